@@ -12,10 +12,15 @@ AC_ARG_ENABLE(wreck,
               [AS_HELP_STRING([--enable-wreck],[Enable support for the Wreck job launcher])],
               [ENABLE_WRECK="true",EXPLICIT_RM="true"])
 
+AC_ARG_ENABLE(flux,
+              [AS_HELP_STRING([--enable-flux],[Enable support for the Flux job launcher])],
+              [ENABLE_FLUX="true",EXPLICIT_RM="true"])
+
 if test "x$EXPLICIT_RM" != "xtrue"; then
    ENABLE_SLURM="true"
    ENABLE_OPENMPI="true"
    ENABLE_WRECK="true"
+   ENABLE_FLUX="true"
 fi
 
 if test "x$ENABLE_SLURM" == "xtrue"; then
@@ -27,4 +32,7 @@ fi
 if test "x$ENABLE_WRECK" == "xtrue"; then
    AC_DEFINE([ENABLE_WRECKRUN_LAUNCHER],[1],[Enable support for srun])
 fi
+if test "x$ENABLE_FLUX" == "xtrue"; then
+   AC_DEFINE([ENABLE_FLUX_LAUNCHER],[1],[Enable support for flux run])
+fi
 
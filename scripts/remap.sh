@@ -38,7 +38,7 @@ int dowork()
 }
 EOF
 
-cat <<EOF | $CCLINE -o $WORKINGDIR/remap$UNIQ -L$WORKINGDIR -lremap$UNIQ -Wl,-rpath,$WORKINGDIR -x c -
+cat <<EOF | $CCLINE -o $WORKINGDIR/remap$UNIQ -x c - -x none -L$WORKINGDIR -lremap$UNIQ -Wl,-rpath,$WORKINGDIR
 extern int dowork();
 int data = 5;
 int main(int argc, char *argv[])
@@ -23,6 +23,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <errno.h>
 #include <stdint.h>
 #include <assert.h>
+#include <time.h>
 
 #include "biterc.h"
 #include "sheep.h"
@@ -494,6 +495,42 @@ int is_heap_blocked(void *session)
    return header->heap_blocked;
 }
 
+static unsigned long now_ms()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((unsigned long) ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void set_handoff(void *session)
+{
+   biterc_session_t *s = (biterc_session_t *) session;
+   biter_header_t *header = &s->shm->shared_header->biter;
+   header->handoff_time = now_ms();
+   header->handed_off = 1;
+}
+
+void clear_handoff(void *session)
+{
+   biterc_session_t *s = (biterc_session_t *) session;
+   biter_header_t *header = &s->shm->shared_header->biter;
+   header->handed_off = 0;
+}
+
+int is_handed_off(void *session)
+{
+   biterc_session_t *s = (biterc_session_t *) session;
+   biter_header_t *header = &s->shm->shared_header->biter;
+   return header->handed_off;
+}
+
+unsigned long handoff_age_ms(void *session)
+{
+   biterc_session_t *s = (biterc_session_t *) session;
+   biter_header_t *header = &s->shm->shared_header->biter;
+   return now_ms() - header->handoff_time;
+}
+
 int get_id(int session_id)
 {
    biterc_session_t *session = sessions + session_id;
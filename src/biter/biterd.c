@@ -338,6 +338,25 @@ int is_heap_blocked(void *session)
    return s->heap_blocked;
 }
 
+/* The daemon never hands messages off (see demultiplex.c) */
+void set_handoff(void *session)
+{
+}
+
+void clear_handoff(void *session)
+{
+}
+
+int is_handed_off(void *session)
+{
+   return 0;
+}
+
+unsigned long handoff_age_ms(void *session)
+{
+   return 0;
+}
+
 
 static int r_aux_fd = -1;
 static int w_aux_fd = -1;
@@ -24,11 +24,28 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <string.h>
 #include <assert.h>
 #include <signal.h>
+#include <sched.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
 
 extern int is_client();
 
+/**
+ * Messages of at least BITER_HANDOFF_SIZE bytes aren't copied through the
+ * shared heap.  The process that reads their header leaves the body in the
+ * pipe and hands the pipe to the target, which reads the body straight into
+ * its own buffer.  If the target hasn't picked it up after
+ * BITER_HANDOFF_TIMEOUT_MS, the next process to get the pipe queues the
+ * message in the heap as usual.  Set BITER_HANDOFF_SIZE to 0 to always queue.
+ **/
+#if !defined(BITER_HANDOFF_SIZE)
+#define BITER_HANDOFF_SIZE 4096
+#endif
+
+#if !defined(BITER_HANDOFF_TIMEOUT_MS)
+#define BITER_HANDOFF_TIMEOUT_MS 10
+#endif
+
 static int dequeue_message(int for_proc, void *msg_data, size_t msg_size, void *session)
 {
    int result, queue_lock_held = 0, read_partial_message;
@@ -191,10 +208,22 @@ static int reliable_write(int fd, const void *buf, size_t size)
 static int check_heap_blocked(void *session, int myid)
 {
    msg_header_t msg;
-   if (!is_heap_blocked(session))
+   if (!is_heap_blocked(session) && !is_handed_off(session))
       return 0;
    get_polled_data(session, &msg);
-   return (myid != msg.msg_target);
+   if (myid == msg.msg_target)
+      return 0;
+   if (is_heap_blocked(session))
+      return 1;
+   return handoff_age_ms(session) < BITER_HANDOFF_TIMEOUT_MS;
+}
+
+static int should_handoff(msg_header_t *msg_header, int may_handoff)
+{
+   //The daemon reads every client's messages itself, so has no one to hand off to
+   if (!is_client())
+      return 0;
+   return BITER_HANDOFF_SIZE && may_handoff && msg_header->msg_size >= BITER_HANDOFF_SIZE;
 }
 
 int demultiplex_read(void *session, int fd, int myid, void *buf, size_t size)
@@ -207,6 +236,7 @@ int demultiplex_read(void *session, int fd, int myid, void *buf, size_t size)
    void *header_space;
    int iter_count = 100000;
    int error_return = -1;
+   int may_handoff;
    
    while (bytes_read < size) {
       if (iter_count == 0)
@@ -249,6 +279,8 @@ int demultiplex_read(void *session, int fd, int myid, void *buf, size_t size)
                goto error;
             }
             have_pipe_lock = 0;
+            //Give the CPU to whoever we're waiting on
+            sched_yield();
             continue;
          }
 
@@ -263,10 +295,21 @@ int demultiplex_read(void *session, int fd, int myid, void *buf, size_t size)
                if (result == 0) {
                   goto eof_error;
                }
+               may_handoff = 1;
             }
             else {
                get_polled_data(session, &msg_header);
                clear_polled_data(session);
+               //Don't hand a message off twice if its target never took it
+               may_handoff = !is_handed_off(session);
+               clear_handoff(session);
+            }
+
+            if (msg_header.msg_target != myid && should_handoff(&msg_header, may_handoff)) {
+               //Leave the body in the pipe for the target to read directly
+               set_polled_data(session, msg_header);
+               set_handoff(session);
+               break;
             }
 
             if (msg_header.msg_target == myid) {
@@ -287,6 +330,14 @@ int demultiplex_read(void *session, int fd, int myid, void *buf, size_t size)
                msg_header.msg_size -= result;
             }
 
+            if (msg_header.msg_size && msg_header.msg_target == myid &&
+                should_handoff(&msg_header, may_handoff)) {
+               //Leave the remainder of our own message in the pipe for our next read
+               set_polled_data(session, msg_header);
+               set_handoff(session);
+               break;
+            }
+
             if (msg_header.msg_size) {
                //Message is for someone else, or is the remainder left over after our read.
                result = get_message_space(msg_header.msg_size, &recv_buf, &header_space, session);
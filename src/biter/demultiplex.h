@@ -43,6 +43,11 @@ extern void set_heap_blocked(void *session);
 extern void set_heap_unblocked(void *session);
 extern int is_heap_blocked(void *session);
 
+extern void set_handoff(void *session);
+extern void clear_handoff(void *session);
+extern int is_handed_off(void *session);
+extern unsigned long handoff_age_ms(void *session);
+
 extern void get_message(int for_proc, void **msg_data, size_t *msg_size, size_t *bytes_read, void *session);
 extern int has_message(int for_proc, void *session);
 extern void rm_message(int for_proc, void *session);
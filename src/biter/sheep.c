@@ -16,7 +16,9 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 unsigned char *sheep_base = NULL;
 static unsigned char *sheep_end = NULL;
@@ -51,16 +53,68 @@ typedef struct block_prefix_t {
 
 static int first_fit = 0; //If 0 then use best-fit malloc, else use first-fit malloc.
 
+/**
+ * Small allocations come from slabs of same-sized objects, which are
+ * carved out of the block heap.  Each object is prefixed by a slab_obj_t,
+ * whose tag overlays the size field of a block_prefix_t.  A block's size
+ * field never has the top bit set, so free_sheep can tell them apart.
+ **/
+#define SLAB_CLASSES 6
+#define SLAB_MIN_SHIFT 4
+#define SLAB_BYTES 4096
+#define SLAB_TAG UINT32_C(0x80000000)
+#define SLAB_CLASS_SHIFT 24
+#define SLAB_VAL_MASK ((UINT32_C(1) << SLAB_CLASS_SHIFT) - 1)
+
+typedef struct slab_t {
+   uint32_t next_slab;
+   uint32_t prev_slab;
+   uint32_t free_obj;
+   uint32_t in_use;
+   uint32_t size_class;
+   uint32_t pad;
+} slab_t;
+
+typedef struct slab_obj_t {
+   uint32_t next_free;
+   uint32_t tag;
+} slab_obj_t;
+
+#define CLASS_SIZE(C) (((size_t) 1) << (SLAB_MIN_SHIFT + (C)))
+#define OBJ_SIZE(C) (CLASS_SIZE(C) + sizeof(slab_obj_t))
+#define SLAB_PTR(X) ((slab_t *) (sheep_base + (((uint64_t) X) << 3)))
+#define OBJ_PTR(X) ((slab_obj_t *) (sheep_base + (((uint64_t) X) << 3)))
+#define IS_SLAB_OBJ(P) (((uint32_t *) (P))[-1] & SLAB_TAG)
+#define OBJ_CLASS(O) (((O)->tag >> SLAB_CLASS_SHIFT) & 0x7f)
+#define OBJ_SLAB(O) SLAB_PTR((O)->tag & SLAB_VAL_MASK)
+
 typedef struct heap_header_t {
    block_prefix_t head_block;
    uint64_t heap_size;
    uint64_t initialized;
+   uint32_t partial_slabs[SLAB_CLASSES]; //Slabs with free objects, per class
 } heap_header_t;
 static heap_header_t *heap_header;
 static block_prefix_t *head_block;
 
 #define ALIGN8(X) (((X) & 7) ? ((((X) >> 3) + 1) << 3) : (X))
 
+/**
+ * Each process keeps a few free slab objects of its own, so the hot
+ * malloc/free paths don't need the heap lock.  These are bounded by bytes,
+ * since objects sitting here are lost to other processes.
+ **/
+#define LOCAL_CACHE_BYTES 1024
+#define LOCAL_CACHE_MAX 16
+static slab_obj_t *local_cache[SLAB_CLASSES][LOCAL_CACHE_MAX];
+static int local_count[SLAB_CLASSES];
+
+static void forget_sheep_local()
+{
+   //The parent still owns anything in its local cache
+   memset(local_count, 0, sizeof(local_count));
+}
+
 void init_sheep(void *mem, size_t size, int use_first_fit)
 {
    block_prefix_t *first_block;
@@ -68,7 +122,10 @@ void init_sheep(void *mem, size_t size, int use_first_fit)
    assert(size % 4096 == 0);
    assert(size < (1 << 25)); //Maximum for shared heap
    first_fit = use_first_fit;
-   
+   assert(sizeof(heap_header_t) % 8 == 0);
+
+   if (!sheep_base)
+      pthread_atfork(NULL, NULL, forget_sheep_local);
 
    heap_header = (heap_header_t *) mem;
    sheep_base = (unsigned char *) mem;
@@ -98,7 +155,7 @@ void init_sheep(void *mem, size_t size, int use_first_fit)
    }
 }
 
-void *malloc_sheep(size_t size)
+static void *block_malloc(size_t size)
 {
    block_prefix_t *cur = NULL, *best_fit = NULL;
    block_prefix_t *prev_free, *next_free, *new_block, *next_block;
@@ -213,7 +270,7 @@ static block_prefix_t *merge_free_blocks(block_prefix_t *a, block_prefix_t *b)
    return a;
 }
 
-void free_sheep(void *p)
+static void block_free(void *p)
 {
    block_prefix_t *cur = ((block_prefix_t *) p) - 1;
    block_prefix_t *prev_free, *next_free, *prev_block, *next_block;
@@ -256,9 +313,194 @@ void free_sheep(void *p)
    } while (changed_something);
 }
 
+static int size_class(size_t size)
+{
+   int c;
+   for (c = 0; c < SLAB_CLASSES; c++) {
+      if (size <= CLASS_SIZE(c))
+         return c;
+   }
+   return -1;
+}
+
+static void slab_link(slab_t *slab)
+{
+   uint32_t *head = heap_header->partial_slabs + slab->size_class;
+   slab->prev_slab = 0;
+   slab->next_slab = *head;
+   if (*head)
+      SLAB_PTR(*head)->prev_slab = VAL(slab);
+   *head = VAL(slab);
+}
+
+static void slab_unlink(slab_t *slab)
+{
+   if (slab->prev_slab)
+      SLAB_PTR(slab->prev_slab)->next_slab = slab->next_slab;
+   else
+      heap_header->partial_slabs[slab->size_class] = slab->next_slab;
+   if (slab->next_slab)
+      SLAB_PTR(slab->next_slab)->prev_slab = slab->prev_slab;
+   slab->next_slab = slab->prev_slab = 0;
+}
+
+static slab_t *new_slab(int c)
+{
+   slab_t *slab;
+   slab_obj_t *obj;
+   unsigned char *objs;
+   uint32_t i, num_objs;
+
+   slab = (slab_t *) block_malloc(SLAB_BYTES);
+   if (!slab)
+      return NULL;
+
+   slab->size_class = c;
+   slab->in_use = 0;
+   slab->free_obj = 0;
+   slab->pad = 0;
+   objs = (unsigned char *) (slab + 1);
+   num_objs = (SLAB_BYTES - sizeof(slab_t)) / OBJ_SIZE(c);
+   for (i = num_objs; i > 0; i--) {
+      obj = (slab_obj_t *) (objs + (i - 1) * OBJ_SIZE(c));
+      obj->tag = SLAB_TAG | (((uint32_t) c) << SLAB_CLASS_SHIFT) | (uint32_t) VAL(slab);
+      obj->next_free = slab->free_obj;
+      slab->free_obj = VAL(obj);
+   }
+   slab_link(slab);
+   return slab;
+}
+
+static slab_obj_t *slab_malloc(int c)
+{
+   slab_t *slab;
+   slab_obj_t *obj;
+
+   if (heap_header->partial_slabs[c])
+      slab = SLAB_PTR(heap_header->partial_slabs[c]);
+   else {
+      slab = new_slab(c);
+      if (!slab)
+         return NULL;
+   }
+
+   obj = OBJ_PTR(slab->free_obj);
+   slab->free_obj = obj->next_free;
+   slab->in_use++;
+   if (!slab->free_obj)
+      slab_unlink(slab);
+   return obj;
+}
+
+static void slab_free(slab_obj_t *obj)
+{
+   slab_t *slab = OBJ_SLAB(obj);
+   int was_full = !slab->free_obj;
+
+   assert(slab->in_use);
+   obj->next_free = slab->free_obj;
+   slab->free_obj = VAL(obj);
+   slab->in_use--;
+   if (was_full)
+      slab_link(slab);
+
+   //Hand empty slabs back to the block heap, but keep the last one of a class
+   if (!slab->in_use && (slab->prev_slab || slab->next_slab)) {
+      slab_unlink(slab);
+      block_free(slab);
+   }
+}
+
+void *malloc_sheep(size_t size)
+{
+   slab_obj_t *obj;
+   int c;
+
+   assert(size);
+   c = size_class(size);
+   if (c != -1) {
+      obj = slab_malloc(c);
+      if (obj)
+         return (void *) (obj + 1);
+      //No room for a new slab.  A block may still fit.
+   }
+   return block_malloc(size);
+}
+
+void free_sheep(void *p)
+{
+   if (IS_SLAB_OBJ(p))
+      slab_free(((slab_obj_t *) p) - 1);
+   else
+      block_free(p);
+}
+
+static int local_limit(int c)
+{
+   int limit = LOCAL_CACHE_BYTES / OBJ_SIZE(c);
+   if (limit > LOCAL_CACHE_MAX)
+      return LOCAL_CACHE_MAX;
+   return limit ? limit : 1;
+}
+
+void *malloc_sheep_local(size_t size)
+{
+   int c = size_class(size ? size : 1);
+   if (c == -1 || !local_count[c])
+      return NULL;
+   return (void *) (local_cache[c][--local_count[c]] + 1);
+}
+
+int free_sheep_local(void *p)
+{
+   slab_obj_t *obj = ((slab_obj_t *) p) - 1;
+   int c;
+
+   if (!IS_SLAB_OBJ(p))
+      return -1;
+   c = OBJ_CLASS(obj);
+   if (local_count[c] >= local_limit(c))
+      return -1;
+   local_cache[c][local_count[c]++] = obj;
+   return 0;
+}
+
+void fill_sheep_local(size_t size)
+{
+   slab_obj_t *obj;
+   int c = size_class(size ? size : 1);
+   int target;
+
+   if (c == -1)
+      return;
+   //Leave room for frees
+   target = (local_limit(c) + 1) / 2;
+   while (local_count[c] < target) {
+      obj = slab_malloc(c);
+      if (!obj)
+         return;
+      local_cache[c][local_count[c]++] = obj;
+   }
+}
+
+void flush_sheep_local()
+{
+   int c;
+   for (c = 0; c < SLAB_CLASSES; c++) {
+      while (local_count[c])
+         slab_free(local_cache[c][--local_count[c]]);
+   }
+}
+
 size_t sheep_alloc_size(size_t size)
 {
    size_t alloc_size;
+   int c;
+
+   c = size_class(size ? size : 1);
+   if (c != -1)
+      return OBJ_SIZE(c);
+
    alloc_size = ALIGN8(size);
    if (!alloc_size)
       alloc_size = 8;
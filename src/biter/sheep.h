@@ -53,6 +53,20 @@ extern void *malloc_sheep(size_t size);
 extern void free_sheep(void *p);
 extern size_t sheep_alloc_size(size_t size);
 
+/**
+ * Per-process caches of small objects.  malloc_sheep_local and
+ * free_sheep_local don't touch the shared heap, and so don't need it
+ * serialized.  They return NULL/-1 if the object should go through
+ * malloc_sheep/free_sheep instead.  fill_sheep_local tops up the cache
+ * for size, and flush_sheep_local returns every cached object to the
+ * heap.  Those two do need the heap serialized.  Call flush_sheep_local
+ * before a process exits or execs, or its cached objects are lost.
+ **/
+extern void *malloc_sheep_local(size_t size);
+extern int free_sheep_local(void *p);
+extern void fill_sheep_local(size_t size);
+extern void flush_sheep_local();
+
 #ifdef __GNUC__
 #define UNUSED_ATTR __attribute__((unused))
 #else
@@ -39,6 +39,8 @@ typedef struct {
    msg_header_t polled_data;
    int has_polled_data;
    int heap_blocked;
+   int handed_off;
+   unsigned long handoff_time;
    int max_rank;
    int num_ranks;
    int read_file;
@@ -52,6 +54,10 @@ typedef struct {
    sheep_ptr_t lru_head;
    sheep_ptr_t lru_end;
    size_t heap_used;
+   size_t num_entries;
+   unsigned long hits;
+   unsigned long misses;
+   unsigned long waits;
 } shmcache_header_t;
 
 typedef struct {
@@ -21,6 +21,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "client.h"
 #include "auditclient.h"
 #include "ldcs_api.h"
+#include "quiesce.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -40,13 +41,35 @@ void spindle_la_activity (uintptr_t *cookie, unsigned int flag)
    return;
 }
 
+/* The cookie is ours to fill in, so hold the object's PLT relocations there
+   rather than searching its dynamic section on every binding */
+static void *find_plt_relocs(struct link_map *map)
+{
+   ElfW(Dyn) *dynamic_section;
+
+   for (dynamic_section = map->l_ld; dynamic_section->d_tag != DT_NULL; dynamic_section++) {
+      if (dynamic_section->d_tag == DT_JMPREL)
+         return (void *) dynamic_section->d_un.d_ptr;
+   }
+   return NULL;
+}
+
+void *get_plt_relocs_from_cookie(uintptr_t *cookie)
+{
+   return (void *) *cookie;
+}
+
 unsigned int spindle_la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie)
 {
    patch_on_linkactivity(map);
+   bindhints_objopen(map, lmid);
+   *cookie = (uintptr_t) find_plt_relocs(map);
    return LA_FLG_BINDTO | LA_FLG_BINDFROM;
 }
 
 unsigned int spindle_la_objclose(uintptr_t *cookie)
 {
+   bindhints_objclose(cookie);
+   quiesce_forget(get_linkmap_from_cookie(cookie));
    return 0;
 }
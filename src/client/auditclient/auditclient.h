@@ -27,6 +27,11 @@ struct link_map *get_linkmap_from_cookie(uintptr_t *cookie);
 void patch_on_linkactivity(struct link_map *lmap);
 ElfX_Addr client_call_binding(const char *symname, ElfX_Addr symvalue);
 struct link_map *get_linkmap_from_cookie(uintptr_t *cookie);
+void *get_plt_relocs_from_cookie(uintptr_t *cookie);
+void bindhints_objopen(struct link_map *map, Lmid_t lmid);
+void bindhints_binding(uintptr_t *refcook, uintptr_t *defcook, unsigned long reloc_index,
+                       const char *symname, ElfW(Sym) *sym, ElfW(Addr) target);
+void bindhints_objclose(uintptr_t *cookie);
 
 #define AUDIT_EXPORT __attribute__((__visibility__("default")))
 
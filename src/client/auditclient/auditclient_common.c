@@ -22,6 +22,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "auditclient.h"
 #include "ldcs_api.h"
 #include "intercept.h"
+#include "client_timing.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -48,7 +49,17 @@ unsigned int la_version(unsigned int version)
    return spindle_la_version(version);
 }
 
+static char *objsearch(const char *name, uintptr_t *cookie, unsigned int flag);
+
 char *la_objsearch(const char *name, uintptr_t *cookie, unsigned int flag)
+{
+   uint64_t start = timing_start();
+   char *result = objsearch(name, cookie, flag);
+   timing_end(CLIENT_TIMING_OBJSEARCH, start);
+   return result;
+}
+
+static char *objsearch(const char *name, uintptr_t *cookie, unsigned int flag)
 {
    debug_printf3("la_objsearch(): name = %s; cookie = %p; flag = %s\n", name, cookie,
                  (flag == LA_SER_ORIG) ?    "LA_SER_ORIG" :
@@ -61,6 +72,11 @@ char *la_objsearch(const char *name, uintptr_t *cookie, unsigned int flag)
 
    /* check if direct name given --> return name  */
    if (!strchr(name, '/')) {
+      if (flag == LA_SER_ORIG && cookie_shift) {
+         char *result = client_library_search(name, (struct link_map *) (((unsigned char *) cookie) + cookie_shift));
+         if (result)
+            return result;
+      }
       debug_printf3("Returning direct name %s after input %s\n", name, name);
       return (char *) name;
    }
@@ -103,6 +119,10 @@ unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie)
       debug_printf3("Set cookie_shift to %ld\n", (unsigned long) shift);
    }
 
+   if (lmid == LM_ID_BASE)
+      client_prefetch_deps(map);
+   client_prefault(map);
+
    return spindle_la_objopen(map, lmid, cookie);
 }
 
@@ -22,6 +22,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "client.h"
 #include "auditclient.h"
 #include "spindle_debug.h"
+#include "quiesce.h"
 
 #if _CALL_ELF != 2
 // v1 ABI
@@ -179,6 +180,7 @@ static Elf64_Addr doPermanentBinding(uintptr_t *refcook, uintptr_t *defcook,
    rel = rels + plt_reloc_idx;
 
    got_entry = (Elf64_Addr *) (rel->r_offset + base);
+   quiesce_track(rmap, got_entry, symname);
 
 #if _CALL_ELF != 2
    func = (struct ppc64_funcptr_t *) target;
@@ -15,6 +15,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
 #include "auditclient.h"
+#include "quiesce.h"
 #include <stdlib.h>
 
 Elf64_Addr la_x86_64_gnu_pltenter(Elf64_Sym *sym, unsigned int ndx,
@@ -23,23 +24,22 @@ Elf64_Addr la_x86_64_gnu_pltenter(Elf64_Sym *sym, unsigned int ndx,
                                   const char *symname, long int *framesizep) AUDIT_EXPORT;
 
 
-static Elf64_Addr doPermanentBinding(struct link_map *map,
+static Elf64_Addr doPermanentBinding(uintptr_t *refcook,
                                      unsigned long plt_reloc_idx,
-                                     Elf64_Addr target)
+                                     Elf64_Addr target,
+                                     const char *symname,
+                                     Elf64_Addr symvalue)
 {
-   Elf64_Dyn *dynamic_section = map->l_ld;
-   Elf64_Rela *rel = NULL;
+   Elf64_Rela *rels = (Elf64_Rela *) get_plt_relocs_from_cookie(refcook);
    Elf64_Addr *got_entry;
-   Elf64_Addr base = map->l_addr;
-   for (; dynamic_section->d_tag != DT_NULL; dynamic_section++) {
-      if (dynamic_section->d_tag == DT_JMPREL) {
-         rel = ((Elf64_Rela *) dynamic_section->d_un.d_ptr) + plt_reloc_idx;
-         break;
-      }
-   }
-   if (!rel)
+   struct link_map *rmap;
+
+   if (!rels)
       return target;
-   got_entry = (Elf64_Addr *) (rel->r_offset + base);
+   rmap = get_linkmap_from_cookie(refcook);
+   got_entry = (Elf64_Addr *) (rels[plt_reloc_idx].r_offset + rmap->l_addr);
+   if (target != symvalue)
+      quiesce_track(rmap, got_entry, symname);
    *got_entry = target;
    return target;
 }
@@ -53,9 +53,9 @@ Elf64_Addr la_x86_64_gnu_pltenter(Elf64_Sym *sym,
                                   const char *symname,
                                   long int *framesizep)
 {
-   struct link_map *map = get_linkmap_from_cookie(refcook);
    unsigned long reloc_index = *((unsigned long *) (regs->lr_rsp-8));
    Elf64_Addr target = client_call_binding(symname, sym->st_value);
-   return doPermanentBinding(map, reloc_index, target);
+   bindhints_binding(refcook, defcook, reloc_index, symname, sym, target);
+   return doPermanentBinding(refcook, reloc_index, target, symname, sym->st_value);
 }
 
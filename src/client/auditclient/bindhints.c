@@ -0,0 +1,311 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "client.h"
+#include "auditclient.h"
+#include "spindle_debug.h"
+#include "spindle_launch.h"
+#include "ldcs_api.h"
+#include "quiesce.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/**
+ * With OPT_BINDHINTS, the PLT bindings ld.so resolves for one process are
+ * kept as a resolution map in the location, and the node's later
+ * processes with the same objects loaded apply the map at their first
+ * binding.  The GOT entries of every binding in it then point straight
+ * at their definitions, so those calls never go through ld.so's symbol
+ * lookup or our pltenter.
+ *
+ * A map is named for a hash of the objects' staged names and dynamic
+ * section offsets, in the order they were opened, and records each
+ * binding as the index of the object that made it, its PLT relocation,
+ * and the index of the object defining the symbol and the symbol's
+ * offset in it.  The first process to find no map for its objects takes
+ * a lock file and learns it, and writes it when it exits.  Bindings we
+ * redirect, IFUNCs, whose target depends on the CPU, and errno's
+ * location, which we need to see bound, are left out.
+ **/
+
+#define BINDHINTS_MAGIC 0x484e4442
+#define BINDHINTS_VERSION 1
+#define MAX_BINDHINT_OBJS 4096
+#define MAX_BINDHINTS (32*1024)
+#define BINDHINT_HASH_SIZE (2*MAX_BINDHINT_OBJS)
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t num_objs;
+   uint32_t num_entries;
+} bindhints_header_t;
+
+typedef struct {
+   uint32_t ref;
+   uint32_t def;
+   uint32_t reloc;
+   uint32_t pad;
+   uint64_t offset;
+} bindhint_t;
+
+typedef enum {
+   BINDHINTS_UNSET,
+   BINDHINTS_STARTING,
+   BINDHINTS_LEARNING,
+   BINDHINTS_DONE
+} bindhints_state_t;
+
+extern char *location;
+
+static struct link_map *objs[MAX_BINDHINT_OBJS];
+static int num_objs = 0, sig_objs = 0;
+static struct link_map *obj_hash[BINDHINT_HASH_SIZE];
+static int obj_hash_index[BINDHINT_HASH_SIZE];
+
+static volatile int state = BINDHINTS_UNSET;
+static bindhint_t hints[MAX_BINDHINTS];
+static volatile int num_hints = 0;
+static char map_path[MAX_PATH_LEN+1];
+
+static unsigned int obj_hash_slot(struct link_map *map)
+{
+   return (unsigned int) ((((uintptr_t) map) >> 4) * 2654435761U) % BINDHINT_HASH_SIZE;
+}
+
+void bindhints_objopen(struct link_map *map, Lmid_t lmid)
+{
+   unsigned int slot;
+
+   if (!(opts & OPT_BINDHINTS) || lmid != LM_ID_BASE || num_objs == MAX_BINDHINT_OBJS)
+      return;
+   for (slot = obj_hash_slot(map); obj_hash[slot]; slot = (slot + 1) % BINDHINT_HASH_SIZE);
+   obj_hash[slot] = map;
+   obj_hash_index[slot] = num_objs;
+   objs[num_objs++] = map;
+}
+
+/* The index of map among the objects the map was named for, or -1 */
+static int obj_index(struct link_map *map)
+{
+   unsigned int slot;
+
+   for (slot = obj_hash_slot(map); obj_hash[slot]; slot = (slot + 1) % BINDHINT_HASH_SIZE) {
+      if (obj_hash[slot] == map)
+         return obj_hash_index[slot] < sig_objs ? obj_hash_index[slot] : -1;
+   }
+   return -1;
+}
+
+static uint64_t objs_signature()
+{
+   uint64_t hash = 14695981039346656037ULL;
+   const char *c;
+   uintptr_t dynoff;
+   int i, j;
+
+   for (i = 0; i < num_objs; i++) {
+      for (c = objs[i]->l_name ? objs[i]->l_name : ""; ; c++) {
+         hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+         if (!*c)
+            break;
+      }
+      /* A rebuilt library that kept its name has moved its dynamic section */
+      dynoff = ((uintptr_t) objs[i]->l_ld) - objs[i]->l_addr;
+      for (j = 0; j < (int) sizeof(dynoff); j++, dynoff >>= 8)
+         hash = (hash ^ (dynoff & 0xff)) * 1099511628211ULL;
+   }
+   return hash;
+}
+
+static ElfW(Rela) *plt_relocs(struct link_map *map, size_t *count)
+{
+   ElfW(Dyn) *dyn;
+   ElfW(Rela) *rels = NULL;
+   size_t size = 0;
+
+   for (dyn = map->l_ld; dyn->d_tag != DT_NULL; dyn++) {
+      if (dyn->d_tag == DT_JMPREL)
+         rels = (ElfW(Rela) *) dyn->d_un.d_ptr;
+      else if (dyn->d_tag == DT_PLTRELSZ)
+         size = dyn->d_un.d_val;
+      else if (dyn->d_tag == DT_PLTREL && dyn->d_un.d_val != DT_RELA)
+         return NULL;
+   }
+   *count = size / sizeof(ElfW(Rela));
+   return rels;
+}
+
+static int read_all(int fd, void *buffer, size_t size)
+{
+   ssize_t result;
+   size_t pos = 0;
+
+   while (pos < size) {
+      result = read(fd, ((char *) buffer) + pos, size - pos);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         return -1;
+      pos += result;
+   }
+   return 0;
+}
+
+static void apply_hints(int fd)
+{
+   bindhints_header_t header;
+   bindhint_t entries[256];
+   ElfW(Rela) *rels;
+   ElfW(Addr) *got;
+   size_t num_rels;
+   uint32_t remaining, count, i, applied = 0;
+
+   if (read_all(fd, &header, sizeof(header)) == -1 || header.magic != BINDHINTS_MAGIC ||
+       header.version != BINDHINTS_VERSION || header.num_objs != (uint32_t) sig_objs) {
+      debug_printf("Resolution map %s doesn't match our objects, not using it\n", map_path);
+      return;
+   }
+   for (remaining = header.num_entries; remaining; remaining -= count) {
+      count = remaining < 256 ? remaining : 256;
+      if (read_all(fd, entries, count * sizeof(bindhint_t)) == -1) {
+         debug_printf("Resolution map %s is short\n", map_path);
+         break;
+      }
+      for (i = 0; i < count; i++) {
+         if (entries[i].ref >= (uint32_t) sig_objs || entries[i].def >= (uint32_t) sig_objs)
+            continue;
+         rels = plt_relocs(objs[entries[i].ref], &num_rels);
+         if (!rels || entries[i].reloc >= num_rels)
+            continue;
+         got = (ElfW(Addr) *) (objs[entries[i].ref]->l_addr + rels[entries[i].reloc].r_offset);
+         *got = objs[entries[i].def]->l_addr + entries[i].offset;
+         applied++;
+      }
+   }
+   debug_printf("Bound %u of %u PLT entries from resolution map %s\n", applied, header.num_entries, map_path);
+}
+
+/* On a process's first binding, apply the map for its objects, or learn it */
+static void start_hints()
+{
+   char lock_path[MAX_PATH_LEN+1];
+   int fd;
+
+   sig_objs = num_objs;
+   if (snprintf(map_path, sizeof(map_path), "%s/bindhints-%016llx", location,
+                (unsigned long long) objs_signature()) >= (int) sizeof(map_path) ||
+       snprintf(lock_path, sizeof(lock_path), "%s.learn", map_path) >= (int) sizeof(lock_path)) {
+      debug_printf("Location %s is too long for resolution maps\n", location);
+      state = BINDHINTS_DONE;
+      return;
+   }
+
+   fd = open(map_path, O_RDONLY | O_CLOEXEC);
+   if (fd != -1) {
+      apply_hints(fd);
+      close(fd);
+      state = BINDHINTS_DONE;
+      return;
+   }
+
+   fd = open(lock_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+   if (fd == -1) {
+      debug_printf3("Another process is learning resolution map %s\n", map_path);
+      state = BINDHINTS_DONE;
+      return;
+   }
+   close(fd);
+   debug_printf("Learning resolution map %s for %d objects\n", map_path, sig_objs);
+   state = BINDHINTS_LEARNING;
+}
+
+void bindhints_binding(uintptr_t *refcook, uintptr_t *defcook, unsigned long reloc_index,
+                       const char *symname, ElfW(Sym) *sym, ElfW(Addr) target)
+{
+   struct link_map *def;
+   int ref_index, def_index, slot;
+
+   if (state == BINDHINTS_UNSET) {
+      if (!(opts & OPT_BINDHINTS) || !num_objs ||
+          !__sync_bool_compare_and_swap(&state, BINDHINTS_UNSET, BINDHINTS_STARTING))
+         return;
+      start_hints();
+   }
+   /* What's bound after quiescing would have other processes skip our
+      wrappers from their start */
+   if (state != BINDHINTS_LEARNING || quiesced)
+      return;
+
+   if (target != sym->st_value || ELF64_ST_TYPE(sym->st_info) == STT_GNU_IFUNC ||
+       strcmp(symname, ERRNO_NAME) == 0)
+      return;
+   ref_index = obj_index(get_linkmap_from_cookie(refcook));
+   def = get_linkmap_from_cookie(defcook);
+   def_index = obj_index(def);
+   if (ref_index == -1 || def_index == -1)
+      return;
+
+   slot = __sync_fetch_and_add(&num_hints, 1);
+   if (slot >= MAX_BINDHINTS)
+      return;
+   hints[slot].ref = ref_index;
+   hints[slot].def = def_index;
+   hints[slot].reloc = reloc_index;
+   hints[slot].pad = 0;
+   hints[slot].offset = sym->st_value - def->l_addr;
+}
+
+/* Write what we learned, as the process exits and closes its executable */
+void bindhints_objclose(uintptr_t *cookie)
+{
+   char tmp_path[MAX_PATH_LEN+1];
+   bindhints_header_t header;
+   int fd, result;
+
+   if (state != BINDHINTS_LEARNING || get_linkmap_from_cookie(cookie) != objs[0])
+      return;
+   state = BINDHINTS_DONE;
+
+   header.magic = BINDHINTS_MAGIC;
+   header.version = BINDHINTS_VERSION;
+   header.num_objs = sig_objs;
+   header.num_entries = num_hints < MAX_BINDHINTS ? num_hints : MAX_BINDHINTS;
+
+   if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", map_path, (int) getpid()) >= (int) sizeof(tmp_path)) {
+      debug_printf("Resolution map path %s is too long to write\n", map_path);
+      return;
+   }
+   fd = open(tmp_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+   if (fd == -1) {
+      debug_printf("Could not create resolution map %s: %s\n", tmp_path, strerror(errno));
+      return;
+   }
+   result = (write(fd, &header, sizeof(header)) == (ssize_t) sizeof(header) &&
+             write(fd, hints, header.num_entries * sizeof(bindhint_t)) ==
+             (ssize_t) (header.num_entries * sizeof(bindhint_t))) ? 0 : -1;
+   close(fd);
+   if (result == -1 || rename(tmp_path, map_path) == -1) {
+      debug_printf("Could not write resolution map %s: %s\n", map_path, strerror(errno));
+      unlink(tmp_path);
+      return;
+   }
+   debug_printf("Wrote resolution map %s with %u bindings\n", map_path, header.num_entries);
+}
@@ -17,6 +17,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "intercept.h"
 #include "client.h"
 #include "spindle_debug.h"
+#include "quiesce.h"
 
 #include <string.h>
 #include <elf.h>
@@ -36,9 +37,11 @@ ElfX_Addr client_call_binding(const char *symname, ElfX_Addr symvalue)
    if (!binding)
       return symvalue;
 
-   if (*binding->libc_func == NULL)
+   if (binding->libc_func && *binding->libc_func == NULL)
       *binding->libc_func = (void *) symvalue;
-   
+   if (quiesce_skips(binding))
+      return symvalue;
+
    return (ElfX_Addr) binding->spindle_func;
 }
 
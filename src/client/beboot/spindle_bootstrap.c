@@ -25,6 +25,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 
 #include "spindle_debug.h"
 #include "ldcs_api.h"
@@ -58,16 +59,22 @@ static char *client_lib;
 static char *opts_s;
 static char **daemon_args;
 static char *cachesize_s;
+static char *container_image;
+static char *attach_dir;
 
 opt_t opts;
 
 char libstr_socket_subaudit[] = PROGLIBDIR "/libspindle_subaudit_socket.so";
 char libstr_pipe_subaudit[] = PROGLIBDIR "/libspindle_subaudit_pipe.so";
 char libstr_biter_subaudit[] = PROGLIBDIR "/libspindle_subaudit_biter.so";
+char libstr_shmem_subaudit[] = PROGLIBDIR "/libspindle_subaudit_shmem.so";
 
 char libstr_socket_audit[] = PROGLIBDIR "/libspindle_audit_socket.so";
 char libstr_pipe_audit[] = PROGLIBDIR "/libspindle_audit_pipe.so";
 char libstr_biter_audit[] = PROGLIBDIR "/libspindle_audit_biter.so";
+char libstr_shmem_audit[] = PROGLIBDIR "/libspindle_audit_shmem.so";
+
+char pyimport_dir[] = PROGLIBDIR "/python";
 
 #if defined(COMM_SOCKET)
 static char *default_audit_libstr = libstr_socket_audit;
@@ -78,6 +85,9 @@ static char *default_subaudit_libstr = libstr_pipe_subaudit;
 #elif defined(COMM_BITER)
 static char *default_audit_libstr = libstr_biter_audit;
 static char *default_subaudit_libstr = libstr_biter_subaudit;
+#elif defined(COMM_SHMEM)
+static char *default_audit_libstr = libstr_shmem_audit;
+static char *default_subaudit_libstr = libstr_shmem_subaudit;
 #else
 #error Unknown connection type
 #endif
@@ -88,18 +98,38 @@ extern char *parse_location(char *loc);
 static int establish_connection()
 {
    debug_printf2("Opening connection to server\n");
+   if (opts & OPT_EARLYLAUNCH)
+      client_connect_wait = CLIENT_EARLY_CONNECT_WAIT;
    ldcsid = client_open_connection(location, number);
    if (ldcsid == -1) 
       return -1;
 
-   send_cwd(ldcsid);
-   send_pid(ldcsid);
-   send_location(ldcsid, location);
-   send_rankinfo_query(ldcsid, &rankinfo[0], &rankinfo[1], &rankinfo[2], &rankinfo[3]);      
+   send_hello(ldcsid, location, HELLO_CWD | HELLO_RANKINFO, rankinfo);
 
    return 0;
 }
 
+/**
+ * With OPT_SELFSTAGE the intercept library was sent through the tree with
+ * the audit library, so preload the staged copy
+ **/
+static char *get_interceptlib()
+{
+   char *interceptlib = NULL;
+   int errorcode;
+
+   if (!(opts & OPT_SELFSTAGE) || !(opts & OPT_RELOCAOUT))
+      return spindle_interceptlib;
+   send_file_query(ldcsid, spindle_interceptlib, &interceptlib, &errorcode);
+   use_numa_replica(&interceptlib);
+   if (!interceptlib) {
+      err_printf("Failed to relocate intercept library %s\n", spindle_interceptlib);
+      return spindle_interceptlib;
+   }
+   debug_printf("Relocated intercept library %s to %s\n", spindle_interceptlib, interceptlib);
+   return interceptlib;
+}
+
 static void setup_environment()
 {
    char rankinfo_str[256];
@@ -120,7 +150,7 @@ static void setup_environment()
    setenv("LDCS_CACHESIZE", cachesize_s, 1);
    setenv("LDCS_BOOTSTRAPPED", "1", 1);
    if (opts & OPT_SUBAUDIT) {
-      char *preload_str = spindle_interceptlib;
+      char *preload_str = get_interceptlib();
       char *preload_env = getenv("LD_PRELOAD");
       char *preload;
       if (preload_env) {
@@ -137,11 +167,34 @@ static void setup_environment()
          free(preload);
       }
    }  
+   if (opts & OPT_PYIMPORT) {
+      /* Python runs the sitecustomize there, which installs spindle_import */
+      char *pypath_env = getenv("PYTHONPATH");
+      char *pypath;
+      if (pypath_env && *pypath_env) {
+         size_t len = strlen(pyimport_dir) + strlen(pypath_env) + 2;
+         pypath = malloc(len);
+         snprintf(pypath, len, "%s:%s", pyimport_dir, pypath_env);
+         setenv("PYTHONPATH", pypath, 1);
+         free(pypath);
+      }
+      else {
+         setenv("PYTHONPATH", pyimport_dir, 1);
+      }
+   }
 }
 
 static int parse_cmdline(int argc, char *argv[])
 {
    int i, daemon_arg_count;
+
+   /* spindle --attach gives the directory to find a server's attach record in */
+   if (argc >= 4 && strcmp(argv[1], "-attach") == 0) {
+      attach_dir = argv[2];
+      cmdline = argv + 3;
+      return 0;
+   }
+
    if (argc < 5)
       return -1;
    
@@ -155,12 +208,21 @@ static int parse_cmdline(int argc, char *argv[])
          daemon_args[i - 3] = argv[i];
       daemon_args[i - 3] = NULL;
    }
+   /* A session step's processes tell their server which step they're in */
+   if (i + 1 < argc && strcmp(argv[i], "-step") == 0) {
+      setenv("LDCS_STEP", argv[i + 1], 1);
+      i += 2;
+   }
+   if (i + 1 < argc && strcmp(argv[i], "-image") == 0) {
+      container_image = argv[i + 1];
+      i += 2;
+   }
 
    location = argv[i++];
    number_s = argv[i++];
    number = atoi(number_s);
    opts_s = argv[i++];
-   opts = atol(opts_s);
+   opts = strtoull(opts_s, NULL, 10);
    cachesize_s = argv[i++];
    cachesize = atoi(cachesize_s);
    cmdline = argv + i;
@@ -169,6 +231,119 @@ static int parse_cmdline(int argc, char *argv[])
    return 0;
 }
 
+/**
+ * Read an attach record, and return 0 if its server is still running.
+ * Records sit in a directory that's usually shared with other users, so
+ * only a regular file of our own naming a server we can signal is taken.
+ **/
+static char *attach_fields[5];
+
+static int read_attach_record(char *path)
+{
+   FILE *f;
+   struct stat buf;
+   char line[MAX_PATH_LEN+1];
+   char *fields[5];
+   int i, j, pid, fd;
+
+   fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+   if (fd == -1)
+      return -1;
+   if (fstat(fd, &buf) == -1 || !S_ISREG(buf.st_mode) || buf.st_uid != getuid()) {
+      debug_printf("Skipping attach record %s, which isn't a file of ours\n", path);
+      close(fd);
+      return -1;
+   }
+   f = fdopen(fd, "r");
+   if (!f) {
+      close(fd);
+      return -1;
+   }
+   for (i = 0; i < 5; i++) {
+      if (!fgets(line, sizeof(line), f))
+         break;
+      line[strcspn(line, "\n")] = '\0';
+      fields[i] = strdup(line);
+   }
+   fclose(f);
+   if (i < 5) {
+      debug_printf("Attach record %s is incomplete\n", path);
+      goto error;
+   }
+
+   /* EPERM means the pid is now someone else's process */
+   pid = atoi(fields[0]);
+   if (pid <= 0 || kill(pid, 0) == -1) {
+      debug_printf("Server %d of attach record %s is gone\n", pid, path);
+      goto error;
+   }
+
+   for (j = 0; j < 5; j++) {
+      free(attach_fields[j]);
+      attach_fields[j] = fields[j];
+   }
+   number_s = fields[1];
+   number = atoi(number_s);
+   opts_s = fields[2];
+   opts = strtoull(opts_s, NULL, 10);
+   cachesize_s = fields[3];
+   cachesize = atoi(cachesize_s);
+   location = fields[4];
+   return 0;
+
+  error:
+   for (j = 0; j < i; j++)
+      free(fields[j]);
+   return -1;
+}
+
+/**
+ * Find the server to attach to from the records in dir: the newest one
+ * whose server is still running.
+ **/
+static int find_attach_record(char *dir)
+{
+   DIR *d;
+   struct dirent *ent;
+   struct stat buf;
+   char path[MAX_PATH_LEN+1], best[MAX_PATH_LEN+1];
+   time_t best_time = 0;
+   size_t prefix_len = strlen(ATTACH_RECORD_PREFIX);
+
+   dir = parse_location(dir);
+   if (!dir)
+      return -1;
+   d = opendir(dir);
+   if (!d) {
+      err_printf("Could not open %s to look for a server to attach to: %s\n", dir, strerror(errno));
+      return -1;
+   }
+   best[0] = '\0';
+   while ((ent = readdir(d)) != NULL) {
+      if (strncmp(ent->d_name, ATTACH_RECORD_PREFIX, prefix_len) != 0 ||
+          strspn(ent->d_name + prefix_len, "0123456789") != strlen(ent->d_name + prefix_len))
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+      if (lstat(path, &buf) == -1 || !S_ISREG(buf.st_mode) || buf.st_uid != getuid() ||
+          (best[0] && buf.st_mtime <= best_time))
+         continue;
+      if (read_attach_record(path) == -1)
+         continue;
+      strncpy(best, path, sizeof(best));
+      best_time = buf.st_mtime;
+   }
+   closedir(d);
+
+   if (!best[0]) {
+      err_printf("No running Spindle server to attach to in %s\n", dir);
+      return -1;
+   }
+   /* A later record may have been read after the best one */
+   read_attach_record(best);
+   debug_printf("Attaching to server %s at %s\n", number_s, location);
+   return 0;
+}
+
 static void launch_daemon(char *location)
 {
    /*grand-child fork, then execv daemon.  By grand-child forking we ensure that
@@ -217,6 +392,127 @@ static void launch_daemon(char *location)
    }
 }
 
+static int names_container_image(char *arg)
+{
+   char *base, *image_base, *path;
+   int result;
+
+   if (strcmp(arg, container_image) == 0)
+      return 1;
+   base = strrchr(arg, '/');
+   image_base = strrchr(container_image, '/');
+   if (strcmp(base ? base + 1 : arg, image_base ? image_base + 1 : container_image) != 0)
+      return 0;
+   path = realpath(arg, NULL);
+   if (!path)
+      return 0;
+   result = (strcmp(path, container_image) == 0);
+   free(path);
+   return result;
+}
+
+/**
+ * Have the container image staged on this node by the servers, which
+ * read it once off the shared file system and send it down the tree, and
+ * point the container runtime at the local copy.  Without OPT_RELOCAOUT
+ * we don't otherwise talk to the server, so open a connection just for
+ * the image, without taking a rank.
+ **/
+static void stage_container_image()
+{
+   char *local_image = NULL;
+   char **arg;
+   int errcode = 0, connected = (opts & OPT_RELOCAOUT), connid = ldcsid;
+
+   if (!container_image)
+      return;
+
+   if (!connected) {
+      if (opts & OPT_EARLYLAUNCH)
+         client_connect_wait = CLIENT_EARLY_CONNECT_WAIT;
+      connid = client_open_connection(location, number);
+      if (connid == -1) {
+         err_printf("Could not connect to server to stage container image %s\n", container_image);
+         return;
+      }
+      send_hello(connid, location, HELLO_CWD, NULL);
+   }
+
+   debug_printf2("Sending request for container image %s\n", container_image);
+   send_file_query(connid, container_image, &local_image, &errcode);
+
+   if (!connected) {
+      send_end(connid);
+      client_close_connection(connid);
+   }
+
+   if (!local_image) {
+      err_printf("Failed to stage container image %s: %s\n", container_image, strerror(errcode));
+      return;
+   }
+   debug_printf("Staged container image %s to %s\n", container_image, local_image);
+
+   for (arg = cmdline; *arg; arg++) {
+      if (names_container_image(*arg))
+         *arg = local_image;
+   }
+   setenv("SPINDLE_CONTAINER_IMAGE", local_image, 1);
+}
+
+static int add_batch_entry(char *query, int len, const char *dir, const char *file)
+{
+   int entry_len;
+
+   entry_len = snprintf(query + len, LDCS_MAX_MSG_LEN - len, "%s%s%s", dir ? dir : "", dir ? "/" : "", file);
+   if (entry_len < 0 || entry_len > MAX_PATH_LEN || len + entry_len + 2 > LDCS_MAX_MSG_LEN)
+      return len;
+   len += entry_len + 1;
+   query[len++] = '\0';
+   return len;
+}
+
+/**
+ * Before asking for them one at a time, tell the server every file the
+ * bootstrap will want: the executable wherever PATH might find it, and
+ * the client library.  Each candidate is its own group in one batch
+ * query, so the server sends a single combined request up the tree for
+ * all of them and the directories they're in, and the queries that
+ * follow are answered from its cache rather than each waiting on a
+ * trip to the parent.
+ *
+ * This is a hint rather than one combined bootstrap exchange.  Once the
+ * batch has fetched the files, the queries after it only cost a round
+ * trip to the local server each.  The interpreter of a script can't be
+ * named until the executable is local anyway.
+ **/
+static void send_bootstrap_batch()
+{
+   static char query[LDCS_MAX_MSG_LEN];
+   char *path, *cur, *saveptr = NULL;
+   int len = 0;
+
+   if (!(opts & OPT_RELOCAOUT))
+      return;
+
+   if (*cmdline && !(opts & OPT_REMAPEXEC)) {
+      path = getenv("PATH");
+      if (strchr(*cmdline, '/') || !path) {
+         len = add_batch_entry(query, len, NULL, *cmdline);
+      }
+      else {
+         path = strdup(path);
+         for (cur = strtok_r(path, ":", &saveptr); cur; cur = strtok_r(NULL, ":", &saveptr))
+            len = add_batch_entry(query, len, cur, *cmdline);
+         free(path);
+      }
+   }
+   len = add_batch_entry(query, len, NULL,
+                         (opts & OPT_SUBAUDIT) ? default_subaudit_libstr : default_audit_libstr);
+
+   debug_printf2("Sending bootstrap batch query of %d bytes\n", len);
+   send_file_query_batch(ldcsid, query, len);
+}
+
 static void get_executable()
 {
    int errcode = 0;
@@ -270,6 +566,7 @@ static void get_clientlib()
    }
 
    send_file_query(ldcsid, default_libstr, &client_lib, &errorcode);
+   use_numa_replica(&client_lib);
    if (client_lib == NULL) {
       client_lib = default_libstr;
       err_printf("Failed to relocate client library %s\n", default_libstr);
@@ -314,7 +611,11 @@ int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct
 
 int get_relocated_file(int fd, const char *name, char** newname, int *errcode)
 {
-   return send_file_query(fd, (char *) name, newname, errcode);
+   int result;
+
+   result = send_file_query(fd, (char *) name, newname, errcode);
+   use_numa_replica(newname);
+   return result;
 }
 
 /**
@@ -380,6 +681,10 @@ int main(int argc, char *argv[])
       fprintf(stderr, "spindle_boostrap cannot be invoked directly\n");
       return -1;
    }
+   if (attach_dir && find_attach_record(attach_dir) == -1) {
+      fprintf(stderr, "Spindle Error: Could not find a Spindle server on this node to attach to\n");
+      return -1;
+   }
    location = parse_location(location);
    if (!location) {
       return -1;
@@ -398,6 +703,8 @@ int main(int argc, char *argv[])
       }
    }
 
+   send_bootstrap_batch();
+   stage_container_image();
    get_executable();
    get_clientlib();
    adjust_script();
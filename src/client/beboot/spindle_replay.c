@@ -0,0 +1,379 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "spindle_debug.h"
+#include "ldcs_api.h"
+#include "ldcs_capture.h"
+#include "client_api.h"
+#include "client_heap.h"
+
+/**
+ * Replays a capture file from a server with SPINDLE_CAPTURE_DIR set
+ * against a server of its own, started in isolation with
+ *   spindle --no-mpi [options] spindle_replay [-s speed] CAPTURE_FILE
+ * Each client in the capture is a process here, with its own connection
+ * over the transport Spindle was built with.  Messages are sent at their
+ * captured times divided by speed, or as fast as answers come back with
+ * -s 0, and a message the client waited on is waited on here too.  One
+ * line reports the messages sent and the time spent waiting on answers.
+ **/
+
+typedef struct {
+   int client;
+   size_t first, num;        /* into records */
+} stream_t;
+
+typedef struct {
+   unsigned long sent, answered;
+   double wait_total, wait_max;
+   int error;
+} stream_result_t;
+
+static char *capture;
+static size_t capture_size;
+static capture_record_t **records;
+static size_t num_records;
+static stream_t *streams;
+static int num_streams;
+static stream_result_t *results;
+static double speed = 1.0;
+static char *location;
+static int number;
+
+static double now()
+{
+   struct timeval t;
+   gettimeofday(&t, NULL);
+   return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+static int read_capture(const char *filename)
+{
+   capture_header_t *header;
+   capture_record_t *record;
+   struct stat buf;
+   size_t pos;
+   int fd;
+
+   fd = open(filename, O_RDONLY);
+   if (fd == -1 || fstat(fd, &buf) == -1) {
+      fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+      return -1;
+   }
+   capture_size = buf.st_size;
+   capture = capture_size ? mmap(NULL, capture_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+   close(fd);
+   if (capture == MAP_FAILED || capture_size < sizeof(capture_header_t)) {
+      fprintf(stderr, "Could not read %s\n", filename);
+      return -1;
+   }
+   header = (capture_header_t *) capture;
+   if (header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION) {
+      fprintf(stderr, "%s is not a Spindle capture file of version %d\n", filename, CAPTURE_VERSION);
+      return -1;
+   }
+
+   for (pos = sizeof(capture_header_t); pos + sizeof(capture_record_t) <= capture_size; ) {
+      record = (capture_record_t *) (capture + pos);
+      if (pos + sizeof(capture_record_t) + record->len > capture_size)
+         break;
+      if (num_records % 4096 == 0)
+         records = (capture_record_t **) realloc(records, sizeof(capture_record_t *) * (num_records + 4096));
+      records[num_records++] = record;
+      pos += sizeof(capture_record_t) + record->len;
+   }
+   if (pos != capture_size)
+      fprintf(stderr, "Ignoring a partial record at the end of %s\n", filename);
+   return 0;
+}
+
+/**
+ * A client's connection index is reused once it ends, so a stream is
+ * what one connection sent, up to its LDCS_MSG_END or until a hello on
+ * it shows a new client has it.
+ **/
+static void split_streams()
+{
+   int *open_stream, max_client = -1, s;
+   size_t i, j, n, *next, *last;
+   capture_record_t *r, **ordered;
+
+   for (i = 0; i < num_records; i++) {
+      if (records[i]->client > max_client)
+         max_client = records[i]->client;
+   }
+   open_stream = (int *) malloc(sizeof(int) * (max_client + 1));
+   for (s = 0; s <= max_client; s++)
+      open_stream[s] = -1;
+   streams = (stream_t *) malloc(sizeof(stream_t) * (num_records + 1));
+   next = (size_t *) malloc(sizeof(size_t) * (num_records + 1));
+   last = (size_t *) malloc(sizeof(size_t) * (num_records + 1));
+
+   /* Link each record to the next of its stream */
+   for (i = 0; i < num_records; i++) {
+      r = records[i];
+      s = r->client >= 0 ? open_stream[r->client] : -1;
+      if (s != -1 && r->type == LDCS_MSG_HELLO)
+         s = -1;
+      if (s == -1) {
+         s = num_streams++;
+         streams[s].client = r->client;
+         streams[s].first = i;
+         streams[s].num = 0;
+         if (r->client >= 0)
+            open_stream[r->client] = s;
+      }
+      else
+         next[last[s]] = i;
+      last[s] = i;
+      next[i] = num_records;
+      streams[s].num++;
+      if (r->type == LDCS_MSG_END && r->client >= 0)
+         open_stream[r->client] = -1;
+   }
+
+   /* Then lay each stream's records out together */
+   ordered = (capture_record_t **) malloc(sizeof(capture_record_t *) * (num_records + 1));
+   n = 0;
+   for (s = 0; s < num_streams; s++) {
+      j = streams[s].first;
+      streams[s].first = n;
+      for (; j < num_records; j = next[j])
+         ordered[n++] = records[j];
+   }
+   free(records);
+   records = ordered;
+   free(last);
+   free(next);
+   free(open_stream);
+}
+
+/* The client asked for these with no request id, and waits on the next message */
+static int expects_answer(capture_record_t *r, const char *data)
+{
+   unsigned int flags;
+
+   if (r->req)
+      return 1;
+   switch (r->type) {
+      case LDCS_MSG_PYTHONPREFIX_REQ:
+      case LDCS_MSG_RELOCRULES_REQ:
+         return 1;
+      case LDCS_MSG_HELLO:
+         if (r->len < sizeof(int) + sizeof(flags))
+            return 0;
+         memcpy(&flags, data + sizeof(int), sizeof(flags));
+         return (flags & (HELLO_RANKINFO | HELLO_PYTHONPREFIX | HELLO_RELOCRULES)) ? 1 : 0;
+      default:
+         return 0;
+   }
+}
+
+/**
+ * Messages that name the client's process or location are rewritten to
+ * name ours, since the server may look at them.
+ **/
+static void rewrite_msg(capture_record_t *r, ldcs_message_t *msg, char *buffer)
+{
+   int pid = getpid();
+   size_t pos, len;
+   const char *data = (const char *) (r + 1);
+
+   msg->header.type = (ldcs_message_ids_t) r->type;
+   msg->header.req = r->req;
+   msg->header.len = r->len;
+   msg->data = (char *) data;
+
+   if (r->type == LDCS_MSG_HELLO && r->len >= sizeof(int) + sizeof(unsigned int)) {
+      pos = sizeof(int) + sizeof(unsigned int);
+      memcpy(buffer, &pid, sizeof(pid));
+      memcpy(buffer + sizeof(pid), data + sizeof(pid), sizeof(unsigned int));
+      len = pos + snprintf(buffer + pos, MAX_PATH_LEN+1, "%s", location) + 1;
+      pos += strnlen(data + pos, r->len - pos) + 1;
+      if (pos < r->len && len + (r->len - pos) <= LDCS_MAX_MSG_LEN) {
+         memcpy(buffer + len, data + pos, r->len - pos);
+         len += r->len - pos;
+      }
+      msg->header.len = len;
+      msg->data = buffer;
+   }
+   else if (r->type == LDCS_MSG_PID) {
+      msg->header.len = snprintf(buffer, MAX_PATH_LEN+1, "%d", pid) + 1;
+      msg->data = buffer;
+   }
+   else if (r->type == LDCS_MSG_LOCATION) {
+      msg->header.len = snprintf(buffer, MAX_PATH_LEN+1, "%s", location) + 1;
+      msg->data = buffer;
+   }
+}
+
+static void sleep_until(double when)
+{
+   struct timespec ts;
+   double left = when - now();
+
+   if (left <= 0.0)
+      return;
+   ts.tv_sec = (time_t) left;
+   ts.tv_nsec = (long) ((left - ts.tv_sec) * 1000000000.0);
+   while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+static int replay_stream(int s, double start)
+{
+   static char buffer[LDCS_MAX_MSG_LEN];
+   stream_result_t *result = results + s;
+   ldcs_message_t msg, answer;
+   capture_record_t *r;
+   double sent, waited;
+   size_t i;
+   int fd;
+
+   if (speed > 0.0)
+      sleep_until(start + records[streams[s].first]->usec / 1000000.0 / speed);
+   fd = client_open_connection(location, number);
+   if (fd == -1) {
+      err_printf("Stream %d could not connect to the server at %s\n", s, location);
+      return -1;
+   }
+
+   for (i = streams[s].first; i < streams[s].first + streams[s].num; i++) {
+      r = records[i];
+      if (speed > 0.0)
+         sleep_until(start + r->usec / 1000000.0 / speed);
+      rewrite_msg(r, &msg, buffer);
+      sent = now();
+      if (client_send_msg(fd, &msg) == -1) {
+         err_printf("Stream %d could not send message %lu of type %d\n", s, (unsigned long) i, (int) r->type);
+         return -1;
+      }
+      result->sent++;
+      if (!expects_answer(r, (const char *) (r + 1)))
+         continue;
+
+      answer.header.type = LDCS_MSG_UNKNOWN;
+      answer.header.len = 0;
+      answer.data = NULL;
+      if (client_recv_msg_dynamic(fd, &answer, LDCS_READ_BLOCK) == -1) {
+         err_printf("Stream %d got no answer to message of type %d\n", s, (int) r->type);
+         return -1;
+      }
+      if (answer.data)
+         spindle_free(answer.data);
+      waited = now() - sent;
+      result->answered++;
+      result->wait_total += waited;
+      if (waited > result->wait_max)
+         result->wait_max = waited;
+   }
+
+   client_close_connection(fd);
+   return 0;
+}
+
+static void usage()
+{
+   fprintf(stderr, "Usage: spindle --no-mpi [spindle options] spindle_replay [-s speed] CAPTURE_FILE\n"
+           "  -s speed   Replay this many times faster than captured, or as fast as possible with 0.  Default: 1\n");
+   exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned long sent = 0, answered = 0;
+   double start, elapsed, wait_total = 0.0, wait_max = 0.0;
+   int opt, s, status, errors = 0;
+   pid_t pid;
+
+   LOGGING_INIT_PREEXEC("Client");
+
+   while ((opt = getopt(argc, argv, "s:h")) != -1) {
+      switch (opt) {
+         case 's': speed = atof(optarg); break;
+         default: usage();
+      }
+   }
+   if (optind + 1 != argc || speed < 0.0)
+      usage();
+
+   location = getenv("LDCS_LOCATION");
+   if (!location || !getenv("LDCS_NUMBER")) {
+      fprintf(stderr, "spindle_replay must be run under spindle, which starts the server it replays to\n");
+      return -1;
+   }
+   number = atoi(getenv("LDCS_NUMBER"));
+
+   if (read_capture(argv[optind]) == -1)
+      return -1;
+   split_streams();
+   debug_printf("Replaying %lu messages from %d clients at speed %f\n", (unsigned long) num_records,
+                num_streams, speed);
+
+   results = (stream_result_t *) mmap(NULL, sizeof(stream_result_t) * (num_streams + 1), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (results == MAP_FAILED) {
+      fprintf(stderr, "Could not allocate replay results: %s\n", strerror(errno));
+      return -1;
+   }
+   memset(results, 0, sizeof(stream_result_t) * num_streams);
+
+   start = now();
+   for (s = 0; s < num_streams; s++) {
+      pid = fork();
+      if (pid == -1) {
+         fprintf(stderr, "Could not fork a client for stream %d: %s\n", s, strerror(errno));
+         errors++;
+         break;
+      }
+      if (pid == 0) {
+         results[s].error = replay_stream(s, start) == -1;
+         exit(results[s].error ? -1 : 0);
+      }
+   }
+   while ((pid = wait(&status)) != -1 || errno == EINTR) {
+      if (pid != -1 && WIFSIGNALED(status))
+         errors++;
+   }
+   elapsed = now() - start;
+
+   for (s = 0; s < num_streams; s++) {
+      sent += results[s].sent;
+      answered += results[s].answered;
+      wait_total += results[s].wait_total;
+      if (results[s].wait_max > wait_max)
+         wait_max = results[s].wait_max;
+      errors += results[s].error;
+   }
+   printf("REPLAY clients=%d messages=%lu sent=%lu answered=%lu time=%f wait_mean_usec=%.1f "
+          "wait_max_usec=%.1f errors=%d\n",
+          num_streams, (unsigned long) num_records, sent, answered, elapsed,
+          answered ? wait_total / answered * 1000000.0 : 0.0, wait_max * 1000000.0, errors);
+
+   LOGGING_FINI;
+   return errors ? -1 : 0;
+}
@@ -0,0 +1,417 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "spindle_debug.h"
+#include "ldcs_api.h"
+#include "client_api.h"
+
+/**
+ * Measures client queries over the transport Spindle was built with,
+ * against a server of its own, started with
+ *   spindle --no-mpi [options] spindle_transbench [-c counts] [-n queries] [-k keyfile]
+ * For each client count, that many processes connect to the server at
+ * once, which is the connect storm, and once all are connected each
+ * sends -n stat queries, round robin over the keys.  The keys are
+ * queried once beforehand, so every query is a cache hit and what's
+ * measured is the transport and the server's dispatch.  Keys are
+ * absolute paths, one per line; without -k the benchmark's own path is
+ * the only key.  One line per client count reports the slowest and the
+ * mean connect, the queries' latency, and the throughput.  The testsuite's
+ * runTransBench runs this against a Spindle build per transport.
+ **/
+
+#define MAX_KEY_LEN 4096
+
+/* Latency histogram of 8 buckets per power of two nanoseconds */
+#define HIST_SUBBITS 3
+#define HIST_BUCKETS (40 << HIST_SUBBITS)
+
+typedef struct {
+   double connect;           /* seconds to connect and be answered hello */
+   double end;               /* when the last query was answered */
+   unsigned long queries;
+   double lat_total, lat_max;
+   unsigned long hist[HIST_BUCKETS];
+   int error;
+} client_result_t;
+
+static char **keys = NULL;
+static int num_keys = 0;
+static int *counts = NULL;
+static int num_counts = 0;
+static unsigned long queries = 10000;
+static int json = 0;
+static const char *label = NULL;
+static client_result_t *results;
+static char *location;
+static int number;
+
+static double now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static int hist_bucket(uint64_t ns)
+{
+   int b, idx;
+   if (ns < (1 << HIST_SUBBITS))
+      return (int) ns;
+   b = 63 - __builtin_clzll(ns);
+   idx = (b << HIST_SUBBITS) + (int) ((ns >> (b - HIST_SUBBITS)) & ((1 << HIST_SUBBITS) - 1));
+   return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+/* The smallest latency in bucket idx, in seconds */
+static double hist_value(int idx)
+{
+   int b = idx >> HIST_SUBBITS, sub = idx & ((1 << HIST_SUBBITS) - 1);
+   if (idx < (1 << HIST_SUBBITS))
+      return idx / 1000000000.0;
+   return (double) (((1 << HIST_SUBBITS) + sub) * (1ULL << (b - HIST_SUBBITS))) / 1000000000.0;
+}
+
+static double hist_percentile(unsigned long *hist, unsigned long total, double p)
+{
+   unsigned long want = (unsigned long) (p * total + 0.5), seen = 0;
+   int i;
+   if (!want)
+      want = 1;
+   for (i = 0; i < HIST_BUCKETS; i++) {
+      seen += hist[i];
+      if (seen >= want)
+         return hist_value(i);
+   }
+   return hist_value(HIST_BUCKETS - 1);
+}
+
+static void add_key(const char *path)
+{
+   if (num_keys % 1024 == 0)
+      keys = (char **) realloc(keys, sizeof(char *) * (num_keys + 1024));
+   keys[num_keys++] = strdup(path);
+}
+
+static int read_keys(const char *filename)
+{
+   char line[MAX_KEY_LEN];
+   FILE *f = fopen(filename, "r");
+   if (!f) {
+      fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+      return -1;
+   }
+   while (fgets(line, sizeof(line), f)) {
+      line[strcspn(line, "\n")] = '\0';
+      if (line[0] == '/' && strlen(line) < MAX_PATH_LEN)
+         add_key(line);
+   }
+   fclose(f);
+   return 0;
+}
+
+static int parse_counts(char *str)
+{
+   char *s;
+   for (s = strtok(str, ", "); s; s = strtok(NULL, ", ")) {
+      counts = (int *) realloc(counts, sizeof(int) * (num_counts + 1));
+      counts[num_counts] = atoi(s);
+      if (counts[num_counts] < 1)
+         return -1;
+      num_counts++;
+   }
+   return num_counts ? 0 : -1;
+}
+
+/* Blocks until the parent closes the other end */
+static void wait_gate(int fd)
+{
+   char c;
+   while (read(fd, &c, 1) == -1 && errno == EINTR);
+}
+
+static int connect_client(int *rankinfo)
+{
+   int fd = client_open_connection(location, number);
+   if (fd == -1)
+      return -1;
+   if (send_hello(fd, location, HELLO_RANKINFO, rankinfo) == -1) {
+      client_close_connection(fd);
+      return -1;
+   }
+   return fd;
+}
+
+static int run_client(int c, int start_fd, int ready_fd, int go_fd)
+{
+   client_result_t *result = results + c;
+   char buffer[MAX_PATH_LEN+1];
+   int rankinfo[4], fd;
+   double start, lat;
+   unsigned long i;
+
+   wait_gate(start_fd);
+   start = now();
+   fd = connect_client(rankinfo);
+   result->connect = now() - start;
+   /* Even on failure, as the parent waits to hear from every client */
+   if (write(ready_fd, "r", 1) != 1 || fd == -1) {
+      err_printf("Client %d could not connect to the server at %s\n", c, location);
+      return -1;
+   }
+
+   wait_gate(go_fd);
+   for (i = 0; i < queries; i++) {
+      start = now();
+      if (send_stat_request(fd, keys[(i + c) % num_keys], 0, buffer) == -1) {
+         err_printf("Client %d's stat query %lu failed\n", c, i);
+         return -1;
+      }
+      lat = now() - start;
+      result->queries++;
+      result->lat_total += lat;
+      if (lat > result->lat_max)
+         result->lat_max = lat;
+      result->hist[hist_bucket((uint64_t) (lat * 1000000000.0))]++;
+   }
+   result->end = now();
+
+   send_end(fd);
+   client_close_connection(fd);
+   return 0;
+}
+
+static const char *transport_name()
+{
+#if defined(COMM_SOCKET)
+   return "socket";
+#elif defined(COMM_PIPES)
+   return "pipes";
+#elif defined(COMM_BITER)
+   return "biter";
+#elif defined(COMM_SHMEM)
+   return "shmem";
+#else
+   return "unknown";
+#endif
+}
+
+static int report(int nclients, double go_time, int errors)
+{
+   static unsigned long hist[HIST_BUCKETS];
+   unsigned long total = 0;
+   double connect_max = 0.0, connect_total = 0.0, lat_total = 0.0, lat_max = 0.0, end = go_time;
+   double elapsed, p50, p90, p99;
+   int c, i;
+
+   memset(hist, 0, sizeof(hist));
+   for (c = 0; c < nclients; c++) {
+      errors += results[c].error;
+      connect_total += results[c].connect;
+      if (results[c].connect > connect_max)
+         connect_max = results[c].connect;
+      total += results[c].queries;
+      lat_total += results[c].lat_total;
+      if (results[c].lat_max > lat_max)
+         lat_max = results[c].lat_max;
+      if (results[c].end > end)
+         end = results[c].end;
+      for (i = 0; i < HIST_BUCKETS; i++)
+         hist[i] += results[c].hist[i];
+   }
+   elapsed = end - go_time;
+   p50 = total ? hist_percentile(hist, total, 0.50) : 0.0;
+   p90 = total ? hist_percentile(hist, total, 0.90) : 0.0;
+   p99 = total ? hist_percentile(hist, total, 0.99) : 0.0;
+
+   if (json)
+      printf("{\"transport\": \"%s\", \"clients\": %d, \"keys\": %d, \"connect_max_usec\": %.1f, "
+             "\"connect_mean_usec\": %.1f, \"queries\": %lu, \"time\": %f, \"queries_per_sec\": %.0f, "
+             "\"lat_mean_usec\": %.2f, \"lat_p50_usec\": %.2f, \"lat_p90_usec\": %.2f, "
+             "\"lat_p99_usec\": %.2f, \"lat_max_usec\": %.2f, \"errors\": %d}\n",
+             label, nclients, num_keys, connect_max * 1000000.0, connect_total / nclients * 1000000.0,
+             total, elapsed, elapsed > 0.0 ? total / elapsed : 0.0,
+             total ? lat_total / total * 1000000.0 : 0.0, p50 * 1000000.0, p90 * 1000000.0,
+             p99 * 1000000.0, lat_max * 1000000.0, errors);
+   else
+      printf("TRANSBENCH transport=%s clients=%d connect_max_usec=%.1f connect_mean_usec=%.1f "
+             "queries=%lu time=%f queries_per_sec=%.0f lat_mean_usec=%.2f lat_p50_usec=%.2f "
+             "lat_p90_usec=%.2f lat_p99_usec=%.2f lat_max_usec=%.2f errors=%d\n",
+             label, nclients, connect_max * 1000000.0, connect_total / nclients * 1000000.0,
+             total, elapsed, elapsed > 0.0 ? total / elapsed : 0.0,
+             total ? lat_total / total * 1000000.0 : 0.0, p50 * 1000000.0, p90 * 1000000.0,
+             p99 * 1000000.0, lat_max * 1000000.0, errors);
+   fflush(stdout);
+   return errors;
+}
+
+/* Returns the number of clients that failed */
+static int run_count(int nclients)
+{
+   int start_pipe[2], ready_pipe[2], go_pipe[2];
+   int c, started = 0, ready = 0, status, errors = 0;
+   double go_time;
+   char r;
+   pid_t pid;
+
+   if (pipe(start_pipe) == -1 || pipe(ready_pipe) == -1 || pipe(go_pipe) == -1) {
+      fprintf(stderr, "Could not create pipes: %s\n", strerror(errno));
+      return nclients;
+   }
+   memset(results, 0, sizeof(client_result_t) * nclients);
+
+   for (c = 0; c < nclients; c++) {
+      pid = fork();
+      if (pid == -1) {
+         fprintf(stderr, "Could not fork client %d: %s\n", c, strerror(errno));
+         errors += nclients - c;
+         break;
+      }
+      if (pid == 0) {
+         close(start_pipe[1]);
+         close(ready_pipe[0]);
+         close(go_pipe[1]);
+         results[c].error = run_client(c, start_pipe[0], ready_pipe[1], go_pipe[0]) == -1;
+         exit(results[c].error ? -1 : 0);
+      }
+      started++;
+   }
+   close(start_pipe[0]);
+   close(ready_pipe[1]);
+   close(go_pipe[0]);
+
+   /* Everyone connects at once, then everyone queries at once */
+   close(start_pipe[1]);
+   while (ready < started) {
+      ssize_t n = read(ready_pipe[0], &r, 1);
+      if (n == 1)
+         ready++;
+      else if (n == 0 || errno != EINTR)
+         break;
+   }
+   close(ready_pipe[0]);
+   go_time = now();
+   close(go_pipe[1]);
+
+   while ((pid = wait(&status)) != -1 || errno == EINTR) {
+      if (pid != -1 && WIFSIGNALED(status))
+         errors++;
+   }
+   return report(started, go_time, errors);
+}
+
+static void usage()
+{
+   fprintf(stderr, "Usage: spindle --no-mpi [spindle options] spindle_transbench [-c counts] [-n queries]\n"
+           "          [-k keyfile] [-t label] [-j]\n"
+           "  -c counts    Comma-separated numbers of concurrent clients.  Default: 1,2,4,8,16,32,64,128,256\n"
+           "  -n queries   Stat queries each client sends.  Default: 10000\n"
+           "  -k keyfile   Absolute paths to query, one per line.  Default: this program\n"
+           "  -t label     Transport name to report.  Default: the one Spindle was built with\n"
+           "  -j           Print a JSON object per client count\n");
+   exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+   char default_counts[] = "1,2,4,8,16,32,64,128,256";
+   char buffer[MAX_PATH_LEN+1], self[MAX_PATH_LEN+1];
+   const char *keyfile = NULL;
+   int opt, i, fd, max_count = 0, rankinfo[4], errors = 0;
+   ssize_t len;
+
+   LOGGING_INIT_PREEXEC("Client");
+
+   while ((opt = getopt(argc, argv, "c:n:k:t:jh")) != -1) {
+      switch (opt) {
+         case 'c': if (parse_counts(optarg) == -1) usage(); break;
+         case 'n': queries = strtoul(optarg, NULL, 10); break;
+         case 'k': keyfile = optarg; break;
+         case 't': label = optarg; break;
+         case 'j': json = 1; break;
+         default: usage();
+      }
+   }
+   if (optind != argc || !queries)
+      usage();
+   if (!num_counts)
+      parse_counts(default_counts);
+   if (!label)
+      label = transport_name();
+
+   location = getenv("LDCS_LOCATION");
+   if (!location || !getenv("LDCS_NUMBER")) {
+      fprintf(stderr, "spindle_transbench must be run under spindle, which starts the server it measures\n");
+      return -1;
+   }
+   number = atoi(getenv("LDCS_NUMBER"));
+
+   if (keyfile) {
+      if (read_keys(keyfile) == -1)
+         return -1;
+   }
+   else {
+      len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+      if (len > 0) {
+         self[len] = '\0';
+         add_key(self);
+      }
+   }
+   if (!num_keys) {
+      fprintf(stderr, "No keys\n");
+      return -1;
+   }
+
+   for (i = 0; i < num_counts; i++) {
+      if (counts[i] > max_count)
+         max_count = counts[i];
+   }
+   results = (client_result_t *) mmap(NULL, sizeof(client_result_t) * max_count, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (results == MAP_FAILED) {
+      fprintf(stderr, "Could not allocate benchmark results: %s\n", strerror(errno));
+      return -1;
+   }
+
+   /* Our own queries put every key in the server's cache */
+   fd = connect_client(rankinfo);
+   if (fd == -1) {
+      fprintf(stderr, "Could not connect to the server at %s\n", location);
+      return -1;
+   }
+   for (i = 0; i < num_keys; i++)
+      send_stat_request(fd, keys[i], 0, buffer);
+   debug_printf("Benchmarking %s with %d keys and %lu queries per client\n", label, num_keys, queries);
+
+   for (i = 0; i < num_counts; i++)
+      errors += run_count(counts[i]);
+
+   send_end(fd);
+   client_close_connection(fd);
+   LOGGING_FINI;
+   return errors ? -1 : 0;
+}
@@ -0,0 +1,107 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+
+#include "client.h"
+#include "client_timing.h"
+#include "should_intercept.h"
+#include "autobypass.h"
+#include "spindle_debug.h"
+#include <sys/stat.h>
+#include <errno.h>
+
+#define AUTO_NUM_CLASSES 4
+#define AUTO_SAMPLE_INTERVAL 64
+#define AUTO_MIN_SAMPLES 8
+#define AUTO_SLOWDOWN 1.5
+#define AUTO_WEIGHT 0.125
+
+extern int (*orig_stat)(const char *path, struct stat *buf);
+
+/**
+ * Averages are weighted towards the recent queries, so a class isn't
+ * judged on the first queries of each file, which wait for the tree to
+ * stage it.  The direct samples add one stat of the shared file system
+ * per AUTO_SAMPLE_INTERVAL queries.
+ **/
+typedef struct {
+   double spindle_avg;
+   double direct_avg;
+   unsigned long queries;
+   unsigned long samples;
+   int dropped;
+} autobypass_class_t;
+
+static autobypass_class_t classes[AUTO_NUM_CLASSES];
+static const char *class_names[AUTO_NUM_CLASSES] = { "open", "python open", "stat", "python stat" };
+
+static void add_sample(double *avg, uint64_t ticks, unsigned long n)
+{
+   if (n == 1)
+      *avg = (double) ticks;
+   else
+      *avg += ((double) ticks - *avg) * AUTO_WEIGHT;
+}
+
+int autobypass_class(int op, const char *path)
+{
+   if (!(opts & OPT_AUTO) || !path)
+      return op * 2;
+   return op * 2 + is_python_file(path);
+}
+
+int autobypass_dropped(int cls)
+{
+   return (opts & OPT_AUTO) && classes[cls].dropped;
+}
+
+uint64_t autobypass_start(int cls)
+{
+   (void) cls;
+   return (opts & OPT_AUTO) ? timing_ticks() : 0;
+}
+
+void autobypass_end(int cls, const char *path, uint64_t start)
+{
+   autobypass_class_t *c = classes + cls;
+   struct stat buf;
+   uint64_t direct_start;
+   int saved_errno;
+
+   if (!start)
+      return;
+   c->queries++;
+   add_sample(&c->spindle_avg, timing_ticks() - start, c->queries);
+   if (c->queries % AUTO_SAMPLE_INTERVAL != 0 || !path)
+      return;
+
+   saved_errno = errno;
+   direct_start = timing_ticks();
+   if (orig_stat)
+      orig_stat(path, &buf);
+   else
+      stat(path, &buf);
+   c->samples++;
+   add_sample(&c->direct_avg, timing_ticks() - direct_start, c->samples);
+   errno = saved_errno;
+
+   if (c->samples >= AUTO_MIN_SAMPLES && c->spindle_avg > c->direct_avg * AUTO_SLOWDOWN) {
+      debug_printf("Spindle averages %.0f ticks a %s against %.0f for the file system, "
+                   "sending them to the file system\n", c->spindle_avg, class_names[cls], c->direct_avg);
+      c->dropped = 1;
+   }
+}
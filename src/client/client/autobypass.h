@@ -0,0 +1,46 @@
+/*
+  This file is part of Spindle.  For copyright information see the COPYRIGHT 
+  file in the top level directory, or at 
+  https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License (as published by the Free Software
+  Foundation) version 2.1 dated February 1999.  This program is distributed in the
+  hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+  WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+  and conditions of the GNU Lesser General Public License for more details.  You should 
+  have received a copy of the GNU Lesser General Public License along with this 
+  program; if not, write to the Free Software Foundation, Inc., 59 Temple
+  Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(AUTOBYPASS_H_)
+#define AUTOBYPASS_H_
+
+#include <stdint.h>
+
+/**
+ * With OPT_AUTO, each process times the queries it sends Spindle for each
+ * class of path, and now and then times the same access made directly.
+ * A class Spindle answers slower than the file system is dropped to
+ * direct access for the rest of the process.  Libraries loaded by ld.so
+ * go through the auditor, not here, and are never dropped.
+ **/
+
+#define AUTO_OPEN 0
+#define AUTO_STAT 1
+
+/* Return the class of an AUTO_OPEN or AUTO_STAT of path */
+int autobypass_class(int op, const char *path);
+
+/* Return true if queries of class cls should go straight to the file system */
+int autobypass_dropped(int cls);
+
+/* Start timing a query of class cls.  Returns 0 without OPT_AUTO. */
+uint64_t autobypass_start(int cls);
+
+/* Finish timing a query of path started at start, and maybe time a direct
+   stat of path to compare it against */
+void autobypass_end(int cls, const char *path, uint64_t start);
+
+#endif
@@ -29,6 +29,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <link.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 #include "ldcs_api.h" 
 #include "config.h"
@@ -37,6 +38,14 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "client_api.h"
 #include "spindle_launch.h"
 #include "shmcache.h"
+#include "lookup_cache.h"
+#include "namesnap.h"
+#include "ldcs_statseg.h"
+#include "client_timing.h"
+#include "relocrules.h"
+#include "localfs.h"
+#include "spindle_probes.h"
+#include "quiesce.h"
 
 errno_location_t app_errno_location;
 
@@ -44,16 +53,28 @@ opt_t opts;
 int ldcsid = -1;
 unsigned int shm_cachesize;
 static unsigned int shm_cache_limit;
+static int use_shmcache;
 
 int intercept_open;
 int intercept_exec;
 int intercept_stat;
+int intercept_read;
+int intercept_dir;
+int intercept_links;
 int intercept_close;
 int intercept_fork;
 static char debugging_name[32];
 
-static char old_cwd[MAX_PATH_LEN+1];
+static char cached_cwd[MAX_PATH_LEN+1];
+static int cwd_valid;
 static int rankinfo[4]={-1,-1,-1,-1};
+static char *pythonprefix_str;
+static reloc_rule_t *reloc_rules;
+static int num_reloc_rules;
+
+/* Ticks and clock when timing started, to turn ticks into nanoseconds */
+static uint64_t timing_base_ticks;
+static struct timespec timing_base_time;
 
 extern char *parse_location(char *loc);
 
@@ -173,9 +194,50 @@ void int_spindle_test_log_msg(char *buffer)
    test_printf("%s", buffer);
 }
 
+/* Autosized shared memory caches get this many kilobytes per rank on the node */
+#define SHM_CACHE_KB_PER_RANK 64
+#define SHM_CACHE_AUTO_MIN_KB 2048
+#define SHM_CACHE_AUTO_MAX_KB (64*1024)
+
+/**
+ * Pick a shared memory cache size from the number of ranks on this node.
+ * Every rank on the node must come up with the same size, so this only
+ * looks at what the launcher put in the environment, and falls back to
+ * the number of CPUs.
+ **/
+static unsigned int auto_shm_cachesize()
+{
+   static const char *local_size_vars[] = { "OMPI_COMM_WORLD_LOCAL_SIZE", "MPI_LOCALNRANKS",
+                                            "MV2_COMM_WORLD_LOCAL_SIZE", "PMI_LOCAL_SIZE",
+                                            "SLURM_STEP_TASKS_PER_NODE", "SLURM_TASKS_PER_NODE",
+                                            NULL };
+   const char *val;
+   long ranks = 0, kb;
+   int i;
+
+   for (i = 0; local_size_vars[i] && ranks <= 0; i++) {
+      val = getenv(local_size_vars[i]);
+      if (val)
+         ranks = atol(val); /* SLURM's "4(x2),3" form gives the first count */
+   }
+   if (ranks <= 0)
+      ranks = sysconf(_SC_NPROCESSORS_ONLN);
+   if (ranks <= 0)
+      ranks = 1;
+
+   kb = ranks * SHM_CACHE_KB_PER_RANK;
+   if (kb < SHM_CACHE_AUTO_MIN_KB)
+      kb = SHM_CACHE_AUTO_MIN_KB;
+   if (kb > SHM_CACHE_AUTO_MAX_KB)
+      kb = SHM_CACHE_AUTO_MAX_KB;
+   debug_printf2("Sizing shared memory cache to %ld KB for %ld ranks on this node\n", kb, ranks);
+   return (unsigned int) kb * 1024;
+}
+
 static int init_server_connection()
 {
    char *connection, *rankinfo_s, *opts_s, *cachesize_s;
+   unsigned int hello_flags;
 
    debug_printf("Initializing connection to server\n");
 
@@ -190,8 +252,12 @@ static int init_server_connection()
    rankinfo_s = getenv("LDCS_RANKINFO");
    opts_s = getenv("LDCS_OPTIONS");
    cachesize_s = getenv("LDCS_CACHESIZE");
-   opts = atol(opts_s);
-   shm_cachesize = atoi(cachesize_s) * 1024;
+   opts = strtoull(opts_s, NULL, 10);
+   shm_cachesize = atoi(cachesize_s);
+   if (shm_cachesize == SHM_CACHE_AUTO_SIZE)
+      shm_cachesize = auto_shm_cachesize();
+   else
+      shm_cachesize *= 1024;
 
    if (strchr(location, '$')) {
       location = parse_location(location);
@@ -216,6 +282,7 @@ static int init_server_connection()
 #endif
       shmcache_init(location, number, shm_cachesize, shm_cache_limit);
    }
+   use_shmcache = (opts & OPT_SHMCACHE) && (shm_cachesize > 0);
 
    if (connection) {
       /* boostrapper established the connection for us.  Reuse it. */
@@ -226,28 +293,41 @@ static int init_server_connection()
       if (ldcsid == -1)
          return -1;
       assert(rankinfo_s);
-      sscanf(rankinfo_s, "%d %d %d %d", rankinfo+0, rankinfo+1, rankinfo+2, rankinfo+3);
+      /* Led by the handing-over process's ldcsid, see client_exec_env */
+      sscanf(rankinfo_s, "%*d %d %d %d %d", rankinfo+0, rankinfo+1, rankinfo+2, rankinfo+3);
       unsetenv("LDCS_CONNECTION");
    }
    else {
       /* Establish a new connection */
       debug_printf("open connection to ldcs %s %d\n", location, number);
+      if (opts & OPT_EARLYLAUNCH)
+         client_connect_wait = CLIENT_EARLY_CONNECT_WAIT;
       ldcsid = client_open_connection(location, number);
       if (ldcsid == -1)
          return -1;
 
-      send_pid(ldcsid);
-      send_location(ldcsid, location);
-      send_rankinfo_query(ldcsid, rankinfo+0, rankinfo+1, rankinfo+2, rankinfo+3);
+      /* A forked child keeps its parent's rank info, python prefixes and
+         rules rather than ask the server again */
+      hello_flags = 0;
+      if (rankinfo[2] == -1)
+         hello_flags |= HELLO_RANKINFO;
+      if ((opts & OPT_RELOCPY) && !pythonprefixes && !getenv("LDCS_PYTHONPREFIX"))
+         hello_flags |= HELLO_PYTHONPREFIX;
+      if ((opts & OPT_RELOCRULES) && !reloc_rules)
+         hello_flags |= HELLO_RELOCRULES;
+      send_hello(ldcsid, location, hello_flags, rankinfo);
    }
    
    snprintf(debugging_name, 32, "Client.%d", rankinfo[0]);
    LOGGING_INIT(debugging_name);
-
-   sync_cwd();
+   client_trace_init(rankinfo[2]);
+   client_deadline_init(ldcsid);
+   namesnap_map(location, number);
 
    if (opts & OPT_RELOCPY)
       parse_python_prefixes(ldcsid);
+   if (opts & OPT_RELOCRULES)
+      parse_reloc_rules(ldcsid);
    return 0;
 }
 
@@ -256,7 +336,6 @@ static void reset_server_connection()
    client_close_connection(ldcsid);
 
    ldcsid = -1;
-   old_cwd[0] = '\0';
 
    init_server_connection();
 }
@@ -264,7 +343,13 @@ static void reset_server_connection()
 void check_for_fork()
 {
    static int cached_pid = 0;
-   int current_pid = getpid();
+   int current_pid;
+
+   /* Every intercepted call and library lookup comes through here */
+   if (quiesce_at)
+      quiesce_poll();
+
+   current_pid = getpid();
    if (!cached_pid) {
       cached_pid = current_pid;
       return;
@@ -280,10 +365,121 @@ void check_for_fork()
    }
    debug_printf("Client %d forked and is now process %d.  Following.\n", cached_pid, current_pid);
    cached_pid = current_pid;
+   lookupcache_reset();
+   if (client_timing_on)
+      memset(&client_timing, 0, sizeof(client_timing));
    reset_spindle_debugging();
    reset_server_connection();
 }
 
+/**
+ * An exec'd process keeps our pid, so it can take over our connection to
+ * the server, which isn't close-on-exec, rather than open another and
+ * query the server again.  It finds the connection, our rank info, and
+ * the python prefixes in the environment, the way a bootstrapped process
+ * does.  Set those in ours before an exec, and clear them if it fails, so
+ * a child we fork later doesn't take a connection that isn't its own.
+ **/
+static char *exec_env[3];
+
+static int fill_exec_env()
+{
+   char *connection_str;
+   size_t len;
+
+   if (ldcsid == -1 || !use_ldcs || !(opts & OPT_FOLLOWFORK))
+      return -1;
+   connection_str = client_get_connection_string(ldcsid);
+   if (!connection_str)
+      return -1;
+
+   len = strlen(connection_str) + 32;
+   exec_env[0] = (char *) spindle_malloc(len);
+   snprintf(exec_env[0], len, "LDCS_CONNECTION=%s", connection_str);
+   spindle_free(connection_str);
+
+   exec_env[1] = (char *) spindle_malloc(128);
+   snprintf(exec_env[1], 128, "LDCS_RANKINFO=%d %d %d %d %d",
+            ldcsid, rankinfo[0], rankinfo[1], rankinfo[2], rankinfo[3]);
+
+   exec_env[2] = NULL;
+   if (pythonprefix_str) {
+      len = strlen(pythonprefix_str) + 32;
+      exec_env[2] = (char *) spindle_malloc(len);
+      snprintf(exec_env[2], len, "LDCS_PYTHONPREFIX=%s", pythonprefix_str);
+   }
+   return 0;
+}
+
+static void free_exec_env()
+{
+   int i;
+   for (i = 0; i < 3; i++) {
+      if (exec_env[i])
+         spindle_free(exec_env[i]);
+      exec_env[i] = NULL;
+   }
+}
+
+void client_exec_env()
+{
+   char *eq;
+   int i;
+
+   if (fill_exec_env() == -1)
+      return;
+   for (i = 0; i < 3 && exec_env[i]; i++) {
+      eq = strchr(exec_env[i], '=');
+      *eq = '\0';
+      setenv(exec_env[i], eq + 1, 1);
+      *eq = '=';
+   }
+   free_exec_env();
+}
+
+void client_exec_env_failed()
+{
+   unsetenv("LDCS_CONNECTION");
+}
+
+/**
+ * For execve, returns a copy of envp with our connection added, or NULL
+ * to use envp as it is.  Without LDCS_LOCATION in envp, the new process
+ * won't be running Spindle, and gets nothing.
+ **/
+char **client_exec_envp(char *const envp[])
+{
+   char **new_envp;
+   int i, j, count;
+
+   if (!envp)
+      return NULL;
+   for (count = 0; envp[count]; count++);
+   for (i = 0; i < count && strncmp(envp[i], "LDCS_LOCATION=", 14) != 0; i++);
+   if (i == count || fill_exec_env() == -1)
+      return NULL;
+
+   new_envp = (char **) spindle_malloc(sizeof(char *) * (count + 4));
+   for (i = 0, j = 0; i < count; i++) {
+      if (strncmp(envp[i], "LDCS_CONNECTION=", 16) == 0 || strncmp(envp[i], "LDCS_RANKINFO=", 14) == 0 ||
+          (exec_env[2] && strncmp(envp[i], "LDCS_PYTHONPREFIX=", 18) == 0))
+         continue;
+      new_envp[j++] = envp[i];
+   }
+   for (i = 0; i < 3 && exec_env[i]; i++)
+      new_envp[j++] = exec_env[i];
+   new_envp[j] = NULL;
+   return new_envp;
+}
+
+void client_exec_envp_free(char **envp)
+{
+   if (!envp)
+      return;
+   spindle_free(envp);
+   free_exec_env();
+}
+
 void test_log(const char *name)
 {
    int result;
@@ -295,27 +491,46 @@ void test_log(const char *name)
    test_printf("open(\"%s\", O_RDONLY) = %d\n", name, result);
 }
 
-void sync_cwd()
+/**
+ * The cwd is read once and kept until the application changes directory
+ * through chdir or fchdir.  Queries name files by absolute path, so the
+ * server doesn't need to know each client's cwd.
+ **/
+static const char *get_cwd()
 {
-   char cwd[MAX_PATH_LEN+1];
-   char *result;
-   
-   result = getcwd(cwd, MAX_PATH_LEN+1);
-   if (!result) {
+   if (cwd_valid)
+      return cached_cwd;
+   if (!getcwd(cached_cwd, sizeof(cached_cwd))) {
       err_printf("Failure to get CWD: %s\n", strerror(errno));
-      return;
-   }
-
-   if (strcmp(cwd, old_cwd) == 0) {
-      /* Diretory hasn't changed since last check. No actions needed. */
-      return;
+      return NULL;
    }
+   debug_printf2("Client's cwd is %s\n", cached_cwd);
+   cwd_valid = 1;
+   return cached_cwd;
+}
 
-   debug_printf("Client changed directory to %s\n", cwd);
-   strncpy(old_cwd, cwd, MAX_PATH_LEN);
-   old_cwd[MAX_PATH_LEN] = '\0';
+void invalidate_cwd()
+{
+   cwd_valid = 0;
+}
 
-   send_dir_cwd(ldcsid, old_cwd);
+/**
+ * Returns path with the cwd in front of it if it's relative, in buffer,
+ * which holds MAX_PATH_LEN+1 bytes.  Returns path itself if it's
+ * absolute, or if we can't make it so.
+ **/
+const char *get_abs_path(const char *path, char *buffer)
+{
+   const char *cwd;
+
+   if (!path || path[0] == '/')
+      return path;
+   cwd = get_cwd();
+   if (!cwd)
+      return path;
+   if (snprintf(buffer, MAX_PATH_LEN+1, "%s/%s", strcmp(cwd, "/") ? cwd : "", path) > MAX_PATH_LEN)
+      return path;
+   return buffer;
 }
 
 void set_errno(int newerrno)
@@ -336,11 +551,25 @@ int client_init()
      return -1;
 
   init_server_connection();
-  intercept_open = (opts & OPT_RELOCPY) ? 1 : 0;
-  intercept_stat = (opts & OPT_RELOCPY || !(opts & OPT_NOHIDE)) ? 1 : 0;
-  intercept_exec = (opts & OPT_RELOCEXEC) ? 1 : 0;
+  intercept_open = (opts & (OPT_RELOCPY | OPT_RELOCRULES)) ? 1 : 0;
+  intercept_stat = (opts & (OPT_RELOCPY | OPT_RELOCRULES) || !(opts & OPT_NOHIDE)) ? 1 : 0;
+  intercept_exec = (opts & (OPT_RELOCEXEC | OPT_RELOCRULES)) ? 1 : 0;
+  /* Only lazy and mapped files need their reads seen */
+  intercept_read = (opts & (OPT_LAZYFETCH | OPT_MMAPREAD)) ? 1 : 0;
+  intercept_dir = (opts & OPT_SERVEDIRS) ? 1 : 0;
+  intercept_links = (opts & OPT_RESOLVELINKS) ? 1 : 0;
   intercept_fork = 1;
   intercept_close = 1;  
+  quiesce_init();
+
+  if ((opts & OPT_LOCALBYPASS) && localfs_init() == -1)
+     err_printf("Could not read the mount table, relocating files on local file systems too\n");
+
+  if ((opts & OPT_CLIENTTIMING) && !client_timing_on) {
+     clock_gettime(CLOCK_MONOTONIC, &timing_base_time);
+     timing_base_ticks = timing_ticks();
+     client_timing_on = 1;
+  }
 
   if (getenv("LDCS_BOOTSTRAPPED")) {
      initial_run = 1;
@@ -357,6 +586,38 @@ int client_init()
   return 0;
 }
 
+/**
+ * Turns the tick counts in client_timing into nanoseconds, logs them, and
+ * sends them to the server to add to its statistics.
+ **/
+static void send_timing()
+{
+   struct timespec now;
+   uint64_t ticks;
+   double ns_per_tick, elapsed;
+   client_timing_msg_t timing;
+   static const char *names[CLIENT_TIMING_NUM] = { "open", "stat", "objsearch", "wait", "fallback" };
+   int i;
+
+   ticks = timing_ticks() - timing_base_ticks;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   elapsed = (now.tv_sec - timing_base_time.tv_sec) * 1000000000.0 +
+      (now.tv_nsec - timing_base_time.tv_nsec);
+   ns_per_tick = ticks ? elapsed / ticks : 1.0;
+
+   /* Fallbacks are counted in nanoseconds, and without OPT_CLIENTTIMING */
+   client_timing.calls[CLIENT_TIMING_FALLBACK] = client_fallbacks;
+   client_timing.nsecs[CLIENT_TIMING_FALLBACK] = client_fallback_ns;
+   for (i = 0; i < CLIENT_TIMING_NUM; i++) {
+      timing.calls[i] = client_timing.calls[i];
+      timing.nsecs[i] = i == CLIENT_TIMING_FALLBACK ? client_timing.nsecs[i] :
+         (uint64_t) (client_timing.nsecs[i] * ns_per_tick);
+      debug_printf("Client timing: %s %lu calls in %.6f sec\n", names[i],
+                   (unsigned long) timing.calls[i], timing.nsecs[i] / 1000000000.0);
+   }
+   send_client_timing(ldcsid, &timing);
+}
+
 int client_done()
 {
    check_for_fork();
@@ -364,6 +625,11 @@ int client_done()
       return 0;
 
    debug_printf2("Done. Closing connection %d\n", ldcsid);
+   if (use_shmcache)
+      shmcache_done();
+   if (client_timing_on || client_fallbacks)
+      send_timing();
+   client_trace_done();
    send_end(ldcsid);
    client_close_connection(ldcsid);
    return 0;
@@ -371,8 +637,83 @@ int client_done()
 
 extern int read_buffer(char *localname, char *buffer, int size);
 
+static statseg_header_t *statseg = NULL;
+
+/**
+ * Map the server's stat segment read-only.  The mapping is inherited
+ * across fork, so this only runs once per exec'd process.
+ **/
+static int map_statseg()
+{
+   char path[MAX_PATH_LEN+1];
+   struct stat segstat;
+   statseg_header_t *header;
+   void *mem;
+   int fd, result;
+
+   snprintf(path, sizeof(path), "%s/%s.%d", location, STATSEG_NAME, number);
+   path[MAX_PATH_LEN] = '\0';
+
+   fd = open(path, O_RDONLY);
+   if (fd == -1) {
+      err_printf("Failed to open stat segment %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+   result = fstat(fd, &segstat);
+   if (result == -1 || segstat.st_size < sizeof(statseg_header_t)) {
+      err_printf("Stat segment %s is missing its header\n", path);
+      close(fd);
+      return -1;
+   }
+   mem = mmap(NULL, segstat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (mem == MAP_FAILED) {
+      err_printf("Failed to map stat segment %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+
+   header = (statseg_header_t *) mem;
+   if (header->magic != STATSEG_MAGIC || header->version != STATSEG_VERSION ||
+       header->entry_size != sizeof(statseg_entry_t) ||
+       segstat.st_size < STATSEG_SIZE(header->max_entries)) {
+      err_printf("Stat segment %s has an unexpected layout\n", path);
+      munmap(mem, segstat.st_size);
+      return -1;
+   }
+
+   debug_printf2("Mapped stat segment %s with %u entries\n", path, header->max_entries);
+   statseg = header;
+   return 0;
+}
+
+static int read_statseg(char *ref, struct stat *buf)
+{
+   unsigned long index;
+   char *end;
+   statseg_entry_t *entry;
+
+   if (!statseg && map_statseg() == -1)
+      return -1;
+
+   index = strtoul(ref + STATSEG_REF_PREFIX_LEN, &end, 10);
+   if (*end != '\0' || index >= statseg->max_entries) {
+      err_printf("Stat segment reference %s is out of range\n", ref);
+      return -1;
+   }
+
+   entry = STATSEG_ENTRY(statseg, index);
+   if (!entry->valid) {
+      err_printf("Stat segment slot %lu has not been written\n", index);
+      return -1;
+   }
+   memcpy(buf, &entry->buf, sizeof(*buf));
+   return 0;
+}
+
 static int read_stat(char *localname, struct stat *buf)
 {
+   if (STATSEG_IS_REF(localname))
+      return read_statseg(localname, buf);
    return read_buffer(localname, (char *) buf, sizeof(*buf));
 }
 
@@ -381,11 +722,12 @@ static int read_ldso_metadata(char *localname, ldso_info_t *ldsoinfo)
    return read_buffer(localname, (char *) ldsoinfo, sizeof(*ldsoinfo));
 }
 
-static int fetch_from_cache(const char *name, char **newname)
+/* Copies the answer into buf if it's given, otherwise spindle_strdup's it */
+static int fetch_from_cache_to(const char *name, char *buf, size_t bufsize, char **newname)
 {
    int result;
-   char *result_name;
-   result = shmcache_lookup_or_add(name, &result_name);
+   char *result_name, buffer[MAX_PATH_LEN+1];
+   result = shmcache_lookup_or_add(name, &result_name, buffer);
    if (result == -1)
       return 0;
 
@@ -395,34 +737,39 @@ static int fetch_from_cache(const char *name, char **newname)
                  result_name);
    if (result_name == in_progress) {
       debug_printf("Waiting for update to %s\n", name);
-      result = shmcache_waitfor_update(name, &result_name);
+      result = shmcache_waitfor_update(name, &result_name, buffer);
       if (result == -1) {
          debug_printf("Entry for %s deleted while waiting for update\n", name);
          return 0;
       }
    }
    
-   *newname = result_name ? spindle_strdup(result_name) : NULL;
+   if (!result_name)
+      *newname = NULL;
+   else if (buf) {
+      snprintf(buf, bufsize, "%s", result_name);
+      *newname = buf;
+   }
+   else
+      *newname = spindle_strdup(result_name);
    return 1;
 }
 
+static int fetch_from_cache(const char *name, char **newname)
+{
+   return fetch_from_cache_to(name, NULL, 0, newname);
+}
+
 static void get_cache_name(const char *path, char *prefix, char *result)
 {
-   char cwd[MAX_PATH_LEN+1];
+   char buffer[MAX_PATH_LEN+1];
 
-   if (path[0] != '/') {
-      getcwd(cwd, MAX_PATH_LEN+1);
-      cwd[MAX_PATH_LEN] = '\0';
-      snprintf(result, MAX_PATH_LEN+strlen(prefix), "%s%s/%s", prefix, cwd, path);
-   }
-   else {
-      snprintf(result, MAX_PATH_LEN+strlen(prefix), "%s%s", prefix, path);
-   }
+   snprintf(result, MAX_PATH_LEN+strlen(prefix), "%s%s", prefix, get_abs_path(path, buffer));
 }
 
 int get_existance_test(int fd, const char *path, int *exists)
 {
-   int use_cache = (opts & OPT_SHMCACHE) && (shm_cachesize > 0);
+   int use_cache = use_shmcache;
    int found_file, result;
    char cache_name[MAX_PATH_LEN+2];
    char *exist_str;
@@ -449,13 +796,13 @@ int get_existance_test(int fd, const char *path, int *exists)
    return 0;
 }
 
-int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct stat *buf)
+static int stat_result(int fd, const char *path, int is_lstat, int *exists, struct stat *buf)
 {
    int result;
    char buffer[MAX_PATH_LEN+1];
    char cache_name[MAX_PATH_LEN+3];
    char *newpath;
-   int use_cache = (opts & OPT_SHMCACHE) && (shm_cachesize > 0);
+   int use_cache = use_shmcache;
    int found_file = 0;
 
    if (use_cache) {
@@ -483,7 +830,8 @@ int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct
    }
    *exists = 1;
 
-   test_log(newpath);
+   if (!STATSEG_IS_REF(newpath))
+      test_log(newpath);
    result = read_stat(newpath, buf);
    if (result == -1) {
       err_printf("Failed to read stat info for %s from %s\n", path, newpath);
@@ -493,40 +841,274 @@ int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct
    return 0;
 }
 
+int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct stat *buf)
+{
+   int result;
+
+   SPINDLE_PROBE2(stat_start, path, is_lstat);
+   result = stat_result(fd, path, is_lstat, exists, buf);
+   SPINDLE_PROBE2(stat_end, path, *exists);
+   return result;
+}
+
+/**
+ * ld.so asks about the same paths over and over, so the answers to file
+ * queries are also kept in a per-process lookup cache, behind which is
+ * the server's name snapshot if it publishes one.  Returns -1 with
+ * *newname NULL if the server didn't answer, as when the query passed its
+ * SPINDLE_CLIENT_DEADLINE, and the caller should use name as it is.
+ **/
 int get_relocated_file(int fd, const char *name, char** newname, int *errorcode)
 {
    int found_file = 0;
-   int use_cache = (opts & OPT_SHMCACHE) && (shm_cachesize > 0);
+   int use_cache = use_shmcache;
    char cache_name[MAX_PATH_LEN+1];
 
+   SPINDLE_PROBE1(query_start, name);
+   get_cache_name(name, "", cache_name);
+   cache_name[sizeof(cache_name)-1] = '\0';
+   if (lookupcache_find(cache_name, newname, errorcode)) {
+      use_numa_replica(newname);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+   if (namesnap_find(cache_name, NULL, 0, newname, errorcode)) {
+      lookupcache_add(cache_name, *newname, *errorcode);
+      use_numa_replica(newname);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+
    if (use_cache) {
       debug_printf2("Looking up %s in shared cache\n", name);
-      get_cache_name(name, "", cache_name);
-      cache_name[sizeof(cache_name)-1] = '\0';
       found_file = fetch_from_cache(cache_name, newname);
    }
 
    if (!found_file) {
       debug_printf2("Send file request to server: %s\n", name);
-      send_file_query(fd, (char *) name, newname, errorcode);
+      if (send_file_query(fd, (char *) name, newname, errorcode) == -1) {
+         /* Past its deadline, or lost.  Not cached, the caller goes to the file system */
+         SPINDLE_PROBE2(query_end, name, NULL);
+         return -1;
+      }
       debug_printf2("Recv file from server: %s\n", *newname ? *newname : "NONE");      
       if (use_cache)
          shmcache_update(cache_name, *newname);
    }
+   lookupcache_add(cache_name, *newname, found_file ? 0 : *errorcode);
+   use_numa_replica(newname);
+   SPINDLE_PROBE2(query_end, name, *newname);
 
    return 0;
 }
 
+/**
+ * Like get_relocated_file, but puts the answer in buf of bufsize bytes and
+ * points *newname at it, so the common open path doesn't touch the heap.
+ **/
+int get_relocated_file_buf(int fd, const char *name, char *buf, size_t bufsize, char **newname, int *errorcode)
+{
+   int found_file = 0;
+   int use_cache = use_shmcache;
+   char cache_name[MAX_PATH_LEN+1];
+
+   SPINDLE_PROBE1(query_start, name);
+   get_cache_name(name, "", cache_name);
+   cache_name[sizeof(cache_name)-1] = '\0';
+   if (lookupcache_find_buf(cache_name, buf, bufsize, newname, errorcode)) {
+      use_numa_replica_buf(*newname, bufsize);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+   if (namesnap_find(cache_name, buf, bufsize, newname, errorcode)) {
+      lookupcache_add(cache_name, *newname, *errorcode);
+      use_numa_replica_buf(*newname, bufsize);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+
+   if (use_cache) {
+      debug_printf2("Looking up %s in shared cache\n", name);
+      found_file = fetch_from_cache_to(cache_name, buf, bufsize, newname);
+   }
+
+   if (!found_file) {
+      debug_printf2("Send file request to server: %s\n", name);
+      if (send_file_query_buf(fd, (char *) name, buf, bufsize, newname, errorcode) == -1) {
+         /* Past its deadline, or lost.  Not cached, the caller goes to the file system */
+         SPINDLE_PROBE2(query_end, name, NULL);
+         return -1;
+      }
+      debug_printf2("Recv file from server: %s\n", *newname ? *newname : "NONE");
+      if (use_cache)
+         shmcache_update(cache_name, *newname);
+   }
+   lookupcache_add(cache_name, *newname, found_file ? 0 : *errorcode);
+   use_numa_replica_buf(*newname, bufsize);
+   SPINDLE_PROBE2(query_end, name, *newname);
+
+   return 0;
+}
+
+/**
+ * Like get_relocated_file, but lets the server answer with a lazily staged
+ * file.  Lazy answers aren't put in the shared cache, since other lookups
+ * of the file expect its whole contents.
+ **/
+int get_relocated_file_lazy(int fd, const char *name, char** newname, int *errorcode, int *is_lazy)
+{
+   int found_file = 0;
+   int use_cache = use_shmcache;
+   char cache_name[MAX_PATH_LEN+1];
+
+   *is_lazy = 0;
+   SPINDLE_PROBE1(query_start, name);
+   get_cache_name(name, "", cache_name);
+   cache_name[sizeof(cache_name)-1] = '\0';
+   if (lookupcache_find(cache_name, newname, errorcode)) {
+      use_numa_replica(newname);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+   if (namesnap_find(cache_name, NULL, 0, newname, errorcode)) {
+      lookupcache_add(cache_name, *newname, *errorcode);
+      use_numa_replica(newname);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+
+   if (use_cache) {
+      debug_printf2("Looking up %s in shared cache\n", name);
+      found_file = fetch_from_cache(cache_name, newname);
+   }
+
+   if (!found_file) {
+      debug_printf2("Send lazy file request to server: %s\n", name);
+      if (send_lazy_file_query(fd, (char *) name, newname, errorcode, is_lazy) == -1) {
+         /* Past its deadline, or lost.  Not cached, the caller goes to the file system */
+         SPINDLE_PROBE2(query_end, name, NULL);
+         return -1;
+      }
+      debug_printf2("Recv %sfile from server: %s\n", *is_lazy ? "lazy " : "", *newname ? *newname : "NONE");
+      if (use_cache && !*is_lazy)
+         shmcache_update(cache_name, *newname);
+   }
+   if (!*is_lazy)
+      lookupcache_add(cache_name, *newname, found_file ? 0 : *errorcode);
+   use_numa_replica(newname);
+   SPINDLE_PROBE2(query_end, name, *newname);
+
+   return 0;
+}
+
+/**
+ * Like get_relocated_file, but also sets *openfd to a read-only descriptor
+ * for *newname when the server passes one, or -1 if the caller must open
+ * *newname itself.  Answers from the shared and lookup caches never have
+ * a descriptor.
+ **/
+int get_relocated_file_fd(int fd, const char *name, char** newname, int *errorcode, int *openfd)
+{
+   int found_file = 0;
+   int use_cache = use_shmcache;
+   char cache_name[MAX_PATH_LEN+1];
+
+   *openfd = -1;
+   SPINDLE_PROBE1(query_start, name);
+   get_cache_name(name, "", cache_name);
+   cache_name[sizeof(cache_name)-1] = '\0';
+   if (lookupcache_find(cache_name, newname, errorcode)) {
+      use_numa_replica(newname);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+   if (namesnap_find(cache_name, NULL, 0, newname, errorcode)) {
+      lookupcache_add(cache_name, *newname, *errorcode);
+      use_numa_replica(newname);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+
+   if (use_cache) {
+      debug_printf2("Looking up %s in shared cache\n", name);
+      found_file = fetch_from_cache(cache_name, newname);
+   }
+
+   if (!found_file) {
+      debug_printf2("Send file request with descriptor to server: %s\n", name);
+      if (send_file_query_fd(fd, (char *) name, newname, errorcode, openfd) == -1) {
+         /* Past its deadline, or lost.  Not cached, the caller goes to the file system */
+         SPINDLE_PROBE2(query_end, name, NULL);
+         return -1;
+      }
+      debug_printf2("Recv file from server: %s (fd %d)\n", *newname ? *newname : "NONE", *openfd);
+      if (use_cache)
+         shmcache_update(cache_name, *newname);
+   }
+   lookupcache_add(cache_name, *newname, found_file ? 0 : *errorcode);
+   use_numa_replica(newname);
+   SPINDLE_PROBE2(query_end, name, *newname);
+
+   return 0;
+}
+
+/**
+ * Look up name, which is under a jit rule, as get_relocated_file_buf
+ * does.  Only staged copies go in the lookup cache, since a file that
+ * isn't published yet may be soon, and none go in the shared cache.
+ **/
+int get_jit_file(int fd, const char *name, char *buf, size_t bufsize, char **newname, int *errorcode)
+{
+   char cache_name[MAX_PATH_LEN+1];
+   int result;
+
+   SPINDLE_PROBE1(query_start, name);
+   get_cache_name(name, "", cache_name);
+   cache_name[sizeof(cache_name)-1] = '\0';
+   if (lookupcache_find_buf(cache_name, buf, bufsize, newname, errorcode) && *newname) {
+      use_numa_replica_buf(*newname, bufsize);
+      SPINDLE_PROBE2(query_end, name, *newname);
+      return 0;
+   }
+
+   debug_printf2("Send jit file request to server: %s\n", name);
+   result = send_jit_query(fd, (char *) name, buf, bufsize, newname, errorcode);
+   debug_printf2("Recv jit file from server: %s\n", result == 0 && *newname ? *newname : "NONE");
+   if (result == -1)
+      return -1;
+   if (*newname) {
+      lookupcache_add(cache_name, *newname, 0);
+      use_numa_replica_buf(*newname, bufsize);
+   }
+   SPINDLE_PROBE2(query_end, name, *newname);
+   return 0;
+}
+
 char *client_library_load(const char *name)
 {
    char *newname;
+   char abspath[MAX_PATH_LEN+1], jitpath[MAX_PATH_LEN+1];
    int errcode;
+   reloc_action_t action;
 
    check_for_fork();
    if (!use_ldcs || ldcsid == -1) {
       return (char *) name;
    }
-   if (!(opts & OPT_RELOCSO)) {
+   action = client_reloc_action(name);
+   if (action == reloc_pass || (action == reloc_none && !(opts & OPT_RELOCSO))) {
+      return (char *) name;
+   }
+   if (action == reloc_jit) {
+      if (jit_check_file(name, jitpath) != 1)
+         return (char *) name;
+      newname = spindle_strdup(jitpath);
+      debug_printf("la_objsearch redirecting %s to published %s\n", name, newname);
+      test_log(newname);
+      return newname;
+   }
+   if (action == reloc_none && (opts & OPT_LOCALBYPASS) && localfs_is_local(get_abs_path(name, abspath))) {
+      debug_printf2("la_objsearch not redirecting %s on a node-local file system\n", name);
       return (char *) name;
    }
    
@@ -538,9 +1120,10 @@ char *client_library_load(const char *name)
       return (char *) name;
    }
    
-   sync_cwd();
-
-   get_relocated_file(ldcsid, name, &newname, &errcode);
+   if (get_relocated_file(ldcsid, get_abs_path(name, abspath), &newname, &errcode) == -1) {
+      debug_printf("la_objsearch leaving %s to ld.so, the server didn't answer\n", name);
+      return (char *) name;
+   }
  
    if(!newname) {
       newname = concatStrings(NOT_FOUND_PREFIX, name);
@@ -554,16 +1137,575 @@ char *client_library_load(const char *name)
    return newname;
 }
 
+#define MAX_BATCH_QUERY_LEN LDCS_MAX_MSG_LEN
+static char batch_query[MAX_BATCH_QUERY_LEN];
+static int batch_query_len;
+
+static void flush_batch_query()
+{
+   if (!batch_query_len)
+      return;
+   debug_printf2("Sending batch query of %d bytes\n", batch_query_len);
+   send_file_query_batch(ldcsid, batch_query, batch_query_len);
+   batch_query_len = 0;
+}
+
+/**
+ * Write the candidate dir/lib into result, with the cwd in front if dir
+ * is relative.  Returns its length including the NUL, or -1 if it
+ * doesn't fit in MAX_PATH_LEN.
+ **/
+static int get_candidate(const char *dir, int dirlen, const char *lib, char *result)
+{
+   const char *cwd = "";
+   int len;
+
+   if (dir[0] != '/') {
+      cwd = get_cwd();
+      if (!cwd)
+         return -1;
+      if (strcmp(cwd, "/") == 0)
+         cwd = "";
+   }
+   len = snprintf(result, MAX_PATH_LEN+1, "%s%s%.*s/%s", cwd, *cwd ? "/" : "", dirlen, dir, lib);
+   return (len > MAX_PATH_LEN) ? -1 : len + 1;
+}
+
+/**
+ * Append the candidates dir/lib for each dir in the colon separated
+ * search path.  Dirs with $ tokens are skipped, since ld.so would expand
+ * $ORIGIN against the relocated object rather than the original one.
+ * Returns -1 if the batch buffer filled up.
+ **/
+static int add_batch_candidates(const char *searchpath, const char *lib)
+{
+   const char *dir, *end;
+   char candidate[MAX_PATH_LEN+1];
+   int dirlen, len;
+
+   for (dir = searchpath; dir && *dir; dir = *end ? end + 1 : end) {
+      end = strchr(dir, ':');
+      if (!end)
+         end = dir + strlen(dir);
+      dirlen = end - dir;
+      if (!dirlen || memchr(dir, '$', dirlen))
+         continue;
+      len = get_candidate(dir, dirlen, lib, candidate);
+      if (len == -1)
+         continue;
+      if (batch_query_len + len + 1 > MAX_BATCH_QUERY_LEN)
+         return -1;
+      memcpy(batch_query + batch_query_len, candidate, len);
+      batch_query_len += len;
+   }
+   return 0;
+}
+
+/**
+ * Find the string table, rpath and runpath of a mapped object.  Returns
+ * -1 if it has no string table.
+ **/
+static int get_dynamic_paths(struct link_map *map, const char **strtab,
+                             const char **rpath, const char **runpath)
+{
+   ElfW(Dyn) *dentry;
+
+   *strtab = *rpath = *runpath = NULL;
+   if (!map->l_ld)
+      return -1;
+   for (dentry = map->l_ld; dentry->d_tag != DT_NULL; dentry++) {
+      if (dentry->d_tag == DT_STRTAB) {
+         /* ld.so usually relocates the dynamic section in place before la_objopen */
+         *strtab = (const char *) dentry->d_un.d_ptr;
+         if (dentry->d_un.d_ptr < map->l_addr)
+            *strtab += map->l_addr;
+      }
+   }
+   if (!*strtab)
+      return -1;
+   for (dentry = map->l_ld; dentry->d_tag != DT_NULL; dentry++) {
+      if (dentry->d_tag == DT_RPATH)
+         *rpath = *strtab + dentry->d_un.d_val;
+      else if (dentry->d_tag == DT_RUNPATH)
+         *runpath = *strtab + dentry->d_un.d_val;
+   }
+   return 0;
+}
+
+/**
+ * Called when an object is mapped, before ld.so searches for its DT_NEEDED
+ * libraries.  Tell the server up front which files those searches will
+ * look for, so it can stage them together rather than one query at a time.
+ * Candidates are listed in ld.so's search order, one group per library.
+ * Libraries ld.so finds through ld.so.cache or default dirs are left to the
+ * normal la_objsearch queries.
+ **/
+void client_prefetch_deps(struct link_map *map)
+{
+   ElfW(Dyn) *dentry;
+   const char *strtab, *rpath, *runpath, *libpath, *lib, *libc_base;
+   int group_start;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || !(opts & OPT_RELOCSO))
+      return;
+
+   if (get_dynamic_paths(map, &strtab, &rpath, &runpath) == -1)
+      return;
+   libpath = getenv("LD_LIBRARY_PATH");
+   if (!rpath && !runpath && !libpath)
+      return;
+
+   find_libc_name();
+   libc_base = libc_name ? strrchr(libc_name, '/') : NULL;
+   libc_base = libc_base ? libc_base + 1 : libc_name;
+
+   for (dentry = map->l_ld; dentry->d_tag != DT_NULL; dentry++) {
+      if (dentry->d_tag != DT_NEEDED)
+         continue;
+      lib = strtab + dentry->d_un.d_val;
+      if (strchr(lib, '/') || (libc_base && strcmp(lib, libc_base) == 0))
+         continue;
+
+      group_start = batch_query_len;
+      if ((!runpath && add_batch_candidates(rpath, lib) == -1) ||
+          add_batch_candidates(libpath, lib) == -1 ||
+          add_batch_candidates(runpath, lib) == -1) {
+         /* Group didn't fit.  Send what we have and redo this library. */
+         batch_query_len = group_start;
+         if (group_start) {
+            flush_batch_query();
+            dentry--;
+         }
+         continue;
+      }
+      if (batch_query_len != group_start)
+         batch_query[batch_query_len++] = '\0';
+   }
+   flush_batch_query();
+}
+
+#define MAX_SEARCH_QUERY_LEN LDCS_MAX_MSG_LEN
+static char search_query[MAX_SEARCH_QUERY_LEN];
+static int search_query_len;
+
+/**
+ * Append the candidate dir/lib for each dir in the colon separated search
+ * path.  Returns -1 if we can't list the candidates the way ld.so would
+ * try them: a dir is empty (the cwd) or has $ tokens, or they don't fit.
+ **/
+static int add_search_candidates(const char *searchpath, const char *lib)
+{
+   const char *dir, *end;
+   char candidate[MAX_PATH_LEN+1];
+   int dirlen, len;
+
+   if (!searchpath)
+      return 0;
+   for (dir = searchpath; ; dir = end + 1) {
+      end = strchr(dir, ':');
+      if (!end)
+         end = dir + strlen(dir);
+      dirlen = end - dir;
+      if (!dirlen || memchr(dir, '$', dirlen))
+         return -1;
+      len = get_candidate(dir, dirlen, lib, candidate);
+      if (len == -1 || search_query_len + len > MAX_SEARCH_QUERY_LEN)
+         return -1;
+      memcpy(search_query + search_query_len, candidate, len);
+      search_query_len += len;
+      if (!*end)
+         return 0;
+   }
+}
+
+/**
+ * Returns true if map was linked with -z nodefaultlib, so ld.so won't
+ * look in ld.so.cache or the default dirs for its libraries.
+ **/
+static int has_nodeflib(struct link_map *map)
+{
+   ElfW(Dyn) *dentry;
+
+   for (dentry = map->l_ld; dentry->d_tag != DT_NULL; dentry++) {
+      if (dentry->d_tag == DT_FLAGS_1)
+         return (dentry->d_un.d_val & DF_1_NODEFLIB) != 0;
+   }
+   return 0;
+}
+
+/**
+ * List the paths ld.so will try for lib, needed by map, from its rpaths,
+ * LD_LIBRARY_PATH and runpath, in search order.  Then lib itself, which
+ * has the server look in ld.so.cache.  Returns -1 if we can't be sure of
+ * the list.
+ **/
+static int get_search_candidates(const char *lib, struct link_map *map)
+{
+   struct link_map *main_map, *m;
+   const char *strtab, *rpath, *runpath, *main_rpath = NULL, *other_rpath, *other_runpath;
+
+   search_query_len = 0;
+   if (get_dynamic_paths(map, &strtab, &rpath, &runpath) == -1)
+      return -1;
+
+   if (!runpath) {
+      /* ld.so tries the rpath of map, then of the objects that loaded it,
+         then of the executable.  We can't see who loaded map, so give up
+         unless no other library has an rpath. */
+      for (main_map = map; main_map->l_prev; main_map = main_map->l_prev);
+      if (main_map->l_name && main_map->l_name[0] != '\0')
+         return -1;
+      for (m = main_map->l_next; m; m = m->l_next) {
+         if (m == map || get_dynamic_paths(m, &strtab, &other_rpath, &other_runpath) == -1)
+            continue;
+         if (other_rpath)
+            return -1;
+      }
+      if (map != main_map && get_dynamic_paths(main_map, &strtab, &main_rpath, &other_runpath) == 0 && other_runpath)
+         main_rpath = NULL;
+
+      if (add_search_candidates(rpath, lib) == -1 ||
+          (map != main_map && add_search_candidates(main_rpath, lib) == -1))
+         return -1;
+   }
+   if (add_search_candidates(getenv("LD_LIBRARY_PATH"), lib) == -1 ||
+       add_search_candidates(runpath, lib) == -1)
+      return -1;
+   if (!has_nodeflib(map) && search_query_len + (int) strlen(lib) + 1 <= MAX_SEARCH_QUERY_LEN) {
+      strcpy(search_query + search_query_len, lib);
+      search_query_len += strlen(lib) + 1;
+   }
+   return search_query_len ? 0 : -1;
+}
+
+/**
+ * The lookup cache key for a search candidate.  The bare library name
+ * that stands for ld.so.cache is kept as is, which can't clash with the
+ * absolute paths of the other keys.
+ **/
+static void get_search_cache_name(const char *candidate, char *result)
+{
+   if (strchr(candidate, '/'))
+      get_cache_name(candidate, "", result);
+   else
+      snprintf(result, MAX_PATH_LEN, "%s", candidate);
+   result[MAX_PATH_LEN] = '\0';
+}
+
+/**
+ * Called from la_objsearch with the bare name of a library, before ld.so
+ * tries each directory of its search path.  Ask the server for the first
+ * candidate that exists in one query, rather than a query per directory,
+ * with the server standing in for ld.so.cache at the end.  Returns NULL to
+ * let ld.so search as usual, which it also does if none of the candidates
+ * exist: the default dirs come last, and only ld.so knows those.  The
+ * candidates we learned don't exist go in the lookup cache, so ld.so's
+ * queries for them stay local.
+ **/
+char *client_library_search(const char *name, struct link_map *map)
+{
+   char cache_name[MAX_PATH_LEN+1];
+   char *newname, *candidate = NULL, *foundpath = NULL;
+   const char *libc_base;
+   int errcode, index, i, pos;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || !(opts & OPT_RELOCSO) || !(opts & OPT_SEARCHPATH))
+      return NULL;
+
+   find_libc_name();
+   libc_base = libc_name ? strrchr(libc_name, '/') : NULL;
+   libc_base = libc_base ? libc_base + 1 : libc_name;
+   if (libc_base && strcmp(name, libc_base) == 0)
+      return NULL;
+
+   if (get_search_candidates(name, map) == -1) {
+      debug_printf3("Leaving search for %s to ld.so\n", name);
+      return NULL;
+   }
+
+   /* We may already know the answer */
+   for (pos = 0, i = 0; pos < search_query_len; pos += strlen(candidate) + 1, i++) {
+      candidate = search_query + pos;
+      get_search_cache_name(candidate, cache_name);
+      if (!lookupcache_find(cache_name, &newname, &errcode))
+         break;
+      if (newname)
+         goto found;
+   }
+   if (pos == search_query_len)
+      return NULL;
+
+   debug_printf2("Send search request to server for %s with %d bytes of candidates\n", name, search_query_len);
+   send_file_query_search(ldcsid, search_query, search_query_len, &newname, &errcode, &index, &foundpath);
+
+   for (pos = 0, i = 0; pos < search_query_len; pos += strlen(candidate) + 1, i++) {
+      candidate = search_query + pos;
+      if (newname && i == index)
+         break;
+      if (!newname && errcode != ENOENT)
+         break;
+      get_search_cache_name(candidate, cache_name);
+      lookupcache_add(cache_name, NULL, ENOENT);
+   }
+   if (!newname) {
+      debug_printf2("Server found no candidate for %s (%d), leaving search to ld.so\n", name, errcode);
+      return NULL;
+   }
+   if (pos == search_query_len) {
+      err_printf("Server answered search for %s with unknown candidate %d\n", name, index);
+      spindle_free(newname);
+      if (foundpath)
+         spindle_free(foundpath);
+      return NULL;
+   }
+   get_search_cache_name(candidate, cache_name);
+   lookupcache_add(cache_name, newname, 0);
+   if (foundpath)
+      candidate = foundpath;
+
+  found:
+   use_numa_replica(&newname);
+   debug_printf("la_objsearch redirecting %s to %s through search path entry %s\n", name, newname, candidate);
+   patch_on_load_success(newname, candidate);
+   test_log(newname);
+   if (foundpath)
+      spindle_free(foundpath);
+   return newname;
+}
+
+/**
+ * Find the first of paths that exists in one query, for the python
+ * importer's module search.  Sets *index to its position, or to -1 if none
+ * exist.  What we learn goes in the lookup cache, so opening the winner
+ * doesn't cost another query.  Returns -1 if Spindle can't answer.
+ **/
+int client_find_first(const char **paths, int count, int *index)
+{
+   char cache_name[MAX_PATH_LEN+1], abspath[MAX_PATH_LEN+1];
+   const char *path;
+   char *query, *newname;
+   int errcode, found, first, i, len, pos;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || !(opts & OPT_RELOCPY) || count <= 0)
+      return -1;
+
+   /* We may already know the answer */
+   for (first = 0; first < count; first++) {
+      if (!paths[first] || !paths[first][0])
+         return -1;
+      get_cache_name(paths[first], "", cache_name);
+      cache_name[sizeof(cache_name)-1] = '\0';
+      if (!lookupcache_find(cache_name, &newname, &errcode))
+         break;
+      if (newname) {
+         spindle_free(newname);
+         *index = first;
+         return 0;
+      }
+   }
+   if (first == count) {
+      *index = -1;
+      return 0;
+   }
+
+   for (i = first, len = 0; i < count; i++) {
+      if (!paths[i] || !paths[i][0])
+         return -1;
+      len += strlen(get_abs_path(paths[i], abspath)) + 1;
+   }
+   if (len > LDCS_MAX_MSG_LEN)
+      return -1;
+   query = (char *) spindle_malloc(len);
+   if (!query)
+      return -1;
+   for (i = first, pos = 0; i < count; i++) {
+      path = get_abs_path(paths[i], abspath);
+      strcpy(query + pos, path);
+      pos += strlen(path) + 1;
+   }
+
+   debug_printf2("Send first-of query to server for %s and %d more\n", paths[first], count - first - 1);
+   send_file_query_first(ldcsid, query, len, &newname, &errcode, &found);
+   spindle_free(query);
+
+   for (i = first; i < count; i++) {
+      if (newname && i - first == found)
+         break;
+      if (!newname && errcode != ENOENT)
+         break;
+      get_cache_name(paths[i], "", cache_name);
+      cache_name[sizeof(cache_name)-1] = '\0';
+      lookupcache_add(cache_name, NULL, ENOENT);
+   }
+   if (!newname) {
+      if (errcode != ENOENT) {
+         debug_printf2("Server could not answer first-of query for %s (%d)\n", paths[first], errcode);
+         return -1;
+      }
+      *index = -1;
+      return 0;
+   }
+   if (i == count) {
+      err_printf("Server answered first-of query for %s with unknown candidate %d\n", paths[first], found);
+      spindle_free(newname);
+      return -1;
+   }
+
+   debug_printf2("First-of query for %s found %s at %s\n", paths[first], paths[i], newname);
+   get_cache_name(paths[i], "", cache_name);
+   cache_name[sizeof(cache_name)-1] = '\0';
+   lookupcache_add(cache_name, newname, 0);
+   spindle_free(newname);
+   *index = i;
+   return 0;
+}
+
+/**
+ * Tell the server that paths will soon be opened, so it can stage them
+ * while the application computes.  Nothing comes back.  The paths go in
+ * batch queries with one candidate per group, as many queries as they
+ * need.  Returns -1 if Spindle can't take the hint.
+ **/
+int client_prefetch(const char **paths, int count)
+{
+   char abspath[MAX_PATH_LEN+1];
+   const char *path;
+   char *query;
+   int i, len, query_len = 0;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || count < 0)
+      return -1;
+
+   query = (char *) spindle_malloc(MAX_BATCH_QUERY_LEN);
+   if (!query)
+      return -1;
+   for (i = 0; i < count; i++) {
+      if (!paths[i] || !paths[i][0])
+         continue;
+      path = get_abs_path(paths[i], abspath);
+      len = strlen(path) + 1;
+      if (len > MAX_PATH_LEN)
+         continue;
+      if (query_len + len + 1 > MAX_BATCH_QUERY_LEN) {
+         send_file_query_batch(ldcsid, query, query_len);
+         query_len = 0;
+      }
+      memcpy(query + query_len, path, len);
+      query_len += len;
+      query[query_len++] = '\0';
+   }
+   if (query_len) {
+      debug_printf2("Sending prefetch hint for %d paths\n", count);
+      send_file_query_batch(ldcsid, query, query_len);
+   }
+   spindle_free(query);
+   return 0;
+}
+
+/**
+ * Tell the server that the files in dir will soon be opened.  It lists
+ * the directory and stages its files, so we don't read it ourselves.
+ * Returns -1 if Spindle can't take the hint.
+ **/
+int client_prefetch_dir(const char *dir)
+{
+   char abspath[MAX_PATH_LEN+1];
+   const char *path;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || !dir || !dir[0])
+      return -1;
+
+   path = get_abs_path(dir, abspath);
+   if (strlen(path) >= MAX_PATH_LEN)
+      return -1;
+   debug_printf2("Sending prefetch hint for directory %s\n", path);
+   return send_prefetch_dir(ldcsid, (char *) path);
+}
+
+/**
+ * Tell the server the job is past its startup.  Only the first call
+ * from this process is sent; the servers ignore repeats from others.
+ **/
+int client_startup_done()
+{
+   static int sent = 0;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1)
+      return -1;
+   if (sent)
+      return 0;
+   sent = 1;
+   debug_printf2("Telling server the job's startup is done\n");
+   return send_startup_done(ldcsid);
+}
+
+/**
+ * The key-value exchange is carried by the servers; see
+ * ldcs_audit_server_kvs.h.  These return -1 without Spindle's servers,
+ * and spindle_kvs_get returns -1 for a key nothing was put for.
+ **/
+int client_kvs_put(const char *key, const char *value)
+{
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || !key || !key[0] || !value)
+      return -1;
+   return send_kvs_put(ldcsid, key, value);
+}
+
+int client_kvs_fence(int local_procs)
+{
+   int errcode = 0;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || local_procs < 1)
+      return -1;
+   debug_printf2("Fencing the key-value exchange with %d local processes\n", local_procs);
+   if (send_kvs_fence(ldcsid, local_procs, &errcode) == -1)
+      return -1;
+   if (errcode) {
+      errno = errcode;
+      return -1;
+   }
+   return 0;
+}
+
+int client_kvs_get(const char *key, char *value, size_t len)
+{
+   int found = 0;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || !key || !value)
+      return -1;
+   if (send_kvs_get(ldcsid, key, value, len, &found) == -1)
+      return -1;
+   return found ? 0 : -1;
+}
+
 python_path_t *pythonprefixes = NULL;
+int pythonprefix_stem;
 void parse_python_prefixes(int fd)
 {
    char *path;
-   int i, j;
+   int i, j, k;
    int num_pythonprefixes;
 
    if (pythonprefixes)
       return;
-   get_python_prefix(fd, &path);
+   path = getenv("LDCS_PYTHONPREFIX");
+   if (path) {
+      debug_printf3("Taking python prefixes from the process that exec'd us\n");
+      path = spindle_strdup(path);
+   }
+   else {
+      get_python_prefix(fd, &path);
+   }
+   pythonprefix_str = spindle_strdup(path);
 
    num_pythonprefixes = (path[0] == '\0') ? 0 : 1;
    for (i = 0; path[i] != '\0'; i++) {
@@ -582,11 +1724,81 @@ void parse_python_prefixes(int fd)
       pythonprefixes[j].pathsize = strlen(cur);
       i += pythonprefixes[j].pathsize+1;
    }
+
+   /* Drop prefixes that another one already covers, and find the stem all
+      of them share, so is_python_path can turn most paths away with one
+      compare */
+   for (i = 0, k = 0; i < num_pythonprefixes; i++) {
+      for (j = 0; j < num_pythonprefixes; j++) {
+         if (j != i && pythonprefixes[j].pathsize <= pythonprefixes[i].pathsize &&
+             strncmp(pythonprefixes[j].path, pythonprefixes[i].path, pythonprefixes[j].pathsize) == 0 &&
+             (pythonprefixes[j].pathsize < pythonprefixes[i].pathsize || j < i))
+            break;
+      }
+      if (j == num_pythonprefixes)
+         pythonprefixes[k++] = pythonprefixes[i];
+   }
+   num_pythonprefixes = k;
    pythonprefixes[num_pythonprefixes].path = NULL;
    pythonprefixes[num_pythonprefixes].pathsize = 0;
 
+   pythonprefix_stem = num_pythonprefixes ? pythonprefixes[0].pathsize : 0;
+   for (i = 1; i < num_pythonprefixes; i++) {
+      for (j = 0; j < pythonprefix_stem && pythonprefixes[i].path[j] == pythonprefixes[0].path[j]; j++);
+      pythonprefix_stem = j;
+   }
+
    for (i = 0; pythonprefixes[i].path != NULL; i++)
       debug_printf3("Python path # %d = %s\n", i, pythonprefixes[i].path);
+   debug_printf3("Python paths share their first %d characters\n", pythonprefix_stem);
+}
+
+/**
+ * The server hands out the text of --reloc-rules, which we cut up in
+ * place and keep for the life of the process, as with the python prefixes
+ **/
+void parse_reloc_rules(int fd)
+{
+   char *text;
+   int errline;
+
+   if (reloc_rules)
+      return;
+   if (get_reloc_rules(fd, &text) == -1)
+      return;
+
+   reloc_rules = (reloc_rule_t *) spindle_malloc(sizeof(reloc_rule_t) * MAX_RELOC_RULES);
+   num_reloc_rules = reloc_rules_parse(text, reloc_rules, MAX_RELOC_RULES, &errline);
+   if (num_reloc_rules == -1) {
+      err_printf("Could not parse line %d of the relocation rules\n", errline);
+      num_reloc_rules = 0;
+   }
+   debug_printf3("Using %d relocation rules\n", num_reloc_rules);
+}
+
+/**
+ * What the --reloc-rules say about path.  A rule on size is decided by
+ * the stat Spindle serves, so it costs no more than the stat the
+ * application would do on the shared file system.
+ **/
+reloc_action_t client_reloc_action(const char *path)
+{
+   char abspath[MAX_PATH_LEN+1];
+   reloc_action_t action;
+   struct stat buf;
+   int exists;
+
+   if (!num_reloc_rules)
+      return reloc_none;
+
+   path = get_abs_path(path, abspath);
+   action = reloc_rules_match(reloc_rules, num_reloc_rules, path, -1);
+   if (action != reloc_need_size)
+      return action;
+
+   if (get_stat_result(ldcsid, path, 0, &exists, &buf) == -1 || !exists)
+      return reloc_none;
+   return reloc_rules_match(reloc_rules, num_reloc_rules, path, (long long) buf.st_size);
 }
 
 int get_ldso_metadata(signed int *binding_offset)
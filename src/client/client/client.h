@@ -25,6 +25,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <link.h>
 
 #include "spindle_launch.h"
+#include "relocrules.h"
 
 #define NOT_FOUND_PREFIX "/__not_exists"
 
@@ -39,6 +40,16 @@ typedef unsigned long ElfX_Addr;
  **/
 ElfX_Addr client_call_binding(const char *symname, ElfX_Addr symvalue);
 char *client_library_load(const char *libname);
+char *client_library_search(const char *libname, struct link_map *map);
+int client_find_first(const char **paths, int count, int *index);
+int client_prefetch(const char **paths, int count);
+int client_prefetch_dir(const char *dir);
+int client_startup_done();
+int client_kvs_put(const char *key, const char *value);
+int client_kvs_fence(int local_procs);
+int client_kvs_get(const char *key, char *value, size_t len);
+void client_prefetch_deps(struct link_map *map);
+void client_prefault(struct link_map *map);
 int client_init();
 int client_done();
 
@@ -47,8 +58,13 @@ int client_done();
  **/
 void set_errno(int newerrno);
 void patch_on_load_success(const char *rewritten_name, const char *orig_name);
-void sync_cwd();
+const char *get_abs_path(const char *path, char *buffer);
+void invalidate_cwd();
 void check_for_fork();
+void client_exec_env();
+void client_exec_env_failed();
+char **client_exec_envp(char *const envp[]);
+void client_exec_envp_free(char **envp);
 
 /**
  * If Libc's GOT is read-only, reset the permissions to be writable.
@@ -66,11 +82,17 @@ void remove_libc_rogot();
 int handle_stat(const char *path, struct stat *buf, int flags);
 int open_worker(const char *path, int oflag, mode_t mode, int is_64);
 FILE *fopen_worker(const char *path, const char *mode, int is_64);
+int spindle_fd_stat(int fd, struct stat *buf);
+int jit_check_file(const char *path, char *newpath);
 void remap_executable();
 int get_ldso_metadata(signed int *binding_offset);
 
 
 int get_relocated_file(int fd, const char *name, char** newname, int *errcode);
+int get_relocated_file_buf(int fd, const char *name, char *buf, size_t bufsize, char **newname, int *errcode);
+int get_relocated_file_lazy(int fd, const char *name, char** newname, int *errcode, int *is_lazy);
+int get_relocated_file_fd(int fd, const char *name, char** newname, int *errcode, int *openfd);
+int get_jit_file(int fd, const char *name, char *buf, size_t bufsize, char **newname, int *errcode);
 int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct stat *buf);
 int get_existance_test(int fd, const char *path, int *exists);
 /**
@@ -81,8 +103,12 @@ typedef struct {
    int pathsize;
 } python_path_t;
 extern python_path_t *pythonprefixes;
+extern int pythonprefix_stem;
 void parse_python_prefixes(int fd);
 
+void parse_reloc_rules(int fd);
+reloc_action_t client_reloc_action(const char *path);
+
 void test_log(const char *name);
 
 extern opt_t opts;
@@ -90,8 +116,12 @@ extern opt_t opts;
 extern int intercept_open;
 extern int intercept_exec;
 extern int intercept_stat;
+extern int intercept_read;
+extern int intercept_dir;
+extern int intercept_links;
 extern int intercept_close;
 extern int intercept_fork;
+extern int intercept_mpi;
 extern void int_spindle_test_log_msg(char *buffer);
 
 /* ERRNO_NAME currently refers to a glibc internal symbol. */
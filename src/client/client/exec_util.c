@@ -179,7 +179,8 @@ int adjust_if_script(const char *orig_path, char *reloc_path, char **argv, char
    }
    
    debug_printf2("Exec operation requesting interpreter %s for script %s\n", interpreter, orig_path);
-   get_relocated_file(ldcsid, interpreter, &new_interpreter, &errcode);
+   if (get_relocated_file(ldcsid, interpreter, &new_interpreter, &errcode) == -1)
+      new_interpreter = spindle_strdup(interpreter);
    debug_printf2("Changed interpreter %s to %s for script %s\n", 
                  interpreter, new_interpreter ? new_interpreter : "NULL", orig_path);
    if (!new_interpreter) {
@@ -214,6 +215,50 @@ int adjust_if_script(const char *orig_path, char *reloc_path, char **argv, char
    return 0;
 }
 
+/**
+ * Have the server search path for orig_exec, in one query rather than a
+ * stat per entry.  Returns 1 with *reloc_exec set if it found a file we
+ * can run, 0 with *errcode set if there's none, -1 if we should
+ * search ourselves, or 2 if the server didn't answer in time.  That's also how an EACCES answer is taken, since a
+ * file we can run but not read is exec'd in place.
+ **/
+static int server_pathsearch(int ldcsid, const char *orig_exec, const char *path, char **reloc_exec,
+                             int *errcode)
+{
+   char newexec[MAX_PATH_LEN+1];
+   const char *entry, *end;
+   struct stat buf;
+   int index, i, exists = 0;
+
+   *errcode = 0;
+   if (send_file_query_exec(ldcsid, orig_exec, path, reloc_exec, errcode, &index) == -1)
+      return *errcode == ETIMEDOUT ? 2 : -1;
+   if (!*reloc_exec) {
+      debug_printf3("Server search of path for %s returned errcode %d\n", orig_exec, *errcode);
+      return *errcode == ENOENT ? 0 : -1;
+   }
+
+   entry = path;
+   for (i = 0; i < index && (end = strchr(entry, ':')); i++)
+      entry = end + 1;
+   end = strchrnul(entry, ':');
+   if (end == entry)
+      snprintf(newexec, MAX_PATH_LEN, "./%s", orig_exec);
+   else
+      snprintf(newexec, MAX_PATH_LEN, "%.*s/%s", (int) (end - entry), entry, orig_exec);
+   newexec[MAX_PATH_LEN] = '\0';
+
+   get_stat_result(ldcsid, newexec, 0, &exists, &buf);
+   if (exists && !(buf.st_mode & S_IFDIR) && (buf.st_mode & 0111)) {
+      debug_printf("Server search of path found %s for %s at %s\n", newexec, orig_exec, *reloc_exec);
+      return 1;
+   }
+   debug_printf3("Server search of path found %s, which we can't run, searching ourselves\n", newexec);
+   spindle_free(*reloc_exec);
+   *reloc_exec = NULL;
+   return -1;
+}
+
 int exec_pathsearch(int ldcsid, const char *orig_exec, char **reloc_exec, int *errcode)
 {
    char *saveptr = NULL, *path, *cur;
@@ -237,6 +282,17 @@ int exec_pathsearch(int ldcsid, const char *orig_exec, char **reloc_exec, int *e
       debug_printf3("No path.  exec_pathsearch translated %s to %s\n", orig_exec, *reloc_exec);
       return 0;
    }
+
+   switch (server_pathsearch(ldcsid, orig_exec, path, reloc_exec, errcode)) {
+      case 1:
+         return 0;
+      case 0:
+         return -1;
+      case 2:
+         debug_printf2("Server didn't answer path search for %s\n", orig_exec);
+         *reloc_exec = NULL;
+         return 0;
+   }
    path = spindle_strdup(path);
 
    debug_printf3("exec_pathsearch using path %s on file %s\n", path, orig_exec);
@@ -249,7 +305,8 @@ int exec_pathsearch(int ldcsid, const char *orig_exec, char **reloc_exec, int *e
       newexec[MAX_PATH_LEN] = '\0';
       
       debug_printf2("Exec search operation requesting file via stat: %s\n", newexec);
-      get_stat_result(ldcsid, newexec, 0, &exists, &buf);
+      if (get_stat_result(ldcsid, newexec, 0, &exists, &buf) == -1)
+         goto no_answer;
       if (!exists)
          continue;
       if (buf.st_mode & S_IFDIR) {
@@ -263,7 +320,8 @@ int exec_pathsearch(int ldcsid, const char *orig_exec, char **reloc_exec, int *e
          continue;
       }
       debug_printf("File %s exists and has execute set, requesting full file\n", newexec);
-      get_relocated_file(ldcsid, newexec, reloc_exec, errcode);
+      if (get_relocated_file(ldcsid, newexec, reloc_exec, errcode) == -1)
+         goto no_answer;
       debug_printf("Exec search request returned %s -> %s\n", newexec, *reloc_exec ? *reloc_exec : "NULL");
       if (*reloc_exec) {
          found = 1;
@@ -286,6 +344,14 @@ int exec_pathsearch(int ldcsid, const char *orig_exec, char **reloc_exec, int *e
    }
    *errcode = ENOENT;
    return -1;
+
+  no_answer:
+   /* The exec searches path itself */
+   debug_printf2("Server didn't answer during path search for %s\n", orig_exec);
+   spindle_free(path);
+   *reloc_exec = NULL;
+   *errcode = ETIMEDOUT;
+   return 0;
 }
 
 int read_buffer(char *localname, char *buffer, int size)
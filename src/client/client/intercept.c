@@ -20,23 +20,51 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <string.h>
 #include "intercept.h"
 #include "client.h"
+#include "ldcs_pltmap.h"
 
 struct spindle_binding_t spindle_bindings[] = {
    { "", NULL, "", NULL }, 
-   { "open", (void **) &orig_open, "rtcache_open", (void *) rtcache_open },
-   { "open64", (void **) &orig_open64, "rtcache_open64", (void *) rtcache_open64 },
-   { "fopen", (void **) &orig_fopen, "rtcache_fopen", (void *) rtcache_fopen },
-   { "fopen64", (void **) &orig_fopen64, "rtcache_fopen64", (void *) rtcache_fopen64 },
+   { "open", (void **) &orig_open, "rtcache_open", (void *) rtcache_open, &intercept_open },
+   { "open64", (void **) &orig_open64, "rtcache_open64", (void *) rtcache_open64, &intercept_open },
+   { "openat", (void **) &orig_openat, "rtcache_openat", (void *) rtcache_openat, &intercept_open },
+   { "openat64", (void **) &orig_openat64, "rtcache_openat64", (void *) rtcache_openat64, &intercept_open },
+   { "fopen", (void **) &orig_fopen, "rtcache_fopen", (void *) rtcache_fopen, &intercept_open },
+   { "fopen64", (void **) &orig_fopen64, "rtcache_fopen64", (void *) rtcache_fopen64, &intercept_open },
    { "close", (void **) &orig_close, "rtcache_close", (void *) rtcache_close },
-   { "stat", (void **) &orig_stat, "rtcache_stat", (void *) rtcache_stat },
-   { "lstat", (void **) &orig_lstat, "rtcache_lstat", (void *) rtcache_lstat },
-   { "__xstat", (void **) &orig_xstat, "rtcache_xstat", (void *) rtcache_xstat },
-   { "__xstat64", (void **) &orig_xstat64, "rtcache_xstat64", (void *) rtcache_xstat64 },
-   { "__lxstat", (void **) &orig_lxstat, "rtcache_lxstat", (void *) rtcache_lxstat },
-   { "__lxstat64", (void **) &orig_lxstat64, "rtcache_lxstat64", (void *) rtcache_lxstat64 },
+   { "read", (void **) &orig_read, "rtcache_read", (void *) rtcache_read, &intercept_read },
+   { "pread", (void **) &orig_pread, "rtcache_pread", (void *) rtcache_pread, &intercept_read },
+   { "pread64", (void **) &orig_pread64, "rtcache_pread64", (void *) rtcache_pread64, &intercept_read },
+   { "readv", (void **) &orig_readv, "rtcache_readv", (void *) rtcache_readv, &intercept_read },
+   { "mmap", (void **) &orig_mmap, "rtcache_mmap", (void *) rtcache_mmap, &intercept_read },
+   { "mmap64", (void **) &orig_mmap64, "rtcache_mmap64", (void *) rtcache_mmap64, &intercept_read },
+   { "dup", (void **) &orig_dup, "rtcache_dup", (void *) rtcache_dup },
+   { "dup2", (void **) &orig_dup2, "rtcache_dup2", (void *) rtcache_dup2 },
+   { "dup3", (void **) &orig_dup3, "rtcache_dup3", (void *) rtcache_dup3 },
+   { "fdopen", (void **) &orig_fdopen, "rtcache_fdopen", (void *) rtcache_fdopen },
+   { "chdir", (void **) &orig_chdir, "rtcache_chdir", (void *) rtcache_chdir },
+   { "fchdir", (void **) &orig_fchdir, "rtcache_fchdir", (void *) rtcache_fchdir },
+   { "rename", (void **) &orig_rename, "rtcache_rename", (void *) rtcache_rename, &intercept_open },
+   { "renameat", (void **) &orig_renameat, "rtcache_renameat", (void *) rtcache_renameat, &intercept_open },
+   { "lseek", (void **) &orig_lseek, "rtcache_lseek", (void *) rtcache_lseek, &intercept_read },
+   { "lseek64", (void **) &orig_lseek64, "rtcache_lseek64", (void *) rtcache_lseek64, &intercept_read },
+   { "opendir", (void **) &orig_opendir, "rtcache_opendir", (void *) rtcache_opendir, &intercept_dir },
+   { "closedir", (void **) &orig_closedir, "rtcache_closedir", (void *) rtcache_closedir, &intercept_dir },
+   { "dirfd", (void **) &orig_dirfd, "rtcache_dirfd", (void *) rtcache_dirfd, &intercept_dir },
+   { "stat", (void **) &orig_stat, "rtcache_stat", (void *) rtcache_stat, &intercept_stat },
+   { "lstat", (void **) &orig_lstat, "rtcache_lstat", (void *) rtcache_lstat, &intercept_stat },
+   { "__xstat", (void **) &orig_xstat, "rtcache_xstat", (void *) rtcache_xstat, &intercept_stat },
+   { "__xstat64", (void **) &orig_xstat64, "rtcache_xstat64", (void *) rtcache_xstat64, &intercept_stat },
+   { "__lxstat", (void **) &orig_lxstat, "rtcache_lxstat", (void *) rtcache_lxstat, &intercept_stat },
+   { "__lxstat64", (void **) &orig_lxstat64, "rtcache_lxstat64", (void *) rtcache_lxstat64, &intercept_stat },
    { "fstat", (void **) &orig_fstat, "rtcache_fstat", (void *) rtcache_fstat },
    { "__fxstat", (void **) &orig_fxstat, "rtcache_fxstat", (void *) rtcache_fxstat },
    { "__fxstat64", (void **) &orig_fxstat64, "rtcache_fxstat64", (void *) rtcache_fxstat64 },
+   { "fstatat", (void **) &orig_fstatat, "rtcache_fstatat", (void *) rtcache_fstatat, &intercept_stat },
+   { "fstatat64", (void **) &orig_fstatat64, "rtcache_fstatat64", (void *) rtcache_fstatat64, &intercept_stat },
+   { "__fxstatat", (void **) &orig_fxstatat, "rtcache_fxstatat", (void *) rtcache_fxstatat, &intercept_stat },
+   { "__fxstatat64", (void **) &orig_fxstatat64, "rtcache_fxstatat64", (void *) rtcache_fxstatat64, &intercept_stat },
+   { "statx", (void **) &orig_statx, "rtcache_statx", (void *) rtcache_statx, &intercept_stat },
+   { "faccessat", (void **) &orig_faccessat, "rtcache_faccessat", (void *) rtcache_faccessat, &intercept_stat },
    { "execl", (void **) NULL, "execl_wrapper", (void *) execl_wrapper },
    { "execv", (void **) &orig_execv, "execv_wrapper", (void *) execv_wrapper },
    { "execle", (void **) NULL, "execle_wrapper", (void *) execle_wrapper },
@@ -46,6 +74,8 @@ struct spindle_binding_t spindle_bindings[] = {
    { "vfork", (void **) NULL, "vfork_wrapper", (void *) vfork_wrapper },
    { "readlink", (void **) &orig_readlink, "readlink_wrapper", (void *) readlink_wrapper },
    { "readlinkat", (void **) &orig_readlinkat, "readlinkat_wrapper", (void *) readlinkat_wrapper },   
+   { "realpath", (void **) &orig_realpath, "realpath_wrapper", (void *) realpath_wrapper, &intercept_links },
+   { "__realpath_chk", (void **) &orig_realpath_chk, "realpath_chk_wrapper", (void *) realpath_chk_wrapper, &intercept_links },
    { "spindle_enable", NULL, "int_spindle_enable", (void *) int_spindle_enable },
    { "spindle_disable", NULL, "int_spindle_disable", (void *) int_spindle_disable },
    { "spindle_is_enabled", NULL, "int_spindle_is_enabled", (void *) int_spindle_is_enabled },
@@ -54,6 +84,17 @@ struct spindle_binding_t spindle_bindings[] = {
    { "spindle_stat", NULL, "int_spindle_stat", (void *) int_spindle_stat },
    { "spindle_lstat", NULL, "int_spindle_lstat", (void *) int_spindle_lstat },
    { "spindle_fopen", NULL, "int_spindle_fopen", (void *) int_spindle_fopen },
+   { "spindle_find_first", NULL, "int_spindle_find_first", (void *) int_spindle_find_first },
+   { "spindle_prefetch", NULL, "int_spindle_prefetch", (void *) int_spindle_prefetch },
+   { "spindle_prefetch_dir", NULL, "int_spindle_prefetch_dir", (void *) int_spindle_prefetch_dir },
+   { "spindle_startup_done", NULL, "int_spindle_startup_done", (void *) int_spindle_startup_done },
+   { "spindle_kvs_put", NULL, "int_spindle_kvs_put", (void *) int_spindle_kvs_put },
+   { "spindle_kvs_fence", NULL, "int_spindle_kvs_fence", (void *) int_spindle_kvs_fence },
+   { "spindle_kvs_get", NULL, "int_spindle_kvs_get", (void *) int_spindle_kvs_get },
+   { "spindle_bcast_file", NULL, "int_spindle_bcast_file", (void *) int_spindle_bcast_file },
+   { "spindle_quiesce", NULL, "int_spindle_quiesce", (void *) int_spindle_quiesce },
+   { "MPI_Init", (void **) &orig_MPI_Init, "mpi_init_wrapper", (void *) mpi_init_wrapper, &intercept_mpi },
+   { "MPI_Init_thread", (void **) &orig_MPI_Init_thread, "mpi_init_thread_wrapper", (void *) mpi_init_thread_wrapper, &intercept_mpi },
    { "spindle_test_log_msg", NULL, "int_spindle_test_log_msg", (void *) int_spindle_test_log_msg },
    { NULL, NULL, NULL, NULL }
 };
@@ -74,6 +115,28 @@ static unsigned int hash_func(const char *str) {
    return hash % HASH_TABLE_SIZE;
 }
 
+#if !defined(NDEBUG)
+/**
+ * Servers name PLT map entries from PLTMAP_NAME_LIST, which must cover
+ * every binding
+ **/
+static int in_pltmap_names(const char *name)
+{
+   static const char *pltmap_names[] = { PLTMAP_NAME_LIST };
+   unsigned int i;
+
+   for (i = 0; i < sizeof(pltmap_names) / sizeof(*pltmap_names); i++) {
+      if (strcmp(name, pltmap_names[i]) == 0)
+         return 1;
+   }
+   return 0;
+}
+#endif
+
+/**
+ * Only bindings whose interception is on for this run go in the hash, so
+ * the others are never redirected and the application calls libc directly
+ **/
 void init_bindings_hash()
 {
    struct spindle_binding_t *b;
@@ -87,6 +150,9 @@ void init_bindings_hash()
 
       unsigned int pos = hash_func(b->name);
       assert(pos != UINT_MAX);
+      assert(in_pltmap_names(b->name));
+      if (b->enabled && !*b->enabled)
+         continue;
 
       while (binding_hash_table[pos] != 0) {
          pos++;
@@ -19,9 +19,13 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <dirent.h>
+
+struct statx;
 
 extern int (*orig_stat)(const char *path, struct stat *buf);
 extern int (*orig_lstat)(const char *path, struct stat *buf);
@@ -32,17 +36,48 @@ extern int (*orig_lxstat64)(int vers, const char *path, struct stat *buf);
 extern int (*orig_fstat)(int fd, struct stat *buf);
 extern int (*orig_fxstat)(int vers, int fd, struct stat *buf);
 extern int (*orig_fxstat64)(int vers, int fd, struct stat *buf);
+extern int (*orig_fstatat)(int dirfd, const char *path, struct stat *buf, int flags);
+extern int (*orig_fstatat64)(int dirfd, const char *path, struct stat *buf, int flags);
+extern int (*orig_fxstatat)(int vers, int dirfd, const char *path, struct stat *buf, int flags);
+extern int (*orig_fxstatat64)(int vers, int dirfd, const char *path, struct stat *buf, int flags);
+extern int (*orig_statx)(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf);
+extern int (*orig_faccessat)(int dirfd, const char *path, int mode, int flags);
 extern int (*orig_execv)(const char *path, char *const argv[]);
 extern int (*orig_execve)(const char *path, char *const argv[], char *const envp[]);
 extern int (*orig_execvp)(const char *file, char *const argv[]);
 extern ssize_t (*orig_readlink)(const char *path, char *buf, size_t bufsiz);
 extern int (*orig_readlinkat)(int dirfd, const char *pathname, char *buf, size_t bufsiz);
+extern char *(*orig_realpath)(const char *path, char *resolved_path);
+extern char *(*orig_realpath_chk)(const char *path, char *resolved_path, size_t resolved_len);
 extern pid_t (*orig_fork)();
 extern int (*orig_open)(const char *pathname, int flags, ...);
 extern int (*orig_open64)(const char *pathname, int flags, ...);
 extern FILE* (*orig_fopen)(const char *pathname, const char *mode);
 extern FILE* (*orig_fopen64)(const char *pathname, const char *mode);
 extern int (*orig_close)(int fd);
+extern ssize_t (*orig_read)(int fd, void *buf, size_t count);
+extern ssize_t (*orig_pread)(int fd, void *buf, size_t count, off_t offset);
+extern ssize_t (*orig_pread64)(int fd, void *buf, size_t count, int64_t offset);
+extern ssize_t (*orig_readv)(int fd, const struct iovec *iov, int iovcnt);
+extern void* (*orig_mmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+extern void* (*orig_mmap64)(void *addr, size_t length, int prot, int flags, int fd, int64_t offset);
+extern int (*orig_dup)(int oldfd);
+extern int (*orig_dup2)(int oldfd, int newfd);
+extern int (*orig_dup3)(int oldfd, int newfd, int flags);
+extern FILE* (*orig_fdopen)(int fd, const char *mode);
+extern int (*orig_openat)(int dirfd, const char *pathname, int flags, ...);
+extern int (*orig_openat64)(int dirfd, const char *pathname, int flags, ...);
+extern int (*orig_chdir)(const char *path);
+extern int (*orig_fchdir)(int fd);
+extern off_t (*orig_lseek)(int fd, off_t offset, int whence);
+extern int64_t (*orig_lseek64)(int fd, int64_t offset, int whence);
+extern DIR *(*orig_opendir)(const char *name);
+extern int (*orig_closedir)(DIR *dirp);
+extern int (*orig_dirfd)(DIR *dirp);
+extern int (*orig_rename)(const char *oldpath, const char *newpath);
+extern int (*orig_renameat)(int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
+extern int (*orig_MPI_Init)(int *argc, char ***argv);
+extern int (*orig_MPI_Init_thread)(int *argc, char ***argv, int required, int *provided);
 
 int rtcache_stat(const char *path, struct stat *buf);
 int rtcache_lstat(const char *path, struct stat *buf);
@@ -53,12 +88,39 @@ int rtcache_lxstat64(int vers, const char *path, struct stat *buf);
 int rtcache_fstat(int fd, struct stat *buf);
 int rtcache_fxstat(int vers, int fd, struct stat *buf);
 int rtcache_fxstat64(int vers, int fd, struct stat *buf);
+int rtcache_fstatat(int dirfd, const char *path, struct stat *buf, int flags);
+int rtcache_fstatat64(int dirfd, const char *path, struct stat *buf, int flags);
+int rtcache_fxstatat(int vers, int dirfd, const char *path, struct stat *buf, int flags);
+int rtcache_fxstatat64(int vers, int dirfd, const char *path, struct stat *buf, int flags);
+int rtcache_statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf);
+int rtcache_faccessat(int dirfd, const char *path, int mode, int flags);
 
 int rtcache_open(const char *path, int oflag, ...);
 int rtcache_open64(const char *path, int oflag, ...);
+int rtcache_openat(int dirfd, const char *path, int oflag, ...);
+int rtcache_openat64(int dirfd, const char *path, int oflag, ...);
 FILE *rtcache_fopen(const char *path, const char *mode);
 FILE *rtcache_fopen64(const char *path, const char *mode);
 int rtcache_close(int fd);
+ssize_t rtcache_read(int fd, void *buf, size_t count);
+ssize_t rtcache_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t rtcache_pread64(int fd, void *buf, size_t count, int64_t offset);
+ssize_t rtcache_readv(int fd, const struct iovec *iov, int iovcnt);
+void *rtcache_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+void *rtcache_mmap64(void *addr, size_t length, int prot, int flags, int fd, int64_t offset);
+int rtcache_dup(int oldfd);
+int rtcache_dup2(int oldfd, int newfd);
+int rtcache_dup3(int oldfd, int newfd, int flags);
+FILE *rtcache_fdopen(int fd, const char *mode);
+int rtcache_chdir(const char *path);
+int rtcache_fchdir(int fd);
+off_t rtcache_lseek(int fd, off_t offset, int whence);
+int64_t rtcache_lseek64(int fd, int64_t offset, int whence);
+DIR *rtcache_opendir(const char *name);
+int rtcache_closedir(DIR *dirp);
+int rtcache_dirfd(DIR *dirp);
+int rtcache_rename(const char *oldpath, const char *newpath);
+int rtcache_renameat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
 
 int execl_wrapper(const char *path, const char *arg0, ...);
 int execv_wrapper(const char *path, char *const argv[]);
@@ -70,16 +132,30 @@ pid_t vfork_wrapper();
 
 ssize_t readlink_wrapper(const char *path, char *buf, size_t bufsiz);
 int readlinkat_wrapper(int dirfd, const char *pathname, char *buf, size_t bufsiz);
+char *realpath_wrapper(const char *path, char *resolved_path);
+char *realpath_chk_wrapper(const char *path, char *resolved_path, size_t resolved_len);
+
+int mpi_init_wrapper(int *argc, char ***argv);
+int mpi_init_thread_wrapper(int *argc, char ***argv, int required, int *provided);
 
 int int_spindle_open(const char *pathname, int flags, ...);
 FILE *int_spindle_fopen(const char *path, const char *opts);
 int int_spindle_stat(const char *path, struct stat *buf);
 int int_spindle_lstat(const char *path, struct stat *buf);
 int int_spindle_lstat(const char *path, struct stat *buf);
+int int_spindle_find_first(const char **paths, int count);
+int int_spindle_prefetch(const char **paths, int n);
+int int_spindle_prefetch_dir(const char *dir);
+int int_spindle_startup_done();
+int int_spindle_kvs_put(const char *key, const char *value);
+int int_spindle_kvs_fence(int local_procs);
+int int_spindle_kvs_get(const char *key, char *value, size_t len);
+void *int_spindle_bcast_file(const char *path, size_t *size);
 int int_spindle_is_present();
 void int_spindle_enable();
 void int_spindle_disable();
 int int_spindle_is_enabled();
+void int_spindle_quiesce();
 void int_spindle_test_log_msg(char *buffer);
 
 struct spindle_binding_t {
@@ -87,6 +163,7 @@ struct spindle_binding_t {
    void **libc_func;
    const char *spindle_name;
    void *spindle_func;
+   int *enabled;     /* NULL if always bound, else bound only if *enabled */
 };
 
 void init_bindings_hash();
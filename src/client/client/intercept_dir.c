@@ -0,0 +1,162 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ldcs_api.h"
+#include "client.h"
+#include "client_heap.h"
+#include "client_api.h"
+#include "should_intercept.h"
+#include "intercept.h"
+
+DIR *(*orig_opendir)(const char *name);
+int (*orig_closedir)(DIR *dirp);
+int (*orig_dirfd)(DIR *dirp);
+
+/**
+ * Directories whose listing the server serves are opened from the local
+ * directory it built, so readdir, telldir, seekdir and rewinddir all run
+ * in libc as for any other directory.  Only the directory's descriptor
+ * has to lead back to the original, since anything opened relative to
+ * it should find the original's files.  That descriptor is opened when
+ * dirfd first asks for it.
+ **/
+#define MAX_SERVED_DIRS 64
+
+typedef struct {
+   DIR *dirp;
+   char *path;
+   int fd;
+} served_dir_t;
+
+static served_dir_t served_dirs[MAX_SERVED_DIRS];
+static int num_served_dirs;
+static struct lock_t served_dir_lock;
+
+static served_dir_t *find_served_dir(DIR *dirp)
+{
+   int i;
+   for (i = 0; i < num_served_dirs; i++) {
+      if (served_dirs[i].dirp == dirp)
+         return served_dirs + i;
+   }
+   return NULL;
+}
+
+static int add_served_dir(DIR *dirp, const char *path)
+{
+   if (lock(&served_dir_lock) == -1)
+      return -1;
+   if (num_served_dirs == MAX_SERVED_DIRS) {
+      unlock(&served_dir_lock);
+      return -1;
+   }
+   served_dirs[num_served_dirs].dirp = dirp;
+   served_dirs[num_served_dirs].path = spindle_strdup(path);
+   served_dirs[num_served_dirs].fd = -1;
+   num_served_dirs++;
+   unlock(&served_dir_lock);
+   return 0;
+}
+
+static DIR *call_orig_opendir(const char *name)
+{
+   return orig_opendir ? orig_opendir(name) : opendir(name);
+}
+
+DIR *rtcache_opendir(const char *name)
+{
+   char abspath[MAX_PATH_LEN+1];
+   char *newpath = NULL;
+   const char *path;
+   int errcode = 0;
+   DIR *dirp;
+
+   check_for_fork();
+   if (ldcsid < 0 || !use_ldcs || !name || num_served_dirs == MAX_SERVED_DIRS)
+      return call_orig_opendir(name);
+   path = get_abs_path(name, abspath);
+   if (opendir_filter(path) != REDIRECT)
+      return call_orig_opendir(name);
+
+   if (send_dir_query(ldcsid, (char *) path, &newpath, &errcode) == -1 || !newpath) {
+      debug_printf3("Listing %s from the file system, server answered %d\n", path, errcode);
+      return call_orig_opendir(name);
+   }
+
+   dirp = call_orig_opendir(newpath);
+   if (!dirp) {
+      debug_printf("Could not open %s, the listing of %s: %s\n", newpath, path, strerror(errno));
+      spindle_free(newpath);
+      return call_orig_opendir(name);
+   }
+   if (add_served_dir(dirp, path) == -1) {
+      /* Too many open to track their descriptors */
+      orig_closedir(dirp);
+      spindle_free(newpath);
+      return call_orig_opendir(name);
+   }
+   debug_printf2("Redirecting 'opendir' call, %s to %s\n", path, newpath);
+   test_log(newpath);
+   spindle_free(newpath);
+   return dirp;
+}
+
+int rtcache_dirfd(DIR *dirp)
+{
+   served_dir_t *sd;
+   int fd;
+
+   if (!num_served_dirs || lock(&served_dir_lock) == -1)
+      return orig_dirfd(dirp);
+   sd = find_served_dir(dirp);
+   if (!sd) {
+      unlock(&served_dir_lock);
+      return orig_dirfd(dirp);
+   }
+   if (sd->fd == -1) {
+      sd->fd = open(sd->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (sd->fd == -1)
+         debug_printf("Could not open %s for dirfd: %s\n", sd->path, strerror(errno));
+   }
+   fd = sd->fd;
+   unlock(&served_dir_lock);
+   return fd;
+}
+
+int rtcache_closedir(DIR *dirp)
+{
+   served_dir_t *sd;
+
+   if (num_served_dirs && lock(&served_dir_lock) != -1) {
+      sd = find_served_dir(dirp);
+      if (sd) {
+         if (sd->fd != -1)
+            orig_close(sd->fd);
+         spindle_free(sd->path);
+         *sd = served_dirs[--num_served_dirs];
+      }
+      unlock(&served_dir_lock);
+   }
+   return orig_closedir(dirp);
+}
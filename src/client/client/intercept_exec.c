@@ -32,6 +32,7 @@
 #include "should_intercept.h"
 #include "exec_util.h"
 #include "handle_vararg.h"
+#include "shmcache.h"
 
 #define INTERCEPT_EXEC
 #if defined(INSTR_LIB)
@@ -52,10 +53,11 @@ static int prep_exec(const char *filepath, char **argv,
    char *interp_name;
 
    debug_printf3("prep_exec for filepath %s to newpath %s\n", filepath, newpath);
+   shmcache_done();
    
-   if (errcode == EACCES) {
-      debug_printf2("exec'ing original path %s because file wasn't +r, but could be +x\n",
-                    newpath);
+   if (errcode == EACCES || errcode == ETIMEDOUT) {
+      debug_printf2("exec'ing original path %s because %s\n", filepath,
+                    errcode == EACCES ? "file wasn't +r, but could be +x" : "the server didn't answer in time");
       strncpy(newpath, filepath, newpath_size);
       newpath[newpath_size-1] = '\0';
       debug_printf("test_log(%s)\n", newpath);
@@ -115,6 +117,8 @@ static int prep_exec(const char *filepath, char **argv,
 static int find_exec(const char *filepath, char **argv, char *newpath, int newpath_size, char ***new_argv)
 {
    char *newname = NULL;
+   const char *abspath;
+   char abspath_buffer[MAX_PATH_LEN+1];
    int errcode, exists;
    struct stat buf;
 
@@ -130,9 +134,14 @@ static int find_exec(const char *filepath, char **argv, char *newpath, int newpa
       return 0;
    }
 
-   sync_cwd();
-   debug_printf2("Requesting stat on exec of %s to validate file\n", filepath);
-   get_stat_result(ldcsid, (char *) filepath, 0, &exists, &buf);
+   abspath = get_abs_path(filepath, abspath_buffer);
+   debug_printf2("Requesting stat on exec of %s to validate file\n", abspath);
+   if (get_stat_result(ldcsid, (char *) abspath, 0, &exists, &buf) == -1) {
+      debug_printf2("No stat of %s from the server, exec'ing it as is\n", abspath);
+      strncpy(newpath, filepath, newpath_size);
+      newpath[newpath_size-1] = '\0';
+      return 0;
+   }
    if (!exists) {
       set_errno(ENOENT);
       return -1;
@@ -145,7 +154,7 @@ static int find_exec(const char *filepath, char **argv, char *newpath, int newpa
       return -1;
    }
    debug_printf2("Exec operation requesting file: %s\n", filepath);
-   get_relocated_file(ldcsid, (char *) filepath, &newname, &errcode);
+   get_relocated_file(ldcsid, (char *) abspath, &newname, &errcode);
    debug_printf("Exec file request returned %s -> %s with errcode %d\n",
                 filepath, newname ? newname : "NULL", errcode);
 
@@ -171,7 +180,6 @@ static int find_exec_pathsearch(const char *filepath, char **argv, char *newpath
       newpath[newpath_size-1] = '\0';
       return 0;
    }
-   sync_cwd();
 
    result = exec_pathsearch(ldcsid, filepath, &newname, &errcode);
    if (result == -1) {
@@ -197,11 +205,13 @@ int execl_wrapper(const char *path, const char *arg0, ...)
       return result;
    }
    debug_printf("execl redirection of %s to %s\n", path, newpath);
+   client_exec_env();
    if (orig_execv)
       result = orig_execv(newpath, new_argv ? new_argv : argv);
    else
       result = execv(newpath, new_argv ? new_argv : argv);
    error = errno;
+   client_exec_env_failed();
 
    VARARG_TO_ARGV_CLEANUP;
 
@@ -223,7 +233,9 @@ int execv_wrapper(const char *path, char *const argv[])
       return result;
    }
    debug_printf("execv redirection of %s to %s\n", path, newpath);
+   client_exec_env();
    result = orig_execv(newpath, new_argv ? new_argv : argv);
+   client_exec_env_failed();
 
    if (new_argv)
       spindle_free(new_argv);
@@ -235,7 +247,7 @@ int execv_wrapper(const char *path, char *const argv[])
 int execle_wrapper(const char *path, const char *arg0, ...)
 {
    int error, result;
-   char **envp;
+   char **envp, **new_envp;
    char newpath[MAX_PATH_LEN+1];
 
    VARARG_TO_ARGV;
@@ -248,11 +260,13 @@ int execle_wrapper(const char *path, const char *arg0, ...)
       return result;
    }
    debug_printf("execle redirection of %s to %s\n", path, newpath);
+   new_envp = client_exec_envp(envp);
    if (orig_execve)
-      result = orig_execve(newpath, new_argv ? new_argv : argv, envp);
+      result = orig_execve(newpath, new_argv ? new_argv : argv, new_envp ? new_envp : envp);
    else
-      result = execve(newpath, new_argv ? new_argv : argv, envp);
+      result = execve(newpath, new_argv ? new_argv : argv, new_envp ? new_envp : envp);
    error = errno;
+   client_exec_envp_free(new_envp);
 
    VARARG_TO_ARGV_CLEANUP;
 
@@ -264,7 +278,7 @@ int execle_wrapper(const char *path, const char *arg0, ...)
 int execve_wrapper(const char *path, char *const argv[], char *const envp[])
 {
    char newpath[MAX_PATH_LEN+1];
-   char **new_argv = NULL;
+   char **new_argv = NULL, **new_envp;
    int result;
 
    debug_printf2("Intercepted execve on %s\n", path);
@@ -274,7 +288,9 @@ int execve_wrapper(const char *path, char *const argv[], char *const envp[])
       return result;
    }   
    debug_printf2("execve redirection of %s to %s\n", path, newpath);
-   result = orig_execve(newpath, new_argv ? new_argv : argv, (char **) envp);
+   new_envp = client_exec_envp(envp);
+   result = orig_execve(newpath, new_argv ? new_argv : argv, new_envp ? new_envp : (char **) envp);
+   client_exec_envp_free(new_envp);
    if (new_argv)
       spindle_free(new_argv);
    return result;
@@ -293,11 +309,13 @@ int execlp_wrapper(const char *path, const char *arg0, ...)
       return result;
    }   
    debug_printf2("execlp redirection of %s to %s\n", path, newpath);
+   client_exec_env();
    if (orig_execv)
       result = orig_execv(newpath, new_argv ? new_argv : argv);
    else
       result = execv(newpath, new_argv ? new_argv : argv);
    error = errno;
+   client_exec_env_failed();
 
    VARARG_TO_ARGV_CLEANUP;
 
@@ -320,7 +338,9 @@ int execvp_wrapper(const char *path, char *const argv[])
    }   
    debug_printf("execvp redirection of %s to %s\n", path, newpath);
    
+   client_exec_env();
    result = orig_execvp(newpath, new_argv ? new_argv : argv);
+   client_exec_env_failed();
    if (new_argv)
       spindle_free(new_argv);
    return result;
@@ -25,12 +25,16 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "ldcs_api.h"
 #include "client.h"
 #include "client_heap.h"
 #include "client_api.h"
+#include "client_timing.h"
 #include "should_intercept.h"
+#include "autobypass.h"
 
 #define INTERCEPT_OPEN
 #if defined(INSTR_LIB)
@@ -42,14 +46,447 @@ int (*orig_open64)(const char *pathname, int flags, ...);
 FILE* (*orig_fopen)(const char *pathname, const char *mode);
 FILE* (*orig_fopen64)(const char *pathname, const char *mode);
 int (*orig_close)(int fd);
+ssize_t (*orig_read)(int fd, void *buf, size_t count);
+ssize_t (*orig_pread)(int fd, void *buf, size_t count, off_t offset);
+ssize_t (*orig_pread64)(int fd, void *buf, size_t count, int64_t offset);
+ssize_t (*orig_readv)(int fd, const struct iovec *iov, int iovcnt);
+void* (*orig_mmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+void* (*orig_mmap64)(void *addr, size_t length, int prot, int flags, int fd, int64_t offset);
+int (*orig_dup)(int oldfd);
+int (*orig_dup2)(int oldfd, int newfd);
+int (*orig_dup3)(int oldfd, int newfd, int flags);
+FILE* (*orig_fdopen)(int fd, const char *mode);
+int (*orig_openat)(int dirfd, const char *pathname, int flags, ...);
+int (*orig_openat64)(int dirfd, const char *pathname, int flags, ...);
+int (*orig_chdir)(const char *path);
+int (*orig_fchdir)(int fd);
+off_t (*orig_lseek)(int fd, off_t offset, int whence);
+int64_t (*orig_lseek64)(int fd, int64_t offset, int whence);
+int (*orig_rename)(const char *oldpath, const char *newpath);
+int (*orig_renameat)(int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
+
+/**
+ * Descriptors for files the server staged lazily.  Their local files are
+ * sparse, so before each read we ask the server to fill in the range
+ * being read.  Reads that don't go through these wrappers, such as
+ * through a FILE* or a dup'd descriptor, can't be tracked, so those
+ * fetch the whole file first.
+ **/
+#define MAX_LAZY_FDS 64
+
+typedef struct {
+   int fd;          /* -1 once closed while a fetch was busy with it */
+   size_t size;
+   char *localpath;
+   int busy;        /* fetches in flight, which the entry is kept for */
+} lazy_fd_t;
+
+static lazy_fd_t lazy_fds[MAX_LAZY_FDS];
+static int num_lazy_fds;
+static struct lock_t lazy_lock;
+
+static lazy_fd_t *find_lazy_fd(int fd)
+{
+   int i;
+   for (i = 0; i < num_lazy_fds; i++) {
+      if (lazy_fds[i].fd == fd)
+         return lazy_fds + i;
+   }
+   return NULL;
+}
+
+/* The entry a fetch was busy with, which may have moved in lazy_fds */
+static lazy_fd_t *find_lazy_localpath(char *localpath)
+{
+   int i;
+   for (i = 0; i < num_lazy_fds; i++) {
+      if (lazy_fds[i].localpath == localpath)
+         return lazy_fds + i;
+   }
+   return NULL;
+}
+
+/* Stop tracking lfd, or only its descriptor while a fetch is busy with it */
+static void remove_lazy_fd(lazy_fd_t *lfd)
+{
+   if (lfd->busy) {
+      lfd->fd = -1;
+      return;
+   }
+   spindle_free(lfd->localpath);
+   *lfd = lazy_fds[--num_lazy_fds];
+}
+
+static int fetch_lazy_range(char *localpath, size_t offset, size_t len)
+{
+   check_for_fork();
+   if (ldcsid < 0)
+      return -1;
+   return send_range_query(ldcsid, localpath, offset, len);
+}
+
+static void add_lazy_fd(int fd, char *localpath)
+{
+   struct stat buf;
+   lazy_fd_t lfd;
+
+   lfd.fd = fd;
+   lfd.localpath = spindle_strdup(localpath);
+   lfd.size = (fstat(fd, &buf) == 0) ? (size_t) buf.st_size : (size_t) -1;
+   lfd.busy = 0;
+
+   if (lock(&lazy_lock) == -1)
+      goto fetch_all;
+   if (num_lazy_fds == MAX_LAZY_FDS) {
+      unlock(&lazy_lock);
+      goto fetch_all;
+   }
+   debug_printf2("Tracking fd %d for lazy file %s\n", fd, localpath);
+   lazy_fds[num_lazy_fds++] = lfd;
+   unlock(&lazy_lock);
+   return;
+
+  fetch_all:
+   debug_printf("Can't track another lazy file, fetching all of %s\n", localpath);
+   fetch_lazy_range(lfd.localpath, 0, lfd.size);
+   spindle_free(lfd.localpath);
+}
+
+/* Whether fd is a lazy file, under the lock since another thread may be
+   adding or removing one */
+static int is_lazy_fd(int fd)
+{
+   int found;
+
+   if (!num_lazy_fds || lock(&lazy_lock) == -1)
+      return 0;
+   found = (find_lazy_fd(fd) != NULL);
+   unlock(&lazy_lock);
+   return found;
+}
+
+/**
+ * If fd is a lazy file, have the server fill in len bytes at offset.  With
+ * whole set, fill in all of it and stop tracking fd.  Returns -1 with errno
+ * set if the range couldn't be fetched.  The fetch is a round trip to the
+ * server, so it's made without the lock, with the entry marked busy.
+ **/
+static int fetch_lazy_fd(int fd, size_t offset, size_t len, int whole)
+{
+   lazy_fd_t *lfd;
+   char *localpath;
+   int result;
+
+   if (!num_lazy_fds)
+      return 0;
+   if (lock(&lazy_lock) == -1) {
+      set_errno(EIO);
+      return -1;
+   }
+   lfd = find_lazy_fd(fd);
+   if (!lfd) {
+      unlock(&lazy_lock);
+      return 0;
+   }
+   localpath = lfd->localpath;
+   if (whole) {
+      offset = 0;
+      len = lfd->size;
+      debug_printf2("Fetching all of lazy file %s\n", localpath);
+   }
+   lfd->busy++;
+   unlock(&lazy_lock);
+
+   result = fetch_lazy_range(localpath, offset, len);
+
+   if (lock(&lazy_lock) == -1) {
+      /* Leave the entry busy rather than free its path under another fetch */
+      set_errno(EIO);
+      return -1;
+   }
+   lfd = find_lazy_localpath(localpath);
+   lfd->busy--;
+   if ((result != -1 && whole) || lfd->fd == -1)
+      remove_lazy_fd(lfd);
+   unlock(&lazy_lock);
+   if (result == -1)
+      set_errno(EIO);
+   return result;
+}
+
+/* Stop tracking fd, which is being closed or replaced */
+static void forget_lazy_fd(int fd)
+{
+   lazy_fd_t *lfd;
+
+   if (!num_lazy_fds || lock(&lazy_lock) == -1)
+      return;
+   lfd = find_lazy_fd(fd);
+   if (lfd)
+      remove_lazy_fd(lfd);
+   unlock(&lazy_lock);
+}
+
+/**
+ * Descriptors we redirected to a staged file, by the path the application
+ * opened, made absolute.  fstat on one is answered with that path's stat,
+ * which is kept after the first call.
+ **/
+#define MAX_SPINDLE_FDS 64
+
+typedef struct {
+   int fd;
+   int have_stat;
+   char *path;
+   struct stat buf;
+} spindle_fd_t;
+
+static spindle_fd_t spindle_fds[MAX_SPINDLE_FDS];
+static int num_spindle_fds;
+static struct lock_t spindle_fd_lock;
+
+static spindle_fd_t *find_spindle_fd(int fd)
+{
+   int i;
+   for (i = 0; i < num_spindle_fds; i++) {
+      if (spindle_fds[i].fd == fd)
+         return spindle_fds + i;
+   }
+   return NULL;
+}
+
+static void add_spindle_fd(int fd, const char *path)
+{
+   char abspath[MAX_PATH_LEN+1];
+
+   path = get_abs_path(path, abspath);
+   if (fd == -1 || *path != '/' || lock(&spindle_fd_lock) == -1)
+      return;
+   if (num_spindle_fds < MAX_SPINDLE_FDS && !find_spindle_fd(fd)) {
+      spindle_fds[num_spindle_fds].fd = fd;
+      spindle_fds[num_spindle_fds].have_stat = 0;
+      spindle_fds[num_spindle_fds].path = spindle_strdup(path);
+      num_spindle_fds++;
+   }
+   unlock(&spindle_fd_lock);
+}
+
+static void forget_spindle_fd(int fd)
+{
+   spindle_fd_t *sfd;
+
+   if (!num_spindle_fds || lock(&spindle_fd_lock) == -1)
+      return;
+   sfd = find_spindle_fd(fd);
+   if (sfd) {
+      spindle_free(sfd->path);
+      *sfd = spindle_fds[--num_spindle_fds];
+   }
+   unlock(&spindle_fd_lock);
+}
+
+/**
+ * Fill in buf for a descriptor we opened.  Returns -1 if fd isn't one,
+ * or if spindle couldn't answer.
+ **/
+int spindle_fd_stat(int fd, struct stat *buf)
+{
+   spindle_fd_t *sfd;
+   char path[MAX_PATH_LEN+1];
+   int result;
+
+   if (!num_spindle_fds || lock(&spindle_fd_lock) == -1)
+      return -1;
+   sfd = find_spindle_fd(fd);
+   if (!sfd) {
+      unlock(&spindle_fd_lock);
+      return -1;
+   }
+   if (sfd->have_stat) {
+      *buf = sfd->buf;
+      unlock(&spindle_fd_lock);
+      return 0;
+   }
+   strncpy(path, sfd->path, MAX_PATH_LEN);
+   path[MAX_PATH_LEN] = '\0';
+   unlock(&spindle_fd_lock);
+
+   /* Asking the server can take a while, so it's done without the lock */
+   result = handle_stat(path, buf, 0);
+   if (result != 0)
+      return -1;
+
+   if (lock(&spindle_fd_lock) == -1)
+      return 0;
+   sfd = find_spindle_fd(fd);
+   if (sfd && strcmp(sfd->path, path) == 0) {
+      sfd->buf = *buf;
+      sfd->have_stat = 1;
+   }
+   unlock(&spindle_fd_lock);
+   return 0;
+}
+
+/**
+ * With OPT_MMAPREAD, descriptors for staged files opened read-only are
+ * backed by a shared mapping of the file, and read, pread, readv and lseek
+ * on them are served from it with our own offset, rather than a system
+ * call and a copy out of the page cache each.  The kernel's offset is
+ * only brought up to date when the descriptor is handed to something we
+ * can't follow, such as dup or fdopen, and the mapping is dropped then.
+ **/
+#define MAX_MAPPED_FDS 64
+
+typedef struct {
+   int fd;
+   char *map;
+   size_t size;
+   size_t offset;
+} mapped_fd_t;
+
+static mapped_fd_t mapped_fds[MAX_MAPPED_FDS];
+static int num_mapped_fds;
+static struct lock_t mapped_fd_lock;
+
+static mapped_fd_t *find_mapped_fd(int fd)
+{
+   int i;
+   for (i = 0; i < num_mapped_fds; i++) {
+      if (mapped_fds[i].fd == fd)
+         return mapped_fds + i;
+   }
+   return NULL;
+}
+
+static void add_mapped_fd(int fd)
+{
+   struct stat buf;
+   void *map;
+
+   if (fd == -1 || num_mapped_fds == MAX_MAPPED_FDS)
+      return;
+   if (fstat(fd, &buf) == -1 || !S_ISREG(buf.st_mode) || buf.st_size == 0)
+      return;
+   map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   if (map == MAP_FAILED)
+      return;
+
+   if (lock(&mapped_fd_lock) == -1) {
+      munmap(map, buf.st_size);
+      return;
+   }
+   if (num_mapped_fds == MAX_MAPPED_FDS || find_mapped_fd(fd)) {
+      unlock(&mapped_fd_lock);
+      munmap(map, buf.st_size);
+      return;
+   }
+   mapped_fds[num_mapped_fds].fd = fd;
+   mapped_fds[num_mapped_fds].map = (char *) map;
+   mapped_fds[num_mapped_fds].size = buf.st_size;
+   mapped_fds[num_mapped_fds].offset = 0;
+   num_mapped_fds++;
+   unlock(&mapped_fd_lock);
+}
+
+/**
+ * Stop serving fd from its mapping.  With sync set, first move the
+ * kernel's offset to ours, for whatever reads fd next.
+ **/
+static void forget_mapped_fd(int fd, int sync)
+{
+   mapped_fd_t *mfd;
+
+   if (!num_mapped_fds || lock(&mapped_fd_lock) == -1)
+      return;
+   mfd = find_mapped_fd(fd);
+   if (mfd) {
+      if (sync)
+         lseek(fd, (off_t) mfd->offset, SEEK_SET);
+      munmap(mfd->map, mfd->size);
+      *mfd = mapped_fds[--num_mapped_fds];
+   }
+   unlock(&mapped_fd_lock);
+}
+
+/**
+ * Copy up to count bytes at offset, or at and past the current offset if
+ * offset is -1, out of fd's mapping.  Returns 0 if fd isn't mapped, or 1
+ * with the bytes copied in *result.
+ **/
+static int read_mapped_fd(int fd, const struct iovec *iov, int iovcnt, int64_t offset, ssize_t *result)
+{
+   mapped_fd_t *mfd;
+   size_t pos, len, total = 0;
+   int i;
+
+   if (!num_mapped_fds || offset < -1 || lock(&mapped_fd_lock) == -1)
+      return 0;
+   mfd = find_mapped_fd(fd);
+   if (!mfd) {
+      unlock(&mapped_fd_lock);
+      return 0;
+   }
+   pos = (offset == -1) ? mfd->offset : (size_t) offset;
+   for (i = 0; i < iovcnt && pos < mfd->size; i++) {
+      len = iov[i].iov_len;
+      if (len > mfd->size - pos)
+         len = mfd->size - pos;
+      memcpy(iov[i].iov_base, mfd->map + pos, len);
+      pos += len;
+      total += len;
+   }
+   if (offset == -1)
+      mfd->offset = pos;
+   unlock(&mapped_fd_lock);
+   *result = (ssize_t) total;
+   return 1;
+}
+
+/* Returns 0 if fd isn't mapped, or 1 with the new offset or -1 in *result */
+static int seek_mapped_fd(int fd, int64_t offset, int whence, int64_t *result)
+{
+   mapped_fd_t *mfd;
+   int64_t base;
+
+   if (!num_mapped_fds || lock(&mapped_fd_lock) == -1)
+      return 0;
+   mfd = find_mapped_fd(fd);
+   if (!mfd) {
+      unlock(&mapped_fd_lock);
+      return 0;
+   }
+   switch (whence) {
+      case SEEK_SET: base = 0; break;
+      case SEEK_CUR: base = (int64_t) mfd->offset; break;
+      case SEEK_END: base = (int64_t) mfd->size; break;
+      default:
+         /* SEEK_DATA and SEEK_HOLE are left to the kernel */
+         unlock(&mapped_fd_lock);
+         forget_mapped_fd(fd, 1);
+         return 0;
+   }
+   if (base + offset < 0) {
+      unlock(&mapped_fd_lock);
+      set_errno(EINVAL);
+      *result = -1;
+      return 1;
+   }
+   mfd->offset = (size_t) (base + offset);
+   *result = base + offset;
+   unlock(&mapped_fd_lock);
+   return 1;
+}
 
 /* returns:
    0 if not existent
    -1 could not check, use orig open
-   1 exists, newpath contains real location */
-static int do_check_file(const char *path, char **newpath) {
+   1 exists, newpath (of MAX_PATH_LEN+1 bytes) contains real location, and
+     *openfd an open descriptor for it if openfd was given and the server
+     passed one */
+static int do_check_file(const char *path, char *newpath, int *is_lazy, int *openfd) {
    char *myname, *newname;
-   int errcode;
+   char abspath[MAX_PATH_LEN+1];
+   int errcode, result;
   
    myname=(char *) path;
    debug_printf2("Open operation requesting file: %s\n", path);
@@ -59,22 +496,135 @@ static int do_check_file(const char *path, char **newpath) {
       debug_printf3("no ldcs: open file query %s\n", myname);
       return -1;
    }
-   sync_cwd();
+   myname = (char *) get_abs_path(path, abspath);
 
-   get_relocated_file(ldcsid, myname, &newname, &errcode);
+   if (is_lazy)
+      result = get_relocated_file_lazy(ldcsid, myname, &newname, &errcode, is_lazy);
+   else if (openfd)
+      result = get_relocated_file_fd(ldcsid, myname, &newname, &errcode, openfd);
+   else
+      result = get_relocated_file_buf(ldcsid, myname, newpath, MAX_PATH_LEN+1, &newname, &errcode);
+   if (result == -1) {
+      debug_printf3("no answer for %s, using orig open\n", myname);
+      return -1;
+   }
 
    if (newname != NULL) {
-      *newpath=newname;
-      debug_printf3("file found under path %s\n", *newpath);
+      if (newname != newpath) {
+         snprintf(newpath, MAX_PATH_LEN+1, "%s", newname);
+         spindle_free(newname);
+      }
+      debug_printf3("file found under path %s\n", newpath);
       return 1;
    } else {
-      *newpath=NULL;
       debug_printf3("file not found file, set errno to %d\n", errcode);
       errno = errcode ? errcode : ENOENT;
       return 0;
    }
 }
 
+/**
+ * Files under a jit rule are ones the job generates, such as compiled GPU
+ * kernels or .pyc files, that every process would otherwise generate for
+ * itself.  Opening one for writing claims it with the server, and reads
+ * of a claimed file wait until the writer publishes it, then get the
+ * staged copy.  A file is published when it's renamed into place, or when
+ * a descriptor that opened it for writing is closed.
+ **/
+#define MAX_JIT_FDS 64
+
+typedef struct {
+   int fd;
+   char *path;
+} jit_fd_t;
+
+static jit_fd_t jit_fds[MAX_JIT_FDS];
+static int num_jit_fds;
+static struct lock_t jit_fd_lock;
+
+/**
+ * Returns 1 with newpath (of MAX_PATH_LEN+1 bytes) set to the published
+ * copy of path, 0 if path should be used itself, or -1 if we couldn't ask
+ **/
+int jit_check_file(const char *path, char *newpath)
+{
+   char abspath[MAX_PATH_LEN+1], *newname = NULL;
+   int errcode;
+
+   check_for_fork();
+   if (ldcsid < 0 || !use_ldcs)
+      return -1;
+   path = get_abs_path(path, abspath);
+   if (get_jit_file(ldcsid, path, newpath, MAX_PATH_LEN+1, &newname, &errcode) == -1)
+      return -1;
+   if (!newname) {
+      debug_printf3("Using jit file %s in place\n", path);
+      return 0;
+   }
+   debug_printf3("Jit file %s was published as %s\n", path, newpath);
+   return 1;
+}
+
+static void jit_claim(const char *path)
+{
+   char abspath[MAX_PATH_LEN+1];
+
+   check_for_fork();
+   if (ldcsid < 0 || !use_ldcs)
+      return;
+   path = get_abs_path(path, abspath);
+   debug_printf2("Claiming jit file %s\n", path);
+   send_jit_claim(ldcsid, (char *) path);
+}
+
+static void jit_publish(const char *path)
+{
+   char abspath[MAX_PATH_LEN+1];
+
+   check_for_fork();
+   if (ldcsid < 0 || !use_ldcs)
+      return;
+   path = get_abs_path(path, abspath);
+   debug_printf("Publishing jit file %s\n", path);
+   send_jit_publish(ldcsid, (char *) path);
+}
+
+static void add_jit_fd(int fd, const char *path)
+{
+   char abspath[MAX_PATH_LEN+1];
+
+   path = get_abs_path(path, abspath);
+   if (fd == -1 || *path != '/' || lock(&jit_fd_lock) == -1)
+      return;
+   if (num_jit_fds < MAX_JIT_FDS) {
+      jit_fds[num_jit_fds].fd = fd;
+      jit_fds[num_jit_fds].path = spindle_strdup(path);
+      num_jit_fds++;
+   }
+   else
+      debug_printf("Can't track another jit file, %s won't be published when closed\n", path);
+   unlock(&jit_fd_lock);
+}
+
+/* Stop tracking fd, returning the path it wrote or NULL */
+static char *take_jit_fd(int fd)
+{
+   char *path = NULL;
+   int i;
+
+   if (!num_jit_fds || lock(&jit_fd_lock) == -1)
+      return NULL;
+   for (i = 0; i < num_jit_fds; i++) {
+      if (jit_fds[i].fd == fd) {
+         path = jit_fds[i].path;
+         jit_fds[i] = jit_fds[--num_jit_fds];
+         break;
+      }
+   }
+   unlock(&jit_fd_lock);
+   return path;
+}
+
 static int call_orig_open(const char *path, int oflag, mode_t mode, int is_64)
 {
    test_log(path);
@@ -94,23 +644,60 @@ static int call_orig_open(const char *path, int oflag, mode_t mode, int is_64)
    }
 }
 
+static int open_relocated(const char *path, int oflag, mode_t mode, int is_64);
+
 int open_worker(const char *path, int oflag, mode_t mode, int is_64)
+{
+   uint64_t start = timing_start();
+   int result = open_relocated(path, oflag, mode, is_64);
+   timing_end(CLIENT_TIMING_OPEN, start);
+   return result;
+}
+
+static int open_relocated(const char *path, int oflag, mode_t mode, int is_64)
 {
    int rc;
-   char *newpath;
-   int result, exists;
+   char newpath[MAX_PATH_LEN+1];
+   int result, exists, lazy_ok, is_lazy = 0, fd_ok, mmap_ok, openfd = -1, cls;
+   uint64_t start;
 
    if (!path) {
       return call_orig_open(path, oflag, mode, is_64);
    }
+   if (ldcsid >= 0 && ((oflag & O_ACCMODE) != O_RDONLY || (oflag & O_CREAT)) && jit_filter(path)) {
+      /* Writing a jit file, which is published when it's closed */
+      jit_claim(path);
+      rc = call_orig_open(path, oflag, mode, is_64);
+      add_jit_fd(rc, path);
+      return rc;
+   }
    result = open_filter(path, oflag);
    if (ldcsid < 0 || result == ORIG_CALL) {
       /* Use the original open */
       return call_orig_open(path, oflag, mode, is_64);
    }
+   else if (result == JIT_CALL) {
+      if (jit_check_file(path, newpath) != 1)
+         return call_orig_open(path, oflag, mode, is_64);
+      debug_printf("Redirecting 'open' call, %s to published %s\n", path, newpath);
+      rc = call_orig_open(newpath, oflag, mode, is_64);
+      add_spindle_fd(rc, path);
+      return rc;
+   }
    else if (result == REDIRECT) {
-      /* Lookup and do open through local path */
-      result = do_check_file(path, &newpath);
+      /* Lookup and do open through local path.  Read-only opens can take
+         a lazily staged file, since we see the reads. */
+      lazy_ok = (opts & OPT_LAZYFETCH) && (oflag & O_ACCMODE) == O_RDONLY;
+      /* Plain read-only opens can use a descriptor the server opened for us */
+      fd_ok = (opts & OPT_PASSFD) && !lazy_ok && (oflag & O_ACCMODE) == O_RDONLY &&
+         !(oflag & ~(O_ACCMODE | O_CLOEXEC | O_LARGEFILE | O_NOCTTY));
+      mmap_ok = (opts & OPT_MMAPREAD) && (oflag & O_ACCMODE) == O_RDONLY && !(oflag & O_DIRECTORY);
+      cls = autobypass_class(AUTO_OPEN, path);
+      if (autobypass_dropped(cls))
+         return call_orig_open(path, oflag, mode, is_64);
+      start = autobypass_start(cls);
+      result = do_check_file(path, newpath, lazy_ok ? &is_lazy : NULL, fd_ok ? &openfd : NULL);
+      autobypass_end(cls, path, start);
       if (result == 0) {
          /* File doesn't exist */
          set_errno(errno);
@@ -122,9 +709,24 @@ int open_worker(const char *path, int oflag, mode_t mode, int is_64)
       }
       else {
          /* Successfully redirect open */
+         if (openfd != -1) {
+            debug_printf("Redirecting 'open' call, %s to passed fd %d for %s\n", path, openfd, newpath);
+            test_log(newpath);
+            /* The server's descriptor arrives close-on-exec */
+            if (!(oflag & O_CLOEXEC))
+               fcntl(openfd, F_SETFD, 0);
+            add_spindle_fd(openfd, path);
+            if (mmap_ok)
+               add_mapped_fd(openfd);
+            return openfd;
+         }
          debug_printf("Redirecting 'open' call, %s to %s\n", path, newpath);
          rc = call_orig_open(newpath, oflag, mode, is_64);
-         spindle_free(newpath);
+         if (rc != -1 && is_lazy)
+            add_lazy_fd(rc, newpath);
+         else if (rc != -1 && mmap_ok)
+            add_mapped_fd(rc);
+         add_spindle_fd(rc, path);
          return rc;
       }
    }
@@ -166,8 +768,9 @@ static FILE *call_orig_fopen(const char *path, const char *mode, int is_64)
 FILE *fopen_worker(const char *path, const char *mode, int is_64)
 {
    FILE *rc;
-   char *newpath;
-   int result, exists;
+   char newpath[MAX_PATH_LEN+1];
+   int result, exists, cls;
+   uint64_t start;
 
    if (!path) {
       return call_orig_fopen(path, mode, is_64);      
@@ -177,9 +780,23 @@ FILE *fopen_worker(const char *path, const char *mode, int is_64)
       /* Use the original open */
       return call_orig_fopen(path, mode, is_64);
    }
+   else if (result == JIT_CALL) {
+      if (jit_check_file(path, newpath) != 1)
+         return call_orig_fopen(path, mode, is_64);
+      debug_printf("Redirecting 'fopen' call, %s to published %s\n", path, newpath);
+      rc = call_orig_fopen(newpath, mode, is_64);
+      if (rc)
+         add_spindle_fd(fileno(rc), path);
+      return rc;
+   }
    else if (result == REDIRECT) {
       /* Lookup and do open through local path */
-      result = do_check_file(path, &newpath);
+      cls = autobypass_class(AUTO_OPEN, path);
+      if (autobypass_dropped(cls))
+         return call_orig_fopen(path, mode, is_64);
+      start = autobypass_start(cls);
+      result = do_check_file(path, newpath, NULL, NULL);
+      autobypass_end(cls, path, start);
       if (result == 0) {
          /* File doesn't exist */
          set_errno(errno);
@@ -193,7 +810,8 @@ FILE *fopen_worker(const char *path, const char *mode, int is_64)
          /* Successfully redirect open */
          debug_printf("Redirecting 'open' call, %s to %s\n", path, newpath);
          rc = call_orig_fopen(newpath, mode, is_64);
-         spindle_free(newpath);
+         if (rc)
+            add_spindle_fd(fileno(rc), path);
          return rc;
       }
    }
@@ -246,6 +864,41 @@ int rtcache_open64(const char *path, int oflag, ...)
    return open_worker(path, oflag, mode, 1);
 }
 
+/* Paths relative to a directory descriptor are left to the original call */
+int rtcache_openat(int dirfd, const char *path, int oflag, ...)
+{
+   va_list argp;
+   mode_t mode = (mode_t) 0;
+
+   va_start(argp, oflag);
+   if (oflag & (O_CREAT | O_TMPFILE))
+      mode = va_arg(argp, mode_t);
+   va_end(argp);
+
+   if (path && (*path == '/' || dirfd == AT_FDCWD)) {
+      debug_printf3("potential openat redirection of %s\n", path);
+      return open_worker(path, oflag, mode, 0);
+   }
+   return orig_openat ? orig_openat(dirfd, path, oflag, mode) : openat(dirfd, path, oflag, mode);
+}
+
+int rtcache_openat64(int dirfd, const char *path, int oflag, ...)
+{
+   va_list argp;
+   mode_t mode = (mode_t) 0;
+
+   va_start(argp, oflag);
+   if (oflag & (O_CREAT | O_TMPFILE))
+      mode = va_arg(argp, mode_t);
+   va_end(argp);
+
+   if (path && (*path == '/' || dirfd == AT_FDCWD)) {
+      debug_printf3("potential openat64 redirection of %s\n", path);
+      return open_worker(path, oflag, mode, 1);
+   }
+   return orig_openat64 ? orig_openat64(dirfd, path, oflag, mode) : openat64(dirfd, path, oflag, mode);
+}
+
 FILE *rtcache_fopen(const char *path, const char *mode)
 {
    debug_printf3("potential fopen redirection of %s\n", path);
@@ -261,12 +914,217 @@ FILE *rtcache_fopen64(const char *path, const char *mode)
 int rtcache_close(int fd)
 {
    /* Don't let applications (looking at you, tcsh) close our FDs */
+   char *jitpath;
    check_for_fork();
    int result = fd_filter(fd);
    if (result == ERR_CALL) {
       set_errno(EBADF);
       return -1;
    }
-   return orig_close(fd);
+   forget_lazy_fd(fd);
+   forget_spindle_fd(fd);
+   forget_mapped_fd(fd, 0);
+   jitpath = take_jit_fd(fd);
+   result = orig_close(fd);
+   if (jitpath) {
+      if (result == 0)
+         jit_publish(jitpath);
+      spindle_free(jitpath);
+   }
+   return result;
 }
 
+ssize_t rtcache_read(int fd, void *buf, size_t count)
+{
+   off_t offset;
+   struct iovec iov;
+   ssize_t result;
+
+   if (num_mapped_fds) {
+      iov.iov_base = buf;
+      iov.iov_len = count;
+      if (read_mapped_fd(fd, &iov, 1, -1, &result))
+         return result;
+   }
+   if (is_lazy_fd(fd)) {
+      offset = lseek(fd, 0, SEEK_CUR);
+      if (offset != (off_t) -1 && fetch_lazy_fd(fd, offset, count, 0) == -1)
+         return -1;
+   }
+   return orig_read ? orig_read(fd, buf, count) : read(fd, buf, count);
+}
+
+ssize_t rtcache_pread(int fd, void *buf, size_t count, off_t offset)
+{
+   struct iovec iov;
+   ssize_t result;
+
+   if (num_mapped_fds) {
+      iov.iov_base = buf;
+      iov.iov_len = count;
+      if (read_mapped_fd(fd, &iov, 1, offset, &result))
+         return result;
+   }
+   if (fetch_lazy_fd(fd, offset, count, 0) == -1)
+      return -1;
+   return orig_pread ? orig_pread(fd, buf, count, offset) : pread(fd, buf, count, offset);
+}
+
+ssize_t rtcache_pread64(int fd, void *buf, size_t count, int64_t offset)
+{
+   struct iovec iov;
+   ssize_t result;
+
+   if (num_mapped_fds) {
+      iov.iov_base = buf;
+      iov.iov_len = count;
+      if (read_mapped_fd(fd, &iov, 1, offset, &result))
+         return result;
+   }
+   if (fetch_lazy_fd(fd, offset, count, 0) == -1)
+      return -1;
+   return orig_pread64 ? orig_pread64(fd, buf, count, offset) : pread64(fd, buf, count, offset);
+}
+
+ssize_t rtcache_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+   off_t offset;
+   size_t count = 0;
+   ssize_t result;
+   int i;
+
+   if (num_mapped_fds && read_mapped_fd(fd, iov, iovcnt, -1, &result))
+      return result;
+   if (is_lazy_fd(fd)) {
+      for (i = 0; i < iovcnt; i++)
+         count += iov[i].iov_len;
+      offset = lseek(fd, 0, SEEK_CUR);
+      if (offset != (off_t) -1 && fetch_lazy_fd(fd, offset, count, 0) == -1)
+         return -1;
+   }
+   return orig_readv ? orig_readv(fd, iov, iovcnt) : readv(fd, iov, iovcnt);
+}
+
+off_t rtcache_lseek(int fd, off_t offset, int whence)
+{
+   int64_t result;
+
+   if (num_mapped_fds && seek_mapped_fd(fd, offset, whence, &result))
+      return (off_t) result;
+   return orig_lseek ? orig_lseek(fd, offset, whence) : lseek(fd, offset, whence);
+}
+
+int64_t rtcache_lseek64(int fd, int64_t offset, int whence)
+{
+   int64_t result;
+
+   if (num_mapped_fds && seek_mapped_fd(fd, offset, whence, &result))
+      return result;
+   return orig_lseek64 ? orig_lseek64(fd, offset, whence) : lseek64(fd, offset, whence);
+}
+
+/* Faults on a mapping would see the holes, so the whole mapped range is filled in */
+void *rtcache_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+   if (fd != -1 && fetch_lazy_fd(fd, offset, length, 0) == -1)
+      return MAP_FAILED;
+   return orig_mmap ? orig_mmap(addr, length, prot, flags, fd, offset) : mmap(addr, length, prot, flags, fd, offset);
+}
+
+void *rtcache_mmap64(void *addr, size_t length, int prot, int flags, int fd, int64_t offset)
+{
+   if (fd != -1 && fetch_lazy_fd(fd, offset, length, 0) == -1)
+      return MAP_FAILED;
+   return orig_mmap64 ? orig_mmap64(addr, length, prot, flags, fd, offset) : mmap64(addr, length, prot, flags, fd, offset);
+}
+
+/**
+ * A lazy file is fetched whole, and a mapped one goes back to the kernel's
+ * offset, before its descriptor is duplicated or given a FILE*
+ **/
+int rtcache_dup(int oldfd)
+{
+   if (fetch_lazy_fd(oldfd, 0, 0, 1) == -1)
+      return -1;
+   forget_mapped_fd(oldfd, 1);
+   return orig_dup ? orig_dup(oldfd) : dup(oldfd);
+}
+
+int rtcache_dup2(int oldfd, int newfd)
+{
+   if (fetch_lazy_fd(oldfd, 0, 0, 1) == -1)
+      return -1;
+   forget_mapped_fd(oldfd, 1);
+   if (oldfd != newfd) {
+      forget_lazy_fd(newfd);
+      forget_spindle_fd(newfd);
+      forget_mapped_fd(newfd, 0);
+      spindle_free(take_jit_fd(newfd));
+   }
+   return orig_dup2 ? orig_dup2(oldfd, newfd) : dup2(oldfd, newfd);
+}
+
+int rtcache_dup3(int oldfd, int newfd, int flags)
+{
+   if (fetch_lazy_fd(oldfd, 0, 0, 1) == -1)
+      return -1;
+   forget_mapped_fd(oldfd, 1);
+   if (oldfd != newfd) {
+      forget_lazy_fd(newfd);
+      forget_spindle_fd(newfd);
+      forget_mapped_fd(newfd, 0);
+      spindle_free(take_jit_fd(newfd));
+   }
+   return orig_dup3 ? orig_dup3(oldfd, newfd, flags) : dup3(oldfd, newfd, flags);
+}
+
+FILE *rtcache_fdopen(int fd, const char *mode)
+{
+   if (fetch_lazy_fd(fd, 0, 0, 1) == -1)
+      return NULL;
+   forget_mapped_fd(fd, 1);
+   return orig_fdopen ? orig_fdopen(fd, mode) : fdopen(fd, mode);
+}
+
+/* Relative paths are resolved against a cached cwd, which these drop */
+int rtcache_chdir(const char *path)
+{
+   int result;
+
+   result = orig_chdir ? orig_chdir(path) : chdir(path);
+   if (result == 0)
+      invalidate_cwd();
+   return result;
+}
+
+int rtcache_fchdir(int fd)
+{
+   int result;
+
+   result = orig_fchdir ? orig_fchdir(fd) : fchdir(fd);
+   if (result == 0)
+      invalidate_cwd();
+   return result;
+}
+
+/* A jit file renamed into place is published */
+int rtcache_rename(const char *oldpath, const char *newpath)
+{
+   int result;
+
+   result = orig_rename ? orig_rename(oldpath, newpath) : rename(oldpath, newpath);
+   if (result == 0 && newpath && jit_filter(newpath))
+      jit_publish(newpath);
+   return result;
+}
+
+int rtcache_renameat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath)
+{
+   int result;
+
+   result = orig_renameat ? orig_renameat(olddirfd, oldpath, newdirfd, newpath) :
+      renameat(olddirfd, oldpath, newdirfd, newpath);
+   if (result == 0 && newpath && (*newpath == '/' || newdirfd == AT_FDCWD) && jit_filter(newpath))
+      jit_publish(newpath);
+   return result;
+}
@@ -20,13 +20,19 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include "intercept.h"
 #include "client.h"
+#include "client_heap.h"
 #include "ldcs_api.h"
 #include "client_api.h"
+#include "should_intercept.h"
 
 ssize_t (*orig_readlink)(const char *path, char *buf, size_t bufsiz);
 int (*orig_readlinkat)(int dirfd, const char *pathname, char *buf, size_t bufsiz);
+char *(*orig_realpath)(const char *path, char *resolved_path);
+char *(*orig_realpath_chk)(const char *path, char *resolved_path, size_t resolved_len);
 
 extern char *location;
 extern int number;
@@ -35,14 +41,23 @@ static ssize_t readlink_worker(const char *path, char *buf, size_t bufsiz,
                                char *newbuf, ssize_t rl_result)
 {
    char newpath[MAX_PATH_LEN+1];
-   char spindle_id[32];
-   int location_len;
+   char spindle_id[32], memfd_id[48];
+   char *localname, *deleted;
+   int location_len, memfd_id_len;
 
    location_len = strlen(location);   
    snprintf(spindle_id, sizeof(spindle_id), "spindle.%d", number);
-
-   if (!strstr(newbuf, spindle_id) ||
-       strncmp(location, newbuf, location_len) != 0) {
+   memfd_id_len = snprintf(memfd_id, sizeof(memfd_id), "/memfd:%s:", spindle_id);
+
+   if (strncmp(memfd_id, newbuf, memfd_id_len) == 0) {
+      /* A file the server staged in a memfd, named for its name in the location */
+      localname = newbuf + memfd_id_len;
+      deleted = strstr(localname, " (deleted)");
+      if (deleted)
+         *deleted = '\0';
+   }
+   else if (!strstr(newbuf, spindle_id) ||
+            strncmp(location, newbuf, location_len) != 0) {
       debug_printf3("readlink not intercepting, %s not prefixed by %s\n", newbuf, location);
       int len = strlen(newbuf);
       if (len > bufsiz)
@@ -50,8 +65,10 @@ static ssize_t readlink_worker(const char *path, char *buf, size_t bufsiz,
       memcpy(buf, newbuf, len);
       return len;
    }
+   else
+      localname = newbuf+location_len+1;
 
-   send_orig_path_request(ldcsid, newbuf+location_len+1, newpath);
+   send_orig_path_request(ldcsid, localname, newpath);
    int len = strlen(newpath);
    if (len > bufsiz)
       len = bufsiz;
@@ -60,6 +77,71 @@ static ssize_t readlink_worker(const char *path, char *buf, size_t bufsiz,
    return len;
 }
 
+/**
+ * With --resolve-links, ask the server to answer from the link targets
+ * it read with each directory listing.  Returns the answer, allocated
+ * with spindle_malloc, or NULL with *errcode set to the error the call
+ * should fail with, or to 0 if the file system should be asked.
+ **/
+static char *resolve_link_query(const char *path, int last_link, int *errcode)
+{
+   char abspath[MAX_PATH_LEN+1];
+   char *newpath = NULL;
+   const char *fullpath;
+
+   *errcode = 0;
+   if (!intercept_links || ldcsid < 0 || !use_ldcs || !path || !*path)
+      return NULL;
+   fullpath = get_abs_path(path, abspath);
+   if (stat_filter(fullpath) != REDIRECT)
+      return NULL;
+   if (send_link_query(ldcsid, (char *) fullpath, last_link, &newpath, errcode) == -1) {
+      *errcode = 0;
+      return NULL;
+   }
+   if (newpath) {
+      debug_printf2("Server resolved %s of %s to %s\n", last_link ? "readlink" : "realpath", fullpath, newpath);
+      return newpath;
+   }
+   switch (*errcode) {
+      case ENOENT:
+      case ENOTDIR:
+      case ELOOP:
+      case EINVAL:
+      case ENAMETOOLONG:
+         debug_printf2("Server failed %s of %s with %s\n", last_link ? "readlink" : "realpath", fullpath,
+                       strerror(*errcode));
+         return NULL;
+      default:
+         debug_printf3("Server couldn't resolve %s, asking the file system\n", fullpath);
+         *errcode = 0;
+         return NULL;
+   }
+}
+
+static int readlink_from_server(const char *path, char *buf, size_t bufsiz, ssize_t *result)
+{
+   char *target;
+   int errcode;
+   size_t len;
+
+   target = resolve_link_query(path, 1, &errcode);
+   if (!target && !errcode)
+      return 0;
+   if (!target) {
+      set_errno(errcode);
+      *result = -1;
+      return 1;
+   }
+   len = strlen(target);
+   if (len > bufsiz)
+      len = bufsiz;
+   memcpy(buf, target, len);
+   spindle_free(target);
+   *result = (ssize_t) len;
+   return 1;
+}
+
 ssize_t readlink_wrapper(const char *path, char *buf, size_t bufsiz)
 {
    char newbuf[MAX_PATH_LEN+1];
@@ -67,6 +149,8 @@ ssize_t readlink_wrapper(const char *path, char *buf, size_t bufsiz)
    debug_printf2("Intercepted readlink on %s\n", path);
 
    check_for_fork();
+   if (readlink_from_server(path, buf, bufsiz, &rl_result))
+      return rl_result;
 
    memset(newbuf, 0, MAX_PATH_LEN+1);
    rl_result = orig_readlink(path, newbuf, MAX_PATH_LEN);
@@ -84,6 +168,9 @@ int readlinkat_wrapper(int dirfd, const char *path, char *buf, size_t bufsiz)
    debug_printf2("Intercepted readlink on %s\n", path);
 
    check_for_fork();
+   if ((dirfd == AT_FDCWD || (path && path[0] == '/')) &&
+       readlink_from_server(path, buf, bufsiz, &rl_result))
+      return (int) rl_result;
 
    memset(newbuf, 0, MAX_PATH_LEN+1);
    rl_result = (ssize_t) orig_readlinkat(dirfd, path, newbuf, MAX_PATH_LEN);
@@ -93,3 +180,52 @@ int readlinkat_wrapper(int dirfd, const char *path, char *buf, size_t bufsiz)
 
    return (int) readlink_worker(path, buf, bufsiz, newbuf, rl_result);   
 }
+
+/**
+ * realpath is only answered into the caller's buffer.  A NULL buffer
+ * needs memory the application can free, which we can't allocate from
+ * here, so those calls go to libc.
+ **/
+static int realpath_from_server(const char *path, char *resolved_path, char **result)
+{
+   char *resolved;
+   int errcode;
+
+   if (!resolved_path)
+      return 0;
+   resolved = resolve_link_query(path, 0, &errcode);
+   if (!resolved && !errcode)
+      return 0;
+   if (!resolved) {
+      set_errno(errcode);
+      *result = NULL;
+      return 1;
+   }
+   strncpy(resolved_path, resolved, PATH_MAX-1);
+   resolved_path[PATH_MAX-1] = '\0';
+   spindle_free(resolved);
+   *result = resolved_path;
+   return 1;
+}
+
+char *realpath_wrapper(const char *path, char *resolved_path)
+{
+   char *result;
+   debug_printf3("Intercepted realpath on %s\n", path);
+
+   check_for_fork();
+   if (realpath_from_server(path, resolved_path, &result))
+      return result;
+   return orig_realpath(path, resolved_path);
+}
+
+char *realpath_chk_wrapper(const char *path, char *resolved_path, size_t resolved_len)
+{
+   char *result;
+   debug_printf3("Intercepted __realpath_chk on %s\n", path);
+
+   check_for_fork();
+   if (resolved_len >= PATH_MAX && realpath_from_server(path, resolved_path, &result))
+      return result;
+   return orig_realpath_chk(path, resolved_path, resolved_len);
+}
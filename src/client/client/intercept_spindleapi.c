@@ -23,11 +23,14 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 #include "client.h"
 #include "client_heap.h"
 #include "spindle_debug.h"
 #include "config.h"
+#include "quiesce.h"
 
 #if !defined(TLS)
 #define TLS
@@ -93,6 +96,92 @@ int int_spindle_lstat(const char *path, struct stat *buf)
    return lstat(path, buf);
 }
 
+int int_spindle_find_first(const char **paths, int count)
+{
+   struct stat buf;
+   int i, index;
+
+   debug_printf("User called spindle_find_first(%s, %d)\n", count > 0 ? paths[0] : "", count);
+
+   if (client_find_first(paths, count, &index) == 0)
+      return index;
+
+   for (i = 0; i < count; i++) {
+      if (int_spindle_stat(paths[i], &buf) == 0)
+         return i;
+   }
+   return -1;
+}
+
+int int_spindle_prefetch(const char **paths, int n)
+{
+   debug_printf("User called spindle_prefetch(%s, %d)\n", n > 0 && paths[0] ? paths[0] : "", n);
+   return client_prefetch(paths, n);
+}
+
+int int_spindle_prefetch_dir(const char *dir)
+{
+   debug_printf("User called spindle_prefetch_dir(%s)\n", dir ? dir : "");
+   return client_prefetch_dir(dir);
+}
+
+int int_spindle_startup_done()
+{
+   debug_printf("User called spindle_startup_done()\n");
+   return client_startup_done();
+}
+
+int int_spindle_kvs_put(const char *key, const char *value)
+{
+   debug_printf("User called spindle_kvs_put(%s)\n", key ? key : "");
+   return client_kvs_put(key, value);
+}
+
+int int_spindle_kvs_fence(int local_procs)
+{
+   debug_printf("User called spindle_kvs_fence(%d)\n", local_procs);
+   return client_kvs_fence(local_procs);
+}
+
+int int_spindle_kvs_get(const char *key, char *value, size_t len)
+{
+   debug_printf3("User called spindle_kvs_get(%s)\n", key ? key : "");
+   return client_kvs_get(key, value, len);
+}
+
+/**
+ * The open goes through the server like any spindle_open, which stages
+ * the file on this node, and the staged copy is what gets mapped.
+ **/
+void *int_spindle_bcast_file(const char *path, size_t *size)
+{
+   struct stat buf;
+   void *addr;
+   int fd, error;
+
+   debug_printf("User called spindle_bcast_file(%s)\n", path ? path : "");
+
+   fd = int_spindle_open(path, O_RDONLY);
+   if (fd == -1)
+      return NULL;
+   if (fstat(fd, &buf) == -1) {
+      error = errno;
+      close(fd);
+      errno = error;
+      return NULL;
+   }
+   addr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   error = errno;
+   close(fd);
+   if (addr == MAP_FAILED) {
+      debug_printf("Could not map %s: %s\n", path, strerror(error));
+      errno = error;
+      return NULL;
+   }
+   *size = buf.st_size;
+   return addr;
+}
+
 int int_spindle_is_present()
 {
    return 1;
@@ -113,6 +202,12 @@ int int_spindle_is_enabled()
    return (intercept_api_enabled > 0);
 }
 
+void int_spindle_quiesce()
+{
+   debug_printf("User called spindle_quiesce()\n");
+   quiesce_now("spindle_quiesce");
+}
+
 int relocate_spindleapi()
 {
    return intercept_api_enabled > 0 || under_spindle_call;
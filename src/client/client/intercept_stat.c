@@ -14,9 +14,13 @@
   Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -24,7 +28,9 @@
 #include "client.h"
 #include "client_heap.h"
 #include "client_api.h"
+#include "client_timing.h"
 #include "should_intercept.h"
+#include "autobypass.h"
 
 #define INTERCEPT_STAT
 #if defined(INSTR_LIB)
@@ -42,10 +48,28 @@ int (*orig_lxstat64)(int vers, const char *path, struct stat *buf);
 int (*orig_fstat)(int fd, struct stat *buf);
 int (*orig_fxstat)(int vers, int fd, struct stat *buf);
 int (*orig_fxstat64)(int vers, int fd, struct stat *buf);
+int (*orig_fstatat)(int dirfd, const char *path, struct stat *buf, int flags);
+int (*orig_fstatat64)(int dirfd, const char *path, struct stat *buf, int flags);
+int (*orig_fxstatat)(int vers, int dirfd, const char *path, struct stat *buf, int flags);
+int (*orig_fxstatat64)(int vers, int dirfd, const char *path, struct stat *buf, int flags);
+int (*orig_statx)(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf);
+int (*orig_faccessat)(int dirfd, const char *path, int mode, int flags);
+
+static int stat_relocated(const char *path, struct stat *buf, int flags);
 
 int handle_stat(const char *path, struct stat *buf, int flags)
 {
-   int result, exists;
+   uint64_t start = timing_start();
+   int result = stat_relocated(path, buf, flags);
+   timing_end(CLIENT_TIMING_STAT, start);
+   return result;
+}
+
+static int stat_relocated(const char *path, struct stat *buf, int flags)
+{
+   char abspath[MAX_PATH_LEN+1], newpath[MAX_PATH_LEN+1];
+   int result, exists, cls;
+   uint64_t start;
 
    check_for_fork();
    if (ldcsid < 0 || !use_ldcs || !path || !buf) {
@@ -54,7 +78,7 @@ int handle_stat(const char *path, struct stat *buf, int flags)
          test_log(path);      
       return ORIG_STAT;
    }
-   sync_cwd();
+   path = get_abs_path(path, abspath);
 
    debug_printf3("Spindle considering stat call %s%sstat%s(%s)\n", 
                  flags & IS_LSTAT ? "l" : "", 
@@ -62,14 +86,28 @@ int handle_stat(const char *path, struct stat *buf, int flags)
                  flags & IS_64 ? "64" : "", 
                  path);
 
-   if (stat_filter(path) == ORIG_CALL) {
+   result = stat_filter(path);
+   if (result == ORIG_CALL) {
       /* Not used by stat, means run the original */
       debug_printf3("Allowing original stat on %s\n", path);
       return ORIG_STAT;
    }
+   if (result == JIT_CALL) {
+      /* A published jit file is stat'd at its staged copy */
+      if (jit_check_file(path, newpath) != 1)
+         return ORIG_STAT;
+      debug_printf3("Running stat on %s at published %s\n", path, newpath);
+      return orig_stat ? orig_stat(newpath, buf) : stat(newpath, buf);
+   }
+
+   cls = autobypass_class(AUTO_STAT, path);
+   if (autobypass_dropped(cls))
+      return ORIG_STAT;
 
    debug_printf3("Asking spindle for stat on %s\n", path);
+   start = autobypass_start(cls);
    result = get_stat_result(ldcsid, path, flags & IS_LSTAT, &exists, buf);
+   autobypass_end(cls, path, start);
    if (result == -1) {
       /* Spindle level error */
       debug_printf3("Allowing original stat on %s\n", path);
@@ -113,6 +151,10 @@ static int handle_fstat(int fd, struct stat* buf, int flags)
       return -1;
    }
 
+   /* Descriptors we opened are answered with the original file's stat */
+   if (spindle_fd_stat(fd, buf) == 0)
+      return 0;
+
    if (get_pathname_from_fd(fd, path, sizeof(path)) < 0)
       return -1;
 
@@ -120,6 +162,68 @@ static int handle_fstat(int fd, struct stat* buf, int flags)
    return handle_stat(path, buf, flags);
 }
 
+/**
+ * The *at calls go through Spindle when path doesn't depend on dirfd.
+ * Paths relative to a directory descriptor are left to the original call.
+ **/
+static int handle_fstatat(int dirfd, const char *path, struct stat *buf, int atflags, int flags)
+{
+   if (path && *path == '\0')
+      return (atflags & AT_EMPTY_PATH) && dirfd != AT_FDCWD ? handle_fstat(dirfd, buf, flags) : ORIG_STAT;
+   if (!path || (*path != '/' && dirfd != AT_FDCWD))
+      return ORIG_STAT;
+   if (atflags & AT_SYMLINK_NOFOLLOW)
+      flags |= IS_LSTAT;
+   return handle_stat(path, buf, flags);
+}
+
+static void stat_to_statx(struct stat *buf, struct statx *xbuf)
+{
+   memset(xbuf, 0, sizeof(*xbuf));
+   xbuf->stx_mask = STATX_BASIC_STATS;
+   xbuf->stx_blksize = buf->st_blksize;
+   xbuf->stx_nlink = buf->st_nlink;
+   xbuf->stx_uid = buf->st_uid;
+   xbuf->stx_gid = buf->st_gid;
+   xbuf->stx_mode = buf->st_mode;
+   xbuf->stx_ino = buf->st_ino;
+   xbuf->stx_size = buf->st_size;
+   xbuf->stx_blocks = buf->st_blocks;
+   xbuf->stx_atime.tv_sec = buf->st_atim.tv_sec;
+   xbuf->stx_atime.tv_nsec = buf->st_atim.tv_nsec;
+   xbuf->stx_mtime.tv_sec = buf->st_mtim.tv_sec;
+   xbuf->stx_mtime.tv_nsec = buf->st_mtim.tv_nsec;
+   xbuf->stx_ctime.tv_sec = buf->st_ctim.tv_sec;
+   xbuf->stx_ctime.tv_nsec = buf->st_ctim.tv_nsec;
+   xbuf->stx_rdev_major = major(buf->st_rdev);
+   xbuf->stx_rdev_minor = minor(buf->st_rdev);
+   xbuf->stx_dev_major = major(buf->st_dev);
+   xbuf->stx_dev_minor = minor(buf->st_dev);
+}
+
+/**
+ * Returns true if the stat's permission bits grant mode.  Supplementary
+ * groups aren't checked, so a false answer has to be confirmed by the
+ * original call.
+ **/
+static int stat_grants_access(struct stat *buf, int mode, int use_effective)
+{
+   uid_t uid = use_effective ? geteuid() : getuid();
+   gid_t gid = use_effective ? getegid() : getgid();
+   mode_t bits;
+
+   if (uid == 0)
+      return !(mode & X_OK) || (buf->st_mode & (S_IXUSR | S_IXGRP | S_IXOTH));
+
+   if (buf->st_uid == uid)
+      bits = (buf->st_mode >> 6) & 7;
+   else if (buf->st_gid == gid)
+      bits = (buf->st_mode >> 3) & 7;
+   else
+      bits = buf->st_mode & 7;
+   return (bits & mode) == (mode_t) mode;
+}
+
 int rtcache_stat(const char *path, struct stat *buf)
 {
    int result = handle_stat(path, buf, 0);
@@ -192,3 +296,64 @@ int rtcache_fxstat64(int vers, int fd, struct stat *buf)
    return orig_fxstat64(vers, fd, buf);
 }
 
+
+int rtcache_fstatat(int dirfd, const char *path, struct stat *buf, int flags)
+{
+   int result = handle_fstatat(dirfd, path, buf, flags, 0);
+   if (result != ORIG_STAT)
+      return result;
+   return orig_fstatat(dirfd, path, buf, flags);
+}
+
+int rtcache_fstatat64(int dirfd, const char *path, struct stat *buf, int flags)
+{
+   int result = handle_fstatat(dirfd, path, buf, flags, IS_64);
+   if (result != ORIG_STAT)
+      return result;
+   return orig_fstatat64(dirfd, path, buf, flags);
+}
+
+int rtcache_fxstatat(int vers, int dirfd, const char *path, struct stat *buf, int flags)
+{
+   int result = handle_fstatat(dirfd, path, buf, flags, IS_XSTAT);
+   if (result != ORIG_STAT)
+      return result;
+   return orig_fxstatat(vers, dirfd, path, buf, flags);
+}
+
+int rtcache_fxstatat64(int vers, int dirfd, const char *path, struct stat *buf, int flags)
+{
+   int result = handle_fstatat(dirfd, path, buf, flags, IS_XSTAT | IS_64);
+   if (result != ORIG_STAT)
+      return result;
+   return orig_fxstatat64(vers, dirfd, path, buf, flags);
+}
+
+int rtcache_statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf)
+{
+   struct stat sbuf;
+   int result = handle_fstatat(dirfd, path, &sbuf, flags, 0);
+   if (result == ORIG_STAT)
+      return orig_statx(dirfd, path, flags, mask, buf);
+   if (result == 0)
+      stat_to_statx(&sbuf, buf);
+   return result;
+}
+
+/* Writes are checked by the original call, as are modes the stat bits don't grant */
+int rtcache_faccessat(int dirfd, const char *path, int mode, int flags)
+{
+   struct stat buf;
+   int result;
+
+   if (mode & W_OK)
+      return orig_faccessat(dirfd, path, mode, flags);
+   result = handle_fstatat(dirfd, path, &buf, flags & AT_SYMLINK_NOFOLLOW, 0);
+   if (result == ORIG_STAT)
+      return orig_faccessat(dirfd, path, mode, flags);
+   if (result == -1)
+      return -1;
+   if (mode == F_OK || stat_grants_access(&buf, mode, flags & AT_EACCESS))
+      return 0;
+   return orig_faccessat(dirfd, path, mode, flags);
+}
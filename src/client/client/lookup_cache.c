@@ -0,0 +1,206 @@
+/*
+  This file is part of Spindle.  For copyright information see the COPYRIGHT 
+  file in the top level directory, or at 
+  https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License (as published by the Free Software
+  Foundation) version 2.1 dated February 1999.  This program is distributed in the
+  hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+  WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+  and conditions of the GNU Lesser General Public License for more details.  You should 
+  have received a copy of the GNU Lesser General Public License along with this 
+  program; if not, write to the Free Software Foundation, Inc., 59 Temple
+  Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <string.h>
+
+#include "lookup_cache.h"
+#include "client_heap.h"
+#include "spindle_debug.h"
+
+/**
+ * An open addressing table with linear probing.  Entries are never
+ * removed, so a lookup can stop at the first empty slot.  Writers claim
+ * a slot by moving it to ENTRY_BUSY with a compare and swap, fill it in,
+ * then publish it as ENTRY_READY.  Invalidating bumps the generation,
+ * which turns every entry stale; stale slots are reclaimed by later adds.
+ * A reclaimed slot's old strings are left in the heap, since another
+ * thread may still be reading them.
+ **/
+
+/* Must be a power of two */
+#define LOOKUP_CACHE_SIZE 1024
+
+#define ENTRY_EMPTY 0
+#define ENTRY_BUSY 1
+#define ENTRY_READY 2
+
+typedef struct {
+   volatile int state;
+   volatile unsigned int generation;
+   unsigned int hash;
+   int errcode;
+   char *key;
+   char *value;
+} lookup_entry_t;
+
+static lookup_entry_t *volatile table = NULL;
+static volatile unsigned int generation = 0;
+
+static unsigned int str_hash(const char *str)
+{
+   unsigned long hashv = 5381;
+   int c;
+   while ((c = *str++))
+      hashv = ((hashv << 5) + hashv) + c;
+   return (unsigned int) hashv;
+}
+
+static lookup_entry_t *get_table()
+{
+   lookup_entry_t *newtable;
+
+   if (table)
+      return table;
+
+   newtable = (lookup_entry_t *) spindle_malloc(LOOKUP_CACHE_SIZE * sizeof(lookup_entry_t));
+   if (!newtable)
+      return NULL;
+   memset(newtable, 0, LOOKUP_CACHE_SIZE * sizeof(lookup_entry_t));
+   if (!__sync_bool_compare_and_swap(&table, NULL, newtable))
+      spindle_free(newtable);
+   return table;
+}
+
+static int find(const char *path, char *buf, size_t bufsize, char **value, int *errcode)
+{
+   lookup_entry_t *entry;
+   unsigned int hash, gen, i;
+   char *result;
+
+   if (!table)
+      return 0;
+
+   hash = str_hash(path);
+   gen = generation;
+   __sync_synchronize();
+   for (i = 0; i < LOOKUP_CACHE_SIZE; i++) {
+      entry = table + ((hash + i) & (LOOKUP_CACHE_SIZE - 1));
+      if (entry->state == ENTRY_EMPTY)
+         return 0;
+      if (entry->state != ENTRY_READY)
+         continue;
+      __sync_synchronize();
+      if (entry->generation != gen || entry->hash != hash || strcmp(entry->key, path) != 0)
+         continue;
+
+      if (!entry->value)
+         result = NULL;
+      else if (!buf)
+         result = spindle_strdup(entry->value);
+      else {
+         if (strlen(entry->value) >= bufsize)
+            return 0;
+         result = strcpy(buf, entry->value);
+      }
+      *errcode = entry->errcode;
+
+      /* Make sure nobody reclaimed the slot while we copied it */
+      __sync_synchronize();
+      if (entry->state != ENTRY_READY || entry->generation != gen) {
+         if (result && !buf)
+            spindle_free(result);
+         return 0;
+      }
+      debug_printf3("Lookup cache has mapping from %s to %s\n", path, result ? result : "[NOT PRESENT]");
+      *value = result;
+      return 1;
+   }
+   return 0;
+}
+
+int lookupcache_find(const char *path, char **value, int *errcode)
+{
+   return find(path, NULL, 0, value, errcode);
+}
+
+int lookupcache_find_buf(const char *path, char *buf, size_t bufsize, char **value, int *errcode)
+{
+   return find(path, buf, bufsize, value, errcode);
+}
+
+void lookupcache_add(const char *path, const char *value, int errcode)
+{
+   lookup_entry_t *entry, *t;
+   unsigned int hash, gen, i;
+   int state;
+   char *key_copy, *value_copy = NULL;
+
+   t = get_table();
+   if (!t)
+      return;
+
+   hash = str_hash(path);
+   gen = generation;
+   key_copy = spindle_strdup(path);
+   if (value)
+      value_copy = spindle_strdup(value);
+
+   for (i = 0; i < LOOKUP_CACHE_SIZE; i++) {
+      entry = t + ((hash + i) & (LOOKUP_CACHE_SIZE - 1));
+      state = entry->state;
+      if (state == ENTRY_EMPTY && __sync_bool_compare_and_swap(&entry->state, ENTRY_EMPTY, ENTRY_BUSY))
+         break;
+      if (state != ENTRY_READY)
+         continue;
+      if (entry->generation != gen) {
+         if (__sync_bool_compare_and_swap(&entry->state, ENTRY_READY, ENTRY_BUSY))
+            break;
+         continue;
+      }
+      if (entry->hash == hash && strcmp(entry->key, path) == 0) {
+         /* Another thread got here first */
+         i = LOOKUP_CACHE_SIZE;
+         break;
+      }
+   }
+   if (i == LOOKUP_CACHE_SIZE) {
+      spindle_free(key_copy);
+      if (value_copy)
+         spindle_free(value_copy);
+      return;
+   }
+
+   entry->hash = hash;
+   entry->errcode = errcode;
+   entry->key = key_copy;
+   entry->value = value_copy;
+   entry->generation = gen;
+   __sync_synchronize();
+   entry->state = ENTRY_READY;
+}
+
+void lookupcache_invalidate()
+{
+   __sync_fetch_and_add(&generation, 1);
+}
+
+void lookupcache_reset()
+{
+   unsigned int i;
+
+   if (!table)
+      return;
+   for (i = 0; i < LOOKUP_CACHE_SIZE; i++) {
+      /* A slot left busy by a thread of the parent may hold anything */
+      if (table[i].state != ENTRY_READY)
+         continue;
+      spindle_free(table[i].key);
+      if (table[i].value)
+         spindle_free(table[i].value);
+   }
+   memset(table, 0, LOOKUP_CACHE_SIZE * sizeof(lookup_entry_t));
+   generation = 0;
+}
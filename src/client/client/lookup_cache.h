@@ -0,0 +1,55 @@
+/*
+  This file is part of Spindle.  For copyright information see the COPYRIGHT 
+  file in the top level directory, or at 
+  https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License (as published by the Free Software
+  Foundation) version 2.1 dated February 1999.  This program is distributed in the
+  hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+  WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+  and conditions of the GNU Lesser General Public License for more details.  You should 
+  have received a copy of the GNU Lesser General Public License along with this 
+  program; if not, write to the Free Software Foundation, Inc., 59 Temple
+  Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LOOKUP_CACHE_H_)
+#define LOOKUP_CACHE_H_
+
+#include <stddef.h>
+
+/**
+ * A per-process cache of the server's answers to file queries, keyed by
+ * absolute path.  Files that don't exist are cached too, with a NULL value.
+ **/
+
+/**
+ * Returns 1 and sets *value to a spindle_malloc'd copy of the cached answer
+ * (or NULL for a missing file) if path is cached, otherwise returns 0.
+ **/
+int lookupcache_find(const char *path, char **value, int *errcode);
+
+/**
+ * Like lookupcache_find, but copies the answer into buf of bufsize bytes
+ * and points *value at it, rather than allocating.
+ **/
+int lookupcache_find_buf(const char *path, char *buf, size_t bufsize, char **value, int *errcode);
+
+/**
+ * Remember the answer for path.  Does nothing if the cache is full.
+ **/
+void lookupcache_add(const char *path, const char *value, int errcode);
+
+/**
+ * Drop every entry.  Safe to call while other threads use the cache.
+ **/
+void lookupcache_invalidate();
+
+/**
+ * Drop every entry and free its memory.  Only for use while the process
+ * has a single thread, such as just after fork.
+ **/
+void lookupcache_reset();
+
+#endif
@@ -0,0 +1,141 @@
+/*
+  This file is part of Spindle.  For copyright information see the COPYRIGHT 
+  file in the top level directory, or at 
+  https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License (as published by the Free Software
+  Foundation) version 2.1 dated February 1999.  This program is distributed in the
+  hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+  WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+  and conditions of the GNU Lesser General Public License for more details.  You should 
+  have received a copy of the GNU Lesser General Public License along with this 
+  program; if not, write to the Free Software Foundation, Inc., 59 Temple
+  Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ldcs_api.h"
+#include "ldcs_namesnap.h"
+#include "namesnap.h"
+#include "client_heap.h"
+#include "spindle_debug.h"
+
+static namesnap_header_t *snap = NULL;
+
+void namesnap_map(const char *location, int number)
+{
+   char path[MAX_PATH_LEN+1];
+   struct stat snapstat;
+   namesnap_header_t *header;
+   void *mem;
+   int fd, result;
+
+   if (snap)
+      return;
+   snprintf(path, sizeof(path), "%s/%s.%d", location, NAMESNAP_NAME, number);
+   path[MAX_PATH_LEN] = '\0';
+
+   /* Most servers don't publish one */
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return;
+   result = fstat(fd, &snapstat);
+   if (result == -1 || snapstat.st_size < sizeof(namesnap_header_t)) {
+      close(fd);
+      return;
+   }
+   mem = mmap(NULL, snapstat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (mem == MAP_FAILED) {
+      err_printf("Failed to map name snapshot %s: %s\n", path, strerror(errno));
+      return;
+   }
+
+   header = (namesnap_header_t *) mem;
+   if (header->magic != NAMESNAP_MAGIC || header->version != NAMESNAP_VERSION ||
+       header->entry_size != sizeof(namesnap_entry_t) ||
+       !header->max_entries || (header->max_entries & (header->max_entries - 1)) ||
+       snapstat.st_size < NAMESNAP_SIZE(header->max_entries, header->strings_size)) {
+      err_printf("Name snapshot %s has an unexpected layout\n", path);
+      munmap(mem, snapstat.st_size);
+      return;
+   }
+
+   debug_printf2("Mapped name snapshot %s with %u entries\n", path, header->max_entries);
+   snap = header;
+}
+
+int namesnap_find(const char *path, char *buf, size_t bufsize, char **value, int *errcode)
+{
+   namesnap_entry_t *e;
+   char *strings;
+   char valbuf[MAX_PATH_LEN+1];
+   uint32_t hash, mask, seq, i, key_off, key_len, value_off, value_len;
+   size_t len;
+   int err, match;
+
+   if (!snap || path[0] != '/')
+      return 0;
+
+   hash = namesnap_hash(path, &len);
+   mask = snap->max_entries - 1;
+   strings = NAMESNAP_STRINGS(snap);
+   for (i = 0; i <= mask; i++) {
+      e = NAMESNAP_ENTRY(snap, (hash + i) & mask);
+      seq = e->seq;
+      __sync_synchronize();
+      if (seq & 1)
+         return 0;
+      key_len = e->key_len;
+      if (!key_len)
+         break;
+      key_off = e->key_off;
+      if (e->hash != hash || key_len != len)
+         continue;
+
+      /* The offsets may be torn, so check them before following them */
+      value_off = e->value_off;
+      value_len = e->value_len;
+      err = e->errcode;
+      if ((size_t) key_off + key_len >= snap->strings_size ||
+          (value_len && ((size_t) value_off + value_len >= snap->strings_size || value_len > MAX_PATH_LEN)))
+         return 0;
+      match = memcmp(strings + key_off, path, len) == 0;
+      if (match && value_len) {
+         memcpy(valbuf, strings + value_off, value_len);
+         valbuf[value_len] = '\0';
+      }
+
+      /* Make sure the server didn't rewrite the entry while we read it */
+      __sync_synchronize();
+      if (e->seq != seq)
+         return 0;
+      if (!match)
+         continue;
+
+      if (!value_len) {
+         if (!err)
+            return 0;
+         *value = NULL;
+      }
+      else if (!buf)
+         *value = spindle_strdup(valbuf);
+      else {
+         if (value_len >= bufsize)
+            return 0;
+         *value = strcpy(buf, valbuf);
+      }
+      *errcode = err;
+      debug_printf3("Name snapshot has mapping from %s to %s\n", path, *value ? *value : "[NOT PRESENT]");
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,42 @@
+/*
+  This file is part of Spindle.  For copyright information see the COPYRIGHT 
+  file in the top level directory, or at 
+  https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License (as published by the Free Software
+  Foundation) version 2.1 dated February 1999.  This program is distributed in the
+  hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+  WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+  and conditions of the GNU Lesser General Public License for more details.  You should 
+  have received a copy of the GNU Lesser General Public License along with this 
+  program; if not, write to the Free Software Foundation, Inc., 59 Temple
+  Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(NAMESNAP_H_)
+#define NAMESNAP_H_
+
+#include <stddef.h>
+
+/**
+ * Looks up the server's answers to file queries in the name snapshot it
+ * publishes with SPINDLE_NAMESNAP (see ldcs_namesnap.h), which saves a
+ * round trip to the server for files it already answered for.
+ **/
+
+/**
+ * Map the server's name snapshot read-only, if it published one.  The
+ * mapping is inherited across fork, so this only runs once per exec'd
+ * process.
+ **/
+void namesnap_map(const char *location, int number);
+
+/**
+ * Returns 1 and sets *value and *errcode to the published answer for the
+ * absolute path, as lookupcache_find_buf does, or returns 0.  If buf is
+ * NULL *value is a spindle_malloc'd copy.
+ **/
+int namesnap_find(const char *path, char *buf, size_t bufsize, char **value, int *errcode);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+
+#include "client.h"
+#include "spindle_debug.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <link.h>
+
+#if !defined(MADV_POPULATE_READ)
+#define MADV_POPULATE_READ 22
+#endif
+
+#define MAX_PREFAULT_PHDRS 32
+
+extern char *location;
+
+static int populate_unsupported = 0;
+
+static void prefault_range(ElfW(Addr) start, ElfW(Addr) end, const char *libname)
+{
+   ElfW(Addr) pagemask = ((ElfW(Addr)) getpagesize()) - 1;
+   void *base;
+   size_t size;
+
+   base = (void *) (start & ~pagemask);
+   size = ((end + pagemask) & ~pagemask) - (ElfW(Addr)) base;
+   if (!size)
+      return;
+
+   if (!populate_unsupported) {
+      if (madvise(base, size, MADV_POPULATE_READ) == 0)
+         return;
+      if (errno != EINVAL) {
+         debug_printf3("Could not populate %p-%p of %s: %s\n", base, ((char *) base) + size,
+                       libname, strerror(errno));
+         return;
+      }
+      debug_printf2("Kernel doesn't support MADV_POPULATE_READ, prefaulting with MADV_WILLNEED\n");
+      populate_unsupported = 1;
+   }
+   madvise(base, size, MADV_WILLNEED);
+}
+
+/**
+ * With OPT_PREFAULT, fill in the page tables of a staged object as soon as
+ * ld.so has mapped it, so startup takes one madvise per segment rather
+ * than a page fault for each page it touches.  Kernels before 5.14 have no
+ * MADV_POPULATE_READ, and get their page cache read ahead with
+ * MADV_WILLNEED instead.  Only staged objects are worth it, since their
+ * pages are local and reading them won't go back to the shared file system.
+ *
+ * The program headers come from the file rather than the mapping, since
+ * nothing says the first segment maps them.
+ **/
+void client_prefault(struct link_map *map)
+{
+   ElfW(Ehdr) ehdr;
+   ElfW(Phdr) phdrs[MAX_PREFAULT_PHDRS];
+   ssize_t phdrs_size;
+   size_t location_len;
+   int fd, i, num_phdrs;
+
+   if (!(opts & OPT_PREFAULT) || !location || !map->l_name)
+      return;
+   location_len = strlen(location);
+   if (strncmp(map->l_name, location, location_len) != 0 || map->l_name[location_len] != '/')
+      return;
+
+   fd = open(map->l_name, O_RDONLY);
+   if (fd == -1) {
+      debug_printf3("Could not open %s to prefault it: %s\n", map->l_name, strerror(errno));
+      return;
+   }
+   num_phdrs = 0;
+   if (pread(fd, &ehdr, sizeof(ehdr), 0) == sizeof(ehdr) &&
+       memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0 &&
+       ehdr.e_phentsize == sizeof(ElfW(Phdr)) &&
+       ehdr.e_phnum <= MAX_PREFAULT_PHDRS) {
+      phdrs_size = ehdr.e_phnum * sizeof(ElfW(Phdr));
+      if (pread(fd, phdrs, phdrs_size, ehdr.e_phoff) == phdrs_size)
+         num_phdrs = ehdr.e_phnum;
+   }
+   close(fd);
+   if (!num_phdrs) {
+      debug_printf3("Could not read the program headers of %s, not prefaulting it\n", map->l_name);
+      return;
+   }
+
+   debug_printf3("Prefaulting %s at %lx\n", map->l_name, (unsigned long) map->l_addr);
+   for (i = 0; i < num_phdrs; i++) {
+      if (phdrs[i].p_type != PT_LOAD || !phdrs[i].p_filesz)
+         continue;
+      prefault_range(map->l_addr + phdrs[i].p_vaddr,
+                     map->l_addr + phdrs[i].p_vaddr + phdrs[i].p_filesz,
+                     map->l_name);
+   }
+}
@@ -0,0 +1,215 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <elf.h>
+#include <link.h>
+
+#include "client.h"
+#include "client_heap.h"
+#include "intercept.h"
+#include "spindle_debug.h"
+#include "quiesce.h"
+
+/* A GOT entry holds a function descriptor on ELFv1 ppc64 */
+#if (defined(arch_ppc64) || defined(arch_ppc64le)) && _CALL_ELF != 2
+#define SLOT_WORDS 2
+#else
+#define SLOT_WORDS 1
+#endif
+
+typedef struct {
+   struct link_map *lmap;
+   ElfW(Addr) *slot;
+   ElfW(Addr) orig[SLOT_WORDS];
+} tracked_slot_t;
+
+int quiesced = 0;
+time_t quiesce_at = 0;
+int intercept_mpi = 0;
+
+int (*orig_MPI_Init)(int *argc, char ***argv);
+int (*orig_MPI_Init_thread)(int *argc, char ***argv, int required, int *provided);
+
+static tracked_slot_t *slots = NULL;
+static int num_slots = 0, slots_size = 0;
+static volatile int slots_lock = 0;
+
+/* The bindings that take a path, and go quiet */
+static const char *quiet_names[] = {
+   "open", "open64", "openat", "openat64", "fopen", "fopen64", "opendir",
+   "stat", "lstat", "__xstat", "__xstat64", "__lxstat", "__lxstat64",
+   "fstatat", "fstatat64", "__fxstatat", "__fxstatat64", "statx", "faccessat",
+   "rename", "renameat", "readlink", "readlinkat", "realpath", "__realpath_chk",
+   "execl", "execv", "execle", "execve", "execlp", "execvp",
+   "MPI_Init", "MPI_Init_thread",
+   NULL
+};
+
+static int binding_quiets(const char *name)
+{
+   const char **n;
+
+   for (n = quiet_names; *n; n++) {
+      if (strcmp(*n, name) == 0)
+         return 1;
+   }
+   return 0;
+}
+
+static void lock_slots()
+{
+   while (__sync_lock_test_and_set(&slots_lock, 1));
+}
+
+static void unlock_slots()
+{
+   __sync_lock_release(&slots_lock);
+}
+
+void quiesce_init()
+{
+   char *policy = getenv("SPINDLE_QUIESCE"), *end;
+   long secs;
+
+   if (!policy || !*policy)
+      return;
+   if (strcmp(policy, "mpi") == 0) {
+      debug_printf("Will quiesce when MPI_Init returns\n");
+      intercept_mpi = 1;
+      return;
+   }
+   secs = strtol(policy, &end, 10);
+   if (*end || secs < 0) {
+      err_printf("Ignoring SPINDLE_QUIESCE=%s, which is neither mpi nor a number of seconds\n", policy);
+      return;
+   }
+   debug_printf("Will quiesce in %ld seconds\n", secs);
+   quiesce_at = time(NULL) + secs;
+}
+
+void quiesce_now(const char *why)
+{
+   tracked_slot_t *t;
+   int i, w;
+
+   lock_slots();
+   if (quiesced) {
+      unlock_slots();
+      return;
+   }
+   quiesced = 1;
+   quiesce_at = 0;
+
+   for (i = 0; i < num_slots; i++) {
+      t = slots + i;
+      for (w = 0; w < SLOT_WORDS; w++)
+         t->slot[w] = t->orig[w];
+   }
+   debug_printf("Quiesced after %s.  Unbound %d GOT entries from Spindle's wrappers\n", why, num_slots);
+
+   if (slots)
+      spindle_free(slots);
+   slots = NULL;
+   num_slots = slots_size = 0;
+   unlock_slots();
+}
+
+void quiesce_poll()
+{
+   if (quiesce_at && time(NULL) >= quiesce_at)
+      quiesce_now("the SPINDLE_QUIESCE timeout");
+}
+
+int quiesce_skips(struct spindle_binding_t *binding)
+{
+   return quiesced && binding_quiets(binding->name);
+}
+
+void quiesce_track(struct link_map *lmap, void *slot, const char *name)
+{
+   struct spindle_binding_t *binding;
+   ElfW(Addr) *words = (ElfW(Addr) *) slot;
+   ElfW(Addr) wrapper;
+   tracked_slot_t *grown;
+   int i;
+
+   if (quiesced || !binding_quiets(name))
+      return;
+   binding = lookup_in_binding_hash(name);
+   if (!binding)
+      return;
+
+   /* An entry patched twice holds the wrapper already, which isn't worth
+      going back to */
+#if SLOT_WORDS == 2
+   wrapper = *((ElfW(Addr) *) binding->spindle_func);
+#else
+   wrapper = (ElfW(Addr)) binding->spindle_func;
+#endif
+   if (words[0] == wrapper)
+      return;
+
+   lock_slots();
+   if (num_slots == slots_size) {
+      /* Without room the entry just stays intercepted */
+      grown = (tracked_slot_t *) spindle_realloc(slots, (slots_size ? slots_size * 2 : 64) * sizeof(tracked_slot_t));
+      if (!grown) {
+         unlock_slots();
+         return;
+      }
+      slots = grown;
+      slots_size = slots_size ? slots_size * 2 : 64;
+   }
+   slots[num_slots].lmap = lmap;
+   slots[num_slots].slot = words;
+   for (i = 0; i < SLOT_WORDS; i++)
+      slots[num_slots].orig[i] = words[i];
+   num_slots++;
+   unlock_slots();
+}
+
+void quiesce_forget(struct link_map *lmap)
+{
+   int i;
+
+   lock_slots();
+   for (i = 0; i < num_slots; ) {
+      if (slots[i].lmap == lmap)
+         slots[i] = slots[--num_slots];
+      else
+         i++;
+   }
+   unlock_slots();
+}
+
+int mpi_init_wrapper(int *argc, char ***argv)
+{
+   int result = orig_MPI_Init(argc, argv);
+   quiesce_now("MPI_Init");
+   return result;
+}
+
+int mpi_init_thread_wrapper(int *argc, char ***argv, int required, int *provided)
+{
+   int result = orig_MPI_Init_thread(argc, argv, required, provided);
+   quiesce_now("MPI_Init_thread");
+   return result;
+}
@@ -0,0 +1,65 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(QUIESCE_H_)
+#define QUIESCE_H_
+
+#include <time.h>
+#include <link.h>
+
+struct spindle_binding_t;
+
+/**
+ * Once an application is past its startup, quiescing stops the
+ * interception of the calls that take a path, which most of its later
+ * opens and stats are, so those no longer pay for our filters,
+ * check_for_fork and sync_cwd.  Each GOT entry we point at one of their
+ * wrappers is tracked with what it held before, and quiescing puts that
+ * back.  The entry's next call binds it again, this time to the real
+ * definition, as do the calls of libraries loaded later.  ld.so still
+ * asks us where to find libraries, so dlopen is still served.  The
+ * Spindle API, and calls on descriptors, streams and directories, which
+ * may have been opened through Spindle before, stay intercepted.
+ *
+ * spindle_quiesce() quiesces, as does SPINDLE_QUIESCE in the
+ * application's environment: "mpi" once the first MPI_Init or
+ * MPI_Init_thread returns, or a number of seconds after the process
+ * started.
+ **/
+
+extern int quiesced;
+extern time_t quiesce_at;   /* when SPINDLE_QUIESCE's timeout passes, or 0 */
+
+/* Read SPINDLE_QUIESCE, before the bindings hash is built */
+void quiesce_init();
+
+/* Quiesce now, if we haven't.  why is for the log */
+void quiesce_now(const char *why);
+
+/* Quiesce if SPINDLE_QUIESCE's timeout has passed */
+void quiesce_poll();
+
+/* True if binding should now be bound to its definition, not redirected */
+int quiesce_skips(struct spindle_binding_t *binding);
+
+/* Called before pointing the GOT entry at slot, in lmap, at the wrapper
+   of the binding named name */
+void quiesce_track(struct link_map *lmap, void *slot, const char *name);
+
+/* lmap is being unloaded, so forget its GOT entries */
+void quiesce_forget(struct link_map *lmap);
+
+#endif
@@ -27,6 +27,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 16))
+#include <sys/auxv.h>
+#define HAVE_GETAUXVAL
+#endif
 
 #if !defined(REMAP_CONF_TEST)
 #include "ldcs_api.h"
@@ -37,15 +41,23 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 static int pagesize;
 
-static int fetchPhdrs(ElfW(Addr) *aout_base, ElfW(Phdr) **phdrs, unsigned int *phdrs_size)
+/**
+ * Finds the a.out's program headers in our auxv.  getauxval reads the copy
+ * the kernel left on our stack, where reading /proc/PID/auxv took an open and
+ * a read for every entry.
+ **/
+static int readAuxvPhdrs(ElfW(Phdr) **phdrs, unsigned int *phdrs_size)
 {
+#if defined(HAVE_GETAUXVAL)
+   *phdrs = (ElfW(Phdr) *) getauxval(AT_PHDR);
+   *phdrs_size = (unsigned int) getauxval(AT_PHNUM);
+   return 0;
+#else
    pid_t pid;
    char auxvpath[64];
-   int fd = 0, result, i;
+   int fd = 0, result;
    ElfW(auxv_t) auxv;
-   ElfW(Phdr) *phdr;
-   ElfW(Addr) phdr_offset = 0;
-   
+
    pid = getpid();
    debug_printf2("Reading auxv for process %d for exec remapping\n", pid);
 
@@ -79,6 +91,18 @@ static int fetchPhdrs(ElfW(Addr) *aout_base, ElfW(Phdr) **phdrs, unsigned int *p
       }      
    } while (result > 0);
    close(fd);
+   return 0;
+#endif
+}
+
+static int fetchPhdrs(ElfW(Addr) *aout_base, ElfW(Phdr) **phdrs, unsigned int *phdrs_size)
+{
+   int i;
+   ElfW(Phdr) *phdr;
+   ElfW(Addr) phdr_offset = 0;
+
+   if (readAuxvPhdrs(phdrs, phdrs_size) == -1)
+      return -1;
 
    if (!*phdrs) {
       err_printf("Could not find phdrs pointer in auxv\n");
@@ -112,31 +136,32 @@ static int openRelocatedExec(int ldcsid)
 {
    char orig_exec[MAX_PATH_LEN+1];
    char *reloc_exec;
-   char proc_pid_exec[64];
    ssize_t result;
    int fd;
    int errcode = 0;
 
-   snprintf(proc_pid_exec, 64, "/proc/%d/exe", getpid());
-   proc_pid_exec[63] = '\0';
    memset(orig_exec, 0, sizeof(orig_exec));
-   result = readlink(proc_pid_exec, orig_exec, MAX_PATH_LEN);
+   result = readlink("/proc/self/exe", orig_exec, MAX_PATH_LEN);
    if (result == -1) {
-      err_printf("Could not read link %s for exec remapping: %s\n",
-                 proc_pid_exec, strerror(errno));
+      err_printf("Could not read link /proc/self/exe for exec remapping: %s\n",
+                 strerror(errno));
       return -1;
    }
    
    debug_printf2("Exec remapping requesting relocation of file %s\n",
                  orig_exec);
-   get_relocated_file(ldcsid, orig_exec, &reloc_exec, &errcode);
+   if (get_relocated_file(ldcsid, orig_exec, &reloc_exec, &errcode) == -1) {
+      debug_printf("No answer for %s--leaving exec as is\n", orig_exec);
+      return -1;
+   }
    debug_printf2("Exec remapping returned %s -> %s\n", orig_exec, reloc_exec);
    if (!reloc_exec && !errcode) {
       debug_printf("Tried to remap local file--leaving exec as is\n");
       return -1;
    }
 
-   fd = open(reloc_exec, O_RDWR);
+   //Only read-only segments are remapped, and privately, so we don't need write access
+   fd = open(reloc_exec, O_RDONLY);
    if (fd == -1) {
       err_printf("Error opening relocated executable %s: %s\n", reloc_exec, strerror(errno));
       spindle_free(reloc_exec);
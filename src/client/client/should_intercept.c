@@ -25,45 +25,64 @@
 #include "client_api.h"
 #include "should_intercept.h"
 #include "spindle_debug.h"
+#include "localfs.h"
 
 extern int relocate_spindleapi();
 
+/**
+ * Every python prefix starts with the same pythonprefix_stem characters,
+ * so a path that doesn't is turned away by one compare, and the rest
+ * only compare what follows the stem.
+ **/
 static int is_python_path(const char *pathname)
 {
    unsigned int i;
 
    assert(pythonprefixes);
+   if (!pythonprefixes[0].path)
+      return 0;
+   if (strncmp(pythonprefixes[0].path, pathname, pythonprefix_stem) != 0)
+      return 0;
+   pathname += pythonprefix_stem;
    for (i = 0; pythonprefixes[i].path != NULL; i++) {
-      if (strncmp(pythonprefixes[i].path, pathname, pythonprefixes[i].pathsize) == 0)
+      if (strncmp(pythonprefixes[i].path + pythonprefix_stem, pathname,
+                  pythonprefixes[i].pathsize - pythonprefix_stem) == 0)
          return 1;
    }
 
    return 0;
 }
 
-static int is_python(const char *pathname, char *last_dot)
-{
-   if (last_dot &&
-       (strcmp(last_dot, ".py") == 0 ||
-        strcmp(last_dot, ".pyc") == 0 ||
-        strcmp(last_dot, ".pyo") == 0))
-      return 1;
-   return 0;
-}
+#define EXT_PY          1
+#define EXT_COMPILED_PY 2
+#define EXT_SO          4
 
-static int is_compiled_python(const char *pathname, char *last_dot)
+/**
+ * Sort the extension at last_dot into the kinds the filters care about,
+ * once per call, rather than strcmp it against each in turn
+ **/
+static int ext_kind(const char *last_dot)
 {
-   if (last_dot &&
-       (strcmp(last_dot, ".pyc") == 0 ||
-        strcmp(last_dot, ".pyo") == 0))
-      return 1;
+   if (!last_dot)
+      return 0;
+   if (last_dot[1] == 'p' && last_dot[2] == 'y') {
+      if (last_dot[3] == '\0')
+         return EXT_PY;
+      if ((last_dot[3] == 'c' || last_dot[3] == 'o') && last_dot[4] == '\0')
+         return EXT_PY | EXT_COMPILED_PY;
+      return 0;
+   }
+   if (last_dot[1] == 's' && last_dot[2] == 'o' && last_dot[3] == '\0')
+      return EXT_SO;
    return 0;
 }
 
-static int is_dso(const char *pathname, char *last_slash, char *last_dot)
+#define is_python(KIND) (KIND & EXT_PY)
+#define is_compiled_python(KIND) (KIND & EXT_COMPILED_PY)
+
+static int is_dso(int kind, char *last_slash)
 {
-   if (last_dot &&
-       strcmp(last_dot, ".so") == 0)
+   if (kind & EXT_SO)
       return 1;
 
    if (last_slash && 
@@ -81,13 +100,56 @@ static int is_lib_prefix(const char *pathname, char *last_slash)
    return 0;
 }
 
+/**
+ * With OPT_RELOCRULES, the user's rules decide a read before the built-in
+ * ones.  Returns -1 to leave it to them.
+ **/
+static int rules_filter(const char *fname)
+{
+   if (!(opts & OPT_RELOCRULES))
+      return -1;
+   switch (client_reloc_action(fname)) {
+      case reloc_relocate:
+      case reloc_push:
+         return REDIRECT;
+      case reloc_pass:
+         return ORIG_CALL;
+      case reloc_jit:
+         return JIT_CALL;
+      default:
+         return -1;
+   }
+}
+
+/* Returns true if fname is under a jit rule, whatever is being done to it */
+int jit_filter(const char *fname)
+{
+   if (!(opts & OPT_RELOCRULES))
+      return 0;
+   return client_reloc_action(fname) == reloc_jit;
+}
+
+/**
+ * With OPT_LOCALBYPASS, what's on the node's own file systems is left
+ * where it is, unless a rule said otherwise.
+ **/
+static int is_node_local(const char *fname)
+{
+   char abspath[MAX_PATH_LEN+1];
+
+   if (!(opts & OPT_LOCALBYPASS))
+      return 0;
+   return localfs_is_local(get_abs_path(fname, abspath));
+}
+
 #define open_for_write(X) ((X & O_WRONLY) == O_WRONLY || (X & O_RDWR) == O_RDWR)
 #define open_for_excl(X) ((X & (O_WRONLY|O_CREAT|O_EXCL|O_TRUNC)) == (O_WRONLY|O_CREAT|O_EXCL|O_TRUNC))
 #define open_for_dir(X) (X & O_DIRECTORY)
 
 int open_filter(const char *fname, int flags)
 {
-   char *last_slash, *last_dot;
+   char *last_slash;
+   int kind, result;
 
    if (relocate_spindleapi()) {
       if (open_for_excl(flags))
@@ -97,22 +159,25 @@ int open_filter(const char *fname, int flags)
       return ORIG_CALL;
    }
 
-   if (!(opts & OPT_RELOCPY))
-      return ORIG_CALL;
+   if (!open_for_write(flags) && !open_for_dir(flags) && (result = rules_filter(fname)) != -1)
+      return result;
 
-   last_dot = strrchr(fname, '.');
-   last_slash = strrchr(fname, '/');
+   if (!(opts & OPT_RELOCPY) || is_node_local(fname))
+      return ORIG_CALL;
 
    if (is_python_path(fname) && !open_for_dir(flags))
       return REDIRECT;
 
-   if (!open_for_write(flags) && is_dso(fname, last_slash, last_dot))
+   last_slash = strrchr(fname, '/');
+   kind = ext_kind(strrchr(last_slash ? last_slash : fname, '.'));
+
+   if (!open_for_write(flags) && is_dso(kind, last_slash))
       return REDIRECT;
 
-   if (open_for_excl(flags) && is_compiled_python(fname, last_dot))
+   if (open_for_excl(flags) && is_compiled_python(kind))
       return EXCL_OPEN;
 
-   if (!open_for_write(flags) && is_python(fname, last_dot))
+   if (!open_for_write(flags) && is_python(kind))
       return REDIRECT;
 
    return ORIG_CALL;
@@ -124,7 +189,8 @@ int open_filter(const char *fname, int flags)
 #define open_for_excl(X) (*X == 'x')
 int fopen_filter(const char *fname, const char *flags)
 {
-   char *last_slash, *last_dot;
+   char *last_slash;
+   int kind, result;
 
    if (relocate_spindleapi()) {
       if (open_for_excl(flags))
@@ -134,22 +200,25 @@ int fopen_filter(const char *fname, const char *flags)
       return ORIG_CALL;
    }
 
-   if (!(opts & OPT_RELOCPY))
-      return ORIG_CALL;
+   if (!open_for_write(flags) && (result = rules_filter(fname)) != -1)
+      return result;
 
-   last_dot = strrchr(fname, '.');
-   last_slash = strrchr(fname, '/');
+   if (!(opts & OPT_RELOCPY) || is_node_local(fname))
+      return ORIG_CALL;
 
    if (is_python_path(fname))
       return REDIRECT;
 
-   if (!open_for_write(flags) && is_dso(fname, last_slash, last_dot))
+   last_slash = strrchr(fname, '/');
+   kind = ext_kind(strrchr(last_slash ? last_slash : fname, '.'));
+
+   if (!open_for_write(flags) && is_dso(kind, last_slash))
       return REDIRECT;
 
-   if (open_for_excl(flags) && is_compiled_python(fname, last_dot))
+   if (open_for_excl(flags) && is_compiled_python(kind))
       return EXCL_OPEN;
 
-   if (!open_for_write(flags) && is_python(fname, last_dot))
+   if (!open_for_write(flags) && is_python(kind))
       return REDIRECT;
 
    return ORIG_CALL;
@@ -157,10 +226,15 @@ int fopen_filter(const char *fname, const char *flags)
 
 int exec_filter(const char *fname)
 {
+   int result;
+
    if (relocate_spindleapi())
       return REDIRECT;
 
-   if (opts & OPT_RELOCEXEC)
+   if ((result = rules_filter(fname)) != -1)
+      return result == JIT_CALL ? ORIG_CALL : result;
+
+   if ((opts & OPT_RELOCEXEC) && !is_node_local(fname))
       return REDIRECT;
    else
       return ORIG_CALL;
@@ -168,28 +242,62 @@ int exec_filter(const char *fname)
 
 int stat_filter(const char *fname)
 {
-   char *last_dot, *last_slash;
+   char *last_slash;
+   int kind, result;
 
    if (relocate_spindleapi())
       return REDIRECT;
 
-   if (!(opts & OPT_RELOCPY))
+   if ((result = rules_filter(fname)) != -1)
+      return result;
+
+   if (!(opts & OPT_RELOCPY) || is_node_local(fname))
       return ORIG_CALL;
 
    if (is_python_path(fname))
       return REDIRECT;
 
-   last_dot = strrchr(fname, '.');
    last_slash = strrchr(fname, '/');
+   kind = ext_kind(strrchr(last_slash ? last_slash : fname, '.'));
 
-   if (is_dso(fname, last_slash, last_dot) ||
-       is_python(fname, last_dot) || 
+   if (is_dso(kind, last_slash) ||
+       is_python(kind) || 
        is_lib_prefix(fname, last_slash))
       return REDIRECT;
    else
       return ORIG_CALL;
 }
 
+/**
+ * Listings are served for the directories python imports from, and the
+ * ones the rules relocate.
+ **/
+int opendir_filter(const char *dirname)
+{
+   int result;
+
+   if (!(opts & OPT_SERVEDIRS))
+      return ORIG_CALL;
+   if ((result = rules_filter(dirname)) != -1)
+      return result == JIT_CALL ? ORIG_CALL : result;
+   if ((opts & OPT_RELOCPY) && is_python_path(dirname) && !is_node_local(dirname))
+      return REDIRECT;
+   return ORIG_CALL;
+}
+
+/**
+ * Python source, bytecode, or anything under a python prefix
+ **/
+int is_python_file(const char *fname)
+{
+   char *last_slash;
+
+   if (is_python_path(fname))
+      return 1;
+   last_slash = strrchr(fname, '/');
+   return is_python(ext_kind(strrchr(last_slash ? last_slash : fname, '.'))) ? 1 : 0;
+}
+
 int fd_filter(int fd)
 {
    if (opts & OPT_NOHIDE)
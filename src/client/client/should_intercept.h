@@ -26,11 +26,15 @@
 #define REDIRECT 1
 #define EXCL_OPEN 2
 #define ERR_CALL 3
+#define JIT_CALL 4
 
 int open_filter(const char *fname, int flags);
 int fopen_filter(const char *fname, const char *flags);
 int exec_filter(const char *fname);
 int stat_filter(const char *fname);
+int opendir_filter(const char *dirname);
 int fd_filter(int fd);
+int jit_filter(const char *fname);
+int is_python_file(const char *fname);
 
 #endif
@@ -27,21 +27,439 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <time.h>
 
 #include "ldcs_api.h"
 #include "client_api.h"
 #include "client_heap.h"
+#include "client_timing.h"
+
+/**
+ * Threads share the one connection, and several may have queries in
+ * flight at once.  A query holds one of the request slots below while it
+ * waits, and goes out tagged with the slot's request id, which the server
+ * puts on the answer.  Sends are serialized by send_lock.  Whichever
+ * waiting thread holds recv_lock reads the next answer off the connection
+ * into its slot's buffer, and passes it to the slot it belongs to if that
+ * isn't its own.  The owner finds it there once it next looks.  Slots are
+ * taken lowest first, so the buffers of slots past the busiest moment's
+ * count are never touched.
+ **/
+
+/* The longest answer to a query, a search answer's flags, index and path */
+#define MAX_ANSWER_LEN (MAX_PATH_LEN+1+2*sizeof(int))
+
+typedef struct {
+   volatile int in_use;
+   volatile int answered;
+   volatile int abandoned;
+   int64_t sent_ns;
+   ldcs_message_header_t header;
+   int passfd;
+   char buffer[MAX_ANSWER_LEN];
+} request_slot_t;
+
+static request_slot_t requests[LDCS_MAX_REQUESTS];
+static struct lock_t send_lock;
+static struct lock_t recv_lock;
+
+int client_timing_on;
+client_timing_msg_t client_timing;
+
+/**
+ * With SPINDLE_CLIENT_DEADLINE set, a file, stat or existence query the
+ * caller can answer from the file system itself waits on the server no
+ * longer than a deadline drawn from how long earlier answers took: the
+ * smoothed wait plus eight times its mean deviation, as TCP times its
+ * retransmits, and never less than the variable's seconds.  A query past
+ * its deadline gives up and its caller goes to the file system.  Its
+ * slot stays taken until the late answer comes, which is dropped but
+ * still counts towards the deadline.  The fallbacks and the time they
+ * waited are sent to the server with the client's timing.  A connection
+ * that can't be polled, as with biter or shmem, keeps no deadlines.
+ **/
+#define DEADLINE_SLICE_MS 10   /* the longest the reader polls before looking at its own deadline */
+
+static int64_t deadline_floor_ns;   /* 0 when deadlines are off */
+static int64_t srtt_ns, rttvar_ns;
+static struct lock_t rtt_lock;
+uint64_t client_fallbacks;
+uint64_t client_fallback_ns;
+
+static int64_t now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t) ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
 
-static struct lock_t comm_lock;
+void client_deadline_init(int fd)
+{
+   char *env = getenv("SPINDLE_CLIENT_DEADLINE"), *end;
+   double secs;
+   int i;
+
+   /* A forked child's connection is new, so its parent's late answers
+      aren't coming */
+   for (i = 0; i < LDCS_MAX_REQUESTS; i++) {
+      if (requests[i].abandoned) {
+         requests[i].abandoned = 0;
+         __sync_lock_release(&requests[i].in_use);
+      }
+   }
+   client_fallbacks = client_fallback_ns = 0;
+   deadline_floor_ns = 0;
+
+   if (!env || !*env)
+      return;
+   secs = strtod(env, &end);
+   if (*end || secs <= 0.0) {
+      err_printf("Ignoring SPINDLE_CLIENT_DEADLINE=%s, which is not a positive number of seconds\n", env);
+      return;
+   }
+   if (client_answer_fd(fd) == -1) {
+      debug_printf("Not keeping deadlines on a connection that can't be polled\n");
+      return;
+   }
+   deadline_floor_ns = (int64_t) (secs * 1000000000.0);
+   debug_printf("Queries fall back to the file system after at least %.3f seconds\n", secs);
+}
 
-#define COMM_LOCK do { if (lock(&comm_lock) == -1) return -1; } while (0)
-#define COMM_UNLOCK unlock(&comm_lock)
-   
-int send_file_query(int fd, char* path, char** newpath, int *errcode) {
+static int64_t query_deadline(int64_t start)
+{
+   int64_t wait;
+
+   if (lock(&rtt_lock) == -1)
+      return start + deadline_floor_ns;
+   wait = srtt_ns + 8 * rttvar_ns;
+   unlock(&rtt_lock);
+   return start + (wait > deadline_floor_ns ? wait : deadline_floor_ns);
+}
+
+/* Fold the wait for an answer into the smoothed wait and its deviation */
+static void add_rtt_sample(int64_t sample)
+{
+   int64_t err;
+
+   if (lock(&rtt_lock) == -1)
+      return;
+   if (!srtt_ns) {
+      srtt_ns = sample;
+      rttvar_ns = sample / 2;
+   }
+   else {
+      err = sample - srtt_ns;
+      srtt_ns += err / 8;
+      rttvar_ns += ((err < 0 ? -err : err) - rttvar_ns) / 4;
+   }
+   unlock(&rtt_lock);
+}
+
+/* Wait up to msecs for an answer to arrive.  Returns 1 if one has, 0 if
+   not, or -1 on error */
+static int poll_answer(int fd, int msecs)
+{
+   struct pollfd pfd;
+   int result;
+
+   pfd.fd = client_answer_fd(fd);
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   do {
+      result = poll(&pfd, 1, msecs);
+   } while (result == -1 && errno == EINTR);
+   if (result == -1)
+      return -1;
+   return result ? 1 : 0;
+}
+
+/**
+ * With SPINDLE_TRACE_DIR set, each client writes a span for every file
+ * query it waits on to DIR/spindle_client_trace.SERVER.PID.json, in the
+ * Chrome trace event format the servers write theirs in.  A client is a
+ * thread of its server's process there, so spindle_waterfall can line up
+ * what each process waited on with what the servers did to answer it.
+ **/
+static int trace_fd = -1;
+static int trace_server;
+static int trace_pid;
+
+static double trace_now()
+{
+   struct timeval tp;
+   gettimeofday(&tp, NULL);
+   return tp.tv_sec + tp.tv_usec / 1000000.0;
+}
+
+static void trace_write(const char *str, int len)
+{
+   while (len > 0) {
+      int result = write(trace_fd, str, len);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         return;
+      str += result;
+      len -= result;
+   }
+}
+
+void client_trace_init(int server_rank)
+{
+   char filename[MAX_PATH_LEN+1], line[256];
+   char *dir = getenv("SPINDLE_TRACE_DIR");
+   int len;
+
+   if (trace_fd != -1) {
+      /* A forked child writes its own file */
+      close(trace_fd);
+      trace_fd = -1;
+   }
+   if (!dir || !*dir)
+      return;
+
+   trace_server = server_rank;
+   trace_pid = getpid();
+   snprintf(filename, sizeof(filename), "%s/spindle_client_trace.%d.%d.json", dir, server_rank, trace_pid);
+   trace_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+   if (trace_fd == -1) {
+      err_printf("Could not create trace file %s: %s\n", filename, strerror(errno));
+      return;
+   }
+   len = snprintf(line, sizeof(line), "[\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+                  "\"tid\": %d, \"args\": {\"name\": \"client %d\"}}", trace_server, trace_pid, trace_pid);
+   trace_write(line, len);
+}
+
+void client_trace_done()
+{
+   if (trace_fd == -1)
+      return;
+   trace_write("\n]\n", 3);
+   close(trace_fd);
+   trace_fd = -1;
+}
+
+/* Write a span for a query about path that was sent at start */
+static void trace_query(const char *path, double start)
+{
+   char line[MAX_PATH_LEN+256];
+   double end;
+   int len;
+
+   if (trace_fd == -1 || !path)
+      return;
+   end = trace_now();
+   len = snprintf(line, sizeof(line), ",\n{\"name\": \"client_wait\", \"cat\": \"spindle\", \"ph\": \"X\", "
+                  "\"ts\": %.0f, \"dur\": %.0f, \"pid\": %d, \"tid\": %d, \"args\": {\"path\": \"%s\"}}",
+                  start * 1000000.0, (end - start) * 1000000.0, trace_server, trace_pid, path);
+   if (len > 0 && len < (int) sizeof(line))
+      trace_write(line, len);
+}
+
+/* Take a free request slot, or return NULL if deadline, when it's not 0,
+   passes first */
+static request_slot_t *get_request_slot(int64_t deadline)
+{
+   int i;
+
+   for (;;) {
+      for (i = 0; i < LDCS_MAX_REQUESTS; i++) {
+         if (!requests[i].in_use && __sync_bool_compare_and_swap(&requests[i].in_use, 0, 1)) {
+            requests[i].answered = 0;
+            requests[i].abandoned = 0;
+            requests[i].passfd = -1;
+            return requests + i;
+         }
+      }
+      if (deadline && now_ns() >= deadline)
+         return NULL;
+      sched_yield();
+   }
+}
+
+static void release_request_slot(request_slot_t *slot)
+{
+   __sync_lock_release(&slot->in_use);
+}
+
+/**
+ * Send msg with request id req, or 0 if it gets no answer
+ **/
+static int send_msg(int fd, ldcs_message_t *msg, int req)
+{
+   int result;
+
+   msg->header.req = req;
+   if (lock(&send_lock) == -1)
+      return -1;
+   result = client_send_msg(fd, msg);
+   unlock(&send_lock);
+   return result;
+}
+
+/**
+ * Read one answer off the connection into slot's buffer, and pass it on
+ * if it's for another slot.  Must hold recv_lock.
+ **/
+static int recv_answer(int fd, request_slot_t *slot)
+{
+   ldcs_message_t message;
+   request_slot_t *owner;
+   int passfd = -1;
+
+   message.header.type = LDCS_MSG_UNKNOWN;
+   message.header.len = 0;
+   message.data = slot->buffer;
+   if (client_recv_msg_static_fd(fd, &message, LDCS_READ_BLOCK, &passfd) == -1)
+      return -1;
+
+   if (message.header.req < 1 || message.header.req > LDCS_MAX_REQUESTS ||
+       !requests[message.header.req-1].in_use) {
+      if (passfd != -1)
+         close(passfd);
+      if (deadline_floor_ns && message.header.req >= 1 && message.header.req <= LDCS_MAX_REQUESTS) {
+         /* Late, for a query given up before an exec took the connection over */
+         debug_printf3("Dropping late answer for request %d\n", message.header.req);
+         return 0;
+      }
+      err_printf("Got answer of type %d for unknown request %d\n", (int) message.header.type,
+                 message.header.req);
+      return -1;
+   }
+
+   owner = requests + (message.header.req-1);
+   if (owner->abandoned) {
+      debug_printf3("Dropping late answer of type %d for request %d\n", (int) message.header.type,
+                    message.header.req);
+      add_rtt_sample(now_ns() - owner->sent_ns);
+      if (passfd != -1)
+         close(passfd);
+      owner->abandoned = 0;
+      release_request_slot(owner);
+      return 0;
+   }
+   if (owner != slot)
+      memcpy(owner->buffer, slot->buffer, message.header.len);
+   owner->header = message.header;
+   owner->passfd = passfd;
+   __sync_synchronize();
+   owner->answered = 1;
+   return 0;
+}
+
+/**
+ * Wait for slot's answer, reading answers off the connection while we
+ * hold recv_lock.  With a deadline, give up on it once that passes.
+ * While deadlines are kept, the reader polls in short slices, so a query
+ * with no deadline doesn't hold up the others behind recv_lock.  Returns
+ * 0 once it's answered, 1 if it was given up, or -1 on error.
+ **/
+static int wait_answer(int fd, request_slot_t *slot, int64_t deadline)
+{
+   int64_t now;
+   int result = 0, msecs;
+
+   while (!slot->answered) {
+      if (lock(&recv_lock) == -1)
+         return -1;
+      if (!slot->answered) {
+         if (!deadline_floor_ns)
+            result = recv_answer(fd, slot);
+         else if (deadline && (now = now_ns()) >= deadline) {
+            /* Still under recv_lock, so the answer can't arrive meanwhile */
+            slot->abandoned = 1;
+            unlock(&recv_lock);
+            return 1;
+         }
+         else {
+            msecs = deadline ? (int) ((deadline - now) / 1000000) + 1 : DEADLINE_SLICE_MS;
+            result = poll_answer(fd, msecs < DEADLINE_SLICE_MS ? msecs : DEADLINE_SLICE_MS);
+            if (result == 1)
+               result = recv_answer(fd, slot);
+         }
+      }
+      unlock(&recv_lock);
+      if (result == -1)
+         return -1;
+   }
+   return 0;
+}
+
+/**
+ * Send msg as a query, and wait for its answer.  The answer's header
+ * replaces msg's, and its data is copied to answer, which msg then points
+ * at.  If passfd is non-NULL, it's set to the descriptor that came with
+ * the answer, or -1.  A query sent with may_expire can be given up at its
+ * deadline, which returns -1 with errno set to ETIMEDOUT.
+ **/
+static int query_server(int fd, ldcs_message_t *msg, char *answer, int *passfd, int may_expire)
+{
+   request_slot_t *slot;
+   int result;
+   uint64_t start = timing_start();
+   int64_t sent = 0, deadline = 0;
+
+   if (deadline_floor_ns) {
+      sent = now_ns();
+      if (may_expire)
+         deadline = query_deadline(sent);
+   }
+   slot = get_request_slot(deadline);
+   if (!slot) {
+      /* Every slot is waiting on an answer that's late */
+      result = 1;
+      goto expired;
+   }
+   slot->sent_ns = sent;
+   if (send_msg(fd, msg, (int) (slot - requests) + 1) == -1) {
+      release_request_slot(slot);
+      return -1;
+   }
+
+   result = wait_answer(fd, slot, deadline);
+  expired:
+   timing_end(CLIENT_TIMING_WAIT, start);
+   if (result == 1) {
+      /* The reader of the late answer frees our slot */
+      __sync_fetch_and_add(&client_fallbacks, 1);
+      __sync_fetch_and_add(&client_fallback_ns, now_ns() - sent);
+      debug_printf("Query of type %d waited past its deadline of %.3f seconds, going to the file system\n",
+                   (int) msg->header.type, (deadline - sent) / 1000000000.0);
+      errno = ETIMEDOUT;
+      return -1;
+   }
+   if (result == -1) {
+      release_request_slot(slot);
+      return -1;
+   }
+   if (deadline)
+      add_rtt_sample(now_ns() - sent);
+
+   __sync_synchronize();
+   msg->header = slot->header;
+   msg->data = answer;
+   memcpy(answer, slot->buffer, slot->header.len);
+   if (passfd)
+      *passfd = slot->passfd;
+   else if (slot->passfd != -1)
+      close(slot->passfd);
+   release_request_slot(slot);
+   return 0;
+}
+
+
+/* Answers are copied into buf if it's given, otherwise spindle_strdup'd */
+static int file_query_to(int fd, char *path, ldcs_message_ids_t type, char *buf, size_t bufsize,
+                         char **newpath, int *errcode, int *flags, int *passfd) {
    ldcs_message_t message;
    char buffer[MAX_PATH_LEN+1+sizeof(int)];
    int result;
    int path_len = strlen(path)+1;
+   double start = trace_fd != -1 ? trace_now() : 0.0;
    buffer[MAX_PATH_LEN+sizeof(int)] = '\0';
     
    if (path_len > MAX_PATH_LEN) {
@@ -50,21 +468,22 @@ int send_file_query(int fd, char* path, char** newpath, int *errcode) {
    }
 
    /* Setup packet */
-   message.header.type = LDCS_MSG_FILE_QUERY_EXACT_PATH;
+   message.header.type = type;
    message.header.len = path_len;
    message.data = buffer;
    strncpy(message.data, path, MAX_PATH_LEN);
 
-   COMM_LOCK;
-
-   debug_printf3("sending message of type: file_query len=%d data='%s' ...(%s)\n",
-                 message.header.len, message.data, path);  
-   client_send_msg(fd, &message);
+   debug_printf3("sending message of type: file_query len=%ld data='%s' ...(%s)\n",
+                 (long) message.header.len, message.data, path);  
 
    /* get new filename */
-   client_recv_msg_static(fd, &message, LDCS_READ_BLOCK);
-
-   COMM_UNLOCK;
+   if (query_server(fd, &message, buffer, passfd, type != LDCS_MSG_JIT_QUERY) == -1) {
+      *newpath = NULL;
+      *errcode = errno == ETIMEDOUT ? ETIMEDOUT : EIO;
+      *flags = 0;
+      return -1;
+   }
+   trace_query(path, start);
 
    if (message.header.type != LDCS_MSG_FILE_QUERY_ANSWER) {
       err_printf("Got unexpected message of type %d\n", (int) message.header.type);
@@ -72,12 +491,19 @@ int send_file_query(int fd, char* path, char** newpath, int *errcode) {
    }
    
    if (message.header.len > sizeof(int)) {
-      *newpath = spindle_strdup(message.data + sizeof(int));
+      if (buf) {
+         snprintf(buf, bufsize, "%s", message.data + sizeof(int));
+         *newpath = buf;
+      }
+      else
+         *newpath = spindle_strdup(message.data + sizeof(int));
+      *flags = *((int *) message.data);
       *errcode = 0;
       result = 0;
    } 
    else {
       *errcode = *((int *) message.data);
+      *flags = 0;
       *newpath = NULL;
       result = 0;
    }
@@ -85,6 +511,307 @@ int send_file_query(int fd, char* path, char** newpath, int *errcode) {
    return result;
 }
 
+static int file_query(int fd, char *path, ldcs_message_ids_t type, char **newpath, int *errcode, int *flags,
+                      int *passfd) {
+   return file_query_to(fd, path, type, NULL, 0, newpath, errcode, flags, passfd);
+}
+
+int send_file_query(int fd, char* path, char** newpath, int *errcode) {
+   int flags;
+   return file_query(fd, path, LDCS_MSG_FILE_QUERY_EXACT_PATH, newpath, errcode, &flags, NULL);
+}
+
+/**
+ * Like send_file_query, but copies the answer into buf of bufsize bytes
+ * and points *newpath at it, rather than allocating.
+ **/
+int send_file_query_buf(int fd, char *path, char *buf, size_t bufsize, char **newpath, int *errcode) {
+   int flags;
+   return file_query_to(fd, path, LDCS_MSG_FILE_QUERY_EXACT_PATH, buf, bufsize, newpath, errcode, &flags, NULL);
+}
+
+int send_lazy_file_query(int fd, char *path, char **newpath, int *errcode, int *is_lazy) {
+   int flags, result;
+   result = file_query(fd, path, LDCS_MSG_FILE_QUERY_LAZY, newpath, errcode, &flags, NULL);
+   *is_lazy = (result == 0 && *newpath && (flags & LDCS_ANSWER_LAZY));
+   return result;
+}
+
+/**
+ * Like send_file_query, but also sets *openfd to a read-only descriptor
+ * for *newpath if the server could pass one, or -1 otherwise.
+ **/
+int send_file_query_fd(int fd, char *path, char **newpath, int *errcode, int *openfd) {
+   int flags, result, passfd = -1;
+   result = file_query(fd, path, LDCS_MSG_FILE_QUERY_FD, newpath, errcode, &flags, &passfd);
+   if (passfd != -1 && (result != 0 || !*newpath || !(flags & LDCS_ANSWER_FD))) {
+      close(passfd);
+      passfd = -1;
+   }
+   *openfd = passfd;
+   return result;
+}
+
+/**
+ * Ask the server about path, which is under a jit rule.  Sets *newpath to
+ * the staged copy of what another process published, or to NULL with
+ * *errcode 0 if we should use path itself.  The answer waits while
+ * another process on the node is writing the file.
+ **/
+int send_jit_query(int fd, char *path, char *buf, size_t bufsize, char **newpath, int *errcode) {
+   int flags;
+   return file_query_to(fd, path, LDCS_MSG_JIT_QUERY, buf, bufsize, newpath, errcode, &flags, NULL);
+}
+
+/* Tell the server we're about to write path, which is under a jit rule */
+int send_jit_claim(int fd, char *path)
+{
+   ldcs_message_t message;
+
+   message.header.type = LDCS_MSG_JIT_CLAIM;
+   message.header.len = strlen(path) + 1;
+   message.data = path;
+
+   debug_printf3("Sending message of type: jit_claim len=%ld, data=%s\n", (long) message.header.len, path);
+   return send_msg(fd, &message, 0);
+}
+
+/* Tell the server we've written path, which is under a jit rule */
+int send_jit_publish(int fd, char *path)
+{
+   ldcs_message_t message;
+
+   message.header.type = LDCS_MSG_JIT_PUBLISH;
+   message.header.len = strlen(path) + 1;
+   message.data = path;
+
+   debug_printf3("Sending message of type: jit_publish len=%ld, data=%s\n", (long) message.header.len, path);
+   return send_msg(fd, &message, 0);
+}
+
+/**
+ * Ask the server for a local directory that lists the same entries as
+ * dir.  Sets *newpath to it, or to NULL with *errcode set if the client
+ * should list dir itself.
+ **/
+int send_dir_query(int fd, char *dir, char **newpath, int *errcode) {
+   int flags;
+   return file_query(fd, dir, LDCS_MSG_DIR_QUERY, newpath, errcode, &flags, NULL);
+}
+
+/**
+ * Ask the server to resolve path from its cached link targets.  With
+ * last_link it's a readlink of path, otherwise a realpath.  Sets *newpath
+ * to the answer, or to NULL with *errcode set.  An errcode of EAGAIN
+ * means the client should ask the file system.
+ **/
+int send_link_query(int fd, char *path, int last_link, char **newpath, int *errcode) {
+   int flags;
+   return file_query(fd, path, last_link ? LDCS_MSG_READLINK_QUERY : LDCS_MSG_REALPATH_QUERY,
+                     newpath, errcode, &flags, NULL);
+}
+
+/**
+ * Ask the server for the first of the len bytes of NUL-terminated candidate
+ * paths that exists.  Sets *newpath to its local copy and *index to its
+ * position in the list, or *newpath to NULL and *errcode to why not.
+ * If the server found the file through ld.so.cache, *foundpath is set to
+ * the path it named, otherwise to NULL.
+ **/
+static int search_query(int fd, ldcs_message_ids_t type, char *paths, int len, char **newpath,
+                        int *errcode, int *index, char **foundpath)
+{
+   ldcs_message_t message;
+   char buffer[MAX_PATH_LEN+1+2*sizeof(int)];
+   int flags, pathlen, i;
+   double start = trace_fd != -1 ? trace_now() : 0.0;
+   char *candidate;
+
+   message.header.type = type;
+   message.header.len = len;
+   message.data = paths;
+
+   debug_printf3("sending message of type: %s len=%d data='%s' ...\n",
+                 type == LDCS_MSG_FILE_QUERY_SEARCH ? "file_query_search" :
+                 type == LDCS_MSG_FILE_QUERY_EXEC ? "file_query_exec" : "file_query_first", len, paths);
+   if (query_server(fd, &message, buffer, NULL, 1) == -1) {
+      *newpath = NULL;
+      *foundpath = NULL;
+      *errcode = errno == ETIMEDOUT ? ETIMEDOUT : EIO;
+      *index = -1;
+      return -1;
+   }
+
+   if (message.header.type != LDCS_MSG_FILE_QUERY_ANSWER) {
+      err_printf("Got unexpected message of type %d\n", (int) message.header.type);
+      assert(0);
+   }
+
+   *foundpath = NULL;
+   memcpy(&flags, message.data, sizeof(int));
+   if (message.header.len > 2*sizeof(int) && (flags & LDCS_ANSWER_SEARCH)) {
+      memcpy(index, message.data + sizeof(int), sizeof(int));
+      *newpath = spindle_strdup(message.data + 2*sizeof(int));
+      *errcode = 0;
+      pathlen = strlen(*newpath) + 1;
+      if ((flags & LDCS_ANSWER_SEARCH_PATH) && 2*sizeof(int) + pathlen < message.header.len)
+         *foundpath = spindle_strdup(message.data + 2*sizeof(int) + pathlen);
+   }
+   else {
+      *errcode = flags;
+      *index = -1;
+      *newpath = NULL;
+   }
+
+   if (trace_fd != -1 && *newpath && type == LDCS_MSG_FILE_QUERY_EXEC) {
+      trace_query(paths, start);
+   }
+   else if (trace_fd != -1 && *newpath) {
+      candidate = *foundpath;
+      for (i = 0, pathlen = 0; !candidate && pathlen < len; pathlen += strlen(paths + pathlen) + 1, i++) {
+         if (i == *index)
+            candidate = paths + pathlen;
+      }
+      trace_query(candidate, start);
+   }
+   return 0;
+}
+
+/**
+ * The candidates are where ld.so would look for a library, in order
+ **/
+int send_file_query_search(int fd, char *paths, int len, char **newpath, int *errcode, int *index,
+                           char **foundpath)
+{
+   return search_query(fd, LDCS_MSG_FILE_QUERY_SEARCH, paths, len, newpath, errcode, index, foundpath);
+}
+
+/**
+ * The candidates are plain paths, and the first that exists wins
+ **/
+int send_file_query_first(int fd, char *paths, int len, char **newpath, int *errcode, int *index)
+{
+   char *foundpath;
+   int result;
+
+   result = search_query(fd, LDCS_MSG_FILE_QUERY_FIRST, paths, len, newpath, errcode, index, &foundpath);
+   if (foundpath)
+      spindle_free(foundpath);
+   return result;
+}
+
+/**
+ * Ask the server which entry of path an exec of name, which has no '/',
+ * would run.  Sets *newpath to its local copy and *index to the entry's
+ * position in path, or *newpath to NULL and *errcode to why not.  Returns
+ * -1 without asking if name and path don't fit in a message.
+ **/
+int send_file_query_exec(int fd, const char *name, const char *path, char **newpath, int *errcode,
+                         int *index)
+{
+   char *query, *foundpath;
+   size_t namelen = strlen(name), pathlen = strlen(path);
+   int result;
+
+   if (namelen + pathlen + 2 > LDCS_MAX_MSG_LEN)
+      return -1;
+   query = (char *) spindle_malloc(namelen + pathlen + 2);
+   memcpy(query, name, namelen + 1);
+   memcpy(query + namelen + 1, path, pathlen + 1);
+
+   result = search_query(fd, LDCS_MSG_FILE_QUERY_EXEC, query, namelen + pathlen + 2, newpath, errcode,
+                         index, &foundpath);
+   if (foundpath)
+      spindle_free(foundpath);
+   spindle_free(query);
+   return result;
+}
+
+/**
+ * If a file query was answered with a file that has a copy on each NUMA
+ * node, switch *newpath to the copy on the node we're running on.  It's
+ * done after the answer is cached, since the caches are shared by
+ * processes on other nodes.
+ **/
+static int is_numa_replica(const char *newpath, size_t *len, unsigned int *node)
+{
+   size_t suffix_len = strlen(NUMA_REPLICA_SUFFIX);
+   unsigned int cpu;
+
+   if (!newpath)
+      return 0;
+   *len = strlen(newpath);
+   if (*len < suffix_len || strcmp(newpath + *len - suffix_len, NUMA_REPLICA_SUFFIX) != 0)
+      return 0;
+   if (syscall(SYS_getcpu, &cpu, node, NULL) == -1)
+      *node = 0;
+   return 1;
+}
+
+void use_numa_replica(char **newpath)
+{
+   size_t len;
+   unsigned int node;
+   char *replica;
+
+   if (!is_numa_replica(*newpath, &len, &node))
+      return;
+   replica = (char *) spindle_malloc(len + 16);
+   snprintf(replica, len + 16, "%s%u", *newpath, node);
+   debug_printf3("Using copy %s on NUMA node %u\n", replica, node);
+   spindle_free(*newpath);
+   *newpath = replica;
+}
+
+/* Like use_numa_replica, for an answer that lives in a buffer of bufsize bytes */
+void use_numa_replica_buf(char *newpath, size_t bufsize)
+{
+   size_t len;
+   unsigned int node;
+
+   if (!is_numa_replica(newpath, &len, &node))
+      return;
+   snprintf(newpath + len, bufsize - len, "%u", node);
+   debug_printf3("Using copy %s on NUMA node %u\n", newpath, node);
+}
+
+int send_range_query(int fd, char *localpath, size_t offset, size_t len)
+{
+   ldcs_message_t message;
+   char buffer[MAX_PATH_LEN+1+2*sizeof(size_t)];
+   int path_len = strlen(localpath)+1, errcode;
+
+   if (path_len > MAX_PATH_LEN) {
+      err_printf("Path to long for message");
+      return -1;
+   }
+
+   memcpy(buffer, &offset, sizeof(offset));
+   memcpy(buffer + sizeof(offset), &len, sizeof(len));
+   memcpy(buffer + 2*sizeof(size_t), localpath, path_len);
+   message.header.type = LDCS_MSG_FILE_RANGE_QUERY;
+   message.header.len = 2*sizeof(size_t) + path_len;
+   message.data = buffer;
+
+   debug_printf3("Sending range query for %lu bytes at %lu of %s\n", (unsigned long) len,
+                 (unsigned long) offset, localpath);
+   if (query_server(fd, &message, buffer, NULL, 0) == -1)
+      return -1;
+
+   if (message.header.type != LDCS_MSG_FILE_RANGE_ANSWER || message.header.len != sizeof(int)) {
+      err_printf("Got unexpected message after range query: %d\n", (int) message.header.type);
+      assert(0);
+   }
+
+   memcpy(&errcode, buffer, sizeof(errcode));
+   if (errcode) {
+      err_printf("Server could not fetch %lu bytes at %lu of %s: %s\n", (unsigned long) len,
+                 (unsigned long) offset, localpath, strerror(errcode));
+      return -1;
+   }
+   return 0;
+}
+
 int send_stat_request(int fd, char *path, int is_lstat, char *newpath)
 {
    int path_len = strlen(path) + (is_lstat ? 0 : 1) + 1;
@@ -103,16 +830,12 @@ int send_stat_request(int fd, char *path, int is_lstat, char *newpath)
    message.header.len = path_len;
    message.data = newpath;
    
-   COMM_LOCK;
-
-   debug_printf3("sending message of type: stat_query len=%d data='%s' ...(%s)\n",
-                 message.header.len, message.data, path);  
-   client_send_msg(fd, &message);
+   debug_printf3("sending message of type: stat_query len=%ld data='%s' ...(%s)\n",
+                 (long) message.header.len, message.data, path);  
 
    /* get new filename */
-   client_recv_msg_static(fd, &message, LDCS_READ_BLOCK);
-
-   COMM_UNLOCK;
+   if (query_server(fd, &message, newpath, NULL, 1) == -1)
+      return -1;
       
    if (message.header.type != LDCS_MSG_STAT_ANSWER) {
       err_printf("Got unexpected message of type %d\n", message.header.type);
@@ -144,15 +867,10 @@ int send_existance_test(int fd, char *path, int *exists)
    message.header.len = strlen(path) + 1;
    message.data = (void *) buffer;
 
-   debug_printf3("Sending message of type: file_exist_query len=%d, data=%s\n",
-                 message.header.len, path);
-   COMM_LOCK;
-
-   client_send_msg(fd, &message);
-
-   client_recv_msg_static(fd, &message, LDCS_READ_BLOCK);
-
-   COMM_UNLOCK;
+   debug_printf3("Sending message of type: file_exist_query len=%ld, data=%s\n",
+                 (long) message.header.len, path);
+   if (query_server(fd, &message, buffer, NULL, 1) == -1)
+      return -1;
 
    if (message.header.type != LDCS_MSG_EXISTS_ANSWER || message.header.len != sizeof(uint32_t)) {
       err_printf("Got unexpected message after existance test: %d\n", (int) message.header.type);
@@ -181,15 +899,10 @@ int send_orig_path_request(int fd, const char *path, char *newpath)
    message.header.len = strlen(path) + 1;
    message.data = (void *) buffer;
 
-   debug_printf3("Sending message of type: file_orig_path len=%d, data=%s\n",
-                 message.header.len, path);
-   COMM_LOCK;
-
-   client_send_msg(fd, &message);
-
-   client_recv_msg_static(fd, &message, LDCS_READ_BLOCK);
-
-   COMM_UNLOCK;
+   debug_printf3("Sending message of type: file_orig_path len=%ld, data=%s\n",
+                 (long) message.header.len, path);
+   if (query_server(fd, &message, buffer, NULL, 0) == -1)
+      return -1;
 
    if (message.header.type != LDCS_MSG_ORIGPATH_ANSWER || message.header.len > MAX_PATH_LEN) {
       err_printf("Got unexpected message after existance test: %d\n", (int) message.header.type);
@@ -208,15 +921,127 @@ int send_dir_cwd(int fd, char *cwd)
    message.header.len = strlen(cwd) + 1;
    message.data = cwd;
 
-   COMM_LOCK;
+   send_msg(fd, &message, 0);
+
+   return 0;
+}
+
+int send_file_query_batch(int fd, char *paths, int len)
+{
+   ldcs_message_t message;
 
-   client_send_msg(fd, &message);
+   message.header.type = LDCS_MSG_FILE_QUERY_BATCH;
+   message.header.len = len;
+   message.data = paths;
 
-   COMM_UNLOCK;
+   send_msg(fd, &message, 0);
 
    return 0;
 }
 
+int send_prefetch_dir(int fd, char *dir)
+{
+   ldcs_message_t message;
+
+   message.header.type = LDCS_MSG_PREFETCH_DIR;
+   message.header.len = strlen(dir) + 1;
+   message.data = dir;
+
+   debug_printf3("Sending message of type: prefetch_dir len=%ld, data=%s\n", (long) message.header.len, dir);
+   return send_msg(fd, &message, 0);
+}
+
+int send_startup_done(int fd)
+{
+   ldcs_message_t message;
+   int direction = 0;
+
+   message.header.type = LDCS_MSG_STARTUP_DONE;
+   message.header.len = sizeof(direction);
+   message.data = (char *) &direction;
+
+   debug_printf3("Sending message of type: startup_done\n");
+   return send_msg(fd, &message, 0);
+}
+
+/* Put key=value, to be seen by everyone after the next fence */
+int send_kvs_put(int fd, const char *key, const char *value)
+{
+   ldcs_message_t message;
+   char buffer[LDCS_KVS_MAX_KEY+LDCS_KVS_MAX_VALUE+2];
+   size_t key_len = strlen(key), value_len = strlen(value);
+
+   if (key_len > LDCS_KVS_MAX_KEY || value_len > LDCS_KVS_MAX_VALUE) {
+      err_printf("Key-value put of %s is too long\n", key);
+      return -1;
+   }
+   memcpy(buffer, key, key_len + 1);
+   memcpy(buffer + key_len + 1, value, value_len + 1);
+   message.header.type = LDCS_MSG_KVS_PUT;
+   message.header.len = key_len + value_len + 2;
+   message.data = buffer;
+
+   debug_printf3("Sending message of type: kvs_put, key=%s\n", key);
+   return send_msg(fd, &message, 0);
+}
+
+/**
+ * Wait until all local_procs processes on the node, and those on every
+ * other node, have fenced.  Sets *errcode to the server's answer.
+ **/
+int send_kvs_fence(int fd, int local_procs, int *errcode)
+{
+   ldcs_message_t message;
+   char buffer[MAX_PATH_LEN+1];
+
+   message.header.type = LDCS_MSG_KVS_FENCE;
+   message.header.len = sizeof(local_procs);
+   message.data = buffer;
+   memcpy(buffer, &local_procs, sizeof(local_procs));
+
+   debug_printf3("Sending message of type: kvs_fence, local_procs=%d\n", local_procs);
+   if (query_server(fd, &message, buffer, NULL, 0) == -1)
+      return -1;
+   if (message.header.type != LDCS_MSG_KVS_ANSWER || message.header.len != sizeof(int)) {
+      err_printf("Got unexpected answer to key-value fence\n");
+      return -1;
+   }
+   memcpy(errcode, message.data, sizeof(int));
+   return 0;
+}
+
+/**
+ * Copy the value put for key into value, of len bytes.  Sets *found to
+ * whether anything was put for it before the last fence.
+ **/
+int send_kvs_get(int fd, const char *key, char *value, size_t len, int *found)
+{
+   ldcs_message_t message;
+   char buffer[MAX_PATH_LEN+1];
+   size_t key_len = strlen(key);
+
+   if (key_len > LDCS_KVS_MAX_KEY) {
+      *found = 0;
+      return 0;
+   }
+   message.header.type = LDCS_MSG_KVS_GET;
+   message.header.len = key_len + 1;
+   message.data = buffer;
+   memcpy(buffer, key, key_len + 1);
+
+   debug_printf3("Sending message of type: kvs_get, key=%s\n", key);
+   if (query_server(fd, &message, buffer, NULL, 0) == -1)
+      return -1;
+   if (message.header.type != LDCS_MSG_KVS_ANSWER) {
+      err_printf("Got unexpected answer to key-value get\n");
+      return -1;
+   }
+   *found = (message.header.len > 0);
+   if (*found && len)
+      snprintf(value, len, "%s", message.data);
+   return 0;
+}
+
 int send_cwd(int fd)
 {
    char buffer[MAX_PATH_LEN+1];
@@ -243,11 +1068,7 @@ int send_pid(int fd) {
 
    debug_printf3("Sending pid\n");
 
-   COMM_LOCK;
-
-   client_send_msg(fd,&message);
-
-   COMM_UNLOCK;
+   send_msg(fd, &message, 0);
 
    return(rc);
 }
@@ -261,11 +1082,7 @@ int send_location(int fd, char *location) {
 
    debug_printf3("Sending location\n");
 
-   COMM_LOCK;
-
-   client_send_msg(fd,&message);
-
-   COMM_UNLOCK;
+   send_msg(fd, &message, 0);
 
    return 0;
 }
@@ -282,11 +1099,8 @@ int send_ldso_info_request(int fd, const char *ldso_path, char *result_path)
    strncpy(buffer+1, ldso_path, MAX_PATH_LEN-1);
    buffer[MAX_PATH_LEN] = '\0';
    
-   COMM_LOCK;
-   client_send_msg(fd, &message);
-   message.data = result_path;
-   client_recv_msg_static(fd, &message, LDCS_READ_BLOCK);
-   COMM_UNLOCK;
+   if (query_server(fd, &message, result_path, NULL, 0) == -1)
+      return -1;
 
    if (message.header.type != LDCS_MSG_LOADER_DATA_RESP) {
       err_printf("Got unexpected message after ldso req: %d\n", (int) message.header.type);
@@ -295,21 +1109,125 @@ int send_ldso_info_request(int fd, const char *ldso_path, char *result_path)
    return 0;
 }
 
+/* Answers that came with the hello, taken by the first get_* call */
+static char *hello_pythonprefix = NULL;
+static char *hello_relocrules = NULL;
+
+/**
+ * Tell the server our pid, location and, with HELLO_CWD, our cwd, and ask
+ * it for what flags names, all in one message.  With HELLO_RANKINFO,
+ * rankinfo is filled in.  The python prefix and relocation rules are kept
+ * for get_python_prefix and get_reloc_rules, which then don't ask again.
+ * Like them, this is only done as the connection is set up.  A process
+ * of a session step says which, from the LDCS_STEP its bootstrap set.
+ **/
+int send_hello(int fd, char *location, unsigned int flags, int *rankinfo)
+{
+   ldcs_message_t message;
+   char buffer[sizeof(int) + 2*sizeof(unsigned int) + 2*(MAX_PATH_LEN+1)];
+   char cwd[MAX_PATH_LEN+1];
+   size_t len, pos;
+   int pid = getpid();
+   char *step_s = getenv("LDCS_STEP");
+   unsigned int step = step_s ? (unsigned int) strtoul(step_s, NULL, 10) : 0;
+
+   if ((flags & HELLO_CWD) && !getcwd(cwd, sizeof(cwd)))
+      flags &= ~HELLO_CWD;
+   if (step)
+      flags |= HELLO_STEP;
+
+   memcpy(buffer, &pid, sizeof(pid));
+   memcpy(buffer + sizeof(pid), &flags, sizeof(flags));
+   len = sizeof(pid) + sizeof(flags);
+   len += snprintf(buffer + len, MAX_PATH_LEN+1, "%s", location) + 1;
+   if (flags & HELLO_CWD)
+      len += snprintf(buffer + len, MAX_PATH_LEN+1, "%s", cwd) + 1;
+   if (flags & HELLO_STEP) {
+      memcpy(buffer + len, &step, sizeof(step));
+      len += sizeof(step);
+   }
+
+   message.header.type = LDCS_MSG_HELLO;
+   message.header.len = len;
+   message.data = buffer;
+
+   debug_printf3("Sending hello with flags 0x%x\n", flags);
+   if (!(flags & (HELLO_RANKINFO | HELLO_PYTHONPREFIX | HELLO_RELOCRULES)))
+      return send_msg(fd, &message, 0);
+
+   if (send_msg(fd, &message, 0) == -1 || lock(&recv_lock) == -1)
+      return -1;
+   client_recv_msg_dynamic(fd, &message, LDCS_READ_BLOCK);
+   unlock(&recv_lock);
+   if (message.header.type != LDCS_MSG_HELLO_ANSWER || message.header.len < 4*sizeof(int)) {
+      err_printf("Got unexpected message after hello: %d\n", (int) message.header.type);
+      return -1;
+   }
+
+   if (flags & HELLO_RANKINFO) {
+      memcpy(rankinfo, message.data, 4*sizeof(int));
+      debug_printf3("received rank info: local: %d of %d md: %d of %d\n",
+                    rankinfo[0], rankinfo[1], rankinfo[2], rankinfo[3]);
+   }
+   pos = 4*sizeof(int);
+   if ((flags & HELLO_PYTHONPREFIX) && pos < message.header.len) {
+      hello_pythonprefix = (char *) message.data + pos;
+      pos += strlen(hello_pythonprefix) + 1;
+   }
+   if ((flags & HELLO_RELOCRULES) && pos < message.header.len)
+      hello_relocrules = (char *) message.data + pos;
+   return 0;
+}
+
 int get_python_prefix(int fd, char **prefix)
 {
    ldcs_message_t message;
+
+   if (hello_pythonprefix) {
+      *prefix = hello_pythonprefix;
+      hello_pythonprefix = NULL;
+      return 0;
+   }
    message.header.type = LDCS_MSG_PYTHONPREFIX_REQ;
    message.header.len = 0;
    message.data = NULL;
-      
-   COMM_LOCK;
-   client_send_msg(fd, &message);
+
+   /* Only asked for as the connection is set up, before other threads can
+      have queries on it, so the next message is the answer */
+   if (send_msg(fd, &message, 0) == -1 || lock(&recv_lock) == -1)
+      return -1;
    client_recv_msg_dynamic(fd, &message, LDCS_READ_BLOCK);
-   COMM_UNLOCK;
+   unlock(&recv_lock);
    *prefix = (char *) message.data;
    return 0;
 }
 
+int get_reloc_rules(int fd, char **rules)
+{
+   ldcs_message_t message;
+
+   if (hello_relocrules) {
+      *rules = hello_relocrules;
+      hello_relocrules = NULL;
+      return 0;
+   }
+   message.header.type = LDCS_MSG_RELOCRULES_REQ;
+   message.header.len = 0;
+   message.data = NULL;
+
+   /* Asked for as the connection is set up, like the python prefix */
+   if (send_msg(fd, &message, 0) == -1 || lock(&recv_lock) == -1)
+      return -1;
+   client_recv_msg_dynamic(fd, &message, LDCS_READ_BLOCK);
+   unlock(&recv_lock);
+   if (message.header.type != LDCS_MSG_RELOCRULES_RESP) {
+      err_printf("Got unexpected message after relocation rules request: %d\n", (int) message.header.type);
+      return -1;
+   }
+   *rules = (char *) message.data;
+   return 0;
+}
+
 int send_rankinfo_query(int fd, int *mylrank, int *mylsize, int *mymdrank, int *mymdsize) {
    ldcs_message_t message;
    char buffer[MAX_PATH_LEN];
@@ -321,13 +1239,8 @@ int send_rankinfo_query(int fd, int *mylrank, int *mylsize, int *mymdrank, int *
    message.header.len=0;
    message.data=buffer;
 
-   COMM_LOCK;
-
-   client_send_msg(fd,&message);
-
-   client_recv_msg_static(fd, &message, LDCS_READ_BLOCK);
-
-   COMM_UNLOCK;
+   if (query_server(fd, &message, buffer, NULL, 0) == -1)
+      return -1;
 
    if (message.header.type != LDCS_MSG_MYRANKINFO_QUERY_ANSWER || message.header.len != 4*sizeof(int)) {
       err_printf("Received incorrect response to rankinfo query\n");
@@ -352,12 +1265,19 @@ int send_end(int fd) {
    message.header.len = 0;
    message.data = NULL;
    
-   COMM_LOCK;
-   
-   client_send_msg(fd, &message);
-   
-   COMM_UNLOCK;
+   send_msg(fd, &message, 0);
    
    return 0;
 }
 
+int send_client_timing(int fd, client_timing_msg_t *timing)
+{
+   ldcs_message_t message;
+
+   message.header.type = LDCS_MSG_CLIENT_TIMING;
+   message.header.len = sizeof(*timing);
+   message.data = (char *) timing;
+
+   return send_msg(fd, &message, 0);
+}
+
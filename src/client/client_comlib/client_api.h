@@ -18,6 +18,7 @@
 #define CLIENT_API_H_
 
 #include "ldcs_api.h"
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -26,20 +27,59 @@
  * Communication functions for sending messages to the server
  **/
 int send_file_query(int fd, char* path, char **newpath, int *errcode);
+int send_file_query_buf(int fd, char *path, char *buf, size_t bufsize, char **newpath, int *errcode);
+int send_lazy_file_query(int fd, char *path, char **newpath, int *errcode, int *is_lazy);
+int send_file_query_fd(int fd, char *path, char **newpath, int *errcode, int *openfd);
+int send_jit_query(int fd, char *path, char *buf, size_t bufsize, char **newpath, int *errcode);
+int send_jit_claim(int fd, char *path);
+int send_jit_publish(int fd, char *path);
+int send_dir_query(int fd, char *dir, char **newpath, int *errcode);
+int send_link_query(int fd, char *path, int last_link, char **newpath, int *errcode);
+int send_range_query(int fd, char *localpath, size_t offset, size_t len);
 int send_dir_cwd(int fd, char *cwd);
+int send_file_query_batch(int fd, char *paths, int len);
+int send_prefetch_dir(int fd, char *dir);
+int send_startup_done(int fd);
+int send_kvs_put(int fd, const char *key, const char *value);
+int send_kvs_fence(int fd, int local_procs, int *errcode);
+int send_kvs_get(int fd, const char *key, char *value, size_t len, int *found);
+int send_file_query_search(int fd, char *paths, int len, char **newpath, int *errcode, int *index,
+                           char **foundpath);
+int send_file_query_first(int fd, char *paths, int len, char **newpath, int *errcode, int *index);
+int send_file_query_exec(int fd, const char *name, const char *path, char **newpath, int *errcode,
+                         int *index);
+void use_numa_replica(char **newpath);
+void use_numa_replica_buf(char *newpath, size_t bufsize);
 int send_cwd(int fd);
 int send_pid(int fd);
 int send_location(int fd, char *location);
 int send_rankinfo_query(int fd, int *mylrank, int *mylsize, int *mymdrank, int *mymdsize);
+int send_hello(int fd, char *location, unsigned int flags, int *rankinfo);
 int send_end(int fd);
+int send_client_timing(int fd, client_timing_msg_t *timing);
+
+/* Spans for SPINDLE_TRACE_DIR, in the trace of the server with server_rank */
+void client_trace_init(int server_rank);
+void client_trace_done();
+
+/* Read SPINDLE_CLIENT_DEADLINE for the connection fd, and forget queries
+   given up on an old connection */
+void client_deadline_init(int fd);
+/* Queries given up at their deadline, and the nanoseconds they waited */
+extern uint64_t client_fallbacks;
+extern uint64_t client_fallback_ns;
 int send_existance_test(int fd, char *path, int *exists);
 int send_stat_request(int fd, char *path, int islstat, char *result);
 int send_ldso_info_request(int fd, const char *ldso_path, char *result_path);
 int send_orig_path_request(int fd, const char *path, char *newpath);
 
 int get_python_prefix(int fd, char **prefix);
+int get_reloc_rules(int fd, char **rules);
 
 /* client */
+#define CLIENT_CONNECT_WAIT 600 /* tenths of a second */
+#define CLIENT_EARLY_CONNECT_WAIT 18000 /* with OPT_EARLYLAUNCH the servers may still be wiring up */
+extern int client_connect_wait;
 int client_open_connection(char* location, int number);
 int client_close_connection(int connid);
 int client_register_connection(char *connection_str);
@@ -47,6 +87,8 @@ char *client_get_connection_string(int fd);
 int client_send_msg(int connid, ldcs_message_t * msg);
 int client_recv_msg_static(int fd, ldcs_message_t *msg, ldcs_read_block_t block);
 int client_recv_msg_dynamic(int fd, ldcs_message_t *msg, ldcs_read_block_t block);
+int client_recv_msg_static_fd(int fd, ldcs_message_t *msg, ldcs_read_block_t block, int *passfd);
+int client_answer_fd(int fd);   /* the descriptor answers arrive on, or -1 if it can't be polled */
 int is_client_fd(int connfd, int fd);
 
 #endif
@@ -71,7 +71,7 @@ int client_send_msg_biter(int connid, ldcs_message_t *msg)
       return -1;
    }
 
-   debug_printf3("sending message of size len=%d\n", msg->header.len);
+   debug_printf3("sending message of size len=%ld\n", (long) msg->header.len);
 
    result = biterc_write(connid, &msg->header, sizeof(msg->header));
    if (result == -1) {
@@ -126,7 +126,7 @@ static int client_recv_msg_biter(int connid, ldcs_message_t *msg, ldcs_read_bloc
       assert(msg->data);
    }
 
-   debug_printf3("Reading %d bytes for body from biter\n", (int) msg->header.len);
+   debug_printf3("Reading %ld bytes for body from biter\n", (long) msg->header.len);
    result = biterc_read(connid, msg->data, msg->header.len);
    if (result == -1)
       err_printf("Error reading message body in biter client: %s\n", biterc_lasterror_str());
@@ -30,6 +30,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "client_heap.h"
 #include "ldcs_api_pipe.h"
 #include "ldcs_api.h"
+#include "client_api.h"
 #include "spindle_launch.h"
 
 #define MAX_FD 1
@@ -62,9 +63,9 @@ static int ldcs_mkfifo(char *fifo)
    return 0;
 }
 
-static int write_pipe(int fd, const void *data, int bytes)
+static ssize_t write_pipe(int fd, const void *data, size_t bytes)
 {
-  int left,bsumwrote;
+  size_t left,bsumwrote;
   ssize_t bwrite, bwrote;
   char *dataptr;
   
@@ -86,9 +87,9 @@ static int write_pipe(int fd, const void *data, int bytes)
   return bsumwrote;
 }
 
-static int read_pipe(int fd, void *data, int bytes)
+static int read_pipe(int fd, void *data, size_t bytes)
 {
-   int         left;
+   size_t      left;
    ssize_t     btoread, bread;
    char       *dataptr;
   
@@ -208,13 +209,13 @@ int client_open_connection_pipe(char* location, int number)
   
    fdlist_pipe[fd].type = LDCS_PIPE_FD_TYPE_CONN;
 
-   /* wait for directory (at most one minute) */
+   /* wait for directory (at most client_connect_wait tenths of a second) */
    stat_cnt = 0;
    snprintf(ready, MAX_PATH_LEN, "%s/spindle_comm/ready", location);
    memset(&st, 0, sizeof(st));
    
    while (((stat(ready, &st) == -1) || ((st.st_mode & (S_IRUSR | S_IWUSR)) == 0)) && 
-          (stat_cnt<600)) {
+          (stat_cnt<client_connect_wait)) {
       if (stat_cnt % 10 == 0)
          debug_printf3("waiting: location %s does not exists (after %d seconds)\n", ready, stat_cnt/10);
       usleep(100000); /* .1 seconds */
@@ -320,11 +321,11 @@ char *client_get_connection_string_pipe(int fd)
 
 int client_send_msg_pipe(int fd, ldcs_message_t *msg) {
 
-   int result;
+   ssize_t result;
 
    assert(fd >= 0 && fd < MAX_FD);
    
-   debug_printf3("sending message of size len=%d\n", msg->header.len);
+   debug_printf3("sending message of size len=%ld\n", (long) msg->header.len);
    
    result = write_pipe(fdlist_pipe[fd].out_fd, &msg->header, sizeof(msg->header));
    if (result == -1)
@@ -364,7 +365,7 @@ static int client_recv_msg_pipe(int fd, ldcs_message_t *msg, ldcs_read_block_t b
       msg->data = (char *) spindle_malloc(msg->header.len);
    }
 
-   debug_printf3("Reading %d bytes for payload from pipe\n", msg->header.len);
+   debug_printf3("Reading %ld bytes for payload from pipe\n", (long) msg->header.len);
    result = read_pipe(fdlist_pipe[fd].in_fd, msg->data, msg->header.len);
    return result;
 }
@@ -379,6 +380,14 @@ int client_recv_msg_static_pipe(int fd, ldcs_message_t *msg, ldcs_read_block_t b
    return client_recv_msg_pipe(fd, msg, block, 0);
 }
 
+int client_pipe_fds(int fd, int *in_fd, int *out_fd)
+{
+   assert(fd >= 0 && fd < MAX_FD);
+   *in_fd = fdlist_pipe[fd].in_fd;
+   *out_fd = fdlist_pipe[fd].out_fd;
+   return 0;
+}
+
 int is_client_fd(int connfd, int fd)
 {
    return (fdlist_pipe[connfd].in_fd == fd || fdlist_pipe[connfd].out_fd == fd);
@@ -0,0 +1,184 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "client_heap.h"
+#include "ldcs_api_pipe.h"
+#include "ldcs_api.h"
+#include "shmring.h"
+
+/* The pipe transport connects us and carries the doorbell; messages go
+   through shared memory rings.  See server/comlib/ldcs_api_shmem.c */
+
+extern int client_open_connection_pipe(char* location, int number);
+extern int client_register_connection_pipe(char *connection_str);
+extern char *client_get_connection_string_pipe(int fd);
+extern int client_close_connection_pipe(int fd);
+extern int client_pipe_fds(int fd, int *in_fd, int *out_fd);
+
+#define MAX_FD 1
+static shmring_conn_t *rings[MAX_FD];
+static char *ring_paths[MAX_FD];
+
+static int ring_doorbell(int out_fd)
+{
+   char doorbell = 1;
+   ssize_t result;
+
+   do {
+      result = write(out_fd, &doorbell, 1);
+   } while (result == -1 && errno == EINTR);
+   if (result != 1) {
+      err_printf("Failed to ring server doorbell: %s\n", strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+int client_open_connection_shmem(char* location, int number)
+{
+   char path[MAX_PATH_LEN];
+   int fd;
+
+   fd = client_open_connection_pipe(location, number);
+   if (fd < 0)
+      return fd;
+   assert(fd < MAX_FD);
+
+   /* The server maps these when our first message rings the doorbell */
+   snprintf(path, sizeof(path), "%s/spindle_comm/shm-%d", location, getpid());
+   rings[fd] = shmring_create(path);
+   if (!rings[fd]) {
+      client_close_connection_pipe(fd);
+      return -1;
+   }
+   ring_paths[fd] = spindle_strdup(path);
+   return fd;
+}
+
+int client_register_connection_shmem(char *connection_str)
+{
+   char *path = NULL;
+   int offset = 0, fd;
+
+   if (sscanf(connection_str, "%ms %n", &path, &offset) != 1 || !offset) {
+      err_printf("Reading shared memory connection string '%s'\n", connection_str);
+      return -1;
+   }
+
+   fd = client_register_connection_pipe(connection_str + offset);
+   if (fd >= 0) {
+      assert(fd < MAX_FD);
+      rings[fd] = shmring_attach(path);
+      ring_paths[fd] = spindle_strdup(path);
+      if (!rings[fd])
+         fd = -1;
+   }
+   spindle_free(path);
+   return fd;
+}
+
+char *client_get_connection_string_shmem(int fd)
+{
+   char *pipe_str, *str;
+   int slen;
+
+   assert(fd >= 0 && fd < MAX_FD);
+   pipe_str = client_get_connection_string_pipe(fd);
+   if (!pipe_str)
+      return NULL;
+
+   slen = strlen(ring_paths[fd]) + strlen(pipe_str) + 2;
+   str = (char *) spindle_malloc(slen);
+   if (str)
+      snprintf(str, slen, "%s %s", ring_paths[fd], pipe_str);
+   spindle_free(pipe_str);
+   return str;
+}
+
+int client_send_msg_shmem(int fd, ldcs_message_t *msg)
+{
+   int in_fd, out_fd, was_empty;
+
+   assert(fd >= 0 && fd < MAX_FD);
+   debug_printf3("sending message of size len=%ld\n", (long) msg->header.len);
+
+   client_pipe_fds(fd, &in_fd, &out_fd);
+   if (shmring_write(&rings[fd]->to_server, &msg->header, sizeof(msg->header),
+                     msg->data, msg->header.len, in_fd, &was_empty) == -1)
+      return -1;
+   if (was_empty)
+      return ring_doorbell(out_fd);
+   return 0;
+}
+
+static int client_recv_msg_shmem(int fd, ldcs_message_t *msg, ldcs_read_block_t block, int is_dynamic)
+{
+   int in_fd, out_fd;
+
+   msg->header.type = LDCS_MSG_UNKNOWN;
+   msg->header.len = 0;
+
+   assert(fd >= 0 && fd < MAX_FD);
+   assert(block == LDCS_READ_BLOCK); /* Non-blocking isn't implemented yet */
+
+   client_pipe_fds(fd, &in_fd, &out_fd);
+   if (shmring_read(&rings[fd]->to_client, &msg->header, sizeof(msg->header), in_fd) == -1)
+      return -1;
+
+   if (msg->header.len == 0) {
+      msg->data = NULL;
+      return 0;
+   }
+
+   if (is_dynamic) {
+      msg->data = (char *) spindle_malloc(msg->header.len);
+   }
+
+   return shmring_read(&rings[fd]->to_client, msg->data, msg->header.len, in_fd);
+}
+
+int client_recv_msg_dynamic_shmem(int fd, ldcs_message_t *msg, ldcs_read_block_t block)
+{
+   return client_recv_msg_shmem(fd, msg, block, 1);
+}
+
+int client_recv_msg_static_shmem(int fd, ldcs_message_t *msg, ldcs_read_block_t block)
+{
+   return client_recv_msg_shmem(fd, msg, block, 0);
+}
+
+int client_close_connection_shmem(int fd)
+{
+   assert(fd >= 0 && fd < MAX_FD);
+
+   /* The server removes the ring file along with our fifos */
+   shmring_detach(rings[fd]);
+   rings[fd] = NULL;
+   if (ring_paths[fd]) {
+      spindle_free(ring_paths[fd]);
+      ring_paths[fd] = NULL;
+   }
+   return client_close_connection_pipe(fd);
+}
@@ -19,19 +19,23 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
-#include <netdb.h>
+#include <sys/un.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
-#include <unistd.h>
 #include <stdlib.h>
 
 #include "client_heap.h"
 #include "ldcs_api_socket.h"
 #include "ldcs_api.h"
+#include "client_api.h"
+
+/* See server/comlib/ldcs_api_socket.c.  Answers to static receives must
+   fit in MAX_PATH_LEN bytes, which every caller's buffer holds. */
 
 #define MAX_FD 1
 static struct fdlist_entry_t ldcs_socket_fdlist[MAX_FD];
@@ -42,106 +46,98 @@ static int get_new_fd_socket()
    return 0;
 }
 
-static int _ldcs_read_socket(int fd, void *data, int bytes, ldcs_read_block_t block) {
-
-  int         left,bsumread;
-  ssize_t      btoread, bread;
-  char       *dataptr;
-  
-  left      = bytes;
-  bsumread  = 0;
-  dataptr   = (char*) data;
-
-  while (left > 0)  {
-    btoread    = left;
-    bread      = read(fd, dataptr, btoread);
-    if(bread<0) {
-      if( (errno==EAGAIN) || (errno==EWOULDBLOCK) ) {
-	debug_printf3("read from socket: got EAGAIN or EWOULDBLOCK\n");
-	if(block==LDCS_READ_NO_BLOCK) return(0);
-	else continue;
-      } else { 
-         debug_printf3("read from socket: %ld bytes ... errno=%d (%s)\n",bread,errno,strerror(errno));
-      }
-    } else {
-      debug_printf3("read from socket: %ld bytes ...\n",bread);
-    }
-
-    if(bread>0) {
-      left      -= bread;
-      dataptr   += bread;
-      bsumread  += bread;
-    } else {
-      if(bread==0) return(bsumread);
-      else         return(bread);
-    }
-  }
-  return (bsumread);
+/* Must match socket_address in server/comlib/ldcs_api_socket.c */
+static int socket_address(char *location, int number, struct sockaddr_un *addr, socklen_t *addr_len)
+{
+   int len;
+
+   memset(addr, 0, sizeof(*addr));
+   addr->sun_family = AF_UNIX;
+#if defined(__linux__)
+   len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "spindle-%d", number) + 1;
+#else
+   len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/spindle_comm/sock-%d", location, number);
+#endif
+   if (len >= (int) sizeof(addr->sun_path)) {
+      err_printf("Location %s is too long for a unix socket path\n", location);
+      return -1;
+   }
+   *addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+   return 0;
 }
 
-static int _ldcs_write_socket(int fd, const void *data, int bytes ) {
-  int         left,bsumwrote;
-  size_t      bwrite, bwrote;
-  char       *dataptr;
-  
-  left      = bytes;
-  bsumwrote = 0;
-  dataptr   = (char*) data;
-
-  while (left > 0) {
-    bwrite     = left;
-    bwrote     = write(fd, dataptr, bwrite);
-    left      -= bwrote;
-    dataptr   += bwrote;
-    bsumwrote += bwrote;
-  }
-  return (bsumwrote);
-}
+/**
+ * Returns true if the server on sockfd runs as our user.  Anyone can bind
+ * an abstract name, so a server started by someone else could otherwise
+ * hand us its own files.
+ **/
+static int check_server(int sockfd, int number)
+{
+#if defined(__linux__)
+   struct ucred cred;
+   socklen_t cred_len = sizeof(cred);
 
+   if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1) {
+      err_printf("Could not get credentials of server %d: %s\n", number, strerror(errno));
+      return 0;
+   }
+   if (cred.uid != getuid()) {
+      err_printf("Server %d is pid %d, which runs as uid %d rather than %d.  Not using it\n",
+                 number, (int) cred.pid, (int) cred.uid, (int) getuid());
+      return 0;
+   }
+#endif
+   return 1;
+}
 
-int client_open_connection_socket(char* hostname, int portno)
+int client_open_connection_socket(char* location, int number)
 {
-   int sockfd, fd;
-   struct sockaddr_in serv_addr;
-   struct hostent *server;
+   int sockfd, fd, result;
+   int connect_cnt = 0;
+   struct sockaddr_un serv_addr;
+   socklen_t serv_addr_len;
 
    fd=get_new_fd_socket();
    if(fd<0) return(-1);
    ldcs_socket_fdlist[fd].type=LDCS_SOCKET_FD_TYPE_CONN;
 
-   sockfd = socket(AF_INET, SOCK_STREAM, 0);
-   if (sockfd < 0) _error("ERROR opening socket");
+   if (socket_address(location, number, &serv_addr, &serv_addr_len) == -1)
+      return -1;
 
+   /* Not close-on-exec.  The connection is handed to the exec'd process. */
+   sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+   if (sockfd < 0) {
+      err_printf("Could not create socket: %s\n", strerror(errno));
+      return -1;
+   }
    debug_printf3("after socket: -> sockfd=%d\n",sockfd);
 
-   server = gethostbyname(hostname);
-   debug_printf3("after gethostbyname: -> server=%p\n",server);
-   if (server == NULL) {
-      fprintf(stderr,"ERROR, no such host\n");
-      exit(0);
+   /* wait for the server (at most client_connect_wait tenths of a second) */
+   for (;;) {
+      result = connect(sockfd, (struct sockaddr *) &serv_addr, serv_addr_len);
+      if (result == 0)
+         break;
+      if (errno == EINTR)
+         continue;
+      if ((errno != ENOENT && errno != ECONNREFUSED && errno != EAGAIN) || connect_cnt >= client_connect_wait) {
+         err_printf("Could not connect to server %d: %s\n", number, strerror(errno));
+         close(sockfd);
+         return -1;
+      }
+      if (connect_cnt % 10 == 0)
+         debug_printf3("waiting: server socket %d is not up (after %d seconds)\n", number, connect_cnt/10);
+      usleep(100000); /* .1 seconds */
+      connect_cnt++;
    }
-
-   debug_printf3("after gethostbyname: -> hostname=%s\n",server->h_name);
-
-   bzero((char *) &serv_addr, sizeof(serv_addr));
-   serv_addr.sin_family = AF_INET;
-   bcopy((char *)server->h_addr, 
-         (char *)&serv_addr.sin_addr.s_addr,
-         server->h_length);
-   serv_addr.sin_port = htons(portno);
-   debug_printf3("after port: -> port=%d\n",portno);
-
-   ldcs_socket_fdlist[fd].fd=sockfd;
-
-
-   if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0) {
-      return(-1);
+   if (!check_server(sockfd, number)) {
+      close(sockfd);
+      return -1;
    }
   
-   debug_printf3("after connect: -> port=%d\n",portno);
+   debug_printf3("after connect: -> server %d on sockfd=%d\n", number, sockfd);
+   ldcs_socket_fdlist[fd].fd=sockfd;
   
    return(fd);
-  
 }
 
 char *client_get_connection_string_socket(int fd)
@@ -174,76 +170,156 @@ int client_register_connection_socket(char *connection_str)
    return fd;
 }
 
+int is_client_fd(int connfd, int fd)
+{
+   return ldcs_socket_fdlist[connfd].fd == fd;
+}
+
+int client_answer_fd_socket(int fd)
+{
+   return ldcs_socket_fdlist[fd].fd;
+}
+
 int client_close_connection_socket(int fd) 
 {
    int rc=0;
    int sockfd;
 
-   if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
+   assert(fd >= 0 && fd < MAX_FD);
 
    sockfd=ldcs_socket_fdlist[fd].fd;
 
    if(sockfd<0) return(-1);
    
    rc=close(sockfd);
+   ldcs_socket_fdlist[fd].fd=-1;
 
    return(rc);
 }
 
 int client_send_msg_socket(int fd, ldcs_message_t * msg) {
+  struct msghdr mh;
+  struct iovec iov[2];
+  ssize_t n;
+  int connfd;
 
-  char help[41];
-  int n, connfd;
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
+  assert(fd >= 0 && fd < MAX_FD);
   connfd=ldcs_socket_fdlist[fd].fd;
 
-  bzero(help,41);if(msg->data) strncpy(help,msg->data,40);
-  debug_printf3("sending message of type: %s len=%d data=%s ...\n",
-	       _message_type_to_str(msg->header.type),
-	       msg->header.len,help );
-
-  n = _ldcs_write_socket(connfd,&msg->header,sizeof(msg->header));
-  if (n < 0) _error("ERROR writing header to socket");
-
-  if(msg->header.len>0) {
-    n = _ldcs_write_socket(connfd,(void *) msg->data,msg->header.len);
-    if (n < 0) _error("ERROR writing data to socket");
+  debug_printf3("sending message of size len=%ld\n", (long) msg->header.len);
+
+  iov[0].iov_base = &msg->header;
+  iov[0].iov_len = sizeof(msg->header);
+  iov[1].iov_base = msg->data;
+  iov[1].iov_len = msg->header.len;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = iov;
+  mh.msg_iovlen = msg->header.len > 0 ? 2 : 1;
+
+  do {
+    n = sendmsg(connfd, &mh, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+     err_printf("Error writing message to socket: %s\n", strerror(errno));
+     return -1;
   }
-  
-  
   return(0);
 }
 
-int client_recv_msg_static_socket(int fd, ldcs_message_t *msg,  ldcs_read_block_t block) {
-  char help[41];
-  int rc=0;
-  int n, connfd;
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
+/**
+ * Receive one record.  Dynamic receives peek at the header to size the
+ * data buffer.  If passfd is non-NULL, it's set to a descriptor that came
+ * with the record, or -1 if there was none.
+ **/
+static int client_recv_msg_socket(int fd, ldcs_message_t *msg, ldcs_read_block_t block, int is_dynamic, int *passfd) {
+  struct msghdr mh;
+  struct iovec iov[2];
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } ctrl;
+  ssize_t n;
+  int connfd, flags = MSG_CMSG_CLOEXEC;
+
+  assert(fd >= 0 && fd < MAX_FD);
   connfd=ldcs_socket_fdlist[fd].fd;
 
+  msg->header.type = LDCS_MSG_UNKNOWN;
+  msg->header.len = 0;
+  if (passfd)
+     *passfd = -1;
+  if (block == LDCS_READ_NO_BLOCK)
+     flags |= MSG_DONTWAIT;
+
+  if (is_dynamic) {
+     do {
+        n = recv(connfd, &msg->header, sizeof(msg->header), flags | MSG_PEEK);
+     } while (n < 0 && errno == EINTR);
+     if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+     if (n != sizeof(msg->header)) {
+        err_printf("Lost connection to server while reading message header\n");
+        return -1;
+     }
+     msg->data = msg->header.len ? (char *) spindle_malloc(msg->header.len) : NULL;
+     if (msg->header.len && !msg->data) {
+        err_printf("Could not allocate memory for message data\n");
+        return -1;
+     }
+  }
 
-  n = _ldcs_read_socket(connfd,&msg->header,sizeof(msg->header), block);
-  if (n == 0) return(rc);
-  if (n < 0) _error("ERROR reading header from socket");
-
-  if(msg->header.len>0) {
+  iov[0].iov_base = &msg->header;
+  iov[0].iov_len = sizeof(msg->header);
+  iov[1].iov_base = msg->data;
+  iov[1].iov_len = is_dynamic ? msg->header.len : MAX_PATH_LEN;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = iov;
+  mh.msg_iovlen = iov[1].iov_len ? 2 : 1;
+  if (passfd) {
+     mh.msg_control = ctrl.buf;
+     mh.msg_controllen = sizeof(ctrl.buf);
+  }
 
-    msg->data = (char *) spindle_malloc(msg->header.len);
-    if (!msg)  _error("could not allocate memory for message data");
-    
-    n = _ldcs_read_socket(connfd,msg->data,msg->header.len, LDCS_READ_BLOCK);
-    if (n == 0) return(rc);
-    if (n < 0) _error("ERROR reading message data from socket");
-    if (n != msg->header.len) _error("received different number of bytes for message data");
+  do {
+     n = recvmsg(connfd, &mh, flags);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+     return 0;
+
+  if (passfd && n > 0) {
+     for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+           memcpy(passfd, CMSG_DATA(cmsg), sizeof(int));
+     }
+  }
 
-  } else {
-    msg->data = NULL;
+  if (n < (ssize_t) sizeof(msg->header) || (mh.msg_flags & MSG_TRUNC) ||
+      n - sizeof(msg->header) != (size_t) msg->header.len) {
+     err_printf("Lost connection to server or got a malformed message (%ld bytes)\n", (long) n);
+     if (passfd && *passfd != -1) {
+        close(*passfd);
+        *passfd = -1;
+     }
+     return -1;
   }
 
-  bzero(help,41);if(msg->data) strncpy(help,msg->data,40);
-  debug_printf3("received message of type: %s len=%d data=%s ...\n",
-	       _message_type_to_str(msg->header.type),
-	       msg->header.len,help );
-  
+  debug_printf3("received message of type %d len=%ld%s\n", (int) msg->header.type, (long) msg->header.len,
+                passfd && *passfd != -1 ? " with descriptor" : "");
   return(0);
 }
+
+int client_recv_msg_static_socket(int fd, ldcs_message_t *msg, ldcs_read_block_t block)
+{
+   return client_recv_msg_socket(fd, msg, block, 0, NULL);
+}
+
+int client_recv_msg_dynamic_socket(int fd, ldcs_message_t *msg, ldcs_read_block_t block)
+{
+   return client_recv_msg_socket(fd, msg, block, 1, NULL);
+}
+
+int client_recv_msg_static_fd_socket(int fd, ldcs_message_t *msg, ldcs_read_block_t block, int *passfd)
+{
+   return client_recv_msg_socket(fd, msg, block, 0, passfd);
+}
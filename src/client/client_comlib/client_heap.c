@@ -18,12 +18,46 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_api.h"
 
 #include <sys/syscall.h>
+#include <sys/mman.h>
 #include <sched.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 struct lock_t heap_lock;
 
+/**
+ * Small blocks come from arenas rather than malloc, so threads opening
+ * files at once don't all queue on heap_lock.  We can't count on TLS in
+ * our namespace, so a thread takes the arena its tid hashes to.  Each
+ * arena has its own lock and a free list per size class, and carves new
+ * blocks from chunks it maps itself.  A block's header names its arena
+ * and class, so any thread can free it.  Blocks bigger than the largest
+ * class still come from malloc under heap_lock.
+ **/
+
+#define NUM_ARENAS 16
+#define NUM_SIZE_CLASSES 8
+#define MIN_CLASS_SHIFT 5
+#define MAX_CLASS_SIZE (1 << (MIN_CLASS_SHIFT + NUM_SIZE_CLASSES - 1))
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define LARGE_BLOCK ((unsigned int) -1)
+
+typedef struct {
+   unsigned int arena;
+   unsigned int sclass;
+   size_t pad;
+} block_header_t;
+
+typedef struct {
+   struct lock_t lock;
+   void *free_list[NUM_SIZE_CLASSES];
+   char *chunk_cur;
+   char *chunk_end;
+} arena_t;
+
+static arena_t arenas[NUM_ARENAS];
+
 static pid_t gettid()
 {
    return syscall(SYS_gettid);
@@ -55,36 +89,132 @@ void unlock(struct lock_t *l)
    __sync_lock_release(&l->lock);
 }
 
+static unsigned int size_class(size_t size)
+{
+   unsigned int sclass = 0;
+   size += sizeof(block_header_t);
+   while (((size_t) 1 << (MIN_CLASS_SHIFT + sclass)) < size)
+      sclass++;
+   return sclass;
+}
+
+static block_header_t *arena_alloc(arena_t *arena, unsigned int sclass)
+{
+   size_t block_size = (size_t) 1 << (MIN_CLASS_SHIFT + sclass);
+   block_header_t *block;
+   void *chunk;
+
+   if (arena->free_list[sclass]) {
+      block = (block_header_t *) arena->free_list[sclass];
+      arena->free_list[sclass] = *((void **) (block + 1));
+      return block;
+   }
+   if ((size_t) (arena->chunk_end - arena->chunk_cur) < block_size) {
+      chunk = mmap(NULL, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (chunk == MAP_FAILED)
+         return NULL;
+      arena->chunk_cur = (char *) chunk;
+      arena->chunk_end = arena->chunk_cur + ARENA_CHUNK_SIZE;
+   }
+   block = (block_header_t *) arena->chunk_cur;
+   arena->chunk_cur += block_size;
+   return block;
+}
+
 void *spindle_malloc(size_t size)
 {
-   void *result;
-   HEAP_LOCK;
-   result = malloc(size);
-   HEAP_UNLOCK;
-   return result;
+   block_header_t *block;
+   unsigned int sclass, arena_num;
+   arena_t *arena;
+
+   if (size + sizeof(block_header_t) > MAX_CLASS_SIZE) {
+      HEAP_LOCK;
+      block = (block_header_t *) malloc(size + sizeof(block_header_t));
+      HEAP_UNLOCK;
+      if (!block)
+         return NULL;
+      block->arena = LARGE_BLOCK;
+      return block + 1;
+   }
+
+   sclass = size_class(size);
+   arena_num = ((unsigned int) gettid()) % NUM_ARENAS;
+   arena = arenas + arena_num;
+   if (lock(&arena->lock) == -1)
+      assert(0);
+   block = arena_alloc(arena, sclass);
+   unlock(&arena->lock);
+   if (!block)
+      return NULL;
+   block->arena = arena_num;
+   block->sclass = sclass;
+   return block + 1;
 }
 
 void spindle_free(void *mem)
 {
-   HEAP_LOCK;
-   free(mem);
-   HEAP_UNLOCK;
+   block_header_t *block;
+   arena_t *arena;
+
+   if (!mem)
+      return;
+   block = ((block_header_t *) mem) - 1;
+   if (block->arena == LARGE_BLOCK) {
+      HEAP_LOCK;
+      free(block);
+      HEAP_UNLOCK;
+      return;
+   }
+
+   arena = arenas + block->arena;
+   if (lock(&arena->lock) == -1)
+      assert(0);
+   *((void **) mem) = arena->free_list[block->sclass];
+   arena->free_list[block->sclass] = block;
+   unlock(&arena->lock);
 }
 
 char *spindle_strdup(const char *str)
 {
+   size_t len = strlen(str) + 1;
    char *result;
-   HEAP_LOCK;
-   result = strdup(str);
-   HEAP_UNLOCK;
+
+   result = (char *) spindle_malloc(len);
+   if (result)
+      memcpy(result, str, len);
    return result;
 }
 
 void *spindle_realloc(void *orig, size_t size)
 {
+   block_header_t *block, *newblock;
+   size_t old_size;
    void *result;
-   HEAP_LOCK;
-   result = realloc(orig, size);
-   HEAP_UNLOCK;
+
+   if (!orig)
+      return spindle_malloc(size);
+   block = ((block_header_t *) orig) - 1;
+   if (block->arena == LARGE_BLOCK) {
+      if (size + sizeof(block_header_t) <= MAX_CLASS_SIZE)
+         old_size = size;
+      else {
+         HEAP_LOCK;
+         newblock = (block_header_t *) realloc(block, size + sizeof(block_header_t));
+         HEAP_UNLOCK;
+         return newblock ? newblock + 1 : NULL;
+      }
+   }
+   else {
+      old_size = ((size_t) 1 << (MIN_CLASS_SHIFT + block->sclass)) - sizeof(block_header_t);
+      if (size <= old_size)
+         return orig;
+   }
+
+   /* Moving between classes, or from a large block down to one */
+   result = spindle_malloc(size);
+   if (!result)
+      return NULL;
+   memcpy(result, orig, old_size < size ? old_size : size);
+   spindle_free(orig);
    return result;
 }
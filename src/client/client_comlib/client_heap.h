@@ -37,7 +37,7 @@ extern struct lock_t heap_lock;
 #define HEAP_LOCK do { if (lock(&heap_lock) == -1) assert(0); } while (0)
 #define HEAP_UNLOCK unlock(&heap_lock)
 
-/* These functions automatically lock the heap_lock */
+/* These functions take an arena lock, or the heap_lock for large blocks */
 void *spindle_malloc(size_t size);
 void spindle_free(void *mem);
 char *spindle_strdup(const char *str);
@@ -0,0 +1,64 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(CLIENT_TIMING_H_)
+#define CLIENT_TIMING_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "ldcs_api.h"
+
+/**
+ * With OPT_CLIENTTIMING the client counts its interceptions and the ticks
+ * spent in them, in client_timing.  Ticks are the cycle counter where
+ * there is one and nanoseconds elsewhere; client_done turns them into
+ * nanoseconds against the clock before they're sent to the server.  When
+ * timing is off, timing_start is a load and a branch.
+ **/
+extern int client_timing_on;
+extern client_timing_msg_t client_timing;
+
+static inline uint64_t timing_ticks()
+{
+#if defined(__x86_64__)
+   uint32_t lo, hi;
+   __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+   return ((uint64_t) hi << 32) | lo;
+#elif defined(__aarch64__)
+   uint64_t val;
+   __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (val));
+   return val;
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t timing_start()
+{
+   return client_timing_on ? timing_ticks() : 0;
+}
+
+static inline void timing_end(client_timing_id_t id, uint64_t start)
+{
+   if (!start)
+      return;
+   __sync_fetch_and_add(client_timing.calls + id, 1);
+   __sync_fetch_and_add(client_timing.nsecs + id, timing_ticks() - start);
+}
+
+#endif
@@ -15,12 +15,13 @@
 */
 
 #include "ldcs_api.h"
+#include "client_api.h"
 #include "config.h"
 
 #if !defined(COMM)
 #if defined(COMM_PIPES)
 #define COMM pipe
-#elif defined(COMM_SOCKETS)
+#elif defined(COMM_SOCKET)
 #define COMM socket
 #elif defined(COMM_BITER)
 #define COMM biter
@@ -42,6 +43,14 @@ extern char *RENAME(client_get_connection_string) (int fd);
 extern int RENAME(client_send_msg) (int connid, ldcs_message_t * msg);
 extern int RENAME(client_recv_msg_static) (int fd, ldcs_message_t *msg, ldcs_read_block_t block);
 extern int RENAME(client_recv_msg_dynamic) (int fd, ldcs_message_t *msg, ldcs_read_block_t block);
+#if defined(COMM_SOCKET)
+extern int client_recv_msg_static_fd_socket(int fd, ldcs_message_t *msg, ldcs_read_block_t block, int *passfd);
+extern int client_answer_fd_socket(int fd);
+#elif defined(COMM_PIPES)
+extern int client_pipe_fds(int fd, int *in_fd, int *out_fd);
+#endif
+
+int client_connect_wait = CLIENT_CONNECT_WAIT;
 
 int client_open_connection(char* location, int number)
 {
@@ -78,3 +87,26 @@ int client_recv_msg_dynamic(int fd, ldcs_message_t *msg, ldcs_read_block_t block
    return RENAME(client_recv_msg_dynamic) (fd, msg, block);
 }
 
+int client_recv_msg_static_fd(int fd, ldcs_message_t *msg, ldcs_read_block_t block, int *passfd)
+{
+#if defined(COMM_SOCKET)
+   return client_recv_msg_static_fd_socket(fd, msg, block, passfd);
+#else
+   *passfd = -1;
+   return RENAME(client_recv_msg_static) (fd, msg, block);
+#endif
+}
+
+int client_answer_fd(int fd)
+{
+#if defined(COMM_SOCKET)
+   return client_answer_fd_socket(fd);
+#elif defined(COMM_PIPES)
+   int in_fd, out_fd;
+   client_pipe_fds(fd, &in_fd, &out_fd);
+   return in_fd;
+#else
+   /* biter and shmem answers don't come through a descriptor */
+   return -1;
+#endif
+}
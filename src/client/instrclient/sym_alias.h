@@ -22,9 +22,14 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #if defined(INTERCEPT_OPEN)
 int open(const char *path, int oflag, ...) __attribute__ ((alias ("rtcache_open"), __visibility__("default")));
 int open64(const char *path, int oflag, ...) __attribute__ ((alias ("rtcache_open64"), __visibility__("default")));
+int openat(int dirfd, const char *path, int oflag, ...) __attribute__ ((alias ("rtcache_openat"), __visibility__("default")));
 FILE *fopen(const char *path, const char *mode) __attribute__ ((alias ("rtcache_fopen"), __visibility__("default")));
 FILE *fopen64(const char *path, const char *mode) __attribute__ ((alias ("rtcache_fopen64"), __visibility__("default")));
 int close(int fd) __attribute__ ((alias ("rtcache_close"), __visibility__("default")));
+int chdir(const char *path) __attribute__ ((alias ("rtcache_chdir"), __visibility__("default")));
+int fchdir(int fd) __attribute__ ((alias ("rtcache_fchdir"), __visibility__("default")));
+int rename(const char *oldpath, const char *newpath) __attribute__ ((alias ("rtcache_rename"), __visibility__("default")));
+int renameat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath) __attribute__ ((alias ("rtcache_renameat"), __visibility__("default")));
 #endif
 
 #if defined(INTERCEPT_STAT)
@@ -37,6 +42,9 @@ int __lxstat64(int vers, const char *path, struct stat *buf) __attribute__ ((ali
 int fstat(int fd, struct stat *buf) __attribute__ ((alias ("rtcache_fstat"), __visibility__("default")));
 int __fxstat(int vers, int fd, struct stat *buf) __attribute__ ((alias ("rtcache_fxstat"), __visibility__("default")));
 int __fxstat64(int vers, int fd, struct stat *buf) __attribute__ ((alias ("rtcache_fxstat64"), __visibility__("default")));
+int fstatat(int dirfd, const char *path, struct stat *buf, int flags) __attribute__ ((alias ("rtcache_fstatat"), __visibility__("default")));
+int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf) __attribute__ ((alias ("rtcache_statx"), __visibility__("default")));
+int faccessat(int dirfd, const char *path, int mode, int flags) __attribute__ ((alias ("rtcache_faccessat"), __visibility__("default")));
 #endif
 
 #if defined(INTERCEPT_EXEC)
@@ -54,6 +62,14 @@ int spindle_open(const char *pathname, int flags, ...) __attribute__ (( alias ("
 FILE *spindle_fopen(const char *path, const char *opts) __attribute__ (( alias ("int_spindle_fopen"), __visibility__("default")));
 int spindle_stat(const char *path, struct stat *buf) __attribute__ (( alias ("int_spindle_stat"), __visibility__("default")));
 int spindle_lstat(const char *path, struct stat *buf) __attribute__ (( alias ("int_spindle_lstat"), __visibility__("default")));
+int spindle_find_first(const char **paths, int count) __attribute__ (( alias ("int_spindle_find_first"), __visibility__("default")));
+int spindle_prefetch(const char **paths, int n) __attribute__ (( alias ("int_spindle_prefetch"), __visibility__("default")));
+int spindle_prefetch_dir(const char *dir) __attribute__ (( alias ("int_spindle_prefetch_dir"), __visibility__("default")));
+int spindle_startup_done() __attribute__ (( alias ("int_spindle_startup_done"), __visibility__("default")));
+int spindle_kvs_put(const char *key, const char *value) __attribute__ (( alias ("int_spindle_kvs_put"), __visibility__("default")));
+int spindle_kvs_fence(int local_procs) __attribute__ (( alias ("int_spindle_kvs_fence"), __visibility__("default")));
+int spindle_kvs_get(const char *key, char *value, size_t len) __attribute__ (( alias ("int_spindle_kvs_get"), __visibility__("default")));
+void *spindle_bcast_file(const char *path, size_t *size) __attribute__ (( alias ("int_spindle_bcast_file"), __visibility__("default")));
 int spindle_is_present() __attribute__ (( alias ("int_spindle_is_present"), __visibility__("default")));
 void spindle_enable() __attribute__ (( alias ("int_spindle_enable"), __visibility__("default")));
 void spindle_disable() __attribute__ (( alias ("int_spindle_disable"), __visibility__("default")));
@@ -22,6 +22,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "spindle_debug.h"
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 struct entry_t {
    sheep_ptr_t libname;
@@ -33,11 +37,38 @@ struct entry_t {
    sheep_ptr_t hash_next;
 };
 
+/**
+ * Lookups don't take any lock.  Each bucket has a sequence count that
+ * writers make odd while they change the bucket's chain or results, and
+ * a reader retries if the count moved under it.  Freed entries stay inside
+ * the shared heap, so a racing reader only has to bounds check pointers
+ * before it follows them.
+ *
+ * Writers take the bucket's lock, then the heap lock for allocations and
+ * the LRU list.  Eviction already holds the heap lock, so it only tries the
+ * victim's bucket lock and moves on to another entry if that fails.
+ **/
+typedef struct {
+   volatile unsigned long lock;
+   volatile unsigned long held_by;
+   volatile uint32_t seq;
+   sheep_ptr_t head;
+} bucket_t;
+
 char *in_progress;
 
 #define HASH_SIZE 1024
 
-static char return_name[MAX_PATH_LEN+1];
+/* Reference bits for the clock are kept outside the entries, so that readers
+   never store to an entry that may be freed under them.  Entries that share
+   a slot protect each other, which is fine for an approximate LRU. */
+#define CLOCK_SLOTS (HASH_SIZE * 4)
+
+/* Lockless attempts at a bucket before a reader waits for its lock */
+#define SEQ_RETRIES 16
+
+/* Lookups between adds of our counts to the node's totals */
+#define STATS_FLUSH_INTERVAL 64
 
 static sheep_ptr_t *hash_ptr;
 static sheep_ptr_t *lru_head;
@@ -45,35 +76,66 @@ static sheep_ptr_t *lru_end;
 static sheep_ptr_t hash_error;
 static size_t heap_limit = 0;
 static size_t *heap_used = 0;
+static size_t *num_entries = 0;
 static lock_t cache_lock;
-static sheep_ptr_t *table;
+static bucket_t *table;
+static volatile unsigned char *clock_bits;
+/* The sheep allocator's local cache is kept per process, and our threads
+   share it */
+static struct lock_t local_cache_lock;
+static const char *heap_start, *heap_end;
 
 static shminfo_t *shminfo = NULL;
 
-static void upgrade_to_writelock()
+static unsigned long local_hits, local_misses, local_waits;
+
+static void bucket_lock(bucket_t *bucket, lock_t *lock)
 {
+   lock->lock = &bucket->lock;
+   lock->held_by = &bucket->held_by;
+   lock->id = -1;
+   lock->ref_count = 0;
 }
 
-static void downgrade_to_readlock()
+static void take_bucket_lock(bucket_t *bucket)
 {
+   lock_t lock;
+   bucket_lock(bucket, &lock);
+   take_lock(&lock);
 }
 
-static void take_writer_lock()
+static int try_bucket_lock(bucket_t *bucket)
 {
-   take_lock(&cache_lock);
+   lock_t lock;
+   bucket_lock(bucket, &lock);
+   return test_lock(&lock);
 }
 
-static void release_writer_lock()
+static void release_bucket_lock(bucket_t *bucket)
 {
-   release_lock(&cache_lock);
+   lock_t lock;
+   bucket_lock(bucket, &lock);
+   release_lock(&lock);
+}
+
+static void begin_bucket_write(bucket_t *bucket)
+{
+   bucket->seq++;
+   MEMORY_BARRIER;
+}
+
+static void end_bucket_write(bucket_t *bucket)
+{
+   MEMORY_BARRIER;
+   bucket->seq++;
 }
 
-static void take_reader_lock()
+static void take_init_lock()
 {
    take_lock(&cache_lock);
 }
 
-static void release_reader_lock()
+static void release_init_lock()
 {
    release_lock(&cache_lock);
 }
@@ -88,20 +150,114 @@ static void release_sheep_lock()
    release_heap_lock(shminfo);
 }
 
-static int clean_oldest_entry();
-static void *malloc_sheep_cache(size_t size)
+/**
+ * Add our hit counts to the totals in the shared header, which the
+ * server reports at exit
+ **/
+void shmcache_flush_stats()
 {
-   void *newalloc;
-   size_t alloc_size;
+   shmcache_header_t *header;
 
-   take_sheep_lock();
+   if (!table)
+      return;
+   header = &shminfo->shared_header->shmcache;
+   if (local_hits)
+      __sync_fetch_and_add(&header->hits, local_hits);
+   if (local_misses)
+      __sync_fetch_and_add(&header->misses, local_misses);
+   if (local_waits)
+      __sync_fetch_and_add(&header->waits, local_waits);
+   local_hits = local_misses = local_waits = 0;
+}
+
+static void count_lookup(unsigned long *counter)
+{
+   (*counter)++;
+   if (local_hits + local_misses + local_waits >= STATS_FLUSH_INTERVAL)
+      shmcache_flush_stats();
+}
+
+/**
+ * Wake processes in shmcache_waitfor_update once an entry is no longer
+ * in progress.  Must hold the entry's bucket lock.
+ **/
+static void wake_waiters(struct entry_t *entry)
+{
+   if (entry->pending_count)
+      syscall(SYS_futex, &entry->result.val, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static int in_heap(const void *p, size_t size)
+{
+   const char *c = (const char *) p;
+   return c >= heap_start && c + size <= heap_end;
+}
+
+/**
+ * strcmp for a string in the shared heap that a writer may be changing
+ **/
+static int heap_strequal(const char *heap_str, const char *str)
+{
+   for (;;) {
+      if (heap_str >= heap_end || *heap_str != *str)
+         return 0;
+      if (*str == '\0')
+         return 1;
+      heap_str++;
+      str++;
+   }
+}
+
+/**
+ * Copy an entry result into buffer, which has room for MAX_PATH_LEN+1
+ * bytes.  Each lookup passes its own, so threads can look up at once.
+ * As with heap_strequal, the source may be changing, and the caller
+ * checks that it didn't.
+ **/
+static char *copy_result(const char *ent_result, char *buffer)
+{
+   size_t i;
+
+   if (ent_result == in_progress || ent_result == NULL)
+      return (char *) ent_result;
+   for (i = 0; i < MAX_PATH_LEN && ent_result + i < heap_end; i++) {
+      buffer[i] = ent_result[i];
+      if (ent_result[i] == '\0')
+         break;
+   }
+   buffer[i] = '\0';
+   return buffer;
+}
+
+static int clean_oldest_entry(bucket_t *held_bucket);
+
+/**
+ * held_bucket is the bucket whose lock the caller holds, or NULL.
+ * Another thread of ours may hold another.
+ **/
+static void *malloc_sheep_cache(size_t size, bucket_t *held_bucket)
+{
+   void *newalloc = NULL;
+   size_t alloc_size;
 
    alloc_size = sheep_alloc_size(size);
 
+   /* Small objects usually come from our local cache, without the lock */
+   if ((!heap_limit || *heap_used + alloc_size <= heap_limit) && lock(&local_cache_lock) == 0) {
+      newalloc = malloc_sheep_local(size);
+      unlock(&local_cache_lock);
+      if (newalloc) {
+         __sync_fetch_and_add(heap_used, alloc_size);
+         return newalloc;
+      }
+   }
+
+   take_sheep_lock();
+
    while (heap_limit && *heap_used + alloc_size > heap_limit) {
       debug_printf3("Cleaning old entries in shmcache.  heap_limit = %lu, heap_used = %lu, alloc_size = %lu\n",
                     heap_limit, *heap_used, alloc_size);
-      if (clean_oldest_entry() == -1) {
+      if (clean_oldest_entry(held_bucket) == -1) {
          /* A completely cleaned heap does not have enough space */
          release_sheep_lock();
          return NULL;
@@ -113,125 +269,178 @@ static void *malloc_sheep_cache(size_t size)
       if (newalloc)
          break;
       debug_printf3("shmcache allocation of size %lu failed, cleaning up older entries\n", size);
-      if (clean_oldest_entry() == -1) {
+      if (clean_oldest_entry(held_bucket) == -1) {
          /* A completely cleaned heap does not have enough space */
          release_sheep_lock();
          return NULL;
       }
    }
+   if (lock(&local_cache_lock) == 0) {
+      fill_sheep_local(size);
+      unlock(&local_cache_lock);
+   }
    
-   *heap_used += alloc_size;
+   __sync_fetch_and_add(heap_used, alloc_size);
    release_sheep_lock();
    return newalloc;
 }
 
-static void free_sheep_str(char *str)
+static void free_sheep_cache(void *p, size_t size)
 {
-   size_t alloc_size;
-   take_sheep_lock();
-   alloc_size = sheep_alloc_size(strlen(str) + 1);
+   size_t alloc_size = sheep_alloc_size(size);
+   int result;
+
    assert(*heap_used >= alloc_size);
-   *heap_used -= alloc_size;
-   free_sheep(str);
+   __sync_fetch_and_sub(heap_used, alloc_size);
+   if (lock(&local_cache_lock) == 0) {
+      result = free_sheep_local(p);
+      unlock(&local_cache_lock);
+      if (result == 0)
+         return;
+   }
+
+   take_sheep_lock();
+   free_sheep(p);
    release_sheep_lock();
 }
 
+static void free_sheep_str(char *str)
+{
+   free_sheep_cache(str, strlen(str) + 1);
+}
+
 static void free_sheep_entry(struct entry_t *entry)
 {
-   size_t alloc_size;
-   take_sheep_lock();
-   alloc_size = sheep_alloc_size(sizeof(struct entry_t));
-   assert(*heap_used >= alloc_size);
-   *heap_used -= alloc_size;
-   free_sheep(entry);
-   release_sheep_lock();
+   free_sheep_cache(entry, sizeof(struct entry_t));
 }
 
-static void mark_recently_used(struct entry_t *entry, int have_write_lock)
+static void mark_recently_used(struct entry_t *entry)
 {
-   struct entry_t *pentry, *nentry;
-   if (sheep_ptr_equals(ptr_sheep(entry), *lru_head))
-      return;
+   volatile unsigned char *bit = clock_bits + (entry->hash_key % CLOCK_SLOTS);
+   /* Only store when the bit changes, so hot entries don't bounce cache lines */
+   if (!*bit)
+      *bit = 1;
+}
 
-   if (!have_write_lock)
-      upgrade_to_writelock();
+/**
+ * The LRU list is ordered by when each entry last got a second chance
+ * from the clock.  Must hold the sheep lock.
+ **/
+static void lru_unlink(struct entry_t *entry)
+{
+   struct entry_t *pentry, *nentry;
 
    nentry = (struct entry_t *) sheep_ptr(&entry->lru_next);
    pentry = (struct entry_t *) sheep_ptr(&entry->lru_prev);
-   
    if (nentry)
       nentry->lru_prev = entry->lru_prev;
+   else
+      *lru_end = entry->lru_prev;
    if (pentry)
       pentry->lru_next = entry->lru_next;
+   else
+      *lru_head = entry->lru_next;
+}
 
-   if (sheep_ptr_equals(ptr_sheep(entry), *lru_end)) {
-      *lru_end = entry->lru_prev;
-   }
-
+static void lru_push_head(struct entry_t *entry)
+{
    entry->lru_next = *lru_head;
    entry->lru_prev = ptr_sheep(SHEEP_NULL);
 
    if (!IS_SHEEP_NULL(lru_head)) {
-      nentry = (struct entry_t *) sheep_ptr(lru_head);
+      struct entry_t *nentry = (struct entry_t *) sheep_ptr(lru_head);
       nentry->lru_prev = ptr_sheep(entry);
    }
    *lru_head = ptr_sheep(entry);
    if (IS_SHEEP_NULL(lru_end)) {
       set_sheep_ptr(lru_end, entry);
    }
-   if (!have_write_lock)
-      downgrade_to_readlock();
 }
 
-static int clean_oldest_entry()
+static void remove_entry(bucket_t *bucket, struct entry_t *entry)
 {
-   sheep_ptr_t pentry, i;
-   struct entry_t *entry, *prev_hash_entry;
-
-   debug_printf3("Cleaning oldest entries from shmcache for more space\n");
-   if (IS_SHEEP_NULL(lru_end))
-      return -1;
-   entry = (struct entry_t *) sheep_ptr(lru_end);
-
-   if (sheep_ptr(&entry->result) == in_progress) {
-      debug_printf("Tried to delete in_progress shmcache entry.  Not cleaning\n");
-      return -1;
-   }
-   if (entry->pending_count) {
-      debug_printf("Tried to delete pending shmcache entry.  Not cleaning\n");
-      return -1;
-   }
-   pentry = entry->lru_prev;
+   sheep_ptr_t i;
+   struct entry_t *prev_hash_entry = NULL;
 
-   prev_hash_entry = NULL;
-   debug_printf3("Cleaning entry %s -> %s\n",
-                 ((char *) sheep_ptr(&entry->libname)) ? : "[NULL]", 
-                 (((char *) sheep_ptr(&entry->result)) ? 
-                  (((char *) sheep_ptr(&entry->result)) == in_progress ? "[IN PROGRESS]" : ((char *) sheep_ptr(&entry->result))) :
-                  "[NULL]"));
-   for (i = table[entry->hash_key]; sheep_ptr(&i) != (void*) entry; i = prev_hash_entry->hash_next)
+   for (i = bucket->head; sheep_ptr(&i) != (void*) entry; i = prev_hash_entry->hash_next)
       prev_hash_entry = (struct entry_t *) sheep_ptr(&i);
 
+   begin_bucket_write(bucket);
    if (prev_hash_entry)
       prev_hash_entry->hash_next = entry->hash_next;
    else
-      table[entry->hash_key] = ptr_sheep(SHEEP_NULL);
+      bucket->head = entry->hash_next;
+   end_bucket_write(bucket);
+}
 
-   free_sheep_str((char *) sheep_ptr(& entry->libname));
-   if (!IS_SHEEP_NULL(&entry->result)) {
-      free_sheep_str((char *) sheep_ptr(&entry->result));
-   }
-   free_sheep_entry(entry);
+/**
+ * Run the clock from the end of the LRU list until an entry can be freed.
+ * Must hold the sheep lock.
+ **/
+static int clean_oldest_entry(bucket_t *held_bucket)
+{
+   struct entry_t *entry;
+   bucket_t *bucket;
+   volatile unsigned char *bit;
+   char *ent_result;
+   size_t steps, max_steps;
+
+   debug_printf3("Cleaning oldest entries from shmcache for more space\n");
+
+   /* Two trips around clear every reference bit */
+   max_steps = *num_entries * 2 + 1;
+   for (steps = 0; steps < max_steps; steps++) {
+      if (IS_SHEEP_NULL(lru_end))
+         return -1;
+      entry = (struct entry_t *) sheep_ptr(lru_end);
+      bucket = table + (entry->hash_key % HASH_SIZE);
+      bit = clock_bits + (entry->hash_key % CLOCK_SLOTS);
+      ent_result = (char *) sheep_ptr(&entry->result);
 
-   if (entry == sheep_ptr(lru_head)) {
-      *lru_head = ptr_sheep(SHEEP_NULL);
-      *lru_end = ptr_sheep(SHEEP_NULL);
+      if (*bit) {
+         *bit = 0;
+      }
+      else if (ent_result == in_progress || entry->pending_count) {
+         debug_printf3("Not cleaning in_progress or pending shmcache entry\n");
+      }
+      else if (bucket == held_bucket || try_bucket_lock(bucket)) {
+         /* A waiter may have taken the entry up before we got its bucket */
+         ent_result = (char *) sheep_ptr(&entry->result);
+         if (ent_result != in_progress && !entry->pending_count)
+            break;
+         debug_printf3("Not cleaning shmcache entry that became pending\n");
+         if (bucket != held_bucket)
+            release_bucket_lock(bucket);
+      }
+      else {
+         debug_printf3("Not cleaning shmcache entry in a busy bucket\n");
+      }
+      lru_unlink(entry);
+      lru_push_head(entry);
    }
-   else {
-      *lru_end = pentry;
-      ((struct entry_t *) sheep_ptr(lru_end))->lru_next = ptr_sheep(SHEEP_NULL);
+   if (steps == max_steps) {
+      debug_printf("Could not find a shmcache entry that can be cleaned\n");
+      return -1;
    }
 
+   debug_printf3("Cleaning entry %s -> %s\n",
+                 ((char *) sheep_ptr(&entry->libname)) ? : "[NULL]", 
+                 ent_result ? ent_result : "[NULL]");
+   remove_entry(bucket, entry);
+   if (bucket != held_bucket) {
+      lock_t lock;
+      bucket_lock(bucket, &lock);
+      release_lock(&lock);
+   }
+
+   lru_unlink(entry);
+   (*num_entries)--;
+   if (!IS_SHEEP_NULL(&entry->libname))
+      free_sheep_str((char *) sheep_ptr(&entry->libname));
+   if (ent_result)
+      free_sheep_str(ent_result);
+   free_sheep_entry(entry);
+
    return 0;
 }
 
@@ -241,88 +450,137 @@ static unsigned int str_hash(const char *str)
    int c;
    while ((c = *str++))
       hashv = ((hashv << 5) + hashv) + c;
-   return hashv % HASH_SIZE;
+   return (unsigned int) hashv;
 }
 
-static int shmcache_lookup_worker(const char *libname, char **result, int have_write_lock, struct entry_t **oentry)
+/**
+ * Find libname in its bucket.  Safe to call without the bucket lock, but
+ * then the answer only means something if the bucket's seq didn't change.
+ **/
+static struct entry_t *find_entry(bucket_t *bucket, const char *libname, unsigned int key)
 {
-   unsigned int key;
    struct entry_t *entry;
    sheep_ptr_t p;
-   char *ent_result;
+   size_t steps = 0;
+   const char *name;
 
-   debug_printf3("Looking up %s in shmcache\n", libname);
-   key = str_hash(libname);
-   for (p = table[key]; !IS_SHEEP_NULL(&p); p = entry->hash_next) {
+   for (p = bucket->head; !IS_SHEEP_NULL(&p); p = entry->hash_next) {
       entry = (struct entry_t *) sheep_ptr(&p);
+      if (!in_heap(entry, sizeof(*entry)) || steps++ > *num_entries)
+         return NULL;
       if (entry->hash_key != key)
          continue;
-      if (IS_SHEEP_NULL(&entry->libname))
+      name = (const char *) sheep_ptr(&entry->libname);
+      if (!name || !in_heap(name, 1))
          continue;
-      if (strcmp((char *) sheep_ptr(&entry->libname), libname) != 0)
+      if (!heap_strequal(name, libname))
          continue;
-      break;
+      return entry;
    }
-   if (IS_SHEEP_NULL(&p)) {
-      /* Not found in cache */
-      debug_printf3("Didn't find %s in shmcache\n", libname);
+   return NULL;
+}
+
+/**
+ * Look up libname without taking any lock.  Returns 0 if found, -1 if
+ * not, and 1 if a writer got in the way.
+ **/
+static int read_bucket(bucket_t *bucket, const char *libname, unsigned int key, char **result,
+                       char *buffer)
+{
+   struct entry_t *entry;
+   char *strresult = NULL;
+   uint32_t seq;
+
+   seq = bucket->seq;
+   if (seq & 1)
+      return 1;
+   MEMORY_BARRIER;
+
+   entry = find_entry(bucket, libname, key);
+   if (entry)
+      strresult = copy_result((char *) sheep_ptr(&entry->result), buffer);
+
+   MEMORY_BARRIER;
+   if (bucket->seq != seq)
+      return 1;
+   if (!entry)
       return -1;
+
+   mark_recently_used(entry);
+   *result = strresult;
+   return 0;
+}
+
+static int shmcache_lookup_worker(const char *libname, char **result, char *buffer)
+{
+   unsigned int key = str_hash(libname);
+   bucket_t *bucket = table + (key % HASH_SIZE);
+   struct entry_t *entry;
+   int i, iresult;
+
+   debug_printf3("Looking up %s in shmcache\n", libname);
+   for (i = 0; i < SEQ_RETRIES; i++) {
+      iresult = read_bucket(bucket, libname, key, result, buffer);
+      if (iresult != 1)
+         break;
    }
 
-   if (oentry) {
-      *oentry = entry;
+   if (iresult == 1) {
+      take_bucket_lock(bucket);
+      entry = find_entry(bucket, libname, key);
+      if (entry) {
+         *result = copy_result((char *) sheep_ptr(&entry->result), buffer);
+         mark_recently_used(entry);
+      }
+      release_bucket_lock(bucket);
+      iresult = entry ? 0 : -1;
    }
-   
-   mark_recently_used(entry, have_write_lock);
-   ent_result = (char *) sheep_ptr(&entry->result);
-   if (!ent_result) {
-      /* Entry is a cached negative result */
-      *result = NULL;
+
+   if (iresult == -1)
+      debug_printf3("Didn't find %s in shmcache\n", libname);
+   else if (!*result)
       debug_printf3("Found %s in shmcache with negative result\n", libname);
-      return 0;
-   }
-   
-   /* Entry is cached with postive result */
-   if (ent_result == in_progress) {
+   else if (*result == in_progress)
       debug_printf3("Found %s in shmcache with in_progress entry\n", libname);
-      *result = in_progress;
-   }
-   else {
-      debug_printf3("Found %s in shmcache with mapping to %s\n", libname, ent_result);
-      *result = ent_result;
-   }
-
-   return 0;
+   else
+      debug_printf3("Found %s in shmcache with mapping to %s\n", libname, *result);
+   return iresult;
 }
 
+/**
+ * Must hold the lock on libname's bucket
+ **/
 static int shmcache_add_worker(const char *libname, const char *mapped_name, int update)
 {
-   char *lookup_result;
    char *libname_str, *mappedname_str = NULL;
-   int result;
    size_t libname_len, mappedname_len;
+   unsigned int key = str_hash(libname);
+   bucket_t *bucket = table + (key % HASH_SIZE);
    struct entry_t *entry;
+   char *old_result;
 
    debug_printf3("%s library %s in shmcache to value %s\n",
                  update ? "Updating" : "Adding", libname,
                  mapped_name == in_progress ? "[IN PROGRESS]" : (mapped_name ? : "[NULL]"));
    if (update) {
-      result = shmcache_lookup_worker(libname, &lookup_result, 1, &entry);
-      if (result == -1) {
+      entry = find_entry(bucket, libname, key);
+      if (!entry) {
          err_printf("Could not find shmcache entry for %s while updating\n", libname);
          return -1;
       }
-      if (sheep_ptr(&entry->result) != in_progress && !IS_SHEEP_NULL(&entry->result))
-         free_sheep_str(sheep_ptr(&entry->result));
       if (mapped_name) {
          mappedname_len = strlen(mapped_name) + 1;
-         mappedname_str = (char *) malloc_sheep_cache(mappedname_len);
+         mappedname_str = (char *) malloc_sheep_cache(mappedname_len, bucket);
          if (!mappedname_str) {
-            free_sheep_str(sheep_ptr(&entry->libname));
+            err_printf("Could not free space in cache for updated entry for %s\n", libname);
+            /* Readers can't match an entry without a name, and eviction will clean it */
+            begin_bucket_write(bucket);
+            libname_str = (char *) sheep_ptr(&entry->libname);
             entry->libname = ptr_sheep(SHEEP_NULL);
             entry->result = ptr_sheep(SHEEP_NULL);
-            entry->hash_key = 0;
-            err_printf("Could not free space in cache for updated entry for %s\n", libname);
+            end_bucket_write(bucket);
+            wake_waiters(entry);
+            free_sheep_str(libname_str);
             return -1;
          }
          strncpy(mappedname_str, mapped_name, mappedname_len);
@@ -331,16 +589,22 @@ static int shmcache_add_worker(const char *libname, const char *mapped_name, int
          mappedname_str = NULL;
       }
 
+      begin_bucket_write(bucket);
+      old_result = (char *) sheep_ptr(&entry->result);
       entry->result = ptr_sheep(mappedname_str);
+      end_bucket_write(bucket);
+      wake_waiters(entry);
+      if (old_result != in_progress && old_result)
+         free_sheep_str(old_result);
       debug_printf3("Successfully updated shmcache entry %s\n", libname);
       return 0;
    }
 
-   entry = (struct entry_t *) malloc_sheep_cache(sizeof(struct entry_t));
+   entry = (struct entry_t *) malloc_sheep_cache(sizeof(struct entry_t), bucket);
    if (!entry)
       return -1;
    libname_len = strlen(libname)+1;
-   libname_str = (char *) malloc_sheep_cache(libname_len);
+   libname_str = (char *) malloc_sheep_cache(libname_len, bucket);
    if (!libname_str) {
       free_sheep_entry(entry);
       return -1;
@@ -351,22 +615,31 @@ static int shmcache_add_worker(const char *libname, const char *mapped_name, int
       mappedname_str = in_progress;
    else if (mapped_name) {
       mappedname_len = strlen(mapped_name) + 1;
-      mappedname_str = (char *) malloc_sheep_cache(mappedname_len);
+      mappedname_str = (char *) malloc_sheep_cache(mappedname_len, bucket);
       if (!mappedname_str) {
          free_sheep_entry(entry);
          free_sheep_str(libname_str);
+         return -1;
       }
       strncpy(mappedname_str, mapped_name, mappedname_len);
    }
 
    entry->libname = ptr_sheep(libname_str);
    entry->result = mappedname_str ? ptr_sheep(mappedname_str) : ptr_sheep(SHEEP_NULL);
-   entry->hash_key = str_hash(libname);
-   entry->hash_next = table[entry->hash_key];
+   entry->hash_key = key;
    entry->lru_next.val = entry->lru_prev.val = 0;
    entry->pending_count = 0;
-   table[entry->hash_key] = ptr_sheep(entry);
-   mark_recently_used(entry, 1);
+   entry->hash_next = bucket->head;
+
+   take_sheep_lock();
+   lru_push_head(entry);
+   (*num_entries)++;
+   release_sheep_lock();
+
+   begin_bucket_write(bucket);
+   bucket->head = ptr_sheep(entry);
+   end_bucket_write(bucket);
+   mark_recently_used(entry);
    debug_printf3("Successfully created shmcache entry %s\n", libname);
    return 0;
 }
@@ -394,6 +667,7 @@ static int setup_cache_ids()
 static int init_cache(size_t hlimit)
 {
    void *newhash;
+   size_t table_size = sizeof(bucket_t) * HASH_SIZE + CLOCK_SLOTS;
 
    if (hlimit == 0)
       return 0;
@@ -403,6 +677,9 @@ static int init_cache(size_t hlimit)
    lru_end = &shminfo->shared_header->shmcache.lru_end;
    heap_limit = hlimit;
    heap_used = &shminfo->shared_header->shmcache.heap_used;
+   num_entries = &shminfo->shared_header->shmcache.num_entries;
+   heap_start = (const char *) shminfo->mem;
+   heap_end = heap_start + shminfo->size;
 
    hash_error = ptr_sheep(((unsigned char *) shminfo->mem) + shminfo->size);
    in_progress = sheep_ptr(&hash_error);
@@ -415,75 +692,92 @@ static int init_cache(size_t hlimit)
    }
    
    if (IS_SHEEP_NULL(hash_ptr)) {
-      take_writer_lock();
+      take_init_lock();
       if (IS_SHEEP_NULL(hash_ptr)) {
-         newhash = malloc_sheep_cache(sizeof(sheep_ptr_t) * HASH_SIZE);
+         newhash = malloc_sheep_cache(table_size, NULL);
          if (!newhash) {
             debug_printf("Not enough shm space to allocate hash table.  Disabling shmcache\n");
             *hash_ptr = hash_error;
             table = NULL;
-            release_writer_lock();
+            release_init_lock();
             return 0;
          }
-         memset(newhash, 0, sizeof(sheep_ptr_t) * HASH_SIZE);
+         memset(newhash, 0, table_size);
+         MEMORY_BARRIER;
          *hash_ptr = ptr_sheep(newhash);
       }
-      release_writer_lock();
+      release_init_lock();
    }
-   table = sheep_ptr(hash_ptr);
+   if (sheep_ptr_equals(*hash_ptr, hash_error)) {
+      table = NULL;
+      return 0;
+   }
+   table = (bucket_t *) sheep_ptr(hash_ptr);
+   clock_bits = (volatile unsigned char *) (table + HASH_SIZE);
 
    return 0;
 }
 
-int shmcache_lookup_or_add(const char *libname, char **result)
+int shmcache_lookup_or_add(const char *libname, char **result, char *buffer)
 {
    int iresult;
    char *strresult = NULL;
+   bucket_t *bucket;
+   struct entry_t *entry;
+   unsigned int key;
+
    if (!table)
       return -1;
-   take_reader_lock();
-   iresult = shmcache_lookup_worker(libname, &strresult, 0, NULL);
+   iresult = shmcache_lookup_worker(libname, &strresult, buffer);
    if (iresult == -1) {
-      upgrade_to_writelock();
-      shmcache_add_worker(libname, in_progress, 0);
-      downgrade_to_readlock();
+      key = str_hash(libname);
+      bucket = table + (key % HASH_SIZE);
+      take_bucket_lock(bucket);
+      /* Someone may have added it since we looked */
+      entry = find_entry(bucket, libname, key);
+      if (entry) {
+         strresult = copy_result((char *) sheep_ptr(&entry->result), buffer);
+         iresult = 0;
+      }
+      else
+         shmcache_add_worker(libname, in_progress, 0);
+      release_bucket_lock(bucket);
    }
 
-   if (strresult == in_progress)
-      *result = in_progress;
-   else if (strresult) {
-      *result = strncpy(return_name, strresult, sizeof(return_name));
-      return_name[sizeof(return_name)-1] = '\0';
-   }
-   else {
-      *result = NULL;
-   }
-                        
-   release_reader_lock();
+   if (iresult == -1)
+      count_lookup(&local_misses);
+   else if (strresult != in_progress)
+      count_lookup(&local_hits);
+
+   *result = strresult;
    return iresult;
 }
 
 int shmcache_add(const char *libname, const char *mapped_name)
 {
    int result;
+   bucket_t *bucket;
    if (!table)
       return 0;
 
-   take_writer_lock();
+   bucket = table + (str_hash(libname) % HASH_SIZE);
+   take_bucket_lock(bucket);
    result = shmcache_add_worker(libname, mapped_name, 0);
-   release_writer_lock();
+   release_bucket_lock(bucket);
    return result;
 }
 
 int shmcache_update(const char *libname, const char *mapped_name)
 {
    int result;
+   bucket_t *bucket;
    if (!table)
       return 0;
 
-   take_writer_lock();
+   bucket = table + (str_hash(libname) % HASH_SIZE);
+   take_bucket_lock(bucket);
    result = shmcache_add_worker(libname, mapped_name, 1);
-   release_writer_lock();
+   release_bucket_lock(bucket);
    return result;
 }
 
@@ -525,52 +819,58 @@ int shmcache_init(const char *tmpdir, int unique_number, size_t shm_size, size_t
    return 0;
 }
 
+/**
+ * Flush our stats and hand our cached heap objects back before we exit
+ * or exec
+ **/
+void shmcache_done()
+{
+   if (!table)
+      return;
+   shmcache_flush_stats();
+   take_sheep_lock();
+   if (lock(&local_cache_lock) == 0) {
+      flush_sheep_local();
+      unlock(&local_cache_lock);
+   }
+   release_sheep_lock();
+}
+
 int shmcache_post_fork()
 {
    update_shm_id(shminfo);
    return 0;
 }
 
-int shmcache_waitfor_update(const char *libname, char **result)
+int shmcache_waitfor_update(const char *libname, char **result, char *buffer)
 {
-   int iresult;
-   int set_pending_count = 0;
-   char *sresult;
+   unsigned int key;
+   bucket_t *bucket;
    struct entry_t *entry;
    if (!table)
       return -1;
 
-   take_reader_lock();
-   iresult = shmcache_lookup_worker(libname, result, 0, &entry);
-   if (iresult == -1) {
-      release_reader_lock();
+   key = str_hash(libname);
+   bucket = table + (key % HASH_SIZE);
+   take_bucket_lock(bucket);
+   entry = find_entry(bucket, libname, key);
+   if (!entry) {
+      release_bucket_lock(bucket);
       return -1;
    }
-   if (sheep_ptr(&entry->result) == in_progress) {
-      upgrade_to_writelock();
-      entry->pending_count++;
-      downgrade_to_readlock();
-      set_pending_count = 1;
-   }
-   release_reader_lock();
+   /* A pending entry can't be cleaned, so it's safe to watch without the lock */
+   entry->pending_count++;
+   release_bucket_lock(bucket);
 
    debug_printf3("Blocking until %s is updated in shmcache\n", libname);
-   while (sheep_ptr(&entry->result) == in_progress);
-
-   sresult = sheep_ptr(&entry->result);
-   
-   if (sresult == NULL)
-      *result = NULL;
-   else {
-      *result = strncpy(return_name, (char *) sheep_ptr(&entry->result), sizeof(return_name));
-      return_name[sizeof(return_name)-1] = '\0';
-   }
-   
-   if (set_pending_count) {
-      take_writer_lock();
-      entry->pending_count--;
-      release_writer_lock();
-   }
+   count_lookup(&local_waits);
+   while (sheep_ptr(&entry->result) == in_progress)
+      syscall(SYS_futex, &entry->result.val, FUTEX_WAIT, hash_error.val, NULL, NULL, 0);
+
+   take_bucket_lock(bucket);
+   *result = copy_result((char *) sheep_ptr(&entry->result), buffer);
+   entry->pending_count--;
+   release_bucket_lock(bucket);
 
    return 0;
 }
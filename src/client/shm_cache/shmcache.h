@@ -19,12 +19,15 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <stdlib.h>
 
-int shmcache_lookup_or_add(const char *libname, char **result);
+/* Results are copied to buffer, of MAX_PATH_LEN+1 bytes */
+int shmcache_lookup_or_add(const char *libname, char **result, char *buffer);
 int shmcache_add(const char *libname, const char *mapped_name);
 int shmcache_update(const char *libname, const char *mapped_name);
 int shmcache_post_fork();
 int shmcache_init(const char *tmpdir, int unique_number, size_t shm_size, size_t hlimit);
-int shmcache_waitfor_update(const char *libname, char **result);
+int shmcache_waitfor_update(const char *libname, char **result, char *buffer);
+void shmcache_flush_stats();
+void shmcache_done();
 void shmcache_take_lock();
 void shmcache_release_lock();
 
@@ -0,0 +1,44 @@
+# This file is part of Spindle.  For copyright information see the COPYRIGHT
+# file in the top level directory, or at
+# https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License (as published by the Free Software
+# Foundation) version 2.1 dated February 1999.  This program is distributed in the
+# hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+# WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+# and conditions of the GNU Lesser General Public License for more details.  You should
+# have received a copy of the GNU Lesser General Public License along with this
+# program; if not, write to the Free Software Foundation, Inc., 59 Temple
+# Place, Suite 330, Boston, MA 02111-1307 USA
+
+"""
+spindle --python-import=yes puts this directory at the front of PYTHONPATH.
+Install Spindle's importer, then run the sitecustomize we hide, if any.
+"""
+
+import os
+import sys
+
+
+def _spindle_sitecustomize():
+    try:
+        import spindle_import
+        spindle_import.install()
+    except Exception:
+        pass
+
+    here = os.path.dirname(os.path.abspath(__file__))
+    saved_path = sys.path[:]
+    me = sys.modules.pop('sitecustomize', None)
+    sys.path[:] = [p for p in sys.path if os.path.abspath(p or '.') != here]
+    try:
+        import sitecustomize
+    except ImportError:
+        if me is not None:
+            sys.modules['sitecustomize'] = me
+    finally:
+        sys.path[:] = saved_path
+
+
+_spindle_sitecustomize()
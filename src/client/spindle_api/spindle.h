@@ -44,6 +44,86 @@ int spindle_stat(const char *path, struct stat *buf) SPINDLE_EXPORT;
 int spindle_lstat(const char *path, struct stat *buf) SPINDLE_EXPORT;
 FILE *spindle_fopen(const char *path, const char *mode) SPINDLE_EXPORT;
 
+/**
+ * Returns the index of the first of the count paths that exists, or -1 if
+ * none do.  Under Spindle this is one query to the server, rather than a
+ * stat per path, and opening the path it finds doesn't cost another.
+ * Spindle's python importer (spindle_import.py) uses this to search
+ * sys.path for a module.
+ **/
+int spindle_find_first(const char **paths, int count) SPINDLE_EXPORT;
+
+/**
+ * Hints that the n paths, or the files in dir, will soon be opened or
+ * dlopened, as with plugin directories or model shards.  Spindle stages
+ * and distributes them in the background, so the transfer overlaps the
+ * application's compute.  Nothing waits for the files; a later open finds
+ * them staged or waits for them as usual.  Return 0, or -1 if Spindle
+ * couldn't take the hint.  Without Spindle these do nothing.
+ **/
+int spindle_prefetch(const char **paths, int n) SPINDLE_EXPORT;
+int spindle_prefetch_dir(const char *dir) SPINDLE_EXPORT;
+
+/**
+ * Tells Spindle the application is past its startup, e.g. once MPI is
+ * wired up and the plugins it needs are loaded.  When the first process
+ * calls this, every server switches to the --background-bandwidth limit
+ * and remarks its traffic low priority if --dscp was given, so Spindle
+ * gets in the way of the application's own communication less.  Later
+ * calls do nothing.  Returns 0, or -1 if Spindle couldn't be told.
+ * Without Spindle this does nothing.
+ **/
+int spindle_startup_done() SPINDLE_EXPORT;
+
+/**
+ * A PMI-style key-value exchange carried over Spindle's tree, for a
+ * runtime's startup address exchange.  Values put before a fence can be
+ * read by every process after it.  A fence is collective over the job,
+ * like PMI_Barrier: local_procs is how many processes on this node call
+ * it, and every node needs at least one.  The exchange shares the
+ * servers' connections, so it overlaps Spindle's own file distribution
+ * rather than waiting on it.  Keys are up to 256 bytes and values up to
+ * 1024.
+ * spindle_kvs_get copies the value into value, truncating it to len
+ * bytes.  Each returns 0, or -1 on error or for a key with no value.
+ * Without Spindle these return -1, and the runtime should use its own
+ * exchange.
+ **/
+int spindle_kvs_put(const char *key, const char *value) SPINDLE_EXPORT;
+int spindle_kvs_fence(int local_procs) SPINDLE_EXPORT;
+int spindle_kvs_get(const char *key, char *value, size_t len) SPINDLE_EXPORT;
+
+/**
+ * Maps a file every process of the job reads, such as an input deck or
+ * mesh, read-only and returns its address, setting *size to its length.
+ * Under Spindle the file is read from the shared file system once and
+ * sent down the tree to each node, and the mapping is of the node's
+ * staged copy, so the job needs no broadcast of its own.  Every process
+ * may call it; the first on each node waits for the file and the others
+ * share it.  To have the file on its way before the job asks, name it in
+ * spindle_prefetch() or in Spindle's --bcast-file option.  Unmap it with
+ * munmap().  Returns NULL and sets errno if the file can't be mapped,
+ * which includes an empty file.  Without Spindle the file is mapped where
+ * it is.
+ **/
+void *spindle_bcast_file(const char *path, size_t *size) SPINDLE_EXPORT;
+
+/**
+ * Spindle redirects the calls above as they're bound through the caller's
+ * PLT, which doesn't happen for callers that look them up with dlsym, such
+ * as python's ctypes.  These make the call through libspindle's own PLT.
+ **/
+int spindle_py_is_present() SPINDLE_EXPORT;
+int spindle_py_find_first(const char **paths, int count) SPINDLE_EXPORT;
+int spindle_py_prefetch(const char **paths, int n) SPINDLE_EXPORT;
+int spindle_py_prefetch_dir(const char *dir) SPINDLE_EXPORT;
+int spindle_py_startup_done() SPINDLE_EXPORT;
+int spindle_py_kvs_put(const char *key, const char *value) SPINDLE_EXPORT;
+int spindle_py_kvs_fence(int local_procs) SPINDLE_EXPORT;
+int spindle_py_kvs_get(const char *key, char *value, size_t len) SPINDLE_EXPORT;
+void *spindle_py_bcast_file(const char *path, size_t *size) SPINDLE_EXPORT;
+void spindle_py_quiesce() SPINDLE_EXPORT;
+
 /**
  * If spindle is enabled through this API, then all open and stat calls
  * will automatically be routed through Spindle.
@@ -59,6 +139,18 @@ void enable_spindle() SPINDLE_EXPORT;
 void disable_spindle() SPINDLE_EXPORT;
 int is_spindle_enabled() SPINDLE_EXPORT;
 
+/**
+ * Tells Spindle the application is past its startup and its later opens,
+ * stats and execs should go straight to the file system.  The calls that
+ * take a path are unbound from Spindle's wrappers, so they cost nothing
+ * more than they would without Spindle.  Libraries loaded with dlopen are
+ * still served by Spindle, and the calls above still work.  Setting
+ * SPINDLE_QUIESCE to "mpi" in the application's environment does the
+ * same once MPI_Init returns, and to a number of seconds does it that
+ * long after each process started.  Without Spindle this does nothing.
+ **/
+void spindle_quiesce() SPINDLE_EXPORT;
+
 /**
  * is_spindle_present returns true if the application was started under Spindle
  **/
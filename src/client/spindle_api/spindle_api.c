@@ -23,6 +23,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 /**
  * These are the functions that get called if Spindle isn't present.
@@ -56,6 +58,74 @@ FILE *spindle_fopen(const char *path, const char *mode)
    return fopen(path, mode);
 }
 
+int spindle_find_first(const char **paths, int count)
+{
+   struct stat buf;
+   int i;
+
+   for (i = 0; i < count; i++) {
+      if (stat(paths[i], &buf) == 0)
+         return i;
+   }
+   return -1;
+}
+
+int spindle_prefetch(const char **paths, int n)
+{
+   return 0;
+}
+
+int spindle_prefetch_dir(const char *dir)
+{
+   return 0;
+}
+
+int spindle_startup_done()
+{
+   return 0;
+}
+
+int spindle_kvs_put(const char *key, const char *value)
+{
+   return -1;
+}
+
+int spindle_kvs_fence(int local_procs)
+{
+   return -1;
+}
+
+int spindle_kvs_get(const char *key, char *value, size_t len)
+{
+   return -1;
+}
+
+void *spindle_bcast_file(const char *path, size_t *size)
+{
+   struct stat buf;
+   void *addr;
+   int fd, error;
+
+   fd = open(path, O_RDONLY);
+   if (fd == -1)
+      return NULL;
+   if (fstat(fd, &buf) == -1) {
+      error = errno;
+      close(fd);
+      errno = error;
+      return NULL;
+   }
+   addr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   error = errno;
+   close(fd);
+   if (addr == MAP_FAILED) {
+      errno = error;
+      return NULL;
+   }
+   *size = buf.st_size;
+   return addr;
+}
+
 void spindle_enable()
 {
 }
@@ -69,7 +139,61 @@ int spindle_is_enabled()
    return 0;
 }
 
+void spindle_quiesce()
+{
+}
+
 int spindle_is_present()
 {
    return 0;
 }
+
+int spindle_py_is_present()
+{
+   return spindle_is_present();
+}
+
+int spindle_py_find_first(const char **paths, int count)
+{
+   return spindle_find_first(paths, count);
+}
+
+int spindle_py_prefetch(const char **paths, int n)
+{
+   return spindle_prefetch(paths, n);
+}
+
+int spindle_py_prefetch_dir(const char *dir)
+{
+   return spindle_prefetch_dir(dir);
+}
+
+int spindle_py_startup_done()
+{
+   return spindle_startup_done();
+}
+
+int spindle_py_kvs_put(const char *key, const char *value)
+{
+   return spindle_kvs_put(key, value);
+}
+
+int spindle_py_kvs_fence(int local_procs)
+{
+   return spindle_kvs_fence(local_procs);
+}
+
+int spindle_py_kvs_get(const char *key, char *value, size_t len)
+{
+   return spindle_kvs_get(key, value, len);
+}
+
+void *spindle_py_bcast_file(const char *path, size_t *size)
+{
+   return spindle_bcast_file(path, size);
+}
+
+void spindle_py_quiesce()
+{
+   spindle_quiesce();
+}
@@ -0,0 +1,142 @@
+# This file is part of Spindle.  For copyright information see the COPYRIGHT
+# file in the top level directory, or at
+# https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License (as published by the Free Software
+# Foundation) version 2.1 dated February 1999.  This program is distributed in the
+# hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+# WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+# and conditions of the GNU Lesser General Public License for more details.  You should
+# have received a copy of the GNU Lesser General Public License along with this
+# program; if not, write to the Free Software Foundation, Inc., 59 Temple
+# Place, Suite 330, Boston, MA 02111-1307 USA
+
+"""
+An importer that finds modules through Spindle.
+
+The path based importer has each sys.path entry's FileFinder look for the
+module, which costs a stat of the directory and of each file it tries, one
+entry after another.  SpindleFinder sits ahead of it on sys.meta_path and
+lists every file those FileFinders would try, in their order, then asks
+Spindle for the first that exists in one query, through libspindle's
+spindle_py_find_first.  The
+answer is kept by the Spindle client, so the open of the module's file that
+follows doesn't go back to the server.
+
+Call install() to use it, as the sitecustomize.py beside this file does
+when spindle runs with --python-import=yes.
+"""
+
+import ctypes
+import os
+import sys
+
+try:
+    from importlib.machinery import FileFinder, PathFinder
+    from importlib.util import spec_from_file_location
+except ImportError:
+    FileFinder = None
+
+
+def _load_libspindle():
+    """
+    Open the libspindle.so installed beside Spindle's lib directory, or the
+    one on the library path.  Returns None if there's none.
+
+    ctypes would open it with RTLD_NOW, which binds its PLT before Spindle
+    can redirect it, so we call dlopen ourselves.
+    """
+    libc = ctypes.CDLL(None)
+    libc.dlopen.argtypes = (ctypes.c_char_p, ctypes.c_int)
+    libc.dlopen.restype = ctypes.c_void_p
+    here = os.path.dirname(os.path.abspath(__file__))
+    for name in (os.path.join(here, '..', '..', 'libspindle.so'), 'libspindle.so'):
+        handle = libc.dlopen(os.fsencode(name), os.RTLD_LAZY)
+        if not handle:
+            continue
+        lib = ctypes.CDLL(name, handle=handle)
+        lib.spindle_py_is_present.argtypes = ()
+        lib.spindle_py_is_present.restype = ctypes.c_int
+        lib.spindle_py_find_first.argtypes = (ctypes.POINTER(ctypes.c_char_p), ctypes.c_int)
+        lib.spindle_py_find_first.restype = ctypes.c_int
+        return lib
+    return None
+
+
+class SpindleFinder(object):
+    """
+    Finds modules along paths whose entries all have a FileFinder in
+    sys.path_importer_cache.  Anything else, such as zip files, entries the
+    path based importer hasn't seen yet, and namespace packages, is left to
+    the PathFinder after us.
+    """
+
+    def __init__(self, lib):
+        self.lib = lib
+
+    def find_spec(self, fullname, path=None, target=None):
+        tail = fullname.rpartition('.')[2]
+        candidates = []
+        kinds = []
+        for entry in (sys.path if path is None else path):
+            if not isinstance(entry, str):
+                return None
+            if entry == '':
+                entry = os.getcwd()
+            try:
+                finder = sys.path_importer_cache[entry]
+            except KeyError:
+                return None
+            if finder is None:
+                continue
+            if type(finder) is not FileFinder:
+                return None
+
+            # A package directory wins over a module file in the same entry
+            base = os.path.join(finder.path, tail)
+            for suffix, loader in finder._loaders:
+                candidates.append(os.path.join(base, '__init__' + suffix))
+                kinds.append((loader, [base]))
+            for suffix, loader in finder._loaders:
+                candidates.append(base + suffix)
+                kinds.append((loader, None))
+        if not candidates:
+            return None
+
+        paths = (ctypes.c_char_p * len(candidates))(*[os.fsencode(c) for c in candidates])
+        index = self.lib.spindle_py_find_first(paths, len(candidates))
+        if index < 0 or index >= len(candidates):
+            return None
+
+        loader, locations = kinds[index]
+        return spec_from_file_location(fullname, candidates[index],
+                                       loader=loader(fullname, candidates[index]),
+                                       submodule_search_locations=locations)
+
+    def invalidate_caches(self):
+        pass
+
+
+def install():
+    """
+    Put a SpindleFinder ahead of the path based importer on sys.meta_path.
+    Returns False if we're not running under Spindle.
+    """
+    if FileFinder is None:
+        return False
+    for finder in sys.meta_path:
+        if isinstance(finder, SpindleFinder):
+            return True
+    lib = _load_libspindle()
+    if lib is None or not lib.spindle_py_is_present():
+        return False
+
+    finder = SpindleFinder(lib)
+    for i, other in enumerate(sys.meta_path):
+        if other is PathFinder:
+            sys.meta_path.insert(i, finder)
+            break
+    else:
+        sys.meta_path.append(finder)
+    return True
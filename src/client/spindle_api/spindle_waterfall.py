@@ -0,0 +1,262 @@
+# This file is part of Spindle.  For copyright information see the COPYRIGHT
+# file in the top level directory, or at
+# https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License (as published by the Free Software
+# Foundation) version 2.1 dated February 1999.  This program is distributed in the
+# hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+# WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+# and conditions of the GNU Lesser General Public License for more details.  You should
+# have received a copy of the GNU Lesser General Public License along with this
+# program; if not, write to the Free Software Foundation, Inc., 59 Temple
+# Place, Suite 330, Boston, MA 02111-1307 USA
+
+"""
+Reconstructs the waterfall of a job's startup from a SPINDLE_TRACE_DIR.
+
+Servers write spindle_trace.RANK.json and clients write
+spindle_client_trace.SERVER.PID.json, one event to a line.  Spans about a
+file carry its path, so each file's trip can be put together:
+
+  ask    the first process to wait on it sent its query
+  leaf   the first server asked its parent for it
+  read   a server read it from the shared file system, and for how long
+  bcast  its contents were sent on down the tree, until the last one
+  done   the last process waiting on it had its answer
+
+Then the process that finished last is walked query by query, which shows
+the chain it was serialized behind, such as one large library that every
+DT_NEEDED dependency after it waited on.
+
+  python spindle_waterfall.py [-n N] [-w WIDTH] [--json] [--chrome OUT] DIR
+"""
+
+import glob
+import json
+import optparse
+import os
+import sys
+
+BCAST_NAMES = ("bcast_64k", "bcast_1m", "bcast_16m", "bcast_huge")
+
+
+def read_events(filename):
+    """Events in a trace file, one to a line.  A file from a process that
+    didn't exit cleanly has no closing bracket, and a line that doesn't
+    parse is skipped."""
+    events = []
+    f = open(filename)
+    for line in f:
+        line = line.strip().strip(",").strip()
+        if not line.startswith("{"):
+            continue
+        try:
+            events.append(json.loads(line))
+        except ValueError:
+            pass
+    f.close()
+    return events
+
+
+class FileTrip(object):
+    def __init__(self, path):
+        self.path = path
+        self.asks = []       # (start, end, who) for each process that waited
+        self.leaf = None     # first request to a parent
+        self.arrived = None  # last answer from a parent
+        self.reads = []      # (start, end)
+        self.bcast = None    # (first start, last end)
+
+    def span(self, start, end):
+        self.bcast = (start, end) if not self.bcast else \
+            (min(self.bcast[0], start), max(self.bcast[1], end))
+
+    def ask(self):
+        return min(a[0] for a in self.asks) if self.asks else None
+
+    def done(self):
+        return max(a[1] for a in self.asks) if self.asks else None
+
+    def max_wait(self):
+        return max(a[1] - a[0] for a in self.asks) if self.asks else 0.0
+
+    def read_start(self):
+        return min(r[0] for r in self.reads) if self.reads else None
+
+    def read_time(self):
+        return max(r[1] - r[0] for r in self.reads) if self.reads else 0.0
+
+
+def load(tracedir):
+    server_files = glob.glob(os.path.join(tracedir, "spindle_trace.*.json"))
+    client_files = glob.glob(os.path.join(tracedir, "spindle_client_trace.*.json"))
+    if not server_files and not client_files:
+        sys.stderr.write("No Spindle trace files in %s\n" % tracedir)
+        sys.exit(1)
+
+    all_events = []
+    trips = {}
+    clients = {}
+    server_asks = {}
+
+    def trip(path):
+        if path not in trips:
+            trips[path] = FileTrip(path)
+        return trips[path]
+
+    for filename in server_files + client_files:
+        is_client = filename in client_files
+        for ev in read_events(filename):
+            all_events.append(ev)
+            if ev.get("ph") != "X":
+                continue
+            path = ev.get("args", {}).get("path")
+            if not path:
+                continue
+            start = ev["ts"] / 1000000.0
+            end = start + ev["dur"] / 1000000.0
+            name = ev["name"]
+            if is_client and name == "client_wait":
+                who = (ev["pid"], ev["tid"])
+                trip(path).asks.append((start, end, who))
+                clients.setdefault(who, []).append((start, end, path))
+            elif name == "client_query":
+                server_asks.setdefault(path, []).append((start, end, (ev["pid"], None)))
+            elif name == "parent_wait":
+                t = trip(path)
+                t.leaf = start if t.leaf is None else min(t.leaf, start)
+                t.arrived = end if t.arrived is None else max(t.arrived, end)
+            elif name == "disk_read":
+                trip(path).reads.append((start, end))
+            elif name in BCAST_NAMES:
+                trip(path).span(start, end)
+
+    # Without client traces, the servers' own spans for client queries stand in
+    for path, asks in server_asks.items():
+        if not trip(path).asks:
+            trips[path].asks = asks
+    return all_events, trips, clients, len(server_files)
+
+
+def ms(t, t0):
+    return "%9.1f" % ((t - t0) * 1000.0) if t is not None else "%9s" % "-"
+
+
+def bar(trip, t0, t1, width):
+    """The trip drawn from t0 to t1: '.' while processes waited on it, '-'
+    while servers waited on their parents, '#' reading the shared file
+    system, '=' broadcasting it back down"""
+    if t1 <= t0:
+        return ""
+    scale = width / (t1 - t0)
+    cells = [" "] * width
+
+    def fill(a, b, c):
+        if a is None or b is None:
+            return
+        lo = max(0, min(width - 1, int((a - t0) * scale)))
+        hi = max(lo + 1, min(width, int((b - t0) * scale + 0.999)))
+        for i in range(lo, hi):
+            cells[i] = c
+
+    fill(trip.ask(), trip.done(), ".")
+    fill(trip.leaf, trip.arrived, "-")
+    if trip.bcast:
+        fill(trip.bcast[0], trip.bcast[1], "=")
+    for r in trip.reads:
+        fill(r[0], r[1], "#")
+    return "".join(cells).rstrip()
+
+
+def print_waterfall(trips, clients, num_servers, top, width):
+    shown = [t for t in trips.values() if t.asks]
+    if not shown:
+        print("No spans for file queries in the traces")
+        return
+    t0 = min(t.ask() for t in shown)
+    t1 = max(t.done() for t in shown)
+    print("Startup waterfall: %d servers, %d processes, %d files, %.1f ms from first query to last answer" %
+          (num_servers, len(clients), len(shown), (t1 - t0) * 1000.0))
+    print("")
+
+    slowest = sorted(shown, key=lambda t: t.max_wait(), reverse=True)[:top]
+    slowest.sort(key=lambda t: t.ask())
+    print("The %d files processes waited on longest, in the order they were first asked for (ms):" % len(slowest))
+    print("%9s %9s %9s %9s %9s %9s %6s %9s  %s" %
+          ("ask", "leaf", "read", "read_ms", "bcast", "done", "procs", "max_wait", "path"))
+    for t in slowest:
+        print("%s %s %s %9.1f %s %s %6d %9.1f  %s" %
+              (ms(t.ask(), t0), ms(t.leaf, t0), ms(t.read_start(), t0), t.read_time() * 1000.0,
+               ms(t.bcast[1] if t.bcast else None, t0), ms(t.done(), t0), len(t.asks),
+               t.max_wait() * 1000.0, t.path))
+        if width:
+            print("    |%s" % bar(t, t0, t1, width))
+    print("")
+
+    if not clients:
+        print("No client traces, so no critical path.  Set SPINDLE_TRACE_DIR for the job's processes too.")
+        return
+
+    who, queries = max(clients.items(), key=lambda c: max(q[1] for q in c[1]))
+    queries.sort()
+    waited = sum(q[1] - q[0] for q in queries)
+    span = queries[-1][1] - queries[0][0]
+    print("Critical path: process %d on server %d finished last, waiting %.1f of %.1f ms on %d queries" %
+          (who[1], who[0], waited * 1000.0, span * 1000.0, len(queries)))
+    print("%9s %9s %9s  %s" % ("start", "wait", "gap", "path"))
+    prev = None
+    for start, end, path in queries:
+        gap = start - prev if prev is not None else 0.0
+        t = trips[path]
+        note = ""
+        if t.reads and t.read_start() >= start - 0.0005:
+            note = "  <- read from shared fs while waiting (%.1f ms)" % (t.read_time() * 1000.0)
+        elif end - start > max(0.1 * waited, 0.001) and t.ask() < start:
+            note = "  <- waited on another process's request"
+        print("%s %9.1f %9.1f  %s%s" % (ms(start, t0), (end - start) * 1000.0, gap * 1000.0, path, note))
+        prev = end
+
+
+def print_json(trips, t0):
+    rows = []
+    for t in sorted(trips.values(), key=lambda t: t.ask() if t.asks else 0.0):
+        if not t.asks:
+            continue
+        rel = lambda x: round((x - t0) * 1000.0, 3) if x is not None else None
+        rows.append({"path": t.path, "ask_ms": rel(t.ask()), "leaf_ms": rel(t.leaf),
+                     "read_ms": rel(t.read_start()), "read_time_ms": round(t.read_time() * 1000.0, 3),
+                     "bcast_done_ms": rel(t.bcast[1] if t.bcast else None), "done_ms": rel(t.done()),
+                     "procs": len(t.asks), "max_wait_ms": round(t.max_wait() * 1000.0, 3)})
+    json.dump(rows, sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+def main():
+    parser = optparse.OptionParser(usage="%prog [options] TRACE_DIR")
+    parser.add_option("-n", "--top", type="int", default=30,
+                      help="Show the N files processes waited on longest [default: %default]")
+    parser.add_option("-w", "--width", type="int", default=60,
+                      help="Width of each file's bar, 0 for none [default: %default]")
+    parser.add_option("--json", action="store_true", default=False,
+                      help="Write every file's trip as JSON instead")
+    parser.add_option("--chrome", metavar="OUT",
+                      help="Also merge every trace into OUT, to load in Perfetto")
+    opts, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error("Expected a trace directory")
+
+    events, trips, clients, num_servers = load(args[0])
+    if opts.chrome:
+        f = open(opts.chrome, "w")
+        json.dump(events, f)
+        f.close()
+    if opts.json:
+        asked = [t.ask() for t in trips.values() if t.asks]
+        print_json(trips, min(asked) if asked else 0.0)
+    else:
+        print_waterfall(trips, clients, num_servers, opts.top, opts.width)
+
+
+if __name__ == "__main__":
+    main()
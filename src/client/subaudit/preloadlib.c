@@ -45,9 +45,12 @@ static void *spindle_realloc(void *b, size_t size)
  
 SPINDLE_EXPORT int open(const char *pathname, int flags, ...);
 SPINDLE_EXPORT int open64(const char *pathname, int flags, mode_t mode);
+SPINDLE_EXPORT int openat(int dirfd, const char *pathname, int flags, ...);
 SPINDLE_EXPORT FILE *fopen(const char *pathname, const char *mode);
 SPINDLE_EXPORT FILE *fopen64(const char *pathname, const char *mode);
 SPINDLE_EXPORT int close(int fd);
+SPINDLE_EXPORT int chdir(const char *path);
+SPINDLE_EXPORT int fchdir(int fd);
 SPINDLE_EXPORT int stat(const char *path, struct stat *buf);
 SPINDLE_EXPORT int lstat(const char *path, struct stat *buf);
 SPINDLE_EXPORT int __xstat(int vers, const char *path, struct stat *buf);
@@ -59,6 +62,10 @@ SPINDLE_EXPORT int fxstat(int vers, int fd, struct stat *buf);
 SPINDLE_EXPORT int fxstat64(int vers, int fd, struct stat *buf);
 SPINDLE_EXPORT int __fxstat(int vers, int fd, struct stat *buf);
 SPINDLE_EXPORT int __fxstat64(int vers, int fd, struct stat *buf);
+SPINDLE_EXPORT int fstatat(int dirfd, const char *path, struct stat *buf, int flags);
+SPINDLE_EXPORT int __fxstatat(int vers, int dirfd, const char *path, struct stat *buf, int flags);
+SPINDLE_EXPORT int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf);
+SPINDLE_EXPORT int faccessat(int dirfd, const char *path, int mode, int flags);
 SPINDLE_EXPORT int execl(const char *path, const char *arg0, ...);
 SPINDLE_EXPORT int execv(const char *path, char *const argv[]);
 SPINDLE_EXPORT int execle(const char *path, const char *arg0, ...);
@@ -72,6 +79,14 @@ SPINDLE_EXPORT int spindle_open(const char *pathname, int flags, ...);
 SPINDLE_EXPORT int spindle_stat(const char *path, struct stat *buf);
 SPINDLE_EXPORT int spindle_lstat(const char *path, struct stat *buf);
 SPINDLE_EXPORT FILE *spindle_fopen(const char *path, const char *mode);
+SPINDLE_EXPORT int spindle_find_first(const char **paths, int count);
+SPINDLE_EXPORT int spindle_prefetch(const char **paths, int n);
+SPINDLE_EXPORT int spindle_prefetch_dir(const char *dir);
+SPINDLE_EXPORT int spindle_startup_done();
+SPINDLE_EXPORT int spindle_kvs_put(const char *key, const char *value);
+SPINDLE_EXPORT int spindle_kvs_fence(int local_procs);
+SPINDLE_EXPORT int spindle_kvs_get(const char *key, char *value, size_t len);
+SPINDLE_EXPORT void *spindle_bcast_file(const char *path, size_t *size);
 SPINDLE_EXPORT void spindle_enable();
 SPINDLE_EXPORT void spindle_disable();
 SPINDLE_EXPORT int spindle_is_enabled();
@@ -96,6 +111,19 @@ int open64(const char *pathname, int flags, mode_t mode)
    return rtcache_open64(pathname, flags, mode);
 }
 
+int openat(int dirfd, const char *pathname, int flags, ...)
+{
+   int mode = 0;
+   va_list arglist;
+
+   if (flags & O_CREAT) {
+      va_start(arglist, flags);
+      mode = va_arg(arglist, int);
+   }
+
+   return rtcache_openat(dirfd, pathname, flags, mode);
+}
+
 FILE *fopen(const char *pathname, const char *mode)
 {
    return rtcache_fopen(pathname, mode);
@@ -111,6 +139,16 @@ int close(int fd)
    return rtcache_close(fd);
 }
 
+int chdir(const char *path)
+{
+   return rtcache_chdir(path);
+}
+
+int fchdir(int fd)
+{
+   return rtcache_fchdir(fd);
+}
+
 int stat(const char *path, struct stat *buf)
 {
    return rtcache_stat(path, buf);
@@ -166,6 +204,26 @@ int __fxstat64(int vers, int fd, struct stat *buf)
    return rtcache_fxstat64(vers, fd, buf);
 }
 
+int fstatat(int dirfd, const char *path, struct stat *buf, int flags)
+{
+   return rtcache_fstatat(dirfd, path, buf, flags);
+}
+
+int __fxstatat(int vers, int dirfd, const char *path, struct stat *buf, int flags)
+{
+   return rtcache_fxstatat(vers, dirfd, path, buf, flags);
+}
+
+int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf)
+{
+   return rtcache_statx(dirfd, path, flags, mask, buf);
+}
+
+int faccessat(int dirfd, const char *path, int mode, int flags)
+{
+   return rtcache_faccessat(dirfd, path, mode, flags);
+}
+
 int execl(const char *path, const char *arg0, ...)
 {
    int result;
@@ -247,6 +305,46 @@ FILE *spindle_fopen(const char *path, const char *mode)
    return int_spindle_fopen(path, mode);
 }
 
+int spindle_find_first(const char **paths, int count)
+{
+   return int_spindle_find_first(paths, count);
+}
+
+int spindle_prefetch(const char **paths, int n)
+{
+   return int_spindle_prefetch(paths, n);
+}
+
+int spindle_prefetch_dir(const char *dir)
+{
+   return int_spindle_prefetch_dir(dir);
+}
+
+int spindle_startup_done()
+{
+   return int_spindle_startup_done();
+}
+
+int spindle_kvs_put(const char *key, const char *value)
+{
+   return int_spindle_kvs_put(key, value);
+}
+
+int spindle_kvs_fence(int local_procs)
+{
+   return int_spindle_kvs_fence(local_procs);
+}
+
+int spindle_kvs_get(const char *key, char *value, size_t len)
+{
+   return int_spindle_kvs_get(key, value, len);
+}
+
+void *spindle_bcast_file(const char *path, size_t *size)
+{
+   return int_spindle_bcast_file(path, size);
+}
+
 void spindle_enable()
 {
    return int_spindle_enable();
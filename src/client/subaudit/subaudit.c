@@ -24,6 +24,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "client.h"
 #include "intercept.h"
 #include "auditclient.h"
+#include "quiesce.h"
 
 unsigned int spindle_la_version(unsigned int version)
 {
@@ -70,6 +71,7 @@ unsigned int spindle_la_objclose(uintptr_t *cookie)
 {
    struct link_map *map = get_linkmap_from_cookie(cookie);
    remove_library_from_plt_update_list(map);
+   quiesce_forget(map);
    return 0;
 }
 
@@ -19,6 +19,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <elf.h>
 #include <sys/mman.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "subaudit.h"
 #include "config.h"
@@ -27,6 +31,9 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "client.h"
 #include "parse_plt.h"
 #include "intercept.h"
+#include "ldcs_api.h"
+#include "ldcs_pltmap.h"
+#include "quiesce.h"
 
 static signed int binding_offset;
 static void *dl_runtime_profile_ptr;
@@ -134,15 +141,125 @@ static void grow_update_list()
   }
 }
 
+extern char *location;
+
+static const char *pltmap_names[] = { PLTMAP_NAME_LIST };
+#define NUM_PLTMAP_NAMES (sizeof(pltmap_names) / sizeof(*pltmap_names))
+static struct spindle_binding_t *pltmap_bindings[NUM_PLTMAP_NAMES];
+static int pltmap_bindings_set = 0;
+
+/**
+ * A binding whose original we couldn't find in libc, such as MPI_Init,
+ * has nothing for its wrapper to call, and one that has gone quiet binds
+ * to its definition, so neither is redirected
+ **/
+static int should_redirect(struct spindle_binding_t *binding)
+{
+   if (!binding)
+      return 0;
+   if (binding->libc_func && !*binding->libc_func)
+      return 0;
+   return !quiesce_skips(binding);
+}
+
+/* PLT map entries read at a time */
+#define PLTMAP_READ_ENTRIES 64
+
+static int read_pltmap(int fd, void *buffer, size_t size)
+{
+   ssize_t result;
+   size_t pos = 0;
+
+   while (pos < size) {
+      result = read(fd, ((char *) buffer) + pos, size - pos);
+      if (result == -1 && (errno == EAGAIN || errno == EINTR))
+         continue;
+      if (result <= 0)
+         return -1;
+      pos += result;
+   }
+   return 0;
+}
+
+/**
+ * Patch lmap's bindings from the PLT map its server staged next to it.
+ * Returns -1 if there's no usable map, and the relocations must be
+ * walked instead.
+ **/
+static int redirect_from_pltmap(struct link_map *lmap)
+{
+   char mapname[MAX_PATH_LEN+1], *replica;
+   pltmap_header_t header;
+   pltmap_entry_t entries[PLTMAP_READ_ENTRIES];
+   struct spindle_binding_t *binding;
+   unsigned int i, j, count;
+   void **addr;
+   int fd, namelen;
+
+   /* Only files the server staged have maps */
+   if (!location || strncmp(lmap->l_name, location, strlen(location)) != 0)
+      return -1;
+   /* A NUMA node's copy uses the map of the file it was copied from */
+   replica = strstr(lmap->l_name, NUMA_REPLICA_SUFFIX);
+   namelen = replica ? (int) (replica - lmap->l_name) : (int) strlen(lmap->l_name);
+   if (snprintf(mapname, sizeof(mapname), "%.*s%s", namelen, lmap->l_name, PLTMAP_SUFFIX) >= (int) sizeof(mapname))
+      return -1;
+   fd = open(mapname, O_RDONLY);
+   if (fd == -1)
+      return -1;
+
+   if (read_pltmap(fd, &header, sizeof(header)) == -1 || header.magic != PLTMAP_MAGIC ||
+       header.version != PLTMAP_VERSION || header.num_names != NUM_PLTMAP_NAMES) {
+      debug_printf("PLT map %s is unusable.  Walking relocations instead\n", mapname);
+      close(fd);
+      return -1;
+   }
+
+   if (!pltmap_bindings_set) {
+      for (i = 0; i < NUM_PLTMAP_NAMES; i++)
+         pltmap_bindings[i] = lookup_in_binding_hash(pltmap_names[i]);
+      pltmap_bindings_set = 1;
+   }
+
+   debug_printf3("Applying %u bindings from PLT map of %s\n", header.num_entries, lmap->l_name);
+   for (i = 0; i < header.num_entries; i += count) {
+      count = header.num_entries - i;
+      if (count > PLTMAP_READ_ENTRIES)
+         count = PLTMAP_READ_ENTRIES;
+      if (read_pltmap(fd, entries, count * sizeof(pltmap_entry_t)) == -1) {
+         /* Patching what's left with a walk redoes the entries we applied, harmlessly */
+         err_printf("Could not read PLT map %s\n", mapname);
+         close(fd);
+         return -1;
+      }
+      for (j = 0; j < count; j++) {
+         if (entries[j].name >= NUM_PLTMAP_NAMES)
+            continue;
+         binding = pltmap_bindings[entries[j].name];
+         if (!should_redirect(binding))
+            continue;
+         addr = (void **) (entries[j].offset + lmap->l_addr);
+         quiesce_track(lmap, addr, binding->name);
+         ASSIGN_FPTR(addr, binding->spindle_func);
+      }
+   }
+   close(fd);
+   return 0;
+}
+
 static int redirect_interceptions(struct link_map *lmap)
 {
    struct spindle_binding_t *binding;
    void **addr;
 
+   if (redirect_from_pltmap(lmap) == 0)
+      return 0;
+
 #define LOOKUP_IN_HASH(SYM, NAME, OFFSET) {                             \
       binding = lookup_in_binding_hash(NAME);                           \
-      if (binding) {                                                    \
+      if (should_redirect(binding)) {                                   \
          addr = (void **) (OFFSET + lmap->l_addr);                      \
+         quiesce_track(lmap, addr, NAME);                               \
          ASSIGN_FPTR(addr, binding->spindle_func);                      \
       }                                                                 \
    }
@@ -225,7 +342,7 @@ int update_plt_bindings()
 
    if (has_spindleint == spindleint_unset) {
       ld_preload = getenv("LD_PRELOAD");
-      has_spindleint = ld_preload && strstr(ld_preload, "libspindleint.so") ? spindleint_present : spindleint_unset;
+      has_spindleint = ld_preload && strstr(ld_preload, "libspindleint.so") ? spindleint_present : spindleint_none;
    }
 
 
@@ -55,6 +55,27 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #define COBO_CONNECT_TIMELIMIT (600) /* seconds -- wait this long before giving up for good */
 #endif
 
+/* set COBO_TREE to binomial, kary[:degree], rack[:degree] or auto to pick the tree shape,
+ * and COBO_TREE_MAP to a hostname to switch map file for the rack tree */
+#define COBO_TREE_BINOMIAL (0)
+#define COBO_TREE_KARY     (1)
+#define COBO_TREE_RACK     (2)
+#ifndef COBO_TREE_DEGREE
+#define COBO_TREE_DEGREE (16) /* children per node in k-ary and rack trees */
+#endif
+#ifndef COBO_TREE_AUTO_DEPTH
+#define COBO_TREE_AUTO_DEPTH (3) /* levels below the root an auto tree aims for */
+#endif
+#ifndef COBO_TREE_AUTO_MIN
+#define COBO_TREE_AUTO_MIN (4) /* fewest children per node in an auto tree */
+#endif
+#ifndef COBO_TREE_AUTO_MAX
+#define COBO_TREE_AUTO_MAX (64) /* most children per node in an auto tree */
+#endif
+#ifndef COBO_LISTEN_BACKLOG
+#define COBO_LISTEN_BACKLOG (SOMAXCONN)
+#endif
+
 #if defined(_IA64_)
 #undef htons
 #undef ntohs
@@ -85,6 +106,10 @@ static int cobo_connect_backoff       = COBO_CONNECT_BACKOFF;   /* exponential b
 static int cobo_connect_sleep         = COBO_CONNECT_SLEEP;     /* milliseconds to sleep before rescanning ports */
 static double cobo_connect_timelimit  = COBO_CONNECT_TIMELIMIT; /* seconds */
 
+/* set COBO_SOCKET_BUFFER to a byte count to size the send and receive buffers
+ * of the tree sockets, or leave unset to keep the kernel's autotuned sizes */
+static int cobo_socket_buffer = 0;
+
 /* to establish a connection, the service and session ids must match
  * the sessionid will be provided by the user, it should be a random
  * number which associate processes with the same session */
@@ -96,9 +121,39 @@ static unsigned int cobo_acceptid  = 2348104830u;
 static int  cobo_num_ports = 0;
 static int* cobo_ports     = NULL;
 
-/* size (in bytes) and pointer to hostlist data structure */
-static int   cobo_hostlist_size = 0;
-static void* cobo_hostlist      = NULL;
+/* Index into cobo_ports of the port we bound.  Whatever held the ports
+ * before it here most likely holds them on our children's nodes too, so
+ * children are tried on this port first rather than from the start of
+ * the range. */
+static int  cobo_port_hint = 0;
+
+/* a run of consecutive ranks in the hostlist: a plain hostname (width 0),
+ * or prefix followed by the numbers first through first+count-1 */
+typedef struct {
+    int rank;
+    int count;
+    const char* prefix;
+    int prefix_len;
+    int width;
+    unsigned long first;
+} cobo_hostrun_t;
+
+/* number of runs and the runs of the hostlist, in rank order.  The prefixes
+ * point into cobo_hostlist_str. */
+static int             cobo_num_hostruns = 0;
+static cobo_hostrun_t* cobo_hostlist     = NULL;
+
+/* size (in bytes, with the NUL) and range-compressed hostlist string we forward */
+static int   cobo_hostlist_str_size = 0;
+static char* cobo_hostlist_str      = NULL;
+
+/* addresses of ranks cobo_addrs_base through cobo_addrs_base+cobo_num_addrs-1,
+ * which the server resolves once so the tree doesn't each hit DNS.  Each rank
+ * gets just the addresses of its own subtree.  An entry of 0 is resolved by
+ * name where it's needed. */
+static int             cobo_addrs_base = 0;
+static int             cobo_num_addrs  = 0;
+static struct in_addr* cobo_addrs      = NULL;
 
 /* tree data structures */
 static int  cobo_parent     = -3;    /* rank of parent */
@@ -109,8 +164,26 @@ static int  cobo_num_child  = 0;     /* number of children */
 static int* cobo_child_incl = NULL;  /* number of children each child is responsible for (includes itself) */
 static int  cobo_num_child_incl = 0; /* total number of children this node is responsible for */
 
+/* tree shape, chosen by the server and sent down with the hostlist */
+static int  cobo_tree_type   = COBO_TREE_BINOMIAL;
+static int  cobo_tree_degree = COBO_TREE_DEGREE;
+static int  cobo_num_groups  = 0;     /* number of switch groups in a rack tree */
+static int* cobo_groups      = NULL;  /* first rank of each switch group, ascending */
+
 static int cobo_root_fd = -1;
 
+/* whether servers that start later may join the tree, chosen by the server
+ * and sent down with the tree shape */
+static int cobo_elastic = 0;
+
+/* with cobo_elastic, the socket our parent connected to, which stays open
+ * after startup so servers that start later can join below us, or -1 */
+static int cobo_listen_fd = -1;
+
+/* joining servers we've accepted, which hold a child slot until they're
+ * given a rank or dropped */
+static int cobo_num_pending_joins = 0;
+
 static handshake_protocol_t cobo_handshake;
 
 double __cobo_ts = 0.0f;
@@ -180,6 +253,13 @@ static int _cobo_opt_socket(int sockfd)  {
 					      cruft */
 			  sizeof(int));    /* length of option value */
   debug_printf3("_cobo_opt_socket (sockfd=%d) flag=%d\n",sockfd, flag);
+  if (cobo_socket_buffer > 0) {
+    /* receive buffers only widen the TCP window if set before connect/listen */
+    if (setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &cobo_socket_buffer, sizeof(int)) < 0 ||
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &cobo_socket_buffer, sizeof(int)) < 0)
+      debug_printf("Could not set socket buffers to %d bytes on %d: %s\n",
+                   cobo_socket_buffer, sockfd, strerror(errno));
+  }
 #ifdef CHANGENNODELAY
   flag=0;
   result = setsockopt(sockfd,            /* socket affected */
@@ -192,6 +272,11 @@ static int _cobo_opt_socket(int sockfd)  {
   return(result);
 }
 
+int cobo_opt_socket(int sockfd)
+{
+    return _cobo_opt_socket(sockfd);
+}
+
 /* given a pointer to an array of ints, allocate and return a copy of the array */
 static int* cobo_int_dup(int* src, int n)
 {
@@ -436,36 +521,148 @@ static int cobo_connect(struct in_addr ip, int port, int timeout)
         return -1;
     }
 
+    _cobo_opt_socket(s);
+
     /* connect socket to address */
     if (cobo_connect_w_timeout(s, (struct sockaddr *) &sockaddr, sizeof(sockaddr), timeout) < 0) {
         close(s);
         return -1;
     }
 
-    _cobo_opt_socket(s);
-
     return s;
 }
 
-/* Attempts to connect to a given hostname using a port list and timeouts */
-static int cobo_connect_hostname(char* hostname, int rank)
+/* Looks up the address of hostname, returns -1 if it can't be resolved */
+static int cobo_lookup_hostname(char* hostname, struct in_addr* saddr)
 {
-    int s = -1;
-    struct in_addr saddr;
-
-    /* lookup host address by name */
     struct hostent* he = gethostbyname(hostname);
     if (!he) {
        /* gethostbyname doesn't know how to resolve hostname, trying inet_addr */ 
-       saddr.s_addr = inet_addr(hostname);
-       if (saddr.s_addr == -1) {
+       saddr->s_addr = inet_addr(hostname);
+       if (saddr->s_addr == -1) {
            err_printf("Hostname lookup failed (gethostbyname(%s) %s h_errno=%d)\n",
                 hostname, hstrerror(h_errno), h_errno);
-           return s;
+           return -1;
        }
     }
     else {
-      saddr = *((struct in_addr *) (*he->h_addr_list));
+      *saddr = *((struct in_addr *) (*he->h_addr_list));
+    }
+    return 0;
+}
+
+/* Looks up the address of rank, from the server's table if it's there */
+static int cobo_rank_addr(int rank, char* hostname, struct in_addr* saddr)
+{
+    int i = rank - cobo_addrs_base;
+    if (cobo_addrs && i >= 0 && i < cobo_num_addrs && cobo_addrs[i].s_addr) {
+        *saddr = cobo_addrs[i];
+        return 0;
+    }
+    return cobo_lookup_hostname(hostname, saddr);
+}
+
+/* Acts on the result of a handshake.  Returns 0 if it succeeded, or -1 if
+ * the caller should close the connection and try again. */
+static int cobo_handshake_result(int result)
+{
+    switch (result) {
+       case HSHAKE_SUCCESS:
+          return 0;
+       case HSHAKE_INTERNAL_ERROR:
+          err_printf("Internal error doing handshake: %s", spindle_handshake_last_error_str());
+          exit(-1);
+          break;
+       case HSHAKE_DROP_CONNECTION:
+          debug_printf3("Handshake said to drop connection\n");
+          return -1;
+       case HSHAKE_ABORT:
+          handle_security_error(spindle_handshake_last_error_str());
+          abort();
+       default:
+          assert(0 && "Unknown return value from handshake_server\n");
+    }
+    return -1;
+}
+
+/* Writes our service and session ids on a connection that passed the handshake */
+static int cobo_send_ids(int s, char* hostname, int port)
+{
+    /* write cobo service id */
+    if (cobo_write_fd_w_suppress(s, &cobo_serviceid, sizeof(cobo_serviceid), 1) < 0) {
+        debug_printf3("Writing service id to %s on port %d\n",
+                      hostname, port);
+        return -1;
+    }
+
+    /* write our session id */
+    if (cobo_write_fd_w_suppress(s, &cobo_sessionid, sizeof(cobo_sessionid), 1) < 0) {
+        debug_printf3("Writing session id to %s on port %d\n",
+                      hostname, port);
+        return -1;
+    }
+    return 0;
+}
+
+/* Reads back the service and accept ids, and finalizes the connection with an ack */
+static int cobo_recv_ids(int s, char* hostname, int rank, int port, int reply_timeout)
+{
+    /* read the service id */
+    unsigned int received_serviceid = 0;
+    if (cobo_read_fd_w_timeout(s, &received_serviceid, sizeof(received_serviceid), reply_timeout) < 0) {
+        debug_printf3("Receiving service id from %s on port %d failed\n",
+                  hostname, port);
+        return -1;
+    }
+
+    /* read the accept id */
+    unsigned int received_acceptid = 0;
+    if (cobo_read_fd_w_timeout(s, &received_acceptid, sizeof(received_acceptid), reply_timeout) < 0) {
+        debug_printf3("Receiving accept id from %s on port %d failed\n",
+                  hostname, port);
+        return -1;
+    }
+
+    /* check that we got the expected service and accept ids */
+    if (received_serviceid != cobo_serviceid || received_acceptid != cobo_acceptid) {
+        return -1;
+    }
+
+    /* write ack to finalize connection (no need to suppress write errors any longer) */
+    unsigned int ack = 1;
+    if (cobo_write_fd(s, &ack, sizeof(ack)) < 0) {
+        debug_printf3("Writing ack to finalize connection to rank %d on %s port %d\n",
+                   rank, hostname, port);
+        return -1;
+    }
+    return 0;
+}
+
+/* Runs the handshake and id exchange on a freshly connected socket.
+ * Returns 0 if it's a good connection to one of our processes, or -1 if
+ * the caller should close it and try again. */
+static int cobo_check_connection(int s, char* hostname, int rank, int port, int reply_timeout)
+{
+    debug_printf3("Connected to rank %d port %d on %s\n", rank, port, hostname);
+
+    if (cobo_handshake_result(spindle_handshake_client(s, &cobo_handshake, cobo_sessionid)) < 0) {
+        return -1;
+    }
+    if (cobo_send_ids(s, hostname, port) < 0) {
+        return -1;
+    }
+    return cobo_recv_ids(s, hostname, rank, port, reply_timeout);
+}
+
+/* Attempts to connect to a given hostname using a port list and timeouts */
+static int cobo_connect_hostname(char* hostname, int rank)
+{
+    int s = -1;
+    struct in_addr saddr;
+
+    /* lookup host address */
+    if (cobo_rank_addr(rank, hostname, &saddr) == -1) {
+        return s;
     }
 
     /* Loop until we make a connection or until our timeout expires. */
@@ -475,7 +672,6 @@ static int cobo_connect_hostname(char* hostname, int rank)
     int connected = 0;
     int connect_timeout = cobo_connect_timeout;
     int reply_timeout = cobo_connect_timeout * 10;
-    int result;
     while (!connected && secs < cobo_connect_timelimit) {
         /* iterate over our ports trying to find a connection */
         int i;
@@ -488,75 +684,11 @@ static int cobo_connect_hostname(char* hostname, int rank)
             /* s = cobo_connect(*(struct in_addr *) (*he->h_addr_list), htons(port)); */
             s = cobo_connect(saddr, htons(port), connect_timeout);
             if (s != -1) {
-                /* got a connection, let's test it out */
-                debug_printf3("Connected to rank %d port %d on %s\n", rank, port, hostname);
-                int test_failed = 0;
-
-                result = spindle_handshake_client(s, &cobo_handshake, cobo_sessionid);
-                switch (result) {
-                   case HSHAKE_SUCCESS:
-                      break;
-                   case HSHAKE_INTERNAL_ERROR:
-                      err_printf("Internal error doing handshake: %s", spindle_handshake_last_error_str());
-                      exit(-1);
-                      break;
-                   case HSHAKE_DROP_CONNECTION:
-                      debug_printf3("Handshake said to drop connection\n");
-                      close(s);
-                      continue;
-                   case HSHAKE_ABORT:
-                      handle_security_error(spindle_handshake_last_error_str());
-                      abort();
-                   default:
-                      assert(0 && "Unknown return value from handshake_server\n");
-                }
-                
-                /* write cobo service id */
-                if (!test_failed && cobo_write_fd_w_suppress(s, &cobo_serviceid, sizeof(cobo_serviceid), 1) < 0) {
-                    debug_printf3("Writing service id to %s on port %d\n",
-                                  hostname, port);
-                    test_failed = 1;
-                }
-
-                /* write our session id */
-                if (!test_failed && cobo_write_fd_w_suppress(s, &cobo_sessionid, sizeof(cobo_sessionid), 1) < 0) {
-                    debug_printf3("Writing session id to %s on port %d\n",
-                                  hostname, port);
-                    test_failed = 1;
-                }
-
-                /* read the service id */
-                unsigned int received_serviceid = 0;
-                if (!test_failed && cobo_read_fd_w_timeout(s, &received_serviceid, sizeof(received_serviceid), reply_timeout) < 0) {
-                    debug_printf3("Receiving service id from %s on port %d failed\n",
-                              hostname, port);
-                    test_failed = 1;
-                }
-
-                /* read the accept id */
-                unsigned int received_acceptid = 0;
-                if (!test_failed && cobo_read_fd_w_timeout(s, &received_acceptid, sizeof(received_acceptid), reply_timeout) < 0) {
-                    debug_printf3("Receiving accept id from %s on port %d failed\n",
-                              hostname, port);
-                    test_failed = 1;
-                }
-
-                /* check that we got the expected service and accept ids */
-                if (!test_failed && (received_serviceid != cobo_serviceid || received_acceptid != cobo_acceptid)) {
-                    test_failed = 1;
-                }
-
-                /* write ack to finalize connection (no need to suppress write errors any longer) */
-                unsigned int ack = 1;
-                if (!test_failed && cobo_write_fd(s, &ack, sizeof(ack)) < 0) {
-                    debug_printf3("Writing ack to finalize connection to rank %d on %s port %d\n",
-                               rank, hostname, port);
-                    test_failed = 1;
-                }
-
-                /* if the connection test failed, close the socket, otherwise we've got a good connection */
-                if (test_failed) {
+                /* got a connection, let's test it out.  If the test failed, close
+                 * the socket, otherwise we've got a good connection */
+                if (cobo_check_connection(s, hostname, rank, port, reply_timeout) < 0) {
                     close(s);
+                    s = -1;
                 } else {
                     connected = 1;
                     break;
@@ -594,9 +726,12 @@ static int cobo_connect_hostname(char* hostname, int rank)
     return s;
 }
 
-/* send rank id and hostlist data to specified hostname */
-static int cobo_send_hostlist(int s, char* hostname, int rank, int ranks, void* hostlist, int bytes)
+/* send rank id, hostlist data, tree shape and the addresses of the num_addrs
+ * ranks starting at rank to specified hostname */
+static int cobo_send_hostlist(int s, char* hostname, int rank, int ranks, void* hostlist, int bytes,
+                              struct in_addr* addrs, int num_addrs)
 {
+    int tree[4];
     debug_printf3("Sending hostlist to rank %d on %s\n", rank, hostname);
 
     /* check that we have an open socket */
@@ -627,13 +762,33 @@ static int cobo_send_hostlist(int s, char* hostname, int rank, int ranks, void*
         return (!COBO_SUCCESS);
     }
 
-    /* and finally, forward the hostlist table */
+    /* forward the hostlist table */
     if (cobo_write_fd(s, hostlist, bytes) < 0) {
         err_printf("Writing hostname table to child (rank %d) at %s failed\n",
                    rank, hostname);
         return (!COBO_SUCCESS);
     }
 
+    /* and finally, forward the tree shape and the switch groups */
+    tree[0] = cobo_tree_type;
+    tree[1] = cobo_tree_degree;
+    tree[2] = cobo_num_groups;
+    tree[3] = cobo_elastic;
+    if (cobo_write_fd(s, tree, sizeof(tree)) < 0 ||
+        (cobo_num_groups && cobo_write_fd(s, cobo_groups, cobo_num_groups * sizeof(int)) < 0)) {
+        err_printf("Writing tree shape to child (rank %d) at %s failed\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
+    }
+
+    /* and the addresses of its subtree, if we have them */
+    if (cobo_write_fd(s, &num_addrs, sizeof(num_addrs)) < 0 ||
+        (num_addrs && cobo_write_fd(s, addrs, num_addrs * sizeof(struct in_addr)) < 0)) {
+        err_printf("Writing address table to child (rank %d) at %s failed\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
+    }
+
     return COBO_SUCCESS;
 }
 
@@ -643,30 +798,357 @@ static int cobo_send_hostlist(int s, char* hostname, int rank, int ranks, void*
  * =============================
 */
 
+/* splits hostname into a prefix and a trailing number, returning the number of
+ * digits, or 0 if it doesn't end in a number we can put in a range */
+static int cobo_split_hostname(const char* hostname, int* prefix_len, unsigned long* value)
+{
+    int len = strlen(hostname);
+    int digits = 0;
+    while (digits < len && hostname[len - digits - 1] >= '0' && hostname[len - digits - 1] <= '9') {
+        digits++;
+    }
+    if (digits == 0 || digits > 9) {
+        return 0;
+    }
+    *prefix_len = len - digits;
+    *value = strtoul(hostname + *prefix_len, NULL, 10);
+    return digits;
+}
+
+/* Encodes hostlist as a comma separated string, with runs of hosts that share
+ * a prefix written as ranges: node0001,node0002,node0005 becomes
+ * node[0001-0002,0005], and node9,node10 becomes node[9-10].  Zero-padded
+ * numbers only share a range with numbers of the same width.  Order is
+ * preserved.  Returns a malloced string and sets bytes to its size including
+ * the NUL. */
+static char* cobo_compress_hostlist(char** hostlist, int num_hosts, int* bytes)
+{
+    size_t size = 1;
+    int i, j;
+    for (i = 0; i < num_hosts; i++) {
+        size += strlen(hostlist[i]) + 3;
+    }
+    char* str = (char*) cobo_malloc(size, "Compressed hostlist");
+    char* pos = str;
+
+    for (i = 0; i < num_hosts; i = j) {
+        int prefix_len, next_len;
+        unsigned long value, next, first;
+        int width = cobo_split_hostname(hostlist[i], &prefix_len, &value);
+        int padded = (width > 1 && hostlist[i][prefix_len] == '0');
+
+        if (i) {
+            *pos++ = ',';
+        }
+
+        /* find the hosts after i with the same prefix, and the same width
+         * if i is zero padded, or no zero padding if it isn't */
+        j = i + 1;
+        if (width) {
+            int next_width;
+            while (j < num_hosts &&
+                   (next_width = cobo_split_hostname(hostlist[j], &next_len, &next)) != 0 &&
+                   next_len == prefix_len &&
+                   strncmp(hostlist[i], hostlist[j], prefix_len) == 0 &&
+                   (padded ? next_width == width :
+                    !(next_width > 1 && hostlist[j][next_len] == '0'))) {
+                j++;
+            }
+        }
+        if (j == i + 1) {
+            pos += sprintf(pos, "%s", hostlist[i]);
+            continue;
+        }
+
+        /* write the prefix, then the numbers of hosts i through j-1 as ranges */
+        if (!padded) {
+            width = 1;
+        }
+        memcpy(pos, hostlist[i], prefix_len);
+        pos += prefix_len;
+        *pos++ = '[';
+        int k = i;
+        while (k < j) {
+            first = strtoul(hostlist[k] + prefix_len, NULL, 10);
+            value = first;
+            k++;
+            while (k < j && strtoul(hostlist[k] + prefix_len, NULL, 10) == value + 1) {
+                value++;
+                k++;
+            }
+            if (value == first) {
+                pos += sprintf(pos, "%0*lu", width, first);
+            } else {
+                pos += sprintf(pos, "%0*lu-%0*lu", width, first, width, value);
+            }
+            *pos++ = (k < j) ? ',' : ']';
+        }
+    }
+    *pos++ = '\0';
+
+    *bytes = (int) (pos - str);
+    return str;
+}
+
+/* Reads a string from cobo_compress_hostlist into the run table that
+ * cobo_expand_hostname searches, so no rank needs every hostname spelled out.
+ * Fails unless it holds exactly num_hosts names. */
+static int cobo_build_hostlist(const char* str, int num_hosts)
+{
+    int pass, count = 0, runs = 0;
+    cobo_hostrun_t* table = NULL;
+
+    /* first pass counts the runs, second pass fills in the table */
+    for (pass = 0; pass < 2; pass++) {
+        const char* pos = str;
+        if (pass == 1) {
+            table = (cobo_hostrun_t*) cobo_malloc(runs * sizeof(cobo_hostrun_t), "Hostlist run table");
+        }
+        count = 0;
+        runs = 0;
+
+        while (*pos) {
+            size_t len = strcspn(pos, ",[");
+            if (pos[len] != '[') {
+                /* a plain hostname */
+                if (pass == 1) {
+                    cobo_hostrun_t* r = table + runs;
+                    r->rank = count;
+                    r->count = 1;
+                    r->prefix = pos;
+                    r->prefix_len = (int) len;
+                    r->width = 0;
+                    r->first = 0;
+                }
+                runs++;
+                count++;
+                pos += len;
+            } else {
+                /* prefix[a-b,c,...] */
+                const char* prefix = pos;
+                size_t prefix_len = len;
+                pos += len + 1;
+                while (*pos && *pos != ']') {
+                    char* end;
+                    unsigned long first = strtoul(pos, &end, 10);
+                    unsigned long last = first;
+                    int width = (int) (end - pos);
+                    if (width == 0) {
+                        break;
+                    }
+                    pos = end;
+                    if (*pos == '-') {
+                        last = strtoul(pos + 1, &end, 10);
+                        pos = end;
+                    }
+                    if (last < first) {
+                        break;
+                    }
+                    if (pass == 1) {
+                        cobo_hostrun_t* r = table + runs;
+                        r->rank = count;
+                        r->count = (int) (last - first + 1);
+                        r->prefix = prefix;
+                        r->prefix_len = (int) prefix_len;
+                        r->width = width;
+                        r->first = first;
+                    }
+                    runs++;
+                    count += (int) (last - first + 1);
+                    if (*pos == ',') {
+                        pos++;
+                    }
+                }
+                if (*pos != ']') {
+                    err_printf("Badly formed hostlist near %s\n", prefix);
+                    cobo_free(table);
+                    return (!COBO_SUCCESS);
+                }
+                pos++;
+            }
+            if (*pos == ',') {
+                pos++;
+            }
+        }
+
+        if (count != num_hosts) {
+            err_printf("Hostlist holds %d hosts, expected %d\n", count, num_hosts);
+            cobo_free(table);
+            return (!COBO_SUCCESS);
+        }
+    }
+
+    cobo_num_hostruns = runs;
+    cobo_hostlist = table;
+    return COBO_SUCCESS;
+}
+
+/* On the server, fills in cobo_addrs with the address of every host in rank
+ * order.  Hosts that don't resolve are left 0, and their parents look them
+ * up by name.  Set COBO_RESOLVE_ON_SERVER=0 to have every parent look up
+ * its children itself. */
+static void cobo_resolve_hostlist(char** hostlist, int num_hosts)
+{
+    char* value = cobo_getenv("COBO_RESOLVE_ON_SERVER", ENV_OPTIONAL);
+    int i, failed = 0;
+
+    if (value && atoi(value) == 0) {
+        return;
+    }
+
+    cobo_addrs = (struct in_addr*) cobo_malloc(num_hosts * sizeof(struct in_addr), "Address table");
+    cobo_addrs_base = 0;
+    cobo_num_addrs = num_hosts;
+    for (i = 0; i < num_hosts; i++) {
+        if (cobo_lookup_hostname(hostlist[i], cobo_addrs + i) == -1) {
+            cobo_addrs[i].s_addr = 0;
+            failed++;
+        }
+    }
+    debug_printf3("Resolved %d of %d hosts for the tree\n", num_hosts - failed, num_hosts);
+}
+
 /* Allocates a string containing the hostname for specified rank.
  * The return string must be freed by the caller. */
 static char* cobo_expand_hostname(int rank)
 {
-    if (cobo_hostlist == NULL) {
+    if (cobo_hostlist == NULL || rank < 0 || rank >= cobo_nprocs) {
         return NULL;
     }
 
-    int* offset = (int*) (cobo_hostlist + rank * sizeof(int));
-    char* hostname = (char*) (cobo_hostlist + *offset);
+    /* find the last run starting at or before rank */
+    int low = 0;
+    int high = cobo_num_hostruns - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (cobo_hostlist[mid].rank <= rank) { low  = mid; }
+        else                                 { high = mid-1; }
+    }
+    cobo_hostrun_t* r = cobo_hostlist + low;
 
-    return strdup(hostname);
+    if (r->width == 0) {
+        return strndup(r->prefix, r->prefix_len);
+    }
+    size_t size = r->prefix_len + r->width + 24;
+    char* hostname = (char*) malloc(size);
+    if (hostname) {
+        snprintf(hostname, size, "%.*s%0*lu", r->prefix_len, r->prefix,
+                 r->width, r->first + (unsigned long) (rank - r->rank));
+    }
+    return hostname;
 }
 
-/* given cobo_me and cobo_nprocs, fills in parent and children ranks -- currently implements a binomial tree */
-static int cobo_compute_children()
+/* Every tree shape gives each node a contiguous range of ranks starting at
+ * itself, and splits the rest of that range between its children.  Children
+ * are listed from the highest ranks down, which the gather and scatter code
+ * relies on to keep data in rank order. */
+
+/* returns the maximum number of children any node may have */
+static int cobo_max_children()
 {
-    /* compute the maximum number of children this task may have */
     int n = 1;
     int max_children = 0;
     while (n < cobo_nprocs) {
         n <<= 1;
         max_children++;
     }
+    if (max_children < 2 * cobo_tree_degree) {
+        max_children = 2 * cobo_tree_degree;
+    }
+    return max_children + 1;
+}
+
+/* returns the index of the switch group holding rank */
+static int cobo_group_index(int rank)
+{
+    int low = 0;
+    int high = cobo_num_groups - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (cobo_groups[mid] <= rank) { low  = mid; }
+        else                          { high = mid-1; }
+    }
+    return low;
+}
+
+/* returns the last rank of the switch group starting at group index g */
+static int cobo_group_last(int g)
+{
+    return (g + 1 < cobo_num_groups) ? cobo_groups[g+1] - 1 : cobo_nprocs - 1;
+}
+
+/* splits ranks (low, high] into up to cobo_tree_degree even pieces */
+static int cobo_split_even(int low, int high, int* child, int* incl, int num)
+{
+    int count = high - low;
+    int pieces = (count < cobo_tree_degree) ? count : cobo_tree_degree;
+    int j;
+    for (j = pieces - 1; j >= 0; j--) {
+        int first = low + 1 + (j * count) / pieces;
+        int last  = low + ((j + 1) * count) / pieces;
+        child[num] = first;
+        incl[num]  = last - first + 1;
+        num++;
+    }
+    return num;
+}
+
+/* splits whole switch groups (low, high] into up to cobo_tree_degree pieces,
+ * each led by the first rank of its first group */
+static int cobo_split_groups(int low, int high, int* child, int* incl, int num)
+{
+    int first_group = cobo_group_index(low + 1);
+    int count = cobo_group_index(high) - first_group + 1;
+    int pieces = (count < cobo_tree_degree) ? count : cobo_tree_degree;
+    int j;
+    for (j = pieces - 1; j >= 0; j--) {
+        int first = cobo_groups[first_group + (j * count) / pieces];
+        int last  = cobo_group_last(first_group + ((j + 1) * count) / pieces - 1);
+        child[num] = first;
+        incl[num]  = last - first + 1;
+        num++;
+    }
+    return num;
+}
+
+/* fills in the children of the node owning ranks [low, high], and the number of
+ * ranks under each child (including itself), and returns the number of children */
+static int cobo_split_range(int low, int high, int* child, int* incl)
+{
+    int num = 0;
+
+    if (cobo_tree_type == COBO_TREE_KARY) {
+        return cobo_split_even(low, high, child, incl, 0);
+    }
+
+    if (cobo_tree_type == COBO_TREE_RACK && cobo_num_groups > 1) {
+        /* leaders of other switches first, then the rest of our own switch,
+         * so only leader to leader edges leave a switch */
+        int own_last = cobo_group_last(cobo_group_index(low));
+        if (own_last > high) {
+            own_last = high;
+        }
+        if (high > own_last) {
+            num = cobo_split_groups(own_last, high, child, incl, num);
+        }
+        return cobo_split_even(low, own_last, child, incl, num);
+    }
+
+    /* binomial tree */
+    while (high - low > 0) {
+        int mid = (high - low) / 2 + (high - low) % 2 + low;
+        child[num] = mid;
+        incl[num]  = high - mid + 1;
+        num++;
+        high = mid - 1;
+    }
+    return num;
+}
+
+/* given cobo_me and cobo_nprocs, fills in parent and children ranks for the chosen tree shape */
+static int cobo_compute_children()
+{
+    int max_children = cobo_max_children();
 
     /* prepare data structures to store our parent and children */
     cobo_parent = 0;
@@ -676,25 +1158,254 @@ static int cobo_compute_children()
     cobo_child_fd    = (int*) cobo_malloc(max_children * sizeof(int), "Child socket fd array");
     cobo_child_incl = (int*) cobo_malloc(max_children * sizeof(int), "Child children count array");
 
-    /* find our parent rank and the ranks of our children */
+    /* walk down from the root to find our parent and the range of ranks we own */
     int low  = 0;
     int high = cobo_nprocs - 1;
-    while (high - low > 0) {
-        int mid = (high - low) / 2 + (high - low) % 2 + low;
-        if (low == cobo_me) {
-            cobo_child[cobo_num_child] = mid;
-            cobo_child_incl[cobo_num_child] = high - mid + 1;
-            cobo_num_child++;
-            cobo_num_child_incl += (high - mid + 1);
+    while (low != cobo_me) {
+        int num = cobo_split_range(low, high, cobo_child, cobo_child_incl);
+        int j;
+        for (j = 0; j < num; j++) {
+            if (cobo_child[j] <= cobo_me && cobo_me < cobo_child[j] + cobo_child_incl[j]) {
+                break;
+            }
         }
-        if (mid == cobo_me) { cobo_parent = low; }
-        if (mid <= cobo_me) { low  = mid; }
-        else                { high = mid-1; }
+        assert(j < num);
+        cobo_parent = low;
+        low  = cobo_child[j];
+        high = cobo_child[j] + cobo_child_incl[j] - 1;
+    }
+
+    /* and split that range between our children */
+    cobo_num_child = cobo_split_range(low, high, cobo_child, cobo_child_incl);
+    int i;
+    for (i = 0; i < cobo_num_child; i++) {
+        cobo_num_child_incl += cobo_child_incl[i];
     }
 
+    debug_printf3("Tree type %d: rank %d has parent %d and %d children\n",
+                  cobo_tree_type, cobo_me, cobo_parent, cobo_num_child);
     return COBO_SUCCESS;
 }
 
+/* the degree of an auto tree over num_hosts hosts: the narrowest k-ary tree that's
+ * at most COBO_TREE_AUTO_DEPTH levels deep.  A binomial tree is log2 levels deep,
+ * which a metadata request climbs one hop at a time, while a wide tree has each
+ * parent send a large file to many children in turn.  A few levels of a few
+ * children each keeps both small. */
+static int cobo_auto_tree_degree(int num_hosts)
+{
+    int degree, level, covered, width;
+    for (degree = COBO_TREE_AUTO_MIN; degree < COBO_TREE_AUTO_MAX; degree++) {
+        covered = 1;
+        width = 1;
+        for (level = 0; level < COBO_TREE_AUTO_DEPTH; level++) {
+            width *= degree;
+            covered += width;
+        }
+        if (covered >= num_hosts) {
+            break;
+        }
+    }
+    return degree;
+}
+
+/* reads the tree shape from COBO_TREE, on the server before it opens the tree */
+static void cobo_read_tree_env()
+{
+    char* value = cobo_getenv("COBO_TREE", ENV_OPTIONAL);
+    char* degree;
+    if (!value) {
+        return;
+    }
+
+    if (strncmp(value, "auto", 4) == 0) {
+        cobo_tree_type = COBO_TREE_KARY;
+        cobo_tree_degree = cobo_auto_tree_degree(cobo_nprocs);
+        debug_printf("Picked a %d-ary tree for %d hosts\n", cobo_tree_degree, cobo_nprocs);
+        return;
+    } else if (strncmp(value, "binomial", 8) == 0) {
+        cobo_tree_type = COBO_TREE_BINOMIAL;
+    } else if (strncmp(value, "kary", 4) == 0) {
+        cobo_tree_type = COBO_TREE_KARY;
+    } else if (strncmp(value, "rack", 4) == 0) {
+        cobo_tree_type = COBO_TREE_RACK;
+    } else {
+        err_printf("Unknown COBO_TREE value %s, using a binomial tree\n", value);
+        cobo_tree_type = COBO_TREE_BINOMIAL;
+        return;
+    }
+
+    degree = strchr(value, ':');
+    if (degree) {
+        cobo_tree_degree = atoi(degree + 1);
+        if (cobo_tree_degree < 2) {
+            err_printf("COBO_TREE degree must be at least 2, using %d\n", COBO_TREE_DEGREE);
+            cobo_tree_degree = COBO_TREE_DEGREE;
+        }
+    }
+}
+
+typedef struct {
+    char* host;
+    char* sw;
+} cobo_switch_entry_t;
+
+static int cobo_switch_entry_cmp(const void* a, const void* b)
+{
+    return strcmp(((const cobo_switch_entry_t*) a)->host, ((const cobo_switch_entry_t*) b)->host);
+}
+
+/* hostnames are compared without their domain, unless they look like addresses */
+static void cobo_short_hostname(char* name)
+{
+    char* dot = strchr(name, '.');
+    if (dot && !(name[0] >= '0' && name[0] <= '9')) {
+        *dot = '\0';
+    }
+}
+
+static void cobo_free_switch_map(cobo_switch_entry_t* map, int num)
+{
+    int i;
+    for (i = 0; i < num; i++) {
+        free(map[i].host);
+        free(map[i].sw);
+    }
+    free(map);
+}
+
+/* reads a map of hostnames to switches.  Each line is either "hostname switch",
+ * or a SLURM_TOPOLOGY_ADDR value such as "core.sw3.node12", whose last
+ * element is the host and the rest its switch.  Returns the entries sorted by host. */
+static int cobo_read_switch_map(const char* file, cobo_switch_entry_t** map, int* num)
+{
+    char line[1024], host[512], sw[512];
+    cobo_switch_entry_t* grown;
+    int size = 0;
+    FILE* f = fopen(file, "r");
+    if (!f) {
+        err_printf("Could not open switch map %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    *map = NULL;
+    *num = 0;
+    while (fgets(line, sizeof(line), f)) {
+        int fields = sscanf(line, "%511s %511s", host, sw);
+        if (fields < 1 || host[0] == '#') {
+            continue;
+        }
+        if (fields == 1) {
+            char* last = strrchr(host, '.');
+            if (!last) {
+                continue;
+            }
+            *last = '\0';
+            strcpy(sw, host);
+            memmove(host, last + 1, strlen(last + 1) + 1);
+        }
+        cobo_short_hostname(host);
+
+        if (*num == size) {
+            size = size ? size * 2 : 256;
+            grown = (cobo_switch_entry_t*) realloc(*map, size * sizeof(cobo_switch_entry_t));
+            if (!grown) {
+                err_printf("Could not allocate switch map of %d entries\n", size);
+                fclose(f);
+                cobo_free_switch_map(*map, *num);
+                *map = NULL;
+                *num = 0;
+                return -1;
+            }
+            *map = grown;
+        }
+        (*map)[*num].host = strdup(host);
+        (*map)[*num].sw = strdup(sw);
+        (*num)++;
+    }
+    fclose(f);
+
+    qsort(*map, *num, sizeof(cobo_switch_entry_t), cobo_switch_entry_cmp);
+    return 0;
+}
+
+/* for a rack tree, reorders hostlist so each switch's hosts are contiguous, keeping
+ * the first host first, and fills in cobo_groups.  Switches are taken from the map
+ * file in COBO_TREE_MAP.  Hosts missing from the map share one group. */
+static int cobo_group_by_switch(char** hostlist, int num_hosts, char*** ordered)
+{
+    cobo_switch_entry_t* map = NULL;
+    cobo_switch_entry_t key, *found;
+    char** switches;
+    int* group_of;
+    int* group_size;
+    int num_map = 0, num_switches = 0, i, j;
+    char* file = cobo_getenv("COBO_TREE_MAP", ENV_OPTIONAL);
+
+    *ordered = hostlist;
+    if (!file) {
+        err_printf("The rack tree needs a switch map in COBO_TREE_MAP, using a k-ary tree\n");
+        cobo_tree_type = COBO_TREE_KARY;
+        return 0;
+    }
+    if (cobo_read_switch_map(file, &map, &num_map) == -1) {
+        cobo_tree_type = COBO_TREE_KARY;
+        return 0;
+    }
+
+    /* number the switches in the order their hosts first appear */
+    switches   = (char**) cobo_malloc(num_hosts * sizeof(char*), "Switch name array");
+    group_of   = (int*) cobo_malloc(num_hosts * sizeof(int), "Host group array");
+    group_size = (int*) cobo_malloc(num_hosts * sizeof(int), "Group size array");
+    for (i = 0; i < num_hosts; i++) {
+        char host[512];
+        char* sw = "";
+        strncpy(host, hostlist[i], sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+        cobo_short_hostname(host);
+        key.host = host;
+        found = (cobo_switch_entry_t*) bsearch(&key, map, num_map, sizeof(cobo_switch_entry_t), cobo_switch_entry_cmp);
+        if (found) {
+            sw = found->sw;
+        } else {
+            debug_printf3("Host %s is not in the switch map\n", hostlist[i]);
+        }
+
+        for (j = 0; j < num_switches; j++) {
+            if (strcmp(switches[j], sw) == 0) {
+                break;
+            }
+        }
+        if (j == num_switches) {
+            switches[num_switches] = sw;
+            group_size[num_switches] = 0;
+            num_switches++;
+        }
+        group_of[i] = j;
+        group_size[j]++;
+    }
+
+    /* lay the groups out one after another */
+    cobo_num_groups = num_switches;
+    cobo_groups = (int*) cobo_malloc(num_switches * sizeof(int), "Switch group table");
+    for (j = 0, i = 0; j < num_switches; j++) {
+        cobo_groups[j] = i;
+        i += group_size[j];
+        group_size[j] = cobo_groups[j];
+    }
+    *ordered = (char**) cobo_malloc(num_hosts * sizeof(char*), "Ordered hostlist");
+    for (i = 0; i < num_hosts; i++) {
+        (*ordered)[group_size[group_of[i]]++] = hostlist[i];
+    }
+    debug_printf3("Grouped %d hosts under %d switches\n", num_hosts, num_switches);
+
+    cobo_free_switch_map(map, num_map);
+    cobo_free(switches);
+    cobo_free(group_of);
+    cobo_free(group_size);
+    return 0;
+}
+
 #ifdef __COBO_CURRENTLY_NOT_USED
 /* given cobo_me and cobo_nprocs, fills in parent and children ranks -- currently implements a binomial tree */
 static int cobo_compute_children_root_C1()
@@ -745,8 +1456,244 @@ static int cobo_compute_children_root_C1()
 }
 #endif
 
+/* connection state for one child while cobo_connect_children runs */
+typedef struct {
+    int rank;
+    char* hostname;
+    struct in_addr addr;
+    int fd;               /* socket with a connect in progress, or -1 */
+    int port;             /* index into cobo_ports of the next port to try */
+    int tried;            /* ports tried since the last full pass */
+    int connect_timeout;  /* milliseconds */
+    int reply_timeout;    /* milliseconds */
+    double started;       /* when the current connect began */
+    double retry_at;      /* don't start another connect before this */
+} cobo_child_connect_t;
+
+/* moves a child on to its next port, wrapping around the end of the list,
+ * waiting out cobo_connect_sleep and backing off its timeouts after it has
+ * tried every port */
+static void cobo_child_next_port(cobo_child_connect_t* c, double now)
+{
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->port = (c->port + 1) % cobo_num_ports;
+    if (++c->tried < cobo_num_ports) {
+        return;
+    }
+    c->tried = 0;
+    c->retry_at = now + cobo_connect_sleep / 1000.0;
+    if (c->connect_timeout < 30000) {
+        c->connect_timeout *= cobo_connect_backoff;
+        c->reply_timeout   *= cobo_connect_backoff;
+    }
+}
+
+/* Checks the children whose connects finished in the same poll together.
+ * Their handshakes run at once, and each step of the id exchange is
+ * started on every connection before any of them is waited on.  Sets
+ * good[i] for each connection that's ready for the hostname table. */
+static void cobo_check_children(cobo_child_connect_t** ready, int n, int* good)
+{
+    int i;
+    int* fds = (int*) cobo_malloc(n * sizeof(int), "Handshake fd array");
+    int* results = (int*) cobo_malloc(n * sizeof(int), "Handshake result array");
+
+    for (i = 0; i < n; i++) {
+        fds[i] = ready[i]->fd;
+        debug_printf3("Connected to rank %d port %d on %s\n",
+                      ready[i]->rank, cobo_ports[ready[i]->port], ready[i]->hostname);
+    }
+    spindle_handshake_client_many(fds, n, &cobo_handshake, cobo_sessionid, results);
+
+    for (i = 0; i < n; i++) {
+        cobo_child_connect_t* c = ready[i];
+        good[i] = cobo_handshake_result(results[i]) == 0 &&
+                  cobo_send_ids(c->fd, c->hostname, cobo_ports[c->port]) == 0;
+    }
+    for (i = 0; i < n; i++) {
+        cobo_child_connect_t* c = ready[i];
+        if (good[i] && cobo_recv_ids(c->fd, c->hostname, c->rank, cobo_ports[c->port], c->reply_timeout) < 0) {
+            good[i] = 0;
+        }
+    }
+
+    cobo_free(fds);
+    cobo_free(results);
+}
+
+/* Connects to all our children concurrently, and forwards the hostname table
+ * to each as soon as its connection is up, so a slow child doesn't hold up
+ * the subtrees of its siblings.  Each child walks the port list as in
+ * cobo_connect_hostname, but starting from cobo_port_hint, with non-blocking
+ * connects polled together, and the children that connect in the same poll
+ * are handshaked together. */
+static int cobo_connect_children()
+{
+    int i, remaining = cobo_num_child;
+    struct timeval start, end;
+    double secs = 0;
+
+    if (cobo_num_child == 0) {
+        return COBO_SUCCESS;
+    }
+
+    cobo_child_connect_t* children = (cobo_child_connect_t*) cobo_malloc(cobo_num_child * sizeof(cobo_child_connect_t), "Child connection array");
+    struct pollfd* fds = (struct pollfd*) cobo_malloc(cobo_num_child * sizeof(struct pollfd), "Child poll array");
+    int* polled = (int*) cobo_malloc(cobo_num_child * sizeof(int), "Child poll index array");
+    cobo_child_connect_t** ready = (cobo_child_connect_t**) cobo_malloc(cobo_num_child * sizeof(cobo_child_connect_t*), "Child ready array");
+    int* good = (int*) cobo_malloc(cobo_num_child * sizeof(int), "Child check array");
+
+    for (i = 0; i < cobo_num_child; i++) {
+        cobo_child_connect_t* c = children + i;
+        c->rank = cobo_child[i];
+        c->hostname = cobo_expand_hostname(c->rank);
+        c->fd = -1;
+        c->port = cobo_port_hint;
+        c->tried = 0;
+        c->connect_timeout = cobo_connect_timeout;
+        c->reply_timeout = cobo_connect_timeout * 10;
+        c->started = c->retry_at = 0;
+        cobo_child_fd[i] = -1;
+        debug_printf3("%d: on COBO%02d: connect to child #%02d (%s)\n", i, cobo_me, c->rank, c->hostname);
+
+        if (cobo_rank_addr(c->rank, c->hostname, &c->addr) == -1) {
+            err_printf("Failed to connect to child (rank %d) on %s failed\n", c->rank, c->hostname);
+            exit(1);
+        }
+    }
+
+    cobo_gettimeofday(&start);
+    while (remaining && secs < cobo_connect_timelimit) {
+        int num_polled = 0;
+
+        /* start a connect for every child that isn't waiting on one */
+        for (i = 0; i < cobo_num_child; i++) {
+            cobo_child_connect_t* c = children + i;
+            if (cobo_child_fd[i] != -1 || c->fd != -1 || secs < c->retry_at) {
+                continue;
+            }
+
+            struct sockaddr_in sockaddr;
+            sockaddr.sin_family = AF_INET;
+            sockaddr.sin_addr = c->addr;
+            sockaddr.sin_port = htons(cobo_ports[c->port]);
+
+            c->fd = socket(AF_INET, SOCK_STREAM, 0); /* IPPROTO_TCP */
+            if (c->fd < 0) {
+                err_printf("Creating socket (socket() %m errno=%d)\n", errno);
+                exit(1);
+            }
+            _cobo_opt_socket(c->fd);
+            fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+
+            debug_printf3("Trying rank %d port %d on %s\n", c->rank, cobo_ports[c->port], c->hostname);
+            c->started = secs;
+            if (connect(c->fd, (struct sockaddr *) &sockaddr, sizeof(sockaddr)) < 0 && errno != EINPROGRESS) {
+                cobo_child_next_port(c, secs);
+            }
+        }
+
+        /* wait for any of the connects to finish */
+        for (i = 0; i < cobo_num_child; i++) {
+            if (children[i].fd != -1) {
+                fds[num_polled].fd = children[i].fd;
+                fds[num_polled].events = POLLIN | POLLOUT;
+                fds[num_polled].revents = 0;
+                polled[num_polled++] = i;
+            }
+        }
+        if (num_polled) {
+            int rc = poll(fds, num_polled, cobo_connect_timeout);
+            if (rc == -1 && errno != EINTR) {
+                err_printf("Polling child connections (poll() %m errno=%d)\n", errno);
+                exit(1);
+            }
+        } else {
+            usleep(cobo_connect_sleep * 1000);
+        }
+
+        cobo_gettimeofday(&end);
+        secs = cobo_getsecs(&end, &start);
+
+        int num_ready = 0;
+        for (i = 0; i < num_polled; i++) {
+            cobo_child_connect_t* c = children + polled[i];
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+
+            if (!fds[i].revents) {
+                /* give up on this connect once it's taken too long */
+                if ((secs - c->started) * 1000 >= c->connect_timeout) {
+                    cobo_child_next_port(c, secs);
+                }
+                continue;
+            }
+
+            /* The revent is not necessarily POLLERR when the connection fails */
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err) {
+                cobo_child_next_port(c, secs);
+                continue;
+            }
+
+            fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) & ~O_NONBLOCK);
+            ready[num_ready++] = c;
+        }
+        if (num_ready) {
+            cobo_check_children(ready, num_ready, good);
+        }
+
+        for (i = 0; i < num_ready; i++) {
+            cobo_child_connect_t* c = ready[i];
+            if (!good[i]) {
+                cobo_child_next_port(c, secs);
+                continue;
+            }
+
+            /* tell child what rank he is and forward the hostname table to him */
+            int child = c - children;
+            int forward = cobo_send_hostlist(c->fd, c->hostname, c->rank,
+                              cobo_nprocs, cobo_hostlist_str, cobo_hostlist_str_size,
+                              cobo_addrs ? cobo_addrs + (c->rank - cobo_addrs_base) : NULL,
+                              cobo_addrs ? cobo_child_incl[child] : 0);
+            if (forward != COBO_SUCCESS) {
+                err_printf("Failed to forward hostname table to child (rank %d) on %s failed\n",
+                           c->rank, c->hostname);
+                exit(1);
+            }
+            cobo_child_fd[child] = c->fd;
+            c->fd = -1;
+            remaining--;
+        }
+    }
+
+    if (remaining) {
+        for (i = 0; i < cobo_num_child; i++) {
+            if (cobo_child_fd[i] == -1) {
+                err_printf("Time limit to connect to rank %d on %s expired\n",
+                           children[i].rank, children[i].hostname);
+            }
+        }
+        exit(1);
+    }
+
+    for (i = 0; i < cobo_num_child; i++) {
+        free(children[i].hostname);
+    }
+    cobo_free(children);
+    cobo_free(fds);
+    cobo_free(polled);
+    cobo_free(ready);
+    cobo_free(good);
+    return COBO_SUCCESS;
+}
+
 /* open socket tree across tasks */
-static int cobo_open_tree()
+/* binds a socket to the first free port in our range and listens on it.
+ * Failing to get any port is fatal. */
+static int cobo_bind_listen()
 {
     /* create a socket to accept connection from parent IPPROTO_TCP */
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -756,6 +1703,9 @@ static int cobo_open_tree()
         exit(1);
     }
 
+    /* accepted sockets inherit the listening socket's options */
+    _cobo_opt_socket(sockfd);
+
     /* TODO: could recycle over port numbers, trying to bind to one for some time */
     /* try to bind the socket to one the ports in our allowed range */
     int i = 0;
@@ -779,8 +1729,9 @@ static int cobo_open_tree()
             continue;
         }
 
-        /* set the socket to listen for connections */
-        if (listen(sockfd, 1) < 0) {
+        /* set the socket to listen for connections, with room to queue
+         * probes from other jobs' servers alongside our parent's */
+        if (listen(sockfd, COBO_LISTEN_BACKLOG) < 0) {
            debug_printf3("Setting parent socket to listen (listen() %m errno=%d) port=%d\n",
                 errno, port);
             continue;
@@ -788,6 +1739,7 @@ static int cobo_open_tree()
 
         /* bound and listening on our port */
         debug_printf3("Opened socket on port %d\n", port);
+        cobo_port_hint = i - 1;
         port_is_bound = 1;
     }
 
@@ -797,90 +1749,171 @@ static int cobo_open_tree()
         err_printf("Failed to open socket on any port\n");
         exit(1);
     }
+    return sockfd;
+}
 
-    /* accept a connection from parent and receive socket table */
-    int reply_timeout = cobo_connect_timeout * 100;
-    int have_parent = 0;
-    while (!have_parent) {
-        struct sockaddr parent_addr;
-        socklen_t parent_len = sizeof(parent_addr);
-        cobo_parent_fd = accept(sockfd, (struct sockaddr *) &parent_addr, &parent_len);
-
-        _cobo_opt_socket(sockfd);
-
-        /* handshake/authenticate our connection to make sure it one of our processes */
-        int result = spindle_handshake_server(cobo_parent_fd, &cobo_handshake, cobo_sessionid);
-        switch (result) {
-           case HSHAKE_SUCCESS:
-              break;
-           case HSHAKE_INTERNAL_ERROR:
-              err_printf("Internal error doing handshake: %s", spindle_handshake_last_error_str());
-              exit(-1);
-              break;
-           case HSHAKE_DROP_CONNECTION:
-              debug_printf3("Handshake said to drop connection\n");
-              close(cobo_parent_fd);
-              continue;
-           case HSHAKE_ABORT:
-              handle_security_error(spindle_handshake_last_error_str());
-              abort();
-           default:
-              assert(0 && "Unknown return value from handshake_server\n");
-        }
-
-        /* read the service id */
-        unsigned int received_serviceid = 0;
-        if (cobo_read_fd_w_timeout(cobo_parent_fd, &received_serviceid, sizeof(received_serviceid), reply_timeout) < 0) {
-            debug_printf3("Receiving service id from new connection failed\n");
-            close(cobo_parent_fd);
-            continue;
-        }
+/* bounds each read and write on fd to msecs, or lifts the bound with 0 */
+static void cobo_set_io_timeout(int fd, int msecs)
+{
+    struct timeval tv;
+    tv.tv_sec = msecs / 1000;
+    tv.tv_usec = (msecs % 1000) * 1000;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
+        debug_printf3("Setting I/O timeout on fd %d (setsockopt() %m errno=%d)\n", fd, errno);
+    }
+}
 
-        /* read the session id */
-        uint64_t received_sessionid = 0;
-        if (cobo_read_fd_w_timeout(cobo_parent_fd, &received_sessionid, sizeof(received_sessionid), reply_timeout) < 0) {
-            debug_printf3("Receiving session id from new connection failed\n");
-            close(cobo_parent_fd);
-            continue;
-        }
+/* accepts a connection on sockfd and checks it's one of our processes.
+ * With io_timeout, each read and write of the handshake gives up after
+ * that many milliseconds, so a peer that stalls can't hold us.  Returns
+ * the connected socket, or -1 if it was dropped. */
+static int cobo_accept_peer(int sockfd, int reply_timeout, int io_timeout)
+{
+    struct sockaddr peer_addr;
+    socklen_t peer_len = sizeof(peer_addr);
+    int fd = accept(sockfd, (struct sockaddr *) &peer_addr, &peer_len);
+    if (fd < 0) {
+        debug_printf3("Accepting connection (accept() %m errno=%d)\n", errno);
+        return -1;
+    }
 
-        /* check that we got the expected sesrive and session ids */
-        /* TODO: reply with some sort of error message if no match? */
-        if (received_serviceid != cobo_serviceid || received_sessionid != cobo_sessionid) {
-            close(cobo_parent_fd);
-            continue;
-        }
+    _cobo_opt_socket(fd);
+    if (io_timeout) {
+        cobo_set_io_timeout(fd, io_timeout);
+    }
+
+    /* handshake/authenticate our connection to make sure it one of our processes */
+    if (cobo_handshake_result(spindle_handshake_server(fd, &cobo_handshake, cobo_sessionid)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* read the service id */
+    unsigned int received_serviceid = 0;
+    if (cobo_read_fd_w_timeout(fd, &received_serviceid, sizeof(received_serviceid), reply_timeout) < 0) {
+        debug_printf3("Receiving service id from new connection failed\n");
+        close(fd);
+        return -1;
+    }
+
+    /* read the session id */
+    uint64_t received_sessionid = 0;
+    if (cobo_read_fd_w_timeout(fd, &received_sessionid, sizeof(received_sessionid), reply_timeout) < 0) {
+        debug_printf3("Receiving session id from new connection failed\n");
+        close(fd);
+        return -1;
+    }
+
+    /* check that we got the expected sesrive and session ids */
+    /* TODO: reply with some sort of error message if no match? */
+    if (received_serviceid != cobo_serviceid || received_sessionid != cobo_sessionid) {
+        close(fd);
+        return -1;
+    }
+
+    /* write our service id back as a reply */
+    if (cobo_write_fd_w_suppress(fd, &cobo_serviceid, sizeof(cobo_serviceid), 1) < 0) {
+        debug_printf3("Writing service id to new connection failed\n");
+        close(fd);
+        return -1;
+    }
+
+    /* write our accept id back as a reply */
+    if (cobo_write_fd_w_suppress(fd, &cobo_acceptid, sizeof(cobo_acceptid), 1) < 0) {
+        debug_printf3("Writing accept id to new connection failed\n");
+        close(fd);
+        return -1;
+    }
+
+    /* our peer may have dropped us if he was too impatient waiting for our reply,
+     * read his ack to know that he completed the connection */
+    unsigned int ack = 0;
+    if (cobo_read_fd_w_timeout(fd, &ack, sizeof(ack), reply_timeout) < 0) {
+        debug_printf3("Receiving ack to finalize connection\n");
+        close(fd);
+        return -1;
+    }
+
+    if (io_timeout) {
+        cobo_set_io_timeout(fd, 0);
+    }
+    return fd;
+}
+
+/* reads what our parent sends after our rank: the number of ranks, the
+ * hostlist, the tree shape and the addresses of our subtree */
+static int cobo_recv_tree()
+{
+    /* discover how many ranks are in our world */
+    if (cobo_read_fd(cobo_parent_fd, &cobo_nprocs, sizeof(int)) < 0) {
+        err_printf("Receiving number of tasks from parent failed\n");
+        exit(1);
+    }
+
+    /* read the size of the compressed hostlist (in bytes) */
+    if (cobo_read_fd(cobo_parent_fd, &cobo_hostlist_str_size, sizeof(int)) < 0) {
+        err_printf("Receiving size of hostname table from parent failed\n");
+        exit(1);
+    }
+
+    /* allocate space for the hostlist, read it in, and expand it */
+    cobo_hostlist_str = (char*) cobo_malloc(cobo_hostlist_str_size, "Hostlist data buffer");
+    if (cobo_read_fd(cobo_parent_fd, cobo_hostlist_str, cobo_hostlist_str_size) < 0) {
+        err_printf("Receiving hostname table from parent failed\n");
+        exit(1);
+    }
+    cobo_hostlist_str[cobo_hostlist_str_size - 1] = '\0';
+    if (cobo_build_hostlist(cobo_hostlist_str, cobo_nprocs) != COBO_SUCCESS) {
+        err_printf("Could not expand hostname table from parent\n");
+        exit(1);
+    }
 
-        /* write our service id back as a reply */
-        if (cobo_write_fd_w_suppress(cobo_parent_fd, &cobo_serviceid, sizeof(cobo_serviceid), 1) < 0) {
-            debug_printf3("Writing service id to new connection failed\n");
-            close(cobo_parent_fd);
-            continue;
+    /* read the tree shape and switch groups */
+    int tree[4];
+    if (cobo_read_fd(cobo_parent_fd, tree, sizeof(tree)) < 0) {
+        err_printf("Receiving tree shape from parent failed\n");
+        exit(1);
+    }
+    cobo_tree_type   = tree[0];
+    cobo_tree_degree = tree[1];
+    cobo_num_groups  = tree[2];
+    cobo_elastic     = tree[3];
+    if (cobo_num_groups) {
+        cobo_groups = (int*) cobo_malloc(cobo_num_groups * sizeof(int), "Switch group table");
+        if (cobo_read_fd(cobo_parent_fd, cobo_groups, cobo_num_groups * sizeof(int)) < 0) {
+            err_printf("Receiving switch groups from parent failed\n");
+            exit(1);
         }
+    }
 
-        /* write our accept id back as a reply */
-        if (cobo_write_fd_w_suppress(cobo_parent_fd, &cobo_acceptid, sizeof(cobo_acceptid), 1) < 0) {
-            debug_printf3("Writing accept id to new connection failed\n");
-            close(cobo_parent_fd);
-            continue;
+    /* read the addresses of our subtree */
+    if (cobo_read_fd(cobo_parent_fd, &cobo_num_addrs, sizeof(int)) < 0) {
+        err_printf("Receiving size of address table from parent failed\n");
+        exit(1);
+    }
+    cobo_addrs_base = cobo_me;
+    if (cobo_num_addrs) {
+        cobo_addrs = (struct in_addr*) cobo_malloc(cobo_num_addrs * sizeof(struct in_addr), "Address table");
+        if (cobo_read_fd(cobo_parent_fd, cobo_addrs, cobo_num_addrs * sizeof(struct in_addr)) < 0) {
+            err_printf("Receiving address table from parent failed\n");
+            exit(1);
         }
+    }
+    return COBO_SUCCESS;
+}
 
-        /* our parent may have dropped us if he was too impatient waiting for our reply,
-         * read his ack to know that he completed the connection */
-        unsigned int ack = 0;
-        if (cobo_read_fd_w_timeout(cobo_parent_fd, &ack, sizeof(ack), reply_timeout) < 0) {
-            debug_printf3("Receiving ack to finalize connection\n");
-            close(cobo_parent_fd);
-            continue;
-        }
+static int cobo_open_tree()
+{
+    int sockfd = cobo_bind_listen();
 
-        /* if we get here, we've got a good connection to our parent */
-        have_parent = 1;
+    /* accept a connection from parent and receive socket table */
+    int reply_timeout = cobo_connect_timeout * 100;
+    cobo_parent_fd = -1;
+    while (cobo_parent_fd == -1) {
+        cobo_parent_fd = cobo_accept_peer(sockfd, reply_timeout, 0);
     }
 
-    /* we've got the connection to our parent, so close the listening socket */
-    close(sockfd);
-
     cobo_gettimeofday(&tree_start);
 
     /* TODO: exchange protocol version number */
@@ -891,23 +1924,17 @@ static int cobo_open_tree()
         exit(1);
     }
 
-    /* discover how many ranks are in our world */
-    if (cobo_read_fd(cobo_parent_fd, &cobo_nprocs, sizeof(int)) < 0) {
-        err_printf("Receiving number of tasks from parent failed\n");
-        exit(1);
-    }
-
-    /* read the size of the hostlist (in bytes) */
-    if (cobo_read_fd(cobo_parent_fd, &cobo_hostlist_size, sizeof(int)) < 0) {
-        err_printf("Receiving size of hostname table from parent failed\n");
-        exit(1);
-    }
+    cobo_recv_tree();
 
-    /* allocate space for the hostlist and read it in */
-    cobo_hostlist = (void*) cobo_malloc(cobo_hostlist_size, "Hostlist data buffer");
-    if (cobo_read_fd(cobo_parent_fd, cobo_hostlist, cobo_hostlist_size) < 0) {
-        err_printf("Receiving hostname table from parent failed\n");
-        exit(1);
+    /* we've got the connection to our parent, so close the listening socket,
+     * or a parent building the tree next to us could reach us and wait out
+     * its handshake.  With cobo_elastic it stays open for servers that join
+     * later, which the event loop takes without blocking. */
+    if (cobo_elastic) {
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+        cobo_listen_fd = sockfd;
+    } else {
+        close(sockfd);
     }
 
 /*
@@ -924,36 +1951,48 @@ static int cobo_open_tree()
     cobo_compute_children();  
     /* cobo_compute_children_root_C1(); */
 
-    /* for each child, open socket connection and forward hostname table */
-    for(i=0; i < cobo_num_child; i++) {
-        /* get rank and hostname for this child */
-        int c = cobo_child[i];
-        char* child_hostname = cobo_expand_hostname(c);
+    /* open socket connections to all children at once and forward hostname table */
+    cobo_connect_children();
 
-        debug_printf3("%d: on COBO%02d: connect to child #%02d (%s)\n",i,cobo_me,c,child_hostname);
+    return COBO_SUCCESS;
+}
 
-        /* connect to child */
-        cobo_child_fd[i] = cobo_connect_hostname(child_hostname, c);
-        if (cobo_child_fd[i] == -1) {
-            err_printf("Failed to connect to child (rank %d) on %s failed\n",
-                       c, child_hostname);
-            exit(1);
-        }
+/* tries each port of hostname once for one of our servers that takes us
+ * as a child.  Returns the socket to it, with our rank read, or -1.  The
+ * rank comes from the root, so we wait for it up to the connect time limit. */
+static int cobo_try_join(char* hostname)
+{
+    struct in_addr saddr;
+    int reply_timeout = cobo_connect_timeout * 10;
+    int rank_timeout = (int) (cobo_connect_timelimit * 1000);
+    int i, s;
 
-        /* tell child what rank he is and forward the hostname table to him */
-        int forward = cobo_send_hostlist(cobo_child_fd[i], child_hostname, c,
-                          cobo_nprocs, cobo_hostlist, cobo_hostlist_size);
-        if (forward != COBO_SUCCESS) {
-            err_printf("Failed to forward hostname table to child (rank %d) on %s failed\n",
-                       c, child_hostname);
-            exit(1);
+    if (cobo_lookup_hostname(hostname, &saddr) == -1) {
+        return -1;
+    }
+
+    for (i = 0; i < cobo_num_ports; i++) {
+        int port = cobo_ports[i];
+        s = cobo_connect(saddr, htons(port), cobo_connect_timeout);
+        if (s == -1) {
+            continue;
+        }
+        if (cobo_check_connection(s, hostname, -1, port, reply_timeout) < 0) {
+            /* another job's server, or not a server at all */
+            close(s);
+            continue;
         }
 
-        /* free the child hostname string */
-        free(child_hostname);
+        /* one of ours, which closes the connection if it has no room for us */
+        if (cobo_read_fd_w_timeout(s, &cobo_me, sizeof(int), rank_timeout) < 0) {
+            debug_printf3("Server on %s port %d has no room for us\n", hostname, port);
+            close(s);
+            return -1;
+        }
+        debug_printf3("Server on %s port %d took us as rank %d\n", hostname, port, cobo_me);
+        return s;
     }
-
-    return COBO_SUCCESS;
+    return -1;
 }
 
 /*
@@ -964,6 +2003,7 @@ static int cobo_close_tree()
 {
     /* close socket connection with parent */
     close(cobo_parent_fd);
+    cobo_close_listen();
 
     /* and all my children */
     int i;
@@ -976,6 +2016,9 @@ static int cobo_close_tree()
     cobo_free(cobo_child_fd);
     cobo_free(cobo_child_incl);
     cobo_free(cobo_hostlist);
+    cobo_free(cobo_hostlist_str);
+    cobo_free(cobo_groups);
+    cobo_free(cobo_addrs);
 
     return COBO_SUCCESS;
 }
@@ -1027,45 +2070,165 @@ int cobo_bcast_down(void* buf, int size)
    return rc;
 }
 
-/* reduce maximum integer to rank 0 */
-static int cobo_allreduce_max_int_tree(int* sendbuf, int* recvbuf)
+/* returns the size in bytes of one value of type */
+static size_t cobo_type_size(cobo_type_t type)
+{
+    switch (type) {
+        case COBO_INT:    return sizeof(int);
+        case COBO_INT64:  return sizeof(int64_t);
+        case COBO_DOUBLE: return sizeof(double);
+    }
+    err_printf("Unknown reduction type %d\n", (int) type);
+    exit(1);
+}
+
+#define COBO_COMBINE(T) {                                          \
+        T* a = (T*) accum;                                         \
+        T* b = (T*) in;                                            \
+        for (i = 0; i < count; i++) {                              \
+            if (op == COBO_SUM)                                    \
+                a[i] += b[i];                                      \
+            else if (op == COBO_MIN ? b[i] < a[i] : b[i] > a[i])   \
+                a[i] = b[i];                                       \
+        }                                                          \
+    }
+
+/* combines count values of type from in into accum with op */
+static void cobo_combine(void* accum, void* in, int count, cobo_type_t type, cobo_op_t op)
+{
+    int i;
+    switch (type) {
+        case COBO_INT:    COBO_COMBINE(int);     break;
+        case COBO_INT64:  COBO_COMBINE(int64_t); break;
+        case COBO_DOUBLE: COBO_COMBINE(double);  break;
+    }
+}
+
+/* reduce count values of type with op to rank 0, each subtree sending up
+ * one array already reduced over its tasks */
+static int cobo_reduce_tree(void* sendbuf, void* recvbuf, int count, cobo_type_t type, cobo_op_t op)
 {
     int rc = COBO_SUCCESS;
+    size_t size = count * cobo_type_size(type);
+    void* accum = (void*) cobo_malloc(size ? size : 1, "Reduction buffer in cobo_reduce_tree");
+    void* child_vals = (void*) cobo_malloc(size ? size : 1, "Child buffer in cobo_reduce_tree");
 
-    /* init our current maximum to our own value */
-    int max_val = *sendbuf;
+    /* start from our own values */
+    memcpy(accum, sendbuf, size);
 
-    /* if i have any children, receive their data */
+    /* if i have any children, combine their data */
     int i;
-    int child_val;
     for(i=cobo_num_child-1; i>=0; i--) {
-        /* read integer from child */
-        if (cobo_read_fd(cobo_child_fd[i], &child_val, sizeof(child_val)) < 0) {
+        if (cobo_read_fd(cobo_child_fd[i], child_vals, size) < 0) {
             err_printf("Reducing data from child (rank %d) failed\n",
                        cobo_child[i]);
             exit(1);
         }
-
-        /* compare child's max to our current max */
-        if (child_val > max_val) {
-            max_val = child_val;
-        }
+        cobo_combine(accum, child_vals, count, type, op);
     }
 
     /* forward data to parent if we're not rank 0, otherwise set the recvbuf */
     if (cobo_me != 0) {
-        /* not the root, so forward our reduction result to our parent */
-        if (cobo_write_fd(cobo_parent_fd, &max_val, sizeof(max_val)) < 0) {
+        if (cobo_write_fd(cobo_parent_fd, accum, size) < 0) {
             err_printf("Sending reduced data to parent failed\n");
             exit(1);
         }
     } else {
-        /* we're the root, got the result, set the recvbuf */
-        *recvbuf = max_val;
+        memcpy(recvbuf, accum, size);
+    }
+
+    cobo_free(accum);
+    cobo_free(child_vals);
+    return rc;
+}
+
+/* Each task sends a one byte token up once its subtree has arrived, and
+ * waits for the token rank 0 sends back down once everyone has.  Every
+ * task only talks to its parent and children, so the barrier takes two
+ * passes over the depth of the tree. */
+static int cobo_barrier_tree()
+{
+    char token = 0;
+    int i;
+
+    for(i=cobo_num_child-1; i>=0; i--) {
+        if (cobo_read_fd(cobo_child_fd[i], &token, sizeof(token)) < 0) {
+            err_printf("Receiving barrier token from child (rank %d) failed\n",
+                       cobo_child[i]);
+            exit(1);
+        }
+    }
+    if (cobo_me != 0) {
+        if (cobo_write_fd(cobo_parent_fd, &token, sizeof(token)) < 0) {
+            err_printf("Sending barrier token to parent failed\n");
+            exit(1);
+        }
+    }
+    return cobo_bcast_tree(&token, sizeof(token));
+}
+
+/* Gather a variable number of bytes from each task to rank 0, with no
+ * padding.  A subtree sends up its total byte count, then the byte count
+ * of each of its tasks, then their data back to back, in the same task
+ * order as cobo_gather_tree.  On rank 0, *counts and *data are allocated
+ * to hold every task's count and data, and *total is set to the sum. */
+static int cobo_gatherv_tree(void* sendbuf, int sendcount, int** counts, char** data, int* total)
+{
+    int rc = COBO_SUCCESS;
+    int num_tasks = cobo_num_child_incl + 1;
+    int* mycounts = (int*) cobo_malloc(num_tasks * sizeof(int), "Count buffer in cobo_gatherv_tree");
+    char** child_data = (char**) cobo_malloc((cobo_num_child + 1) * sizeof(char*), "Child data array in cobo_gatherv_tree");
+    int* child_total = (int*) cobo_malloc((cobo_num_child + 1) * sizeof(int), "Child size array in cobo_gatherv_tree");
+
+    /* receive each child's counts and data */
+    int i;
+    int offset = 1;
+    int mytotal = sendcount;
+    mycounts[0] = sendcount;
+    for(i=cobo_num_child-1; i>=0; i--) {
+        if (cobo_read_fd(cobo_child_fd[i], &child_total[i], sizeof(int)) < 0 ||
+            cobo_read_fd(cobo_child_fd[i], mycounts + offset, cobo_child_incl[i] * sizeof(int)) < 0) {
+            err_printf("Gathering counts from child (rank %d) failed\n",
+                       cobo_child[i]);
+            exit(1);
+        }
+        child_data[i] = (char*) cobo_malloc(child_total[i] ? child_total[i] : 1, "Child data in cobo_gatherv_tree");
+        if (cobo_read_fd(cobo_child_fd[i], child_data[i], child_total[i]) < 0) {
+            err_printf("Gathering data from child (rank %d) failed\n",
+                       cobo_child[i]);
+            exit(1);
+        }
+        offset += cobo_child_incl[i];
+        mytotal += child_total[i];
+    }
+
+    /* lay our data out ahead of our children's */
+    char* mydata = (char*) cobo_malloc(mytotal ? mytotal : 1, "Data buffer in cobo_gatherv_tree");
+    memcpy(mydata, sendbuf, sendcount);
+    offset = sendcount;
+    for(i=cobo_num_child-1; i>=0; i--) {
+        memcpy(mydata + offset, child_data[i], child_total[i]);
+        offset += child_total[i];
+        cobo_free(child_data[i]);
     }
+    cobo_free(child_data);
+    cobo_free(child_total);
 
-    /* broadcast result of reduction from rank 0 to all tasks */
-    cobo_bcast_tree(recvbuf, sizeof(int));
+    /* if i'm not rank 0, send to parent, otherwise hand back the result */
+    if (cobo_me != 0) {
+        if (cobo_write_fd(cobo_parent_fd, &mytotal, sizeof(int)) < 0 ||
+            cobo_write_fd(cobo_parent_fd, mycounts, num_tasks * sizeof(int)) < 0 ||
+            cobo_write_fd(cobo_parent_fd, mydata, mytotal) < 0) {
+            err_printf("Sending gathered data to parent failed\n");
+            exit(1);
+        }
+        cobo_free(mycounts);
+        cobo_free(mydata);
+    } else {
+        *counts = mycounts;
+        *data = mydata;
+        *total = mytotal;
+    }
 
     return rc;
 }
@@ -1155,6 +2318,40 @@ int cobo_get_child_socket(int num, int *fd)
    return COBO_SUCCESS;
 }
 
+/* fills in up to max ranks of the root's children, in the same order the root
+ * numbers its child sockets.  Valid on every rank, not just the root. */
+int cobo_get_root_children(int *ranks, int max, int *num)
+{
+   int max_children = cobo_max_children();
+   int *child = (int*) cobo_malloc(max_children * sizeof(int), "Root child rank array");
+   int *incl = (int*) cobo_malloc(max_children * sizeof(int), "Root child count array");
+   int i, n;
+
+   n = cobo_split_range(0, cobo_nprocs - 1, child, incl);
+   for (i = 0; i < n && i < max; i++)
+      ranks[i] = child[i];
+   *num = i;
+
+   cobo_free(child);
+   cobo_free(incl);
+   return COBO_SUCCESS;
+}
+
+/* sets leader to 1 if we're the first rank of our switch group in a rack tree,
+ * whose parent is outside the switch.  Other trees have no switches, so there the
+ * root and its children lead the subtrees below them.  A server that joined
+ * after startup leads nothing. */
+int cobo_is_rack_leader(int *leader)
+{
+   if (cobo_me >= cobo_nprocs)
+      *leader = 0;
+   else if (cobo_tree_type == COBO_TREE_RACK && cobo_num_groups > 1)
+      *leader = (cobo_groups[cobo_group_index(cobo_me)] == cobo_me);
+   else
+      *leader = (cobo_me == 0 || cobo_parent == 0);
+   return COBO_SUCCESS;
+}
+
 /*
  * ==========================================================================
  * ==========================================================================
@@ -1185,6 +2382,80 @@ int cobo_get_parent_socket(int* fd)
     return -1; /* failure RCs? */ 
 }
 
+/* fills in fd with the socket servers join the running tree through */
+int cobo_get_listen_socket(int* fd)
+{
+    if (cobo_listen_fd != -1) {
+        *fd = cobo_listen_fd;
+        return COBO_SUCCESS;
+    }
+    return -1;
+}
+
+/* stop taking servers that join later */
+int cobo_close_listen()
+{
+    if (cobo_listen_fd != -1) {
+        close(cobo_listen_fd);
+        cobo_listen_fd = -1;
+    }
+    return COBO_SUCCESS;
+}
+
+/* accept a server joining the running tree.  The handshake is bounded by
+ * the reply timeout, since we're called from the server's event loop.
+ * Unless refuse is set or our children and pending joins already fill the
+ * tree's degree, it holds a child slot and fd is filled in; its rank is
+ * picked elsewhere and given with cobo_admit_join, or it's turned away
+ * with cobo_drop_join.  Otherwise the connection is dropped and it tries
+ * elsewhere. */
+int cobo_accept_join(int refuse, int* fd)
+{
+    int reply_timeout = cobo_connect_timeout * 10;
+    int s = cobo_accept_peer(cobo_listen_fd, reply_timeout, reply_timeout);
+    if (s == -1) {
+        return !COBO_SUCCESS;
+    }
+
+    if (refuse || cobo_num_child + cobo_num_pending_joins >= cobo_tree_degree) {
+        debug_printf3("Turning away a joining server, with %d children and %d joining\n",
+                      cobo_num_child, cobo_num_pending_joins);
+        close(s);
+        return !COBO_SUCCESS;
+    }
+
+    cobo_num_pending_joins++;
+    *fd = s;
+    return COBO_SUCCESS;
+}
+
+/* make the server accepted on fd our last child, as rank */
+int cobo_admit_join(int fd, int rank)
+{
+    char hostname[] = "joining server";
+
+    cobo_num_pending_joins--;
+    if (cobo_send_hostlist(fd, hostname, rank, cobo_nprocs, cobo_hostlist_str,
+                           cobo_hostlist_str_size, NULL, 0) != COBO_SUCCESS) {
+        close(fd);
+        return !COBO_SUCCESS;
+    }
+
+    cobo_child[cobo_num_child] = rank;
+    cobo_child_fd[cobo_num_child] = fd;
+    cobo_child_incl[cobo_num_child] = 1;
+    cobo_num_child++;
+    return COBO_SUCCESS;
+}
+
+/* turn away the server accepted on fd, which tries elsewhere */
+int cobo_drop_join(int fd)
+{
+    cobo_num_pending_joins--;
+    close(fd);
+    return COBO_SUCCESS;
+}
+
 /* Perform barrier, each task writes an int then waits for an int */
 int cobo_barrier()
 {
@@ -1192,10 +2463,7 @@ int cobo_barrier()
     cobo_gettimeofday(&start);
     debug_printf3("Starting cobo_barrier()\n");
 
-    /* use allreduce of an int for our barrier */
-    int dummy;
-    int myint = 1;
-    cobo_allreduce_max_int_tree(&myint, &dummy);
+    cobo_barrier_tree();
 
     cobo_gettimeofday(&end);
     debug_printf3("Exiting cobo_barrier(), took %f seconds for %d procs\n", cobo_getsecs(&end,&start), cobo_nprocs);
@@ -1322,22 +2590,82 @@ int cobo_alltoall(void* sendbuf, int sendcount, void* recvbuf)
 }
 
 /*
- * Perform MPI-like Allreduce maximum of a single int from each task
+ * Perform MPI-like Reduce, each task provides count values of type in
+ * sendbuf, root receives them combined with op into recvbuf
+ */
+int cobo_reduce(void* sendbuf, void* recvbuf, int count, cobo_type_t type, cobo_op_t op, int root)
+{
+    struct timeval start, end;
+    cobo_gettimeofday(&start);
+    debug_printf3("Starting cobo_reduce()");
+
+    int rc = COBO_SUCCESS;
+
+    if (root == 0) {
+        rc = cobo_reduce_tree(sendbuf, recvbuf, count, type, op);
+    } else {
+        err_printf("Cannot execute reduce to non-zero root\n");
+        exit(1);
+    }
+
+    cobo_gettimeofday(&end);
+    debug_printf3("Exiting cobo_reduce(), took %f seconds for %d procs\n", cobo_getsecs(&end,&start), cobo_nprocs);
+    return rc;
+}
+
+/*
+ * Perform MPI-like Allreduce, each task provides count values of type in
+ * sendbuf and receives them combined with op into recvbuf
  */
-static int cobo_allreduce_max_int(int* sendint, int* recvint)
+int cobo_allreduce(void* sendbuf, void* recvbuf, int count, cobo_type_t type, cobo_op_t op)
 {
     struct timeval start, end;
     cobo_gettimeofday(&start);
-    debug_printf3("Starting cobo_allreducemaxint()");
+    debug_printf3("Starting cobo_allreduce()");
 
-    /* compute allreduce via tree */
-    cobo_allreduce_max_int_tree(sendint, recvint);
+    /* reduce to rank 0, then broadcast the result */
+    cobo_reduce_tree(sendbuf, recvbuf, count, type, op);
+    cobo_bcast_tree(recvbuf, count * cobo_type_size(type));
 
     cobo_gettimeofday(&end);
-    debug_printf3("Exiting cobo_allreducemaxint(), took %f seconds for %d procs\n", cobo_getsecs(&end,&start), cobo_nprocs);
+    debug_printf3("Exiting cobo_allreduce(), took %f seconds for %d procs\n", cobo_getsecs(&end,&start), cobo_nprocs);
     return COBO_SUCCESS;
 }
 
+/*
+ * Perform MPI-like Gatherv, each task sends sendcount bytes from sendbuf,
+ * which may differ from task to task, and root receives them back to back
+ * in rank order in a buffer it allocates.  On root, recvcounts is filled in
+ * with each task's count; the buffer should be freed.
+ */
+int cobo_gatherv(void* sendbuf, int sendcount, void** recvbuf, int* recvcounts, int root)
+{
+    struct timeval start, end;
+    cobo_gettimeofday(&start);
+    debug_printf3("Starting cobo_gatherv()");
+
+    int rc = COBO_SUCCESS;
+    int* counts = NULL;
+    char* data = NULL;
+    int total;
+
+    if (root == 0) {
+        rc = cobo_gatherv_tree(sendbuf, sendcount, &counts, &data, &total);
+        if (cobo_me == 0) {
+            memcpy(recvcounts, counts, cobo_nprocs * sizeof(int));
+            *recvbuf = data;
+            cobo_free(counts);
+        }
+    } else {
+        err_printf("Cannot execute gatherv to non-zero root\n");
+        exit(1);
+    }
+
+    cobo_gettimeofday(&end);
+    debug_printf3("Exiting cobo_gatherv(), took %f seconds for %d procs\n", cobo_getsecs(&end,&start), cobo_nprocs);
+    return rc;
+}
+
 /*
  * Perform MPI-like Allgather of NULL-terminated strings (whose lengths may vary
  * from task to task).
@@ -1362,29 +2690,27 @@ int cobo_allgather_str(char* sendstr, char*** recvstr, char** recvbuf)
     cobo_gettimeofday(&start);
     debug_printf3("Starting cobo_allgatherstr()");
 
-    /* determine max length of send strings */
-    int mylen  = strlen(sendstr) + 1;
-    int maxlen = 0;
-    cobo_allreduce_max_int(&mylen, &maxlen);
-
-    /* pad my string to match max length */
-    char* mystr = (char*) cobo_malloc(maxlen, "Padded String");
-    memset(mystr, '\0', maxlen);
-    strcpy(mystr, sendstr);
-
-    /* allocate enough buffer space to receive a maxlen string from all tasks */
-    char* stringbuf = (char*) cobo_malloc(cobo_nprocs * maxlen, "String Buffer");
-
-    /* gather strings from everyone */
-    cobo_allgather((void*) mystr, maxlen, (void*) stringbuf);
+    /* gather the strings to rank 0 at their own lengths, then send every
+     * task the total size and the strings back to back */
+    int* counts = NULL;
+    char* stringbuf = NULL;
+    int total = 0;
+    cobo_gatherv_tree(sendstr, strlen(sendstr) + 1, &counts, &stringbuf, &total);
+    cobo_free(counts);
+    cobo_bcast_tree(&total, sizeof(int));
+    if (cobo_me != 0) {
+        stringbuf = (char*) cobo_malloc(total, "String Buffer");
+    }
+    cobo_bcast_tree(stringbuf, total);
 
-    /* set up array and free temporary maxlen string */
+    /* each string starts after the terminator of the one before it */
     char** strings = (char **) cobo_malloc(cobo_nprocs * sizeof(char*), "Array of String Pointers");
     int i;
+    char* str = stringbuf;
     for (i=0; i<cobo_nprocs; i++) {
-        strings[i] = stringbuf + i*maxlen;
+        strings[i] = str;
+        str += strlen(str) + 1;
     }
-    cobo_free(mystr);
 
     *recvstr = strings;
     *recvbuf = stringbuf;
@@ -1395,17 +2721,12 @@ int cobo_allgather_str(char* sendstr, char*** recvstr, char** recvbuf)
 }
 
 /* provide list of ports and number of ports as input, get number of tasks and my rank as output */
-int cobo_open(uint64_t sessionid, int* portlist, int num_ports, int* rank, int* num_ranks)
+/* reads the connection settings from the environment and records the
+ * session id and port range, for cobo_open and cobo_join */
+static void cobo_init_settings(uint64_t sessionid, int* portlist, int num_ports)
 {
-    setvbuf(stdout, NULL, _IONBF, 0);
     char *value;
 
-    struct timeval start, end;
-    cobo_gettimeofday(&start);
-
-    /* we now know this process is a client, although we don't know what our rank is yet */
-    cobo_me = -1;
-
     /* record the sessionid, which we'll use to verify our connections */
     cobo_sessionid = sessionid;
 
@@ -1433,6 +2754,11 @@ int cobo_open(uint64_t sessionid, int* portlist, int num_ports, int* rank, int*
         cobo_connect_timelimit = (double) atoi(value);
     }
 
+    /* bytes */
+    if ((value = cobo_getenv("COBO_SOCKET_BUFFER", ENV_OPTIONAL))) {
+        cobo_socket_buffer = atoi(value);
+    }
+
     debug_printf3("In cobo_init():\n" \
         "COBO_CONNECT_TIMEOUT: %d, COBO_CONNECT_BACKOFF: %d, COBO_CONNECT_SLEEP: %d, COBO_CONNECT_TIMELIMIT: %d\n",
         cobo_connect_timeout, cobo_connect_backoff, cobo_connect_sleep, (int) cobo_connect_timelimit);
@@ -1444,6 +2770,19 @@ int cobo_open(uint64_t sessionid, int* portlist, int num_ports, int* rank, int*
         err_printf("Failed to copy port list\n");
         exit(1);
     }
+}
+
+int cobo_open(uint64_t sessionid, int* portlist, int num_ports, int* rank, int* num_ranks)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    struct timeval start, end;
+    cobo_gettimeofday(&start);
+
+    /* we now know this process is a client, although we don't know what our rank is yet */
+    cobo_me = -1;
+
+    cobo_init_settings(sessionid, portlist, num_ports);
 
     /* open the tree */
     cobo_open_tree();
@@ -1468,6 +2807,76 @@ int cobo_open(uint64_t sessionid, int* portlist, int num_ports, int* rank, int*
     return COBO_SUCCESS;
 }
 
+/* join a running tree as a new leaf, below the first of the num_hosts
+ * hosts' servers that has room for us.  The hosts are tried from one
+ * picked by our hostname, so servers joining at once spread out. */
+int cobo_join(uint64_t sessionid, int* portlist, int num_ports, char** hosts, int num_hosts,
+              int* rank, int* num_ranks)
+{
+    char hostname[256];
+    unsigned int hash = 2166136261u;
+    char *c;
+    int i, first;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    cobo_me = -1;
+    cobo_init_settings(sessionid, portlist, num_ports);
+    if (num_hosts <= 0) {
+        err_printf("No running servers to join\n");
+        return !COBO_SUCCESS;
+    }
+
+    /* so our own children can join below us later */
+    cobo_listen_fd = cobo_bind_listen();
+    fcntl(cobo_listen_fd, F_SETFL, fcntl(cobo_listen_fd, F_GETFL) | O_NONBLOCK);
+
+    if (gethostname(hostname, sizeof(hostname)) == -1) {
+        hostname[0] = '\0';
+    }
+    hostname[sizeof(hostname) - 1] = '\0';
+    for (c = hostname; *c; c++) {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    first = (int) (hash % (unsigned int) num_hosts);
+
+    struct timeval start, end;
+    cobo_gettimeofday(&start);
+    double secs = 0;
+    while (cobo_parent_fd == -1) {
+        for (i = 0; i < num_hosts && cobo_parent_fd == -1; i++) {
+            cobo_parent_fd = cobo_try_join(hosts[(first + i) % num_hosts]);
+        }
+        if (cobo_parent_fd != -1) {
+            break;
+        }
+
+        cobo_gettimeofday(&end);
+        secs = cobo_getsecs(&end, &start);
+        if (secs >= cobo_connect_timelimit) {
+            err_printf("Time limit to join a running server expired\n");
+            return !COBO_SUCCESS;
+        }
+        usleep(cobo_connect_sleep * 1000);
+    }
+
+    cobo_recv_tree();
+
+    /* our parent is outside the job's ranks, and we have no children yet */
+    cobo_parent = -1;
+    cobo_num_child = 0;
+    cobo_num_child_incl = 0;
+    int max_children = cobo_max_children();
+    cobo_child      = (int*) cobo_malloc(max_children * sizeof(int), "Child rank array");
+    cobo_child_fd   = (int*) cobo_malloc(max_children * sizeof(int), "Child socket fd array");
+    cobo_child_incl = (int*) cobo_malloc(max_children * sizeof(int), "Child children count array");
+
+    *rank      = cobo_me;
+    *num_ranks = cobo_nprocs;
+    debug_printf3("Joined the tree as rank %d of %d procs\n", cobo_me, cobo_nprocs);
+    return COBO_SUCCESS;
+}
+
 /* shut down the connections between tasks and free data structures */
 int cobo_close()
 {
@@ -1512,40 +2921,39 @@ int cobo_server_get_root_socket(int* fd)
 }
 
 /* given a hostlist and portlist where clients are running, open the tree and assign ranks to clients */
-int cobo_server_open(uint64_t sessionid, char** hostlist, int num_hosts, int* portlist, int num_ports)
+int cobo_server_open(uint64_t sessionid, char** hostlist, int num_hosts, int* portlist, int num_ports,
+                     int elastic)
 {
     /* at this point, we know this process is the server, so set its rank */
     cobo_me = -2;
     cobo_nprocs = num_hosts;
     cobo_sessionid = sessionid;
+    cobo_elastic = elastic;
 
     /* check that we have some hosts in the hostlist */
     if (num_hosts <= 0) {
         return (!COBO_SUCCESS);
     }
 
-    /* determine the total number of bytes to hold the strings including terminating NUL character */
-    int i;
-    int size = 0;
-    for (i=0; i < num_hosts; i++) {
-        size += strlen(hostlist[i]) + 1;
+    /* pick the tree shape, and for a rack tree order the hosts by switch */
+    char** given_hostlist = hostlist;
+    cobo_read_tree_env();
+    if (cobo_tree_type == COBO_TREE_RACK) {
+        cobo_group_by_switch(given_hostlist, num_hosts, &hostlist);
     }
 
-    /* determine and allocate the total number of bytes to hold the strings plus offset table */
-    cobo_hostlist_size = num_hosts * sizeof(int) + size;
-    cobo_hostlist = cobo_malloc(cobo_hostlist_size, "Buffer for hostlist data structure");
-    if (cobo_hostlist == NULL) {
-        err_printf("Failed to allocate hostname table of %lu bytes\n",
-                   (unsigned long) cobo_hostlist_size);
-        return (!COBO_SUCCESS);
-    }
+    /* encode the hostlist, compressing runs of numbered hosts */
+    cobo_hostlist_str = cobo_compress_hostlist(hostlist, num_hosts, &cobo_hostlist_str_size);
+    debug_printf3("Encoded %d hosts in %d bytes\n", num_hosts, cobo_hostlist_str_size);
 
-    /* copy the strings in and fill in the offsets */
-    int offset = num_hosts * sizeof(int);
-    for (i=0; i < num_hosts; i++) {
-        ((int*)cobo_hostlist)[i] = offset;
-        strcpy((char*)(cobo_hostlist + offset), hostlist[i]);
-        offset += strlen(hostlist[i]) + 1;
+    /* resolve every host here, once, rather than on each parent in the tree */
+    cobo_resolve_hostlist(hostlist, num_hosts);
+
+    /* rank 0 is the first host in tree order */
+    char* root_host = hostlist[0];
+    if (hostlist != given_hostlist) {
+        cobo_free(hostlist);
+        hostlist = given_hostlist;
     }
 
     /* copy the portlist */
@@ -1557,18 +2965,19 @@ int cobo_server_open(uint64_t sessionid, char** hostlist, int num_hosts, int* po
     }
 
     /* connect to first host */
-    cobo_root_fd = cobo_connect_hostname(hostlist[0], 0);
+    cobo_root_fd = cobo_connect_hostname(root_host, 0);
     if (cobo_root_fd == -1) {
         err_printf("Failed to connect to child (rank %d) on %s failed\n",
-                   0, hostlist[0]);
+                   0, root_host);
         return (!COBO_SUCCESS);
     }
 
     /* forward the hostlist table to the first host */
-    int forward = cobo_send_hostlist(cobo_root_fd, hostlist[0], 0, num_hosts, cobo_hostlist, cobo_hostlist_size);
+    int forward = cobo_send_hostlist(cobo_root_fd, root_host, 0, num_hosts, cobo_hostlist_str, cobo_hostlist_str_size,
+                                     cobo_addrs, cobo_num_addrs);
     if (forward != COBO_SUCCESS) {
         err_printf("Failed to forward hostname table to child (rank %d) on %s failed\n",
-                   0, hostlist[0]);
+                   0, root_host);
         return (!COBO_SUCCESS);
     }
 
@@ -1585,7 +2994,9 @@ int cobo_server_close()
 
     /* free data structures */
     cobo_free(cobo_ports);
-    cobo_free(cobo_hostlist);
+    cobo_free(cobo_hostlist_str);
+    cobo_free(cobo_groups);
+    cobo_free(cobo_addrs);
 
     return COBO_SUCCESS;
 }
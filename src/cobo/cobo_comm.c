@@ -20,6 +20,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <netdb.h>
@@ -157,12 +158,12 @@ int ldcs_cobo_write_fd(int fd, void* buf, int size)
 
 int ll_read(int fd, void *buf, size_t count)
 {
-   int result;
+   ssize_t result;
    size_t pos = 0;
 
    while (pos < count) {
       result = read(fd, ((char *) buf) + pos, count - pos);
-      debug_printf3("Read %d bytes from network: %d %d %d...\n", result, (int) ((char *)buf)[pos],
+      debug_printf3("Read %ld bytes from network: %d %d %d...\n", (long) result, (int) ((char *)buf)[pos],
                     (int) ((char *)buf)[pos+1], (int) ((char *)buf)[pos+2]);
       if (result == -1 || result == 0) {
          if (errno == EINTR || errno == EAGAIN)
@@ -177,15 +178,21 @@ int ll_read(int fd, void *buf, size_t count)
 
 int ll_write(int fd, void *buf, size_t count)
 {
-   int result, error;
+   ssize_t result;
+   int error;
    size_t pos = 0;
 
    while (pos < count) {
       result = write(fd, ((char *) buf) + pos, count - pos);
-      debug_printf3("Wrote %d bytes to network: %d %d %d...\n", result, (int) ((char *)buf)[pos],
+      debug_printf3("Wrote %ld bytes to network: %d %d %d...\n", (long) result, (int) ((char *)buf)[pos],
                     (int) ((char *)buf)[pos+1], (int) ((char *)buf)[pos+2]);
 
-      if (result == -1 || result == 0) {
+      if (result == 0) {
+         /* errno is stale here, and retrying on it could spin forever */
+         err_printf("Error writing to cobo FD %d: connection closed\n", fd);
+         return -1;
+      }
+      if (result == -1) {
          if (errno == EINTR || errno == EAGAIN)
             continue;
          error = errno;
@@ -199,18 +206,38 @@ int ll_write(int fd, void *buf, size_t count)
 
 int write_msg(int fd, ldcs_message_t *msg)
 {
-   int result = ll_write(fd, msg, sizeof(*msg));
-   if (result == -1) {
-      return -1;
-   }
-
-   if (msg->header.len && msg->data) {
-      result = ll_write(fd, msg->data, msg->header.len);
+   struct iovec iov[2];
+   ssize_t result;
+   size_t header_left = sizeof(*msg);
+   size_t data_left = (msg->header.len && msg->data) ? msg->header.len : 0;
+
+   /* Header and data in one syscall (and usually one packet) */
+   while (header_left) {
+      iov[0].iov_base = ((char *) msg) + sizeof(*msg) - header_left;
+      iov[0].iov_len = header_left;
+      iov[1].iov_base = msg->data;
+      iov[1].iov_len = data_left;
+      result = writev(fd, iov, data_left ? 2 : 1);
+      if (result == 0) {
+         err_printf("Error writing to cobo FD %d: connection closed\n", fd);
+         return -1;
+      }
       if (result == -1) {
+         if (errno == EINTR || errno == EAGAIN)
+            continue;
+         err_printf("Error writing to cobo FD %d: %s\n", fd, strerror(errno));
          return -1;
       }
+      if ((size_t) result >= header_left) {
+         data_left -= (size_t) result - header_left;
+         header_left = 0;
+      }
+      else
+         header_left -= result;
    }
 
+   if (data_left)
+      return ll_write(fd, ((char *) msg->data) + msg->header.len - data_left, data_left);
    return 0;
 }
 
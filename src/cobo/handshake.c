@@ -24,6 +24,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <fcntl.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -100,6 +101,32 @@ typedef struct {
    struct sockaddr client_addr;
 } connection_info_t;
 
+/**
+ * One connection being handshaked.  A client handshakes with all of its
+ * servers at once, starting each step on every connection before it waits
+ * on any of them.
+ **/
+typedef struct {
+   int sockfd;
+   connection_info_t conninfo;
+   int result;                  /* HSHAKE_* result with this peer so far */
+   int socket_error;            /* Stream is out of step with the peer, don't share results */
+   int peer_declined;           /* Peer sent an empty packet, share_result says why */
+   int done;
+   int num_timeouts;
+} handshake_peer_t;
+
+#define TICKET_SECRET_LEN 32
+#define TICKET_REFRESH_SEC 300
+#if !defined MUNGE_TICKET_TTL_SEC
+#define MUNGE_TICKET_TTL_SEC 600
+#endif
+
+/* Payload of the munge credential in a ticket */
+typedef struct {
+   uint64_t session_id;
+   unsigned char secret[TICKET_SECRET_LEN];
+} ticket_payload_t;
 
 static FILE *debug_file = NULL;
 static char *last_error_message = NULL;
@@ -109,6 +136,13 @@ static char *saved_key_filepath;
 static unsigned int saved_key_len;
 static connection_info_t *saved_conninfo;
 static int timeout_seconds = 0;
+#if defined(MUNGE) && defined(GCRYPT)
+static char *ticket_cred;
+static unsigned char ticket_secret[TICKET_SECRET_LEN];
+static int ticket_is_mine;
+static time_t ticket_created;
+static int ticket_stale;
+#endif
 
 /** Routines for creating a handshake_packet_t **/
 static int encode_addr(struct sockaddr *addr, unsigned char *target_addr, uint16_t *port);
@@ -128,6 +162,8 @@ static int filekey_encrypt_packet(char *key_filepath, int key_length_bytes,
 static int key_encrypt_packet(unsigned char *key, int key_length_bytes,
                               handshake_packet_t *packet, 
                               unsigned char **packet_buffer, size_t *packet_buffer_size);
+static int ticket_encrypt_packet(handshake_packet_t *packet,
+                                 unsigned char **packet_buffer, size_t *packet_buffer_size);
 
 /** Routines for decrypting and validating a handshake_packet_t **/
 static int decrypt_packet(handshake_protocol_t *hdata, handshake_packet_t *expected_packet,
@@ -139,35 +175,54 @@ static int munge_decrypt_packet(handshake_packet_t *expected_packet,
 static int key_decrypt_packet(unsigned char *key, unsigned int key_len,
                               handshake_packet_t *expected_packet,
                               unsigned char *recvd_buffer, size_t recvd_buffer_size);
+static int ticket_decrypt_packet(handshake_packet_t *expected_packet,
+                                 unsigned char *recvd_buffer, size_t recvd_buffer_size);
 static int compare_packets(handshake_packet_t *expected_packet,
                            handshake_packet_t *recvd_packet);
 
+/** Routines for munge tickets **/
+static int get_ticket(uint64_t session_id, unsigned char **ticket, size_t *ticket_size);
+static int accept_ticket(uint64_t session_id, unsigned char *ticket, size_t ticket_size);
+static int ticket_edge_key(uint64_t session_id, unsigned char **key, int *key_size);
 
-static int handshake_wrapper(int sockfd, handshake_protocol_t *hdata, uint64_t session_id,
-                             int is_server);
-static int handshake_main(int sockfd, handshake_protocol_t *hdata, uint64_t session_id,
-                          int is_server);
+static int handshake_wrapper(int *sockfds, int count, handshake_protocol_t *hdata,
+                             uint64_t session_id, int is_server, int *results);
+static void handshake_main(handshake_peer_t *peers, int count, handshake_protocol_t *hdata,
+                           uint64_t session_id, int is_server);
 static int reliable_write(int fd, const void *buf, size_t size);
 static int reliable_read(int fd, void *buf, size_t size);
 static int read_key(char *key_filepath, int key_length_bytes);
-static int share_result(int fd, int result);
+static int send_result(int fd, int result);
+static int recv_result(int fd);
 static int get_client_server_addrs(int sockfd, int i_am_server, connection_info_t *conninfo);
 static int send_packet(int sockfd, unsigned char *packet, unsigned int packet_size);
 static int recv_packet(int sockfd, unsigned char **packet, size_t *packet_size);
-static int exchange_sig(int sockfd);
+static int send_sig(int sockfd);
+static int recv_sig(int sockfd);
 static int log_security_error(const char *format, ...);
 static int log_error(const char *format, ...);
 
 int spindle_handshake_server(int sockfd, handshake_protocol_t *hdata, uint64_t session_id)
 {
+   int result;
    debug_printf("Starting handshake from server\n");
-   return handshake_wrapper(sockfd, hdata, session_id, 1);
+   handshake_wrapper(&sockfd, 1, hdata, session_id, 1, &result);
+   return result;
 }
 
 int spindle_handshake_client(int sockfd, handshake_protocol_t *hdata, uint64_t session_id)
 {
+   int result;
    debug_printf("Starting handshake from client\n");
-   return handshake_wrapper(sockfd, hdata, session_id, 0);
+   handshake_wrapper(&sockfd, 1, hdata, session_id, 0, &result);
+   return result;
+}
+
+int spindle_handshake_client_many(int *sockfds, int count, handshake_protocol_t *hdata,
+                                  uint64_t session_id, int *results)
+{
+   debug_printf("Starting handshake from client with %d servers\n", count);
+   return handshake_wrapper(sockfds, count, hdata, session_id, 0, results);
 }
 
 int spindle_handshake_is_security_type_enabled(handshake_security_t sectype)
@@ -191,6 +246,12 @@ int spindle_handshake_is_security_type_enabled(handshake_security_t sectype)
          return 1;
 #else
          return 0;
+#endif
+      case hs_munge_ticket:
+#if defined(MUNGE) && defined(GCRYPT)
+         return 1;
+#else
+         return 0;
 #endif
    }
    return 0;
@@ -214,11 +275,11 @@ void spindle_handshake_enable_read_timeout(int timeout_sec)
    timeout_seconds = timeout_sec;
 }
 
-static int handshake_wrapper(int sockfd, handshake_protocol_t *hdata, uint64_t session_id,
-                             int is_server)
+static int handshake_wrapper(int *sockfds, int count, handshake_protocol_t *hdata,
+                             uint64_t session_id, int is_server, int *results)
 {
-   connection_info_t connection_info;
-   int num_timeouts = 0, result, return_result;
+   handshake_peer_t *peers;
+   int i, result, remaining = 0, return_result = HSHAKE_SUCCESS;
    sighandler_t old_pipe_action;
 
    if (last_security_message)
@@ -229,165 +290,278 @@ static int handshake_wrapper(int sockfd, handshake_protocol_t *hdata, uint64_t s
 
    old_pipe_action = signal(SIGPIPE, SIG_IGN);
 
+   peers = (handshake_peer_t *) calloc(count, sizeof(*peers));
+   assert(peers);
+
    /**
     * Record connection info
     **/
-   saved_conninfo = &connection_info;
-   result = get_client_server_addrs(sockfd, is_server, &connection_info);
-   if (result < 0) {
-      debug_printf("Error getting socket addresses in get_client_server_addrs\n");
-      return_result = result;
-      goto done;
+   for (i = 0; i < count; i++) {
+      peers[i].sockfd = sockfds[i];
+      result = get_client_server_addrs(sockfds[i], is_server, &peers[i].conninfo);
+      if (result < 0) {
+         debug_printf("Error getting socket addresses in get_client_server_addrs\n");
+         peers[i].result = result;
+         peers[i].done = 1;
+         continue;
+      }
+      remaining++;
    }
    
-   for (;;) {
-      result = handshake_main(sockfd, hdata, session_id, is_server);
-      if (result != HSHAKE_AGAIN) {
-         /* Typical case */
-         break;
-      }
-      /* We hit a timeout (perhaps a munge cert beyond its TTL).  Try again if num_timeouts < MAX_NUM_TIMEOUTS */
-      if (++num_timeouts == MAX_NUM_TIMEOUTS) {
-         security_error_printf("Peer could not produce a non-timed out certificate in %d attempts\n",
-                             num_timeouts);
-         result = HSHAKE_ABORT;
-         break;
+   while (remaining) {
+      handshake_main(peers, count, hdata, session_id, is_server);
+      for (i = 0; i < count; i++) {
+         handshake_peer_t *peer = peers + i;
+         if (peer->done)
+            continue;
+         if (peer->result == HSHAKE_AGAIN) {
+            /* We hit a timeout (perhaps a munge cert beyond its TTL).  Try again if num_timeouts < MAX_NUM_TIMEOUTS */
+#if defined(MUNGE) && defined(GCRYPT)
+            if (hdata->mechanism == hs_munge_ticket && !is_server)
+               ticket_stale = 1;
+#endif
+            if (++peer->num_timeouts < MAX_NUM_TIMEOUTS)
+               continue;
+            saved_conninfo = &peer->conninfo;
+            security_error_printf("Peer could not produce a non-timed out certificate in %d attempts\n",
+                                  peer->num_timeouts);
+            peer->result = HSHAKE_ABORT;
+         }
+         peer->done = 1;
+         remaining--;
       }
    }
-   return_result = result;
 
-  done:
-   debug_printf("Completed server handshake.  Result = %d\n", result);
+   for (i = 0; i < count; i++) {
+      results[i] = peers[i].result;
+      if (return_result == HSHAKE_SUCCESS)
+         return_result = peers[i].result;
+   }
+   debug_printf("Completed %s handshake.  Result = %d\n", is_server ? "server" : "client", return_result);
 
+   free(peers);
    saved_conninfo = NULL;
    signal(SIGPIPE, old_pipe_action);
 
    return return_result;
 }
 
-static int handshake_main(int sockfd, handshake_protocol_t *hdata, uint64_t session_id,
-                          int is_server)
+static int peer_active(handshake_peer_t *peer)
+{
+   return !peer->done && !peer->socket_error;
+}
+
+static void peer_socket_error(handshake_peer_t *peer, int result)
 {
-   int result, return_result, peer_result, socket_error = 0;
+   peer->result = result;
+   peer->socket_error = 1;
+}
+
+static void handshake_main(handshake_peer_t *peers, int count, handshake_protocol_t *hdata,
+                           uint64_t session_id, int is_server)
+{
+   int i, result, peer_result;
+   handshake_peer_t *peer;
    handshake_packet_t packet, expected_packet;
-   unsigned char *packet_buffer = NULL, *recvd_packet_buffer = NULL;
-   size_t packet_buffer_size = 0, recvd_packet_buffer_size;
+   unsigned char *packet_buffer, *recvd_packet_buffer, *ticket = NULL;
+   size_t packet_buffer_size, recvd_packet_buffer_size, ticket_size = 0;
+
+   for (i = 0; i < count; i++) {
+      if (peers[i].done)
+         continue;
+      peers[i].result = HSHAKE_SUCCESS;
+      peers[i].socket_error = peers[i].peer_declined = 0;
+   }
 
    /**
     * Exchange a public signature as a handshake to make sure
     * we're speaking the same protocol.
     **/
-   result = exchange_sig(sockfd);
-   if (result < 0) {
-      debug_printf("Error exchanging signatures\n");
-      socket_error = 1;
-      return_result = result;
-      goto done;
+   for (i = 0; i < count; i++) {
+      peer = peers + i;
+      if (!peer_active(peer))
+         continue;
+      saved_conninfo = &peer->conninfo;
+      result = send_sig(peer->sockfd);
+      if (result < 0) {
+         debug_printf("Error exchanging signatures\n");
+         peer_socket_error(peer, result);
+      }
    }
-
-   /**
-    * Encode socket names, session, gid, and uid into a handshake_packet_t
-    **/
-   debug_printf("Creating outgoing packet for handshake\n");
-   result = encode_packet(&packet, session_id, &saved_conninfo->server_addr, &saved_conninfo->client_addr);
-   if (result < 0) {
-      debug_printf("Error encoding outgoing packet");
-      return_result = result;
-      goto done;
+   for (i = 0; i < count; i++) {
+      peer = peers + i;
+      if (!peer_active(peer))
+         continue;
+      saved_conninfo = &peer->conninfo;
+      result = recv_sig(peer->sockfd);
+      if (result < 0) {
+         debug_printf("Error exchanging signatures\n");
+         peer_socket_error(peer, result);
+      }
    }
-   packet.signature = is_server ? SERVER_TO_CLIENT_SIG : CLIENT_TO_SERVER_SIG;
-   debug_printf("Encoded packet: server_port = %d, client_port = %d, "
-                "uid = %d, gid = %d, session_id = %llu, signature = %lx\n",
-                (int) packet.server_port, (int) packet.client_port, (int) packet.uid, (int) packet.gid, 
-                (unsigned long long) packet.session_id, (unsigned long) packet.signature);
 
    /**
-    * Encrypt/Sign the handshake_packet_t, producing a packet_buffer
+    * With munge tickets, the client passes down the ticket that
+    * every connection's key is derived from.  A side that has already
+    * failed sends an empty packet in place of its next one, which 
+    * keeps the streams in step until results are shared.
     **/
-   debug_printf("Encrypting outgoing packet\n");
-   result = encrypt_packet(hdata, &packet, &packet_buffer, &packet_buffer_size);
-   if (result < 0) {
-      debug_printf("Error in server encrypting outgoing packet");
-      return_result = result;
-      goto done;
+   if (hdata->mechanism == hs_munge_ticket && !is_server) {
+      result = get_ticket(session_id, &ticket, &ticket_size);
+      for (i = 0; i < count; i++) {
+         peer = peers + i;
+         if (!peer_active(peer))
+            continue;
+         if (result < 0)
+            peer->result = result;
+         if (send_packet(peer->sockfd, ticket, result < 0 ? 0 : ticket_size) < 0) {
+            debug_printf("Problem sending ticket on network: %s\n", strerror(errno));
+            peer_socket_error(peer, HSHAKE_INTERNAL_ERROR);
+         }
+      }
    }
-   debug_printf("Encrypted packet to buffer of size %lu\n", (unsigned long) packet_buffer_size);
-
-   /**
-    * Send the packet_buffer on the network
-    **/
-   result = send_packet(sockfd, packet_buffer, packet_buffer_size);
-   if (result < 0) {
-      debug_printf("Problem sending packet on network: %s\n", strerror(errno));
-      return_result = result;
-      socket_error = 1;
-      goto done;
+   else if (hdata->mechanism == hs_munge_ticket && is_server) {
+      for (i = 0; i < count; i++) {
+         peer = peers + i;
+         if (!peer_active(peer))
+            continue;
+         saved_conninfo = &peer->conninfo;
+         result = recv_packet(peer->sockfd, &ticket, &ticket_size);
+         if (result < 0) {
+            debug_printf("Problem receiving ticket\n");
+            peer_socket_error(peer, result);
+            continue;
+         }
+         peer->result = accept_ticket(session_id, ticket, ticket_size);
+         free(ticket);
+         ticket = NULL;
+      }
    }
 
    /**
-    * Recieve a packet_buffer on the network
+    * Encode socket names, session, gid, and uid into a handshake_packet_t,
+    * encrypt/sign it, and send it to every peer.
     **/
-   result = recv_packet(sockfd, &recvd_packet_buffer, &recvd_packet_buffer_size);
-   if (result < 0) {
-      debug_printf("Problem receiving packet\n");
-      return_result = result;
-      socket_error = 1;
-      goto done;
-   }
+   for (i = 0; i < count; i++) {
+      peer = peers + i;
+      if (!peer_active(peer))
+         continue;
+      saved_conninfo = &peer->conninfo;
+      packet_buffer = NULL;
+      packet_buffer_size = 0;
+
+      if (peer->result == HSHAKE_SUCCESS) {
+         debug_printf("Creating outgoing packet for handshake\n");
+         result = encode_packet(&packet, session_id, &peer->conninfo.server_addr, &peer->conninfo.client_addr);
+         if (result < 0) {
+            debug_printf("Error encoding outgoing packet");
+            peer->result = result;
+         }
+      }
+      if (peer->result == HSHAKE_SUCCESS) {
+         packet.signature = is_server ? SERVER_TO_CLIENT_SIG : CLIENT_TO_SERVER_SIG;
+         debug_printf("Encoded packet: server_port = %d, client_port = %d, "
+                      "uid = %d, gid = %d, session_id = %llu, signature = %lx\n",
+                      (int) packet.server_port, (int) packet.client_port, (int) packet.uid, (int) packet.gid, 
+                      (unsigned long long) packet.session_id, (unsigned long) packet.signature);
+
+         debug_printf("Encrypting outgoing packet\n");
+         result = encrypt_packet(hdata, &packet, &packet_buffer, &packet_buffer_size);
+         if (result < 0) {
+            debug_printf("Error in encrypting outgoing packet");
+            peer->result = result;
+            packet_buffer_size = 0;
+         }
+         else
+            debug_printf("Encrypted packet to buffer of size %lu\n", (unsigned long) packet_buffer_size);
+      }
 
-   /**
-    * Produce an expected handshake_packet_t
-    **/
-   debug_printf("Creating an expected packet\n");
-   result = encode_packet(&expected_packet, session_id, &saved_conninfo->server_addr, &saved_conninfo->client_addr);
-   if (result < 0) {
-      debug_printf("Error creating expected packet\n");
-      return_result = result;
-      goto done;
+      result = send_packet(peer->sockfd, packet_buffer, packet_buffer_size);
+      if (result < 0) {
+         debug_printf("Problem sending packet on network: %s\n", strerror(errno));
+         peer_socket_error(peer, result);
+      }
+      if (packet_buffer)
+         free(packet_buffer);
    }
-   expected_packet.signature = is_server ? CLIENT_TO_SERVER_SIG : SERVER_TO_CLIENT_SIG;
-  
+
    /**
-    * Decrypt the packet recieved on the network and compare
-    * it to the expected handshake_packet_t
+    * Recieve each peer's packet_buffer on the network, decrypt it and
+    * compare it to the expected handshake_packet_t
     **/
-   debug_printf("Decrypting and checking packet\n");
-   result = decrypt_packet(hdata, &expected_packet, recvd_packet_buffer, recvd_packet_buffer_size);
-   if (result < 0) {
-      debug_printf("Error decrypting and checking received packet\n");
-      return_result = result;
-      goto done;
-   }
-
-   debug_printf("Successfully completed initial handshake\n");
-
-   return_result = 0;
+   for (i = 0; i < count; i++) {
+      peer = peers + i;
+      if (!peer_active(peer))
+         continue;
+      saved_conninfo = &peer->conninfo;
+      recvd_packet_buffer = NULL;
 
-  done:
+      result = recv_packet(peer->sockfd, &recvd_packet_buffer, &recvd_packet_buffer_size);
+      if (result < 0) {
+         debug_printf("Problem receiving packet\n");
+         peer_socket_error(peer, result);
+      }
+      else if (peer->result == HSHAKE_SUCCESS && recvd_packet_buffer_size == 0) {
+         debug_printf("Peer sent an empty packet, it has already failed the handshake\n");
+         peer->result = HSHAKE_DROP_CONNECTION;
+         peer->peer_declined = 1;
+      }
+      else if (peer->result == HSHAKE_SUCCESS) {
+         debug_printf("Creating an expected packet\n");
+         result = encode_packet(&expected_packet, session_id, &peer->conninfo.server_addr, &peer->conninfo.client_addr);
+         if (result < 0) {
+            debug_printf("Error creating expected packet\n");
+            peer->result = result;
+         }
+         else {
+            expected_packet.signature = is_server ? CLIENT_TO_SERVER_SIG : SERVER_TO_CLIENT_SIG;
+            debug_printf("Decrypting and checking packet\n");
+            result = decrypt_packet(hdata, &expected_packet, recvd_packet_buffer, recvd_packet_buffer_size);
+            if (result < 0) {
+               debug_printf("Error decrypting and checking received packet\n");
+               peer->result = result;
+            }
+            else
+               debug_printf("Successfully completed initial handshake\n");
+         }
+      }
+      if (recvd_packet_buffer)
+         free(recvd_packet_buffer);
+   }
 
    /** 
-    * Send to peer the result of our connection attempt.  Only share whether
+    * Send to peers the result of our connection attempt.  Only share whether
     * we're accepting, dropping, or asking for a re-try.  
     **/
-   if (!socket_error) {
-      peer_result = share_result(sockfd, return_result);
-      if (return_result == 0 && peer_result != 0) {
+   for (i = 0; i < count; i++) {
+      peer = peers + i;
+      if (!peer_active(peer))
+         continue;
+      if (send_result(peer->sockfd, peer->result) < 0) {
+         peer->socket_error = 1;
+         if (peer->result == HSHAKE_SUCCESS)
+            peer->result = HSHAKE_INTERNAL_ERROR;
+      }
+   }
+   for (i = 0; i < count; i++) {
+      peer = peers + i;
+      if (!peer_active(peer))
+         continue;
+      peer_result = recv_result(peer->sockfd);
+      if (peer->peer_declined) {
+         /* Our failure was only the peer's, so take its reason */
+         peer->result = (peer_result == HSHAKE_AGAIN) ? HSHAKE_AGAIN : HSHAKE_DROP_CONNECTION;
+      }
+      else if (peer->result == HSHAKE_SUCCESS && peer_result != HSHAKE_SUCCESS) {
          /**
           * Only return the peer's result if we think everything
           * authenticated successfully on our end.  Otherwise we'll
           * return our result.
           **/
          debug_printf("Setting handshake result to peer's result of %d\n", peer_result);
-         return_result = peer_result;
+         peer->result = peer_result;
       }
    }
-
-   if (packet_buffer)
-      free(packet_buffer);
-   if (recvd_packet_buffer)
-      free(recvd_packet_buffer);
-
-   return return_result;
 }
 
 static int encode_addr(struct sockaddr *addr, unsigned char *target_addr, uint16_t *port)
@@ -456,6 +630,9 @@ static int encrypt_packet(handshake_protocol_t *hdata, handshake_packet_t *packe
          return key_encrypt_packet(hdata->data.explicit_key.key,
                                    hdata->data.explicit_key.key_length_bytes,
                                    packet, packet_buffer, packet_buffer_size);
+      case hs_munge_ticket:
+         debug_printf("Server encrypting packet with key derived from munge ticket\n");
+         return ticket_encrypt_packet(packet, packet_buffer, packet_buffer_size);
    }
    abort();
    return HSHAKE_INTERNAL_ERROR;
@@ -654,6 +831,17 @@ static int filekey_encrypt_packet(char *key_filepath, int key_length_bytes,
 }
 
 #if defined(GCRYPT)
+static void gcrypt_init()
+{
+   static int initialized = 0;
+
+   if (!initialized) {
+      gcry_control(GCRYCTL_DISABLE_SECMEM, 0);
+      gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+      initialized = 1;
+   }
+}
+
 static int get_hash_of_buffer(unsigned char *buffer, size_t buffer_size,
                               unsigned char *key, int key_length_bytes,
                               unsigned char **hash_result, int *hash_result_size)
@@ -705,14 +893,9 @@ static int key_encrypt_packet(unsigned char *key, int key_length_bytes,
    unsigned char *hash_result;
    int hash_result_size;
    int result;
-   static int initialized = 0;
 
-   if (!initialized) {
-      gcry_control(GCRYCTL_DISABLE_SECMEM, 0);
-      gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
-      initialized = 1;
-   }
-   
+   gcrypt_init();
+
    result = get_hash_of_buffer((unsigned char *) packet, sizeof(*packet),
                                key, key_length_bytes,
                                &hash_result, &hash_result_size);
@@ -816,6 +999,9 @@ static int decrypt_packet(handshake_protocol_t *hdata, handshake_packet_t *expec
          debug_printf("Decrypting packet with explicit key\n");
          return key_decrypt_packet(hdata->data.explicit_key.key, hdata->data.explicit_key.key_length_bytes,
                                    expected_packet, recvd_buffer, recvd_buffer_size);
+      case hs_munge_ticket:
+         debug_printf("Decrypting packet with key derived from munge ticket\n");
+         return ticket_decrypt_packet(expected_packet, recvd_buffer, recvd_buffer_size);
    }
    abort();
    return HSHAKE_INTERNAL_ERROR;
@@ -840,29 +1026,13 @@ static int none_decrypt_packet(handshake_packet_t *expected_packet,
 #endif
 }
 
-static int munge_decrypt_packet(handshake_packet_t *expected_packet,
-                                unsigned char *recvd_buffer, size_t recvd_buffer_size)
-{
 #if defined(MUNGE)
-   munge_err_t result;
-   munge_ctx_t ctx = NULL;
-   void *payload = NULL;
-   int payload_size, return_result, iresult;
-   uid_t uid;
-   gid_t gid;
-   handshake_packet_t *recvd_packet;
-
-   iresult = munge_create_context(&ctx);
-   if (iresult < 0) {
-      debug_printf("Failed to create munge context while decrypting packet\n");
-      return_result = iresult;
-      goto done;
-   }
-   
-   result = munge_decode((char *) recvd_buffer, ctx, &payload, &payload_size, &uid, &gid);
+/* Maps an error from munge_decode to a handshake result */
+static int munge_error_result(munge_err_t result)
+{
    switch (result) {
       case EMUNGE_SUCCESS:
-         break;
+         return 0;
       case EMUNGE_SNAFU:
       case EMUNGE_BAD_ARG:
       case EMUNGE_BAD_LENGTH:
@@ -871,16 +1041,13 @@ static int munge_decrypt_packet(handshake_packet_t *expected_packet,
       case EMUNGE_SOCKET:
       case EMUNGE_TIMEOUT:
          error_printf("Munge failed to decrypt packet with error: %s\n", munge_strerror(result));
-         return_result = HSHAKE_INTERNAL_ERROR;
-         goto done;
+         return HSHAKE_INTERNAL_ERROR;
       case EMUNGE_CRED_EXPIRED:
          debug_printf("Produced a timed out certificate.\n");
-         return_result = HSHAKE_AGAIN;
-         goto done;
+         return HSHAKE_AGAIN;
       case EMUNGE_BAD_CRED:
          debug_printf("Received garbage credential\n");
-         return_result = HSHAKE_DROP_CONNECTION;
-         goto done;
+         return HSHAKE_DROP_CONNECTION;
       case EMUNGE_BAD_VERSION:
       case EMUNGE_BAD_CIPHER:
       case EMUNGE_BAD_MAC:
@@ -891,13 +1058,38 @@ static int munge_decrypt_packet(handshake_packet_t *expected_packet,
       case EMUNGE_CRED_REPLAYED:
       case EMUNGE_CRED_UNAUTHORIZED:
          security_error_printf("Bad credential provided: %s\n", munge_strerror(result));
-         return_result = HSHAKE_ABORT;
-         goto done;
+         return HSHAKE_ABORT;
       default:
          security_error_printf("Unknown error return from munge: %s\n", munge_strerror(result));
-         return_result = HSHAKE_ABORT;
-         goto done;
-   } 
+         return HSHAKE_ABORT;
+   }
+}
+#endif
+
+static int munge_decrypt_packet(handshake_packet_t *expected_packet,
+                                unsigned char *recvd_buffer, size_t recvd_buffer_size)
+{
+#if defined(MUNGE)
+   munge_err_t result;
+   munge_ctx_t ctx = NULL;
+   void *payload = NULL;
+   int payload_size, return_result, iresult;
+   uid_t uid;
+   gid_t gid;
+   handshake_packet_t *recvd_packet;
+
+   iresult = munge_create_context(&ctx);
+   if (iresult < 0) {
+      debug_printf("Failed to create munge context while decrypting packet\n");
+      return_result = iresult;
+      goto done;
+   }
+   
+   result = munge_decode((char *) recvd_buffer, ctx, &payload, &payload_size, &uid, &gid);
+   if (result != EMUNGE_SUCCESS) {
+      return_result = munge_error_result(result);
+      goto done;
+   }
      
    if (payload_size != sizeof(*recvd_packet)) {
       security_error_printf("Recieved munge packet with invalid payload size of %d\n", (int) payload_size);
@@ -993,6 +1185,234 @@ static int key_decrypt_packet(unsigned char *key, unsigned int key_len,
 #endif
 }
 
+/**
+ * With hs_munge_ticket only the client at the root of the tree talks to
+ * munged to make a credential, and each server talks to it once to decode
+ * the credential its client passed down.  The credential is restricted to
+ * our uid and carries a random secret.  Each connection signs its packets
+ * with a key made from the secret and the connection's addresses, so no
+ * connection needs munge of its own.
+ **/
+static int get_ticket(uint64_t session_id, unsigned char **ticket, size_t *ticket_size)
+{
+#if defined(MUNGE) && defined(GCRYPT)
+   munge_err_t result;
+   munge_ctx_t ctx = NULL;
+   ticket_payload_t payload;
+   char *cred = NULL;
+   int return_result, iresult;
+
+   /**
+    * Only the root made its ticket and can make a new one, when it ages or
+    * a server found it expired.  Everyone else passes on the one they got.
+    **/
+   if (ticket_cred && (!ticket_is_mine || (!ticket_stale && time(NULL) - ticket_created < TICKET_REFRESH_SEC))) {
+      *ticket = (unsigned char *) ticket_cred;
+      *ticket_size = strlen(ticket_cred) + 1;
+      return 0;
+   }
+
+   debug_printf("Creating a new munge ticket\n");
+   gcrypt_init();
+   payload.session_id = session_id;
+   gcry_randomize(payload.secret, TICKET_SECRET_LEN, GCRY_STRONG_RANDOM);
+
+   iresult = munge_create_context(&ctx);
+   if (iresult < 0) {
+      debug_printf("Failed to create munge context while creating ticket\n");
+      return_result = iresult;
+      goto done;
+   }
+
+   result = munge_ctx_set(ctx, MUNGE_OPT_TTL, MUNGE_TICKET_TTL_SEC);
+   if (result == EMUNGE_SUCCESS)
+      result = munge_ctx_set(ctx, MUNGE_OPT_UID_RESTRICTION, getuid());
+   if (result != EMUNGE_SUCCESS) {
+      error_printf("Unable to set ticket options in munge: %s", munge_ctx_strerror(ctx) ? : "NO ERROR");
+      return_result = HSHAKE_INTERNAL_ERROR;
+      goto done;
+   }
+
+   result = munge_encode(&cred, ctx, &payload, sizeof(payload));
+   if (result != EMUNGE_SUCCESS) {
+      error_printf("Munge failed to encrypt ticket with error: %s\n", munge_ctx_strerror(ctx));
+      return_result = HSHAKE_INTERNAL_ERROR;
+      goto done;
+   }
+
+   if (ticket_cred)
+      free(ticket_cred);
+   ticket_cred = cred;
+   memcpy(ticket_secret, payload.secret, TICKET_SECRET_LEN);
+   ticket_is_mine = 1;
+   ticket_stale = 0;
+   ticket_created = time(NULL);
+
+   *ticket = (unsigned char *) ticket_cred;
+   *ticket_size = strlen(ticket_cred) + 1;
+   return_result = 0;
+
+  done:
+   memset(&payload, 0, sizeof(payload));
+   if (ctx)
+      munge_ctx_destroy(ctx);
+   return return_result;
+#else
+   error_printf("Handshake not compiled with both munge and gcrypt support\n");
+   return HSHAKE_INTERNAL_ERROR;
+#endif
+}
+
+static int accept_ticket(uint64_t session_id, unsigned char *ticket, size_t ticket_size)
+{
+#if defined(MUNGE) && defined(GCRYPT)
+   munge_err_t result;
+   munge_ctx_t ctx = NULL;
+   void *payload = NULL;
+   int payload_size, return_result, iresult;
+   uid_t uid;
+   gid_t gid;
+   ticket_payload_t *recvd_payload;
+
+   if (ticket_size == 0 || ticket[ticket_size-1] != '\0') {
+      error_printf("Received malformed ticket of size %lu\n", (unsigned long) ticket_size);
+      return HSHAKE_DROP_CONNECTION;
+   }
+
+   if (ticket_cred && strcmp(ticket_cred, (char *) ticket) == 0) {
+      debug_printf("Reusing decoded munge ticket\n");
+      return 0;
+   }
+
+   iresult = munge_create_context(&ctx);
+   if (iresult < 0) {
+      debug_printf("Failed to create munge context while decoding ticket\n");
+      return_result = iresult;
+      goto done;
+   }
+
+   /**
+    * Munge remembers the credentials it decoded on this host, so every
+    * server after the first on a node sees the ticket as replayed.  The
+    * payload is still returned then, and the ticket is meant to be reused.
+    **/
+   result = munge_decode((char *) ticket, ctx, &payload, &payload_size, &uid, &gid);
+   if (result == EMUNGE_CRED_REPLAYED) {
+      debug_printf("Munge ticket was already decoded on this host\n");
+      result = EMUNGE_SUCCESS;
+   }
+   if (result != EMUNGE_SUCCESS) {
+      return_result = munge_error_result(result);
+      goto done;
+   }
+
+   if (payload_size != sizeof(*recvd_payload)) {
+      security_error_printf("Recieved munge ticket with invalid payload size of %d\n", (int) payload_size);
+      return_result = HSHAKE_ABORT;
+      goto done;
+   }
+   recvd_payload = (ticket_payload_t *) payload;
+
+   if (uid != getuid() || gid != getgid()) {
+      security_error_printf("Received ticket from uid %d and gid %d\n", (int) uid, (int) gid);
+      return_result = HSHAKE_ABORT;
+      goto done;
+   }
+
+   if (recvd_payload->session_id != session_id) {
+      error_printf("Received ticket for another session.  Expected %lu, got %lu\n",
+                   session_id, recvd_payload->session_id);
+      return_result = HSHAKE_DROP_CONNECTION;
+      goto done;
+   }
+
+   if (ticket_cred)
+      free(ticket_cred);
+   ticket_cred = strdup((char *) ticket);
+   memcpy(ticket_secret, recvd_payload->secret, TICKET_SECRET_LEN);
+   ticket_is_mine = 0;
+   debug_printf("Decoded munge ticket\n");
+
+   return_result = 0;
+
+  done:
+   if (payload) {
+      memset(payload, 0, payload_size);
+      free(payload);
+   }
+   if (ctx)
+      munge_ctx_destroy(ctx);
+   return return_result;
+#else
+   error_printf("Handshake not compiled with both munge and gcrypt support\n");
+   return HSHAKE_INTERNAL_ERROR;
+#endif
+}
+
+/* A connection's key is the HMAC of its addresses and session under the ticket's secret */
+static int ticket_edge_key(uint64_t session_id, unsigned char **key, int *key_size)
+{
+#if defined(MUNGE) && defined(GCRYPT)
+   handshake_packet_t edge;
+   int result;
+
+   if (!ticket_cred) {
+      error_printf("No munge ticket to derive a connection key from\n");
+      return HSHAKE_INTERNAL_ERROR;
+   }
+
+   memset(&edge, 0, sizeof(edge));
+   result = encode_packet(&edge, session_id, &saved_conninfo->server_addr, &saved_conninfo->client_addr);
+   if (result < 0) {
+      debug_printf("Error encoding connection for its key\n");
+      return result;
+   }
+
+   gcrypt_init();
+   return get_hash_of_buffer((unsigned char *) &edge, sizeof(edge), ticket_secret, TICKET_SECRET_LEN,
+                             key, key_size);
+#else
+   error_printf("Handshake not compiled with both munge and gcrypt support\n");
+   return HSHAKE_INTERNAL_ERROR;
+#endif
+}
+
+static int ticket_encrypt_packet(handshake_packet_t *packet,
+                                 unsigned char **packet_buffer, size_t *packet_buffer_size)
+{
+   unsigned char *key;
+   int key_size, result;
+
+   result = ticket_edge_key(packet->session_id, &key, &key_size);
+   if (result < 0) {
+      debug_printf("Error deriving connection key while encrypting packet\n");
+      return result;
+   }
+
+   result = key_encrypt_packet(key, key_size, packet, packet_buffer, packet_buffer_size);
+   memset(key, 0, key_size);
+   free(key);
+   return result;
+}
+
+static int ticket_decrypt_packet(handshake_packet_t *expected_packet,
+                                 unsigned char *recvd_buffer, size_t recvd_buffer_size)
+{
+   unsigned char *key;
+   int key_size, result;
+
+   result = ticket_edge_key(expected_packet->session_id, &key, &key_size);
+   if (result < 0) {
+      debug_printf("Error deriving connection key while decrypting packet\n");
+      return result;
+   }
+
+   result = key_decrypt_packet(key, key_size, expected_packet, recvd_buffer, recvd_buffer_size);
+   memset(key, 0, key_size);
+   free(key);
+   return result;
+}
+
 static int compare_packets(handshake_packet_t *expected_packet,
                            handshake_packet_t *recvd_packet)
 {
@@ -1055,9 +1475,9 @@ static int compare_packets(handshake_packet_t *expected_packet,
    return 0;
 }
 
-static int share_result(int fd, int handshake_result)
+static int send_result(int fd, int handshake_result)
 {
-   int32_t result_to_send, peer_result;
+   int32_t result_to_send = HSHAKE_DROP_CONNECTION;
    int result;
 
    switch (handshake_result) {
@@ -1081,7 +1501,14 @@ static int share_result(int fd, int handshake_result)
       error_printf("Failed to send result of connection\n");
       return HSHAKE_INTERNAL_ERROR;
    }
-   
+   return 0;
+}
+
+static int recv_result(int fd)
+{
+   int32_t peer_result;
+   int result;
+
    debug_printf("Reading peer result\n");
    result = reliable_read(fd, &peer_result, sizeof(peer_result));
    if (result != sizeof(peer_result)) {
@@ -1131,7 +1558,7 @@ static int get_client_server_addrs(int sockfd, int i_am_server,
    return 0;
 }
 
-static int exchange_sig(int sockfd) 
+static int send_sig(int sockfd)
 {
    uint32_t sig = SIG;
    int result;
@@ -1142,6 +1569,13 @@ static int exchange_sig(int sockfd)
       debug_printf("Problem writing sig on network\n");
       return HSHAKE_INTERNAL_ERROR;
    }
+   return 0;
+}
+
+static int recv_sig(int sockfd)
+{
+   uint32_t sig;
+   int result;
 
    debug_printf("Receiving sig from network\n");
    result = reliable_read(sockfd, &sig, sizeof(sig));
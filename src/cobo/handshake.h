@@ -36,7 +36,8 @@ typedef enum {
    hs_none,         //No security validation in handshake
    hs_munge,        //Use munge 
    hs_key_in_file,  //Use gcrypt with key from file
-   hs_explicit_key  //Use gcrypt with provided key
+   hs_explicit_key, //Use gcrypt with provided key
+   hs_munge_ticket  //Use one munge credential from the root, and gcrypt keys derived from it
 } handshake_security_t;
 
 typedef struct {
@@ -48,6 +49,9 @@ typedef struct {
       struct {
          //No data needed for munge
       } munge;
+      struct {
+         //No data needed for munge tickets
+      } munge_ticket;
       struct {
          char *key_filepath;
          int key_length_bytes;
@@ -61,6 +65,8 @@ typedef struct {
 
 int spindle_handshake_server(int sockfd, handshake_protocol_t *hdata, uint64_t session_id);
 int spindle_handshake_client(int sockfd, handshake_protocol_t *hdata, uint64_t session_id);
+int spindle_handshake_client_many(int *sockfds, int count, handshake_protocol_t *hdata,
+                                  uint64_t session_id, int *results);
 int spindle_handshake_is_security_type_enabled(handshake_security_t sectype);
 char *spindle_handshake_last_error_str();
 
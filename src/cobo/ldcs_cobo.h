@@ -40,6 +40,10 @@ extern "C" {
 
 #define COBO_SUCCESS (0)
 
+/* value types and operations for cobo_reduce and cobo_allreduce */
+typedef enum { COBO_INT, COBO_INT64, COBO_DOUBLE } cobo_type_t;
+typedef enum { COBO_SUM, COBO_MIN, COBO_MAX } cobo_op_t;
+
 #define COBO_NAMESPACE ldcs
 
 #if defined(COBO_NAMESPACE)
@@ -55,6 +59,9 @@ extern "C" {
 #define cobo_allgather COMBINE(COBO_NAMESPACE, cobo_allgather)
 #define cobo_alltoall  COMBINE(COBO_NAMESPACE, cobo_alltoall )
 #define cobo_allgather_str COMBINE(COBO_NAMESPACE, cobo_allgather_str)
+#define cobo_gatherv COMBINE(COBO_NAMESPACE, cobo_gatherv)
+#define cobo_reduce COMBINE(COBO_NAMESPACE, cobo_reduce)
+#define cobo_allreduce COMBINE(COBO_NAMESPACE, cobo_allreduce)
 #define cobo_server_open COMBINE(COBO_NAMESPACE, cobo_server_open)
 #define cobo_server_close COMBINE(COBO_NAMESPACE, cobo_server_close)
 #define cobo_server_get_root_socket COMBINE(COBO_NAMESPACE, cobo_server_get_root_socket)
@@ -62,7 +69,16 @@ extern "C" {
 #define cobo_get_num_childs COMBINE(COBO_NAMESPACE, cobo_get_num_childs)
 #define cobo_bcast_down COMBINE(COBO_NAMESPACE, cobo_bcast_down)
 #define cobo_get_child_socket COMBINE(COBO_NAMESPACE, cobo_get_child_socket)
+#define cobo_get_root_children COMBINE(COBO_NAMESPACE, cobo_get_root_children)
+#define cobo_is_rack_leader COMBINE(COBO_NAMESPACE, cobo_is_rack_leader)
 #define cobo_set_handshake COMBINE(COBO_NAMESPACE, cobo_set_handshake)
+#define cobo_opt_socket COMBINE(COBO_NAMESPACE, cobo_opt_socket)
+#define cobo_join COMBINE(COBO_NAMESPACE, cobo_join)
+#define cobo_get_listen_socket COMBINE(COBO_NAMESPACE, cobo_get_listen_socket)
+#define cobo_close_listen COMBINE(COBO_NAMESPACE, cobo_close_listen)
+#define cobo_accept_join COMBINE(COBO_NAMESPACE, cobo_accept_join)
+#define cobo_admit_join COMBINE(COBO_NAMESPACE, cobo_admit_join)
+#define cobo_drop_join COMBINE(COBO_NAMESPACE, cobo_drop_join)
 #endif
 
 /*
@@ -106,6 +122,16 @@ int cobo_allgather(void* sendbuf, int sendcount, void* recvbuf);
 /* each task sends N*sendcount bytes from sendbuf and receives N*sendcount bytes into recvbuf */
 int cobo_alltoall (void* sendbuf, int sendcount, void* recvbuf);
 
+/* each task sends its own number of bytes, root receives them back to back in rank order in a
+ * buffer it allocates into recvbuf, and each task's count in recvcounts */
+int cobo_gatherv  (void* sendbuf, int sendcount, void** recvbuf, int* recvcounts, int root);
+
+/* each task sends count values of type, root receives them combined with op into recvbuf */
+int cobo_reduce   (void* sendbuf, void* recvbuf, int count, cobo_type_t type, cobo_op_t op, int root);
+
+/* each task sends count values of type and receives them combined with op into recvbuf */
+int cobo_allreduce(void* sendbuf, void* recvbuf, int count, cobo_type_t type, cobo_op_t op);
+
 /*
  * Perform MPI-like Allgather of NULL-terminated strings (whose lengths may vary
  * from task to task).
@@ -134,8 +160,10 @@ int cobo_allgather_str(char* sendstr, char*** recvstr, char** recvbuf);
  * ==========================================================================
  */
 
-/* given a hostlist and portlist where clients are running, open the tree and assign ranks to clients */
-int cobo_server_open(uint64_t sessionid, char** hostlist, int num_hosts, int* portlist, int num_ports);
+/* given a hostlist and portlist where clients are running, open the tree and assign ranks to clients.
+   With elastic, clients keep listening for ones that join the tree later */
+int cobo_server_open(uint64_t sessionid, char** hostlist, int num_hosts, int* portlist, int num_ports,
+                     int elastic);
 
 /* shut down the tree connections (leaves processes running) */
 int cobo_server_close();
@@ -153,8 +181,36 @@ int cobo_get_num_childs(int* num_childs);
 /* Methods to access child fds */
 int cobo_get_child_socket(int num, int *fd);
 
+/* Ranks of the root's children, computable from any rank */
+int cobo_get_root_children(int *ranks, int max, int *num);
+
+/* Whether we lead our switch's hosts in a rack tree, or in any other tree
+   are the root or one of its children */
+int cobo_is_rack_leader(int *leader);
+
 void cobo_set_handshake(handshake_protocol_t *hs);
 
+/* Apply the tree sockets' TCP options and buffer sizes to another socket */
+int cobo_opt_socket(int sockfd);
+
+/* Join a running tree, as a leaf below the server on one of hosts that
+   takes us, in place of cobo_open */
+int cobo_join(uint64_t sessionid, int* portlist, int num_ports, char** hosts, int num_hosts,
+              int* rank, int* num_ranks);
+
+/* The socket servers that start later join through, if the tree was
+   opened elastic, until it's closed */
+int cobo_get_listen_socket(int* fd);
+int cobo_close_listen();
+
+/* Accept a joining server on the listen socket, unless refuse is set or we
+   have no room, and fill in its socket.  It takes a child slot until it's
+   made our last child as rank with cobo_admit_join, or turned away with
+   cobo_drop_join. */
+int cobo_accept_join(int refuse, int* fd);
+int cobo_admit_join(int fd, int rank);
+int cobo_drop_join(int fd);
+
 void handle_security_error(const char *msg);
 int initialize_handshake_security(handshake_protocol_t *protocol);
 
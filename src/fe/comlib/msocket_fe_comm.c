@@ -20,213 +20,83 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_api.h"
 #include "fe_comm.h"
 #include "config.h"
+#include "ldcs_audit_server_md_msocket.h"
+#include "ldcs_audit_server_md_msocket_util.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
 
-struct ldcs_msocket_fe_data_struct
-{
-  int connid;
-};
-typedef struct ldcs_msocket_fe_data_struct ldcs_msocket_fe_data_t;
-
-/* FRONT END functions */
-int ldcs_audit_server_fe_md_open ( char **hostlist, int hostlistsize, unsigned int port, void **data  ) {
-  int rc=0;
-  int num_ports   = 20;
-  int num_hosts   = -1;
-  int* portlist = malloc(num_ports * sizeof(int));
-  int i, sersize, connid;
-  char *serdata; 
-  ldcs_message_t* msg;
-  ldcs_message_t *in_msg;
-  ldcs_msocket_hostinfo_t hostinfo;  
-  int myerank, esize;
-  int *eportlist;
-  char **ehostlist; 
-  ldcs_msocket_fe_data_t *fe_data;
-  
-  fe_data=(ldcs_msocket_fe_data_t *) malloc(sizeof(ldcs_msocket_fe_data_t));
-  if(!fe_data) _error("could not allocate fe_data");
-
-
-  /* get info about server over external fabric, if available */
-  if(ldcs_msocket_external_fabric_CB_registered) {
-
-      char buffer[MAX_PATH_LEN];
-      rc=gethostname(buffer, MAX_PATH_LEN);
-      if(!strcmp(buffer,"zam371guest")) {
-	strcpy(buffer,"localhost");
-      }
-      ldcs_msocket_external_fabric_CB(buffer, -1, &myerank, &esize, &ehostlist, &eportlist, ldcs_msocket_external_fabric_CB_data);
-      num_hosts=esize;
-  } else {
-
-    num_hosts=hostlistsize;
-    /* build our portlist */
-    for (i=0; i<num_ports; i++) {
-      portlist[i] = 5000 + i;
-    }
-
-  }
-
-  /* connect to first host */
-  if(ldcs_msocket_external_fabric_CB_registered) {
-    connid=ldcs_audit_server_md_msocket_connect(ehostlist[0], eportlist, 1);
-    debug_printf3("after connect connid=%d (E: %s,%d)\n",connid,ehostlist[0], eportlist[0]);
-  } else {
-    connid=ldcs_audit_server_md_msocket_connect(hostlist[0], portlist, num_ports);
-    debug_printf3("after connect connid=%d (D: %s,%d)\n",connid,hostlist[0], portlist[0]);
-  }
-
-  /* message for hostinfo */
-  debug_printf3("send msg hostinfo\n");
-  msg=ldcs_msg_new();
-
-  hostinfo.rank=0;
-  hostinfo.size=num_hosts;
-  hostinfo.depth=0;  hostinfo.cinfo_from=hostinfo.cinfo_to=-1; /* hostinfo.cinfo_dir=-1; */ 
-
-  msg->header.type=LDCS_MSG_MD_HOSTINFO;
-  msg->header.mtype=LDCS_MSG_MTYPE_P2P;
-  msg->header.source=-1;  msg->header.from=-1; 
-  msg->header.dest=0;   
-  msg->header.len=sizeof(hostinfo);
-  msg->alloclen=sizeof(hostinfo);
-  msg->data=(char *) &hostinfo;
-
-  ldcs_send_msg_socket(connid,msg);
-
-  if(!ldcs_msocket_external_fabric_CB_registered) {
-
-    debug_printf3("processing hostlist of size %d\n",hostlistsize);
-    ldcs_audit_server_md_msocket_serialize_hostlist(hostlist, hostlistsize, &serdata, &sersize);
-    debug_printf3("serialized hostlist has size %d\n",sersize);
-    
-    /* message for hostlist */
-    msg->header.type=LDCS_MSG_MD_HOSTLIST;
-    msg->header.mtype=LDCS_MSG_MTYPE_P2P;
-    msg->header.len=sersize;
-    msg->alloclen=sersize;
-    msg->data=serdata;
-
-    /* sent message to first host */
-    debug_printf3("send msg hostlist\n");
-    ldcs_send_msg_socket(connid,msg);
-  }
-
-  /* message for start of bootstrap */
-  msg->header.type=LDCS_MSG_MD_BOOTSTRAP;
-  msg->header.mtype=LDCS_MSG_MTYPE_P2P;
-  msg->header.len=0;
-  msg->alloclen=0;
-  msg->data=NULL;
-
-  /* sent message to first host */
-  debug_printf3("send msg bootstrap\n");
-  ldcs_send_msg_socket(connid,msg);
-
-  /* message for ending bootstrap */
-  msg->header.type=LDCS_MSG_MD_BOOTSTRAP_END;
-  msg->header.mtype=LDCS_MSG_MTYPE_BCAST;
-  msg->header.source=-1;  msg->header.from=-1;   msg->header.dest=-1;   
-  msg->header.len=0;
-  msg->alloclen=0;
-  msg->data=NULL;
-
-  /* sent message to first host */
-  debug_printf3("send msg bootstrap end\n");
-  ldcs_send_msg_socket(connid,msg);
-
-
-  /* receive msg from root node whether bootstrap ended  */
-  in_msg=ldcs_recv_msg_socket(connid, LDCS_READ_BLOCK);
-  if(in_msg->header.type==LDCS_MSG_MD_BOOTSTRAP_END_OK) {
-    fprintf(stderr, "SERVERFE: bootstrap  --> successful\n");
-  } else {
-    fprintf(stderr, "SERVERFE: bootstrap  --> not successful\n");
-  }
-  ldcs_msg_free(&in_msg);
-
-  fe_data->connid=connid;
-  *data=fe_data;
-
-  return(rc);
+static int root_fd = -1;
+static handshake_protocol_t msocket_handshake;
 
+/* Set by initialize_handshake_security in cobo_handshake.c */
+void cobo_set_handshake(handshake_protocol_t *hs)
+{
+   msocket_handshake = *hs;
 }
 
-int ldcs_audit_server_fe_md_preload ( char *filename, void *data  ) {
-  int rc=0;
-  char buffer[MAX_PATH_LEN];
-  ldcs_msocket_fe_data_t *fe_data=(ldcs_msocket_fe_data_t *) data;
-  FILE * fp;
-  char * line = NULL, *p;
-  size_t len = 0;
-  ssize_t read;
-  ldcs_message_t out_msg;
-  ldcs_message_t *in_msg;
-  
-  fprintf(stderr,"SERVERFE: open file for list of library for preload: '%s'\n",filename); 
-  fp = fopen(filename, "r");  
-  if (fp == NULL)  {
-    fprintf(stderr,"SPINDLE FE: preloadfile not found: '%s' ... skipping \n",filename); 
-    return(rc);
-  }
-
-  out_msg.header.type=LDCS_MSG_PRELOAD_FILE;
-  out_msg.alloclen=MAX_PATH_LEN;  out_msg.data=buffer;
-
-  while( (read = getline(&line, &len, fp)) >= 0) {
-    
-    if( (p=strchr(line,'\n')) ) *p='\0';
-    if( (p=strchr(line,' ')) ) *p='\0';
-    strcpy(buffer,line);
-
-    fprintf(stderr,"SERVERFE: found library for preload: '%s'\n",line); 
-    if( buffer[0]=='#') continue;
-
-    if ( strlen(buffer)==0 ) {
-      fprintf(stderr,"SERVERFE: unknown line: '%s'\n",buffer);
-      continue;
-    }
-    out_msg.header.len=strlen(buffer)+1;
-    
-    debug_printf3("SERVERFE: sent preload msg(%s)  to tree root connid=%d\n",out_msg.data, fe_data->connid);
-    ldcs_send_msg_socket(fe_data->connid,&out_msg);
-    
-    fprintf(stderr, "SERVERFE: sent preload msg(%s)  to tree root\n",out_msg.data);
-
-    /* receive msg from root node */
-    in_msg=ldcs_recv_msg_socket(fe_data->connid, LDCS_READ_BLOCK);
-    if(in_msg->header.type==LDCS_MSG_PRELOAD_FILE_OK) {
-      fprintf(stderr, "SERVERFE:   --> successful\n");
-    } else {
-      fprintf(stderr, "SERVERFE:   --> not successful\n");
-    }
-    ldcs_msg_free(&in_msg);
-    
-  }
-  fclose(fp);
-  if (line) free(line);
-
-  return(rc);
+int ldcs_audit_server_fe_md_open ( char **hostlist, int numhosts, unsigned int port, unsigned int num_ports,
+                                   unique_id_t unique_id, int elastic,
+                                   void **data  ) {
+   unsigned int *portlist;
+   int i, ready = 0, hostlist_size;
+   char *hostlist_data;
+   ldcs_msocket_hostinfo_t hostinfo;
+
+   assert(num_ports >= 1);
+   portlist = malloc(sizeof(unsigned int) * num_ports);
+   for (i = 0; i < num_ports; i++) {
+      portlist[i] = port + i;
+   }
+
+   debug_printf2("Opening msocket with port %d - %d\n", portlist[0], portlist[num_ports-1]);
+   root_fd = ldcs_audit_server_md_msocket_connect(hostlist[0], portlist, num_ports, &msocket_handshake, unique_id);
+   free(portlist);
+   if (root_fd == -1) {
+      err_printf("Could not connect to the server on %s\n", hostlist[0]);
+      return -1;
+   }
+
+   /* The root chooses the tree's shape, the same way on every server */
+   if (ldcs_audit_server_md_msocket_serialize_hostlist(hostlist, numhosts, &hostlist_data, &hostlist_size) == -1)
+      return -1;
+   hostinfo.rank = 0;
+   hostinfo.size = numhosts;
+   hostinfo.topo = LDCS_TOPO_TYPE_UNKNOWN;
+   hostinfo.fanout = 0;
+   hostinfo.hostlist_size = hostlist_size;
+   if (ldcs_audit_server_md_msocket_send_hostinfo(root_fd, &hostinfo, hostlist_data) == -1) {
+      err_printf("Could not send the hostlist to the server on %s\n", hostlist[0]);
+      free(hostlist_data);
+      return -1;
+   }
+   free(hostlist_data);
+
+   ldcs_cobo_read_fd(root_fd, &ready, sizeof(ready));
+   if (ready != LDCS_MSOCKET_READY) {
+      err_printf("Servers did not finish connecting their tree\n");
+      return -1;
+   }
+   return 0;
 }
 
 int ldcs_audit_server_fe_md_close ( void *data  ) {
-  int rc=0;
-
-#if 0
-  int root_fd, ack;
-
-  cobo_server_get_root_socket(&root_fd);
   
-  ldcs_cobo_read_fd(root_fd, &ack, sizeof(ack));
-  printf("server_rsh_ldcs: got ack=%d from tree root\n",ack);
-  
-  ack=15;
-  ldcs_cobo_write_fd(root_fd, &ack, sizeof(ack));
-  printf("server_rsh_ldcs: sent ack=%d to tree root\n",ack);
+   ldcs_message_t out_msg;
+
+   debug_printf("Sending exit message to daemons\n");
+   out_msg.header.type = LDCS_MSG_EXIT;
+   out_msg.header.len = 0;
+   out_msg.data = NULL;
 
-  /* open and close the server */
-  cobo_server_close();
-#endif
+   write_msg(root_fd, &out_msg);
+   close(root_fd);
+   root_fd = -1;
+   return 0;
+}
 
-  return(rc);
+int ldcs_audit_server_fe_broadcast(ldcs_message_t *msg, void *data)
+{
+   debug_printf("Broadcasting message to daemons\n");
+   return write_msg(root_fd, msg);
 }
@@ -593,6 +593,13 @@ HostbinLauncher::~HostbinLauncher()
    HostbinLauncher::hlauncher = NULL;
 }
 
+/**
+ * Nothing to spawn here.  setupJob puts the daemon's command line on
+ * each application process's spindle_bootstrap, and the first of them
+ * on a node starts that node's daemon.  Daemons so come up on all nodes
+ * at once as the launcher starts the job, and the hostbin only has to
+ * name the hosts.
+ **/
 bool HostbinLauncher::spawnDaemon()
 {
    return true;
@@ -213,8 +213,9 @@ int LMonLauncher::packfebe_cb(void *udata, void *msgbuf,
 
    spindle_args_t *args = (spindle_args_t *) udata;
    unsigned int send_env = push_env ? 1 : 0;
+   unsigned int release_early = (args->opts & OPT_EARLYLAUNCH) ? 1 : 0;
 
-   *msgbuflen = sizeof(unsigned int) * 3;
+   *msgbuflen = sizeof(unsigned int) * 4;
    *msgbuflen += sizeof(unique_id_t);
    assert(*msgbuflen < msgbufmax);
    
@@ -226,6 +227,8 @@ int LMonLauncher::packfebe_cb(void *udata, void *msgbuf,
    pos += sizeof(args->num_ports);
    memcpy(buffer + pos, &send_env, sizeof(send_env));
    pos += sizeof(send_env);
+   memcpy(buffer + pos, &release_early, sizeof(release_early));
+   pos += sizeof(release_early);
    memcpy(buffer + pos, &args->unique_id, sizeof(args->unique_id));
    pos += sizeof(args->unique_id);
 
@@ -0,0 +1,206 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "launcher.h"
+#include "spindle_debug.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <map>
+#include <set>
+#include <cassert>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * Starts the servers with OpenMPI's mpirun, one per node.  This works
+ * with PRRTE in OpenMPI 5, which dropped the MPIR symbols the LaunchMON
+ * intercept relies on, as well as with ORTE.  The host list comes from
+ * PRRTE's own mapping of one process per node, so the servers land on
+ * the nodes mpirun maps the job to.
+ **/
+class OpenMPILauncher : public ForkLauncher
+{
+   friend Launcher *createOpenMPILauncher(spindle_args_t *params);
+private:
+   int nnodes;
+   bool initError;
+   vector<char *> hostlist;
+   static OpenMPILauncher *olauncher;
+protected:
+   virtual bool spawnDaemon();
+   virtual bool spawnJob(app_id_t id, int app_argc, char **app_argv);
+public:
+   OpenMPILauncher(spindle_args_t *params_);
+   virtual ~OpenMPILauncher();
+   virtual const char **getProcessTable();
+   virtual const char *getDaemonArg();
+   virtual void getSecondaryDaemonArgs(vector<const char *> &secondary_args);
+};
+
+OpenMPILauncher *OpenMPILauncher::olauncher = NULL;
+
+Launcher *createOpenMPILauncher(spindle_args_t *params)
+{
+   assert(!OpenMPILauncher::olauncher);
+   OpenMPILauncher::olauncher = new OpenMPILauncher(params);
+   if (OpenMPILauncher::olauncher->initError)
+      delete OpenMPILauncher::olauncher;
+   return OpenMPILauncher::olauncher;
+}
+
+OpenMPILauncher::OpenMPILauncher(spindle_args_t *params_) :
+   ForkLauncher(params_),
+   nnodes(0),
+   initError(false)
+{
+   const char *cmd = "mpirun --map-by ppr:1:node hostname";
+   FILE *f = popen(cmd, "r");
+   if (!f) {
+      int error = errno;
+      err_printf("Failed to popen mpirun: %s\n", strerror(error));
+      initError = true;
+      return;
+   }
+
+   set<string> seen;
+   while (!feof(f)) {
+      char *hostname = NULL;
+      fscanf(f, "%ms", &hostname);
+      if (hostname && *hostname && seen.insert(hostname).second)
+         hostlist.push_back(hostname);
+      else
+         free(hostname);
+   }
+   int result = pclose(f);
+   if (result != 0 || hostlist.empty()) {
+      int error = errno;
+      fprintf(stderr, "Spindle encountered an error fetching the hostlist from OpenMPI. "
+              "We tried to run the command:\n  %s\n", cmd);
+      err_printf("mpirun returned %d: %s\n", result, strerror(error));
+      initError = true;
+      return;
+   }
+   nnodes = hostlist.size();
+}
+
+OpenMPILauncher::~OpenMPILauncher()
+{
+   olauncher = NULL;
+}
+
+bool OpenMPILauncher::spawnDaemon()
+{
+   daemon_pid = fork();
+   if (daemon_pid == -1) {
+      err_printf("Failed to fork process for daemon: %s\n", strerror(errno));
+      return false;
+   }
+   else if (daemon_pid == 0) {
+      int total_args = 10 + daemon_argc;
+      char **new_daemon_args = (char **) malloc(total_args * sizeof(char *));
+      int i = 0;
+      char count_buffer[64];
+      snprintf(count_buffer, 64, "%d", nnodes);
+      new_daemon_args[i++] = const_cast<char *>("mpirun");
+      new_daemon_args[i++] = const_cast<char *>("--map-by");
+      new_daemon_args[i++] = const_cast<char *>("ppr:1:node");
+      new_daemon_args[i++] = const_cast<char *>("--bind-to");
+      new_daemon_args[i++] = const_cast<char *>("none");
+      new_daemon_args[i++] = const_cast<char *>("-n");
+      new_daemon_args[i++] = count_buffer;
+      for (int j = 0; j < daemon_argc; j++)
+         new_daemon_args[i++] = daemon_argv[j];
+      new_daemon_args[i++] = NULL;
+      assert(i <= total_args);
+      debug_printf("Execing daemon in pid %d with command line: ", getpid());
+      for (i = 0; new_daemon_args[i]; i++) {
+         bare_printf("%s ", new_daemon_args[i]);
+      }
+      bare_printf("\n");
+
+      execvp(new_daemon_args[0], new_daemon_args);
+
+      int error = errno;
+      err_printf("Could not exec mpirun of daemon: %s\n", strerror(error));
+      fprintf(stderr, "Error launching spindle daemon via mpirun: %s\n", strerror(error));
+      fprintf(stderr, "Attempted command line was: ");
+      for (i = 0; new_daemon_args[i]; i++) {
+         fprintf(stderr, "%s ", new_daemon_args[i]);
+      }
+      fprintf(stderr, "\n");
+      exit(-1);
+   }
+
+   return true;
+}
+
+bool OpenMPILauncher::spawnJob(app_id_t id, int app_argc, char **app_argv)
+{
+   debug_printf("Spindle launching OpenMPI job with app-id %lu: %s\n", id, app_argv[0]);
+   int pid = fork();
+   if (pid == -1) {
+      int error = errno;
+      err_printf("Failed to fork process for mpirun: %s\n", strerror(error));
+      return false;
+   }
+   else if (pid == 0) {
+      execvp(*app_argv, app_argv);
+      int error = errno;
+      fprintf(stderr, "Spindle failed to run %s: %s\n", app_argv[0], strerror(error));
+      err_printf("Failed to run application %s: %s\n", app_argv[0], strerror(error));
+      exit(-1);
+   }
+   app_pids[pid] = id;
+   return true;
+}
+
+const char **OpenMPILauncher::getProcessTable()
+{
+   //Keep the launcher's order, which keeps numbered hosts in runs that
+   //cobo sends as ranges
+   char **proctable = (char **) malloc(sizeof(char*) * (hostlist.size()+1));
+   int j = 0;
+   for (vector<char *>::iterator i = hostlist.begin(); i != hostlist.end(); i++, j++) {
+      proctable[j] = *i;
+      debug_printf2("Adding host %s to proctable[%d]\n", proctable[j], j);
+   }
+   proctable[j] = NULL;
+   return const_cast<const char **>(proctable);
+}
+
+const char *OpenMPILauncher::getDaemonArg()
+{
+   return "--spindle_mpi";
+}
+
+void OpenMPILauncher::getSecondaryDaemonArgs(vector<const char *> &secondary_args)
+{
+   char port_str[32], ss_str[32], port_num_str[32];
+   snprintf(port_str, 32, "%d", params->port);
+   snprintf(port_num_str, 32, "%d", params->num_ports);
+   snprintf(ss_str, 32, "%lu", params->unique_id);
+   secondary_args.push_back(strdup(port_str));
+   secondary_args.push_back(strdup(port_num_str));
+   secondary_args.push_back(strdup(ss_str));
+}
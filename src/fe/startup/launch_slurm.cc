@@ -38,7 +38,7 @@ class SlurmLauncher : public ForkLauncher
 private:
    int nnodes;
    bool initError;
-   set<char *> hostset;
+   vector<char *> hostlist;
    static SlurmLauncher *slauncher;
 protected:
    virtual bool spawnDaemon();
@@ -113,7 +113,7 @@ SlurmLauncher::SlurmLauncher(spindle_args_t *params_) :
       char *hostname = NULL;
       fscanf(f, "%ms", &hostname);
       if (hostname && *hostname)
-         hostset.insert(hostname);
+         hostlist.push_back(hostname);
    }
    int result = pclose(f);
    if (result != 0) {
@@ -199,21 +199,17 @@ bool SlurmLauncher::spawnJob(app_id_t id, int app_argc, char **app_argv)
    return true;
 }
 
-static int cmpstr(const void *a, const void *b)
-{
-   return strcmp(*(const char **) a, *(const char **) b);
-}
-
 const char **SlurmLauncher::getProcessTable()
 {
-   char **proctable = (char **) malloc(sizeof(char*) * (hostset.size()+1));
+   //Keep the launcher's order, which keeps numbered hosts in runs that
+   //cobo sends as ranges
+   char **proctable = (char **) malloc(sizeof(char*) * (hostlist.size()+1));
    int j = 0;
-   for (set<char *>::iterator i = hostset.begin(); i != hostset.end(); i++, j++) {
+   for (vector<char *>::iterator i = hostlist.begin(); i != hostlist.end(); i++, j++) {
       proctable[j] = *i;
       debug_printf2("Adding host %s to proctable[%d]\n", proctable[j], j);
    }
    proctable[j] = NULL;
-   qsort(proctable, j, sizeof(char *), cmpstr);
    return const_cast<const char **>(proctable);
 }
 
@@ -72,6 +72,8 @@ bool Launcher::setupJob(app_id_t id, int &app_argc, char** &app_argv)
    char **mod_argv;
 
    ModifyArgv modargv(app_argc, app_argv, daemon_argc, daemon_argv, params);
+   if (params->opts & OPT_SESSION)
+      modargv.setStep(id);
    if (!modargv.getNewArgv(mod_argc, mod_argv))
       return false;
 
@@ -107,6 +109,7 @@ bool Launcher::setupDaemons()
       STR_CASE(OPT_SEC_KEYLMON);
       STR_CASE(OPT_SEC_KEYFILE);
       STR_CASE(OPT_SEC_NULL);
+      STR_CASE(OPT_SEC_MUNGETICKET);
    }
 
    char number_s[32];
@@ -199,6 +202,8 @@ bool ForkLauncher::getReturnCodes(bool &daemon_done, int &daemon_ret,
 }
 
 extern Launcher *createSlurmLauncher(spindle_args_t *params);
+extern Launcher *createFluxLauncher(spindle_args_t *params);
+extern Launcher *createOpenMPILauncher(spindle_args_t *params);
 
 Launcher *createMPILauncher(spindle_args_t *params)
 {
@@ -216,7 +221,10 @@ Launcher *createMPILauncher(spindle_args_t *params)
    switch (launcher) {
       case srun_launcher:
          return createSlurmLauncher(params);
+      case flux_launcher:
+         return createFluxLauncher(params);
       case openmpi_launcher:
+         return createOpenMPILauncher(params);
       case wreckrun_launcher:
          err_printf("Unsupported launcher %d\n", launcher);
          fprintf(stderr, "Error: Spindle does not yet support this job launcher\n");
@@ -45,10 +45,12 @@ extern bool setOpenMPIInterceptEnv(string launcher_rel);
 char libstr_socket_subaudit[] = PROGLIBDIR "/libspindle_subaudit_socket.so";
 char libstr_pipe_subaudit[] = PROGLIBDIR "/libspindle_subaudit_pipe.so";
 char libstr_biter_subaudit[] = PROGLIBDIR "/libspindle_subaudit_biter.so";
+char libstr_shmem_subaudit[] = PROGLIBDIR "/libspindle_subaudit_shmem.so";
 
 char libstr_socket_audit[] = PROGLIBDIR "/libspindle_audit_socket.so";
 char libstr_pipe_audit[] = PROGLIBDIR "/libspindle_audit_pipe.so";
 char libstr_biter_audit[] = PROGLIBDIR "/libspindle_audit_biter.so";
+char libstr_shmem_audit[] = PROGLIBDIR "/libspindle_audit_shmem.so";
 
 char libstr_intercept_lib[] = PROGLIBDIR "/libspindleint.so";
 #if defined(COMM_SOCKET)
@@ -60,6 +62,9 @@ static char *default_subaudit_libstr = libstr_pipe_subaudit;
 #elif defined(COMM_BITER)
 static char *default_audit_libstr = libstr_biter_audit;
 static char *default_subaudit_libstr = libstr_biter_subaudit;
+#elif defined(COMM_SHMEM)
+static char *default_audit_libstr = libstr_shmem_audit;
+static char *default_subaudit_libstr = libstr_shmem_subaudit;
 #else
 #error Unknown connection type
 #endif
@@ -68,6 +73,7 @@ SRunParser *srunparser;
 SerialParser *serialparser;
 OpenMPIParser *openmpiparser;
 WreckRunParser *wreckrunparser;
+FluxParser *fluxparser;
 MarkerParser *markerparser;
 
 unsigned int default_launchers_enabled = 0
@@ -79,6 +85,9 @@ unsigned int default_launchers_enabled = 0
 #endif
 #if defined(ENABLE_WRECKRUN_LAUNCHER)
    | wreckrun_launcher
+#endif
+#if defined(ENABLE_FLUX_LAUNCHER)
+   | flux_launcher
 #endif
    | marker_launcher;
 
@@ -187,8 +196,14 @@ ModifyArgv::ModifyArgv(int argc_, char **argv_,
    daemon_argc(daemon_argc_),
    daemon_argv(daemon_argv_),
    params(params_),
-   parser(NULL)
+   parser(NULL),
+   step(0)
+{
+}
+
+void ModifyArgv::setStep(unsigned long step_)
 {
+   step = step_;
 }
 
 bool ModifyArgv::chooseParser()
@@ -293,6 +308,9 @@ void ModifyArgv::modifyCmdLine()
    char daemon_argc_str[32];
    snprintf(daemon_argc_str, 32, "%u", daemon_argc);
 
+   char step_str[32];
+   snprintf(step_str, 32, "%lu", step);
+
    char shm_cache_size_str[32];
    snprintf(shm_cache_size_str, 32, "%u", params->shm_cache_size);
    string shmcache_size(shm_cache_size_str);
@@ -300,7 +318,7 @@ void ModifyArgv::modifyCmdLine()
    const char *default_libstr = params->opts & OPT_SUBAUDIT ? default_subaudit_libstr : default_audit_libstr;
    const char *intercept_libstr = params->opts & OPT_SUBAUDIT ? libstr_intercept_lib : "";
 
-   int new_argv_size = argc + 9 + daemon_argc;
+   int new_argv_size = argc + 13 + daemon_argc;
    new_argv = (char **) malloc(sizeof(char *) * new_argv_size);
    
    int n = 0;
@@ -324,6 +342,10 @@ void ModifyArgv::modifyCmdLine()
                new_argv[n++] = strdup(daemon_argv[k]);
             }
          }
+         if (step) {
+            new_argv[n++] = strdup("-step");
+            new_argv[n++] = strdup(step_str);
+         }
          for (int i = 1; i < a_argc; i++) 
             new_argv[n++] = a_argv[i];
          (void) default_libstr; (void) intercept_libstr; //Not needed on linux
@@ -39,6 +39,7 @@ class ModifyArgv {
    char **daemon_argv;
    spindle_args_t *params;
    CmdLineParser *parser;
+   unsigned long step;
    
    void print_err(std::string str);
    bool autodetectParser();
@@ -50,6 +51,8 @@ class ModifyArgv {
               int daemon_argc, char **daemon_argv,
               spindle_args_t *params);
    bool getNewArgv(int &newargc, char** &newargv);
+   /* Tag the processes as belonging to session step step */
+   void setStep(unsigned long step_);
 };
 
 /**
@@ -96,6 +99,7 @@ class SRunParser : public LauncherParser
 };
 
 typedef LauncherParser WreckRunParser;
+typedef LauncherParser FluxParser;
 class SerialParser : public LauncherParser
 {
   public:
@@ -131,6 +135,7 @@ extern SRunParser *srunparser;
 extern SerialParser *serialparser;
 extern OpenMPIParser *openmpiparser;
 extern WreckRunParser *wreckrunparser;
+extern FluxParser *fluxparser;
 extern MarkerParser *markerparser;
 
 void initParsers(int parsers_enabled, std::set<LauncherParser *> &all_parsers);
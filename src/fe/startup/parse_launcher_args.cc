@@ -35,8 +35,10 @@ static cmdoption_t openmpi_options[] = {
    { "mpiexec", NULL,                FL_LAUNCHER },
    { "mpirun", NULL,                 FL_LAUNCHER },
    { "orterun", NULL,                FL_LAUNCHER },
+   { "prterun", NULL,                FL_LAUNCHER },
    { "-am", NULL,                    FL_PARAM },
    { "--app", NULL,                  FL_CUSTOM_OPTION },
+   { "-bind-to", NULL,               FL_OPTIONAL_DASH | FL_PARAM },
    { "-bind-to-board", NULL,         FL_OPTIONAL_DASH },
    { "-bind-to-core", NULL,          FL_OPTIONAL_DASH },
    { "-bind-to-none", NULL,          FL_OPTIONAL_DASH },
@@ -59,6 +61,7 @@ static cmdoption_t openmpi_options[] = {
    { "-debug-daemons-file", NULL,    FL_OPTIONAL_DASH },
    { "-debugger", NULL,              FL_OPTIONAL_DASH | FL_PARAM },
    { "-default-hostfile", NULL,      FL_OPTIONAL_DASH | FL_PARAM },
+   { "-display", NULL,               FL_OPTIONAL_DASH | FL_PARAM },
    { "-display-allocation", NULL,    FL_OPTIONAL_DASH },
    { "-display-devel-allocation", NULL, FL_OPTIONAL_DASH },
    { "-display-devel-map", NULL,     FL_OPTIONAL_DASH },
@@ -75,6 +78,7 @@ static cmdoption_t openmpi_options[] = {
    { "-leave-session-attached", NULL,FL_OPTIONAL_DASH },
    { "-loadbalance", NULL,           FL_OPTIONAL_DASH },
    { "-machinefile", NULL,           FL_OPTIONAL_DASH | FL_PARAM },
+   { "-map-by", NULL,                FL_OPTIONAL_DASH | FL_PARAM },
    { "-mca", NULL,                   FL_OPTIONAL_DASH | FL_PARAM2 },
    { "-n", NULL,                     FL_OPTIONAL_DASH | FL_PARAM },
    { "-nolocal", NULL,               FL_OPTIONAL_DASH },
@@ -88,6 +92,7 @@ static cmdoption_t openmpi_options[] = {
    { "-num-sockets", NULL,           FL_OPTIONAL_DASH | FL_PARAM },
    { "-ompi-server", NULL,           FL_OPTIONAL_DASH | FL_PARAM },
    { "-output-filename", NULL,       FL_OPTIONAL_DASH | FL_PARAM },
+   { "-output", NULL,                FL_OPTIONAL_DASH | FL_PARAM },
    { "-path", NULL,                  FL_OPTIONAL_DASH | FL_PARAM | FL_EXEDIR },
    { "-pernode", NULL,               FL_OPTIONAL_DASH },
    { "--prefix", NULL,               FL_PARAM },
@@ -103,6 +108,10 @@ static cmdoption_t openmpi_options[] = {
    { "--rankfile", NULL,             FL_PARAM },
    { "-s", NULL,                     0 },
    { "--preload-binary", NULL,       0 },
+   { "-pmixmca", NULL,               FL_OPTIONAL_DASH | FL_PARAM2 },
+   { "-prtemca", NULL,               FL_OPTIONAL_DASH | FL_PARAM2 },
+   { "-rank-by", NULL,               FL_OPTIONAL_DASH | FL_PARAM },
+   { "-runtime-options", NULL,       FL_OPTIONAL_DASH | FL_PARAM },
    { "-server-wait-time", NULL,      FL_OPTIONAL_DASH | FL_PARAM },
    { "-show-progress", NULL,         FL_OPTIONAL_DASH },
    { "-slot-list", NULL,             FL_OPTIONAL_DASH | FL_PARAM },
@@ -232,6 +241,46 @@ static cmdoption_t wreckrun_options[] = {
 static const char *wreck_bg_env_str = "";
 static const unsigned int wreckrun_size = (sizeof(wreckrun_options) / sizeof(cmdoption_t));
 
+static cmdoption_t flux_options[] = {
+   { "flux", NULL,                   FL_LAUNCHER },
+   { "run", NULL,                    0 },
+   { "-B",   "--bank",               FL_GNU_PARAM },
+   { NULL,   "--begin-time",         FL_GNU_PARAM },
+   { "-c",   "--cores-per-task",     FL_GNU_PARAM },
+   { NULL,   "--cwd",                FL_GNU_PARAM | FL_EXEDIR },
+   { NULL,   "--debug",              0 },
+   { NULL,   "--dependency",         FL_GNU_PARAM },
+   { NULL,   "--dry-run",            0 },
+   { NULL,   "--env",                FL_GNU_PARAM },
+   { NULL,   "--env-file",           FL_GNU_PARAM },
+   { NULL,   "--env-remove",         FL_GNU_PARAM },
+   { NULL,   "--error",              FL_GNU_PARAM },
+   { "-x",   "--exclusive",          0 },
+   { NULL,   "--flags",              FL_GNU_PARAM },
+   { "-g",   "--gpus-per-task",      FL_GNU_PARAM },
+   { NULL,   "--gpus-per-node",      FL_GNU_PARAM },
+   { "-h",   "--help",               0 },
+   { NULL,   "--input",              FL_GNU_PARAM },
+   { NULL,   "--job-name",           FL_GNU_PARAM },
+   { "-l",   "--label-io",           0 },
+   { "-N",   "--nodes",              FL_GNU_PARAM },
+   { "-n",   "--ntasks",             FL_GNU_PARAM },
+   { NULL,   "--output",             FL_GNU_PARAM },
+   { "-q",   "--queue",              FL_GNU_PARAM },
+   { NULL,   "--requires",           FL_GNU_PARAM },
+   { "-S",   "--setattr",            FL_GNU_PARAM },
+   { "-o",   "--setopt",             FL_GNU_PARAM },
+   { NULL,   "--tasks-per-core",     FL_GNU_PARAM },
+   { NULL,   "--tasks-per-node",     FL_GNU_PARAM },
+   { "-t",   "--time-limit",         FL_GNU_PARAM },
+   { "-u",   "--unbuffered",         0 },
+   { NULL,   "--urgency",            FL_GNU_PARAM },
+   { "-v",   "--verbose",            0 },
+   { NULL,   "--wait-event",         FL_GNU_PARAM }
+};
+static const char *flux_bg_env_str = "";
+static const unsigned int flux_size = (sizeof(flux_options) / sizeof(cmdoption_t));
+
 static cmdoption_t marker_options[] = {
    { NULL, NULL, 0 }
 };
@@ -675,6 +724,11 @@ void initParsers(int parsers_enabled, set<LauncherParser *> &all_parsers)
          wreckrunparser = new WreckRunParser(wreckrun_options, wreckrun_size, wreck_bg_env_str, "wreckrun", wreckrun_launcher);
       all_parsers.insert(wreckrunparser);
    }
+   if (parsers_enabled & flux_launcher) {
+      if (!fluxparser)
+         fluxparser = new FluxParser(flux_options, flux_size, flux_bg_env_str, "flux", flux_launcher);
+      all_parsers.insert(fluxparser);
+   }
    if (parsers_enabled & marker_launcher) {
       if (!markerparser)
          markerparser = new MarkerParser(marker_options, marker_size, marker_bg_env_str, "marker", marker_launcher);
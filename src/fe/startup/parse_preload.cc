@@ -17,10 +17,16 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <cstdio>
 #include <cstring>
 #include <set>
+#include <vector>
 #include <string>
 #include <cerrno>
 #include <cstdlib>
 #include <cassert>
+#include <algorithm>
+
+#include <glob.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "parse_preload.h"
 #include "pathfn.h"
@@ -34,43 +40,155 @@ using namespace std;
 #define STR2(X) #X
 #define STR(X) STR2(X)
 
-ldcs_message_t *parsePreloadFile(string filename)
+typedef struct {
+   char cwd[MAX_PATH_LEN+1];
+   set<string> seen;
+   vector<string> all_dirs, all_files;
+} preload_list_t;
+
+static void addPreloadPath(preload_list_t &list, const char *path)
 {
-   char pathname[MAX_PATH_LEN+1], cwd[MAX_PATH_LEN+1], dir[MAX_PATH_LEN+1], file[MAX_PATH_LEN+1];
-   set<string> all_dirs, all_files;
-
-   debug_printf("Parsing preload file: %s\n", filename.c_str());
-   FILE *f = fopen(filename.c_str(), "r");
-   if (!f) {
-      err_printf("Error opening preload file %s: %s\n", filename.c_str(), strerror(errno));
-      return NULL;
+   char pathname[MAX_PATH_LEN+1], dir[MAX_PATH_LEN+1], file[MAX_PATH_LEN+1];
+   size_t len;
+
+   strncpy(pathname, path, MAX_PATH_LEN+1);
+   pathname[MAX_PATH_LEN] = '\0';
+   len = strlen(pathname);
+   if (len > 1 && pathname[len-1] == '/') {
+      pathname[len-1] = '\0';
+      canonicalizeDir(list.cwd, pathname, len-1, dir, MAX_PATH_LEN);
+      file[0] = '\0';
    }
+   else
+      canonicalizePath(list.cwd, pathname, file, dir, MAX_PATH_LEN);
+
+   string dirstr(dir);
+   if (list.seen.insert(dirstr + "/").second)
+      list.all_dirs.push_back(dirstr);
+   if (!file[0])
+      return;
+   string filestr = dirstr + string("/") + string(file);
+   if (list.seen.insert(filestr).second)
+      list.all_files.push_back(filestr);
+}
 
-   getcwd(cwd, MAX_PATH_LEN+1);
-   cwd[MAX_PATH_LEN] = '\0';
-
-   for (;;) {
-      int result = fscanf(f, "%" STR(MAX_PATH_LEN) "s", pathname);
-      if (result == EOF)
-         break;
-      pathname[MAX_PATH_LEN] = '\0';
-      
-      parseFilenameNoAlloc(pathname, file, dir, MAX_PATH_LEN);
-      file[MAX_PATH_LEN] = '\0';
-      dir[MAX_PATH_LEN] = '\0';
-      addCWDToDir(cwd, dir, MAX_PATH_LEN);
-      reducePath(dir);
-   
-      all_dirs.insert(string(dir));
-      all_files.insert(string(dir) + string("/") + string(file));      
+/**
+ * Add the listing of dir and of every directory under it, and every file
+ * under it.  Symbolic links to directories aren't followed.
+ **/
+static void addPreloadTree(preload_list_t &list, string dir)
+{
+   vector<string> names;
+   struct stat buf;
+
+   DIR *d = opendir(dir.c_str());
+   if (!d) {
+      err_printf("Could not open preload directory %s: %s\n", dir.c_str(), strerror(errno));
+      return;
+   }
+   for (struct dirent *ent = readdir(d); ent; ent = readdir(d)) {
+      if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+         continue;
+      names.push_back(ent->d_name);
+   }
+   closedir(d);
+   sort(names.begin(), names.end());
+
+   addPreloadPath(list, (dir + "/").c_str());
+   for (vector<string>::iterator i = names.begin(); i != names.end(); i++) {
+      string path = dir + "/" + *i;
+      if (lstat(path.c_str(), &buf) == -1)
+         continue;
+      if (S_ISDIR(buf.st_mode))
+         addPreloadTree(list, path);
+      else if (stat(path.c_str(), &buf) == 0 && S_ISREG(buf.st_mode))
+         addPreloadPath(list, path.c_str());
+   }
+}
+
+static void addPreloadEntry(preload_list_t &list, char *pathname)
+{
+   size_t len = strlen(pathname);
+   int result;
+
+   if (len > 3 && strcmp(pathname + len - 3, "/**") == 0) {
+      pathname[len-3] = '\0';
+      char dir[MAX_PATH_LEN+1];
+      canonicalizeDir(list.cwd, pathname, len-3, dir, MAX_PATH_LEN);
+      addPreloadTree(list, dir);
+   }
+   else if (strpbrk(pathname, "*?[")) {
+      glob_t matches;
+      result = glob(pathname, GLOB_MARK, NULL, &matches);
+      if (result == GLOB_NOMATCH)
+         debug_printf("Preload pattern %s matched nothing\n", pathname);
+      else if (result != 0)
+         err_printf("Could not expand preload pattern %s\n", pathname);
+      else {
+         for (size_t i = 0; i < matches.gl_pathc; i++)
+            addPreloadPath(list, matches.gl_pathv[i]);
+      }
+      globfree(&matches);
+   }
+   else
+      addPreloadPath(list, pathname);
+}
+
+/**
+ * Parse a preload file into a LDCS_MSG_PRELOAD_FILELIST message.  Files
+ * and directories keep the order they're first listed in, which for a
+ * file written by --preload-learn is the order they were first used.  A
+ * path ending in '/' names a directory whose listing, but none of whose
+ * files, should be preloaded.  A path whose last component is '**' names
+ * a directory whose whole tree should be preloaded, such as a
+ * site-packages directory.  Other paths may be glob patterns, such as
+ * every '*.so' in a lib directory, which are expanded here in sorted
+ * order.
+ *
+ * The --bcast-file paths, colon-separated in bcast_files, are added after
+ * the file's, and are all there is when filename is empty.
+ **/
+ldcs_message_t *parsePreloadFile(string filename, const char *bcast_files)
+{
+   char pathname[MAX_PATH_LEN+1];
+   preload_list_t list;
+   vector<string> &all_dirs = list.all_dirs, &all_files = list.all_files;
+
+   getcwd(list.cwd, MAX_PATH_LEN+1);
+   list.cwd[MAX_PATH_LEN] = '\0';
+
+   if (!filename.empty()) {
+      debug_printf("Parsing preload file: %s\n", filename.c_str());
+      FILE *f = fopen(filename.c_str(), "r");
+      if (!f) {
+         err_printf("Error opening preload file %s: %s\n", filename.c_str(), strerror(errno));
+         return NULL;
+      }
+      while (fscanf(f, "%" STR(MAX_PATH_LEN) "s", pathname) == 1) {
+         pathname[MAX_PATH_LEN] = '\0';
+         addPreloadEntry(list, pathname);
+      }
+      fclose(f);
+   }
+
+   for (const char *cur = bcast_files; cur && *cur; ) {
+      const char *end = strchr(cur, ':');
+      size_t len = end ? (size_t) (end - cur) : strlen(cur);
+      if (len && len <= MAX_PATH_LEN) {
+         memcpy(pathname, cur, len);
+         pathname[len] = '\0';
+         debug_printf2("Adding broadcast file %s to preload list\n", pathname);
+         addPreloadEntry(list, pathname);
+      }
+      cur = end ? end + 1 : cur + len;
    }
 
    size_t size = 0;
    size += sizeof(int); //Num dirs as int
    size += sizeof(int); //Num files as int
-   for (set<string>::iterator i = all_dirs.begin(); i != all_dirs.end(); i++)
+   for (vector<string>::iterator i = all_dirs.begin(); i != all_dirs.end(); i++)
       size += i->length() + 1; //String + 0-terminated character
-   for (set<string>::iterator i = all_files.begin(); i != all_files.end(); i++)
+   for (vector<string>::iterator i = all_files.begin(); i != all_files.end(); i++)
       size += i->length() + 1; //String + 0-terminated character
 
    char *buffer = (char *) malloc(size);
@@ -82,13 +200,13 @@ ldcs_message_t *parsePreloadFile(string filename)
    *((int *) (buffer+cur)) = (int) all_files.size();
    cur += sizeof(int);
 
-   for (set<string>::iterator i = all_dirs.begin(); i != all_dirs.end(); i++) {
+   for (vector<string>::iterator i = all_dirs.begin(); i != all_dirs.end(); i++) {
       debug_printf3("Adding directory %s to preload list\n", i->c_str());
       int length = i->length() + 1;
       memcpy(buffer + cur, i->c_str(), length);
       cur += length;
    }
-   for (set<string>::iterator i = all_files.begin(); i != all_files.end(); i++) {
+   for (vector<string>::iterator i = all_files.begin(); i != all_files.end(); i++) {
       debug_printf3("Adding file %s to preload list\n", i->c_str());
       int length = i->length() + 1;
       memcpy(buffer + cur, i->c_str(), length);
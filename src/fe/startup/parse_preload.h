@@ -21,6 +21,6 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_api.h"
 
 void cleanPreloadMsg(ldcs_message_t *msg);
-ldcs_message_t *parsePreloadFile(std::string filename);
+ldcs_message_t *parsePreloadFile(std::string filename, const char *bcast_files = NULL);
 
 #endif
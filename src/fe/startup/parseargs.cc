@@ -19,8 +19,11 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <fcntl.h>
 #include <argp.h>
 #include <cstring>
+#include <cerrno>
 #include <cassert>
+#include <cctype>
 #include <stdlib.h>
+#include <unistd.h>
 #include <string>
 #include <set>
 
@@ -30,6 +33,7 @@ using namespace std;
 #include "spindle_launch.h"
 #include "spindle_debug.h"
 #include "parseargs.h"
+#include "relocrules.h"
 
 #if !defined(STR)
 #define STR2(X) #X
@@ -59,6 +63,7 @@ using namespace std;
 #define SECKEYLMON (256+OPT_SEC_KEYLMON)
 #define SECKEYFILE (256+OPT_SEC_KEYFILE)
 #define SECNULL (256+OPT_SEC_NULL)
+#define SECMUNGETICKET (256+OPT_SEC_MUNGETICKET)
 #define SLURM 270
 #define OPENMPI 271
 #define WRECK 272
@@ -69,6 +74,73 @@ using namespace std;
 #define RUNSESSION 277
 #define ENDSESSION 278
 #define LAUNCHERSTARTUP 279
+#define PREFETCH 280
+#define CACHEINDEX 281
+#define CACHEBUDGET 282
+#define COMPRESS 283
+#define DEDUP 284
+#define LAZYFETCH 285
+#define PUSHDEPS 286
+#define READERS 287
+#define STREAMS 288
+#define PROMOTE 289
+#define PEERS 290
+#define PASSFD 291
+#define SEARCHPATH 292
+#define PYIMPORT 293
+#define PYBUNDLE 294
+#define PRELOADLEARN 295
+#define EARLYLAUNCH 296
+#define FLUX 297
+#define CONTAINERIMAGE 298
+#define STATSREPORT 299
+#define CLIENTTIMING 300
+#define RELOCRULES 301
+#define MMAPREAD 302
+#define DISKLOCATION 303
+#define DISKTHRESHOLD 304
+#define HUGEPAGES 305
+#define SHAREDCACHE 306
+#define CLUSTERCACHE 307
+#define BYPASSSLOW 308
+#define BANDWIDTH 309
+#define BGBANDWIDTH 310
+#define DSCP 311
+#define PREDICT 312
+#define PREDICTTRACE 313
+#define COMPILEPYC 314
+#define SERVEDIRS 315
+#define RESOLVELINKS 316
+#define LOCALBYPASS 317
+#define NUMAREPLICAS 318
+#define PREFAULT 319
+#define FOREST 320
+#define STRIPEDREAD 321
+#define BCASTFILE 322
+#define VERIFY 323
+#define REVALIDATE 324
+#define SELFSTAGE 325
+#define AUTO 326
+#define AUTOPROFILE 327
+#define PROLOG 328
+#define EPILOG 329
+#define SERVERCPUS 330
+#define SERVERNICE 331
+#define SERVERNUMA 332
+#define EMULATE 333
+#define BATCHSMALL 334
+#define ATTACH 335
+#define IOURING 336
+#define FAIRCLIENTS 337
+#define DELTAUPDATES 338
+#define MEMFD 339
+#define BINDHINTS 340
+#define RACKCACHE 341
+#define ELASTIC 342
+#define SPARSEFILES 343
+#define HOTEXTENTS 344
+#define PFSMETA 345
+#define CONTROLSESSION 346
 
 #define GROUP_RELOC 1
 #define GROUP_PUSHPULL 2
@@ -108,7 +180,7 @@ static const opt_t all_reloc_opts = OPT_RELOCAOUT | OPT_RELOCSO | OPT_RELOCEXEC
                                             OPT_RELOCPY | OPT_FOLLOWFORK;
 static const opt_t all_network_opts = OPT_COBO;
 static const opt_t all_pushpull_opts = OPT_PUSH | OPT_PULL;
-static const opt_t all_misc_opts = OPT_STRIP | OPT_DEBUG | OPT_PRELOAD | OPT_NOCLEAN | OPT_PERSIST;
+static const opt_t all_misc_opts = OPT_STRIP | OPT_DEBUG | OPT_PRELOAD | OPT_NOCLEAN | OPT_PERSIST | OPT_PREFETCH | OPT_CACHEINDEX | OPT_COMPRESS | OPT_DEDUP | OPT_LAZYFETCH | OPT_PUSHDEPS | OPT_PASSFD | OPT_SEARCHPATH | OPT_PYIMPORT | OPT_PYBUNDLE | OPT_PRELOADLEARN | OPT_EARLYLAUNCH | OPT_STATSREPORT | OPT_CLIENTTIMING | OPT_MMAPREAD | OPT_HUGEPAGES | OPT_BYPASSSLOW | OPT_PREDICT | OPT_COMPILEPYC | OPT_SERVEDIRS | OPT_RESOLVELINKS | OPT_LOCALBYPASS | OPT_NUMA | OPT_PREFAULT | OPT_FOREST | OPT_STRIPEDREAD | OPT_VERIFY | OPT_REVALIDATE | OPT_SELFSTAGE | OPT_AUTO | OPT_BATCHSMALL | OPT_IOURING | OPT_FAIRCLIENTS | OPT_DELTA | OPT_MEMFD | OPT_BINDHINTS | OPT_ELASTIC | OPT_SPARSE | OPT_HOTEXTENTS | OPT_PFSMETA;
 
 static const opt_t default_reloc_opts = OPT_RELOCAOUT | OPT_RELOCSO | OPT_RELOCEXEC |
                                                 OPT_RELOCPY | OPT_FOLLOWFORK;
@@ -136,6 +208,12 @@ static opt_t enabled_opts = 0;
 static opt_t disabled_opts = 0;
 
 static char *preload_file;
+static char *container_image = NULL;
+static char *stats_report = NULL;
+static char *predict_trace = NULL;
+static char *reloc_rules = NULL;
+static char *auto_profile = NULL;
+static bool auto_bypass = false;
 static char **mpi_argv;
 static int mpi_argc;
 static bool done = false;
@@ -144,11 +222,31 @@ static int sec_model = -1;
 static int launcher = 0;
 static int startup_type = 0;
 static int shm_cache_size = SHM_DEFAULT_SIZE;
+static unsigned int cache_budget = 0;
+static unsigned int num_readers = 1;
+static unsigned int num_streams = 1;
+static unsigned int promote_children = 0;
+static unsigned int lateral_peers = 0;
+static unsigned int bandwidth = 0;
+static unsigned int background_bandwidth = 0;
+static unsigned int dscp = 0;
+static char *server_cpus = NULL;
+static int server_nice = 0;
+static int server_numa = -1;
+static int emulate_servers = 0;
+static bool attach = false;
+static string disk_location;
+static unsigned int disk_threshold = 16;
+static string shared_cache;
+static string cluster_cache;
+static string rack_cache;
+static string bcast_files;
 static opt_t use_subaudit = DEFAULT_USE_SUBAUDIT;
 static const opt_t persist = DEFAULT_PERSIST;
 
 static session_status_t session_status = sstatus_unused;
 static string session_id;
+static bool prolog_session = false;
 
 static set<string> python_prefixes;
 static const char *default_python_prefixes = PYTHON_INST_PREFIX;
@@ -201,12 +299,18 @@ struct argp_option options[] = {
      "Relocate the targets of exec/execv/execve/... calls. Default: yes", GROUP_RELOC },
    { "follow-fork", FOLLOWFORK, YESNO, 0,
      "Relocate objects in fork'd child processes. Default: yes", GROUP_RELOC },
+   { "reloc-rules", RELOCRULES, "FILE", 0,
+     "Decide what to relocate by the rules in FILE, ahead of the options above.  Each line is 'ACTION GLOB [>SIZE|<SIZE]', "
+     "where ACTION is relocate, push (relocate, and send to every node on the first request) or pass (use the original "
+     "file).  GLOB is matched against the absolute path, and SIZE may end in K, M, G or T.  The first matching rule wins", GROUP_RELOC },
    { NULL, 0, NULL, 0,
      "These options specify how the Spindle network should distibute files.  Push is better for SPMD programs.  Pull is better for MPMD programs. Default is push.", GROUP_PUSHPULL },
    { "push", PUSH, NULL, 0,
      "Use a push model where objects loaded by any process are made available to all processes", GROUP_PUSHPULL },
    { "pull", PULL, NULL, 0,
      "Use a pull model where objects are only made available to processes that require them", GROUP_PUSHPULL },
+   { "promote", PROMOTE, "num", 0,
+     "With the pull model, push a file or directory to all of a server's children once this many of them have asked for it. 0 never pushes. Default: 0", GROUP_PUSHPULL },
    { NULL, 0, NULL, 0,
      "These options configure Spindle's network model.  Typical Spindle runs should not need to set these.", GROUP_NETWORK },
    { "cobo", COBO, NULL, 0,
@@ -220,6 +324,10 @@ struct argp_option options[] = {
    { "security-munge", SECMUNGE, NULL, 0,
      "Use munge for security authentication", GROUP_SEC },
 #endif
+#if defined(MUNGE) && defined(GCRYPT)
+   { "security-munge-ticket", SECMUNGETICKET, NULL, 0,
+     "Use one munge credential from the root of the tree, with keys derived from it for each connection", GROUP_SEC },
+#endif
 #if defined(SECLMON) && defined(HAVE_LMON)
    { "security-lmon", SECKEYLMON, NULL, 0,
      "Use LaunchMON to exchange keys for security authentication", GROUP_SEC },
@@ -246,12 +354,24 @@ struct argp_option options[] = {
    { "wreck", WRECK, NULL, 0,
      "MPI Job is launched with the wreck job launcher.", GROUP_LAUNCHER },
 #endif
-#if defined(ENABLE_SRUN_LAUNCHER)
+#if defined(ENABLE_FLUX_LAUNCHER)
+   { "flux", FLUX, NULL, 0,
+     "MPI Job is launched with the 'flux run' job launcher.", GROUP_LAUNCHER },
+#endif
+#if defined(ENABLE_SRUN_LAUNCHER) || defined(ENABLE_FLUX_LAUNCHER) || defined(ENABLE_OPENMPI_LAUNCHER)
    { "launcher-startup", LAUNCHERSTARTUP, NULL, 0,
      "Launch spindle daemons using the system's job launcher (requires an already set-up session).", GROUP_LAUNCHER },
 #endif
    { "no-mpi", NOMPI, NULL, 0,
      "Run serial jobs instead of MPI job", GROUP_LAUNCHER },
+   { "emulate", EMULATE, "num", 0,
+     "Emulate a job on num nodes on this host, for profiling and testing the server tree.  Runs num servers, each named "
+     "by its own loopback address and with its own location, and a copy of the command line for each.  "
+     "Needs a --port range of at least num ports", GROUP_LAUNCHER },
+   { "attach", ATTACH, NULL, 0,
+     "Run the command, on this node, under the Spindle server already running here for a job or session, rather "
+     "than launching a job.  For the workers that many-task frameworks start from their own agents.  Give the "
+     "job's --location if it wasn't the default", GROUP_LAUNCHER },
    { NULL, 0, NULL, 0,
      "Options for managing sessions, which can run multiple jobs out of one spindle cache.", GROUP_SESSION },
    { "start-session", STARTSESSION, NULL, 0,
@@ -260,12 +380,22 @@ struct argp_option options[] = {
      "End a persistent Spindle session with the given session-id", GROUP_SESSION },
    { "run-in-session", RUNSESSION, "session-id", 0,
      "Run a new job in the given session", GROUP_SESSION },
+   { "prolog", PROLOG, NULL, 0,
+     "Start a session for this Slurm allocation, preloading $SPINDLE_PROLOG_PRELOAD if there's no --preload, "
+     "and record it so later steps can give 'job' as the session-id", GROUP_SESSION },
+   { "epilog", EPILOG, NULL, 0,
+     "End the session --prolog started for this Slurm allocation", GROUP_SESSION },
+   { "control-session", CONTROLSESSION, "session-id", 0,
+     "Change settings of the given session's servers while it runs, keeping their cache.  Takes name=value pairs "
+     "in place of a command line: distribution=push|pull, bandwidth=MB/s and background-bandwidth=MB/s (0 for no "
+     "limit), predict-depth=files and predict-chance=0-1 for how far ahead and how surely --predict pushes, and "
+     "log-level=0-3 for servers started with SPINDLE_DEBUG", GROUP_SESSION },
    { NULL, 0, NULL, 0,
      "Misc options", GROUP_MISC },
    { "audit-type", AUDITTYPE, "subaudit|audit", 0,
      "Use the new-style subaudit interface for intercepting ld.so, or the old-style audit interface.  The subaudit option reduces memory overhead, but is more complex.  Default is " DEFAULT_USE_SUBAUDIT_STR ".", GROUP_MISC },
    { "shmcache-size", SHAREDCACHE_SIZE, "size", 0,
-     "Size of client shared memory cache in kilobytes, which can be used to improve performance if multiple processes are running on each node.  Default: " STR(SHM_DEFAULT_SIZE), GROUP_MISC },
+     "Size of client shared memory cache in kilobytes, which can be used to improve performance if multiple processes are running on each node.  'auto' sizes the cache from the number of ranks on each node.  Default: " STR(SHM_DEFAULT_SIZE), GROUP_MISC },
    { "python-prefix", PYTHONPREFIX, "path", 0,
      "Colon-seperated list of directories that contain the python install location", GROUP_MISC },
    { "cache-prefix", PYTHONPREFIX, "path", 0,
@@ -277,10 +407,182 @@ struct argp_option options[] = {
    { "preload", PRELOAD, "FILE", 0,
      "Provides a text file containing a white-space separated list of files that should be "
      "relocated to each node before execution begins", GROUP_MISC },
+   { "preload-learn", PRELOADLEARN, "FILE", 0,
+     "Write every file and directory the servers were asked for to FILE when the job exits, in the order they were "
+     "first asked for.  If FILE already exists, send its files to every server as soon as Spindle starts, without "
+     "holding back the job until they arrive.  Not used with --preload or --persist", GROUP_MISC },
+   { "bcast-file", BCASTFILE, "path", 0,
+     "Send this file, such as an input deck or mesh every process reads, to every node as soon as Spindle starts, "
+     "without holding back the job until it arrives.  May be a glob pattern, and may be given more than once.  The "
+     "job gets at the node's copy with spindle_bcast_file() or spindle_open()", GROUP_MISC },
+   { "container-image", CONTAINERIMAGE, "FILE", 0,
+     "A container image, such as a squashfs or SIF file, that the job's command line names.  Each node stages it "
+     "through the servers before the job starts, and the command line and SPINDLE_CONTAINER_IMAGE are given the local copy", GROUP_MISC },
+   { "stats-report", STATSREPORT, "FILE", 0,
+     "When the job exits, gather every server's statistics up the tree and write a summary to FILE: the load put "
+     "on the shared file system against the client queries it satisfied, the spread of each counter across servers, "
+     "broadcast times at each level of the tree, and the slowest servers.  A FILE "
+     "ending in .json is written as JSON.  Not used with --persist", GROUP_MISC },
+   { "cache-budget", CACHEBUDGET, "megabytes", 0,
+     "Limit the staged files each server keeps on local disk to this many megabytes, evicting the least recently used when full.  Not used with a shared memory cache.  Default: 0 (no limit)", GROUP_MISC },
+   { "cache-index", CACHEINDEX, YESNO, 0,
+     "Keep each server's cache in a spindle.persist.<uid> directory beside the location when it exits, and reload whatever is still valid when the next server starts. Most useful with sessions. Default: no", GROUP_MISC },
+   { "compress", COMPRESS, YESNO, 0,
+     "Compress library and file contents larger than 64 KB before sending them between servers. Default: no", GROUP_MISC },
+   { "sparse-files", SPARSEFILES, YESNO, 0,
+     "Read only the data of files with holes of 1 MB or more, and send them between servers as their data "
+     "extents, so every server stages them with the same holes. Default: no", GROUP_MISC },
+   { "batch-small", BATCHSMALL, YESNO, 0,
+     "Send the files of 8 KB or less that go to every server at about the same time together, in one message, "
+     "rather than one message per file. Default: no", GROUP_MISC },
+   { "io-uring", IOURING, YESNO, 0,
+     "Have the servers wait for network and client events on an io_uring rather than with epoll, if the kernel allows it. Default: no", GROUP_MISC },
+   { "fair-clients", FAIRCLIENTS, YESNO, 0,
+     "Have each server answer the messages its clients send at about the same time with the least busy clients first, "
+     "so one rank flooding it with queries doesn't hold up the others. Default: no", GROUP_MISC },
+   { "dedup", DEDUP, YESNO, 0,
+     "Send and stage files with identical contents once, and give every path a link to the one local copy. Not used with --cache-budget. Default: no", GROUP_MISC },
+   { "lazy-fetch", LAZYFETCH, YESNO, 0,
+     "Stage data files of 64 MB or more opened with open() or spindle_open() as sparse files, and only send the 4 MB pieces that processes read. Not used with --cache-budget. Default: no", GROUP_MISC },
+   { "hot-extents", HOTEXTENTS, YESNO, 0,
+     "With --lazy-fetch and --preload-learn, record the pieces of lazily fetched files that processes read, and "
+     "on later runs push them to every server first, then stream the rest of the file. Default: no", GROUP_MISC },
+   { "pfs-metadata", PFSMETA, YESNO, 0,
+     "Stat the files the root reads together off Lustre or GPFS mounts in parallel, ahead of reading them, "
+     "rather than one metadata round trip at a time. Default: no", GROUP_MISC },
+   { "prefetch", PREFETCH, YESNO, 0,
+     "Read and distribute the directories under the python prefixes and LD_LIBRARY_PATH before they are requested. Default: no", GROUP_MISC },
+   { "push-deps", PUSHDEPS, YESNO, 0,
+     "Send the libraries each distributed executable or library depends on through its rpath, runpath or LD_LIBRARY_PATH to every server before they are requested. Default: no", GROUP_MISC },
+   { "pass-fd", PASSFD, YESNO, 0,
+     "Have servers open the staged file for each read-only open() and pass the descriptor to the process, rather than its path. Only used when spindle is built with --enable-socket. Default: no", GROUP_MISC },
+   { "mmap-read", MMAPREAD, YESNO, 0,
+     "Have processes map each staged file they open() read-only, and answer read(), pread(), readv() and lseek() on it "
+     "from the mapping, rather than with a system call and a copy each. Not used with --lazy-fetch files. Default: no", GROUP_MISC },
+   { "search-path", SEARCHPATH, YESNO, 0,
+     "Have each process send the server the directories of its rpath, LD_LIBRARY_PATH and runpath to look for a library in, in one query, rather than a query per directory. Default: no", GROUP_MISC },
+   { "python-import", PYIMPORT, YESNO, 0,
+     "Have python processes find each module they import along sys.path in one query, through an importer that spindle puts on PYTHONPATH, rather than probing each directory. Default: no", GROUP_MISC },
+   { "python-bundle", PYBUNDLE, YESNO, 0,
+     "Have the server that reads the first file out of a directory under the python prefix send all of the directory's files under 1 MB to every server in one message, rather than one message per file. "
+     "The first file read out of a .dist-info or .egg-info directory sends those of every such directory beside it. Default: no", GROUP_MISC },
+   { "compile-pyc", COMPILEPYC, YESNO, 0,
+     "Have the server that reads a __pycache__ directory compile the .py files beside it that have no .pyc there for the "
+     "job's python, once, so processes load the bytecode rather than each compiling the source. Uses $SPINDLE_PYTHON or "
+     "the python under the python prefix. Default: no", GROUP_MISC },
+   { "serve-dirs", SERVEDIRS, YESNO, 0,
+     "Have processes list the directories spindle relocates files from, such as those on sys.path, from the server's "
+     "cache of their listings rather than reading them from the file system. Default: no", GROUP_MISC },
+   { "resolve-links", RESOLVELINKS, YESNO, 0,
+     "Have the servers read symbolic link targets along with directory listings, and answer readlink and realpath "
+     "on the paths spindle handles from their cache rather than from the file system. Default: no", GROUP_MISC },
+   { "local-bypass", LOCALBYPASS, YESNO, 0,
+     "Read files in place, rather than relocating them, when they're on a file system local to each node, such as "
+     "the ext4, xfs, overlay, squashfs or tmpfs of the node's root image. Default: no", GROUP_MISC },
+   { "numa-replicas", NUMAREPLICAS, YESNO, 0,
+     "Stage a copy of each large shared library and executable in the memory of every NUMA node, and have each "
+     "process load the copy on the node it runs on, so its code isn't fetched across sockets. Default: no", GROUP_MISC },
+   { "prefault", PREFAULT, YESNO, 0,
+     "Fill in the page tables of each staged shared library as soon as it's loaded, rather than taking a page fault "
+     "the first time each of its pages is touched. Default: no", GROUP_MISC },
+   { "bind-hints", BINDHINTS, YESNO, 0,
+     "Experimental. Have the first process on a node record where its PLT bindings resolved, and later processes "
+     "with the same libraries bind from that record rather than have ld.so look the symbols up. Only with "
+     "--audit-type=audit on x86_64. Default: no", GROUP_MISC },
+   { "elastic", ELASTIC, YESNO, 0,
+     "Let servers started on nodes added to the job after it started join the running servers with spindle_be "
+     "--spindle_join, and serve the processes started there. Default: no", GROUP_MISC },
+   { "early-launch", EARLYLAUNCH, YESNO, 0,
+     "Start the job while the servers are still connecting to each other, rather than after.  Each process waits "
+     "for its node's server when it first asks for a file, for as long as the servers take to come up. Default: no", GROUP_MISC },
+   { "client-timing", CLIENTTIMING, YESNO, 0,
+     "Have each process time the opens, stats and library searches Spindle intercepts, and the part of that spent "
+     "waiting on its server.  Totals are logged in each process's debug output and added to the server statistics "
+     "and --stats-report. Default: no", GROUP_MISC },
+   { "peers", PEERS, "num", 0,
+     "Link each server to this many siblings on either side of it under its parent. With the pull model, a server then has a child that already holds a file of 256 KB or more send it to a linked sibling, rather than sending it again itself. Not used with --cache-budget or --lazy-fetch. Default: 0", GROUP_MISC },
+   { "bypass-slow", BYPASSSLOW, YESNO, 0,
+     "Link each server to its children's children as well. A server then also sends files of 1 MB or more that go to all its "
+     "children straight to the children of a child whose sends have been lagging well behind its siblings', so one slow "
+     "server doesn't hold up its subtree. Default: no", GROUP_MISC },
+   { "predict", PREDICT, YESNO, 0,
+     "Have the root server learn which file is usually asked for after which, per requesting server, as the job runs. "
+     "When a file is asked for, it reads the few files most likely to be asked for next and pushes them to every server "
+     "behind the files that were asked for. Default: no", GROUP_MISC },
+   { "predict-trace", PREDICTTRACE, "FILE", 0,
+     "Start --predict off with the file order in FILE, a preload file such as --preload-learn writes.  Unlike --preload, "
+     "nothing in FILE is sent until the job asks for a file that comes before it.  Implies --predict", GROUP_MISC },
+   { "bandwidth", BANDWIDTH, "MB/s", 0,
+     "Limit what each server sends to each neighboring server to this many megabytes per second, so Spindle's broadcasts "
+     "leave room for the job's own startup traffic. Default: 0, no limit", GROUP_MISC },
+   { "background-bandwidth", BGBANDWIDTH, "MB/s", 0,
+     "Once the job calls spindle_startup_done(), limit what each server sends to each neighboring server to this many "
+     "megabytes per second instead. Default: 0, keep the --bandwidth limit", GROUP_MISC },
+   { "dscp", DSCP, "num", 0,
+     "Mark the servers' network traffic with this DSCP value, 0-63, which also sets the sockets' priority. Once the job "
+     "calls spindle_startup_done(), the traffic is remarked CS1, the low priority class. Default: 0, unmarked", GROUP_MISC },
+   { "server-cpus", SERVERCPUS, "list|reserved", 0,
+     "Pin each server to these CPUs, a list like 0,2-3, or to 'reserved', the node's CPUs that the job may not use, "
+     "such as the cores Slurm keeps for the system with core specialization. Default: unpinned", GROUP_MISC },
+   { "server-nice", SERVERNICE, "num", 0,
+     "Run each server at this nice value, -20 to 19. Values below 0 need privileges. Default: 0", GROUP_MISC },
+   { "server-numa", SERVERNUMA, "node", 0,
+     "Place each server's memory, including the files it stages in memory, on this NUMA node. Default: the kernel's policy", GROUP_MISC },
+   { "readers", READERS, "num", 0,
+     "Split reads of the shared file system between this many servers, the root and its children, by hashing each directory to one of them. Only used with the pull model, and not with --dedup or --lazy-fetch. Default: 1", GROUP_MISC },
+   { "forest", FOREST, YESNO, 0,
+     "With --readers, have each reader serve the part of the tree below it by itself, reading every file its part "
+     "asks for, rather than reading the directories hashed to it for the whole job. Default: no", GROUP_MISC },
+   { "striped-read", STRIPEDREAD, YESNO, 0,
+     "With --readers, split the read of each large file between the readers, each reading its own Lustre stripes "
+     "or piece of the file, rather than having one server read all of it. Default: no", GROUP_MISC },
+   { "verify", VERIFY, YESNO, 0,
+     "Send a CRC32C checksum with each file, check copies against it when they're received and before they're sent on, "
+     "and fetch corrupt copies again. Not used with --lazy-fetch. Default: no", GROUP_MISC },
+   { "revalidate", REVALIDATE, YESNO, 0,
+     "In a session, check the files and directories the servers read against the file system before each step, "
+     "and drop just the ones that changed. Not used with --dedup or --lazy-fetch. Default: no", GROUP_MISC },
+   { "delta-updates", DELTAUPDATES, YESNO, 0,
+     "With --revalidate, keep the old copy of each large file that changed, and send its new version through the tree "
+     "as the blocks that differ from the old one. Not used with --cache-budget. Default: no", GROUP_MISC },
+   { "self-stage", SELFSTAGE, YESNO, 0,
+     "Send Spindle's own audit, intercept and python libraries through the tree at startup, "
+     "and have processes load the staged copies. Default: no", GROUP_MISC },
+   { "auto", AUTO, YESNO, 0,
+     "Size what Spindle relocates to the job: run jobs of a few ranks without Spindle, relocate only libraries "
+     "on jobs of a few nodes, and have processes drop a kind of open or stat to the file system when Spindle "
+     "answers it slower. Default: no", GROUP_MISC },
+   { "auto-profile", AUTOPROFILE, "FILE", 0,
+     "With --auto, also decide from a --stats-report written by an earlier run of the job. Implies --auto", GROUP_MISC },
+   { "streams", STREAMS, "num", 0,
+     "Open this many TCP connections between each pair of servers, and split file contents of 2 MB or more across them. Default: 1", GROUP_MISC },
    { "strip", STRIP, YESNO, 0,
      "Strip debug and symbol information from binaries before distributing them. Default: yes", GROUP_MISC },
    { "location", LOCATION, "directory", 0,
      "Back-end directory for storing relocated files.  Should be a non-shared location such as a ramdisk.  Default: " SPINDLE_LOC, GROUP_MISC },
+   { "disk-location", DISKLOCATION, "directory", 0,
+     "Back-end directory on a node-local disk, such as NVMe, for staging files of --disk-threshold megabytes or more, "
+     "so they don't take up the ramdisk at --location.  Their space is allocated up front.  Default: none", GROUP_MISC },
+   { "disk-threshold", DISKTHRESHOLD, "megabytes", 0,
+     "With --disk-location, stage files of this many megabytes or more there.  0 stages every file there.  Default: 16", GROUP_MISC },
+   { "huge-pages", HUGEPAGES, YESNO, 0,
+     "Stage files of 2 MB or more at 2 MB aligned addresses and advise huge pages for them, so a location on a tmpfs "
+     "mounted with huge=advise or huge=within_size holds them in 2 MB pages. Default: no", GROUP_MISC },
+   { "memfd", MEMFD, YESNO, 0,
+     "Stage files in sealed memfds that processes open through the server's /proc entries, rather than in the location. "
+     "Not used with --dedup, --lazy-fetch, --numa-replicas, --cache-index, --shared-cache, --cluster-cache or --rack-cache. Default: no", GROUP_MISC },
+   { "shared-cache", SHAREDCACHE, "directory", 0,
+     "Node-local directory shared by every Spindle job of this user, such as a directory on the same ramdisk as --location.  "
+     "Files read from the shared file system are also linked there, and later jobs stage unchanged files from it "
+     "instead of reading them again.  Never cleaned by Spindle.  Default: none", GROUP_MISC },
+   { "cluster-cache", CLUSTERCACHE, "directory", 0,
+     "Directory on a burst buffer or other file system every node sees, where servers keep copies of the files they "
+     "read from the shared file system, and look for unchanged files before reading them again in later jobs.  "
+     "Never cleaned by Spindle.  Default: none", GROUP_MISC },
+   { "rack-cache", RACKCACHE, "directory", 0,
+     "Directory on the local disk, such as NVMe, of the server leading each rack: the first of each switch in a rack "
+     "tree, or else the root and its children.  It keeps copies of the files that reach it there, and stages unchanged "
+     "files from them rather than asking up the tree, in this and later jobs.  Never cleaned by Spindle.  Default: none", GROUP_MISC },
    { "noclean", NOCLEAN, YESNO, 0,
      "Don't remove local file cache after execution.  Default: no (removes the cache)", GROUP_MISC },
    { "disable-logging", DISABLE_LOGGING, NULL, DISABLE_LOGGING_FLAGS,
@@ -292,6 +594,41 @@ struct argp_option options[] = {
    {0}
 };
 
+/**
+ * Read the rules file, and check it here so a bad rule is reported before
+ * the job starts
+ **/
+static char *read_reloc_rules(const char *filename, struct argp_state *state)
+{
+   reloc_rule_t rules[MAX_RELOC_RULES];
+   string text;
+   char buffer[4096];
+   char *copy;
+   int fd, errline, result;
+   ssize_t len;
+
+   fd = open(filename, O_RDONLY);
+   if (fd == -1) {
+      argp_error(state, "Could not open relocation rules %s: %s", filename, strerror(errno));
+   }
+   while ((len = read(fd, buffer, sizeof(buffer))) > 0 || (len == -1 && errno == EINTR)) {
+      if (len > 0)
+         text.append(buffer, len);
+   }
+   close(fd);
+   if (text.size() + 1 > MAX_RELOC_RULES_LEN) {
+      argp_error(state, "Relocation rules %s are larger than %d bytes", filename, MAX_RELOC_RULES_LEN);
+   }
+
+   copy = strdup(text.c_str());
+   result = reloc_rules_parse(copy, rules, MAX_RELOC_RULES, &errline);
+   free(copy);
+   if (result == -1) {
+      argp_error(state, "Bad relocation rule at %s:%d, or more than %d rules", filename, errline, MAX_RELOC_RULES);
+   }
+   return strdup(text.c_str());
+}
+
 static opt_t opt_key_to_code(int key)
 {
    switch (key) {
@@ -308,6 +645,46 @@ static opt_t opt_key_to_code(int key)
       case RELOCPY: return OPT_RELOCPY;
       case NOCLEAN: return OPT_NOCLEAN;
       case PERSIST: return OPT_PERSIST;
+      case PREFETCH: return OPT_PREFETCH;
+      case CACHEINDEX: return OPT_CACHEINDEX;
+      case COMPRESS: return OPT_COMPRESS;
+      case DEDUP: return OPT_DEDUP;
+      case LAZYFETCH: return OPT_LAZYFETCH;
+      case PUSHDEPS: return OPT_PUSHDEPS;
+      case PASSFD: return OPT_PASSFD;
+      case SEARCHPATH: return OPT_SEARCHPATH;
+      case PYIMPORT: return OPT_PYIMPORT;
+      case PYBUNDLE: return OPT_PYBUNDLE;
+      case PRELOADLEARN: return OPT_PRELOADLEARN;
+      case EARLYLAUNCH: return OPT_EARLYLAUNCH;
+      case STATSREPORT: return OPT_STATSREPORT;
+      case CLIENTTIMING: return OPT_CLIENTTIMING;
+      case MMAPREAD: return OPT_MMAPREAD;
+      case HUGEPAGES: return OPT_HUGEPAGES;
+      case BYPASSSLOW: return OPT_BYPASSSLOW;
+      case PREDICT: return OPT_PREDICT;
+      case COMPILEPYC: return OPT_COMPILEPYC;
+      case SERVEDIRS: return OPT_SERVEDIRS;
+      case RESOLVELINKS: return OPT_RESOLVELINKS;
+      case LOCALBYPASS: return OPT_LOCALBYPASS;
+      case NUMAREPLICAS: return OPT_NUMA;
+      case PREFAULT: return OPT_PREFAULT;
+      case FOREST: return OPT_FOREST;
+      case STRIPEDREAD: return OPT_STRIPEDREAD;
+      case VERIFY: return OPT_VERIFY;
+      case REVALIDATE: return OPT_REVALIDATE;
+      case SELFSTAGE: return OPT_SELFSTAGE;
+      case AUTO: return OPT_AUTO;
+      case BATCHSMALL: return OPT_BATCHSMALL;
+      case IOURING: return OPT_IOURING;
+      case FAIRCLIENTS: return OPT_FAIRCLIENTS;
+      case DELTAUPDATES: return OPT_DELTA;
+      case MEMFD: return OPT_MEMFD;
+      case BINDHINTS: return OPT_BINDHINTS;
+      case ELASTIC: return OPT_ELASTIC;
+      case SPARSEFILES: return OPT_SPARSE;
+      case HOTEXTENTS: return OPT_HOTEXTENTS;
+      case PFSMETA: return OPT_PFSMETA;
       default: return 0;
    }
 }
@@ -317,6 +694,156 @@ static bool multi_bits_set(opt_t v)
    return (v & (v - 1)) != 0;
 }
 
+/**
+ * With --auto, the job's size is taken from $SPINDLE_AUTO_NODES and
+ * $SPINDLE_AUTO_RANKS, or else from the options before the executable on
+ * the launch command line, or else from the resource manager's
+ * environment.  0 is a size we couldn't find.
+ **/
+#define AUTO_BYPASS_RANKS 16
+#define AUTO_LIBS_NODES 4
+#define AUTO_MIN_QUERIES_PER_OP 2.0
+
+static unsigned int env_count(const char * const names[])
+{
+   const char *value;
+   int i;
+
+   for (i = 0; names[i]; i++) {
+      value = getenv(names[i]);
+      if (value && atoi(value) > 0)
+         return atoi(value);
+   }
+   return 0;
+}
+
+static unsigned int cmdline_count(const char *shortopt, const char *shortopt2, const char *longopt)
+{
+   size_t longlen = strlen(longopt);
+   const char *arg, *value;
+   int i;
+
+   for (i = 1; i < mpi_argc; i++) {
+      arg = mpi_argv[i];
+      if (strcmp(arg, "spindlemarker") == 0)
+         break;
+      if (arg[0] != '-') {
+         /* The executable, unless it's the value of an option */
+         if (mpi_argv[i-1][0] != '-' || strchr(mpi_argv[i-1], '='))
+            break;
+         continue;
+      }
+      value = NULL;
+      if (strcmp(arg, shortopt) == 0 || (shortopt2 && strcmp(arg, shortopt2) == 0) ||
+          strcmp(arg, longopt) == 0)
+         value = i + 1 < mpi_argc ? mpi_argv[i+1] : NULL;
+      else if (strncmp(arg, longopt, longlen) == 0 && arg[longlen] == '=')
+         value = arg + longlen + 1;
+      if (value && atoi(value) > 0)
+         return atoi(value);
+   }
+   return 0;
+}
+
+static void auto_job_size(unsigned int *nodes, unsigned int *ranks)
+{
+   static const char * const node_vars[] = { "SLURM_NNODES", "SLURM_JOB_NUM_NODES", "FLUX_JOB_NNODES",
+                                             "PBS_NUM_NODES", NULL };
+   static const char * const rank_vars[] = { "SLURM_NTASKS", "SLURM_NPROCS", "FLUX_JOB_SIZE",
+                                             "PBS_NP", "LSB_DJOB_NUMPROC", NULL };
+   static const char * const node_override[] = { "SPINDLE_AUTO_NODES", NULL };
+   static const char * const rank_override[] = { "SPINDLE_AUTO_RANKS", NULL };
+
+   if (launcher == serial_launcher) {
+      *nodes = *ranks = emulate_servers ? emulate_servers : 1;
+      return;
+   }
+   *nodes = env_count(node_override);
+   if (!*nodes)
+      *nodes = cmdline_count("-N", NULL, "--nodes");
+   if (!*nodes)
+      *nodes = env_count(node_vars);
+   *ranks = env_count(rank_override);
+   if (!*ranks)
+      *ranks = cmdline_count("-n", "-np", "--ntasks");
+   if (!*ranks)
+      *ranks = env_count(rank_vars);
+}
+
+/**
+ * Return how many client queries each file system operation served in the
+ * run that wrote the --stats-report at filename, from its text or json
+ * form, or a negative value if we can't tell.
+ **/
+static double auto_profile_queries_per_op(const char *filename)
+{
+   char line[1024], *value;
+   double result = -1.0;
+   FILE *f;
+
+   f = fopen(filename, "r");
+   if (!f) {
+      fprintf(stderr, "Spindle Warning: Could not open --auto-profile %s: %s\n", filename, strerror(errno));
+      return -1.0;
+   }
+   while (fgets(line, sizeof(line), f)) {
+      if ((value = strstr(line, "\"queries_per_op\":")) != NULL)
+         value += strlen("\"queries_per_op\":");
+      else if ((value = strstr(line, "queries per operation")) != NULL)
+         value += strlen("queries per operation");
+      else
+         continue;
+      result = atof(value);
+      break;
+   }
+   fclose(f);
+   return result;
+}
+
+/**
+ * Decide what --auto relocates.  On a job of a few ranks the server tree
+ * takes longer to start than the file system takes to serve every process
+ * directly, so the job is run without us.  On a job of a few nodes only
+ * the libraries and executables ld.so loads, which every process reads
+ * whole, are worth the trip through the tree.  A profile of an earlier
+ * run overrides the guess: if each file system operation served fewer than
+ * AUTO_MIN_QUERIES_PER_OP queries we bypass, and otherwise we relocate as
+ * usual.  Options set on the command line are left as they were.
+ **/
+static void auto_select()
+{
+   unsigned int nodes, ranks, bypass_ranks, libs_nodes;
+   opt_t narrowed;
+   double queries_per_op = -1.0;
+   const char *env;
+
+   env = getenv("SPINDLE_AUTO_BYPASS_RANKS");
+   bypass_ranks = env ? atoi(env) : AUTO_BYPASS_RANKS;
+   env = getenv("SPINDLE_AUTO_LIBS_NODES");
+   libs_nodes = env ? atoi(env) : AUTO_LIBS_NODES;
+
+   auto_job_size(&nodes, &ranks);
+   if (auto_profile)
+      queries_per_op = auto_profile_queries_per_op(auto_profile);
+   debug_printf("Auto mode sees %u nodes, %u ranks and a profile of %.2f queries per operation\n",
+                nodes, ranks, queries_per_op);
+
+   if (queries_per_op >= AUTO_MIN_QUERIES_PER_OP)
+      return;
+   if (queries_per_op >= 0.0 || (ranks && ranks <= bypass_ranks)) {
+      if (session_status == sstatus_unused && mpi_argc > 0) {
+         debug_printf("Auto mode is running the job without spindle\n");
+         auto_bypass = true;
+         return;
+      }
+   }
+   if (nodes && nodes <= libs_nodes) {
+      narrowed = (OPT_RELOCPY | OPT_RELOCEXEC) & ~enabled_opts;
+      debug_printf("Auto mode is relocating only libraries on %u nodes\n", nodes);
+      opts &= ~narrowed;
+   }
+}
+
 static int parse(int key, char *arg, struct argp_state *vstate)
 {
    struct argp_state *state = (struct argp_state *) vstate;
@@ -348,9 +875,66 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       enabled_opts |= opt;
       return 0;
    }
-   else if (entry->key == PRELOAD) {
+   else if (entry->key == PRELOAD || entry->key == PRELOADLEARN) {
+      if (enabled_opts & (OPT_PRELOAD | OPT_PRELOADLEARN)) {
+         argp_error(state, "Cannot use more than one of --preload and --preload-learn");
+      }
       enabled_opts |= opt;
       preload_file = arg;
+      if (key == PRELOADLEARN && arg[0] != '/') {
+         /* The root server writes it, from its own cwd */
+         char *cwd = getcwd(NULL, 0);
+         if (!cwd) {
+            argp_error(state, "Could not get the current directory for %s", entry->name);
+         }
+         preload_file = strdup((string(cwd) + "/" + arg).c_str());
+         free(cwd);
+      }
+      return 0;
+   }
+   else if (entry->key == STATSREPORT) {
+      enabled_opts |= opt;
+      stats_report = arg;
+      if (arg[0] != '/') {
+         /* The root server writes it, from its own cwd */
+         char *cwd = getcwd(NULL, 0);
+         if (!cwd) {
+            argp_error(state, "Could not get the current directory for %s", entry->name);
+         }
+         stats_report = strdup((string(cwd) + "/" + arg).c_str());
+         free(cwd);
+      }
+      return 0;
+   }
+   else if (entry->key == PREDICTTRACE) {
+      enabled_opts |= OPT_PREDICT;
+      predict_trace = arg;
+      if (arg[0] != '/') {
+         /* The root server reads it, from its own cwd */
+         char *cwd = getcwd(NULL, 0);
+         if (!cwd) {
+            argp_error(state, "Could not get the current directory for %s", entry->name);
+         }
+         predict_trace = strdup((string(cwd) + "/" + arg).c_str());
+         free(cwd);
+      }
+      return 0;
+   }
+   else if (entry->key == AUTOPROFILE) {
+      enabled_opts |= OPT_AUTO;
+      auto_profile = arg;
+      return 0;
+   }
+   else if (entry->key == RELOCRULES) {
+      reloc_rules = read_reloc_rules(arg, state);
+      enabled_opts |= OPT_RELOCRULES;
+      return 0;
+   }
+   else if (entry->key == CONTAINERIMAGE) {
+      container_image = realpath(arg, NULL);
+      if (!container_image) {
+         argp_error(state, "Could not find container image %s", arg);
+      }
       return 0;
    }
    else if (entry->key == PORT) {
@@ -375,17 +959,111 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       return 0;
    }
    else if (entry->key == SHAREDCACHE_SIZE) {
+      if (strcmp(arg, "auto") == 0) {
+         shm_cache_size = SHM_CACHE_AUTO_SIZE;
+         return 0;
+      }
       shm_cache_size = atoi(arg);
       if (shm_cache_size < SHM_MIN_SIZE)
          shm_cache_size = SHM_MIN_SIZE;
       if (shm_cache_size % 4 != 0) {
          argp_error(state, "shmcache-size argument must be a multiple of 4");
       }
-      if (shm_cache_size < 8) {
+      if (shm_cache_size && shm_cache_size < 8) {
          argp_error(state, "shmcache-size argument must be at least 8 if non-zero");
       }
       return 0;
    }
+   else if (entry->key == CACHEBUDGET) {
+      int budget = atoi(arg);
+      if (budget < 0) {
+         argp_error(state, "cache-budget argument must not be negative");
+      }
+      cache_budget = (unsigned int) budget;
+      return 0;
+   }
+   else if (entry->key == READERS) {
+      int readers = atoi(arg);
+      if (readers < 1) {
+         argp_error(state, "readers argument must be at least 1");
+      }
+      num_readers = (unsigned int) readers;
+      return 0;
+   }
+   else if (entry->key == PROMOTE) {
+      int promote = atoi(arg);
+      if (promote < 0) {
+         argp_error(state, "promote argument must not be negative");
+      }
+      promote_children = (unsigned int) promote;
+      return 0;
+   }
+   else if (entry->key == PEERS) {
+      int peers = atoi(arg);
+      if (peers < 0) {
+         argp_error(state, "peers argument must not be negative");
+      }
+      lateral_peers = (unsigned int) peers;
+      return 0;
+   }
+   else if (entry->key == BANDWIDTH || entry->key == BGBANDWIDTH) {
+      int mbs = atoi(arg);
+      if (mbs < 0) {
+         argp_error(state, "bandwidth argument must not be negative");
+      }
+      if (entry->key == BANDWIDTH)
+         bandwidth = (unsigned int) mbs;
+      else
+         background_bandwidth = (unsigned int) mbs;
+      return 0;
+   }
+   else if (entry->key == DSCP) {
+      int val = atoi(arg);
+      if (val < 0 || val > 63) {
+         argp_error(state, "dscp argument must be between 0 and 63");
+      }
+      dscp = (unsigned int) val;
+      return 0;
+   }
+   else if (entry->key == SERVERCPUS) {
+      if (strcmp(arg, "reserved") != 0 && (!*arg || strspn(arg, "0123456789,-") != strlen(arg))) {
+         argp_error(state, "server-cpus must be a list of CPUs, like 0,2-3, or 'reserved'");
+      }
+      server_cpus = arg;
+      return 0;
+   }
+   else if (entry->key == SERVERNICE) {
+      int val = atoi(arg);
+      if (val < -20 || val > 19) {
+         argp_error(state, "server-nice argument must be between -20 and 19");
+      }
+      server_nice = val;
+      return 0;
+   }
+   else if (entry->key == EMULATE) {
+      int val = atoi(arg);
+      if (val < 1) {
+         argp_error(state, "emulate argument must be at least 1");
+      }
+      emulate_servers = val;
+      return 0;
+   }
+   else if (entry->key == SERVERNUMA) {
+      int val = atoi(arg);
+      if (val < 0 || !isdigit(arg[0])) {
+         argp_error(state, "server-numa argument must be a NUMA node number");
+      }
+      server_numa = val;
+      return 0;
+   }
+   else if (entry->key == STREAMS) {
+      int streams = atoi(arg);
+      if (streams < 1) {
+         argp_error(state, "streams argument must be at least 1");
+      }
+      num_streams = (unsigned int) streams;
+      return 0;
+   }
    else if (entry->key == AUDITTYPE) {
       if (strcmp(arg, "subaudit") == 0) {
          use_subaudit = 1;
@@ -402,6 +1080,36 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       spindle_location = arg;
       return 0;
    }
+   else if (entry->key == DISKLOCATION) {
+      disk_location = arg;
+      return 0;
+   }
+   else if (entry->key == SHAREDCACHE) {
+      shared_cache = arg;
+      return 0;
+   }
+   else if (entry->key == CLUSTERCACHE) {
+      cluster_cache = arg;
+      return 0;
+   }
+   else if (entry->key == RACKCACHE) {
+      rack_cache = arg;
+      return 0;
+   }
+   else if (entry->key == BCASTFILE) {
+      if (!bcast_files.empty())
+         bcast_files += ":";
+      bcast_files += arg;
+      return 0;
+   }
+   else if (entry->key == DISKTHRESHOLD) {
+      int threshold = atoi(arg);
+      if (threshold < 0) {
+         argp_error(state, "disk-threshold argument must not be negative");
+      }
+      disk_threshold = (unsigned int) threshold;
+      return 0;
+   }
    else if (key == DISABLE_LOGGING) {
       logging_enabled = false;
       return 0;
@@ -418,10 +1126,18 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       launcher = wreckrun_launcher;
       return 0;
    }
+   else if (key == FLUX) {
+      launcher = flux_launcher;
+      return 0;
+   }
    else if (key == NOMPI) {
       launcher = serial_launcher;
       return 0;
    }
+   else if (key == ATTACH) {
+      attach = true;
+      return 0;
+   }
    else if (key == HIDE) {
       hide_fd = false;
       opts |= OPT_NOHIDE;
@@ -462,6 +1178,24 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       opts |= OPT_SESSION;
       return 0;
    }
+   else if (key == CONTROLSESSION) {
+      session_status = sstatus_control;
+      session_id = string(arg);
+      opts |= OPT_SESSION;
+      return 0;
+   }
+   else if (key == PROLOG) {
+      session_status = sstatus_start;
+      prolog_session = true;
+      opts |= OPT_SESSION;
+      return 0;
+   }
+   else if (key == EPILOG) {
+      session_status = sstatus_end;
+      session_id = string(JOB_SESSION_ID);
+      opts |= OPT_SESSION;
+      return 0;
+   }
    else if (key == LAUNCHERSTARTUP) {
       startup_type = startup_mpi;
 #if defined(TESTRM)
@@ -498,6 +1232,24 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       /* Set any reloc options */
       opts |= all_reloc_opts & ~disabled_opts & (enabled_opts | default_reloc_opts);
 
+      if (attach) {
+         if (launcher || emulate_servers || (opts & OPT_SESSION))
+            argp_error(state, "--attach runs the command under this node's server, and can't be used with a job launcher, --emulate or sessions");
+         launcher = serial_launcher;
+      }
+
+      if (emulate_servers) {
+         if (launcher && launcher != serial_launcher)
+            argp_error(state, "--emulate runs the job on this host, and can't be used with a job launcher");
+         if (opts & OPT_SESSION)
+            argp_error(state, "--emulate can't be used with sessions");
+         if ((unsigned int) emulate_servers > num_ports)
+            argp_error(state, "--emulate=%d needs a --port range of at least %d ports", emulate_servers, emulate_servers);
+         launcher = serial_launcher;
+         /* A node's cache would answer for every server on this host */
+         shm_cache_size = 0;
+      }
+
       /* Set startup type */
       if (startup_type == 0) {
          if (launcher == serial_launcher)
@@ -513,12 +1265,32 @@ static int parse(int key, char *arg, struct argp_state *vstate)
          sec_model = default_sec;
       OPT_SET_SEC(opts, sec_model);
 
+      if ((prolog_session || session_id == JOB_SESSION_ID) && !getenv("SLURM_JOB_ID")) {
+         argp_error(state, "--prolog, --epilog and the '%s' session-id can only be used in a Slurm allocation",
+                    JOB_SESSION_ID);
+      }
+      if (prolog_session && !(enabled_opts & (OPT_PRELOAD | OPT_PRELOADLEARN)) && getenv("SPINDLE_PROLOG_PRELOAD")) {
+         /* The site's preload set, such as its MPI, CUDA and python stacks */
+         preload_file = getenv("SPINDLE_PROLOG_PRELOAD");
+         enabled_opts |= OPT_PRELOAD;
+      }
+
       /* Set any misc options */
       opts |= all_misc_opts & ~disabled_opts & (enabled_opts | default_misc_opts);
       opts |= use_subaudit ? OPT_SUBAUDIT : 0;
       opts |= logging_enabled ? OPT_LOGUSAGE : 0;
       opts |= shm_cache_size > 0 ? OPT_SHMCACHE : 0;
 
+      if ((opts & OPT_PRELOADLEARN) && (opts & (OPT_PERSIST | OPT_SESSION))) {
+         /* Only the bottom-up exit gathers what each server recorded */
+         argp_error(state, "--preload-learn can't be used with --persist or sessions");
+      }
+      if ((opts & OPT_STATSREPORT) && (opts & (OPT_PERSIST | OPT_SESSION))) {
+         argp_error(state, "--stats-report can't be used with --persist or sessions");
+      }
+      if (opts & OPT_AUTO)
+         auto_select();
+
       if (opts & OPT_SESSION) { 
          opts |= OPT_PERSIST;
          if (startup_type == startup_lmon || startup_type == startup_hostbin) {
@@ -528,6 +1300,9 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       }
       return 0;
    }
+   else if (key == ARGP_KEY_NO_ARGS && session_status == sstatus_control) {
+      argp_error(state, "No settings given to --control-session");
+   }
    else if (key == ARGP_KEY_NO_ARGS && 
             !(session_status == sstatus_start || session_status == sstatus_end)) {
       argp_error(state, "No MPI command line found");
@@ -568,16 +1343,92 @@ char *getPreloadFile()
    return preload_file;
 }
 
+char *getContainerImage()
+{
+   return container_image;
+}
+
+char *getStatsReport()
+{
+   return stats_report;
+}
+
+char *getPredictTrace()
+{
+   return predict_trace;
+}
+
+bool getAutoBypass()
+{
+   return auto_bypass;
+}
+
+char *getRelocRules()
+{
+   return reloc_rules;
+}
+
 unsigned int getPort()
 {
    return spindle_port;
 }
 
+/* Each emulated server's location ends in its instance number, which the
+   servers and clients fill in from their environment */
+static string emulate_suffix()
+{
+   if (!emulate_servers)
+      return string();
+   return string(".$") + string(EMULATE_INSTANCE_ENV);
+}
+
 string getLocation(int number)
 {
    char num_s[32];
    snprintf(num_s, 32, "%d", number);
-   return spindle_location + string("/spindle.") + string(num_s);
+   return spindle_location + string("/spindle.") + string(num_s) + emulate_suffix();
+}
+
+char *getDiskLocation(int number)
+{
+   char num_s[32];
+   if (disk_location.empty())
+      return NULL;
+   snprintf(num_s, 32, "%d", number);
+   return strdup((disk_location + string("/spindle.") + string(num_s) + emulate_suffix()).c_str());
+}
+
+char *getSharedCache()
+{
+   if (shared_cache.empty())
+      return NULL;
+   return strdup(shared_cache.c_str());
+}
+
+char *getClusterCache()
+{
+   if (cluster_cache.empty())
+      return NULL;
+   return strdup(cluster_cache.c_str());
+}
+
+char *getRackCache()
+{
+   if (rack_cache.empty())
+      return NULL;
+   return strdup(rack_cache.c_str());
+}
+
+char *getBcastFiles()
+{
+   if (bcast_files.empty())
+      return NULL;
+   return strdup(bcast_files.c_str());
+}
+
+unsigned int getDiskThreshold()
+{
+   return disk_threshold;
 }
 
 static void parse_python_prefix(const char *prefix)
@@ -648,6 +1499,76 @@ int getShmCacheSize()
    return shm_cache_size;
 }
 
+unsigned int getCacheBudget()
+{
+   return cache_budget;
+}
+
+unsigned int getNumReaders()
+{
+   return num_readers;
+}
+
+unsigned int getNumStreams()
+{
+   return num_streams;
+}
+
+unsigned int getPromoteChildren()
+{
+   return promote_children;
+}
+
+unsigned int getLateralPeers()
+{
+   return lateral_peers;
+}
+
+unsigned int getBandwidth()
+{
+   return bandwidth;
+}
+
+unsigned int getBackgroundBandwidth()
+{
+   return background_bandwidth;
+}
+
+unsigned int getDSCP()
+{
+   return dscp;
+}
+
+char *getServerCPUs()
+{
+   return server_cpus;
+}
+
+int getServerNice()
+{
+   return server_nice;
+}
+
+int getServerNUMA()
+{
+   return server_numa;
+}
+
+int getEmulateServers()
+{
+   return emulate_servers;
+}
+
+bool getAttach()
+{
+   return attach;
+}
+
+string getAttachDir()
+{
+   return spindle_location;
+}
+
 static unsigned int str_hash(const char *str)
 {
    unsigned long hash = 5381;
@@ -708,19 +1629,45 @@ void parseCommandLine(int argc, char *argv[], spindle_args_t *args)
    args->use_launcher = getLauncher();
    args->startup_type = getStartupType();
    args->shm_cache_size = getShmCacheSize();
+   args->cache_budget = getCacheBudget();
+   args->num_readers = getNumReaders();
+   args->num_streams = getNumStreams();
+   args->promote_children = getPromoteChildren();
+   args->lateral_peers = getLateralPeers();
+   args->bandwidth = getBandwidth();
+   args->background_bandwidth = getBackgroundBandwidth();
+   args->dscp = getDSCP();
+   args->server_cpus = getServerCPUs();
+   args->server_nice = getServerNice();
+   args->server_numa = getServerNUMA();
    args->location = strdup(getLocation(args->number).c_str());
    args->pythonprefix = strdup(getPythonPrefixes().c_str());
    args->preloadfile = getPreloadFile();
+   args->bcast_files = getBcastFiles();
+   args->container_image = getContainerImage();
+   args->stats_report = getStatsReport();
+   args->predict_trace = getPredictTrace();
+   args->reloc_rules = getRelocRules();
+   args->disk_location = getDiskLocation(args->number);
+   args->disk_threshold = getDiskThreshold();
+   args->shared_cache = getSharedCache();
+   args->cluster_cache = getClusterCache();
+   args->rack_cache = getRackCache();
 
    debug_printf("Spindle options bitmask: %lu\n", (unsigned long) opts);
 }
 
 string get_arg_session_id()
 {
-   assert(session_status == sstatus_run || session_status == sstatus_end);
+   assert(session_status == sstatus_run || session_status == sstatus_end || session_status == sstatus_control);
    return session_id;
 }
 
+bool get_prolog_session()
+{
+   return prolog_session;
+}
+
 session_status_t get_session_status()
 {
    return session_status;
@@ -24,24 +24,57 @@ typedef enum {
    sstatus_unused,
    sstatus_start,
    sstatus_run,
-   sstatus_end
+   sstatus_end,
+   sstatus_control
 } session_status_t;
 
+/* Session-id that stands for the session --prolog started for this Slurm job */
+#define JOB_SESSION_ID "job"
+
+/* Environment variable holding each --emulate server's instance number */
+#define EMULATE_INSTANCE_ENV "SPINDLE_EMULATE_INSTANCE"
+
 void parseCommandLine(int argc, char *argv[], spindle_args_t *args);
 
 opt_t parseArgs(int argc, char *argv[]);
 char *getPreloadFile();
+char *getContainerImage();
+char *getStatsReport();
+char *getPredictTrace();
+char *getRelocRules();
+bool getAutoBypass();
 unsigned int getPort();
 unsigned int getNumPorts();
 std::string getLocation(int number);
+char *getDiskLocation(int number);
+unsigned int getDiskThreshold();
+char *getSharedCache();
+char *getClusterCache();
+char *getRackCache();
+char *getBcastFiles();
 std::string getPythonPrefixes();
 std::string getHostbin();
 int getStartupType();
 int getLauncher();
 int getShmCacheSize();
+unsigned int getCacheBudget();
+unsigned int getNumReaders();
+unsigned int getNumStreams();
+unsigned int getPromoteChildren();
+unsigned int getLateralPeers();
+unsigned int getBandwidth();
+unsigned int getBackgroundBandwidth();
+unsigned int getDSCP();
+char *getServerCPUs();
+int getServerNice();
+int getServerNUMA();
+int getEmulateServers();
+bool getAttach();
+std::string getAttachDir();
 unique_id_t get_unique_id();
 std::string get_arg_session_id();
 session_status_t get_session_status();
+bool get_prolog_session();
 
 int getAppArgs(int *argc, char ***argv);
 
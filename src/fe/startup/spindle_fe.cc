@@ -25,10 +25,13 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_cobo.h"
 
 #include <string>
+#include <map>
 #include <cassert>
 #include <pwd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #if defined(USAGE_LOGGING_FILE)
@@ -60,12 +63,21 @@ void pack_param<char*>(char *value, char *buffer, unsigned int &pos)
 
 static int pack_data(spindle_args_t *args, void* &buffer, unsigned &buffer_size)
 {  
-   buffer_size = sizeof(unsigned int) * 6;
+   buffer_size = sizeof(unsigned int) * 15;
    buffer_size += sizeof(opt_t);
    buffer_size += sizeof(unique_id_t);
+   buffer_size += sizeof(int) * 2;
    buffer_size += args->location ? strlen(args->location) + 1 : 1;
    buffer_size += args->pythonprefix ? strlen(args->pythonprefix) + 1 : 1;
    buffer_size += args->preloadfile ? strlen(args->preloadfile) + 1 : 1;
+   buffer_size += args->stats_report ? strlen(args->stats_report) + 1 : 1;
+   buffer_size += args->predict_trace ? strlen(args->predict_trace) + 1 : 1;
+   buffer_size += args->reloc_rules ? strlen(args->reloc_rules) + 1 : 1;
+   buffer_size += args->disk_location ? strlen(args->disk_location) + 1 : 1;
+   buffer_size += args->shared_cache ? strlen(args->shared_cache) + 1 : 1;
+   buffer_size += args->cluster_cache ? strlen(args->cluster_cache) + 1 : 1;
+   buffer_size += args->rack_cache ? strlen(args->rack_cache) + 1 : 1;
+   buffer_size += args->server_cpus ? strlen(args->server_cpus) + 1 : 1;
 
    unsigned int pos = 0;
    char *buf = (char *) malloc(buffer_size);
@@ -77,9 +89,28 @@ static int pack_data(spindle_args_t *args, void* &buffer, unsigned &buffer_size)
    pack_param(args->use_launcher, buf, pos);
    pack_param(args->startup_type, buf, pos);
    pack_param(args->shm_cache_size, buf, pos);
+   pack_param(args->cache_budget, buf, pos);
+   pack_param(args->num_readers, buf, pos);
+   pack_param(args->num_streams, buf, pos);
+   pack_param(args->promote_children, buf, pos);
+   pack_param(args->lateral_peers, buf, pos);
+   pack_param(args->bandwidth, buf, pos);
+   pack_param(args->background_bandwidth, buf, pos);
+   pack_param(args->dscp, buf, pos);
+   pack_param(args->server_nice, buf, pos);
+   pack_param(args->server_numa, buf, pos);
+   pack_param(args->disk_threshold, buf, pos);
    pack_param(args->location, buf, pos);
    pack_param(args->pythonprefix, buf, pos);
    pack_param(args->preloadfile, buf, pos);
+   pack_param(args->stats_report, buf, pos);
+   pack_param(args->predict_trace, buf, pos);
+   pack_param(args->reloc_rules, buf, pos);
+   pack_param(args->disk_location, buf, pos);
+   pack_param(args->shared_cache, buf, pos);
+   pack_param(args->cluster_cache, buf, pos);
+   pack_param(args->rack_cache, buf, pos);
+   pack_param(args->server_cpus, buf, pos);
    assert(pos == buffer_size);
 
    buffer = (void *) buf;
@@ -170,6 +201,10 @@ static void setupSecurity(spindle_args_t *params)
          debug_printf("Initializing BE with NULL security\n");
          handshake.mechanism = hs_none;
          break;
+      case OPT_SEC_MUNGETICKET:
+         debug_printf("Initializing FE with munge ticket security\n");
+         handshake.mechanism = hs_munge_ticket;
+         break;
    }
    result = initialize_handshake_security(&handshake);
    if (result == -1) {
@@ -188,14 +223,19 @@ int getApplicationArgsFE(spindle_args_t *params, int *spindle_argc, char ***spin
    snprintf(opt_s, sizeof(opt_s), "%lu", (unsigned long) params->opts);
    snprintf(cachesize_s, sizeof(cachesize_s), "%u", params->shm_cache_size);
    
-   *spindle_argv = (char **) malloc(sizeof(char*) * 6);
-   (*spindle_argv)[0] = strdup(spindle_bootstrap);
-   (*spindle_argv)[1] = strdup(params->location);
-   (*spindle_argv)[2] = strdup(number_s);
-   (*spindle_argv)[3] = strdup(opt_s);
-   (*spindle_argv)[4] = strdup(cachesize_s);
-   (*spindle_argv)[5] = NULL;
-   *spindle_argc = 5;
+   int i = 0;
+   *spindle_argv = (char **) malloc(sizeof(char*) * 8);
+   (*spindle_argv)[i++] = strdup(spindle_bootstrap);
+   if (params->container_image) {
+      (*spindle_argv)[i++] = strdup("-image");
+      (*spindle_argv)[i++] = strdup(params->container_image);
+   }
+   (*spindle_argv)[i++] = strdup(params->location);
+   (*spindle_argv)[i++] = strdup(number_s);
+   (*spindle_argv)[i++] = strdup(opt_s);
+   (*spindle_argv)[i++] = strdup(cachesize_s);
+   (*spindle_argv)[i] = NULL;
+   *spindle_argc = i;
 
    return 0;
 }
@@ -217,6 +257,25 @@ void fillInSpindleArgsFE(spindle_args_t *params)
 }
 
 static void *md_data_ptr;
+static char *cur_preloadfile = NULL;
+
+/**
+ * The --bcast-file paths, plus with --self-stage the libraries Spindle
+ * has every process load, so each is read once by the root rather than
+ * by every process on every node.
+ **/
+static string getBcastFiles(spindle_args_t *params)
+{
+   string files = params->bcast_files ? string(params->bcast_files) : string();
+   if (!(params->opts & OPT_SELFSTAGE))
+      return files;
+
+   files += files.empty() ? "" : ":";
+   files += PROGLIBDIR "/libspindle*.so";
+   if (params->opts & OPT_PYIMPORT)
+      files += ":" PROGLIBDIR "/python/**";
+   return files;
+}
 
 int spindleInitFE(const char **hosts, spindle_args_t *params)
 {
@@ -229,14 +288,28 @@ int spindleInitFE(const char **hosts, spindle_args_t *params)
 
    /* Create preload message before initializing network to detect errors */
    ldcs_message_t *preload_msg = NULL;
+   string bcast_str = getBcastFiles(params);
+   const char *bcast_files = bcast_str.empty() ? NULL : bcast_str.c_str();
    if (params->opts & OPT_PRELOAD) {
+      cur_preloadfile = strdup(params->preloadfile);
       string preload_file = string(params->preloadfile);
-      preload_msg = parsePreloadFile(preload_file);
+      preload_msg = parsePreloadFile(preload_file, bcast_files);
       if (!preload_msg) {
          fprintf(stderr, "Failed to parse preload file %s\n", preload_file.c_str());
          return -1;
       }
    }
+   else if ((params->opts & OPT_PRELOADLEARN) && access(params->preloadfile, R_OK) == 0) {
+      /* Replay what an earlier run learned.  Without OPT_PRELOAD the
+         servers don't hold back clients while it's sent. */
+      preload_msg = parsePreloadFile(string(params->preloadfile), bcast_files);
+      if (!preload_msg)
+         err_printf("Could not replay learned preload file %s\n", params->preloadfile);
+   }
+   if (!preload_msg && bcast_files) {
+      /* Sent like a learned preload file, without holding back the job */
+      preload_msg = parsePreloadFile(string(), bcast_files);
+   }
 
    /* Compute hosts size */
    unsigned int hosts_size = 0;
@@ -246,7 +319,7 @@ int spindleInitFE(const char **hosts, spindle_args_t *params)
    debug_printf("Starting FE servers with hostlist of size %u on port %u\n", hosts_size, params->port);
    ldcs_audit_server_fe_md_open(const_cast<char **>(hosts), hosts_size, 
                                 params->port, params->num_ports, params->unique_id,
-                                &md_data_ptr);
+                                (params->opts & OPT_ELASTIC) ? 1 : 0, &md_data_ptr);
 
    /* Broadcast parameters */
    debug_printf("Sending parameters to servers\n");
@@ -270,6 +343,193 @@ int spindleInitFE(const char **hosts, spindle_args_t *params)
    return 0;   
 }
 
+/**
+ * Settings updates are [unsigned int version][unsigned int fields] followed
+ * by a string for each SETTINGS_* bit set in fields, in bit order, except
+ * SETTINGS_REVALIDATE, which has none.  Only what changed since the last
+ * update is sent, and servers drop an update whose version isn't newer
+ * than theirs.
+ **/
+static unsigned int settings_version = 0;
+
+static bool settingChanged(const char *oldval, const char *newval)
+{
+   if (!newval)
+      return false;
+   return !oldval || strcmp(oldval, newval) != 0;
+}
+
+/**
+ * Bring a session's servers up to date with the python prefix and preload
+ * file of a step about to run in it.  Either may be NULL to leave it as it
+ * is.  A new preload file is parsed and preloaded as at startup.  With
+ * --revalidate, every step's update has the servers recheck their cache.
+ **/
+int spindleUpdateSettingsFE(spindle_args_t *params, char *pythonprefix, char *preloadfile)
+{
+   unsigned int fields = 0;
+   ldcs_message_t *preload_msg = NULL;
+
+   if (settingChanged(params->pythonprefix, pythonprefix))
+      fields |= SETTINGS_PYTHONPREFIX;
+   if (settingChanged(cur_preloadfile, preloadfile)) {
+      preload_msg = parsePreloadFile(string(preloadfile));
+      if (!preload_msg) {
+         fprintf(stderr, "Failed to parse preload file %s\n", preloadfile);
+         return -1;
+      }
+      fields |= SETTINGS_PRELOADFILE;
+   }
+   if (params->opts & OPT_REVALIDATE)
+      fields |= SETTINGS_REVALIDATE;
+   if (!fields)
+      return 0;
+
+   unsigned int buffer_size = sizeof(unsigned int) * 2;
+   if (fields & SETTINGS_PYTHONPREFIX)
+      buffer_size += strlen(pythonprefix) + 1;
+   if (fields & SETTINGS_PRELOADFILE)
+      buffer_size += strlen(preloadfile) + 1;
+
+   unsigned int pos = 0;
+   char *buf = (char *) malloc(buffer_size);
+   pack_param(++settings_version, buf, pos);
+   pack_param(fields, buf, pos);
+   if (fields & SETTINGS_PYTHONPREFIX)
+      pack_param(pythonprefix, buf, pos);
+   if (fields & SETTINGS_PRELOADFILE)
+      pack_param(preloadfile, buf, pos);
+   assert(pos == buffer_size);
+
+   debug_printf("Sending settings update %u with fields 0x%x to servers\n", settings_version, fields);
+   ldcs_message_t msg;
+   msg.header.type = LDCS_MSG_SETTINGS_UPDATE;
+   msg.header.len = buffer_size;
+   msg.data = buf;
+   int result = ldcs_audit_server_fe_broadcast(&msg, md_data_ptr);
+   free(buf);
+
+   if (fields & SETTINGS_PYTHONPREFIX) {
+      free(params->pythonprefix);
+      params->pythonprefix = strdup(pythonprefix);
+   }
+   if (fields & SETTINGS_PRELOADFILE) {
+      free(cur_preloadfile);
+      cur_preloadfile = strdup(preloadfile);
+   }
+
+   if (preload_msg) {
+      debug_printf("Sending message with updated preload information\n");
+      if (result != -1)
+         result = ldcs_audit_server_fe_broadcast(preload_msg, md_data_ptr);
+      cleanPreloadMsg(preload_msg);
+   }
+   return result == -1 ? -1 : 0;
+}
+
+/**
+ * What spindle --control-session can change in a running session, and the
+ * settings update field each goes out in.
+ **/
+static const struct {
+   const char *name;
+   unsigned int field;
+} control_settings[] = {
+   { "distribution", SETTINGS_DISTMODEL },
+   { "bandwidth", SETTINGS_BANDWIDTH },
+   { "background-bandwidth", SETTINGS_BGBANDWIDTH },
+   { "predict-depth", SETTINGS_PREDICTDEPTH },
+   { "predict-chance", SETTINGS_PREDICTCHANCE },
+   { "log-level", SETTINGS_LOGLEVEL },
+   { NULL, 0 }
+};
+
+static bool controlValueOK(unsigned int field, const char *value)
+{
+   char *end;
+
+   if (!*value)
+      return false;
+   if (field == SETTINGS_DISTMODEL)
+      return strcmp(value, "push") == 0 || strcmp(value, "pull") == 0;
+   if (field == SETTINGS_PREDICTCHANCE) {
+      double chance = strtod(value, &end);
+      return !*end && chance >= 0.0 && chance <= 1.0;
+   }
+   if (*value == '-')
+      return false;
+   unsigned long num = strtoul(value, &end, 10);
+   if (*end || num > UINT_MAX)
+      return false;
+   return field != SETTINGS_LOGLEVEL || num <= 3;
+}
+
+/**
+ * Change settings of a running session's servers, for spindle
+ * --control-session.  Each of argv is name=value, with a name from
+ * control_settings.  If any is bad nothing is sent, and error says why.
+ **/
+int spindleControlFE(spindle_args_t *params, int argc, char **argv, string &error)
+{
+   map<unsigned int, string> values;
+   unsigned int fields = 0;
+   int i, j;
+
+   for (i = 0; i < argc; i++) {
+      const char *eq = strchr(argv[i], '=');
+      string name = eq ? string(argv[i], eq - argv[i]) : string(argv[i]);
+      for (j = 0; control_settings[j].name; j++) {
+         if (name == control_settings[j].name)
+            break;
+      }
+      if (!control_settings[j].name) {
+         error = "unknown setting " + name;
+         return -1;
+      }
+      if (!eq || !controlValueOK(control_settings[j].field, eq + 1)) {
+         error = "bad value for " + name;
+         return -1;
+      }
+      values[control_settings[j].field] = string(eq + 1);
+      fields |= control_settings[j].field;
+   }
+
+   /* The map keeps the fields in bit order */
+   unsigned int buffer_size = sizeof(unsigned int) * 2;
+   for (map<unsigned int, string>::iterator k = values.begin(); k != values.end(); k++)
+      buffer_size += k->second.length() + 1;
+
+   unsigned int pos = 0;
+   char *buf = (char *) malloc(buffer_size);
+   pack_param(++settings_version, buf, pos);
+   pack_param(fields, buf, pos);
+   for (map<unsigned int, string>::iterator k = values.begin(); k != values.end(); k++)
+      pack_param(const_cast<char *>(k->second.c_str()), buf, pos);
+   assert(pos == buffer_size);
+
+   debug_printf("Sending control update %u with fields 0x%x to servers\n", settings_version, fields);
+   ldcs_message_t msg;
+   msg.header.type = LDCS_MSG_SETTINGS_UPDATE;
+   msg.header.len = buffer_size;
+   msg.data = buf;
+   int result = ldcs_audit_server_fe_broadcast(&msg, md_data_ptr);
+   free(buf);
+   if (result == -1) {
+      error = "could not send the settings to the servers";
+      return -1;
+   }
+
+   if (fields & SETTINGS_DISTMODEL) {
+      params->opts &= ~(OPT_PUSH | OPT_PULL);
+      params->opts |= (values[SETTINGS_DISTMODEL] == "push") ? OPT_PUSH : OPT_PULL;
+   }
+   if (fields & SETTINGS_BANDWIDTH)
+      params->bandwidth = (unsigned int) strtoul(values[SETTINGS_BANDWIDTH].c_str(), NULL, 10);
+   if (fields & SETTINGS_BGBANDWIDTH)
+      params->background_bandwidth = (unsigned int) strtoul(values[SETTINGS_BGBANDWIDTH].c_str(), NULL, 10);
+   return 0;
+}
+
 int spindleCloseFE(spindle_args_t *params)
 {
    if (OPT_GET_SEC(params->opts) == OPT_SEC_KEYFILE) {
@@ -41,7 +41,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 using namespace std;
 
 static void setupLogging(int argc, char **argv);
+static bool initSpindle(Launcher *launcher, spindle_args_t *params);
 static bool getNextTask(Launcher *launcher, spindle_args_t *params, vector<JobTask*> &tasks);
+static int runWithoutSpindle();
+static int runAttached();
 
 #if defined(HAVE_LMON)
 extern Launcher *createLaunchmonLauncher(spindle_args_t *params);
@@ -49,6 +52,8 @@ extern Launcher *createLaunchmonLauncher(spindle_args_t *params);
 extern Launcher *createSerialLauncher(spindle_args_t *params);
 extern Launcher *createHostbinLauncher(spindle_args_t *params);
 extern Launcher *createMPILauncher(spindle_args_t *params);
+extern int spindleUpdateSettingsFE(spindle_args_t *params, char *pythonprefix, char *preloadfile);
+extern int spindleControlFE(spindle_args_t *params, int argc, char **argv, string &error);
 
 Launcher *newLauncher(spindle_args_t *params)
 {
@@ -78,6 +83,57 @@ Launcher *newLauncher(spindle_args_t *params)
    return NULL;
 }
 
+/**
+ * --auto decided the job is too small to be worth a server tree, so run
+ * its launch command line as it would have been run without us.
+ **/
+static int runWithoutSpindle()
+{
+   int app_argc, i, j;
+   char **app_argv, **new_argv;
+
+   getAppArgs(&app_argc, &app_argv);
+   new_argv = (char **) malloc(sizeof(char *) * (app_argc + 1));
+   for (i = 0, j = 0; i < app_argc; i++) {
+      if (strcmp(app_argv[i], "spindlemarker") != 0)
+         new_argv[j++] = app_argv[i];
+   }
+   new_argv[j] = NULL;
+
+   debug_printf("Running %s without spindle\n", new_argv[0]);
+   execvp(new_argv[0], new_argv);
+   fprintf(stderr, "Spindle Error: Could not run %s: %s\n", new_argv[0], strerror(errno));
+   err_printf("Could not exec %s: %s\n", new_argv[0], strerror(errno));
+   return -1;
+}
+
+/**
+ * --attach runs the command through the bootstrapper, which finds the
+ * server already running on this node from the records in the location's
+ * directory, and sets the command up as that server's client.
+ **/
+static int runAttached()
+{
+   int app_argc, i;
+   char **app_argv, **new_argv;
+   string attach_dir = getAttachDir();
+
+   getAppArgs(&app_argc, &app_argv);
+   new_argv = (char **) malloc(sizeof(char *) * (app_argc + 4));
+   new_argv[0] = const_cast<char *>(LIBEXECDIR "/spindle_bootstrap");
+   new_argv[1] = const_cast<char *>("-attach");
+   new_argv[2] = const_cast<char *>(attach_dir.c_str());
+   for (i = 0; i < app_argc; i++)
+      new_argv[i + 3] = app_argv[i];
+   new_argv[i + 3] = NULL;
+
+   debug_printf("Attaching %s to the server in %s\n", app_argv[0], attach_dir.c_str());
+   execv(new_argv[0], new_argv);
+   fprintf(stderr, "Spindle Error: Could not run %s: %s\n", new_argv[0], strerror(errno));
+   err_printf("Could not exec %s: %s\n", new_argv[0], strerror(errno));
+   return -1;
+}
+
 int main(int argc, char *argv[])
 {
    bool result;
@@ -86,6 +142,11 @@ int main(int argc, char *argv[])
    spindle_args_t *params = (spindle_args_t *) malloc(sizeof(spindle_args_t));;
    parseCommandLine(argc, argv, params);
 
+   if (getAttach())
+      return runAttached();
+   if (getAutoBypass())
+      return runWithoutSpindle();
+
    init_session(params);
 
    Launcher *launcher = newLauncher(params);
@@ -105,6 +166,14 @@ int main(int argc, char *argv[])
    int nonzero_rc = 0;
    bool session_shutdown = false, do_shutdown = false, initialized_spindle = false;
 
+   if (params->opts & OPT_SESSION) {
+      //Build the server tree while the session waits for its first job,
+      //so that no run-in-session step pays for it.
+      if (!initSpindle(launcher, params))
+         return -1;
+      initialized_spindle = true;
+   }
+
    //Main loop when running multiple jobs
    for (;;) {
       vector<JobTask*> tasks;
@@ -188,14 +257,8 @@ int main(int argc, char *argv[])
       }
 
       if ((num_run_jobs == 1 || do_shutdown) && !initialized_spindle) {
-         debug_printf("Calling spindleInitFE\n");
-         const char **hosts = launcher->getProcessTable();
-         int iresult = spindleInitFE(hosts, params);
-         if (iresult == -1) {
-            err_printf("[LMON FE] spindleInitFE returned an error\n");
+         if (!initSpindle(launcher, params))
             return -1;
-         }
-         debug_printf("Done calling spindleInitFE\n");
          initialized_spindle = true;
       }
 
@@ -207,6 +270,19 @@ int main(int argc, char *argv[])
    }
 }
 
+static bool initSpindle(Launcher *launcher, spindle_args_t *params)
+{
+   debug_printf("Calling spindleInitFE\n");
+   const char **hosts = launcher->getProcessTable();
+   int iresult = spindleInitFE(hosts, params);
+   if (iresult == -1) {
+      err_printf("[LMON FE] spindleInitFE returned an error\n");
+      return false;
+   }
+   debug_printf("Done calling spindleInitFE\n");
+   return true;
+}
+
 static void setupLogging(int argc, char **argv)
 {
    LOGGING_INIT(const_cast<char *>("FE"));
@@ -293,11 +369,33 @@ static bool getNextTask(Launcher *launcher, spindle_args_t *params, vector<JobTa
    if (session_fd != -1 && FD_ISSET(session_fd, &readset)) {
       bool session_complete = false;
       app_id_t appid;
-      result = get_session_runcmds(appid, app_argc, app_argv, session_complete);
+      char *pythonprefix = NULL, *preloadfile = NULL;
+      int control_argc = 0;
+      char **control_argv = NULL;
+      app_argc = 0;
+      result = get_session_runcmds(appid, app_argc, app_argv, pythonprefix, preloadfile,
+                                   control_argc, control_argv, session_complete);
       if (result == -1) {
          debug_printf("Error reading session command. Dropping.\n");
          return true;
       }
+      if (control_argc > 0) {
+         string error;
+         int rc = spindleControlFE(params, control_argc, control_argv, error);
+         if (rc == -1)
+            err_printf("Could not apply session control: %s\n", error.c_str());
+         return_session_control(rc == -1 ? -1 : 0, error.c_str());
+         for (int i = 0; i < control_argc; i++)
+            free(control_argv[i]);
+         free(control_argv);
+      }
+      if (app_argc > 0) {
+         //The servers take on this step's settings before it starts
+         if (spindleUpdateSettingsFE(params, pythonprefix, preloadfile) == -1)
+            err_printf("Could not update session settings for app-id %lu\n", appid);
+      }
+      free(pythonprefix);
+      free(preloadfile);
       if (session_complete) {
          JobTask *task = new JobTask();
          task->setSessionShutdown();
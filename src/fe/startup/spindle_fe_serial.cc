@@ -17,6 +17,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "spindle_launch.h"
 #include "spindle_debug.h"
 #include "launcher.h"
+#include "parseargs.h"
 
 #include <cerrno>
 #include <cstdlib>
@@ -26,6 +27,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sys/wait.h>
 
 #include <map>
+#include <vector>
 
 using namespace std;
 
@@ -35,13 +37,19 @@ class SerialLauncher : public ForkLauncher
 private:
    bool initError;
    pid_t daemon_pid;
+   int num_instances;
+   map<app_id_t, pair<int, int> > running_instances;
    static SerialLauncher *slauncher;
 
    SerialLauncher(spindle_args_t *params_);
+   bool forkDaemon(int instance);
+   bool forkJob(app_id_t id, char **app_argv, int instance);
 protected:
    virtual bool spawnDaemon();
 public:
    virtual bool spawnJob(app_id_t id, int app_argc, char **app_argv);
+   virtual bool getReturnCodes(bool &daemon_done, int &daemon_ret,
+                               vector<pair<app_id_t, int> > &app_rets);
    virtual const char **getProcessTable();
    virtual const char *getDaemonArg();
    virtual ~SerialLauncher();
@@ -60,7 +68,8 @@ Launcher *createSerialLauncher(spindle_args_t *params)
 
 SerialLauncher::SerialLauncher(spindle_args_t *params_) :
    ForkLauncher(params_),
-   initError(false)
+   initError(false),
+   num_instances(getEmulateServers())
 {
 }
 
@@ -68,7 +77,20 @@ SerialLauncher::~SerialLauncher()
 {
 }
 
-bool SerialLauncher::spawnJob(app_id_t id, int /*app_argc*/, char *app_argv[])
+/**
+ * With --emulate, every server and every copy of the job gets its instance
+ * number in the environment, which the location names, so each server has
+ * its own location and only the copy of the job with the same number asks
+ * it for files.
+ **/
+static void setInstance(int instance)
+{
+   char instance_s[32];
+   snprintf(instance_s, 32, "%d", instance);
+   setenv(EMULATE_INSTANCE_ENV, instance_s, 1);
+}
+
+bool SerialLauncher::forkJob(app_id_t id, char *app_argv[], int instance)
 {
    pid_t app_pid = fork();
    if (app_pid == -1) {
@@ -82,6 +104,8 @@ bool SerialLauncher::spawnJob(app_id_t id, int /*app_argc*/, char *app_argv[])
       return true;
    }
    else {
+      if (num_instances)
+         setInstance(instance);
       execvp(app_argv[0], app_argv);
       int error = errno;
       err_printf("Error exec'ing application %s: %s\n", app_argv[0], strerror(error));
@@ -90,8 +114,49 @@ bool SerialLauncher::spawnJob(app_id_t id, int /*app_argc*/, char *app_argv[])
       return false;
    }
 }
-   
-bool SerialLauncher::spawnDaemon()
+
+bool SerialLauncher::spawnJob(app_id_t id, int /*app_argc*/, char *app_argv[])
+{
+   if (!num_instances)
+      return forkJob(id, app_argv, 0);
+
+   running_instances[id] = make_pair(0, 0);
+   for (int i = 0; i < num_instances; i++) {
+      if (!forkJob(id, app_argv, i))
+         return false;
+      running_instances[id].first++;
+   }
+   return true;
+}
+
+/**
+ * An emulated job is done when its last copy exits, with the first
+ * non-zero return code of any of them.
+ **/
+bool SerialLauncher::getReturnCodes(bool &daemon_done, int &daemon_ret,
+                                    vector<pair<app_id_t, int> > &app_rets)
+{
+   vector<pair<app_id_t, int> > instance_rets;
+   if (!ForkLauncher::getReturnCodes(daemon_done, daemon_ret, instance_rets))
+      return false;
+
+   for (vector<pair<app_id_t, int> >::iterator i = instance_rets.begin(); i != instance_rets.end(); i++) {
+      map<app_id_t, pair<int, int> >::iterator j = running_instances.find(i->first);
+      if (j == running_instances.end()) {
+         app_rets.push_back(*i);
+         continue;
+      }
+      if (!j->second.second)
+         j->second.second = i->second;
+      if (--j->second.first == 0) {
+         app_rets.push_back(make_pair(i->first, j->second.second));
+         running_instances.erase(j);
+      }
+   }
+   return true;
+}
+
+bool SerialLauncher::forkDaemon(int instance)
 {
    daemon_pid = fork();
    if (daemon_pid == -1) {
@@ -111,6 +176,8 @@ bool SerialLauncher::spawnDaemon()
       setenv("SPINDLE_SERIAL_PORT", port_s, 1);
       setenv("SPINDLE_SERIAL_NUMPORTS", num_ports_s, 1);
       setenv("SPINDLE_SERIAL_SHARED", unique_id_s, 1);
+      if (num_instances)
+         setInstance(instance);
 
       execv(daemon_argv[0], daemon_argv);
       int error = errno;
@@ -120,12 +187,42 @@ bool SerialLauncher::spawnDaemon()
    }
 }
 
+bool SerialLauncher::spawnDaemon()
+{
+   if (!num_instances)
+      return forkDaemon(0);
+
+   debug_printf("Emulating %d servers on this host\n", num_instances);
+   for (int i = 0; i < num_instances; i++) {
+      if (!forkDaemon(i))
+         return false;
+   }
+   return true;
+}
+
+/**
+ * Emulated servers are each named by a loopback address of their own.
+ * They all listen on every address, so the tree's connections reach this
+ * host whatever the name, and each is taken by whichever server is still
+ * waiting for its parent.
+ **/
 const char **SerialLauncher::getProcessTable()
 {
    const char **hostlist;
-   hostlist = (const char **) malloc(sizeof(const char *) * 2);
-   hostlist[0] = "localhost";
-   hostlist[1] = NULL;
+   if (!num_instances) {
+      hostlist = (const char **) malloc(sizeof(const char *) * 2);
+      hostlist[0] = "localhost";
+      hostlist[1] = NULL;
+      return hostlist;
+   }
+
+   hostlist = (const char **) malloc(sizeof(const char *) * (num_instances + 1));
+   for (int i = 0; i < num_instances; i++) {
+      char host[32];
+      snprintf(host, sizeof(host), "127.0.%d.%d", (i + 1) / 256, (i + 1) % 256);
+      hostlist[i] = strdup(host);
+   }
+   hostlist[num_instances] = NULL;
    return hostlist;
 }
 
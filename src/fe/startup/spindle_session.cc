@@ -55,6 +55,7 @@ static int sock = -1;
 #define RET_JOB_DONE 1
 #define RET_RUN_CMD 2
 #define RET_END_SESSION 3
+#define RET_CONTROL 4
 
 static void create_session_id()
 {
@@ -76,6 +77,76 @@ static void set_session_id(string id)
    session_socket = string(socket_name) + SOCKET_PREFIX + id;
 }
 
+/**
+ * --prolog records its session-id in a file named for the Slurm job, in
+ * $SPINDLE_SESSION_DIR, $TMPDIR or /tmp, so the job's steps can find the
+ * session by giving JOB_SESSION_ID.
+ **/
+static string job_session_file()
+{
+   const char *dir = getenv("SPINDLE_SESSION_DIR");
+   const char *jobid = getenv("SLURM_JOB_ID");
+
+   if (!dir)
+      dir = getenv("TMPDIR");
+   if (!dir)
+      dir = "/tmp";
+   return string(dir) + "/spindle_session." + string(jobid ? jobid : "");
+}
+
+static int record_job_session()
+{
+   string filename = job_session_file();
+   string tmpname = filename + ".tmp";
+   string contents = session_id + "\n";
+
+   int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1) {
+      int error = errno;
+      err_printf("Could not create session file %s: %s\n", tmpname.c_str(), strerror(error));
+      return -1;
+   }
+   if (write(fd, contents.c_str(), contents.length()) != (ssize_t) contents.length()) {
+      int error = errno;
+      err_printf("Could not write session file %s: %s\n", tmpname.c_str(), strerror(error));
+      close(fd);
+      unlink(tmpname.c_str());
+      return -1;
+   }
+   close(fd);
+   if (rename(tmpname.c_str(), filename.c_str()) == -1) {
+      int error = errno;
+      err_printf("Could not rename session file to %s: %s\n", filename.c_str(), strerror(error));
+      unlink(tmpname.c_str());
+      return -1;
+   }
+   debug_printf("Recorded session %s in %s\n", session_id.c_str(), filename.c_str());
+   return 0;
+}
+
+static int read_job_session(string &id)
+{
+   string filename = job_session_file();
+   char buffer[256];
+   ssize_t len;
+
+   int fd = open(filename.c_str(), O_RDONLY);
+   if (fd == -1) {
+      int error = errno;
+      err_printf("Could not open session file %s: %s\n", filename.c_str(), strerror(error));
+      return -1;
+   }
+   do {
+      len = read(fd, buffer, sizeof(buffer) - 1);
+   } while (len == -1 && errno == EINTR);
+   close(fd);
+   if (len <= 0)
+      return -1;
+   buffer[len] = '\0';
+   id = string(buffer, strcspn(buffer, "\n"));
+   return id.empty() ? -1 : 0;
+}
+
 static int create_unixsocket()
 {
    struct sockaddr_un local;
@@ -329,8 +400,52 @@ static void finish_session_startup(bool err)
 }
 static app_id_t next_app_id = 1;
 static map<app_id_t, int> socket_ids;
+static int control_client = -1;
+
+/**
+ * A run-in-session step follows its command line with the settings it
+ * was given that the session's servers can take on mid-session: the
+ * python prefix and the preload file, or "" for no preload file.
+ **/
+static int send_settings(int fd, spindle_args_t *args)
+{
+   char *settings[2];
+   char preload_path[PATH_MAX];
+
+   settings[0] = args->pythonprefix ? args->pythonprefix : const_cast<char *>("");
+   settings[1] = const_cast<char *>("");
+   if ((args->opts & OPT_PRELOAD) && args->preloadfile) {
+      /* The session runs in another directory */
+      if (realpath(args->preloadfile, preload_path))
+         settings[1] = preload_path;
+      else
+         settings[1] = args->preloadfile;
+   }
+   return send_msg(fd, 2, settings);
+}
+
+static int get_settings(int fd, char* &pythonprefix, char* &preloadfile)
+{
+   int argc = 0;
+   char **argv = NULL;
+   int result = get_msg(fd, argc, argv);
+   if (result == -1 || argc != 2) {
+      err_printf("Bad settings message from run-in-session client\n");
+      return -1;
+   }
+   pythonprefix = argv[0];
+   preloadfile = argv[1];
+   if (!*preloadfile) {
+      free(preloadfile);
+      preloadfile = NULL;
+   }
+   free(argv);
+   return 0;
+}
 
-int get_session_runcmds(app_id_t &appid, int &app_argc, char** &app_argv, bool &session_complete)
+int get_session_runcmds(app_id_t &appid, int &app_argc, char** &app_argv, char* &pythonprefix,
+                        char* &preloadfile, int &control_argc, char** &control_argv,
+                        bool &session_complete)
 {
    debug_printf("Receiving client request in session handler\n");
 
@@ -353,6 +468,8 @@ int get_session_runcmds(app_id_t &appid, int &app_argc, char** &app_argv, bool &
    }
    if (cmd == RET_RUN_CMD) {
       result = get_msg(client, app_argc, app_argv);
+      if (result != -1)
+         result = get_settings(client, pythonprefix, preloadfile);
       if (result == -1) {
          debug_printf("Error reading message from client on socket %d\n", client);
          close(client);
@@ -362,6 +479,17 @@ int get_session_runcmds(app_id_t &appid, int &app_argc, char** &app_argv, bool &
       socket_ids[appid] = client;
       session_complete = false;
    }
+   if (cmd == RET_CONTROL) {
+      result = get_msg(client, control_argc, control_argv);
+      if (result == -1) {
+         debug_printf("Error reading control message from client on socket %d\n", client);
+         close(client);
+         return -1;
+      }
+      /* Answered by return_session_control once the servers have the update */
+      control_client = client;
+      session_complete = false;
+   }
    if (cmd == RET_END_SESSION) {
       debug_printf("Received session shutdown message\n");
       session_complete = true;
@@ -391,6 +519,11 @@ int init_session(spindle_args_t *args)
       debug_printf("New session code is %s\n", session_id.c_str());
       debug_printf("New session socket is %s\n", session_socket.c_str());
 
+      if (get_prolog_session() && record_job_session() == -1) {
+         fprintf(stderr, "ERROR: Spindle could not record the session for Slurm job %s\n", getenv("SLURM_JOB_ID"));
+         exit(-1);
+      }
+
       //Print new session id
       write(1, session_id.c_str(), session_id.length());
       write(1, "\n", 1);
@@ -425,7 +558,13 @@ int init_session(spindle_args_t *args)
       return 0;
    }
 
-   set_session_id(get_arg_session_id());
+   string id = get_arg_session_id();
+   bool job_session = (id == JOB_SESSION_ID);
+   if (job_session && read_job_session(id) == -1) {
+      fprintf(stderr, "ERROR: Spindle found no session started by --prolog for Slurm job %s\n", getenv("SLURM_JOB_ID"));
+      exit(-1);
+   }
+   set_session_id(id);
    debug_printf("Connecting to existing spindle session-id %s\n", session_id.c_str());
    result = connect_to_session();
    if (result == -1) {
@@ -446,6 +585,8 @@ int init_session(spindle_args_t *args)
          goto done;
       }
       result = send_msg(sock, app_argc, app_argv);
+      if (result != -1)
+         result = send_settings(sock, args);
       if (result == -1) {
          debug_printf("Error sending app cmdline\n");
          goto done;
@@ -486,6 +627,32 @@ int init_session(spindle_args_t *args)
       exit(-1);
    }
    
+   if (sstatus == sstatus_control) {
+      debug_printf("Sending settings to session-id %s\n", session_id.c_str());
+      int control_argc, rc = -1;
+      char **control_argv;
+      int cmd = RET_CONTROL;
+      getAppArgs(&control_argc, &control_argv);
+      result = safe_send(sock, &cmd, sizeof(cmd));
+      if (result != -1)
+         result = send_msg(sock, control_argc, control_argv);
+      if (result != -1)
+         result = safe_recv(sock, &rc, sizeof(rc));
+      if (result != -1 && rc != 0)
+         result = get_msg(sock, control_argc, control_argv);
+      close(sock);
+      if (result == -1) {
+         fprintf(stderr, "Spindle error while communicating with session %s\n", session_id.c_str());
+         exit(-1);
+      }
+      if (rc != 0) {
+         fprintf(stderr, "ERROR: Spindle session %s did not take the settings: %s\n", session_id.c_str(),
+                 control_argc == 1 ? control_argv[0] : "unknown error");
+         exit(-1);
+      }
+      exit(0);
+   }
+
    if (sstatus == sstatus_end) {
       debug_printf("Telling session-id %s to shutdown\n", session_id.c_str());
       int cmd = RET_END_SESSION;
@@ -495,6 +662,8 @@ int init_session(spindle_args_t *args)
          fprintf(stderr, "Spindle error while communicating with session %s\n", session_id.c_str());
          exit(-1);
       }
+      if (job_session)
+         unlink(job_session_file().c_str());
       exit(0);
    }
 
@@ -534,3 +703,20 @@ int return_session_cmd(app_id_t appid, int app_argc, char **app_argv)
    close(client);
    return result;
 }
+
+void return_session_control(int rc, const char *error)
+{
+   char *msg[1];
+   int result;
+
+   assert(control_client != -1);
+   result = safe_send(control_client, &rc, sizeof(rc));
+   if (result != -1 && rc != 0) {
+      msg[0] = const_cast<char *>(error);
+      result = send_msg(control_client, 1, msg);
+   }
+   if (result == -1)
+      debug_printf("Error answering control request on socket %d\n", control_client);
+   close(control_client);
+   control_client = -1;
+}
@@ -21,9 +21,12 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "launcher.h"
 
 int init_session(spindle_args_t *args);
-int get_session_runcmds(app_id_t &appid, int &app_argc, char** &app_argv, bool &session_complete);
+int get_session_runcmds(app_id_t &appid, int &app_argc, char** &app_argv, char* &pythonprefix,
+                        char* &preloadfile, int &control_argc, char** &control_argv,
+                        bool &session_complete);
 int get_session_fd();
 int return_session_cmd(app_id_t appid, int app_argc, char **app_argv);
 void mark_session_job_done(app_id_t appid, int rc);
+void return_session_control(int rc, const char *error);
 
 #endif
@@ -67,9 +67,99 @@ typedef enum {
    LDCS_MSG_EXIT_READY,
    LDCS_MSG_EXIT_CANCEL,
    LDCS_MSG_EXIT,
+   LDCS_MSG_CACHE_ENTRIES_BATCH,
+   LDCS_MSG_FILE_ALIAS,
+   LDCS_MSG_PRELOAD_ALIAS,
+   LDCS_MSG_FILE_QUERY_LAZY,
+   LDCS_MSG_FILE_RANGE_QUERY,
+   LDCS_MSG_FILE_RANGE_ANSWER,
+   LDCS_MSG_LAZY_FILE,
+   LDCS_MSG_FILE_RANGE_REQUEST,
+   LDCS_MSG_FILE_RANGE_DATA,
+   LDCS_MSG_FILE_QUERY_BATCH,
+   LDCS_MSG_PEER_SEND,
+   LDCS_MSG_FILE_QUERY_FD,
+   LDCS_MSG_FILE_QUERY_SEARCH,
+   LDCS_MSG_FILE_QUERY_FIRST,
+   LDCS_MSG_FILE_BUNDLE,
+   LDCS_MSG_PREFETCH_DIR,
+   LDCS_MSG_SETTINGS_UPDATE,
+   LDCS_MSG_STATS_REPORT,
+   LDCS_MSG_CLIENT_TIMING,
+   LDCS_MSG_RELOCRULES_REQ,
+   LDCS_MSG_RELOCRULES_RESP,
+   LDCS_MSG_STARTUP_DONE,
+   LDCS_MSG_DIR_QUERY,
+   LDCS_MSG_READLINK_QUERY,
+   LDCS_MSG_REALPATH_QUERY,
+   LDCS_MSG_STRIPE_REQUEST,
+   LDCS_MSG_STRIPE_DATA,
+   LDCS_MSG_INVALIDATE,
+   LDCS_MSG_HELLO,
+   LDCS_MSG_HELLO_ANSWER,
+   LDCS_MSG_FILE_QUERY_EXEC,
+   LDCS_MSG_JIT_QUERY,
+   LDCS_MSG_JIT_PUBLISH,
+   LDCS_MSG_KVS_PUT,
+   LDCS_MSG_KVS_FENCE,
+   LDCS_MSG_KVS_GET,
+   LDCS_MSG_KVS_ANSWER,
+   LDCS_MSG_KVS_GATHER,
+   LDCS_MSG_KVS_TABLE,
+   LDCS_MSG_FILE_RANGE_PUSH,
+   LDCS_MSG_JOIN_RANK,
+   LDCS_MSG_JIT_CLAIM,
    LDCS_MSG_UNKNOWN
 } ldcs_message_ids_t;
 
+/* Fields a LDCS_MSG_SETTINGS_UPDATE can carry */
+#define SETTINGS_PYTHONPREFIX  (1 << 0)
+#define SETTINGS_PRELOADFILE   (1 << 1)
+#define SETTINGS_REVALIDATE    (1 << 2)
+#define SETTINGS_DISTMODEL     (1 << 3)
+#define SETTINGS_BANDWIDTH     (1 << 4)
+#define SETTINGS_BGBANDWIDTH   (1 << 5)
+#define SETTINGS_PREDICTDEPTH  (1 << 6)
+#define SETTINGS_PREDICTCHANCE (1 << 7)
+#define SETTINGS_LOGLEVEL      (1 << 8)
+
+/* What a LDCS_MSG_HELLO carries or asks for.  It's [int pid][unsigned int
+   flags][location] then [cwd] with HELLO_CWD, then [unsigned int step]
+   with HELLO_STEP.  The answer, sent only if something is asked for, is
+   [int rankinfo[4]] then the python prefix and relocation rules, each a
+   string, if asked for */
+#define HELLO_CWD          (1 << 0)
+#define HELLO_RANKINFO     (1 << 1)
+#define HELLO_PYTHONPREFIX (1 << 2)
+#define HELLO_RELOCRULES   (1 << 3)
+#define HELLO_STEP         (1 << 4)
+
+/* A LDCS_MSG_FILE_QUERY_EXEC is [name][PATH], each a string, for the exec
+   of a name without a '/'.  Its answer is that of a
+   LDCS_MSG_FILE_QUERY_FIRST, whose candidates are PATH's entries in order */
+
+/* A LDCS_MSG_JIT_QUERY is the absolute path of a file under a jit
+   relocation rule.  It's answered like a LDCS_MSG_FILE_QUERY, with the
+   staged copy, or with errcode 0 when the client should use the path
+   itself.  A LDCS_MSG_JIT_CLAIM, with the same path as the client opens
+   the file for writing, and a LDCS_MSG_JIT_PUBLISH, once it has written
+   the file, get no answer */
+
+/* A LDCS_MSG_KVS_PUT is [key][value], each a string, and gets no answer.
+   A LDCS_MSG_KVS_FENCE is [int local_procs], the number of the node's
+   processes taking part, and is answered with a LDCS_MSG_KVS_ANSWER of
+   [int errcode] once the whole job has fenced.  A LDCS_MSG_KVS_GET is
+   [key], answered with the value, or with an empty LDCS_MSG_KVS_ANSWER if
+   nothing was put for it before the last fence.  Between servers, a
+   LDCS_MSG_KVS_GATHER carries a subtree's puts up and a LDCS_MSG_KVS_TABLE
+   carries everyone's down, each as packed [key][value] pairs */
+#define LDCS_KVS_MAX_KEY 256
+#define LDCS_KVS_MAX_VALUE 1024
+
+/* A LDCS_MSG_JOIN_RANK is [int md_rank][int request][int rank] and gets a
+   server joining below md_rank its rank from the root.  It goes up with a
+   rank of -1 and comes back down to everyone with the rank filled in */
+
 typedef  enum {
    LDCS_READ_BLOCK,
    LDCS_READ_NO_BLOCK,
@@ -94,7 +184,8 @@ typedef  enum {
 struct ldcs_message_header_struct
 {
   ldcs_message_ids_t type;
-  int len;
+  int req;      /* a client query's request id, which its answer carries back, or 0 */
+  int64_t len;  /* 64-bit, as file messages carry a whole file */
 };
 
 typedef struct ldcs_message_header_struct ldcs_message_header_t;
@@ -111,6 +202,10 @@ ldcs_message_t * ldcs_recv_msg(int fd, ldcs_read_block_t block);
 int ldcs_recv_msg_static(int fd, ldcs_message_t *msg, ldcs_read_block_t block);
 int ldcs_get_aux_fd();
 
+/* Send msg with an open descriptor attached, on transports that can carry one */
+int ldcs_can_send_fd();
+int ldcs_send_msg_fd(int connid, ldcs_message_t *msg, int passfd);
+
 int ldcs_create_server(char* location, int number);
 int ldcs_open_server_connection(int serverid);
 int ldcs_open_server_connections(int fd, int nc, int *more_avail);
@@ -142,6 +237,57 @@ typedef struct {
    int64_t binding_offset;
 } ldso_info_t;
 
+/* Set in the leading int of a LDCS_MSG_FILE_QUERY_LAZY answer when the file is
+   staged lazily, and its ranges must be fetched with LDCS_MSG_FILE_RANGE_QUERY */
+#define LDCS_ANSWER_LAZY 1
+
+/* Set in the leading int of a LDCS_MSG_FILE_QUERY_FD answer when an open,
+   read-only descriptor for the file came with the message */
+#define LDCS_ANSWER_FD 2
+
+/* Set in the leading int of a LDCS_MSG_FILE_QUERY_SEARCH,
+   LDCS_MSG_FILE_QUERY_FIRST or LDCS_MSG_FILE_QUERY_EXEC answer, which has
+   the index of the candidate that was found in a second int before the path */
+#define LDCS_ANSWER_SEARCH 4
+
+/* Set with LDCS_ANSWER_SEARCH when the file came from ld.so.cache, and its
+   path follows the local one */
+#define LDCS_ANSWER_SEARCH_PATH 8
+
+/* A file query answered with a staged name that ends in this has a copy
+   for each NUMA node, named with the node's number added.  Staged names
+   never have a '$' of their own. */
+#define NUMA_REPLICA_SUFFIX "$numa"
+
 #define MAX_PATH_LEN 4096
+
+/* Largest message a client sends its server.  Servers receive client
+   messages into buffers of this size. */
+#define LDCS_MAX_MSG_LEN (64*1024)
+
+/* With OPT_CLIENTTIMING, a client sends the calls it intercepted and the
+   time it spent in them in a LDCS_MSG_CLIENT_TIMING, ahead of its
+   LDCS_MSG_END.  CLIENT_TIMING_WAIT is time spent waiting on the server
+   for answers, which is also counted in the interception it happened in.
+   CLIENT_TIMING_FALLBACK is the queries given up at their
+   SPINDLE_CLIENT_DEADLINE and the time they waited, which a client sends
+   even without OPT_CLIENTTIMING. */
+typedef enum {
+   CLIENT_TIMING_OPEN,
+   CLIENT_TIMING_STAT,
+   CLIENT_TIMING_OBJSEARCH,
+   CLIENT_TIMING_WAIT,
+   CLIENT_TIMING_FALLBACK,
+   CLIENT_TIMING_NUM
+} client_timing_id_t;
+
+typedef struct {
+   uint64_t calls[CLIENT_TIMING_NUM];
+   uint64_t nsecs[CLIENT_TIMING_NUM];
+} client_timing_msg_t;
+
+/* Queries a client may have in flight at once, with request ids 1 to this.
+   Threads past this many wait for a free id before they send. */
+#define LDCS_MAX_REQUESTS 64
 #define MAX_NAME_LEN 255
 #endif
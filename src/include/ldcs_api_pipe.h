@@ -17,6 +17,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef LDCS_API_PIPE_H
 #define LDCS_API_PIPE_H
 
+#include <sys/types.h>
 #include "ldcs_api.h"
 
 int ldcs_open_connection_pipe(char* location, int number);
@@ -26,6 +27,7 @@ int ldcs_open_server_connection_pipe(int fd);
 int ldcs_open_server_connections_pipe(int fd, int nc, int *more_avail);
 int ldcs_close_server_connection_pipe(int fd);
 int ldcs_get_fd_pipe(int id);
+char *ldcs_get_in_fn_pipe(int id);
 int ldcs_destroy_server_pipe(int fd);
 int ldcs_send_msg_pipe(int fd, ldcs_message_t * msg);
 ldcs_message_t * ldcs_recv_msg_pipe(int fd, ldcs_read_block_t block );
@@ -34,8 +36,8 @@ char *ldcs_get_connection_string_pipe(int fd);
 int ldcs_register_connection_pipe(char *connection_str);
 
 /* internal */
-int _ldcs_write_pipe(int fd, const void *data, int bytes );
-int _ldcs_read_pipe(int fd, void *data, int bytes, ldcs_read_block_t block );
+ssize_t _ldcs_write_pipe(int fd, const void *data, size_t bytes );
+ssize_t _ldcs_read_pipe(int fd, void *data, size_t bytes, ldcs_read_block_t block );
 
 typedef enum {
    LDCS_PIPE_FD_TYPE_SERVER,
@@ -33,6 +33,7 @@ struct fdlist_entry_t
   int   conn_list_size; 
   int   conn_list_used; 
   int  *conn_list; 
+  char *path;
 
   /* connection part */
   int   fd;
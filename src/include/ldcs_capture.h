@@ -0,0 +1,54 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_CAPTURE_H_)
+#define LDCS_CAPTURE_H_
+
+#include <stdint.h>
+
+/**
+ * A capture file, written by a server with SPINDLE_CAPTURE_DIR set and
+ * read by spindle_replay, is a capture_header_t followed by one record per
+ * message the server got from a local client, in arrival order.  Each
+ * record is a capture_record_t followed by the message's len bytes of
+ * data, which for a query is the path.  Clients are told apart by the
+ * server's index for their connection, which is reused once a client
+ * sends LDCS_MSG_END.  Fields are in the server's byte order.
+ **/
+
+#define CAPTURE_MAGIC 0x53504e43
+#define CAPTURE_VERSION 1
+#define CAPTURE_NAME "spindle_capture"
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   int32_t rank;         /* the server's rank in the tree */
+   uint32_t pad;
+   double start;         /* when the server started capturing, in seconds */
+} capture_header_t;
+
+typedef struct {
+   uint64_t usec;        /* arrival, in microseconds since start */
+   int32_t client;       /* the server's index for the client's connection */
+   int32_t lrank;        /* the client's rank on the node, by when it connected */
+   uint32_t type;        /* ldcs_message_ids_t */
+   int32_t req;          /* request id the client waits on an answer for, or 0 */
+   uint32_t len;
+   uint32_t pad;
+} capture_record_t;
+
+#endif
@@ -0,0 +1,84 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_NAMESNAP_H_)
+#define LDCS_NAMESNAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The name snapshot is a file in the server's local location holding the
+ * server's answers to file queries: a global path, and the local path of
+ * its staged copy or the errno it was answered with.  The server mmaps it
+ * read-write and is its only writer; clients mmap it read-only and look a
+ * path up there before asking the server.
+ *
+ * The entries are an open addressing table with linear probing, followed
+ * by an append-only area of NUL-terminated strings that entries point
+ * into.  Each entry has its own sequence number, which is odd while the
+ * server writes it.  A reader takes the sequence number, reads the entry
+ * and its strings, and only trusts what it read if the sequence number is
+ * even and hasn't changed, so readers take no locks and a torn or
+ * in-progress entry is just a miss.  Sequence numbers only go up, so an
+ * entry that was cleared and reused while a reader looked at it is never
+ * mistaken for the one it read.  An entry with an even sequence number
+ * and no key is empty and ends a probe.  Clearing the snapshot bumps
+ * every used entry, then reuses the string area, and bumps the header's
+ * generation.
+ **/
+
+#define NAMESNAP_MAGIC 0x53504e4e
+#define NAMESNAP_VERSION 1
+#define NAMESNAP_NAME "spindle_names"
+#define NAMESNAP_DEFAULT_ENTRIES (64*1024)      /* must be a power of two */
+#define NAMESNAP_STRING_BYTES_PER_ENTRY 256
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t entry_size;
+   uint32_t max_entries;
+   uint32_t strings_size;
+   uint32_t generation;
+} namesnap_header_t;
+
+typedef struct {
+   volatile uint32_t seq;
+   uint32_t hash;
+   int32_t errcode;
+   uint32_t key_off;
+   uint32_t key_len;       /* without the NUL, 0 for an empty entry */
+   uint32_t value_off;
+   uint32_t value_len;     /* 0 for no local path */
+   uint32_t pad;
+} namesnap_entry_t;
+
+#define NAMESNAP_SIZE(ENTRIES, STRBYTES) (sizeof(namesnap_header_t) + ((size_t) (ENTRIES)) * sizeof(namesnap_entry_t) + (STRBYTES))
+#define NAMESNAP_ENTRY(HDR, I) (((namesnap_entry_t *) (((char *) (HDR)) + sizeof(namesnap_header_t))) + (I))
+#define NAMESNAP_STRINGS(HDR) (((char *) (HDR)) + sizeof(namesnap_header_t) + ((size_t) (HDR)->max_entries) * sizeof(namesnap_entry_t))
+
+static inline uint32_t namesnap_hash(const char *str, size_t *len)
+{
+   uint32_t hash = 2166136261U;
+   const char *c;
+   for (c = str; *c; c++)
+      hash = (hash ^ (unsigned char) *c) * 16777619U;
+   *len = c - str;
+   return hash;
+}
+
+#endif
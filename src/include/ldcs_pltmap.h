@@ -0,0 +1,69 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_PLTMAP_H_)
+#define LDCS_PLTMAP_H_
+
+#include <stdint.h>
+
+/**
+ * A PLT map lists the PLT relocations of a library that bind to a function
+ * the client intercepts.  In subaudit mode a server writes one next to each
+ * ELF file it stages, named as the local file plus PLTMAP_SUFFIX.  The
+ * subaudit client then patches a library's bindings from the map, rather
+ * than walking its relocations and hashing every symbol name.  A library
+ * without a map is walked as before.
+ *
+ * Entries name their function by its index in PLTMAP_NAME_LIST.  The list
+ * must hold every name in the client's spindle_bindings table, which
+ * init_bindings_hash checks.
+ **/
+
+#define PLTMAP_MAGIC 0x504c544d
+#define PLTMAP_VERSION 1
+#define PLTMAP_SUFFIX ".spindle_plt"
+
+#define PLTMAP_NAME_LIST                                                \
+   "open", "open64", "openat", "openat64", "fopen", "fopen64", "close", \
+   "read", "pread", "pread64", "readv", "mmap", "mmap64", "dup", "dup2", \
+   "dup3", "fdopen", "chdir", "fchdir", "stat", "lstat", "__xstat",     \
+   "__xstat64", "__lxstat", "__lxstat64", "fstat", "__fxstat",          \
+   "__fxstat64", "fstatat", "fstatat64", "__fxstatat", "__fxstatat64",  \
+   "statx", "faccessat", "execl", "execv", "execle", "execve", "execlp", \
+   "execvp", "vfork", "readlink", "readlinkat", "spindle_enable",       \
+   "spindle_disable", "spindle_is_enabled", "spindle_is_present",       \
+   "spindle_open", "spindle_stat", "spindle_lstat", "spindle_fopen",    \
+   "spindle_find_first", "spindle_prefetch", "spindle_prefetch_dir",    \
+   "spindle_test_log_msg", "lseek", "lseek64", "spindle_startup_done",  \
+   "opendir", "closedir", "dirfd", "realpath", "__realpath_chk",        \
+   "spindle_bcast_file", "rename", "renameat", "spindle_kvs_put",      \
+   "spindle_kvs_fence", "spindle_kvs_get", "spindle_quiesce",           \
+   "MPI_Init", "MPI_Init_thread"
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t num_names;
+   uint32_t num_entries;
+} pltmap_header_t;
+
+typedef struct {
+   uint64_t offset;
+   uint32_t name;
+   uint32_t pad;
+} pltmap_entry_t;
+
+#endif
@@ -0,0 +1,59 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_STATSEG_H_)
+#define LDCS_STATSEG_H_
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * The stat segment is a file in the server's local location that holds
+ * one struct stat per slot.  The server mmaps it read-write and appends
+ * stat results to it; clients mmap it read-only.  A stat answer that
+ * lives in the segment is sent to the client as STATSEG_REF_PREFIX
+ * followed by the decimal slot index, instead of the path of a local
+ * file holding the struct stat.  Slots are never reused, and a slot is
+ * fully written before its reference is handed out.
+ **/
+
+#define STATSEG_MAGIC 0x53504e53
+#define STATSEG_VERSION 1
+#define STATSEG_NAME "spindle_statseg"
+#define STATSEG_REF_PREFIX "#statseg:"
+#define STATSEG_REF_PREFIX_LEN (sizeof(STATSEG_REF_PREFIX)-1)
+#define STATSEG_DEFAULT_ENTRIES (64*1024)
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t entry_size;
+   uint32_t max_entries;
+   uint32_t num_entries;
+   uint32_t pad;
+} statseg_header_t;
+
+typedef struct {
+   uint32_t valid;
+   uint32_t pad;
+   struct stat buf;
+} statseg_entry_t;
+
+#define STATSEG_SIZE(NUM_ENTRIES) (sizeof(statseg_header_t) + ((size_t) (NUM_ENTRIES)) * sizeof(statseg_entry_t))
+#define STATSEG_ENTRY(HDR, I) (((statseg_entry_t *) (((char *) (HDR)) + sizeof(statseg_header_t))) + (I))
+#define STATSEG_IS_REF(NAME) (strncmp((NAME), STATSEG_REF_PREFIX, STATSEG_REF_PREFIX_LEN) == 0)
+
+#endif
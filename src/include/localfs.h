@@ -0,0 +1,55 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LOCALFS_H_)
+#define LOCALFS_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+ * With --local-bypass, paths on file systems that every node has its own
+ * copy of, such as the root image's ext4, xfs, overlay, squashfs or
+ * tmpfs, are read in place rather than relocated.  Each mount point is
+ * checked with statfs the first time a path under it is asked about, and
+ * the answer is kept.  Network and automount mounts are known from their
+ * type in the mount table, and aren't statfs'd.
+ *
+ * With --pfs-metadata, the server also asks whether a path is on a
+ * Lustre or GPFS mount, which is known from the mount table alone.
+ *
+ * The mount table is read once, by localfs_init, and mounts made after
+ * that are judged by the mount they're under.  Like relocrules, this
+ * doesn't allocate, since the client runs it inside ld.so's audit
+ * interface.
+ **/
+
+/* Read the mount table.  Returns -1 if it couldn't be read, in which case
+   nothing is local */
+int localfs_init();
+
+/* Return 1 if the absolute path is on a node-local file system, else 0 */
+int localfs_is_local(const char *path);
+
+/* Return 1 if the absolute path is on a Lustre or GPFS mount, else 0 */
+int localfs_is_parallel(const char *path);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
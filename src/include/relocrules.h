@@ -0,0 +1,69 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(RELOCRULES_H_)
+#define RELOCRULES_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+ * Relocation rules from --reloc-rules, one to a line:
+ *
+ *   ACTION GLOB [>SIZE | <SIZE]
+ *
+ * ACTION is relocate, push, pass or jit.  GLOB is matched against the
+ * whole absolute path, where '*' matches any run of characters, '/'
+ * included, and '?' any one.  SIZE is in bytes, or with a K, M, G or T
+ * suffix, and isn't allowed on jit rules, whose files may not exist yet.
+ * '#' starts a comment.  The first rule that matches a path decides it.
+ *
+ * The parser doesn't allocate, since the client runs it inside ld.so's
+ * audit interface.  It cuts the text up in place, and the rules point
+ * into it.
+ **/
+typedef enum {
+   reloc_none = 0,     /* No rule matched, the OPT_RELOC* options decide */
+   reloc_relocate,     /* Serve through Spindle */
+   reloc_push,         /* Serve through Spindle, and send to every node on the first request */
+   reloc_pass,         /* Never relocate, use the original path */
+   reloc_jit,          /* Write-once files the job generates, shared once the first is written */
+   reloc_need_size     /* A rule matched the path, but depends on its size */
+} reloc_action_t;
+
+typedef struct reloc_rule {
+   reloc_action_t action;
+   const char *glob;
+   int size_cmp;              /* 1 for larger than size, -1 for smaller, 0 for any size */
+   unsigned long long size;
+} reloc_rule_t;
+
+#define MAX_RELOC_RULES 64
+#define MAX_RELOC_RULES_LEN (16*1024)
+
+/* Returns the number of rules, or -1 with *errline set to the bad line */
+int reloc_rules_parse(char *text, reloc_rule_t *rules, int max_rules, int *errline);
+
+/* size is -1 if not yet known */
+reloc_action_t reloc_rules_match(const reloc_rule_t *rules, int num_rules, const char *path,
+                                 long long size);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
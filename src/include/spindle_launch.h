@@ -45,11 +45,61 @@ extern "C" {
 #define OPT_NOHIDE     (1 << 13)            /* Hide Spindle's communication FDs from application */
 #define OPT_REMAPEXEC  (1 << 14)            /* Use remapping hack to make /proc/PID/exe point to original exe */
 #define OPT_LOGUSAGE   (1 << 15)            /* Log usage information to a file */
-#define OPT_SHMCACHE   (1 << 16)            /* Use a shared memory cache optimization (only needed on BlueGene) */
+#define OPT_SHMCACHE   (1 << 16)            /* Clients on a node share lookup results through shared memory */
 #define OPT_SUBAUDIT   (1 << 17)            /* Use subaudit mechanism (needed on BlueGene and very old GLIBCs) */
 #define OPT_PERSIST    (1 << 18)            /* Spindle servers should not exit when all clients exit. */
 #define OPT_SEC        (7 << 19)            /* Security mode, one of the below OPT_SEC_* values */
 #define OPT_SESSION    (1 << 22)            /* Session mode, where Spindle lifetime spans jobs */
+#define OPT_PREFETCH   (1 << 23)            /* Root server prefetches directories under the cache prefixes */
+#define OPT_CACHEINDEX (1 << 24)            /* Servers save their cache at exit and reload it at startup */
+#define OPT_COMPRESS   (1 << 25)            /* Compress file contents sent between servers */
+#define OPT_DEDUP      (1 << 26)            /* Stage files with identical contents once, as links */
+#define OPT_LAZYFETCH  (1 << 27)            /* Stage big data files sparsely and fetch ranges on demand */
+#define OPT_PUSHDEPS   (1 << 28)            /* Root server pushes the libraries an ELF file depends on */
+#define OPT_PASSFD     (1 << 29)            /* Servers pass clients open descriptors for read-only opens */
+#define OPT_SEARCHPATH (1 << 30)            /* Clients send a library's whole search path in one query */
+#define OPT_PYIMPORT   ((opt_t) 1 << 31)    /* Python processes search sys.path through Spindle's importer */
+#define OPT_PYBUNDLE   ((opt_t) 1 << 32)    /* Directories under the python prefix are sent as one bundle */
+#define OPT_PRELOADLEARN ((opt_t) 1 << 33)  /* Record the files a run is served as its preload file, and replay it */
+#define OPT_EARLYLAUNCH ((opt_t) 1 << 34)   /* Job starts while the servers wire up, and waits for them on its first query */
+#define OPT_STATSREPORT ((opt_t) 1 << 35)   /* Servers gather their statistics up the tree at exit, and the root writes a report */
+#define OPT_CLIENTTIMING ((opt_t) 1 << 36)  /* Clients time their interceptions and report them to their server at exit */
+#define OPT_RELOCRULES ((opt_t) 1 << 37)    /* Path and size rules decide what is relocated, ahead of the OPT_RELOC* options */
+#define OPT_MMAPREAD ((opt_t) 1 << 38)      /* Clients serve reads of staged read-only files from a shared mapping */
+#define OPT_HUGEPAGES ((opt_t) 1 << 39)     /* Servers stage files of 2 MB or more aligned and advised for huge pages */
+#define OPT_BYPASSSLOW ((opt_t) 1 << 40)    /* Servers also send large broadcasts to the children of a lagging child */
+#define OPT_PREDICT ((opt_t) 1 << 41)       /* The root pushes the files that usually follow each one asked for */
+#define OPT_COMPILEPYC ((opt_t) 1 << 42)    /* Servers compile the .pyc files missing from the __pycache__ directories they read */
+#define OPT_SERVEDIRS ((opt_t) 1 << 43)     /* Clients list relocated directories from the server's cache */
+#define OPT_RESOLVELINKS ((opt_t) 1 << 44)  /* Servers answer readlink and realpath from cached link targets */
+#define OPT_LOCALBYPASS ((opt_t) 1 << 45)   /* Files on node-local file systems are read in place, not relocated */
+#define OPT_NUMA ((opt_t) 1 << 46)          /* Large libraries are staged once per NUMA node */
+#define OPT_PREFAULT ((opt_t) 1 << 47)      /* Staged libraries have their page tables filled when opened */
+#define OPT_FOREST ((opt_t) 1 << 48)        /* Each reader serves its own slice of the tree */
+#define OPT_STRIPEDREAD ((opt_t) 1 << 49)   /* Large files are read in pieces by the readers */
+#define OPT_VERIFY ((opt_t) 1 << 50)        /* Check file contents against a CRC32C checksum */
+#define OPT_REVALIDATE ((opt_t) 1 << 51)    /* Drop changed files from the cache between session steps */
+#define OPT_SELFSTAGE ((opt_t) 1 << 52)     /* Send Spindle's own libraries through the tree */
+#define OPT_AUTO ((opt_t) 1 << 53)          /* Size what we relocate to the job, and drop slow path classes */
+#define OPT_BATCHSMALL ((opt_t) 1 << 54)    /* Small files sent to all servers in the same pass go in one message */
+#define OPT_IOURING ((opt_t) 1 << 55)       /* Servers wait for events on an io_uring rather than epoll */
+#define OPT_FAIRCLIENTS ((opt_t) 1 << 56)   /* Servers handle client messages least busy client first */
+#define OPT_DELTA ((opt_t) 1 << 57)         /* Changed files are sent as changes to their last version */
+#define OPT_MEMFD ((opt_t) 1 << 58)         /* Files are staged in sealed memfds rather than the location */
+#define OPT_BINDHINTS ((opt_t) 1 << 59)     /* Processes bind PLT entries from a resolution map learned on the node */
+#define OPT_ELASTIC ((opt_t) 1 << 60)       /* Servers started after the job may join the tree */
+#define OPT_SPARSE ((opt_t) 1 << 61)        /* Files with holes are read and sent as their data extents */
+#define OPT_HOTEXTENTS ((opt_t) 1 << 62)    /* Lazy files' extents clients read are learned, and pushed first next run */
+#define OPT_PFSMETA ((opt_t) 1 << 63)       /* Files read together off Lustre or GPFS are stat'd together */
+
+/* Each server leaves a record of how to join it, named this plus its number, in
+   the directory above its location.  spindle --attach reads it to start processes
+   that weren't launched through Spindle under the node's server.  It holds the
+   server's pid, number, opts, shm_cache_size and location, one per line. */
+#define ATTACH_RECORD_PREFIX "spindle_attach."
+
+/* shm_cache_size value that has clients size the cache from the ranks on their node */
+#define SHM_CACHE_AUTO_SIZE 1
 
 #define OPT_SET_SEC(OPT, X) OPT |= (X << 19)
 #define OPT_GET_SEC(OPT) ((OPT >> 19) & 7)
@@ -57,6 +107,7 @@ extern "C" {
 #define OPT_SEC_KEYLMON 1                   /* Use LaunchMON transmitted keys to validate */
 #define OPT_SEC_KEYFILE 2                   /* Use a key from a shared file to validate */
 #define OPT_SEC_NULL 3                      /* Do not validate connections */
+#define OPT_SEC_MUNGETICKET 4               /* Validate with one munge credential from the root, and keys derived from it */
 
 /* Possible values for use_launcher, describe how the job is started */
 #define srun_launcher (1 << 0)              /* Job is launched via SLURM */
@@ -66,6 +117,7 @@ extern "C" {
 #define marker_launcher (1 << 4)            /* Unknown job launcher with Spindle markers in launch line */
 #define external_launcher (1 << 5)          /* An external mechanism starts application */
 #define unknown_launcher (1 << 5)           /* Deprecated alias for external launcher */
+#define flux_launcher (1 << 6)              /* Job is launched via 'flux run' */
 
 /* Possible values for startup_type, describe how Spindle servers are started */
 #define startup_serial 0                    /* Job is non-parallel app, and server is forked/exec */
@@ -102,7 +154,7 @@ typedef struct {
    /* The mechanism used to start Spindle daemons */
    unsigned int startup_type;
 
-   /* Size of client shared memory cache */
+   /* Kilobytes of client shared memory cache, or SHM_CACHE_AUTO_SIZE */
    unsigned int shm_cache_size;
 
    /* The local-disk location where Spindle will store its cache */
@@ -111,8 +163,83 @@ typedef struct {
    /* Colon-seperated list of directories where Python is installed */
    char *pythonprefix;
 
-   /* Name of a white-space delimited file containing a list of files that will be preloaded */
+   /* Name of a white-space delimited file containing a list of files that will be preloaded.
+      With OPT_PRELOADLEARN, the root server also rewrites it at exit. */
    char *preloadfile;
+
+   /* The fields above keep the order of the 0.11 interface, and new ones only go at the
+      end.  Adding one still changes the struct's size, so it also bumps the spindlefe and
+      spindlebe versions in LIB_VERSION. */
+
+   /* Megabytes of staged files each server keeps on local disk, 0 for no limit */
+   unsigned int cache_budget;
+
+   /* Number of servers that read files from the shared file system, 1 for only the root */
+   unsigned int num_readers;
+
+   /* Number of TCP streams between each pair of servers, 1 for a single socket */
+   unsigned int num_streams;
+
+   /* With the pull model, children that must ask for a file before it's pushed to all of them, 0 for never */
+   unsigned int promote_children;
+
+   /* Siblings on either side that each server links to, 0 for no sibling links */
+   unsigned int lateral_peers;
+
+   /* Megabytes per second each server sends to each neighbor, 0 for no limit */
+   unsigned int bandwidth;
+
+   /* The limit after the job calls spindle_startup_done(), 0 to keep bandwidth */
+   unsigned int background_bandwidth;
+
+   /* DSCP value the servers mark their traffic with, 0 for unmarked */
+   unsigned int dscp;
+
+   /* CPUs each server is pinned to, as a list like 0,2-3, or "reserved" for the node's CPUs
+      the job may not use.  NULL to leave servers unpinned. */
+   char *server_cpus;
+
+   /* Nice value the servers run at */
+   int server_nice;
+
+   /* NUMA node the servers' memory and in-memory staged files are placed on, -1 for the default */
+   int server_numa;
+
+   /* Colon-separated list of files, such as input decks, sent to every node as soon as the
+      servers start, without holding back the job.  NULL for none.  Only the front end uses it. */
+   char *bcast_files;
+
+   /* A container image the job's command line names, which is staged on each node and replaced
+      with the local copy before the job is exec'd.  NULL for none. */
+   char *container_image;
+
+   /* With OPT_STATSREPORT, where the root server writes the tree's statistics at exit.
+      A name ending in .json gets JSON, anything else a text summary. */
+   char *stats_report;
+
+   /* With OPT_PREDICT, a preload file whose order the root server's predictions start from.
+      NULL to start from nothing. */
+   char *predict_trace;
+
+   /* With OPT_RELOCRULES, the text of the relocation rules, one to a line.  See relocrules.h */
+   char *reloc_rules;
+
+   /* A node-local disk directory for staging files of disk_threshold megabytes or more,
+      rather than location.  NULL to stage everything at location. */
+   char *disk_location;
+   unsigned int disk_threshold;
+
+   /* A node-local directory shared by this user's Spindle jobs.  Servers link the files they
+      read from the shared file system into it, and stage unchanged files from it.  NULL for none. */
+   char *shared_cache;
+
+   /* A directory every node sees, such as a burst buffer, where servers keep copies of the files
+      they read, for later jobs.  NULL for none. */
+   char *cluster_cache;
+
+   /* A directory on the local disk of each rack's leading server, where it keeps copies of the
+      files that reach it for its rack's servers in this and later jobs.  NULL for none. */
+   char *rack_cache;
 } spindle_args_t;
 
 /* Functions used to startup Spindle on the front-end. Init returns after finishing start-up,
@@ -147,6 +274,12 @@ SPINDLE_EXPORT int getApplicationArgsFE(spindle_args_t *params, int *spindle_arg
 SPINDLE_EXPORT int spindleRunBE(unsigned int port, unsigned int num_ports, unique_id_t unique_id, int security_type,
                                 int (*post_setup)(spindle_args_t *));
 
+/* Runs a server started after the job, which joins the servers of a
+   session run with OPT_ELASTIC through one of the comma separated hosts.
+   Returns when the server is done */
+SPINDLE_EXPORT int spindleJoinBE(unsigned int port, unsigned int num_ports, unique_id_t unique_id, int security_type,
+                                 char *hosts);
+
 /* Bitmask of values for the test_launchers parameter */
 #define TEST_PRESETUP 1<<0
 #define TEST_SERIAL   1<<1
@@ -0,0 +1,52 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(SPINDLE_PROBES_H_)
+#define SPINDLE_PROBES_H_
+
+/**
+ * USDT probes under the provider 'spindle', so a running job can be
+ * profiled with bpftrace or perf, e.g.
+ *   bpftrace -e 'usdt:/path/to/spindled:spindle:read_end { @[str(arg0)] = arg1; }'
+ * An unused probe is a nop in the code and a note in the ELF file.  They
+ * compile to nothing without <sys/sdt.h> or with SPINDLE_NO_PROBES.
+ *
+ * Client:  query_start(path), query_end(path, newpath),
+ *          stat_start(path, is_lstat), stat_end(path, exists)
+ * Server:  client_msg_start(nc, type), client_msg_end(nc, type, result),
+ *          server_msg_start(type), server_msg_end(type, result),
+ *          read_start(path), read_end(path, size, errcode),
+ *          bcast_send(fd, type, len), bcast_recv(path, size)
+ **/
+
+#if !defined(SPINDLE_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SPINDLE_HAVE_PROBES
+#endif
+#endif
+
+#if defined(SPINDLE_HAVE_PROBES)
+#define SPINDLE_PROBE1(name, a) STAP_PROBE1(spindle, name, a)
+#define SPINDLE_PROBE2(name, a, b) STAP_PROBE2(spindle, name, a, b)
+#define SPINDLE_PROBE3(name, a, b, c) STAP_PROBE3(spindle, name, a, b, c)
+#else
+#define SPINDLE_PROBE1(name, a) do { (void) (a); } while (0)
+#define SPINDLE_PROBE2(name, a, b) do { (void) (a); (void) (b); } while (0)
+#define SPINDLE_PROBE3(name, a, b, c) do { (void) (a); (void) (b); (void) (c); } while (0)
+#endif
+
+#endif
@@ -16,6 +16,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #define _GNU_SOURCE
 
 #include "spindle_logc.h"
+#include "spindle_ring.h"
 #include "config.h"
 
 #include <sys/socket.h>
@@ -23,6 +24,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -31,6 +34,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <fcntl.h>
 #include <errno.h>
 #include <execinfo.h>
+#include <stdarg.h>
 
 #if !defined(LIBEXEC)
 #error Expected to have LIBEXEC defined
@@ -51,12 +55,31 @@ FILE *spindle_test_output_f;
 FILE *spindle_debug_output_f;
 char *spindle_debug_name = "UNKNOWN";
 int spindle_debug_prints;
+int spindle_debug_ring;
 int run_tests;
 
+static spindle_ring_header_t *ring;
+static char *ring_data;
+static pid_t ring_pid;
+
 //Timeout in tenths of a second
 #define SPAWN_TIMEOUT 300
 #define CONNECT_TIMEOUT 100
 
+//Longest message the ring or socket takes
+#define RING_MAX_MESSAGE 4096
+
+//Milliseconds a message waits for spindle_logd to catch up before it's
+//dropped, once per overload: while messages are being dropped, the next
+//ones don't wait
+#define LOG_FULL_WAIT_MSEC 10
+
+//Messages dropped from the socket because spindle_logd was behind, not yet reported
+static volatile unsigned long sock_dropped;
+
+//Set while messages are being dropped from a full ring
+static volatile int ring_dropping;
+
 extern int spindle_mkdir(char *orig_path);
 
 int fileExists(char *name) 
@@ -250,6 +273,187 @@ static int setup_connection(char *connection_name)
    return fd;
 }
 
+/**
+ * Map this process's ring, creating it if an exec'd process hasn't
+ * already, and tell spindle_logd to drain it.
+ **/
+static void setup_ring(int kb)
+{
+   char path[512], marker[600];
+   size_t size = (kb > 0 ? kb : RING_DEFAULT_KB) * 1024;
+   struct stat buf;
+   void *mem;
+   int fd, len;
+
+   if (ring && ring_pid == getpid()) {
+      spindle_debug_ring = 1;
+      return;
+   }
+   if (ring) {
+      /* A forked child gets a ring of its own */
+      munmap(ring, sizeof(spindle_ring_header_t) + ring->size);
+      ring = NULL;
+      spindle_debug_ring = 0;
+   }
+
+   snprintf(path, sizeof(path), "%s/spindle_ring.%d", tempdir, getpid());
+   fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+   if (fd == -1)
+      return;
+   if (fstat(fd, &buf) == -1 || !S_ISREG(buf.st_mode) || buf.st_uid != getuid() ||
+       (buf.st_mode & 0777) != 0600) {
+      /* Not a ring we made; someone else could read or feed our log */
+      close(fd);
+      return;
+   }
+   if (lseek(fd, 0, SEEK_END) < (off_t) (sizeof(spindle_ring_header_t) + size) &&
+       ftruncate(fd, sizeof(spindle_ring_header_t) + size) == -1) {
+      close(fd);
+      return;
+   }
+   mem = mmap(NULL, sizeof(spindle_ring_header_t) + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (mem == MAP_FAILED)
+      return;
+
+   if (((spindle_ring_header_t *) mem)->magic == RING_MAGIC &&
+       ((spindle_ring_header_t *) mem)->size != size) {
+      /* Left by our pre-exec self with another size */
+      munmap(mem, sizeof(spindle_ring_header_t) + size);
+      return;
+   }
+   ring = (spindle_ring_header_t *) mem;
+   ring_data = ((char *) mem) + sizeof(spindle_ring_header_t);
+   ring_pid = getpid();
+   if (ring->magic != RING_MAGIC) {
+      ring->size = size;
+      ring->magic = RING_MAGIC;
+   }
+
+   len = snprintf(marker, sizeof(marker), RING_MARKER "%s\n", path);
+   if (write(debug_fd, marker, len) != len) {
+      munmap(mem, sizeof(spindle_ring_header_t) + size);
+      ring = NULL;
+      return;
+   }
+   spindle_debug_ring = 1;
+}
+
+static void ring_write(const char *text, uint32_t len)
+{
+   spindle_ring_record_t *rec;
+   uint64_t head, pos, pad, need = RING_RECORD_SIZE(len);
+   int waits = 0;
+
+   for (;;) {
+      head = ring->head;
+      pos = head % ring->size;
+      pad = (pos + need > ring->size) ? ring->size - pos : 0;
+      if (head + pad + need - ring->tail > ring->size) {
+         /* spindle_logd is behind.  Drop rather than hold up the application */
+         if (ring_dropping || waits++ == LOG_FULL_WAIT_MSEC) {
+            ring_dropping = 1;
+            __sync_fetch_and_add(&ring->dropped, 1);
+            return;
+         }
+         usleep(1000);
+         continue;
+      }
+      if (__sync_bool_compare_and_swap(&ring->head, head, head + pad + need))
+         break;
+   }
+
+   if (pad) {
+      rec = (spindle_ring_record_t *) (ring_data + pos);
+      rec->len = RING_PAD;
+      __sync_synchronize();
+      rec->ready = 1;
+   }
+   rec = (spindle_ring_record_t *) (ring_data + (head + pad) % ring->size);
+   memcpy(rec + 1, text, len);
+   rec->len = len;
+   __sync_synchronize();
+   rec->ready = 1;
+   ring_dropping = 0;
+}
+
+void spindle_ring_printf(const char *format, ...)
+{
+   char buffer[RING_MAX_MESSAGE];
+   va_list ap;
+   int len;
+
+   va_start(ap, format);
+   len = vsnprintf(buffer, sizeof(buffer), format, ap);
+   va_end(ap);
+   if (len < 0)
+      return;
+   if (len >= (int) sizeof(buffer))
+      len = sizeof(buffer) - 1;
+   ring_write(buffer, len);
+}
+
+/**
+ * Send len bytes of text to spindle_logd without waiting on it for longer
+ * than LOG_FULL_WAIT_MSEC, or at all if wait isn't set.  Returns -1 if
+ * none of it could be sent.  Once some is, the rest is sent even if that
+ * waits, so the daemon never sees half a line.
+ **/
+static int sock_send(const char *text, int len, int wait)
+{
+   struct pollfd pfd;
+   int result, sent = 0;
+
+   result = send(debug_fd, text, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+   if (result == -1 && wait && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pfd.fd = debug_fd;
+      pfd.events = POLLOUT;
+      if (poll(&pfd, 1, LOG_FULL_WAIT_MSEC) == 1)
+         result = send(debug_fd, text, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+   }
+   if (result <= 0)
+      return -1;
+   for (sent = result; sent < len; sent += result) {
+      result = send(debug_fd, text + sent, len - sent, MSG_NOSIGNAL);
+      if (result == -1 && errno == EINTR) {
+         result = 0;
+         continue;
+      }
+      if (result <= 0)
+         break;
+   }
+   return 0;
+}
+
+void spindle_sock_printf(const char *format, ...)
+{
+   char buffer[RING_MAX_MESSAGE], notice[128];
+   unsigned long dropped;
+   int len, saved_errno = errno;
+   va_list ap;
+
+   va_start(ap, format);
+   len = vsnprintf(buffer, sizeof(buffer), format, ap);
+   va_end(ap);
+   if (len >= (int) sizeof(buffer))
+      len = sizeof(buffer) - 1;
+
+   /* Take the count of dropped messages, to report ahead of this one */
+   dropped = __sync_fetch_and_and(&sock_dropped, 0);
+   if (dropped) {
+      int nlen = snprintf(notice, sizeof(notice), "[%s.%d] %lu debug messages were dropped while spindle_logd was behind\n",
+                          spindle_debug_name, getpid(), dropped);
+      if (sock_send(notice, nlen, 0) == -1) {
+         __sync_fetch_and_add(&sock_dropped, dropped + 1);
+         errno = saved_errno;
+         return;
+      }
+   }
+   if (len > 0 && sock_send(buffer, len, !dropped) == -1)
+      __sync_fetch_and_add(&sock_dropped, 1);
+   errno = saved_errno;
+}
+
 void reset_spindle_debugging()
 {
    spindle_debug_prints = 0;
@@ -306,6 +510,8 @@ void init_spindle_debugging(char *name, int survive_exec)
    /* Setup the variables */
    if (debug_fd != -1)
       spindle_debug_output_f = fdopen(debug_fd, "w");
+   if (debug_fd != -1 && getenv("SPINDLE_DEBUG_RING"))
+      setup_ring(atoi(getenv("SPINDLE_DEBUG_RING")));
    if (test_fd != -1)
       spindle_test_output_f = fdopen(test_fd, "w");      
 }
@@ -326,7 +532,7 @@ void spindle_dump_on_error()
    syms = backtrace_symbols(stacktrace, size);
    
    for (i = 0; i<size; i++) {
-      fprintf(spindle_debug_output_f, "%p - %s\n", stacktrace[i], syms && syms[i] ? syms[i] : "<NO NAME>");
+      spindle_log_out("%p - %s\n", stacktrace[i], syms && syms[i] ? syms[i] : "<NO NAME>");
    }
    
    if (syms)
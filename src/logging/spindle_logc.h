@@ -31,68 +31,78 @@ extern void spindle_dump_on_error();
 
 #define BASE_FILE (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/')+1 : __FILE__)
 
+extern int spindle_debug_ring;
+void spindle_ring_printf(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+void spindle_sock_printf(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+/* Write a message to the debug log, through the ring if there is one.
+   Neither waits on spindle_logd; a message it has no room for is dropped
+   and counted. */
+#define spindle_log_out(format, ...)                                    \
+   do {                                                                 \
+      if (spindle_debug_ring) {                                         \
+         spindle_ring_printf(format, ## __VA_ARGS__);                   \
+      }                                                                 \
+      else {                                                            \
+         spindle_sock_printf(format, ## __VA_ARGS__);                   \
+      }                                                                 \
+   } while (0)
+
 #define debug_printf(format, ...)                                       \
    do {                                                                 \
       if (spindle_debug_prints && spindle_debug_output_f) {             \
-         fprintf(spindle_debug_output_f, "[%s.%d@%s:%u] %s - " format,  \
-                 spindle_debug_name, getpid(),                          \
-                 BASE_FILE, __LINE__, __func__, ## __VA_ARGS__);        \
-         fflush(spindle_debug_output_f);                                \
+         spindle_log_out("[%s.%d@%s:%u] %s - " format,                  \
+                         spindle_debug_name, getpid(),                  \
+                         BASE_FILE, __LINE__, __func__, ## __VA_ARGS__); \
       }                                                                 \
    } while (0)
 
 #define debug_printf2(format, ...)                                      \
    do {                                                                 \
       if (spindle_debug_prints > 1 && spindle_debug_output_f) {         \
-         fprintf(spindle_debug_output_f, "[%s.%d@%s:%u] %s - " format,  \
-                 spindle_debug_name, getpid(),                          \
-                 BASE_FILE, __LINE__, __func__, ## __VA_ARGS__);        \
-         fflush(spindle_debug_output_f);                                \
+         spindle_log_out("[%s.%d@%s:%u] %s - " format,                  \
+                         spindle_debug_name, getpid(),                  \
+                         BASE_FILE, __LINE__, __func__, ## __VA_ARGS__); \
       }                                                                 \
    } while (0)
 
 #define debug_printf3(format, ...)                                      \
    do {                                                                 \
       if (spindle_debug_prints > 2 && spindle_debug_output_f) {         \
-         fprintf(spindle_debug_output_f, "[%s.%d@%s:%u] %s - " format,  \
-                 spindle_debug_name, getpid(),                          \
-                 BASE_FILE, __LINE__, __func__, ## __VA_ARGS__);        \
-         fflush(spindle_debug_output_f);                                \
+         spindle_log_out("[%s.%d@%s:%u] %s - " format,                  \
+                         spindle_debug_name, getpid(),                  \
+                         BASE_FILE, __LINE__, __func__, ## __VA_ARGS__); \
       }                                                                 \
    } while (0)
 
 #define bare_printf(format, ...)                                        \
    do {                                                                 \
       if (spindle_debug_prints && spindle_debug_output_f) {             \
-         fprintf(spindle_debug_output_f, format, ## __VA_ARGS__);       \
-         fflush(spindle_debug_output_f);                                \
+         spindle_log_out(format, ## __VA_ARGS__);                       \
       }                                                                 \
    } while (0)
 
 #define bare_printf2(format, ...)                                       \
    do {                                                                 \
       if (spindle_debug_prints > 1 && spindle_debug_output_f) {         \
-         fprintf(spindle_debug_output_f, format, ## __VA_ARGS__);       \
-         fflush(spindle_debug_output_f);                                \
+         spindle_log_out(format, ## __VA_ARGS__);                       \
       }                                                                 \
    } while (0)
 
 #define bare_printf3(format, ...)                                       \
    do {                                                                 \
       if (spindle_debug_prints > 2 && spindle_debug_output_f) {         \
-         fprintf(spindle_debug_output_f, format, ## __VA_ARGS__);       \
-         fflush(spindle_debug_output_f);                                \
+         spindle_log_out(format, ## __VA_ARGS__);                       \
       }                                                                 \
    } while (0)
 
 #define err_printf(format, ...)                                         \
    do {                                                                 \
       if (spindle_debug_prints && spindle_debug_output_f) {             \
-         fprintf(spindle_debug_output_f, "[%s.%d@%s:%u] - ERROR: "      \
-                 format, spindle_debug_name, getpid(),                  \
-                 BASE_FILE, __LINE__, ## __VA_ARGS__);                  \
+         spindle_log_out("[%s.%d@%s:%u] - ERROR: "                      \
+                         format, spindle_debug_name, getpid(),          \
+                         BASE_FILE, __LINE__, ## __VA_ARGS__);          \
          spindle_dump_on_error();                                       \
-         fflush(spindle_debug_output_f);                                \
       }                                                                 \
    } while (0)
 
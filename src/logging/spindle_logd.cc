@@ -25,21 +25,30 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
-#include <pthread.h>
+#include <time.h>
+
+#include "spindle_ring.h"
 
 using namespace std;
 
 //Seconds to live without a child
 #define TIMEOUT 10
 
+//Bytes of log output gathered before they're written out, and the
+// longest in milliseconds they're held
+#define WRITE_BATCH (256*1024)
+#define WRITE_BATCH_MSEC 100
+
 string tmpdir;
 string debug_fname;
 string test_fname;
@@ -61,6 +70,9 @@ MsgReader *test_reader;
 
 bool runTests = false;
 bool runDebug = false;
+bool compressDebug = false;
+
+int epoll_fd = -1;
 
 static unsigned char exitcode[8] = { 0x01, 0xff, 0x03, 0xdf, 0x05, 0xbf, 0x07, '\n' };
 
@@ -146,13 +158,33 @@ public:
    virtual void writeMessage(int proc, const char *msg1, int msg1_size, const char *msg2, int msg2_size) = 0;
 };
 
+static unsigned long now_msec()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Messages are gathered and written out WRITE_BATCH bytes at a time, or
+ * after WRITE_BATCH_MSEC.  With SPINDLE_DEBUG_COMPRESS set they go through
+ * a gzip process into output_file.gz, so the compression doesn't slow the
+ * loop that reads the clients.  If gzip can't be run, the rest of the log
+ * is written uncompressed.
+ **/
 class OutputLog : public OutputInterface
 {
    int fd;
+   pid_t gzip_pid;
    string output_file;
+   string buffer;
+   unsigned long last_flush;
 public:
-   OutputLog(string fname) :
-      output_file(fname)
+   OutputLog(string fname, bool compress) :
+      fd(-1),
+      gzip_pid(-1),
+      output_file(fname),
+      last_flush(now_msec())
    {
       char hostname[1024];
       char pid[16];
@@ -165,19 +197,17 @@ public:
       snprintf(pid, 16, "%d", getpid());
       output_file += string(".");
       output_file += string(pid);
-      
-      fd = creat(output_file.c_str(), 0660);
-      if (fd == -1) {
-         fprintf(stderr, "[%s:%u] - Error opening output file %s: %s\n",
-                 __FILE__, __LINE__, output_file.c_str(), strerror(errno));
-         fd = 2; //stderr
-      }
+      buffer.reserve(WRITE_BATCH);
+
+      if (compress && startGzip())
+         return;
+      openPlain();
    }
 
    virtual ~OutputLog()
    {
-      if (fd != -1 && fd != 2)
-         close(fd);
+      flush();
+      closeOutput();
    }
 
    virtual void writeMessage(int proc, const char *msg1, int msg1_size, const char *msg2, int msg2_size)
@@ -188,9 +218,104 @@ public:
          return;
       }
 
-      write(fd, msg1, msg1_size);
+      buffer.append(msg1, msg1_size);
       if (msg2)
-         write(fd, msg2, msg2_size);
+         buffer.append(msg2, msg2_size);
+      if (buffer.size() >= WRITE_BATCH)
+         flush();
+   }
+
+   void flush()
+   {
+      const char *pos = buffer.data();
+      size_t remaining = buffer.size();
+      while (remaining) {
+         ssize_t result = write(fd, pos, remaining);
+         if (result == -1 && errno == EINTR)
+            continue;
+         if (result == -1 && errno == EPIPE && gzip_pid != -1) {
+            fprintf(stderr, "[%s:%u] - gzip exited, writing the rest of the log uncompressed\n",
+                    __FILE__, __LINE__);
+            closeOutput();
+            openPlain();
+            continue;
+         }
+         if (result <= 0)
+            break;
+         pos += result;
+         remaining -= result;
+      }
+      buffer.clear();
+      last_flush = now_msec();
+   }
+
+   //Milliseconds until gathered messages should be written, or -1 if there are none
+   int flushDue() const
+   {
+      if (buffer.empty())
+         return -1;
+      unsigned long elapsed = now_msec() - last_flush;
+      return elapsed >= WRITE_BATCH_MSEC ? 0 : (int) (WRITE_BATCH_MSEC - elapsed);
+   }
+
+private:
+   void openPlain()
+   {
+      fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0660);
+      if (fd == -1) {
+         fprintf(stderr, "[%s:%u] - Error opening output file %s: %s\n",
+                 __FILE__, __LINE__, output_file.c_str(), strerror(errno));
+         fd = 2; //stderr
+      }
+   }
+
+   bool startGzip()
+   {
+      string gz_file = output_file + string(".gz");
+      int out = creat(gz_file.c_str(), 0660);
+      if (out == -1) {
+         fprintf(stderr, "[%s:%u] - Error opening output file %s: %s\n",
+                 __FILE__, __LINE__, gz_file.c_str(), strerror(errno));
+         return false;
+      }
+      int pipefds[2];
+      if (pipe(pipefds) == -1) {
+         close(out);
+         return false;
+      }
+      gzip_pid = fork();
+      if (gzip_pid == -1) {
+         close(out);
+         close(pipefds[0]);
+         close(pipefds[1]);
+         return false;
+      }
+      if (gzip_pid == 0) {
+         dup2(pipefds[0], 0);
+         dup2(out, 1);
+         close(pipefds[0]);
+         close(pipefds[1]);
+         close(out);
+         execlp("gzip", "gzip", "-1", "-c", (char *) NULL);
+         _exit(127);
+      }
+      close(pipefds[0]);
+      close(out);
+      fd = pipefds[1];
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+      return true;
+   }
+
+   void closeOutput()
+   {
+      if (fd != -1 && fd != 2)
+         close(fd);
+      fd = -1;
+      if (gzip_pid != -1) {
+         int status;
+         waitpid(gzip_pid, &status, 0);
+         gzip_pid = -1;
+      }
    }
 };
 
@@ -366,174 +491,268 @@ public:
    }
 };
 
+
+//Messages clients dropped from full rings, over all rings
+static uint64_t ring_dropped_total = 0;
+
+/**
+ * A process's ring of debug messages, see spindle_ring.h
+ **/
+class LogRing
+{
+private:
+   string path;
+   spindle_ring_header_t *header;
+   char *data;
+   size_t map_size;
+   uint64_t dropped;
+public:
+   LogRing(string path_) :
+      path(path_),
+      header(NULL),
+      data(NULL),
+      map_size(0),
+      dropped(0)
+   {
+      struct stat buf;
+      int fd = open(path.c_str(), O_RDWR | O_NOFOLLOW);
+      if (fd == -1) {
+         fprintf(stderr, "[%s:%u] - Error opening ring %s: %s\n", __FILE__, __LINE__, path.c_str(), strerror(errno));
+         return;
+      }
+      if (fstat(fd, &buf) == -1 || !S_ISREG(buf.st_mode) || buf.st_uid != getuid() ||
+          (size_t) buf.st_size <= sizeof(spindle_ring_header_t)) {
+         close(fd);
+         return;
+      }
+      void *mem = mmap(NULL, buf.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (mem == MAP_FAILED)
+         return;
+      header = (spindle_ring_header_t *) mem;
+      map_size = buf.st_size;
+      if (header->magic != RING_MAGIC || sizeof(spindle_ring_header_t) + header->size > map_size) {
+         munmap(mem, map_size);
+         header = NULL;
+         return;
+      }
+      data = ((char *) mem) + sizeof(spindle_ring_header_t);
+   }
+
+   ~LogRing()
+   {
+      if (!header)
+         return;
+      munmap(header, map_size);
+      unlink(path.c_str());
+   }
+
+   bool isValid() const
+   {
+      return header != NULL;
+   }
+
+   const string &getPath() const
+   {
+      return path;
+   }
+
+   void drain(OutputInterface *log, int proc)
+   {
+      uint64_t tail = header->tail, advance;
+      while (tail != header->head) {
+         spindle_ring_record_t *rec = (spindle_ring_record_t *) (data + tail % header->size);
+         if (!rec->ready)
+            break;
+         __sync_synchronize();
+         if (rec->len == RING_PAD) {
+            advance = header->size - tail % header->size;
+         }
+         else {
+            log->writeMessage(proc, (char *) (rec + 1), rec->len, NULL, 0);
+            advance = RING_RECORD_SIZE(rec->len);
+         }
+         memset(rec, 0, advance);
+         __sync_synchronize();
+         tail += advance;
+         header->tail = tail;
+      }
+      if (header->dropped != dropped) {
+         char msg[128];
+         int len = snprintf(msg, sizeof(msg), "[spindle_logd] %lu debug messages were dropped from a full ring\n",
+                            (unsigned long) (header->dropped - dropped));
+         ring_dropped_total += header->dropped - dropped;
+         dropped = header->dropped;
+         log->writeMessage(proc, msg, len, NULL, 0);
+      }
+   }
+};
+
+/**
+ * Reads the lines processes write to one socket, and the rings they name
+ * there.  Every reader's sockets are watched by the one epoll loop in
+ * runLoop, so 128 processes logging at once cost one thread rather than
+ * one select over all of them per message.  Connections are non-blocking,
+ * and each keeps the unfinished end of its last read until the rest of
+ * the line arrives.
+ **/
 class MsgReader
 {
 private:
-   static const unsigned int MAX_MESSAGE = 4096;
-   static const unsigned int LISTEN_BACKLOG = 64;
+   static const unsigned int MAX_MESSAGE = 65536;
+   static const unsigned int MAX_LINE = 1024*1024;
+   static const unsigned int LISTEN_BACKLOG = 1024;
 
+public:
    struct Connection {
       int fd;
-      struct sockaddr_un remote_addr;
+      MsgReader *reader;
+      bool listener;
       bool shutdown;
-      char unfinished_msg[MAX_MESSAGE];
+      string unfinished_msg;
+      vector<LogRing *> rings;
    };
 
+private:
    int sockfd;
+   Connection listen_con;
    map<int, Connection *> conns;
    char recv_buffer[MAX_MESSAGE];
-   size_t recv_buffer_size, named_buffer_size;
    bool error;
    string socket_path;
-   pthread_t thrd;
    OutputInterface *log;
 
-   bool addNewConnection() {
-      Connection *con = new Connection();
-      socklen_t remote_addr_size = sizeof(struct sockaddr_un);
-      con->fd = accept(sockfd, (struct sockaddr *) &con->remote_addr, &remote_addr_size);
-      con->shutdown = false;
-      if (con->fd == -1) {
-         fprintf(stderr, "[%s:%u] - Error adding connection: %s\n", __FILE__, __LINE__, strerror(errno));
-         delete con;
-         return false;
-      }
-
-      int flags = fcntl(con->fd, F_GETFL, 0);
-      if (flags == -1) flags = 0;
-      fcntl(con->fd, F_SETFL, flags | O_NONBLOCK);
-
-      con->unfinished_msg[0] = '\0';
-      conns.insert(make_pair(con->fd, con));
-      return true;
-   }
-   
-   bool waitAndHandleMessage() {
-      fd_set rset;
-
+   void addNewConnections()
+   {
       for (;;) {
-         FD_ZERO(&rset);
-         int max_fd = 0;
-         if (sockfd != -1) {
-            FD_SET(sockfd, &rset);
-            max_fd = sockfd;
-         }
-         
-         for (map<int, Connection *>::iterator i = conns.begin(); i != conns.end(); i++) {
-            int fd = i->first;
-            FD_SET(fd, &rset);
-            if (fd > max_fd)
-               max_fd = fd;
-         }
-         
-         struct timeval timeout;
-         timeout.tv_sec = TIMEOUT;
-         timeout.tv_usec = 0;
-
-         if (!max_fd) {
-            return false;
-         }
-
-         int result = select(max_fd+1, &rset, NULL, NULL, conns.empty() ? &timeout : NULL);
-         if (result == 0) {
-            return NULL;
-         }
-         if (result == -1) {
-            fprintf(stderr, "[%s:%u] - Error calling select: %s\n", __FILE__, __LINE__, strerror(errno));
-            return NULL;
-         }
-
-         if (sockfd != -1 && FD_ISSET(sockfd, &rset)) {
-            addNewConnection();
+         struct sockaddr_un remote_addr;
+         socklen_t remote_addr_size = sizeof(struct sockaddr_un);
+         int fd = accept(sockfd, (struct sockaddr *) &remote_addr, &remote_addr_size);
+         if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+               fprintf(stderr, "[%s:%u] - Error adding connection: %s\n", __FILE__, __LINE__, strerror(errno));
+            return;
          }
 
-         for (map<int, Connection *>::iterator i = conns.begin(); i != conns.end(); i++) {
-            int fd = i->first;
-            if (FD_ISSET(fd, &rset)) {
-               readMessage(i->second);
-            }
+         int flags = fcntl(fd, F_GETFL, 0);
+         if (flags == -1) flags = 0;
+         fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+         Connection *con = new Connection();
+         con->fd = fd;
+         con->reader = this;
+         con->listener = false;
+         con->shutdown = false;
+
+         struct epoll_event ev;
+         ev.events = EPOLLIN;
+         ev.data.ptr = con;
+         if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            fprintf(stderr, "[%s:%u] - Error watching connection: %s\n", __FILE__, __LINE__, strerror(errno));
+            close(fd);
+            delete con;
+            continue;
          }
-         
-         bool foundShutdownProc;
-         do {
-            foundShutdownProc = false;
-            for (map<int, Connection *>::iterator i = conns.begin(); i != conns.end(); i++) {
-               if (i->second->shutdown) {
-                  conns.erase(i);
-                  foundShutdownProc = true;
-                  break;
-               }
-            }
-         } while (foundShutdownProc);
+         conns.insert(make_pair(fd, con));
       }
    }
 
-   bool readMessage(Connection *con)
+   void readMessage(Connection *con)
    {
       int result = recv(con->fd, recv_buffer, MAX_MESSAGE, 0);
-      if (result == -1) {
+      if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+         return;
+      if (result == -1)
          fprintf(stderr, "[%s:%u] - Error calling recv: %s\n", __FILE__, __LINE__, strerror(errno));
-         close(con->fd);
-         return false;
-      }
 
-      if (result == 0) {
+      if (result <= 0) {
          //A client shutdown
-         map<int, Connection *>::iterator i = conns.find(con->fd);
-         assert(i != conns.end());
-         i->second->shutdown = true;
-         if (con->unfinished_msg[0] != '\0')
+         if (!con->unfinished_msg.empty())
             processMessage(con, "\n", 1);
+         con->shutdown = true;
+         epoll_ctl(epoll_fd, EPOLL_CTL_DEL, con->fd, NULL);
          close(con->fd);
-         return true;
+         return;
+      }
+
+      processMessage(con, recv_buffer, result);
+   }
+
+   void closeRings(Connection *con)
+   {
+      for (vector<LogRing *>::iterator j = con->rings.begin(); j != con->rings.end(); j++) {
+         (*j)->drain(log, con->fd);
+         delete *j;
       }
+      con->rings.clear();
+   }
 
-      return processMessage(con, recv_buffer, result);
+   /**
+    * A line naming a ring adds it to the connection's, unless an exec'd
+    * process named the one it already has
+    **/
+   bool handleRingMarker(Connection *con, const char *line, int line_size)
+   {
+      int marker_len = strlen(RING_MARKER);
+      if (line_size <= marker_len || strncmp(line, RING_MARKER, marker_len) != 0)
+         return false;
+      string path(line + marker_len, line_size - marker_len - 1);
+      for (vector<LogRing *>::iterator j = con->rings.begin(); j != con->rings.end(); j++) {
+         if ((*j)->getPath() == path)
+            return true;
+      }
+      LogRing *ring = new LogRing(path);
+      if (ring->isValid())
+         con->rings.push_back(ring);
+      else
+         delete ring;
+      return true;
+   }
+
+   void handleLine(Connection *con, const char *line, int line_size)
+   {
+      if (!handleRingMarker(con, line, line_size))
+         log->writeMessage(con->fd, line, line_size, NULL, 0);
    }
 
-   bool processMessage(Connection *con, const char *msg, int msg_size) {
+   void processMessage(Connection *con, const char *msg, int msg_size) {
       int msg_begin = 0;
       for (int i = 0; i < msg_size; i++) {
          if (msg[i] != '\n')
             continue;
 
-         if (con->unfinished_msg[0] != '\0') {
-            log->writeMessage(con->fd, con->unfinished_msg, strlen(con->unfinished_msg),
-                              msg + msg_begin, i+1 - msg_begin);
+         if (!con->unfinished_msg.empty()) {
+            con->unfinished_msg.append(msg + msg_begin, i+1 - msg_begin);
+            handleLine(con, con->unfinished_msg.data(), con->unfinished_msg.size());
+            con->unfinished_msg.clear();
          }
          else {
-            log->writeMessage(con->fd, msg + msg_begin, i+1 - msg_begin,
-                              NULL, 0);
+            handleLine(con, msg + msg_begin, i+1 - msg_begin);
          }
-         con->unfinished_msg[0] = '\0';
          msg_begin = i+1;
       }
 
       if (msg_begin != msg_size) {
-         int remaining_bytes = msg_size - msg_begin;
-         strncat(con->unfinished_msg, msg + msg_begin, remaining_bytes);
+         con->unfinished_msg.append(msg + msg_begin, msg_size - msg_begin);
+         if (con->unfinished_msg.size() >= MAX_LINE) {
+            //Don't let a line without an end grow without bound
+            con->unfinished_msg += '\n';
+            handleLine(con, con->unfinished_msg.data(), con->unfinished_msg.size());
+            con->unfinished_msg.clear();
+         }
       }
-
-      return true;
-   }
-
-   static void *main_wrapper(void *mreader)
-   {
-      return static_cast<MsgReader *>(mreader)->main_loop();
-   }
-
-   void *main_loop()
-   {
-      while (waitAndHandleMessage());
-      return NULL;
    }
 
 public:
-   
+
    MsgReader(string socket_suffix, OutputInterface *log_) :
       log(log_)
    {
       error = true;
+      listen_con.fd = -1;
+      listen_con.reader = this;
+      listen_con.listener = true;
+      listen_con.shutdown = false;
 
       sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
       if (sockfd == -1) {
@@ -567,14 +786,31 @@ public:
          return;
       }
 
+      int flags = fcntl(sockfd, F_GETFL, 0);
+      if (flags == -1) flags = 0;
+      fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+
+      listen_con.fd = sockfd;
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.ptr = &listen_con;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockfd, &ev) == -1) {
+         fprintf(stderr, "[%s:%u] - Error watching socket: %s\n",
+                 __FILE__, __LINE__, strerror(errno));
+         return;
+      }
+
       error = false;
    }
 
    ~MsgReader()
    {
       for (map<int, Connection *>::iterator i = conns.begin(); i != conns.end(); i++) {
-         int fd = i->first;
-         close(fd);
+         Connection *con = i->second;
+         closeRings(con);
+         if (!con->shutdown)
+            close(con->fd);
+         delete con;
       }
       conns.clear();
       if (sockfd != -1) {
@@ -584,32 +820,146 @@ public:
    }
 
    void cleanFile() {
+      if (sockfd == -1)
+         return;
       close(sockfd);
       unlink(socket_path.c_str());
       sockfd = -1;
+      listen_con.fd = -1;
    }
 
    bool hadError() const {
       return error;
    }
 
-   void *run()
+   bool isListening() const {
+      return sockfd != -1;
+   }
+
+   bool hasConnections() const {
+      return !conns.empty();
+   }
+
+   bool hasRings() const
+   {
+      for (map<int, Connection *>::const_iterator i = conns.begin(); i != conns.end(); i++) {
+         if (!i->second->rings.empty())
+            return true;
+      }
+      return false;
+   }
+
+   void handleEvent(Connection *con)
    {
-      int result = pthread_create(&thrd, NULL, main_wrapper, (void *) this);
-      if (result < 0) {
-         fprintf(stderr, "Failed to spawn thread: %s\n", strerror(errno));
-         return NULL;
+      if (con->listener) {
+         if (sockfd != -1)
+            addNewConnections();
+      }
+      else if (!con->shutdown) {
+         readMessage(con);
       }
-      return NULL;
    }
 
-   void join()
+   void drainRings()
    {
-      void *result;
-      pthread_join(thrd, &result);
+      for (map<int, Connection *>::iterator i = conns.begin(); i != conns.end(); i++) {
+         for (vector<LogRing *>::iterator j = i->second->rings.begin(); j != i->second->rings.end(); j++)
+            (*j)->drain(log, i->first);
+      }
+   }
+
+   //Drop the connections that closed, after a last drain of their rings
+   void reapConnections()
+   {
+      map<int, Connection *>::iterator i = conns.begin();
+      while (i != conns.end()) {
+         Connection *con = i->second;
+         if (!con->shutdown) {
+            i++;
+            continue;
+         }
+         closeRings(con);
+         delete con;
+         conns.erase(i++);
+      }
    }
 };
 
+/**
+ * Waits on every reader's sockets, drains the rings every RING_POLL_USEC
+ * while there are any, and writes out the gathered debug log as it comes
+ * due.  Returns once no reader has had a connection for TIMEOUT seconds,
+ * or no reader is listening and the last connection has closed.
+ **/
+static void runLoop()
+{
+   static const int MAX_EVENTS = 256;
+   struct epoll_event events[MAX_EVENTS];
+   MsgReader *readers[2];
+   int num_readers = 0;
+   unsigned long idle_since = now_msec();
+
+   if (debug_reader)
+      readers[num_readers++] = debug_reader;
+   if (test_reader)
+      readers[num_readers++] = test_reader;
+
+   for (;;) {
+      bool have_conns = false, have_rings = false, listening = false;
+      for (int i = 0; i < num_readers; i++) {
+         have_conns |= readers[i]->hasConnections();
+         have_rings |= readers[i]->hasRings();
+         listening |= readers[i]->isListening();
+      }
+      if (!have_conns && !listening)
+         break;
+
+      int timeout = -1;
+      if (!have_conns) {
+         unsigned long idle = now_msec() - idle_since;
+         if (idle >= TIMEOUT * 1000ul)
+            break;
+         timeout = (int) (TIMEOUT * 1000ul - idle);
+      }
+      else if (have_rings) {
+         timeout = RING_POLL_USEC / 1000;
+      }
+      int flush_due = debug_log ? debug_log->flushDue() : -1;
+      if (flush_due != -1 && (timeout == -1 || flush_due < timeout))
+         timeout = flush_due;
+
+      int result = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+      if (result == -1 && errno != EINTR) {
+         fprintf(stderr, "[%s:%u] - Error calling epoll_wait: %s\n", __FILE__, __LINE__, strerror(errno));
+         break;
+      }
+      for (int i = 0; i < result; i++) {
+         MsgReader::Connection *con = (MsgReader::Connection *) events[i].data.ptr;
+         con->reader->handleEvent(con);
+      }
+
+      for (int i = 0; i < num_readers; i++) {
+         readers[i]->drainRings();
+         readers[i]->reapConnections();
+      }
+      if (debug_log && debug_log->flushDue() == 0)
+         debug_log->flush();
+
+      if (have_conns || result > 0)
+         idle_since = now_msec();
+   }
+
+   if (debug_log) {
+      if (ring_dropped_total) {
+         char msg[128];
+         int len = snprintf(msg, sizeof(msg), "[spindle_logd] %lu debug messages in all were dropped from full rings\n",
+                            (unsigned long) ring_dropped_total);
+         debug_log->writeMessage(0, msg, len, NULL, 0);
+      }
+      debug_log->flush();
+   }
+}
+
 void parseArgs(int argc, char *argv[])
 {
    if (argc < 3) {
@@ -637,15 +987,22 @@ void clean()
    if (lockProcess)
       delete lockProcess;
    lockProcess = NULL;
+   //Readers drain their rings into the logs as they go
+   if (debug_reader)
+      delete debug_reader;
+   debug_reader = NULL;
+   if (test_reader)
+      delete test_reader;
+   test_reader = NULL;
    if (debug_log)
       delete debug_log;
    debug_log = NULL;
    if (test_log)
       delete test_log;
    test_log = NULL;
-   if (debug_reader)
-      delete debug_reader;
-   debug_reader = NULL;
+   if (epoll_fd != -1)
+      close(epoll_fd);
+   epoll_fd = -1;
 }
 
 void cleanFiles()
@@ -668,6 +1025,7 @@ void registerCrashHandlers()
 {
    signal(SIGINT, on_sig);
    signal(SIGTERM, on_sig);
+   signal(SIGPIPE, SIG_IGN);
 }
 
 int main(int argc, char *argv[])
@@ -688,8 +1046,15 @@ int main(int argc, char *argv[])
    close(1);
    open("/dev/null", O_WRONLY);
 
+   epoll_fd = epoll_create(64);
+   if (epoll_fd == -1) {
+      fprintf(stderr, "Error creating epoll: %s\n", strerror(errno));
+      return -1;
+   }
+   compressDebug = (getenv("SPINDLE_DEBUG_COMPRESS") != NULL);
+
    if (runDebug) {
-      debug_log = new OutputLog(debug_fname);
+      debug_log = new OutputLog(debug_fname, compressDebug);
       debug_reader = new MsgReader("log", debug_log);
       if (debug_reader->hadError()) {
          fprintf(stderr, "Debug reader error termination\n");
@@ -705,15 +1070,7 @@ int main(int argc, char *argv[])
       }      
    }
 
-   if (runDebug)
-      debug_reader->run();
-   if (runTests)
-      test_reader->run();
-
-   if (runDebug)
-      debug_reader->join();
-   if (runTests)
-      test_reader->join();
+   runLoop();
 
    clean();
    return 0;
@@ -0,0 +1,60 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(SPINDLE_RING_H_)
+#define SPINDLE_RING_H_
+
+#include <stdint.h>
+
+/**
+ * With SPINDLE_DEBUG_RING set, a process writes its debug messages into a
+ * ring in a shared file, TMPDIR/spindle_ring.PID, rather than writing and
+ * flushing each one down its socket to spindle_logd.  The process names
+ * the ring in a RING_MARKER line on its socket, and spindle_logd drains
+ * it every RING_POLL_USEC, and one last time when the socket closes, so a
+ * crashed process's last messages still reach the log.
+ *
+ * Writers on any thread, or in a forked child sharing the mapping, reserve
+ * space by advancing head.  A record is read once its ready flag is set.
+ * spindle_logd zeroes what it has read before advancing tail, so space
+ * past tail is always zero.  A record that won't fit before the end of the
+ * ring is placed at the start, after a RING_PAD record filling the end.
+ **/
+
+#define RING_MAGIC 0x53524e47
+#define RING_MARKER "\002spindle_ring "
+#define RING_PAD 0xffffffff
+#define RING_POLL_USEC 10000
+#define RING_DEFAULT_KB 4096
+
+typedef struct {
+   uint32_t magic;
+   uint32_t size;              /* bytes of records after the header */
+   volatile uint64_t head;     /* bytes reserved by writers, ever */
+   volatile uint64_t tail;     /* bytes drained by spindle_logd, ever */
+   volatile uint64_t dropped;  /* messages that found the ring full */
+} spindle_ring_header_t;
+
+typedef struct {
+   volatile uint32_t len;      /* bytes of text that follow, or RING_PAD */
+   volatile uint32_t ready;
+} spindle_ring_record_t;
+
+/* Records are padded so the next one's header stays aligned */
+#define RING_RECORD_SIZE(LEN) \
+   ((sizeof(spindle_ring_record_t) + (LEN) + 7) & ~((uint64_t) 7))
+
+#endif
@@ -0,0 +1,359 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_bundle.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * Bundled directories are kept by their interned names, which never move,
+ * so a bucket is searched by comparing pointers.
+ **/
+
+#define BUNDLE_TABLE_SIZE 1024
+
+typedef struct bundle_dir_t {
+   const char *dir;
+   struct bundle_dir_t *next;
+} bundle_dir_t;
+
+typedef struct bundle_file_t {
+   char *pathname;
+   struct stat buf;
+} bundle_file_t;
+
+static bundle_dir_t *bundled_table[BUNDLE_TABLE_SIZE];
+static bundle_dir_t *metadata_table[BUNDLE_TABLE_SIZE];
+
+static int in_path_list(const char *pathlist, const char *dir)
+{
+   const char *cur, *end;
+   size_t len;
+
+   if (!pathlist)
+      return 0;
+   for (cur = pathlist; *cur; cur = *end ? end + 1 : end) {
+      end = strchr(cur, ':');
+      if (!end)
+         end = cur + strlen(cur);
+      len = end - cur;
+      while (len > 1 && cur[len-1] == '/')
+         len--;
+      if (*cur != '/' || !len)
+         continue;
+      if (strncmp(dir, cur, len) == 0 && (dir[len] == '/' || dir[len] == '\0' || len == 1))
+         return 1;
+   }
+   return 0;
+}
+
+/* Add dir to table, returning 0 if it was already there */
+static int mark_bundled(bundle_dir_t **table, const char *dir)
+{
+   const char *name;
+   bundle_dir_t *bd;
+   unsigned int bucket;
+
+   name = intern_name(dir);
+   bucket = intern_name_hash(name) % BUNDLE_TABLE_SIZE;
+   for (bd = table[bucket]; bd; bd = bd->next) {
+      if (bd->dir == name)
+         return 0;
+   }
+
+   bd = (bundle_dir_t *) malloc(sizeof(*bd));
+   bd->dir = name;
+   bd->next = table[bucket];
+   table[bucket] = bd;
+   return 1;
+}
+
+static int is_metadata_name(const char *name)
+{
+   size_t len = strlen(name);
+   return (len > 10 && strcmp(name + len - 10, ".dist-info") == 0) ||
+          (len > 9 && strcmp(name + len - 9, ".egg-info") == 0);
+}
+
+int bundle_is_candidate(ldcs_process_data_t *procdata, char *dir)
+{
+   if (!(procdata->opts & OPT_PYBUNDLE) || !in_path_list(procdata->pythonprefix, dir))
+      return 0;
+   return mark_bundled(bundled_table, dir);
+}
+
+int bundle_is_metadata_candidate(ldcs_process_data_t *procdata, char *dir, char *parent)
+{
+   char *last_slash;
+
+   if (!(procdata->opts & OPT_PYBUNDLE) || !in_path_list(procdata->pythonprefix, dir))
+      return 0;
+   last_slash = strrchr(dir, '/');
+   if (!last_slash || last_slash == dir || !is_metadata_name(last_slash + 1))
+      return 0;
+   strncpy(parent, dir, last_slash - dir);
+   parent[last_slash - dir] = '\0';
+   return mark_bundled(metadata_table, parent);
+}
+
+/* Add path to the list of files to bundle, unless it doesn't fit */
+static void add_bundle_file(char *path, struct stat *buf, bundle_file_t **files, int *num_files,
+                            int *files_size, size_t *total)
+{
+   size_t entry_size;
+
+   if (buf->st_size > BUNDLE_MAX_FILE_SIZE) {
+      debug_printf3("Leaving %s out of bundle, it's %lu bytes\n", path, (unsigned long) buf->st_size);
+      return;
+   }
+   entry_size = strlen(path) + 1 + sizeof(struct stat) + sizeof(size_t) + buf->st_size;
+   if (*total + entry_size > BUNDLE_MAX_SIZE) {
+      debug_printf2("Bundle is full, leaving out %s\n", path);
+      return;
+   }
+
+   if (*num_files == *files_size) {
+      *files_size = *files_size ? *files_size * 2 : 64;
+      *files = (bundle_file_t *) realloc(*files, sizeof(bundle_file_t) * *files_size);
+   }
+   (*files)[*num_files].pathname = strdup(path);
+   (*files)[*num_files].buf = *buf;
+   (*num_files)++;
+   *total += entry_size;
+}
+
+/**
+ * Add the regular files in dir that fit under the size limits to *files.
+ **/
+static int list_bundle_files(char *dir, bundle_file_t **files, int *num_files, int *files_size,
+                             size_t *total)
+{
+   DIR *d;
+   struct dirent *ent;
+   struct stat buf;
+   char path[MAX_PATH_LEN+1];
+
+   d = opendir(dir);
+   filemngt_count_fsop(FSOP_READDIR, 0);
+   if (!d) {
+      debug_printf2("Could not open directory %s to bundle it\n", dir);
+      return 0;
+   }
+
+   while ((ent = readdir(d)) != NULL) {
+      if (ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN)
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+      filemngt_count_fsop(FSOP_STAT, 0);
+      if (lstat(path, &buf) == -1 || !S_ISREG(buf.st_mode))
+         continue;
+      add_bundle_file(path, &buf, files, num_files, files_size, total);
+   }
+   closedir(d);
+   return 0;
+}
+
+/**
+ * Add the files of every .dist-info and .egg-info directory in dir, and
+ * its .egg-info files, to *files.  The directories are marked bundled,
+ * so reading one of the files left out doesn't bundle them again.
+ **/
+static int list_metadata_files(char *dir, bundle_file_t **files, int *num_files, int *files_size,
+                               size_t *total)
+{
+   DIR *d;
+   struct dirent *ent;
+   struct stat buf;
+   char path[MAX_PATH_LEN+1];
+
+   d = opendir(dir);
+   filemngt_count_fsop(FSOP_READDIR, 0);
+   if (!d) {
+      debug_printf2("Could not open directory %s to bundle its package metadata\n", dir);
+      return 0;
+   }
+
+   while ((ent = readdir(d)) != NULL) {
+      if (ent->d_type != DT_DIR && ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN)
+         continue;
+      if (!is_metadata_name(ent->d_name))
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+      filemngt_count_fsop(FSOP_STAT, 0);
+      if (lstat(path, &buf) == -1)
+         continue;
+      if (S_ISREG(buf.st_mode))
+         add_bundle_file(path, &buf, files, num_files, files_size, total);
+      else if (S_ISDIR(buf.st_mode) && mark_bundled(bundled_table, path))
+         list_bundle_files(path, files, num_files, files_size, total);
+   }
+   closedir(d);
+   return 0;
+}
+
+/**
+ * Read the listed files into a bundle named dir, and free the list.
+ **/
+static int pack_files(char *dir, bundle_file_t *files, int num, size_t total, int strip,
+                      char **data, size_t *size, int *num_files, size_t *bytes_read)
+{
+   int i, result, errcode, global_result = 0;
+   size_t pos, len, contents_size;
+
+   *data = NULL;
+   *size = 0;
+   *num_files = 0;
+   *bytes_read = 0;
+   if (!num)
+      return 0;
+
+   /* Zeroed, since the holes of files read with --sparse-files aren't written */
+   *data = (char *) calloc(1, total);
+   if (!*data) {
+      err_printf("Could not allocate %lu bytes to bundle %s\n", (unsigned long) total, dir);
+      global_result = -1;
+      goto done;
+   }
+
+   pos = strlen(dir) + 1;
+   memcpy(*data, dir, pos);
+   for (i = 0; i < num; i++) {
+      size_t start = pos;
+      len = strlen(files[i].pathname) + 1;
+      memcpy(*data + pos, files[i].pathname, len);
+      pos += len;
+      memcpy(*data + pos, &files[i].buf, sizeof(struct stat));
+      pos += sizeof(struct stat);
+
+      /* Contents are read straight into place, then the size is filled in */
+      contents_size = files[i].buf.st_size;
+      errcode = 0;
+      result = filemngt_read_file(files[i].pathname, *data + pos + sizeof(size_t), &contents_size,
+                                  strip, &errcode);
+      if (result == -1 || errcode) {
+         debug_printf2("Could not read %s into bundle, leaving it out\n", files[i].pathname);
+         pos = start;
+         continue;
+      }
+      memcpy(*data + pos, &contents_size, sizeof(size_t));
+      pos += sizeof(size_t) + contents_size;
+      *bytes_read += contents_size;
+      (*num_files)++;
+   }
+   *size = pos;
+
+  done:
+   for (i = 0; i < num; i++)
+      free(files[i].pathname);
+   free(files);
+   return global_result;
+}
+
+int bundle_pack_dir(char *dir, int strip, char **data, size_t *size, int *num_files, size_t *bytes_read)
+{
+   bundle_file_t *files = NULL;
+   int num = 0, files_size = 0;
+   size_t total = strlen(dir) + 1;
+
+   list_bundle_files(dir, &files, &num, &files_size, &total);
+   return pack_files(dir, files, num, total, strip, data, size, num_files, bytes_read);
+}
+
+int bundle_pack_metadata(char *dir, int strip, char **data, size_t *size, int *num_files, size_t *bytes_read)
+{
+   bundle_file_t *files = NULL;
+   int num = 0, files_size = 0;
+   size_t total = strlen(dir) + 1;
+
+   list_metadata_files(dir, &files, &num, &files_size, &total);
+   return pack_files(dir, files, num, total, strip, data, size, num_files, bytes_read);
+}
+
+int bundle_append_entry(char **data, size_t *size, size_t *alloc, char *pathname, struct stat *buf,
+                        char *contents, size_t contents_size)
+{
+   size_t len = strlen(pathname) + 1, needed;
+   char *newdata;
+
+   needed = *size + (*size ? 0 : 1) + len + sizeof(struct stat) + sizeof(size_t) + contents_size;
+   if (needed > *alloc) {
+      size_t newalloc = *alloc ? *alloc : 64*1024;
+      while (newalloc < needed)
+         newalloc *= 2;
+      newdata = (char *) realloc(*data, newalloc);
+      if (!newdata) {
+         err_printf("Could not grow a bundle to %lu bytes\n", (unsigned long) newalloc);
+         return -1;
+      }
+      *data = newdata;
+      *alloc = newalloc;
+   }
+
+   if (!*size)
+      (*data)[(*size)++] = '\0';
+   memcpy(*data + *size, pathname, len);
+   *size += len;
+   memcpy(*data + *size, buf, sizeof(struct stat));
+   *size += sizeof(struct stat);
+   memcpy(*data + *size, &contents_size, sizeof(size_t));
+   *size += sizeof(size_t);
+   memcpy(*data + *size, contents, contents_size);
+   *size += contents_size;
+   return 0;
+}
+
+char *bundle_first_entry(char *data, size_t size, size_t *pos)
+{
+   char *end = memchr(data, '\0', size);
+   if (!end)
+      return NULL;
+   *pos = end - data + 1;
+   return data;
+}
+
+int bundle_next_entry(char *data, size_t size, size_t *pos, char **pathname, struct stat *buf,
+                      char **contents, size_t *contents_size)
+{
+   char *end;
+
+   if (*pos == size)
+      return 0;
+   end = memchr(data + *pos, '\0', size - *pos);
+   if (!end)
+      return -1;
+   *pathname = data + *pos;
+   *pos = end - data + 1;
+
+   if (size - *pos < sizeof(struct stat) + sizeof(size_t))
+      return -1;
+   memcpy(buf, data + *pos, sizeof(struct stat));
+   *pos += sizeof(struct stat);
+   memcpy(contents_size, data + *pos, sizeof(size_t));
+   *pos += sizeof(size_t);
+
+   if (size - *pos < *contents_size)
+      return -1;
+   *contents = data + *pos;
+   *pos += *contents_size;
+   return 1;
+}
@@ -0,0 +1,75 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_BUNDLE_H_)
+#define LDCS_AUDIT_SERVER_BUNDLE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * Packs the small files of a directory under the python prefix into one
+ * LDCS_MSG_FILE_BUNDLE message.  The server that reads the first file out
+ * of such a directory reads all of them, and every server stages the
+ * whole directory, with each file's stat, from the one message.  Imports
+ * of the directory's other modules then don't go up the tree at all.
+ *
+ * A bundle is the directory's name followed by one entry per file:
+ * [pathname\0][struct stat][size_t size][size bytes of contents]
+ *
+ * Package metadata is bundled by site-packages directory instead.  The
+ * first file read out of a .dist-info or .egg-info directory brings every
+ * such directory's files beside it, as importlib.metadata and
+ * pkg_resources scans read the METADATA and entry_points.txt of every
+ * installed package.
+ *
+ * With --batch-small the same message carries small files that were sent
+ * within one pass of the listen loop.  Such a batch has an empty directory
+ * name, and its entries have a zeroed stat, since the files' stats travel
+ * on their own.
+ **/
+
+#define BUNDLE_MAX_FILE_SIZE (1024*1024)
+#define BUNDLE_MAX_SIZE (64*1024*1024)
+
+/* Return true if dir should be bundled and hasn't been yet, and mark it bundled */
+int bundle_is_candidate(ldcs_process_data_t *procdata, char *dir);
+
+/* Return true if dir is package metadata whose directory, put in parent, should be bundled and
+   hasn't been yet, and mark it bundled.  parent is MAX_PATH_LEN+1 bytes. */
+int bundle_is_metadata_candidate(ldcs_process_data_t *procdata, char *dir, char *parent);
+
+/* Read the regular files of dir that fit in a bundle into *data, which the caller frees */
+int bundle_pack_dir(char *dir, int strip, char **data, size_t *size, int *num_files, size_t *bytes_read);
+
+/* As bundle_pack_dir, for the package metadata in dir */
+int bundle_pack_metadata(char *dir, int strip, char **data, size_t *size, int *num_files, size_t *bytes_read);
+
+/* Append a file to the bundle in *data, growing it as needed.  An empty
+   bundle is started with an empty directory name. */
+int bundle_append_entry(char **data, size_t *size, size_t *alloc, char *pathname, struct stat *buf,
+                        char *contents, size_t contents_size);
+
+/* Return the bundle's directory and set *pos to its first entry */
+char *bundle_first_entry(char *data, size_t size, size_t *pos);
+
+/* Step to the entry at *pos.  Returns 1 for an entry, 0 at the end, and -1 if the bundle is corrupt */
+int bundle_next_entry(char *data, size_t size, size_t *pos, char **pathname, struct stat *buf,
+                      char **contents, size_t *contents_size);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "ldcs_api.h"
+#include "ldcs_capture.h"
+#include "ldcs_audit_server_capture.h"
+#include "spindle_debug.h"
+
+#define CAPTURE_BUFFER_SIZE (1024*1024)
+
+static FILE *capture_f = NULL;
+static char *capture_buffer = NULL;
+static double capture_start;
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void capture_init(int rank)
+{
+   char filename[MAX_PATH_LEN+1];
+   char *dir = getenv("SPINDLE_CAPTURE_DIR");
+   capture_header_t header;
+
+   if (!dir || !*dir)
+      return;
+   snprintf(filename, sizeof(filename), "%s/%s.%d", dir, CAPTURE_NAME, rank);
+   capture_f = fopen(filename, "w");
+   if (!capture_f) {
+      err_printf("Could not create capture file %s: %s\n", filename, strerror(errno));
+      return;
+   }
+   capture_buffer = (char *) malloc(CAPTURE_BUFFER_SIZE);
+   if (capture_buffer)
+      setvbuf(capture_f, capture_buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+   capture_start = ldcs_get_time();
+   memset(&header, 0, sizeof(header));
+   header.magic = CAPTURE_MAGIC;
+   header.version = CAPTURE_VERSION;
+   header.rank = rank;
+   header.start = capture_start;
+   if (fwrite(&header, sizeof(header), 1, capture_f) != 1) {
+      err_printf("Could not write capture file %s: %s\n", filename, strerror(errno));
+      fclose(capture_f);
+      capture_f = NULL;
+      return;
+   }
+   debug_printf("Capturing client messages to %s\n", filename);
+}
+
+void capture_finish()
+{
+   pthread_mutex_lock(&capture_lock);
+   if (capture_f) {
+      if (fclose(capture_f) != 0)
+         err_printf("Could not finish writing capture file: %s\n", strerror(errno));
+      capture_f = NULL;
+   }
+   free(capture_buffer);
+   capture_buffer = NULL;
+   pthread_mutex_unlock(&capture_lock);
+}
+
+void capture_client_msg(int nc, int lrank, ldcs_message_t *msg, double arrival)
+{
+   capture_record_t record;
+
+   if (!capture_f)
+      return;
+   memset(&record, 0, sizeof(record));
+   record.usec = arrival > capture_start ? (uint64_t) ((arrival - capture_start) * 1000000.0) : 0;
+   record.client = nc;
+   record.lrank = lrank;
+   record.type = (uint32_t) msg->header.type;
+   record.req = msg->header.req;
+   record.len = msg->data ? (uint32_t) msg->header.len : 0;
+
+   pthread_mutex_lock(&capture_lock);
+   if (capture_f) {
+      fwrite(&record, sizeof(record), 1, capture_f);
+      if (record.len)
+         fwrite(msg->data, 1, record.len, capture_f);
+   }
+   pthread_mutex_unlock(&capture_lock);
+}
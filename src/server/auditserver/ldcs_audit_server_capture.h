@@ -0,0 +1,39 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_CAPTURE_H_)
+#define LDCS_AUDIT_SERVER_CAPTURE_H_
+
+#include "ldcs_api.h"
+
+/**
+ * With SPINDLE_CAPTURE_DIR set, each server writes every message it gets
+ * from a local client to DIR/spindle_capture.RANK, in the format of
+ * ldcs_capture.h.  spindle_replay drives a server with such a file, so a
+ * node's traffic from a large job can be played back on one node.
+ **/
+
+/* Open the capture file, if SPINDLE_CAPTURE_DIR asks for one */
+void capture_init(int rank);
+
+/* Close the capture file */
+void capture_finish();
+
+/* Record msg, which just arrived from client nc of local rank lrank.
+   Safe to call from the client threads. */
+void capture_client_msg(int nc, int lrank, ldcs_message_t *msg, double arrival);
+
+#endif
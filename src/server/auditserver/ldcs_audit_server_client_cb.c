@@ -27,6 +27,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_audit_server_md.h"
 #include "ldcs_audit_server_filemngt.h"
 #include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_capture.h"
+#include "ldcs_audit_server_fairq.h"
 #include "ldcs_api_listen.h"
 #include "ldcs_cache.h" 
 #define DISTCACHE 1
@@ -36,7 +38,7 @@ extern int ldcs_socket_id_to_nc(int id, int fd, ldcs_process_data_t *process_dat
 int _ldcs_client_dump_info ( ldcs_process_data_t *ldcs_process_data );
 
 /* some message container */
-static  char buffer_in[MAX_PATH_LEN];
+static  char buffer_in[LDCS_MAX_MSG_LEN];
 /* static  char buffer_out[MAX_PATH_LEN]; */
 
 int _ldcs_client_CB ( int fd, int id, void *data ) {
@@ -71,10 +73,16 @@ int _ldcs_client_CB ( int fd, int id, void *data ) {
 
   /* statistics */
   ldcs_process_data->client_table[nc].query_arrival_time = cb_starttime;
+  capture_client_msg(nc, ldcs_process_data->client_table[nc].lrank, &in_msg, cb_starttime);
 
-  rc = handle_client_message(ldcs_process_data, nc, &in_msg);
-  
-  debug_printf3("Finished handling client message on %d with return code %d\n", nc, rc);
+  if (fairq_enabled()) {
+     /* Handled at the end of the listen loop's pass, see ldcs_audit_server_fairq.h */
+     rc = fairq_push(ldcs_process_data, nc, &in_msg, cb_starttime);
+  }
+  else {
+     rc = handle_client_message(ldcs_process_data, nc, &in_msg);
+     debug_printf3("Finished handling client message on %d with return code %d\n", nc, rc);
+  }
 
   ldcs_process_data->server_stat.client_cb.cnt++;
   ldcs_process_data->server_stat.client_cb.time+=(ldcs_get_time()-cb_starttime);
@@ -0,0 +1,373 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+#include "ldcs_audit_server_process.h"
+#include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_clientpool.h"
+#include "ldcs_audit_server_latency.h"
+#include "ldcs_audit_server_capture.h"
+
+/**
+ * The client pool lets more than one core answer local clients.  With
+ * SPINDLE_CLIENT_THREADS set, each client connection is read by one of
+ * the client threads instead of the main listen loop.  A client thread
+ * answers file queries that the cache can settle (a staged file, or a
+ * known miss) on its own, and hands every other message to the main
+ * thread, which still does all network traffic, reads and broadcasts.
+ *
+ * The server lock is a read-write lock.  The main thread holds the write
+ * side at all times except while it waits for events, so the client
+ * threads only run while the main thread is idle, and see a consistent
+ * cache and client table.  Among themselves, the client threads read
+ * and write their connections in parallel, and take pool_lock only to
+ * look up an answer and update the stats.
+ *
+ * Connections are added with EPOLLONESHOT.  A client thread re-arms a
+ * connection once it has answered it, or the main thread does once it
+ * has handled the message it was given.  So at most one message per
+ * client is in flight, and a client's messages are handled in order.
+ **/
+
+#define CLIENTPOOL_MAX_THREADS 64
+#define CLIENTPOOL_EVENTS 32
+
+typedef struct {
+   int fd;              /* -1 when the slot isn't in use */
+   unsigned int gen;    /* bumped on reuse, so stale events are ignored */
+   int thread;
+} client_slot_t;
+
+typedef struct forwarded_msg_t {
+   int nc;
+   unsigned int gen;
+   double arrival_time;
+   ldcs_message_t msg;
+   struct forwarded_msg_t *next;
+} forwarded_msg_t;
+
+typedef struct {
+   pthread_t thread;
+   int epoll_fd;
+   char buffer_in[LDCS_MAX_MSG_LEN];
+   char buffer_out[MAX_PATH_LEN+1+sizeof(int)];
+} client_thread_t;
+
+static ldcs_process_data_t *pool_procdata = NULL;
+static pthread_rwlock_t server_lock;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static client_thread_t *threads = NULL;
+static int num_threads = 0;
+static int next_thread = 0;
+
+/* Only changed by the main thread, with the write side of server_lock held */
+static client_slot_t *slots = NULL;
+static int num_slots = 0;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static forwarded_msg_t *queue_head = NULL, *queue_tail = NULL;
+static int queue_fd = -1;
+
+static int arm_slot(int nc, int op)
+{
+   struct epoll_event ev;
+   memset(&ev, 0, sizeof(ev));
+   ev.events = EPOLLIN | EPOLLONESHOT;
+   ev.data.u64 = ((uint64_t) slots[nc].gen << 32) | (uint32_t) nc;
+   return epoll_ctl(threads[slots[nc].thread].epoll_fd, op, slots[nc].fd, &ev);
+}
+
+/**
+ * Pass a message a client thread couldn't answer to the main thread.
+ **/
+static void forward_msg(int nc, ldcs_message_t *msg, double arrival_time)
+{
+   forwarded_msg_t *fwd;
+   uint64_t one = 1;
+   ssize_t result;
+
+   fwd = (forwarded_msg_t *) malloc(sizeof(forwarded_msg_t));
+   if (fwd) {
+      fwd->msg = *msg;
+      fwd->msg.data = NULL;
+      if (msg->data && msg->header.len) {
+         fwd->msg.data = (char *) malloc(msg->header.len);
+         if (fwd->msg.data)
+            memcpy(fwd->msg.data, msg->data, msg->header.len);
+      }
+   }
+   if (!fwd || (msg->data && msg->header.len && !fwd->msg.data)) {
+      err_printf("Could not pass a message from client %d to the main thread\n", nc);
+      free(fwd);
+      return;
+   }
+   fwd->nc = nc;
+   fwd->gen = slots[nc].gen;
+   fwd->arrival_time = arrival_time;
+   fwd->next = NULL;
+
+   pthread_mutex_lock(&queue_lock);
+   if (queue_tail)
+      queue_tail->next = fwd;
+   else
+      queue_head = fwd;
+   queue_tail = fwd;
+   pthread_mutex_unlock(&queue_lock);
+
+   do {
+      result = write(queue_fd, &one, sizeof(one));
+   } while (result == -1 && errno == EINTR);
+}
+
+/**
+ * Read one message from client nc and answer it, or pass it on.  Called
+ * with the read side of server_lock held.
+ **/
+static void client_thread_handle(client_thread_t *t, int nc, unsigned int gen)
+{
+   ldcs_message_t in_msg, out_msg;
+   double starttime = ldcs_get_time();
+   int connid, answered;
+
+   if (nc >= num_slots || slots[nc].fd == -1 || slots[nc].gen != gen)
+      return;
+   connid = pool_procdata->client_table[nc].connid;
+
+   in_msg.header.type = LDCS_MSG_UNKNOWN;
+   in_msg.header.len = 0;
+   in_msg.data = t->buffer_in;
+   ldcs_recv_msg_static(connid, &in_msg, LDCS_READ_BLOCK);
+   debug_printf3("Client thread received message on connection nc=%d connid=%d\n", nc, connid);
+   capture_client_msg(nc, pool_procdata->client_table[nc].lrank, &in_msg, starttime);
+
+   out_msg.data = t->buffer_out;
+   pthread_mutex_lock(&pool_lock);
+   answered = handle_client_cached_query(pool_procdata, nc, &in_msg, &out_msg);
+   pthread_mutex_unlock(&pool_lock);
+
+   if (!answered) {
+      forward_msg(nc, &in_msg, starttime);
+      return;
+   }
+
+   ldcs_send_msg(connid, &out_msg);
+   if (arm_slot(nc, EPOLL_CTL_MOD) == -1)
+      err_printf("Could not listen to client %d again: %s\n", nc, strerror(errno));
+
+   pthread_mutex_lock(&pool_lock);
+   pool_procdata->server_stat.clientmsg.cnt++;
+   pool_procdata->server_stat.clientmsg.time += ldcs_get_time() - starttime;
+   pool_procdata->server_stat.clientpool.cnt++;
+   pool_procdata->server_stat.clientpool.time += ldcs_get_time() - starttime;
+   pthread_mutex_unlock(&pool_lock);
+   latency_record(LATENCY_CLIENT_QUERY, starttime, NULL);
+}
+
+static void *client_thread_main(void *arg)
+{
+   client_thread_t *t = (client_thread_t *) arg;
+   struct epoll_event events[CLIENTPOOL_EVENTS];
+   int i, n;
+
+   for (;;) {
+      n = epoll_wait(t->epoll_fd, events, CLIENTPOOL_EVENTS, -1);
+      if (n == -1 && errno == EINTR)
+         continue;
+      if (n == -1) {
+         err_printf("Client thread could not wait for clients: %s\n", strerror(errno));
+         return NULL;
+      }
+      pthread_rwlock_rdlock(&server_lock);
+      for (i = 0; i < n; i++)
+         client_thread_handle(t, (int) (uint32_t) events[i].data.u64,
+                              (unsigned int) (events[i].data.u64 >> 32));
+      pthread_rwlock_unlock(&server_lock);
+   }
+   return NULL;
+}
+
+/**
+ * Listen loop callback for messages the client threads passed on.
+ **/
+static int clientpool_queue_CB(int fd, int id, void *data)
+{
+   forwarded_msg_t *fwd, *next;
+   uint64_t count;
+   double starttime;
+   int nc, result;
+
+   if (read(queue_fd, &count, sizeof(count)) == -1 && errno != EAGAIN && errno != EINTR)
+      err_printf("Could not read client thread queue: %s\n", strerror(errno));
+
+   pthread_mutex_lock(&queue_lock);
+   fwd = queue_head;
+   queue_head = queue_tail = NULL;
+   pthread_mutex_unlock(&queue_lock);
+
+   for (; fwd; fwd = next) {
+      next = fwd->next;
+      nc = fwd->nc;
+      if (nc < num_slots && slots[nc].fd != -1 && slots[nc].gen == fwd->gen) {
+         starttime = ldcs_get_time();
+         pool_procdata->client_table[nc].query_arrival_time = fwd->arrival_time;
+         result = handle_client_message(pool_procdata, nc, &fwd->msg);
+         debug_printf3("Finished handling client message on %d with return code %d\n", nc, result);
+         pool_procdata->server_stat.client_cb.cnt++;
+         pool_procdata->server_stat.client_cb.time += ldcs_get_time() - starttime;
+
+         /* An error stops us listening to the client, as in the listen loop */
+         if (result != -1 && nc < num_slots && slots[nc].fd != -1 && slots[nc].gen == fwd->gen &&
+             arm_slot(nc, EPOLL_CTL_MOD) == -1)
+            err_printf("Could not listen to client %d again: %s\n", nc, strerror(errno));
+      }
+      free(fwd->msg.data);
+      free(fwd);
+   }
+   return 0;
+}
+
+/**
+ * Listen loop callback around its waits.  The client threads may run
+ * while the main thread waits for events.
+ **/
+static int clientpool_wait_cb(int waiting, void *data)
+{
+   if (waiting)
+      pthread_rwlock_unlock(&server_lock);
+   else
+      pthread_rwlock_wrlock(&server_lock);
+   return 0;
+}
+
+int clientpool_start(ldcs_process_data_t *procdata, int nthreads)
+{
+   pthread_rwlockattr_t attr;
+   int i;
+
+   if (nthreads <= 0)
+      return 0;
+   if (ldcs_get_aux_fd() != -1) {
+      /* Clients share a connection fd, so it can't belong to one thread */
+      err_printf("Client threads can't be used with this client connection type, not starting them\n");
+      return 0;
+   }
+   if (nthreads > CLIENTPOOL_MAX_THREADS)
+      nthreads = CLIENTPOOL_MAX_THREADS;
+
+   pthread_rwlockattr_init(&attr);
+   /* Don't let a stream of client hits starve the main thread */
+   pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+   pthread_rwlock_init(&server_lock, &attr);
+   pthread_rwlockattr_destroy(&attr);
+   pthread_rwlock_wrlock(&server_lock);
+
+   queue_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (queue_fd == -1) {
+      err_printf("Could not create client thread queue: %s\n", strerror(errno));
+      return -1;
+   }
+
+   threads = (client_thread_t *) calloc(nthreads, sizeof(client_thread_t));
+   if (!threads)
+      return -1;
+   pool_procdata = procdata;
+   for (i = 0; i < nthreads; i++) {
+      threads[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (threads[i].epoll_fd == -1 ||
+          pthread_create(&threads[i].thread, NULL, client_thread_main, threads + i) != 0) {
+         err_printf("Could not start client thread %d\n", i);
+         if (threads[i].epoll_fd != -1)
+            close(threads[i].epoll_fd);
+         break;
+      }
+      num_threads++;
+   }
+   if (!num_threads) {
+      free(threads);
+      threads = NULL;
+      close(queue_fd);
+      queue_fd = -1;
+      return -1;
+   }
+
+   ldcs_listen_register_fd(queue_fd, queue_fd, clientpool_queue_CB, procdata);
+   ldcs_listen_register_wait_cb(clientpool_wait_cb, NULL);
+   debug_printf("Answering clients on %d client threads\n", num_threads);
+   return 0;
+}
+
+int clientpool_register_fd(int nc, int fd)
+{
+   client_slot_t *newslots;
+   int i;
+
+   if (!num_threads || queue_fd == -1)
+      return -1;
+
+   if (nc >= num_slots) {
+      newslots = (client_slot_t *) realloc(slots, sizeof(client_slot_t) * (nc + 16));
+      if (!newslots)
+         return -1;
+      slots = newslots;
+      for (i = num_slots; i < nc + 16; i++) {
+         slots[i].fd = -1;
+         slots[i].gen = 0;
+      }
+      num_slots = nc + 16;
+   }
+   slots[nc].fd = fd;
+   slots[nc].gen++;
+   slots[nc].thread = next_thread;
+   next_thread = (next_thread + 1) % num_threads;
+
+   if (arm_slot(nc, EPOLL_CTL_ADD) == -1) {
+      err_printf("Could not give client %d to a client thread: %s\n", nc, strerror(errno));
+      slots[nc].fd = -1;
+      return -1;
+   }
+   debug_printf3("Client %d on fd %d is read by client thread %d\n", nc, fd, slots[nc].thread);
+   return 0;
+}
+
+int clientpool_unregister_fd(int nc)
+{
+   if (nc >= num_slots || slots[nc].fd == -1)
+      return -1;
+   epoll_ctl(threads[slots[nc].thread].epoll_fd, EPOLL_CTL_DEL, slots[nc].fd, NULL);
+   slots[nc].fd = -1;
+   return 0;
+}
+
+void clientpool_stop()
+{
+   if (queue_fd == -1)
+      return;
+   ldcs_listen_unregister_fd(queue_fd);
+   close(queue_fd);
+   queue_fd = -1;
+}
@@ -0,0 +1,47 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_CLIENTPOOL_H_)
+#define LDCS_AUDIT_SERVER_CLIENTPOOL_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * Start num_threads client threads, which take over reading from client
+ * connections and answer the queries the cache can.  Called from the
+ * main thread before the listen loop.  Returns 0 if the threads are
+ * running or weren't asked for, or -1 on error.
+ **/
+int clientpool_start(ldcs_process_data_t *procdata, int num_threads);
+
+/**
+ * Hand client nc's connection fd to a client thread.  Returns -1 if the
+ * client threads aren't running, so the caller should listen to fd itself.
+ **/
+int clientpool_register_fd(int nc, int fd);
+
+/**
+ * Stop reading from client nc's connection.  Returns -1 if it wasn't
+ * on a client thread.
+ **/
+int clientpool_unregister_fd(int nc);
+
+/**
+ * Stop handing client messages to the main thread, once the clients are gone.
+ **/
+void clientpool_stop();
+
+#endif
@@ -0,0 +1,228 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ldcs_audit_server_compress.h"
+
+/**
+ * Each sequence is a token byte holding a 4-bit literal count and a 4-bit
+ * match length, any overflow of those as runs of 255-valued bytes, the
+ * literals, and a 2-byte little-endian offset back to the match.  The
+ * last sequence is literals only.  As in LZ4, the last 5 bytes are
+ * always literals and no match starts in the last 12 bytes.
+ **/
+#define LZ_MINMATCH 4
+#define LZ_LASTLITERALS 5
+#define LZ_MFLIMIT 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 16
+#define LZ_SKIP_TRIGGER 6
+
+static uint32_t read32(const unsigned char *p)
+{
+   uint32_t val;
+   memcpy(&val, p, sizeof(val));
+   return val;
+}
+
+static unsigned int hash4(uint32_t val)
+{
+   return (val * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+   while (len >= 255) {
+      *op++ = 255;
+      len -= 255;
+   }
+   *op++ = (unsigned char) len;
+   return op;
+}
+
+static int get_length(const unsigned char **ip, const unsigned char *iend, size_t *len)
+{
+   unsigned char b;
+   do {
+      if (*ip >= iend)
+         return -1;
+      b = *(*ip)++;
+      *len += b;
+   } while (b == 255);
+   return 0;
+}
+
+size_t compress_bound(size_t len)
+{
+   return len + len / 255 + 16;
+}
+
+size_t compress_buffer(const void *src, size_t len, void *dst, size_t dst_len)
+{
+   const unsigned char *in = (const unsigned char *) src;
+   const unsigned char *ip = in, *anchor = in, *ref;
+   const unsigned char *iend = in + len;
+   const unsigned char *mflimit = iend - LZ_MFLIMIT;
+   const unsigned char *matchlimit = iend - LZ_LASTLITERALS;
+   unsigned char *op = (unsigned char *) dst, *oend = op + dst_len, *token;
+   uint32_t *table, seq;
+   size_t lit_len, match_len;
+   unsigned int h, step, searches;
+
+   /* Positions are kept in 32 bits */
+   if (len > 0xffffffffUL)
+      return 0;
+
+   table = (uint32_t *) calloc(1 << LZ_HASH_BITS, sizeof(uint32_t));
+   if (!table)
+      return 0;
+
+   if (len <= LZ_MFLIMIT)
+      goto last_literals;
+
+   table[hash4(read32(ip))] = 0;
+   ip++;
+
+   while (ip < mflimit) {
+      /* Look for a match, stepping further the longer we go without one */
+      step = 1;
+      searches = 1 << LZ_SKIP_TRIGGER;
+      for (;;) {
+         seq = read32(ip);
+         h = hash4(seq);
+         ref = in + table[h];
+         table[h] = (uint32_t) (ip - in);
+         if (ip - ref <= LZ_MAX_OFFSET && read32(ref) == seq)
+            break;
+         ip += step;
+         step = searches++ >> LZ_SKIP_TRIGGER;
+         if (ip >= mflimit)
+            goto last_literals;
+      }
+
+      while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+         ip--;
+         ref--;
+      }
+      match_len = LZ_MINMATCH;
+      while (ip + match_len < matchlimit && ip[match_len] == ref[match_len])
+         match_len++;
+
+      lit_len = ip - anchor;
+      if ((size_t) (oend - op) < lit_len + lit_len / 255 + match_len / 255 + 8)
+         goto fail;
+
+      token = op++;
+      if (lit_len >= 15) {
+         *token = 15 << 4;
+         op = put_length(op, lit_len - 15);
+      }
+      else
+         *token = (unsigned char) (lit_len << 4);
+      memcpy(op, anchor, lit_len);
+      op += lit_len;
+
+      *op++ = (unsigned char) ((ip - ref) & 0xff);
+      *op++ = (unsigned char) ((ip - ref) >> 8);
+      if (match_len - LZ_MINMATCH >= 15) {
+         *token |= 15;
+         op = put_length(op, match_len - LZ_MINMATCH - 15);
+      }
+      else
+         *token |= (unsigned char) (match_len - LZ_MINMATCH);
+
+      ip += match_len;
+      anchor = ip;
+      if (ip < mflimit)
+         table[hash4(read32(ip - 2))] = (uint32_t) (ip - 2 - in);
+   }
+
+  last_literals:
+   lit_len = iend - anchor;
+   if ((size_t) (oend - op) < lit_len + lit_len / 255 + 2)
+      goto fail;
+   token = op++;
+   if (lit_len >= 15) {
+      *token = 15 << 4;
+      op = put_length(op, lit_len - 15);
+   }
+   else
+      *token = (unsigned char) (lit_len << 4);
+   memcpy(op, anchor, lit_len);
+   op += lit_len;
+
+   free(table);
+   return op - (unsigned char *) dst;
+
+  fail:
+   free(table);
+   return 0;
+}
+
+int decompress_buffer(const void *src, size_t len, void *dst, size_t dst_len)
+{
+   const unsigned char *ip = (const unsigned char *) src, *iend = ip + len;
+   unsigned char *out = (unsigned char *) dst, *op = out, *oend = out + dst_len;
+   const unsigned char *ref;
+   unsigned char token;
+   size_t lit_len, match_len, offset, i;
+
+   for (;;) {
+      if (ip >= iend)
+         return -1;
+      token = *ip++;
+
+      lit_len = token >> 4;
+      if (lit_len == 15 && get_length(&ip, iend, &lit_len) == -1)
+         return -1;
+      if (lit_len > (size_t) (iend - ip) || lit_len > (size_t) (oend - op))
+         return -1;
+      memcpy(op, ip, lit_len);
+      op += lit_len;
+      ip += lit_len;
+      if (ip == iend)
+         break;
+
+      if (iend - ip < 2)
+         return -1;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (size_t) (op - out))
+         return -1;
+
+      match_len = token & 15;
+      if (match_len == 15 && get_length(&ip, iend, &match_len) == -1)
+         return -1;
+      match_len += LZ_MINMATCH;
+      if (match_len > (size_t) (oend - op))
+         return -1;
+
+      /* Matches may overlap the bytes they produce */
+      ref = op - offset;
+      if (offset >= match_len)
+         memcpy(op, ref, match_len);
+      else
+         for (i = 0; i < match_len; i++)
+            op[i] = ref[i];
+      op += match_len;
+   }
+
+   return op == oend ? 0 : -1;
+}
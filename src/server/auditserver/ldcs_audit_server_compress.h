@@ -0,0 +1,44 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_COMPRESS_H_)
+#define LDCS_AUDIT_SERVER_COMPRESS_H_
+
+#include <sys/types.h>
+
+/**
+ * A small LZ77 codec that writes the LZ4 block format, used to shrink file
+ * contents before they go across the tree.  It trades ratio for speed, so
+ * compressing and decompressing stay cheaper than the network time saved.
+ **/
+
+/* Worst case compressed size of len bytes */
+size_t compress_bound(size_t len);
+
+/**
+ * Compress len bytes from src into dst, which holds dst_len bytes.
+ * Returns the compressed size, or 0 if the result doesn't fit in dst_len.
+ **/
+size_t compress_buffer(const void *src, size_t len, void *dst, size_t dst_len);
+
+/**
+ * Decompress len bytes from src into dst, which must come out to exactly
+ * dst_len bytes.  Returns 0 on success, or -1 if src is corrupt.
+ **/
+int decompress_buffer(const void *src, size_t len, void *dst, size_t dst_len);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "ldcs_audit_server_crc.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * Checksums are kept by interned pathname, so a bucket is searched by
+ * comparing pointers.
+ **/
+
+#define CRC_TABLE_SIZE 4096
+#define CRC32C_POLY 0x82f63b78u
+
+typedef struct file_crc_t {
+   const char *pathname;
+   uint32_t crc;
+   struct file_crc_t *next;
+} file_crc_t;
+
+static file_crc_t *crc_table[CRC_TABLE_SIZE];
+static uint32_t crc32c_bytes[256];
+static int crc32c_setup = 0;
+static int crc32c_hw = 0;
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+   while (len--)
+      crc = crc32c_bytes[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+   return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw_run(uint32_t crc, const unsigned char *p, size_t len)
+{
+   uint64_t crc64 = crc, word;
+
+   for (; len && ((uintptr_t) p & 7); len--)
+      crc64 = __builtin_ia32_crc32qi((uint32_t) crc64, *p++);
+   for (; len >= 8; len -= 8, p += 8) {
+      memcpy(&word, p, sizeof(word));
+      crc64 = __builtin_ia32_crc32di(crc64, word);
+   }
+   for (; len; len--)
+      crc64 = __builtin_ia32_crc32qi((uint32_t) crc64, *p++);
+   return (uint32_t) crc64;
+}
+#define HAVE_CRC32C_HW 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_hw_run(uint32_t crc, const unsigned char *p, size_t len)
+{
+   uint64_t word;
+
+   for (; len && ((uintptr_t) p & 7); len--)
+      crc = __crc32cb(crc, *p++);
+   for (; len >= 8; len -= 8, p += 8) {
+      memcpy(&word, p, sizeof(word));
+      crc = __crc32cd(crc, word);
+   }
+   for (; len; len--)
+      crc = __crc32cb(crc, *p++);
+   return crc;
+}
+#define HAVE_CRC32C_HW 1
+#endif
+
+static void crc32c_init()
+{
+   uint32_t crc;
+   int i, j;
+
+   for (i = 0; i < 256; i++) {
+      crc = i;
+      for (j = 0; j < 8; j++)
+         crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+      crc32c_bytes[i] = crc;
+   }
+#if defined(__x86_64__)
+   crc32c_hw = __builtin_cpu_supports("sse4.2");
+#elif defined(HAVE_CRC32C_HW)
+   crc32c_hw = 1;
+#endif
+   debug_printf2("Checksumming with %s CRC32C\n", crc32c_hw ? "hardware" : "table-driven");
+   crc32c_setup = 1;
+}
+
+uint32_t crc32c(const void *buf, size_t len)
+{
+   if (!crc32c_setup)
+      crc32c_init();
+#if defined(HAVE_CRC32C_HW)
+   if (crc32c_hw)
+      return ~crc32c_hw_run(~0u, (const unsigned char *) buf, len);
+#endif
+   return ~crc32c_sw(~0u, (const unsigned char *) buf, len);
+}
+
+void crc_record(const char *pathname, uint32_t crc)
+{
+   const char *name;
+   file_crc_t *fc;
+   unsigned int bucket;
+
+   name = intern_name(pathname);
+   bucket = intern_name_hash(name) % CRC_TABLE_SIZE;
+   for (fc = crc_table[bucket]; fc; fc = fc->next) {
+      if (fc->pathname == name) {
+         fc->crc = crc;
+         return;
+      }
+   }
+
+   fc = (file_crc_t *) malloc(sizeof(file_crc_t));
+   if (!fc) {
+      err_printf("Could not allocate checksum record for %s\n", pathname);
+      return;
+   }
+   fc->pathname = name;
+   fc->crc = crc;
+   fc->next = crc_table[bucket];
+   crc_table[bucket] = fc;
+}
+
+void crc_forget(const char *pathname)
+{
+   const char *name;
+   file_crc_t **prev, *fc;
+
+   name = lookup_intern_name(pathname);
+   if (!name)
+      return;
+   for (prev = crc_table + intern_name_hash(name) % CRC_TABLE_SIZE; *prev; prev = &(*prev)->next) {
+      if ((*prev)->pathname == name) {
+         fc = *prev;
+         *prev = fc->next;
+         free(fc);
+         return;
+      }
+   }
+}
+
+int crc_lookup(const char *pathname, uint32_t *crc)
+{
+   const char *name;
+   file_crc_t *fc;
+
+   name = lookup_intern_name(pathname);
+   if (!name)
+      return -1;
+   for (fc = crc_table[intern_name_hash(name) % CRC_TABLE_SIZE]; fc; fc = fc->next) {
+      if (fc->pathname == name) {
+         *crc = fc->crc;
+         return 0;
+      }
+   }
+   return -1;
+}
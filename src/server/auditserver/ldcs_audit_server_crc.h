@@ -0,0 +1,43 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_CRC_H_)
+#define LDCS_AUDIT_SERVER_CRC_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * With --verify, the server that reads a file off the shared file system
+ * takes the CRC32C of its contents and sends it with them.  Each server
+ * checks what it receives against it, and checks its staged copy again
+ * before sending it on later.  A copy that doesn't match is replaced with
+ * the file from the shared file system.
+ *
+ * CRC32C uses the SSE 4.2 crc32 instruction on x86_64, or the ARMv8 CRC
+ * instructions when built for them, which keeps pace with memcpy.
+ **/
+
+/* CRC32C of len bytes at buf */
+uint32_t crc32c(const void *buf, size_t len);
+
+/* Remember pathname's checksum, forget it, or look it up.  crc_lookup
+   returns 0 if found, -1 if not */
+void crc_record(const char *pathname, uint32_t crc);
+void crc_forget(const char *pathname);
+int crc_lookup(const char *pathname, uint32_t *crc);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_dedup.h"
+#include "ldcs_cache.h"
+#include "name_intern.h"
+#include "pathfn.h"
+
+/**
+ * Files are found by device and inode, which catches hard links and
+ * paths through symlinked directories without reading anything, and by
+ * size.  Files of the same size are compared by a hash of their staged
+ * contents, computed only once a second file of that size shows up, and
+ * a hash match is confirmed byte for byte.
+ **/
+
+#define DEDUP_TABLE_SIZE (16*1024)
+
+typedef struct dedup_file_t {
+   const char *pathname;
+   dev_t dev;
+   ino_t ino;
+   size_t size;
+   uint64_t hash;
+   int hashed;
+   struct dedup_file_t *next_inode;
+   struct dedup_file_t *next_size;
+} dedup_file_t;
+
+typedef struct dedup_alias_t {
+   const char *pathname;
+   const char *canonical;
+   struct dedup_alias_t *next;
+} dedup_alias_t;
+
+static dedup_file_t *inode_table[DEDUP_TABLE_SIZE];
+static dedup_file_t *size_table[DEDUP_TABLE_SIZE];
+static dedup_alias_t *alias_table[DEDUP_TABLE_SIZE];
+
+static unsigned int inode_bucket(dev_t dev, ino_t ino)
+{
+   return (unsigned int) ((((uint64_t) dev) * 31 + (uint64_t) ino) * 2654435761U) % DEDUP_TABLE_SIZE;
+}
+
+static unsigned int size_bucket(size_t size)
+{
+   return (unsigned int) ((((uint64_t) size) * 2654435761U) >> 8) % DEDUP_TABLE_SIZE;
+}
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+   return (x << r) | (x >> (64 - r));
+}
+
+/* A MurmurHash3-style mix, one 8-byte word at a time */
+static uint64_t hash_contents(const unsigned char *p, size_t len)
+{
+   uint64_t h = 0x9e3779b97f4a7c15ULL ^ len, w;
+   size_t i;
+
+   for (; len >= 8; p += 8, len -= 8) {
+      memcpy(&w, p, sizeof(w));
+      w *= 0x87c37b91114253d5ULL;
+      w = rotl64(w, 31);
+      w *= 0x4cf5ad432745937fULL;
+      h ^= w;
+      h = rotl64(h, 27) * 5 + 0x52dce729;
+   }
+   for (w = 0, i = 0; i < len; i++)
+      w |= ((uint64_t) p[i]) << (i * 8);
+   h ^= w * 0x87c37b91114253d5ULL;
+
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ULL;
+   h ^= h >> 33;
+   return h;
+}
+
+static void *staged_buffer(const char *pathname, size_t size)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   void *buffer;
+   size_t buffer_size;
+
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_get_buffer(dirname, filename, &buffer, &buffer_size) == -1)
+      return NULL;
+   if (!buffer || buffer_size != size)
+      return NULL;
+   return buffer;
+}
+
+void dedup_add_file(char *pathname, dev_t dev, ino_t ino, size_t size)
+{
+   dedup_file_t *f;
+   unsigned int b;
+
+   f = (dedup_file_t *) malloc(sizeof(*f));
+   if (!f) {
+      err_printf("Could not allocate dedup entry for %s\n", pathname);
+      return;
+   }
+   f->pathname = intern_name(pathname);
+   f->dev = dev;
+   f->ino = ino;
+   f->size = size;
+   f->hash = 0;
+   f->hashed = 0;
+
+   b = inode_bucket(dev, ino);
+   f->next_inode = inode_table[b];
+   inode_table[b] = f;
+   b = size_bucket(size);
+   f->next_size = size_table[b];
+   size_table[b] = f;
+}
+
+char *dedup_find_by_inode(char *pathname, dev_t dev, ino_t ino)
+{
+   dedup_file_t *f;
+
+   for (f = inode_table[inode_bucket(dev, ino)]; f; f = f->next_inode) {
+      if (f->dev == dev && f->ino == ino && strcmp(f->pathname, pathname) != 0)
+         return (char *) f->pathname;
+   }
+   return NULL;
+}
+
+char *dedup_find_by_contents(char *pathname, size_t size)
+{
+   dedup_file_t *f;
+   unsigned char *buffer = NULL, *other;
+   uint64_t hash = 0;
+
+   for (f = size_table[size_bucket(size)]; f; f = f->next_size) {
+      if (f->size != size || strcmp(f->pathname, pathname) == 0)
+         continue;
+      if (!buffer) {
+         buffer = (unsigned char *) staged_buffer(pathname, size);
+         if (!buffer)
+            return NULL;
+         hash = hash_contents(buffer, size);
+      }
+      other = (unsigned char *) staged_buffer(f->pathname, size);
+      if (!other)
+         continue;
+      if (!f->hashed) {
+         f->hash = hash_contents(other, size);
+         f->hashed = 1;
+      }
+      if (f->hash == hash && memcmp(buffer, other, size) == 0) {
+         debug_printf2("%s has the same %lu bytes of contents as %s\n", pathname,
+                       (unsigned long) size, f->pathname);
+         return (char *) f->pathname;
+      }
+   }
+   return NULL;
+}
+
+void dedup_add_alias(char *pathname, char *canonical)
+{
+   dedup_alias_t *a;
+   const char *name = intern_name(pathname);
+   unsigned int b = intern_name_hash(name) % DEDUP_TABLE_SIZE;
+
+   for (a = alias_table[b]; a; a = a->next) {
+      if (a->pathname == name) {
+         a->canonical = intern_name(canonical);
+         return;
+      }
+   }
+   a = (dedup_alias_t *) malloc(sizeof(*a));
+   if (!a) {
+      err_printf("Could not allocate dedup alias for %s\n", pathname);
+      return;
+   }
+   a->pathname = name;
+   a->canonical = intern_name(canonical);
+   a->next = alias_table[b];
+   alias_table[b] = a;
+}
+
+char *dedup_get_canonical(char *pathname)
+{
+   dedup_alias_t *a;
+   const char *name = lookup_intern_name(pathname);
+
+   if (!name)
+      return NULL;
+   for (a = alias_table[intern_name_hash(name) % DEDUP_TABLE_SIZE]; a; a = a->next) {
+      if (a->pathname == name)
+         return (char *) a->canonical;
+   }
+   return NULL;
+}
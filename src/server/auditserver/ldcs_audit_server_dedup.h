@@ -0,0 +1,46 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_DEDUP_H_)
+#define LDCS_AUDIT_SERVER_DEDUP_H_
+
+#include <sys/types.h>
+
+/**
+ * Tracks staged files with the same contents.  The server that reads
+ * files off disk remembers each one it stages.  A later file that is the
+ * same file on disk, or has the same size and contents, becomes an alias
+ * of the first.  Every server then stages the alias as a link to the
+ * first file's local copy rather than receiving it again.
+ **/
+
+/* Remember a file that was read off disk and staged */
+void dedup_add_file(char *pathname, dev_t dev, ino_t ino, size_t size);
+
+/* Return a staged file that is the same file on disk, or NULL */
+char *dedup_find_by_inode(char *pathname, dev_t dev, ino_t ino);
+
+/* Return a staged file with the same size and contents as pathname's staged copy, or NULL */
+char *dedup_find_by_contents(char *pathname, size_t size);
+
+/* Record that pathname is staged as a link to canonical */
+void dedup_add_alias(char *pathname, char *canonical);
+
+/* Return the file that pathname is an alias of, or NULL */
+char *dedup_get_canonical(char *pathname);
+
+#endif
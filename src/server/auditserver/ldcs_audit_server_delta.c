@@ -0,0 +1,419 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_delta.h"
+#include "ldcs_audit_server_crc.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * The sending server has both versions, so unlike rsync nothing is asked
+ * of the receivers.  The base's blocks are put in a table by a rolling
+ * checksum, and the new version is scanned a byte at a time for blocks
+ * that match one, which are confirmed byte for byte.  A match is first
+ * looked for right after the last one, so a run of unchanged blocks is
+ * found with one memcmp each, and code that moved when a function grew is
+ * still found at its new offset.
+ **/
+
+#define DELTA_TABLE_SIZE 256
+#define DELTA_BLOCK_SIZE 4096
+#define DELTA_MAX_CANDIDATES 16   /* blocks with the same checksum compared against */
+#define DELTA_MAX_EIGHTHS 6       /* bigger encodings aren't worth it */
+
+#define DELTA_OP_COPY 'c'
+#define DELTA_OP_DATA 'd'
+#define DELTA_HEADER_SIZE (sizeof(size_t) + 2 * sizeof(uint32_t))
+#define DELTA_NO_MATCH ((size_t) -1)
+
+typedef struct delta_entry_t {
+   const char *pathname;
+   void *base;                /* NULL once the new version is encoded or rebuilt */
+   size_t base_size;
+   uint32_t base_crc;
+   int have_crc;
+   node_peer_t *holders;
+   int num_holders;
+   void *delta;
+   size_t delta_size;
+   int tried;
+   struct delta_entry_t *next;
+} delta_entry_t;
+
+typedef struct {
+   char *buffer;
+   size_t size;
+   size_t used;
+   size_t max;
+   size_t last_copy;          /* offset of the last op if it's a copy, else 0 */
+} delta_writer_t;
+
+static delta_entry_t *delta_table[DELTA_TABLE_SIZE];
+
+static delta_entry_t *find_entry(const char *pathname, delta_entry_t ***prev)
+{
+   const char *name = lookup_intern_name(pathname);
+   delta_entry_t **e;
+
+   if (!name)
+      return NULL;
+   for (e = delta_table + intern_name_hash(name) % DELTA_TABLE_SIZE; *e; e = &(*e)->next) {
+      if ((*e)->pathname == name) {
+         if (prev)
+            *prev = e;
+         return *e;
+      }
+   }
+   return NULL;
+}
+
+static void release_base(delta_entry_t *e)
+{
+   if (!e->base)
+      return;
+   filemngt_unmap_staged_file(e->base, e->base_size);
+   e->base = NULL;
+}
+
+static void free_entry(delta_entry_t *e)
+{
+   release_base(e);
+   free(e->holders);
+   free(e->delta);
+   free(e);
+}
+
+void delta_keep_base(const char *pathname, void *buffer, size_t size,
+                     node_peer_t *holders, int num_holders)
+{
+   const char *name = intern_name(pathname);
+   delta_entry_t *e;
+
+   delta_drop(pathname);
+   e = (delta_entry_t *) calloc(1, sizeof(delta_entry_t));
+   if (e && num_holders)
+      e->holders = (node_peer_t *) malloc(num_holders * sizeof(node_peer_t));
+   if (!e || (num_holders && !e->holders)) {
+      err_printf("Could not allocate the base of %s, it will be sent whole\n", pathname);
+      free(e);
+      filemngt_unmap_staged_file(buffer, size);
+      return;
+   }
+   e->pathname = name;
+   e->base = buffer;
+   e->base_size = size;
+   if (num_holders)
+      memcpy(e->holders, holders, num_holders * sizeof(node_peer_t));
+   e->num_holders = num_holders;
+   e->next = delta_table[intern_name_hash(name) % DELTA_TABLE_SIZE];
+   delta_table[intern_name_hash(name) % DELTA_TABLE_SIZE] = e;
+   debug_printf2("Keeping %lu bytes of %s, which %d peers have, to send its next version against\n",
+                 (unsigned long) size, pathname, num_holders);
+}
+
+int delta_peer_has_base(const char *pathname, node_peer_t peer)
+{
+   delta_entry_t *e = find_entry(pathname, NULL);
+   int i;
+
+   if (!e)
+      return 0;
+   for (i = 0; i < e->num_holders; i++) {
+      if (e->holders[i] == peer || e->holders[i] == NODE_PEER_ALL)
+         return 1;
+   }
+   return 0;
+}
+
+static uint32_t get_base_crc(delta_entry_t *e)
+{
+   if (!e->have_crc) {
+      e->base_crc = crc32c(e->base, e->base_size);
+      e->have_crc = 1;
+   }
+   return e->base_crc;
+}
+
+static int put(delta_writer_t *w, const void *data, size_t len)
+{
+   char *newbuf;
+
+   if (w->used + len > w->max)
+      return -1;
+   if (w->used + len > w->size) {
+      w->size = w->used + len > w->size * 2 ? w->used + len : w->size * 2;
+      newbuf = (char *) realloc(w->buffer, w->size);
+      if (!newbuf)
+         return -1;
+      w->buffer = newbuf;
+   }
+   memcpy(w->buffer + w->used, data, len);
+   w->used += len;
+   return 0;
+}
+
+static int put_copy(delta_writer_t *w, size_t offset, size_t len)
+{
+   char op = DELTA_OP_COPY;
+   size_t last_offset, last_len;
+
+   /* Extend the last copy if this carries on from it */
+   if (w->last_copy) {
+      memcpy(&last_offset, w->buffer + w->last_copy + 1, sizeof(size_t));
+      memcpy(&last_len, w->buffer + w->last_copy + 1 + sizeof(size_t), sizeof(size_t));
+      if (last_offset + last_len == offset) {
+         last_len += len;
+         memcpy(w->buffer + w->last_copy + 1 + sizeof(size_t), &last_len, sizeof(size_t));
+         return 0;
+      }
+   }
+   w->last_copy = w->used;
+   if (put(w, &op, 1) == -1 || put(w, &offset, sizeof(offset)) == -1 || put(w, &len, sizeof(len)) == -1)
+      return -1;
+   return 0;
+}
+
+static int put_data(delta_writer_t *w, const void *data, size_t len)
+{
+   char op = DELTA_OP_DATA;
+
+   w->last_copy = 0;
+   if (put(w, &op, 1) == -1 || put(w, &len, sizeof(len)) == -1 || put(w, data, len) == -1)
+      return -1;
+   return 0;
+}
+
+/* rsync's checksum, which can be rolled along a byte at a time */
+static void block_sum(const unsigned char *p, uint32_t *a, uint32_t *b)
+{
+   uint32_t s1 = 0, s2 = 0;
+   size_t i;
+
+   for (i = 0; i < DELTA_BLOCK_SIZE; i++) {
+      s1 += p[i];
+      s2 += (DELTA_BLOCK_SIZE - i) * p[i];
+   }
+   *a = s1 & 0xffff;
+   *b = s2 & 0xffff;
+}
+
+static uint32_t sum_bucket(uint32_t sum, int bits)
+{
+   return (sum * 2654435761u) >> (32 - bits);
+}
+
+/**
+ * Encode buf, of size bytes, against base into w.  Returns -1 if the
+ * encoding outgrew w->max or we ran out of memory.
+ **/
+static int encode(delta_writer_t *w, const unsigned char *base, size_t base_size,
+                  const unsigned char *buf, size_t size)
+{
+   uint32_t *heads = NULL, *nexts = NULL, *sums = NULL, a = 0, b = 0, sum, j;
+   size_t num_blocks = base_size / DELTA_BLOCK_SIZE, pos = 0, lit = 0, expect = DELTA_NO_MATCH, match, i;
+   int bits = 1, rolling = 0, n, result = -1;
+
+   while (((size_t) 1 << bits) < num_blocks * 2)
+      bits++;
+   heads = (uint32_t *) calloc((size_t) 1 << bits, sizeof(uint32_t));
+   nexts = (uint32_t *) malloc((num_blocks + 1) * sizeof(uint32_t));
+   sums = (uint32_t *) malloc((num_blocks + 1) * sizeof(uint32_t));
+   if (!heads || !nexts || !sums)
+      goto done;
+   for (i = 0; i < num_blocks; i++) {
+      block_sum(base + i * DELTA_BLOCK_SIZE, &a, &b);
+      sums[i] = a | (b << 16);
+      nexts[i] = heads[sum_bucket(sums[i], bits)];
+      heads[sum_bucket(sums[i], bits)] = i + 1;
+   }
+
+   while (pos + DELTA_BLOCK_SIZE <= size) {
+      match = DELTA_NO_MATCH;
+      if (expect != DELTA_NO_MATCH && expect + DELTA_BLOCK_SIZE <= base_size &&
+          memcmp(buf + pos, base + expect, DELTA_BLOCK_SIZE) == 0) {
+         match = expect;
+      }
+      else {
+         if (!rolling) {
+            block_sum(buf + pos, &a, &b);
+            rolling = 1;
+         }
+         sum = a | (b << 16);
+         for (j = heads[sum_bucket(sum, bits)], n = 0; j && n < DELTA_MAX_CANDIDATES; j = nexts[j-1], n++) {
+            if (sums[j-1] == sum &&
+                memcmp(buf + pos, base + (size_t) (j-1) * DELTA_BLOCK_SIZE, DELTA_BLOCK_SIZE) == 0) {
+               match = (size_t) (j-1) * DELTA_BLOCK_SIZE;
+               break;
+            }
+         }
+      }
+
+      if (match != DELTA_NO_MATCH) {
+         if (pos > lit && put_data(w, buf + lit, pos - lit) == -1)
+            goto done;
+         if (put_copy(w, match, DELTA_BLOCK_SIZE) == -1)
+            goto done;
+         pos += DELTA_BLOCK_SIZE;
+         lit = pos;
+         expect = match + DELTA_BLOCK_SIZE;
+         rolling = 0;
+         continue;
+      }
+
+      /* Give up as soon as the new bytes alone are too many */
+      if (w->used + (pos - lit) > w->max)
+         goto done;
+      expect = DELTA_NO_MATCH;
+      if (pos + DELTA_BLOCK_SIZE < size) {
+         a = (a - buf[pos] + buf[pos + DELTA_BLOCK_SIZE]) & 0xffff;
+         b = (b - DELTA_BLOCK_SIZE * buf[pos] + a) & 0xffff;
+      }
+      pos++;
+   }
+   if (size > lit && put_data(w, buf + lit, size - lit) == -1)
+      goto done;
+   result = 0;
+
+  done:
+   free(heads);
+   free(nexts);
+   free(sums);
+   return result;
+}
+
+void *delta_get_encoded(const char *pathname, const void *buffer, size_t size, size_t *dsize)
+{
+   delta_entry_t *e = find_entry(pathname, NULL);
+   delta_writer_t w;
+   uint32_t base_crc, crc;
+   double starttime;
+
+   if (!e)
+      return NULL;
+   if (e->delta) {
+      *dsize = e->delta_size;
+      return e->delta;
+   }
+   if (!buffer || !e->base || e->tried || size < DELTA_MIN_SIZE)
+      return NULL;
+   e->tried = 1;
+
+   starttime = ldcs_get_time();
+   memset(&w, 0, sizeof(w));
+   w.max = (size / 8) * DELTA_MAX_EIGHTHS;
+   w.size = 64*1024;
+   w.buffer = (char *) malloc(w.size);
+   base_crc = get_base_crc(e);
+   crc = crc32c(buffer, size);
+   if (!w.buffer || put(&w, &e->base_size, sizeof(size_t)) == -1 ||
+       put(&w, &base_crc, sizeof(base_crc)) == -1 || put(&w, &crc, sizeof(crc)) == -1 ||
+       encode(&w, (const unsigned char *) e->base, e->base_size, (const unsigned char *) buffer, size) == -1) {
+      debug_printf2("%s changed too much to send as changes to its last version\n", pathname);
+      free(w.buffer);
+      release_base(e);
+      return NULL;
+   }
+   release_base(e);
+
+   debug_printf("Encoded %s as %lu bytes of changes to its last version, of %lu bytes, in %.3fs\n",
+                pathname, (unsigned long) w.used, (unsigned long) size, ldcs_get_time() - starttime);
+   e->delta = w.buffer;
+   e->delta_size = w.used;
+   *dsize = w.used;
+   return e->delta;
+}
+
+int delta_apply(const char *pathname, void *delta, size_t dsize, void *buffer, size_t size)
+{
+   delta_entry_t *e = find_entry(pathname, NULL);
+   const char *d = (const char *) delta;
+   size_t pos = DELTA_HEADER_SIZE, out = 0, base_size, offset, len;
+   uint32_t base_crc, crc;
+   int corrupt = 0;
+   char op;
+
+   if (!e || !e->base) {
+      err_printf("Got changes to %s, but have no last version of it to apply them to\n", pathname);
+      return -1;
+   }
+   if (dsize < DELTA_HEADER_SIZE) {
+      err_printf("Changes to %s are truncated\n", pathname);
+      return -1;
+   }
+   memcpy(&base_size, d, sizeof(base_size));
+   memcpy(&base_crc, d + sizeof(base_size), sizeof(base_crc));
+   memcpy(&crc, d + sizeof(base_size) + sizeof(base_crc), sizeof(crc));
+   if (base_size != e->base_size || base_crc != get_base_crc(e)) {
+      err_printf("Changes to %s are against a different last version than ours\n", pathname);
+      return -1;
+   }
+
+   while (pos < dsize) {
+      op = d[pos++];
+      if (op == DELTA_OP_COPY && pos + 2 * sizeof(size_t) <= dsize) {
+         memcpy(&offset, d + pos, sizeof(offset));
+         memcpy(&len, d + pos + sizeof(offset), sizeof(len));
+         pos += 2 * sizeof(size_t);
+         if (offset > base_size || len > base_size - offset || len > size - out) {
+            corrupt = 1;
+            break;
+         }
+         memcpy((char *) buffer + out, (char *) e->base + offset, len);
+      }
+      else if (op == DELTA_OP_DATA && pos + sizeof(size_t) <= dsize) {
+         memcpy(&len, d + pos, sizeof(len));
+         pos += sizeof(size_t);
+         if (len > dsize - pos || len > size - out) {
+            corrupt = 1;
+            break;
+         }
+         memcpy((char *) buffer + out, d + pos, len);
+         pos += len;
+      }
+      else {
+         corrupt = 1;
+         break;
+      }
+      out += len;
+   }
+   if (corrupt || out != size || crc32c(buffer, size) != crc) {
+      err_printf("Changes to %s are corrupt\n", pathname);
+      return -1;
+   }
+
+   release_base(e);
+   free(e->delta);
+   e->delta = delta;
+   e->delta_size = dsize;
+   return 0;
+}
+
+void delta_drop(const char *pathname)
+{
+   delta_entry_t *e, **prev;
+
+   e = find_entry(pathname, &prev);
+   if (!e)
+      return;
+   *prev = e->next;
+   free_entry(e);
+}
@@ -0,0 +1,65 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_DELTA_H_)
+#define LDCS_AUDIT_SERVER_DELTA_H_
+
+#include <sys/types.h>
+
+#include "ldcs_audit_server_md.h"
+
+/**
+ * With --delta-updates, a file that --revalidate found changed keeps its
+ * staged copy, unlinked but still mapped, as the base of its next version.
+ * The server sending the next version encodes it against the base, rsync
+ * style, as blocks to copy from the base and the bytes that are new, and
+ * sends that to the children it knows staged the base.  Each of them
+ * rebuilds the file from its own base and passes the same encoding on.
+ *
+ * An encoding is [size_t base_size][uint32_t base_crc][uint32_t crc]
+ * followed by ops, each a 'c' with a size_t offset into the base and a
+ * size_t length, or a 'd' with a size_t length and that many new bytes.
+ * The CRC32Cs of the base and of the rebuilt file are checked on each
+ * server.
+ **/
+
+#define DELTA_MIN_SIZE (1024*1024)    /* smaller files are sent whole */
+
+/* Keep buffer, pathname's staged copy of size bytes, as the base of its
+   next version.  holders are the peers we sent the copy to, which have it
+   too.  Takes over the mapping */
+void delta_keep_base(const char *pathname, void *buffer, size_t size,
+                     node_peer_t *holders, int num_holders);
+
+/* Returns 1 if peer has pathname's base, or 0 */
+int delta_peer_has_base(const char *pathname, node_peer_t peer);
+
+/* The encoding of the size bytes at buffer against pathname's base, made
+   once and kept until delta_drop.  buffer may be NULL to only look for an
+   encoding already made.  Returns NULL and leaves *dsize alone if there's
+   no base, or the encoding wouldn't be much smaller than the file */
+void *delta_get_encoded(const char *pathname, const void *buffer, size_t size, size_t *dsize);
+
+/* Rebuild pathname's new contents of size bytes into buffer from the
+   malloced encoding at delta and our base.  Returns 0 and keeps the
+   encoding for sending on, or -1 if we have no base or the encoding
+   doesn't match it */
+int delta_apply(const char *pathname, void *delta, size_t dsize, void *buffer, size_t size);
+
+/* Forget pathname's base and encoding */
+void delta_drop(const char *pathname);
+
+#endif
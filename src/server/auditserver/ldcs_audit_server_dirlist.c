@@ -0,0 +1,172 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_dirlist.h"
+#include "ldcs_cache.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * Built directories are kept by their interned pathnames, so a bucket is
+ * searched by comparing pointers.  A listing that couldn't be built is
+ * kept too, so the next process falls back without another try.
+ **/
+
+#define DIRLIST_TABLE_SIZE 1024
+
+typedef struct dirlist_t {
+   const char *dirname;
+   char *localdir;            /* NULL if the listing can't be served */
+   int errcode;
+   struct dirlist_t *next;
+} dirlist_t;
+
+typedef struct {
+   char *dir;
+   char *localdir;
+   int errcode;
+} dirlist_build_t;
+
+static dirlist_t *dirlist_table[DIRLIST_TABLE_SIZE];
+static int dirlist_state = 0;         /* 0 until set up, 1 if usable, -1 if not */
+static char dirlist_root[MAX_PATH_LEN+1];
+static unsigned long num_dirlists = 0;
+
+static int dirlist_setup(ldcs_process_data_t *procdata)
+{
+   if (dirlist_state)
+      return dirlist_state == 1 ? 0 : -1;
+   dirlist_state = -1;
+
+   snprintf(dirlist_root, sizeof(dirlist_root), "%s/dirs", procdata->location);
+   if (mkdir(dirlist_root, 0700) == -1 && errno != EEXIST) {
+      err_printf("Could not create %s, not serving directory listings: %s\n", dirlist_root, strerror(errno));
+      return -1;
+   }
+   dirlist_state = 1;
+   return 0;
+}
+
+static void dirlist_add_entry(char *filename, unsigned char d_type, char *localpath,
+                              size_t size, void *arg)
+{
+   dirlist_build_t *build = (dirlist_build_t *) arg;
+   char path[MAX_PATH_LEN+1], target[MAX_PATH_LEN+1];
+   int result;
+
+   if (build->errcode || strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
+      return;
+
+   snprintf(path, sizeof(path), "%s/%s", build->localdir, filename);
+   switch (d_type) {
+      case DT_REG:
+         result = open(path, O_CREAT | O_EXCL | O_WRONLY, 0600);
+         if (result != -1)
+            close(result);
+         break;
+      case DT_DIR:
+         result = mkdir(path, 0700);
+         break;
+      case DT_LNK:
+         /* Only the type is listed, but following the link should still lead somewhere */
+         snprintf(target, sizeof(target), "%s/%s", build->dir, filename);
+         result = symlink(target, path);
+         break;
+      default:
+         debug_printf2("Not serving the listing of %s, which doesn't give the type of %s\n",
+                       build->dir, filename);
+         build->errcode = ENOTSUP;
+         return;
+   }
+   if (result == -1) {
+      err_printf("Could not create %s for the listing of %s: %s\n", path, build->dir, strerror(errno));
+      build->errcode = EIO;
+   }
+}
+
+const char *dirlist_get(ldcs_process_data_t *procdata, char *dir, int *errcode)
+{
+   char localdir[MAX_PATH_LEN+1];
+   const char *name;
+   dirlist_t *dl;
+   dirlist_build_t build;
+   unsigned int bucket;
+   double starttime;
+
+   name = intern_name(dir);
+   bucket = intern_name_hash(name) % DIRLIST_TABLE_SIZE;
+   for (dl = dirlist_table[bucket]; dl; dl = dl->next) {
+      if (dl->dirname == name)
+         break;
+   }
+   if (dl) {
+      if (dl->localdir)
+         procdata->server_stat.dirlist.cnt++;
+      *errcode = dl->errcode;
+      return dl->localdir;
+   }
+
+   dl = (dirlist_t *) malloc(sizeof(dirlist_t));
+   if (!dl) {
+      err_printf("Could not allocate the listing record of %s\n", dir);
+      *errcode = ENOMEM;
+      return NULL;
+   }
+
+   starttime = ldcs_get_time();
+   build.dir = dir;
+   build.localdir = localdir;
+   build.errcode = 0;
+   if (ldcs_cache_isSparseDir(dir)) {
+      debug_printf2("Not serving the listing of sparse directory %s\n", dir);
+      build.errcode = ENOTSUP;
+   }
+   else if (dirlist_setup(procdata) == -1)
+      build.errcode = EIO;
+   else {
+      snprintf(localdir, sizeof(localdir), "%s/%lu", dirlist_root, num_dirlists++);
+      if (mkdir(localdir, 0700) == -1) {
+         err_printf("Could not create %s for the listing of %s: %s\n", localdir, dir, strerror(errno));
+         build.errcode = EIO;
+      }
+      else
+         ldcs_cache_foreachEntryInDir(dir, dirlist_add_entry, &build);
+   }
+
+   dl->dirname = name;
+   dl->localdir = build.errcode ? NULL : strdup(localdir);
+   dl->errcode = build.errcode;
+   dl->next = dirlist_table[bucket];
+   dirlist_table[bucket] = dl;
+
+   if (dl->localdir) {
+      debug_printf2("Built listing of %s in %s\n", dir, localdir);
+      procdata->server_stat.dirlist.cnt++;
+   }
+   procdata->server_stat.dirlist.time += (ldcs_get_time() - starttime);
+   *errcode = dl->errcode;
+   return dl->localdir;
+}
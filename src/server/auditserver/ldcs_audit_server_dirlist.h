@@ -0,0 +1,37 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_DIRLIST_H_)
+#define LDCS_AUDIT_SERVER_DIRLIST_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * With --serve-dirs, processes list the directories spindle relocates
+ * from the server's cache rather than from the shared file system.  The
+ * server builds a local directory with an entry of the same name and type
+ * for each one in the cached listing: an empty file, an empty directory or
+ * a link to the original.  The client opens that in place of the original,
+ * so readdir returns the listing, with d_type, without the server
+ * translating it into dirents.
+ **/
+
+/* Return the local directory listing dir, building it the first time, or
+   NULL with *errcode set if dir's listing can't be served.  dir's listing
+   must be in the cache. */
+const char *dirlist_get(ldcs_process_data_t *procdata, char *dir, int *errcode);
+
+#endif
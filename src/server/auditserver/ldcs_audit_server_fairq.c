@@ -0,0 +1,221 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+#include "ldcs_audit_server_process.h"
+#include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_latency.h"
+#include "ldcs_audit_server_fairq.h"
+
+/* Seconds for a client's busyness to fall by half */
+#define FAIRQ_HALF_LIFE 1.0
+
+typedef struct {
+   int queued;
+   ldcs_message_t msg;        /* a copy, whose data we free */
+   double arrival_time;
+   double busy;               /* server seconds spent on this client's messages, decayed */
+   double busy_time;          /* when busy was last decayed */
+   unsigned long waits;
+   double wait_total;
+   double wait_max;
+} fairq_client_t;
+
+static int enabled = 0;
+static fairq_client_t *clients = NULL;
+static int num_clients = 0;
+static int num_queued = 0;
+static int next_turn = 0;      /* goes first among clients that are equally busy */
+static int *order = NULL;
+static int order_size = 0;
+
+static int fairq_grow(int nc)
+{
+   fairq_client_t *newclients;
+   int newsize = nc + 64;
+
+   newclients = (fairq_client_t *) realloc(clients, newsize * sizeof(fairq_client_t));
+   if (!newclients) {
+      err_printf("Could not grow the client queue table to %d clients\n", newsize);
+      return -1;
+   }
+   memset(newclients + num_clients, 0, (newsize - num_clients) * sizeof(fairq_client_t));
+   clients = newclients;
+   num_clients = newsize;
+   return 0;
+}
+
+static void fairq_decay(fairq_client_t *fc, double now)
+{
+   if (now - fc->busy_time > 64 * FAIRQ_HALF_LIFE)
+      fc->busy = 0.0;
+   while (fc->busy > 0.0 && now - fc->busy_time >= FAIRQ_HALF_LIFE) {
+      fc->busy /= 2.0;
+      fc->busy_time += FAIRQ_HALF_LIFE;
+   }
+   if (fc->busy == 0.0)
+      fc->busy_time = now;
+}
+
+/**
+ * Handle client nc's queued message.
+ **/
+static int fairq_handle(ldcs_process_data_t *procdata, int nc)
+{
+   fairq_client_t *fc = clients + nc;
+   ldcs_message_t msg = fc->msg;
+   double starttime, wait;
+   int result, connid;
+
+   fc->queued = 0;
+   num_queued--;
+
+   starttime = ldcs_get_time();
+   wait = starttime - fc->arrival_time;
+   fc->waits++;
+   fc->wait_total += wait;
+   if (wait > fc->wait_max)
+      fc->wait_max = wait;
+   procdata->server_stat.fairq.cnt++;
+   procdata->server_stat.fairq.time += wait;
+   latency_record(LATENCY_CLIENT_QUEUE, fc->arrival_time, NULL);
+
+   connid = procdata->client_table[nc].connid;
+   procdata->client_table[nc].query_arrival_time = fc->arrival_time;
+   result = handle_client_message(procdata, nc, &msg);
+   debug_printf3("Finished handling client message on %d with return code %d\n", nc, result);
+   free(msg.data);
+
+   fairq_decay(fc, ldcs_get_time());
+   fc->busy += ldcs_get_time() - starttime;
+   procdata->server_stat.client_cb.time += ldcs_get_time() - starttime;
+
+   /* An error stops us listening to the client, as in the listen loop */
+   if (result == -1 && procdata->client_table[nc].state == LDCS_CLIENT_STATUS_ACTIVE &&
+       procdata->client_table[nc].connid == connid)
+      ldcs_listen_disable_fd(ldcs_get_fd(connid));
+   return result;
+}
+
+/**
+ * Listen loop flush callback.  Handles the messages read during the pass,
+ * least busy client first.
+ **/
+static int fairq_flush(void *data)
+{
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
+   double now;
+   int i, j, n = 0, nc;
+
+   if (!num_queued)
+      return 0;
+
+   if (order_size < num_clients) {
+      free(order);
+      order = (int *) malloc(num_clients * sizeof(int));
+      if (!order) {
+         err_printf("Could not allocate the client queue order\n");
+         order_size = 0;
+         return -1;
+      }
+      order_size = num_clients;
+   }
+
+   /* Insertion sort by busyness, which keeps the turn order among equals */
+   now = ldcs_get_time();
+   for (i = 0; i < num_clients; i++) {
+      nc = (next_turn + i) % num_clients;
+      if (!clients[nc].queued)
+         continue;
+      fairq_decay(clients + nc, now);
+      for (j = n; j > 0 && clients[order[j-1]].busy > clients[nc].busy; j--)
+         order[j] = order[j-1];
+      order[j] = nc;
+      n++;
+   }
+   next_turn = (order[0] + 1) % num_clients;
+
+   for (i = 0; i < n; i++) {
+      /* An earlier message may have ended this client */
+      if (clients[order[i]].queued)
+         fairq_handle(procdata, order[i]);
+   }
+   return 0;
+}
+
+int fairq_init(ldcs_process_data_t *procdata)
+{
+   if (ldcs_listen_register_flush_cb(fairq_flush, procdata) == -1)
+      return -1;
+   enabled = 1;
+   debug_printf2("Handling client messages least busy client first\n");
+   return 0;
+}
+
+int fairq_enabled()
+{
+   return enabled;
+}
+
+int fairq_push(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg, double arrival_time)
+{
+   fairq_client_t *fc;
+   int result = 0;
+
+   if (nc >= num_clients && fairq_grow(nc) == -1)
+      return -1;
+   fc = clients + nc;
+
+   /* Messages from one client are handled in order */
+   if (fc->queued)
+      result = fairq_handle(procdata, nc);
+
+   fc->msg = *msg;
+   fc->msg.data = NULL;
+   if (msg->data && msg->header.len) {
+      fc->msg.data = (char *) malloc(msg->header.len);
+      if (!fc->msg.data) {
+         err_printf("Could not queue a message from client %d\n", nc);
+         return -1;
+      }
+      memcpy(fc->msg.data, msg->data, msg->header.len);
+   }
+   fc->arrival_time = arrival_time;
+   fc->queued = 1;
+   num_queued++;
+   return result;
+}
+
+void fairq_client_end(ldcs_process_data_t *procdata, int nc)
+{
+   fairq_client_t *fc;
+
+   if (!enabled || nc >= num_clients)
+      return;
+   fc = clients + nc;
+   if (fc->waits)
+      debug_printf2("Client %d (local rank %d) waited %.6fs in the queue over %lu messages, %.6fs at most\n",
+                    nc, procdata->client_table[nc].lrank, fc->wait_total, fc->waits, fc->wait_max);
+   if (fc->queued) {
+      free(fc->msg.data);
+      num_queued--;
+   }
+   memset(fc, 0, sizeof(*fc));
+}
@@ -0,0 +1,53 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_FAIRQ_H_)
+#define LDCS_AUDIT_SERVER_FAIRQ_H_
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_process.h"
+
+/**
+ * Fair queuing of client messages, with OPT_FAIRCLIENTS.  Without it, the
+ * listen loop handles each client message as soon as it reads it, in
+ * whatever order epoll hands back the ready connections, so a quiet
+ * rank's cached lookup can wait behind a noisy rank's file read.  With
+ * it, the client callback only reads the message into the client's queue.
+ * At the end of the loop's pass, before anything held back for the
+ * network goes out, the queued messages are handled least busy client
+ * first, where a client's busyness is the server time its messages took,
+ * halved each second.  Clients that are equally busy take turns going
+ * first.
+ *
+ * A client gets at most one message handled per pass, as the callback
+ * reads one message per call.  Each message's wait in the queue goes in
+ * the client_queue latency histogram, and each client's total and worst
+ * wait are logged when it disconnects.
+ **/
+
+/* Start queuing client messages, flushed by a listen loop flush callback */
+int fairq_init(ldcs_process_data_t *procdata);
+
+/* True once fairq_init has been called */
+int fairq_enabled();
+
+/* Queue a copy of a message client nc sent, which arrived at arrival_time */
+int fairq_push(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg, double arrival_time);
+
+/* Drop whatever client nc had queued, and log its queue delays */
+void fairq_client_end(ldcs_process_data_t *procdata, int nc);
+
+#endif
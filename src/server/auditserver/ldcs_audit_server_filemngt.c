@@ -17,6 +17,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -28,14 +29,24 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <assert.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/xattr.h>
 #include <elf.h>
 
 #include "ldcs_api.h"
 #include "ldcs_cache.h"
 #include "ldcs_api_listen.h"
 #include "ldcs_audit_server_process.h"
+#include "ldcs_audit_server_pfsmeta.h"
 #include "ldcs_audit_server_filemngt.h"
+#include "ldcs_audit_server_statseg.h"
+#include "ldcs_statseg.h"
 #include "ldcs_elf_read.h"
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_audit_server_latency.h"
+#include "ldcs_audit_server_msgpool.h"
+#include "name_intern.h"
 #include "config.h"
 
 #if !defined(LIBEXECDIR)
@@ -44,8 +55,32 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 char *_ldcs_audit_server_tmpdir;
 static char *normalized_tmpdir;
+static char *persist_dir = NULL;
+static char *disk_dir = NULL;
+static char *normalized_disk_dir = NULL;
+static size_t disk_threshold;
+static int use_huge_pages;
+static char *shared_cache_dirs[3] = { NULL, NULL, NULL };
+static char *memfd_dir = NULL;
+static unsigned int memfd_number;
+
+/* Indexed by fd.  A memfd's staged name is the fd we keep it open through */
+typedef struct {
+   int writer;     /* for a staged fd, the fd its contents are written through until synced */
+   int staged;     /* for a writer, its staged fd */
+   char *alias;    /* for a staged fd, the name it would have had in the tmpdir */
+} memfd_slot_t;
+static memfd_slot_t *memfd_slots = NULL;
+static int num_memfd_slots = 0;
+
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+static volatile int fsop_cnt[FSOP_NUM];
+static volatile long fsop_bytes[FSOP_NUM];
 
 extern int spindle_mkdir(char *path);
+static int copy_local_file(char *srcname, char *dstname);
+static char *calc_localname(char *global_name, const char *dir);
 
 static char *filemngt_normalize_dir(char *dir) {
    char *newpath = realpath(dir, NULL);
@@ -65,6 +100,449 @@ int ldcs_audit_server_filemngt_init (char* location) {
    return(rc);
 }
 
+/**
+ * Stage files of threshold bytes or more in dir, on a node-local disk,
+ * rather than in the tmpdir.  Their space is allocated as they're
+ * created, so a full disk shows up then rather than as a SIGBUS when
+ * their contents are written through the mapping.
+ **/
+void filemngt_set_disk_location(char *dir, size_t threshold)
+{
+   if (spindle_mkdir(dir) == -1) {
+      err_printf("Could not create disk location %s, staging every file at %s\n", dir, _ldcs_audit_server_tmpdir);
+      return;
+   }
+   disk_dir = dir;
+   normalized_disk_dir = filemngt_normalize_dir(dir);
+   disk_threshold = threshold;
+}
+
+/**
+ * Map files of a huge page or more at huge page aligned addresses, and
+ * advise huge pages for them.  A tmpfs mounted with huge=advise or
+ * huge=within_size then stages them in 2 MB pages, which processes whose
+ * loader also maps them 2 MB aligned share through PMD entries.
+ **/
+void filemngt_set_huge_pages(int on)
+{
+   use_huge_pages = on;
+}
+
+/**
+ * Stage files in sealed memfds rather than in the tmpdir.  A file's
+ * memfd is written through one fd, then sealed against any change as
+ * it's synced, and kept open through a read-only fd.  Its local name is
+ * that fd under /proc/<our pid>/fd, which our clients' loaders open like
+ * any other file.  Nothing is left on the ramdisk to clean, and the
+ * processes that mapped a file can rely on it not changing.  Files big
+ * enough for the disk location still go there.
+ **/
+void filemngt_set_memfd(unsigned int number)
+{
+#if defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+   char dir[64];
+   struct rlimit rl;
+
+   snprintf(dir, sizeof(dir), "/proc/%d/fd", (int) getpid());
+   memfd_dir = strdup(dir);
+   memfd_number = number;
+
+   /* Every staged file holds one of our fds open */
+   if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+      rl.rlim_cur = rl.rlim_max;
+      if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+         debug_printf("Could not raise our fd limit for memfds: %s\n", strerror(errno));
+   }
+#else
+   err_printf("This build has no sealed memfds, staging files at %s\n", _ldcs_audit_server_tmpdir);
+#endif
+}
+
+static memfd_slot_t *memfd_slot(int fd)
+{
+   memfd_slot_t *newslots;
+   int newsize, i;
+
+   if (fd >= num_memfd_slots) {
+      newsize = num_memfd_slots ? num_memfd_slots : 64;
+      while (newsize <= fd)
+         newsize *= 2;
+      newslots = (memfd_slot_t *) realloc(memfd_slots, newsize * sizeof(memfd_slot_t));
+      if (!newslots)
+         return NULL;
+      for (i = num_memfd_slots; i < newsize; i++) {
+         newslots[i].writer = -1;
+         newslots[i].staged = -1;
+         newslots[i].alias = NULL;
+      }
+      memfd_slots = newslots;
+      num_memfd_slots = newsize;
+   }
+   return memfd_slots + fd;
+}
+
+/* The staged fd a local name stands for, or -1 if it isn't a memfd's */
+static int memfd_staged_fd(const char *localname)
+{
+   size_t len;
+   char *end;
+   long fd;
+
+   if (!memfd_dir)
+      return -1;
+   len = strlen(memfd_dir);
+   if (strncmp(memfd_dir, localname, len) != 0 || localname[len] != '/')
+      return -1;
+   fd = strtol(localname + len + 1, &end, 10);
+   if (*end || fd < 0 || fd >= num_memfd_slots || !memfd_slots[fd].alias)
+      return -1;
+   return (int) fd;
+}
+
+/* A writer is done with.  If it never got synced, its memfd is dropped */
+static void memfd_close_writer(int writer)
+{
+   int staged;
+
+   if (writer < num_memfd_slots && (staged = memfd_slots[writer].staged) != -1) {
+      memfd_slots[writer].staged = -1;
+      close(staged);
+      free(memfd_slots[staged].alias);
+      memfd_slots[staged].alias = NULL;
+   }
+   close(writer);
+}
+
+#if !defined(MFD_EXEC)
+#define MFD_EXEC 0x0010U
+#endif
+
+/**
+ * Create global_name's memfd and return its malloc'd local name.  The
+ * memfd is named for where the file would have been staged in the
+ * tmpdir, which is what /proc/self/exe and /proc/self/maps show for it,
+ * and that name is kept so clients can have it translated back to
+ * global_name.  Returns the tmpdir name if a memfd can't be made.
+ **/
+static char *memfd_localname(char *global_name)
+{
+#if defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+   char memfd_name[250], path[64], *alias, *newname;
+   int writer, staged;
+
+   alias = calc_localname(global_name, _ldcs_audit_server_tmpdir);
+   snprintf(memfd_name, sizeof(memfd_name), "spindle.%u:%s", memfd_number, strrchr(alias, '/') + 1);
+
+   /* MFD_EXEC keeps a vm.memfd_noexec default from stopping libraries being mapped */
+   writer = memfd_create(memfd_name, MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_EXEC);
+   if (writer == -1 && errno == EINVAL)
+      writer = memfd_create(memfd_name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+   if (writer == -1) {
+      debug_printf("Could not create a memfd for %s, staging it at %s: %s\n", global_name, alias, strerror(errno));
+      return alias;
+   }
+   snprintf(path, sizeof(path), "/proc/self/fd/%d", writer);
+   staged = open(path, O_RDONLY | O_CLOEXEC);
+   if (staged == -1 || !memfd_slot(staged > writer ? staged : writer)) {
+      debug_printf("Could not open a read-only fd on the memfd for %s, staging it at %s\n", global_name, alias);
+      if (staged != -1)
+         close(staged);
+      close(writer);
+      return alias;
+   }
+   memfd_slots[staged].writer = writer;
+   memfd_slots[staged].alias = alias;
+   memfd_slots[writer].staged = staged;
+
+   newname = (char *) malloc(strlen(memfd_dir) + 16);
+   sprintf(newname, "%s/%d", memfd_dir, staged);
+   return newname;
+#else
+   return calc_localname(global_name, _ldcs_audit_server_tmpdir);
+#endif
+}
+
+/**
+ * The name a memfd staged file would have had in the tmpdir, or NULL if
+ * localname isn't a memfd's.  It's owned by filemngt.
+ **/
+char *filemngt_memfd_alias(char *localname)
+{
+   int staged = memfd_staged_fd(localname);
+   return staged == -1 ? NULL : memfd_slots[staged].alias;
+}
+
+/**
+ * Share staged files with other jobs on this node through dir.  Each
+ * file we read from the shared file system is hard linked there under
+ * its identity on that file system, and files whose identity is already
+ * there are staged as links to it rather than read again.  link() either
+ * makes the whole entry or fails, so servers of concurrent jobs don't
+ * need to coordinate.
+ **/
+void filemngt_set_shared_cache(char *dir)
+{
+   if (spindle_mkdir(dir) == -1) {
+      err_printf("Could not create shared cache %s, not sharing files with other jobs\n", dir);
+      return;
+   }
+   shared_cache_dirs[SHARED_CACHE_NODE] = dir;
+}
+
+/**
+ * Keep copies of the files we read in dir, on a burst buffer or other
+ * file system every node sees, for servers of later jobs that haven't
+ * got them in their node's shared cache.  Entries are written under a
+ * temporary name and renamed into place, so they're never seen partly
+ * written.
+ **/
+void filemngt_set_cluster_cache(char *dir)
+{
+   if (spindle_mkdir(dir) == -1) {
+      err_printf("Could not create cluster cache %s, not using it\n", dir);
+      return;
+   }
+   shared_cache_dirs[SHARED_CACHE_CLUSTER] = dir;
+}
+
+/**
+ * Keep copies of the files that reach this server, a rack leader, in dir
+ * on its local disk, for the servers of its rack in this and later jobs.
+ * Entries are written as in the cluster cache.
+ **/
+void filemngt_set_rack_cache(char *dir)
+{
+   if (spindle_mkdir(dir) == -1) {
+      err_printf("Could not create rack cache %s, not using it\n", dir);
+      return;
+   }
+   shared_cache_dirs[SHARED_CACHE_RACK] = dir;
+}
+
+/**
+ * stat pathname, unless --pfs-metadata already stat'd it ahead.
+ **/
+static int filemngt_stat_path(char *pathname, struct stat *buf)
+{
+   int result;
+
+   if (pfsmeta_lookup(pathname, buf, &result))
+      return result;
+   filemngt_count_fsop(FSOP_STAT, 0);
+   return stat(pathname, buf);
+}
+
+/**
+ * The name pathname's current contents have in the shared caches: a hash
+ * of its path, and its inode, size and modification time, so a file that
+ * was replaced or rewritten gets a new entry.  The device number isn't
+ * used, as it needn't be the same on every node.  Stripped and unstripped
+ * copies differ.  Returns a malloc'd name, or NULL if there are no shared
+ * caches or pathname can't be stat'd.
+ **/
+char *filemngt_shared_cache_key(char *pathname, int strip)
+{
+   struct stat st;
+   char key[MAX_NAME_LEN+1];
+   unsigned long long hash = 14695981039346656037ULL;
+   const char *c;
+
+   if (!shared_cache_dirs[SHARED_CACHE_NODE] && !shared_cache_dirs[SHARED_CACHE_CLUSTER] &&
+       !shared_cache_dirs[SHARED_CACHE_RACK])
+      return NULL;
+   if (filemngt_stat_path(pathname, &st) == -1 || !S_ISREG(st.st_mode))
+      return NULL;
+   for (c = pathname; *c; c++)
+      hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+   snprintf(key, sizeof(key), "%016llx-%lx-%lx-%lx.%lx%s", hash,
+            (unsigned long) st.st_ino, (unsigned long) st.st_size,
+            (unsigned long) st.st_mtim.tv_sec, (unsigned long) st.st_mtim.tv_nsec, strip ? "-s" : "");
+   return strdup(key);
+}
+
+/**
+ * Returns the malloc'd path and the size of key's entry in the given
+ * shared cache, or NULL if it isn't there.
+ **/
+char *filemngt_shared_cache_find(int tier, char *key, size_t *size)
+{
+   char path[MAX_PATH_LEN+1];
+   struct stat st;
+
+   if (!shared_cache_dirs[tier])
+      return NULL;
+   snprintf(path, sizeof(path), "%s/%s", shared_cache_dirs[tier], key);
+   if (stat(path, &st) == -1)
+      return NULL;
+   *size = (size_t) st.st_size;
+   return strdup(path);
+}
+
+/**
+ * Add the staged file localname to the given shared cache under key.  The
+ * node's cache gets a hard link, the cluster's and the rack's a copy.
+ * Another server may have added it first, which is just as good.
+ **/
+void filemngt_shared_cache_publish(int tier, char *localname, char *key)
+{
+   char path[MAX_PATH_LEN+1], tmppath[MAX_PATH_LEN+1], host[64];
+   struct stat st;
+   int result;
+
+   if (!shared_cache_dirs[tier])
+      return;
+   snprintf(path, sizeof(path), "%s/%s", shared_cache_dirs[tier], key);
+
+   if (tier == SHARED_CACHE_NODE) {
+      if (link(localname, path) == 0)
+         debug_printf3("Added %s to the shared cache as %s\n", localname, path);
+      else if (errno != EEXIST)
+         debug_printf2("Could not add %s to the shared cache as %s: %s\n", localname, path, strerror(errno));
+      return;
+   }
+
+   if (stat(path, &st) == 0)
+      return;
+   host[sizeof(host)-1] = '\0';
+   if (gethostname(host, sizeof(host)-1) == -1)
+      strcpy(host, "host");
+   result = snprintf(tmppath, sizeof(tmppath), "%s.%s.%d.tmp", path, host, (int) getpid());
+   if (result < 0 || result >= (int) sizeof(tmppath)) {
+      debug_printf2("Not adding %s to the %s cache, since %s is too long to copy to\n", localname,
+                    tier == SHARED_CACHE_RACK ? "rack" : "cluster", path);
+      return;
+   }
+   if (copy_local_file(localname, tmppath) == -1)
+      return;
+   if (rename(tmppath, path) == -1) {
+      err_printf("Could not rename %s to %s: %s\n", tmppath, path, strerror(errno));
+      unlink(tmppath);
+      return;
+   }
+   debug_printf3("Added %s to the %s cache as %s\n", localname,
+                 tier == SHARED_CACHE_RACK ? "rack" : "cluster", path);
+}
+
+/**
+ * The keys of the files we staged from the shared file system or got from
+ * our parent, by interned pathname.  They're sent on with the files, so
+ * servers that get a file over the tree can find it in, and add it to,
+ * their shared caches without stat'ing it on the shared file system.
+ **/
+#define SHARED_KEY_TABLE_SIZE 4096
+
+typedef struct shared_key_t {
+   const char *pathname;
+   char *key;
+   struct shared_key_t *next;
+} shared_key_t;
+
+static shared_key_t *shared_key_table[SHARED_KEY_TABLE_SIZE];
+
+void filemngt_shared_cache_remember(char *pathname, char *key)
+{
+   const char *name;
+   shared_key_t *sk;
+   unsigned int bucket;
+   char *newkey;
+
+   newkey = strdup(key);
+   if (!newkey)
+      return;
+   name = intern_name(pathname);
+   bucket = intern_name_hash(name) % SHARED_KEY_TABLE_SIZE;
+   for (sk = shared_key_table[bucket]; sk; sk = sk->next) {
+      if (sk->pathname == name) {
+         free(sk->key);
+         sk->key = newkey;
+         return;
+      }
+   }
+
+   sk = (shared_key_t *) malloc(sizeof(shared_key_t));
+   if (!sk) {
+      free(newkey);
+      return;
+   }
+   sk->pathname = name;
+   sk->key = newkey;
+   sk->next = shared_key_table[bucket];
+   shared_key_table[bucket] = sk;
+}
+
+void filemngt_shared_cache_forget(char *pathname)
+{
+   const char *name;
+   shared_key_t **prev, *sk;
+
+   name = lookup_intern_name(pathname);
+   if (!name)
+      return;
+   for (prev = shared_key_table + intern_name_hash(name) % SHARED_KEY_TABLE_SIZE; *prev; prev = &(*prev)->next) {
+      if ((*prev)->pathname == name) {
+         sk = *prev;
+         *prev = sk->next;
+         free(sk->key);
+         free(sk);
+         return;
+      }
+   }
+}
+
+char *filemngt_shared_cache_known(char *pathname)
+{
+   const char *name;
+   shared_key_t *sk;
+
+   name = lookup_intern_name(pathname);
+   if (!name)
+      return NULL;
+   for (sk = shared_key_table[intern_name_hash(name) % SHARED_KEY_TABLE_SIZE]; sk; sk = sk->next) {
+      if (sk->pathname == name)
+         return sk->key;
+   }
+   return NULL;
+}
+
+static void *map_file_space(size_t size, int prot, int fd)
+{
+   char *reserve, *aligned, *end, *reserve_end;
+   size_t reserve_size;
+
+   if (!use_huge_pages || size < HUGE_PAGE_SIZE)
+      return mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+
+   /* Reserve a huge page more than we need, and map the file over its aligned part */
+   reserve_size = size + HUGE_PAGE_SIZE;
+   reserve = mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (reserve == MAP_FAILED)
+      return mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+   aligned = (char *) (((uintptr_t) reserve + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+   if (mmap(aligned, size, prot, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+      munmap(reserve, reserve_size);
+      return mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+   }
+   end = aligned + ((size + getpagesize() - 1) & ~((size_t) getpagesize() - 1));
+   reserve_end = reserve + reserve_size;
+   if (aligned > reserve)
+      munmap(reserve, aligned - reserve);
+   if (reserve_end > end)
+      munmap(end, reserve_end - end);
+
+   madvise(aligned, size, MADV_HUGEPAGE);
+   return aligned;
+}
+
+static int is_disk_file(const char *filename)
+{
+   size_t len;
+
+   if (!disk_dir)
+      return 0;
+   len = strlen(disk_dir);
+   return strncmp(disk_dir, filename, len) == 0 && filename[len] == '/';
+}
+
 /* Returns NULL if not a local file. Otherwise, returns pointer to file portion of string */
 char* ldcs_is_a_localfile (char* filename) {
   int len = strlen(_ldcs_audit_server_tmpdir);
@@ -77,10 +555,27 @@ char* ldcs_is_a_localfile (char* filename) {
      return filename + len + 1;
   if ( strncmp(normalized_tmpdir, filename, norm_len) == 0 )
      return filename + norm_len + 1;
+  if ( persist_dir && strncmp(persist_dir, filename, strlen(persist_dir)) == 0 )
+     return filename + strlen(persist_dir) + 1;
+  if ( disk_dir && strncmp(disk_dir, filename, strlen(disk_dir)) == 0 )
+     return filename + strlen(disk_dir) + 1;
+  if ( normalized_disk_dir && strncmp(normalized_disk_dir, filename, strlen(normalized_disk_dir)) == 0 )
+     return filename + strlen(normalized_disk_dir) + 1;
+  if ( memfd_dir && strncmp(memfd_dir, filename, strlen(memfd_dir)) == 0 && filename[strlen(memfd_dir)] == '/' )
+     return filename + strlen(memfd_dir) + 1;
   return NULL;
 }
 
-char *filemngt_calc_localname(char *global_name)
+/**
+ * Files kept across server runs by the cache index live in dir, outside
+ * the cleaned location.  Treat them as local files too.
+ **/
+void filemngt_set_persist_dir(char *dir)
+{
+   persist_dir = dir;
+}
+
+static char *calc_localname(char *global_name, const char *dir)
 {
    static unsigned int unique_str_num = 0;
    char target[MAX_NAME_LEN+1];
@@ -109,41 +604,204 @@ char *filemngt_calc_localname(char *global_name)
          *s = '_';
    }
 
-   newname_size = strlen(target) + strlen(_ldcs_audit_server_tmpdir) + 2;
+   newname_size = strlen(target) + strlen(dir) + 2;
    newname = (char *) malloc(newname_size);
-   snprintf(newname, newname_size, "%s/%s", _ldcs_audit_server_tmpdir, target);
+   snprintf(newname, newname_size, "%s/%s", dir, target);
 
    return newname;
 }
 
+char *filemngt_calc_localname(char *global_name)
+{
+   return calc_localname(global_name, _ldcs_audit_server_tmpdir);
+}
+
+/* The local name for staging a file of size bytes, on the disk location if it's big enough */
+char *filemngt_calc_file_localname(char *global_name, size_t size)
+{
+   if (disk_dir && size >= disk_threshold)
+      return calc_localname(global_name, disk_dir);
+   if (memfd_dir)
+      return memfd_localname(global_name);
+   return calc_localname(global_name, _ldcs_audit_server_tmpdir);
+}
+
 int filemngt_read_file(char *filename, void *buffer, size_t *size, int strip, int *errcode)
 {
-   FILE *f;
+   int fd, direct_fd;
    int result = 0;
+   double starttime = ldcs_get_time();
 
    debug_printf2("Reading file %s from disk\n", filename);
-   f = fopen(filename, "r");
-   if (!f) {
+   fd = open(filename, O_RDONLY);
+   filemngt_count_fsop(FSOP_OPEN, 0);
+   if (fd == -1) {
       *errcode = errno;
       debug_printf2("Could not read file %s from disk, errcode = %d\n", filename, *errcode);
       return 0;
    }
+   direct_fd = readpool_open_direct(filename);
+   if (direct_fd != -1)
+      filemngt_count_fsop(FSOP_OPEN, 0);
 
-   result = read_file_and_strip(f, buffer, size, strip);
+   result = read_file_and_strip(fd, direct_fd, buffer, size, strip);
    if (result == -1)
       err_printf("Error reading from file %s: %s\n", filename, strerror(errno));
+   filemngt_count_fsop(FSOP_READ, result == -1 ? 0 : *size);
 
-   fclose(f);
+   if (direct_fd != -1)
+      close(direct_fd);
+   close(fd);
+   latency_record(LATENCY_DISK_READ, starttime, filename);
    return result;
 }
 
+/**
+ * Read len bytes at offset of filename into buffer, for a server reading
+ * one stripe of a file.  Like filemngt_read_file, a file we can't open
+ * sets *errcode and isn't an error.
+ **/
+int filemngt_read_range(char *filename, void *buffer, size_t offset, size_t len, int *errcode)
+{
+   int fd;
+   ssize_t result;
+   size_t pos = 0;
+   double starttime = ldcs_get_time();
+
+   debug_printf2("Reading %lu bytes at %lu of %s from disk\n", (unsigned long) len,
+                 (unsigned long) offset, filename);
+   fd = open(filename, O_RDONLY);
+   filemngt_count_fsop(FSOP_OPEN, 0);
+   if (fd == -1) {
+      *errcode = errno;
+      return 0;
+   }
+
+   while (pos < len) {
+      result = pread(fd, ((char *) buffer) + pos, len - pos, offset + pos);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0) {
+         err_printf("Error reading %lu bytes at %lu of %s: %s\n", (unsigned long) (len - pos),
+                    (unsigned long) (offset + pos), filename, result == 0 ? "short file" : strerror(errno));
+         close(fd);
+         return -1;
+      }
+      pos += result;
+   }
+   filemngt_count_fsop(FSOP_READ, len);
+   close(fd);
+   latency_record(LATENCY_DISK_READ, starttime, filename);
+   return 0;
+}
+
+/* Lustre's lov_user_md_v1 and v3 both start with these fields */
+#define LOV_USER_MAGIC_V1 0x0BD10BD0
+#define LOV_USER_MAGIC_V3 0x0BD30BD0
+#define LOV_STRIPE_SIZE_OFFSET 24
+
+/**
+ * The stripe size of a file on Lustre, from its lustre.lov xattr, or 0 if
+ * the file isn't on Lustre or has a composite layout.
+ **/
+size_t filemngt_stripe_size(char *filename)
+{
+   unsigned char *lov;
+   uint32_t magic, stripe_size = 0;
+   ssize_t len;
+
+   /* The layout lists every stripe's object, so ask how long it is first */
+   len = getxattr(filename, "lustre.lov", NULL, 0);
+   if (len < LOV_STRIPE_SIZE_OFFSET + (ssize_t) sizeof(stripe_size))
+      return 0;
+   lov = (unsigned char *) malloc(len);
+   if (!lov)
+      return 0;
+   len = getxattr(filename, "lustre.lov", lov, len);
+   if (len >= LOV_STRIPE_SIZE_OFFSET + (ssize_t) sizeof(stripe_size)) {
+      memcpy(&magic, lov, sizeof(magic));
+      if (magic == LOV_USER_MAGIC_V1 || magic == LOV_USER_MAGIC_V3)
+         memcpy(&stripe_size, lov + LOV_STRIPE_SIZE_OFFSET, sizeof(stripe_size));
+   }
+   free(lov);
+   return stripe_size;
+}
+
+static void read_file_job(void *arg)
+{
+   filemngt_read_t *read = (filemngt_read_t *) arg;
+   read->result = filemngt_read_file(read->filename, read->buffer, &read->size, read->strip, &read->errcode);
+   if (read->transform && read->result != -1 && !read->errcode)
+      transform_run(read->transform, read->buffer, read->size);
+}
+
+/**
+ * Read a batch of files concurrently with the read pool.  Each entry's
+ * result and errcode are set as filemngt_read_file would set them.
+ * Returns -1 if any read failed.
+ **/
+int filemngt_read_files(filemngt_read_t *reads, int num_reads)
+{
+   void **args;
+   int i, global_result = 0;
+
+   if (!num_reads)
+      return 0;
+   args = (void **) malloc(sizeof(void *) * num_reads);
+   assert(args);
+   for (i = 0; i < num_reads; i++)
+      args[i] = reads + i;
+
+   debug_printf2("Reading %d files from disk concurrently\n", num_reads);
+   readpool_run(read_file_job, args, num_reads);
+
+   for (i = 0; i < num_reads; i++) {
+      if (reads[i].result == -1)
+         global_result = -1;
+   }
+   free(args);
+   return global_result;
+}
+
+/**
+ * Start reading one file on the read pool, for a caller that streams
+ * through a list of files and wants the next reads in flight while it
+ * handles the last one.  filemngt_wait_read waits for the read and
+ * returns its result.
+ **/
+void filemngt_start_read(filemngt_read_t *read)
+{
+   read->pending = 0;
+   readpool_start(read_file_job, read, &read->pending);
+}
+
+int filemngt_wait_read(filemngt_read_t *read)
+{
+   readpool_wait(&read->pending);
+   return read->result;
+}
+
+/**
+ * File packets are [int filename_len][size_t payload_size][size_t raw_size]
+ * [int encoding][uint32_t crc][int key_len][filename][key][payload].  The
+ * payload is the file contents, or with FILE_ENCODING_LZ those contents
+ * compressed down from raw_size, or with FILE_ENCODING_DELTA their changes
+ * from the file's last version, or with FILE_ENCODING_SPARSE their data
+ * extents.  crc is the CRC32C of the raw contents with OPT_VERIFY, else 0.
+ * key is the file's shared cache key, or empty if sharedkey is NULL.
+ * Only the part before the payload is put in *buffer, which is freed with
+ * msgpool_free; *buffer_size counts the payload too.
+ **/
 int filemngt_encode_packet(char *filename, void *filecontents, size_t filesize, 
+                           size_t raw_size, int encoding, uint32_t crc, char *sharedkey,
                            char **buffer, size_t *buffer_size)
 {
    int cur_pos = 0;
    int filename_len = strlen(filename) + 1;
-   *buffer_size = filename_len + sizeof(filename_len) + sizeof(filesize) + filesize;
-   *buffer = (char *) malloc(*buffer_size);
+   int key_len = sharedkey ? strlen(sharedkey) + 1 : 0;
+   *buffer_size = filename_len + sizeof(filename_len) + sizeof(filesize) + sizeof(raw_size) +
+      sizeof(encoding) + sizeof(crc) + sizeof(key_len) + key_len + filesize;
+   *buffer = (char *) msgpool_alloc(*buffer_size - filesize);
    if (!*buffer) {
       err_printf("Failed to allocate memory for file contents packet for %s\n", filename);
       return -1;
@@ -155,9 +813,26 @@ int filemngt_encode_packet(char *filename, void *filecontents, size_t filesize,
    memcpy(*buffer + cur_pos, &filesize, sizeof(filesize));
    cur_pos += sizeof(filesize);
 
+   memcpy(*buffer + cur_pos, &raw_size, sizeof(raw_size));
+   cur_pos += sizeof(raw_size);
+
+   memcpy(*buffer + cur_pos, &encoding, sizeof(encoding));
+   cur_pos += sizeof(encoding);
+
+   memcpy(*buffer + cur_pos, &crc, sizeof(crc));
+   cur_pos += sizeof(crc);
+
+   memcpy(*buffer + cur_pos, &key_len, sizeof(key_len));
+   cur_pos += sizeof(key_len);
+
    memcpy(*buffer + cur_pos, filename, filename_len);
    cur_pos += filename_len;
 
+   if (key_len) {
+      memcpy(*buffer + cur_pos, sharedkey, key_len);
+      cur_pos += key_len;
+   }
+
    /* Explicitely removing the memcpy that puts the file contents into the
       packet.  In order to keep file contents zero-copy we won't add them
       to the packet, but will instead send them with a second write command.
@@ -169,74 +844,332 @@ int filemngt_encode_packet(char *filename, void *filecontents, size_t filesize,
    return 0;
 }
 
-int filemngt_decode_packet(node_peer_t peer, ldcs_message_t *msg, char *filename, size_t *filesize)
+/* sharedkey has room for MAX_NAME_LEN+1 bytes, and is set empty if the
+   packet has no key */
+int filemngt_decode_packet(node_peer_t peer, ldcs_message_t *msg, char *filename, size_t *filesize,
+                           size_t *raw_size, int *encoding, uint32_t *crc, char *sharedkey)
 {
    /* We've delayed the file read from the network.  Just read the filename and size here.
       We'll later get the file contents latter by reading directly to mapped memory */
-   int filename_len = 0;
+   int filename_len = 0, key_len = 0;
+   size_t header_len;
    int result;
+
+   header_len = sizeof(filename_len) + sizeof(*filesize) + sizeof(*raw_size) + sizeof(*encoding) +
+      sizeof(*crc) + sizeof(key_len);
+   if (msg->header.len < (int64_t) header_len) {
+      err_printf("File packet of %ld bytes is too short for its header\n", (long) msg->header.len);
+      return -1;
+   }
    
    result = ldcs_audit_server_md_complete_msg_read(peer, msg, &filename_len, sizeof(filename_len));
    if (result == -1)
       return -1;
-   assert(filename_len > 0 && filename_len <= MAX_PATH_LEN+1);
+   if (filename_len <= 0 || filename_len > MAX_PATH_LEN+1) {
+      err_printf("File packet has a filename of %d bytes\n", filename_len);
+      return -1;
+   }
 
    result = ldcs_audit_server_md_complete_msg_read(peer, msg, filesize, sizeof(*filesize));
    if (result == -1)
       return -1;
 
+   result = ldcs_audit_server_md_complete_msg_read(peer, msg, raw_size, sizeof(*raw_size));
+   if (result == -1)
+      return -1;
+
+   result = ldcs_audit_server_md_complete_msg_read(peer, msg, encoding, sizeof(*encoding));
+   if (result == -1)
+      return -1;
+   if (*encoding != FILE_ENCODING_RAW && *encoding != FILE_ENCODING_LZ && *encoding != FILE_ENCODING_DELTA &&
+       *encoding != FILE_ENCODING_SPARSE) {
+      err_printf("File packet has unknown encoding %d\n", *encoding);
+      return -1;
+   }
+
+   result = ldcs_audit_server_md_complete_msg_read(peer, msg, crc, sizeof(*crc));
+   if (result == -1)
+      return -1;
+
+   result = ldcs_audit_server_md_complete_msg_read(peer, msg, &key_len, sizeof(key_len));
+   if (result == -1)
+      return -1;
+   if (key_len < 0 || key_len > MAX_NAME_LEN+1) {
+      err_printf("File packet has a shared cache key of %d bytes\n", key_len);
+      return -1;
+   }
+
+   /* The payload is read into a buffer of raw_size, and is all that's left
+      of the message after the header */
+   if (*encoding == FILE_ENCODING_RAW && *filesize != *raw_size) {
+      err_printf("File packet has %lu bytes of contents for a file of %lu bytes\n",
+                 (unsigned long) *filesize, (unsigned long) *raw_size);
+      return -1;
+   }
+   header_len += filename_len + key_len;
+   if (msg->header.len < (int64_t) header_len || *filesize != (size_t) (msg->header.len - header_len)) {
+      err_printf("File packet of %ld bytes has a header of %lu bytes and %lu bytes of contents\n",
+                 (long) msg->header.len, (unsigned long) header_len, (unsigned long) *filesize);
+      return -1;
+   }
+
    result = ldcs_audit_server_md_complete_msg_read(peer, msg, filename, filename_len);
    if (result == -1)
       return -1;
+   filename[filename_len-1] = '\0';
+
+   sharedkey[0] = '\0';
+   if (key_len) {
+      result = ldcs_audit_server_md_complete_msg_read(peer, msg, sharedkey, key_len);
+      if (result == -1)
+         return -1;
+      sharedkey[key_len-1] = '\0';
+   }
 
    return 0;
 }
 
 /**
- * Clear files from the local ramdisk
+ * The data extents of the size bytes at buffer, the staged copy of a file
+ * at localname, as FILE_ENCODING_SPARSE.  Returns a malloced encoding of
+ * *esize bytes, or NULL to send the file whole if its holes are too small
+ * or its file system can't find them.
  **/
-int ldcs_audit_server_filemngt_clean()
+void *filemngt_sparse_encode(char *localname, void *buffer, size_t size, size_t *esize)
+{
+   char *encoded = NULL;
+   size_t num_extents = 0, data_bytes = 0, counted = 0, table, pos, extent[2];
+   off_t data, hole = 0;
+   int fd, pass;
+
+   if (size < SPARSE_MIN_HOLES)
+      return NULL;
+   fd = open(localname, O_RDONLY);
+   if (fd == -1)
+      return NULL;
+
+   /* The first pass counts the extents, the second copies them */
+   for (pass = 0; pass < 2; pass++) {
+      counted = num_extents;
+      num_extents = 0;
+      data_bytes = 0;
+      table = sizeof(size_t);
+      pos = table + counted * 2 * sizeof(size_t);
+      for (data = lseek(fd, 0, SEEK_DATA); data != (off_t) -1 && (size_t) data < size;
+           data = lseek(fd, hole, SEEK_DATA)) {
+         hole = lseek(fd, data, SEEK_HOLE);
+         if (hole == (off_t) -1 || (size_t) hole > size)
+            hole = size;
+         if (encoded) {
+            /* Staged files don't change, but don't overrun if one did */
+            if (num_extents == counted || pos + (hole - data) > *esize) {
+               num_extents = counted + 1;
+               break;
+            }
+            extent[0] = data;
+            extent[1] = hole - data;
+            memcpy(encoded + table, extent, sizeof(extent));
+            table += sizeof(extent);
+            memcpy(encoded + pos, ((char *) buffer) + data, hole - data);
+            pos += hole - data;
+         }
+         num_extents++;
+         data_bytes += hole - data;
+      }
+      if (data == (off_t) -1 && errno != ENXIO) {
+         debug_printf3("Could not find the holes in %s: %s\n", localname, strerror(errno));
+         break;
+      }
+      if (encoded) {
+         if (num_extents != counted || pos != *esize)
+            break;
+         memcpy(encoded, &num_extents, sizeof(size_t));
+         close(fd);
+         return encoded;
+      }
+      if (size - data_bytes < SPARSE_MIN_HOLES)
+         break;
+      *esize = sizeof(size_t) + num_extents * 2 * sizeof(size_t) + data_bytes;
+      encoded = (char *) malloc(*esize);
+      if (!encoded)
+         break;
+   }
+
+   if (encoded)
+      free(encoded);
+   close(fd);
+   return NULL;
+}
+
+static void punch_hole(int fd, size_t offset, size_t len)
 {
+#if defined(FALLOC_FL_PUNCH_HOLE)
+   if (fd == -1 || !len)
+      return;
+   if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == -1)
+      debug_printf3("Could not punch a hole of %lu bytes at %lu: %s\n", (unsigned long) len,
+                    (unsigned long) offset, strerror(errno));
+#endif
+}
+
+/**
+ * Write the data extents of a FILE_ENCODING_SPARSE encoding into buffer,
+ * the size bytes of a new staged file, leaving its holes untouched.  A
+ * new file on tmpfs has no pages there, and the blocks a file staged on
+ * disk was allocated there are punched out of fd, if it isn't -1.
+ * Returns -1 if the encoding is corrupt.
+ **/
+int filemngt_sparse_decode(void *encoded, size_t esize, void *buffer, size_t size, int fd)
+{
+   char *e = (char *) encoded;
+   size_t num_extents, i, offset, len, table, pos, end = 0;
+
+   if (esize < sizeof(size_t))
+      return -1;
+   memcpy(&num_extents, e, sizeof(size_t));
+   table = sizeof(size_t);
+   if (num_extents > (esize - table) / (2 * sizeof(size_t)))
+      return -1;
+   pos = table + num_extents * 2 * sizeof(size_t);
+
+   for (i = 0; i < num_extents; i++) {
+      memcpy(&offset, e + table, sizeof(size_t));
+      table += sizeof(size_t);
+      memcpy(&len, e + table, sizeof(size_t));
+      table += sizeof(size_t);
+      if (offset < end || offset > size || len > size - offset || len > esize - pos)
+         return -1;
+      punch_hole(fd, end, offset - end);
+      memcpy(((char *) buffer) + offset, e + pos, len);
+      pos += len;
+      end = offset + len;
+   }
+   punch_hole(fd, end, size - end);
+   return (pos == esize) ? 0 : -1;
+}
+
 #if !defined(USE_CLEANUP_PROC)
+/**
+ * Unlink the staged files in dir, and the directories and links that
+ * serve listings, then remove it if that emptied it.
+ **/
+static int clean_dir(const char *dir)
+{
    DIR *tmpdir;
    struct dirent *dp;
-   char path[MAX_PATH_LEN];
    struct stat finfo;
-   int result;
+   char subdir[MAX_PATH_LEN+1];
+   int dfd, type;
 
-   debug_printf("Cleaning tmpdir %s\n", _ldcs_audit_server_tmpdir);
-
-   tmpdir = opendir(_ldcs_audit_server_tmpdir);
+   tmpdir = opendir(dir);
    if (!tmpdir) {
-      err_printf("Failed to open %s for cleaning: %s\n", _ldcs_audit_server_tmpdir,
-                 strerror(errno));
+      err_printf("Failed to open %s for cleaning: %s\n", dir, strerror(errno));
       return -1;
    }
+   dfd = dirfd(tmpdir);
    
    while ((dp = readdir(tmpdir))) {
-      snprintf(path, MAX_PATH_LEN, "%s/%s", _ldcs_audit_server_tmpdir, dp->d_name);
-      result = lstat(path, &finfo);
-      if (result == -1) {
-         err_printf("Failed to stat %s\n", path);
+      if (dp->d_type != DT_UNKNOWN)
+         type = dp->d_type;
+      else if (fstatat(dfd, dp->d_name, &finfo, AT_SYMLINK_NOFOLLOW) == -1) {
+         err_printf("Failed to stat %s/%s\n", dir, dp->d_name);
+         continue;
+      }
+      else
+         type = S_ISREG(finfo.st_mode) ? DT_REG : S_ISDIR(finfo.st_mode) ? DT_DIR :
+            S_ISLNK(finfo.st_mode) ? DT_LNK : DT_UNKNOWN;
+      if (type == DT_DIR && strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0) {
+         snprintf(subdir, sizeof(subdir), "%s/%s", dir, dp->d_name);
+         clean_dir(subdir);
          continue;
       }
-      if (!S_ISREG(finfo.st_mode)) {
-         debug_printf3("Not cleaning file %s\n", path);
+      if (type != DT_REG && type != DT_LNK) {
+         debug_printf3("Not cleaning file %s/%s\n", dir, dp->d_name);
          continue;
       }
-      unlink(path);
+      unlinkat(dfd, dp->d_name, 0);
    }
 
    closedir(tmpdir);
-   rmdir(_ldcs_audit_server_tmpdir);
+   rmdir(dir);
+   return 0;
+}
+#endif
+
+/**
+ * Clear files from the local ramdisk.  Unlinking gigabytes of staged
+ * files from tmpfs takes seconds, and the job isn't done until its
+ * servers exit.  So the tmpdir is renamed aside, which frees its name for
+ * the next job's server on this node, and a detached process unlinks
+ * what was in it while we finish exiting.  The disk location, if any, is
+ * treated the same way.
+ **/
+#if !defined(USE_CLEANUP_PROC)
+static const char *move_aside(const char *dir, char *trashdir)
+{
+   snprintf(trashdir, MAX_PATH_LEN+1, "%s.trash.%d", dir, getpid());
+   if (rename(dir, trashdir) == 0)
+      return trashdir;
+   debug_printf("Could not move %s aside for cleaning: %s\n", dir, strerror(errno));
+   return dir;
+}
+#endif
+
+int ldcs_audit_server_filemngt_clean()
+{
+#if !defined(USE_CLEANUP_PROC)
+   char trashdir[MAX_PATH_LEN+1], disk_trashdir[MAX_PATH_LEN+1];
+   const char *cleandir, *disk_cleandir = NULL;
+   pid_t pid;
+   int fd;
+
+   cleandir = move_aside(_ldcs_audit_server_tmpdir, trashdir);
+   if (disk_dir && strcmp(disk_dir, _ldcs_audit_server_tmpdir) != 0)
+      disk_cleandir = move_aside(disk_dir, disk_trashdir);
+
+   debug_printf("Cleaning tmpdir %s in a detached process\n", cleandir);
+   pid = fork();
+   if (pid == -1) {
+      err_printf("Could not fork to clean %s, cleaning it now: %s\n", cleandir, strerror(errno));
+      if (disk_cleandir)
+         clean_dir(disk_cleandir);
+      return clean_dir(cleandir);
+   }
+   if (pid == 0) {
+      /* The grandchild is reparented to init, so nothing waits on it.  It
+         lets go of our output too, which a launcher may be waiting to see close. */
+      if (fork() != 0)
+         _exit(0);
+      setsid();
+      fd = open("/dev/null", O_RDWR);
+      if (fd != -1) {
+         dup2(fd, 0);
+         dup2(fd, 1);
+         dup2(fd, 2);
+      }
+      for (fd = 3; fd < getdtablesize(); fd++)
+         close(fd);
+      clean_dir(cleandir);
+      if (disk_cleandir)
+         clean_dir(disk_cleandir);
+      _exit(0);
+   }
+   waitpid(pid, NULL, 0);
 #endif
    return 0;
 }
 
 int filemngt_create_file_space(char *filename, size_t size, void **buffer_out, int *fd_out)
 {
-   int result;
-   *fd_out = open(filename, O_CREAT | O_EXCL | O_RDWR, 0700);
+   int result, staged;
+
+   staged = memfd_staged_fd(filename);
+   if (staged != -1 && memfd_slots[staged].writer != -1) {
+      *fd_out = memfd_slots[staged].writer;
+      memfd_slots[staged].writer = -1;
+   }
+   else
+      *fd_out = open(filename, O_CREAT | O_EXCL | O_RDWR, 0700);
    if (*fd_out == -1) {
       err_printf("Could not create local file %s: %s\n", filename, strerror(errno));
       return -1;
@@ -245,29 +1178,56 @@ int filemngt_create_file_space(char *filename, size_t size, void **buffer_out, i
        size = getpagesize();
        debug_printf2("growing empty file to size %d", (int) size);
    }
-   result = ftruncate(*fd_out, size);
+   /* On disk, reserve the blocks now, rather than fault them in as the contents are written */
+   if (is_disk_file(filename)) {
+      result = fallocate(*fd_out, 0, 0, size);
+      if (result == -1 && errno == EOPNOTSUPP)
+         result = ftruncate(*fd_out, size);
+   }
+   else
+      result = ftruncate(*fd_out, size);
    if (result == -1) {
       err_printf("Could not grow local file %s to %lu (out of memory?): %s\n", filename, size, strerror(errno));
-      close(*fd_out);
+      memfd_close_writer(*fd_out);
       return -1;
    }
-   *buffer_out = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd_out, 0);
+   *buffer_out = map_file_space(size, PROT_READ | PROT_WRITE, *fd_out);
    if (*buffer_out == MAP_FAILED) {
       err_printf("Could not mmap file %s: %s\n", filename, strerror(errno));
-      close(*fd_out);
+      memfd_close_writer(*fd_out);
       return -1;
    }
    assert(*buffer_out);
    return 0;
 }
 
+/**
+ * Create a local file of size bytes with nothing written to it, so it
+ * takes no space until its contents are filled in.
+ **/
+int filemngt_create_sparse_file(char *filename, size_t size)
+{
+   int fd, result;
+
+   fd = open(filename, O_CREAT | O_EXCL | O_RDWR, 0700);
+   if (fd == -1) {
+      err_printf("Could not create local file %s: %s\n", filename, strerror(errno));
+      return -1;
+   }
+   result = ftruncate(fd, size);
+   if (result == -1)
+      err_printf("Could not grow local file %s to %lu: %s\n", filename, size, strerror(errno));
+   close(fd);
+   return result;
+}
+
 int filemngt_clear_file_space(void *buffer, size_t size, int fd)
 {
    int result = 0;
    if (buffer && size)
       result = munmap(buffer, size);
    if (fd != -1)
-      close(fd);
+      memfd_close_writer(fd);
    if (result == -1) {
       err_printf("Error unmapping buffer");
       return -1;
@@ -276,6 +1236,183 @@ int filemngt_clear_file_space(void *buffer, size_t size, int fd)
    return 0;
 }
 
+/**
+ * Drop a staged file from local disk.  Empty files were grown to a page
+ * when they were synced, so that is what is mapped for them.
+ **/
+int filemngt_evict_file(char *localname, void *buffer, size_t size)
+{
+   char mapname[MAX_PATH_LEN+1];
+   int result, staged;
+
+   if (buffer) {
+      result = munmap(buffer, size ? size : (size_t) getpagesize());
+      if (result == -1) {
+         err_printf("Error unmapping buffer for %s: %s\n", localname, strerror(errno));
+      }
+   }
+
+   /* A memfd goes away once no process has it open or mapped */
+   staged = memfd_staged_fd(localname);
+   if (staged != -1) {
+      if (memfd_slots[staged].writer != -1)
+         memfd_close_writer(memfd_slots[staged].writer);
+      else {
+         close(staged);
+         free(memfd_slots[staged].alias);
+         memfd_slots[staged].alias = NULL;
+      }
+      return 0;
+   }
+
+   result = unlink(localname);
+   if (result == -1) {
+      err_printf("Could not remove evicted file %s: %s\n", localname, strerror(errno));
+      return -1;
+   }
+
+   /* A PLT map, if filemngt_write_pltmap made one */
+   if (snprintf(mapname, sizeof(mapname), "%s%s", localname, PLTMAP_SUFFIX) < (int) sizeof(mapname))
+      unlink(mapname);
+   return 0;
+}
+
+/**
+ * Map a staged file read-only again after filemngt_unmap_staged_file,
+ * the way filemngt_sync_file_space left it.  Returns NULL on failure.
+ **/
+void *filemngt_map_staged_file(char *localname, size_t size)
+{
+   size_t map_size = size ? size : (size_t) getpagesize();
+   void *buffer;
+   int fd;
+
+   fd = open(localname, O_RDONLY);
+   if (fd == -1) {
+      err_printf("Could not open staged file %s to map it: %s\n", localname, strerror(errno));
+      return NULL;
+   }
+   buffer = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (buffer == MAP_FAILED) {
+      err_printf("Could not map staged file %s: %s\n", localname, strerror(errno));
+      return NULL;
+   }
+   if (use_huge_pages && map_size >= HUGE_PAGE_SIZE)
+      madvise(buffer, map_size, MADV_HUGEPAGE);
+   return buffer;
+}
+
+int filemngt_unmap_staged_file(void *buffer, size_t size)
+{
+   if (munmap(buffer, size ? size : (size_t) getpagesize()) == -1) {
+      err_printf("Error unmapping staged file at %p: %s\n", buffer, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Copy a staged file, for when it can't be hard linked.
+ **/
+static int copy_local_file(char *srcname, char *dstname)
+{
+   int src, dst, result = 0;
+   char buffer[64*1024];
+   ssize_t bytes_read, bytes_written, pos;
+
+   src = open(srcname, O_RDONLY);
+   if (src == -1) {
+      err_printf("Could not open %s to copy it: %s\n", srcname, strerror(errno));
+      return -1;
+   }
+   dst = open(dstname, O_CREAT | O_EXCL | O_WRONLY, 0700);
+   if (dst == -1) {
+      err_printf("Could not create %s: %s\n", dstname, strerror(errno));
+      close(src);
+      return -1;
+   }
+
+   for (;;) {
+      bytes_read = read(src, buffer, sizeof(buffer));
+      if (bytes_read == -1 && errno == EINTR)
+         continue;
+      if (bytes_read <= 0) {
+         result = bytes_read;
+         break;
+      }
+      for (pos = 0; pos < bytes_read; pos += bytes_written) {
+         bytes_written = write(dst, buffer + pos, bytes_read - pos);
+         if (bytes_written == -1 && errno == EINTR)
+            bytes_written = 0;
+         else if (bytes_written == -1) {
+            result = -1;
+            break;
+         }
+      }
+      if (result == -1)
+         break;
+   }
+   if (result == -1) {
+      err_printf("Could not copy %s to %s: %s\n", srcname, dstname, strerror(errno));
+      unlink(dstname);
+   }
+   close(src);
+   close(dst);
+   return result;
+}
+
+/**
+ * Stage localname as a hard link to another staged file with the same
+ * contents and map it read-only, so both names share one copy on disk and
+ * in the page cache.  Falls back to copying if the link fails.  The link is
+ * made under a temporary name and renamed over localname, so a copy already
+ * staged there, mapped at old_buffer, is only dropped once this worked.
+ **/
+int filemngt_link_file(char *srcname, char *localname, size_t size, void **buffer_out,
+                       void *old_buffer, size_t old_size)
+{
+   char tmpname[MAX_PATH_LEN+1];
+   int fd, result;
+   void *buffer;
+
+   snprintf(tmpname, sizeof(tmpname), "%s.lnk", localname);
+   unlink(tmpname);
+   result = link(srcname, tmpname);
+   if (result == -1) {
+      debug_printf2("Could not link %s to %s, copying it instead: %s\n", localname, srcname, strerror(errno));
+      if (copy_local_file(srcname, tmpname) == -1)
+         return -1;
+   }
+
+   fd = open(tmpname, O_RDONLY);
+   if (fd == -1) {
+      err_printf("Could not open linked file %s: %s\n", tmpname, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+   buffer = mmap(NULL, size ? size : (size_t) getpagesize(), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (buffer == MAP_FAILED) {
+      err_printf("Could not mmap linked file %s: %s\n", tmpname, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+
+   result = rename(tmpname, localname);
+   if (result == -1) {
+      err_printf("Could not rename %s to %s: %s\n", tmpname, localname, strerror(errno));
+      munmap(buffer, size ? size : (size_t) getpagesize());
+      unlink(tmpname);
+      return -1;
+   }
+
+   if (old_buffer)
+      munmap(old_buffer, old_size ? old_size : (size_t) getpagesize());
+   *buffer_out = buffer;
+   return 0;
+}
+
 void *filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size, size_t newsize)
 {
    /* Linux gets annoying here.  We can't just mprotect the buffer to read-only,
@@ -309,7 +1446,15 @@ void *filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size
          return NULL;
       }
    }
-   
+
+#if defined(F_ADD_SEALS)
+   if (fd < num_memfd_slots && memfd_slots[fd].staged != -1) {
+      /* Nothing has it mapped writable now, so it can be sealed against writes too */
+      if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+         debug_printf("Could not seal the memfd for %s: %s\n", pathname, strerror(errno));
+      memfd_slots[fd].staged = -1;
+   }
+#endif
    close(fd);
    
    fd = open(pathname, O_RDONLY);
@@ -327,6 +1472,8 @@ void *filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size
          return NULL;
       }
    }
+   if (use_huge_pages && newsize >= HUGE_PAGE_SIZE)
+      madvise(buffer2, newsize, MADV_HUGEPAGE);
 
    close(fd);
 
@@ -338,7 +1485,7 @@ size_t filemngt_get_file_size(char *pathname, int *errcode)
    struct stat st;
    int result;
 
-   result = stat(pathname, &st);
+   result = filemngt_stat_path(pathname, &st);
    if (result == -1) {
       if (errcode)
          *errcode = errno;
@@ -348,14 +1495,26 @@ size_t filemngt_get_file_size(char *pathname, int *errcode)
    return (size_t) st.st_size;
 }
 
+int filemngt_get_file_id(char *pathname, dev_t *dev, ino_t *ino)
+{
+   struct stat st;
+
+   if (filemngt_stat_path(pathname, &st) == -1)
+      return -1;
+   *dev = st.st_dev;
+   *ino = st.st_ino;
+   return 0;
+}
+
 int filemngt_stat(char *pathname, struct stat *buf)
 {
    int result;
    if (*pathname == '*') {
-      result = stat(pathname+1, buf);
+      result = filemngt_stat_path(pathname+1, buf);
       debug_printf3("stat(%s) = %d\n", pathname, result);
    }
    else {
+      filemngt_count_fsop(FSOP_STAT, 0);
       result = lstat(pathname, buf);
       debug_printf3("lstat(%s) = %d\n", pathname, result);
    }
@@ -364,7 +1523,9 @@ int filemngt_stat(char *pathname, struct stat *buf)
 
 static int filemngt_write_buffer(char *localname, char *buffer, size_t size)
 {
-   int result, bytes_written, fd;
+   ssize_t result;
+   size_t bytes_written;
+   int fd;
 
    fd = creat(localname, 0600);
    if (fd == -1) {
@@ -399,10 +1560,60 @@ int filemngt_write_ldsometadata(char *localname, ldso_info_t *ldsoinfo)
    return filemngt_write_buffer(localname, (char *) ldsoinfo, sizeof(*ldsoinfo));
 }
 
+static const char *pltmap_names[] = { PLTMAP_NAME_LIST };
+
+/**
+ * Write the PLT map of a staged ELF file next to it, for subaudit clients.
+ * Files that aren't ELF, or whose relocations can't be read, get no map.
+ **/
+int filemngt_write_pltmap(char *localname, void *buffer, size_t size)
+{
+   char mapname[MAX_PATH_LEN+1];
+   pltmap_header_t header;
+   pltmap_entry_t *entries;
+   char *contents;
+   int num_entries, result;
+
+   /* Clients only look for maps next to files in the location */
+   if (memfd_staged_fd(localname) != -1)
+      return 0;
+
+   result = elf_read_pltmap(buffer, size, pltmap_names, sizeof(pltmap_names) / sizeof(*pltmap_names),
+                            &entries, &num_entries);
+   if (result != 1)
+      return result;
+   if (snprintf(mapname, sizeof(mapname), "%s%s", localname, PLTMAP_SUFFIX) >= (int) sizeof(mapname)) {
+      free(entries);
+      return 0;
+   }
+
+   contents = (char *) malloc(sizeof(header) + num_entries * sizeof(pltmap_entry_t));
+   if (!contents) {
+      err_printf("Could not allocate PLT map for %s\n", localname);
+      free(entries);
+      return -1;
+   }
+   header.magic = PLTMAP_MAGIC;
+   header.version = PLTMAP_VERSION;
+   header.num_names = sizeof(pltmap_names) / sizeof(*pltmap_names);
+   header.num_entries = num_entries;
+   memcpy(contents, &header, sizeof(header));
+   if (num_entries)
+      memcpy(contents + sizeof(header), entries, num_entries * sizeof(pltmap_entry_t));
+   free(entries);
+
+   debug_printf3("Writing PLT map of %d entries for %s\n", num_entries, localname);
+   result = filemngt_write_buffer(mapname, contents, sizeof(header) + num_entries * sizeof(pltmap_entry_t));
+   free(contents);
+   return result;
+}
+
 
 static int filemngt_read_buffer(char *localname, char *buffer, size_t size)
 {
-   int result, bytes_read, fd;
+   ssize_t result;
+   size_t bytes_read;
+   int fd;
 
    fd = open(localname, O_RDONLY);
    if (fd == -1) {
@@ -434,6 +1645,8 @@ int filemngt_read_ldsometadata(char *localname, ldso_info_t *ldsoinfo)
 
 int filemngt_read_stat(char *localname, struct stat *buf)
 {
+   if (STATSEG_IS_REF(localname))
+      return statseg_read(localname, buf);
    return filemngt_read_buffer(localname, (char *) buf, sizeof(*buf));
 }
 
@@ -532,7 +1745,50 @@ static int filemngt_ldso_elfX(unsigned char *base, ldso_info_t *ldsoinfo) \
 filemngt_ldso_elfx(filemngt_ldso_elf32, Elf32_Ehdr, Elf32_Shdr, Elf32_Sym, Elf32_Off, Elf32_Phdr)
 filemngt_ldso_elfx(filemngt_ldso_elf64, Elf64_Ehdr, Elf64_Shdr, Elf64_Sym, Elf64_Off, Elf64_Phdr)
 
-static int ldso_metadata_sym(char *pathname, ldso_info_t *ldsoinfo)
+#define LDSO_BUILDID_MAX 64
+#define NOTE_ALIGN(X) (((X) + 3) & ~((size_t) 3))
+
+/* Write the loader's GNU build-id note as hex into buildid, or leave it empty */
+#define filemngt_buildid_elfx(filemngt_buildid_elfX, ElfX_Ehdr, ElfX_Phdr, ElfX_Nhdr) \
+static void filemngt_buildid_elfX(unsigned char *base, size_t size, char *buildid) \
+{                                                                       \
+   ElfX_Ehdr *ehdr = (ElfX_Ehdr *) base;                                \
+   ElfX_Phdr *phdrs, *phdr;                                             \
+   ElfX_Nhdr *note;                                                     \
+   size_t pos, end, desc;                                               \
+   unsigned int i, j;                                                   \
+                                                                        \
+   buildid[0] = '\0';                                                   \
+   if (ehdr->e_phoff + ehdr->e_phnum * sizeof(ElfX_Phdr) > size)        \
+      return;                                                           \
+   phdrs = (ElfX_Phdr *) (base + ehdr->e_phoff);                        \
+   for (i = 0; i < ehdr->e_phnum; i++) {                                \
+      phdr = phdrs + i;                                                 \
+      if (phdr->p_type != PT_NOTE || phdr->p_offset + phdr->p_filesz > size) \
+         continue;                                                      \
+      pos = phdr->p_offset;                                             \
+      end = phdr->p_offset + phdr->p_filesz;                            \
+      while (pos + sizeof(*note) <= end) {                              \
+         note = (ElfX_Nhdr *) (base + pos);                             \
+         desc = pos + sizeof(*note) + NOTE_ALIGN(note->n_namesz);       \
+         if (desc + note->n_descsz > end)                               \
+            break;                                                      \
+         if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&  \
+             memcmp(base + pos + sizeof(*note), "GNU", 4) == 0 &&       \
+             note->n_descsz * 2 < LDSO_BUILDID_MAX) {                   \
+            for (j = 0; j < note->n_descsz; j++)                        \
+               sprintf(buildid + j*2, "%02x", base[desc + j]);          \
+            return;                                                     \
+         }                                                              \
+         pos = desc + NOTE_ALIGN(note->n_descsz);                       \
+      }                                                                 \
+   }                                                                    \
+}
+
+filemngt_buildid_elfx(filemngt_buildid_elf32, Elf32_Ehdr, Elf32_Phdr, Elf32_Nhdr)
+filemngt_buildid_elfx(filemngt_buildid_elf64, Elf64_Ehdr, Elf64_Phdr, Elf64_Nhdr)
+
+static int ldso_metadata_sym(char *pathname, ldso_info_t *ldsoinfo, char *buildid)
 {
    int fd = -1, result, error, ret = -1;
    size_t ldso_size;
@@ -569,18 +1825,18 @@ static int ldso_metadata_sym(char *pathname, ldso_info_t *ldsoinfo)
    }
 
    if (elf_ident[EI_CLASS] == ELFCLASS32) {
-      filemngt_ldso_elf32(map_result, ldsoinfo);
+      filemngt_buildid_elf32(map_result, ldso_size, buildid);
+      ret = filemngt_ldso_elf32(map_result, ldsoinfo);
    }
    else if (elf_ident[EI_CLASS] == ELFCLASS64) {
-      filemngt_ldso_elf64(map_result, ldsoinfo);      
+      filemngt_buildid_elf64(map_result, ldso_size, buildid);
+      ret = filemngt_ldso_elf64(map_result, ldsoinfo);
    }
    else {
       err_printf("Error, linker %s had invalid elf class %d\n", pathname, (int) elf_ident[EI_CLASS]);
       goto done;
    }
-   
-   
-   ret = 0;
+
   done:
 
    if (fd != -1)
@@ -590,6 +1846,53 @@ static int ldso_metadata_sym(char *pathname, ldso_info_t *ldsoinfo)
    return ret;
 }
 
+/**
+ * Offsets that took running print_ldso_entry to find are kept in the
+ * persist directory under the loader's build-id, so later servers on the
+ * node don't run it again for the same loader.
+ **/
+static int ldso_metadata_cached(char *buildid, ldso_info_t *ldsoinfo)
+{
+   char path[MAX_PATH_LEN+1];
+   int fd, result;
+
+   if (!persist_dir || !buildid[0])
+      return -1;
+   snprintf(path, sizeof(path), "%s/%s%s", persist_dir, LDSO_CACHE_PREFIX, buildid);
+   fd = open(path, O_RDONLY);
+   if (fd == -1)
+      return -1;
+   result = read(fd, ldsoinfo, sizeof(*ldsoinfo));
+   close(fd);
+   return result == sizeof(*ldsoinfo) ? 0 : -1;
+}
+
+static void ldso_metadata_store(char *buildid, ldso_info_t *ldsoinfo)
+{
+   char path[MAX_PATH_LEN+1], tmppath[MAX_PATH_LEN+1];
+   int fd, result;
+
+   if (!persist_dir || !buildid[0])
+      return;
+   snprintf(path, sizeof(path), "%s/%s%s", persist_dir, LDSO_CACHE_PREFIX, buildid);
+   result = snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+   if (result < 0 || result >= (int) sizeof(tmppath)) {
+      debug_printf("Not caching ldso metadata, since %s is too long to write to\n", path);
+      return;
+   }
+   fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1) {
+      debug_printf("Could not create ldso metadata cache %s: %s\n", tmppath, strerror(errno));
+      return;
+   }
+   result = write(fd, ldsoinfo, sizeof(*ldsoinfo));
+   close(fd);
+   if (result != sizeof(*ldsoinfo) || rename(tmppath, path) == -1) {
+      debug_printf("Could not write ldso metadata cache %s\n", path);
+      unlink(tmppath);
+   }
+}
+
 #if !defined(os_bgq)
 static int ldso_metadata_run(char *pathname, ldso_info_t *ldsoinfo)
 {
@@ -630,20 +1933,50 @@ static int ldso_metadata_run(char *pathname, ldso_info_t *ldsoinfo)
 int filemngt_get_ldso_metadata(char *pathname, ldso_info_t *ldsoinfo)
 {
    int result;
+   char buildid[LDSO_BUILDID_MAX];
 
    debug_printf("Looking up symbol names in linker %s\n", pathname);
-   result = ldso_metadata_sym(pathname, ldsoinfo);
+   filemngt_count_fsop(FSOP_OPEN, 0);
+   filemngt_count_fsop(FSOP_READ, 0);
+   buildid[0] = '\0';
+   result = ldso_metadata_sym(pathname, ldsoinfo, buildid);
    if (result == 0)
       return 0;
 
+   result = ldso_metadata_cached(buildid, ldsoinfo);
+   if (result == 0) {
+      debug_printf("Using cached symbol offsets of %s for build-id %s\n", pathname, buildid);
+      return 0;
+   }
+
 #if !defined(os_bgq)
    debug_printf("Getting symbol offsets of %s from invoking print_ldso_entry\n", pathname);
    result = ldso_metadata_run(pathname, ldsoinfo);
-   if (result == 0)
+   if (result == 0) {
+      ldso_metadata_store(buildid, ldsoinfo);
       return 0;
+   }
 #endif
 
    err_printf("Could not find any mechanism for fetching ldso metadata of %s\n", pathname);
    return -1;
 }
 
+
+void filemngt_count_fsop(filemngt_fsop_t op, size_t bytes)
+{
+   __sync_fetch_and_add(fsop_cnt + op, 1);
+   if (bytes)
+      __sync_fetch_and_add(fsop_bytes + op, (long) bytes);
+}
+
+void filemngt_fsops_stats(ldcs_server_stat_t *stat)
+{
+   ldcs_server_stat_entry_t *entries[FSOP_NUM] = { &stat->fs_open, &stat->fs_stat,
+                                                   &stat->fs_readdir, &stat->fs_read };
+   int i;
+   for (i = 0; i < FSOP_NUM; i++) {
+      entries[i]->cnt = fsop_cnt[i];
+      entries[i]->bytes = fsop_bytes[i];
+   }
+}
@@ -17,34 +17,121 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef LDCS_AUDIT_SERVER_FILEMNGT_H
 #define LDCS_AUDIT_SERVER_FILEMNGT_H
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "ldcs_audit_server_md.h"
+#include "ldcs_audit_server_transform.h"
 
 int ldcs_audit_server_filemngt_init (char* location);
 
+typedef struct {
+   char *filename;
+   void *buffer;
+   size_t size;
+   int strip;
+   int errcode;
+   int result;
+   int pending;
+   transform_t *transform;   /* run over the contents once they're read, or NULL */
+} filemngt_read_t;
+
 int filemngt_read_file(char *filename, void *buffer, size_t *size, int strip, int *err);
+int filemngt_read_files(filemngt_read_t *reads, int num_reads);
+void filemngt_start_read(filemngt_read_t *read);
+int filemngt_wait_read(filemngt_read_t *read);
+int filemngt_read_range(char *filename, void *buffer, size_t offset, size_t len, int *err);
+size_t filemngt_stripe_size(char *filename);
+#define FILE_ENCODING_RAW 0
+#define FILE_ENCODING_LZ  1
+#define FILE_ENCODING_DELTA 2
+#define FILE_ENCODING_SPARSE 3
 int filemngt_encode_packet(char *filename, void *filecontents, size_t filesize, 
+                           size_t raw_size, int encoding, uint32_t crc, char *sharedkey,
                            char **buffer, size_t *buffer_size);
-int filemngt_decode_packet(node_peer_t peer, ldcs_message_t *msg, char *filename, size_t *buffer_size);
+int filemngt_decode_packet(node_peer_t peer, ldcs_message_t *msg, char *filename, size_t *buffer_size,
+                           size_t *raw_size, int *encoding, uint32_t *crc, char *sharedkey);
+
+/**
+ * With --sparse-files, a staged file whose holes are at least
+ * SPARSE_MIN_HOLES bytes is sent as FILE_ENCODING_SPARSE, a size_t count
+ * of data extents, each a size_t offset and size_t length, then the
+ * extents' bytes.  The holes are found in the staged copy at localname
+ * with SEEK_DATA and SEEK_HOLE, and the receiver writes only the extents,
+ * so its staged copy has the same holes.
+ **/
+#define SPARSE_MIN_HOLES (1024*1024)
+void *filemngt_sparse_encode(char *localname, void *buffer, size_t size, size_t *esize);
+int filemngt_sparse_decode(void *encoded, size_t esize, void *buffer, size_t size, int fd);
 char *filemngt_calc_localname(char *global_name);
+char *filemngt_calc_file_localname(char *global_name, size_t size);
+void filemngt_set_persist_dir(char *dir);
+void filemngt_set_disk_location(char *dir, size_t threshold);
+void filemngt_set_huge_pages(int on);
+void filemngt_set_memfd(unsigned int number);
+char *filemngt_memfd_alias(char *localname);
+
+/* The node's shared cache, the one on a file system all nodes see, and
+   the one a rack leader keeps for its rack */
+#define SHARED_CACHE_NODE    0
+#define SHARED_CACHE_CLUSTER 1
+#define SHARED_CACHE_RACK    2
+void filemngt_set_shared_cache(char *dir);
+void filemngt_set_cluster_cache(char *dir);
+void filemngt_set_rack_cache(char *dir);
+char *filemngt_shared_cache_key(char *pathname, int strip);
+char *filemngt_shared_cache_find(int tier, char *key, size_t *size);
+void filemngt_shared_cache_publish(int tier, char *localname, char *key);
+
+/* The shared cache key pathname's staged copy has, which goes with it in
+   file packets.  filemngt_shared_cache_known returns NULL if there's none */
+void filemngt_shared_cache_remember(char *pathname, char *key);
+void filemngt_shared_cache_forget(char *pathname);
+char *filemngt_shared_cache_known(char *pathname);
+
+/* Names in the persist directory that hold ldso metadata, rather than staged files */
+#define LDSO_CACHE_PREFIX "ldso-"
 
 int ldcs_audit_server_filemngt_clean();
 
 int filemngt_create_file_space(char *filename, size_t size, void **buffer_out, int *fd_out);
 void *filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size, size_t newsize);
 int filemngt_clear_file_space(void *buffer, size_t size, int fd);
+int filemngt_create_sparse_file(char *filename, size_t size);
+int filemngt_evict_file(char *localname, void *buffer, size_t size);
+void *filemngt_map_staged_file(char *localname, size_t size);
+int filemngt_unmap_staged_file(void *buffer, size_t size);
+int filemngt_link_file(char *srcname, char *localname, size_t size, void **buffer_out,
+                       void *old_buffer, size_t old_size);
 size_t filemngt_get_file_size(char *pathname, int *errcode);
+int filemngt_get_file_id(char *pathname, dev_t *dev, ino_t *ino);
 
 char* ldcs_is_a_localfile(char* filename);
 int filemngt_stat(char *pathname, struct stat *buf);
 int filemngt_write_stat(char *localname, struct stat *buf);
 int filemngt_read_stat(char *localname, struct stat *buf);
 int filemngt_write_ldsometadata(char *localname, ldso_info_t *ldsoinfo);
+int filemngt_write_pltmap(char *localname, void *buffer, size_t size);
 int filemngt_read_ldsometadata(char *localname, ldso_info_t *ldsoinfo);
 
 int filemngt_get_ldso_metadata(char *pathname, ldso_info_t *ldsoinfo);
 
+/**
+ * Operations we issue against the shared file system.  They're counted
+ * from whichever thread issues them, and filemngt_fsops_stats copies the
+ * counts into the server's fs_* statistics.
+ **/
+typedef enum {
+   FSOP_OPEN,
+   FSOP_STAT,
+   FSOP_READDIR,
+   FSOP_READ,
+   FSOP_NUM
+} filemngt_fsop_t;
+
+void filemngt_count_fsop(filemngt_fsop_t op, size_t bytes);
+void filemngt_fsops_stats(ldcs_server_stat_t *stat);
+
 #endif
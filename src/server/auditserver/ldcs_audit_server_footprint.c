@@ -0,0 +1,467 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ftw.h>
+#include <elf.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/signalfd.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+#include "ldcs_audit_server_footprint.h"
+#include "ldcs_cache.h"
+#include "ldcs_statseg.h"
+#include "stat_cache.h"
+#include "spindle_debug.h"
+
+#define FOOTPRINT_NAME "spindle_footprint"
+#define FOOTPRINT_TABLE_SIZE 4096
+#define FOOTPRINT_MAX_DIRS 100     /* directories listed, biggest first */
+
+typedef enum {
+   CAT_LIBRARY,
+   CAT_EXEC,
+   CAT_PYTHON,
+   CAT_DATA,
+   CAT_METADATA,
+   CAT_NUM
+} category_t;
+
+static const char *category_names[CAT_NUM] = { "library", "exec", "python", "data", "stat metadata" };
+
+typedef struct use_t {
+   char *pathname;
+   int is_stat;
+   int lookups;
+   struct use_t *next;
+} use_t;
+
+typedef struct {
+   char *pathname;
+   category_t category;
+   unsigned long bytes;
+   int lookups;
+   dev_t dev;
+   ino_t ino;
+} staged_file_t;
+
+typedef struct {
+   const char *dirname;
+   int dirname_len;
+   int files, unused;
+   unsigned long bytes, wasted;
+} dir_total_t;
+
+typedef struct {
+   staged_file_t *files;
+   int num, size;
+} file_list_t;
+
+static use_t *use_table[FOOTPRINT_TABLE_SIZE];
+static char *footprint_path = NULL;
+static int signal_fd = -1;
+static unsigned long walked_bytes;
+
+static unsigned int use_bucket(const char *pathname, int is_stat)
+{
+   unsigned int hash = 2166136261U ^ (unsigned int) is_stat;
+   for (; *pathname; pathname++)
+      hash = (hash ^ (unsigned char) *pathname) * 16777619U;
+   return hash % FOOTPRINT_TABLE_SIZE;
+}
+
+static use_t *find_use(const char *pathname, int is_stat)
+{
+   use_t *u;
+   for (u = use_table[use_bucket(pathname, is_stat)]; u; u = u->next) {
+      if (u->is_stat == is_stat && strcmp(u->pathname, pathname) == 0)
+         return u;
+   }
+   return NULL;
+}
+
+void footprint_note_use(const char *pathname, int is_stat)
+{
+   unsigned int bucket;
+   use_t *u;
+
+   if (!footprint_path || !pathname)
+      return;
+   u = find_use(pathname, is_stat);
+   if (!u) {
+      u = (use_t *) calloc(1, sizeof(use_t));
+      if (u)
+         u->pathname = strdup(pathname);
+      if (!u || !u->pathname) {
+         free(u);
+         return;
+      }
+      u->is_stat = is_stat;
+      bucket = use_bucket(pathname, is_stat);
+      u->next = use_table[bucket];
+      use_table[bucket] = u;
+   }
+   u->lookups++;
+}
+
+static int has_suffix(const char *str, const char *suffix)
+{
+   size_t len = strlen(str), slen = strlen(suffix);
+   return len >= slen && strcmp(str + len - slen, suffix) == 0;
+}
+
+/* An ELF executable, PIE or not, has an interpreter.  A library doesn't */
+static category_t elf_category(const char *localpath)
+{
+   Elf64_Ehdr ehdr;
+   Elf64_Phdr phdr;
+   category_t cat = CAT_DATA;
+   int fd, i;
+
+   fd = open(localpath, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return CAT_DATA;
+   if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+       ehdr.e_ident[EI_CLASS] != ELFCLASS64) {
+      close(fd);
+      return CAT_DATA;
+   }
+   if (ehdr.e_type == ET_EXEC)
+      cat = CAT_EXEC;
+   else if (ehdr.e_type == ET_DYN) {
+      cat = CAT_LIBRARY;
+      for (i = 0; i < ehdr.e_phnum; i++) {
+         if (pread(fd, &phdr, sizeof(phdr), ehdr.e_phoff + i * ehdr.e_phentsize) != sizeof(phdr))
+            break;
+         if (phdr.p_type == PT_INTERP) {
+            cat = CAT_EXEC;
+            break;
+         }
+      }
+   }
+   close(fd);
+   return cat;
+}
+
+static category_t file_category(const char *pathname, const char *localpath)
+{
+   if (has_suffix(pathname, ".py") || has_suffix(pathname, ".pyc") || has_suffix(pathname, ".pyo") ||
+       strstr(pathname, "/__pycache__/"))
+      return CAT_PYTHON;
+   return elf_category(localpath);
+}
+
+static void add_file(file_list_t *list, const char *pathname, const char *localpath, int is_stat)
+{
+   staged_file_t *grown, *f;
+   struct stat st;
+   use_t *u;
+
+   if (list->num == list->size) {
+      grown = (staged_file_t *) realloc(list->files, (list->size ? list->size * 2 : 1024) * sizeof(staged_file_t));
+      if (!grown)
+         return;
+      list->files = grown;
+      list->size = list->size ? list->size * 2 : 1024;
+   }
+   f = list->files + list->num;
+   memset(f, 0, sizeof(*f));
+   f->pathname = strdup(pathname);
+   if (!f->pathname)
+      return;
+
+   if (is_stat && STATSEG_IS_REF(localpath))
+      f->bytes = sizeof(statseg_entry_t);
+   else if (stat(localpath, &st) == 0) {
+      f->bytes = (unsigned long) st.st_blocks * 512;
+      f->dev = st.st_dev;
+      f->ino = st.st_ino;
+   }
+   f->category = is_stat ? CAT_METADATA : file_category(pathname, localpath);
+   u = find_use(pathname, is_stat);
+   f->lookups = u ? u->lookups : 0;
+   list->num++;
+}
+
+typedef struct {
+   file_list_t *list;
+   char *dirname;
+} dir_walk_t;
+
+static void entry_cb(char *filename, unsigned char d_type, char *localpath, size_t size, void *arg)
+{
+   dir_walk_t *walk = (dir_walk_t *) arg;
+   char pathname[MAX_PATH_LEN+1];
+
+   if (!localpath)
+      return;
+   snprintf(pathname, sizeof(pathname), "%s/%s", walk->dirname, filename);
+   add_file(walk->list, pathname, localpath, 0);
+}
+
+static void dir_cb(char *dirname, int exists, void *arg)
+{
+   dir_walk_t walk;
+
+   if (!exists)
+      return;
+   walk.list = (file_list_t *) arg;
+   walk.dirname = dirname;
+   ldcs_cache_foreachEntryInDir(dirname, entry_cb, &walk);
+}
+
+static void stat_cb(const char *pathname, char *data, void *arg)
+{
+   if (data)
+      add_file((file_list_t *) arg, pathname, data, 1);
+}
+
+static int walk_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+   if (typeflag == FTW_F)
+      walked_bytes += (unsigned long) sb->st_blocks * 512;
+   return 0;
+}
+
+static int by_inode(const void *a, const void *b)
+{
+   const staged_file_t *fa = (const staged_file_t *) a, *fb = (const staged_file_t *) b;
+   if (fa->dev != fb->dev)
+      return fa->dev < fb->dev ? -1 : 1;
+   if (fa->ino != fb->ino)
+      return fa->ino < fb->ino ? -1 : 1;
+   return 0;
+}
+
+static int by_bytes(const void *a, const void *b)
+{
+   const staged_file_t *fa = (const staged_file_t *) a, *fb = (const staged_file_t *) b;
+   if (fa->bytes != fb->bytes)
+      return fa->bytes > fb->bytes ? -1 : 1;
+   return strcmp(fa->pathname, fb->pathname);
+}
+
+static int dirname_len(const char *pathname)
+{
+   const char *slash = strrchr(pathname, '/');
+   return slash ? (int) (slash - pathname) : 0;
+}
+
+static int by_dirname(const void *a, const void *b)
+{
+   const staged_file_t *fa = (const staged_file_t *) a, *fb = (const staged_file_t *) b;
+   int la = dirname_len(fa->pathname), lb = dirname_len(fb->pathname), result;
+
+   result = strncmp(fa->pathname, fb->pathname, la < lb ? la : lb);
+   if (result)
+      return result;
+   return la - lb;
+}
+
+static int by_dir_bytes(const void *a, const void *b)
+{
+   const dir_total_t *da = (const dir_total_t *) a, *db = (const dir_total_t *) b;
+   if (da->bytes != db->bytes)
+      return da->bytes > db->bytes ? -1 : 1;
+   return 0;
+}
+
+static void write_dirs(FILE *f, file_list_t *list)
+{
+   dir_total_t *dirs;
+   int i, num_dirs = 0, len;
+
+   dirs = (dir_total_t *) calloc(list->num ? list->num : 1, sizeof(dir_total_t));
+   if (!dirs)
+      return;
+   qsort(list->files, list->num, sizeof(staged_file_t), by_dirname);
+   for (i = 0; i < list->num; i++) {
+      len = dirname_len(list->files[i].pathname);
+      if (!num_dirs || dirs[num_dirs-1].dirname_len != len ||
+          strncmp(dirs[num_dirs-1].dirname, list->files[i].pathname, len) != 0) {
+         dirs[num_dirs].dirname = list->files[i].pathname;
+         dirs[num_dirs].dirname_len = len;
+         num_dirs++;
+      }
+      dirs[num_dirs-1].files++;
+      dirs[num_dirs-1].bytes += list->files[i].bytes;
+      if (!list->files[i].lookups) {
+         dirs[num_dirs-1].unused++;
+         dirs[num_dirs-1].wasted += list->files[i].bytes;
+      }
+   }
+   qsort(dirs, num_dirs, sizeof(dir_total_t), by_dir_bytes);
+
+   fprintf(f, "\nBy directory, the %d biggest of %d:\n", num_dirs < FOOTPRINT_MAX_DIRS ? num_dirs : FOOTPRINT_MAX_DIRS,
+           num_dirs);
+   fprintf(f, "%14s %7s %14s %7s  %s\n", "bytes", "files", "wasted bytes", "unused", "directory");
+   for (i = 0; i < num_dirs && i < FOOTPRINT_MAX_DIRS; i++) {
+      fprintf(f, "%14lu %7d %14lu %7d  %.*s\n", dirs[i].bytes, dirs[i].files, dirs[i].wasted, dirs[i].unused,
+              dirs[i].dirname_len ? dirs[i].dirname_len : 1, dirs[i].dirname_len ? dirs[i].dirname : "/");
+   }
+   free(dirs);
+}
+
+static void write_footprint(ldcs_process_data_t *procdata, FILE *f, file_list_t *list)
+{
+   unsigned long cat_bytes[CAT_NUM], cat_wasted[CAT_NUM], total = 0, wasted = 0;
+   int cat_files[CAT_NUM], cat_unused[CAT_NUM], i;
+   staged_file_t *file;
+
+   memset(cat_bytes, 0, sizeof(cat_bytes));
+   memset(cat_wasted, 0, sizeof(cat_wasted));
+   memset(cat_files, 0, sizeof(cat_files));
+   memset(cat_unused, 0, sizeof(cat_unused));
+
+   /* Copies linked to one another, by --dedup or a cache index, take their
+      bytes once */
+   qsort(list->files, list->num, sizeof(staged_file_t), by_inode);
+   for (i = 1; i < list->num; i++) {
+      if (list->files[i].ino && list->files[i].dev == list->files[i-1].dev &&
+          list->files[i].ino == list->files[i-1].ino)
+         list->files[i].bytes = 0;
+   }
+
+   for (i = 0; i < list->num; i++) {
+      file = list->files + i;
+      cat_files[file->category]++;
+      cat_bytes[file->category] += file->bytes;
+      total += file->bytes;
+      if (!file->lookups) {
+         cat_unused[file->category]++;
+         cat_wasted[file->category] += file->bytes;
+         wasted += file->bytes;
+      }
+   }
+
+   fprintf(f, "Spindle staging footprint of server %d on %s, in %s\n", procdata->number,
+           procdata->hostname ? procdata->hostname : "unknown", procdata->location);
+   fprintf(f, "Staged: %lu bytes in %d files, of which %lu bytes are wasted, never looked up by a client here\n",
+           total, list->num, wasted);
+   fprintf(f, "Other: %lu bytes in the location that aren't staged files\n",
+           walked_bytes > total ? walked_bytes - total : 0);
+
+   fprintf(f, "\nBy category:\n");
+   fprintf(f, "%14s %7s %14s %7s  %s\n", "bytes", "files", "wasted bytes", "unused", "category");
+   for (i = 0; i < CAT_NUM; i++) {
+      fprintf(f, "%14lu %7d %14lu %7d  %s\n", cat_bytes[i], cat_files[i], cat_wasted[i], cat_unused[i],
+              category_names[i]);
+   }
+
+   write_dirs(f, list);
+
+   qsort(list->files, list->num, sizeof(staged_file_t), by_bytes);
+   fprintf(f, "\nBy file:\n");
+   fprintf(f, "%14s %7s  %-13s %s\n", "bytes", "lookups", "category", "file");
+   for (i = 0; i < list->num; i++) {
+      file = list->files + i;
+      fprintf(f, "%14lu %7d  %-13s %s%s\n", file->bytes, file->lookups, category_names[file->category],
+              file->pathname, file->lookups ? "" : "  (wasted)");
+   }
+}
+
+int footprint_write(ldcs_process_data_t *procdata)
+{
+   char tmpname[MAX_PATH_LEN+1];
+   file_list_t list;
+   int i, result = 0;
+   FILE *f;
+
+   if (!footprint_path)
+      return 0;
+
+   memset(&list, 0, sizeof(list));
+   ldcs_cache_foreachDir(dir_cb, &list);
+   foreach_stat_cache(stat_cb, &list);
+   walked_bytes = 0;
+   nftw(procdata->location, walk_cb, 16, FTW_PHYS);
+   if (procdata->disk_location && *procdata->disk_location)
+      nftw(procdata->disk_location, walk_cb, 16, FTW_PHYS);
+
+   snprintf(tmpname, sizeof(tmpname), "%s.tmp", footprint_path);
+   f = fopen(tmpname, "w");
+   if (!f) {
+      err_printf("Could not create footprint report %s: %s\n", tmpname, strerror(errno));
+      result = -1;
+   }
+   else {
+      write_footprint(procdata, f, &list);
+      if (fclose(f) != 0 || rename(tmpname, footprint_path) == -1) {
+         err_printf("Could not write footprint report %s: %s\n", footprint_path, strerror(errno));
+         unlink(tmpname);
+         result = -1;
+      }
+      else
+         debug_printf("Wrote footprint report of %d staged files to %s\n", list.num, footprint_path);
+   }
+
+   for (i = 0; i < list.num; i++)
+      free(list.files[i].pathname);
+   free(list.files);
+   return result;
+}
+
+static int footprint_CB(int fd, int id, void *data)
+{
+   struct signalfd_siginfo info;
+   while (read(fd, &info, sizeof(info)) == sizeof(info));
+   footprint_write((ldcs_process_data_t *) data);
+   return 0;
+}
+
+int footprint_start(ldcs_process_data_t *procdata)
+{
+   char path[MAX_PATH_LEN+1];
+   char *dir = getenv("SPINDLE_FOOTPRINT");
+   sigset_t mask;
+
+   if (!dir || !*dir)
+      return 0;
+   snprintf(path, sizeof(path), "%s/%s.%s.%d", dir, FOOTPRINT_NAME,
+            procdata->hostname ? procdata->hostname : "unknown", procdata->number);
+   footprint_path = strdup(path);
+
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGUSR2);
+   pthread_sigmask(SIG_BLOCK, &mask, NULL);
+   signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+   if (signal_fd == -1) {
+      err_printf("Could not take SIGUSR2 for footprint reports, writing one at exit only: %s\n", strerror(errno));
+      return -1;
+   }
+   ldcs_listen_register_fd(signal_fd, signal_fd, footprint_CB, procdata);
+   debug_printf("Writing footprint reports to %s at exit and on SIGUSR2\n", footprint_path);
+   return 0;
+}
+
+void footprint_stop()
+{
+   if (signal_fd == -1)
+      return;
+   ldcs_listen_unregister_fd(signal_fd);
+   close(signal_fd);
+   signal_fd = -1;
+}
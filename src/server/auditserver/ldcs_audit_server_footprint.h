@@ -0,0 +1,53 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_FOOTPRINT_H_)
+#define LDCS_AUDIT_SERVER_FOOTPRINT_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * With SPINDLE_FOOTPRINT naming a directory, a server writes
+ * spindle_footprint.HOST.NUMBER there when it exits, and whenever it gets
+ * a SIGUSR2, saying what it has staged in its location: the bytes each
+ * staged file takes, counted in allocated blocks so sparse and lazy files
+ * count what they hold, and those bytes summed by the file's directory
+ * and by its category (library, exec, python, data or stat metadata).
+ * Each file also gets the number of times our clients looked it up.  A
+ * file no client looked up was staged for nothing, such as a preloaded or
+ * pushed file this node never used, and those bytes are counted as
+ * wasted.  Lookups answered from the client shared memory cache never
+ * reach us, so with it a used file may show no lookups.  What's in the
+ * location that isn't a staged file, such as the stat segment and the
+ * cache index, is reported as other.
+ *
+ * SIGUSR2 is blocked in the server's threads and read from a signalfd on
+ * the listen loop, so footprint_start must run before any threads are.
+ **/
+
+/* Start taking SIGUSR2, if SPINDLE_FOOTPRINT asks for a report */
+int footprint_start(ldcs_process_data_t *procdata);
+
+/* A client looked up pathname's staged copy, or its stat if is_stat */
+void footprint_note_use(const char *pathname, int is_stat);
+
+/* Write the report now */
+int footprint_write(ldcs_process_data_t *procdata);
+
+/* Stop taking SIGUSR2.  The report can still be written */
+void footprint_stop();
+
+#endif
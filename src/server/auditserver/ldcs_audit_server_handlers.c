@@ -20,7 +20,9 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <string.h>
 #include <sys/inotify.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <assert.h>
+#include <dirent.h>
 
 #include "ldcs_api.h"
 #include "ldcs_api_listen.h"
@@ -32,8 +34,40 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "global_name.h"
 #include "ldcs_audit_server_handlers.h"
 #include "ldcs_audit_server_requestors.h"
+#include "ldcs_audit_server_statseg.h"
+#include "ldcs_audit_server_compress.h"
+#include "ldcs_audit_server_transform.h"
+#include "ldcs_audit_server_dedup.h"
+#include "ldcs_audit_server_lazy.h"
+#include "ldcs_elf_read.h"
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_audit_server_clientpool.h"
+#include "ldcs_audit_server_ldcache.h"
+#include "ldcs_audit_server_bundle.h"
+#include "ldcs_audit_server_learn.h"
+#include "ldcs_audit_server_report.h"
+#include "ldcs_audit_server_latency.h"
+#include "ldcs_audit_server_msgpool.h"
+#include "ldcs_audit_server_predict.h"
+#include "ldcs_audit_server_pycompile.h"
+#include "ldcs_audit_server_numa.h"
+#include "ldcs_audit_server_dirlist.h"
+#include "ldcs_audit_server_crc.h"
+#include "ldcs_audit_server_revalidate.h"
+#include "ldcs_audit_server_jitcache.h"
+#include "ldcs_audit_server_kvs.h"
+#include "localfs.h"
 #include "spindle_launch.h"
 #include "pathfn.h"
+#include "relocrules.h"
+#include "spindle_probes.h"
+#include "name_intern.h"
+#include "ldcs_audit_server_fairq.h"
+#include "ldcs_audit_server_steps.h"
+#include "ldcs_audit_server_delta.h"
+#include "ldcs_audit_server_pfsmeta.h"
+#include "ldcs_audit_server_footprint.h"
+#include "ldcs_audit_server_namesnap.h"
 
 /** 
  * This file contains the "brains" of Spindle.  It's public interface,
@@ -81,15 +115,162 @@ typedef enum {
    metadata_loader
 } metadata_t;
 
+/* Files bigger than this are passed down the tree a chunk at a time as they arrive.  This is
+   also the chunk size a link starts with, before the md layer tunes it. */
+#define FILE_CHUNK_SIZE (1024*1024)
+
+/* Smallest file worth compressing, and the most a compressed copy may be
+   relative to the original, in eighths, for it to be sent instead */
+#define COMPRESS_MIN_SIZE (64*1024)
+#define COMPRESS_MAX_EIGHTHS 7
+
+/* Smallest file worth checking for a staged duplicate */
+#define DEDUP_MIN_SIZE (4*1024)
+
+/* How many files of a list are being read off disk at once */
+#define READ_BATCH_SIZE 64
+
+/* Most bytes of candidate paths kept for one dependency being pushed */
+#define PUSHDEP_MAX_LEN (16*1024)
+
+/* How far down the chain of likely successors --predict pushes, unless a
+   control update says otherwise */
+#define PREDICT_DEPTH 3
+#define PREDICT_MAX_DEPTH 16
+
+/* Smallest file worth the extra hop of having a sibling send it */
+#define PEER_SEND_MIN_SIZE (256*1024)
+
+/* Smallest file worth sending around a lagging child with --bypass-slow */
+#define BYPASS_MIN_SIZE (1024*1024)
+
+/* Largest file --batch-small holds back for a batch, and how big a batch
+   gets before it's sent without waiting for the end of the pass */
+#define BATCH_FILE_MAX_SIZE (8*1024)
+#define BATCH_MAX_SIZE (256*1024)
+
+/**
+ * A library some distributed ELF file depends on, or with --predict a file
+ * we expect to be asked for, waiting to be pushed.  candidates holds
+ * NUL-terminated paths in search order, ended by an empty string.
+ **/
+typedef struct pushdep_t {
+   char *candidates;
+   int predicted;
+   struct pushdep_t *next;
+} pushdep_t;
+
+static pushdep_t *pushdeps_head = NULL, *pushdeps_tail = NULL;
+
+/**
+ * A directory a client asked to have prefetched, waiting for its listing.
+ * requested is set once the listing has been asked for up the network.
+ **/
+typedef struct prefetchdir_t {
+   char *dir;
+   int requested;
+   struct prefetchdir_t *next;
+} prefetchdir_t;
+
+static prefetchdir_t *prefetchdirs = NULL;
+
+/* Small files waiting to go to all our children in one bundle, with --batch-small */
+static char *batch_data = NULL;
+static size_t batch_size = 0, batch_alloc = 0;
+static int batch_files = 0;
+
+/* How an exec search through an all-absolute PATH came out, by its
+   interned name/PATH key: the index of the PATH entry it found the file
+   in, or -1 and the errcode it failed with */
+#define EXEC_SEARCH_TABLE_SIZE 256
+typedef struct exec_search_t {
+   const char *key;
+   int index;
+   int errcode;
+   struct exec_search_t *next;
+} exec_search_t;
+static exec_search_t *exec_searches[EXEC_SEARCH_TABLE_SIZE];
+
+/* Clients waiting on a requested file or directory, by its interned path.
+   A client may be listed under a path it no longer waits on; only those
+   whose wait_path is still the path are woken. */
+#define WAIT_QUEUE_TABLE_SIZE 1024
+typedef struct wait_queue_t {
+   const char *path;
+   int *clients;
+   int num_clients;
+   int clients_size;
+   struct wait_queue_t *next;
+} wait_queue_t;
+static wait_queue_t *wait_queues[WAIT_QUEUE_TABLE_SIZE];
+
+typedef struct {
+   char *pathname;
+   char *localname;
+   char *buffer;
+   size_t size;
+   size_t newsize;
+   int fd;
+   int errcode;
+   void *pin;
+   dev_t dev;
+   ino_t ino;
+   int have_id;
+   int linked;     /* staged as a link to a duplicate, nothing to read */
+   char *sharedkey; /* with shared caches, the file's name in them */
+   transform_t xf;  /* what a reader thread works out from the contents it read */
+} file_read_t;
+
+/**
+ * A file being read off disk on a reader thread.  File reads go through
+ * these stages: handle_start_file_read looks the file up and sets up its
+ * buffer on the server loop, a reader thread fills the buffer, then back
+ * on the loop handle_finish_file_read stores and broadcasts it and the
+ * waiting clients are answered.  Until then, requests for the file wait
+ * on it as if it had been requested from the network.
+ **/
+typedef struct async_read_t {
+   file_read_t rd;
+   broadcast_t bcast;
+   int strip;
+   int result;
+   double read_time;
+   int stripes_left;  /* for a striped read, pieces the readers haven't sent */
+   struct async_read_t *next;
+} async_read_t;
+
+static async_read_t *async_reads = NULL;
+static int async_fd = -1;
+
+static int predict_depth = PREDICT_DEPTH;
+
 static int handle_client_info_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
 static int handle_client_myrankinfo_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
 static int handle_pythonprefix_query(ldcs_process_data_t *procdata, int nc);
+static int handle_relocrules_query(ldcs_process_data_t *procdata, int nc);
+static int handle_client_hello(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_client_timing(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_startup_done(ldcs_process_data_t *procdata, ldcs_message_t *msg);
 static int handle_client_file_request(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_client_batch_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_stage_candidates(ldcs_process_data_t *procdata, char *cwd, char *data, size_t len);
+static int handle_client_prefetch_dir(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_prefetch_dirs(ldcs_process_data_t *procdata);
+static int handle_client_search_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg, int is_ldso);
+static int handle_client_exec_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_begin_search(ldcs_process_data_t *procdata, int nc, char *list, int len, int is_ldso,
+                               int is_exec, const char *key);
+static int handle_search_next(ldcs_client_t *client);
+static void handle_remember_exec_search(ldcs_client_t *client, int errcode);
+static void handle_forget_exec_searches();
+static int handle_search_dir_has_subdirs(char *dir);
 static handle_file_result_t handle_howto_directory(ldcs_process_data_t *procdata, char *dir);
 static handle_file_result_t handle_howto_file(ldcs_process_data_t *procdata, char *pathname,
                                               char *file, char *dir, char **localpath, int *errcode);
 static int handle_client_progress(ldcs_process_data_t *procdata, int nc);
 static int handle_progress(ldcs_process_data_t *procdata);
+static int handle_progress_path(ldcs_process_data_t *procdata, const char *pathname);
+static int handle_wait_on(int nc, ldcs_client_t *client, const char *pathname);
 
 static int handle_read_directory(ldcs_process_data_t *procdata, char *dir);
 static int handle_broadcast_dir(ldcs_process_data_t *procdata, char *dir, broadcast_t bcast);
@@ -97,49 +278,174 @@ static int handle_read_and_broadcast_dir(ldcs_process_data_t *procdata, char *di
 
 static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *filename, 
                                           broadcast_t bcast);
-static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size,
-                                 broadcast_t bcast);
+static int handle_read_and_broadcast_files(ldcs_process_data_t *procdata, char **pathnames, int num_files,
+                                           broadcast_t bcast);
+static int handle_read_in_flight(char *pathname);
+static int handle_read_and_broadcast_bundle(ldcs_process_data_t *procdata, char *dir, int metadata);
+static int handle_stage_bundle(ldcs_process_data_t *procdata, ldcs_message_t *msg, int *num_staged);
+static int handle_bundle_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_start_async_read(ldcs_process_data_t *procdata, file_read_t *rd, broadcast_t bcast);
+static void handle_async_read_job(void *arg);
+static int handle_async_read_done(int fd, int id, void *data);
+static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                 char *buffer, size_t size, broadcast_t bcast);
+static int handle_send_file_contents(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                     char *buffer, size_t size, broadcast_t bcast,
+                                     int all_children, node_peer_t *peers, int num_peers,
+                                     double starttime);
+static void handle_unmap_sent_file(ldcs_process_data_t *procdata, char *pathname);
+static int handle_batch_file(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size,
+                             double starttime);
+static int handle_delegate_to_siblings(ldcs_process_data_t *procdata, char *pathname, size_t size,
+                                       node_peer_t *peers, int *num_peers);
+static int handle_peer_send(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg);
+static int handle_peer_send_returned(ldcs_process_data_t *procdata, char *pathname, int sibling,
+                                     node_peer_t target);
 static void *handle_setup_file_buffer(ldcs_process_data_t *procdata, char *pathname, size_t size, 
                                       int *fd, char **localpath, int *already_loaded);
 static int handle_finish_buffer_setup(ldcs_process_data_t *procdata, 
                                       char *localname, char *pathname, int *fd,
                                       void *buffer, size_t size, size_t newsize, int errcode);
 
+static void handle_evict_file(char *localpath, void *buffer, size_t size, void *arg);
+static uint32_t handle_file_crc(ldcs_process_data_t *procdata, char *pathname, void *buffer, size_t size);
+static int handle_verify_received(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                  size_t size, uint32_t crc);
+static int handle_verify_staged(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                void *buffer, size_t size);
+static void handle_drop_corrupt_file(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                     void *buffer, size_t size);
+static void handle_pin_client_file(ldcs_process_data_t *procdata, ldcs_client_t *client);
+static void handle_count_cache_result(ldcs_process_data_t *procdata, ldcs_client_t *client);
+
 static int handle_client_fulfilled_query(ldcs_process_data_t *procdata, int nc);
 static int handle_client_rejected_query(ldcs_process_data_t *procdata, int nc, int errcode);
 
 static int handle_request(ldcs_process_data_t *procdata, node_peer_t from, ldcs_message_t *msg);
+static void handle_statahead(ldcs_process_data_t *procdata, char **pathnames, int num);
+static void handle_statahead_request(ldcs_process_data_t *procdata, ldcs_message_t *msg);
 static int handle_request_directory(ldcs_process_data_t *procdata, node_peer_t from, char *pathname);
 static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from, char *pathname);
 
 static int handle_send_query(ldcs_process_data_t *procdata, char *path, int is_dir);
 static int handle_send_directory_query(ldcs_process_data_t *procdata, char *directory);
 static int handle_send_file_query(ldcs_process_data_t *procdata, char *fullpath);
+static void handle_begin_query_batch();
+static int handle_end_query_batch(ldcs_process_data_t *procdata);
+static int handle_query_batch_pending();
+static int handle_forward_query_entry(ldcs_process_data_t *procdata, char type, char *path);
+static int handle_expand_search_dir(const char *dir, size_t dirlen, const char *origin, char *result);
+static void handle_queue_dependencies(ldcs_process_data_t *procdata, char *pathname, void *buffer, size_t size);
+static int handle_push_dependencies(ldcs_process_data_t *procdata);
+static void handle_predict(ldcs_process_data_t *procdata, long stream, char *pathname);
+static int handle_client_dispatch(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_server_dispatch(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg);
 
 static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, 
                             broadcast_t bcast);
+static int handle_file_recv_and_forward(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer,
+                                        char *pathname, int fd, char *buffer, size_t size,
+                                        size_t raw_size, int encoding, uint32_t crc, broadcast_t bcast);
+static int handle_link_file(ldcs_process_data_t *procdata, char *pathname, char *canonical,
+                            char **localname, void **buffer, size_t *size);
+static int handle_link_staged(char *pathname, char *srcname, size_t size,
+                              char **localname, void **buffer);
+static int handle_stage_shared_file(ldcs_process_data_t *procdata, char *pathname, file_read_t *rd);
+static int handle_in_rack_cache(ldcs_process_data_t *procdata, char *pathname);
+static void handle_publish_received(ldcs_process_data_t *procdata, char *pathname, char *localname);
+static int handle_recv_shared_file(ldcs_process_data_t *procdata, node_peer_t peer, char *pathname,
+                                   char *sharedkey, size_t size, broadcast_t bcast);
+static int handle_stage_compiled_pyc(char *pathname, file_read_t *rd);
+static void handle_dedup_contents(ldcs_process_data_t *procdata, file_read_t *rd);
+static void handle_setup_transforms(ldcs_process_data_t *procdata, file_read_t *rd);
+static void handle_take_transforms(ldcs_process_data_t *procdata, file_read_t *rd);
+static int handle_bypass_slow_children(ldcs_process_data_t *procdata, ldcs_message_t *msg, int file_fd,
+                                       char *buffer, size_t size);
+static int handle_send_alias(ldcs_process_data_t *procdata, char *pathname, char *canonical, broadcast_t bcast,
+                             int *all_children, node_peer_t *peers, int *num_peers);
+static int handle_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast);
+static void *handle_get_compressed(ldcs_process_data_t *procdata, char *pathname, size_t size, size_t *zsize);
+static void handle_release_compressed(ldcs_process_data_t *procdata, char *pathname);
+static void *handle_get_sparse(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                               size_t size, size_t *esize);
+static void *handle_get_delta(ldcs_process_data_t *procdata, char *pathname, size_t size,
+                              int all_children, node_peer_t *peers, int num_peers, size_t *dsize);
+static void handle_keep_delta_base(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                   void *buffer, size_t size);
 static int handle_directory_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast);
+static int handle_lazy_stage_file(ldcs_process_data_t *procdata, char *pathname, int *staged);
+static lazy_file_t *handle_setup_lazy_file(ldcs_process_data_t *procdata, char *pathname, size_t size, int is_source);
+static int handle_broadcast_lazy_file(ldcs_process_data_t *procdata, char *pathname, size_t size);
+static int handle_lazy_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_lazy_fetch(ldcs_process_data_t *procdata, lazy_file_t *lf, size_t first, size_t last);
+static int handle_send_range_request(ldcs_process_data_t *procdata, lazy_file_t *lf, size_t first, size_t last);
+static int handle_range_request_recv(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg);
+static int handle_send_ready_ranges(ldcs_process_data_t *procdata, lazy_file_t *lf);
+static char *handle_pack_range(lazy_file_t *lf, size_t first, size_t last, size_t *offset, size_t *len,
+                               int *packet_len);
+static int handle_range_data_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, int pushed);
+static int handle_start_lazy_push(ldcs_process_data_t *procdata, lazy_file_t *lf);
+static int handle_push_extents(ldcs_process_data_t *procdata, lazy_file_t *lf, size_t first, size_t last);
+static int handle_lazy_push_timer(int fd, int id, void *data);
+static int handle_start_striped_read(ldcs_process_data_t *procdata, file_read_t *rd, broadcast_t bcast,
+                                     int *striped);
+static int handle_finish_striped_read(ldcs_process_data_t *procdata, async_read_t *ar);
+static int handle_stripe_request_recv(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg);
+static int handle_stripe_data_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_client_range_request(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_client_range_progress(ldcs_process_data_t *procdata, int nc);
+static int handle_client_range_answer(ldcs_process_data_t *procdata, int nc, int errcode);
 
 static int handle_exit_broadcast(ldcs_process_data_t *procdata);
+static int handle_select_msg_targets(ldcs_process_data_t *procdata, char *key, int force_broadcast,
+                                     int is_stat, node_peer_t **peers, int *num_peers);
 static int handle_send_msg_to_keys(ldcs_process_data_t *procdata, ldcs_message_t *msg, char *key,
                                    void *secondary_data, size_t secondary_size, int force_broadcast,
                                    int is_metadata);
 static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t *msg);
 static int handle_preload_done(ldcs_process_data_t *procdata);
+static int handle_settings_update(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static void handle_set_distmodel(ldcs_process_data_t *procdata, const char *model);
+static int handle_revalidate(ldcs_process_data_t *procdata);
+static int handle_invalidate_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_send_invalidations(ldcs_process_data_t *procdata, char *data, size_t len);
+static void handle_apply_invalidations(ldcs_process_data_t *procdata, char *data, size_t len);
 static int handle_create_selfload_file(ldcs_process_data_t *procdata, char *filename);
 static int handle_recv_selfload_file(ldcs_process_data_t *procdata, ldcs_message_t *msg);
 static int handle_report_fileexist_result(ldcs_process_data_t *procdata, int nc, exist_t res);
 
 static int handle_fileexist_test(ldcs_process_data_t *procdata, int nc);
 static int handle_client_fileexist_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_dirlist_test(ldcs_process_data_t *procdata, int nc);
+static int handle_client_dir_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_resolve_test(ldcs_process_data_t *procdata, int nc);
+static int handle_client_resolve_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
 static int handle_client_origpath_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_jit_answer(ldcs_process_data_t *procdata, int nc, int staged);
+static int handle_jit_test(ldcs_process_data_t *procdata, int nc);
+static int handle_jit_timer(int fd, int id, void *data);
+static int handle_client_jit_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_jit_publish(ldcs_process_data_t *procdata, char *pathname);
+static int handle_jit_publish_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_client_jit_claim(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_client_jit_publish(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_kvs_answer(ldcs_process_data_t *procdata, int nc, int errcode);
+static int handle_kvs_fence_if_done(ldcs_process_data_t *procdata);
+static int handle_client_kvs_put(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_client_kvs_fence(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_client_kvs_get(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_kvs_gather_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_kvs_table_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_join_rank_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg);
 static int handle_stat_file(ldcs_process_data_t *procdata, char *pathname, char **localname, struct stat *buf);
 static int handle_metadata_and_broadcast_file(ldcs_process_data_t *procdata, char *pathname, metadata_t mdtype, broadcast_t bcast);
-static int handle_cache_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, 
-                             struct stat *buf, char **localname);
 static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, unsigned char *buf, size_t buf_size, metadata_t mdtype);
+static void handle_begin_metadata_batch();
+static int handle_end_metadata_batch(ldcs_process_data_t *procdata);
 static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathname, int errcode);
 static int handle_metadata_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, metadata_t mdtype, node_peer_t peer);
+static int handle_metadata_record_recv(ldcs_process_data_t *procdata, char *buffer, size_t *record_pos,
+                                       metadata_t mdtype);
 static int handle_client_metadata(ldcs_process_data_t *procdata, int nc);
 static int handle_client_metadata_result(ldcs_process_data_t *procdata, int nc, metadata_t mdtype);
 static int handle_metadata_request(ldcs_process_data_t *procdata, char *pathname, metadata_t mdtype, node_peer_t from);
@@ -147,14 +453,43 @@ static int handle_metadata_request_recv(ldcs_process_data_t *procdata, ldcs_mess
 static int handle_load_and_broadcast_metadata(ldcs_process_data_t *procdata, char *pathname, metadata_t mdtype);
 static int handle_send_exit_ready_if_done(ldcs_process_data_t *procdata);
 static int handle_exit_ready_msg(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_stats_report_msg(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg);
 static int handle_exit_cancel_msg(ldcs_process_data_t *procdata, ldcs_message_t *msg);
 static int handle_send_exit_cancel(ldcs_process_data_t *procdata);
 static int handle_read_ldso_metadata(ldcs_process_data_t *procdata, char *pathname, ldso_info_t *ldsoinfo, char **result_file);
-static int handle_cache_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, struct stat *buf, char **localname);
 static int handle_cache_ldso(ldcs_process_data_t *procdata, char *pathname, int file_exists,
                              ldso_info_t *ldsoinfo, char **localname);
 
 
+/**
+ * The client's cwd, or the empty string before it has sent one
+ **/
+static char *client_cwd(ldcs_client_t *client)
+{
+   return client->remote_cwd ? client->remote_cwd : "";
+}
+
+/**
+ * Allocate the query buffers of a client on its first query.  The three
+ * share one block, which _ldcs_server_free_client releases.
+ **/
+static int client_query_buffers(ldcs_client_t *client)
+{
+   char *buffers;
+
+   if (client->query_filename)
+      return 0;
+   buffers = (char *) malloc(3 * MAX_PATH_LEN);
+   if (!buffers) {
+      err_printf("Could not allocate query buffers for client\n");
+      return -1;
+   }
+   client->query_filename = buffers;
+   client->query_dirname = buffers + MAX_PATH_LEN;
+   client->query_globalpath = buffers + 2 * MAX_PATH_LEN;
+   return 0;
+}
+
 /**
  * Query from client to server.  Returns info about client's rank in server data structures. 
  **/
@@ -162,7 +497,8 @@ static int handle_client_info_msg(ldcs_process_data_t *procdata, int nc, ldcs_me
 {
    ldcs_client_t *client = procdata->client_table + nc;
    if(msg->header.type == LDCS_MSG_CWD) {
-      strncpy(client->remote_cwd, msg->data, MAX_PATH_LEN);
+      free(client->remote_cwd);
+      client->remote_cwd = strdup(msg->data);
       debug_printf2("Server recvd CWD %s from %d\n", msg->data, nc);
    } 
    else if(msg->header.type == LDCS_MSG_PID) {
@@ -172,12 +508,93 @@ static int handle_client_info_msg(ldcs_process_data_t *procdata, int nc, ldcs_me
       debug_printf2("Server recvd pid %d from %d\n", mypid, nc);
    } 
    else if(msg->header.type == LDCS_MSG_LOCATION) {
-      strncpy(client->remote_location, msg->data, MAX_PATH_LEN);
+      free(client->remote_location);
+      client->remote_location = strdup(msg->data);
       debug_printf2("Server recvd location %s from %d\n", msg->data, nc);
    }
    return 0;
 }
 
+/**
+ * A client with OPT_CLIENTTIMING sends the totals of its interceptions
+ * as it finishes, as does one that gave up on queries at their
+ * SPINDLE_CLIENT_DEADLINE.  Add them to our statistics.  It wants no
+ * answer.
+ **/
+static int handle_client_timing(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   client_timing_msg_t *timing = (client_timing_msg_t *) msg->data;
+   ldcs_server_stat_entry_t *entries[CLIENT_TIMING_NUM];
+   int i;
+
+   if (msg->header.len != sizeof(client_timing_msg_t)) {
+      err_printf("Client %d sent timing message of length %ld\n", nc, (long) msg->header.len);
+      return 0;
+   }
+
+   entries[CLIENT_TIMING_OPEN] = &procdata->server_stat.client_open;
+   entries[CLIENT_TIMING_STAT] = &procdata->server_stat.client_stat;
+   entries[CLIENT_TIMING_OBJSEARCH] = &procdata->server_stat.client_objsearch;
+   entries[CLIENT_TIMING_WAIT] = &procdata->server_stat.client_wait;
+   entries[CLIENT_TIMING_FALLBACK] = &procdata->server_stat.client_fallback;
+   for (i = 0; i < CLIENT_TIMING_NUM; i++) {
+      entries[i]->cnt += (int) timing->calls[i];
+      entries[i]->time += timing->nsecs[i] / 1000000000.0;
+   }
+   debug_printf2("Client %d spent %.4fs in opens, %.4fs in stats, %.4fs in library searches, %.4fs waiting on us\n",
+                 nc, timing->nsecs[CLIENT_TIMING_OPEN] / 1000000000.0, timing->nsecs[CLIENT_TIMING_STAT] / 1000000000.0,
+                 timing->nsecs[CLIENT_TIMING_OBJSEARCH] / 1000000000.0, timing->nsecs[CLIENT_TIMING_WAIT] / 1000000000.0);
+   if (timing->calls[CLIENT_TIMING_FALLBACK])
+      debug_printf("Client %d gave up on %lu queries at their deadline, after %.4fs waiting\n", nc,
+                   (unsigned long) timing->calls[CLIENT_TIMING_FALLBACK],
+                   timing->nsecs[CLIENT_TIMING_FALLBACK] / 1000000000.0);
+   return 0;
+}
+
+#define STARTUP_DONE_UP 0      /* from a client or child, on its way to the root */
+#define STARTUP_DONE_DOWN 1    /* from the root, on its way to every server */
+
+/**
+ * A client called spindle_startup_done(), or a child passed one on.  The
+ * first one goes up to the root, which sends the word down to every
+ * server, so they all switch to background mode once.  Later ones are
+ * dropped.
+ **/
+static int handle_startup_done(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   ldcs_message_t out_msg;
+   int direction;
+
+   if (msg->header.len != sizeof(direction)) {
+      err_printf("Got startup done message of length %ld\n", (long) msg->header.len);
+      return 0;
+   }
+   memcpy(&direction, msg->data, sizeof(direction));
+
+   if (direction == STARTUP_DONE_UP && procdata->startup_done == 0 &&
+       !ldcs_audit_server_md_is_responsible(procdata, "")) {
+      debug_printf2("Passing the job's startup done up to our parent\n");
+      procdata->startup_done = 1;
+      out_msg.header.type = LDCS_MSG_STARTUP_DONE;
+      out_msg.header.len = sizeof(direction);
+      out_msg.data = (char *) &direction;
+      return ldcs_audit_server_md_forward_query(procdata, &out_msg);
+   }
+   if (procdata->startup_done == 2)
+      return 0;
+   if (direction == STARTUP_DONE_UP && procdata->startup_done == 1)
+      return 0;
+
+   debug_printf("The job's startup is done, switching to background mode\n");
+   procdata->startup_done = 2;
+   ldcs_audit_server_md_set_background(procdata);
+   direction = STARTUP_DONE_DOWN;
+   out_msg.header.type = LDCS_MSG_STARTUP_DONE;
+   out_msg.header.len = sizeof(direction);
+   out_msg.data = (char *) &direction;
+   return ldcs_audit_server_md_broadcast(procdata, &out_msg);
+}
+
 static int handle_pythonprefix_query(ldcs_process_data_t *procdata, int nc)
 {
    ldcs_message_t msg;
@@ -191,12 +608,44 @@ static int handle_pythonprefix_query(ldcs_process_data_t *procdata, int nc)
       return 0;
 
    msg.header.type = LDCS_MSG_PYTHONPREFIX_RESP;
+   msg.header.req = client->req;
    msg.header.len = strlen(procdata->pythonprefix) + 1;
    msg.data = procdata->pythonprefix;
    
    ldcs_send_msg(connid, &msg);
    procdata->server_stat.clientmsg.cnt++;
    procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, NULL);
+   return 0;
+}
+
+static int handle_relocrules_query(ldcs_process_data_t *procdata, int nc)
+{
+   ldcs_message_t msg;
+   int connid;
+   ldcs_client_t *client;
+
+   assert(nc != -1);
+   client = procdata->client_table + nc;
+   connid = client->connid;
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+      return 0;
+
+   msg.header.type = LDCS_MSG_RELOCRULES_RESP;
+   msg.header.req = client->req;
+   if (procdata->num_rules) {
+      msg.header.len = strlen(procdata->reloc_rules) + 1;
+      msg.data = procdata->reloc_rules;
+   }
+   else {
+      msg.header.len = 1;
+      msg.data = "";
+   }
+
+   ldcs_send_msg(connid, &msg);
+   procdata->server_stat.clientmsg.cnt++;
+   procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, NULL);
    return 0;
 }
 
@@ -220,6 +669,7 @@ static int handle_client_myrankinfo_msg(ldcs_process_data_t *procdata, int nc, l
 
    connid = client->connid;
    out_msg.header.type = LDCS_MSG_MYRANKINFO_QUERY_ANSWER;
+   out_msg.header.req = client->req;
    out_msg.data = buffer_out;
    out_msg.header.len = sizeof(tmpdata);
    memcpy(out_msg.data, &tmpdata, out_msg.header.len);
@@ -229,6 +679,92 @@ static int handle_client_myrankinfo_msg(ldcs_process_data_t *procdata, int nc, l
    procdata->server_stat.clientmsg.cnt++;
    procdata->server_stat.clientmsg.time+=(ldcs_get_time()-
                                                    client->query_arrival_time);
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, NULL);
+   return 0;
+}
+
+/**
+ * A new connection's pid, location and cwd, and its questions about its
+ * rank, the python prefix and the relocation rules, in one message, so a
+ * client starting up waits on one answer rather than one for each.
+ **/
+static int handle_client_hello(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   ldcs_message_t out_msg;
+   unsigned int flags;
+   int pid, rankinfo[4];
+   size_t pos, len, prefix_len = 0, rules_len = 0;
+   char *data = msg->data, *out, *rules = "";
+
+   if (msg->header.len < sizeof(pid) + sizeof(flags) + 1) {
+      err_printf("Client %d sent hello of length %ld\n", nc, (long) msg->header.len);
+      return 0;
+   }
+   memcpy(&pid, data, sizeof(pid));
+   memcpy(&flags, data + sizeof(pid), sizeof(flags));
+   pos = sizeof(pid) + sizeof(flags);
+
+   client->remote_pid = pid;
+   free(client->remote_location);
+   client->remote_location = strdup(data + pos);
+   pos += strlen(data + pos) + 1;
+   if ((flags & HELLO_CWD) && pos < msg->header.len) {
+      free(client->remote_cwd);
+      client->remote_cwd = strdup(data + pos);
+      pos += strlen(data + pos) + 1;
+   }
+   if ((flags & HELLO_STEP) && !client->step && pos + sizeof(client->step) <= msg->header.len) {
+      memcpy(&client->step, data + pos, sizeof(client->step));
+      steps_client_start(client->step);
+   }
+   debug_printf2("Server recvd hello from pid %d at %d, flags 0x%x\n", pid, nc, flags);
+
+   if (!(flags & (HELLO_RANKINFO | HELLO_PYTHONPREFIX | HELLO_RELOCRULES)))
+      return 0;
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || client->connid < 0)
+      return 0;
+
+   rankinfo[0] = nc;
+   rankinfo[1] = procdata->client_counter;
+   rankinfo[2] = procdata->md_rank;
+   rankinfo[3] = procdata->md_size;
+   len = sizeof(rankinfo);
+   if (flags & HELLO_PYTHONPREFIX) {
+      prefix_len = strlen(procdata->pythonprefix) + 1;
+      len += prefix_len;
+   }
+   if (flags & HELLO_RELOCRULES) {
+      if (procdata->num_rules)
+         rules = procdata->reloc_rules;
+      rules_len = strlen(rules) + 1;
+      len += rules_len;
+   }
+
+   out = (char *) malloc(len);
+   if (!out) {
+      err_printf("Could not allocate hello answer of %lu bytes\n", (unsigned long) len);
+      return -1;
+   }
+   memcpy(out, rankinfo, sizeof(rankinfo));
+   pos = sizeof(rankinfo);
+   if (prefix_len) {
+      memcpy(out + pos, procdata->pythonprefix, prefix_len);
+      pos += prefix_len;
+   }
+   if (rules_len)
+      memcpy(out + pos, rules, rules_len);
+
+   out_msg.header.type = LDCS_MSG_HELLO_ANSWER;
+   out_msg.header.req = client->req;
+   out_msg.header.len = len;
+   out_msg.data = out;
+   ldcs_send_msg(client->connid, &out_msg);
+   free(out);
+
+   procdata->server_stat.clientmsg.cnt++;
+   procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, NULL);
    return 0;
 }
 
@@ -267,14 +803,13 @@ static int handle_client_file_request(ldcs_process_data_t *procdata, int nc, ldc
      }
    }
 
-   parseFilenameNoAlloc(pathname, file, dir, MAX_PATH_LEN);
-
    /* do initial check of query, parse the filename and store info */
    assert(nc != -1);
    ldcs_client_t *client = procdata->client_table + nc;
-   addCWDToDir(client->remote_cwd, dir, MAX_PATH_LEN);
-   reducePath(dir);
+   canonicalizePath(client_cwd(client), pathname, file, dir, MAX_PATH_LEN);
 
+   if (client_query_buffers(client) == -1)
+      return -1;
    strncpy(client->query_filename, file, MAX_PATH_LEN);
    strncpy(client->query_dirname, dir, MAX_PATH_LEN);
    snprintf(client->query_globalpath, MAX_PATH_LEN, "%s%s/%s", 
@@ -283,8 +818,11 @@ static int handle_client_file_request(ldcs_process_data_t *procdata, int nc, ldc
    client->query_localpath = NULL;
    
    client->query_open = 1;
+   client->query_missed = 0;
    client->is_stat = is_stat;
    client->is_loader = is_loader;
+   client->is_lazy = (msg->header.type == LDCS_MSG_FILE_QUERY_LAZY);
+   client->want_fd = (msg->header.type == LDCS_MSG_FILE_QUERY_FD);
    
    debug_printf2("Server recvd query %s%s for %s.  Dir = %s, File = %s\n", 
                  is_loader ? "loader " : "",
@@ -294,123 +832,719 @@ static int handle_client_file_request(ldcs_process_data_t *procdata, int nc, ldc
 }
 
 /**
- * Inspect a directory request and decide whether it can be immediately
- * fulfilled, needs to be read, or be requested from the network.
- * Called from handlers
+ * Whether client's queries wait for the preload to finish.  A session
+ * step's new preload file only holds up the clients that connected after
+ * it came, so steps already running carry on.
  **/
-static handle_file_result_t handle_howto_directory(ldcs_process_data_t *procdata, char *dir)
+static int handle_held_for_preload(ldcs_process_data_t *procdata, ldcs_client_t *client)
 {
-   ldcs_cache_result_t cache_dir_result;
-   int responsible;
+   if (!(procdata->opts & OPT_PRELOAD) || procdata->preload_done)
+      return 0;
+   return client->settings_seen >= procdata->preload_version;
+}
 
-   cache_dir_result = ldcs_cache_findDirInCache(dir);
-   debug_printf2("Looked for dir in cache... %s\n",
-                 ldcs_cache_result_to_str(cache_dir_result));
+/**
+ * Client is telling us which libraries it will soon load.  The message holds
+ * groups of NUL-terminated candidate paths, one group per library, with an
+ * empty string ending each group.  Candidates are in the order the loader
+ * will search them.  Nothing is sent back; we just start staging the first
+ * candidate that exists, and stop early if we can't yet tell which one the
+ * loader would pick.  Requests that go up the network are combined.
+ **/
+static int handle_client_batch_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
 
-   if (cache_dir_result == LDCS_CACHE_DIR_PARSED_AND_EXISTS) {
-      /* Directory was found */
-      return FOUND_FILE;
+   if (handle_held_for_preload(procdata, client)) {
+      debug_printf3("Dropping batch query from %d until preload is complete\n", nc);
+      return 0;
    }
-   else if (cache_dir_result == LDCS_CACHE_DIR_PARSED_AND_NOT_EXISTS) {
-      return NO_FILE;
+   return handle_stage_candidates(procdata, client_cwd(client), msg->data, msg->header.len);
+}
+
+/**
+ * Start staging the first candidate that exists in each group of a batch
+ * query's list.  Relative candidates are taken from cwd.
+ **/
+static int handle_stage_candidates(ldcs_process_data_t *procdata, char *cwd, char *data, size_t len)
+{
+   char file[MAX_PATH_LEN], dir[MAX_PATH_LEN], path[MAX_PATH_LEN];
+   char *entry, *localpath;
+   size_t pos, entry_len;
+   int group_done = 0, result, global_result = 0, errcode;
+   handle_file_result_t fresult;
+
+   handle_begin_query_batch();
+   for (pos = 0; pos < len; pos += entry_len + 1) {
+      entry = data + pos;
+      entry_len = strnlen(entry, len - pos);
+      if (!entry_len) {
+         group_done = 0;
+         continue;
+      }
+      if (group_done)
+         continue;
+
+      canonicalizePath(cwd, entry, file, dir, MAX_PATH_LEN);
+      snprintf(path, MAX_PATH_LEN, "%s/%s", dir, file);
+
+      result = 0;
+      group_done = 1;
+      fresult = handle_howto_file(procdata, path, file, dir, &localpath, &errcode);
+      if (fresult == READ_DIRECTORY) {
+         result = handle_read_and_broadcast_dir(procdata, dir);
+         if (result == -1) {
+            global_result = -1;
+            continue;
+         }
+         fresult = handle_howto_file(procdata, path, file, dir, &localpath, &errcode);
+      }
+      debug_printf3("Batch query for %s\n", path);
+      switch (fresult) {
+         case FOUND_FILE:
+            break;
+         case NO_FILE:
+         case FOUND_ERRCODE:
+            group_done = 0;
+            break;
+         case READ_FILE:
+            result = handle_read_and_broadcast_file(procdata, path, request_broadcast);
+            break;
+         case REQ_DIRECTORY:
+            result = handle_send_query(procdata, dir, 1);
+            add_requestor(procdata->pending_requests, dir, NODE_PEER_CLIENT);
+            /* Fall through to next case and request file */
+         case REQ_FILE:
+            if (handle_send_query(procdata, path, 0) == -1)
+               result = -1;
+            add_requestor(procdata->pending_requests, path, NODE_PEER_CLIENT);
+            break;
+         case READ_DIRECTORY:
+            break;
+      }
+      if (result == -1)
+         global_result = -1;
    }
+   if (handle_end_query_batch(procdata) == -1)
+      global_result = -1;
 
-   /* We need to process the directory */
-   responsible = ldcs_audit_server_md_is_responsible(procdata, dir);   
-   if (responsible)
-      return READ_DIRECTORY;
-   else
-      return REQ_DIRECTORY;
+   return global_result;
 }
 
 /**
- * Inspect a file request query and decide whether it can be immediately 
- * fulfilled, needs to be read, needs a directory read, or be requested
- * from the network.
- * Called from handlers
+ * Client is asking for every file in a directory to be staged.  The
+ * message holds the directory.  Nothing is sent back; the files are
+ * staged once the directory's listing is known.
  **/
-static handle_file_result_t handle_howto_file(ldcs_process_data_t *procdata, char *pathname, char *file, char *dir,
-                                              char **localpath, int *errcode)
+static int handle_client_prefetch_dir(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
 {
-   int responsible = 0;
-   ldcs_cache_result_t cache_filedir_result;
-   handle_file_result_t dir_result;
+   ldcs_client_t *client = procdata->client_table + nc;
+   char dir[MAX_PATH_LEN];
+   prefetchdir_t *pd;
 
-   if (ldcs_is_a_localfile(pathname)) {
-      debug_printf("Recieved request for local file %s, returning err to client\n", pathname);
-      *errcode = 0;
-      return FOUND_ERRCODE;
+   if (!msg->header.len || msg->data[msg->header.len-1] != '\0') {
+      err_printf("Malformed prefetch request from client %d\n", nc);
+      return -1;
    }
-   
-   /* check directory + file */
-   cache_filedir_result = ldcs_cache_findFileDirInCache(file, dir, localpath, errcode);
-   debug_printf2("Looked for file %s in cache... %s\n",
-                 pathname, ldcs_cache_result_to_str(cache_filedir_result));
-                 
-   if(cache_filedir_result == LDCS_CACHE_FILE_FOUND) {
-      /* File was found. */
-      if (*localpath) {
-         /* File was stored locally.  Yeah. */
-         return FOUND_FILE;
+   if (handle_held_for_preload(procdata, client)) {
+      debug_printf3("Dropping prefetch request from %d until preload is complete\n", nc);
+      return 0;
+   }
+
+   canonicalizeDir(client_cwd(client), msg->data, strlen(msg->data), dir, MAX_PATH_LEN);
+   debug_printf2("Client %d asked to prefetch directory %s\n", nc, dir);
+
+   pd = (prefetchdir_t *) malloc(sizeof(*pd));
+   pd->dir = strdup(dir);
+   pd->requested = 0;
+   pd->next = prefetchdirs;
+   prefetchdirs = pd;
+
+   return handle_prefetch_dirs(procdata);
+}
+
+typedef struct {
+   char *dir;
+   char *data;
+   size_t len;
+   size_t size;
+} prefetch_list_t;
+
+static void prefetch_list_entry(char *filename, unsigned char d_type, char *localpath,
+                                size_t size, void *arg)
+{
+   prefetch_list_t *list = (prefetch_list_t *) arg;
+   size_t needed;
+
+   if (d_type == DT_DIR || localpath)
+      return;
+   needed = strlen(list->dir) + strlen(filename) + 3;
+   if (list->len + needed > list->size) {
+      list->size = (list->size + needed) * 2;
+      list->data = (char *) realloc(list->data, list->size);
+   }
+   list->len += snprintf(list->data + list->len, needed, "%s/%s", list->dir, filename) + 1;
+   list->data[list->len++] = '\0';
+}
+
+/**
+ * Stage the files of each prefetched directory whose listing is known, and
+ * ask for the listings that are not.  Staging calls back into
+ * handle_progress, so this guards against running inside itself.
+ **/
+static int handle_prefetch_dirs(ldcs_process_data_t *procdata)
+{
+   static int prefetching = 0;
+   prefetchdir_t **ppd, *pd;
+   prefetch_list_t list;
+   handle_file_result_t dresult;
+   int result, global_result = 0;
+
+   if (prefetching)
+      return 0;
+   prefetching = 1;
+
+   ppd = &prefetchdirs;
+   while ((pd = *ppd) != NULL) {
+      dresult = handle_howto_directory(procdata, pd->dir);
+      if (dresult == READ_DIRECTORY) {
+         if (handle_read_and_broadcast_dir(procdata, pd->dir) == -1)
+            global_result = -1;
+         dresult = handle_howto_directory(procdata, pd->dir);
       }
-      if (*errcode) {
-         /* An errcode associated with reading this file was stored locally.  Less yeah. */
-         return FOUND_ERRCODE;
+      if (dresult == REQ_DIRECTORY || dresult == READ_DIRECTORY) {
+         if (!pd->requested && dresult == REQ_DIRECTORY) {
+            if (handle_send_query(procdata, pd->dir, 1) == -1)
+               global_result = -1;
+            add_requestor(procdata->pending_requests, pd->dir, NODE_PEER_CLIENT);
+            pd->requested = 1;
+         }
+         ppd = &pd->next;
+         continue;
       }
 
-      /* File exists, but isn't present.  Read or request. */
-      responsible = ldcs_audit_server_md_is_responsible(procdata, pathname);
-      if (responsible)
-         return READ_FILE;
-      else
-         return REQ_FILE;
+      *ppd = pd->next;
+      if (dresult == FOUND_FILE && ldcs_cache_isSparseDir(pd->dir))
+         debug_printf2("Not prefetching sparse directory %s\n", pd->dir);
+      else if (dresult == FOUND_FILE) {
+         list.dir = pd->dir;
+         list.data = NULL;
+         list.len = list.size = 0;
+         ldcs_cache_foreachEntryInDir(pd->dir, prefetch_list_entry, &list);
+         debug_printf2("Prefetching %lu bytes of paths from %s\n", (unsigned long) list.len, pd->dir);
+         if (list.len) {
+            result = handle_stage_candidates(procdata, "", list.data, list.len);
+            if (result == -1)
+               global_result = -1;
+         }
+         free(list.data);
+      }
+      free(pd->dir);
+      free(pd);
    }
 
-   /* File wasn't found.  Check state of directory */
-   dir_result = handle_howto_directory(procdata, dir);
-   if (dir_result == FOUND_FILE) {
-      /* Directory was found, but file wasn't.  File doesn't exist. */
-      return NO_FILE;
-   }
-   if (dir_result == NO_FILE) {
-      /* Directory doesn't exist */
-      return NO_FILE;
-   }
-   /* Do whatever is needed to load the directory */
-   return dir_result;
+   prefetching = 0;
+   return global_result;
 }
 
 /**
- * Check whether a client can make progress on any pending operations.
+ * Client is asking which of a list of candidate paths the loader would
+ * open for a library, and for that file.  The message holds the
+ * NUL-terminated candidates in search order.  A last candidate without a
+ * '/' is the bare library name, and stands for the loader's ld.so.cache.
+ * We look at them one at a time as their directories arrive in the
+ * cache, and answer once for the first that exists, so the client doesn't
+ * send a query per candidate.
+ *
+ * Without is_ldso, as for a LDCS_MSG_FILE_QUERY_FIRST from the python
+ * importer, the candidates are plain paths and the first that exists wins.
  **/
-static int handle_client_progress(ldcs_process_data_t *procdata, int nc)
+static int handle_client_search_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg, int is_ldso)
 {
-   handle_file_result_t result;
-   int read_result, broadcast_result, client_result, errcode;
+   char *list;
 
-   ldcs_client_t *client = procdata->client_table + nc;
-   if ((procdata->opts & OPT_PRELOAD) && !procdata->preload_done) {
-      /* Postpone client requests until preload is complete */
-     debug_printf3("Postpone client requests until preload is complete\n");
-      return 0;
+   if (!msg->header.len || msg->data[msg->header.len - 1] != '\0') {
+      err_printf("Malformed search query from client %d\n", nc);
+      return handle_client_rejected_query(procdata, nc, EINVAL);
    }
-   if (!client->query_open)
-      return 0;
-   if (client->existance_query)
-      return handle_fileexist_test(procdata, nc);
-   if (client->is_stat || client->is_loader)
-      return handle_client_metadata(procdata, nc);
 
-   result = handle_howto_file(procdata, client->query_globalpath, client->query_filename,
-                              client->query_dirname, &client->query_localpath, &errcode);
-   switch (result) {
+   list = (char *) malloc(msg->header.len);
+   if (!list) {
+      err_printf("Could not allocate search list for client %d\n", nc);
+      return -1;
+   }
+   memcpy(list, msg->data, msg->header.len);
+   return handle_begin_search(procdata, nc, list, msg->header.len, is_ldso, 0, NULL);
+}
+
+/**
+ * Client is exec'ing a name without a '/', and asks which entry of its
+ * PATH the shell would run it from.  The message is [name][PATH], and we
+ * search PATH's entries in order, an empty one standing for the cwd, as
+ * we would a LDCS_MSG_FILE_QUERY_FIRST list.  Candidates we can't read,
+ * such as directories, are passed over, and if there are any and no
+ * file, the answer is EACCES like execvp's.  The client still checks the
+ * execute bits of what we find.
+ *
+ * Shells exec the same few utilities over and over, so when PATH is all
+ * absolute we remember where each name was found and go straight there
+ * the next time, or answer straight away if it wasn't.
+ **/
+static int handle_client_exec_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   char *name, *path, *entry, *end, *list, *key;
+   size_t namelen, pathlen, entrylen, len;
+   int absolute = 1;
+   const char *interned = NULL;
+
+   name = msg->data;
+   namelen = msg->header.len ? strnlen(name, msg->header.len) : 0;
+   if (!namelen || namelen + 1 >= (size_t) msg->header.len || strchr(name, '/') ||
+       msg->data[msg->header.len - 1] != '\0') {
+      err_printf("Malformed exec query from client %d\n", nc);
+      return handle_client_rejected_query(procdata, nc, EINVAL);
+   }
+   path = name + namelen + 1;
+   pathlen = strlen(path);
+
+   /* Each entry becomes entry/name, with "." for an empty entry */
+   len = 0;
+   for (entry = path; ; entry = end + 1) {
+      end = strchr(entry, ':');
+      if (!end)
+         end = entry + strlen(entry);
+      entrylen = end - entry;
+      len += (entrylen ? entrylen : 1) + 1 + namelen + 1;
+      if (!entrylen || *entry != '/')
+         absolute = 0;
+      if (!*end)
+         break;
+   }
+   list = (char *) malloc(len);
+   if (!list) {
+      err_printf("Could not allocate exec search list for client %d\n", nc);
+      return -1;
+   }
+   len = 0;
+   for (entry = path; ; entry = end + 1) {
+      end = strchr(entry, ':');
+      if (!end)
+         end = entry + strlen(entry);
+      entrylen = end - entry;
+      if (entrylen)
+         len += sprintf(list + len, "%.*s/%s", (int) entrylen, entry, name) + 1;
+      else
+         len += sprintf(list + len, "./%s", name) + 1;
+      if (!*end)
+         break;
+   }
+
+   if (absolute) {
+      key = (char *) malloc(namelen + 1 + pathlen + 1);
+      if (key) {
+         sprintf(key, "%s/%s", name, path);
+         interned = intern_name(key);
+         free(key);
+      }
+   }
+   debug_printf2("Server recvd exec query from %d for %s\n", nc, name);
+   procdata->server_stat.execsearch.cnt++;
+   return handle_begin_search(procdata, nc, list, (int) len, 0, 1, interned);
+}
+
+/**
+ * Start a client's search through the len bytes of NUL-terminated
+ * candidates in list, which it takes.  An exec search with a key starts
+ * from how the same search came out before.
+ **/
+static int handle_begin_search(ldcs_process_data_t *procdata, int nc, char *list, int len, int is_ldso,
+                               int is_exec, const char *key)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   exec_search_t *es = NULL;
+   int search_result;
+
+   if (client_query_buffers(client) == -1) {
+      free(list);
+      return -1;
+   }
+
+   free(client->search_list);
+   client->search_list = list;
+   client->search_len = len;
+   client->search_pos = -1;
+   client->search_index = -1;
+   client->search_cached = 0;
+   client->search_ldso = is_ldso;
+   client->search_exec = is_exec;
+   client->search_denied = 0;
+   client->search_key = key;
+
+   client->query_open = 1;
+   client->query_missed = 0;
+   client->is_search = 1;
+   client->existance_query = 0;
+   client->dir_query = 0;
+   client->link_query = 0;
+   client->is_stat = 0;
+   client->is_loader = 0;
+   client->is_lazy = 0;
+   client->want_fd = 0;
+
+   if (key) {
+      for (es = exec_searches[intern_name_hash(key) % EXEC_SEARCH_TABLE_SIZE]; es; es = es->next) {
+         if (es->key == key)
+            break;
+      }
+   }
+   if (es && es->index == -1) {
+      debug_printf2("Exec search %s failed before with errcode %d\n", key, es->errcode);
+      procdata->server_stat.execsearch_hit.cnt++;
+      client->search_key = NULL;
+      return handle_client_rejected_query(procdata, nc, es->errcode);
+   }
+   if (es)
+      procdata->server_stat.execsearch_hit.cnt++;
+
+   do {
+      search_result = handle_search_next(client);
+      if (search_result)
+         return handle_client_rejected_query(procdata, nc, search_result);
+   } while (es && client->search_index < es->index);
+
+   debug_printf2("Server recvd search query from %d starting at %s\n", nc, client->query_globalpath);
+   return handle_client_progress(procdata, nc);
+}
+
+/**
+ * Remember how the client's exec search came out, if that's what it was
+ * answered for and it had a key.  An errcode of 0 means it found the file
+ * at its current candidate.
+ **/
+static void handle_remember_exec_search(ldcs_client_t *client, int errcode)
+{
+   exec_search_t *es;
+   unsigned int bucket;
+   const char *key = client->search_key;
+
+   client->search_key = NULL;
+   if (!key || !client->is_search || (errcode && errcode != ENOENT && errcode != EACCES))
+      return;
+
+   bucket = intern_name_hash(key) % EXEC_SEARCH_TABLE_SIZE;
+   for (es = exec_searches[bucket]; es; es = es->next) {
+      if (es->key == key)
+         break;
+   }
+   if (!es) {
+      es = (exec_search_t *) malloc(sizeof(exec_search_t));
+      if (!es)
+         return;
+      es->key = key;
+      es->next = exec_searches[bucket];
+      exec_searches[bucket] = es;
+   }
+   es->index = errcode ? -1 : client->search_index;
+   es->errcode = errcode;
+}
+
+/**
+ * Forget every exec search, when files may have come or gone
+ **/
+static void handle_forget_exec_searches()
+{
+   exec_search_t *es, *next;
+   int i;
+
+   for (i = 0; i < EXEC_SEARCH_TABLE_SIZE; i++) {
+      for (es = exec_searches[i]; es; es = next) {
+         next = es->next;
+         free(es);
+      }
+      exec_searches[i] = NULL;
+   }
+}
+
+/**
+ * Point a search query at its next candidate.  Returns 0 on success, or
+ * the errcode to answer the client with: ENOENT if there are no more, or
+ * EAGAIN if we can't tell what the loader would try next.
+ **/
+static int handle_search_next(ldcs_client_t *client)
+{
+   char *candidate;
+   const char *cached;
+
+   if (client->search_cached)
+      return ENOENT;
+
+   do {
+      if (client->search_pos == -1)
+         client->search_pos = 0;
+      else
+         client->search_pos += strlen(client->search_list + client->search_pos) + 1;
+      client->search_index++;
+      if (client->search_pos >= client->search_len)
+         return client->search_denied ? EACCES : ENOENT;
+      candidate = client->search_list + client->search_pos;
+   } while (*candidate == '\0');
+
+   if (client->search_ldso && !strchr(candidate, '/')) {
+      /* The loader would look in its ld.so.cache.  If that fails, it goes
+         on to default dirs that we don't know, so the client does that. */
+      switch (ldcache_lookup(candidate, &cached)) {
+         case LDCACHE_FOUND:
+            debug_printf3("ld.so cache maps %s to %s\n", candidate, cached);
+            client->search_cached = 1;
+            candidate = (char *) cached;
+            break;
+         case LDCACHE_MISSING:
+            return ENOENT;
+         case LDCACHE_UNKNOWN:
+            return EAGAIN;
+      }
+   }
+
+   client->query_filename[0] = '\0';
+   client->query_dirname[0] = '\0';
+   canonicalizePath(client_cwd(client), candidate, client->query_filename, client->query_dirname, MAX_PATH_LEN);
+   snprintf(client->query_globalpath, MAX_PATH_LEN, "%s/%s", client->query_dirname, client->query_filename);
+   client->query_localpath = NULL;
+   return 0;
+}
+
+/* Subdirectories of a search directory that the loader may look in first,
+   for builds tuned to the CPU */
+static const char *ldso_subdirs[] = { "glibc-hwcaps", "tls", "haswell", "xeon_phi", "x86_64",
+                                      "power8", "power9", "power10", NULL };
+
+/**
+ * Returns true if dir has a subdirectory where the loader might find a
+ * library before dir itself.  We don't know which of them the client's
+ * loader would use, so searches through such a dir are left to the client.
+ **/
+static int handle_search_dir_has_subdirs(char *dir)
+{
+   char *localpath;
+   int errcode, i;
+
+   for (i = 0; ldso_subdirs[i]; i++) {
+      if (ldcs_cache_findFileDirInCache((char *) ldso_subdirs[i], dir, &localpath, &errcode) == LDCS_CACHE_FILE_FOUND)
+         return 1;
+   }
+   return 0;
+}
+
+/**
+ * Inspect a directory request and decide whether it can be immediately
+ * fulfilled, needs to be read, or be requested from the network.
+ * Called from handlers
+ **/
+static handle_file_result_t handle_howto_directory(ldcs_process_data_t *procdata, char *dir)
+{
+   ldcs_cache_result_t cache_dir_result;
+   int responsible;
+
+   cache_dir_result = ldcs_cache_findDirInCache(dir);
+   debug_printf2("Looked for dir in cache... %s\n",
+                 ldcs_cache_result_to_str(cache_dir_result));
+
+   if (cache_dir_result == LDCS_CACHE_DIR_PARSED_AND_EXISTS) {
+      /* Directory was found */
+      return FOUND_FILE;
+   }
+   else if (cache_dir_result == LDCS_CACHE_DIR_PARSED_AND_NOT_EXISTS) {
+      return NO_FILE;
+   }
+
+   /* We need to process the directory */
+   responsible = ldcs_audit_server_md_is_reader(procdata, dir);
+   if (responsible)
+      return READ_DIRECTORY;
+   else
+      return REQ_DIRECTORY;
+}
+
+/**
+ * Inspect a file request query and decide whether it can be immediately 
+ * fulfilled, needs to be read, needs a directory read, or be requested
+ * from the network.
+ * Called from handlers
+ **/
+/**
+ * With --local-bypass, a file on one of this node's own file systems is
+ * left for the client to open in place, unless a rule relocates it.
+ **/
+static int handle_is_node_local(ldcs_process_data_t *procdata, char *pathname)
+{
+   if (!(procdata->opts & OPT_LOCALBYPASS))
+      return 0;
+   if (procdata->num_rules &&
+       reloc_rules_match(procdata->rules, procdata->num_rules, pathname, -1) != reloc_none)
+      return 0;
+   return localfs_is_local(pathname);
+}
+
+static handle_file_result_t handle_howto_file(ldcs_process_data_t *procdata, char *pathname, char *file, char *dir,
+                                              char **localpath, int *errcode)
+{
+   int responsible = 0, filter_result;
+   ldcs_cache_result_t cache_filedir_result;
+   handle_file_result_t dir_result;
+
+   if (ldcs_is_a_localfile(pathname)) {
+      debug_printf("Recieved request for local file %s, returning err to client\n", pathname);
+      *errcode = 0;
+      return FOUND_ERRCODE;
+   }
+
+   if (handle_is_node_local(procdata, pathname)) {
+      debug_printf2("%s is on a node-local file system, returning err to client\n", pathname);
+      procdata->server_stat.localfs.cnt++;
+      *errcode = 0;
+      return FOUND_ERRCODE;
+   }
+
+   /* A file being read on a reader thread is waited on like a network request */
+   if (async_reads && handle_read_in_flight(pathname)) {
+      *localpath = NULL;
+      return REQ_FILE;
+   }
+
+   /* The directory's bloom filter can prove a miss without a cache lookup */
+   filter_result = ldcs_cache_dirFilterCheck(file, dir);
+   if (filter_result == 0) {
+      debug_printf2("Directory filter for %s rules out %s\n", dir, file);
+      procdata->server_stat.dirfilter_hit.cnt++;
+      *localpath = NULL;
+      return NO_FILE;
+   }
+   
+   /* check directory + file */
+   cache_filedir_result = ldcs_cache_findFileDirInCache(file, dir, localpath, errcode);
+   debug_printf2("Looked for file %s in cache... %s\n",
+                 pathname, ldcs_cache_result_to_str(cache_filedir_result));
+                 
+   if(cache_filedir_result == LDCS_CACHE_FILE_FOUND) {
+      /* File was found. */
+      if (*localpath) {
+         /* File was stored locally.  Yeah. */
+         return FOUND_FILE;
+      }
+      if (*errcode) {
+         /* An errcode associated with reading this file was stored locally.  Less yeah. */
+         return FOUND_ERRCODE;
+      }
+
+      /* File exists, but isn't present.  Read or request. */
+      responsible = ldcs_audit_server_md_is_reader(procdata, dir);
+      if (responsible || handle_in_rack_cache(procdata, pathname))
+         return READ_FILE;
+      else
+         return REQ_FILE;
+   }
+
+   /* File wasn't found.  Check state of directory */
+   dir_result = handle_howto_directory(procdata, dir);
+   if (dir_result == FOUND_FILE && ldcs_cache_isSparseDir(dir)) {
+      /* The filter couldn't rule it out, so look this one name up.  Reading
+         a file that isn't there caches and broadcasts ENOENT. */
+      debug_printf2("Looking up %s in sparse directory %s\n", file, dir);
+      responsible = ldcs_audit_server_md_is_reader(procdata, dir);
+      return (responsible || handle_in_rack_cache(procdata, pathname)) ? READ_FILE : REQ_FILE;
+   }
+   if (dir_result == FOUND_FILE) {
+      /* Directory was found, but file wasn't.  File doesn't exist. */
+      if (filter_result == 1)
+         procdata->server_stat.dirfilter_miss.cnt++;
+      return NO_FILE;
+   }
+   if (dir_result == NO_FILE) {
+      /* Directory doesn't exist */
+      return NO_FILE;
+   }
+   /* Do whatever is needed to load the directory */
+   return dir_result;
+}
+
+/**
+ * Check whether a client can make progress on any pending operations.
+ **/
+static int handle_client_progress(ldcs_process_data_t *procdata, int nc)
+{
+   handle_file_result_t result;
+   int read_result, broadcast_result, client_result, errcode, search_result;
+
+   ldcs_client_t *client = procdata->client_table + nc;
+   lazy_file_t *lf;
+   size_t first, last;
+
+   client->wait_path = NULL;
+   if (handle_held_for_preload(procdata, client)) {
+      /* Postpone client requests until preload is complete */
+     debug_printf3("Postpone client requests until preload is complete\n");
+      return 0;
+   }
+   if (client->range_open)
+      return handle_client_range_progress(procdata, nc);
+   if (!client->query_open)
+      return 0;
+   if (client->jit_query)
+      return handle_jit_test(procdata, nc);
+   if (client->existance_query)
+      return handle_fileexist_test(procdata, nc);
+   if (client->dir_query)
+      return handle_dirlist_test(procdata, nc);
+   if (client->link_query)
+      return handle_resolve_test(procdata, nc);
+   if (client->is_stat || client->is_loader)
+      return handle_client_metadata(procdata, nc);
+
+   result = handle_howto_file(procdata, client->query_globalpath, client->query_filename,
+                              client->query_dirname, &client->query_localpath, &errcode);
+   while (client->is_search && result != READ_DIRECTORY && result != REQ_DIRECTORY) {
+      /* The candidate's directory is in the cache.  The loader doesn't
+         look in subdirectories of what ld.so.cache names. */
+      if (client->search_ldso && !client->search_cached &&
+          handle_search_dir_has_subdirs(client->query_dirname)) {
+         debug_printf2("Leaving search through %s to the client\n", client->query_dirname);
+         return handle_client_rejected_query(procdata, nc, EAGAIN);
+      }
+      if (result == FOUND_ERRCODE && !errcode) {
+         /* A candidate the client opens in place, so it searches itself */
+         debug_printf2("Leaving search through %s to the client\n", client->query_dirname);
+         return handle_client_rejected_query(procdata, nc, EAGAIN);
+      }
+      if (result != NO_FILE && result != FOUND_ERRCODE)
+         break;
+      if (result == FOUND_ERRCODE && client->search_exec)
+         client->search_denied = 1;
+      search_result = handle_search_next(client);
+      if (search_result)
+         return handle_client_rejected_query(procdata, nc, search_result);
+      result = handle_howto_file(procdata, client->query_globalpath, client->query_filename,
+                                 client->query_dirname, &client->query_localpath, &errcode);
+   }
+   switch (result) {
       case FOUND_FILE:
+         lf = (procdata->opts & OPT_LAZYFETCH) ? lazy_find_file(client->query_globalpath) : NULL;
+         if (lf && !client->is_lazy && !lazy_is_complete(lf)) {
+            /* This client can't fetch ranges, so it waits for the whole file */
+            lazy_range_extents(lf, 0, lazy_file_size(lf), &first, &last);
+            if (handle_lazy_fetch(procdata, lf, first, last) == -1)
+               return handle_client_rejected_query(procdata, nc, EIO);
+            if (!lazy_is_complete(lf))
+               return 0;
+         }
          return handle_client_fulfilled_query(procdata, nc);
       case NO_FILE:
+         namesnap_publish(procdata, client->query_globalpath, NULL, ENOENT);
          return handle_client_rejected_query(procdata, nc, ENOENT);         
       case FOUND_ERRCODE:
+         namesnap_publish(procdata, client->query_globalpath, NULL, errcode);
          return handle_client_rejected_query(procdata, nc, errcode);
       case READ_DIRECTORY:
+         client->query_missed = 1;
          read_result = handle_read_directory(procdata, client->query_dirname);
          if (read_result == -1)
             return -1; 
@@ -418,24 +1552,102 @@ static int handle_client_progress(ldcs_process_data_t *procdata, int nc)
          client_result = handle_client_progress(procdata, nc);
          return (client_result == -1 || broadcast_result == -1) ? -1 : 0;
       case READ_FILE:
+         client->query_missed = 1;
          read_result = handle_read_and_broadcast_file(procdata, client->query_globalpath, request_broadcast);
          if (read_result == -1)
             return -1;
          client_result = handle_client_progress(procdata, nc);
          return (client_result == -1 || read_result == -1) ? -1 : 0;
       case REQ_DIRECTORY:
+         client->query_missed = 1;
          client_result = handle_send_query(procdata, client->query_dirname, 1);
          add_requestor(procdata->pending_requests, client->query_dirname, NODE_PEER_CLIENT);
+         if (handle_wait_on(nc, client, client->query_dirname) == -1)
+            client_result = -1;
          return client_result;
       case REQ_FILE:
+         client->query_missed = 1;
          client_result = handle_send_query(procdata, client->query_globalpath, 0);
          add_requestor(procdata->pending_requests, client->query_globalpath, NODE_PEER_CLIENT);
+         if (handle_wait_on(nc, client, client->query_globalpath) == -1)
+            client_result = -1;
          return client_result;
    }
    assert(0);
    return -1;
 }
 
+/**
+ * Put client nc on the wait queue of a path it requested.
+ **/
+static int handle_wait_on(int nc, ldcs_client_t *client, const char *pathname)
+{
+   wait_queue_t *wq;
+   unsigned int bucket;
+   const char *path;
+   int i;
+
+   path = intern_name(pathname);
+   if (!path)
+      return -1;
+   client->wait_path = path;
+
+   bucket = intern_name_hash(path) % WAIT_QUEUE_TABLE_SIZE;
+   for (wq = wait_queues[bucket]; wq; wq = wq->next) {
+      if (wq->path == path)
+         break;
+   }
+   if (!wq) {
+      wq = (wait_queue_t *) calloc(1, sizeof(wait_queue_t));
+      if (!wq) {
+         err_printf("Could not allocate wait queue for %s\n", path);
+         return -1;
+      }
+      wq->path = path;
+      wq->next = wait_queues[bucket];
+      wait_queues[bucket] = wq;
+   }
+
+   for (i = 0; i < wq->num_clients; i++) {
+      if (wq->clients[i] == nc)
+         return 0;
+   }
+   if (wq->num_clients == wq->clients_size) {
+      int newsize = wq->clients_size ? wq->clients_size * 2 : 4;
+      int *newclients = (int *) realloc(wq->clients, newsize * sizeof(int));
+      if (!newclients) {
+         err_printf("Could not grow wait queue for %s\n", path);
+         return -1;
+      }
+      wq->clients = newclients;
+      wq->clients_size = newsize;
+   }
+   wq->clients[wq->num_clients++] = nc;
+   return 0;
+}
+
+/**
+ * Take the wait queue of pathname off the table, or NULL if nobody
+ * waits on it.  The caller frees it.
+ **/
+static wait_queue_t *handle_take_wait_queue(const char *pathname)
+{
+   wait_queue_t *wq, **prev;
+   const char *path;
+
+   path = lookup_intern_name(pathname);
+   if (!path)
+      return NULL;
+   prev = wait_queues + (intern_name_hash(path) % WAIT_QUEUE_TABLE_SIZE);
+   for (wq = *prev; wq; prev = &wq->next, wq = wq->next) {
+      if (wq->path == path) {
+         *prev = wq->next;
+         return wq;
+      }
+   }
+   return NULL;
+}
+
 /**
  * Handle client file requests for all clients.
  **/
@@ -450,6 +1662,52 @@ static int handle_progress(ldcs_process_data_t *procdata)
       if (result == -1)
          global_result = -1;
    }
+   if (prefetchdirs && handle_prefetch_dirs(procdata) == -1)
+      global_result = -1;
+   return global_result;
+}
+
+/**
+ * Handle client file requests after pathname arrived.  Clients waiting on
+ * a requested file or directory only progress when it's theirs, so only
+ * they and clients blocked on something else are looked at.
+ **/
+static int handle_progress_path(ldcs_process_data_t *procdata, const char *pathname)
+{
+   int global_result = 0, result, nc, i;
+   wait_queue_t *wq;
+
+   /* Progressing a client can land back here, so the queue is taken off
+      the table first */
+   wq = handle_take_wait_queue(pathname);
+   if (wq) {
+      for (i = 0; i < wq->num_clients; i++) {
+         nc = wq->clients[i];
+         ldcs_client_t *client = procdata->client_table + nc;
+         if (nc >= procdata->client_table_used || client->wait_path != wq->path)
+            continue;
+         if (client->state == LDCS_CLIENT_STATUS_FREE || client->state == LDCS_CLIENT_STATUS_ACTIVE_PSEUDO)
+            continue;
+         result = handle_client_progress(procdata, nc);
+         if (result == -1)
+            global_result = -1;
+      }
+      free(wq->clients);
+      free(wq);
+   }
+
+   for (nc = 0; nc < procdata->client_table_used; nc++) {
+      ldcs_client_t *client = procdata->client_table + nc;
+      if (client->state == LDCS_CLIENT_STATUS_FREE || client->state == LDCS_CLIENT_STATUS_ACTIVE_PSEUDO)
+         continue;
+      if (client->wait_path)
+         continue;
+      result = handle_client_progress(procdata, nc);
+      if (result == -1)
+         global_result = -1;
+   }
+   if (prefetchdirs && handle_prefetch_dirs(procdata) == -1)
+      global_result = -1;
    return global_result;
 }
 
@@ -471,7 +1729,15 @@ static int handle_read_directory(ldcs_process_data_t *procdata, char *dir)
    /* process directory */
    starttime = ldcs_get_time();
    debug_printf2("Reading directory: %s\n", dir );
-   cache_dir_result = ldcs_cache_processDirectory(dir, &rc);
+   if (pycompile_is_candidate(procdata, dir))
+      cache_dir_result = pycompile_process_directory(procdata, dir, &rc);
+   else {
+      cache_dir_result = ldcs_cache_processDirectory(dir, &rc);
+      /* Compiled .pyc files aren't on disk, so a __pycache__ listing can't be rechecked */
+      if ((procdata->opts & OPT_REVALIDATE) && cache_dir_result == LDCS_CACHE_DIR_PARSED_AND_EXISTS)
+         revalidate_track(dir, 1);
+   }
+   filemngt_count_fsop(FSOP_READDIR, rc);
    procdata->server_stat.procdir.cnt++;
    procdata->server_stat.procdir.bytes += rc;
    procdata->server_stat.procdir.time += (ldcs_get_time() - starttime);
@@ -551,6 +1817,7 @@ static void *handle_setup_file_buffer(ldcs_process_data_t *procdata, char *pathn
    void *buffer;
    int result;
    char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+   char *alias;
    ldcs_cache_result_t cresult;
    double starttime;
    int errcode = 0;
@@ -583,12 +1850,26 @@ static void *handle_setup_file_buffer(ldcs_process_data_t *procdata, char *pathn
       assert(0);
    }
 
+   /**
+    * Make room under the staging budget before adding this file.
+    **/
+   if (procdata->cache_budget) {
+      starttime = ldcs_get_time();
+      ldcs_cache_makeRoom(size, handle_evict_file, procdata);
+      procdata->server_stat.evict.time += (ldcs_get_time()-starttime);
+   }
+
    /**
     * Set up mapped memory for on the local disk for storing the file.
     **/
-   *localname = filemngt_calc_localname(pathname);
+   *localname = filemngt_calc_file_localname(pathname, size);
    assert(*localname);
    add_global_name(pathname, *localname);
+   alias = filemngt_memfd_alias(*localname);
+   if (alias) {
+      /* What a readlink of /proc/self/exe shows for a memfd */
+      add_global_name(pathname, alias);
+   }
 
    starttime = ldcs_get_time();
    result = filemngt_create_file_space(*localname, size, &buffer, fd);
@@ -605,6 +1886,139 @@ static void *handle_setup_file_buffer(ldcs_process_data_t *procdata, char *pathn
    return buffer;
 }
 
+/**
+ * Called by ldcs_cache_makeRoom for each staged file it evicts.  The
+ * localpath string stays owned by the cache, since clients may have
+ * been handed a copy of it in the past.
+ **/
+static void handle_evict_file(char *localpath, void *buffer, size_t size, void *arg)
+{
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) arg;
+
+   debug_printf2("Evicting staged file %s\n", localpath);
+   remove_global_name(localpath);
+   if (procdata->opts & OPT_NUMA)
+      numa_evict(localpath);
+   ldcs_audit_server_md_release_buffer(buffer, size);
+   filemngt_evict_file(localpath, buffer, size);
+   procdata->server_stat.evict.cnt++;
+   procdata->server_stat.evict.bytes += size;
+}
+
+/**
+ * With OPT_VERIFY, the checksum sent with a file's contents.  It's taken
+ * once, when the file is read or received, and remembered after that.
+ **/
+static uint32_t handle_file_crc(ldcs_process_data_t *procdata, char *pathname, void *buffer, size_t size)
+{
+   uint32_t crc;
+   double starttime;
+
+   if (crc_lookup(pathname, &crc) == 0)
+      return crc;
+   starttime = ldcs_get_time();
+   crc = crc32c(buffer, size);
+   crc_record(pathname, crc);
+   procdata->server_stat.verify.cnt++;
+   procdata->server_stat.verify.bytes += size;
+   procdata->server_stat.verify.time += ldcs_get_time() - starttime;
+   return crc;
+}
+
+/**
+ * Check a file we just received and staged against the checksum that came
+ * with it.  A copy that doesn't match is dropped and asked for again, and
+ * 1 is returned so the caller doesn't pass it on.
+ **/
+static int handle_verify_received(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                  size_t size, uint32_t crc)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   void *buffer;
+   size_t buffer_size;
+   uint32_t actual;
+   double starttime;
+
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_get_buffer(dirname, filename, &buffer, &buffer_size) == -1 || !buffer)
+      return 0;
+
+   starttime = ldcs_get_time();
+   actual = crc32c(buffer, size);
+   procdata->server_stat.verify.cnt++;
+   procdata->server_stat.verify.bytes += size;
+   procdata->server_stat.verify.time += ldcs_get_time() - starttime;
+   if (actual == crc) {
+      crc_record(pathname, crc);
+      return 0;
+   }
+
+   err_printf("Contents of %s from our parent have checksum %08x rather than %08x, asking for them again\n",
+              pathname, actual, crc);
+   handle_drop_corrupt_file(procdata, pathname, localname, buffer, buffer_size);
+   if (handle_send_file_query(procdata, pathname) == -1)
+      return -1;
+   return 1;
+}
+
+/**
+ * Check a staged copy against its checksum before it's sent on again.  A
+ * copy that was truncated, which reading through the mapping would fault
+ * on, or changed is dropped, and 1 is returned so the caller reads or asks
+ * for the file again rather than passing the damage on.
+ **/
+static int handle_verify_staged(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                void *buffer, size_t size)
+{
+   struct stat buf;
+   uint32_t expected, actual = 0;
+   double starttime;
+   int truncated;
+
+   if (!localname || !buffer || crc_lookup(pathname, &expected) == -1)
+      return 0;
+
+   starttime = ldcs_get_time();
+   truncated = (stat(localname, &buf) == -1 || (size_t) buf.st_size < size);
+   if (!truncated)
+      actual = crc32c(buffer, size);
+   procdata->server_stat.verify.cnt++;
+   procdata->server_stat.verify.bytes += size;
+   procdata->server_stat.verify.time += ldcs_get_time() - starttime;
+   if (!truncated && actual == expected)
+      return 0;
+
+   if (truncated)
+      err_printf("Staged copy of %s at %s was truncated, reading it again\n", pathname, localname);
+   else
+      err_printf("Staged copy of %s at %s has checksum %08x rather than %08x, reading it again\n",
+                 pathname, localname, actual, expected);
+   handle_drop_corrupt_file(procdata, pathname, localname, buffer, size);
+   return 1;
+}
+
+/**
+ * Throw away a staged copy that failed its check.  The cache entry goes
+ * back to a file that exists but isn't staged here, so the next request
+ * for it reads it or asks for it again.
+ **/
+static void handle_drop_corrupt_file(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                     void *buffer, size_t size)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+
+   procdata->server_stat.verify_bad.cnt++;
+   procdata->server_stat.verify_bad.bytes += size;
+   remove_global_name(localname);
+   if (procdata->opts & OPT_NUMA)
+      numa_evict(localname);
+   ldcs_audit_server_md_release_buffer(buffer, size);
+   filemngt_evict_file(localname, buffer, size);
+   crc_forget(pathname);
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   ldcs_cache_updateEntry(filename, dirname, NULL, NULL, 0, 0);
+}
+
 /**
  * Finalize a buffer that a file has just been written into.
  **/
@@ -632,6 +2046,9 @@ static int handle_finish_buffer_setup(ldcs_process_data_t *procdata, char *local
       newbuffer = filemngt_sync_file_space(buffer, *fd, localname, size, newsize);
       if (newbuffer == NULL)
          return -1;
+      /* Subaudit clients patch bindings from the map instead of parsing the file */
+      if (procdata->opts & OPT_SUBAUDIT)
+         filemngt_write_pltmap(localname, newbuffer, newsize);
    }
    procdata->server_stat.libstore.time += (ldcs_get_time() - starttime);      
 
@@ -646,1022 +2063,5329 @@ static int handle_finish_buffer_setup(ldcs_process_data_t *procdata, char *local
 }
 
 /**
- * Reads a file contents off disk and put into the file cache.  Distribute file
- * on network if necessary.
+ * Look up a file's size and set up the buffer it will be read into.  If the
+ * file can't be read, rd->errcode is set and rd->buffer is left NULL.  The
+ * cache entry is pinned until handle_finish_file_read, so a budget eviction
+ * can't take the buffer away while a batch is being read.
  **/
-static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *pathname,
-                                          broadcast_t bcast)
+static int handle_start_file_read(ldcs_process_data_t *procdata, char *pathname, file_read_t *rd)
 {
    double starttime;
-   char *buffer = NULL, *localname = NULL;
-   size_t size, newsize;
-   int result, global_result = 0, already_loaded;
-   int fd = -1;
-   int errcode = 0;
+   int already_loaded;
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+
+   memset(rd, 0, sizeof(*rd));
+   rd->pathname = pathname;
+   rd->fd = -1;
+   SPINDLE_PROBE1(read_start, pathname);
 
    debug_printf2("Reading and broadcasting file %s\n", pathname);
+   /* A .pyc we compiled isn't on disk under its own name */
+   if ((procdata->opts & OPT_COMPILEPYC) && handle_stage_compiled_pyc(pathname, rd) == 0)
+      return 0;
+
    /* Read file size from disk */
    starttime = ldcs_get_time();
-   size = filemngt_get_file_size(pathname, &errcode);
-   if (size == (size_t) -1) {
-      size = 0;
-      goto readdone;
+   rd->size = filemngt_get_file_size(pathname, &rd->errcode);
+   if (rd->size == (size_t) -1) {
+      rd->size = 0;
+      return 0;
    }
-   newsize = size;
+   rd->newsize = rd->size;
+   if (procdata->opts & OPT_REVALIDATE)
+      revalidate_track(pathname, 0);
    procdata->server_stat.libread.time += (ldcs_get_time() - starttime);
 
+   /* A file we've already staged under another path is just linked to */
+   if ((procdata->opts & OPT_DEDUP) && rd->size >= DEDUP_MIN_SIZE &&
+       filemngt_get_file_id(pathname, &rd->dev, &rd->ino) == 0) {
+      char *canonical = dedup_find_by_inode(pathname, rd->dev, rd->ino);
+      rd->have_id = 1;
+      if (canonical && handle_link_file(procdata, pathname, canonical, &rd->localname,
+                                        (void **) &rd->buffer, &rd->newsize) == 0) {
+         debug_printf2("%s is the same file as %s, linked it instead of reading it\n", pathname, canonical);
+         rd->linked = 1;
+         return 0;
+      }
+   }
+
+   /* A file an earlier job already read is staged from the shared caches */
+   rd->sharedkey = filemngt_shared_cache_key(pathname, (procdata->opts & OPT_STRIP) ? 1 : 0);
+   if (rd->sharedkey && handle_stage_shared_file(procdata, pathname, rd) == 0)
+      return 0;
+
    /* Setup buffer for file contents */
-   buffer = handle_setup_file_buffer(procdata, pathname, size, &fd, &localname, &already_loaded);
-   if (!buffer) {
+   rd->buffer = handle_setup_file_buffer(procdata, pathname, rd->size, &rd->fd, &rd->localname, &already_loaded);
+   if (!rd->buffer) {
       assert(!already_loaded);
-      global_result = -1;
-      goto done;
+      return -1;
    }
 
-   /* Actually read the file into the buffer */
-   starttime = ldcs_get_time();
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   rd->pin = ldcs_cache_pinEntry(filename, dirname);
+   handle_setup_transforms(procdata, rd);
+   return 0;
+}
 
-   result = filemngt_read_file(pathname, buffer, &newsize, (procdata->opts & OPT_STRIP), &errcode);
-   if (result == -1) {
-      global_result = -1;
-      goto done;
+/**
+ * Stage a file from the node's shared cache, or else from our rack's or
+ * the cluster's, instead of reading it from the shared file system.  What
+ * comes from a wider cache is added to the narrower ones for the next job.
+ **/
+static int handle_stage_shared_file(ldcs_process_data_t *procdata, char *pathname, file_read_t *rd)
+{
+   int tiers[3] = { SHARED_CACHE_NODE, SHARED_CACHE_RACK, SHARED_CACHE_CLUSTER };
+   char *sharedpath;
+   size_t size;
+   int i, result;
+
+   for (i = 0; i < 3; i++) {
+      sharedpath = filemngt_shared_cache_find(tiers[i], rd->sharedkey, &size);
+      if (!sharedpath)
+         continue;
+      result = handle_link_staged(pathname, sharedpath, size, &rd->localname, (void **) &rd->buffer);
+      if (result == 0)
+         debug_printf2("Staged %s from the shared cache at %s\n", pathname, sharedpath);
+      free(sharedpath);
+      if (result == -1)
+         continue;
+
+      if (tiers[i] != SHARED_CACHE_NODE)
+         filemngt_shared_cache_publish(SHARED_CACHE_NODE, rd->localname, rd->sharedkey);
+      if (tiers[i] == SHARED_CACHE_CLUSTER)
+         filemngt_shared_cache_publish(SHARED_CACHE_RACK, rd->localname, rd->sharedkey);
+      if (tiers[i] == SHARED_CACHE_RACK) {
+         procdata->server_stat.rackcache.cnt++;
+         procdata->server_stat.rackcache.bytes += size;
+      }
+      rd->newsize = size;
+      rd->linked = 1;
+      filemngt_shared_cache_remember(pathname, rd->sharedkey);
+      free(rd->sharedkey);
+      rd->sharedkey = NULL;
+      return 0;
    }
+   return -1;
+}
 
-   procdata->server_stat.libread.cnt++;
-   procdata->server_stat.libread.bytes += !errcode ? newsize : 0;
-   procdata->server_stat.libread.time += (ldcs_get_time() - starttime);
+/**
+ * On a rack leader, whether pathname's current contents are in the rack
+ * cache.  We then stage the file from there and answer our subtree
+ * ourselves, as a reader would, rather than asking up the tree.
+ **/
+static int handle_in_rack_cache(ldcs_process_data_t *procdata, char *pathname)
+{
+   char *key, *cachedpath;
+   size_t size;
 
-   procdata->server_stat.libstore.cnt++;
-   procdata->server_stat.libstore.bytes += !errcode ? newsize : 0;
-   procdata->server_stat.libstore.time += (ldcs_get_time() - starttime);
+   if (!procdata->rack_cache || been_requested(procdata->pending_requests, pathname))
+      return 0;
+   key = filemngt_shared_cache_key(pathname, (procdata->opts & OPT_STRIP) ? 1 : 0);
+   if (!key)
+      return 0;
+   cachedpath = filemngt_shared_cache_find(SHARED_CACHE_RACK, key, &size);
+   free(key);
+   if (!cachedpath)
+      return 0;
+   debug_printf2("%s is in our rack cache at %s, staging it from there\n", pathname, cachedpath);
+   free(cachedpath);
+   return 1;
+}
 
-  readdone:   
-   result = handle_finish_buffer_setup(procdata, localname, pathname, &fd, buffer, size, newsize, errcode);
-   if (result == -1) {
-      global_result = -1;
-      goto done;
+/**
+ * Add a file our parent sent us to the node's shared cache, under the key
+ * that came with it, for the servers of later jobs on the node.  A rack
+ * leader also keeps a copy in the rack cache, so the rack's servers in
+ * later jobs get it from us.
+ **/
+static void handle_publish_received(ldcs_process_data_t *procdata, char *pathname, char *localname)
+{
+   char *key;
+
+   key = filemngt_shared_cache_known(pathname);
+   if (!key)
+      return;
+   filemngt_shared_cache_publish(SHARED_CACHE_NODE, localname, key);
+   if (procdata->rack_cache)
+      filemngt_shared_cache_publish(SHARED_CACHE_RACK, localname, key);
+}
+
+/**
+ * A file our parent is sending us is in the node's shared cache already,
+ * put there by the server of another job.  Stage it from there and drop
+ * the copy coming over the network, size bytes, then pass it on as if it
+ * had arrived.  Returns 1 if it isn't there, so it's received as usual.
+ **/
+static int handle_recv_shared_file(ldcs_process_data_t *procdata, node_peer_t peer, char *pathname,
+                                   char *sharedkey, size_t size, broadcast_t bcast)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   char *sharedpath, *localname = NULL;
+   void *buffer = NULL;
+   size_t shared_size;
+   int result, errcode = 0;
+
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode) == LDCS_CACHE_FILE_FOUND &&
+       localname)
+      return 1;
+   sharedpath = filemngt_shared_cache_find(SHARED_CACHE_NODE, sharedkey, &shared_size);
+   if (!sharedpath)
+      return 1;
+   result = handle_link_staged(pathname, sharedpath, shared_size, &localname, &buffer);
+   if (result == 0)
+      debug_printf2("Staged %s from the shared cache at %s instead of receiving it\n", pathname, sharedpath);
+   free(sharedpath);
+   if (result == -1)
+      return 1;
+
+   if (ldcs_audit_server_md_trash_bytes(peer, size) == -1)
+      return -1;
+   result = handle_broadcast_file(procdata, pathname, localname, (char *) buffer, shared_size, bcast);
+   if (result == -1)
+      return -1;
+   return handle_progress_path(procdata, pathname);
+}
+
+/**
+ * Stage a .pyc from where pycompile_process_directory compiled it.
+ **/
+static int handle_stage_compiled_pyc(char *pathname, file_read_t *rd)
+{
+   const char *compiled;
+   size_t size;
+
+   compiled = pycompile_find(pathname, &size);
+   if (!compiled)
+      return -1;
+   if (handle_link_staged(pathname, (char *) compiled, size, &rd->localname, (void **) &rd->buffer) == -1)
+      return -1;
+   debug_printf2("Staged %s from its bytecode compiled at %s\n", pathname, compiled);
+   rd->size = rd->newsize = size;
+   rd->linked = 1;
+   return 0;
+}
+
+/**
+ * Drop a file read that failed part way.
+ **/
+static void handle_abort_file_read(file_read_t *rd)
+{
+   if (rd->sharedkey)
+      free(rd->sharedkey);
+   rd->sharedkey = NULL;
+   transform_release(&rd->xf);
+   SPINDLE_PROBE3(read_end, rd->pathname, rd->newsize, rd->errcode);
+   if (rd->pin)
+      ldcs_cache_unpinEntry(rd->pin);
+   rd->pin = NULL;
+   if (rd->fd != -1)
+      close(rd->fd);
+   rd->fd = -1;
+}
+
+/**
+ * Store a file that has been read into its buffer and distribute it on the
+ * network if necessary.
+ **/
+static int handle_finish_file_read(ldcs_process_data_t *procdata, file_read_t *rd, broadcast_t bcast)
+{
+   int result, global_result = 0;
+
+   if (rd->pin)
+      ldcs_cache_unpinEntry(rd->pin);
+   rd->pin = NULL;
+
+   if (!rd->linked) {
+      if (rd->buffer) {
+         procdata->server_stat.libread.cnt++;
+         procdata->server_stat.libread.bytes += !rd->errcode ? rd->newsize : 0;
+         procdata->server_stat.libstore.cnt++;
+         procdata->server_stat.libstore.bytes += !rd->errcode ? rd->newsize : 0;
+      }
+
+      result = handle_finish_buffer_setup(procdata, rd->localname, rd->pathname, &rd->fd, rd->buffer,
+                                          rd->size, rd->newsize, rd->errcode);
+      if (result == -1) {
+         global_result = -1;
+         goto done;
+      }
+
+      if (!rd->errcode && rd->xf.done)
+         handle_take_transforms(procdata, rd);
+      if (!rd->errcode && (procdata->opts & OPT_VERIFY) && !(rd->xf.done & TRANSFORM_CRC)) {
+         /* The buffer may have moved when it was synced, so take it from the cache */
+         char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+         void *synced;
+         size_t synced_size;
+         parseFilenameNoAlloc(rd->pathname, filename, dirname, MAX_PATH_LEN);
+         crc_forget(rd->pathname);
+         if (ldcs_cache_get_buffer(dirname, filename, &synced, &synced_size) != -1 && synced)
+            handle_file_crc(procdata, rd->pathname, synced, synced_size);
+      }
+      if (!rd->errcode && rd->buffer && rd->sharedkey) {
+         filemngt_shared_cache_remember(rd->pathname, rd->sharedkey);
+         filemngt_shared_cache_publish(SHARED_CACHE_NODE, rd->localname, rd->sharedkey);
+         filemngt_shared_cache_publish(SHARED_CACHE_RACK, rd->localname, rd->sharedkey);
+         filemngt_shared_cache_publish(SHARED_CACHE_CLUSTER, rd->localname, rd->sharedkey);
+      }
+      if (!rd->errcode && (procdata->opts & OPT_DEDUP) && rd->newsize >= DEDUP_MIN_SIZE)
+         handle_dedup_contents(procdata, rd);
+      if (!rd->errcode && rd->buffer && (procdata->opts & OPT_PUSHDEPS) && bcast != suppress_broadcast)
+         handle_queue_dependencies(procdata, rd->pathname, rd->buffer, rd->newsize);
    }
 
    if (bcast == suppress_broadcast)
       goto done;
 
-   if (!errcode)
-      result = handle_broadcast_file(procdata, pathname, buffer, newsize, bcast);
+   if (!rd->errcode)
+      result = handle_broadcast_file(procdata, rd->pathname, rd->localname, rd->buffer, rd->newsize, bcast);
    else
-      result = handle_broadcast_errorcode(procdata, pathname, errcode);
+      result = handle_broadcast_errorcode(procdata, rd->pathname, rd->errcode);
    if (result == -1)
       global_result = -1;
 
   done:
-   if (fd != -1)
-      close(fd);
+   if (rd->sharedkey)
+      free(rd->sharedkey);
+   rd->sharedkey = NULL;
+   transform_release(&rd->xf);
+   if (rd->fd != -1)
+      close(rd->fd);
+   rd->fd = -1;
    return global_result;
 }
 
 /**
- * Send a file's contents across the network
+ * Pick what a reader thread works out from a file's contents as it reads
+ * them.  Otherwise the CRC and the compressed copy are made on the server
+ * loop when the file is first sent.
  **/
-static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size,
-                                 broadcast_t bcast)
+static void handle_setup_transforms(ldcs_process_data_t *procdata, file_read_t *rd)
 {
-   char *packet_buffer = NULL;
-   size_t packet_size;
-   double starttime;
-   int result, global_result = 0;
-   ldcs_message_t msg;
-   int force_broadcast;
-
-   result = filemngt_encode_packet(pathname, buffer, size, &packet_buffer, &packet_size);
-   if (result == -1) {
-      global_result = -1;
-      goto done;
+   if (!rd->buffer || rd->linked)
+      return;
+   if (procdata->opts & OPT_VERIFY)
+      rd->xf.stages |= TRANSFORM_CRC;
+   if ((procdata->opts & OPT_COMPRESS) && rd->size >= COMPRESS_MIN_SIZE) {
+      rd->xf.stages |= TRANSFORM_COMPRESS;
+      rd->xf.zeighths = COMPRESS_MAX_EIGHTHS;
    }
+}
 
-   if (bcast == preload_broadcast) {
-      msg.header.type = LDCS_MSG_PRELOAD_FILE;
-      force_broadcast = 1;
-   }
-   else {
-      msg.header.type = LDCS_MSG_FILE_DATA;
-      force_broadcast = 0;
+/**
+ * A reader thread ran the transforms over a file it read, which is now
+ * stored.  Remember the CRC and keep the compressed copy in the cache, as
+ * handle_file_crc and handle_get_compressed would.
+ **/
+static void handle_take_transforms(ldcs_process_data_t *procdata, file_read_t *rd)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+
+   if (rd->xf.done & TRANSFORM_CRC) {
+      crc_forget(rd->pathname);
+      crc_record(rd->pathname, rd->xf.crc);
+      procdata->server_stat.verify.cnt++;
+      procdata->server_stat.verify.bytes += rd->newsize;
+      procdata->server_stat.verify.time += rd->xf.crc_time;
    }
-   msg.header.len = packet_size;
-   msg.data = packet_buffer;
-   
-   starttime = ldcs_get_time();
-   
-   result = handle_send_msg_to_keys(procdata, &msg, pathname, buffer, size, force_broadcast, 0);
-   if (result == -1) {
-      global_result = -1;
-      goto done;
+   if ((rd->xf.done & TRANSFORM_COMPRESS) && rd->newsize >= COMPRESS_MIN_SIZE) {
+      parseFilenameNoAlloc(rd->pathname, filename, dirname, MAX_PATH_LEN);
+      procdata->server_stat.libdist_raw.time += rd->xf.compress_time;
+      if (rd->xf.zbuffer)
+         debug_printf2("Compressed %s from %lu to %lu bytes on a reader thread\n", rd->pathname,
+                       (unsigned long) rd->newsize, (unsigned long) rd->xf.zsize);
+      if (ldcs_cache_setCompressed(filename, dirname, rd->xf.zbuffer, rd->xf.zsize) == 0)
+         rd->xf.zbuffer = NULL;
    }
+}
 
-   procdata->server_stat.libdist.cnt++;
-   procdata->server_stat.libdist.bytes += packet_size;
-   procdata->server_stat.libdist.time += (ldcs_get_time()-starttime);      
-   
-  done:
-   if (packet_buffer)
-      free(packet_buffer);
+/**
+ * Expand one directory of a DT_RPATH/DT_RUNPATH/LD_LIBRARY_PATH list into
+ * result, replacing $ORIGIN with the directory of the object that's doing
+ * the search.  Returns -1 for dirs we can't resolve the way ld.so would:
+ * relative dirs, other $ tokens, or ones too long.
+ **/
+static int handle_expand_search_dir(const char *dir, size_t dirlen, const char *origin, char *result)
+{
+   size_t i, len = 0, toklen, originlen = strlen(origin);
 
-   return global_result;
+   for (i = 0; i < dirlen; ) {
+      if (dir[i] != '$') {
+         if (len + 1 >= MAX_PATH_LEN)
+            return -1;
+         result[len++] = dir[i++];
+         continue;
+      }
+      if (dirlen - i >= 7 && strncmp(dir + i, "$ORIGIN", 7) == 0)
+         toklen = 7;
+      else if (dirlen - i >= 9 && strncmp(dir + i, "${ORIGIN}", 9) == 0)
+         toklen = 9;
+      else
+         return -1;
+      if (len + originlen >= MAX_PATH_LEN)
+         return -1;
+      memcpy(result + len, origin, originlen);
+      len += originlen;
+      i += toklen;
+   }
+   result[len] = '\0';
+   return (result[0] == '/') ? 0 : -1;
 }
 
 /**
- * Broadcast an error result from reading a file rather than file contents
+ * A file we read off disk may be a dynamically linked ELF file.  Queue the
+ * libraries it needs so handle_push_dependencies can send them to every
+ * server before anyone asks.  Candidates follow ld.so's order: DT_RPATH
+ * (when there's no DT_RUNPATH), LD_LIBRARY_PATH, then DT_RUNPATH.  We don't
+ * know the application's environment, so the server's LD_LIBRARY_PATH
+ * stands in for it, as with --prefetch.  Libraries only found through
+ * ld.so.cache or the default dirs are left to be requested as usual.
  **/
-static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathname, int errcode)
+static void handle_queue_dependencies(ldcs_process_data_t *procdata, char *pathname, void *buffer, size_t size)
 {
-   char *packet_buffer = NULL;
-   size_t packet_size = 0;
-   int result;
-   int pathname_len = strlen(pathname)+1;
-   int pos = 0;
-   ldcs_message_t msg;
-   double starttime;
-   
-   debug_printf2("Broadcasting errcode result %d for file %s\n", errcode, pathname);
-   packet_size = sizeof(errcode);
-   packet_size += sizeof(pathname_len);
-   packet_size += pathname_len;
-   packet_buffer = (char *) malloc(packet_size);
-   memcpy(packet_buffer + pos, &errcode, sizeof(errcode));
-   pos += sizeof(errcode);
-   memcpy(packet_buffer + pos, &pathname_len, sizeof(pathname_len));
-   pos += sizeof(pathname_len);
-   strncpy(packet_buffer + pos, pathname, pathname_len);
-   pos += pathname_len;
-   assert(pos == packet_size);
-   
-   msg.header.type = LDCS_MSG_FILE_ERRCODE;
-   msg.header.len = packet_size;
-   msg.data = packet_buffer;
+   elf_deps_t deps;
+   char origin[MAX_PATH_LEN], file[MAX_PATH_LEN], dir[MAX_PATH_LEN];
+   char candidates[PUSHDEP_MAX_LEN];
+   const char *searchpaths[3], *start, *end, *lib;
+   size_t used, dirlen, len;
+   int i, j;
+   pushdep_t *dep;
+
+   if (!ldcs_audit_server_md_is_responsible(procdata, pathname))
+      return;
+   if (elf_read_dependencies(buffer, size, &deps) == -1 || !deps.num_needed) {
+      elf_free_dependencies(&deps);
+      return;
+   }
 
-   starttime = ldcs_get_time();
-   result = handle_send_msg_to_keys(procdata, &msg, pathname, NULL, 0, 0, 0);
-   procdata->server_stat.libdist.cnt++;
-   procdata->server_stat.libdist.bytes += packet_size;
-   procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);      
+   parseFilenameNoAlloc(pathname, file, origin, MAX_PATH_LEN);
+   searchpaths[0] = deps.runpath ? NULL : deps.rpath;
+   searchpaths[1] = getenv("LD_LIBRARY_PATH");
+   searchpaths[2] = deps.runpath;
 
-   free(packet_buffer);
-   return result;   
+   for (i = 0; i < deps.num_needed; i++) {
+      lib = deps.needed[i];
+      if (strchr(lib, '/'))
+         continue;
+      used = 0;
+      for (j = 0; j < 3; j++) {
+         for (start = searchpaths[j]; start && *start; start = *end ? end + 1 : end) {
+            end = strchr(start, ':');
+            if (!end)
+               end = start + strlen(start);
+            dirlen = end - start;
+            if (!dirlen || handle_expand_search_dir(start, dirlen, origin, dir) == -1)
+               continue;
+            reducePath(dir);
+            len = strlen(dir) + 1 + strlen(lib) + 1;
+            if (len > MAX_PATH_LEN || used + len + 1 > PUSHDEP_MAX_LEN)
+               continue;
+            snprintf(candidates + used, len, "%s/%s", dir, lib);
+            used += len;
+         }
+      }
+      if (!used)
+         continue;
+      candidates[used++] = '\0';
+
+      dep = (pushdep_t *) malloc(sizeof(pushdep_t));
+      if (dep)
+         dep->candidates = (char *) malloc(used);
+      if (!dep || !dep->candidates) {
+         err_printf("Could not allocate dependency of %s\n", pathname);
+         if (dep)
+            free(dep);
+         break;
+      }
+      memcpy(dep->candidates, candidates, used);
+      dep->predicted = 0;
+      dep->next = NULL;
+      if (pushdeps_tail)
+         pushdeps_tail->next = dep;
+      else
+         pushdeps_head = dep;
+      pushdeps_tail = dep;
+      debug_printf3("Queued dependency %s of %s\n", lib, pathname);
+   }
+   elf_free_dependencies(&deps);
 }
 
 /**
- * Sends a message to a client with the local path for a sucessfully read file.
+ * Push each queued dependency: stage the first candidate that exists and
+ * broadcast it, and its directory, to every server.  Pushed files may queue
+ * their own dependencies, so this runs until the closure is done.
  **/
-static int handle_client_fulfilled_query(ldcs_process_data_t *procdata, int nc)
+static int handle_push_dependencies(ldcs_process_data_t *procdata)
 {
-   ldcs_message_t out_msg;
-   int connid, zero = 0;
-   char buffer_out[MAX_PATH_LEN+1+sizeof(int)];
-   ldcs_client_t *client = procdata->client_table + nc;
-
-   connid = client->connid;
+   static int pushing = 0;
+   pushdep_t *dep;
+   char *path, *localpath, file[MAX_PATH_LEN], dir[MAX_PATH_LEN];
+   handle_file_result_t fresult;
+   ldcs_server_stat_entry_t *stat;
+   int result, global_result = 0, errcode;
+   void *buffer;
+   size_t size;
+   double starttime;
 
-   /* send answer only to active client not to pseudo client */
-   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+   if (pushing)
       return 0;
+   pushing = 1;
+
+   while ((dep = pushdeps_head) != NULL) {
+      pushdeps_head = dep->next;
+      if (!pushdeps_head)
+         pushdeps_tail = NULL;
+
+      for (path = dep->candidates; *path; path += strlen(path) + 1) {
+         file[0] = '\0'; dir[0] = '\0';
+         parseFilenameNoAlloc(path, file, dir, MAX_PATH_LEN);
+         fresult = handle_howto_file(procdata, path, file, dir, &localpath, &errcode);
+         if (fresult == READ_DIRECTORY) {
+            result = handle_read_directory(procdata, dir);
+            if (result != -1)
+               result = handle_broadcast_dir(procdata, dir, preload_broadcast);
+            if (result == -1) {
+               global_result = -1;
+               break;
+            }
+            fresult = handle_howto_file(procdata, path, file, dir, &localpath, &errcode);
+         }
+         if (fresult == NO_FILE || fresult == FOUND_ERRCODE)
+            continue;
+         if (fresult == READ_FILE) {
+            debug_printf2("Pushing %s %s\n", dep->predicted ? "predicted file" : "dependency", path);
+            starttime = ldcs_get_time();
+            result = handle_read_and_broadcast_file(procdata, path, preload_broadcast);
+            if (result == -1)
+               global_result = -1;
+            stat = dep->predicted ? &procdata->server_stat.predict : &procdata->server_stat.pushdeps;
+            stat->cnt++;
+            /* The cache entry has its size once the read starts, even one left to a reader thread */
+            if (result != -1 && ldcs_cache_get_buffer(dir, file, &buffer, &size) != -1)
+               stat->bytes += size;
+            stat->time += (ldcs_get_time() - starttime);
+         }
+         break;
+      }
+      free(dep->candidates);
+      free(dep);
+   }
 
-   out_msg.header.type = LDCS_MSG_FILE_QUERY_ANSWER;
-   out_msg.data = (void *) buffer_out;
-   memcpy(out_msg.data, &zero, sizeof(int));
-   strncpy(out_msg.data+sizeof(int), client->query_localpath, MAX_PATH_LEN+1);
-   out_msg.header.len = strlen(client->query_localpath) + 1 + sizeof(int);
-
-   ldcs_send_msg(connid, &out_msg);
-   client->query_open = 0;
+   pushing = 0;
+   return global_result;
+}
 
-   debug_printf2("Server answering query (fulfilled): %s\n", out_msg.data);
-   
-   /* statistic */
-   procdata->server_stat.clientmsg.cnt++;
-   procdata->server_stat.clientmsg.time += ldcs_get_time() -
-      client->query_arrival_time;
-   return 0;
+/**
+ * With --predict, learn from the root's request for pathname and queue the
+ * files that usually follow it, to be read and pushed at preload priority
+ * like dependencies are.  Files that were already read are skipped when
+ * the queue runs, so a wrong guess only costs files nobody asked for yet.
+ **/
+static void handle_predict(ldcs_process_data_t *procdata, long stream, char *pathname)
+{
+   const char *paths[PREDICT_MAX_DEPTH];
+   pushdep_t *dep;
+   size_t len;
+   int i, num;
+
+   if (!(procdata->opts & OPT_PREDICT) || !ldcs_audit_server_md_is_responsible(procdata, ""))
+      return;
+
+   predict_record(stream, pathname);
+   num = predict_next(pathname, paths, predict_depth);
+   for (i = 0; i < num; i++) {
+      len = strlen(paths[i]) + 1;
+      dep = (pushdep_t *) malloc(sizeof(pushdep_t));
+      if (dep)
+         dep->candidates = (char *) malloc(len + 1);
+      if (!dep || !dep->candidates) {
+         err_printf("Could not allocate prediction after %s\n", pathname);
+         if (dep)
+            free(dep);
+         break;
+      }
+      memcpy(dep->candidates, paths[i], len);
+      dep->candidates[len] = '\0';
+      dep->predicted = 1;
+      dep->next = NULL;
+      if (pushdeps_tail)
+         pushdeps_tail->next = dep;
+      else
+         pushdeps_head = dep;
+      pushdeps_tail = dep;
+      debug_printf3("Predicted %s after %s\n", paths[i], pathname);
+   }
 }
 
 /**
- * Sends a message to a client that shows a file wasn't found.
+ * Reads a file contents off disk and put into the file cache.  Distribute file
+ * on network if necessary.
  **/
-static int handle_client_rejected_query(ldcs_process_data_t *procdata, int nc, int errcode)
+static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *pathname,
+                                          broadcast_t bcast)
 {
-   ldcs_message_t out_msg;
-   int buffer_out;
+   double starttime;
+   int result, staged, striped;
+   file_read_t rd;
 
-   out_msg.header.type = LDCS_MSG_FILE_QUERY_ANSWER;
-   out_msg.data = (void *) &buffer_out;
-   buffer_out = errcode;
-   ldcs_client_t *client = procdata->client_table + nc;
-   int connid = client->connid;
-   
-   /* send answer only to active client not to pseudo client */
-   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+   if (handle_read_in_flight(pathname)) {
+      debug_printf2("File %s is already being read\n", pathname);
       return 0;
+   }
 
-   out_msg.header.len = sizeof(buffer_out);
-      
-   ldcs_send_msg(connid, &out_msg);
-   client->query_open = 0;
+   if ((procdata->opts & OPT_PYBUNDLE) && bcast != suppress_broadcast) {
+      char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1], parent[MAX_PATH_LEN+1], *localname = NULL;
+      int errcode = 0, metadata;
+      filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+      parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+      metadata = bundle_is_metadata_candidate(procdata, dirname, parent);
+      if (metadata || bundle_is_candidate(procdata, dirname)) {
+         result = handle_read_and_broadcast_bundle(procdata, metadata ? parent : dirname, metadata);
+         if (result == -1)
+            return -1;
+         if (ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode) == LDCS_CACHE_FILE_FOUND &&
+             localname)
+            return handle_progress(procdata);
+      }
+   }
 
-   debug_printf2("Server answering query (rejected with errcode %d)\n", errcode);
-      
-   /* statistic */
-   procdata->server_stat.clientmsg.cnt++;
-   procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
-   return 0;
+   if (procdata->opts & OPT_LAZYFETCH) {
+      result = handle_lazy_stage_file(procdata, pathname, &staged);
+      if (result == -1 || staged)
+         return result;
+   }
+
+   result = handle_start_file_read(procdata, pathname, &rd);
+   if (result == -1) {
+      handle_abort_file_read(&rd);
+      return -1;
+   }
+
+   if (rd.buffer && !rd.linked) {
+      result = handle_start_striped_read(procdata, &rd, bcast, &striped);
+      if (result == -1 || striped)
+         return result;
+   }
+
+   if (rd.buffer && !rd.linked && handle_start_async_read(procdata, &rd, bcast) == 0)
+      return 0;
+
+   if (rd.buffer && !rd.linked) {
+      /* Actually read the file into the buffer */
+      starttime = ldcs_get_time();
+      result = filemngt_read_file(pathname, rd.buffer, &rd.newsize, (procdata->opts & OPT_STRIP), &rd.errcode);
+      if (result == -1) {
+         handle_abort_file_read(&rd);
+         return -1;
+      }
+      procdata->server_stat.libread.time += (ldcs_get_time() - starttime);
+      procdata->server_stat.libstore.time += (ldcs_get_time() - starttime);
+   }
+
+   return handle_finish_file_read(procdata, &rd, bcast);
 }
 
 /**
- * Set server to shutdown
+ * Returns true if pathname is being read on a reader thread.
  **/
-static int handle_exit_broadcast(ldcs_process_data_t *procdata)
+static int handle_read_in_flight(char *pathname)
 {
-   ldcs_message_t out_msg;
-   debug_printf("Setting up Exiting after receiving exit bcast message\n");
+   async_read_t *ar;
+   for (ar = async_reads; ar; ar = ar->next) {
+      if (strcmp(ar->rd.pathname, pathname) == 0)
+         return 1;
+   }
+   return 0;
+}
 
-   out_msg.header.type = LDCS_MSG_EXIT;
-   out_msg.header.len = 0;
-   out_msg.data = NULL;
+/**
+ * Returns true if any file reads handed to reader threads haven't been
+ * collected.  Their cache entries point at incomplete files.
+ **/
+int handle_reads_in_flight()
+{
+   return async_reads != NULL;
+}
 
-   ldcs_audit_server_md_broadcast(procdata, &out_msg);
+static void handle_async_read_job(void *arg)
+{
+   async_read_t *ar = (async_read_t *) arg;
+   double starttime = ldcs_get_time();
 
-   mark_exit();
-   return 0;
+   ar->result = filemngt_read_file(ar->rd.pathname, ar->rd.buffer, &ar->rd.newsize, ar->strip, &ar->rd.errcode);
+   ar->read_time = ldcs_get_time() - starttime;
+   if (ar->result != -1 && !ar->rd.errcode && ar->rd.xf.stages)
+      transform_run(&ar->rd.xf, ar->rd.buffer, ar->rd.newsize);
 }
 
 /**
- * We've received a request for a directory or file from the network.
- * Satisify it, if possible.  Otherwise mark it and forward it on.
+ * Hand a started file read to a reader thread.  Returns -1 if it can't be,
+ * and the caller should read the file itself.
  **/
-static int handle_request(ldcs_process_data_t *procdata, node_peer_t from, ldcs_message_t *msg)
+static int handle_start_async_read(ldcs_process_data_t *procdata, file_read_t *rd, broadcast_t bcast)
 {
-   int result, is_dir;
-   char msg_type = msg->data[0];
-   char *pathname = msg->data+1;
+   async_read_t *ar;
+
+   if (async_fd == -1) {
+      async_fd = readpool_completion_fd();
+      if (async_fd == -1)
+         return -1;
+      ldcs_listen_register_fd(async_fd, async_fd, handle_async_read_done, procdata);
+   }
 
-   debug_printf2("Got request for %s from network\n", pathname);
-   if (msg_type != 'D' && msg_type != 'F') {
-      err_printf("Badly formed request message with starting char '%c'\n", msg_type);
+   ar = (async_read_t *) malloc(sizeof(async_read_t));
+   if (!ar)
+      return -1;
+   ar->rd = *rd;
+   ar->rd.pathname = strdup(rd->pathname);
+   ar->bcast = bcast;
+   ar->strip = (procdata->opts & OPT_STRIP);
+   ar->result = 0;
+   ar->read_time = 0.0;
+   ar->stripes_left = 0;
+   if (!ar->rd.pathname) {
+      free(ar);
       return -1;
    }
-   is_dir = (msg_type == 'D');
-   if (is_dir)
-      return handle_request_directory(procdata, from, pathname);
-   else
-      return handle_request_file(procdata, from, pathname);
 
-   return result;
+   ar->next = async_reads;
+   async_reads = ar;
+   if (readpool_submit(handle_async_read_job, ar) == -1) {
+      async_reads = ar->next;
+      free(ar->rd.pathname);
+      free(ar);
+      return -1;
+   }
+   debug_printf2("Reading %s on a reader thread\n", rd->pathname);
+   return 0;
 }
 
 /**
- * We've received a request for a directory from the network.
- * Satisify it, if possible.  Otherwise mark it and forward it on.
+ * Called from the server loop when reader threads have finished files.
+ * Store and broadcast each one, then let waiting clients make progress.
  **/
-static int handle_request_directory(ldcs_process_data_t *procdata, node_peer_t from, char *pathname)
+static int handle_async_read_done(int fd, int id, void *data)
 {
-   
-   handle_file_result_t result = handle_howto_directory(procdata, pathname);
-   int res;
-
-   debug_printf2("Received request for directory %s from network\n", pathname);
-   switch (result) {
-      case READ_DIRECTORY:
-         add_requestor(procdata->pending_requests, pathname, from);
-         return handle_read_and_broadcast_dir(procdata, pathname);
-      case REQ_DIRECTORY:
-         res = handle_send_query(procdata, pathname, 1);
-         add_requestor(procdata->pending_requests, pathname, from);
-         return res;
-      case NO_FILE:
-      case FOUND_FILE:
-         add_requestor(procdata->pending_requests, pathname, from);
-         return handle_broadcast_dir(procdata, pathname, request_broadcast);
-      default:
-         err_printf("Unexpected return from handle_how_directory: %d\n", (int) result);
-         assert(0);
-         return -1;
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
+   async_read_t *ar, **prev;
+   void *finished;
+   ssize_t result;
+   int global_result = 0, done = 0;
+
+   for (;;) {
+      result = read(fd, &finished, sizeof(finished));
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result != sizeof(finished))
+         break;
+
+      for (prev = &async_reads; *prev && *prev != finished; prev = &(*prev)->next);
+      ar = *prev;
+      assert(ar);
+      *prev = ar->next;
+      done++;
+
+      procdata->server_stat.libread.time += ar->read_time;
+      procdata->server_stat.libstore.time += ar->read_time;
+      if (ar->result == -1) {
+         handle_abort_file_read(&ar->rd);
+         global_result = -1;
+      }
+      else if (handle_finish_file_read(procdata, &ar->rd, ar->bcast) == -1)
+         global_result = -1;
+      free(ar->rd.pathname);
+      free(ar);
    }
+   if (!done)
+      return 0;
+
+   if (handle_progress(procdata) == -1)
+      global_result = -1;
+   if (pushdeps_head && handle_push_dependencies(procdata) == -1)
+      global_result = -1;
+   return global_result;
 }
 
 /**
- * We've receieved a request for stat data from a client.  Decide what to do with it
+ * With OPT_STRIPEDREAD, the root splits the read of a large file between
+ * the readers.  Each reader reads one piece, whole Lustre stripes where
+ * the file has them, and sends it up in a LDCS_MSG_STRIPE_DATA, while the
+ * root reads the first piece itself.  Until every piece is in, the file is
+ * waited on like a read on a reader thread.  A piece a reader couldn't
+ * read, or couldn't be asked for, is read by the root.
  **/
-static handle_metadata_result_t handle_howto_metadata(ldcs_process_data_t *procdata, char *pathname)
+#define STRIPE_DEFAULT_UNIT (1024*1024)
+#define STRIPE_DEFAULT_MIN_MB 64
+
+static size_t handle_stripe_min_size()
 {
-   char *localname;
-   int result, responsible;
+   static size_t min_size = 0;
+   char *env;
 
-   result = lookup_stat_cache(pathname, &localname);
-   if (result != -1)
-      return REPORT_METADATA;
+   if (!min_size) {
+      env = getenv("SPINDLE_STRIPE_MIN_MB");
+      min_size = ((size_t) (env && atoi(env) > 0 ? atoi(env) : STRIPE_DEFAULT_MIN_MB)) * 1024 * 1024;
+   }
+   return min_size;
+}
 
-   responsible = ldcs_audit_server_md_is_responsible(procdata, pathname);
-   if (responsible)
-      return METADATA_FILE;
+static int handle_start_striped_read(ldcs_process_data_t *procdata, file_read_t *rd, broadcast_t bcast,
+                                     int *striped)
+{
+   async_read_t *ar;
+   ldcs_message_t msg;
+   char buffer[2*sizeof(size_t)+MAX_PATH_LEN+1];
+   size_t unit, piece, offset, len;
+   int num_readers, pathname_len, i, result;
+   node_peer_t reader;
+   double starttime;
 
-   if (been_requested(procdata->pending_metadata_requests, pathname)) {
-      return METADATA_IN_PROGRESS;
+   *striped = 0;
+   if (!(procdata->opts & OPT_STRIPEDREAD) || (procdata->opts & OPT_STRIP) ||
+       rd->size < handle_stripe_min_size() || !ldcs_audit_server_md_is_responsible(procdata, ""))
+      return 0;
+   num_readers = ldcs_audit_server_md_get_num_readers(procdata);
+   pathname_len = strlen(rd->pathname) + 1;
+   if (num_readers < 2 || pathname_len > MAX_PATH_LEN + 1)
+      return 0;
+
+   unit = filemngt_stripe_size(rd->pathname);
+   if (!unit)
+      unit = STRIPE_DEFAULT_UNIT;
+   piece = (rd->size + num_readers - 1) / num_readers;
+   piece = ((piece + unit - 1) / unit) * unit;
+
+   ar = (async_read_t *) malloc(sizeof(async_read_t));
+   if (!ar)
+      return 0;
+   ar->rd = *rd;
+   ar->rd.pathname = strdup(rd->pathname);
+   ar->rd.newsize = rd->size;
+   ar->bcast = bcast;
+   ar->strip = 0;
+   ar->result = 0;
+   ar->read_time = 0.0;
+   ar->stripes_left = 0;
+   if (!ar->rd.pathname) {
+      free(ar);
+      return 0;
    }
-      
-   return REQUEST_METADATA;
+   *striped = 1;
+   debug_printf2("Reading %s in pieces of %lu bytes across %d readers\n", rd->pathname,
+                 (unsigned long) piece, num_readers);
+
+   starttime = ldcs_get_time();
+   for (i = 1; i < num_readers && (size_t) i * piece < rd->size; i++) {
+      offset = i * piece;
+      len = rd->size - offset < piece ? rd->size - offset : piece;
+      memcpy(buffer, &offset, sizeof(offset));
+      memcpy(buffer + sizeof(offset), &len, sizeof(len));
+      memcpy(buffer + 2*sizeof(size_t), rd->pathname, pathname_len);
+      msg.header.type = LDCS_MSG_STRIPE_REQUEST;
+      msg.header.len = 2*sizeof(size_t) + pathname_len;
+      msg.data = buffer;
+
+      reader = ldcs_audit_server_md_get_reader(procdata, i);
+      if (reader != NODE_PEER_NULL && ldcs_audit_server_md_send(procdata, &msg, reader) == 0) {
+         ar->stripes_left++;
+         continue;
+      }
+      debug_printf("Could not ask reader %d for its piece of %s, reading it here\n", i, rd->pathname);
+      if (filemngt_read_range(ar->rd.pathname, ar->rd.buffer + offset, offset, len, &ar->rd.errcode) == -1)
+         ar->result = -1;
+   }
+
+   len = rd->size < piece ? rd->size : piece;
+   if (filemngt_read_range(ar->rd.pathname, ar->rd.buffer, 0, len, &ar->rd.errcode) == -1)
+      ar->result = -1;
+   procdata->server_stat.libread.time += (ldcs_get_time() - starttime);
+   procdata->server_stat.libstore.time += (ldcs_get_time() - starttime);
+
+   ar->next = async_reads;
+   async_reads = ar;
+   if (ar->stripes_left)
+      return 0;
+   result = handle_finish_striped_read(procdata, ar);
+   if (handle_progress(procdata) == -1)
+      result = -1;
+   return result;
 }
 
-static int handle_client_metadata(ldcs_process_data_t *procdata, int nc)
+/**
+ * Every piece of a striped read is in.  Store and broadcast the file.
+ **/
+static int handle_finish_striped_read(ldcs_process_data_t *procdata, async_read_t *ar)
 {
-   handle_metadata_result_t stat_result;
-   ldcs_client_t *client = procdata->client_table + nc;
-   char *pathname = client->query_globalpath;
-   int broadcast_result, client_result;
-   metadata_t mdtype;
+   async_read_t **prev;
+   int result = 0;
 
-   if (client->is_stat)
-      mdtype = metadata_stat;
-   else if (client->is_loader)
-      mdtype = metadata_loader;
+   for (prev = &async_reads; *prev && *prev != ar; prev = &(*prev)->next);
+   assert(*prev);
+   *prev = ar->next;
+
+   if (ar->result == -1) {
+      handle_abort_file_read(&ar->rd);
+      result = -1;
+   }
    else
-      assert(0);
-      
-   stat_result = handle_howto_metadata(procdata, pathname);
-   switch (stat_result) {
-      case REQUEST_METADATA:
-         return handle_metadata_request(procdata, pathname, mdtype, NODE_PEER_CLIENT);
-      case METADATA_FILE:
-         add_requestor(procdata->pending_metadata_requests, pathname, NODE_PEER_CLIENT);
-         broadcast_result = handle_metadata_and_broadcast_file(procdata, pathname, mdtype, request_broadcast);
-         client_result = handle_client_metadata_result(procdata, nc, mdtype);
-         if (broadcast_result == -1 || client_result == -1)
-            return -1;
-         return 0;
-      case REPORT_METADATA:
-         return handle_client_metadata_result(procdata, nc, mdtype);
-      case METADATA_IN_PROGRESS:
-         add_requestor(procdata->pending_metadata_requests, pathname, NODE_PEER_CLIENT);
-         return 0;
+      result = handle_finish_file_read(procdata, &ar->rd, ar->bcast);
+   free(ar->rd.pathname);
+   free(ar);
+   return result;
+}
+
+/**
+ * The root wants a piece of a file it's reading in stripes.  Read it and
+ * send it back, or send back the error that kept us from reading it.
+ **/
+static int handle_stripe_request_recv(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg)
+{
+   size_t offset, len;
+   char *pathname, *packet;
+   int pathname_len, header_len, errcode = 0, result;
+   ldcs_message_t out_msg;
+   double starttime;
+
+   if (msg->header.len <= (int64_t) (2*sizeof(size_t)) || msg->data[msg->header.len-1] != '\0') {
+      err_printf("Badly formed stripe request\n");
+      return -1;
    }
-   err_printf("Unexpected result from handle_howto_metadata: %d\n", (int) stat_result);
-   assert(0);
-   return -1;   
+   memcpy(&offset, msg->data, sizeof(offset));
+   memcpy(&len, msg->data + sizeof(offset), sizeof(len));
+   pathname = msg->data + 2*sizeof(size_t);
+   pathname_len = strlen(pathname) + 1;
+
+   header_len = sizeof(int) + 2*sizeof(size_t) + sizeof(int) + pathname_len;
+   packet = (char *) malloc(header_len + len);
+   if (!packet) {
+      err_printf("Could not allocate %lu bytes to read a piece of %s\n", (unsigned long) len, pathname);
+      return -1;
+   }
+
+   starttime = ldcs_get_time();
+   result = filemngt_read_range(pathname, packet + header_len, offset, len, &errcode);
+   if (result == -1 && !errcode)
+      errcode = EIO;
+   out_msg.header.len = header_len + (errcode ? 0 : len);
+   procdata->server_stat.stripe.time += ldcs_get_time() - starttime;
+   if (!errcode) {
+      procdata->server_stat.stripe.cnt++;
+      procdata->server_stat.stripe.bytes += len;
+   }
+   debug_printf2("Read %lu bytes at %lu of %s for the root, errcode %d\n", (unsigned long) len,
+                 (unsigned long) offset, pathname, errcode);
+
+   memcpy(packet, &pathname_len, sizeof(int));
+   memcpy(packet + sizeof(int), &offset, sizeof(offset));
+   memcpy(packet + sizeof(int) + sizeof(offset), &len, sizeof(len));
+   memcpy(packet + sizeof(int) + 2*sizeof(size_t), &errcode, sizeof(errcode));
+   memcpy(packet + sizeof(int) + 2*sizeof(size_t) + sizeof(int), pathname, pathname_len);
+   out_msg.header.type = LDCS_MSG_STRIPE_DATA;
+   out_msg.data = packet;
+   result = ldcs_audit_server_md_send(procdata, &out_msg, peer);
+   free(packet);
+   return result;
 }
 
 /**
- * We've received a request for a file from the network.  
- * Satisify or forward it.
+ * A reader sent back its piece of a file we're reading in stripes.
  **/
-static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from, char *pathname)
+static int handle_stripe_data_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg)
 {
-   char *localname;
-   void *buffer;
-   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
-   size_t size;
-   handle_file_result_t fresult;
-   int result = 0, dir_result = 0, errcode = 0;
-   
-   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
-   fresult = handle_howto_file(procdata, pathname, filename, dirname, &localname, &errcode);
+   int pathname_len, header_len, errcode, result = 0;
+   size_t offset, len;
+   char *pathname;
+   async_read_t *ar;
 
-   debug_printf2("Received request for file %s from network\n", pathname);
-   switch (fresult) {
-      case FOUND_FILE:
-         result = ldcs_cache_get_buffer(dirname, filename, &buffer, &size);
-         if (result == -1) {
-            err_printf("Failed to lookup %s / %s in cache\n", dirname, filename);
-            return -1;
-         }
-         add_requestor(procdata->pending_requests, pathname, from);
-         result = handle_broadcast_file(procdata, pathname, buffer, size, request_broadcast);
-         return result;
-      case FOUND_ERRCODE:
-         add_requestor(procdata->pending_requests, pathname, from);         
-         return handle_broadcast_errorcode(procdata, pathname, errcode);
-      case NO_FILE:
-         return handle_create_selfload_file(procdata, pathname);
-      case READ_DIRECTORY:
-         result = handle_read_and_broadcast_dir(procdata, dirname);
-         if (result == -1)
-            return -1;
-         return handle_request_file(procdata, from, pathname);
-      case READ_FILE:
-         add_requestor(procdata->pending_requests, pathname, from);
-         return handle_read_and_broadcast_file(procdata, pathname, request_broadcast);
-      case REQ_DIRECTORY:
-         dir_result = handle_send_query(procdata, dirname, 1);
-         add_requestor(procdata->pending_requests, dirname, from);
-         /* Fall through to next case and request file */
-      case REQ_FILE:
-         result = handle_send_query(procdata, pathname, 0);
-         add_requestor(procdata->pending_requests, pathname, from);
-         return (result == -1 || dir_result == -1) ? -1 : 0;
+   header_len = sizeof(int) + 2*sizeof(size_t) + sizeof(int);
+   if (msg->header.len < header_len) {
+      err_printf("Badly formed stripe data message\n");
+      return -1;
    }
-   assert(0);
-   return -1;
+   memcpy(&pathname_len, msg->data, sizeof(int));
+   memcpy(&offset, msg->data + sizeof(int), sizeof(offset));
+   memcpy(&len, msg->data + sizeof(int) + sizeof(offset), sizeof(len));
+   memcpy(&errcode, msg->data + sizeof(int) + 2*sizeof(size_t), sizeof(errcode));
+   header_len += pathname_len;
+   if (pathname_len <= 0 || msg->header.len != (int64_t) (header_len + (errcode ? 0 : len)) ||
+       msg->data[header_len-1] != '\0') {
+      err_printf("Badly formed stripe data message\n");
+      return -1;
+   }
+   pathname = msg->data + header_len - pathname_len;
+
+   for (ar = async_reads; ar && !(ar->stripes_left && strcmp(ar->rd.pathname, pathname) == 0); ar = ar->next);
+   if (!ar || offset + len > ar->rd.size) {
+      err_printf("Received a piece of %s, which isn't being read in stripes\n", pathname);
+      return -1;
+   }
+
+   if (errcode) {
+      debug_printf("Reader couldn't read its piece of %s, errcode %d, reading it here\n", pathname, errcode);
+      if (filemngt_read_range(ar->rd.pathname, ar->rd.buffer + offset, offset, len, &ar->rd.errcode) == -1)
+         ar->result = -1;
+   }
+   else {
+      debug_printf2("Received %lu bytes at %lu of %s\n", (unsigned long) len, (unsigned long) offset, pathname);
+      memcpy(ar->rd.buffer + offset, msg->data + header_len, len);
+      procdata->server_stat.stripe.cnt++;
+      procdata->server_stat.stripe.bytes += len;
+   }
+
+   if (--ar->stripes_left)
+      return 0;
+   if (handle_finish_striped_read(procdata, ar) == -1)
+      result = -1;
+   if (handle_progress(procdata) == -1)
+      result = -1;
+   return result;
 }
 
 /**
- * Requests another node on the network to read a file or directory off disk
- * and forward it to us.
+ * Reads the small files of a directory under the python prefix off disk,
+ * stages them, and sends them to every other server in one bundle.  With
+ * metadata set, the files are those of the package metadata directories
+ * in dir.
  **/
-static int handle_send_query(ldcs_process_data_t *procdata, char *path, int is_dir)
+static int handle_read_and_broadcast_bundle(ldcs_process_data_t *procdata, char *dir, int metadata)
 {
-   if (been_requested(procdata->pending_requests, path)) {
-      debug_printf2("File %s has already been requested.  Not re-sending request\n", path);
+   ldcs_message_t msg;
+   char *data;
+   size_t size, bytes_read;
+   int num_files, num_staged, result, global_result = 0;
+   double starttime;
+
+   starttime = ldcs_get_time();
+   if (metadata)
+      result = bundle_pack_metadata(dir, (procdata->opts & OPT_STRIP), &data, &size, &num_files, &bytes_read);
+   else
+      result = bundle_pack_dir(dir, (procdata->opts & OPT_STRIP), &data, &size, &num_files, &bytes_read);
+   procdata->server_stat.libread.cnt += num_files;
+   procdata->server_stat.libread.bytes += bytes_read;
+   procdata->server_stat.libread.time += (ldcs_get_time() - starttime);
+   if (result == -1)
+      return -1;
+   if (!num_files) {
+      free(data);
       return 0;
    }
-            
-   if (is_dir)
-      return handle_send_directory_query(procdata, path);
-   else {
-      return handle_send_file_query(procdata, path);
+   debug_printf("Bundling %d %sfiles of %s in %lu bytes\n", num_files, metadata ? "package metadata " : "",
+                dir, (unsigned long) size);
+
+   msg.header.type = LDCS_MSG_FILE_BUNDLE;
+   msg.header.len = size;
+   msg.data = data;
+
+   result = handle_stage_bundle(procdata, &msg, &num_staged);
+   if (result == -1)
+      global_result = -1;
+
+   result = ldcs_audit_server_md_broadcast(procdata, &msg);
+   if (result == -1) {
+      err_printf("Error broadcasting bundle of %s\n", dir);
+      global_result = -1;
    }
+
+   free(data);
+   return global_result;
 }
 
 /**
- * We've received request for a directory's contents. Request it from up the network.
+ * Stage every file in a bundle we don't have yet, along with its stat.
+ * Each file is marked as sent to all children, since the bundle goes to
+ * every server.  A bundle with an empty directory name is a --batch-small
+ * batch.
  **/
-static int handle_send_directory_query(ldcs_process_data_t *procdata, char *directory)
+static int handle_stage_bundle(ldcs_process_data_t *procdata, ldcs_message_t *msg, int *num_staged)
 {
-   ldcs_message_t out_msg;
-   char buffer_out[MAX_PATH_LEN+1];
-   int bytes_written;
+   char *pathname, *contents, *localname, *statname;
+   struct stat buf;
+   size_t pos, contents_size;
+   void *buffer;
+   int result, fd, already_loaded, global_result = 0;
+   double starttime = ldcs_get_time();
 
-   debug_printf2("Sending directory request for %s up network\n", directory);
-   out_msg.header.type = LDCS_MSG_FILE_REQUEST;
-   out_msg.data = buffer_out;
+   *num_staged = 0;
+   if (!bundle_first_entry(msg->data, msg->header.len, &pos)) {
+      err_printf("Received bundle without a directory name\n");
+      return -1;
+   }
 
-   bytes_written = snprintf(out_msg.data, MAX_PATH_LEN+1, "D%s", directory);
-   out_msg.header.len = bytes_written+1;
+   while ((result = bundle_next_entry(msg->data, msg->header.len, &pos, &pathname, &buf,
+                                      &contents, &contents_size)) == 1) {
+      /* Batched small files come without their stat */
+      if (buf.st_mode && lookup_stat_cache(pathname, &statname) == -1)
+         handle_cache_metadata(procdata, pathname, 1, &buf, &statname);
 
-   ldcs_audit_server_md_forward_query(procdata, &out_msg);
-   return 0;
+      fd = -1;
+      buffer = handle_setup_file_buffer(procdata, pathname, contents_size, &fd, &localname, &already_loaded);
+      if (!buffer) {
+         if (!already_loaded)
+            global_result = -1;
+         continue;
+      }
+      memcpy(buffer, contents, contents_size);
+      result = handle_finish_buffer_setup(procdata, localname, pathname, &fd, buffer,
+                                          contents_size, contents_size, 0);
+      if (fd != -1)
+         close(fd);
+      if (result == -1) {
+         global_result = -1;
+         continue;
+      }
+
+      add_requestor(procdata->completed_requests, pathname, NODE_PEER_ALL);
+      clear_requestor(procdata->pending_requests, pathname);
+      procdata->server_stat.libstore.cnt++;
+      procdata->server_stat.libstore.bytes += contents_size;
+      (*num_staged)++;
+   }
+   if (result == -1) {
+      err_printf("Received corrupt bundle\n");
+      global_result = -1;
+   }
+
+   procdata->server_stat.libstore.time += ldcs_get_time() - starttime;
+   return global_result;
 }
 
 /**
- * We've received request for a files's contents. Request it from up the network.
+ * Our parent sent us a bundle of files.  Stage them and pass the bundle
+ * on to all of our children.
  **/
-static int handle_send_file_query(ldcs_process_data_t *procdata, char *fullpath)
+static int handle_bundle_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg)
 {
-   ldcs_message_t out_msg;
-   char buffer_out[MAX_PATH_LEN+1];
-   int bytes_written;
+   int num_staged, result, global_result = 0;
+   double starttime = ldcs_get_time();
 
-   debug_printf2("Sending directory request for %s up network\n", fullpath);
-   out_msg.header.type = LDCS_MSG_FILE_REQUEST;
-   out_msg.data = buffer_out;
+   result = handle_stage_bundle(procdata, msg, &num_staged);
+   if (result == -1)
+      global_result = -1;
+   debug_printf2("Staged %d files from a bundle of %ld bytes\n", num_staged, (long) msg->header.len);
 
-   bytes_written = snprintf(out_msg.data, MAX_PATH_LEN+1, "F%s", fullpath);
-   out_msg.header.len = bytes_written+1;
+   result = ldcs_audit_server_md_broadcast(procdata, msg);
+   if (result == -1) {
+      err_printf("Error broadcasting bundle\n");
+      global_result = -1;
+   }
 
-   ldcs_audit_server_md_forward_query(procdata, &out_msg);
-   return 0;
+   procdata->server_stat.libdist.cnt += num_staged;
+   procdata->server_stat.libdist.bytes += msg->header.len;
+   procdata->server_stat.libdist.time += ldcs_get_time() - starttime;
+
+   if (handle_progress(procdata) == -1)
+      return -1;
+   return global_result;
 }
 
 /**
- * A parent server is sending us an errcode associated with a file.  Receive it.
+ * Reads a list of files off disk with several reads in flight at once, and
+ * stores and distributes each one as soon as its read is done.  The reads
+ * are a sliding window of READ_BATCH_SIZE files, so the next files are
+ * coming off disk while the last one goes out on the network.  Used for the
+ * preload list, which can name hundreds of libraries.
  **/
-static int handle_file_errcode(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast)
+static int handle_read_and_broadcast_files(ldcs_process_data_t *procdata, char **pathnames, int num_files,
+                                           broadcast_t bcast)
 {
-   char *pathname;
-   int errcode, pathname_len, result, pos = 0;
-   unsigned char *data;
-
-   data = (unsigned char *) msg->data;
-   errcode = *((int *) (data + pos));
-   pos += sizeof(errcode);
-   pathname_len = *((int *) (data + pos));
-   pos += sizeof(pathname_len);
-   pathname = (char *) (data + pos);
-   pos += pathname_len;
-   assert(pos == msg->header.len);
+   file_read_t rd[READ_BATCH_SIZE];
+   filemngt_read_t reads[READ_BATCH_SIZE];
+   int started[READ_BATCH_SIZE], reading[READ_BATCH_SIZE];
+   int next_start = 0, next_finish, i, result, global_result = 0;
+   double starttime;
 
-   debug_printf2("Received errcode result %d from read of %s\n", errcode, pathname);
-   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
-   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
-   ldcs_cache_updateEntry(filename, dirname, NULL, NULL, 0, errcode);
+   if (procdata->opts & OPT_PFSMETA)
+      handle_statahead(procdata, pathnames, num_files);
+
+   for (next_finish = 0; next_finish < num_files; next_finish++) {
+      for (; next_start < num_files && next_start - next_finish < READ_BATCH_SIZE; next_start++) {
+         i = next_start % READ_BATCH_SIZE;
+         reading[i] = 0;
+         result = handle_start_file_read(procdata, pathnames[next_start], rd + i);
+         started[i] = (result != -1);
+         if (!started[i]) {
+            handle_abort_file_read(rd + i);
+            global_result = -1;
+            continue;
+         }
+         if (!rd[i].buffer || rd[i].linked)
+            continue;
+         reads[i].filename = rd[i].pathname;
+         reads[i].buffer = rd[i].buffer;
+         reads[i].size = rd[i].newsize;
+         reads[i].strip = (procdata->opts & OPT_STRIP);
+         reads[i].errcode = 0;
+         reads[i].result = 0;
+         reads[i].transform = rd[i].xf.stages ? &rd[i].xf : NULL;
+         filemngt_start_read(reads + i);
+         reading[i] = 1;
+      }
 
-   result = handle_broadcast_errorcode(procdata, pathname, errcode);
-   if (result == -1)
-      return -1;
+      i = next_finish % READ_BATCH_SIZE;
+      if (!started[i])
+         continue;
+      if (reading[i]) {
+         starttime = ldcs_get_time();
+         result = filemngt_wait_read(reads + i);
+         procdata->server_stat.libread.time += (ldcs_get_time() - starttime);
+         procdata->server_stat.libstore.time += (ldcs_get_time() - starttime);
+         rd[i].newsize = reads[i].size;
+         rd[i].errcode = reads[i].errcode;
+         if (result == -1) {
+            handle_abort_file_read(rd + i);
+            global_result = -1;
+            continue;
+         }
+      }
+      result = handle_finish_file_read(procdata, rd + i, bcast);
+      if (result == -1)
+         global_result = -1;
+   }
+   pfsmeta_clear();
 
-   return handle_progress(procdata);
+   return global_result;
 }
 
 /**
- * A parent server is sending us a file.  Receive it from the network
+ * Stage pathname as a link to the local copy of canonical, a staged file
+ * with the same contents, replacing any copy of pathname we staged
+ * already.  Returns -1 if canonical isn't staged here or the link failed,
+ * in which case pathname is left as it was.
  **/
-static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast)
+static int handle_link_file(ldcs_process_data_t *procdata, char *pathname, char *canonical,
+                            char **localname_out, void **buffer_out, size_t *size_out)
 {
-   char pathname[MAX_PATH_LEN+1], *localname;
-   char *buffer = NULL;
-   size_t size = 0;
-   int result, global_error = 0, already_loaded, fd = -1;
-   pathname[MAX_PATH_LEN] = '\0';
-
-   assert(!msg->data); /* If this hits, then the network layer read a entire FILE_DATA packet
-                          rather than just the header */
+   char cfilename[MAX_PATH_LEN], cdirname[MAX_PATH_LEN];
+   char *clocalname = NULL;
+   void *cbuffer = NULL;
+   size_t csize = 0;
+   int errcode = 0;
+   double starttime = ldcs_get_time();
 
-   /* We haven't read the file data off the network.  We'll postpone doing that
-      until we have the memory allocated for it in a mapped region of our address
-      space.  The decode packet will just read the pathname and size. */
-   result = filemngt_decode_packet(peer, msg, pathname, &size);
-   if (result == -1) {
-      global_error = -1;
-      goto done;
+   parseFilenameNoAlloc(canonical, cfilename, cdirname, MAX_PATH_LEN);
+   if (ldcs_cache_findFileDirInCache(cfilename, cdirname, &clocalname, &errcode) != LDCS_CACHE_FILE_FOUND ||
+       !clocalname || ldcs_cache_get_buffer(cdirname, cfilename, &cbuffer, &csize) == -1) {
+      debug_printf("Can't link %s to %s, which isn't staged here\n", pathname, canonical);
+      return -1;
    }
 
-   debug_printf("Receiving file contents for file %s from %s\n", pathname, 
-                bcast == preload_broadcast ? "preload" : "request");
+   if (handle_link_staged(pathname, clocalname, csize, localname_out, buffer_out) == -1)
+      return -1;
+   dedup_add_alias(pathname, canonical);
 
-   /* Setup up a memory buffer for us to read into, which is mapped to the
-      local file.  Also fills in the hash table.  Does not actually read
-      the file data */
-   buffer = handle_setup_file_buffer(procdata, pathname, size, &fd, &localname, &already_loaded);
-   if (!buffer) {
-      if (already_loaded) {
-         debug_printf("File %s was already loaded\n", pathname);
-      }
-      else {
-         debug_printf("Problem allocating memory for buffer.  Flushing out read from the network\n");
-         global_error = -1;
-      }
-      ldcs_audit_server_md_trash_bytes(peer, size);
-      goto done;
-   }
+   procdata->server_stat.dedup.cnt++;
+   procdata->server_stat.dedup.bytes += csize;
+   procdata->server_stat.dedup.time += (ldcs_get_time() - starttime);
 
-   /* No we'll go ahead and read the file data */
-   result = ldcs_audit_server_md_complete_msg_read(peer, msg, buffer, size);
-   if (result == -1) {
-      global_error = -1;
-      goto done;
-   }
+   *size_out = csize;
+   return 0;
+}
 
-   /* Syncs the file contents to disk and sets local access permissions */
-   result = handle_finish_buffer_setup(procdata, localname, pathname, &fd, buffer, size, size, 0);
-   if (result == -1) {
-      global_error = -1;
-      goto done;
-   }
+/**
+ * Stage pathname as a link to srcname, a local file of size bytes, and
+ * point its cache entry there.  Any copy of pathname we staged already
+ * is replaced.
+ **/
+static int handle_link_staged(char *pathname, char *srcname, size_t size,
+                              char **localname_out, void **buffer_out)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   char *localname = NULL;
+   void *buffer = NULL, *oldbuffer = NULL;
+   size_t oldsize = 0;
+   int errcode = 0, result, new_localname = 0;
 
-   /* Notify other servers and clients of file read */
-   result = handle_broadcast_file(procdata, pathname, buffer, size, bcast);
-   if (result == -1) {
-      global_error = -1;
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode) == LDCS_CACHE_FILE_NOT_FOUND)
+      ldcs_cache_addFileDir(dirname, filename);
+   if (localname) {
+      if (ldcs_cache_get_buffer(dirname, filename, &oldbuffer, &oldsize) == -1)
+         oldbuffer = NULL;
    }
-   result = handle_progress(procdata);
+   else {
+      localname = filemngt_calc_file_localname(pathname, size);
+      assert(localname);
+      new_localname = 1;
+   }
+
+   result = filemngt_link_file(srcname, localname, size, &buffer, oldbuffer, oldsize);
    if (result == -1) {
-      global_error = -1;
+      if (new_localname)
+         free(localname);
+      return -1;
    }
+   if (new_localname)
+      add_global_name(pathname, localname);
+   ldcs_cache_updateEntry(filename, dirname, localname, buffer, size, 0);
 
-  done:
-   if (fd != -1)
-      close(fd);
-   return global_error;
+   *localname_out = localname;
+   *buffer_out = buffer;
+   return 0;
 }
 
 /**
- * We've received a packet with directory info.  Process it.
+ * A file was just read and staged.  If a staged file has the same contents,
+ * link this one to it so it's sent as an alias.  Otherwise remember it for
+ * the files read after it.
  **/
-static int handle_directory_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast)
+static void handle_dedup_contents(ldcs_process_data_t *procdata, file_read_t *rd)
 {
-   dirbuffer_iterator_t pos;
-   char *filename, *dirname, *dir = NULL;;
+   char *canonical;
+   void *buffer;
+   size_t size;
    double starttime = ldcs_get_time();
 
-   debug_printf2("New directory cache entries received from %s\n",
-                 bcast == preload_broadcast ? "preload" : "request");
-
-   /* For each directory/file in packet add it to the cache. */
-   foreach_filedir(msg->data, msg->header.len, pos, filename, dirname) {
-      assert(dir == NULL || dir == dirname); /* One directory per packet for now */
-      dir = dirname;
-      if (dirname && !filename) {
-         addEmptyDirectory(dirname);
-         continue;
-      }
-      ldcs_cache_addFileDir(dirname, filename);
+   canonical = dedup_find_by_contents(rd->pathname, rd->newsize);
+   procdata->server_stat.dedup.time += (ldcs_get_time() - starttime);
+   if (canonical && handle_link_file(procdata, rd->pathname, canonical, &rd->localname, &buffer, &size) == 0) {
+      rd->buffer = (char *) buffer;
+      rd->newsize = size;
+      return;
    }
-
-   handle_broadcast_dir(procdata, dir, bcast);
-   
-   procdata->server_stat.distdir.cnt++;
-   procdata->server_stat.distdir.bytes += msg->header.len;
-   procdata->server_stat.distdir.time += ldcs_get_time() - starttime;
-
-   return handle_progress(procdata);
+   if (rd->have_id)
+      dedup_add_file(rd->pathname, rd->dev, rd->ino, rd->newsize);
 }
 
 /**
- * Send a message to child servers.  If in push mode we send to every child always.
- * If in pull mode only send to children who requested the file.
+ * Send an alias of a staged file to those of the targets that already have
+ * the file it's an alias of, and take them off the target list.  The rest
+ * still need the file contents.
  **/
-int handle_send_msg_to_keys(ldcs_process_data_t *procdata, ldcs_message_t *msg, char *key,
-                            void *secondary_data, size_t secondary_size, int force_broadcast,
-                            int is_stat)
+static int handle_send_alias(ldcs_process_data_t *procdata, char *pathname, char *canonical, broadcast_t bcast,
+                             int *all_children, node_peer_t *peers, int *num_peers)
 {
-   int result, global_result = 0;
-   static int have_done_broadcast = 0;
+   char *packet_buffer;
+   size_t packet_size;
+   int pathname_len = strlen(pathname)+1, canonical_len = strlen(canonical)+1;
+   int pos = 0, i, j, result, global_result = 0, sent = 0, have_all;
+   ldcs_message_t msg;
+   double starttime;
 
-   requestor_list_t pending_reqs = !is_stat ? procdata->pending_requests : procdata->pending_metadata_requests;
-   requestor_list_t completed_reqs = !is_stat ? procdata->completed_requests : procdata->completed_metadata_requests;
+   /* The file this links to may still be waiting in the batch */
+   handle_send_batch(procdata);
 
-   if (have_done_broadcast) {
-      /* Test whether this file has already been broadcast to all */
-      if (peer_requested(completed_reqs, key, NODE_PEER_ALL)) {
-         debug_printf2("Not sending message for %s, because it's already been broadcast\n", key);
-         return 0;
-      }
+   packet_size = sizeof(pathname_len) + pathname_len + sizeof(canonical_len) + canonical_len;
+   packet_buffer = (char *) msgpool_alloc(packet_size);
+   if (!packet_buffer) {
+      err_printf("Failed to allocate alias packet for %s\n", pathname);
+      return -1;
    }
+   memcpy(packet_buffer + pos, &pathname_len, sizeof(pathname_len));
+   pos += sizeof(pathname_len);
+   memcpy(packet_buffer + pos, pathname, pathname_len);
+   pos += pathname_len;
+   memcpy(packet_buffer + pos, &canonical_len, sizeof(canonical_len));
+   pos += sizeof(canonical_len);
+   memcpy(packet_buffer + pos, canonical, canonical_len);
+   pos += canonical_len;
+   assert(pos == packet_size);
 
-   if (procdata->dist_model == LDCS_PUSH || force_broadcast) {
-      debug_printf3("Pushing message to all children\n");
-      result = ldcs_audit_server_md_broadcast_noncontig(procdata, msg, secondary_data, secondary_size);
-      if (result == -1)
-         global_result = -1;
-      have_done_broadcast = 1;
-      add_requestor(completed_reqs, key, NODE_PEER_ALL);
-   }
-   else if (procdata->dist_model == LDCS_PULL) {
-      node_peer_t *nodes = NULL;
-      int nodes_size, i;
-
-      debug_printf3("Sending messages to select children via pull model\n");
-      result = get_requestors(pending_reqs, key, &nodes, &nodes_size);
-      if (result == -1) {
-         return 0;
-      }
-      debug_printf3("Sending message %s to %d nodes who requested it\n", key, nodes_size);
-      for (i = 0; i < nodes_size; i++) {
-         if (nodes[i] == NODE_PEER_CLIENT || nodes[i] == NODE_PEER_NULL)
-            continue;
-         if (peer_requested(completed_reqs, key, nodes[i])) {
-            debug_printf2("Not sending message for %s to child, because it's already been sent\n", key);
-            continue;
-         }
-         result = ldcs_audit_server_md_send_noncontig(procdata, msg, nodes[i], secondary_data, secondary_size);
+   msg.header.type = (bcast == preload_broadcast) ? LDCS_MSG_PRELOAD_ALIAS : LDCS_MSG_FILE_ALIAS;
+   msg.header.len = packet_size;
+   msg.data = packet_buffer;
+
+   starttime = ldcs_get_time();
+   have_all = peer_requested(procdata->completed_requests, canonical, NODE_PEER_ALL) &&
+      !been_requested(procdata->unaliased_requests, pathname);
+   if (*all_children) {
+      if (have_all) {
+         debug_printf2("Broadcasting %s as an alias of %s\n", pathname, canonical);
+         result = ldcs_audit_server_md_broadcast(procdata, &msg);
          if (result == -1)
             global_result = -1;
-         else
-            add_requestor(completed_reqs, key, nodes[i]);
+         *all_children = 0;
+         sent++;
       }
    }
-   else {
-      assert(0);
+   for (i = 0, j = 0; i < *num_peers; i++) {
+      if (peer_requested(procdata->unaliased_requests, pathname, peers[i]))
+         peers[j++] = peers[i];
+      else if (have_all || peer_requested(procdata->completed_requests, canonical, peers[i])) {
+         debug_printf2("Sending %s as an alias of %s\n", pathname, canonical);
+         result = ldcs_audit_server_md_send(procdata, &msg, peers[i]);
+         if (result == -1)
+            global_result = -1;
+         sent++;
+      }
+      else
+         peers[j++] = peers[i];
    }
+   *num_peers = j;
 
-   clear_requestor(pending_reqs, key);
-
+   if (sent) {
+      procdata->server_stat.libdist.cnt++;
+      procdata->server_stat.libdist.bytes += packet_size;
+      procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);
+   }
+   msgpool_free(packet_buffer);
    return global_result;
 }
 
 /**
- * Handle a message that just arrived from a client
+ * Find or make the compressed copy of a file that's about to be sent to
+ * other servers, or return NULL to send the file as is.  Compression is
+ * tried once per file, and the copy is kept in the cache entry until
+ * handle_release_compressed.
  **/
-int handle_client_message(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+static void *handle_get_compressed(ldcs_process_data_t *procdata, char *pathname, size_t size, size_t *zsize)
 {
-   switch (msg->header.type) {
-      case LDCS_MSG_CWD:
-      case LDCS_MSG_PID:
-      case LDCS_MSG_LOCATION:
-         return handle_client_info_msg(procdata, nc, msg);
-      case LDCS_MSG_PYTHONPREFIX_REQ:
-         return handle_pythonprefix_query(procdata, nc);
-      case LDCS_MSG_MYRANKINFO_QUERY:
-         return handle_client_myrankinfo_msg(procdata, nc, msg);
-      case LDCS_MSG_FILE_QUERY:
-      case LDCS_MSG_FILE_QUERY_EXACT_PATH:
-      case LDCS_MSG_STAT_QUERY:
-      case LDCS_MSG_LOADER_DATA_REQ:
-         return handle_client_file_request(procdata, nc, msg);
-      case LDCS_MSG_EXISTS_QUERY:
-         return handle_client_fileexist_msg(procdata, nc, msg);
-      case LDCS_MSG_ORIGPATH_QUERY:
-         return handle_client_origpath_msg(procdata, nc, msg);
-      case LDCS_MSG_END:
-         return handle_client_end(procdata, nc);
-      default:
-         err_printf("Received unexpected message from client %d: %d\n", nc, (int) msg->header.type);
-         assert(0);
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   void *zbuffer = NULL, *buffer = NULL;
+   size_t buffer_size = 0, max_size;
+   double starttime;
+
+   if (!(procdata->opts & OPT_COMPRESS) || size < COMPRESS_MIN_SIZE)
+      return NULL;
+
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_getCompressed(filename, dirname, &zbuffer, zsize))
+      return zbuffer;
+
+   /* Compress from the cache's mapping, since syncing a new file may have moved it */
+   if (ldcs_cache_get_buffer(dirname, filename, &buffer, &buffer_size) == -1 ||
+       !buffer || buffer_size != size)
+      return NULL;
+
+   starttime = ldcs_get_time();
+   max_size = (size / 8) * COMPRESS_MAX_EIGHTHS;
+   zbuffer = malloc(max_size);
+   if (zbuffer) {
+      *zsize = compress_buffer(buffer, size, zbuffer, max_size);
+      if (!*zsize) {
+         free(zbuffer);
+         zbuffer = NULL;
+      }
    }
-   return -1;
+   procdata->server_stat.libdist_raw.time += (ldcs_get_time() - starttime);
+
+   if (zbuffer)
+      debug_printf2("Compressed %s from %lu to %lu bytes\n", pathname, (unsigned long) size,
+                    (unsigned long) *zsize);
+   else
+      debug_printf3("%s does not compress, sending it as is\n", pathname);
+   
+   if (ldcs_cache_setCompressed(filename, dirname, zbuffer, *zsize) == -1) {
+      free(zbuffer);
+      return NULL;
+   }
+   return zbuffer;
 }
 
 /**
- * Handle a message that just arrived from a server
+ * Drop a file's compressed copy once it's been sent, unless we expect to
+ * send it again.  Only pull mode sends a file to servers one at a time.
  **/
-int handle_server_message(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg)
+static void handle_release_compressed(ldcs_process_data_t *procdata, char *pathname)
 {
-   switch (msg->header.type) {
-      case LDCS_MSG_CACHE_ENTRIES:
-         return handle_directory_recv(procdata, msg, request_broadcast);
-      case LDCS_MSG_FILE_DATA:
-         return handle_file_recv(procdata, msg, peer, request_broadcast);         
-      case LDCS_MSG_FILE_ERRCODE:
-         return handle_file_errcode(procdata, msg, peer, request_broadcast);
-      case LDCS_MSG_FILE_REQUEST:
-         return handle_request(procdata, peer, msg);
-      case LDCS_MSG_EXIT:
-         return handle_exit_broadcast(procdata);
-      case LDCS_MSG_PRELOAD_FILELIST:
-         return handle_preload_filelist(procdata, msg);
-      case LDCS_MSG_PRELOAD_DIR:
-         return handle_directory_recv(procdata, msg, preload_broadcast);
-      case LDCS_MSG_PRELOAD_FILE:
-         return handle_file_recv(procdata, msg, peer, preload_broadcast);
-      case LDCS_MSG_PRELOAD_DONE:
-         return handle_preload_done(procdata);
-      case LDCS_MSG_SELFLOAD_FILE:
-         return handle_recv_selfload_file(procdata, msg);
-      case LDCS_MSG_STAT_NET_RESULT:
-         return handle_metadata_recv(procdata, msg, metadata_stat, peer);
-      case LDCS_MSG_STAT_NET_REQUEST:
-         return handle_metadata_request_recv(procdata, msg, metadata_stat, peer);
-       case LDCS_MSG_LOADER_DATA_NET_RESP:
-         return handle_metadata_recv(procdata, msg, metadata_loader, peer);
-      case LDCS_MSG_LOADER_DATA_NET_REQ:
-         return handle_metadata_request_recv(procdata, msg, metadata_loader, peer);
-     case LDCS_MSG_EXIT_READY:
-         return handle_exit_ready_msg(procdata, msg);
-      case LDCS_MSG_EXIT_CANCEL:
-         return handle_exit_cancel_msg(procdata, msg);
-      default:
-         err_printf("Received unexpected message from node: %d\n", (int) msg->header.type);
-         assert(0);
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+
+   if (procdata->dist_model == LDCS_PULL)
+      return;
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   ldcs_cache_setCompressed(filename, dirname, NULL, 0);
+}
+
+/**
+ * With --sparse-files, the data extents of a file with big holes that's
+ * about to be sent to other servers, or NULL to send it as is.  The
+ * extents are found in our staged copy, which we stage with the same
+ * holes, and the malloced encoding is freed once it's sent.
+ **/
+static void *handle_get_sparse(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                               size_t size, size_t *esize)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   void *encoded, *buffer = NULL;
+   size_t buffer_size = 0;
+   double starttime;
+
+   if (!(procdata->opts & OPT_SPARSE) || !localname || size < SPARSE_MIN_HOLES)
+      return NULL;
+
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_get_buffer(dirname, filename, &buffer, &buffer_size) == -1 ||
+       !buffer || buffer_size != size)
+      return NULL;
+
+   starttime = ldcs_get_time();
+   encoded = filemngt_sparse_encode(localname, buffer, size, esize);
+   procdata->server_stat.sparse.time += ldcs_get_time() - starttime;
+   if (encoded)
+      debug_printf2("Sending %s as %lu of its %lu bytes that aren't holes\n", pathname,
+                    (unsigned long) *esize, (unsigned long) size);
+   return encoded;
+}
+
+/**
+ * With --delta-updates, the changes from a file's last version to the
+ * one about to be sent, if every server it's going to has the last
+ * version, or NULL to send the file whole.
+ **/
+static void *handle_get_delta(ldcs_process_data_t *procdata, char *pathname, size_t size,
+                              int all_children, node_peer_t *peers, int num_peers, size_t *dsize)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   void *buffer = NULL, *delta;
+   size_t buffer_size = 0;
+   node_peer_t child;
+   double starttime;
+   int i;
+
+   if (!(procdata->opts & OPT_DELTA) || size < DELTA_MIN_SIZE)
+      return NULL;
+   for (i = 0; all_children && i < ldcs_audit_server_md_get_num_children(procdata); i++) {
+      child = ldcs_audit_server_md_get_child(procdata, i);
+      if (child != NODE_PEER_NULL && !delta_peer_has_base(pathname, child))
+         return NULL;
    }
-   return -1;
+   for (i = 0; i < num_peers; i++) {
+      if (!delta_peer_has_base(pathname, peers[i]))
+         return NULL;
+   }
+
+   delta = delta_get_encoded(pathname, NULL, size, dsize);
+   if (delta)
+      return delta;
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_get_buffer(dirname, filename, &buffer, &buffer_size) == -1 ||
+       !buffer || buffer_size != size)
+      return NULL;
+   starttime = ldcs_get_time();
+   delta = delta_get_encoded(pathname, buffer, size, dsize);
+   procdata->server_stat.delta.time += ldcs_get_time() - starttime;
+   return delta;
 }
 
 /**
- * Handle new client 
+ * Send a file's contents across the network.  The contents are sent from the
+ * staged copy at localname when we can open it, so the kernel can copy them
+ * without going through our mapping.  With OPT_COMPRESS, big files are sent
+ * compressed if that makes them smaller.  With OPT_SPARSE, files with big
+ * holes are sent as their data extents.
  **/
-int handle_client_start(ldcs_process_data_t *procdata, int nc)
+static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                 char *buffer, size_t size, broadcast_t bcast)
 {
-   if (procdata->sent_exit_ready) {
-      return handle_send_exit_cancel(procdata);
+   double starttime;
+   int result, global_result = 0;
+   int force_broadcast, all_children, num_peers;
+   node_peer_t *peers = NULL;
+   char *canonical;
+
+   force_broadcast = (bcast == preload_broadcast);
+   if (!force_broadcast && procdata->num_rules)
+      force_broadcast = (reloc_rules_match(procdata->rules, procdata->num_rules, pathname,
+                                           (long long) size) == reloc_push);
+   starttime = ldcs_get_time();
+
+   all_children = handle_select_msg_targets(procdata, pathname, force_broadcast, 0, &peers, &num_peers);
+   if (!all_children && !num_peers)
+      goto done;
+
+   /* Servers that have the file this is a duplicate of only need its name */
+   canonical = (procdata->opts & OPT_DEDUP) ? dedup_get_canonical(pathname) : NULL;
+   if (canonical) {
+      result = handle_send_alias(procdata, pathname, canonical, bcast, &all_children, peers, &num_peers);
+      if (result == -1)
+         global_result = -1;
+      if (!all_children && !num_peers)
+         goto done;
    }
-   return 0;
+
+   /* Children that already have the file can pass it to their siblings */
+   if (procdata->lateral_peers && !all_children && bcast == request_broadcast &&
+       size >= PEER_SEND_MIN_SIZE) {
+      result = handle_delegate_to_siblings(procdata, pathname, size, peers, &num_peers);
+      if (result == -1)
+         global_result = -1;
+      if (!num_peers)
+         goto done;
+   }
+
+   result = handle_send_file_contents(procdata, pathname, localname, buffer, size, bcast,
+                                      all_children, peers, num_peers, starttime);
+   if (result == -1)
+      global_result = -1;
+
+  done:
+   if (peers)
+      free(peers);
+   if (global_result != -1)
+      handle_unmap_sent_file(procdata, pathname);
+   return global_result;
 }
 
 /**
- * Clean up after a client exit
+ * Once every child has a staged file, or we have no children, only a late
+ * request needs its contents, so stop keeping it mapped.  With tens of GB
+ * staged, the mappings would otherwise hold the server's page tables and
+ * address space for the life of the job.  ldcs_cache_get_buffer maps it
+ * again from the staged copy if it's asked for.
  **/
-int handle_client_end(ldcs_process_data_t *procdata, int nc)
+static void handle_unmap_sent_file(ldcs_process_data_t *procdata, char *pathname)
 {
-   ldcs_client_t *client = procdata->client_table + nc;
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   void *buffer;
+   size_t size;
+   double starttime;
 
-   int connid = client->connid;
-   debug_printf2("Server recvd END: closing connection\n");
+   if (ldcs_audit_server_md_get_num_children(procdata) &&
+       !peer_requested(procdata->completed_requests, pathname, NODE_PEER_ALL))
+      return;
+   if (procdata->opts & OPT_DELTA)
+      delta_drop(pathname);
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   buffer = ldcs_cache_releaseBuffer(filename, dirname, &size);
+   if (!buffer)
+      return;
 
-   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
-      return 0;
-   
-   ldcs_listen_unregister_fd(ldcs_get_fd(connid)); 
-   ldcs_close_server_connection(connid);
-   client->state = LDCS_CLIENT_STATUS_FREE;
-   debug_printf("Closed client %d\n", nc);
-   
-   assert(procdata->clients_live > 0);
-   procdata->clients_live--;
-   return handle_send_exit_ready_if_done(procdata);
+   starttime = ldcs_get_time();
+   debug_printf3("Unmapping %s, which every child has\n", pathname);
+   ldcs_audit_server_md_release_buffer(buffer, size);
+   filemngt_unmap_staged_file(buffer, size);
+   procdata->server_stat.unmap.cnt++;
+   procdata->server_stat.unmap.bytes += size;
+   procdata->server_stat.unmap.time += ldcs_get_time() - starttime;
 }
 
-static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+/**
+ * The part of handle_broadcast_file that sends the contents.  They go to
+ * every child if all_children is set, and to each of the num_peers peers.
+ **/
+static int handle_send_file_contents(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                     char *buffer, size_t size, broadcast_t bcast,
+                                     int all_children, node_peer_t *peers, int num_peers,
+                                     double starttime)
 {
-   int cur = 0, global_result = 0, result;
-   int num_dirs, num_files, i;
-   char *data = (char *) msg->data;
-   char *pathname;
-   
-   debug_printf2("At top of handle_preload_filelist\n");
+   char *packet_buffer = NULL;
+   size_t packet_size, send_size = size, zsize = 0;
+   int result, global_result = 0, i;
+   ldcs_message_t msg;
+   int file_fd = -1, encoding = FILE_ENCODING_RAW;
+   char *send_buffer = buffer, *zbuffer = NULL;
+   uint32_t crc = 0;
+
+   if ((procdata->opts & OPT_BATCHSMALL) && !(procdata->opts & OPT_VERIFY) &&
+       all_children && !num_peers && bcast == request_broadcast &&
+       buffer && size <= BATCH_FILE_MAX_SIZE &&
+       handle_batch_file(procdata, pathname, buffer, size, starttime) == 0)
+      return 0;
 
-   memcpy(&num_dirs, data + cur, sizeof(int));
-   cur += sizeof(int);
-   
-   memcpy(&num_files, data + cur, sizeof(int));
-   cur += sizeof(int);
+   msg.header.type = (bcast == preload_broadcast) ? LDCS_MSG_PRELOAD_FILE : LDCS_MSG_FILE_DATA;
+   if (procdata->opts & OPT_VERIFY)
+      crc = handle_file_crc(procdata, pathname, buffer, size);
+
+   zbuffer = (char *) handle_get_delta(procdata, pathname, size, all_children, peers, num_peers, &zsize);
+   if (zbuffer)
+      encoding = FILE_ENCODING_DELTA;
+   if (!zbuffer) {
+      /* Before compression, which would have the receivers write out the holes */
+      zbuffer = (char *) handle_get_sparse(procdata, pathname, localname, size, &zsize);
+      if (zbuffer)
+         encoding = FILE_ENCODING_SPARSE;
+   }
+   if (!zbuffer) {
+      zbuffer = (char *) handle_get_compressed(procdata, pathname, size, &zsize);
+      if (zbuffer)
+         encoding = FILE_ENCODING_LZ;
+   }
+   if (zbuffer) {
+      send_buffer = zbuffer;
+      send_size = zsize;
+   }
 
-   for (i = 0; i<num_dirs; i++) {
-      assert(cur < msg->header.len);
-      pathname = data + cur;
-      cur += strlen(pathname)+1;
+   result = filemngt_encode_packet(pathname, send_buffer, send_size, size, encoding, crc,
+                                   filemngt_shared_cache_known(pathname), &packet_buffer, &packet_size);
+   if (result == -1) {
+      global_result = -1;
+      goto done;
+   }
+   msg.header.len = packet_size;
+   msg.data = packet_buffer;
 
-      if (!ldcs_audit_server_md_is_responsible(procdata, pathname)) {
-         debug_printf3("I am not responsible for preloading directory %s\n", pathname);
-         continue;
-      }
+   if (localname && size && !zbuffer) {
+      file_fd = open(localname, O_RDONLY);
+      if (file_fd == -1)
+         debug_printf("Could not open %s to send it, sending from memory: %s\n", localname, strerror(errno));
+   }
 
-      debug_printf2("Preload read of directory %s\n", pathname);
-      result = handle_read_directory(procdata, pathname);
-      if (result == -1) {
-         err_printf("Error reading directory during preload\n");
+   if (all_children) {
+      result = ldcs_audit_server_md_broadcast_noncontig_file(procdata, &msg, file_fd, send_buffer, send_size);
+      if (result == -1)
          global_result = -1;
-         continue;
+      /* Our grandchildren may not have the last version the changes apply to */
+      if (encoding != FILE_ENCODING_DELTA) {
+         result = handle_bypass_slow_children(procdata, &msg, file_fd, send_buffer, send_size);
+         if (result == -1)
+            global_result = -1;
       }
-      
-      result = handle_broadcast_dir(procdata, pathname, preload_broadcast);
-      if (result == -1) {
-         err_printf("Error broadcasting directory during preload\n");
+   }
+   for (i = 0; i < num_peers; i++) {
+      result = ldcs_audit_server_md_send_noncontig_file(procdata, &msg, peers[i], file_fd, send_buffer, send_size);
+      if (result == -1)
          global_result = -1;
-         continue;
-      }
    }
+   if (global_result == -1)
+      goto done;
 
-   for (i = 0; i<num_files; i++) {
-      assert(cur < msg->header.len);
-      pathname = data + cur;
-      cur += strlen(pathname)+1;
+   procdata->server_stat.libdist.cnt++;
+   procdata->server_stat.libdist.bytes += packet_size;
+   procdata->server_stat.libdist.time += (ldcs_get_time()-starttime);      
+   latency_record(latency_bcast_id(size), starttime, pathname);
+   if (encoding == FILE_ENCODING_LZ)
+      procdata->server_stat.libdist_raw.cnt++;
+   if (encoding == FILE_ENCODING_DELTA) {
+      procdata->server_stat.delta.cnt++;
+      procdata->server_stat.delta.bytes += size - send_size;
+   }
+   if (encoding == FILE_ENCODING_SPARSE) {
+      procdata->server_stat.sparse.cnt++;
+      procdata->server_stat.sparse.bytes += size - send_size;
+   }
+   procdata->server_stat.libdist_raw.bytes += size;
+   
+  done:
+   /* A compressed copy the reader threads made isn't needed either */
+   if (zbuffer)
+      ldcs_audit_server_md_release_buffer(zbuffer, zsize);
+   if (encoding == FILE_ENCODING_LZ || encoding == FILE_ENCODING_SPARSE)
+      handle_release_compressed(procdata, pathname);
+   if (encoding == FILE_ENCODING_SPARSE)
+      free(zbuffer);
+   if (file_fd != -1)
+      close(file_fd);
+   msgpool_free(packet_buffer);
 
-      if (!ldcs_audit_server_md_is_responsible(procdata, pathname)) {
-         debug_printf3("I am not responsible for preloading file %s\n", pathname);
-         continue;
-      }
+   return global_result;
+}
+
+/**
+ * With --batch-small, a small file going to all our children is added to
+ * the pending batch rather than sent in a message of its own.  The batch
+ * goes out as one LDCS_MSG_FILE_BUNDLE at the end of the listen loop's
+ * pass, or once it's full, and each server stages the files from it as it
+ * does a python bundle's.  Returns -1 if the file couldn't be added, and
+ * should be sent on its own.
+ **/
+static int handle_batch_file(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size,
+                             double starttime)
+{
+   struct stat buf;
+
+   memset(&buf, 0, sizeof(buf));
+   if (bundle_append_entry(&batch_data, &batch_size, &batch_alloc, pathname, &buf, buffer, size) == -1)
+      return -1;
+   batch_files++;
+   debug_printf3("Batched %s, %d files in %lu bytes waiting\n", pathname, batch_files,
+                 (unsigned long) batch_size);
+
+   procdata->server_stat.libdist.cnt++;
+   procdata->server_stat.libdist.time += (ldcs_get_time()-starttime);
+   procdata->server_stat.libdist_raw.bytes += size;
+   latency_record(latency_bcast_id(size), starttime, pathname);
+
+   /* A failed send has been reported, and sending the file again wouldn't help */
+   if (batch_size >= BATCH_MAX_SIZE)
+      handle_send_batch(procdata);
+   return 0;
+}
+
+/**
+ * Send the small files batched since the last call to all our children.
+ * Called at the end of each pass of the listen loop, and before any
+ * message that must not overtake the files.
+ **/
+int handle_send_batch(ldcs_process_data_t *procdata)
+{
+   ldcs_message_t msg;
+   double starttime;
+   int result;
+
+   if (!batch_size)
+      return 0;
+   starttime = ldcs_get_time();
+   debug_printf2("Sending a batch of %d small files in %lu bytes\n", batch_files, (unsigned long) batch_size);
+
+   msg.header.type = LDCS_MSG_FILE_BUNDLE;
+   msg.header.len = batch_size;
+   msg.data = batch_data;
+   result = ldcs_audit_server_md_broadcast(procdata, &msg);
+   if (result == -1)
+      err_printf("Error broadcasting a batch of %d small files\n", batch_files);
+
+   procdata->server_stat.libdist.bytes += batch_size;
+   procdata->server_stat.libdist.time += (ldcs_get_time()-starttime);
+   batch_size = 0;
+   batch_files = 0;
+   return result;
+}
+
+/**
+ * With --bypass-slow, a large file that went to all our children also goes
+ * straight to the children of any child that has been taking what we send
+ * much slower than its siblings, so that child doesn't hold up everything
+ * below it.  It still gets the file and passes it on, and its children
+ * drop the copy that arrives second.
+ **/
+static int handle_bypass_slow_children(ldcs_process_data_t *procdata, ldcs_message_t *msg, int file_fd,
+                                       char *buffer, size_t size)
+{
+   double starttime;
+   int sent;
+
+   if (!(procdata->opts & OPT_BYPASSSLOW) || size < BYPASS_MIN_SIZE)
+      return 0;
+   starttime = ldcs_get_time();
+   sent = ldcs_audit_server_md_bypass_slow(procdata, msg, file_fd, buffer, size);
+   if (sent <= 0)
+      return sent;
+   procdata->server_stat.bypass.cnt += sent;
+   procdata->server_stat.bypass.bytes += (long) sent * size;
+   procdata->server_stat.bypass.time += ldcs_get_time() - starttime;
+   return 0;
+}
+
+/**
+ * With sibling links, look through the num_peers children we're about to
+ * send a file to for ones that are linked to a child we sent it to
+ * earlier.  That child is asked to pass the file on instead, and the peer
+ * is taken out of the list.  The work is spread over the holders by how
+ * many files each has been asked to pass on.
+ **/
+static int handle_delegate_to_siblings(ldcs_process_data_t *procdata, char *pathname, size_t size,
+                                       node_peer_t *peers, int *num_peers)
+{
+   static int *delegations = NULL;
+   static int delegations_size = 0;
+   int num_children, i, j, k, sibling, best, result, global_result = 0, *grown;
+   node_peer_t child, holder;
+   char packet[MAX_PATH_LEN+1+sizeof(int)];
+   size_t pathname_len;
+   ldcs_message_t msg;
+
+   num_children = ldcs_audit_server_md_get_num_children(procdata);
+   if (num_children < 2)
+      return 0;
+   if (delegations_size < num_children) {
+      grown = (int *) realloc(delegations, sizeof(int) * num_children);
+      if (!grown)
+         return 0;
+      delegations = grown;
+      for (i = delegations_size; i < num_children; i++)
+         delegations[i] = 0;
+      delegations_size = num_children;
+   }
+
+   pathname_len = strlen(pathname) + 1;
+   if (pathname_len > MAX_PATH_LEN + 1)
+      return 0;
+   memcpy(packet + sizeof(int), pathname, pathname_len);
+   msg.header.type = LDCS_MSG_PEER_SEND;
+   msg.header.len = sizeof(int) + pathname_len;
+   msg.data = packet;
+
+   for (i = 0; i < *num_peers; ) {
+      sibling = ldcs_audit_server_md_get_child_index(procdata, peers[i]);
+      best = -1;
+      for (j = 0; sibling != -1 && j < num_children; j++) {
+         child = ldcs_audit_server_md_get_child(procdata, j);
+         if (!peer_requested(procdata->completed_requests, pathname, child))
+            continue;
+         for (k = 0; k < *num_peers && peers[k] != child; k++);
+         if (k < *num_peers)
+            continue; /* Being sent it now */
+         if (!ldcs_audit_server_md_children_linked(procdata, child, peers[i]))
+            continue;
+         if (best == -1 || delegations[j] < delegations[best])
+            best = j;
+      }
+      if (best == -1) {
+         i++;
+         continue;
+      }
+
+      holder = ldcs_audit_server_md_get_child(procdata, best);
+      debug_printf2("Asking child %d to send %s to its sibling %d\n", best, pathname, sibling);
+      memcpy(packet, &sibling, sizeof(int));
+      result = ldcs_audit_server_md_send(procdata, &msg, holder);
+      if (result == -1) {
+         /* Send it ourselves */
+         global_result = -1;
+         i++;
+         continue;
+      }
+      delegations[best]++;
+      procdata->server_stat.delegated.cnt++;
+      procdata->server_stat.delegated.bytes += size;
+      peers[i] = peers[--(*num_peers)];
+   }
+   return global_result;
+}
+
+/**
+ * A child handed back a LDCS_MSG_PEER_SEND for pathname, and we can't send
+ * our own copy either, e.g. because it was evicted.  Who holds the file is
+ * out of date, so forget it, so the file isn't delegated back to that
+ * child, and fetch the file for the waiting sibling as if it had asked.
+ * Failures are logged rather than returned, as they aren't the child's.
+ **/
+static int handle_peer_send_returned(ldcs_process_data_t *procdata, char *pathname, int sibling,
+                                     node_peer_t target)
+{
+   if (target == NODE_PEER_NULL) {
+      err_printf("Child handed back %s for child %d, which we don't have\n", pathname, sibling);
+      return 0;
+   }
+   debug_printf("Neither we nor a child could send %s to child %d.  Fetching it again\n", pathname, sibling);
+   clear_requestor(procdata->completed_requests, pathname);
+   if (handle_request_file(procdata, target, pathname) == -1)
+      err_printf("Could not fetch %s again for child %d\n", pathname, sibling);
+   return 0;
+}
+
+/**
+ * LDCS_MSG_PEER_SEND from our parent asks us to send a file we hold to one
+ * of our siblings.  If we can't, we hand the message back, and the parent,
+ * getting it from a child, gets the file to that sibling itself.
+ **/
+static int handle_peer_send(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   char *pathname, *localname = NULL;
+   void *buffer;
+   size_t size;
+   int sibling, errcode = 0, from_child, result;
+   handle_file_result_t fresult;
+   node_peer_t target;
+   double starttime = ldcs_get_time();
+
+   if (msg->header.len < sizeof(int) + 2 || msg->data[msg->header.len - 1] != '\0') {
+      err_printf("Badly formed peer send message\n");
+      return -1;
+   }
+   memcpy(&sibling, msg->data, sizeof(int));
+   pathname = msg->data + sizeof(int);
+
+   from_child = (ldcs_audit_server_md_get_child_index(procdata, peer) != -1);
+   target = from_child ? ldcs_audit_server_md_get_child(procdata, sibling) :
+                         ldcs_audit_server_md_get_sibling(procdata, sibling);
+
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   fresult = handle_howto_file(procdata, pathname, filename, dirname, &localname, &errcode);
+   if (fresult != FOUND_FILE || target == NODE_PEER_NULL ||
+       ldcs_cache_get_buffer(dirname, filename, &buffer, &size) == -1) {
+      if (from_child)
+         return handle_peer_send_returned(procdata, pathname, sibling, target);
+      debug_printf("Can't send %s to sibling %d, handing it back to our parent\n", pathname, sibling);
+      return ldcs_audit_server_md_send(procdata, msg, peer);
+   }
+
+   debug_printf2("Sending %s to %s %d\n", pathname, from_child ? "child" : "sibling", sibling);
+   result = handle_send_file_contents(procdata, pathname, localname, buffer, size, request_broadcast,
+                                      0, &target, 1, starttime);
+   if (result == -1)
+      return -1;
+   if (!from_child) {
+      procdata->server_stat.lateral.cnt++;
+      procdata->server_stat.lateral.bytes += size;
+      procdata->server_stat.lateral.time += ldcs_get_time() - starttime;
+   }
+   return 0;
+}
+
+/**
+ * Broadcast an error result from reading a file rather than file contents
+ **/
+static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathname, int errcode)
+{
+   char *packet_buffer = NULL;
+   size_t packet_size = 0;
+   int result;
+   int pathname_len = strlen(pathname)+1;
+   int pos = 0;
+   ldcs_message_t msg;
+   double starttime;
+   
+   debug_printf2("Broadcasting errcode result %d for file %s\n", errcode, pathname);
+   packet_size = sizeof(errcode);
+   packet_size += sizeof(pathname_len);
+   packet_size += pathname_len;
+   packet_buffer = (char *) msgpool_alloc(packet_size);
+   memcpy(packet_buffer + pos, &errcode, sizeof(errcode));
+   pos += sizeof(errcode);
+   memcpy(packet_buffer + pos, &pathname_len, sizeof(pathname_len));
+   pos += sizeof(pathname_len);
+   strncpy(packet_buffer + pos, pathname, pathname_len);
+   pos += pathname_len;
+   assert(pos == packet_size);
+   
+   msg.header.type = LDCS_MSG_FILE_ERRCODE;
+   msg.header.len = packet_size;
+   msg.data = packet_buffer;
+
+   starttime = ldcs_get_time();
+   result = handle_send_msg_to_keys(procdata, &msg, pathname, NULL, 0, 0, 0);
+   procdata->server_stat.libdist.cnt++;
+   procdata->server_stat.libdist.bytes += packet_size;
+   procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);      
+
+   msgpool_free(packet_buffer);
+   return result;   
+}
+
+/**
+ * Sends a message to a client with the local path for a sucessfully read file.
+ **/
+static int handle_client_fulfilled_query(ldcs_process_data_t *procdata, int nc)
+{
+   ldcs_message_t out_msg;
+   int connid, flags = 0, passfd = -1, pathoff = sizeof(int), replicated = 0;
+   size_t locallen, globallen;
+   char buffer_out[MAX_PATH_LEN+1+2*sizeof(int)];
+   ldcs_client_t *client = procdata->client_table + nc;
+   lazy_file_t *lf;
+
+   connid = client->connid;
+
+   /* send answer only to active client not to pseudo client */
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+      return 0;
+
+   if (client->is_lazy && (procdata->opts & OPT_LAZYFETCH)) {
+      lf = lazy_find_file(client->query_globalpath);
+      if (lf && !lazy_is_complete(lf))
+         flags |= LDCS_ANSWER_LAZY;
+   }
+
+   /* The client opens the copy on its own NUMA node, which we can't */
+   if ((procdata->opts & OPT_NUMA) && !(flags & LDCS_ANSWER_LAZY) &&
+       strlen(client->query_localpath) + sizeof(NUMA_REPLICA_SUFFIX) <= MAX_PATH_LEN)
+      replicated = numa_replicate(procdata, client->query_localpath);
+
+   /* Save the client a second trip through the filesystem to open it.
+      If we can't open it, the client still gets the path. */
+   if (client->want_fd && ldcs_can_send_fd() && !replicated) {
+      passfd = open(client->query_localpath, O_RDONLY | O_CLOEXEC);
+      if (passfd != -1)
+         flags |= LDCS_ANSWER_FD;
+      else
+         debug_printf2("Could not open %s to pass to client: %s\n", client->query_localpath, strerror(errno));
+   }
+
+   if (client->is_search)
+      flags |= LDCS_ANSWER_SEARCH;
+   locallen = strlen(client->query_localpath) + 1;
+   if (replicated)
+      locallen += strlen(NUMA_REPLICA_SUFFIX);
+   globallen = strlen(client->query_globalpath) + 1;
+   if (client->search_cached && 2*sizeof(int) + locallen + globallen <= MAX_PATH_LEN)
+      flags |= LDCS_ANSWER_SEARCH_PATH;
+
+   out_msg.header.type = LDCS_MSG_FILE_QUERY_ANSWER;
+   out_msg.header.req = client->req;
+   out_msg.data = (void *) buffer_out;
+   memcpy(out_msg.data, &flags, sizeof(int));
+   if (client->is_search) {
+      memcpy(out_msg.data+pathoff, &client->search_index, sizeof(int));
+      pathoff += sizeof(int);
+   }
+   strncpy(out_msg.data+pathoff, client->query_localpath, MAX_PATH_LEN+1);
+   if (replicated)
+      strcat(out_msg.data+pathoff, NUMA_REPLICA_SUFFIX);
+   if (!(flags & LDCS_ANSWER_LAZY))
+      namesnap_publish(procdata, client->query_globalpath, out_msg.data+pathoff, 0);
+   out_msg.header.len = locallen + pathoff;
+   if (flags & LDCS_ANSWER_SEARCH_PATH) {
+      /* The client doesn't know which file ld.so.cache named */
+      memcpy(out_msg.data+pathoff+locallen, client->query_globalpath, globallen);
+      out_msg.header.len += globallen;
+   }
+
+   if (passfd != -1) {
+      ldcs_send_msg_fd(connid, &out_msg, passfd);
+      close(passfd);
+   }
+   else
+      ldcs_send_msg(connid, &out_msg);
+   client->query_open = 0;
+   handle_remember_exec_search(client, 0);
+   client->is_search = 0;
+   handle_pin_client_file(procdata, client);
+   footprint_note_use(client->query_globalpath, 0);
+   if (procdata->opts & OPT_PRELOADLEARN)
+      learn_record(client->query_globalpath, 0);
+   handle_predict(procdata, -(long) nc - 2, client->query_globalpath);
+
+   debug_printf2("Server answering query (fulfilled): %s\n", out_msg.data+pathoff);
+   
+   /* statistic */
+   procdata->server_stat.clientmsg.cnt++;
+   procdata->server_stat.clientmsg.time += ldcs_get_time() -
+      client->query_arrival_time;
+   handle_count_cache_result(procdata, client);
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, client->query_globalpath);
+   return 0;
+}
+
+/**
+ * Count an answered file query as a hit or a miss of our cache.
+ **/
+static void handle_count_cache_result(ldcs_process_data_t *procdata, ldcs_client_t *client)
+{
+   if (client->query_missed)
+      procdata->server_stat.cache_miss.cnt++;
+   else
+      procdata->server_stat.cache_hit.cnt++;
+   steps_count_query(client->step, !client->query_missed);
+   client->query_missed = 0;
+}
+
+/**
+ * Keep a staged file from being evicted while the client it was handed
+ * to is still connected.  We can't see when the client unmaps it, so the
+ * pins are only dropped in handle_client_end.
+ **/
+static void handle_pin_client_file(ldcs_process_data_t *procdata, ldcs_client_t *client)
+{
+   void *handle;
+
+   if (!procdata->cache_budget)
+      return;
+   handle = ldcs_cache_pinEntry(client->query_filename, client->query_dirname);
+   if (!handle)
+      return;
+
+   if (client->pinned_count == client->pinned_size) {
+      client->pinned_size = client->pinned_size ? client->pinned_size * 2 : 16;
+      client->pinned = (void **) realloc(client->pinned, client->pinned_size * sizeof(void *));
+      assert(client->pinned);
+   }
+   client->pinned[client->pinned_count++] = handle;
+}
+
+/**
+ * Sends a message to a client that shows a file wasn't found.
+ **/
+static int handle_client_rejected_query(ldcs_process_data_t *procdata, int nc, int errcode)
+{
+   ldcs_message_t out_msg;
+   int buffer_out;
+
+   out_msg.header.type = LDCS_MSG_FILE_QUERY_ANSWER;
+   out_msg.data = (void *) &buffer_out;
+   buffer_out = errcode;
+   ldcs_client_t *client = procdata->client_table + nc;
+   int connid = client->connid;
+   out_msg.header.req = client->req;
+   
+   /* send answer only to active client not to pseudo client */
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+      return 0;
+
+   out_msg.header.len = sizeof(buffer_out);
+      
+   ldcs_send_msg(connid, &out_msg);
+   client->query_open = 0;
+   handle_remember_exec_search(client, errcode);
+   client->is_search = 0;
+
+   debug_printf2("Server answering query (rejected with errcode %d)\n", errcode);
+      
+   /* statistic */
+   procdata->server_stat.clientmsg.cnt++;
+   procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   handle_count_cache_result(procdata, client);
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, client->query_globalpath);
+   return 0;
+}
+
+/**
+ * Work out the answer to a client file query from the cache alone, for
+ * a client thread (see ldcs_audit_server_clientpool.c).  The caller
+ * holds the read side of the server lock and the client pool's lock, so
+ * this looks at the cache and the client's entry but changes nothing
+ * other than stats.  Returns 1 with the answer in out_msg, whose data
+ * must have room for MAX_PATH_LEN+1+sizeof(int) bytes, or 0 if the query
+ * has to go to the main thread.
+ **/
+int handle_client_cached_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg,
+                               ldcs_message_t *out_msg)
+{
+   char file[MAX_PATH_LEN], dir[MAX_PATH_LEN], globalpath[MAX_PATH_LEN];
+   char *localpath = NULL;
+   int errcode = 0, flags = 0;
+   ldcs_client_t *client = procdata->client_table + nc;
+
+   if (msg->header.type != LDCS_MSG_FILE_QUERY && msg->header.type != LDCS_MSG_FILE_QUERY_EXACT_PATH)
+      return 0;
+   /* Answers that pin files, or depend on preload or lazy state, stay on the main thread */
+   if (procdata->cache_budget || (procdata->opts & OPT_LAZYFETCH) ||
+       ((procdata->opts & OPT_PRELOAD) && !procdata->preload_done))
+      return 0;
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || client->connid < 0 ||
+       client->query_open || client->range_open)
+      return 0;
+   if (!msg->data || msg->data[0] == '*' || msg->data[0] == '$')
+      return 0;
+
+   canonicalizePath(client_cwd(client), msg->data, file, dir, MAX_PATH_LEN);
+   snprintf(globalpath, MAX_PATH_LEN, "%s/%s", dir, file);
+   /* The main thread publishes its answer, so the client's next lookup doesn't reach us */
+   if (namesnap_missing(globalpath))
+      return 0;
+
+   switch (handle_howto_file(procdata, globalpath, file, dir, &localpath, &errcode)) {
+      case FOUND_FILE:
+         out_msg->header.type = LDCS_MSG_FILE_QUERY_ANSWER;
+         out_msg->header.req = msg->header.req;
+         memcpy(out_msg->data, &flags, sizeof(int));
+         strncpy(out_msg->data+sizeof(int), localpath, MAX_PATH_LEN+1);
+         out_msg->header.len = strlen(localpath) + 1 + sizeof(int);
+         debug_printf2("Client thread answering query (fulfilled): %s\n", localpath);
+         if (procdata->opts & OPT_PRELOADLEARN)
+            learn_record(globalpath, 0);
+         return 1;
+      case NO_FILE:
+         errcode = ENOENT;
+         /* fall through */
+      case FOUND_ERRCODE:
+         out_msg->header.type = LDCS_MSG_FILE_QUERY_ANSWER;
+         out_msg->header.req = msg->header.req;
+         memcpy(out_msg->data, &errcode, sizeof(int));
+         out_msg->header.len = sizeof(int);
+         debug_printf2("Client thread answering query (rejected with errcode %d)\n", errcode);
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+/**
+ * Set server to shutdown
+ **/
+static int handle_exit_broadcast(ldcs_process_data_t *procdata)
+{
+   ldcs_message_t out_msg;
+   debug_printf("Setting up Exiting after receiving exit bcast message\n");
+
+   out_msg.header.type = LDCS_MSG_EXIT;
+   out_msg.header.len = 0;
+   out_msg.data = NULL;
+
+   handle_send_batch(procdata);
+   ldcs_audit_server_md_broadcast(procdata, &out_msg);
+
+   mark_exit();
+   return 0;
+}
+
+/**
+ * We've received a request for a directory or file from the network.
+ * Satisify it, if possible.  Otherwise mark it and forward it on.
+ **/
+static int handle_request(ldcs_process_data_t *procdata, node_peer_t from, ldcs_message_t *msg)
+{
+   int result, global_result = 0;
+   size_t pos, entry_len;
+   char msg_type, *pathname;
+
+   if (procdata->opts & OPT_PFSMETA)
+      handle_statahead_request(procdata, msg);
+
+   /* A request may carry several NUL-separated 'D'/'F'/'C' entries.  'C' asks
+      for a file's contents from a peer that couldn't stage it as an alias.
+      Whatever we can't satisfy locally is forwarded upward as one combined
+      request. */
+   handle_begin_query_batch();
+   for (pos = 0; pos < msg->header.len; pos += entry_len + 1) {
+      entry_len = strnlen(msg->data + pos, msg->header.len - pos);
+      if (!entry_len)
+         continue;
+      msg_type = msg->data[pos];
+      pathname = msg->data + pos + 1;
+
+      debug_printf2("Got request for %s from network\n", pathname);
+      if (msg_type != 'D' && msg_type != 'F' && msg_type != 'C') {
+         err_printf("Badly formed request message with starting char '%c'\n", msg_type);
+         global_result = -1;
+         break;
+      }
+      if (msg_type == 'D')
+         result = handle_request_directory(procdata, from, pathname);
+      else {
+         if (msg_type == 'C')
+            add_requestor(procdata->unaliased_requests, pathname, from);
+         result = handle_request_file(procdata, from, pathname);
+      }
+      if (result == -1)
+         global_result = -1;
+      if (msg_type == 'F')
+         handle_predict(procdata, (long) from, pathname);
+   }
+   if (handle_query_batch_pending() && procdata->aggregate_usec) {
+      /* Let requests siblings send close behind this one join it upward */
+      result = ldcs_audit_server_md_gather_children(procdata, from, procdata->aggregate_usec);
+      if (result == -1)
+         global_result = -1;
+   }
+   result = handle_end_query_batch(procdata);
+   if (result == -1)
+      global_result = -1;
+   pfsmeta_clear();
+
+   return global_result;
+}
+
+/**
+ * With --pfs-metadata, stat pathnames at once if they're on Lustre or GPFS.
+ **/
+static void handle_statahead(ldcs_process_data_t *procdata, char **pathnames, int num)
+{
+   double starttime = ldcs_get_time();
+   int num_stated;
+
+   num_stated = pfsmeta_statahead(pathnames, num);
+   if (!num_stated)
+      return;
+   procdata->server_stat.statahead.cnt += num_stated;
+   procdata->server_stat.statahead.time += ldcs_get_time() - starttime;
+}
+
+/**
+ * Stat the files a network request names that we'll read off disk, before
+ * handling its entries one at a time.
+ **/
+static void handle_statahead_request(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+   char **pathnames, *pathname, *localname;
+   size_t pos, entry_len;
+   int num = 0, errcode;
+
+   pathnames = (char **) malloc((msg->header.len / 2 + 1) * sizeof(char *));
+   if (!pathnames)
+      return;
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   for (pos = 0; pos < msg->header.len; pos += entry_len + 1) {
+      entry_len = strnlen(msg->data + pos, msg->header.len - pos);
+      if (entry_len < 2 || msg->data[pos] != 'F' || pos + entry_len == msg->header.len)
+         continue;
+      pathname = msg->data + pos + 1;
+      if (!ldcs_audit_server_md_is_responsible(procdata, pathname))
+         continue;
+      parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+      localname = NULL;
+      errcode = 0;
+      if (ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode) == LDCS_CACHE_FILE_FOUND)
+         continue;
+      pathnames[num++] = pathname;
+   }
+   handle_statahead(procdata, pathnames, num);
+   free(pathnames);
+}
+
+/**
+ * We've received a request for a directory from the network.
+ * Satisify it, if possible.  Otherwise mark it and forward it on.
+ **/
+static int handle_request_directory(ldcs_process_data_t *procdata, node_peer_t from, char *pathname)
+{
+   
+   handle_file_result_t result = handle_howto_directory(procdata, pathname);
+   int res;
+
+   debug_printf2("Received request for directory %s from network\n", pathname);
+   switch (result) {
+      case READ_DIRECTORY:
+         add_requestor(procdata->pending_requests, pathname, from);
+         return handle_read_and_broadcast_dir(procdata, pathname);
+      case REQ_DIRECTORY:
+         res = handle_send_query(procdata, pathname, 1);
+         add_requestor(procdata->pending_requests, pathname, from);
+         return res;
+      case NO_FILE:
+      case FOUND_FILE:
+         add_requestor(procdata->pending_requests, pathname, from);
+         return handle_broadcast_dir(procdata, pathname, request_broadcast);
+      default:
+         err_printf("Unexpected return from handle_how_directory: %d\n", (int) result);
+         assert(0);
+         return -1;
+   }
+}
+
+/**
+ * We've receieved a request for stat data from a client.  Decide what to do with it
+ **/
+static handle_metadata_result_t handle_howto_metadata(ldcs_process_data_t *procdata, char *pathname)
+{
+   char *localname;
+   int result, responsible;
+
+   result = lookup_stat_cache(pathname, &localname);
+   if (result != -1)
+      return REPORT_METADATA;
+
+   responsible = ldcs_audit_server_md_is_responsible(procdata, pathname);
+   if (responsible)
+      return METADATA_FILE;
+
+   if (been_requested(procdata->pending_metadata_requests, pathname)) {
+      return METADATA_IN_PROGRESS;
+   }
+      
+   return REQUEST_METADATA;
+}
+
+static int handle_client_metadata(ldcs_process_data_t *procdata, int nc)
+{
+   handle_metadata_result_t stat_result;
+   ldcs_client_t *client = procdata->client_table + nc;
+   char *pathname = client->query_globalpath;
+   int broadcast_result, client_result;
+   metadata_t mdtype;
+
+   if (client->is_stat)
+      mdtype = metadata_stat;
+   else if (client->is_loader)
+      mdtype = metadata_loader;
+   else
+      assert(0);
+      
+   stat_result = handle_howto_metadata(procdata, pathname);
+   switch (stat_result) {
+      case REQUEST_METADATA:
+         return handle_metadata_request(procdata, pathname, mdtype, NODE_PEER_CLIENT);
+      case METADATA_FILE:
+         add_requestor(procdata->pending_metadata_requests, pathname, NODE_PEER_CLIENT);
+         broadcast_result = handle_metadata_and_broadcast_file(procdata, pathname, mdtype, request_broadcast);
+         client_result = handle_client_metadata_result(procdata, nc, mdtype);
+         if (broadcast_result == -1 || client_result == -1)
+            return -1;
+         return 0;
+      case REPORT_METADATA:
+         return handle_client_metadata_result(procdata, nc, mdtype);
+      case METADATA_IN_PROGRESS:
+         add_requestor(procdata->pending_metadata_requests, pathname, NODE_PEER_CLIENT);
+         return 0;
+   }
+   err_printf("Unexpected result from handle_howto_metadata: %d\n", (int) stat_result);
+   assert(0);
+   return -1;   
+}
+
+/**
+ * We've received a request for a file from the network.  
+ * Satisify or forward it.
+ **/
+static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from, char *pathname)
+{
+   char *localname;
+   void *buffer;
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   size_t size;
+   handle_file_result_t fresult;
+   int result = 0, dir_result = 0, errcode = 0;
+   lazy_file_t *lf;
+   
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   fresult = handle_howto_file(procdata, pathname, filename, dirname, &localname, &errcode);
+
+   debug_printf2("Received request for file %s from network\n", pathname);
+   if (procdata->cache_budget || (procdata->opts & OPT_VERIFY)) {
+      /* A peer may be asking again because it evicted its copy, or its copy was bad */
+      clear_requestor(procdata->completed_requests, pathname);
+   }
+   switch (fresult) {
+      case FOUND_FILE:
+         lf = (procdata->opts & OPT_LAZYFETCH) ? lazy_find_file(pathname) : NULL;
+         if (lf) {
+            add_requestor(procdata->pending_requests, pathname, from);
+            return handle_broadcast_lazy_file(procdata, pathname, lazy_file_size(lf));
+         }
+         result = ldcs_cache_get_buffer(dirname, filename, &buffer, &size);
+         if (result == -1) {
+            err_printf("Failed to lookup %s / %s in cache\n", dirname, filename);
+            return -1;
+         }
+         if ((procdata->opts & OPT_VERIFY) && handle_verify_staged(procdata, pathname, localname, buffer, size))
+            return handle_request_file(procdata, from, pathname);
+         add_requestor(procdata->pending_requests, pathname, from);
+         result = handle_broadcast_file(procdata, pathname, localname, buffer, size, request_broadcast);
+         return result;
+      case FOUND_ERRCODE:
+         add_requestor(procdata->pending_requests, pathname, from);         
+         return handle_broadcast_errorcode(procdata, pathname, errcode);
+      case NO_FILE:
+         return handle_create_selfload_file(procdata, pathname);
+      case READ_DIRECTORY:
+         result = handle_read_and_broadcast_dir(procdata, dirname);
+         if (result == -1)
+            return -1;
+         return handle_request_file(procdata, from, pathname);
+      case READ_FILE:
+         add_requestor(procdata->pending_requests, pathname, from);
+         return handle_read_and_broadcast_file(procdata, pathname, request_broadcast);
+      case REQ_DIRECTORY:
+         dir_result = handle_send_query(procdata, dirname, 1);
+         add_requestor(procdata->pending_requests, dirname, from);
+         /* Fall through to next case and request file */
+      case REQ_FILE:
+         result = handle_send_query(procdata, pathname, 0);
+         add_requestor(procdata->pending_requests, pathname, from);
+         return (result == -1 || dir_result == -1) ? -1 : 0;
+   }
+   assert(0);
+   return -1;
+}
+
+/**
+ * Requests another node on the network to read a file or directory off disk
+ * and forward it to us.
+ **/
+static int handle_send_query(ldcs_process_data_t *procdata, char *path, int is_dir)
+{
+   if (been_requested(procdata->pending_requests, path)) {
+      debug_printf2("File %s has already been requested.  Not re-sending request\n", path);
+      return 0;
+   }
+   if (!is_dir && handle_read_in_flight(path)) {
+      debug_printf2("File %s is being read.  Not sending request\n", path);
+      return 0;
+   }
+            
+   if (is_dir)
+      return handle_send_directory_query(procdata, path);
+   else {
+      return handle_send_file_query(procdata, path);
+   }
+}
+
+/**
+ * Queries sent up the network while a query batch is open are collected
+ * here and sent as a single multi-entry request when the batch closes.
+ * Batches nest; only the outermost close sends.
+ **/
+static struct {
+   int depth;
+   char *buffer;
+   size_t used;
+   size_t size;
+} query_batch;
+
+static void handle_begin_query_batch()
+{
+   query_batch.depth++;
+}
+
+/**
+ * True if the outermost query batch is open and has entries to send.
+ **/
+static int handle_query_batch_pending()
+{
+   return query_batch.depth == 1 && query_batch.used;
+}
+
+/**
+ * True if the open query batch already holds entry, len bytes plus its NUL.
+ **/
+static int handle_query_batch_has(char *entry, size_t len)
+{
+   size_t pos, entry_len;
+   for (pos = 0; pos < query_batch.used; pos += entry_len + 1) {
+      entry_len = strlen(query_batch.buffer + pos);
+      if (entry_len == len && memcmp(query_batch.buffer + pos, entry, len) == 0)
+         return 1;
+   }
+   return 0;
+}
+
+static int handle_end_query_batch(ldcs_process_data_t *procdata)
+{
+   ldcs_message_t out_msg;
+   int result = 0;
+
+   assert(query_batch.depth > 0);
+   if (--query_batch.depth || !query_batch.used)
+      return 0;
+
+   debug_printf2("Sending batched request of %lu bytes up network\n", (unsigned long) query_batch.used);
+   out_msg.header.type = LDCS_MSG_FILE_REQUEST;
+   out_msg.header.len = query_batch.used;
+   out_msg.data = query_batch.buffer;
+   result = ldcs_audit_server_md_forward_query(procdata, &out_msg);
+   query_batch.used = 0;
+   return result;
+}
+
+/**
+ * Send a single 'D', 'F' or 'C' request entry up the network, or append
+ * it to the open query batch.
+ **/
+static int handle_forward_query_entry(ldcs_process_data_t *procdata, char type, char *path)
+{
+   ldcs_message_t out_msg;
+   char buffer_out[MAX_PATH_LEN+1], *new_buffer;
+   size_t new_size = 0;
+   int bytes_written;
+
+   bytes_written = snprintf(buffer_out, MAX_PATH_LEN+1, "%c%s", type, path);
+   if (bytes_written > MAX_PATH_LEN)
+      bytes_written = MAX_PATH_LEN;
+   latency_wait_begin(type == 'D' ? 'D' : 'F', path);
+
+   if (query_batch.depth) {
+      if (handle_query_batch_has(buffer_out, bytes_written)) {
+         debug_printf2("%s is already in the batched request.  Not adding it again\n", buffer_out);
+         return 0;
+      }
+      if (query_batch.used + bytes_written + 1 > query_batch.size) {
+         new_size = query_batch.size ? query_batch.size * 2 : 4096;
+         while (query_batch.used + bytes_written + 1 > new_size)
+            new_size *= 2;
+         new_buffer = (char *) realloc(query_batch.buffer, new_size);
+         if (new_buffer) {
+            query_batch.buffer = new_buffer;
+            query_batch.size = new_size;
+         }
+      }
+      if (query_batch.used + bytes_written + 1 <= query_batch.size) {
+         memcpy(query_batch.buffer + query_batch.used, buffer_out, bytes_written + 1);
+         query_batch.used += bytes_written + 1;
+         return 0;
+      }
+      /* The batch keeps what it has, and this query goes up on its own */
+      err_printf("Could not allocate %lu bytes for query batch, sending %s unbatched\n",
+                 (unsigned long) new_size, buffer_out);
+   }
+
+   out_msg.header.type = LDCS_MSG_FILE_REQUEST;
+   out_msg.header.len = bytes_written+1;
+   out_msg.data = buffer_out;
+   ldcs_audit_server_md_forward_query(procdata, &out_msg);
+   return 0;
+}
+
+/**
+ * We've received request for a directory's contents. Request it from up the network.
+ **/
+static int handle_send_directory_query(ldcs_process_data_t *procdata, char *directory)
+{
+   debug_printf2("Sending directory request for %s up network\n", directory);
+   return handle_forward_query_entry(procdata, 'D', directory);
+}
+
+/**
+ * We've received request for a files's contents. Request it from up the network.
+ **/
+static int handle_send_file_query(ldcs_process_data_t *procdata, char *fullpath)
+{
+   debug_printf2("Sending file request for %s up network\n", fullpath);
+   return handle_forward_query_entry(procdata, 'F', fullpath);
+}
+
+/**
+ * A parent server is sending us an errcode associated with a file.  Receive it.
+ **/
+static int handle_file_errcode(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast)
+{
+   char *pathname;
+   int errcode, pathname_len, result, pos = 0;
+   unsigned char *data;
+
+   data = (unsigned char *) msg->data;
+   errcode = *((int *) (data + pos));
+   pos += sizeof(errcode);
+   pathname_len = *((int *) (data + pos));
+   pos += sizeof(pathname_len);
+   pathname = (char *) (data + pos);
+   pos += pathname_len;
+   assert(pos == msg->header.len);
+
+   debug_printf2("Received errcode result %d from read of %s\n", errcode, pathname);
+   latency_wait_end('F', pathname);
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   ldcs_cache_updateEntry(filename, dirname, NULL, NULL, 0, errcode);
+
+   result = handle_broadcast_errorcode(procdata, pathname, errcode);
+   if (result == -1)
+      return -1;
+
+   return handle_progress_path(procdata, pathname);
+}
+
+/**
+ * A parent server is telling us a file has the same contents as one we
+ * already have.  Stage it as a link to that file.
+ **/
+static int handle_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast)
+{
+   char *pathname, *canonical, *localname = NULL;
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+   int pathname_len, canonical_len, pos = 0, result, errcode = 0;
+   unsigned char *data;
+   void *buffer;
+   size_t size;
+
+   data = (unsigned char *) msg->data;
+   memcpy(&pathname_len, data + pos, sizeof(pathname_len));
+   pos += sizeof(pathname_len);
+   pathname = (char *) (data + pos);
+   pos += pathname_len;
+   memcpy(&canonical_len, data + pos, sizeof(canonical_len));
+   pos += sizeof(canonical_len);
+   canonical = (char *) (data + pos);
+   pos += canonical_len;
+   assert(pos == msg->header.len);
+
+   debug_printf("Receiving %s as an alias of %s from %s\n", pathname, canonical,
+                bcast == preload_broadcast ? "preload" : "request");
+
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode) == LDCS_CACHE_FILE_FOUND &&
+       localname) {
+      debug_printf("File %s was already loaded\n", pathname);
+      return handle_progress_path(procdata, pathname);
+   }
+
+   /* canonical may have been evicted, or the link failed.  Clients are
+      still waiting on pathname, so ask our parent for its contents. */
+   result = handle_link_file(procdata, pathname, canonical, &localname, &buffer, &size);
+   if (result == -1) {
+      debug_printf("Could not stage %s as a link to %s.  Requesting its contents\n", pathname, canonical);
+      return handle_forward_query_entry(procdata, 'C', pathname);
+   }
+
+   result = handle_broadcast_file(procdata, pathname, localname, buffer, size, bcast);
+   if (result == -1)
+      return -1;
+
+   return handle_progress_path(procdata, pathname);
+}
+
+/**
+ * A parent server is sending us a file.  Receive it from the network
+ **/
+static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast)
+{
+   char pathname[MAX_PATH_LEN+1], sharedkey[MAX_NAME_LEN+1], *localname;
+   char *buffer = NULL, *zbuffer = NULL;
+   size_t size = 0, raw_size = 0;
+   int result, global_error = 0, already_loaded, fd = -1, forwarded = 0;
+   int encoding = FILE_ENCODING_RAW;
+   uint32_t crc = 0;
+   double starttime;
+   pathname[MAX_PATH_LEN] = '\0';
+
+   assert(!msg->data); /* If this hits, then the network layer read a entire FILE_DATA packet
+                          rather than just the header */
+
+   /* We haven't read the file data off the network.  We'll postpone doing that
+      until we have the memory allocated for it in a mapped region of our address
+      space.  The decode packet will just read the pathname and size. */
+   result = filemngt_decode_packet(peer, msg, pathname, &size, &raw_size, &encoding, &crc, sharedkey);
+   if (result == -1) {
+      global_error = -1;
+      goto done;
+   }
+
+   latency_wait_end('F', pathname);
+   SPINDLE_PROBE2(bcast_recv, pathname, raw_size);
+   debug_printf("Receiving %sfile contents for file %s from %s\n", 
+                encoding == FILE_ENCODING_LZ ? "compressed " :
+                encoding == FILE_ENCODING_DELTA ? "changes to the " :
+                encoding == FILE_ENCODING_SPARSE ? "data extents of " : "", pathname, 
+                bcast == preload_broadcast ? "preload" : "request");
+
+   /* Changes need the last version we staged, and a checked copy needs the
+      contents as sent, so only whole files come from the shared cache */
+   if (sharedkey[0]) {
+      filemngt_shared_cache_remember(pathname, sharedkey);
+      if (encoding != FILE_ENCODING_DELTA && !(procdata->opts & OPT_VERIFY)) {
+         result = handle_recv_shared_file(procdata, peer, pathname, sharedkey, size, bcast);
+         if (result != 1) {
+            global_error = result;
+            goto done;
+         }
+      }
+   }
+   else
+      filemngt_shared_cache_forget(pathname);
+
+   /* Setup up a memory buffer for us to read into, which is mapped to the
+      local file.  Also fills in the hash table.  Does not actually read
+      the file data */
+   buffer = handle_setup_file_buffer(procdata, pathname, raw_size, &fd, &localname, &already_loaded);
+   if (!buffer) {
+      if (already_loaded) {
+         debug_printf("File %s was already loaded\n", pathname);
+      }
+      else {
+         debug_printf("Problem allocating memory for buffer.  Flushing out read from the network\n");
+         global_error = -1;
+      }
+      ldcs_audit_server_md_trash_bytes(peer, size);
+      goto done;
+   }
+
+   /* Compressed contents, changes and extents are read to the heap and
+      decoded into the buffer.  We pass them on to other servers still encoded. */
+   if (encoding != FILE_ENCODING_RAW) {
+      zbuffer = (char *) malloc(size);
+      if (!zbuffer) {
+         err_printf("Could not allocate %lu bytes for encoded contents of %s\n", 
+                    (unsigned long) size, pathname);
+         ldcs_audit_server_md_trash_bytes(peer, size);
+         global_error = -1;
+         goto done;
+      }
+   }
+
+   /* No we'll go ahead and read the file data.  Big files are forwarded to
+      our children while we read them, so they don't wait for the whole file.
+      Changes are sent on once we've applied them, to the children that have
+      the last version, and the file whole to the rest. */
+   if (size > FILE_CHUNK_SIZE && bcast != suppress_broadcast && encoding != FILE_ENCODING_DELTA) {
+      forwarded = 1;
+      if (zbuffer)
+         result = handle_file_recv_and_forward(procdata, msg, peer, pathname, -1, zbuffer, size,
+                                               raw_size, encoding, crc, bcast);
+      else
+         result = handle_file_recv_and_forward(procdata, msg, peer, pathname, fd, buffer, size,
+                                               raw_size, encoding, crc, bcast);
+   }
+   else if (zbuffer) {
+      result = ldcs_audit_server_md_complete_msg_read_file(peer, msg, -1, zbuffer, size);
+   }
+   else {
+      result = ldcs_audit_server_md_complete_msg_read_file(peer, msg, fd, buffer, size);
+   }
+   if (result == -1) {
+      global_error = -1;
+      goto done;
+   }
+
+   if (encoding == FILE_ENCODING_DELTA) {
+      starttime = ldcs_get_time();
+      result = delta_apply(pathname, zbuffer, size, buffer, raw_size);
+      procdata->server_stat.delta.time += (ldcs_get_time() - starttime);
+      if (result == -1) {
+         global_error = -1;
+         goto done;
+      }
+      zbuffer = NULL;
+   }
+   else if (encoding == FILE_ENCODING_SPARSE) {
+      starttime = ldcs_get_time();
+      result = filemngt_sparse_decode(zbuffer, size, buffer, raw_size, fd);
+      procdata->server_stat.sparse.time += (ldcs_get_time() - starttime);
+      if (result == -1) {
+         err_printf("Data extents of %s from our parent are corrupt\n", pathname);
+         global_error = -1;
+         goto done;
+      }
+   }
+   else if (zbuffer) {
+      starttime = ldcs_get_time();
+      result = decompress_buffer(zbuffer, size, buffer, raw_size);
+      procdata->server_stat.libdist_raw.time += (ldcs_get_time() - starttime);
+      if (result == -1) {
+         err_printf("Compressed contents of %s from our parent are corrupt\n", pathname);
+         global_error = -1;
+         goto done;
+      }
+   }
+
+   /* Syncs the file contents to disk and sets local access permissions */
+   result = handle_finish_buffer_setup(procdata, localname, pathname, &fd, buffer, raw_size, raw_size, 0);
+   if (result == -1) {
+      global_error = -1;
+      goto done;
+   }
+
+   if (procdata->opts & OPT_VERIFY) {
+      result = handle_verify_received(procdata, pathname, localname, raw_size, crc);
+      if (result == -1)
+         global_error = -1;
+      if (result)
+         goto done;
+   }
+   handle_publish_received(procdata, pathname, localname);
+
+   /* Notify other servers and clients of file read.  The compressed copy
+      goes in the cache so we send it on without compressing it again.
+      Extents are found again in our staged copy. */
+   if (!forwarded) {
+      if (zbuffer && encoding == FILE_ENCODING_LZ) {
+         char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+         parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+         if (ldcs_cache_setCompressed(filename, dirname, zbuffer, size) == 0)
+            zbuffer = NULL;
+      }
+      result = handle_broadcast_file(procdata, pathname, localname, buffer, raw_size, bcast);
+      if (result == -1) {
+         global_error = -1;
+      }
+   }
+   else
+      handle_unmap_sent_file(procdata, pathname);
+   result = handle_progress_path(procdata, pathname);
+   if (result == -1) {
+      global_error = -1;
+   }
+
+  done:
+   if (zbuffer)
+      free(zbuffer);
+   if (fd != -1)
+      close(fd);
+   return global_error;
+}
+
+/**
+ * Read a file's contents off the network into buffer, passing each chunk on
+ * to the children that should get the file as soon as it arrives.  Each
+ * level of the tree then only waits for one chunk, not the whole file.
+ * The contents are forwarded in the encoding they arrived in.
+ **/
+static int handle_file_recv_and_forward(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer,
+                                        char *pathname, int fd, char *buffer, size_t size,
+                                        size_t raw_size, int encoding, uint32_t crc, broadcast_t bcast)
+{
+   char *packet_buffer = NULL;
+   size_t packet_size;
+   double starttime;
+   int result, all_children, num_peers;
+   node_peer_t *peers = NULL;
+   ldcs_message_t out_msg;
+
+   result = filemngt_encode_packet(pathname, buffer, size, raw_size, encoding, crc,
+                                   filemngt_shared_cache_known(pathname), &packet_buffer, &packet_size);
+   if (result == -1) {
+      ldcs_audit_server_md_trash_bytes(peer, size);
+      return -1;
+   }
+   out_msg.header.type = (bcast == preload_broadcast) ? LDCS_MSG_PRELOAD_FILE : LDCS_MSG_FILE_DATA;
+   out_msg.header.len = packet_size;
+   out_msg.data = packet_buffer;
+
+   all_children = handle_select_msg_targets(procdata, pathname, bcast == preload_broadcast, 0,
+                                            &peers, &num_peers);
+   if (!all_children && !num_peers) {
+      debug_printf3("No children need %s, reading it without forwarding\n", pathname);
+      result = ldcs_audit_server_md_complete_msg_read_file(peer, msg, fd, buffer, size);
+      goto done;
+   }
+
+   debug_printf2("Forwarding %s to %s in chunks as it arrives\n", pathname,
+                 all_children ? "all children" : "requesting children");
+   starttime = ldcs_get_time();
+   result = ldcs_audit_server_md_forward_noncontig(procdata, &out_msg, peer, all_children ? NULL : peers,
+                                                   num_peers, fd, buffer, size, FILE_CHUNK_SIZE);
+   if (result != -1 && all_children)
+      result = handle_bypass_slow_children(procdata, &out_msg, fd, buffer, size);
+
+   procdata->server_stat.libdist.cnt++;
+   procdata->server_stat.libdist.bytes += packet_size;
+   procdata->server_stat.libdist.time += (ldcs_get_time()-starttime);
+   latency_record(latency_bcast_id(raw_size), starttime, pathname);
+   if (encoding == FILE_ENCODING_LZ)
+      procdata->server_stat.libdist_raw.cnt++;
+   procdata->server_stat.libdist_raw.bytes += raw_size;
+
+  done:
+   if (peers)
+      free(peers);
+   msgpool_free(packet_buffer);
+   return result;
+}
+
+/**
+ * If pathname is a big data file and lazy fetching is on, stage it as a
+ * sparse file instead of reading it, and tell the other servers about it.
+ * Sets *staged if it was staged lazily.
+ **/
+static int handle_lazy_stage_file(ldcs_process_data_t *procdata, char *pathname, int *staged)
+{
+   size_t size;
+   int errcode = 0;
+   lazy_file_t *lf;
+
+   *staged = 0;
+   size = filemngt_get_file_size(pathname, &errcode);
+   if (size == (size_t) -1 || !lazy_is_candidate(pathname, size))
+      return 0;
+
+   lf = handle_setup_lazy_file(procdata, pathname, size, 1);
+   if (!lf)
+      return -1;
+   *staged = 1;
+   if (handle_broadcast_lazy_file(procdata, pathname, size) == -1)
+      return -1;
+   if (procdata->opts & OPT_HOTEXTENTS)
+      return handle_start_lazy_push(procdata, lf);
+   return 0;
+}
+
+/**
+ * Put a lazily staged file in the cache, backed by a sparse local file.  If
+ * we already have the whole file staged, it's tracked as a lazy file that
+ * has all its extents.
+ **/
+static lazy_file_t *handle_setup_lazy_file(ldcs_process_data_t *procdata, char *pathname, size_t size, int is_source)
+{
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+   char *localname = NULL;
+   ldcs_cache_result_t cresult;
+   lazy_file_t *lf;
+   int errcode = 0;
+
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+
+   cresult = ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode);
+   if (cresult == LDCS_CACHE_FILE_FOUND && localname) {
+      debug_printf3("File %s was already staged at %s, tracking it as complete\n", pathname, localname);
+      return lazy_add_complete_file(pathname, localname, size);
+   }
+   if (cresult == LDCS_CACHE_FILE_NOT_FOUND)
+      ldcs_cache_addFileDir(dirname, filename);
+
+   localname = filemngt_calc_file_localname(pathname, size);
+   assert(localname);
+   lf = lazy_add_file(pathname, localname, size, is_source);
+   if (!lf) {
+      free(localname);
+      return NULL;
+   }
+   add_global_name(pathname, localname);
+   ldcs_cache_updateEntry(filename, dirname, localname, NULL, 0, 0);
+   return lf;
+}
+
+/**
+ * Tell child servers that pathname is staged lazily and how big it is.
+ * They fetch the extents they need from us later.
+ **/
+static int handle_broadcast_lazy_file(ldcs_process_data_t *procdata, char *pathname, size_t size)
+{
+   ldcs_message_t msg;
+   char *packet;
+   int pathname_len = strlen(pathname) + 1, result;
+
+   packet = (char *) malloc(sizeof(size) + pathname_len);
+   if (!packet) {
+      err_printf("Could not allocate lazy file message for %s\n", pathname);
+      return -1;
+   }
+   memcpy(packet, &size, sizeof(size));
+   memcpy(packet + sizeof(size), pathname, pathname_len);
+
+   msg.header.type = LDCS_MSG_LAZY_FILE;
+   msg.header.len = sizeof(size) + pathname_len;
+   msg.data = packet;
+
+   debug_printf2("Sending lazy file %s of %lu bytes to other servers\n", pathname, (unsigned long) size);
+   result = handle_send_msg_to_keys(procdata, &msg, pathname, NULL, 0, 0, 0);
+   free(packet);
+   return result;
+}
+
+/**
+ * A parent server is telling us a file is staged lazily.  Stage our own
+ * sparse copy, and pass the news on.
+ **/
+static int handle_lazy_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   char *pathname;
+   size_t size;
+   lazy_file_t *lf;
+   int result;
+
+   if (msg->header.len <= (int) sizeof(size) || msg->data[msg->header.len-1] != '\0') {
+      err_printf("Badly formed lazy file message\n");
+      return -1;
+   }
+   memcpy(&size, msg->data, sizeof(size));
+   pathname = msg->data + sizeof(size);
+   debug_printf2("Received lazy file %s of %lu bytes\n", pathname, (unsigned long) size);
+
+   lf = lazy_find_file(pathname);
+   if (!lf)
+      lf = handle_setup_lazy_file(procdata, pathname, size, 0);
+   if (!lf)
+      return -1;
+
+   result = handle_broadcast_lazy_file(procdata, pathname, size);
+   if (result == -1)
+      return -1;
+   return handle_progress_path(procdata, pathname);
+}
+
+/**
+ * Make sure extents first through last of a lazy file are on their way.
+ * The source reads them off disk now.  Other servers ask their parent for
+ * the ones nobody has asked for yet.
+ **/
+static int handle_lazy_fetch(ldcs_process_data_t *procdata, lazy_file_t *lf, size_t first, size_t last)
+{
+   size_t run_first, run_last, bytes;
+   double starttime;
+   int result;
+
+   while (lazy_next_missing(lf, first, last, &run_first, &run_last)) {
+      if (!lazy_is_source(lf)) {
+         result = handle_send_range_request(procdata, lf, run_first, run_last);
+         if (result == -1)
+            return -1;
+         continue;
+      }
+
+      starttime = ldcs_get_time();
+      result = lazy_read_extents(lf, run_first, run_last, &bytes);
+      if (result == -1)
+         return -1;
+      procdata->server_stat.lazy.cnt += run_last - run_first + 1;
+      procdata->server_stat.lazy.bytes += bytes;
+      procdata->server_stat.lazy.time += ldcs_get_time() - starttime;
+   }
+   return 0;
+}
+
+/**
+ * Ask our parent for extents first through last of a lazy file.
+ **/
+static int handle_send_range_request(ldcs_process_data_t *procdata, lazy_file_t *lf, size_t first, size_t last)
+{
+   ldcs_message_t msg;
+   char buffer[2*sizeof(size_t)+MAX_PATH_LEN+1];
+   char *pathname = lazy_file_name(lf);
+   int pathname_len = strlen(pathname) + 1;
+
+   debug_printf2("Requesting extents %lu to %lu of %s up network\n", (unsigned long) first,
+                 (unsigned long) last, pathname);
+   memcpy(buffer, &first, sizeof(first));
+   memcpy(buffer + sizeof(first), &last, sizeof(last));
+   memcpy(buffer + 2*sizeof(size_t), pathname, pathname_len);
+
+   msg.header.type = LDCS_MSG_FILE_RANGE_REQUEST;
+   msg.header.len = 2*sizeof(size_t) + pathname_len;
+   msg.data = buffer;
+   return ldcs_audit_server_md_forward_query(procdata, &msg);
+}
+
+/**
+ * A child server wants some extents of a lazy file.  Send them once we have
+ * them.
+ **/
+static int handle_range_request_recv(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg)
+{
+   size_t first, last;
+   char *pathname;
+   lazy_file_t *lf;
+   int result;
+
+   if (msg->header.len <= (int) (2*sizeof(size_t)) || msg->data[msg->header.len-1] != '\0') {
+      err_printf("Badly formed range request\n");
+      return -1;
+   }
+   memcpy(&first, msg->data, sizeof(first));
+   memcpy(&last, msg->data + sizeof(first), sizeof(last));
+   pathname = msg->data + 2*sizeof(size_t);
+
+   lf = lazy_find_file(pathname);
+   if (!lf) {
+      err_printf("Child asked for extents of %s, which isn't staged lazily here\n", pathname);
+      return -1;
+   }
+   debug_printf2("Child requested extents %lu to %lu of %s\n", (unsigned long) first, (unsigned long) last, pathname);
+
+   lazy_add_waiter(lf, peer, first, last);
+   result = handle_lazy_fetch(procdata, lf, first, last);
+   if (result == -1)
+      return -1;
+   return handle_send_ready_ranges(procdata, lf);
+}
+
+/**
+ * Send extents to every child server whose requested extents of lf are
+ * now all staged.
+ **/
+static int handle_send_ready_ranges(ldcs_process_data_t *procdata, lazy_file_t *lf)
+{
+   node_peer_t peer;
+   size_t first, last, offset, len;
+   char *packet;
+   int packet_len, result, global_result = 0;
+   ldcs_message_t msg;
+   double starttime;
+
+   while (lazy_pop_ready_waiter(lf, &peer, &first, &last)) {
+      packet = handle_pack_range(lf, first, last, &offset, &len, &packet_len);
+      if (!packet) {
+         global_result = -1;
+         continue;
+      }
+      debug_printf2("Sending %lu bytes at %lu of %s to child\n", (unsigned long) len,
+                    (unsigned long) offset, lazy_file_name(lf));
+      msg.header.type = LDCS_MSG_FILE_RANGE_DATA;
+      msg.header.len = packet_len;
+      msg.data = packet;
+      starttime = ldcs_get_time();
+      result = ldcs_audit_server_md_send(procdata, &msg, peer);
+      procdata->server_stat.libdist.cnt++;
+      procdata->server_stat.libdist.bytes += len;
+      procdata->server_stat.libdist.time += ldcs_get_time() - starttime;
+      if (result == -1)
+         global_result = -1;
+      free(packet);
+   }
+   return global_result;
+}
+
+/**
+ * Build a range data message with extents first through last of lf, which
+ * we have staged.  Returns the malloced message, or NULL.
+ **/
+static char *handle_pack_range(lazy_file_t *lf, size_t first, size_t last, size_t *offset, size_t *len,
+                               int *packet_len)
+{
+   char *pathname = lazy_file_name(lf), *packet;
+   int pathname_len = strlen(pathname) + 1, header_len;
+
+   header_len = sizeof(int) + 2*sizeof(size_t) + pathname_len;
+   lazy_extent_bytes(lf, first, last, offset, len);
+   packet = (char *) malloc(header_len + *len);
+   if (!packet) {
+      err_printf("Could not allocate %lu bytes to send extents of %s\n", (unsigned long) *len, pathname);
+      return NULL;
+   }
+   memcpy(packet, &pathname_len, sizeof(int));
+   memcpy(packet + sizeof(int), offset, sizeof(*offset));
+   memcpy(packet + sizeof(int) + sizeof(*offset), len, sizeof(*len));
+   memcpy(packet + sizeof(int) + 2*sizeof(size_t), pathname, pathname_len);
+   if (lazy_read_local(lf, *offset, packet + header_len, *len) == -1) {
+      free(packet);
+      return NULL;
+   }
+   *packet_len = header_len + *len;
+   return packet;
+}
+
+/**
+ * Extents of a lazy file arrived from our parent.  Store them, pass them to
+ * any children waiting on them, and wake up clients.  Pushed extents go on
+ * to all our children.
+ **/
+static int handle_range_data_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, int pushed)
+{
+   int pathname_len, header_len, result, global_result = 0;
+   size_t offset, len;
+   char *pathname;
+   lazy_file_t *lf;
+
+   if (msg->header.len < (int) (sizeof(int) + 2*sizeof(size_t))) {
+      err_printf("Badly formed range data message\n");
+      return -1;
+   }
+   memcpy(&pathname_len, msg->data, sizeof(int));
+   memcpy(&offset, msg->data + sizeof(int), sizeof(offset));
+   memcpy(&len, msg->data + sizeof(int) + sizeof(offset), sizeof(len));
+   header_len = sizeof(int) + 2*sizeof(size_t) + pathname_len;
+   if (pathname_len <= 0 || header_len + len != (size_t) msg->header.len ||
+       msg->data[header_len-1] != '\0') {
+      err_printf("Badly formed range data message\n");
+      return -1;
+   }
+   pathname = msg->data + sizeof(int) + 2*sizeof(size_t);
+
+   lf = lazy_find_file(pathname);
+   if (!lf && pushed) {
+      debug_printf3("Dropping pushed extents of %s, which isn't staged lazily here\n", pathname);
+      return 0;
+   }
+   if (!lf) {
+      err_printf("Received extents of %s, which isn't staged lazily here\n", pathname);
+      return -1;
+   }
+   debug_printf2("Received %lu %sbytes at %lu of %s\n", (unsigned long) len, pushed ? "pushed " : "",
+                 (unsigned long) offset, pathname);
+
+   result = lazy_write_range(lf, offset, msg->data + header_len, len);
+   if (result == -1)
+      return -1;
+   procdata->server_stat.lazy.cnt += (len + LAZY_EXTENT_SIZE - 1) / LAZY_EXTENT_SIZE;
+   procdata->server_stat.lazy.bytes += len;
+   if (pushed) {
+      procdata->server_stat.lazypush.cnt++;
+      procdata->server_stat.lazypush.bytes += len;
+      if (ldcs_audit_server_md_broadcast(procdata, msg) == -1)
+         global_result = -1;
+   }
+
+   result = handle_send_ready_ranges(procdata, lf);
+   if (result == -1)
+      global_result = -1;
+   result = handle_progress(procdata);
+   if (result == -1)
+      global_result = -1;
+   return global_result;
+}
+
+/**
+ * With --hot-extents, start pushing a lazy file we just staged as its
+ * source: first the extents clients read last run, then the rest of it,
+ * a run each timer tick.
+ **/
+static int handle_start_lazy_push(ldcs_process_data_t *procdata, lazy_file_t *lf)
+{
+   static int loaded_profile = 0;
+   char filename[MAX_PATH_LEN+1];
+   size_t first, last;
+
+   if (!loaded_profile) {
+      loaded_profile = 1;
+      snprintf(filename, sizeof(filename), "%s%s", procdata->preloadfile, LEARN_EXTENTS_SUFFIX);
+      lazy_load_profile(filename);
+   }
+   if (!lazy_start_push(lf))
+      return 0;
+   if (lazy_next_push(lf, &first, &last) && handle_push_extents(procdata, lf, first, last) == -1)
+      return -1;
+   return lazy_start_push_timer(handle_lazy_push_timer, procdata);
+}
+
+/**
+ * Push extents first through last of lf to every server, reading them off
+ * disk first if no client has.
+ **/
+static int handle_push_extents(ldcs_process_data_t *procdata, lazy_file_t *lf, size_t first, size_t last)
+{
+   ldcs_message_t msg;
+   size_t offset, len;
+   char *packet;
+   int packet_len, result;
+   double starttime;
+
+   if (!lazy_range_present(lf, first, last)) {
+      result = handle_lazy_fetch(procdata, lf, first, last);
+      if (result == -1)
+         return -1;
+   }
+   packet = handle_pack_range(lf, first, last, &offset, &len, &packet_len);
+   if (!packet)
+      return -1;
+
+   debug_printf3("Pushing %lu bytes at %lu of %s\n", (unsigned long) len, (unsigned long) offset,
+                 lazy_file_name(lf));
+   msg.header.type = LDCS_MSG_FILE_RANGE_PUSH;
+   msg.header.len = packet_len;
+   msg.data = packet;
+   starttime = ldcs_get_time();
+   result = ldcs_audit_server_md_broadcast(procdata, &msg);
+   procdata->server_stat.lazypush.cnt++;
+   procdata->server_stat.lazypush.bytes += len;
+   procdata->server_stat.lazypush.time += ldcs_get_time() - starttime;
+   free(packet);
+   return result;
+}
+
+/**
+ * Every LAZY_PUSH_INTERVAL_MS, push the next run of the file we're
+ * pushing, until there are none left.
+ **/
+static int handle_lazy_push_timer(int fd, int id, void *data)
+{
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
+   uint64_t expirations;
+   size_t first, last;
+   lazy_file_t *lf;
+
+   while (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations));
+
+   for (;;) {
+      lf = lazy_pushing_file();
+      if (!lf) {
+         lazy_stop_push_timer();
+         return 0;
+      }
+      if (lazy_next_push(lf, &first, &last))
+         return handle_push_extents(procdata, lf, first, last);
+   }
+}
+
+/**
+ * A client is about to read a range of a lazily staged file.  Answer once
+ * the range is staged.
+ **/
+static int handle_client_range_request(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   size_t offset, len;
+   char *localpath;
+   lazy_file_t *lf;
+
+   if (msg->header.len <= (int) (2*sizeof(size_t)) || msg->data[msg->header.len-1] != '\0') {
+      err_printf("Badly formed range query from client %d\n", nc);
+      return handle_client_range_answer(procdata, nc, EINVAL);
+   }
+   memcpy(&offset, msg->data, sizeof(offset));
+   memcpy(&len, msg->data + sizeof(offset), sizeof(len));
+   localpath = msg->data + 2*sizeof(size_t);
+
+   lf = lazy_find_local(localpath);
+   if (!lf) {
+      err_printf("Client asked for a range of %s, which isn't staged lazily\n", localpath);
+      return handle_client_range_answer(procdata, nc, EINVAL);
+   }
+   debug_printf2("Client %d wants %lu bytes at %lu of %s\n", nc, (unsigned long) len,
+                 (unsigned long) offset, lazy_file_name(lf));
+   if (!lazy_range_extents(lf, offset, len, &client->range_first, &client->range_last))
+      return handle_client_range_answer(procdata, nc, 0);
+   if (procdata->opts & OPT_HOTEXTENTS)
+      learn_record_extents(lazy_file_name(lf), client->range_first, client->range_last);
+
+   client->range_open = 1;
+   client->range_file = lf;
+   return handle_client_range_progress(procdata, nc);
+}
+
+/**
+ * Check whether the range a client is waiting on has been staged.
+ **/
+static int handle_client_range_progress(ldcs_process_data_t *procdata, int nc)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   lazy_file_t *lf = (lazy_file_t *) client->range_file;
+   int result;
+
+   if (!lazy_range_present(lf, client->range_first, client->range_last)) {
+      result = handle_lazy_fetch(procdata, lf, client->range_first, client->range_last);
+      if (result == -1) {
+         client->range_open = 0;
+         return handle_client_range_answer(procdata, nc, EIO);
+      }
+      if (!lazy_range_present(lf, client->range_first, client->range_last))
+         return 0;
+   }
+   client->range_open = 0;
+   return handle_client_range_answer(procdata, nc, 0);
+}
+
+/**
+ * Tell a client whether the range it asked for is staged.
+ **/
+static int handle_client_range_answer(ldcs_process_data_t *procdata, int nc, int errcode)
+{
+   ldcs_message_t out_msg;
+   ldcs_client_t *client = procdata->client_table + nc;
+   int connid = client->connid;
+
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+      return 0;
+
+   out_msg.header.type = LDCS_MSG_FILE_RANGE_ANSWER;
+   out_msg.header.req = client->req;
+   out_msg.header.len = sizeof(errcode);
+   out_msg.data = (char *) &errcode;
+   ldcs_send_msg(connid, &out_msg);
+
+   procdata->server_stat.clientmsg.cnt++;
+   procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, NULL);
+   return 0;
+}
+
+/**
+ * We've received a packet with directory info.  Process it.
+ **/
+static int handle_directory_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast)
+{
+   char *dir;
+   int already_cached;
+   double starttime = ldcs_get_time();
+
+   debug_printf2("New directory cache entries received from %s\n",
+                 bcast == preload_broadcast ? "preload" : "request");
+
+   /* For each directory/file in packet add it to the cache. */
+   dir = ldcs_cache_storeDirPacket(msg->data, msg->header.len, &already_cached);
+   if (!dir) {
+      err_printf("Received empty directory packet\n");
+      return -1;
+   }
+   latency_wait_end('D', dir);
+
+   handle_broadcast_dir(procdata, dir, bcast);
+   
+   procdata->server_stat.distdir.cnt++;
+   procdata->server_stat.distdir.bytes += msg->header.len;
+   procdata->server_stat.distdir.time += ldcs_get_time() - starttime;
+
+   return handle_progress_path(procdata, dir);
+}
+
+/**
+ * We've received a batch of directory packets, either from the prefetch
+ * stage or from our parent.  The batch is a list of [int len][packet]
+ * pairs.  Store every directory we don't have yet and forward the whole
+ * batch to all children.
+ **/
+int handle_directory_batch(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   int pos = 0, len, already_cached, result;
+   unsigned int num_dirs = 0;
+   char *dir;
+   wait_queue_t *wq;
+   double starttime = ldcs_get_time();
+
+   while (pos + (int) sizeof(int) <= msg->header.len) {
+      memcpy(&len, msg->data + pos, sizeof(int));
+      pos += sizeof(int);
+      assert(len > 0 && pos + len <= msg->header.len);
+      dir = ldcs_cache_storeDirPacket(msg->data + pos, len, &already_cached);
+      pos += len;
+      if (!dir)
+         continue;
+      add_requestor(procdata->completed_requests, dir, NODE_PEER_ALL);
+      clear_requestor(procdata->pending_requests, dir);
+      wq = handle_take_wait_queue(dir);
+      if (wq) {
+         free(wq->clients);
+         free(wq);
+      }
+      num_dirs++;
+   }
+   debug_printf2("Received batch of %u directories in %ld bytes\n", num_dirs, (long) msg->header.len);
+
+   result = ldcs_audit_server_md_broadcast(procdata, msg);
+   if (result == -1)
+      err_printf("Error broadcasting directory batch\n");
+
+   procdata->server_stat.distdir.cnt += num_dirs;
+   procdata->server_stat.distdir.bytes += msg->header.len;
+   procdata->server_stat.distdir.time += ldcs_get_time() - starttime;
+
+   /* Several directories came in, so every client is looked at */
+   if (handle_progress(procdata) == -1)
+      return -1;
+   return result;
+}
+
+/**
+ * The number of child servers that have asked for key, whether or not
+ * they've been sent it yet.
+ **/
+static int handle_count_child_requestors(requestor_list_t pending_reqs, requestor_list_t completed_reqs,
+                                         char *key)
+{
+   node_peer_t *nodes;
+   int nodes_size, i, count = 0;
+
+   if (get_requestors(completed_reqs, key, &nodes, &nodes_size) == 0) {
+      for (i = 0; i < nodes_size; i++) {
+         if (nodes[i] != NODE_PEER_CLIENT && nodes[i] != NODE_PEER_NULL && nodes[i] != NODE_PEER_ALL)
+            count++;
+      }
+   }
+   if (get_requestors(pending_reqs, key, &nodes, &nodes_size) == 0) {
+      for (i = 0; i < nodes_size; i++) {
+         if (nodes[i] != NODE_PEER_CLIENT && nodes[i] != NODE_PEER_NULL &&
+             !peer_requested(completed_reqs, key, nodes[i]))
+            count++;
+      }
+   }
+   return count;
+}
+
+/**
+ * key went to every child before some joined, with --elastic.  Put the
+ * joined children that have asked for it in *peers.
+ **/
+static void handle_select_joined(ldcs_process_data_t *procdata, requestor_list_t pending_reqs,
+                                 char *key, node_peer_t **peers, int *num_peers)
+{
+   node_peer_t *nodes = NULL;
+   int nodes_size, i;
+
+   if (get_requestors(pending_reqs, key, &nodes, &nodes_size) == -1 || !nodes_size)
+      return;
+   for (i = 0; i < nodes_size; i++) {
+      if (nodes[i] == NODE_PEER_CLIENT || nodes[i] == NODE_PEER_NULL ||
+          !ldcs_audit_server_md_child_joined(procdata, nodes[i]))
+         continue;
+      if (!*peers)
+         *peers = (node_peer_t *) malloc(sizeof(node_peer_t) * nodes_size);
+      (*peers)[(*num_peers)++] = nodes[i];
+   }
+   if (*num_peers) {
+      debug_printf2("Sending %s, which went out before they joined, to %d servers\n", key, *num_peers);
+      clear_requestor(pending_reqs, key);
+   }
+}
+
+/**
+ * Decide which child servers a message for key goes to, and record it as sent
+ * to them.  If in push mode we send to every child always, and return 1.  If in
+ * pull mode only children who requested the file are put in *peers, which the
+ * caller frees, and we return 0.  Once procdata->promote_children children
+ * have asked for key, the rest of them are put in *peers too.
+ **/
+static int handle_select_msg_targets(ldcs_process_data_t *procdata, char *key, int force_broadcast,
+                                     int is_stat, node_peer_t **peers, int *num_peers)
+{
+   int result, nodes_size, i;
+   node_peer_t *nodes = NULL;
+   static int have_done_broadcast = 0;
+
+   requestor_list_t pending_reqs = !is_stat ? procdata->pending_requests : procdata->pending_metadata_requests;
+   requestor_list_t completed_reqs = !is_stat ? procdata->completed_requests : procdata->completed_metadata_requests;
+
+   *peers = NULL;
+   *num_peers = 0;
+
+   if (have_done_broadcast) {
+      /* Test whether this file has already been broadcast to all */
+      if (peer_requested(completed_reqs, key, NODE_PEER_ALL)) {
+         if (procdata->opts & OPT_ELASTIC)
+            handle_select_joined(procdata, pending_reqs, key, peers, num_peers);
+         if (!*num_peers)
+            debug_printf2("Not sending message for %s, because it's already been broadcast\n", key);
+         return 0;
+      }
+   }
+
+   if (procdata->dist_model == LDCS_PUSH || force_broadcast) {
+      debug_printf3("Pushing message to all children\n");
+      have_done_broadcast = 1;
+      add_requestor(completed_reqs, key, NODE_PEER_ALL);
+      clear_requestor(pending_reqs, key);
+      return 1;
+   }
+   assert(procdata->dist_model == LDCS_PULL);
+
+   if (procdata->promote_children && 
+       handle_count_child_requestors(pending_reqs, completed_reqs, key) >= (int) procdata->promote_children) {
+      nodes_size = ldcs_audit_server_md_get_num_children(procdata);
+      debug_printf2("%s was asked for by %u children, sending it to all %d\n", key,
+                    procdata->promote_children, nodes_size);
+      *peers = (node_peer_t *) malloc(sizeof(node_peer_t) * (nodes_size ? nodes_size : 1));
+      if (!*peers) {
+         /* Every child is getting it anyway, so a broadcast does the same job */
+         err_printf("Could not allocate peer list for promoting %s, broadcasting it\n", key);
+         have_done_broadcast = 1;
+         add_requestor(completed_reqs, key, NODE_PEER_ALL);
+         clear_requestor(pending_reqs, key);
+         procdata->server_stat.promote.cnt++;
+         return 1;
+      }
+      for (i = 0; i < nodes_size; i++) {
+         node_peer_t child = ldcs_audit_server_md_get_child(procdata, i);
+         if (child == NODE_PEER_NULL || peer_requested(completed_reqs, key, child))
+            continue;
+         add_requestor(completed_reqs, key, child);
+         (*peers)[(*num_peers)++] = child;
+      }
+      have_done_broadcast = 1;
+      add_requestor(completed_reqs, key, NODE_PEER_ALL);
+      clear_requestor(pending_reqs, key);
+      procdata->server_stat.promote.cnt++;
+      return 0;
+   }
+
+   debug_printf3("Sending messages to select children via pull model\n");
+   result = get_requestors(pending_reqs, key, &nodes, &nodes_size);
+   if (result == -1) {
+      return 0;
+   }
+   debug_printf3("Sending message %s to %d nodes who requested it\n", key, nodes_size);
+   *peers = (node_peer_t *) malloc(sizeof(node_peer_t) * (nodes_size ? nodes_size : 1));
+   for (i = 0; i < nodes_size; i++) {
+      if (nodes[i] == NODE_PEER_CLIENT || nodes[i] == NODE_PEER_NULL)
+         continue;
+      if (peer_requested(completed_reqs, key, nodes[i])) {
+         debug_printf2("Not sending message for %s to child, because it's already been sent\n", key);
+         continue;
+      }
+      add_requestor(completed_reqs, key, nodes[i]);
+      (*peers)[(*num_peers)++] = nodes[i];
+   }
+
+   clear_requestor(pending_reqs, key);
+   return 0;
+}
+
+/**
+ * Send a message to child servers.  If in push mode we send to every child always.
+ * If in pull mode only send to children who requested the file.
+ **/
+int handle_send_msg_to_keys(ldcs_process_data_t *procdata, ldcs_message_t *msg, char *key,
+                            void *secondary_data, size_t secondary_size, int force_broadcast,
+                            int is_stat)
+{
+   int result, global_result = 0;
+   node_peer_t *peers;
+   int num_peers, i;
+
+   if (handle_select_msg_targets(procdata, key, force_broadcast, is_stat, &peers, &num_peers))
+      return ldcs_audit_server_md_broadcast_noncontig(procdata, msg, secondary_data, secondary_size);
+
+   for (i = 0; i < num_peers; i++) {
+      result = ldcs_audit_server_md_send_noncontig(procdata, msg, peers[i], secondary_data, secondary_size);
+      if (result == -1)
+         global_result = -1;
+   }
+   if (peers)
+      free(peers);
+
+   return global_result;
+}
+
+/**
+ * A client whose threads query at once tags each query with a request id.
+ * Each id gets an entry of its own in the client table, on the same
+ * connection as client nc, so that its queries can be pending together.
+ * Returns the entry for request req, setting it up on first use.
+ **/
+static int handle_client_request_entry(ldcs_process_data_t *procdata, int nc, int req)
+{
+   ldcs_client_t *client, *conn;
+   int i, rnc;
+
+   if (req < 1 || req > LDCS_MAX_REQUESTS) {
+      err_printf("Client %d sent a query with bad request id %d\n", nc, req);
+      return -1;
+   }
+   conn = procdata->client_table + nc;
+   if (!conn->requests) {
+      conn->requests = (int *) malloc(LDCS_MAX_REQUESTS * sizeof(int));
+      if (!conn->requests) {
+         err_printf("Could not allocate request table for client %d\n", nc);
+         return -1;
+      }
+      for (i = 0; i < LDCS_MAX_REQUESTS; i++)
+         conn->requests[i] = -1;
+   }
+   if (conn->requests[req-1] != -1) {
+      rnc = conn->requests[req-1];
+      client = procdata->client_table + rnc;
+      /* Follow a cwd the client sent since this request's entry was made */
+      if (conn->remote_cwd && (!client->remote_cwd || strcmp(client->remote_cwd, conn->remote_cwd) != 0)) {
+         free(client->remote_cwd);
+         client->remote_cwd = strdup(conn->remote_cwd);
+      }
+      return rnc;
+   }
+
+   rnc = _ldcs_server_alloc_client(procdata);
+   if (rnc == -1)
+      return -1;
+   /* Growing the table may have moved it */
+   conn = procdata->client_table + nc;
+   client = procdata->client_table + rnc;
+
+   memset(client, 0, sizeof(*client));
+   client->connid = conn->connid;
+   client->state = LDCS_CLIENT_STATUS_ACTIVE;
+   client->parent = nc;
+   client->req = req;
+   client->lrank = conn->lrank;
+   client->step = conn->step;
+   client->settings_seen = conn->settings_seen;
+   client->remote_pid = conn->remote_pid;
+   client->remote_cwd = conn->remote_cwd ? strdup(conn->remote_cwd) : NULL;
+   conn->requests[req-1] = rnc;
+   procdata->client_table_used++;
+   debug_printf2("Request %d of client %d is handled as client %d\n", req, nc, rnc);
+   return rnc;
+}
+
+/**
+ * Handle a message that just arrived from a client
+ **/
+int handle_client_message(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   int result, rnc, type = (int) msg->header.type;
+
+   SPINDLE_PROBE2(client_msg_start, nc, type);
+   if (msg->header.req) {
+      rnc = handle_client_request_entry(procdata, nc, msg->header.req);
+      if (rnc == -1)
+         return -1;
+      procdata->client_table[rnc].query_arrival_time = procdata->client_table[nc].query_arrival_time;
+      nc = rnc;
+   }
+
+   result = handle_client_dispatch(procdata, nc, msg);
+   if (pushdeps_head && handle_push_dependencies(procdata) == -1)
+      result = -1;
+   SPINDLE_PROBE3(client_msg_end, nc, type, result);
+   return result;
+}
+
+static int handle_client_dispatch(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   switch (msg->header.type) {
+      case LDCS_MSG_CWD:
+      case LDCS_MSG_PID:
+      case LDCS_MSG_LOCATION:
+         return handle_client_info_msg(procdata, nc, msg);
+      case LDCS_MSG_PYTHONPREFIX_REQ:
+         return handle_pythonprefix_query(procdata, nc);
+      case LDCS_MSG_RELOCRULES_REQ:
+         return handle_relocrules_query(procdata, nc);
+      case LDCS_MSG_MYRANKINFO_QUERY:
+         return handle_client_myrankinfo_msg(procdata, nc, msg);
+      case LDCS_MSG_HELLO:
+         return handle_client_hello(procdata, nc, msg);
+      case LDCS_MSG_FILE_QUERY:
+      case LDCS_MSG_FILE_QUERY_EXACT_PATH:
+      case LDCS_MSG_FILE_QUERY_LAZY:
+      case LDCS_MSG_FILE_QUERY_FD:
+      case LDCS_MSG_STAT_QUERY:
+      case LDCS_MSG_LOADER_DATA_REQ:
+         return handle_client_file_request(procdata, nc, msg);
+      case LDCS_MSG_FILE_QUERY_BATCH:
+         return handle_client_batch_query(procdata, nc, msg);
+      case LDCS_MSG_PREFETCH_DIR:
+         return handle_client_prefetch_dir(procdata, nc, msg);
+      case LDCS_MSG_FILE_QUERY_SEARCH:
+         return handle_client_search_query(procdata, nc, msg, 1);
+      case LDCS_MSG_FILE_QUERY_FIRST:
+         return handle_client_search_query(procdata, nc, msg, 0);
+      case LDCS_MSG_FILE_QUERY_EXEC:
+         return handle_client_exec_query(procdata, nc, msg);
+      case LDCS_MSG_FILE_RANGE_QUERY:
+         return handle_client_range_request(procdata, nc, msg);
+      case LDCS_MSG_EXISTS_QUERY:
+         return handle_client_fileexist_msg(procdata, nc, msg);
+      case LDCS_MSG_DIR_QUERY:
+         return handle_client_dir_msg(procdata, nc, msg);
+      case LDCS_MSG_READLINK_QUERY:
+      case LDCS_MSG_REALPATH_QUERY:
+         return handle_client_resolve_msg(procdata, nc, msg);
+      case LDCS_MSG_ORIGPATH_QUERY:
+         return handle_client_origpath_msg(procdata, nc, msg);
+      case LDCS_MSG_JIT_QUERY:
+         return handle_client_jit_query(procdata, nc, msg);
+      case LDCS_MSG_JIT_CLAIM:
+         return handle_client_jit_claim(procdata, nc, msg);
+      case LDCS_MSG_JIT_PUBLISH:
+         return handle_client_jit_publish(procdata, nc, msg);
+      case LDCS_MSG_KVS_PUT:
+         return handle_client_kvs_put(procdata, nc, msg);
+      case LDCS_MSG_KVS_FENCE:
+         return handle_client_kvs_fence(procdata, nc, msg);
+      case LDCS_MSG_KVS_GET:
+         return handle_client_kvs_get(procdata, nc, msg);
+      case LDCS_MSG_CLIENT_TIMING:
+         return handle_client_timing(procdata, nc, msg);
+      case LDCS_MSG_STARTUP_DONE:
+         return handle_startup_done(procdata, msg);
+      case LDCS_MSG_END:
+         return handle_client_end(procdata, nc);
+      default:
+         err_printf("Received unexpected message from client %d: %d\n", nc, (int) msg->header.type);
+         assert(0);
+   }
+   return -1;
+}
+
+/**
+ * Handle a message that just arrived from a server
+ **/
+int handle_server_message(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg)
+{
+   int result, type = (int) msg->header.type;
+
+   SPINDLE_PROBE1(server_msg_start, type);
+   handle_begin_metadata_batch();
+   result = handle_server_dispatch(procdata, peer, msg);
+   if (handle_end_metadata_batch(procdata) == -1)
+      result = -1;
+   if (pushdeps_head && handle_push_dependencies(procdata) == -1)
+      result = -1;
+   SPINDLE_PROBE2(server_msg_end, type, result);
+   return result;
+}
+
+static int handle_server_dispatch(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg)
+{
+   switch (msg->header.type) {
+      case LDCS_MSG_CACHE_ENTRIES:
+         return handle_directory_recv(procdata, msg, request_broadcast);
+      case LDCS_MSG_CACHE_ENTRIES_BATCH:
+         return handle_directory_batch(procdata, msg);
+      case LDCS_MSG_FILE_BUNDLE:
+         return handle_bundle_recv(procdata, msg);
+      case LDCS_MSG_FILE_DATA:
+         return handle_file_recv(procdata, msg, peer, request_broadcast);         
+      case LDCS_MSG_FILE_ERRCODE:
+         return handle_file_errcode(procdata, msg, peer, request_broadcast);
+      case LDCS_MSG_FILE_ALIAS:
+         return handle_alias_recv(procdata, msg, request_broadcast);
+      case LDCS_MSG_FILE_REQUEST:
+         return handle_request(procdata, peer, msg);
+      case LDCS_MSG_PEER_SEND:
+         return handle_peer_send(procdata, peer, msg);
+      case LDCS_MSG_LAZY_FILE:
+         return handle_lazy_file_recv(procdata, msg);
+      case LDCS_MSG_FILE_RANGE_REQUEST:
+         return handle_range_request_recv(procdata, peer, msg);
+      case LDCS_MSG_FILE_RANGE_DATA:
+         return handle_range_data_recv(procdata, msg, 0);
+      case LDCS_MSG_FILE_RANGE_PUSH:
+         return handle_range_data_recv(procdata, msg, 1);
+      case LDCS_MSG_STRIPE_REQUEST:
+         return handle_stripe_request_recv(procdata, peer, msg);
+      case LDCS_MSG_STRIPE_DATA:
+         return handle_stripe_data_recv(procdata, msg);
+      case LDCS_MSG_EXIT:
+         return handle_exit_broadcast(procdata);
+      case LDCS_MSG_PRELOAD_FILELIST:
+         return handle_preload_filelist(procdata, msg);
+      case LDCS_MSG_PRELOAD_DIR:
+         return handle_directory_recv(procdata, msg, preload_broadcast);
+      case LDCS_MSG_PRELOAD_FILE:
+         return handle_file_recv(procdata, msg, peer, preload_broadcast);
+      case LDCS_MSG_PRELOAD_ALIAS:
+         return handle_alias_recv(procdata, msg, preload_broadcast);
+      case LDCS_MSG_PRELOAD_DONE:
+         return handle_preload_done(procdata);
+      case LDCS_MSG_SETTINGS_UPDATE:
+         return handle_settings_update(procdata, msg);
+      case LDCS_MSG_INVALIDATE:
+         return handle_invalidate_recv(procdata, msg);
+      case LDCS_MSG_SELFLOAD_FILE:
+         return handle_recv_selfload_file(procdata, msg);
+      case LDCS_MSG_JIT_PUBLISH:
+         return handle_jit_publish_recv(procdata, msg);
+      case LDCS_MSG_KVS_GATHER:
+         return handle_kvs_gather_recv(procdata, msg);
+      case LDCS_MSG_KVS_TABLE:
+         return handle_kvs_table_recv(procdata, msg);
+      case LDCS_MSG_JOIN_RANK:
+         return handle_join_rank_recv(procdata, msg);
+      case LDCS_MSG_STAT_NET_RESULT:
+         return handle_metadata_recv(procdata, msg, metadata_stat, peer);
+      case LDCS_MSG_STAT_NET_REQUEST:
+         return handle_metadata_request_recv(procdata, msg, metadata_stat, peer);
+       case LDCS_MSG_LOADER_DATA_NET_RESP:
+         return handle_metadata_recv(procdata, msg, metadata_loader, peer);
+      case LDCS_MSG_LOADER_DATA_NET_REQ:
+         return handle_metadata_request_recv(procdata, msg, metadata_loader, peer);
+     case LDCS_MSG_EXIT_READY:
+         return handle_exit_ready_msg(procdata, msg);
+      case LDCS_MSG_STATS_REPORT:
+         return handle_stats_report_msg(procdata, peer, msg);
+      case LDCS_MSG_EXIT_CANCEL:
+         return handle_exit_cancel_msg(procdata, msg);
+      case LDCS_MSG_STARTUP_DONE:
+         return handle_startup_done(procdata, msg);
+      default:
+         err_printf("Received unexpected message from node: %d\n", (int) msg->header.type);
+         assert(0);
+   }
+   return -1;
+}
+
+/**
+ * Handle new client 
+ **/
+int handle_client_start(ldcs_process_data_t *procdata, int nc)
+{
+   if (procdata->sent_exit_ready) {
+      return handle_send_exit_cancel(procdata);
+   }
+   return 0;
+}
+
+/**
+ * Unpin a client's files and free its entry
+ **/
+static void handle_release_client(ldcs_client_t *client)
+{
+   client->state = LDCS_CLIENT_STATUS_FREE;
+   while (client->pinned_count)
+      ldcs_cache_unpinEntry(client->pinned[--client->pinned_count]);
+   free(client->pinned);
+   client->pinned = NULL;
+   client->pinned_size = 0;
+   _ldcs_server_free_client(client);
+}
+
+/**
+ * Clean up after a client exit
+ **/
+int handle_client_end(ldcs_process_data_t *procdata, int nc)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   int i;
+
+   int connid = client->connid;
+   debug_printf2("Server recvd END: closing connection\n");
+
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+      return 0;
+   
+   if (clientpool_unregister_fd(nc) == -1)
+      ldcs_listen_unregister_fd(ldcs_get_fd(connid)); 
+   fairq_client_end(procdata, nc);
+   ldcs_close_server_connection(connid);
+
+   /* Requests still pending on the connection go away with it */
+   for (i = 0; client->requests && i < LDCS_MAX_REQUESTS; i++) {
+      if (client->requests[i] != -1)
+         handle_release_client(procdata->client_table + client->requests[i]);
+   }
+   steps_client_end(client->step);
+   handle_release_client(client);
+   debug_printf("Closed client %d\n", nc);
+   
+   assert(procdata->clients_live > 0);
+   procdata->clients_live--;
+
+   /* Whoever waits on what it was writing goes on to write it */
+   if (jitcache_drop_producer(connid) && handle_progress(procdata) == -1)
+      return -1;
+   return handle_send_exit_ready_if_done(procdata);
+}
+
+static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   int cur = 0, global_result = 0, result;
+   int num_dirs, num_files, i, num_pathnames = 0;
+   char *data = (char *) msg->data;
+   char *pathname, **pathnames;
+   
+   debug_printf2("At top of handle_preload_filelist\n");
+
+   memcpy(&num_dirs, data + cur, sizeof(int));
+   cur += sizeof(int);
+   
+   memcpy(&num_files, data + cur, sizeof(int));
+   cur += sizeof(int);
+
+   for (i = 0; i<num_dirs; i++) {
+      assert(cur < msg->header.len);
+      pathname = data + cur;
+      cur += strlen(pathname)+1;
+
+      if (!ldcs_audit_server_md_is_responsible(procdata, pathname)) {
+         debug_printf3("I am not responsible for preloading directory %s\n", pathname);
+         continue;
+      }
+
+      debug_printf2("Preload read of directory %s\n", pathname);
+      result = handle_read_directory(procdata, pathname);
+      if (result == -1) {
+         err_printf("Error reading directory during preload\n");
+         global_result = -1;
+         continue;
+      }
+      
+      result = handle_broadcast_dir(procdata, pathname, preload_broadcast);
+      if (result == -1) {
+         err_printf("Error broadcasting directory during preload\n");
+         global_result = -1;
+         continue;
+      }
+   }
+
+   pathnames = (char **) malloc(sizeof(char *) * (num_files ? num_files : 1));
+   for (i = 0; i<num_files; i++) {
+      assert(cur < msg->header.len);
+      pathname = data + cur;
+      cur += strlen(pathname)+1;
+
+      if (!ldcs_audit_server_md_is_responsible(procdata, pathname)) {
+         debug_printf3("I am not responsible for preloading file %s\n", pathname);
+         continue;
+      }
+
+      debug_printf2("Preload read of file %s\n", pathname);
+      pathnames[num_pathnames++] = pathname;
+   }
+   result = handle_read_and_broadcast_files(procdata, pathnames, num_pathnames, preload_broadcast);
+   if (result == -1) {
+      err_printf("Error broadcasting file data during preload\n");
+      global_result = -1;
+   }
+   free(pathnames);
+
+   result = handle_preload_done(procdata);
+   if (result == -1) {
+      err_printf("Error from handle_preload_done");
+      global_result = -1;
+   }
+
+   return global_result;
+}
+
+static int handle_preload_done(ldcs_process_data_t *procdata)
+{
+   ldcs_message_t done_msg;
+   int result;
+
+   debug_printf2("Handle preload done\n");
+   procdata->preload_done = 1;
+
+   done_msg.header.type = LDCS_MSG_PRELOAD_DONE;
+   done_msg.header.len = 0;
+   done_msg.data = NULL;
+
+   result = ldcs_audit_server_md_broadcast(procdata, &done_msg);
+   if (result == -1) {
+      err_printf("Error broadcasting done message during preload\n");
+      return -1;
+   }
+
+   return handle_progress(procdata);
+}
+
+/**
+ * With --elastic, the setup message and the latest settings update are
+ * kept for servers that join below us later.
+ **/
+static ldcs_message_t kept_settings, kept_update;
+
+static void keep_message(ldcs_message_t *kept, ldcs_message_t *msg)
+{
+   char *data = (char *) malloc(msg->header.len ? msg->header.len : 1);
+   if (!data) {
+      err_printf("Could not keep a %lu byte settings message for joining servers\n",
+                 (unsigned long) msg->header.len);
+      return;
+   }
+   memcpy(data, msg->data, msg->header.len);
+   free(kept->data);
+   kept->header = msg->header;
+   kept->data = data;
+}
+
+void handle_keep_settings(ldcs_message_t *msg)
+{
+   keep_message(&kept_settings, msg);
+}
+
+typedef struct {
+   char *buffer;
+   size_t used;
+   size_t size;
+   unsigned int dirs;
+} join_snapshot_t;
+
+static void add_snapshot_dir(char *dirname, int exists, void *arg)
+{
+   join_snapshot_t *snap = (join_snapshot_t *) arg;
+   char *packet = NULL, *newbuf;
+   int len = 0;
+
+   /* A directory that doesn't exist is cheap for the joined server to ask about */
+   if (!exists || ldcs_cache_getNewEntriesForDir(dirname, &packet, &len) == -1 || !packet)
+      return;
+   if (snap->used + sizeof(int) + len > snap->size) {
+      while (snap->used + sizeof(int) + len > snap->size)
+         snap->size = snap->size ? snap->size * 2 : 64*1024;
+      newbuf = (char *) realloc(snap->buffer, snap->size);
+      if (!newbuf) {
+         free(packet);
+         return;
+      }
+      snap->buffer = newbuf;
+   }
+   memcpy(snap->buffer + snap->used, &len, sizeof(int));
+   snap->used += sizeof(int);
+   memcpy(snap->buffer + snap->used, packet, len);
+   snap->used += len;
+   snap->dirs++;
+   free(packet);
+}
+
+/**
+ * A server joined below us after startup.  It already read the setup
+ * message from cobo's welcome; send it the latest settings update, the
+ * listings of every directory we've cached as one batch, and whether the
+ * preload and the job's startup are done, ahead of anything we broadcast
+ * from now on.  Files it needs it asks us for, as any child would.
+ **/
+int handle_join(ldcs_process_data_t *procdata, node_peer_t peer)
+{
+   join_snapshot_t snap;
+   ldcs_message_t msg;
+   int direction = STARTUP_DONE_DOWN, result, global_result = 0;
+
+   if (!kept_settings.data) {
+      err_printf("No settings kept for a joining server\n");
+      return -1;
+   }
+   result = ldcs_audit_server_md_send(procdata, &kept_settings, peer);
+   if (result == -1)
+      return -1;
+   if (kept_update.data && ldcs_audit_server_md_send(procdata, &kept_update, peer) == -1)
+      global_result = -1;
+
+   memset(&snap, 0, sizeof(snap));
+   ldcs_cache_foreachDir(add_snapshot_dir, &snap);
+   if (snap.dirs) {
+      debug_printf2("Sending joined server %u directories in %lu bytes\n", snap.dirs, (unsigned long) snap.used);
+      msg.header.type = LDCS_MSG_CACHE_ENTRIES_BATCH;
+      msg.header.len = snap.used;
+      msg.data = snap.buffer;
+      if (ldcs_audit_server_md_send(procdata, &msg, peer) == -1)
+         global_result = -1;
+   }
+   free(snap.buffer);
+
+   if ((procdata->opts & OPT_PRELOAD) && procdata->preload_done) {
+      msg.header.type = LDCS_MSG_PRELOAD_DONE;
+      msg.header.len = 0;
+      msg.data = NULL;
+      if (ldcs_audit_server_md_send(procdata, &msg, peer) == -1)
+         global_result = -1;
+   }
+   if (procdata->startup_done == 2) {
+      msg.header.type = LDCS_MSG_STARTUP_DONE;
+      msg.header.len = sizeof(direction);
+      msg.data = (char *) &direction;
+      if (ldcs_audit_server_md_send(procdata, &msg, peer) == -1)
+         global_result = -1;
+   }
+
+   procdata->server_stat.join.cnt++;
+   procdata->server_stat.join.bytes += snap.used;
+   return global_result;
+}
+
+/**
+ * A server is joining below us.  Its rank comes from the root, so that
+ * two parents taking servers at once can't hand out the same one: ask up
+ * the tree with a LDCS_MSG_JOIN_RANK, and take the server once the
+ * answer comes back down.  Joins are rare enough that sending the answer
+ * to everyone, rather than routing it, is fine.
+ **/
+static int joined_ranks = 0;
+
+static int admit_joining_server(ldcs_process_data_t *procdata, int request, int rank)
+{
+   node_peer_t peer;
+
+   peer = ldcs_audit_server_md_admit_join(procdata, request, rank);
+   if (peer == NODE_PEER_NULL)
+      return 0;
+   return handle_join(procdata, peer);
+}
+
+int handle_join_request(ldcs_process_data_t *procdata, int request)
+{
+   ldcs_message_t msg;
+   int packet[3];
+
+   if (procdata->md_rank == 0)
+      return admit_joining_server(procdata, request, procdata->md_size + joined_ranks++);
+
+   packet[0] = procdata->md_rank;
+   packet[1] = request;
+   packet[2] = -1;
+   msg.header.type = LDCS_MSG_JOIN_RANK;
+   msg.header.len = sizeof(packet);
+   msg.data = (char *) packet;
+   debug_printf2("Asking the root for the rank of a server joining below us\n");
+   return ldcs_audit_server_md_forward_query(procdata, &msg);
+}
+
+static int handle_join_rank_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   ldcs_message_t answer;
+   int packet[3];
+
+   if (msg->header.len != sizeof(packet)) {
+      err_printf("Got a join rank message of %d bytes\n", (int) msg->header.len);
+      return 0;
+   }
+   memcpy(packet, msg->data, sizeof(packet));
+
+   if (packet[2] == -1) {
+      if (procdata->md_rank != 0)
+         return ldcs_audit_server_md_forward_query(procdata, msg);
+      packet[2] = procdata->md_size + joined_ranks++;
+      debug_printf2("Giving rank %d to a server joining below server %d\n", packet[2], packet[0]);
+      answer.header.type = LDCS_MSG_JOIN_RANK;
+      answer.header.len = sizeof(packet);
+      answer.data = (char *) packet;
+      return ldcs_audit_server_md_broadcast(procdata, &answer);
+   }
+
+   if (packet[0] == procdata->md_rank)
+      return admit_joining_server(procdata, packet[1], packet[2]);
+   return ldcs_audit_server_md_broadcast(procdata, msg);
+}
+
+/**
+ * A session step is about to start with settings that differ from the
+ * session's, or spindle --control-session changed some.  Take on the ones
+ * in the update and pass it on, leaving the cache alone: a new python
+ * prefix only changes how later lookups are treated, a new preload file
+ * is followed by its own preload list, and the rest only change what we
+ * do from now on.
+ **/
+static int handle_settings_update(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   unsigned int version, fields;
+   char *data = (char *) msg->data;
+   size_t cur = 0;
+   int result;
+
+   assert(msg->header.len >= sizeof(unsigned int) * 2);
+   memcpy(&version, data + cur, sizeof(version));
+   cur += sizeof(version);
+   memcpy(&fields, data + cur, sizeof(fields));
+   cur += sizeof(fields);
+
+   if (version <= procdata->settings_version) {
+      debug_printf("Dropping settings update %u, already at %u\n", version, procdata->settings_version);
+      return 0;
+   }
+   if (procdata->opts & OPT_ELASTIC)
+      keep_message(&kept_update, msg);
+
+   result = ldcs_audit_server_md_broadcast(procdata, msg);
+   if (result == -1) {
+      err_printf("Error broadcasting settings update\n");
+      return -1;
+   }
+
+   if (fields & SETTINGS_PYTHONPREFIX) {
+      assert(cur < msg->header.len);
+      /* Before the first update it points into the setup message */
+      if (procdata->settings_version)
+         free(procdata->pythonprefix);
+      procdata->pythonprefix = strdup(data + cur);
+      cur += strlen(data + cur) + 1;
+      debug_printf("Python prefix is now %s\n", procdata->pythonprefix);
+   }
+   if (fields & SETTINGS_PRELOADFILE) {
+      assert(cur < msg->header.len);
+      debug_printf("Preload file is now %s\n", data + cur);
+      cur += strlen(data + cur) + 1;
+      procdata->preload_done = 0;
+      procdata->preload_version = version;
+   }
+   if (fields & SETTINGS_DISTMODEL) {
+      assert(cur < msg->header.len);
+      handle_set_distmodel(procdata, data + cur);
+      cur += strlen(data + cur) + 1;
+   }
+   if (fields & SETTINGS_BANDWIDTH) {
+      assert(cur < msg->header.len);
+      procdata->bandwidth = (unsigned int) strtoul(data + cur, NULL, 10);
+      cur += strlen(data + cur) + 1;
+   }
+   if (fields & SETTINGS_BGBANDWIDTH) {
+      assert(cur < msg->header.len);
+      procdata->background_bandwidth = (unsigned int) strtoul(data + cur, NULL, 10);
+      cur += strlen(data + cur) + 1;
+   }
+   if (fields & (SETTINGS_BANDWIDTH | SETTINGS_BGBANDWIDTH))
+      ldcs_audit_server_md_set_bandwidth(procdata);
+   if (fields & SETTINGS_PREDICTDEPTH) {
+      assert(cur < msg->header.len);
+      predict_depth = atoi(data + cur);
+      if (predict_depth > PREDICT_MAX_DEPTH)
+         predict_depth = PREDICT_MAX_DEPTH;
+      else if (predict_depth < 0)
+         predict_depth = 0;
+      cur += strlen(data + cur) + 1;
+      debug_printf("Predicting %d files ahead\n", predict_depth);
+   }
+   if (fields & SETTINGS_PREDICTCHANCE) {
+      assert(cur < msg->header.len);
+      predict_set_min_chance(strtod(data + cur, NULL));
+      debug_printf("Predicting files at least %s likely to be asked for\n", data + cur);
+      cur += strlen(data + cur) + 1;
+   }
+   if (fields & SETTINGS_LOGLEVEL) {
+      assert(cur < msg->header.len);
+      debug_printf("Log level is now %s\n", data + cur);
+      /* Only servers that started with a log can write to one */
+      if (spindle_debug_output_f)
+         spindle_debug_prints = atoi(data + cur);
+      cur += strlen(data + cur) + 1;
+   }
+   procdata->settings_version = version;
+   if (fields & SETTINGS_REVALIDATE)
+      return handle_revalidate(procdata);
+   return 0;
+}
+
+/**
+ * Switch between the push and pull models.  Files already staged stay as
+ * they are; only what's read from now on goes out the new way.  Every
+ * server makes the same choice, so they agree on how files move.
+ **/
+static void handle_set_distmodel(ldcs_process_data_t *procdata, const char *model)
+{
+   if (strcmp(model, "push") == 0) {
+      if (procdata->num_readers > 1) {
+         /* Pushed files go down from the root, so only it may read them */
+         err_printf("Multiple readers can't be used with the push model, staying with pull\n");
+         return;
+      }
+      debug_printf("Using PUSH model\n");
+      procdata->dist_model = LDCS_PUSH;
+   }
+   else if (strcmp(model, "pull") == 0) {
+      debug_printf("Using PULL model\n");
+      procdata->dist_model = LDCS_PULL;
+   }
+   else {
+      err_printf("Unknown distribution model %s in settings update\n", model);
+   }
+}
+
+/**
+ * A session step is about to start.  Check the files and directories we
+ * read against the file system, and send what changed to the root, which
+ * passes it down to everyone.
+ **/
+static int handle_revalidate(ldcs_process_data_t *procdata)
+{
+   char *data;
+   size_t len;
+   int num_records, result;
+
+   num_records = revalidate_check(procdata, &data, &len);
+   if (num_records <= 0)
+      return num_records;
+
+   debug_printf("Found %d changes to files and directories we read\n", num_records);
+   data[0] = INVALIDATE_UP;
+   result = handle_send_invalidations(procdata, data, len);
+   free(data);
+   return result;
+}
+
+/**
+ * Changes found below the root go up to it, and it sends them down the
+ * tree.  Each server drops what changed as the changes pass it on the way
+ * down, so the server that found them does too.  data starts with the
+ * direction it's going.
+ **/
+static int handle_send_invalidations(ldcs_process_data_t *procdata, char *data, size_t len)
+{
+   ldcs_message_t msg;
+   int result;
+
+   msg.header.type = LDCS_MSG_INVALIDATE;
+   msg.header.len = len;
+   msg.data = data;
+
+   if (data[0] == INVALIDATE_UP && procdata->md_rank != 0) {
+      result = ldcs_audit_server_md_forward_query(procdata, &msg);
+      if (result == -1)
+         err_printf("Error sending invalidations to our parent\n");
+      return result;
+   }
+
+   data[0] = INVALIDATE_DOWN;
+   handle_send_batch(procdata);
+   result = ldcs_audit_server_md_broadcast(procdata, &msg);
+   if (result == -1)
+      err_printf("Error broadcasting invalidations\n");
+   handle_apply_invalidations(procdata, data, len);
+   return result;
+}
+
+static int handle_invalidate_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   assert(msg->header.len >= 1);
+   return handle_send_invalidations(procdata, (char *) msg->data, msg->header.len);
+}
+
+/**
+ * Drop what changed.  A changed or removed file loses its staged copy and
+ * stat results, and is fetched again when it's next asked for.  A removed
+ * name stays in its directory's listing, but opening it fails.  A name
+ * added to a directory we've listed is added to the listing.  Where exec
+ * searches went may no longer hold, so they're all forgotten.
+ **/
+static void handle_apply_invalidations(ldcs_process_data_t *procdata, char *data, size_t len)
+{
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN], key[MAX_PATH_LEN+2];
+   char *path, *localpath, type;
+   unsigned char d_type;
+   void *buffer;
+   size_t pos = 1, size;
+   int errcode, i;
+   const char prefixes[] = { '*', '$' };
+
+   if (pos + 2 < len) {
+      handle_forget_exec_searches();
+      namesnap_clear();
+   }
+   while (pos + 2 < len) {
+      type = data[pos];
+      d_type = (unsigned char) data[pos+1];
+      path = data + pos + 2;
+      pos += 2 + strlen(path) + 1;
+      parseFilenameNoAlloc(path, filename, dirname, MAX_PATH_LEN);
+
+      if (type == INVALIDATE_ADDED) {
+         if (ldcs_cache_findDirInCache(dirname) != LDCS_CACHE_DIR_PARSED_AND_EXISTS)
+            continue;
+         if (ldcs_cache_findFileDirInCache(filename, dirname, &localpath, &errcode) == LDCS_CACHE_FILE_NOT_FOUND)
+            ldcs_cache_addFileDirType(dirname, filename, d_type);
+         else if (errcode == ENOENT)
+            ldcs_cache_updateEntry(filename, dirname, NULL, NULL, 0, 0);
+      }
+      else {
+         debug_printf2("Dropping %s, which %s\n", path, type == INVALIDATE_GONE ? "is gone" : "changed");
+         if (ldcs_cache_findFileDirInCache(filename, dirname, &localpath, &errcode) == LDCS_CACHE_FILE_FOUND) {
+            if (localpath && !errcode && ldcs_cache_get_buffer(dirname, filename, &buffer, &size) != -1 && buffer) {
+               procdata->server_stat.invalidate.bytes += size;
+               remove_global_name(localpath);
+               if (procdata->opts & OPT_NUMA)
+                  numa_evict(localpath);
+               if (type == INVALIDATE_CHANGED && (procdata->opts & OPT_DELTA) && size >= DELTA_MIN_SIZE)
+                  handle_keep_delta_base(procdata, path, localpath, buffer, size);
+               else {
+                  ldcs_audit_server_md_release_buffer(buffer, size);
+                  filemngt_evict_file(localpath, buffer, size);
+               }
+            }
+            ldcs_cache_updateEntry(filename, dirname, NULL, NULL, 0, type == INVALIDATE_GONE ? ENOENT : 0);
+         }
+         if (type == INVALIDATE_GONE && (procdata->opts & OPT_DELTA))
+            delta_drop(path);
+         crc_forget(path);
+         filemngt_shared_cache_forget(path);
+         clear_requestor(procdata->completed_requests, path);
+      }
+
+      /* Stat results for the path, by stat, lstat or ldso lookup, are stale either way */
+      remove_stat_cache(path);
+      clear_requestor(procdata->completed_metadata_requests, path);
+      for (i = 0; i < (int) sizeof(prefixes); i++) {
+         snprintf(key, sizeof(key), "%c%s", prefixes[i], path);
+         remove_stat_cache(key);
+         clear_requestor(procdata->completed_metadata_requests, key);
+      }
+      procdata->server_stat.invalidate.cnt++;
+   }
+}
+
+/**
+ * Rather than evict a changed file, keep its staged copy mapped as the
+ * last version, which the next one is sent as changes to.  The copy is
+ * unlinked so the next version can be staged in its place, and the
+ * mapping keeps it around until that arrives.  Which children we sent it
+ * to is remembered, since only they can take the changes.
+ **/
+static void handle_keep_delta_base(ldcs_process_data_t *procdata, char *pathname, char *localname,
+                                   void *buffer, size_t size)
+{
+   node_peer_t *holders = NULL;
+   int num_holders = 0;
+
+   filemngt_evict_file(localname, NULL, size);
+   if (get_requestors(procdata->completed_requests, pathname, &holders, &num_holders) == -1) {
+      holders = NULL;
+      num_holders = 0;
+   }
+   delta_keep_base(pathname, buffer, size, holders, num_holders);
+}
+
+static int handle_create_selfload_file(ldcs_process_data_t *procdata, char *filename)
+{
+   /* Other nodes know about a file we don't know about.  Maybe a local file? 
+      Send a "read it yourself" message */
+   ldcs_message_t msg;
+   msg.header.type = LDCS_MSG_SELFLOAD_FILE;
+   msg.header.len = strlen(filename) + 1;
+   msg.data = filename;
+
+   return handle_send_msg_to_keys(procdata, &msg, filename, NULL, 0, request_broadcast, 0);
+}
+
+static int handle_recv_selfload_file(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   char *filename = (char *) msg->data;
+   int result, nc, global_result = 0, found_client = 0;
+
+   debug_printf("Recieved notice to selfload file %s\n", filename);
+   result = handle_send_msg_to_keys(procdata, msg, filename, NULL, 0, request_broadcast, 0);
+   if (result == -1) {
+      err_printf("Could not send selfload file message\n");
+      global_result = -1;
+   }
+
+   for (nc = 0; nc < procdata->client_table_used; nc++) {
+      ldcs_client_t *client = procdata->client_table + nc;
+      if (client->state == LDCS_CLIENT_STATUS_FREE || client->state == LDCS_CLIENT_STATUS_ACTIVE_PSEUDO)
+         continue;
+      if (!client->query_open)
+         continue;
+      if (strcmp(filename, client->query_globalpath) != 0)
+         continue;
+
+      debug_printf("We have a requesting client--self loading file %s\n", filename);
+      result = handle_read_and_broadcast_file(procdata, filename, suppress_broadcast);
+      if (result == -1) {
+         err_printf("Could not read and broadcast local file %s\n", filename);
+         global_result = -1;
+      }
+      found_client = 1;
+   }
+
+   if (found_client) {
+      result = handle_progress(procdata);
+      if (result == -1) {
+         err_printf("Error from handle_progress\n");
+         global_result = -1;
+      }
+   }
+
+   return global_result;
+}
+
+static int handle_report_fileexist_result(ldcs_process_data_t *procdata, int nc, exist_t res)
+{
+   ldcs_message_t out_msg;
+   uint32_t query_result;
+   int result;
+   ldcs_client_t *client = procdata->client_table + nc;
+   int connid = client->connid;
+
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+      return 0;
+
+   query_result = (res == exists ? 1 : 0);
+
+   out_msg.header.type = LDCS_MSG_EXISTS_ANSWER;
+   out_msg.header.req = client->req;
+   out_msg.header.len = sizeof(query_result);
+   out_msg.data = (void *) &query_result;
+
+   result = ldcs_send_msg(connid, &out_msg);
+   client->query_open = 0;
+   client->existance_query = 0;
+
+   procdata->server_stat.clientmsg.cnt++;
+   procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, client->query_globalpath);
+
+   return result;
+}
+
+static int handle_fileexist_test(ldcs_process_data_t *procdata, int nc)
+{
+   int result;
+   int errcode;
+   char *localpath;
+   handle_file_result_t howto_result;
+   ldcs_client_t *client;
+
+   client = procdata->client_table + nc;
+   debug_printf2("Request to test for existance of %s\n", client->query_globalpath);
+
+   howto_result = handle_howto_file(procdata, client->query_globalpath, client->query_filename,
+                                    client->query_dirname, &client->query_localpath, &errcode);
+   if ((howto_result == READ_FILE || howto_result == REQ_FILE) &&
+       ldcs_cache_isSparseDir(client->query_dirname) &&
+       ldcs_cache_findFileDirInCache(client->query_filename, client->query_dirname,
+                                     &localpath, &errcode) == LDCS_CACHE_FILE_NOT_FOUND) {
+      /* Only a lookup says whether a name in a sparse directory exists */
+      if (howto_result == READ_FILE) {
+         result = handle_read_and_broadcast_file(procdata, client->query_globalpath, request_broadcast);
+         if (result == -1)
+            return -1;
+         return handle_fileexist_test(procdata, nc);
+      }
+      result = handle_send_query(procdata, client->query_globalpath, 0);
+      add_requestor(procdata->pending_requests, client->query_globalpath, NODE_PEER_CLIENT);
+      return result;
+   }
+   switch (howto_result) {
+      case FOUND_ERRCODE:
+         if (errcode == ENOENT)
+            return handle_report_fileexist_result(procdata, nc, not_exists);
+         return handle_report_fileexist_result(procdata, nc, exists);
+      case READ_FILE:
+      case REQ_FILE:
+      case FOUND_FILE:
+         return handle_report_fileexist_result(procdata, nc, exists);
+      case NO_FILE:
+         return handle_report_fileexist_result(procdata, nc, not_exists);
+      case READ_DIRECTORY:
+         /* We should read the directory.  After that is done, restart this operation */
+         result = handle_read_and_broadcast_dir(procdata, client->query_dirname);
+         if (result == -1) {
+            err_printf("Error reading and broadcasting directory %s\n", client->query_dirname);
+            return -1;
+         }
+         return handle_fileexist_test(procdata, nc);
+      case REQ_DIRECTORY:
+         /* We should request the directory from another node */
+         result = handle_send_query(procdata, client->query_dirname, 1);
+         if (result == -1) {
+            err_printf("Failure sending query for directory %s\n", client->query_dirname);
+            return -1;
+         }
+         return 0;
+      default:
+         err_printf("Unexpected return %d from handle_howto_file\n", (int) howto_result);
+         assert(0);
+         return -1;
+   }
+}
+
+static int handle_client_fileexist_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client;
+   char *pathname;
+   char file[MAX_PATH_LEN];
+   char dir[MAX_PATH_LEN];
+
+   pathname = msg->data;
+   assert(nc != -1);
+   client = procdata->client_table + nc;
+   canonicalizePath(client_cwd(client), pathname, file, dir, MAX_PATH_LEN);
+
+   if (client_query_buffers(client) == -1)
+      return -1;
+   strncpy(client->query_filename, file, MAX_PATH_LEN);
+   strncpy(client->query_dirname, dir, MAX_PATH_LEN);
+   snprintf(client->query_globalpath, MAX_PATH_LEN, "%s/%s", client->query_dirname, client->query_filename);
+   client->query_localpath = NULL;
+
+   client->query_open = 1;
+   client->existance_query = 1;
+   
+   debug_printf2("Server recvd existance query for %s.  Dir = %s, File = %s\n", 
+                 client->query_globalpath, client->query_dirname, client->query_filename);
+   return handle_client_progress(procdata, nc);
+}
+
+/**
+ * Answer a jit query with the staged copy of a published file, or with
+ * errcode 0, which has the client use the original path.
+ **/
+static int handle_jit_answer(ldcs_process_data_t *procdata, int nc, int staged)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+
+   client->jit_query = 0;
+   if (client->jit_waiting) {
+      procdata->server_stat.jit_wait.time += ldcs_get_time() - client->query_arrival_time;
+      client->jit_waiting = 0;
+   }
+   if (staged)
+      return handle_client_fulfilled_query(procdata, nc);
+   client->query_localpath = NULL;
+   return handle_client_rejected_query(procdata, nc, 0);
+}
+
+/**
+ * A client is about to open a file under a jit rule.  If it's been
+ * published and staged here, it gets the staged copy.  If one of our
+ * other clients claimed it to write it, or it's on its way back from the
+ * root, the client waits.  Otherwise it uses the original.  Only opening
+ * the file for writing claims it (see handle_client_jit_claim), so a
+ * client that finds it missing and never writes it holds nobody up.
+ **/
+static int handle_jit_test(ldcs_process_data_t *procdata, int nc)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   char *localpath = NULL;
+   int errcode = 0, producer = -1;
+   struct stat buf;
+
+   if (ldcs_cache_findFileDirInCache(client->query_filename, client->query_dirname,
+                                     &localpath, &errcode) == LDCS_CACHE_FILE_FOUND &&
+       localpath && !errcode) {
+      debug_printf2("jit file %s is staged at %s\n", client->query_globalpath, localpath);
+      client->query_localpath = localpath;
+      return handle_jit_answer(procdata, nc, 1);
+   }
+
+   switch (jitcache_state(client->query_globalpath, &producer)) {
+      case jit_unknown:
+         filemngt_count_fsop(FSOP_STAT, 0);
+         if (stat(client->query_globalpath, &buf) == 0) {
+            debug_printf2("jit file %s is already on disk\n", client->query_globalpath);
+            jitcache_set_state(client->query_globalpath, jit_on_disk, -1);
+         }
+         return handle_jit_answer(procdata, nc, 0);
+      case jit_on_disk:
+         return handle_jit_answer(procdata, nc, 0);
+      case jit_producing:
+         if (producer == client->connid)
+            return handle_jit_answer(procdata, nc, 0);
+         break;
+      case jit_published:
+         break;
+   }
+
+   if (!client->jit_waiting) {
+      debug_printf2("Client %d waits for jit file %s\n", nc, client->query_globalpath);
+      client->jit_waiting = 1;
+      procdata->server_stat.jit_wait.cnt++;
+      if (jitcache_start_timer(procdata, handle_jit_timer) == -1)
+         return handle_jit_answer(procdata, nc, 0);
+   }
+   return 0;
+}
+
+/**
+ * Once a second while clients wait on jit files, let go of those that
+ * have waited too long.  They write the file themselves.
+ **/
+static int handle_jit_timer(int fd, int id, void *data)
+{
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
+   ldcs_client_t *client;
+   uint64_t expirations;
+   double now, limit;
+   int nc, num_waiting = 0, result = 0;
+
+   while (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations));
+
+   now = ldcs_get_time();
+   limit = jitcache_wait_limit();
+   for (nc = 0; nc < procdata->client_table_used; nc++) {
+      client = procdata->client_table + nc;
+      if (client->state != LDCS_CLIENT_STATUS_ACTIVE || !client->jit_waiting)
+         continue;
+      if (now - client->query_arrival_time < limit) {
+         num_waiting++;
+         continue;
+      }
+      debug_printf("Client %d gave up waiting for jit file %s after %.0f seconds\n", nc,
+                   client->query_globalpath, now - client->query_arrival_time);
+      procdata->server_stat.jit_timeout.cnt++;
+      if (handle_jit_answer(procdata, nc, 0) == -1)
+         result = -1;
+   }
+   if (!num_waiting)
+      jitcache_stop_timer();
+   return result;
+}
+
+static int handle_client_jit_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client;
+   char *pathname;
+   char file[MAX_PATH_LEN];
+   char dir[MAX_PATH_LEN];
+
+   pathname = msg->data;
+   assert(nc != -1);
+   client = procdata->client_table + nc;
+   canonicalizePath(client_cwd(client), pathname, file, dir, MAX_PATH_LEN);
+
+   if (client_query_buffers(client) == -1)
+      return -1;
+   strncpy(client->query_filename, file, MAX_PATH_LEN);
+   strncpy(client->query_dirname, dir, MAX_PATH_LEN);
+   snprintf(client->query_globalpath, MAX_PATH_LEN, "%s/%s", client->query_dirname, client->query_filename);
+   client->query_localpath = NULL;
+
+   client->query_open = 1;
+   client->query_missed = 0;
+   client->is_stat = client->is_loader = client->is_lazy = client->want_fd = 0;
+   client->jit_query = 1;
+   client->jit_waiting = 0;
+
+   debug_printf2("Server recvd jit query for %s.  Dir = %s, File = %s\n",
+                 client->query_globalpath, client->query_dirname, client->query_filename);
+   if (reloc_rules_match(procdata->rules, procdata->num_rules, client->query_globalpath, -1) != reloc_jit) {
+      debug_printf("jit query for %s, which no jit rule covers\n", client->query_globalpath);
+      return handle_jit_answer(procdata, nc, 0);
+   }
+   return handle_client_progress(procdata, nc);
+}
+
+/**
+ * A jit file is written.  Servers below the root pass it up, and the root
+ * reads it and sends it to every node, where it's staged for the clients
+ * waiting on it.
+ **/
+static int handle_jit_publish(ldcs_process_data_t *procdata, char *pathname)
+{
+   ldcs_message_t msg;
+   char file[MAX_PATH_LEN+1], dir[MAX_PATH_LEN+1], *localpath = NULL;
+   int errcode = 0, result;
+
+   if (procdata->md_rank != 0) {
+      msg.header.type = LDCS_MSG_JIT_PUBLISH;
+      msg.header.len = strlen(pathname) + 1;
+      msg.data = pathname;
+      return ldcs_audit_server_md_forward_query(procdata, &msg);
+   }
+
+   file[MAX_PATH_LEN] = dir[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, file, dir, MAX_PATH_LEN);
+   if (ldcs_cache_findFileDirInCache(file, dir, &localpath, &errcode) == LDCS_CACHE_FILE_FOUND &&
+       localpath && !errcode) {
+      debug_printf2("jit file %s was already sent out\n", pathname);
+      return 0;
+   }
+   debug_printf("Sending published jit file %s to every node\n", pathname);
+   result = handle_read_and_broadcast_file(procdata, pathname, preload_broadcast);
+   if (result == -1)
+      return -1;
+   return handle_progress(procdata);
+}
+
+static int handle_jit_publish_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   char *pathname = (char *) msg->data;
+
+   if (!msg->header.len || pathname[msg->header.len-1] != '\0' || pathname[0] != '/') {
+      err_printf("Dropping malformed jit publish message\n");
+      return 0;
+   }
+   return handle_jit_publish(procdata, pathname);
+}
+
+/**
+ * A client is opening a file under a jit rule for writing.  If nobody
+ * here has claimed it or found it on disk, it's this client's to write,
+ * and our other clients that ask for it wait until it's published or the
+ * client goes away.
+ **/
+static int handle_client_jit_claim(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   char pathname[MAX_PATH_LEN+1];
+
+   if (!msg->header.len || ((char *) msg->data)[msg->header.len-1] != '\0' ||
+       ((char *) msg->data)[0] != '/' || msg->header.len > MAX_PATH_LEN) {
+      err_printf("Dropping malformed jit claim from client %d\n", nc);
+      return 0;
+   }
+   strncpy(pathname, (char *) msg->data, MAX_PATH_LEN+1);
+   reducePath(pathname);
+   if (reloc_rules_match(procdata->rules, procdata->num_rules, pathname, -1) != reloc_jit)
+      return 0;
+   if (jitcache_state(pathname, NULL) != jit_unknown)
+      return 0;
+
+   debug_printf2("Client %d writes jit file %s\n", nc, pathname);
+   jitcache_set_state(pathname, jit_producing, client->connid);
+   return 0;
+}
+
+static int handle_client_jit_publish(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   char pathname[MAX_PATH_LEN+1];
+
+   if (!msg->header.len || ((char *) msg->data)[msg->header.len-1] != '\0' ||
+       ((char *) msg->data)[0] != '/' || msg->header.len > MAX_PATH_LEN) {
+      err_printf("Dropping malformed jit publish from client %d\n", nc);
+      return 0;
+   }
+   strncpy(pathname, (char *) msg->data, MAX_PATH_LEN+1);
+   reducePath(pathname);
+   if (reloc_rules_match(procdata->rules, procdata->num_rules, pathname, -1) != reloc_jit) {
+      debug_printf("Client %d published %s, which no jit rule covers\n", nc, pathname);
+      return 0;
+   }
+   if (jitcache_state(pathname, NULL) == jit_published)
+      return 0;
+
+   debug_printf2("Client %d published jit file %s\n", nc, pathname);
+   jitcache_set_state(pathname, jit_published, -1);
+   procdata->server_stat.jit_publish.cnt++;
+   return handle_jit_publish(procdata, pathname);
+}
+
+/**
+ * Answer a key-value fence with errcode, once the whole job has fenced
+ **/
+static int handle_kvs_answer(ldcs_process_data_t *procdata, int nc, int errcode)
+{
+   ldcs_message_t out_msg;
+   ldcs_client_t *client = procdata->client_table + nc;
+
+   client->kvs_waiting = 0;
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || client->connid < 0)
+      return 0;
+
+   out_msg.header.type = LDCS_MSG_KVS_ANSWER;
+   out_msg.header.req = client->req;
+   out_msg.header.len = sizeof(errcode);
+   out_msg.data = (char *) &errcode;
+   ldcs_send_msg(client->connid, &out_msg);
+   return 0;
+}
+
+/**
+ * Once our clients and children have all fenced, send the puts from our
+ * subtree up.  At the root they're everyone's, and go back down to every
+ * server as the fence's table.
+ **/
+static int handle_kvs_fence_if_done(ldcs_process_data_t *procdata)
+{
+   ldcs_message_t msg;
+   char *data;
+   size_t size;
+   int result;
+
+   if (!kvs_fence_ready(ldcs_audit_server_md_get_num_children(procdata)))
+      return 0;
+   kvs_fence_reset();
+   kvs_take_pending(&data, &size);
+
+   msg.header.len = size;
+   msg.data = data;
+   if (procdata->md_rank != 0) {
+      debug_printf2("Subtree has fenced, sending %lu bytes of key-value puts to our parent\n",
+                    (unsigned long) size);
+      msg.header.type = LDCS_MSG_KVS_GATHER;
+      result = ldcs_audit_server_md_forward_query(procdata, &msg);
+   }
+   else {
+      debug_printf("Every server has fenced, sending %lu bytes of key-value puts to every node\n",
+                   (unsigned long) size);
+      msg.header.type = LDCS_MSG_KVS_TABLE;
+      result = handle_kvs_table_recv(procdata, &msg);
+   }
+   free(data);
+   return result;
+}
+
+static int handle_client_kvs_put(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   char *key = (char *) msg->data, *value;
+   size_t key_len;
+
+   if (!msg->header.len || key[msg->header.len-1] != '\0' ||
+       (key_len = strlen(key)) + 1 >= msg->header.len) {
+      err_printf("Dropping malformed key-value put from client %d\n", nc);
+      return 0;
+   }
+   value = key + key_len + 1;
+   if (key_len + strlen(value) + 2 != msg->header.len) {
+      err_printf("Dropping malformed key-value put from client %d\n", nc);
+      return 0;
+   }
+   return kvs_put(key, value);
+}
+
+/**
+ * A client fenced.  It waits for its answer until the table comes down
+ * from the root.
+ **/
+static int handle_client_kvs_fence(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   int local_procs;
+
+   if (msg->header.len != sizeof(local_procs)) {
+      err_printf("Got key-value fence of length %ld from client %d\n", (long) msg->header.len, nc);
+      return handle_kvs_answer(procdata, nc, EINVAL);
+   }
+   memcpy(&local_procs, msg->data, sizeof(local_procs));
+
+   debug_printf2("Client %d fenced, with %d local processes taking part\n", nc, local_procs);
+   client->kvs_waiting = 1;
+   client->query_arrival_time = ldcs_get_time();
+   kvs_fence_local(local_procs);
+   return handle_kvs_fence_if_done(procdata);
+}
+
+static int handle_client_kvs_get(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_message_t out_msg;
+   ldcs_client_t *client = procdata->client_table + nc;
+   const char *value = NULL;
+
+   if (msg->header.len && ((char *) msg->data)[msg->header.len-1] == '\0')
+      value = kvs_get((char *) msg->data);
+   debug_printf3("Client %d got key %s: %s\n", nc, msg->header.len ? (char *) msg->data : "",
+                 value ? value : "(none)");
+
+   out_msg.header.type = LDCS_MSG_KVS_ANSWER;
+   out_msg.header.req = client->req;
+   out_msg.header.len = value ? strlen(value) + 1 : 0;
+   out_msg.data = (char *) value;
+   ldcs_send_msg(client->connid, &out_msg);
+   return 0;
+}
+
+/**
+ * A child's subtree has fenced, and sent up its puts
+ **/
+static int handle_kvs_gather_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   debug_printf2("Got %lu bytes of key-value puts from a child\n", (unsigned long) msg->header.len);
+   if (msg->header.len && kvs_merge((char *) msg->data, msg->header.len) == -1)
+      return -1;
+   kvs_fence_child();
+   return handle_kvs_fence_if_done(procdata);
+}
+
+/**
+ * The fence's table came down from the root.  Pass it on, add it to ours,
+ * and let our fenced clients go.
+ **/
+static int handle_kvs_table_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   ldcs_client_t *client;
+   int nc, result = 0;
 
-      debug_printf2("Preload read of file %s\n", pathname);
-      result = handle_read_and_broadcast_file(procdata, pathname, preload_broadcast);
-      if (result == -1) {
-         err_printf("Error broadcasting file data during preload\n");
-         global_result = -1;
-         continue;
-      }
-   }
+   if (ldcs_audit_server_md_broadcast(procdata, msg) == -1)
+      result = -1;
+   if (msg->header.len && kvs_apply((char *) msg->data, msg->header.len) == -1)
+      result = -1;
 
-   result = handle_preload_done(procdata);
-   if (result == -1) {
-      err_printf("Error from handle_preload_done");
-      global_result = -1;
+   for (nc = 0; nc < procdata->client_table_used; nc++) {
+      client = procdata->client_table + nc;
+      if (!client->kvs_waiting)
+         continue;
+      if (handle_kvs_answer(procdata, nc, result == -1 ? EIO : 0) == -1)
+         result = -1;
    }
-
-   return global_result;
+   return result;
 }
 
-static int handle_preload_done(ldcs_process_data_t *procdata)
+/**
+ * Answer a directory listing query with the local directory that lists
+ * the same entries, in the form of a file query answer, or with the
+ * errcode for why the client should list the original.
+ **/
+static int handle_report_dirlist_result(ldcs_process_data_t *procdata, int nc, const char *localdir, int errcode)
 {
-   ldcs_message_t done_msg;
-   int result;
-
-   debug_printf2("Handle preload done\n");
-   procdata->preload_done = 1;
+   ldcs_message_t out_msg;
+   char buffer_out[MAX_PATH_LEN+1+sizeof(int)];
+   int flags = 0, result;
+   ldcs_client_t *client = procdata->client_table + nc;
+   int connid = client->connid;
 
-   done_msg.header.type = LDCS_MSG_PRELOAD_DONE;
-   done_msg.header.len = 0;
-   done_msg.data = NULL;
+   if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
+      return 0;
 
-   result = ldcs_audit_server_md_broadcast(procdata, &done_msg);
-   if (result == -1) {
-      err_printf("Error broadcasting done message during preload\n");
-      return -1;
+   out_msg.header.type = LDCS_MSG_FILE_QUERY_ANSWER;
+   out_msg.header.req = client->req;
+   out_msg.data = (void *) buffer_out;
+   if (localdir) {
+      memcpy(out_msg.data, &flags, sizeof(int));
+      strncpy(out_msg.data+sizeof(int), localdir, MAX_PATH_LEN+1);
+      out_msg.header.len = sizeof(int) + strlen(localdir) + 1;
+   }
+   else {
+      memcpy(out_msg.data, &errcode, sizeof(int));
+      out_msg.header.len = sizeof(int);
    }
 
-   return handle_progress(procdata);
-}
+   result = ldcs_send_msg(connid, &out_msg);
+   client->query_open = 0;
+   client->dir_query = 0;
+   debug_printf2("Server answering listing query for %s with %s\n", client->query_globalpath,
+                 localdir ? localdir : strerror(errcode));
 
-static int handle_create_selfload_file(ldcs_process_data_t *procdata, char *filename)
-{
-   /* Other nodes know about a file we don't know about.  Maybe a local file? 
-      Send a "read it yourself" message */
-   ldcs_message_t msg;
-   msg.header.type = LDCS_MSG_SELFLOAD_FILE;
-   msg.header.len = strlen(filename) + 1;
-   msg.data = filename;
+   procdata->server_stat.clientmsg.cnt++;
+   procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, client->query_globalpath);
 
-   return handle_send_msg_to_keys(procdata, &msg, filename, NULL, 0, request_broadcast, 0);
+   return result;
 }
 
-static int handle_recv_selfload_file(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+static int handle_dirlist_test(ldcs_process_data_t *procdata, int nc)
 {
-   char *filename = (char *) msg->data;
-   int result, nc, global_result = 0, found_client = 0;
+   int result, errcode;
+   const char *localdir;
+   handle_file_result_t howto_result;
+   ldcs_client_t *client;
 
-   debug_printf("Recieved notice to selfload file %s\n", filename);
-   result = handle_send_msg_to_keys(procdata, msg, filename, NULL, 0, request_broadcast, 0);
-   if (result == -1) {
-      err_printf("Could not send selfload file message\n");
-      global_result = -1;
+   client = procdata->client_table + nc;
+   howto_result = handle_howto_directory(procdata, client->query_globalpath);
+   switch (howto_result) {
+      case FOUND_FILE:
+         localdir = dirlist_get(procdata, client->query_globalpath, &errcode);
+         return handle_report_dirlist_result(procdata, nc, localdir, errcode);
+      case NO_FILE:
+         return handle_report_dirlist_result(procdata, nc, NULL, ENOENT);
+      case READ_DIRECTORY:
+         result = handle_read_and_broadcast_dir(procdata, client->query_globalpath);
+         if (result == -1) {
+            err_printf("Error reading and broadcasting directory %s\n", client->query_globalpath);
+            return -1;
+         }
+         return handle_dirlist_test(procdata, nc);
+      case REQ_DIRECTORY:
+         result = handle_send_query(procdata, client->query_globalpath, 1);
+         if (result == -1) {
+            err_printf("Failure sending query for directory %s\n", client->query_globalpath);
+            return -1;
+         }
+         return 0;
+      default:
+         err_printf("Unexpected return %d from handle_howto_directory\n", (int) howto_result);
+         assert(0);
+         return -1;
    }
+}
 
-   for (nc = 0; nc < procdata->client_table_used; nc++) {
-      ldcs_client_t *client = procdata->client_table + nc;
-      if (client->state == LDCS_CLIENT_STATUS_FREE || client->state == LDCS_CLIENT_STATUS_ACTIVE_PSEUDO)
-         continue;
-      if (!client->query_open)
-         continue;
-      if (strcmp(filename, client->query_globalpath) != 0)
-         continue;
+static int handle_client_dir_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client;
+   char dir[MAX_PATH_LEN];
 
-      debug_printf("We have a requesting client--self loading file %s\n", filename);
-      result = handle_read_and_broadcast_file(procdata, filename, suppress_broadcast);
-      if (result == -1) {
-         err_printf("Could not read and broadcast local file %s\n", filename);
-         global_result = -1;
-      }
-      found_client = 1;
+   assert(nc != -1);
+   client = procdata->client_table + nc;
+   if (!msg->header.len || msg->data[msg->header.len-1] != '\0') {
+      err_printf("Malformed directory listing query from client %d\n", nc);
+      return -1;
    }
+   if (client_query_buffers(client) == -1)
+      return -1;
 
-   if (found_client) {
-      result = handle_progress(procdata);
-      if (result == -1) {
-         err_printf("Error from handle_progress\n");
-         global_result = -1;
-      }
+   if (canonicalizeDir(client_cwd(client), msg->data, strlen(msg->data), dir, MAX_PATH_LEN) == -1 || !dir[0] || !(procdata->opts & OPT_SERVEDIRS)) {
+      client->query_globalpath[0] = '\0';
+      return handle_report_dirlist_result(procdata, nc, NULL, EINVAL);
    }
+   strncpy(client->query_globalpath, dir, MAX_PATH_LEN);
+   strncpy(client->query_dirname, dir, MAX_PATH_LEN);
+   client->query_filename[0] = '\0';
+   client->query_localpath = NULL;
 
-   return global_result;
+   client->query_open = 1;
+   client->dir_query = 1;
+
+   debug_printf2("Server recvd directory listing query for %s\n", client->query_globalpath);
+   return handle_client_progress(procdata, nc);
 }
 
-static int handle_report_fileexist_result(ldcs_process_data_t *procdata, int nc, exist_t res)
+/**
+ * Answer a readlink or realpath query with the link target or resolved
+ * path, in the form of a file query answer, or with the errcode the
+ * call should fail with.  An errcode of EAGAIN tells the client to ask
+ * the filesystem itself.
+ **/
+static int handle_report_resolve_result(ldcs_process_data_t *procdata, int nc, const char *path, int errcode)
 {
    ldcs_message_t out_msg;
-   uint32_t query_result;
-   int result;
+   char buffer_out[MAX_PATH_LEN+1+sizeof(int)];
+   int flags = 0, result;
    ldcs_client_t *client = procdata->client_table + nc;
    int connid = client->connid;
 
    if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
       return 0;
 
-   query_result = (res == exists ? 1 : 0);
-
-   out_msg.header.type = LDCS_MSG_EXISTS_ANSWER;
-   out_msg.header.len = sizeof(query_result);
-   out_msg.data = (void *) &query_result;
+   out_msg.header.type = LDCS_MSG_FILE_QUERY_ANSWER;
+   out_msg.header.req = client->req;
+   out_msg.data = (void *) buffer_out;
+   if (path) {
+      memcpy(out_msg.data, &flags, sizeof(int));
+      strncpy(out_msg.data+sizeof(int), path, MAX_PATH_LEN+1);
+      out_msg.header.len = sizeof(int) + strlen(path) + 1;
+   }
+   else {
+      memcpy(out_msg.data, &errcode, sizeof(int));
+      out_msg.header.len = sizeof(int);
+   }
 
    result = ldcs_send_msg(connid, &out_msg);
    client->query_open = 0;
-   client->existance_query = 0;
+   debug_printf2("Server answering %s query for %s with %s\n", client->link_last ? "readlink" : "realpath",
+                 client->query_globalpath, path ? path : strerror(errcode));
+   client->link_query = 0;
 
    procdata->server_stat.clientmsg.cnt++;
    procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   procdata->server_stat.resolve.cnt++;
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, client->query_globalpath);
 
    return result;
 }
 
-static int handle_fileexist_test(ldcs_process_data_t *procdata, int nc)
+/**
+ * Walk the query's path through the cached listings, fetching each
+ * directory the walk needs that isn't cached yet.
+ **/
+static int handle_resolve_test(ldcs_process_data_t *procdata, int nc)
 {
-   int result;
-   int errcode;
+   char path[LDCS_CACHE_MAX_LINK_LEN+1];
+   int result, errcode;
+   ldcs_cache_result_t cache_result;
    handle_file_result_t howto_result;
    ldcs_client_t *client;
 
    client = procdata->client_table + nc;
-   debug_printf2("Request to test for existance of %s\n", client->query_globalpath);
+   cache_result = ldcs_cache_resolvePath(client->query_globalpath, client->link_last, path, &errcode);
+   if (cache_result == LDCS_CACHE_FILE_FOUND)
+      return handle_report_resolve_result(procdata, nc, path, 0);
+   if (cache_result != LDCS_CACHE_DIR_NOT_PARSED)
+      return handle_report_resolve_result(procdata, nc, NULL, errcode);
 
-   howto_result = handle_howto_file(procdata, client->query_globalpath, client->query_filename,
-                                    client->query_dirname, &client->query_localpath, &errcode);
+   howto_result = handle_howto_directory(procdata, path);
    switch (howto_result) {
-      case READ_FILE:
-      case REQ_FILE:
       case FOUND_FILE:
-      case FOUND_ERRCODE:
-         return handle_report_fileexist_result(procdata, nc, exists);
       case NO_FILE:
-         return handle_report_fileexist_result(procdata, nc, not_exists);
+         return handle_report_resolve_result(procdata, nc, NULL, EAGAIN);
       case READ_DIRECTORY:
-         /* We should read the directory.  After that is done, restart this operation */
-         result = handle_read_and_broadcast_dir(procdata, client->query_dirname);
+         result = handle_read_and_broadcast_dir(procdata, path);
          if (result == -1) {
-            err_printf("Error reading and broadcasting directory %s\n", client->query_dirname);
+            err_printf("Error reading and broadcasting directory %s\n", path);
             return -1;
          }
-         return handle_fileexist_test(procdata, nc);
+         return handle_resolve_test(procdata, nc);
       case REQ_DIRECTORY:
-         /* We should request the directory from another node */
-         result = handle_send_query(procdata, client->query_dirname, 1);
+         result = handle_send_query(procdata, path, 1);
          if (result == -1) {
-            err_printf("Failure sending query for directory %s\n", client->query_dirname);
+            err_printf("Failure sending query for directory %s\n", path);
             return -1;
          }
          return 0;
       default:
-         err_printf("Unexpected return %d from handle_howto_file\n", (int) howto_result);
+         err_printf("Unexpected return %d from handle_howto_directory\n", (int) howto_result);
          assert(0);
          return -1;
    }
 }
 
-static int handle_client_fileexist_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+/**
+ * The path isn't reduced, since a '..' that follows a link leads out of
+ * the link's target rather than back to where the link is.
+ **/
+static int handle_client_resolve_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
 {
    ldcs_client_t *client;
-   char *pathname;
-   char file[MAX_PATH_LEN];
-   char dir[MAX_PATH_LEN];
-
-   file[0] = '\0'; dir[0] = '\0';
-   pathname = msg->data;
-   parseFilenameNoAlloc(pathname, file, dir, MAX_PATH_LEN);
+   char path[MAX_PATH_LEN];
 
    assert(nc != -1);
    client = procdata->client_table + nc;
-   addCWDToDir(client->remote_cwd, dir, MAX_PATH_LEN);
-   reducePath(dir);
+   if (!msg->header.len || msg->data[msg->header.len-1] != '\0') {
+      err_printf("Malformed link query from client %d\n", nc);
+      return -1;
+   }
+   if (client_query_buffers(client) == -1)
+      return -1;
 
-   strncpy(client->query_filename, file, MAX_PATH_LEN);
-   strncpy(client->query_dirname, dir, MAX_PATH_LEN);
-   snprintf(client->query_globalpath, MAX_PATH_LEN, "%s/%s", client->query_dirname, client->query_filename);
+   client->link_last = (msg->header.type == LDCS_MSG_READLINK_QUERY);
+   strncpy(path, msg->data, MAX_PATH_LEN-1);
+   path[MAX_PATH_LEN-1] = '\0';
+   addCWDToDir(client_cwd(client), path, MAX_PATH_LEN);
+   if (!path[0] || !(procdata->opts & OPT_RESOLVELINKS)) {
+      client->query_globalpath[0] = '\0';
+      return handle_report_resolve_result(procdata, nc, NULL, EAGAIN);
+   }
+   strncpy(client->query_globalpath, path, MAX_PATH_LEN);
+   client->query_dirname[0] = '\0';
+   client->query_filename[0] = '\0';
    client->query_localpath = NULL;
 
    client->query_open = 1;
-   client->existance_query = 1;
-   
-   debug_printf2("Server recvd existance query for %s.  Dir = %s, File = %s\n", 
-                 client->query_globalpath, client->query_dirname, client->query_filename);
+   client->link_query = 1;
+
+   debug_printf2("Server recvd %s query for %s\n", client->link_last ? "readlink" : "realpath",
+                 client->query_globalpath);
    return handle_client_progress(procdata, nc);
 }
 
@@ -1695,6 +7419,7 @@ static int handle_client_origpath_msg(ldcs_process_data_t *procdata, int nc, ldc
       
 
    resp.header.type = LDCS_MSG_ORIGPATH_ANSWER;
+   resp.header.req = client->req;
    resp.header.len = strlen(newpath)+1;
    resp.data = (void*) newpath;
 
@@ -1703,6 +7428,7 @@ static int handle_client_origpath_msg(ldcs_process_data_t *procdata, int nc, ldc
 
    procdata->server_stat.clientmsg.cnt++;
    procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, NULL);
 
    return result;
 }
@@ -1812,7 +7538,7 @@ static int handle_stat_file(ldcs_process_data_t *procdata, char *pathname, char
 /**
  * Puts the results of a stat into the cache
  **/
-static int handle_cache_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, struct stat *buf, char **localname)
+int handle_cache_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, struct stat *buf, char **localname)
 {
    double starttime;
    int result;
@@ -1821,19 +7547,28 @@ static int handle_cache_metadata(ldcs_process_data_t *procdata, char *pathname,
    if (!file_exists) {
       debug_printf3("File %s doesn't exist based on stat\n", pathname);
       *localname = NULL;
+      add_stat_cache(pathname, NULL);
+      return 0;
    }
-   else {
-      debug_printf3("Successfully stat'd file %s\n", pathname);
-      *localname = filemngt_calc_localname(pathname);
-      add_global_name(pathname, *localname);
+
+   debug_printf3("Successfully stat'd file %s\n", pathname);
+   starttime = ldcs_get_time();
+
+   /* Prefer a slot in the shared stat segment, which clients read directly */
+   *localname = statseg_add(buf);
+   if (*localname) {
+      add_stat_cache(pathname, *localname);
+      procdata->server_stat.libstore.cnt++;
+      procdata->server_stat.libstore.bytes += sizeof(struct stat);
+      procdata->server_stat.libstore.time += (ldcs_get_time() - starttime);
+      return 0;
    }
+
+   *localname = filemngt_calc_localname(pathname);
+   add_global_name(pathname, *localname);
    add_stat_cache(pathname, *localname);
 
-   if (!file_exists)
-      return 0;
-   
    /* Write stat contents to disk */
-   starttime = ldcs_get_time();
    result = filemngt_write_stat(*localname, buf);   
    procdata->server_stat.libstore.cnt++;
    procdata->server_stat.libstore.bytes += sizeof(struct stat);
@@ -1871,6 +7606,105 @@ static int handle_cache_ldso(ldcs_process_data_t *procdata, char *pathname, int
    return 0;
 }
 
+/**
+ * Metadata results produced while handling a message from another server,
+ * such as a batched request or a batch of results from our parent, are
+ * gathered into one LDCS_MSG_STAT_NET_RESULT or LDCS_MSG_LOADER_DATA_NET_RESP
+ * per child rather than sent one per path.  The records in such a message
+ * sit back to back, each laid out as a single result would be.  Batches
+ * nest like query batches, and go out when the outermost one ends.
+ **/
+typedef struct {
+   node_peer_t peer;   /* NODE_PEER_ALL for a broadcast to every child */
+   metadata_t mdtype;
+   char *buffer;
+   size_t used;
+   size_t size;
+} metadata_batch_t;
+
+static struct {
+   int depth;
+   metadata_batch_t *batches;
+   int num_batches;
+   double starttime;
+} metadata_batch;
+
+static void handle_begin_metadata_batch()
+{
+   if (!metadata_batch.depth++)
+      metadata_batch.starttime = ldcs_get_time();
+}
+
+static int handle_metadata_batch_add(node_peer_t peer, metadata_t mdtype, char *record, size_t size)
+{
+   metadata_batch_t *b;
+   int i;
+
+   for (i = 0; i < metadata_batch.num_batches; i++) {
+      if (metadata_batch.batches[i].peer == peer && metadata_batch.batches[i].mdtype == mdtype)
+         break;
+   }
+   if (i == metadata_batch.num_batches) {
+      metadata_batch.batches = (metadata_batch_t *) realloc(metadata_batch.batches,
+                                                            sizeof(metadata_batch_t) * (i + 1));
+      metadata_batch.num_batches++;
+      b = metadata_batch.batches + i;
+      memset(b, 0, sizeof(*b));
+      b->peer = peer;
+      b->mdtype = mdtype;
+   }
+   b = metadata_batch.batches + i;
+
+   if (b->used + size > b->size) {
+      b->size = b->size ? b->size * 2 : 4096;
+      while (b->used + size > b->size)
+         b->size *= 2;
+      b->buffer = (char *) realloc(b->buffer, b->size);
+      if (!b->buffer) {
+         err_printf("Could not allocate %lu bytes for metadata batch\n", (unsigned long) b->size);
+         b->size = b->used = 0;
+         return -1;
+      }
+   }
+   memcpy(b->buffer + b->used, record, size);
+   b->used += size;
+   return 0;
+}
+
+static int handle_end_metadata_batch(ldcs_process_data_t *procdata)
+{
+   ldcs_message_t msg;
+   metadata_batch_t *b;
+   int i, result, global_result = 0, sent = 0;
+
+   assert(metadata_batch.depth > 0);
+   if (--metadata_batch.depth)
+      return 0;
+
+   for (i = 0; i < metadata_batch.num_batches; i++) {
+      b = metadata_batch.batches + i;
+      if (!b->used)
+         continue;
+      msg.header.type = (b->mdtype == metadata_stat) ? LDCS_MSG_STAT_NET_RESULT : LDCS_MSG_LOADER_DATA_NET_RESP;
+      msg.header.len = b->used;
+      msg.data = b->buffer;
+      debug_printf2("Sending %lu bytes of batched metadata results to %s\n", (unsigned long) b->used,
+                    b->peer == NODE_PEER_ALL ? "all children" : "a child");
+      if (b->peer == NODE_PEER_ALL)
+         result = ldcs_audit_server_md_broadcast(procdata, &msg);
+      else
+         result = ldcs_audit_server_md_send(procdata, &msg, b->peer);
+      if (result == -1)
+         global_result = -1;
+      procdata->server_stat.libdist.bytes += b->used;
+      b->used = 0;
+      sent = 1;
+   }
+   if (sent)
+      procdata->server_stat.libdist.time += (ldcs_get_time() - metadata_batch.starttime);
+   return global_result;
+}
+
 /**
  * Distributes stat contents onto the network
  **/
@@ -1890,7 +7724,7 @@ static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathna
    packet_size = sizeof(int);
    packet_size += pathname_len;
    packet_size += file_exists ? buf_size : 0;
-   packet_buffer = (char *) malloc(packet_size);
+   packet_buffer = (char *) msgpool_alloc(packet_size);
    if (!packet_buffer) {
       err_printf("Error allocating packet\n");
       return -1;
@@ -1908,6 +7742,24 @@ static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathna
    }
    assert(pos == packet_size);
 
+   if (metadata_batch.depth) {
+      node_peer_t *peers;
+      int num_peers, i;
+
+      result = 0;
+      if (handle_select_msg_targets(procdata, pathname, 0, 1, &peers, &num_peers))
+         result = handle_metadata_batch_add(NODE_PEER_ALL, mdtype, packet_buffer, packet_size);
+      for (i = 0; i < num_peers; i++) {
+         if (handle_metadata_batch_add(peers[i], mdtype, packet_buffer, packet_size) == -1)
+            result = -1;
+      }
+      if (peers)
+         free(peers);
+      procdata->server_stat.libdist.cnt++;
+      msgpool_free(packet_buffer);
+      return result;
+   }
+
    msg.header.type = (mdtype == metadata_stat) ? LDCS_MSG_STAT_NET_RESULT : LDCS_MSG_LOADER_DATA_NET_RESP;
    msg.header.len = packet_size;
    msg.data = packet_buffer;
@@ -1919,24 +7771,41 @@ static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathna
    procdata->server_stat.libdist.bytes += packet_size;
    procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);      
 
-   free(packet_buffer);
+   msgpool_free(packet_buffer);
    return result;
 }
 
 /**
- * Received a stat contents packet.  Decode, cache, and broadcast.
+ * Received a stat contents packet, which may hold several records.  Decode,
+ * cache, and broadcast each.
  **/
 static int handle_metadata_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, metadata_t mdtype, node_peer_t peer)
+{
+   size_t pos = 0;
+   int result;
+
+   while (pos < msg->header.len) {
+      result = handle_metadata_record_recv(procdata, msg->data, &pos, mdtype);
+      if (result == -1)
+         return -1;
+   }
+   assert(pos == msg->header.len);
+
+   return handle_progress(procdata);
+}
+
+static int handle_metadata_record_recv(ldcs_process_data_t *procdata, char *buffer, size_t *record_pos,
+                                       metadata_t mdtype)
 {
    int file_exists;
    char pathname[MAX_PATH_LEN+1], *localpath;
    struct stat buf;
    ldso_info_t ldsoinfo;
-   int pos = 0, pathlen, result, payload_size = 0;
-   char *buffer = (char *) msg->data;
+   size_t pos = *record_pos;
+   int pathlen, result, payload_size = 0;
    unsigned char *payload = NULL;
 
-   /* Decode packet from network */
+   /* Decode record from network */
    memcpy(&file_exists, buffer + pos, sizeof(int));
    pos += sizeof(int);
 
@@ -1957,7 +7826,7 @@ static int handle_metadata_recv(ldcs_process_data_t *procdata, ldcs_message_t *m
          payload_size = sizeof(ldsoinfo);
       }
    }
-   assert(pos == msg->header.len);
+   *record_pos = pos;
 
    debug_printf2("Received packet with stat for %s (%s)\n", pathname,
                  file_exists ? "file exists" : "nonexistant file");
@@ -1978,7 +7847,7 @@ static int handle_metadata_recv(ldcs_process_data_t *procdata, ldcs_message_t *m
       return -1;
    }
 
-   return handle_progress(procdata);
+   return 0;
 }
 
 /**
@@ -2007,16 +7876,22 @@ static int handle_client_metadata_result(ldcs_process_data_t *procdata, int nc,
    }
    
    msg.header.type = (mdtype == metadata_stat) ? LDCS_MSG_STAT_ANSWER : LDCS_MSG_LOADER_DATA_RESP;
+   msg.header.req = client->req;
    msg.header.len = localpath ? strlen(localpath)+1 : 0;
    msg.data = localpath;
    
    result = ldcs_send_msg(connid, &msg);
    client->query_open = 0;
    client->is_stat = 0;
+   if (mdtype == metadata_stat && localpath)
+      footprint_note_use(client->query_globalpath, 1);
+   if ((procdata->opts & OPT_PRELOADLEARN) && mdtype == metadata_stat && localpath)
+      learn_record(client->query_globalpath, 1);
 
    procdata->server_stat.clientmsg.cnt++;
    procdata->server_stat.clientmsg.time+=(ldcs_get_time()-
                                                    client->query_arrival_time);
+   latency_record(LATENCY_CLIENT_QUERY, client->query_arrival_time, client->query_globalpath);
    return result;
 }
 
@@ -2134,6 +8009,9 @@ static int handle_load_and_broadcast_metadata(ldcs_process_data_t *procdata, cha
 static int handle_send_exit_ready_if_done(ldcs_process_data_t *procdata)
 {
    ldcs_message_t msg;
+   char *learned = NULL;
+   size_t learned_size = 0;
+   int result;
    debug_printf2("Checking if we need to send an exit ready message\n");
 
    if (procdata->opts & OPT_PERSIST) {
@@ -2161,14 +8039,42 @@ static int handle_send_exit_ready_if_done(ldcs_process_data_t *procdata)
    msg.header.len = 0;
    msg.data = NULL;
    procdata->sent_exit_ready = 1;
+   if (procdata->opts & OPT_STATSREPORT)
+      _ldcs_server_stat_collect(procdata);
 
    if (ldcs_audit_server_md_is_responsible(procdata, "")) {
       debug_printf("Exit globally ready.  Sending exit broadcast.\n");
+      if (procdata->opts & OPT_PRELOADLEARN)
+         learn_write(procdata->preloadfile);
+      if (procdata->opts & OPT_STATSREPORT)
+         report_write(&procdata->server_stat, procdata->stats_report);
       return handle_exit_broadcast(procdata);
    }
    else {
+      /* Our subtree's statistics go up just ahead of it */
+      if (procdata->opts & OPT_STATSREPORT) {
+         ldcs_message_t report_msg;
+         char *report;
+         size_t report_size;
+         if (report_pack(&procdata->server_stat, &report, &report_size) == 0) {
+            report_msg.header.type = LDCS_MSG_STATS_REPORT;
+            report_msg.header.len = report_size;
+            report_msg.data = report;
+            result = ldcs_audit_server_md_forward_query(procdata, &report_msg);
+            free(report);
+            if (result == -1)
+               return -1;
+         }
+      }
+      /* What we and our children learned goes up with it */
+      if ((procdata->opts & OPT_PRELOADLEARN) && learn_pack(&learned, &learned_size) == 0) {
+         msg.header.len = learned_size;
+         msg.data = learned;
+      }
       debug_printf2("Sending exit ready message to parent\n");
-      return ldcs_audit_server_md_forward_query(procdata, &msg);
+      result = ldcs_audit_server_md_forward_query(procdata, &msg);
+      free(learned);
+      return result;
    }
 }
 
@@ -2180,9 +8086,28 @@ static int handle_exit_ready_msg(ldcs_process_data_t *procdata, ldcs_message_t *
 {
    debug_printf2("Got exit ready message\n");
    procdata->exit_readys_recvd++;
+   if ((procdata->opts & OPT_PRELOADLEARN) && msg->header.len)
+      learn_merge(msg->data, msg->header.len);
    return handle_send_exit_ready_if_done(procdata);
 }
 
+/**
+ * A child sent its subtree's statistics ahead of its exit ready
+ **/
+static int handle_stats_report_msg(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg)
+{
+   debug_printf2("Got statistics report of %lu bytes\n", (unsigned long) msg->header.len);
+   if (!(procdata->opts & OPT_STATSREPORT))
+      return 0;
+   if (ldcs_audit_server_md_child_joined(procdata, peer)) {
+      /* Joined servers have no rank in the job's report */
+      debug_printf2("Dropping statistics report from a joined server\n");
+      return 0;
+   }
+   return report_merge(&procdata->server_stat, ldcs_audit_server_md_get_child_index(procdata, peer),
+                       msg->data, msg->header.len);
+}
+
 /**
  * Someone who sent us an exit ready got a new client and is now
  * canceling their exit_ready message.  We may have to cancel our own
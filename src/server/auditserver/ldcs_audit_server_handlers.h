@@ -17,6 +17,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef LDCS_AUDIT_SERVER_STATELOOP_H
 #define LDCS_AUDIT_SERVER_STATELOOP_H
 
+#include <sys/stat.h>
+
 #include "ldcs_audit_server_process.h"
 #include "ldcs_audit_server_md.h"
 
@@ -24,5 +26,15 @@ int handle_server_message(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_
 int handle_client_message(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
 int handle_client_start(ldcs_process_data_t *procdata, int nc);
 int handle_client_end(ldcs_process_data_t *procdata, int nc);
+int handle_client_cached_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg,
+                               ldcs_message_t *out_msg);
+int handle_directory_batch(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+void handle_keep_settings(ldcs_message_t *msg);
+int handle_join(ldcs_process_data_t *procdata, node_peer_t peer);
+int handle_join_request(ldcs_process_data_t *procdata, int request);
+int handle_reads_in_flight();
+int handle_send_batch(ldcs_process_data_t *procdata);
+int handle_cache_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists,
+                          struct stat *buf, char **localname);
 
 #endif
@@ -0,0 +1,606 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "ldcs_api.h"
+#include "ldcs_cache.h"
+#include "stat_cache.h"
+#include "global_name.h"
+#include "ldcs_audit_server_process.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_index.h"
+#include "ldcs_audit_server_lazy.h"
+
+extern int spindle_mkdir(char *path);
+
+/**
+ * The index is a header followed by a list of records.  A rec_dir
+ * record is followed by the rec_name and rec_file records for the
+ * entries in that directory, so a single stat of the directory at load
+ * time revalidates its whole listing.  Staged files and stat results
+ * are revalidated one at a time against the inode, mtime and size that
+ * were recorded for them.
+ **/
+#define INDEX_MAGIC 0x58444e49
+#define INDEX_VERSION 1
+#define PERSIST_DIR_NAME "spindle.persist"
+#define INDEX_FILE_NAME "index"
+#define INDEX_LOCK_NAME "lock"
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t num_records;
+   uint32_t pad;
+   uint64_t body_size;
+   uint64_t checksum;
+} index_header_t;
+
+typedef enum {
+   rec_dir = 1,     /* directory that exists, name is the directory */
+   rec_nodir,       /* directory that doesn't exist */
+   rec_name,        /* name in the last rec_dir */
+   rec_file,        /* staged file in the last rec_dir, extra is the local path */
+   rec_stat,        /* stat cache entry, name is the stat cache key */
+   rec_nostat       /* stat cache entry for a file that doesn't exist */
+} index_rectype_t;
+
+typedef struct {
+   uint16_t type;
+   uint16_t d_type;
+   uint32_t name_len;    /* including NUL */
+   uint32_t extra_len;   /* including NUL, 0 if no extra string */
+   uint32_t pad;
+   uint64_t ino;
+   int64_t mtime_sec;
+   int64_t mtime_nsec;
+   int64_t size;
+   uint64_t local_size;  /* size of the cached buffer for rec_file */
+} index_record_t;
+
+#define REC_ALIGN(X) (((X) + 7) & ~((size_t) 7))
+
+typedef struct {
+   char *buffer;
+   size_t size;
+   size_t used;
+   uint32_t num_records;
+   char *cur_dir;
+   ldcs_process_data_t *procdata;
+} index_writer_t;
+
+static char *persist_dir = NULL;
+static int lock_fd = -1;
+
+static uint64_t index_checksum(const unsigned char *data, size_t len)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   size_t i;
+   for (i = 0; i < len; i++) {
+      hash ^= data[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+static int is_persisted(const char *path)
+{
+   size_t len = strlen(persist_dir);
+   return strncmp(path, persist_dir, len) == 0 && path[len] == '/';
+}
+
+static int same_file(index_record_t *rec, struct stat *st, int check_size)
+{
+   return rec->ino == (uint64_t) st->st_ino &&
+      rec->mtime_sec == (int64_t) st->st_mtim.tv_sec &&
+      rec->mtime_nsec == (int64_t) st->st_mtim.tv_nsec &&
+      (!check_size || rec->size == (int64_t) st->st_size);
+}
+
+/* A stat of a path on the shared file system, which counts against its load */
+static int global_stat(const char *path, struct stat *st, int follow)
+{
+   filemngt_count_fsop(FSOP_STAT, 0);
+   return follow ? stat(path, st) : lstat(path, st);
+}
+
+/**
+ * The persist directory sits beside the location, which is unique to each
+ * server run, and is named for our uid, since its parent is often shared
+ * with other users.  spindle_mkdir won't take one that isn't ours alone.
+ * Only one server at a time may use it, since loading an index removes
+ * any staged files that it doesn't reference.
+ **/
+static int setup_persist_dir(ldcs_process_data_t *procdata)
+{
+   char *parent, *slash, lockpath[MAX_PATH_LEN+1];
+
+   if (persist_dir)
+      return 0;
+
+   parent = strdup(procdata->location);
+   slash = strrchr(parent, '/');
+   if (slash && slash != parent)
+      *slash = '\0';
+   else
+      strcpy(parent, "/tmp");
+
+   persist_dir = (char *) malloc(strlen(parent) + strlen(PERSIST_DIR_NAME) + 16);
+   sprintf(persist_dir, "%s/%s.%d", parent, PERSIST_DIR_NAME, (int) geteuid());
+   free(parent);
+
+   if (spindle_mkdir(persist_dir) == -1) {
+      err_printf("Could not create cache index directory %s\n", persist_dir);
+      goto error;
+   }
+
+   snprintf(lockpath, sizeof(lockpath), "%s/%s", persist_dir, INDEX_LOCK_NAME);
+   lock_fd = open(lockpath, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+   if (lock_fd == -1) {
+      err_printf("Could not open cache index lock %s: %s\n", lockpath, strerror(errno));
+      goto error;
+   }
+   if (flock(lock_fd, LOCK_EX | LOCK_NB) == -1) {
+      debug_printf("Cache index in %s is in use by another server, not using it\n", persist_dir);
+      close(lock_fd);
+      lock_fd = -1;
+      goto error;
+   }
+
+   filemngt_set_persist_dir(persist_dir);
+   return 0;
+
+  error:
+   free(persist_dir);
+   persist_dir = NULL;
+   return -1;
+}
+
+static void add_record(index_writer_t *w, index_rectype_t type, const char *name, const char *extra,
+                       struct stat *st, unsigned char d_type, size_t local_size)
+{
+   index_record_t rec;
+   size_t name_len = strlen(name) + 1;
+   size_t extra_len = extra ? strlen(extra) + 1 : 0;
+   size_t needed = REC_ALIGN(sizeof(rec) + name_len + extra_len);
+
+   if (w->used + needed > w->size) {
+      while (w->used + needed > w->size)
+         w->size = w->size ? w->size * 2 : 64*1024;
+      w->buffer = (char *) realloc(w->buffer, w->size);
+   }
+
+   memset(&rec, 0, sizeof(rec));
+   rec.type = type;
+   rec.d_type = d_type;
+   rec.name_len = name_len;
+   rec.extra_len = extra_len;
+   if (st) {
+      rec.ino = st->st_ino;
+      rec.mtime_sec = st->st_mtim.tv_sec;
+      rec.mtime_nsec = st->st_mtim.tv_nsec;
+      rec.size = st->st_size;
+   }
+   rec.local_size = local_size;
+
+   memset(w->buffer + w->used, 0, needed);
+   memcpy(w->buffer + w->used, &rec, sizeof(rec));
+   memcpy(w->buffer + w->used + sizeof(rec), name, name_len);
+   if (extra)
+      memcpy(w->buffer + w->used + sizeof(rec) + name_len, extra, extra_len);
+   w->used += needed;
+   w->num_records++;
+}
+
+/**
+ * Move a staged file out of the location, which is cleaned at exit, into
+ * the persist directory.  Returns the path it now lives at.
+ **/
+static char *persist_local_file(ldcs_process_data_t *procdata, char *localpath, char *newpath)
+{
+   char *base;
+   int result, prefix_len;
+   size_t base_len;
+
+   if (is_persisted(localpath)) {
+      strncpy(newpath, localpath, MAX_PATH_LEN);
+      return newpath;
+   }
+
+   base = strrchr(localpath, '/');
+   base = base ? base + 1 : localpath;
+   base_len = strlen(base);
+
+   prefix_len = snprintf(newpath, MAX_PATH_LEN+1, "%s/s%x-", persist_dir, (unsigned int) procdata->number);
+   if (base_len > MAX_NAME_LEN - (prefix_len - strlen(persist_dir) - 1))
+      base += base_len - (MAX_NAME_LEN - (prefix_len - strlen(persist_dir) - 1));
+   snprintf(newpath + prefix_len, MAX_PATH_LEN+1 - prefix_len, "%s", base);
+
+   result = rename(localpath, newpath);
+   if (result == -1) {
+      debug_printf2("Could not move %s to %s for the cache index: %s\n", localpath, newpath, strerror(errno));
+      return NULL;
+   }
+   return newpath;
+}
+
+static void save_entry_cb(char *filename, unsigned char d_type, char *localpath, size_t size, void *arg)
+{
+   index_writer_t *w = (index_writer_t *) arg;
+   char globalpath[MAX_PATH_LEN+1], newpath[MAX_PATH_LEN+1];
+   struct stat st;
+
+   add_record(w, rec_name, filename, NULL, NULL, d_type, 0);
+   if (!localpath)
+      return;
+
+   snprintf(globalpath, sizeof(globalpath), "%s/%s", w->cur_dir, filename);
+   if (lazy_find_file(globalpath)) {
+      /* Lazily staged files may be missing extents, and aren't kept */
+      return;
+   }
+   if (global_stat(globalpath, &st, 1) == -1)
+      return;
+   if (!persist_local_file(w->procdata, localpath, newpath))
+      return;
+   add_record(w, rec_file, filename, newpath, &st, d_type, size);
+}
+
+static void save_dir_cb(char *dirname, int exists, void *arg)
+{
+   index_writer_t *w = (index_writer_t *) arg;
+   struct stat st;
+
+   if (!exists) {
+      add_record(w, rec_nodir, dirname, NULL, NULL, 0, 0);
+      return;
+   }
+   if (ldcs_cache_isSparseDir(dirname))
+      return;
+   if (global_stat(dirname, &st, 1) == -1 || !S_ISDIR(st.st_mode))
+      return;
+
+   add_record(w, rec_dir, dirname, NULL, &st, 0, 0);
+   w->cur_dir = dirname;
+   ldcs_cache_foreachEntryInDir(dirname, save_entry_cb, w);
+   w->cur_dir = NULL;
+}
+
+static void save_stat_cb(const char *pathname, char *data, void *arg)
+{
+   index_writer_t *w = (index_writer_t *) arg;
+   struct stat st;
+
+   /* ldso metadata isn't a stat result, and is cheap to recompute */
+   if (pathname[0] == '$')
+      return;
+
+   if (!data) {
+      add_record(w, rec_nostat, pathname, NULL, NULL, 0, 0);
+      return;
+   }
+   if (filemngt_read_stat(data, &st) == -1)
+      return;
+   add_record(w, rec_stat, pathname, NULL, &st, 0, 0);
+}
+
+static int write_index(index_writer_t *w)
+{
+   char path[MAX_PATH_LEN+1], tmppath[MAX_PATH_LEN+1];
+   index_header_t header;
+   size_t written = 0;
+   ssize_t result;
+   int fd;
+
+   memset(&header, 0, sizeof(header));
+   header.magic = INDEX_MAGIC;
+   header.version = INDEX_VERSION;
+   header.num_records = w->num_records;
+   header.body_size = w->used;
+   header.checksum = index_checksum((unsigned char *) w->buffer, w->used);
+
+   snprintf(path, sizeof(path), "%s/%s", persist_dir, INDEX_FILE_NAME);
+   snprintf(tmppath, sizeof(tmppath), "%s/%s.tmp", persist_dir, INDEX_FILE_NAME);
+   fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1) {
+      err_printf("Could not create cache index %s: %s\n", tmppath, strerror(errno));
+      return -1;
+   }
+
+   result = write(fd, &header, sizeof(header));
+   if (result != sizeof(header))
+      goto error;
+   while (written < w->used) {
+      result = write(fd, w->buffer + written, w->used - written);
+      if (result == -1 && (errno == EINTR || errno == EAGAIN))
+         continue;
+      if (result <= 0)
+         goto error;
+      written += result;
+   }
+   close(fd);
+
+   if (rename(tmppath, path) == -1) {
+      err_printf("Could not rename cache index %s to %s: %s\n", tmppath, path, strerror(errno));
+      unlink(tmppath);
+      return -1;
+   }
+   return 0;
+
+  error:
+   err_printf("Could not write cache index %s: %s\n", tmppath, strerror(errno));
+   close(fd);
+   unlink(tmppath);
+   return -1;
+}
+
+int cacheindex_save(ldcs_process_data_t *procdata)
+{
+   index_writer_t w;
+   double starttime = ldcs_get_time();
+   int result;
+
+   if (!persist_dir) {
+      debug_printf("No cache index directory, not saving the cache index\n");
+      return -1;
+   }
+
+   memset(&w, 0, sizeof(w));
+   w.procdata = procdata;
+   ldcs_cache_foreachDir(save_dir_cb, &w);
+   foreach_stat_cache(save_stat_cb, &w);
+
+   result = write_index(&w);
+   debug_printf("Saved cache index with %u records (%lu bytes) to %s in %fs\n", w.num_records,
+                (unsigned long) w.used, persist_dir, ldcs_get_time() - starttime);
+   free(w.buffer);
+   return result;
+}
+
+/**
+ * Map a staged file from the persist directory back into the cache.
+ **/
+static int load_staged_file(char *dirname, char *filename, char *localpath, size_t size)
+{
+   char globalpath[MAX_PATH_LEN+1], *lpath, *localdup;
+   struct stat st;
+   void *buffer;
+   int fd, errcode;
+
+   /* Touching a mapping past the end of the file is a SIGBUS, so an empty or
+      shortened file is staged again instead */
+   if (!size)
+      return -1;
+   if (ldcs_cache_findFileDirInCache(filename, dirname, &lpath, &errcode) != LDCS_CACHE_FILE_FOUND)
+      return -1;
+
+   fd = open(localpath, O_RDONLY | O_NOFOLLOW);
+   if (fd == -1)
+      return -1;
+   if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (size_t) st.st_size < size) {
+      close(fd);
+      return -1;
+   }
+   buffer = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (buffer == MAP_FAILED)
+      return -1;
+
+   localdup = strdup(localpath);
+   snprintf(globalpath, sizeof(globalpath), "%s/%s", dirname, filename);
+   ldcs_cache_updateEntry(filename, dirname, localdup, buffer, size, 0);
+   add_global_name(globalpath, localdup);
+   return 0;
+}
+
+/**
+ * Remove staged files left in the persist directory that the loaded
+ * index doesn't reference.
+ **/
+static void sweep_persist_dir()
+{
+   DIR *dir;
+   struct dirent *dp;
+   char path[MAX_PATH_LEN+1];
+
+   dir = opendir(persist_dir);
+   if (!dir)
+      return;
+   while ((dp = readdir(dir))) {
+      if (dp->d_type != DT_REG && dp->d_type != DT_UNKNOWN)
+         continue;
+      if (strcmp(dp->d_name, INDEX_FILE_NAME) == 0 || strcmp(dp->d_name, INDEX_LOCK_NAME) == 0)
+         continue;
+      if (strncmp(dp->d_name, LDSO_CACHE_PREFIX, strlen(LDSO_CACHE_PREFIX)) == 0)
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", persist_dir, dp->d_name);
+      if (lookup_global_name(path) == NULL) {
+         debug_printf3("Removing unreferenced staged file %s\n", path);
+         unlink(path);
+      }
+   }
+   closedir(dir);
+}
+
+static int record_ok(index_record_t *rec, char *body, size_t pos, size_t body_size)
+{
+   char *name = body + pos + sizeof(*rec);
+   if (pos + sizeof(*rec) + rec->name_len + rec->extra_len > body_size)
+      return 0;
+   if (rec->name_len == 0 || name[rec->name_len-1] != '\0')
+      return 0;
+   if (rec->extra_len && name[rec->name_len + rec->extra_len - 1] != '\0')
+      return 0;
+   return 1;
+}
+
+int cacheindex_load(ldcs_process_data_t *procdata)
+{
+   char path[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1], *localname;
+   char *mem, *body, *name, *extra, *statpath;
+   index_header_t *header;
+   index_record_t rec;
+   struct stat st, filest;
+   size_t pos;
+   int fd, result, dir_valid = 0;
+   unsigned int loaded = 0, dropped = 0;
+   double starttime = ldcs_get_time();
+
+   if (setup_persist_dir(procdata) == -1)
+      return -1;
+
+   snprintf(path, sizeof(path), "%s/%s", persist_dir, INDEX_FILE_NAME);
+   fd = open(path, O_RDONLY);
+   if (fd == -1) {
+      debug_printf("No cache index at %s, starting cold\n", path);
+      sweep_persist_dir();
+      return 0;
+   }
+   result = fstat(fd, &st);
+   if (result == -1 || st.st_size < sizeof(index_header_t)) {
+      close(fd);
+      goto bad_index;
+   }
+   mem = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (mem == MAP_FAILED)
+      goto bad_index;
+
+   header = (index_header_t *) mem;
+   body = mem + sizeof(index_header_t);
+   if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION ||
+       header->body_size != st.st_size - sizeof(index_header_t) ||
+       header->checksum != index_checksum((unsigned char *) body, header->body_size)) {
+      munmap(mem, st.st_size);
+      goto bad_index;
+   }
+
+   dirname[0] = '\0';
+   for (pos = 0; pos + sizeof(rec) <= header->body_size; pos += REC_ALIGN(sizeof(rec) + rec.name_len + rec.extra_len)) {
+      memcpy(&rec, body + pos, sizeof(rec));
+      if (!record_ok(&rec, body, pos, header->body_size)) {
+         err_printf("Truncated record in cache index %s\n", path);
+         break;
+      }
+      name = body + pos + sizeof(rec);
+      extra = rec.extra_len ? name + rec.name_len : NULL;
+
+      switch ((index_rectype_t) rec.type) {
+         case rec_dir:
+            if (dir_valid)
+               ldcs_cache_finishDirectory(dirname);
+            dir_valid = (rec.name_len <= sizeof(dirname) &&
+                         ldcs_cache_findDirInCache(name) == LDCS_CACHE_DIR_NOT_PARSED &&
+                         global_stat(name, &filest, 1) == 0 && S_ISDIR(filest.st_mode) &&
+                         same_file(&rec, &filest, 0));
+            if (dir_valid) {
+               strcpy(dirname, name);
+               ldcs_cache_addFileDir(dirname, dirname);
+               loaded++;
+            }
+            else
+               dropped++;
+            break;
+         case rec_nodir:
+            if (ldcs_cache_findDirInCache(name) == LDCS_CACHE_DIR_NOT_PARSED &&
+                global_stat(name, &filest, 1) == -1 && errno == ENOENT) {
+               addEmptyDirectory(name);
+               loaded++;
+            }
+            else
+               dropped++;
+            break;
+         case rec_name:
+            if (dir_valid)
+               ldcs_cache_addFileDirType(dirname, name, (unsigned char) rec.d_type);
+            break;
+         case rec_file: {
+            char globalpath[MAX_PATH_LEN+1];
+            int file_valid = 0;
+            if (!extra || !is_persisted(extra))
+               break;
+            if (dir_valid) {
+               snprintf(globalpath, sizeof(globalpath), "%s/%s", dirname, name);
+               file_valid = (global_stat(globalpath, &filest, 1) == 0 && same_file(&rec, &filest, 1) &&
+                             load_staged_file(dirname, name, extra, rec.local_size) == 0);
+            }
+            if (file_valid)
+               loaded++;
+            else {
+               unlink(extra);
+               dropped++;
+            }
+            break;
+         }
+         case rec_stat:
+            statpath = (name[0] == '*') ? name + 1 : name;
+            result = global_stat(statpath, &filest, name[0] == '*');
+            if (result == 0 && same_file(&rec, &filest, 1) && lookup_stat_cache(name, &localname) == -1) {
+               handle_cache_metadata(procdata, name, 1, &filest, &localname);
+               loaded++;
+            }
+            else
+               dropped++;
+            break;
+         case rec_nostat:
+            statpath = (name[0] == '*') ? name + 1 : name;
+            result = global_stat(statpath, &filest, name[0] == '*');
+            if (result == -1 && errno == ENOENT && lookup_stat_cache(name, &localname) == -1) {
+               handle_cache_metadata(procdata, name, 0, NULL, &localname);
+               loaded++;
+            }
+            else
+               dropped++;
+            break;
+         default:
+            err_printf("Unknown record type %d in cache index %s\n", (int) rec.type, path);
+            dropped++;
+            break;
+      }
+   }
+   if (dir_valid)
+      ldcs_cache_finishDirectory(dirname);
+   munmap(mem, st.st_size);
+   sweep_persist_dir();
+
+   procdata->server_stat.cacheindex.cnt += loaded;
+   procdata->server_stat.cacheindex.bytes += st.st_size;
+   procdata->server_stat.cacheindex.time += ldcs_get_time() - starttime;
+   debug_printf("Loaded cache index %s: %u entries still valid, %u dropped, in %fs\n", path,
+                loaded, dropped, ldcs_get_time() - starttime);
+   return 0;
+
+  bad_index:
+   err_printf("Cache index %s is damaged, starting cold\n", path);
+   unlink(path);
+   sweep_persist_dir();
+   return 0;
+}
@@ -0,0 +1,35 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_INDEX_H_)
+#define LDCS_AUDIT_SERVER_INDEX_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * The cache index lets a server start with the cache a previous server
+ * on this node left behind.  Staged files and the index itself are kept
+ * in a spindle.persist.<uid> directory next to the server's location.
+ **/
+
+/* Load and revalidate the index left by a previous server, if any */
+int cacheindex_load(ldcs_process_data_t *procdata);
+
+/* Write the current cache to the index and keep its staged files */
+int cacheindex_save(ldcs_process_data_t *procdata);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+#include "ldcs_audit_server_jitcache.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * Files are kept by their interned pathnames, so a bucket is searched by
+ * comparing pointers.  Entries are never freed; a file dropped by its
+ * producer goes back to jit_unknown.
+ **/
+
+#define JITCACHE_TABLE_SIZE 1024
+#define JITCACHE_DEFAULT_WAIT 120.0
+
+typedef struct jitfile_t {
+   const char *pathname;
+   jit_state_t state;
+   int producer;
+   struct jitfile_t *next;
+} jitfile_t;
+
+static jitfile_t *jitcache_table[JITCACHE_TABLE_SIZE];
+static int timer_fd = -1;
+
+static jitfile_t *find_jitfile(const char *pathname, int create)
+{
+   const char *name;
+   jitfile_t *jf;
+   unsigned int bucket;
+
+   name = create ? intern_name(pathname) : lookup_intern_name(pathname);
+   if (!name)
+      return NULL;
+   bucket = intern_name_hash(name) % JITCACHE_TABLE_SIZE;
+   for (jf = jitcache_table[bucket]; jf; jf = jf->next) {
+      if (jf->pathname == name)
+         return jf;
+   }
+   if (!create)
+      return NULL;
+
+   jf = (jitfile_t *) malloc(sizeof(jitfile_t));
+   if (!jf) {
+      err_printf("Could not allocate jit record for %s\n", pathname);
+      return NULL;
+   }
+   jf->pathname = name;
+   jf->state = jit_unknown;
+   jf->producer = -1;
+   jf->next = jitcache_table[bucket];
+   jitcache_table[bucket] = jf;
+   return jf;
+}
+
+jit_state_t jitcache_state(const char *pathname, int *producer)
+{
+   jitfile_t *jf;
+
+   jf = find_jitfile(pathname, 0);
+   if (!jf)
+      return jit_unknown;
+   if (producer)
+      *producer = jf->producer;
+   return jf->state;
+}
+
+void jitcache_set_state(const char *pathname, jit_state_t state, int producer)
+{
+   jitfile_t *jf;
+
+   jf = find_jitfile(pathname, 1);
+   if (!jf)
+      return;
+   debug_printf3("jit file %s goes from state %d to %d, producer %d\n", pathname, (int) jf->state,
+                 (int) state, producer);
+   jf->state = state;
+   jf->producer = (state == jit_producing) ? producer : -1;
+}
+
+int jitcache_drop_producer(int connid)
+{
+   jitfile_t *jf;
+   int i, count = 0;
+
+   for (i = 0; i < JITCACHE_TABLE_SIZE; i++) {
+      for (jf = jitcache_table[i]; jf; jf = jf->next) {
+         if (jf->state != jit_producing || jf->producer != connid)
+            continue;
+         debug_printf2("Writer of jit file %s went away without publishing it\n", jf->pathname);
+         jf->state = jit_unknown;
+         jf->producer = -1;
+         count++;
+      }
+   }
+   return count;
+}
+
+double jitcache_wait_limit()
+{
+   static double limit = -1.0;
+
+   if (limit >= 0.0)
+      return limit;
+   limit = JITCACHE_DEFAULT_WAIT;
+   if (getenv("SPINDLE_JIT_WAIT_SEC")) {
+      if (atof(getenv("SPINDLE_JIT_WAIT_SEC")) > 0.0)
+         limit = atof(getenv("SPINDLE_JIT_WAIT_SEC"));
+      else
+         err_printf("Ignoring SPINDLE_JIT_WAIT_SEC=%s\n", getenv("SPINDLE_JIT_WAIT_SEC"));
+   }
+   return limit;
+}
+
+int jitcache_start_timer(ldcs_process_data_t *procdata, int (*cb)(int fd, int id, void *data))
+{
+   struct itimerspec spec;
+
+   if (timer_fd != -1)
+      return 0;
+   timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (timer_fd == -1) {
+      err_printf("Could not create jit wait timer: %s\n", strerror(errno));
+      return -1;
+   }
+   memset(&spec, 0, sizeof(spec));
+   spec.it_interval.tv_sec = 1;
+   spec.it_value.tv_sec = 1;
+   if (timerfd_settime(timer_fd, 0, &spec, NULL) == -1) {
+      err_printf("Could not start jit wait timer: %s\n", strerror(errno));
+      close(timer_fd);
+      timer_fd = -1;
+      return -1;
+   }
+   ldcs_listen_register_fd(timer_fd, timer_fd, cb, procdata);
+   return 0;
+}
+
+void jitcache_stop_timer()
+{
+   if (timer_fd == -1)
+      return;
+   ldcs_listen_unregister_fd(timer_fd);
+   close(timer_fd);
+   timer_fd = -1;
+}
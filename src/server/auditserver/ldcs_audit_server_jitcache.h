@@ -0,0 +1,54 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_JITCACHE_H_)
+#define LDCS_AUDIT_SERVER_JITCACHE_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * Files under a jit relocation rule are written by the job, and every
+ * process would write the same ones.  Claims on them are per node: the
+ * first of our clients to open a missing file for writing writes it, and
+ * the node's other clients wait until it's published, and its copy has come
+ * back down from the root, or until the writer goes away.  A waiter that
+ * has waited SPINDLE_JIT_WAIT_SEC seconds, 120 by default, gives up and
+ * writes the file itself.
+ **/
+
+typedef enum {
+   jit_unknown = 0,   /* Not asked about yet */
+   jit_on_disk,       /* There before anyone here wrote it, so it's read in place */
+   jit_producing,     /* One of our clients is writing it */
+   jit_published      /* Written and sent to the root, waiting for its copy */
+} jit_state_t;
+
+/* Returns pathname's state, with *producer set to the writer's connid
+   while it's jit_producing */
+jit_state_t jitcache_state(const char *pathname, int *producer);
+
+void jitcache_set_state(const char *pathname, jit_state_t state, int producer);
+
+/* Forget the files the client on connid was writing, returning how many */
+int jitcache_drop_producer(int connid);
+
+double jitcache_wait_limit();
+
+/* Call cb every second while clients are waiting */
+int jitcache_start_timer(ldcs_process_data_t *procdata, int (*cb)(int fd, int id, void *data));
+void jitcache_stop_timer();
+
+#endif
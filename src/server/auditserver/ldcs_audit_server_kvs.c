@@ -0,0 +1,194 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldcs_audit_server_kvs.h"
+#include "spindle_debug.h"
+
+#define KVS_TABLE_SIZE 4096
+
+typedef struct kvs_entry_t {
+   char *key;
+   char *value;
+   struct kvs_entry_t *next;
+} kvs_entry_t;
+
+static kvs_entry_t *kvs_table[KVS_TABLE_SIZE];
+
+static char *pending = NULL;
+static size_t pending_size = 0;
+static size_t pending_alloc = 0;
+
+static int fenced_local = 0;
+static int expected_local = 0;
+static int fenced_children = 0;
+
+static unsigned int kvs_hash(const char *key)
+{
+   unsigned int hash = 5381;
+   while (*key)
+      hash = hash * 33 + (unsigned char) *key++;
+   return hash % KVS_TABLE_SIZE;
+}
+
+static int pending_append(const char *data, size_t size)
+{
+   char *newpending;
+   size_t newalloc;
+
+   if (pending_size + size > pending_alloc) {
+      newalloc = pending_alloc ? pending_alloc : 4096;
+      while (newalloc < pending_size + size)
+         newalloc *= 2;
+      newpending = (char *) realloc(pending, newalloc);
+      if (!newpending) {
+         err_printf("Could not grow key-value buffer to %lu bytes\n", (unsigned long) newalloc);
+         return -1;
+      }
+      pending = newpending;
+      pending_alloc = newalloc;
+   }
+   memcpy(pending + pending_size, data, size);
+   pending_size += size;
+   return 0;
+}
+
+/* Check that data is a whole number of [key][value] pairs */
+static int kvs_check(char *data, size_t size)
+{
+   size_t pos = 0;
+   int strings = 0;
+   char *end;
+
+   while (pos < size) {
+      end = (char *) memchr(data + pos, '\0', size - pos);
+      if (!end)
+         return -1;
+      pos = (end - data) + 1;
+      strings++;
+   }
+   return (strings % 2) ? -1 : 0;
+}
+
+int kvs_put(const char *key, const char *value)
+{
+   debug_printf3("Holding key-value put of %s\n", key);
+   if (pending_append(key, strlen(key) + 1) == -1)
+      return -1;
+   return pending_append(value, strlen(value) + 1);
+}
+
+int kvs_merge(char *data, size_t size)
+{
+   if (kvs_check(data, size) == -1) {
+      err_printf("Got malformed key-value gather of %lu bytes\n", (unsigned long) size);
+      return -1;
+   }
+   return pending_append(data, size);
+}
+
+void kvs_take_pending(char **data, size_t *size)
+{
+   *data = pending;
+   *size = pending_size;
+   pending = NULL;
+   pending_size = pending_alloc = 0;
+}
+
+int kvs_apply(char *data, size_t size)
+{
+   kvs_entry_t *entry;
+   char *key, *value, *newvalue;
+   size_t pos = 0;
+   unsigned int bucket;
+
+   if (kvs_check(data, size) == -1) {
+      err_printf("Got malformed key-value table of %lu bytes\n", (unsigned long) size);
+      return -1;
+   }
+   while (pos < size) {
+      key = data + pos;
+      value = key + strlen(key) + 1;
+      pos = (value - data) + strlen(value) + 1;
+
+      bucket = kvs_hash(key);
+      for (entry = kvs_table[bucket]; entry; entry = entry->next) {
+         if (strcmp(entry->key, key) == 0)
+            break;
+      }
+      if (entry) {
+         newvalue = strdup(value);
+         if (!newvalue)
+            return -1;
+         free(entry->value);
+         entry->value = newvalue;
+         continue;
+      }
+      entry = (kvs_entry_t *) malloc(sizeof(kvs_entry_t));
+      if (!entry) {
+         err_printf("Could not allocate key-value entry for %s\n", key);
+         return -1;
+      }
+      entry->key = strdup(key);
+      entry->value = strdup(value);
+      if (!entry->key || !entry->value) {
+         free(entry->key);
+         free(entry->value);
+         free(entry);
+         return -1;
+      }
+      entry->next = kvs_table[bucket];
+      kvs_table[bucket] = entry;
+   }
+   return 0;
+}
+
+const char *kvs_get(const char *key)
+{
+   kvs_entry_t *entry;
+
+   for (entry = kvs_table[kvs_hash(key)]; entry; entry = entry->next) {
+      if (strcmp(entry->key, key) == 0)
+         return entry->value;
+   }
+   return NULL;
+}
+
+void kvs_fence_local(int local_procs)
+{
+   fenced_local++;
+   if (local_procs > expected_local)
+      expected_local = local_procs;
+}
+
+void kvs_fence_child()
+{
+   fenced_children++;
+}
+
+int kvs_fence_ready(int num_children)
+{
+   if (fenced_children < num_children || !fenced_local)
+      return 0;
+   return fenced_local >= expected_local;
+}
+
+void kvs_fence_reset()
+{
+   fenced_local = expected_local = fenced_children = 0;
+}
@@ -0,0 +1,63 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_KVS_H_)
+#define LDCS_AUDIT_SERVER_KVS_H_
+
+#include <stddef.h>
+
+/**
+ * A PMI-style key-value exchange over the server tree, for runtimes that
+ * want to do their startup address exchange while Spindle is still
+ * staging their libraries.  Clients put entries, which their server holds
+ * until a fence.  Once every local process named in the fence and every
+ * child has fenced, a server sends what it and its subtree put up to its
+ * parent in one LDCS_MSG_KVS_GATHER.  The root sends the lot down to
+ * every server in a LDCS_MSG_KVS_TABLE, and each server then answers its
+ * fenced clients.  Gets are answered from the server's table, so the
+ * table is kept once per node rather than in every process.  As with
+ * PMI, a fence is collective: every node has to have at least one of the
+ * job's processes fence.
+ *
+ * Entries are packed as [key][value], each a string.
+ **/
+
+/* Hold a put from one of our clients until the next fence */
+int kvs_put(const char *key, const char *value);
+
+/* Hold the packed entries a child gathered from its subtree */
+int kvs_merge(char *data, size_t size);
+
+/* Hand over the entries held since the last fence, to be freed by the
+   caller.  *data is NULL if there are none */
+void kvs_take_pending(char **data, size_t *size);
+
+/* Add a fence's packed entries to the table.  Later puts of a key win */
+int kvs_apply(char *data, size_t size);
+
+/* The value put for key, or NULL */
+const char *kvs_get(const char *key);
+
+/* Count a local client's fence, which says local_procs processes on the
+   node take part, or a child's gather.  kvs_fence_ready is true once all
+   of them and all of our num_children children are in, and
+   kvs_fence_reset starts the count over for the next fence */
+void kvs_fence_local(int local_procs);
+void kvs_fence_child();
+int kvs_fence_ready(int num_children);
+void kvs_fence_reset();
+
+#endif
@@ -0,0 +1,314 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_latency.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * Bucket i < 8 holds i microseconds.  Above that, each power of two is
+ * split into eight buckets by the three bits below its top bit.
+ **/
+#define SUB_BITS 3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_OCTAVES 40
+#define NUM_BUCKETS (SUB_BUCKETS * NUM_OCTAVES)
+
+typedef struct {
+   uint64_t buckets[NUM_BUCKETS];
+   uint64_t total_usec;
+} histogram_t;
+
+static histogram_t ours[LATENCY_NUM];
+
+/* What each child server sent, its subtree's sums */
+typedef histogram_t histogram_set_t[LATENCY_NUM];
+static histogram_set_t *children = NULL;
+static int num_children = 0;
+
+static const char *names[LATENCY_NUM] = {
+   "client_query", "client_queue", "parent_wait", "disk_read",
+   "bcast_64k", "bcast_1m", "bcast_16m", "bcast_huge"
+};
+
+static FILE *trace_f = NULL;
+static int trace_rank;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define WAIT_TABLE_SIZE 4096
+
+typedef struct wait_entry_t {
+   const char *pathname;
+   char type;
+   double start;
+   struct wait_entry_t *next;
+} wait_entry_t;
+
+static wait_entry_t *wait_table[WAIT_TABLE_SIZE];
+
+static int bucket_of(uint64_t usec)
+{
+   int top, idx;
+   if (usec < SUB_BUCKETS)
+      return (int) usec;
+   top = 63 - __builtin_clzll(usec);
+   idx = (top - SUB_BITS + 1) * SUB_BUCKETS + (int) ((usec >> (top - SUB_BITS)) & (SUB_BUCKETS - 1));
+   return idx < NUM_BUCKETS ? idx : NUM_BUCKETS - 1;
+}
+
+/* Highest value that lands in bucket idx */
+static uint64_t bucket_top(int idx)
+{
+   int top;
+   if (idx < SUB_BUCKETS)
+      return idx;
+   top = idx / SUB_BUCKETS + SUB_BITS - 1;
+   return (((uint64_t) (SUB_BUCKETS + idx % SUB_BUCKETS + 1)) << (top - SUB_BITS)) - 1;
+}
+
+/* djb2, like the interned names, but safe to take off the main thread */
+static unsigned int path_id(const char *path)
+{
+   unsigned int hash = 5381;
+   while (*path)
+      hash = hash * 33 + (unsigned char) *path++;
+   return hash;
+}
+
+void latency_init(int rank, const char *hostname)
+{
+   char filename[MAX_PATH_LEN+1];
+   char *dir = getenv("SPINDLE_TRACE_DIR");
+
+   if (!dir || !*dir)
+      return;
+   snprintf(filename, sizeof(filename), "%s/spindle_trace.%d.json", dir, rank);
+   trace_f = fopen(filename, "w");
+   if (!trace_f) {
+      err_printf("Could not create trace file %s: %s\n", filename, strerror(errno));
+      return;
+   }
+   trace_rank = rank;
+   fprintf(trace_f, "[\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+           "\"args\": {\"name\": \"spindle server %d (%s)\"}}",
+           rank, rank, hostname ? hostname : "");
+   debug_printf("Writing trace spans to %s\n", filename);
+}
+
+void latency_finish()
+{
+   pthread_mutex_lock(&trace_lock);
+   if (trace_f) {
+      fprintf(trace_f, "\n]\n");
+      fclose(trace_f);
+      trace_f = NULL;
+   }
+   pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_span(latency_id_t id, double start, double end, const char *path)
+{
+   pthread_mutex_lock(&trace_lock);
+   if (!trace_f) {
+      pthread_mutex_unlock(&trace_lock);
+      return;
+   }
+   fprintf(trace_f, ",\n{\"name\": \"%s\", \"cat\": \"spindle\", \"ph\": \"X\", \"ts\": %.0f, "
+           "\"dur\": %.0f, \"pid\": %d, \"tid\": %lu",
+           names[id], start * 1000000.0, (end - start) * 1000000.0, trace_rank,
+           (unsigned long) pthread_self() % 100000);
+   if (path)
+      fprintf(trace_f, ", \"args\": {\"id\": \"%08x\", \"path\": \"%s\"}", path_id(path), path);
+   fprintf(trace_f, "}");
+   pthread_mutex_unlock(&trace_lock);
+}
+
+void latency_record(latency_id_t id, double start, const char *path)
+{
+   double end = ldcs_get_time();
+   uint64_t usec = end > start ? (uint64_t) ((end - start) * 1000000.0) : 0;
+
+   __sync_fetch_and_add(&ours[id].buckets[bucket_of(usec)], 1);
+   __sync_fetch_and_add(&ours[id].total_usec, usec);
+   if (trace_f)
+      trace_span(id, start, end, path);
+}
+
+latency_id_t latency_bcast_id(size_t size)
+{
+   if (size < 64 * 1024)
+      return LATENCY_BCAST_64K;
+   if (size < 1024 * 1024)
+      return LATENCY_BCAST_1M;
+   if (size < 16 * 1024 * 1024)
+      return LATENCY_BCAST_16M;
+   return LATENCY_BCAST_HUGE;
+}
+
+/**
+ * Waits are only begun and ended on the main thread.  A request that's
+ * sent again while one is outstanding keeps its first start.
+ **/
+void latency_wait_begin(char type, const char *path)
+{
+   const char *name = intern_name(path);
+   unsigned int bucket = intern_name_hash(name) % WAIT_TABLE_SIZE;
+   wait_entry_t *w;
+
+   for (w = wait_table[bucket]; w; w = w->next) {
+      if (w->pathname == name && w->type == type)
+         return;
+   }
+   w = (wait_entry_t *) malloc(sizeof(wait_entry_t));
+   w->pathname = name;
+   w->type = type;
+   w->start = ldcs_get_time();
+   w->next = wait_table[bucket];
+   wait_table[bucket] = w;
+}
+
+void latency_wait_end(char type, const char *path)
+{
+   const char *name = lookup_intern_name(path);
+   wait_entry_t **w, *found;
+
+   if (!name)
+      return;
+   for (w = wait_table + intern_name_hash(name) % WAIT_TABLE_SIZE; *w; w = &(*w)->next) {
+      if ((*w)->pathname == name && (*w)->type == type)
+         break;
+   }
+   if (!*w)
+      return;
+   found = *w;
+   *w = found->next;
+   latency_record(LATENCY_PARENT_WAIT, found->start, name);
+   free(found);
+}
+
+const char *latency_name(latency_id_t id)
+{
+   return names[id];
+}
+
+static double percentile(uint64_t *buckets, uint64_t count, double p)
+{
+   uint64_t seen = 0, target = (uint64_t) (p * count + 0.5);
+   int i;
+
+   if (target < 1)
+      target = 1;
+   for (i = 0; i < NUM_BUCKETS; i++) {
+      seen += buckets[i];
+      if (seen >= target)
+         return bucket_top(i) / 1000000.0;
+   }
+   return bucket_top(NUM_BUCKETS - 1) / 1000000.0;
+}
+
+/* Our histogram id, plus our children's if tree is set */
+static void histogram_sum(latency_id_t id, int tree, histogram_t *sum)
+{
+   int i, j;
+
+   *sum = ours[id];
+   for (i = 0; tree && i < num_children; i++) {
+      for (j = 0; j < NUM_BUCKETS; j++)
+         sum->buckets[j] += children[i][id].buckets[j];
+      sum->total_usec += children[i][id].total_usec;
+   }
+}
+
+void latency_summary(latency_id_t id, int tree, latency_summary_t *summary)
+{
+   histogram_t sum;
+   uint64_t *buckets = sum.buckets;
+   int i;
+
+   memset(summary, 0, sizeof(*summary));
+   histogram_sum(id, tree, &sum);
+   for (i = 0; i < NUM_BUCKETS; i++) {
+      summary->count += buckets[i];
+      if (buckets[i])
+         summary->max = bucket_top(i) / 1000000.0;
+   }
+   if (!summary->count)
+      return;
+   summary->mean = sum.total_usec / 1000000.0 / summary->count;
+   summary->p50 = percentile(buckets, summary->count, 0.50);
+   summary->p90 = percentile(buckets, summary->count, 0.90);
+   summary->p99 = percentile(buckets, summary->count, 0.99);
+}
+
+void latency_print(int rank)
+{
+   latency_summary_t s;
+   int i;
+
+   for (i = 0; i < LATENCY_NUM; i++) {
+      latency_summary((latency_id_t) i, 0, &s);
+      if (!s.count)
+         continue;
+      debug_printf("SERVER[%02d] LATENCY: %-12s, #cnt=%7lu, mean=%8.4f p50=%8.4f p90=%8.4f p99=%8.4f max=%8.4f sec\n",
+                   rank, names[i], (unsigned long) s.count, s.mean, s.p50, s.p90, s.p99, s.max);
+   }
+}
+
+size_t latency_pack_size()
+{
+   return sizeof(histogram_set_t);
+}
+
+void latency_pack(char *data)
+{
+   histogram_t sum;
+   int i;
+
+   for (i = 0; i < LATENCY_NUM; i++) {
+      histogram_sum((latency_id_t) i, 1, &sum);
+      memcpy(data + i * sizeof(histogram_t), &sum, sizeof(histogram_t));
+   }
+}
+
+/**
+ * A child that cancels its exit ready sends its histograms again, so
+ * they replace what it sent before.
+ **/
+int latency_merge(int child, int fan_out, char *data, size_t size)
+{
+   if (size != sizeof(histogram_set_t)) {
+      err_printf("Latency histograms from child are %lu bytes, not %lu\n",
+                 (unsigned long) size, (unsigned long) sizeof(histogram_set_t));
+      return -1;
+   }
+   if (child < 0 || child >= fan_out) {
+      err_printf("Latency histograms from unknown child %d\n", child);
+      return -1;
+   }
+   if (!children) {
+      num_children = fan_out;
+      children = (histogram_set_t *) calloc(num_children, sizeof(histogram_set_t));
+   }
+   memcpy(children[child], data, size);
+   return 0;
+}
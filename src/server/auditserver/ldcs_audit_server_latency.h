@@ -0,0 +1,87 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_LATENCY_H_)
+#define LDCS_AUDIT_SERVER_LATENCY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The server_stat counters only sum times, which can't tell ten slow
+ * requests from ten thousand medium ones.  Each server also keeps a
+ * latency histogram for each of the below, with buckets eight to a power
+ * of two of microseconds, so any percentile is within an eighth of the
+ * true value.  Histograms are updated atomically, as reads finish on the
+ * read pool's threads and client threads answer queries.
+ *
+ * With SPINDLE_TRACE_DIR set, each server also writes every span it times
+ * to DIR/spindle_trace.RANK.json in Chrome's trace event format, which
+ * Perfetto and chrome://tracing load.  A server is a process in the trace.
+ * Spans for a file carry its path and an id hashed from the path, so one
+ * library's trip down the tree can be picked out across servers.
+ **/
+
+typedef enum {
+   LATENCY_CLIENT_QUERY,   /* client query arriving until we answer it */
+   LATENCY_CLIENT_QUEUE,   /* client message waiting its turn (OPT_FAIRCLIENTS) */
+   LATENCY_PARENT_WAIT,    /* request sent to our parent until its answer arrives */
+   LATENCY_DISK_READ,      /* reading a file from the shared file system */
+   LATENCY_BCAST_64K,      /* sending a file's contents on, by size */
+   LATENCY_BCAST_1M,
+   LATENCY_BCAST_16M,
+   LATENCY_BCAST_HUGE,
+   LATENCY_NUM
+} latency_id_t;
+
+typedef struct {
+   uint64_t count;
+   double mean, p50, p90, p99, max;   /* seconds */
+} latency_summary_t;
+
+/* Open the trace file, if SPINDLE_TRACE_DIR asks for one */
+void latency_init(int rank, const char *hostname);
+
+/* Close the trace file */
+void latency_finish();
+
+/* Record something that started at start and finished now, concerning path if not NULL */
+void latency_record(latency_id_t id, double start, const char *path);
+
+/* The broadcast histogram for a file of size bytes */
+latency_id_t latency_bcast_id(size_t size);
+
+/* Note a request for path sent to our parent, and take its answer's arrival */
+void latency_wait_begin(char type, const char *path);
+void latency_wait_end(char type, const char *path);
+
+const char *latency_name(latency_id_t id);
+
+/* Summarize a histogram, with the histograms merged from child servers if tree is set */
+void latency_summary(latency_id_t id, int tree, latency_summary_t *summary);
+
+/* Write our histograms summaries to the debug log */
+void latency_print(int rank);
+
+/* Size of packed histograms, and pack ours and our children's into data */
+size_t latency_pack_size();
+void latency_pack(char *data);
+
+/* Take the histograms our child'th of fan_out children packed */
+int latency_merge(int child, int fan_out, char *data, size_t size);
+
+#endif
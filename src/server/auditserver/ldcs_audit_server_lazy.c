@@ -0,0 +1,534 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <elf.h>
+#include <sys/timerfd.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+#include "ldcs_audit_server_lazy.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "name_intern.h"
+
+/**
+ * There are only ever a handful of files big enough to be staged lazily,
+ * so they're kept on a list.  Each extent has a byte saying whether it is
+ * staged and another saying whether we've asked our parent for it.
+ **/
+
+typedef struct lazy_waiter_t {
+   node_peer_t peer;
+   size_t first;
+   size_t last;
+   struct lazy_waiter_t *next;
+} lazy_waiter_t;
+
+struct lazy_file_t {
+   const char *pathname;
+   char *localname;
+   size_t size;
+   size_t num_extents;
+   int is_source;
+   int fd;
+   unsigned char *present;
+   unsigned char *requested;
+   lazy_waiter_t *waiters;
+   int pushing;
+   unsigned char *pushed;     /* with --hot-extents, on the source while pushing */
+   size_t *hot;
+   size_t num_hot, next_hot, next_rest;
+   struct lazy_file_t *next;
+};
+
+/* The hot extents of a file, from the last run's profile */
+typedef struct lazy_profile_t {
+   const char *pathname;
+   size_t *hot;
+   size_t num_hot;
+   struct lazy_profile_t *next;
+} lazy_profile_t;
+
+static lazy_file_t *lazy_files;
+static lazy_profile_t *profiles;
+static int push_timer_fd = -1;
+
+int lazy_is_candidate(char *pathname, size_t size)
+{
+   unsigned char ident[SELFMAG];
+   ssize_t result;
+   int fd;
+
+   if (size < LAZY_MIN_SIZE)
+      return 0;
+
+   /* Executables and libraries are read by the loader, which we can't
+      make fetch ranges on demand */
+   fd = open(pathname, O_RDONLY);
+   filemngt_count_fsop(FSOP_OPEN, 0);
+   if (fd == -1)
+      return 0;
+   do {
+      result = pread(fd, ident, sizeof(ident), 0);
+   } while (result == -1 && errno == EINTR);
+   close(fd);
+   filemngt_count_fsop(FSOP_READ, result > 0 ? result : 0);
+   if (result != (ssize_t) sizeof(ident))
+      return 0;
+   return memcmp(ident, ELFMAG, SELFMAG) != 0;
+}
+
+static lazy_file_t *new_lazy_file(char *pathname, char *localname, size_t size, int is_source, int present)
+{
+   lazy_file_t *lf;
+
+   lf = (lazy_file_t *) calloc(1, sizeof(*lf));
+   if (!lf) {
+      err_printf("Could not allocate lazy file entry for %s\n", pathname);
+      return NULL;
+   }
+   lf->pathname = intern_name(pathname);
+   lf->localname = localname;
+   lf->size = size;
+   lf->num_extents = (size + LAZY_EXTENT_SIZE - 1) / LAZY_EXTENT_SIZE;
+   lf->is_source = is_source;
+   lf->present = (unsigned char *) malloc(lf->num_extents ? lf->num_extents : 1);
+   lf->requested = (unsigned char *) calloc(lf->num_extents ? lf->num_extents : 1, 1);
+   if (!lf->present || !lf->requested) {
+      err_printf("Could not allocate extent maps for %s\n", pathname);
+      free(lf->present);
+      free(lf->requested);
+      free(lf);
+      return NULL;
+   }
+   memset(lf->present, present, lf->num_extents ? lf->num_extents : 1);
+
+   lf->fd = open(localname, O_RDWR);
+   if (lf->fd == -1) {
+      err_printf("Could not open local file %s for %s: %s\n", localname, pathname, strerror(errno));
+      free(lf->present);
+      free(lf->requested);
+      free(lf);
+      return NULL;
+   }
+
+   lf->next = lazy_files;
+   lazy_files = lf;
+   return lf;
+}
+
+lazy_file_t *lazy_add_file(char *pathname, char *localname, size_t size, int is_source)
+{
+   if (filemngt_create_sparse_file(localname, size) == -1)
+      return NULL;
+   debug_printf2("Staged %s lazily as %lu byte sparse file %s\n", pathname, (unsigned long) size, localname);
+   return new_lazy_file(pathname, localname, size, is_source, 0);
+}
+
+lazy_file_t *lazy_add_complete_file(char *pathname, char *localname, size_t size)
+{
+   return new_lazy_file(pathname, localname, size, 0, 1);
+}
+
+lazy_file_t *lazy_find_file(char *pathname)
+{
+   lazy_file_t *lf;
+   for (lf = lazy_files; lf; lf = lf->next) {
+      if (strcmp(lf->pathname, pathname) == 0)
+         return lf;
+   }
+   return NULL;
+}
+
+lazy_file_t *lazy_find_local(char *localname)
+{
+   lazy_file_t *lf;
+   for (lf = lazy_files; lf; lf = lf->next) {
+      if (strcmp(lf->localname, localname) == 0)
+         return lf;
+   }
+   return NULL;
+}
+
+char *lazy_file_name(lazy_file_t *lf)
+{
+   return (char *) lf->pathname;
+}
+
+size_t lazy_file_size(lazy_file_t *lf)
+{
+   return lf->size;
+}
+
+int lazy_is_source(lazy_file_t *lf)
+{
+   return lf->is_source;
+}
+
+int lazy_range_extents(lazy_file_t *lf, size_t offset, size_t len, size_t *first, size_t *last)
+{
+   if (!len || offset >= lf->size)
+      return 0;
+   if (len > lf->size - offset)
+      len = lf->size - offset;
+   *first = offset / LAZY_EXTENT_SIZE;
+   *last = (offset + len - 1) / LAZY_EXTENT_SIZE;
+   return 1;
+}
+
+void lazy_extent_bytes(lazy_file_t *lf, size_t first, size_t last, size_t *offset, size_t *len)
+{
+   size_t end = (last + 1) * LAZY_EXTENT_SIZE;
+   if (end > lf->size)
+      end = lf->size;
+   *offset = first * LAZY_EXTENT_SIZE;
+   *len = end - *offset;
+}
+
+int lazy_range_present(lazy_file_t *lf, size_t first, size_t last)
+{
+   size_t i;
+   if (last >= lf->num_extents)
+      return 0;
+   for (i = first; i <= last; i++) {
+      if (!lf->present[i])
+         return 0;
+   }
+   return 1;
+}
+
+int lazy_is_complete(lazy_file_t *lf)
+{
+   return !lf->num_extents || lazy_range_present(lf, 0, lf->num_extents - 1);
+}
+
+int lazy_next_missing(lazy_file_t *lf, size_t first, size_t last, size_t *run_first, size_t *run_last)
+{
+   size_t i;
+
+   if (last >= lf->num_extents)
+      last = lf->num_extents - 1;
+   for (i = first; i <= last && (lf->present[i] || lf->requested[i]); i++);
+   if (i > last)
+      return 0;
+
+   *run_first = i;
+   for (; i <= last && i - *run_first < LAZY_MAX_RUN && !lf->present[i] && !lf->requested[i]; i++)
+      lf->requested[i] = 1;
+   *run_last = i - 1;
+   return 1;
+}
+
+static int write_all(int fd, char *data, size_t len, size_t offset)
+{
+   ssize_t result;
+   while (len) {
+      result = pwrite(fd, data, len, offset);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         return -1;
+      data += result;
+      len -= result;
+      offset += result;
+   }
+   return 0;
+}
+
+static int read_all(int fd, char *data, size_t len, size_t offset)
+{
+   ssize_t result;
+   while (len) {
+      result = pread(fd, data, len, offset);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         return -1;
+      data += result;
+      len -= result;
+      offset += result;
+   }
+   return 0;
+}
+
+static void mark_present(lazy_file_t *lf, size_t offset, size_t len)
+{
+   size_t first, last, i;
+   if (!lazy_range_extents(lf, offset, len, &first, &last))
+      return;
+   for (i = first; i <= last; i++) {
+      lf->present[i] = 1;
+      lf->requested[i] = 0;
+   }
+}
+
+int lazy_read_extents(lazy_file_t *lf, size_t first, size_t last, size_t *bytes_read)
+{
+   size_t offset, len;
+   char *buffer;
+   int fd, result;
+
+   assert(lf->is_source);
+   lazy_extent_bytes(lf, first, last, &offset, &len);
+   *bytes_read = 0;
+
+   fd = open(lf->pathname, O_RDONLY);
+   filemngt_count_fsop(FSOP_OPEN, 0);
+   if (fd == -1) {
+      err_printf("Could not open %s to read extents: %s\n", lf->pathname, strerror(errno));
+      return -1;
+   }
+   buffer = (char *) malloc(len);
+   if (!buffer) {
+      err_printf("Could not allocate %lu bytes for extents of %s\n", (unsigned long) len, lf->pathname);
+      close(fd);
+      return -1;
+   }
+
+   result = read_all(fd, buffer, len, offset);
+   filemngt_count_fsop(FSOP_READ, result == -1 ? 0 : len);
+   if (result == -1)
+      err_printf("Could not read %lu bytes at %lu of %s: %s\n", (unsigned long) len, (unsigned long) offset,
+                 lf->pathname, strerror(errno));
+   else
+      result = lazy_write_range(lf, offset, buffer, len);
+   if (result == 0)
+      *bytes_read = len;
+
+   free(buffer);
+   close(fd);
+   return result;
+}
+
+int lazy_write_range(lazy_file_t *lf, size_t offset, void *data, size_t len)
+{
+   if (offset > lf->size || len > lf->size - offset) {
+      err_printf("Extent at %lu of %s is past its end\n", (unsigned long) offset, lf->pathname);
+      return -1;
+   }
+   if (write_all(lf->fd, (char *) data, len, offset) == -1) {
+      err_printf("Could not write extent to %s: %s\n", lf->localname, strerror(errno));
+      return -1;
+   }
+   mark_present(lf, offset, len);
+   return 0;
+}
+
+int lazy_read_local(lazy_file_t *lf, size_t offset, void *data, size_t len)
+{
+   if (read_all(lf->fd, (char *) data, len, offset) == -1) {
+      err_printf("Could not read extent from %s: %s\n", lf->localname, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+void lazy_add_waiter(lazy_file_t *lf, node_peer_t peer, size_t first, size_t last)
+{
+   lazy_waiter_t *w;
+
+   w = (lazy_waiter_t *) malloc(sizeof(*w));
+   if (!w) {
+      err_printf("Could not allocate extent waiter for %s\n", lf->pathname);
+      return;
+   }
+   w->peer = peer;
+   w->first = first;
+   w->last = last;
+   w->next = lf->waiters;
+   lf->waiters = w;
+}
+
+int lazy_pop_ready_waiter(lazy_file_t *lf, node_peer_t *peer, size_t *first, size_t *last)
+{
+   lazy_waiter_t **w, *ready;
+
+   for (w = &lf->waiters; *w; w = &(*w)->next) {
+      if (!lazy_range_present(lf, (*w)->first, (*w)->last))
+         continue;
+      ready = *w;
+      *w = ready->next;
+      *peer = ready->peer;
+      *first = ready->first;
+      *last = ready->last;
+      free(ready);
+      return 1;
+   }
+   return 0;
+}
+
+/**
+ * A profile has a line per file: the number of hot extents, the extents
+ * in the order they were first read, and the file's path, each after a
+ * space.
+ **/
+int lazy_load_profile(const char *filename)
+{
+   FILE *f;
+   char *line = NULL, *pos, *end;
+   size_t line_size = 0, n, i;
+   ssize_t len;
+   lazy_profile_t *p;
+   int count = 0;
+
+   f = fopen(filename, "r");
+   if (!f) {
+      debug_printf("No hot extents to push, could not open %s: %s\n", filename, strerror(errno));
+      return -1;
+   }
+   while ((len = getline(&line, &line_size, f)) != -1) {
+      if (len && line[len-1] == '\n')
+         line[--len] = '\0';
+      n = strtoul(line, &pos, 10);
+      if (pos == line || !n)
+         continue;
+      p = (lazy_profile_t *) calloc(1, sizeof(*p));
+      if (p)
+         p->hot = (size_t *) malloc(n * sizeof(size_t));
+      if (!p || !p->hot) {
+         err_printf("Could not allocate %lu hot extents\n", (unsigned long) n);
+         free(p);
+         break;
+      }
+      for (i = 0; i < n; i++, pos = end) {
+         p->hot[i] = strtoul(pos, &end, 10);
+         if (end == pos)
+            break;
+      }
+      if (i < n || *pos != ' ' || !pos[1]) {
+         err_printf("Ignoring malformed line of hot extents profile %s\n", filename);
+         free(p->hot);
+         free(p);
+         continue;
+      }
+      p->pathname = intern_name(pos + 1);
+      p->num_hot = n;
+      p->next = profiles;
+      profiles = p;
+      count++;
+   }
+   free(line);
+   fclose(f);
+   debug_printf("Loaded hot extents of %d files from %s\n", count, filename);
+   return 0;
+}
+
+int lazy_start_push(lazy_file_t *lf)
+{
+   lazy_profile_t *p;
+
+   if (!lf->is_source || lf->pushing)
+      return 0;
+   for (p = profiles; p && p->pathname != lf->pathname; p = p->next);
+   if (!p)
+      return 0;
+   lf->pushed = (unsigned char *) calloc(lf->num_extents ? lf->num_extents : 1, 1);
+   if (!lf->pushed) {
+      err_printf("Could not allocate push map for %s\n", lf->pathname);
+      return 0;
+   }
+   lf->hot = p->hot;
+   lf->num_hot = p->num_hot;
+   lf->next_hot = lf->next_rest = 0;
+   lf->pushing = 1;
+   debug_printf2("Pushing %lu hot extents of %s, then the rest of it\n", (unsigned long) p->num_hot,
+                 lf->pathname);
+   return 1;
+}
+
+int lazy_next_push(lazy_file_t *lf, size_t *first, size_t *last)
+{
+   size_t e;
+
+   if (!lf->pushing)
+      return 0;
+
+   /* Hot extents that were read one after another go as one run */
+   while (lf->next_hot < lf->num_hot) {
+      e = lf->hot[lf->next_hot++];
+      if (e >= lf->num_extents || lf->pushed[e])
+         continue;
+      *first = *last = e;
+      lf->pushed[e] = 1;
+      while (lf->next_hot < lf->num_hot && *last - *first + 1 < LAZY_MAX_RUN &&
+             lf->hot[lf->next_hot] == *last + 1 && *last + 1 < lf->num_extents &&
+             !lf->pushed[*last + 1]) {
+         lf->pushed[++(*last)] = 1;
+         lf->next_hot++;
+      }
+      return 1;
+   }
+
+   for (; lf->next_rest < lf->num_extents; lf->next_rest++) {
+      if (lf->pushed[lf->next_rest])
+         continue;
+      *first = *last = lf->next_rest;
+      lf->pushed[lf->next_rest++] = 1;
+      return 1;
+   }
+
+   debug_printf2("Pushed all of %s\n", lf->pathname);
+   lf->pushing = 0;
+   free(lf->pushed);
+   lf->pushed = NULL;
+   return 0;
+}
+
+lazy_file_t *lazy_pushing_file()
+{
+   lazy_file_t *lf;
+   for (lf = lazy_files; lf && !lf->pushing; lf = lf->next);
+   return lf;
+}
+
+int lazy_start_push_timer(int (*cb)(int fd, int id, void *data), void *data)
+{
+   struct itimerspec spec;
+
+   if (push_timer_fd != -1)
+      return 0;
+   push_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (push_timer_fd == -1) {
+      err_printf("Could not create extent push timer: %s\n", strerror(errno));
+      return -1;
+   }
+   memset(&spec, 0, sizeof(spec));
+   spec.it_interval.tv_nsec = LAZY_PUSH_INTERVAL_MS * 1000000L;
+   spec.it_value.tv_nsec = LAZY_PUSH_INTERVAL_MS * 1000000L;
+   if (timerfd_settime(push_timer_fd, 0, &spec, NULL) == -1) {
+      err_printf("Could not start extent push timer: %s\n", strerror(errno));
+      close(push_timer_fd);
+      push_timer_fd = -1;
+      return -1;
+   }
+   ldcs_listen_register_fd(push_timer_fd, push_timer_fd, cb, data);
+   return 0;
+}
+
+void lazy_stop_push_timer()
+{
+   if (push_timer_fd == -1)
+      return;
+   ldcs_listen_unregister_fd(push_timer_fd);
+   close(push_timer_fd);
+   push_timer_fd = -1;
+}
@@ -0,0 +1,113 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_LAZY_H_)
+#define LDCS_AUDIT_SERVER_LAZY_H_
+
+#include <sys/types.h>
+
+#include "ldcs_audit_server_md.h"
+
+/**
+ * Tracks big data files that are staged lazily.  Rather than shipping the
+ * whole file, each server stages a sparse local file of the right size and
+ * fills in fixed-size extents as clients touch them.  The server that read
+ * the file's size off disk (the source) reads extents off disk; the others
+ * ask their parent, which passes back just the extents that were asked for.
+ **/
+
+#define LAZY_MIN_SIZE (64*1024*1024)
+#define LAZY_EXTENT_SIZE (4*1024*1024)
+#define LAZY_MAX_RUN 8     /* Most extents sent in one message */
+
+typedef struct lazy_file_t lazy_file_t;
+
+/* Return true if pathname, which is size bytes, should be staged lazily */
+int lazy_is_candidate(char *pathname, size_t size);
+
+/* Create a sparse local file for pathname and start tracking it */
+lazy_file_t *lazy_add_file(char *pathname, char *localname, size_t size, int is_source);
+
+/* Track a file that is already fully staged at localname */
+lazy_file_t *lazy_add_complete_file(char *pathname, char *localname, size_t size);
+
+/* Look up a lazily staged file by global or local name.  NULL if it isn't one. */
+lazy_file_t *lazy_find_file(char *pathname);
+lazy_file_t *lazy_find_local(char *localname);
+
+char *lazy_file_name(lazy_file_t *lf);
+size_t lazy_file_size(lazy_file_t *lf);
+int lazy_is_source(lazy_file_t *lf);
+
+/* Translate a byte range into the extents covering it.  Returns 0 if the range is empty */
+int lazy_range_extents(lazy_file_t *lf, size_t offset, size_t len, size_t *first, size_t *last);
+
+/* Return the byte range covered by extents first through last */
+void lazy_extent_bytes(lazy_file_t *lf, size_t first, size_t last, size_t *offset, size_t *len);
+
+/* Return true if extents first through last are all staged */
+int lazy_range_present(lazy_file_t *lf, size_t first, size_t last);
+
+/* Return true if the whole file is staged */
+int lazy_is_complete(lazy_file_t *lf);
+
+/* Find the next run of up to LAZY_MAX_RUN extents in first through last that is neither
+   staged nor already asked for, and mark it asked for.  Returns 0 if there is none. */
+int lazy_next_missing(lazy_file_t *lf, size_t first, size_t last, size_t *run_first, size_t *run_last);
+
+/* On the source, read extents first through last off disk into the local file */
+int lazy_read_extents(lazy_file_t *lf, size_t first, size_t last, size_t *bytes_read);
+
+/* Store extent contents that arrived from the parent */
+int lazy_write_range(lazy_file_t *lf, size_t offset, void *data, size_t len);
+
+/* Copy staged extent contents out of the local file */
+int lazy_read_local(lazy_file_t *lf, size_t offset, void *data, size_t len);
+
+/* Remember that peer is waiting for extents first through last, and hand back
+   the next waiter whose extents are now all staged */
+void lazy_add_waiter(lazy_file_t *lf, node_peer_t peer, size_t first, size_t last);
+int lazy_pop_ready_waiter(lazy_file_t *lf, node_peer_t *peer, size_t *first, size_t *last);
+
+/**
+ * With --hot-extents, the extents the last run's clients read of each lazy
+ * file, as learn_write recorded them, are pushed to every server as soon
+ * as the source stages the file, in the order they were first read, and
+ * the rest of the file is streamed after them, an extent at a time.
+ * Clients still only wait for the extents they read.
+ **/
+
+#define LAZY_PUSH_INTERVAL_MS 10   /* how often the next extents are pushed */
+
+/* Load the hot extents written to filename.  Returns -1 if it can't be read */
+int lazy_load_profile(const char *filename);
+
+/* Start pushing lf, which we're the source of, if it has hot extents.  Returns 1 if it does */
+int lazy_start_push(lazy_file_t *lf);
+
+/* The next run of lf to push, of up to LAZY_MAX_RUN hot extents or one
+   other.  Returns 0 once every extent has been pushed */
+int lazy_next_push(lazy_file_t *lf, size_t *first, size_t *last);
+
+/* The first lazy file with extents left to push, or NULL */
+lazy_file_t *lazy_pushing_file();
+
+/* Call cb from the listen loop every LAZY_PUSH_INTERVAL_MS while there are
+   extents to push.  Its fd must be read to clear the timer */
+int lazy_start_push_timer(int (*cb)(int fd, int id, void *data), void *data);
+void lazy_stop_push_timer();
+
+#endif
@@ -0,0 +1,238 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_ldcache.h"
+
+/**
+ * A parsed copy of ld.so.cache, so the server can answer a search that
+ * reaches the cache without the client's ld.so mapping and scanning it.
+ * The layouts below are glibc's (see its sysdeps/generic/dl-cache.h).
+ * We only keep the entries for our own ABI, sorted by name.  Entries with
+ * hwcaps are for CPU-specific builds; ld.so picks between those at run
+ * time, so names that have them are left to it.
+ **/
+
+#define CACHEMAGIC_OLD "ld.so-1.7.0"
+#define CACHEMAGIC_NEW "glibc-ld.so.cache"
+#define CACHEVERSION_NEW "1.1"
+
+#define FLAG_ELF_LIBC6 0x0003
+#if defined(__x86_64__) && defined(__ILP32__)
+#define LDCACHE_FLAGS (0x0800 | FLAG_ELF_LIBC6)
+#elif defined(__x86_64__)
+#define LDCACHE_FLAGS (0x0300 | FLAG_ELF_LIBC6)
+#elif defined(__aarch64__)
+#define LDCACHE_FLAGS (0x0a00 | FLAG_ELF_LIBC6)
+#elif defined(__powerpc64__)
+#define LDCACHE_FLAGS (0x0500 | FLAG_ELF_LIBC6)
+#elif defined(__i386__)
+#define LDCACHE_FLAGS FLAG_ELF_LIBC6
+#endif
+
+struct cache_entry_old {
+   int32_t flags;
+   uint32_t key, value;
+};
+
+struct cache_header_old {
+   char magic[sizeof(CACHEMAGIC_OLD) - 1];
+   uint32_t nlibs;
+};
+
+struct cache_entry_new {
+   int32_t flags;
+   uint32_t key, value;
+   uint32_t osversion;
+   uint64_t hwcap;
+};
+
+struct cache_header_new {
+   char magic[sizeof(CACHEMAGIC_NEW) - 1];
+   char version[sizeof(CACHEVERSION_NEW) - 1];
+   uint32_t nlibs;
+   uint32_t len_strings;
+   uint8_t flags;
+   uint8_t padding[3];
+   uint32_t extension_offset;
+   uint32_t unused[3];
+};
+
+typedef struct {
+   const char *name;
+   const char *path;
+   int has_hwcap;
+   int order;
+} ldcache_entry_t;
+
+static char *cache_data = NULL;
+static ldcache_entry_t *entries = NULL;
+static int num_entries = 0;
+
+static int entry_cmp(const void *a, const void *b)
+{
+   const ldcache_entry_t *ea = (const ldcache_entry_t *) a, *eb = (const ldcache_entry_t *) b;
+   int result = strcmp(ea->name, eb->name);
+   return result ? result : ea->order - eb->order;
+}
+
+static const char *cache_string(size_t size, size_t base, uint32_t offset)
+{
+   size_t start = base + offset;
+   if (start >= size || !memchr(cache_data + start, '\0', size - start))
+      return NULL;
+   return cache_data + start;
+}
+
+static int read_cache(const char *path, size_t *size)
+{
+   struct stat st;
+   ssize_t result;
+   size_t pos = 0;
+   int fd;
+
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1) {
+      debug_printf("Could not open ld.so cache %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+   if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct cache_header_new)) {
+      debug_printf("ld.so cache %s is too small to use\n", path);
+      close(fd);
+      return -1;
+   }
+   cache_data = (char *) malloc(st.st_size);
+   if (!cache_data) {
+      close(fd);
+      return -1;
+   }
+   while (pos < (size_t) st.st_size) {
+      result = read(fd, cache_data + pos, st.st_size - pos);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0) {
+         err_printf("Could not read ld.so cache %s: %s\n", path, strerror(errno));
+         close(fd);
+         return -1;
+      }
+      pos += result;
+   }
+   close(fd);
+   *size = pos;
+   return 0;
+}
+
+int ldcache_init(const char *path)
+{
+#if defined(LDCACHE_FLAGS)
+   struct cache_header_old *old_header;
+   struct cache_header_new *header;
+   struct cache_entry_new *libs;
+   size_t size, base = 0;
+   const char *name, *libpath;
+   uint32_t i;
+
+   if (read_cache(path, &size) == -1)
+      goto error;
+
+   /* Old caches have the new format after their own table */
+   if (memcmp(cache_data, CACHEMAGIC_OLD, sizeof(CACHEMAGIC_OLD) - 1) == 0) {
+      old_header = (struct cache_header_old *) cache_data;
+      base = sizeof(*old_header) + (size_t) old_header->nlibs * sizeof(struct cache_entry_old);
+      base = (base + __alignof__(struct cache_header_new) - 1) & ~(__alignof__(struct cache_header_new) - 1);
+      if (base + sizeof(*header) > size) {
+         debug_printf("ld.so cache %s doesn't have the new format\n", path);
+         goto error;
+      }
+   }
+   header = (struct cache_header_new *) (cache_data + base);
+   if (memcmp(header->magic, CACHEMAGIC_NEW, sizeof(CACHEMAGIC_NEW) - 1) != 0 ||
+       memcmp(header->version, CACHEVERSION_NEW, sizeof(CACHEVERSION_NEW) - 1) != 0) {
+      debug_printf("ld.so cache %s has an unknown format\n", path);
+      goto error;
+   }
+   if (header->nlibs > (size - base - sizeof(*header)) / sizeof(struct cache_entry_new)) {
+      err_printf("ld.so cache %s is truncated\n", path);
+      goto error;
+   }
+
+   libs = (struct cache_entry_new *) (header + 1);
+   entries = (ldcache_entry_t *) malloc(header->nlibs * sizeof(ldcache_entry_t) + 1);
+   if (!entries)
+      goto error;
+   for (i = 0; i < header->nlibs; i++) {
+      if (libs[i].flags != LDCACHE_FLAGS)
+         continue;
+      name = cache_string(size, base, libs[i].key);
+      libpath = cache_string(size, base, libs[i].value);
+      if (!name || !libpath)
+         continue;
+      entries[num_entries].name = name;
+      entries[num_entries].path = libpath;
+      entries[num_entries].has_hwcap = (libs[i].hwcap != 0);
+      entries[num_entries].order = num_entries;
+      num_entries++;
+   }
+   qsort(entries, num_entries, sizeof(ldcache_entry_t), entry_cmp);
+   debug_printf("Parsed %d entries for this ABI from ld.so cache %s\n", num_entries, path);
+   return 0;
+
+  error:
+   free(entries);
+   entries = NULL;
+   num_entries = 0;
+   free(cache_data);
+   cache_data = NULL;
+   return -1;
+#else
+   debug_printf("Not reading ld.so cache, unknown ABI\n");
+   return -1;
+#endif
+}
+
+ldcache_result_t ldcache_lookup(const char *lib, const char **path)
+{
+   int low = 0, high = num_entries, mid, i;
+
+   if (!entries)
+      return LDCACHE_UNKNOWN;
+
+   /* Find the first entry for lib */
+   while (low < high) {
+      mid = low + (high - low) / 2;
+      if (strcmp(entries[mid].name, lib) < 0)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+   if (low == num_entries || strcmp(entries[low].name, lib) != 0)
+      return LDCACHE_MISSING;
+
+   for (i = low; i < num_entries && strcmp(entries[i].name, lib) == 0; i++) {
+      if (entries[i].has_hwcap)
+         return LDCACHE_UNKNOWN;
+   }
+   *path = entries[low].path;
+   return LDCACHE_FOUND;
+}
@@ -0,0 +1,39 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_LDCACHE_H_)
+#define LDCS_AUDIT_SERVER_LDCACHE_H_
+
+#define LDCACHE_PATH "/etc/ld.so.cache"
+
+typedef enum {
+   LDCACHE_FOUND,     /* ld.so would try the file in *path */
+   LDCACHE_MISSING,   /* ld.so's cache has no entry for the library */
+   LDCACHE_UNKNOWN    /* we can't tell what ld.so would pick */
+} ldcache_result_t;
+
+/**
+ * Read and parse the node's ld.so cache at path.  Returns -1 if it
+ * couldn't be parsed, and every lookup is then LDCACHE_UNKNOWN.
+ **/
+int ldcache_init(const char *path);
+
+/**
+ * Look up a library name the way ld.so would in its cache
+ **/
+ldcache_result_t ldcache_lookup(const char *lib, const char **path);
+
+#endif
@@ -0,0 +1,381 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_learn.h"
+#include "name_intern.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "spindle_debug.h"
+
+/**
+ * Notes are kept by their interned pathnames, so a bucket is searched by
+ * comparing pointers.  notes holds them all, in the order first seen.
+ **/
+
+#define LEARN_TABLE_SIZE 4096
+
+typedef struct learn_note_t {
+   const char *pathname;
+   double first_use;
+   int is_stat;      /* only the path's stat was served */
+   int packed;       /* unchanged since it was last sent to our parent */
+   struct learn_note_t *next;
+} learn_note_t;
+
+static learn_note_t *learn_table[LEARN_TABLE_SIZE];
+static learn_note_t **notes = NULL;
+static size_t num_notes = 0, notes_size = 0;
+
+/* There are only ever a handful of lazy files, so they're kept on a list */
+typedef struct learn_extents_t {
+   const char *pathname;
+   size_t num_extents;
+   double *first_read;       /* when each extent was first read, or 0 */
+   unsigned char *packed;
+   struct learn_extents_t *next;
+} learn_extents_t;
+
+static learn_extents_t *extent_notes = NULL;
+
+static void learn_note(const char *pathname, double first_use, int is_stat)
+{
+   const char *name;
+   learn_note_t *n;
+   unsigned int bucket;
+
+   name = intern_name(pathname);
+   bucket = intern_name_hash(name) % LEARN_TABLE_SIZE;
+   for (n = learn_table[bucket]; n; n = n->next) {
+      if (n->pathname == name)
+         break;
+   }
+
+   if (!n) {
+      if (num_notes == notes_size) {
+         notes_size = notes_size ? notes_size * 2 : 1024;
+         notes = (learn_note_t **) realloc(notes, notes_size * sizeof(learn_note_t *));
+      }
+      n = (learn_note_t *) malloc(sizeof(learn_note_t));
+      n->pathname = name;
+      n->first_use = first_use;
+      n->is_stat = is_stat;
+      n->packed = 0;
+      n->next = learn_table[bucket];
+      learn_table[bucket] = n;
+      notes[num_notes++] = n;
+      return;
+   }
+
+   if (first_use < n->first_use) {
+      n->first_use = first_use;
+      n->packed = 0;
+   }
+   if (n->is_stat && !is_stat) {
+      n->is_stat = 0;
+      n->packed = 0;
+   }
+}
+
+void learn_record(const char *pathname, int is_stat)
+{
+   learn_note(pathname, ldcs_get_time(), is_stat);
+}
+
+static void learn_extent_note(const char *pathname, size_t extent, double first_read)
+{
+   const char *name;
+   learn_extents_t *e;
+   size_t size;
+   double *first_read_grown;
+   unsigned char *packed_grown;
+
+   name = intern_name(pathname);
+   for (e = extent_notes; e && e->pathname != name; e = e->next);
+   if (!e) {
+      e = (learn_extents_t *) calloc(1, sizeof(learn_extents_t));
+      if (!e)
+         return;
+      e->pathname = name;
+      e->next = extent_notes;
+      extent_notes = e;
+   }
+
+   if (extent >= e->num_extents) {
+      size = (extent + 1 > e->num_extents * 2) ? extent + 1 : e->num_extents * 2;
+      first_read_grown = (double *) realloc(e->first_read, size * sizeof(double));
+      if (!first_read_grown)
+         return;
+      e->first_read = first_read_grown;
+      packed_grown = (unsigned char *) realloc(e->packed, size);
+      if (!packed_grown)
+         return;
+      e->packed = packed_grown;
+      memset(e->first_read + e->num_extents, 0, (size - e->num_extents) * sizeof(double));
+      memset(e->packed + e->num_extents, 1, size - e->num_extents);
+      e->num_extents = size;
+   }
+
+   if (e->first_read[extent] != 0.0 && e->first_read[extent] <= first_read)
+      return;
+   e->first_read[extent] = first_read;
+   e->packed[extent] = 0;
+}
+
+void learn_record_extents(const char *pathname, size_t first, size_t last)
+{
+   double now = ldcs_get_time();
+   size_t i;
+
+   for (i = first; i <= last; i++)
+      learn_extent_note(pathname, i, now);
+}
+
+int learn_pack(char **data, size_t *size)
+{
+   size_t i, pos = 0, len;
+   char *buffer;
+   char is_stat;
+
+   learn_extents_t *e;
+
+   *data = NULL;
+   *size = 0;
+   for (i = 0; i < num_notes; i++) {
+      if (!notes[i]->packed)
+         pos += sizeof(double) + 1 + intern_name_strlen(notes[i]->pathname) + 1;
+   }
+   for (e = extent_notes; e; e = e->next) {
+      for (i = 0; i < e->num_extents; i++) {
+         if (!e->packed[i])
+            pos += sizeof(double) + 1 + intern_name_strlen(e->pathname) + 1 + sizeof(size_t);
+      }
+   }
+   if (!pos)
+      return 0;
+
+   buffer = (char *) malloc(pos);
+   if (!buffer) {
+      err_printf("Could not allocate %lu bytes for learned preload list\n", (unsigned long) pos);
+      return -1;
+   }
+   *size = pos;
+   pos = 0;
+   for (i = 0; i < num_notes; i++) {
+      if (notes[i]->packed)
+         continue;
+      is_stat = (char) notes[i]->is_stat;
+      len = intern_name_strlen(notes[i]->pathname) + 1;
+      memcpy(buffer + pos, &notes[i]->first_use, sizeof(double));
+      pos += sizeof(double);
+      buffer[pos++] = is_stat;
+      memcpy(buffer + pos, notes[i]->pathname, len);
+      pos += len;
+      notes[i]->packed = 1;
+   }
+   for (e = extent_notes; e; e = e->next) {
+      len = intern_name_strlen(e->pathname) + 1;
+      for (i = 0; i < e->num_extents; i++) {
+         if (e->packed[i])
+            continue;
+         memcpy(buffer + pos, e->first_read + i, sizeof(double));
+         pos += sizeof(double);
+         buffer[pos++] = LEARN_EXTENT;
+         memcpy(buffer + pos, e->pathname, len);
+         pos += len;
+         memcpy(buffer + pos, &i, sizeof(size_t));
+         pos += sizeof(size_t);
+         e->packed[i] = 1;
+      }
+   }
+   *data = buffer;
+   debug_printf2("Packed %lu bytes of learned preload list\n", (unsigned long) *size);
+   return 0;
+}
+
+int learn_merge(char *data, size_t size)
+{
+   size_t pos = 0, len, extent;
+   double first_use;
+   int is_stat;
+
+   while (pos < size) {
+      if (size - pos < sizeof(double) + 2) {
+         err_printf("Truncated learned preload list from child\n");
+         return -1;
+      }
+      memcpy(&first_use, data + pos, sizeof(double));
+      pos += sizeof(double);
+      is_stat = data[pos++];
+      len = strnlen(data + pos, size - pos);
+      if (len == size - pos || len >= MAX_PATH_LEN ||
+          (is_stat == LEARN_EXTENT && size - pos - len - 1 < sizeof(size_t))) {
+         err_printf("Malformed learned preload list from child\n");
+         return -1;
+      }
+      if (is_stat == LEARN_EXTENT) {
+         memcpy(&extent, data + pos + len + 1, sizeof(size_t));
+         learn_extent_note(data + pos, extent, first_use);
+         pos += len + 1 + sizeof(size_t);
+         continue;
+      }
+      learn_note(data + pos, first_use, is_stat);
+      pos += len + 1;
+   }
+   return 0;
+}
+
+static int by_first_use(const void *a, const void *b)
+{
+   double x = (*(learn_note_t * const *) a)->first_use;
+   double y = (*(learn_note_t * const *) b)->first_use;
+   return (x > y) - (x < y);
+}
+
+typedef struct {
+   double first_read;
+   size_t extent;
+} extent_use_t;
+
+static int by_first_read(const void *a, const void *b)
+{
+   double x = ((const extent_use_t *) a)->first_read;
+   double y = ((const extent_use_t *) b)->first_read;
+   return (x > y) - (x < y);
+}
+
+/* Write the hot extents for lazy_load_profile, next to the preload file */
+static int write_extents(const char *filename)
+{
+   char extname[MAX_PATH_LEN+1], tmpname[MAX_PATH_LEN+1];
+   learn_extents_t *e;
+   extent_use_t *uses;
+   size_t i, n;
+   FILE *f;
+   int result, count = 0;
+
+   if (!extent_notes)
+      return 0;
+   snprintf(extname, sizeof(extname), "%s%s", filename, LEARN_EXTENTS_SUFFIX);
+   snprintf(tmpname, sizeof(tmpname), "%s.%d", extname, getpid());
+   f = fopen(tmpname, "w");
+   if (!f) {
+      err_printf("Could not create hot extents file %s: %s\n", tmpname, strerror(errno));
+      return -1;
+   }
+
+   for (e = extent_notes; e; e = e->next) {
+      uses = (extent_use_t *) malloc((e->num_extents ? e->num_extents : 1) * sizeof(extent_use_t));
+      if (!uses)
+         continue;
+      for (i = 0, n = 0; i < e->num_extents; i++) {
+         if (e->first_read[i] == 0.0)
+            continue;
+         uses[n].first_read = e->first_read[i];
+         uses[n].extent = i;
+         n++;
+      }
+      qsort(uses, n, sizeof(extent_use_t), by_first_read);
+      if (n) {
+         fprintf(f, "%lu", (unsigned long) n);
+         for (i = 0; i < n; i++)
+            fprintf(f, " %lu", (unsigned long) uses[i].extent);
+         fprintf(f, " %s\n", e->pathname);
+         count++;
+      }
+      free(uses);
+   }
+
+   result = fclose(f);
+   if (result == 0)
+      result = rename(tmpname, extname);
+   if (result == -1) {
+      err_printf("Could not write hot extents file %s: %s\n", extname, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+   debug_printf("Wrote the hot extents of %d files to %s\n", count, extname);
+   return 0;
+}
+
+/**
+ * Files are written as they are.  A path that was only stat'ed is written
+ * as a directory, with a trailing '/', so the next run gets its listing
+ * but not its contents: the path itself if it's a directory, or else the
+ * one it's in.
+ **/
+int learn_write(const char *filename)
+{
+   char tmpname[MAX_PATH_LEN+1], dir[MAX_PATH_LEN+1], lastdir[MAX_PATH_LEN+1];
+   struct stat buf;
+   learn_note_t **sorted;
+   FILE *f;
+   size_t i;
+   char *slash;
+   int result;
+
+   snprintf(tmpname, sizeof(tmpname), "%s.%d", filename, getpid());
+   f = fopen(tmpname, "w");
+   if (!f) {
+      err_printf("Could not create learned preload file %s: %s\n", tmpname, strerror(errno));
+      return -1;
+   }
+
+   sorted = (learn_note_t **) malloc((num_notes ? num_notes : 1) * sizeof(learn_note_t *));
+   memcpy(sorted, notes, num_notes * sizeof(learn_note_t *));
+   qsort(sorted, num_notes, sizeof(learn_note_t *), by_first_use);
+
+   lastdir[0] = '\0';
+   for (i = 0; i < num_notes; i++) {
+      if (!sorted[i]->is_stat) {
+         fprintf(f, "%s\n", sorted[i]->pathname);
+         continue;
+      }
+      filemngt_count_fsop(FSOP_STAT, 0);
+      if (stat(sorted[i]->pathname, &buf) == -1)
+         continue;
+      strncpy(dir, sorted[i]->pathname, sizeof(dir));
+      dir[MAX_PATH_LEN] = '\0';
+      if (!S_ISDIR(buf.st_mode)) {
+         slash = strrchr(dir, '/');
+         if (!slash)
+            continue;
+         slash[slash == dir ? 1 : 0] = '\0';
+      }
+      if (strcmp(dir, lastdir) == 0)
+         continue;
+      fprintf(f, "%s/\n", dir);
+      strcpy(lastdir, dir);
+   }
+   free(sorted);
+
+   result = fclose(f);
+   if (result == 0)
+      result = rename(tmpname, filename);
+   if (result == -1) {
+      err_printf("Could not write learned preload file %s: %s\n", filename, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+   debug_printf("Wrote %lu learned preload entries to %s\n", (unsigned long) num_notes, filename);
+   return write_extents(filename);
+}
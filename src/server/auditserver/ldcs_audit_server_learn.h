@@ -0,0 +1,58 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_LEARN_H_)
+#define LDCS_AUDIT_SERVER_LEARN_H_
+
+#include <stddef.h>
+
+/**
+ * With --preload-learn, each server notes when it first served a client
+ * each file, or the stat of each path.  A server's notes go to its parent
+ * in its exit ready message, and the root writes everyone's out as a
+ * preload file, in first-use order, for the next run to replay.
+ *
+ * Notes are taken on the main thread or on a client thread holding the
+ * client pool's lock, so they need no lock of their own.
+ *
+ * A packed list is one entry per path:
+ * [double first use][char is_stat][pathname\0]
+ **/
+
+/* Note that a client was served pathname, or only its stat if is_stat */
+void learn_record(const char *pathname, int is_stat);
+
+/**
+ * With --hot-extents, the extents of lazily staged files that clients
+ * read are noted too, each with when it was first read.  They're packed
+ * as [double first read][char LEARN_EXTENT][pathname\0][size_t extent],
+ * and learn_write writes them for lazy_load_profile to the preload file's
+ * name plus LEARN_EXTENTS_SUFFIX.
+ **/
+#define LEARN_EXTENT 2
+#define LEARN_EXTENTS_SUFFIX ".extents"
+void learn_record_extents(const char *pathname, size_t first, size_t last);
+
+/* Pack the notes that changed since the last pack into *data, which the caller frees */
+int learn_pack(char **data, size_t *size);
+
+/* Merge in notes a child server packed */
+int learn_merge(char *data, size_t size);
+
+/* Write the notes to filename as a preload file */
+int learn_write(const char *filename);
+
+#endif
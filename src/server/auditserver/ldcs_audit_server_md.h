@@ -59,6 +59,11 @@ typedef void* node_peer_t;
 /* Any initialization can be done here. */
 int ldcs_audit_server_md_init(unsigned int port, unsigned int num_ports, unique_id_t unique_id, ldcs_process_data_t *data);
 
+/* Used in place of init by a server started after the job, to join the running
+   tree below a server on one of the comma separated hosts. */
+int ldcs_audit_server_md_join(unsigned int port, unsigned int num_ports, unique_id_t unique_id,
+                              char *hosts, ldcs_process_data_t *data);
+
 /* register_fd should, for every fd we want Spindle to recv messages on, call
    ldcs_listen_register_fd with the fd and a callback function to be triggered
    when a message arrives. */
@@ -68,6 +73,21 @@ int ldcs_audit_server_md_register_fd ( ldcs_process_data_t *data );
    ldcs_listen_unregister_fd call */
 int ldcs_audit_server_md_unregister_fd ( ldcs_process_data_t *data );
 
+/* Open the extra connections to each neighboring server that large file
+   contents are split across.  Every server calls this before any other
+   traffic, after the settings have been distributed */
+int ldcs_audit_server_md_open_streams ( ldcs_process_data_t *data );
+
+/* With --peers, hand each server the addresses of some of the other children
+   of its parent, which it links to on first use.  Every server calls this after
+   ldcs_audit_server_md_open_streams */
+int ldcs_audit_server_md_open_peers ( ldcs_process_data_t *data );
+
+/* With --bypass-slow, hand each server the addresses of its children's children,
+   which it links to once a child is slow.  Every server calls this after
+   ldcs_audit_server_md_open_peers */
+int ldcs_audit_server_md_open_bypass ( ldcs_process_data_t *data );
+
 /* Any shutdown code can be done here */
 int ldcs_audit_server_md_destroy ( ldcs_process_data_t *data );
 
@@ -76,6 +96,34 @@ int ldcs_audit_server_md_destroy ( ldcs_process_data_t *data );
    read the file */
 int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *data, char *filename );
 
+/* Returns true if the current server reads the directory dir, or the files
+   in it, off disk.  Unlike ldcs_audit_server_md_is_responsible, this may
+   pick servers other than the root when several readers are configured.
+   With OPT_FOREST, each reader reads everything for its own subtree */
+int ldcs_audit_server_md_is_reader ( ldcs_process_data_t *data, char *dir );
+
+/* Returns true if the current server leads its rack's servers: in a tree
+   built by switch, the one whose parent is outside the rack, and in other
+   trees, the root or one of its children.  With a rack cache, these are
+   the servers that keep it */
+int ldcs_audit_server_md_is_rack_leader ( ldcs_process_data_t *data );
+
+/* On the root, the number of readers, itself included, and the link to
+   reader i for i > 0, or NODE_PEER_NULL */
+int ldcs_audit_server_md_get_num_readers ( ldcs_process_data_t *data );
+node_peer_t ldcs_audit_server_md_get_reader ( ldcs_process_data_t *data, int i );
+
+/* Handle the messages children other than from send over the next usecs
+   microseconds, stopping early once each has sent one.  Lets requests that
+   arrive close together go up the tree as one message.  Does nothing when
+   called from a message it's gathering. */
+int ldcs_audit_server_md_gather_children ( ldcs_process_data_t *data, node_peer_t from, long usecs );
+
+/* Wait until no send is still reading from the size bytes at mem, so they
+   may be unmapped, freed or overwritten.  File contents may go out with
+   the kernel still reading them after the send returns */
+void ldcs_audit_server_md_release_buffer ( void *mem, size_t size );
+
 /* Read some number of bytes from the peer and throw them away. */
 int ldcs_audit_server_md_trash_bytes(node_peer_t peer, size_t size);
 
@@ -101,7 +149,68 @@ int ldcs_audit_server_md_send_noncontig(ldcs_process_data_t *ldcs_process_data,
 int ldcs_audit_server_md_broadcast_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
                                              void *secondary_data, size_t secondary_size);
 
+/* Variants of the above for file contents that are staged in the local file open on file_fd,
+   and mapped shared at mem/secondary_data.  These may move the contents between the network
+   and file_fd inside the kernel (sendfile, splice), and fall back to the mapping when they
+   can't.  Pass -1 for file_fd to always use the mapping. */
+int ldcs_audit_server_md_complete_msg_read_file(node_peer_t peer, ldcs_message_t *msg, int file_fd,
+                                                void *mem, size_t size);
+int ldcs_audit_server_md_send_noncontig_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg, 
+                                             node_peer_t peer, int file_fd,
+                                             void *secondary_data, size_t secondary_size);
+int ldcs_audit_server_md_broadcast_noncontig_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                                  int file_fd, void *secondary_data, size_t secondary_size);
+
+/* Used to pass a file's contents on to other servers while they are still arriving.  Sends
+   msg's header and initial data to each of peers, or to every child if peers is NULL.  Then
+   reads size bytes of payload from src into file_fd/mem, writing each chunk_size piece to the
+   peers as soon as it has been read.  chunk_size is where a link starts; implementations may
+   tune it to what they measure of the links. */
+int ldcs_audit_server_md_forward_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                           node_peer_t src, node_peer_t *peers, int num_peers,
+                                           int file_fd, void *mem, size_t size, size_t chunk_size);
+
 int ldcs_audit_server_md_get_num_children(ldcs_process_data_t *procdata);
+node_peer_t ldcs_audit_server_md_get_child(ldcs_process_data_t *procdata, int child);
+
+/* Whether child joined below us after startup, with --elastic */
+int ldcs_audit_server_md_child_joined(ldcs_process_data_t *procdata, node_peer_t child);
+
+/* Make the server joining below us that handle_join_request was called for
+   a child with rank, which the root picked.  Returns it, or NODE_PEER_NULL
+   if it's gone or we turned it away. */
+node_peer_t ldcs_audit_server_md_admit_join(ldcs_process_data_t *procdata, int request, int rank);
+
+/* Our position among our parent's children is our sibling index.  get_child_index
+   returns a child's index, or -1 for a peer that isn't our child.  children_linked
+   is true if children a and b have a link from ldcs_audit_server_md_open_peers, and
+   get_sibling returns our link to a sibling by index, connecting it if this is its
+   first use, or NODE_PEER_NULL */
+int ldcs_audit_server_md_get_child_index ( ldcs_process_data_t *data, node_peer_t child );
+int ldcs_audit_server_md_children_linked ( ldcs_process_data_t *data, node_peer_t a, node_peer_t b );
+node_peer_t ldcs_audit_server_md_get_sibling ( ldcs_process_data_t *data, int sibling );
+
+/* Bytes waiting to be sent to peer, or to every peer for NODE_PEER_ALL */
+size_t ldcs_audit_server_md_get_queued ( ldcs_process_data_t *data, node_peer_t peer );
+
+/* Send a message that just went to all children, as with broadcast_noncontig_file,
+   to the children of each child whose sends have been lagging behind its siblings'.
+   Returns how many servers it went to, or -1 on error */
+int ldcs_audit_server_md_bypass_slow ( ldcs_process_data_t *data, ldcs_message_t *msg,
+                                       int file_fd, void *secondary_data, size_t secondary_size );
+
+/* Called once the job has passed its startup.  Switches the links to other servers to
+   the --background-bandwidth limit, and remarks their traffic low priority if --dscp
+   marked it */
+int ldcs_audit_server_md_set_background ( ldcs_process_data_t *data );
+
+/* Called when a control update changes --bandwidth or --background-bandwidth.  Holds
+   the links to other servers to whichever of them applies now */
+int ldcs_audit_server_md_set_bandwidth ( ldcs_process_data_t *data );
+
+/* Prints, with the server's statistics, each link's measured round trip time and rate,
+   and the chunk size, chunks in flight and socket buffers it was tuned to */
+int ldcs_audit_server_md_print_links ( ldcs_process_data_t *data );
 
 #if defined(__cplusplus)
 }
@@ -14,13 +14,29 @@
   Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <time.h>
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define HAVE_ZEROCOPY
+#endif
 
 #include "ldcs_api.h"
 #include "ldcs_api_listen.h"
@@ -28,10 +44,13 @@
 #include "ldcs_audit_server_filemngt.h"
 #include "ldcs_audit_server_md.h"
 #include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_audit_server_msgpool.h"
 #include "ldcs_cache.h"
 #include "ldcs_cobo.h"
 #include "cobo_comm.h"
 #include "config.h"
+#include "spindle_probes.h"
 
 int ldcs_audit_server_md_cobo_CB ( int fd, int nc, void *data );
 int ldcs_audit_server_md_cobo_send_msg ( int fd, ldcs_message_t *msg );
@@ -40,115 +59,2582 @@ extern unique_id_t unique_id;
 
 extern int ll_read(int fd, void *buf, size_t count);
 
-int read_msg(int fd, node_peer_t *peer, ldcs_message_t *msg)
+#define SPLICE_PIPE_SIZE (1024*1024)
+
+#define ZEROCOPY_MIN_SIZE (64*1024)
+#define ZEROCOPY_POLL_MS 1000
+#define ZEROCOPY_MAX_POLLS 30
+
+#define COALESCE_MAX_SIZE 4096
+#define SEND_IOV_MAX 64
+#define CORK_MIN_SIZE (64*1024)
+
+/* Send queue priorities.  Only items above SENDQ_PRIO_ORDERED move, and
+   only ahead of file contents with a lower priority. */
+#define SENDQ_PRIO_ORDERED 0    /* keeps its place behind everything queued before it */
+#define SENDQ_PRIO_PRELOAD 1    /* file contents nobody has asked for yet */
+#define SENDQ_PRIO_DEMAND  2    /* file contents a client is waiting on */
+#define SENDQ_PRIO_META    3    /* directory listings, metadata, requests and their answers */
+
+#define STRAGGLER_SAMPLE_SIZE (256*1024)  /* sends timed for straggler detection */
+#define STRAGGLER_WEIGHT 0.25             /* of each new sample in a peer's average */
+#define STRAGGLER_MIN_SAMPLES 4
+#define STRAGGLER_MIN_DELAY 0.05          /* seconds, below which no child is slow */
+#define STRAGGLER_FACTOR 4.0              /* times the median of the siblings' delays */
+
+#define BANDWIDTH_BURST_SECS 0.1          /* of the --bandwidth rate a peer that's been idle may send at once */
+#define BANDWIDTH_MIN_BURST (64*1024)
+#define BANDWIDTH_TICK_NSEC (10*1000*1000) /* how often queues over the limit are retried */
+#define DSCP_BACKGROUND 8                 /* CS1, the low priority class */
+
+static int sendfile_works = 1;
+static int splice_works = 1;
+static int zerocopy_works = 1;
+static int splice_pipe[2] = { -1, -1 };
+
+/**
+ * Send count bytes of file_fd, starting at offset, to the network.  The
+ * kernel copies them straight out of the page cache, so we never touch
+ * (or fault in) our mapping of the file.  Returns 1 without having sent
+ * anything if the kernel can't sendfile to this fd.
+ **/
+static int ll_sendfile(int fd, int file_fd, off_t offset, size_t count)
+{
+   ssize_t result;
+   size_t pos = 0;
+
+   while (pos < count) {
+      result = sendfile(fd, file_fd, &offset, count - pos);
+      if (result == -1 && (errno == EINTR || errno == EAGAIN))
+         continue;
+      if (result == -1 && pos == 0 && (errno == EINVAL || errno == ENOSYS)) {
+         debug_printf("sendfile not supported (%s), using write for file contents\n", strerror(errno));
+         sendfile_works = 0;
+         return 1;
+      }
+      if (result <= 0) {
+         err_printf("Error sending file contents to cobo FD %d: %s\n", fd,
+                    result == 0 ? "short file" : strerror(errno));
+         return -1;
+      }
+      pos += result;
+   }
+   return 0;
+}
+
+#if defined(HAVE_ZEROCOPY)
+/**
+ * A MSG_ZEROCOPY send returns while the NIC may still be reading our
+ * pages.  The kernel numbers each socket's zero-copy sends from 0, and
+ * reports ranges of those numbers on the socket's error queue as it lets
+ * go of them.  We note which part of which buffer each socket still
+ * holds, and only wait on the kernel once that buffer is about to be
+ * unmapped or reused, in ldcs_audit_server_md_release_buffer.
+ **/
+typedef struct {
+   char *start, *end;
+   uint32_t last;          /* number of the last send from [start, end) */
+} zerocopy_range_t;
+
+typedef struct {
+   int enabled;            /* SO_ZEROCOPY is set on the socket */
+   uint32_t sent;          /* number the next send gets */
+   uint32_t done;          /* sends numbered below this have been released */
+   zerocopy_range_t *ranges;
+   int num_ranges;
+} zerocopy_sock_t;
+
+/* By fd.  It only grows at link setup, which never overlaps the stripe
+   jobs, and each stripe job only touches its own stream's entry. */
+static zerocopy_sock_t *zerocopy_socks = NULL;
+static int num_zerocopy_socks = 0;
+
+/**
+ * Set SO_ZEROCOPY on a new link to another server, once, so sends on it
+ * may use MSG_ZEROCOPY.
+ **/
+static void enable_zerocopy(int fd)
+{
+   zerocopy_sock_t *socks;
+   int one = 1, num;
+
+   if (fd < 0 || !__atomic_load_n(&zerocopy_works, __ATOMIC_RELAXED))
+      return;
+   if (fd >= num_zerocopy_socks) {
+      num = fd + 64;
+      socks = (zerocopy_sock_t *) realloc(zerocopy_socks, sizeof(zerocopy_sock_t) * num);
+      if (!socks) {
+         err_printf("Could not allocate zero-copy state for cobo FD %d\n", fd);
+         return;
+      }
+      memset(socks + num_zerocopy_socks, 0, sizeof(zerocopy_sock_t) * (num - num_zerocopy_socks));
+      zerocopy_socks = socks;
+      num_zerocopy_socks = num;
+   }
+
+   /* A link that had this fd before is closed */
+   free(zerocopy_socks[fd].ranges);
+   memset(zerocopy_socks + fd, 0, sizeof(zerocopy_sock_t));
+   if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1) {
+      debug_printf("SO_ZEROCOPY not supported on cobo FD %d (%s), using write for its file contents\n",
+                   fd, strerror(errno));
+      return;
+   }
+   zerocopy_socks[fd].enabled = 1;
+}
+
+/**
+ * Take whatever completions are on fd's error queue, without waiting,
+ * and forget the ranges the kernel no longer holds.
+ **/
+static int zerocopy_reap(int fd)
+{
+   zerocopy_sock_t *zs = zerocopy_socks + fd;
+   struct msghdr msg;
+   struct cmsghdr *cm;
+   struct sock_extended_err *serr;
+   char control[128];
+   int result, i, j, copied = 0;
+
+   for (;;) {
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      result = recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         break;
+      if (result == -1) {
+         err_printf("Error reading zero-copy completions on cobo FD %d: %s\n", fd, strerror(errno));
+         return -1;
+      }
+      for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+         serr = (struct sock_extended_err *) CMSG_DATA(cm);
+         if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            continue;
+         /* TCP releases its sends in order */
+         if ((int32_t) (serr->ee_data + 1 - zs->done) > 0)
+            zs->done = serr->ee_data + 1;
+         if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            copied = 1;
+      }
+   }
+
+   for (i = 0, j = 0; i < zs->num_ranges; i++) {
+      if ((int32_t) (zs->ranges[i].last - zs->done) >= 0)
+         zs->ranges[j++] = zs->ranges[i];
+   }
+   zs->num_ranges = j;
+
+   if (copied && __atomic_load_n(&zerocopy_works, __ATOMIC_RELAXED)) {
+      /* The kernel had to copy anyway (loopback, or a NIC without scatter-gather), 
+         so pinning pages only costs us. */
+      debug_printf("Zero-copy sends on cobo FD %d were copied, using write for file contents\n", fd);
+      __atomic_store_n(&zerocopy_works, 0, __ATOMIC_RELAXED);
+   }
+   return 0;
+}
+
+static int zerocopy_holds(zerocopy_sock_t *zs, char *start, char *end)
+{
+   int i;
+   for (i = 0; i < zs->num_ranges; i++) {
+      if (zs->ranges[i].start < end && start < zs->ranges[i].end)
+         return 1;
+   }
+   return 0;
+}
+
+/**
+ * Send count bytes at buf with MSG_ZEROCOPY, so the NIC DMAs them straight
+ * out of our mapping instead of the kernel copying them into socket
+ * buffers.  buf must stay as it is until ldcs_audit_server_md_release_buffer
+ * says the kernel is done with it.  Returns 1 without having sent anything
+ * if the socket can't do zero-copy.
+ **/
+static int ll_send_zerocopy(int fd, void *buf, size_t count)
+{
+   zerocopy_sock_t *zs;
+   zerocopy_range_t *ranges;
+   ssize_t result;
+   size_t pos = 0;
+   uint32_t first;
+   int global_result = 0;
+
+   if (fd >= num_zerocopy_socks || !zerocopy_socks[fd].enabled)
+      return 1;
+   zs = zerocopy_socks + fd;
+
+   /* Keeps the list of ranges the kernel holds short */
+   if (zs->num_ranges && zerocopy_reap(fd) == -1)
+      return -1;
+   ranges = (zerocopy_range_t *) realloc(zs->ranges, sizeof(zerocopy_range_t) * (zs->num_ranges + 1));
+   if (!ranges)
+      return 1;
+   zs->ranges = ranges;
+
+   first = zs->sent;
+   while (pos < count) {
+      result = send(fd, ((char *) buf) + pos, count - pos, MSG_ZEROCOPY);
+      if (result == -1 && (errno == EINTR || errno == EAGAIN))
+         continue;
+      if (result == -1 && errno == ENOBUFS) {
+         /* Out of optmem for pinned pages. Finish this one the normal way. */
+         global_result = ll_write(fd, ((char *) buf) + pos, count - pos);
+         break;
+      }
+      if (result <= 0) {
+         err_printf("Error sending file contents to cobo FD %d: %s\n", fd,
+                    result == 0 ? "connection closed" : strerror(errno));
+         global_result = -1;
+         break;
+      }
+      pos += result;
+      zs->sent++;
+   }
+
+   if (zs->sent != first) {
+      ranges[zs->num_ranges].start = (char *) buf;
+      ranges[zs->num_ranges].end = ((char *) buf) + count;
+      ranges[zs->num_ranges].last = zs->sent - 1;
+      zs->num_ranges++;
+   }
+   return global_result;
+}
+#else
+static void enable_zerocopy(int fd)
+{
+}
+#endif
+
+/**
+ * Read count bytes off the network into file_fd at offset.  The data moves
+ * socket -> pipe -> file inside the kernel.  Returns 1 without having read
+ * anything if the kernel can't splice from this fd.
+ **/
+static int ll_splice_read(int fd, int file_fd, off_t offset, size_t count)
+{
+   ssize_t in, out;
+   size_t pos = 0;
+   loff_t file_off = offset;
+
+   if (splice_pipe[0] == -1) {
+      if (pipe(splice_pipe) == -1) {
+         debug_printf("Could not create splice pipe (%s), using read for file contents\n", strerror(errno));
+         splice_works = 0;
+         return 1;
+      }
+      fcntl(splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+   }
+
+   while (pos < count) {
+      in = splice(fd, NULL, splice_pipe[1], NULL, count - pos, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (in == -1 && (errno == EINTR || errno == EAGAIN))
+         continue;
+      if (in == -1 && pos == 0 && (errno == EINVAL || errno == ENOSYS)) {
+         debug_printf("splice not supported (%s), using read for file contents\n", strerror(errno));
+         splice_works = 0;
+         return 1;
+      }
+      if (in <= 0) {
+         err_printf("Error reading file contents from cobo FD %d\n", fd);
+         return -1;
+      }
+      while (in) {
+         out = splice(splice_pipe[0], NULL, file_fd, &file_off, in, SPLICE_F_MOVE);
+         if (out == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+         if (out <= 0) {
+            /* The pipe still holds data we can't place. Start over with a new one. */
+            err_printf("Error writing network data to local file: %s\n", strerror(errno));
+            close(splice_pipe[0]);
+            close(splice_pipe[1]);
+            splice_pipe[0] = splice_pipe[1] = -1;
+            return -1;
+         }
+         in -= out;
+         pos += out;
+      }
+   }
+   return 0;
+}
+
+/**
+ * Send part of a file's contents, from file_fd when we have one, else from
+ * the mapping at mem.
+ **/
+static int write_file_data(int fd, int file_fd, void *mem, size_t offset, size_t count)
 {
    int result;
-   char *buffer = NULL;
+   if (file_fd != -1 && sendfile_works) {
+      result = ll_sendfile(fd, file_fd, (off_t) offset, count);
+      if (result != 1)
+         return result;
+   }
+#if defined(HAVE_ZEROCOPY)
+   if (count >= ZEROCOPY_MIN_SIZE && __atomic_load_n(&zerocopy_works, __ATOMIC_RELAXED)) {
+      result = ll_send_zerocopy(fd, ((char *) mem) + offset, count);
+      if (result != 1)
+         return result;
+   }
+#endif
+   return ll_write(fd, ((char *) mem) + offset, count);
+}
+
+/**
+ * Receive part of a file's contents, into file_fd when we have one, else
+ * into the mapping at mem.
+ **/
+static int read_file_data(int fd, int file_fd, void *mem, size_t offset, size_t count)
+{
+   int result;
+   if (file_fd != -1 && splice_works) {
+      result = ll_splice_read(fd, file_fd, (off_t) offset, count);
+      if (result != 1)
+         return result;
+   }
+   return ll_read(fd, ((char *) mem) + offset, count);
+}
+
+/**
+ * With --streams, each tree edge has extra sockets beside the cobo one.
+ * File contents of at least STRIPE_MIN_SIZE are cut into STRIPE_BLOCK_SIZE
+ * blocks, and block b travels on stream b % num_streams, where stream 0 is
+ * the cobo socket.  The block layout only depends on the offset within the
+ * contents, so the receiver may read them in any sized pieces.  Headers and
+ * all other messages stay on the cobo socket.
+ **/
+#define STRIPE_BLOCK_SIZE (1024*1024)
+#define STRIPE_MIN_SIZE (2*STRIPE_BLOCK_SIZE)
+
+typedef struct {
+   int fd;         /* the cobo socket to this peer */
+   int *streams;   /* streams[0] is fd */
+   int num_streams;
+} peer_streams_t;
+
+static peer_streams_t *peer_streams = NULL;
+static int num_peer_streams = 0;
+
+typedef enum {
+   stripe_write,
+   stripe_read,
+   stripe_trash
+} stripe_mode_t;
+
+typedef struct {
+   stripe_mode_t mode;
+   int fd;
+   int file_fd;
+   char *mem;
+   size_t pos;
+   size_t end;
+   int stream;
+   int num_streams;
+   int result;
+} stripe_job_t;
+
+/**
+ * Returns the streams to the peer on cobo socket fd if contents of size
+ * bytes should be split across them, or NULL if they go on fd alone.
+ **/
+static peer_streams_t *get_stripe_streams(int fd, size_t size)
+{
+   int i;
+   if (size < STRIPE_MIN_SIZE)
+      return NULL;
+   for (i = 0; i < num_peer_streams; i++) {
+      if (peer_streams[i].fd == fd)
+         return peer_streams[i].num_streams > 1 ? peer_streams + i : NULL;
+   }
+   return NULL;
+}
+
+static int is_file_contents_msg(ldcs_message_t *msg)
+{
+   return msg->header.type == LDCS_MSG_FILE_DATA || msg->header.type == LDCS_MSG_PRELOAD_FILE;
+}
+
+/**
+ * Move the blocks of [pos, end) that belong to one stream.  Run on the
+ * reader threads, one job per stream.
+ **/
+static void stripe_job(void *arg)
+{
+   stripe_job_t *job = (stripe_job_t *) arg;
+   char scratch[4096];
+   size_t block, start, len, i;
+
+   job->result = 0;
+   for (block = job->pos / STRIPE_BLOCK_SIZE; block * STRIPE_BLOCK_SIZE < job->end; block++) {
+      if (block % job->num_streams != (size_t) job->stream)
+         continue;
+      start = block * STRIPE_BLOCK_SIZE;
+      if (start < job->pos)
+         start = job->pos;
+      len = (block + 1) * STRIPE_BLOCK_SIZE;
+      if (len > job->end)
+         len = job->end;
+      len -= start;
+
+      switch (job->mode) {
+         case stripe_write:
+            job->result = write_file_data(job->fd, job->file_fd, job->mem, start, len);
+            break;
+         case stripe_read:
+            /* Straight into the mapping.  The splice pipe can't be shared between threads */
+            job->result = ll_read(job->fd, job->mem + start, len);
+            break;
+         case stripe_trash:
+            for (i = 0; i < len && job->result != -1; i += sizeof(scratch))
+               job->result = ll_read(job->fd, scratch, (len - i < sizeof(scratch)) ? len - i : sizeof(scratch));
+            break;
+      }
+      if (job->result == -1) {
+         err_printf("Error moving striped file contents on stream %d\n", job->stream);
+         return;
+      }
+   }
+}
+
+/**
+ * Move bytes [pos, pos+count) of some file contents across all of a peer's
+ * streams at once.
+ **/
+static int stripe_io(peer_streams_t *ps, stripe_mode_t mode, int file_fd, void *mem,
+                     size_t pos, size_t count)
+{
+   stripe_job_t *jobs;
+   void **args;
+   int i, result = 0;
+
+   jobs = (stripe_job_t *) malloc(sizeof(stripe_job_t) * ps->num_streams);
+   args = (void **) malloc(sizeof(void *) * ps->num_streams);
+   if (!jobs || !args) {
+      err_printf("Could not allocate stripe jobs\n");
+      free(jobs);
+      free(args);
+      return -1;
+   }
+   for (i = 0; i < ps->num_streams; i++) {
+      jobs[i].mode = mode;
+      jobs[i].fd = ps->streams[i];
+      jobs[i].file_fd = file_fd;
+      jobs[i].mem = (char *) mem;
+      jobs[i].pos = pos;
+      jobs[i].end = pos + count;
+      jobs[i].stream = i;
+      jobs[i].num_streams = ps->num_streams;
+      args[i] = jobs + i;
+   }
+
+   readpool_run(stripe_job, args, ps->num_streams);
+
+   for (i = 0; i < ps->num_streams; i++) {
+      if (jobs[i].result == -1)
+         result = -1;
+   }
+   free(jobs);
+   free(args);
+   return result;
+}
+
+/**
+ * Messages to children don't make us wait on each child in turn.  Every
+ * child socket has a queue of pending sends.  A broadcast queues the
+ * message for all children, pushes as much as each socket takes without
+ * blocking, and leaves the rest to the listen loop, which calls us back
+ * when a socket drains.  The children share one copy of the payload, and
+ * file contents are sendfile'd from a dup of the file's fd.  Anything
+ * else written to a peer first empties its queue, so messages stay in
+ * order.
+ *
+ * While the listen loop runs, messages of at most COALESCE_MAX_SIZE
+ * bytes aren't pushed right away.  They wait in the queue until the end
+ * of the loop's pass, so a burst of small requests and replies to one
+ * peer goes out in a single writev instead of a header and a data write
+ * each.
+ *
+ * Queued messages don't all keep their order.  File contents are
+ * self-contained, so a message with a higher priority (see send_priority)
+ * is queued ahead of file contents with a lower one that haven't started
+ * going out.  A directory listing or metadata answer then doesn't wait
+ * behind a large library, and a library clients asked for doesn't wait
+ * behind preloaded ones.  Messages that must keep their place, like the
+ * end of a preload, are never passed, and the message being sent is
+ * always finished first, since the stream can't be split mid-message.
+ **/
+typedef struct {
+   int refs;
+   size_t size;
+   char *data;
+} send_buf_t;
+
+typedef struct send_item_t {
+   struct send_item_t *next;
+   send_buf_t *buf;
+   size_t buf_pos;
+   int file_fd;        /* sendfile file_left bytes from here after buf, or -1 */
+   off_t file_pos;
+   size_t file_left;
+   char *file_mem;     /* file_fd's contents mapped, to write if sendfile fails, or NULL */
+   double queued_at;   /* when the item first had to wait, or 0 */
+   size_t queued_left; /* bytes of it not yet sent at queued_at */
+   size_t total;       /* bytes in the whole item */
+   int prio;           /* SENDQ_PRIO_* */
+} send_item_t;
+
+typedef struct {
+   int fd;
+   send_item_t *head, *tail;
+   size_t bytes;       /* not yet sent */
+   int watching;       /* registered for write callbacks */
+   double delay;       /* running average of how long large items waited on this peer */
+   int samples;        /* large items in that average */
+   double tokens;      /* bytes we may send under the --bandwidth limit, below 0 when over it */
+   double tokens_at;   /* when tokens was last refilled, or 0 before the first limited send */
+   double throttled_at; /* when the queue started waiting on the limit, or 0 */
+} send_queue_t;
+
+static send_queue_t *send_queues = NULL;
+static int num_send_queues = 0;
+static ldcs_process_data_t *sendq_procdata = NULL;
+static int hold_small_sends = 0;
+static double sendq_rate = 0.0;       /* bytes a second we send each peer, 0 for no limit */
+static int bandwidth_timer_fd = -1;
+static int bandwidth_timer_armed = 0;
+
+static int sendq_write_cb(int fd, int id, void *data);
+static int queue_noncontig_file(int *fds, int num_fds, ldcs_message_t *msg,
+                                int file_fd, void *secondary_data, size_t secondary_size);
+
+static send_queue_t *get_send_queue(int fd, int create)
+{
+   int i;
+   send_queue_t *newq;
+   for (i = 0; i < num_send_queues; i++) {
+      if (send_queues[i].fd == fd)
+         return send_queues + i;
+   }
+   if (!create)
+      return NULL;
+   newq = (send_queue_t *) realloc(send_queues, sizeof(send_queue_t) * (num_send_queues + 1));
+   if (!newq)
+      return NULL;
+   send_queues = newq;
+   memset(send_queues + num_send_queues, 0, sizeof(send_queue_t));
+   send_queues[num_send_queues].fd = fd;
+   return send_queues + num_send_queues++;
+}
+
+/**
+ * Copy the header, the initial data, and mem_size bytes of mem into one
+ * buffer that can be queued for several peers.  The send_buf_t and its
+ * data come from a single pooled allocation.
+ **/
+static send_buf_t *new_send_buf(ldcs_message_t *msg, size_t initial_size, void *mem, size_t mem_size)
+{
+   send_buf_t *buf = (send_buf_t *) msgpool_alloc(sizeof(send_buf_t) + sizeof(*msg) + initial_size + mem_size);
+   if (!buf) {
+      err_printf("Could not allocate %lu bytes to queue a message\n",
+                 (unsigned long) (sizeof(*msg) + initial_size + mem_size));
+      return NULL;
+   }
+   buf->data = (char *) (buf + 1);
+   buf->refs = 1;
+   buf->size = sizeof(*msg) + initial_size + mem_size;
+   memcpy(buf->data, msg, sizeof(*msg));
+   if (initial_size)
+      memcpy(buf->data + sizeof(*msg), msg->data, initial_size);
+   if (mem_size)
+      memcpy(buf->data + sizeof(*msg) + initial_size, mem, mem_size);
+   return buf;
+}
+
+static void release_send_buf(send_buf_t *buf)
+{
+   if (--buf->refs)
+      return;
+   msgpool_free(buf);
+}
+
+static void free_send_item(send_item_t *item)
+{
+   release_send_buf(item->buf);
+   if (item->file_fd != -1)
+      close(item->file_fd);
+   msgpool_free(item);
+}
+
+static void clear_send_queue(send_queue_t *q)
+{
+   send_item_t *item;
+   while ((item = q->head) != NULL) {
+      q->head = item->next;
+      free_send_item(item);
+   }
+   q->tail = NULL;
+   q->bytes = 0;
+   if (q->watching)
+      ldcs_listen_register_write_cb(q->fd, NULL, NULL);
+   q->watching = 0;
+}
+
+/**
+ * Send what the socket will take of item.  Returns 1 when the item is
+ * all sent, 0 if the socket is full, or -1 on error.  The socket must
+ * be non-blocking.
+ **/
+static int push_send_item(send_queue_t *q, send_item_t *item)
+{
+   ssize_t result;
+
+   while (item->buf_pos < item->buf->size) {
+      result = write(q->fd, item->buf->data + item->buf_pos, item->buf->size - item->buf_pos);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return 0;
+      if (result <= 0) {
+         err_printf("Error writing to cobo FD %d: %s\n", q->fd,
+                    result == 0 ? "connection closed" : strerror(errno));
+         return -1;
+      }
+      item->buf_pos += result;
+      q->bytes -= result;
+   }
+   while (item->file_left) {
+      result = sendfile(q->fd, item->file_fd, &item->file_pos, item->file_left);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return 0;
+      if (result == -1 && item->file_mem) {
+         /* The rest can still come from the mapping, rather than the peer
+            losing everything queued behind this */
+         debug_printf("sendfile to cobo FD %d failed (%s), writing the rest of the file contents\n",
+                      q->fd, strerror(errno));
+         if (errno == EINVAL || errno == ENOSYS)
+            sendfile_works = 0;
+         if (write_file_data(q->fd, -1, item->file_mem, item->file_pos, item->file_left) == -1)
+            return -1;
+         q->bytes -= item->file_left;
+         item->file_pos += item->file_left;
+         item->file_left = 0;
+         break;
+      }
+      if (result <= 0) {
+         err_printf("Error sending file contents to cobo FD %d: %s\n", q->fd,
+                    result == 0 ? "short file" : strerror(errno));
+         return -1;
+      }
+      item->file_left -= result;
+      q->bytes -= result;
+   }
+   return 1;
+}
+
+/**
+ * Wait until no link is still sending out of [mem, mem+size), so the
+ * caller may unmap, free or overwrite it.  A link that releases none of
+ * its sends in ZEROCOPY_MAX_POLLS polls has lost its peer, and is given up on.
+ * Queued file contents stop falling back on it if sendfile fails.
+ **/
+void ldcs_audit_server_md_release_buffer(void *mem, size_t size)
+{
+   char *start = (char *) mem, *end = start + size;
+   send_item_t *item;
+   int i;
+#if defined(HAVE_ZEROCOPY)
+   struct pollfd pfd;
+   uint32_t done;
+   int fd, polls;
+
+   for (fd = 0; fd < num_zerocopy_socks; fd++) {
+      polls = 0;
+      done = zerocopy_socks[fd].done;
+      while (zerocopy_holds(zerocopy_socks + fd, start, end)) {
+         if (zerocopy_reap(fd) == -1 || polls == ZEROCOPY_MAX_POLLS) {
+            if (polls == ZEROCOPY_MAX_POLLS)
+               err_printf("Gave up waiting on zero-copy sends on cobo FD %d\n", fd);
+            zerocopy_socks[fd].num_ranges = 0;
+            break;
+         }
+         if (!zerocopy_holds(zerocopy_socks + fd, start, end))
+            break;
+         if (zerocopy_socks[fd].done != done) {
+            done = zerocopy_socks[fd].done;
+            polls = 0;
+         }
+         /* Completions show up as POLLERR */
+         pfd.fd = fd;
+         pfd.events = 0;
+         pfd.revents = 0;
+         poll(&pfd, 1, ZEROCOPY_POLL_MS);
+         polls++;
+      }
+   }
+#endif
+
+   for (i = 0; i < num_send_queues; i++) {
+      for (item = send_queues[i].head; item; item = item->next) {
+         if (item->file_mem && item->file_mem < end && start < item->file_mem + item->file_pos + item->file_left)
+            item->file_mem = NULL;
+      }
+   }
+}
+
+/**
+ * Send the unsent buffers of the items at the head of q in one go,
+ * stopping after the first item that has file contents to follow.
+ * Returns 1 once the head's buffer is all sent, 0 if the socket is full,
+ * or -1 on error.  The socket must be non-blocking.
+ **/
+static int push_send_bufs(send_queue_t *q)
+{
+   struct iovec iov[SEND_IOV_MAX];
+   struct msghdr mh;
+   send_item_t *item;
+   ssize_t result;
+   size_t left;
+   int more;
+
+   while (q->head->buf_pos < q->head->buf->size) {
+      memset(&mh, 0, sizeof(mh));
+      mh.msg_iov = iov;
+      more = 0;
+      for (item = q->head; item; item = item->next) {
+         if (mh.msg_iovlen == SEND_IOV_MAX || item->file_left) {
+            /* Let the kernel fill a segment with what comes next */
+            more = 1;
+            if (mh.msg_iovlen == SEND_IOV_MAX)
+               break;
+         }
+         if (item->buf_pos < item->buf->size) {
+            iov[mh.msg_iovlen].iov_base = item->buf->data + item->buf_pos;
+            iov[mh.msg_iovlen].iov_len = item->buf->size - item->buf_pos;
+            mh.msg_iovlen++;
+         }
+         if (item->file_left)
+            break;
+      }
+      result = sendmsg(q->fd, &mh, more ? MSG_MORE : 0);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return 0;
+      if (result <= 0) {
+         err_printf("Error writing to cobo FD %d: %s\n", q->fd,
+                    result == 0 ? "connection closed" : strerror(errno));
+         return -1;
+      }
+      q->bytes -= result;
+      for (item = q->head; result; item = item->next) {
+         left = item->buf->size - item->buf_pos;
+         if (left > (size_t) result)
+            left = (size_t) result;
+         item->buf_pos += left;
+         result -= left;
+      }
+   }
+   return 1;
+}
+
+/**
+ * How long large sends wait on each peer's socket says how fast it takes
+ * what we send it.  Children that are much slower at it than their
+ * siblings are stragglers; see ldcs_audit_server_md_bypass_slow.
+ **/
+static void record_send_delay(send_queue_t *q, double delay)
+{
+   q->delay = q->samples ? q->delay * (1.0 - STRAGGLER_WEIGHT) + delay * STRAGGLER_WEIGHT : delay;
+   q->samples++;
+}
+
+/**
+ * How big the chunks of forwarded file contents should be, and how many
+ * of them should be in flight, depends on the link.  A 1 GbE management
+ * network wants neither the chunks nor the socket buffers of a 200 Gb
+ * one.  So each tree edge is measured as it's used.  Its round trip time
+ * is the kernel's smoothed estimate for the socket, first taken when the
+ * tree is wired up, and its rate is the average our large transfers on
+ * it reached.  Once an edge has LINK_MIN_SAMPLES of them behind it, its
+ * chunks carry LINK_CHUNK_SECS of its rate, and enough chunks to cover
+ * twice its bandwidth-delay product are kept in flight by raising the
+ * socket's buffers to hold them.  Buffers are only ever raised, and
+ * only within net.core.wmem_max and rmem_max, since setting them turns
+ * off the kernel's own tuning of the socket.
+ **/
+#define LINK_SAMPLE_SIZE (256*1024)       /* transfers timed to measure an edge */
+#define LINK_MIN_SAMPLES 2
+#define LINK_WEIGHT 0.25                  /* of each new sample in an edge's rate */
+#define LINK_CHUNK_SECS 0.002
+#define LINK_MIN_CHUNK (256*1024)
+#define LINK_MAX_CHUNK (8*1024*1024)
+#define LINK_CHUNK_ALIGN (64*1024)
+#define LINK_MIN_DEPTH 2
+#define LINK_MAX_DEPTH 16
+
+typedef struct {
+   int fd;
+   double rtt;         /* seconds, 0 until the kernel has a sample */
+   double rate;        /* bytes a second our large transfers reached */
+   int samples;
+   size_t chunk;       /* bytes forwarded at a time, 0 until tuned */
+   int depth;          /* chunks kept in flight */
+   int sndbuf;         /* what we raised the socket's buffers to, or 0 */
+   int rcvbuf;
+} link_tune_t;
+
+static link_tune_t *links = NULL;
+static int num_links = 0;
+static int wmem_max = -1;
+static int rmem_max = -1;
+
+static link_tune_t *get_link(int fd)
+{
+   int i;
+   link_tune_t *newlinks;
+   for (i = 0; i < num_links; i++) {
+      if (links[i].fd == fd)
+         return links + i;
+   }
+   newlinks = (link_tune_t *) realloc(links, sizeof(link_tune_t) * (num_links + 1));
+   if (!newlinks)
+      return NULL;
+   links = newlinks;
+   memset(links + num_links, 0, sizeof(link_tune_t));
+   links[num_links].fd = fd;
+   return links + num_links++;
+}
+
+static int read_sysctl_int(const char *path)
+{
+   FILE *f;
+   int value = 0;
+
+   f = fopen(path, "r");
+   if (!f)
+      return 0;
+   if (fscanf(f, "%d", &value) != 1)
+      value = 0;
+   fclose(f);
+   return value;
+}
+
+static void link_read_rtt(link_tune_t *l)
+{
+   struct tcp_info info;
+   socklen_t len = sizeof(info);
+
+   memset(&info, 0, sizeof(info));
+   if (getsockopt(l->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1 || !info.tcpi_rtt)
+      return;
+   l->rtt = info.tcpi_rtt / 1000000.0;
+}
+
+/**
+ * Raise fd's opt buffer to hold size bytes, if it's smaller and the
+ * system allows that much.  The kernel doubles what it's asked for, and
+ * reports the doubled size.  Returns the size set, or 0.
+ **/
+static int raise_socket_buffer(int fd, int opt, int size, int sysmax)
+{
+   int cur;
+   socklen_t len = sizeof(cur);
+
+   if (size > sysmax)
+      size = sysmax;
+   if (size <= 0 || getsockopt(fd, SOL_SOCKET, opt, &cur, &len) == -1 || 2 * size <= cur)
+      return 0;
+   if (setsockopt(fd, SOL_SOCKET, opt, &size, sizeof(size)) == -1) {
+      debug_printf2("Could not raise %s of fd %d to %d: %s\n", opt == SO_SNDBUF ? "SO_SNDBUF" : "SO_RCVBUF",
+                    fd, size, strerror(errno));
+      return 0;
+   }
+   return size;
+}
+
+static void link_tune(link_tune_t *l, int sending)
+{
+   size_t chunk, buf;
+   int depth, i, num_streams = 1, set, *streams = &l->fd;
+
+   link_read_rtt(l);
+   chunk = (size_t) (l->rate * LINK_CHUNK_SECS);
+   if (chunk < LINK_MIN_CHUNK)
+      chunk = LINK_MIN_CHUNK;
+   if (chunk > LINK_MAX_CHUNK)
+      chunk = LINK_MAX_CHUNK;
+   chunk -= chunk % LINK_CHUNK_ALIGN;
+   depth = (int) (2.0 * l->rate * l->rtt / chunk) + 1;
+   if (depth < LINK_MIN_DEPTH)
+      depth = LINK_MIN_DEPTH;
+   if (depth > LINK_MAX_DEPTH)
+      depth = LINK_MAX_DEPTH;
+
+   if (chunk != l->chunk || depth != l->depth) {
+      debug_printf2("Tuned link on fd %d: rtt %.3f ms, %.2f MB/s, %lu KB chunks, %d in flight\n",
+                    l->fd, l->rtt * 1000.0, l->rate / (1024.0 * 1024.0), (unsigned long) chunk / 1024, depth);
+      if (sendq_procdata)
+         sendq_procdata->server_stat.linktune.cnt++;
+   }
+   l->chunk = chunk;
+   l->depth = depth;
+
+   /* With --streams the edge's data is split across its streams */
+   for (i = 0; i < num_peer_streams; i++) {
+      if (peer_streams[i].fd == l->fd) {
+         streams = peer_streams[i].streams;
+         num_streams = peer_streams[i].num_streams;
+         break;
+      }
+   }
+   buf = chunk * depth / num_streams;
+   if (buf > INT_MAX / 2)
+      buf = INT_MAX / 2;
+   if (sending && wmem_max == -1)
+      wmem_max = read_sysctl_int("/proc/sys/net/core/wmem_max");
+   if (!sending && rmem_max == -1)
+      rmem_max = read_sysctl_int("/proc/sys/net/core/rmem_max");
+   for (i = 0; i < num_streams; i++) {
+      if (sending)
+         set = raise_socket_buffer(streams[i], SO_SNDBUF, (int) buf, wmem_max);
+      else
+         set = raise_socket_buffer(streams[i], SO_RCVBUF, (int) buf, rmem_max);
+      if (set && sending)
+         l->sndbuf = set;
+      else if (set)
+         l->rcvbuf = set;
+   }
+}
+
+/**
+ * Count a transfer of bytes on fd that took secs toward its edge's rate,
+ * and retune the edge.
+ **/
+static void link_record(int fd, size_t bytes, double secs, int sending)
+{
+   link_tune_t *l;
+   double rate;
+
+   if (bytes < LINK_SAMPLE_SIZE || secs <= 0.0)
+      return;
+   l = get_link(fd);
+   if (!l)
+      return;
+   rate = bytes / secs;
+   l->rate = l->samples ? l->rate * (1.0 - LINK_WEIGHT) + rate * LINK_WEIGHT : rate;
+   l->samples++;
+   if (sendq_procdata) {
+      sendq_procdata->server_stat.linktune.bytes += bytes;
+      sendq_procdata->server_stat.linktune.time += secs;
+   }
+   if (l->samples >= LINK_MIN_SAMPLES)
+      link_tune(l, sending);
+}
+
+/**
+ * The chunk size for forwarding from src_fd to fds: the smallest any of
+ * the tuned edges wants, or chunk_size if none are tuned yet.
+ **/
+static size_t link_chunk_size(int src_fd, int *fds, int num_fds, size_t chunk_size)
+{
+   size_t best = 0;
+   int i, j, used;
+
+   for (i = 0; i < num_links; i++) {
+      if (!links[i].chunk || (best && links[i].chunk >= best))
+         continue;
+      used = (links[i].fd == src_fd);
+      for (j = 0; j < num_fds && !used; j++)
+         used = (fds[j] == links[i].fd);
+      if (used)
+         best = links[i].chunk;
+   }
+   return best ? best : chunk_size;
+}
+
+/**
+ * Take each tree edge's first round trip time, which the kernel has from
+ * the connection's handshake and the wire-up messages.
+ **/
+static void link_wireup(int parent_fd, int num_childs)
+{
+   link_tune_t *l;
+   int i, fd;
+
+   for (i = -1; i < num_childs; i++) {
+      if (i == -1)
+         fd = parent_fd;
+      else if (cobo_get_child_socket(i, &fd) != COBO_SUCCESS)
+         continue;
+      l = get_link(fd);
+      if (!l)
+         continue;
+      link_read_rtt(l);
+      debug_printf3("Link on fd %d starts with rtt %.3f ms\n", fd, l->rtt * 1000.0);
+   }
+}
+
+/**
+ * With --bandwidth, what we send each peer is held to sendq_rate bytes a
+ * second by a token bucket.  Sends aren't cut to fit what's in the
+ * bucket.  A send takes what it needs, which may leave the bucket in
+ * debt, and nothing more goes to that peer until the debt is paid off.
+ * A queue in debt waits on the bandwidth timer instead of its socket,
+ * and the paths that write straight to a socket sleep the debt off
+ * first.  So a peer gets the limit on average, in bursts of at most the
+ * socket's buffer.
+ **/
+static double bucket_size()
+{
+   double size = sendq_rate * BANDWIDTH_BURST_SECS;
+   return size < BANDWIDTH_MIN_BURST ? BANDWIDTH_MIN_BURST : size;
+}
+
+static void refill_tokens(send_queue_t *q)
+{
+   double now = ldcs_get_time();
+   if (q->tokens_at == 0.0)
+      q->tokens = bucket_size();
+   else
+      q->tokens += (now - q->tokens_at) * sendq_rate;
+   if (q->tokens > bucket_size())
+      q->tokens = bucket_size();
+   q->tokens_at = now;
+}
+
+/**
+ * Sleep until q's bucket is out of debt
+ **/
+static void wait_for_tokens(send_queue_t *q)
+{
+   double start;
+
+   if (sendq_rate <= 0.0)
+      return;
+   refill_tokens(q);
+   if (q->tokens > 0.0)
+      return;
+   start = ldcs_get_time();
+   usleep((useconds_t) (-q->tokens / sendq_rate * 1000000.0) + 1);
+   refill_tokens(q);
+   if (sendq_procdata) {
+      sendq_procdata->server_stat.throttle.cnt++;
+      sendq_procdata->server_stat.throttle.time += ldcs_get_time() - start;
+   }
+}
+
+/**
+ * Count bytes we're about to write straight to fd against its bucket,
+ * after waiting out any debt.
+ **/
+static void charge_direct(int fd, size_t bytes)
+{
+   send_queue_t *q;
+
+   if (sendq_rate <= 0.0)
+      return;
+   q = get_send_queue(fd, 1);
+   if (!q)
+      return;
+   wait_for_tokens(q);
+   q->tokens -= (double) bytes;
+}
+
+static void arm_bandwidth_timer(int on)
+{
+   struct itimerspec its;
+
+   if (bandwidth_timer_fd == -1 || bandwidth_timer_armed == on)
+      return;
+   memset(&its, 0, sizeof(its));
+   if (on) {
+      its.it_value.tv_nsec = BANDWIDTH_TICK_NSEC;
+      its.it_interval.tv_nsec = BANDWIDTH_TICK_NSEC;
+   }
+   if (timerfd_settime(bandwidth_timer_fd, 0, &its, NULL) == -1) {
+      err_printf("Could not set the bandwidth timer: %s\n", strerror(errno));
+      return;
+   }
+   bandwidth_timer_armed = on;
+}
+
+/**
+ * Leave q to the bandwidth timer until its bucket is out of debt
+ **/
+static void throttle_queue(send_queue_t *q)
+{
+   if (q->watching) {
+      ldcs_listen_register_write_cb(q->fd, NULL, NULL);
+      q->watching = 0;
+   }
+   if (q->throttled_at == 0.0) {
+      q->throttled_at = ldcs_get_time();
+      if (sendq_procdata)
+         sendq_procdata->server_stat.throttle.cnt++;
+   }
+   arm_bandwidth_timer(1);
+}
+
+static void unthrottle_queue(send_queue_t *q)
+{
+   if (q->throttled_at == 0.0)
+      return;
+   if (sendq_procdata)
+      sendq_procdata->server_stat.throttle.time += ldcs_get_time() - q->throttled_at;
+   q->throttled_at = 0.0;
+}
+
+/**
+ * Send as much of q as the socket takes without blocking.  If some is
+ * left, ask the listen loop to call us when the socket is writable.
+ * On error the queue is dropped and -1 returned.
+ **/
+static int push_send_queue(send_queue_t *q)
+{
+   send_item_t *item;
+   int flags, result = 1;
+   size_t start_bytes = q->bytes;
+
+   if (!q->head)
+      return 0;
+
+   if (sendq_rate > 0.0) {
+      refill_tokens(q);
+      if (q->tokens <= 0.0) {
+         throttle_queue(q);
+         return 0;
+      }
+      unthrottle_queue(q);
+   }
+
+   flags = fcntl(q->fd, F_GETFL);
+   fcntl(q->fd, F_SETFL, flags | O_NONBLOCK);
+   while ((item = q->head) != NULL) {
+      if (sendq_rate > 0.0 && q->tokens <= (double) (start_bytes - q->bytes))
+         break;
+      result = push_send_bufs(q);
+      if (result == 1)
+         result = push_send_item(q, item);
+      if (result != 1)
+         break;
+      if (item->queued_at != 0.0 && sendq_procdata)
+         sendq_procdata->server_stat.sendq.time += ldcs_get_time() - item->queued_at;
+      if (item->total >= STRAGGLER_SAMPLE_SIZE)
+         record_send_delay(q, item->queued_at != 0.0 ? ldcs_get_time() - item->queued_at : 0.0);
+      if (item->queued_at != 0.0)
+         link_record(q->fd, item->queued_left, ldcs_get_time() - item->queued_at, 1);
+      q->head = item->next;
+      if (!q->head)
+         q->tail = NULL;
+      free_send_item(item);
+   }
+   fcntl(q->fd, F_SETFL, flags);
+   if (sendq_rate > 0.0)
+      q->tokens -= (double) (start_bytes - q->bytes);
+
+   if (result == -1) {
+      clear_send_queue(q);
+      return -1;
+   }
+
+   if (q->head) {
+      /* The socket is full.  Everything still queued is waiting on this peer. */
+      for (item = q->head; item; item = item->next) {
+         if (item->queued_at != 0.0)
+            continue;
+         item->queued_at = ldcs_get_time();
+         item->queued_left = item->buf->size - item->buf_pos + item->file_left;
+         if (sendq_procdata) {
+            sendq_procdata->server_stat.sendq.cnt++;
+            sendq_procdata->server_stat.sendq.bytes += item->buf->size - item->buf_pos + item->file_left;
+         }
+      }
+      if (sendq_procdata && (long) q->bytes > sendq_procdata->server_stat.sendq_peak)
+         sendq_procdata->server_stat.sendq_peak = (long) q->bytes;
+      if (sendq_rate > 0.0 && q->tokens <= 0.0)
+         throttle_queue(q);
+      else if (!q->watching)
+         q->watching = (ldcs_listen_register_write_cb(q->fd, sendq_write_cb, NULL) == 0);
+   }
+   else if (q->watching) {
+      ldcs_listen_register_write_cb(q->fd, NULL, NULL);
+      q->watching = 0;
+   }
+   return 0;
+}
+
+static int sendq_write_cb(int fd, int id, void *data)
+{
+   send_queue_t *q = get_send_queue(fd, 0);
+   if (!q)
+      return ldcs_listen_register_write_cb(fd, NULL, NULL);
+   return push_send_queue(q);
+}
+
+/**
+ * Which SENDQ_PRIO_* the message at the start of buf is queued with
+ **/
+static int send_priority(send_buf_t *buf)
+{
+   ldcs_message_t *msg = (ldcs_message_t *) buf->data;
+
+   switch (msg->header.type) {
+      case LDCS_MSG_PRELOAD_FILE:
+      case LDCS_MSG_SELFLOAD_FILE:
+      case LDCS_MSG_FILE_RANGE_PUSH:
+         return SENDQ_PRIO_PRELOAD;
+      case LDCS_MSG_FILE_DATA:
+         return SENDQ_PRIO_DEMAND;
+      case LDCS_MSG_CACHE_ENTRIES:
+      case LDCS_MSG_CACHE_ENTRIES_BATCH:
+      case LDCS_MSG_FILE_REQUEST:
+      case LDCS_MSG_FILE_RANGE_REQUEST:
+      case LDCS_MSG_FILE_RANGE_DATA:
+      case LDCS_MSG_STRIPE_REQUEST:
+      case LDCS_MSG_STRIPE_DATA:
+      case LDCS_MSG_STAT_NET_REQUEST:
+      case LDCS_MSG_STAT_NET_RESULT:
+      case LDCS_MSG_LOADER_DATA_NET_REQ:
+      case LDCS_MSG_LOADER_DATA_NET_RESP:
+      case LDCS_MSG_JOIN_RANK:
+         return SENDQ_PRIO_META;
+      default:
+         return SENDQ_PRIO_ORDERED;
+   }
+}
+
+/**
+ * Link item into q behind every item it may not pass: one that has
+ * started going out, one that keeps its order, or one whose priority
+ * is at least item's.  Returns the number of items passed.
+ **/
+static int insert_send_item(send_queue_t *q, send_item_t *item)
+{
+   send_item_t *cur, *after = NULL;
+   int passed = 0;
+
+   if (item->prio != SENDQ_PRIO_ORDERED) {
+      for (cur = q->head; cur; cur = cur->next) {
+         if (cur->buf_pos || cur->prio == SENDQ_PRIO_ORDERED || cur->prio >= item->prio) {
+            after = cur;
+            passed = 0;
+         }
+         else {
+            passed++;
+         }
+      }
+   }
+   else {
+      after = q->tail;
+   }
+
+   if (!after) {
+      item->next = q->head;
+      q->head = item;
+   }
+   else {
+      item->next = after->next;
+      after->next = item;
+   }
+   if (!item->next)
+      q->tail = item;
+   return passed;
+}
+
+/**
+ * Queue buf, then file_left bytes of file_fd from file_pos, for fd.
+ * Takes a reference to buf and ownership of file_fd.  Returns the queue,
+ * or NULL on error.
+ **/
+static send_queue_t *append_send(int fd, send_buf_t *buf, int file_fd, off_t file_pos, size_t file_left,
+                                 char *file_mem)
+{
+   send_queue_t *q;
+   send_item_t *item;
+
+   q = get_send_queue(fd, 1);
+   item = q ? (send_item_t *) msgpool_alloc(sizeof(send_item_t)) : NULL;
+   if (!item) {
+      err_printf("Could not queue a message for cobo FD %d\n", fd);
+      if (file_fd != -1)
+         close(file_fd);
+      return NULL;
+   }
+   buf->refs++;
+   item->next = NULL;
+   item->buf = buf;
+   item->buf_pos = 0;
+   item->file_fd = file_fd;
+   item->file_pos = file_pos;
+   item->file_left = file_left;
+   item->file_mem = file_mem;
+   item->queued_at = 0.0;
+   item->total = buf->size + file_left;
+   item->prio = send_priority(buf);
+   if (insert_send_item(q, item) && sendq_procdata) {
+      sendq_procdata->server_stat.sendq_jump.cnt++;
+      sendq_procdata->server_stat.sendq_jump.bytes += item->total;
+   }
+   q->bytes += buf->size + file_left;
+
+   return q;
+}
+
+/**
+ * Queue buf, then file_left bytes of file_fd from file_pos, for fd, and
+ * send what we can right away.  file_mem, if not NULL, maps file_fd, to
+ * write from should sendfile fail.  A small message is left for
+ * flush_send_queues instead, while the listen loop is running.
+ **/
+static int queue_send(int fd, send_buf_t *buf, int file_fd, off_t file_pos, size_t file_left,
+                      char *file_mem)
+{
+   send_queue_t *q = append_send(fd, buf, file_fd, file_pos, file_left, file_mem);
+   if (!q)
+      return -1;
+   if (hold_small_sends && !file_left && buf->size <= COALESCE_MAX_SIZE) {
+      if (sendq_procdata) {
+         sendq_procdata->server_stat.coalesce.cnt++;
+         sendq_procdata->server_stat.coalesce.bytes += buf->size;
+      }
+      return 0;
+   }
+   return push_send_queue(q);
+}
+
+/**
+ * Called by the listen loop after each pass, to send the small messages
+ * queue_send held back.  Queues waiting on a full socket are left to
+ * their write callback.
+ **/
+static int flush_send_queues(void *data)
+{
+   int i;
+   for (i = 0; i < num_send_queues; i++) {
+      if (send_queues[i].head && !send_queues[i].watching && send_queues[i].throttled_at == 0.0)
+         push_send_queue(send_queues + i);
+   }
+   return 0;
+}
+
+/**
+ * Called by the listen loop on each bandwidth timer tick, to retry the
+ * queues that went over the limit.
+ **/
+static int bandwidth_timer_cb(int fd, int id, void *data)
+{
+   uint64_t ticks;
+   int i, throttled = 0;
+
+   while (read(fd, &ticks, sizeof(ticks)) == -1 && errno == EINTR);
+   for (i = 0; i < num_send_queues; i++) {
+      if (send_queues[i].throttled_at == 0.0)
+         continue;
+      push_send_queue(send_queues + i);
+      if (send_queues[i].throttled_at != 0.0)
+         throttled = 1;
+   }
+   if (!throttled)
+      arm_bandwidth_timer(0);
+   return 0;
+}
+
+static int open_bandwidth_timer()
+{
+   bandwidth_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (bandwidth_timer_fd == -1) {
+      err_printf("Could not create the bandwidth timer, not limiting bandwidth: %s\n", strerror(errno));
+      return -1;
+   }
+   ldcs_listen_register_fd(bandwidth_timer_fd, 0, &bandwidth_timer_cb, NULL);
+   return 0;
+}
+
+/**
+ * Block until everything queued for fd has been sent.
+ **/
+static int drain_send_queue(int fd)
+{
+   send_queue_t *q = get_send_queue(fd, 0);
+   struct pollfd pfd;
+
+   while (q && q->head) {
+      if (push_send_queue(q) == -1)
+         return -1;
+      if (!q->head)
+         break;
+      if (q->throttled_at != 0.0) {
+         /* Waiting on the bandwidth limit rather than the socket */
+         unthrottle_queue(q);
+         wait_for_tokens(q);
+         continue;
+      }
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+         err_printf("Error polling cobo FD %d: %s\n", fd, strerror(errno));
+         clear_send_queue(q);
+         return -1;
+      }
+   }
+   return 0;
+}
+
+static int drain_all_send_queues()
+{
+   int i, result = 0;
+   for (i = 0; i < num_send_queues; i++) {
+      if (drain_send_queue(send_queues[i].fd) == -1)
+         result = -1;
+   }
+   return result;
+}
+
+/**
+ * write_msg for a peer that may have queued sends.  Small messages go
+ * through the queue, so they can share a write with others.
+ **/
+static int write_peer_msg(int fd, ldcs_message_t *msg)
+{
+   send_buf_t *buf;
+   size_t len = (msg->header.len && msg->data) ? msg->header.len : 0;
+   int result;
+
+   if (hold_small_sends && sizeof(*msg) + len <= COALESCE_MAX_SIZE) {
+      buf = new_send_buf(msg, len, NULL, 0);
+      if (!buf)
+         return -1;
+      result = queue_send(fd, buf, -1, 0, 0, NULL);
+      release_send_buf(buf);
+      return result;
+   }
+   if (drain_send_queue(fd) == -1)
+      return -1;
+   charge_direct(fd, sizeof(*msg) + len);
+   return write_msg(fd, msg);
+}
+
+/**
+ * Read a message from fd.  Its data comes from the message pool, unless
+ * pooled is 0 because the caller keeps it and frees it with free.
+ **/
+static int read_msg(int fd, node_peer_t *peer, ldcs_message_t *msg, int pooled)
+{
+   int result;
+   char *buffer = NULL;
+
+   *peer = (node_peer_t) (long) fd;
+   
+   result = ll_read(fd, msg, sizeof(*msg));
+   if (result == -1)
+      return -1;
+
+   if (msg->header.type == LDCS_MSG_FILE_DATA || msg->header.type == LDCS_MSG_PRELOAD_FILE) {
+      /* Optimization.  Don't read file data into heap, as it could be
+         very large.  For these packets we'll postpone the network read
+         until we have the file's mmap ready, then read it straight
+         into that memory. */
+      msg->data = NULL;
+      return 0;
+   } 
+
+   if (msg->header.len) {
+      buffer = pooled ? (char *) msgpool_alloc(msg->header.len) : (char *) malloc(msg->header.len);
+      if (buffer == NULL) {
+         err_printf("Error allocating space for message from network of size %lu\n", (long) msg->header.len);
+         return -1;
+      }
+      result = ll_read(fd, buffer, msg->header.len);
+      if (result == -1) {
+         if (pooled)
+            msgpool_free(buffer);
+         else
+            free(buffer);
+         return -1;
+      }
+   }
+
+   msg->data = buffer;
+   return 0;
+}
+
+/* The children we started with, which the per-child link tables cover,
+   and whether we joined the tree after startup */
+static int tree_childs = 0;
+static int joined = 0;
+
+int ldcs_audit_server_md_init(unsigned int port, unsigned int num_ports, 
+                              unique_id_t unique_id, ldcs_process_data_t *data)
+{
+   int rc=0;
+   unsigned int *portlist;
+   int my_rank, ranks, fanout;
+   int i;
+
+   portlist = malloc(sizeof(unsigned int) * (num_ports + 1));
+   for (i = 0; i < num_ports; i++) {
+      portlist[i] = port + i;
+   }
+   portlist[num_ports] = 0;
+
+   /* initialize the client (read environment variables) */
+   debug_printf2("Opening cobo with port %d - %d\n", portlist[0], portlist[num_ports-1]);
+   if (cobo_open(unique_id, (int *) portlist, num_ports, &my_rank, &ranks) != COBO_SUCCESS) {
+      printf("Failed to init\n");
+      exit(1);
+   }
+   debug_printf2("cobo_open complete. Cobo rank %d/%d\n", my_rank, ranks);
+   free(portlist);
+
+   data->server_stat.md_rank = data->md_rank = my_rank;
+   data->server_stat.md_size = data->md_size = ranks;
+   data->md_listen_to_parent = 0;
+   sendq_procdata = data;
+
+   cobo_get_num_childs(&fanout);
+   data->server_stat.md_fan_out = data->md_fan_out = fanout;
+   tree_childs = fanout;
+
+   cobo_barrier();
+
+   /* send ack about being ready */
+   if (data->md_rank == 0) { 
+      int root_fd, ack=13;
+
+      /* send fe client signal to stop (ack)  */
+      cobo_get_parent_socket(&root_fd);
+    
+      ldcs_cobo_write_fd(root_fd, &ack, sizeof(ack));
+      debug_printf3("sent FE client signal that server are ready %d\n",ack);
+   }
+  
+   return(rc);
+}
+
+/**
+ * With --elastic, a server started on a node after the job can join the
+ * running tree below a server with room for it (see cobo_accept_join),
+ * taking a rank the root gives out (see handle_join_request).
+ * It reads the job's settings from its new parent, then handle_join's
+ * snapshot of the parent's cache, and takes everything broadcast from
+ * then on.  A joined server has no streams, sibling or bypass links, so
+ * those and their per-child tables only cover the tree we started with.
+ **/
+int ldcs_audit_server_md_join(unsigned int port, unsigned int num_ports, unique_id_t unique_id,
+                              char *hosts, ldcs_process_data_t *data)
+{
+   unsigned int *portlist;
+   char **hostlist, *host, *saveptr = NULL;
+   int num_hosts = 0, my_rank, ranks, i, result;
+
+   portlist = malloc(sizeof(unsigned int) * (num_ports + 1));
+   hostlist = malloc(sizeof(char *) * (strlen(hosts) / 2 + 1));
+   for (i = 0; i < num_ports; i++)
+      portlist[i] = port + i;
+   portlist[num_ports] = 0;
+   for (host = strtok_r(hosts, ",", &saveptr); host; host = strtok_r(NULL, ",", &saveptr))
+      hostlist[num_hosts++] = host;
+
+   debug_printf2("Joining a running server on one of %d hosts with port %d - %d\n", num_hosts,
+                 portlist[0], portlist[num_ports-1]);
+   result = cobo_join(unique_id, (int *) portlist, num_ports, hostlist, num_hosts, &my_rank, &ranks);
+   free(portlist);
+   free(hostlist);
+   if (result != COBO_SUCCESS) {
+      err_printf("Could not join a running server\n");
+      return -1;
+   }
+   debug_printf("Joined the running tree as rank %d\n", my_rank);
+
+   joined = 1;
+   tree_childs = 0;
+   data->server_stat.md_rank = data->md_rank = my_rank;
+   data->server_stat.md_size = data->md_size = ranks;
+   data->server_stat.md_fan_out = data->md_fan_out = 0;
+   data->md_listen_to_parent = 0;
+   sendq_procdata = data;
+   return 0;
+}
+
+static void mark_socket(int fd, int dscp);
+
+/* Servers joining below us, accepted by join_cb and waiting on the rank
+   handle_join_request gets them from the root.  The cobo FD names each. */
+static int *pending_joins = NULL;
+static int num_pending_joins = 0;
+
+static int join_cb(int fd, int id, void *data)
+{
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
+   int child_fd, *newjoins;
+
+   /* Once we've told our parent we're ready to exit, a new child would be left out */
+   if (cobo_accept_join(procdata->sent_exit_ready, &child_fd) != COBO_SUCCESS)
+      return 0;
+   newjoins = (int *) realloc(pending_joins, sizeof(int) * (num_pending_joins + 1));
+   if (!newjoins) {
+      err_printf("Could not allocate room for a joining server\n");
+      cobo_drop_join(child_fd);
+      return 0;
+   }
+   pending_joins = newjoins;
+   pending_joins[num_pending_joins++] = child_fd;
+   debug_printf("A server is joining below us on cobo FD %d\n", child_fd);
+   return handle_join_request(procdata, child_fd);
+}
+
+node_peer_t ldcs_audit_server_md_admit_join ( ldcs_process_data_t *procdata, int request, int rank ) {
+   int i;
+
+   for (i = 0; i < num_pending_joins && pending_joins[i] != request; i++);
+   if (i == num_pending_joins) {
+      err_printf("Got rank %d for a joining server we don't have\n", rank);
+      return NODE_PEER_NULL;
+   }
+   pending_joins[i] = pending_joins[--num_pending_joins];
+
+   if (procdata->sent_exit_ready) {
+      debug_printf("Turning away the server joining on cobo FD %d, since we're ready to exit\n", request);
+      cobo_drop_join(request);
+      return NODE_PEER_NULL;
+   }
+   if (cobo_admit_join(request, rank) != COBO_SUCCESS) {
+      err_printf("Could not give rank %d to the server joining on cobo FD %d\n", rank, request);
+      return NODE_PEER_NULL;
+   }
+   debug_printf("Server %d joined below us on cobo FD %d\n", rank, request);
+   if (procdata->dscp)
+      mark_socket(request, procdata->startup_done == 2 ? DSCP_BACKGROUND : (int) procdata->dscp);
+   enable_zerocopy(request);
+   ldcs_listen_register_fd(request, 0, &ldcs_audit_server_md_cobo_CB, (void *) procdata);
+   return (node_peer_t) (long) request;
+}
+
+/* Sibling links, opened on first use after ldcs_audit_server_md_open_peers below */
+static int *lateral_fds = NULL;    /* by sibling index, -1 if not linked yet */
+static int *lateral_in_fds = NULL; /* by sibling index, the sibling's link when we'd opened our own */
+static int num_lateral = 0;        /* our parent's number of children */
+/* Our grandparent's link, opened when it first sends around our parent */
+static int bypass_parent_fd = -1;  /* our grandparent's link to us, or -1 */
+static void mark_tree_sockets(int dscp);
+static void register_link_listeners(ldcs_process_data_t *procdata);
+static void unregister_link_listeners();
+
+int ldcs_audit_server_md_register_fd ( ldcs_process_data_t *ldcs_process_data ) {
+   int rc=0, i;
+   int parent_fd, child_fd, listen_fd;
+   int num_childs;
+
+   if(cobo_get_parent_socket(&parent_fd)!=COBO_SUCCESS) {
+      err_printf("Error, could not get parent socket\n");
+      assert(0);
+   }
+
+   debug_printf3("Registering fd %d for cobo parent connection\n",parent_fd);
+   enable_zerocopy(parent_fd);
+   ldcs_listen_register_fd(parent_fd, 0, &ldcs_audit_server_md_cobo_CB, (void *) ldcs_process_data);
+   ldcs_process_data->md_listen_to_parent=1;
+   
+   cobo_get_num_childs(&num_childs);
+   for (i = 0; i<num_childs; i++) {
+      cobo_get_child_socket(i, &child_fd);
+      enable_zerocopy(child_fd);
+      ldcs_listen_register_fd(child_fd, 0, &ldcs_audit_server_md_cobo_CB, (void *) ldcs_process_data);
+   }
+   link_wireup(parent_fd, num_childs);
+   register_link_listeners(ldcs_process_data);
+   /* Only there if cobo_open was told the tree is elastic */
+   if (cobo_get_listen_socket(&listen_fd) == COBO_SUCCESS)
+      ldcs_listen_register_fd(listen_fd, 0, &join_cb, (void *) ldcs_process_data);
+
+   if (ldcs_process_data->dscp)
+      mark_tree_sockets((int) ldcs_process_data->dscp);
+   if ((ldcs_process_data->bandwidth || ldcs_process_data->background_bandwidth) &&
+       open_bandwidth_timer() != -1)
+      sendq_rate = ldcs_process_data->bandwidth * 1024.0 * 1024.0;
+
+   /* Anything queued before now (e.g. the settings) can be pushed from the listen loop */
+   for (i = 0; i < num_send_queues; i++)
+      push_send_queue(send_queues + i);
+   ldcs_listen_register_flush_cb(flush_send_queues, NULL);
+   hold_small_sends = 1;
+   
+   return(rc);
+}
+
+#define MAX_STREAMS 16
+
+static uint64_t stream_token()
+{
+   uint64_t token = 0;
+   int fd = open("/dev/urandom", O_RDONLY);
+   if (fd != -1) {
+      if (ll_read(fd, &token, sizeof(token)) == -1)
+         token = 0;
+      close(fd);
+   }
+   if (!token)
+      token = ((uint64_t) getpid() << 32) ^ (uint64_t) (ldcs_get_time() * 1000000.0);
+   return token;
+}
+
+/**
+ * As a child, listen on a new port and tell our parent about it over the
+ * cobo socket, along with a token it proves itself with.  Then accept
+ * the parent's extra streams.
+ **/
+static int accept_parent_streams(int parent_fd, int num_streams, int *streams)
+{
+   struct sockaddr_in addr;
+   socklen_t addr_len = sizeof(addr);
+   uint64_t token = stream_token(), recv_token;
+   int listen_fd, port, fd, idx, accepted = 1;
+
+   listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (listen_fd == -1) {
+      err_printf("Could not create stream socket: %s\n", strerror(errno));
+      return -1;
+   }
+   /* Accepted sockets inherit its buffer sizes */
+   cobo_opt_socket(listen_fd);
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_ANY);
+   addr.sin_port = 0;
+   if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+       listen(listen_fd, num_streams) == -1 ||
+       getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len) == -1) {
+      err_printf("Could not listen for streams from parent: %s\n", strerror(errno));
+      close(listen_fd);
+      return -1;
+   }
+   port = ntohs(addr.sin_port);
+   debug_printf2("Listening for %d streams from parent on port %d\n", num_streams - 1, port);
+
+   if (ll_write(parent_fd, &port, sizeof(port)) == -1 ||
+       ll_write(parent_fd, &token, sizeof(token)) == -1) {
+      err_printf("Could not send stream port to parent\n");
+      close(listen_fd);
+      return -1;
+   }
+
+   streams[0] = parent_fd;
+   for (idx = 1; idx < num_streams; idx++)
+      streams[idx] = -1;
+   while (accepted < num_streams) {
+      fd = accept(listen_fd, NULL, NULL);
+      if (fd == -1) {
+         if (errno == EINTR)
+            continue;
+         err_printf("Could not accept stream from parent: %s\n", strerror(errno));
+         close(listen_fd);
+         return -1;
+      }
+      if (ll_read(fd, &recv_token, sizeof(recv_token)) == -1 ||
+          ll_read(fd, &idx, sizeof(idx)) == -1 ||
+          recv_token != token || idx < 1 || idx >= num_streams || streams[idx] != -1) {
+         debug_printf("Dropping stream connection that didn't come from our parent\n");
+         close(fd);
+         continue;
+      }
+      cobo_opt_socket(fd);
+      enable_zerocopy(fd);
+      streams[idx] = fd;
+      accepted++;
+   }
+   close(listen_fd);
+   return 0;
+}
+
+/**
+ * As a parent, connect the extra streams to a child at the address of its
+ * cobo socket.
+ **/
+static int connect_child_streams(int child_fd, int num_streams, int *streams)
+{
+   struct sockaddr_in addr;
+   socklen_t addr_len = sizeof(addr);
+   uint64_t token;
+   int port, fd, idx;
+
+   if (ll_read(child_fd, &port, sizeof(port)) == -1 ||
+       ll_read(child_fd, &token, sizeof(token)) == -1) {
+      err_printf("Could not read stream port from child\n");
+      return -1;
+   }
+   if (getpeername(child_fd, (struct sockaddr *) &addr, &addr_len) == -1) {
+      err_printf("Could not get address of child: %s\n", strerror(errno));
+      return -1;
+   }
+   addr.sin_port = htons(port);
+
+   streams[0] = child_fd;
+   for (idx = 1; idx < num_streams; idx++) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+         err_printf("Could not connect stream %d to child: %s\n", idx, strerror(errno));
+         if (fd != -1)
+            close(fd);
+         return -1;
+      }
+      if (ll_write(fd, &token, sizeof(token)) == -1 || ll_write(fd, &idx, sizeof(idx)) == -1) {
+         err_printf("Could not send token on stream %d to child\n", idx);
+         close(fd);
+         return -1;
+      }
+      cobo_opt_socket(fd);
+      enable_zerocopy(fd);
+      streams[idx] = fd;
+   }
+   return 0;
+}
+
+int ldcs_audit_server_md_open_streams ( ldcs_process_data_t *ldcs_process_data ) {
+   int num_streams = (int) ldcs_process_data->num_streams;
+   int num_childs, parent_fd, child_fd, i;
+   int *streams;
+
+   if (num_streams <= 1 || joined)
+      return 0;
+   if (num_streams > MAX_STREAMS) {
+      /* Every server clamps the same way, so both ends of an edge agree */
+      debug_printf("Limiting streams to %d\n", MAX_STREAMS);
+      num_streams = MAX_STREAMS;
+   }
+
+   cobo_get_num_childs(&num_childs);
+   peer_streams = (peer_streams_t *) calloc(num_childs + 1, sizeof(peer_streams_t));
+   if (!peer_streams) {
+      err_printf("Could not allocate stream table\n");
+      return -1;
+   }
+
+   /* Our parent's streams are wired up before we wire up our children's */
+   if (ldcs_process_data->md_rank != 0) {
+      cobo_get_parent_socket(&parent_fd);
+      streams = (int *) malloc(sizeof(int) * num_streams);
+      if (!streams || accept_parent_streams(parent_fd, num_streams, streams) == -1) {
+         free(streams);
+         return -1;
+      }
+      peer_streams[num_peer_streams].fd = parent_fd;
+      peer_streams[num_peer_streams].streams = streams;
+      peer_streams[num_peer_streams].num_streams = num_streams;
+      num_peer_streams++;
+   }
+
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &child_fd);
+      streams = (int *) malloc(sizeof(int) * num_streams);
+      if (!streams || connect_child_streams(child_fd, num_streams, streams) == -1) {
+         free(streams);
+         return -1;
+      }
+      peer_streams[num_peer_streams].fd = child_fd;
+      peer_streams[num_peer_streams].streams = streams;
+      peer_streams[num_peer_streams].num_streams = num_streams;
+      num_peer_streams++;
+   }
+
+   debug_printf2("Opened %d streams to each of %d neighboring servers\n", num_streams, num_peer_streams);
+   return 0;
+}
+
+/**
+ * With --peers, each server also links to the siblings within lateral_peers
+ * places of it around our parent's list of children.  A parent can then
+ * have a child that already holds a file send it to a linked sibling,
+ * instead of sending it again itself.  The parent hands out the sibling
+ * addresses over the cobo sockets at startup, but a link is only
+ * connected the first time one of the pair sends over it, so jobs that
+ * never pass a file sideways never pay for the links.  Each server keeps
+ * listening for its siblings from the listen loop.  Either side of a pair
+ * may connect; if both do at once, each sends over the link it opened
+ * and reads from both.
+ **/
+#define MAX_PEERS 16
+
+static int lateral_links = 0;      /* the lateral_peers in effect */
+static int lateral_index = -1;     /* our own sibling index */
+static int lateral_listen_fd = -1;
+static uint64_t lateral_token;
+
+typedef struct {
+   uint32_t addr;    /* network order */
+   int port;         /* 0 once connecting to it has failed */
+   uint64_t token;
+} sibling_addr_t;
+
+static sibling_addr_t *lateral_addrs = NULL;
+
+static int clamp_links(ldcs_process_data_t *ldcs_process_data)
+{
+   int links = (int) ldcs_process_data->lateral_peers;
+   return links > MAX_PEERS ? MAX_PEERS : links;
+}
+
+/**
+ * True if siblings a and b, of count, are linked.
+ **/
+static int siblings_linked(int a, int b, int count, int links)
+{
+   int dist = a > b ? a - b : b - a;
+   if (a == b || a < 0 || b < 0)
+      return 0;
+   if (count - dist < dist)
+      dist = count - dist;
+   return dist <= links;
+}
+
+/**
+ * Listen on a port of our own for a server that links to us later.
+ **/
+static int listen_for_link(int backlog, int *port, const char *what)
+{
+   struct sockaddr_in addr;
+   socklen_t addr_len = sizeof(addr);
+   int listen_fd;
+
+   listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (listen_fd == -1) {
+      err_printf("Could not create socket for our %s: %s\n", what, strerror(errno));
+      return -1;
+   }
+   /* Accepted sockets inherit its buffer sizes */
+   cobo_opt_socket(listen_fd);
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_ANY);
+   addr.sin_port = 0;
+   if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+       listen(listen_fd, backlog) == -1 ||
+       getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len) == -1) {
+      err_printf("Could not listen for our %s: %s\n", what, strerror(errno));
+      close(listen_fd);
+      return -1;
+   }
+   *port = ntohs(addr.sin_port);
+   return listen_fd;
+}
+
+/**
+ * Connect to a server that listens for us at to, and send its token, and
+ * our index if it isn't -1.  A failed connect isn't retried.
+ **/
+static int connect_link(ldcs_process_data_t *procdata, sibling_addr_t *to, int index, const char *what)
+{
+   struct sockaddr_in addr;
+   int fd;
+
+   if (!to->port)
+      return -1;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = to->addr;
+   addr.sin_port = htons(to->port);
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+      err_printf("Could not connect to %s: %s\n", what, strerror(errno));
+      goto error;
+   }
+   if (ll_write(fd, &to->token, sizeof(to->token)) == -1 ||
+       (index != -1 && ll_write(fd, &index, sizeof(index)) == -1)) {
+      err_printf("Could not send token to %s\n", what);
+      goto error;
+   }
+   cobo_opt_socket(fd);
+   enable_zerocopy(fd);
+   if (procdata->dscp)
+      mark_socket(fd, procdata->startup_done == 2 ? DSCP_BACKGROUND : (int) procdata->dscp);
+   return fd;
+
+  error:
+   if (fd != -1)
+      close(fd);
+   to->port = 0;
+   return -1;
+}
+
+/**
+ * As a child, tell our parent where we listen for siblings and read back
+ * the addresses of all of them.
+ **/
+static int read_sibling_table(int parent_fd)
+{
+   int port, i;
+
+   lateral_token = stream_token();
+   lateral_listen_fd = listen_for_link(MAX_PEERS * 2, &port, "siblings");
+   if (lateral_listen_fd == -1)
+      return -1;
+
+   if (ll_write(parent_fd, &port, sizeof(port)) == -1 ||
+       ll_write(parent_fd, &lateral_token, sizeof(lateral_token)) == -1) {
+      err_printf("Could not send peer port to parent\n");
+      return -1;
+   }
+   if (ll_read(parent_fd, &lateral_index, sizeof(lateral_index)) == -1 ||
+       ll_read(parent_fd, &num_lateral, sizeof(num_lateral)) == -1 ||
+       ll_read(parent_fd, &lateral_links, sizeof(lateral_links)) == -1 ||
+       num_lateral < 1 || lateral_index < 0 || lateral_index >= num_lateral) {
+      err_printf("Could not read sibling table from parent\n");
+      num_lateral = 0;
+      return -1;
+   }
+   lateral_addrs = (sibling_addr_t *) malloc(sizeof(sibling_addr_t) * num_lateral);
+   lateral_fds = (int *) malloc(sizeof(int) * num_lateral);
+   lateral_in_fds = (int *) malloc(sizeof(int) * num_lateral);
+   if (!lateral_addrs || !lateral_fds || !lateral_in_fds) {
+      err_printf("Could not allocate sibling table\n");
+      num_lateral = 0;
+      return -1;
+   }
+   for (i = 0; i < num_lateral; i++)
+      lateral_fds[i] = lateral_in_fds[i] = -1;
+   if (ll_read(parent_fd, lateral_addrs, sizeof(sibling_addr_t) * num_lateral) == -1) {
+      err_printf("Could not read sibling table from parent\n");
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * A sibling is linking up with us.
+ **/
+static int sibling_accept_cb(int fd, int id, void *data)
+{
+   uint64_t recv_token;
+   int new_fd, i;
+
+   new_fd = accept(fd, NULL, NULL);
+   if (new_fd == -1) {
+      if (errno != EINTR && errno != EAGAIN)
+         err_printf("Could not accept sibling connection: %s\n", strerror(errno));
+      return 0;
+   }
+   if (ll_read(new_fd, &recv_token, sizeof(recv_token)) == -1 ||
+       ll_read(new_fd, &i, sizeof(i)) == -1 ||
+       recv_token != lateral_token || i < 0 || i >= num_lateral || lateral_in_fds[i] != -1 ||
+       !siblings_linked(lateral_index, i, num_lateral, lateral_links)) {
+      debug_printf("Dropping peer connection that didn't come from a sibling\n");
+      close(new_fd);
+      return 0;
+   }
+   cobo_opt_socket(new_fd);
+   enable_zerocopy(new_fd);
+   if (sendq_procdata && sendq_procdata->dscp)
+      mark_socket(new_fd, sendq_procdata->startup_done == 2 ? DSCP_BACKGROUND : (int) sendq_procdata->dscp);
+   if (lateral_fds[i] == -1)
+      lateral_fds[i] = new_fd;
+   else
+      lateral_in_fds[i] = new_fd;
+   debug_printf2("Sibling %d linked up with us on FD %d\n", i, new_fd);
+   ldcs_listen_register_fd(new_fd, 0, &ldcs_audit_server_md_cobo_CB, data);
+   return 0;
+}
+
+/**
+ * As a parent, collect where each child listens for its siblings and send
+ * every child the whole table.
+ **/
+static int send_sibling_tables(int num_childs, int links)
+{
+   struct sockaddr_in addr;
+   socklen_t addr_len;
+   sibling_addr_t *siblings;
+   int i, child_fd, result = 0;
+
+   siblings = (sibling_addr_t *) malloc(sizeof(sibling_addr_t) * num_childs);
+   if (!siblings) {
+      err_printf("Could not allocate sibling table\n");
+      return -1;
+   }
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &child_fd);
+      addr_len = sizeof(addr);
+      if (ll_read(child_fd, &siblings[i].port, sizeof(siblings[i].port)) == -1 ||
+          ll_read(child_fd, &siblings[i].token, sizeof(siblings[i].token)) == -1 ||
+          getpeername(child_fd, (struct sockaddr *) &addr, &addr_len) == -1) {
+         err_printf("Could not read peer port from child %d\n", i);
+         free(siblings);
+         return -1;
+      }
+      siblings[i].addr = addr.sin_addr.s_addr;
+   }
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &child_fd);
+      if (ll_write(child_fd, &i, sizeof(i)) == -1 ||
+          ll_write(child_fd, &num_childs, sizeof(num_childs)) == -1 ||
+          ll_write(child_fd, &links, sizeof(links)) == -1 ||
+          ll_write(child_fd, siblings, sizeof(sibling_addr_t) * num_childs) == -1) {
+         err_printf("Could not send sibling table to child %d\n", i);
+         result = -1;
+      }
+   }
+   free(siblings);
+   return result;
+}
+
+int ldcs_audit_server_md_open_peers ( ldcs_process_data_t *ldcs_process_data ) {
+   int links = clamp_links(ldcs_process_data);
+   int num_childs, parent_fd, i, linked = 0;
+
+   if (links <= 0 || joined)
+      return 0;
+
+   /* As with the streams, our own table comes down before our children's */
+   if (ldcs_process_data->md_rank != 0) {
+      cobo_get_parent_socket(&parent_fd);
+      if (read_sibling_table(parent_fd) == -1)
+         return -1;
+      for (i = 0; i < num_lateral; i++) {
+         if (siblings_linked(lateral_index, i, num_lateral, lateral_links))
+            linked++;
+      }
+   }
+
+   cobo_get_num_childs(&num_childs);
+   if (num_childs && send_sibling_tables(num_childs, links) == -1)
+      return -1;
+
+   debug_printf2("Can link to %d of %d siblings when first needed\n", linked, num_lateral);
+   return 0;
+}
+
+int ldcs_audit_server_md_get_child_index ( ldcs_process_data_t *ldcs_process_data, node_peer_t child ) {
+   int num_childs, i, fd;
+
+   cobo_get_num_childs(&num_childs);
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &fd);
+      if ((node_peer_t) (long) fd == child)
+         return i;
+   }
+   return -1;
+}
+
+int ldcs_audit_server_md_child_joined ( ldcs_process_data_t *ldcs_process_data, node_peer_t child ) {
+   return ldcs_audit_server_md_get_child_index(ldcs_process_data, child) >= tree_childs;
+}
+
+int ldcs_audit_server_md_children_linked ( ldcs_process_data_t *ldcs_process_data, node_peer_t a, node_peer_t b ) {
+   int a_index = ldcs_audit_server_md_get_child_index(ldcs_process_data, a);
+   int b_index = ldcs_audit_server_md_get_child_index(ldcs_process_data, b);
+   if (a_index >= tree_childs || b_index >= tree_childs)
+      return 0;
+   return siblings_linked(a_index, b_index, tree_childs, clamp_links(ldcs_process_data));
+}
+
+node_peer_t ldcs_audit_server_md_get_sibling ( ldcs_process_data_t *ldcs_process_data, int sibling ) {
+   char what[64];
+   int fd;
+
+   if (sibling < 0 || sibling >= num_lateral)
+      return NODE_PEER_NULL;
+   if (lateral_fds[sibling] != -1)
+      return (node_peer_t) (long) lateral_fds[sibling];
+   if (!siblings_linked(lateral_index, sibling, num_lateral, lateral_links))
+      return NODE_PEER_NULL;
+
+   snprintf(what, sizeof(what), "sibling %d", sibling);
+   fd = connect_link(ldcs_process_data, lateral_addrs + sibling, lateral_index, what);
+   if (fd == -1)
+      return NODE_PEER_NULL;
+   debug_printf2("Linked up with sibling %d on FD %d\n", sibling, fd);
+   lateral_fds[sibling] = fd;
+   ldcs_listen_register_fd(fd, 0, &ldcs_audit_server_md_cobo_CB, (void *) ldcs_process_data);
+   return (node_peer_t) (long) fd;
+}
+
+size_t ldcs_audit_server_md_get_queued ( ldcs_process_data_t *ldcs_process_data, node_peer_t peer ) {
+   size_t bytes = 0;
+   int i;
+   for (i = 0; i < num_send_queues; i++) {
+      if (peer == NODE_PEER_ALL || (node_peer_t) (long) send_queues[i].fd == peer)
+         bytes += send_queues[i].bytes;
+   }
+   return bytes;
+}
+
+/**
+ * With --bypass-slow, each server can also link to its children's
+ * children, so it can send around a child that's falling behind.
+ * Children pass up where they listen, and each parent passes its
+ * children's addresses up to its own parent.  Every step only waits on
+ * the servers below, so this can't deadlock.  The grandparent only
+ * connects when it first finds a child slow, so most links are never
+ * opened.
+ **/
+static int *bypass_fds = NULL;      /* our links to our children's children, -1 if not linked yet */
+static sibling_addr_t *bypass_addrs = NULL; /* and where they listen for us */
+static int *bypass_first = NULL;    /* by child, its first entry in bypass_fds; num_childs+1 entries */
+static int bypass_listen_fd = -1;   /* where we wait for it */
+static uint64_t bypass_token;
+
+/**
+ * Our grandparent is linking up with us, to send around our parent.
+ **/
+static int grandparent_accept_cb(int fd, int id, void *data)
+{
+   uint64_t recv_token;
+   int new_fd;
+
+   new_fd = accept(fd, NULL, NULL);
+   if (new_fd == -1) {
+      if (errno != EINTR && errno != EAGAIN)
+         err_printf("Could not accept our grandparent's connection: %s\n", strerror(errno));
+      return 0;
+   }
+   if (ll_read(new_fd, &recv_token, sizeof(recv_token)) == -1 || recv_token != bypass_token ||
+       bypass_parent_fd != -1) {
+      debug_printf("Dropping bypass connection that didn't come from our grandparent\n");
+      close(new_fd);
+      return 0;
+   }
+   cobo_opt_socket(new_fd);
+   enable_zerocopy(new_fd);
+   if (sendq_procdata && sendq_procdata->dscp)
+      mark_socket(new_fd, sendq_procdata->startup_done == 2 ? DSCP_BACKGROUND : (int) sendq_procdata->dscp);
+   bypass_parent_fd = new_fd;
+   debug_printf2("Our grandparent linked up with us on FD %d\n", new_fd);
+   ldcs_listen_register_fd(new_fd, 0, &ldcs_audit_server_md_cobo_CB, data);
+
+   /* We only have the one grandparent */
+   ldcs_listen_unregister_fd(fd);
+   close(fd);
+   bypass_listen_fd = -1;
+   return 0;
+}
+
+int ldcs_audit_server_md_open_bypass ( ldcs_process_data_t *ldcs_process_data ) {
+   struct sockaddr_in addr;
+   socklen_t addr_len;
+   sibling_addr_t *children = NULL;
+   int num_childs, parent_fd = -1, child_fd, port, *newfds;
+   sibling_addr_t *newaddrs;
+   int has_grandparent = 0, has_parent, count, total, i, j, result = -1;
+
+   if (!(ldcs_process_data->opts & OPT_BYPASSSLOW) || joined)
+      return 0;
+
+   cobo_get_num_childs(&num_childs);
+   has_parent = (ldcs_process_data->md_rank != 0);
+   if (has_parent) {
+      cobo_get_parent_socket(&parent_fd);
+      bypass_token = stream_token();
+      bypass_listen_fd = listen_for_link(1, &port, "grandparent");
+      if (bypass_listen_fd == -1)
+         return -1;
+      if (ll_write(parent_fd, &port, sizeof(port)) == -1 ||
+          ll_write(parent_fd, &bypass_token, sizeof(bypass_token)) == -1 ||
+          ll_read(parent_fd, &has_grandparent, sizeof(has_grandparent)) == -1) {
+         err_printf("Could not exchange bypass port with parent\n");
+         goto done;
+      }
+   }
+
+   /* Tell our children whether they have a grandparent, and where they listen to ours */
+   children = (sibling_addr_t *) malloc(sizeof(sibling_addr_t) * (num_childs ? num_childs : 1));
+   bypass_first = (int *) malloc(sizeof(int) * (num_childs + 1));
+   if (!children || !bypass_first) {
+      err_printf("Could not allocate bypass table\n");
+      goto done;
+   }
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &child_fd);
+      addr_len = sizeof(addr);
+      if (ll_read(child_fd, &children[i].port, sizeof(children[i].port)) == -1 ||
+          ll_read(child_fd, &children[i].token, sizeof(children[i].token)) == -1 ||
+          getpeername(child_fd, (struct sockaddr *) &addr, &addr_len) == -1 ||
+          ll_write(child_fd, &has_parent, sizeof(has_parent)) == -1) {
+         err_printf("Could not exchange bypass port with child %d\n", i);
+         goto done;
+      }
+      children[i].addr = addr.sin_addr.s_addr;
+   }
+   if (has_parent) {
+      if (ll_write(parent_fd, &num_childs, sizeof(num_childs)) == -1 ||
+          (num_childs && ll_write(parent_fd, children, sizeof(sibling_addr_t) * num_childs) == -1)) {
+         err_printf("Could not send our children's bypass ports to our parent\n");
+         goto done;
+      }
+   }
+
+   /* Note where each child's children listen, for when we need them */
+   total = 0;
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &child_fd);
+      bypass_first[i] = total;
+      if (ll_read(child_fd, &count, sizeof(count)) == -1 || count < 0) {
+         err_printf("Could not read bypass table from child %d\n", i);
+         goto done;
+      }
+      if (!count)
+         continue;
+      newfds = (int *) realloc(bypass_fds, sizeof(int) * (total + count));
+      if (newfds)
+         bypass_fds = newfds;
+      newaddrs = (sibling_addr_t *) realloc(bypass_addrs, sizeof(sibling_addr_t) * (total + count));
+      if (newaddrs)
+         bypass_addrs = newaddrs;
+      if (!newfds || !newaddrs) {
+         err_printf("Could not allocate bypass table\n");
+         goto done;
+      }
+      if (ll_read(child_fd, bypass_addrs + total, sizeof(sibling_addr_t) * count) == -1) {
+         err_printf("Could not read bypass table from child %d\n", i);
+         goto done;
+      }
+      for (j = 0; j < count; j++)
+         bypass_fds[total++] = -1;
+   }
+   bypass_first[num_childs] = total;
+
+   debug_printf2("Can link to %d grandchildren%s when first needed\n", total,
+                 has_grandparent ? ", and our grandparent to us," : "");
+   result = 0;
+
+  done:
+   if (bypass_listen_fd != -1 && (result == -1 || !has_grandparent)) {
+      close(bypass_listen_fd);
+      bypass_listen_fd = -1;
+   }
+   free(children);
+   if (result == -1) {
+      free(bypass_first);
+      bypass_first = NULL;
+   }
+   return result;
+}
+
+/**
+ * Link up with the children of child, if we haven't yet.
+ **/
+static int link_grandchildren(ldcs_process_data_t *procdata, int child)
+{
+   char what[64];
+   int i;
+
+   for (i = bypass_first[child]; i < bypass_first[child+1]; i++) {
+      if (bypass_fds[i] != -1)
+         continue;
+      snprintf(what, sizeof(what), "a grandchild under child %d", child);
+      bypass_fds[i] = connect_link(procdata, bypass_addrs + i, -1, what);
+      if (bypass_fds[i] == -1)
+         return -1;
+      debug_printf2("Linked up with a grandchild under child %d on FD %d\n", child, bypass_fds[i]);
+   }
+   return 0;
+}
+
+/**
+ * The listen sockets for the links above that others open to us.
+ **/
+static void register_link_listeners(ldcs_process_data_t *procdata)
+{
+   if (lateral_listen_fd != -1)
+      ldcs_listen_register_fd(lateral_listen_fd, 0, &sibling_accept_cb, (void *) procdata);
+   if (bypass_listen_fd != -1)
+      ldcs_listen_register_fd(bypass_listen_fd, 0, &grandparent_accept_cb, (void *) procdata);
+}
+
+static void unregister_link_listeners()
+{
+   if (lateral_listen_fd != -1) {
+      ldcs_listen_unregister_fd(lateral_listen_fd);
+      close(lateral_listen_fd);
+      lateral_listen_fd = -1;
+   }
+   if (bypass_listen_fd != -1) {
+      ldcs_listen_unregister_fd(bypass_listen_fd);
+      close(bypass_listen_fd);
+      bypass_listen_fd = -1;
+   }
+}
+
+static int compare_delays(const void *a, const void *b)
+{
+   double da = *(const double *) a, db = *(const double *) b;
+   return (da > db) - (da < db);
+}
+
+/**
+ * True if sends to child have been waiting STRAGGLER_FACTOR times as long
+ * as the median of its siblings'.
+ **/
+static int child_is_slow(int num_childs, int child_fd)
+{
+   send_queue_t *q = get_send_queue(child_fd, 0), *sq;
+   double *delays, median;
+   int i, n = 0, fd;
+
+   if (!q || q->samples < STRAGGLER_MIN_SAMPLES || q->delay < STRAGGLER_MIN_DELAY || num_childs < 2)
+      return 0;
+   delays = (double *) malloc(sizeof(double) * num_childs);
+   if (!delays)
+      return 0;
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &fd);
+      sq = get_send_queue(fd, 0);
+      if (fd == child_fd || !sq || sq->samples < STRAGGLER_MIN_SAMPLES)
+         continue;
+      delays[n++] = sq->delay;
+   }
+   if (!n) {
+      free(delays);
+      return 0;
+   }
+   qsort(delays, n, sizeof(double), compare_delays);
+   median = delays[n / 2];
+   free(delays);
+   return q->delay > median * STRAGGLER_FACTOR;
+}
 
-   *peer = (node_peer_t) (long) fd;
-   
-   result = ll_read(fd, msg, sizeof(*msg));
-   if (result == -1)
-      return -1;
+int ldcs_audit_server_md_bypass_slow ( ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                       int file_fd, void *secondary_data, size_t secondary_size ) {
+   int num_childs, child_fd, i, sent = 0;
 
-   if (msg->header.type == LDCS_MSG_FILE_DATA || msg->header.type == LDCS_MSG_PRELOAD_FILE) {
-      /* Optimization.  Don't read file data into heap, as it could be
-         very large.  For these packets we'll postpone the network read
-         until we have the file's mmap ready, then read it straight
-         into that memory. */
-      msg->data = NULL;
+   if (!bypass_first || !bypass_fds)
       return 0;
-   } 
-
-   if (msg->header.len) {
-      buffer = (char *) malloc(msg->header.len);
-      if (buffer == NULL) {
-         err_printf("Error allocating space for message from network of size %lu\n", (long) msg->header.len);
-         return -1;
+   cobo_get_num_childs(&num_childs);
+   for (i = 0; i < tree_childs; i++) {
+      if (bypass_first[i] == bypass_first[i+1])
+         continue;
+      cobo_get_child_socket(i, &child_fd);
+      if (!child_is_slow(num_childs, child_fd))
+         continue;
+      if (link_grandchildren(ldcs_process_data, i) == -1) {
+         debug_printf("Could not link up with child %d's children, not sending around it\n", i);
+         continue;
       }
-      result = ll_read(fd, buffer, msg->header.len);
-      if (result == -1) {
-         free(buffer);
+      debug_printf2("Child %d is lagging, sending to its %d children directly\n", i,
+                    bypass_first[i+1] - bypass_first[i]);
+      if (queue_noncontig_file(bypass_fds + bypass_first[i], bypass_first[i+1] - bypass_first[i],
+                               msg, file_fd, secondary_data, secondary_size) == -1)
          return -1;
-      }
+      sent += bypass_first[i+1] - bypass_first[i];
    }
+   return sent;
+}
 
-   msg->data = buffer;
-   return 0;
+/**
+ * With --dscp, every link to another server is marked with the DSCP
+ * value, which goes in the top six bits of the IP TOS byte.  Linux sets
+ * the socket's priority from it as well.
+ **/
+static void mark_socket(int fd, int dscp)
+{
+   int tos = dscp << 2;
+   if (fd == -1)
+      return;
+   if (setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == -1)
+      debug_printf("Could not mark cobo FD %d with DSCP %d: %s\n", fd, dscp, strerror(errno));
 }
 
-int ldcs_audit_server_md_init(unsigned int port, unsigned int num_ports, 
-                              unique_id_t unique_id, ldcs_process_data_t *data)
+static void mark_tree_sockets(int dscp)
 {
-   int rc=0;
-   unsigned int *portlist;
-   int my_rank, ranks, fanout;
-   int i;
+   int fd, i, j, num_childs = 0;
 
-   portlist = malloc(sizeof(unsigned int) * (num_ports + 1));
-   for (i = 0; i < num_ports; i++) {
-      portlist[i] = port + i;
+   if (cobo_get_parent_socket(&fd) == COBO_SUCCESS)
+      mark_socket(fd, dscp);
+   cobo_get_num_childs(&num_childs);
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &fd);
+      mark_socket(fd, dscp);
    }
-   portlist[num_ports] = 0;
-
-   /* initialize the client (read environment variables) */
-   debug_printf2("Opening cobo with port %d - %d\n", portlist[0], portlist[num_ports-1]);
-   if (cobo_open(unique_id, (int *) portlist, num_ports, &my_rank, &ranks) != COBO_SUCCESS) {
-      printf("Failed to init\n");
-      exit(1);
+   for (i = 0; i < num_peer_streams; i++) {
+      for (j = 1; j < peer_streams[i].num_streams; j++)
+         mark_socket(peer_streams[i].streams[j], dscp);
    }
-   debug_printf2("cobo_open complete. Cobo rank %d/%d\n", my_rank, ranks);
-   free(portlist);
-
-   data->server_stat.md_rank = data->md_rank = my_rank;
-   data->server_stat.md_size = data->md_size = ranks;
-   data->md_listen_to_parent = 0;
-
-   cobo_get_num_childs(&fanout);
-   data->server_stat.md_fan_out = data->md_fan_out = fanout;
+   for (i = 0; i < num_lateral; i++) {
+      mark_socket(lateral_fds[i], dscp);
+      mark_socket(lateral_in_fds[i], dscp);
+   }
+   mark_socket(bypass_parent_fd, dscp);
+   if (bypass_first && bypass_fds) {
+      for (i = 0; i < bypass_first[tree_childs]; i++)
+         mark_socket(bypass_fds[i], dscp);
+   }
+}
 
-   cobo_barrier();
+int ldcs_audit_server_md_set_background ( ldcs_process_data_t *ldcs_process_data ) {
+   if (ldcs_process_data->background_bandwidth && bandwidth_timer_fd != -1) {
+      debug_printf("Job startup is done, limiting sends to %u MB/s\n",
+                   ldcs_process_data->background_bandwidth);
+      sendq_rate = ldcs_process_data->background_bandwidth * 1024.0 * 1024.0;
+   }
+   if (ldcs_process_data->dscp) {
+      debug_printf("Job startup is done, marking our traffic low priority\n");
+      mark_tree_sockets(DSCP_BACKGROUND);
+   }
+   return 0;
+}
 
-   /* send ack about being ready */
-   if (data->md_rank == 0) { 
-      int root_fd, ack=13;
+int ldcs_audit_server_md_print_links ( ldcs_process_data_t *ldcs_process_data ) {
+   int i, j, num_childs = 0, fd;
+   char role[32];
 
-      /* send fe client signal to stop (ack)  */
-      cobo_get_parent_socket(&root_fd);
-    
-      ldcs_cobo_write_fd(root_fd, &ack, sizeof(ack));
-      debug_printf3("sent FE client signal that server are ready %d\n",ack);
+   cobo_get_num_childs(&num_childs);
+   for (i = 0; i < num_links; i++) {
+      if (!links[i].samples)
+         continue;
+      if (cobo_get_parent_socket(&fd) == COBO_SUCCESS && fd == links[i].fd)
+         strcpy(role, "parent");
+      else {
+         snprintf(role, sizeof(role), "peer");
+         for (j = 0; j < num_childs; j++) {
+            if (cobo_get_child_socket(j, &fd) == COBO_SUCCESS && fd == links[i].fd) {
+               snprintf(role, sizeof(role), "child %d", j);
+               break;
+            }
+         }
+      }
+      debug_printf("SERVER[%02d] STAT:  %-10s, %-8s rtt=%8.3f ms, rate=%8.2f MB/s, chunk=%5lu KB, "
+                   "depth=%2d, sndbuf=%6d KB, rcvbuf=%6d KB\n",
+                   ldcs_process_data->md_rank, "link", role, links[i].rtt * 1000.0,
+                   links[i].rate / (1024.0 * 1024.0), (unsigned long) links[i].chunk / 1024,
+                   links[i].depth, links[i].sndbuf / 1024, links[i].rcvbuf / 1024);
    }
-  
-   return(rc);
+   return 0;
 }
 
-int ldcs_audit_server_md_register_fd ( ldcs_process_data_t *ldcs_process_data ) {
-   int rc=0, i;
-   int parent_fd, child_fd;
-   int num_childs;
+int ldcs_audit_server_md_set_bandwidth ( ldcs_process_data_t *ldcs_process_data ) {
+   unsigned int limit = ldcs_process_data->bandwidth;
+   int i;
 
-   if(cobo_get_parent_socket(&parent_fd)!=COBO_SUCCESS) {
-      err_printf("Error, could not get parent socket\n");
-      assert(0);
+   if (ldcs_process_data->startup_done == 2 && ldcs_process_data->background_bandwidth)
+      limit = ldcs_process_data->background_bandwidth;
+   if (!limit && bandwidth_timer_fd == -1)
+      return 0;
+   if (bandwidth_timer_fd == -1 && open_bandwidth_timer() == -1)
+      return -1;
+
+   sendq_rate = limit * 1024.0 * 1024.0;
+   if (limit) {
+      /* Queues waiting on the old limit are retried on the timer's next tick */
+      debug_printf("Limiting sends to %u MB/s\n", limit);
+      return 0;
    }
 
-   debug_printf3("Registering fd %d for cobo parent connection\n",parent_fd);
-   ldcs_listen_register_fd(parent_fd, 0, &ldcs_audit_server_md_cobo_CB, (void *) ldcs_process_data);
-   ldcs_process_data->md_listen_to_parent=1;
-   
-   cobo_get_num_childs(&num_childs);
-   for (i = 0; i<num_childs; i++) {
-      cobo_get_child_socket(i, &child_fd);
-      ldcs_listen_register_fd(child_fd, 0, &ldcs_audit_server_md_cobo_CB, (void *) ldcs_process_data);
+   debug_printf("No longer limiting sends\n");
+   for (i = 0; i < num_send_queues; i++) {
+      if (send_queues[i].throttled_at == 0.0)
+         continue;
+      unthrottle_queue(send_queues + i);
+      push_send_queue(send_queues + i);
    }
-   
-   return(rc);
+   arm_bandwidth_timer(0);
+   return 0;
 }
 
 int ldcs_audit_server_md_unregister_fd ( ldcs_process_data_t *ldcs_process_data ) {
    int rc=0, i;
-   int parent_fd, child_fd;
+   int parent_fd, child_fd, listen_fd;
    int num_childs;
    if(ldcs_process_data->md_listen_to_parent) {
       if(cobo_get_parent_socket(&parent_fd)!=COBO_SUCCESS) {
@@ -156,12 +2642,35 @@ int ldcs_audit_server_md_unregister_fd ( ldcs_process_data_t *ldcs_process_data
       }
       ldcs_process_data->md_listen_to_parent=0;
       ldcs_listen_unregister_fd(parent_fd);
+      hold_small_sends = 0;
+
+      if (drain_all_send_queues() == -1)
+         err_printf("Could not finish sending queued messages to children\n");
+      if (bandwidth_timer_fd != -1) {
+         arm_bandwidth_timer(0);
+         ldcs_listen_unregister_fd(bandwidth_timer_fd);
+      }
 
       cobo_get_num_childs(&num_childs);
       for (i = 0; i<num_childs; i++) {
          cobo_get_child_socket(i, &child_fd);
          ldcs_listen_unregister_fd(child_fd);
       }
+      for (i = 0; i < num_lateral; i++) {
+         if (lateral_fds[i] != -1)
+            ldcs_listen_unregister_fd(lateral_fds[i]);
+         if (lateral_in_fds[i] != -1)
+            ldcs_listen_unregister_fd(lateral_in_fds[i]);
+      }
+      if (bypass_parent_fd != -1)
+         ldcs_listen_unregister_fd(bypass_parent_fd);
+      unregister_link_listeners();
+      if (cobo_get_listen_socket(&listen_fd) == COBO_SUCCESS) {
+         ldcs_listen_unregister_fd(listen_fd);
+         cobo_close_listen();
+      }
+      while (num_pending_joins)
+         cobo_drop_join(pending_joins[--num_pending_joins]);
    }
 
    return(rc);
@@ -169,8 +2678,8 @@ int ldcs_audit_server_md_unregister_fd ( ldcs_process_data_t *ldcs_process_data
 
 int ldcs_audit_server_md_destroy ( ldcs_process_data_t *ldcs_process_data ) 
 {
-   /* Nothing to be done.  Sockets will be closed when we exit. */
-   return 0;
+   /* Sockets will be closed when we exit. */
+   return drain_all_send_queues();
 }
 
 int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *ldcs_process_data, char *filename ) {
@@ -184,16 +2693,193 @@ int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *ldcs_process_data
    }
 }
 
+#define MAX_READERS 64
+
+/**
+ * The servers that read the shared file system: the root, followed by
+ * its first num_readers-1 children.  reader_child[i] is the root's socket
+ * index for readers[i].  Every server computes the same table.
+ *
+ * With OPT_FOREST the readers split the tree rather than the directories.
+ * Each reader is the root of a slice of the job, its own subtree, or for
+ * the root everything outside the other slices.  It reads every directory
+ * and file its slice asks for and answers them itself, so requests and
+ * file contents never cross between slices, and the root only handles
+ * its own slice plus the job-wide messages (preload, exit, stats).
+ **/
+static int readers[MAX_READERS];
+static int reader_child[MAX_READERS];
+static int num_readers = 0;
+static int forest = 0;
+static int slice_root = 0;
+
+static void init_readers(ldcs_process_data_t *ldcs_process_data)
+{
+   int children[MAX_READERS], num_children, i;
+
+   if (num_readers)
+      return;
+
+   readers[0] = 0;
+   reader_child[0] = -1;
+   num_readers = 1;
+   if (ldcs_process_data->num_readers <= 1)
+      return;
+
+   cobo_get_root_children(children, MAX_READERS - 1, &num_children);
+   for (i = 0; i < num_children && num_readers < (int) ldcs_process_data->num_readers; i++) {
+      reader_child[num_readers] = i;
+      readers[num_readers++] = children[i];
+   }
+
+   forest = (ldcs_process_data->opts & OPT_FOREST) && num_readers > 1;
+   if (forest) {
+      for (i = 0; i < num_readers; i++) {
+         if (readers[i] == ldcs_process_data->md_rank)
+            slice_root = 1;
+      }
+      debug_printf2("Splitting the job into %d slices, each reading its own files%s\n", num_readers,
+                    slice_root ? ", and we're the root of one" : "");
+      return;
+   }
+   debug_printf2("Splitting file system reads between %d servers\n", num_readers);
+}
+
+/**
+ * Hash a directory to the index of the reader that owns it.  Files are
+ * hashed by their directory, so a file's reader has already read its
+ * directory.
+ **/
+static int reader_for_dir(const char *dir, size_t len)
+{
+   unsigned int hash = 2166136261u;
+   size_t i;
+
+   for (i = 0; i < len; i++) {
+      hash ^= (unsigned char) dir[i];
+      hash *= 16777619u;
+   }
+   return (int) (hash % num_readers);
+}
+
+int ldcs_audit_server_md_is_reader ( ldcs_process_data_t *ldcs_process_data, char *dir ) {
+   int idx;
+
+   init_readers(ldcs_process_data);
+   if (num_readers == 1)
+      return ldcs_audit_server_md_is_responsible(ldcs_process_data, dir);
+   if (forest)
+      return slice_root;
+
+   idx = reader_for_dir(dir, strlen(dir));
+   debug_printf3("Directory %s is read by server %d\n", dir, readers[idx]);
+   return readers[idx] == ldcs_process_data->md_rank;
+}
+
+int ldcs_audit_server_md_is_rack_leader ( ldcs_process_data_t *ldcs_process_data ) {
+   static int leader = -1;
+
+   if (leader == -1) {
+      cobo_is_rack_leader(&leader);
+      debug_printf2("Decided I am %sa rack leader\n", leader ? "" : "not ");
+   }
+   return leader;
+}
+
+int ldcs_audit_server_md_get_num_readers ( ldcs_process_data_t *ldcs_process_data ) {
+   init_readers(ldcs_process_data);
+   return num_readers;
+}
+
+node_peer_t ldcs_audit_server_md_get_reader ( ldcs_process_data_t *ldcs_process_data, int i ) {
+   init_readers(ldcs_process_data);
+   if (i <= 0 || i >= num_readers)
+      return NODE_PEER_NULL;
+   return ldcs_audit_server_md_get_child(ldcs_process_data, reader_child[i]);
+}
+
+/**
+ * On the root, send each entry of a request message to the child reader
+ * that owns its directory, combining the entries for each child.
+ **/
+static int forward_query_to_readers(ldcs_message_t *msg)
+{
+   char *buffers[MAX_READERS];
+   size_t used[MAX_READERS];
+   size_t pos, entry_len, dir_len;
+   char *entry, *slash;
+   ldcs_message_t out_msg;
+   int i, idx, fd, result, global_result = 0;
+
+   memset(used, 0, sizeof(used));
+   for (i = 0; i < num_readers; i++)
+      buffers[i] = NULL;
+
+   for (pos = 0; pos < msg->header.len; pos += entry_len + 1) {
+      entry = msg->data + pos;
+      entry_len = strnlen(entry, msg->header.len - pos);
+      if (entry_len < 2)
+         continue;
+
+      dir_len = entry_len - 1;
+      if (entry[0] != 'D') {
+         slash = memrchr(entry + 1, '/', entry_len - 1);
+         dir_len = slash ? (size_t) (slash - (entry + 1)) : 0;
+      }
+      idx = reader_for_dir(entry + 1, dir_len);
+      if (idx == 0) {
+         /* Ours.  Nothing left to send it to. */
+         continue;
+      }
+
+      if (!buffers[idx]) {
+         buffers[idx] = (char *) malloc(msg->header.len);
+         if (!buffers[idx]) {
+            err_printf("Could not allocate %lu bytes for reader request\n", (unsigned long) msg->header.len);
+            global_result = -1;
+            break;
+         }
+      }
+      memcpy(buffers[idx] + used[idx], entry, entry_len);
+      used[idx] += entry_len;
+      buffers[idx][used[idx]++] = '\0';
+   }
+
+   for (i = 1; i < num_readers; i++) {
+      if (!buffers[i])
+         continue;
+      if (used[i] && global_result != -1) {
+         debug_printf2("Forwarding %lu bytes of requests to reader %d\n", (unsigned long) used[i], readers[i]);
+         out_msg.header.type = msg->header.type;
+         out_msg.header.len = used[i];
+         out_msg.data = buffers[i];
+         cobo_get_child_socket(reader_child[i], &fd);
+         result = write_peer_msg(fd, &out_msg);
+         if (result < 0) {
+            err_printf("Problem writing request to reader %d\n", readers[i]);
+            global_result = -1;
+         }
+      }
+      free(buffers[i]);
+   }
+
+   return global_result;
+}
+
 int ldcs_audit_server_md_forward_query(ldcs_process_data_t *ldcs_process_data, ldcs_message_t* msg) {
    int parent_fd;
    int result;
    if (ldcs_process_data->md_rank == 0) {
+      init_readers(ldcs_process_data);
+      if (num_readers > 1 && !forest && msg->header.type == LDCS_MSG_FILE_REQUEST)
+         return forward_query_to_readers(msg);
+
       /* We're root--no one to forward a query to*/
       return 0;
    }
   
    cobo_get_parent_socket(&parent_fd);
-   result = write_msg(parent_fd, msg);
+   result = write_peer_msg(parent_fd, msg);
    if (result < 0) {
       err_printf("Problem writing message to parent, result is %d\n", result);
       return -1;
@@ -213,10 +2899,36 @@ int ldcs_audit_server_md_complete_msg_read(node_peer_t peer, ldcs_message_t *msg
    return 0;
 }
 
+int ldcs_audit_server_md_complete_msg_read_file(node_peer_t peer, ldcs_message_t *msg, int file_fd,
+                                                void *mem, size_t size)
+{
+   int fd = (int) (long) peer, result;
+   peer_streams_t *ps;
+   double start;
+   assert(msg->header.len >= size);
+   if (!size)
+      return 0;
+   start = ldcs_get_time();
+   ps = get_stripe_streams(fd, size);
+   if (ps)
+      result = stripe_io(ps, stripe_read, file_fd, mem, 0, size);
+   else
+      result = read_file_data(fd, file_fd, mem, 0, size);
+   if (result != -1)
+      link_record(fd, size, ldcs_get_time() - start, 0);
+   return result;
+}
+
 int ldcs_audit_server_md_trash_bytes(node_peer_t peer, size_t size)
 {
    char buffer[4096];
    int fd = (int) (long) peer;
+   peer_streams_t *ps;
+
+   /* Only used for file contents, which may have been striped */
+   ps = get_stripe_streams(fd, size);
+   if (ps)
+      return stripe_io(ps, stripe_trash, -1, NULL, 0, size);
 
    while (size) {
       if (size < 4096) {
@@ -238,7 +2950,7 @@ int ldcs_audit_server_md_recv_from_parent(ldcs_message_t *msg)
    node_peer_t peer;
 
    cobo_get_parent_socket(&fd);
-   return read_msg(fd, &peer, msg);
+   return read_msg(fd, &peer, msg, 0);
 }
 
 int ldcs_audit_server_md_cobo_CB(int fd, int nc, void *data)
@@ -250,7 +2962,7 @@ int ldcs_audit_server_md_cobo_CB(int fd, int nc, void *data)
    node_peer_t peer;
   
    /* receive msg from cobo network */
-   rc = read_msg(fd, &peer, &msg);
+   rc = read_msg(fd, &peer, &msg, 1);
    if (rc == -1)
       return -1;
 
@@ -259,52 +2971,251 @@ int ldcs_audit_server_md_cobo_CB(int fd, int nc, void *data)
    ldcs_process_data->server_stat.md_cb.cnt++;
    ldcs_process_data->server_stat.md_cb.time+=(ldcs_get_time() - starttime);
 
-   if (msg.data)
-      free(msg.data);
+   msgpool_free(msg.data);
 
    return(rc);
 }
 
+int ldcs_audit_server_md_gather_children(ldcs_process_data_t *ldcs_process_data, node_peer_t from, long usecs)
+{
+   static int gathering = 0;
+   struct pollfd *fds;
+   struct timespec timeout;
+   int i, fd, num_childs = 0, num_polled = 0, num_heard = 0, result;
+   double starttime, remaining;
+
+   cobo_get_num_childs(&num_childs);
+   if (!num_childs || usecs <= 0 || gathering)
+      return 0;
+
+   fds = (struct pollfd *) malloc(sizeof(struct pollfd) * num_childs);
+   if (!fds)
+      return 0;
+   for (i = 0; i < num_childs; i++) {
+      cobo_get_child_socket(i, &fd);
+      if (fd == (int) (long) from)
+         continue;
+      fds[num_polled].fd = fd;
+      fds[num_polled].events = POLLIN;
+      num_polled++;
+   }
+   if (!num_polled) {
+      free(fds);
+      return 0;
+   }
+   gathering = 1;
+
+   /* Don't sit on held replies while we wait */
+   flush_send_queues(NULL);
+
+   starttime = ldcs_get_time();
+   while (num_heard < num_polled) {
+      remaining = usecs / 1000000.0 - (ldcs_get_time() - starttime);
+      if (remaining <= 0.0)
+         break;
+      timeout.tv_sec = (time_t) remaining;
+      timeout.tv_nsec = (long) ((remaining - timeout.tv_sec) * 1000000000.0);
+      for (i = 0; i < num_polled; i++)
+         fds[i].revents = 0;
+      result = ppoll(fds, num_polled, &timeout, NULL);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         break;
+      for (i = 0; i < num_polled; i++) {
+         if (!fds[i].revents)
+            continue;
+         if (fds[i].revents & POLLIN) {
+            /* Each child's first message is handled here.  Later ones wait
+               for the listen loop, so one busy child can't hold us. */
+            ldcs_process_data->server_stat.aggregate.cnt++;
+            debug_printf3("Gathering message from child on cobo FD %d\n", fds[i].fd);
+            if (ldcs_audit_server_md_cobo_CB(fds[i].fd, 0, ldcs_process_data) == -1)
+               err_printf("Error handling message from child on cobo FD %d\n", fds[i].fd);
+         }
+         /* Errors and hangups are left for the listen loop to find */
+         fds[i].fd = -1;
+         num_heard++;
+      }
+   }
+   ldcs_process_data->server_stat.aggregate.time += ldcs_get_time() - starttime;
+   gathering = 0;
+
+   free(fds);
+   return 0;
+}
+
 int ldcs_audit_server_md_send(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg, node_peer_t peer)
 {
    int fd = (int) (long) peer;
-   return write_msg(fd, msg);
+   return write_peer_msg(fd, msg);
 }
 
-int ldcs_audit_server_md_send_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg, 
-                                        node_peer_t peer,
-                                        void *secondary_data, size_t secondary_size)
+/**
+ * The tree sockets run with TCP_NODELAY, so small messages leave at once.
+ * For a large message, that would put its header in a packet of its own.
+ * Corking the socket from the header to the end of the data lets the
+ * kernel send only full segments.
+ **/
+static void cork_socket(int fd, int on)
 {
-   int fd; 
-   if (!secondary_size)
-      return ldcs_audit_server_md_send(ldcs_process_data, msg, peer);
+#if defined(TCP_CORK)
+   setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+}
 
+static int send_noncontig(int fd, ldcs_message_t *msg, int file_fd,
+                          void *secondary_data, size_t secondary_size)
+{
+   int result;
+   peer_streams_t *ps;
    assert(msg->header.len >= secondary_size);
    size_t initial_size = msg->header.len - secondary_size;
+
+   if (drain_send_queue(fd) == -1)
+      return -1;
+   charge_direct(fd, sizeof(*msg) + msg->header.len);
+
+   if (secondary_size >= CORK_MIN_SIZE)
+      cork_socket(fd, 1);
    
    /* Send header */
-   fd = (int) (long) peer;
-   int result = ll_write(fd, msg, sizeof(*msg));
-   if (result == -1) {
-      return -1;
-   }
+   result = ll_write(fd, msg, sizeof(*msg));
 
-   if (initial_size) {
+   if (result != -1 && initial_size) {
       /* Send initial part of data */
       assert(msg->data);
       result = ll_write(fd, msg->data, initial_size);
+   }
+
+   /* Send the secondary data */
+   if (result != -1) {
+      ps = is_file_contents_msg(msg) ? get_stripe_streams(fd, secondary_size) : NULL;
+      if (ps)
+         result = stripe_io(ps, stripe_write, file_fd, secondary_data, 0, secondary_size);
+      else
+         result = write_file_data(fd, file_fd, secondary_data, 0, secondary_size);
+   }
+
+   if (secondary_size >= CORK_MIN_SIZE)
+      cork_socket(fd, 0);
+   return result;
+}
+
+int ldcs_audit_server_md_send_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg, 
+                                        node_peer_t peer,
+                                        void *secondary_data, size_t secondary_size)
+{
+   return ldcs_audit_server_md_send_noncontig_file(ldcs_process_data, msg, peer, -1,
+                                                   secondary_data, secondary_size);
+}
+
+int ldcs_audit_server_md_send_noncontig_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg, 
+                                             node_peer_t peer, int file_fd,
+                                             void *secondary_data, size_t secondary_size)
+{
+   if (!secondary_size)
+      return ldcs_audit_server_md_send(ldcs_process_data, msg, peer);
+   return send_noncontig((int) (long) peer, msg, file_fd, secondary_data, secondary_size);
+}
+
+int ldcs_audit_server_md_forward_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                           node_peer_t src, node_peer_t *peers, int num_peers,
+                                           int file_fd, void *mem, size_t size, size_t chunk_size)
+{
+   int *fds, i, result, global_result = 0;
+   size_t initial_size, pos, chunk;
+   int src_fd = (int) (long) src;
+   peer_streams_t *src_streams, **peer_streams_list;
+   double start, read_start, read_time = 0.0;
+
+   assert(msg->header.len >= size);
+   initial_size = msg->header.len - size;
+
+   if (!peers)
+      cobo_get_num_childs(&num_peers);
+   fds = (int *) malloc(sizeof(int) * (num_peers ? num_peers : 1));
+   peer_streams_list = (peer_streams_t **) malloc(sizeof(peer_streams_t *) * (num_peers ? num_peers : 1));
+   for (i = 0; i < num_peers; i++) {
+      if (peers)
+         fds[i] = (int) (long) peers[i];
+      else
+         cobo_get_child_socket(i, fds + i);
+      peer_streams_list[i] = is_file_contents_msg(msg) ? get_stripe_streams(fds[i], size) : NULL;
+   }
+   src_streams = is_file_contents_msg(msg) ? get_stripe_streams(src_fd, size) : NULL;
+   chunk_size = link_chunk_size(src_fd, fds, num_peers, chunk_size);
+
+   /* Send header and initial part of data */
+   for (i = 0; i < num_peers; i++) {
+      result = drain_send_queue(fds[i]);
+      if (result != -1)
+         charge_direct(fds[i], sizeof(*msg) + initial_size);
+      if (result != -1 && size >= CORK_MIN_SIZE)
+         cork_socket(fds[i], 1);
+      if (result != -1)
+         result = ll_write(fds[i], msg, sizeof(*msg));
+      if (result != -1 && initial_size) {
+         assert(msg->data);
+         result = ll_write(fds[i], msg->data, initial_size);
+      }
       if (result == -1) {
-         return -1;
+         if (size >= CORK_MIN_SIZE)
+            cork_socket(fds[i], 0);
+         fds[i] = -1;
+         global_result = -1;
       }
    }
 
-   /* Send the secondary data */
-   result = ll_write(fd, secondary_data, secondary_size);
-   if (result == -1) {
-      return -1;
+   /* Pass each chunk on as soon as it has arrived.  A peer that fails
+      is dropped, but we keep reading so the source stream stays intact. */
+   start = ldcs_get_time();
+   for (pos = 0; pos < size; pos += chunk) {
+      chunk = (size - pos < chunk_size) ? size - pos : chunk_size;
+      read_start = ldcs_get_time();
+      if (src_streams)
+         result = stripe_io(src_streams, stripe_read, file_fd, mem, pos, chunk);
+      else
+         result = read_file_data(src_fd, file_fd, mem, pos, chunk);
+      read_time += ldcs_get_time() - read_start;
+      if (result == -1) {
+         global_result = -1;
+         break;
+      }
+      for (i = 0; i < num_peers; i++) {
+         if (fds[i] == -1)
+            continue;
+         charge_direct(fds[i], chunk);
+         if (peer_streams_list[i])
+            result = stripe_io(peer_streams_list[i], stripe_write, file_fd, mem, pos, chunk);
+         else
+            result = write_file_data(fds[i], file_fd, mem, pos, chunk);
+         if (result == -1) {
+            if (size >= CORK_MIN_SIZE)
+               cork_socket(fds[i], 0);
+            fds[i] = -1;
+            global_result = -1;
+         }
+      }
    }
 
-   return 0;
+   for (i = 0; i < num_peers && size >= CORK_MIN_SIZE; i++) {
+      if (fds[i] != -1)
+         cork_socket(fds[i], 0);
+   }
+
+   /* The source edge is measured by how fast the contents came in, and the
+      others by how fast they went through all of it */
+   if (pos >= size) {
+      link_record(src_fd, size, read_time, 0);
+      for (i = 0; i < num_peers; i++) {
+         if (fds[i] != -1)
+            link_record(fds[i], size, ldcs_get_time() - start, 1);
+      }
+   }
+   free(fds);
+   free(peer_streams_list);
+   return global_result;
 }
 
 int ldcs_audit_server_md_broadcast(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg)
@@ -312,14 +3223,23 @@ int ldcs_audit_server_md_broadcast(ldcs_process_data_t *ldcs_process_data, ldcs_
    int fd, i;
    int result, global_result = 0;
    int num_childs = 0;
+   send_buf_t *buf;
 
    cobo_get_num_childs(&num_childs);
+   if (!num_childs)
+      return 0;
+
+   buf = new_send_buf(msg, msg->data ? msg->header.len : 0, NULL, 0);
+   if (!buf)
+      return -1;
    for (i = 0; i<num_childs; i++) {
       cobo_get_child_socket(i, &fd);
-      result = write_msg(fd, msg);
+      SPINDLE_PROBE3(bcast_send, fd, (int) msg->header.type, msg->header.len);
+      result = queue_send(fd, buf, -1, 0, 0, NULL);
       if (result == -1)
          global_result = -1;
    }
+   release_send_buf(buf);
    
    return global_result;
 }
@@ -327,23 +3247,80 @@ int ldcs_audit_server_md_broadcast(ldcs_process_data_t *ldcs_process_data, ldcs_
 int ldcs_audit_server_md_broadcast_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
                                              void *secondary_data, size_t secondary_size)
 {
-   int fd, i;
-   int result, global_result = 0;
+   return ldcs_audit_server_md_broadcast_noncontig_file(ldcs_process_data, msg, -1,
+                                                        secondary_data, secondary_size);
+}
+
+int ldcs_audit_server_md_broadcast_noncontig_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                                  int file_fd, void *secondary_data, size_t secondary_size)
+{
+   int *fds, i, result;
    int num_childs = 0;
-   node_peer_t peer;
 
    if (!secondary_size)
       return ldcs_audit_server_md_broadcast(ldcs_process_data, msg);
 
    cobo_get_num_childs(&num_childs);
+   if (!num_childs)
+      return 0;
+   fds = (int *) malloc(sizeof(int) * num_childs);
+   if (!fds)
+      return -1;
+   for (i = 0; i < num_childs; i++)
+      cobo_get_child_socket(i, fds + i);
+   result = queue_noncontig_file(fds, num_childs, msg, file_fd, secondary_data, secondary_size);
+   free(fds);
+   return result;
+}
 
-   for (i = 0; i<num_childs; i++) {
-      cobo_get_child_socket(i, &fd);
-      peer = (void *) (long) fd;
-      result = ldcs_audit_server_md_send_noncontig(ldcs_process_data, msg, peer, secondary_data, secondary_size);
+/**
+ * Queue msg, followed by secondary_size bytes from file_fd or
+ * secondary_data, for each of the num_fds peers.  They share one buffer.
+ **/
+static int queue_noncontig_file(int *fds, int num_fds, ldcs_message_t *msg,
+                                int file_fd, void *secondary_data, size_t secondary_size)
+{
+   int fd, i, child_file_fd;
+   int result, global_result = 0;
+   int use_file = (file_fd != -1 && sendfile_works);
+   size_t initial_size;
+   send_buf_t *buf = NULL;
+
+   assert(msg->header.len >= secondary_size);
+   initial_size = msg->header.len - secondary_size;
+
+   for (i = 0; i < num_fds; i++) {
+      fd = fds[i];
+      SPINDLE_PROBE3(bcast_send, fd, (int) msg->header.type, msg->header.len);
+      if (is_file_contents_msg(msg) && get_stripe_streams(fd, secondary_size)) {
+         /* Striped contents go out on the streams in parallel already */
+         result = send_noncontig(fd, msg, file_fd, secondary_data, secondary_size);
+         if (result == -1)
+            global_result = -1;
+         continue;
+      }
+
+      if (!buf) {
+         buf = new_send_buf(msg, initial_size, secondary_data, use_file ? 0 : secondary_size);
+         if (!buf)
+            return -1;
+      }
+      child_file_fd = -1;
+      if (use_file) {
+         child_file_fd = dup(file_fd);
+         if (child_file_fd == -1) {
+            err_printf("Could not dup file for sending to cobo FD %d: %s\n", fd, strerror(errno));
+            global_result = -1;
+            continue;
+         }
+      }
+      result = queue_send(fd, buf, child_file_fd, 0, use_file ? secondary_size : 0,
+                          use_file ? (char *) secondary_data : NULL);
       if (result == -1)
          global_result = -1;
    }
+   if (buf)
+      release_send_buf(buf);
    
    return global_result;   
 }
@@ -354,3 +3331,11 @@ int ldcs_audit_server_md_get_num_children(ldcs_process_data_t *procdata)
    cobo_get_num_childs(&num_childs);
    return num_childs;
 }
+
+node_peer_t ldcs_audit_server_md_get_child(ldcs_process_data_t *procdata, int child)
+{
+   int fd;
+   if (cobo_get_child_socket(child, &fd) != COBO_SUCCESS)
+      return NODE_PEER_NULL;
+   return (node_peer_t) (long) fd;
+}
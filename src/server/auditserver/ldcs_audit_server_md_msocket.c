@@ -14,570 +14,721 @@ program; if not, write to the Free Software Foundation, Inc., 59 Temple
 Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/inotify.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <assert.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "ldcs_api.h"
-#include "ldcs_api_socket.h"
 #include "ldcs_api_listen.h"
 #include "ldcs_audit_server_process.h"
-#include "ldcs_audit_server_filemngt.h"
 #include "ldcs_audit_server_md.h"
+#include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_msgpool.h"
 #include "ldcs_audit_server_md_msocket.h"
 #include "ldcs_audit_server_md_msocket_util.h"
 #include "ldcs_audit_server_md_msocket_topo.h"
-#include "ldcs_cache.h"
-
-
-ldcs_msocket_data_t ldcs_msocket_data;
-
-/* callback to gather info from other server over external fabric (connecting server and frontend), e.g. COBO or MPI */
-/* gets local hostname and already openened listening port and returns rank and size of each server (rank of frontend=-1)   */
-/* on rank 0  (root) it should return hostlist and portlist of all servers  */
-/* on rank -1 (FE)   it should return in hostlist and portlist info about root server */
-
-int ldcs_msocket_external_fabric_CB_registered=0;
-int(*ldcs_msocket_external_fabric_CB) ( char *myhostname, int myport, int *myrank, int *size, char ***hostlist, int **portlist, 
-					void *data );
-void* ldcs_msocket_external_fabric_CB_data=NULL;
-
-int _ldcs_audit_server_md_msocket_init_CB ( int fd, int nc, void *data );
-int _ldcs_audit_server_md_msocket_comm_CB ( int fd, int nc, void *data );
-int _ldcs_audit_server_md_cobo_bcast_msg ( ldcs_process_data_t *data, ldcs_message_t *msg );
-
-int ldcs_register_external_fabric_CB( int cb ( char*, int, int*, int*, char***, int**, void *), 
-					      void *data) {
-  int rc=0;
-  ldcs_msocket_external_fabric_CB_registered=1;
-  ldcs_msocket_external_fabric_CB=cb;
-  ldcs_msocket_external_fabric_CB_data=data;
-  return(rc);
-}
-
-int ldcs_audit_server_md_init ( ldcs_process_data_t *ldcs_process_data ) {
-  int rc=0;
-
-  char* ldcs_nportsstr=getenv("LDCS_NPORTS");
-  char* ldcs_locmodstr=getenv("LDCS_LOCATION_MOD");
-
-  int usedport;
-  int serverfd, serverid, i;
-
-  ldcs_msocket_data.default_num_ports = 20;
-  if(ldcs_nportsstr) {
-    ldcs_msocket_data.default_num_ports=atoi(ldcs_nportsstr);
-  }
-  ldcs_msocket_data.default_portlist = malloc(ldcs_msocket_data.default_num_ports * sizeof(int));
-  if(!ldcs_msocket_data.default_portlist) _error("could not allocate portlist");
-  for (i=0; i<ldcs_msocket_data.default_num_ports; i++) {
-    ldcs_msocket_data.default_portlist[i] = 5000 + i;
-  }
-  
-  /* open listening port for bootstrapping startup  */
-  serverid=ldcs_audit_server_md_msocket_create_server(ldcs_process_data->location, 
-						      ldcs_msocket_data.default_portlist, ldcs_msocket_data.default_num_ports, 
-						      &usedport);
-  if (serverid<0) {
-    _error("Failed to init msocket\n");
-  }
-  serverfd=ldcs_get_fd_socket(serverid);
-
-  /* init data structure */
-  ldcs_msocket_data.serverfd=serverfd;
-  ldcs_msocket_data.serverid=serverid;
-  {
-    char buffer[MAX_PATH_LEN];
-    rc=gethostname(buffer, MAX_PATH_LEN);
-    if(!strcmp(buffer,"zam371guest")) {
-      strcpy(buffer,"localhost");
-    }
-    ldcs_msocket_data.hostname=strdup(buffer);
-    ldcs_msocket_data.server_stat.hostname=strdup(buffer);
-  }
-  ldcs_msocket_data.procdata=ldcs_process_data;
-
-  ldcs_msocket_data.hostinfo.rank=-2; /* not yet identified */
-  ldcs_msocket_data.hostlist=NULL;
-
-  /* if external fabric: distribute and/or get data about local contact info */
-  if(ldcs_msocket_external_fabric_CB_registered) {
-    int myerank,esize;
-    int *eportlist;
-    char **ehostlist; 
-    ldcs_msocket_external_fabric_CB(ldcs_msocket_data.hostname, usedport, &myerank, &esize, &ehostlist, &eportlist, ldcs_msocket_external_fabric_CB_data);
-    ldcs_process_data->md_rank=myerank;
-    ldcs_process_data->md_size=esize;
-    ldcs_msocket_data.hostinfo.rank=myerank;
-    ldcs_msocket_data.hostinfo.size=esize;
-    ldcs_msocket_data.hostlist=ehostlist;
-    ldcs_msocket_data.portlist=eportlist;
-  }
-
-  /* register server listen fd to listener */
-  ldcs_listen_register_fd(serverfd, serverid, &_ldcs_audit_server_md_msocket_server_CB, (void *) &ldcs_msocket_data);
-
-  /* go into listen loop to enable startup CB functions, 
-     the listen loop will exists after startup ofd msocket is completed */
-  debug_printf3("msocket listen loop starting\n");
-  ldcs_listen();
-  debug_printf3("msocket listen loop finished\n");
-
-  ldcs_listen_unregister_fd(serverfd);
-
-  
-  if(ldcs_locmodstr) {
-    int ldcs_locmod=atoi(ldcs_locmodstr);
-    if(ldcs_locmod>0) {
-      char buffer[MAX_PATH_LEN];
-      debug_printf3("multiple server per node add modifier to location mod=%d\n",ldcs_locmod);
-      if(strlen(ldcs_process_data->location)+10<MAX_PATH_LEN) {
-	sprintf(buffer,"%s-%02d",ldcs_process_data->location,ldcs_process_data->md_rank%ldcs_locmod);
-	debug_printf3("change location to %s (locmod=%d)\n",buffer,ldcs_locmod);
-	free(ldcs_process_data->location);
-	ldcs_process_data->location=strdup(buffer);
-      } else _error("location path too long");
-    }
-  } 
-  
-  return(rc);
-}
-
-int ldcs_audit_server_md_distribute ( ldcs_process_data_t *ldcs_process_data, ldcs_message_t* msg) {
-  int rc=0;
-
-  /* rc=_ldcs_audit_server_md_cobo_bcast_msg(ldcs_process_data, msg); */
-
-  msg->header.mtype=LDCS_MSG_MTYPE_BCAST;
-  msg->header.dest=-1;
-  msg->header.source=ldcs_msocket_data.hostinfo.rank;  msg->header.from=ldcs_msocket_data.hostinfo.rank; 
-
-  /* sent message to first host */
-  debug_printf3("route bcast msg %d->%d\n",msg->header.source, msg->header.dest);
-  ldcs_audit_server_md_msocket_route_msg(&ldcs_msocket_data, msg);
-
-  return(rc);
+#include "ldcs_cobo.h"
+#include "cobo_comm.h"
+#include "spindle_probes.h"
+
+/**
+ * A server tree over plain TCP sockets, in whichever shape
+ * ldcs_audit_server_md_msocket_topo.c builds.  The front end connects to
+ * the root and sends it the hostlist.  Each server then connects to its
+ * own children and sends the hostlist on.  Once the tree is up, messages
+ * have the same framing as over cobo.  File contents are read off the
+ * socket straight into their staging file, or its mapping, and sent from
+ * there.  Sends block until they're done.
+ *
+ * Streams, peer links, bypass links, several readers and bandwidth
+ * limits are cobo only, and the calls for them do nothing here.
+ **/
+
+extern int ll_read(int fd, void *buf, size_t count);
+
+#define SPLICE_PIPE_SIZE (1024*1024)
+#define CORK_MIN_SIZE (64*1024)
+
+static handshake_protocol_t msocket_handshake;
+static int parent_fd = -1;
+static int *child_fds = NULL;
+static int num_children = 0;
+
+static int sendfile_works = 1;
+static int splice_works = 1;
+static int splice_pipe[2] = { -1, -1 };
+
+int ldcs_audit_server_md_msocket_CB(int fd, int nc, void *data);
+
+/* Set by initialize_handshake_security in cobo_handshake.c */
+void cobo_set_handshake(handshake_protocol_t *hs)
+{
+   msocket_handshake = *hs;
 }
 
+/**
+ * Send count bytes of file_fd, starting at offset, out of the page cache.
+ * Returns 1 without having sent anything if the kernel can't sendfile to
+ * this fd.
+ **/
+static int ll_sendfile(int fd, int file_fd, off_t offset, size_t count)
+{
+   ssize_t result;
+   size_t pos = 0;
+
+   while (pos < count) {
+      result = sendfile(fd, file_fd, &offset, count - pos);
+      if (result == -1 && (errno == EINTR || errno == EAGAIN))
+         continue;
+      if (result == -1 && pos == 0 && (errno == EINVAL || errno == ENOSYS)) {
+         debug_printf("sendfile not supported (%s), using write for file contents\n", strerror(errno));
+         sendfile_works = 0;
+         return 1;
+      }
+      if (result <= 0) {
+         err_printf("Error sending file contents to msocket FD %d: %s\n", fd,
+                    result == 0 ? "short file" : strerror(errno));
+         return -1;
+      }
+      pos += result;
+   }
+   return 0;
+}
+
+/**
+ * Read count bytes off the network into file_fd at offset, through a pipe
+ * inside the kernel.  Returns 1 without having read anything if the kernel
+ * can't splice from this fd.
+ **/
+static int ll_splice_read(int fd, int file_fd, off_t offset, size_t count)
+{
+   ssize_t in, out;
+   size_t pos = 0;
+   loff_t file_off = offset;
+
+   if (splice_pipe[0] == -1) {
+      if (pipe(splice_pipe) == -1) {
+         debug_printf("Could not create splice pipe (%s), using read for file contents\n", strerror(errno));
+         splice_works = 0;
+         return 1;
+      }
+      fcntl(splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+   }
+
+   while (pos < count) {
+      in = splice(fd, NULL, splice_pipe[1], NULL, count - pos, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (in == -1 && (errno == EINTR || errno == EAGAIN))
+         continue;
+      if (in == -1 && pos == 0 && (errno == EINVAL || errno == ENOSYS)) {
+         debug_printf("splice not supported (%s), using read for file contents\n", strerror(errno));
+         splice_works = 0;
+         return 1;
+      }
+      if (in <= 0) {
+         err_printf("Error reading file contents from msocket FD %d\n", fd);
+         return -1;
+      }
+      while (in) {
+         out = splice(splice_pipe[0], NULL, file_fd, &file_off, in, SPLICE_F_MOVE);
+         if (out == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+         if (out <= 0) {
+            err_printf("Error writing network data to local file: %s\n", strerror(errno));
+            close(splice_pipe[0]);
+            close(splice_pipe[1]);
+            splice_pipe[0] = splice_pipe[1] = -1;
+            return -1;
+         }
+         in -= out;
+         pos += out;
+      }
+   }
+   return 0;
+}
+
+/* Send part of a file's contents, from file_fd when we have one, else from mem */
+static int write_file_data(int fd, int file_fd, void *mem, size_t offset, size_t count)
+{
+   int result;
+   if (file_fd != -1 && sendfile_works) {
+      result = ll_sendfile(fd, file_fd, (off_t) offset, count);
+      if (result != 1)
+         return result;
+   }
+   return ll_write(fd, ((char *) mem) + offset, count);
+}
+
+/* Receive part of a file's contents, into file_fd when we have one, else into mem */
+static int read_file_data(int fd, int file_fd, void *mem, size_t offset, size_t count)
+{
+   int result;
+   if (file_fd != -1 && splice_works) {
+      result = ll_splice_read(fd, file_fd, (off_t) offset, count);
+      if (result != 1)
+         return result;
+   }
+   return ll_read(fd, ((char *) mem) + offset, count);
+}
+
+/**
+ * Read a message from fd.  File contents are left on the socket for
+ * ldcs_audit_server_md_complete_msg_read, so they can go straight into
+ * their staging file.  Other data comes from the message pool, unless
+ * pooled is 0 because the caller keeps it and frees it with free.
+ **/
+static int read_msg(int fd, node_peer_t *peer, ldcs_message_t *msg, int pooled)
+{
+   char *buffer = NULL;
+
+   *peer = (node_peer_t) (long) fd;
+
+   if (ll_read(fd, msg, sizeof(*msg)) == -1)
+      return -1;
+
+   if (msg->header.type == LDCS_MSG_FILE_DATA || msg->header.type == LDCS_MSG_PRELOAD_FILE) {
+      msg->data = NULL;
+      return 0;
+   }
+
+   if (msg->header.len) {
+      buffer = pooled ? (char *) msgpool_alloc(msg->header.len) : (char *) malloc(msg->header.len);
+      if (buffer == NULL) {
+         err_printf("Error allocating space for message from network of size %lu\n", (long) msg->header.len);
+         return -1;
+      }
+      if (ll_read(fd, buffer, msg->header.len) == -1) {
+         if (pooled)
+            msgpool_free(buffer);
+         else
+            free(buffer);
+         return -1;
+      }
+   }
+
+   msg->data = buffer;
+   return 0;
+}
+
+static int wait_ready(int fd)
+{
+   int ready = 0;
+   if (ll_read(fd, &ready, sizeof(ready)) == -1 || ready != LDCS_MSOCKET_READY) {
+      err_printf("Did not get a ready signal on msocket FD %d\n", fd);
+      return -1;
+   }
+   return 0;
+}
+
+int ldcs_audit_server_md_init(unsigned int port, unsigned int num_ports,
+                              unique_id_t unique_id, ldcs_process_data_t *data)
+{
+   unsigned int *ports, port_used;
+   int listen_fd, i, ready = LDCS_MSOCKET_READY, fanout;
+   int *children = NULL;
+   char *hostlist_data = NULL, **hostlist = NULL;
+   ldcs_msocket_hostinfo_t hostinfo, child_info;
+   ldcs_msocket_topo_t topo;
+
+   ports = (unsigned int *) malloc(sizeof(unsigned int) * num_ports);
+   for (i = 0; i < num_ports; i++)
+      ports[i] = port + i;
+
+   debug_printf2("Opening msocket with port %d - %d\n", ports[0], ports[num_ports-1]);
+   listen_fd = ldcs_audit_server_md_msocket_create_server(ports, num_ports, &port_used);
+   if (listen_fd == -1) {
+      err_printf("Failed to open msocket listening port\n");
+      exit(1);
+   }
+   parent_fd = ldcs_audit_server_md_msocket_accept(listen_fd, &msocket_handshake, unique_id);
+   /* Servers sharing a host are told apart by which one still listens */
+   close(listen_fd);
+   if (parent_fd == -1 ||
+       ldcs_audit_server_md_msocket_recv_hostinfo(parent_fd, &hostinfo, &hostlist_data) == -1) {
+      err_printf("Failed to get the hostlist from our msocket parent\n");
+      exit(1);
+   }
+   hostlist = ldcs_audit_server_md_msocket_expand_hostlist(hostlist_data, hostinfo.hostlist_size, hostinfo.size);
+   if (!hostlist) {
+      err_printf("Malformed hostlist from our msocket parent\n");
+      exit(1);
+   }
+   if (hostinfo.topo == LDCS_TOPO_TYPE_UNKNOWN) {
+      hostinfo.topo = ldcs_audit_server_md_msocket_topo_from_env(hostinfo.size, &fanout);
+      hostinfo.fanout = fanout;
+   }
+
+   ldcs_audit_server_md_msocket_topo_init(&topo, hostinfo.topo, hostinfo.fanout, hostinfo.size, hostlist);
+   children = (int *) malloc(sizeof(int) * (ldcs_audit_server_md_msocket_topo_max_children(&topo) + 1));
+   num_children = ldcs_audit_server_md_msocket_topo_children(&topo, hostinfo.rank, children);
+   child_fds = (int *) malloc(sizeof(int) * (num_children + 1));
+
+   /* Connect all children before waiting on any, so subtrees come up together */
+   child_info = hostinfo;
+   for (i = 0; i < num_children; i++) {
+      child_fds[i] = ldcs_audit_server_md_msocket_connect(hostlist[children[i]], ports, num_ports,
+                                                         &msocket_handshake, unique_id);
+      child_info.rank = children[i];
+      if (child_fds[i] == -1 ||
+          ldcs_audit_server_md_msocket_send_hostinfo(child_fds[i], &child_info, hostlist_data) == -1) {
+         err_printf("Failed to connect msocket child %d on %s\n", children[i], hostlist[children[i]]);
+         exit(1);
+      }
+   }
+   for (i = 0; i < num_children; i++) {
+      if (wait_ready(child_fds[i]) == -1)
+         exit(1);
+   }
+   debug_printf2("msocket open complete.  Rank %d/%d with %d children\n", hostinfo.rank, hostinfo.size, num_children);
+
+   data->server_stat.md_rank = data->md_rank = hostinfo.rank;
+   data->server_stat.md_size = data->md_size = hostinfo.size;
+   data->server_stat.md_fan_out = data->md_fan_out = num_children;
+   data->md_listen_to_parent = 0;
+
+   /* the root's parent is the front end, which waits on this before sending settings */
+   if (ll_write(parent_fd, &ready, sizeof(ready)) == -1) {
+      err_printf("Failed to signal our msocket parent that we're ready\n");
+      exit(1);
+   }
+
+   ldcs_audit_server_md_msocket_topo_free(&topo);
+   free(children);
+   free(hostlist);
+   free(hostlist_data);
+   free(ports);
+   return 0;
+}
 
 int ldcs_audit_server_md_register_fd ( ldcs_process_data_t *ldcs_process_data ) {
-  int rc=0;
-  debug_printf3("call not used for md_msocket\n");
-  return(rc);
+   int i;
+
+   debug_printf3("Registering fd %d for msocket parent connection\n", parent_fd);
+   ldcs_listen_register_fd(parent_fd, 0, &ldcs_audit_server_md_msocket_CB, (void *) ldcs_process_data);
+   ldcs_process_data->md_listen_to_parent = 1;
+   for (i = 0; i < num_children; i++)
+      ldcs_listen_register_fd(child_fds[i], 0, &ldcs_audit_server_md_msocket_CB, (void *) ldcs_process_data);
+   return 0;
 }
 
 int ldcs_audit_server_md_unregister_fd ( ldcs_process_data_t *ldcs_process_data ) {
-  int rc=0;
+   int i;
+
+   if (!ldcs_process_data->md_listen_to_parent)
+      return 0;
+   ldcs_process_data->md_listen_to_parent = 0;
+   ldcs_listen_unregister_fd(parent_fd);
+   for (i = 0; i < num_children; i++)
+      ldcs_listen_unregister_fd(child_fds[i]);
+   return 0;
+}
 
-  /* callbacks for md connections are further on needed for bringing down network   */
-  /* therefore: instead of unregister those, a direct signal is send to listener to end */
-  /*            the listener will startet again in md_destroy */
-  ldcs_listen_signal_end_listen_loop();
+int ldcs_audit_server_md_open_streams ( ldcs_process_data_t *ldcs_process_data ) {
+   /* msocket keeps one connection per tree edge */
+   return 0;
+}
+
+int ldcs_audit_server_md_open_peers ( ldcs_process_data_t *ldcs_process_data ) {
+   /* msocket has no sibling links */
+   return 0;
+}
 
-  /* unregister all fds */
-  /* ldcs_listen_unregister_fd(parent_fd); */
+int ldcs_audit_server_md_join(unsigned int port, unsigned int num_ports, unique_id_t unique_id,
+                              char *hosts, ldcs_process_data_t *data)
+{
+   /* msocket trees are fixed once they're built */
+   err_printf("Servers can't join a running msocket tree\n");
+   return -1;
+}
 
-  return(rc);
+int ldcs_audit_server_md_open_bypass ( ldcs_process_data_t *ldcs_process_data ) {
+   /* msocket has no links past its own neighbors */
+   return 0;
 }
 
 int ldcs_audit_server_md_destroy ( ldcs_process_data_t *ldcs_process_data ) {
-  int rc=0;
-  ldcs_message_t *msg=ldcs_msg_new();
-
-  /* TODO: implement bringdown procedure  */
-
-#if 0
-  if(ldcs_process_data->md_rank==0) { 
-    int root_fd, ack=14;
-    
-    /* send all other server signal to stop */
-    msg->header.type=LDCS_MSG_END;
-    msg->header.len=0;
-    _ldcs_audit_server_md_cobo_bcast_msg(ldcs_process_data, msg);
-
-    /* send all other server signal to destroy */
-    msg->header.type=LDCS_MSG_DESTROY;
-    msg->header.len=0;
-    _ldcs_audit_server_md_cobo_bcast_msg(ldcs_process_data, msg);
-    
-    /* send fe client sognal to stop (ack)  */
-    cobo_get_parent_socket(&root_fd);
-    
-    ldcs_cobo_write_fd(root_fd, &ack, sizeof(ack));
-    debug_printf3("sent FE client signal to stop %d\n",ack);
-
-    ldcs_cobo_read_fd(root_fd, &ack, sizeof(ack));
-    debug_printf3("read from FE client ack to signal to stop %d\n",ack);
-  } else {
-
-    /* receive all other server signal to destroy */
-    msg->header.type=LDCS_MSG_DESTROY;
-    msg->header.len=0;
-    _ldcs_audit_server_md_cobo_bcast_msg(ldcs_process_data, msg);
-  }
-  
-  if (cobo_close() != COBO_SUCCESS) {
-    debug_printf3("Failed to close\n");
-    printf("Failed to close\n");
-    exit(1);
-  }
+   /* Sockets will be closed when we exit. */
+   return 0;
+}
 
-#endif
-  ldcs_msg_free(&msg);
+int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *ldcs_process_data, char *filename ) {
+   /* only the root reads files */
+   return ldcs_process_data->md_rank == 0;
+}
 
-  return(rc);
+int ldcs_audit_server_md_is_reader ( ldcs_process_data_t *ldcs_process_data, char *dir ) {
+   /* msocket keeps a single reader */
+   return ldcs_audit_server_md_is_responsible(ldcs_process_data, dir);
 }
 
+int ldcs_audit_server_md_is_rack_leader ( ldcs_process_data_t *ldcs_process_data ) {
+   /* msocket has no racks, only the reader leads */
+   return ldcs_audit_server_md_is_responsible(ldcs_process_data, "");
+}
 
-int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *ldcs_process_data, char *filename ) {
-  int rc=0;
-  
-  /* this is the place to aplly the mapping function later on  */
+int ldcs_audit_server_md_get_num_readers ( ldcs_process_data_t *ldcs_process_data ) {
+   return 1;
+}
 
-  /* current implementation: only MD rank does file operations  */
-  if(ldcs_process_data->md_rank==0) { 
-    rc=1;
-  } else {
-    rc=0;
-  }
+node_peer_t ldcs_audit_server_md_get_reader ( ldcs_process_data_t *ldcs_process_data, int i ) {
+   return NODE_PEER_NULL;
+}
 
-  debug_printf3("responsible: fn=%s rank=%d  --> %s \n",filename, ldcs_process_data->md_rank, (rc)?"YES":"NO");
+int ldcs_audit_server_md_bypass_slow ( ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                       int file_fd, void *secondary_data, size_t secondary_size ) {
+   return 0;
+}
+
+void ldcs_audit_server_md_release_buffer ( void *mem, size_t size ) {
+}
+
+int ldcs_audit_server_md_set_background ( ldcs_process_data_t *ldcs_process_data ) {
+   /* msocket doesn't limit or mark its traffic */
+   return 0;
+}
+
+int ldcs_audit_server_md_set_bandwidth ( ldcs_process_data_t *ldcs_process_data ) {
+   /* msocket doesn't limit its traffic */
+   return 0;
+}
+
+int ldcs_audit_server_md_print_links ( ldcs_process_data_t *ldcs_process_data ) {
+   /* msocket doesn't measure its links */
+   return 0;
+}
+
+int ldcs_audit_server_md_get_child_index ( ldcs_process_data_t *ldcs_process_data, node_peer_t child ) {
+   int i, fd = (int) (long) child;
+   for (i = 0; i < num_children; i++) {
+      if (child_fds[i] == fd)
+         return i;
+   }
+   return -1;
+}
 
-  return(rc);
+int ldcs_audit_server_md_child_joined ( ldcs_process_data_t *ldcs_process_data, node_peer_t child ) {
+   return 0;
 }
 
-int ldcs_audit_server_md_distribution_required ( ldcs_process_data_t *ldcs_process_data, char *msg ) {
-  int rc=0;
-  
-  /* do distribution of data if more than one server available  */
-  if(ldcs_process_data->md_size>1) { 
-    rc=1;
-  } else {
-    rc=0;
-  }
-  return(rc);
+node_peer_t ldcs_audit_server_md_admit_join ( ldcs_process_data_t *ldcs_process_data, int request, int rank ) {
+   /* Nothing joins an msocket tree */
+   return NODE_PEER_NULL;
+}
+
+int ldcs_audit_server_md_children_linked ( ldcs_process_data_t *ldcs_process_data, node_peer_t a, node_peer_t b ) {
+   return 0;
+}
+
+node_peer_t ldcs_audit_server_md_get_sibling ( ldcs_process_data_t *ldcs_process_data, int sibling ) {
+   return NODE_PEER_NULL;
+}
+
+size_t ldcs_audit_server_md_get_queued ( ldcs_process_data_t *ldcs_process_data, node_peer_t peer ) {
+   /* msocket sends block until they're done */
+   return 0;
 }
 
 int ldcs_audit_server_md_forward_query(ldcs_process_data_t *ldcs_process_data, ldcs_message_t* msg) {
-  int rc=0;
-
-  /* currently not implemented  */
-  
-  return(rc);
-}
-
-int _ldcs_audit_server_md_msocket_server_CB ( int infd, int serverid, void *data ) {
-  int rc=0;
-  ldcs_msocket_data_t *ldcs_msocket_data = (ldcs_msocket_data_t *) data ;
-  int nc, fd, more_avail;
-  double cb_starttime;
-
-  cb_starttime=ldcs_get_time();
-
-  debug_printf3("starting callback\n");
-
-  more_avail=1;
-  while(more_avail) {
-    
-    /* add new connection */
-    nc=ldcs_audit_server_md_msocket_get_free_connection_table_entry (ldcs_msocket_data);
-
-    ldcs_msocket_data->connection_table[nc].connid       = ldcs_open_server_connections_socket(serverid,&more_avail);
-    ldcs_msocket_data->connection_table[nc].state        = LDCS_CONNECTION_STATUS_ACTIVE;
-    ldcs_msocket_data->connection_table[nc].null_msg_cnt = 0;    
-    ldcs_msocket_data->connection_table[nc].remote_rank  = -2; /* not yet identified */
-    printf("SERVER[%02d]: open connection on host %s #c=%02d at %12.4f\n", ldcs_msocket_data->md_rank, 
-	   ldcs_msocket_data->hostname, 
-	   ldcs_msocket_data->connection_counter,ldcs_get_time());
-    
-    /* register connection fd to listener */
-    fd=ldcs_get_fd_socket(ldcs_msocket_data->connection_table[nc].connid);
-    ldcs_listen_register_fd(fd, nc, &_ldcs_audit_server_md_msocket_connection_CB, (void *) ldcs_msocket_data);
-    ldcs_msocket_data->server_stat.num_connections++;
-  }
-
-  /* remember timestamp of connect of first connection */
-  if(ldcs_msocket_data->server_stat.starttime<0) {
-    ldcs_msocket_data->server_stat.starttime=cb_starttime;
-  }
-  ldcs_msocket_data->server_stat.server_cb.cnt++;
-  ldcs_msocket_data->server_stat.server_cb.time+=(ldcs_get_time()-cb_starttime);
-
-  debug_printf3("ending callback\n");
-
-  return(rc);
-}
-
-
-int _ldcs_audit_server_md_msocket_connection_CB ( int fd, int nc, void *data ) {
-  int rc=0;
-  ldcs_msocket_data_t *ldcs_msocket_data = (ldcs_msocket_data_t *) data ;
-  ldcs_process_data_t *ldcs_process_data = ldcs_msocket_data->procdata ;
-  ldcs_message_t *msg, *out_msg;
-  double starttime,cb_starttime;
-#ifdef LDCSDEBUG
-  double msg_time;
-#endif
-  int connid, do_route, do_process;
-  cb_starttime=ldcs_get_time();
-
-  connid=ldcs_msocket_data->connection_table[nc].connid;
-  debug_printf3("starting callback for fd=%d nc=%d connid=%d lfd=%d rrank=%d\n",fd,nc,connid,ldcs_get_fd(connid),ldcs_msocket_data->connection_table[nc].remote_rank);
-  
-  /* get message  */
-  starttime=ldcs_get_time();
-  msg=ldcs_recv_msg_socket(connid, LDCS_READ_BLOCK);
-#ifdef LDCSDEBUG
-  msg_time=ldcs_get_time()-starttime;
-  debug_printf3("received message on connection  nc=%d connid=%d routing: %d -> %d %s %s (%10.4fs) \n", nc, connid, 
-	       msg->header.source, msg->header.dest,
-	       _message_type_to_str(msg->header.type),(msg->header.mtype==LDCS_MSG_MTYPE_P2P)?"P2P":"BCAST", msg_time);
-#endif
+   /* We're root--no one to forward a query to */
+   if (ldcs_process_data->md_rank == 0)
+      return 0;
+
+   if (write_msg(parent_fd, msg) < 0) {
+      err_printf("Problem writing message to msocket parent\n");
+      return -1;
+   }
+   return 0;
+}
 
-  /* check if msg dest is not addressed me or must be bcast */
-
-  if ( msg->header.type==LDCS_MSG_MD_HOSTINFO ) {
-    /* no hostinfo up to now */
-    do_route=0;	do_process=1;
-  } else {
-    if (msg->header.mtype==LDCS_MSG_MTYPE_P2P) {
-      if (msg->header.dest==ldcs_msocket_data->hostinfo.rank) {
-	do_route=0;do_process=1;
-      } else {
-	do_route=1;do_process=0;
-      }
-    } else {
-      /* bcast */
-      do_route=1; do_process=1;
-    }
-  }
-
-  debug_printf3("do_route=%d, do_process=%d \n", do_route, do_process); 
-
-  if(do_route) {
-    ldcs_audit_server_md_msocket_route_msg(ldcs_msocket_data, msg);
-  }
-
-  if(!do_process) {
-    ldcs_msg_free(&msg);
-    return(rc);
-  }
-
-  /* otherwise process message */
-  switch(msg->header.type) {
-
-  case LDCS_MSG_PRELOAD_FILE:
-    {
-      debug_printf3("MDSERVER[%02d]: new preload file name received %d (%s)\n",
-		   ldcs_process_data->md_rank,msg->header.len, msg->data);
-      
-
-      /* send bootstrap msg to client  */
-      out_msg=ldcs_msg_new();
-      out_msg->header.mtype=LDCS_MSG_MTYPE_P2P;
-      out_msg->header.dest=-1;
-      out_msg->header.source=ldcs_msocket_data->hostinfo.rank;  out_msg->header.from=ldcs_msocket_data->hostinfo.rank; 
-      out_msg->header.len=0;      out_msg->alloclen=0;	out_msg->data=NULL;
-      
-            /* send ack */
-      if(rc==1) {
-	out_msg->header.type=LDCS_MSG_PRELOAD_FILE_OK;
-      } else {
-	out_msg->header.type=LDCS_MSG_PRELOAD_FILE_NOT_FOUND;
+int ldcs_audit_server_md_complete_msg_read(node_peer_t peer, ldcs_message_t *msg, void *mem, size_t size)
+{
+   assert(msg->header.len >= size);
+   return ll_read((int) (long) peer, mem, size);
+}
+
+int ldcs_audit_server_md_complete_msg_read_file(node_peer_t peer, ldcs_message_t *msg, int file_fd,
+                                                void *mem, size_t size)
+{
+   assert(msg->header.len >= size);
+   if (!size)
+      return 0;
+   return read_file_data((int) (long) peer, file_fd, mem, 0, size);
+}
+
+int ldcs_audit_server_md_trash_bytes(node_peer_t peer, size_t size)
+{
+   char buffer[4096];
+   int fd = (int) (long) peer;
+   size_t chunk;
+
+   while (size) {
+      chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+      if (ll_read(fd, buffer, chunk) == -1)
+         return -1;
+      size -= chunk;
+   }
+   return 0;
+}
+
+int ldcs_audit_server_md_recv_from_parent(ldcs_message_t *msg)
+{
+   node_peer_t peer;
+   return read_msg(parent_fd, &peer, msg, 0);
+}
+
+int ldcs_audit_server_md_msocket_CB(int fd, int nc, void *data)
+{
+   int rc;
+   ldcs_process_data_t *ldcs_process_data = (ldcs_process_data_t *) data;
+   ldcs_message_t msg;
+   double starttime = ldcs_get_time();
+   node_peer_t peer;
+
+   rc = read_msg(fd, &peer, &msg, 1);
+   if (rc == -1)
+      return -1;
+
+   rc = handle_server_message(ldcs_process_data, peer, &msg);
+
+   ldcs_process_data->server_stat.md_cb.cnt++;
+   ldcs_process_data->server_stat.md_cb.time += (ldcs_get_time() - starttime);
+
+   msgpool_free(msg.data);
+   return rc;
+}
+
+int ldcs_audit_server_md_gather_children(ldcs_process_data_t *ldcs_process_data, node_peer_t from, long usecs)
+{
+   static int gathering = 0;
+   struct pollfd *fds;
+   struct timespec timeout;
+   int i, num_polled = 0, num_heard = 0, result;
+   double starttime, remaining;
+
+   if (!num_children || usecs <= 0 || gathering)
+      return 0;
+
+   fds = (struct pollfd *) malloc(sizeof(struct pollfd) * num_children);
+   if (!fds)
+      return 0;
+   for (i = 0; i < num_children; i++) {
+      if (child_fds[i] == (int) (long) from)
+         continue;
+      fds[num_polled].fd = child_fds[i];
+      fds[num_polled].events = POLLIN;
+      num_polled++;
+   }
+   if (!num_polled) {
+      free(fds);
+      return 0;
+   }
+   gathering = 1;
+
+   starttime = ldcs_get_time();
+   while (num_heard < num_polled) {
+      remaining = usecs / 1000000.0 - (ldcs_get_time() - starttime);
+      if (remaining <= 0.0)
+         break;
+      timeout.tv_sec = (time_t) remaining;
+      timeout.tv_nsec = (long) ((remaining - timeout.tv_sec) * 1000000000.0);
+      for (i = 0; i < num_polled; i++)
+         fds[i].revents = 0;
+      result = ppoll(fds, num_polled, &timeout, NULL);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         break;
+      for (i = 0; i < num_polled; i++) {
+         if (!fds[i].revents)
+            continue;
+         if (fds[i].revents & POLLIN) {
+            ldcs_process_data->server_stat.aggregate.cnt++;
+            if (ldcs_audit_server_md_msocket_CB(fds[i].fd, 0, ldcs_process_data) == -1)
+               err_printf("Error handling message from child on msocket FD %d\n", fds[i].fd);
+         }
+         fds[i].fd = -1;
+         num_heard++;
       }
+   }
+   ldcs_process_data->server_stat.aggregate.time += ldcs_get_time() - starttime;
+   gathering = 0;
+
+   free(fds);
+   return 0;
+}
+
+int ldcs_audit_server_md_send(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg, node_peer_t peer)
+{
+   return write_msg((int) (long) peer, msg);
+}
+
+/* Keep a large message's header out of a packet of its own */
+static void cork_socket(int fd, int on)
+{
+#if defined(TCP_CORK)
+   setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+}
 
-      ldcs_send_msg_socket(connid,out_msg);
+static int send_noncontig(int fd, ldcs_message_t *msg, int file_fd,
+                          void *secondary_data, size_t secondary_size)
+{
+   int result;
+   size_t initial_size;
+
+   assert(msg->header.len >= secondary_size);
+   initial_size = msg->header.len - secondary_size;
+
+   if (secondary_size >= CORK_MIN_SIZE)
+      cork_socket(fd, 1);
+
+   result = ll_write(fd, msg, sizeof(*msg));
+   if (result != -1 && initial_size) {
+      assert(msg->data);
+      result = ll_write(fd, msg->data, initial_size);
+   }
+   if (result != -1)
+      result = write_file_data(fd, file_fd, secondary_data, 0, secondary_size);
+
+   if (secondary_size >= CORK_MIN_SIZE)
+      cork_socket(fd, 0);
+   return result;
+}
 
-    }
-    break;
+int ldcs_audit_server_md_send_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                        node_peer_t peer,
+                                        void *secondary_data, size_t secondary_size)
+{
+   return ldcs_audit_server_md_send_noncontig_file(ldcs_process_data, msg, peer, -1,
+                                                   secondary_data, secondary_size);
+}
 
-  case LDCS_MSG_MD_HOSTINFO:
-    {
+int ldcs_audit_server_md_send_noncontig_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                             node_peer_t peer, int file_fd,
+                                             void *secondary_data, size_t secondary_size)
+{
+   if (!secondary_size)
+      return ldcs_audit_server_md_send(ldcs_process_data, msg, peer);
+   return send_noncontig((int) (long) peer, msg, file_fd, secondary_data, secondary_size);
+}
 
-      /* store info about local server only, action at hostlist msg  */
-      ldcs_msocket_hostinfo_t *hostinfo=(ldcs_msocket_hostinfo_t *) msg->data;
-      debug_printf3("HOSTINFO: received %d of %d  (%d of %d)\n", hostinfo->rank, hostinfo->size, ldcs_msocket_data->hostinfo.rank, ldcs_msocket_data->hostinfo.size); 
-      if(ldcs_msocket_data->hostinfo.rank>=0) {
-	if(ldcs_msocket_data->hostinfo.rank!=hostinfo->rank) {
-	  _error("different rank from external fabric ...");
-	}
+int ldcs_audit_server_md_forward_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                           node_peer_t src, node_peer_t *peers, int num_peers,
+                                           int file_fd, void *mem, size_t size, size_t chunk_size)
+{
+   int *fds, i, result, global_result = 0;
+   size_t initial_size, pos, chunk;
+   int src_fd = (int) (long) src;
+
+   assert(msg->header.len >= size);
+   initial_size = msg->header.len - size;
+
+   if (!peers)
+      num_peers = num_children;
+   fds = (int *) malloc(sizeof(int) * (num_peers ? num_peers : 1));
+   if (!fds)
+      return -1;
+   for (i = 0; i < num_peers; i++)
+      fds[i] = peers ? (int) (long) peers[i] : child_fds[i];
+
+   /* Send header and initial part of data */
+   for (i = 0; i < num_peers; i++) {
+      if (size >= CORK_MIN_SIZE)
+         cork_socket(fds[i], 1);
+      result = ll_write(fds[i], msg, sizeof(*msg));
+      if (result != -1 && initial_size) {
+         assert(msg->data);
+         result = ll_write(fds[i], msg->data, initial_size);
+      }
+      if (result == -1) {
+         if (size >= CORK_MIN_SIZE)
+            cork_socket(fds[i], 0);
+         fds[i] = -1;
+         global_result = -1;
       }
-      ldcs_msocket_data->hostinfo.rank=hostinfo->rank;      ldcs_msocket_data->hostinfo.size=hostinfo->size;
-      ldcs_msocket_data->hostinfo.topo=hostinfo->topo;
-      ldcs_process_data->md_rank=hostinfo->rank;
-      ldcs_process_data->md_size=hostinfo->size;
-      
-      /* info about connection */
-      ldcs_msocket_data->connection_table[nc].remote_rank  = msg->header.from;
-      
-      /* get info about connection? */
-      if(ldcs_msocket_data->connection_table[nc].remote_rank!=-2) {
-	ldcs_msocket_data->connection_table[nc].remote_rank  = msg->header.from;
-
-	/* Is this connection part of topo? */
-	if ( (hostinfo->cinfo_to==ldcs_process_data->md_rank) &&
-	     (hostinfo->cinfo_from>=0) ) {
-	  ldcs_msocket_data->connection_table[nc].ctype=LDCS_CONNECTION_TYPE_TOPO;
-	  /* pocess more info, e.g. dir ... */
-	} else {
-	  ldcs_msocket_data->connection_table[nc].ctype=LDCS_CONNECTION_TYPE_CONTROL;
-	} 
+   }
+
+   /* Pass each chunk on as soon as it has arrived.  A peer that fails
+      is dropped, but we keep reading so the source stream stays intact. */
+   for (pos = 0; pos < size; pos += chunk) {
+      chunk = (size - pos < chunk_size) ? size - pos : chunk_size;
+      if (read_file_data(src_fd, file_fd, mem, pos, chunk) == -1) {
+         global_result = -1;
+         break;
       }
-      debug_printf3("MDSERVER[%02d]: hostinfo received from %d (%d of %d, depth %d)\n",ldcs_process_data->md_rank,
-		   msg->header.source, hostinfo->rank,hostinfo->size,hostinfo->depth); 
-    }
-    break;
-
-  case LDCS_MSG_MD_HOSTLIST:
-    {
-      int rank;
-
-      ldcs_msocket_data->hostlist = (char**) malloc(ldcs_process_data->md_size * sizeof(char*));
-      if(!ldcs_msocket_data->hostlist) _error("could not allocate hostlist");
-      ldcs_msocket_data->portlist = malloc(ldcs_process_data->md_size * sizeof(int));
-      if(!ldcs_msocket_data->portlist) _error("could not allocate portlist");
-  
-      for(rank=0;rank<ldcs_process_data->md_size;rank++) {
-	ldcs_msocket_data->hostlist[rank]=ldcs_audit_server_md_msocket_expand_hostname(msg->data,msg->header.len,rank);
-	ldcs_msocket_data->portlist[rank]=-1;
+      for (i = 0; i < num_peers; i++) {
+         if (fds[i] == -1)
+            continue;
+         if (write_file_data(fds[i], file_fd, mem, pos, chunk) == -1) {
+            if (size >= CORK_MIN_SIZE)
+               cork_socket(fds[i], 0);
+            fds[i] = -1;
+            global_result = -1;
+         }
       }
-      debug_printf3("MDSERVER: hostlist received from %d (%d bytes)\n",ldcs_process_data->md_rank,msg->header.len);
+   }
+
+   for (i = 0; i < num_peers && size >= CORK_MIN_SIZE; i++) {
+      if (fds[i] != -1)
+         cork_socket(fds[i], 0);
+   }
+   free(fds);
+   return global_result;
+}
 
-    }
-    break;
+int ldcs_audit_server_md_broadcast(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg)
+{
+   int i, global_result = 0;
 
+   for (i = 0; i < num_children; i++) {
+      SPINDLE_PROBE3(bcast_send, child_fds[i], (int) msg->header.type, msg->header.len);
+      if (write_msg(child_fds[i], msg) == -1)
+         global_result = -1;
+   }
+   return global_result;
+}
 
-  case LDCS_MSG_MD_BOOTSTRAP:
-    {
-      if(ldcs_msocket_data->hostinfo.rank==0) {
-	debug_printf3("MDSERVER: initiate bootstrap of network topology on root node\n");
-	ldcs_audit_server_md_msocket_init_topo_bootstrap(ldcs_msocket_data);
-      } else {
-	debug_printf3("MDSERVER: run bootstrap of network topology on non-root node\n");
-	ldcs_audit_server_md_msocket_run_topo_bootstrap(ldcs_msocket_data, (char *) msg->data, msg->header.len);
-      }
-      
-    }
-    break;
-
-  case LDCS_MSG_MD_BOOTSTRAP_END:
-    {
-      /* ToDo: change to BARRIER over MD server */
-      
-      
-      /* sent message to first host */
-      debug_printf3("switch off initial listening for bootstrap\n");
-           
-      /* signal listener, that listen loop should be ended */
-      ldcs_listen_signal_end_listen_loop();
-
-      if(ldcs_msocket_data->hostinfo.rank==0) {
-
-	out_msg=ldcs_msg_new();
-	
-	/* signal fe that bootstrap is ready */
-	out_msg->header.type=LDCS_MSG_MD_BOOTSTRAP_END_OK;
-	out_msg->header.mtype=LDCS_MSG_MTYPE_P2P;
-	out_msg->header.dest=-1;
-	out_msg->header.source=ldcs_msocket_data->hostinfo.rank;  out_msg->header.from=ldcs_msocket_data->hostinfo.rank; 
-	out_msg->header.len=0;      out_msg->alloclen=0;	out_msg->data=NULL;
-
-	
-	/* sent message to first host */
-	debug_printf3("send msg bootstrap end ok\n");
-	ldcs_send_msg_socket(connid,out_msg);
-	
-	ldcs_msg_free(&out_msg);
-	
-      }
-      
-
-
-    }
-    break;
-
-  case LDCS_MSG_CACHE_ENTRIES:
-    {
-      debug_printf3("MDSERVER[%02d]: new cache entries received, insert %d bytes in local cache\n",
-		   ldcs_process_data->md_rank,msg->header.len);
-      /* printf("MDSERVER[%02d]: recvd NEW ENTRIES: \n", ldcs_process_data->md_rank); */
-      
-      ldcs_process_data->server_stat.distdir.cnt++;
-      ldcs_process_data->server_stat.distdir.bytes+=msg->header.len;
-      ldcs_process_data->server_stat.distdir.time+=(ldcs_get_time()-starttime);
-    
-#warning Fix here
-      //ldcs_cache_storeNewEntriesSerList(msg->data,msg->header.len);
-      
-      /* _ldcs_client_process_clients_requests_after_update( ldcs_process_data ); */
-    }
-    break;
-
-  case LDCS_MSG_FILE_DATA:
-    {
-      char *filename, *dirname, *localpath;
-      double starttime;
-      int domangle;
-
-      debug_printf3("MDSERVER[%02d]: new cache entries received, insert %d bytes in local cache\n",
-		   ldcs_process_data->md_rank,msg->header.len);
-      /* printf("MDSERVER[%02d]: recvd NEW ENTRIES: \n", ldcs_process_data->md_rank); */
-      
-      /* store file */
-      starttime=ldcs_get_time();
-#warning Fix here
-      //rc=ldcs_audit_server_filemngt_store_file(msg, &filename, &dirname, &localpath, &domangle);
-      ldcs_process_data->server_stat.libstore.cnt++;
-      ldcs_process_data->server_stat.libstore.bytes+=rc;
-      ldcs_process_data->server_stat.libstore.time+=(ldcs_get_time()-starttime);
-      
-      /* update cache */
-      ldcs_cache_updateLocalPath(filename, dirname, localpath);
-      ldcs_cache_updateStatus(filename, dirname, LDCS_CACHE_OBJECT_STATUS_LOCAL_PATH);
-      free(filename);  free(dirname); free(localpath);
-
-      ldcs_process_data->server_stat.libdist.cnt++;
-      ldcs_process_data->server_stat.libdist.bytes+=msg->header.len;
-      ldcs_process_data->server_stat.libdist.time+=(ldcs_get_time()-starttime);
-      
-      _ldcs_client_process_clients_requests_after_update( ldcs_process_data );
-
-    }
-    break;
-
-  case LDCS_MSG_END:
-    {
-       debug_printf3("MDSERVER[%02d]: END message received \n", ldcs_process_data->md_rank);
-      
-      ldcs_audit_server_md_unregister_fd ( ldcs_process_data );
-      
-      ldcs_process_data->md_size=1;
-
-      _ldcs_client_process_clients_requests_after_end( ldcs_process_data );
-    }
-    break;
-    
-  default: ;
-    {
-      debug_printf3("MDSERVER[%03d]: recvd unknown message of type: %s len=%d data=%s ...\n", 
-		   ldcs_process_data->md_rank,
-		   _message_type_to_str(msg->header.type),
-		   msg->header.len, msg->data );
-      printf("MDSERVER[%03d]: recvd unknown message of type: %s len=%d data=%s ...\n", ldcs_process_data->md_rank,
-	     _message_type_to_str(msg->header.type),
-	     msg->header.len, msg->data );
-      _error("wrong message");
-    }
-    break;
-  }
-  ldcs_process_data->server_stat.md_cb.cnt++;
-  ldcs_process_data->server_stat.md_cb.time+=(ldcs_get_time()-cb_starttime);
-
-  ldcs_msg_free(&msg);
-
-  return(rc);
+int ldcs_audit_server_md_broadcast_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                             void *secondary_data, size_t secondary_size)
+{
+   return ldcs_audit_server_md_broadcast_noncontig_file(ldcs_process_data, msg, -1,
+                                                        secondary_data, secondary_size);
 }
 
+int ldcs_audit_server_md_broadcast_noncontig_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                                  int file_fd, void *secondary_data, size_t secondary_size)
+{
+   int i, global_result = 0;
+
+   if (!secondary_size)
+      return ldcs_audit_server_md_broadcast(ldcs_process_data, msg);
+
+   for (i = 0; i < num_children; i++) {
+      SPINDLE_PROBE3(bcast_send, child_fds[i], (int) msg->header.type, msg->header.len);
+      if (send_noncontig(child_fds[i], msg, file_fd, secondary_data, secondary_size) == -1)
+         global_result = -1;
+   }
+   return global_result;
+}
+
+int ldcs_audit_server_md_get_num_children(ldcs_process_data_t *procdata)
+{
+   return num_children;
+}
+
+node_peer_t ldcs_audit_server_md_get_child(ldcs_process_data_t *procdata, int child)
+{
+   if (child < 0 || child >= num_children)
+      return NODE_PEER_NULL;
+   return (node_peer_t) (long) child_fds[child];
+}
@@ -19,26 +19,25 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "ldcs_audit_server_md_msocket.h"
 
-struct ldcs_msocket_bootstrap_struct
+/* Shape of the server tree.  Every builder numbers the ranks so that
+   each subtree is a contiguous range starting at its root. */
+struct ldcs_msocket_topo_struct
 {
+  ldcs_topo_type_t type;
   int size;
-  int allocsize;
-  int* fromlist;
-  int* tolist;
-  char** tohostlist;
-  int* toportlist;
+  int fanout;
+  int num_groups;		/* LDCS_TOPO_TYPE_HOST_TREE only */
+  int *group_start;		/* of length num_groups+1 */
+  int *group_of;		/* of length size */
 };
-typedef struct ldcs_msocket_bootstrap_struct ldcs_msocket_bootstrap_t;
+typedef struct ldcs_msocket_topo_struct ldcs_msocket_topo_t;
 
 
-int ldcs_audit_server_md_msocket_init_topo_bootstrap(ldcs_msocket_data_t *ldcs_msocket_data);
-int ldcs_audit_server_md_msocket_run_topo_bootstrap(ldcs_msocket_data_t *ldcs_msocket_data, char *serbootinfo, int serbootlen);
-int _ldcs_audit_server_md_msocket_run_topo_bootstrap(ldcs_msocket_data_t *ldcs_msocket_data, ldcs_msocket_bootstrap_t *bootstrap);
+ldcs_topo_type_t ldcs_audit_server_md_msocket_topo_from_env(int size, int *fanout);
+int ldcs_audit_server_md_msocket_topo_init(ldcs_msocket_topo_t *topo, ldcs_topo_type_t type, int fanout, int size, char **hostlist);
+int ldcs_audit_server_md_msocket_topo_free(ldcs_msocket_topo_t *topo);
+int ldcs_audit_server_md_msocket_topo_max_children(ldcs_msocket_topo_t *topo);
+int ldcs_audit_server_md_msocket_topo_children(ldcs_msocket_topo_t *topo, int rank, int *children);
 
-int compute_connections(int size, int **connlist, int *connlistsize, int *max_connections);
-int compute_binom_tree(int size, int **connlist, int *connlistsize, int *max_connections);
-
-int ldcs_audit_server_md_msocket_route_msg(ldcs_msocket_data_t *ldcs_msocket_data, ldcs_message_t *msg);
-int ldcs_audit_server_md_msocket_route_msg_binom_tree(ldcs_msocket_data_t *ldcs_msocket_data, ldcs_message_t *msg);
 
 #endif
@@ -18,171 +18,240 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/inotify.h>
 #include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 #include "ldcs_api.h"
-#include "ldcs_api_socket.h"
-#include "ldcs_audit_server_md_msocket_topo.h"
+#include "spindle_debug.h"
+#include "ldcs_cobo.h"
 #include "ldcs_audit_server_md_msocket_util.h"
 
-int ldcs_audit_server_md_msocket_create_server(char *hostname, int *portlist, int num_ports, int *portused) {
-  int fd=-1;
-  int port=0, portindex;
-
-  portindex=0;
-  
-  while((fd<0) && (portindex<num_ports)) { 
-    port=portlist[portindex];
-    fd=ldcs_create_server_socket(hostname, port);
-    portindex++;
-  }
-  *portused=port;
-  return(fd);
+#define MSOCKET_SERVICE_ID 0x4d534f43u   /* "MSOC" */
+#define MSOCKET_ACCEPT_ID  0x41434350u
+#define MSOCKET_CONNECT_TIMEOUT 2        /* seconds for one connect attempt */
+#define MSOCKET_REPLY_TIMEOUT 10         /* seconds for the id exchange */
+#define MSOCKET_CONNECT_TIMELIMIT 120    /* seconds to keep rescanning the ports */
+#define MSOCKET_CONNECT_SLEEP 100000     /* usecs between scans */
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return(tv.tv_sec + tv.tv_usec / 1000000.0);
 }
 
+static void set_timeout(int fd, int optname, int secs) {
+  struct timeval tv;
+  tv.tv_sec=secs;
+  tv.tv_usec=0;
+  setsockopt(fd, SOL_SOCKET, optname, &tv, sizeof(tv));
+}
 
-int ldcs_audit_server_md_msocket_connect(char *hostname, int *portlist, int num_ports) {
-  int fd=-1;
-  int port, portindex;
+/* Unlike ll_read, gives up when a receive timeout set on fd expires */
+static int read_timed(int fd, void *buf, size_t count) {
+  ssize_t result;
+  size_t pos=0;
 
-  portindex=0;
-  
-  while((fd<0) && (portindex<num_ports)) { 
-    port=portlist[portindex];
-    fd=ldcs_open_connection_socket(hostname, port);
-    portindex++;
+  while(pos<count) {
+    result=read(fd, ((char *) buf)+pos, count-pos);
+    if(result==-1 && errno==EINTR) continue;
+    if(result<=0) return(-1);
+    pos+=result;
   }
-  
-  return(fd);
+  return(0);
 }
 
+static int write_all(int fd, void *buf, size_t count) {
+  ssize_t result;
+  size_t pos=0;
 
-/* from cobo, to support same interface */
-int ldcs_audit_server_md_msocket_serialize_hostlist(char **hostlist, int num_hosts, char **rdata, int *rsize) {
-  int rc=0;
-  int i;
-  int size = 0;
-  char *data=NULL;
-  int datasize=0;
-
-
-  /* check that we have some hosts in the hostlist */
-  if (num_hosts <= 0) {
-    return (-1);
-  }
-  
-  /* determine the total number of bytes to hold the strings including terminating NUL character */
-  for (i=0; i < num_hosts; i++) {
-    size += strlen(hostlist[i]) + 1;
-  }
-  
-  /* determine and allocate the total number of bytes to hold the strings plus offset table */
-  datasize = num_hosts * sizeof(int) + size;
-  data     = malloc(datasize);
-  if (data == NULL) {
-    _error("Failed to allocate hostname table");
-  }
-
-  /* copy the strings in and fill in the offsets */
-  int offset = num_hosts * sizeof(int);
-  for (i=0; i < num_hosts; i++) {
-    ((int*)data)[i] = offset;
-    strcpy((char*)(data + offset), hostlist[i]);
-    offset += strlen(hostlist[i]) + 1;
+  while(pos<count) {
+    result=write(fd, ((char *) buf)+pos, count-pos);
+    if(result==-1 && errno==EINTR) continue;
+    if(result<=0) return(-1);
+    pos+=result;
   }
+  return(0);
+}
 
-  *rdata=data;
-  *rsize=size;
-
-  return(rc);
+static void tree_socket_opts(int fd) {
+  int on=1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
 
+/* Acts on the result of a handshake.  Returns 0 if it succeeded, or -1 if
+   the connection should be closed and another one tried.  A server closes
+   its port once it has a parent, which can reset a connection mid-handshake,
+   so only a security failure is fatal. */
+static int handshake_result(int result) {
+  switch(result) {
+  case HSHAKE_SUCCESS:
+    return(0);
+  case HSHAKE_DROP_CONNECTION:
+    debug_printf3("Handshake said to drop connection\n");
+    return(-1);
+  case HSHAKE_ABORT:
+    handle_security_error(spindle_handshake_last_error_str());
+    abort();
+  default:
+    debug_printf3("msocket handshake failed: %s\n", spindle_handshake_last_error_str());
+    return(-1);
+  }
 }
 
-/* Allocates a string containing the hostname for specified rank.
- * The return string must be freed by the caller. */
-char* ldcs_audit_server_md_msocket_expand_hostname(char *rdata, int rsize, int rank) {
+int ldcs_audit_server_md_msocket_create_server(unsigned int *ports, int num_ports, unsigned int *portused) {
+  struct sockaddr_in addr;
+  int fd, i, on=1;
 
-  if (rdata == NULL) {
-    return NULL;
+  for(i=0;i<num_ports;i++) {
+    fd=socket(AF_INET, SOCK_STREAM, 0);
+    if(fd==-1) {
+      err_printf("Could not create msocket listening socket: %s\n", strerror(errno));
+      return(-1);
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family=AF_INET;
+    addr.sin_addr.s_addr=htonl(INADDR_ANY);
+    addr.sin_port=htons(ports[i]);
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr))==0 && listen(fd, 128)==0) {
+      debug_printf2("msocket listening on port %u\n", ports[i]);
+      *portused=ports[i];
+      return(fd);
+    }
+    close(fd);
   }
-
-  int* offset = (int*) (rdata + rank * sizeof(int));
-  char* hostname = (char*) (rdata + *offset);
-  
-  return strdup(hostname);
+  err_printf("Could not bind to any of ports %u-%u for msocket\n", ports[0], ports[num_ports-1]);
+  return(-1);
 }
 
+/* Wait for a connection with our session id on listen_fd.  Others, e.g.
+   another job's servers scanning the same ports, are dropped. */
+int ldcs_audit_server_md_msocket_accept(int listen_fd, handshake_protocol_t *handshake, uint64_t session_id) {
+  unsigned int serviceid, acceptid, ack;
+  uint64_t sessionid;
+  int fd;
+
+  for(;;) {
+    fd=accept(listen_fd, NULL, NULL);
+    if(fd==-1) {
+      if(errno==EINTR || errno==ECONNABORTED) continue;
+      err_printf("Could not accept msocket connection: %s\n", strerror(errno));
+      return(-1);
+    }
+    if(handshake_result(spindle_handshake_server(fd, handshake, session_id))==-1) {
+      close(fd);
+      continue;
+    }
 
-int ldcs_audit_server_md_msocket_get_free_connection_table_entry (ldcs_msocket_data_t *ldcs_msocket_data) {
-  int nc=-1;
-  if (ldcs_msocket_data->connection_table_used >= ldcs_msocket_data->connection_table_size) {
-    ldcs_msocket_data->connection_table = realloc(ldcs_msocket_data->connection_table, 
-						  (ldcs_msocket_data->connection_table_used + 16) * sizeof(ldcs_connection_t)
-						  );
-    ldcs_msocket_data->connection_table_size = ldcs_msocket_data->connection_table_used + 16;
-    for(nc=ldcs_msocket_data->connection_table_used;(nc<ldcs_msocket_data->connection_table_used + 16);nc++) {
-      ldcs_msocket_data->connection_table[nc].state=LDCS_CONNECTION_STATUS_FREE;
+    set_timeout(fd, SO_RCVTIMEO, MSOCKET_REPLY_TIMEOUT);
+    serviceid=MSOCKET_SERVICE_ID; acceptid=MSOCKET_ACCEPT_ID;
+    if(read_timed(fd, &serviceid, sizeof(serviceid))==-1 || read_timed(fd, &sessionid, sizeof(sessionid))==-1 ||
+       serviceid!=MSOCKET_SERVICE_ID || sessionid!=session_id) {
+      debug_printf3("Dropping msocket connection from another session\n");
+      close(fd);
+      continue;
     }
+    serviceid=MSOCKET_SERVICE_ID;
+    if(write_all(fd, &serviceid, sizeof(serviceid))==-1 || write_all(fd, &acceptid, sizeof(acceptid))==-1 ||
+       read_timed(fd, &ack, sizeof(ack))==-1) {
+      debug_printf3("msocket connection dropped during id exchange\n");
+      close(fd);
+      continue;
+    }
+    set_timeout(fd, SO_RCVTIMEO, 0);
+    tree_socket_opts(fd);
+    return(fd);
   }
-  for(nc=0;(nc<ldcs_msocket_data->connection_table_size);nc++) {
-    if (ldcs_msocket_data->connection_table[nc].state==LDCS_CONNECTION_STATUS_FREE) break;
-  }
-  if(nc==ldcs_msocket_data->connection_table_size) _error("internal error with connection table (table full)");
-
-  ldcs_msocket_data->connection_table_used++;
-  ldcs_msocket_data->connection_counter++;
-  
-  return(nc);
 }
 
-
-ldcs_msocket_bootstrap_t *ldcs_audit_server_md_msocket_new_bootstrap(int max_connections) {
-  
-  ldcs_msocket_bootstrap_t *bootstrap=NULL;
-
-  /* allocate bootstrap data structure */
-  bootstrap=(ldcs_msocket_bootstrap_t *) malloc(sizeof(ldcs_msocket_bootstrap_t));
-  if(!bootstrap) _error("could not allocate memory for bootstrap");
-
-  bootstrap->size=0;
-  bootstrap->allocsize=max_connections;
-  bootstrap->fromlist=(int *) malloc(max_connections * sizeof(int));
-  if(!bootstrap->fromlist) _error("could not allocate memory for bootstrap->fromlist");
-  bootstrap->tolist=(int *) malloc(max_connections * sizeof(int));
-  if(!bootstrap->tolist) _error("could not allocate memory for bootstrap->tolist");
-  bootstrap->tohostlist=(char **) malloc(max_connections * sizeof(char *));
-  if(!bootstrap->tohostlist) _error("could not allocate memory for bootstrap->toportlist");
-  bootstrap->toportlist=(int *) malloc(max_connections * sizeof(int));
-  if(!bootstrap->toportlist) _error("could not allocate memory for bootstrap->toportlist");
-
-  return(bootstrap);
+static int lookup_host(char *hostname, struct in_addr *saddr) {
+  struct addrinfo hints, *info;
+  int result;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family=AF_INET;
+  hints.ai_socktype=SOCK_STREAM;
+  result=getaddrinfo(hostname, NULL, &hints, &info);
+  if(result!=0) {
+    err_printf("Could not look up host %s: %s\n", hostname, gai_strerror(result));
+    return(-1);
+  }
+  *saddr=((struct sockaddr_in *) info->ai_addr)->sin_addr;
+  freeaddrinfo(info);
+  return(0);
 }
 
-int ldcs_audit_server_md_msocket_free_bootstrap(ldcs_msocket_bootstrap_t *bootstrap) {
-  int rc=0;
+static int try_port(struct in_addr saddr, unsigned int port, handshake_protocol_t *handshake, uint64_t session_id) {
+  struct sockaddr_in addr;
+  unsigned int serviceid=MSOCKET_SERVICE_ID, acceptid=0, ack=1;
+  int fd;
+
+  fd=socket(AF_INET, SOCK_STREAM, 0);
+  if(fd==-1) return(-1);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family=AF_INET;
+  addr.sin_addr=saddr;
+  addr.sin_port=htons(port);
+  /* bounds connect on Linux as well as send */
+  set_timeout(fd, SO_SNDTIMEO, MSOCKET_CONNECT_TIMEOUT);
+  if(connect(fd, (struct sockaddr *) &addr, sizeof(addr))==-1) {
+    close(fd);
+    return(-1);
+  }
+  set_timeout(fd, SO_SNDTIMEO, 0);
+  if(handshake_result(spindle_handshake_client(fd, handshake, session_id))==-1) {
+    close(fd);
+    return(-1);
+  }
+  set_timeout(fd, SO_RCVTIMEO, MSOCKET_REPLY_TIMEOUT);
+  if(write_all(fd, &serviceid, sizeof(serviceid))==-1 || write_all(fd, &session_id, sizeof(session_id))==-1 ||
+     read_timed(fd, &serviceid, sizeof(serviceid))==-1 || read_timed(fd, &acceptid, sizeof(acceptid))==-1 ||
+     serviceid!=MSOCKET_SERVICE_ID || acceptid!=MSOCKET_ACCEPT_ID ||
+     write_all(fd, &ack, sizeof(ack))==-1) {
+    close(fd);
+    return(-1);
+  }
+  set_timeout(fd, SO_RCVTIMEO, 0);
+  tree_socket_opts(fd);
+  return(fd);
+}
 
-  free(bootstrap->fromlist);
-  free(bootstrap->tolist);
-  free(bootstrap->tohostlist);
-  free(bootstrap->toportlist);
+/* Scan ports on hostname until one accepts us, as the server there may
+   not have bound its port yet */
+int ldcs_audit_server_md_msocket_connect(char *hostname, unsigned int *ports, int num_ports,
+                                         handshake_protocol_t *handshake, uint64_t session_id) {
+  struct in_addr saddr;
+  double starttime;
+  int fd, i;
+
+  if(lookup_host(hostname, &saddr)==-1) return(-1);
+
+  starttime=now();
+  do {
+    for(i=0;i<num_ports;i++) {
+      debug_printf3("Trying msocket port %u on %s\n", ports[i], hostname);
+      fd=try_port(saddr, ports[i], handshake, session_id);
+      if(fd!=-1) {
+        debug_printf2("Connected to %s on msocket port %u\n", hostname, ports[i]);
+        return(fd);
+      }
+    }
+    usleep(MSOCKET_CONNECT_SLEEP);
+  } while(now()-starttime<MSOCKET_CONNECT_TIMELIMIT);
 
-  
-  return(rc);
+  err_printf("Could not connect to a server on %s on ports %u-%u\n", hostname, ports[0], ports[num_ports-1]);
+  return(-1);
 }
 
-int ldcs_audit_server_md_msocket_dump_bootstrap(ldcs_msocket_bootstrap_t *bootstrap) {
-  int rc=0;
-  int i;
-  for (i=0; i < bootstrap->size; i++) {
-    debug_printf3("DUMP bootstrap: %2d -> %2d (%s,%d)\n",
-		 bootstrap->fromlist[i],bootstrap->tolist[i],
-		 bootstrap->tohostlist[i],bootstrap->toportlist[i]);
-  }
-  return(rc);
-}
 
-int ldcs_audit_server_md_msocket_serialize_bootstrap(ldcs_msocket_bootstrap_t *bootstrap, char **rdata, int *rsize) {
+/* from cobo, to support same interface */
+int ldcs_audit_server_md_msocket_serialize_hostlist(char **hostlist, int num_hosts, char **rdata, int *rsize) {
   int rc=0;
   int i;
   int size = 0;
@@ -190,51 +259,30 @@ int ldcs_audit_server_md_msocket_serialize_bootstrap(ldcs_msocket_bootstrap_t *b
   int datasize=0;
 
 
-  ldcs_audit_server_md_msocket_dump_bootstrap(bootstrap);
-
-  /* check that we have some entries */
-  if (bootstrap->size < 0) {
-    *rdata=NULL;
-    *rsize=0;
+  /* check that we have some hosts in the hostlist */
+  if (num_hosts <= 0) {
     return (-1);
   }
   
   /* determine the total number of bytes to hold the strings including terminating NUL character */
-  for (i=0; i < bootstrap->size; i++) {
-    size += strlen(bootstrap->tohostlist[i]) + 1;
+  for (i=0; i < num_hosts; i++) {
+    size += strlen(hostlist[i]) + 1;
   }
   
   /* determine and allocate the total number of bytes to hold the strings plus offset table */
-  datasize = bootstrap->size * sizeof(int) + size;
-  
-  /* additional info */
-  datasize += ( 3 * bootstrap->size + 2 ) * sizeof(int);
-
+  datasize = num_hosts * sizeof(int) + size;
   data     = malloc(datasize);
   if (data == NULL) {
-    _error("Failed to allocate hostname table");
+    err_printf("Failed to allocate hostname table\n");
+    return (-1);
   }
 
-  int o = 0;
-  ((int*)data)[o] = bootstrap->size; o++;
-  ((int*)data)[o] = bootstrap->allocsize; o++;
-  
-  for (i=0; i < bootstrap->size; i++) {
-    ((int*)data)[o] = bootstrap->fromlist[i]; o++;
-  }
-  for (i=0; i < bootstrap->size; i++) {
-    ((int*)data)[o] = bootstrap->tolist[i]; o++;
-  }
-  for (i=0; i < bootstrap->size; i++) {
-    ((int*)data)[o] = bootstrap->toportlist[i]; o++;
-  }
-  
   /* copy the strings in and fill in the offsets */
-  int offset = o * sizeof(int) + bootstrap->size * sizeof(int);
-  for (i=0; i < bootstrap->size; i++) {
-    ((int*)data)[o+i] = offset;
-    strcpy((char*)(data + offset), bootstrap->tohostlist[i]);
-    offset += strlen(bootstrap->tohostlist[i]) + 1;
+  int offset = num_hosts * sizeof(int);
+  for (i=0; i < num_hosts; i++) {
+    ((int*)data)[i] = offset;
+    strcpy((char*)(data + offset), hostlist[i]);
+    offset += strlen(hostlist[i]) + 1;
   }
 
   *rdata=data;
@@ -244,61 +292,55 @@ int ldcs_audit_server_md_msocket_serialize_bootstrap(ldcs_msocket_bootstrap_t *b
 
 }
 
+/* Returns a table of the numhosts hostnames in rdata, which point into
+ * rdata, or NULL if it's malformed.  The table must be freed by the caller. */
+char** ldcs_audit_server_md_msocket_expand_hostlist(char *rdata, int rsize, int numhosts) {
+  char **hostlist;
+  int i, offset;
 
-int ldcs_audit_server_md_msocket_deserialize_bootstrap(char *data, int datasize, ldcs_msocket_bootstrap_t **rbootstrap) {
-  int rc=0;
-  ldcs_msocket_bootstrap_t *bootstrap;
-  int size;
-  int i,o;
-
-  /* check that we have some entries */
-  if (datasize <= 0) {
-    return (-1);
+  if (rdata == NULL || numhosts <= 0 || rsize < numhosts * (int) sizeof(int) || rdata[rsize-1] != '\0') {
+    return NULL;
   }
-  
-  o=0;
-  size=((int*)data)[o];  o++;
 
-  debug_printf3("deserialize: size = %d\n",size);
-  
-  /* check again i we have some entries */
-  if (size <= 0) {
-    return (-1);
+  hostlist = (char **) malloc(numhosts * sizeof(char *));
+  if (hostlist == NULL) {
+    return NULL;
   }
-
-  bootstrap=ldcs_audit_server_md_msocket_new_bootstrap(size);
-
-  /* allocate bootstrap data structure */
-  bootstrap->size=size;
-  bootstrap->allocsize=((int*)data)[o]; o++;
-
-  for (i=0; i < bootstrap->size; i++) {
-    bootstrap->fromlist[i]=((int*)data)[o]; o++;
-    debug_printf3("deserialize: from[%d] = %d\n",i,bootstrap->fromlist[i]);
+  for (i=0; i < numhosts; i++) {
+    offset = ((int*)rdata)[i];
+    if (offset < numhosts * (int) sizeof(int) || offset >= rsize) {
+      free(hostlist);
+      return NULL;
+    }
+    hostlist[i] = rdata + offset;
   }
+  return hostlist;
+}
 
-  for (i=0; i < bootstrap->size; i++) {
-    bootstrap->tolist[i]=((int*)data)[o]; o++;
-    debug_printf3("deserialize: to[%d] = %d\n",i,bootstrap->tolist[i]);
+int ldcs_audit_server_md_msocket_send_hostinfo(int fd, ldcs_msocket_hostinfo_t *hostinfo, char *hostlist_data) {
+  if(write_all(fd, hostinfo, sizeof(*hostinfo))==-1 ||
+     write_all(fd, hostlist_data, hostinfo->hostlist_size)==-1) {
+    err_printf("Could not send hostinfo on msocket fd %d: %s\n", fd, strerror(errno));
+    return(-1);
   }
+  return(0);
+}
 
-  for (i=0; i < bootstrap->size; i++) {
-    bootstrap->toportlist[i]=((int*)data)[o]; o++;
-    debug_printf3("deserialize: toport[%d] = %d\n",i,bootstrap->toportlist[i]);
+int ldcs_audit_server_md_msocket_recv_hostinfo(int fd, ldcs_msocket_hostinfo_t *hostinfo, char **hostlist_data) {
+  if(read_timed(fd, hostinfo, sizeof(*hostinfo))==-1 || hostinfo->hostlist_size<=0 ||
+     hostinfo->rank<0 || hostinfo->rank>=hostinfo->size) {
+    err_printf("Could not read hostinfo from msocket fd %d\n", fd);
+    return(-1);
   }
-
-  /* copy the strings in and fill in the offsets */
-  int offset = o * sizeof(int) + bootstrap->size * sizeof(int);
-  for (i=0; i < bootstrap->size; i++) {
-    offset=((int*)data)[o+i];
-    bootstrap->tohostlist[i]=strdup((char*)(data + offset));
-    debug_printf3("deserialize: tohost[%d] = %s\n",i,bootstrap->tohostlist[i]);
+  *hostlist_data=(char *) malloc(hostinfo->hostlist_size);
+  if(!*hostlist_data) {
+    err_printf("Could not allocate hostlist of %d bytes\n", hostinfo->hostlist_size);
+    return(-1);
   }
-
-  ldcs_audit_server_md_msocket_dump_bootstrap(bootstrap);
-
-  *rbootstrap=bootstrap;
-
-  return(rc);
-
+  if(read_timed(fd, *hostlist_data, hostinfo->hostlist_size)==-1) {
+    err_printf("Could not read hostlist from msocket fd %d\n", fd);
+    free(*hostlist_data);
+    return(-1);
+  }
+  return(0);
 }
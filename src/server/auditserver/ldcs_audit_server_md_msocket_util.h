@@ -17,24 +17,23 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef LDCS_AUDIT_SERVER_MD_MSOCKET_UTIL_H
 #define LDCS_AUDIT_SERVER_MD_MSOCKET_UTIL_H
 
+#include <stdint.h>
+#include "handshake.h"
 #include "ldcs_audit_server_md_msocket.h"
-#include "ldcs_audit_server_md_msocket_topo.h"
 
-int ldcs_audit_server_md_msocket_create_server(char * location, int *portlist, int num_ports, int *portused); 
+/* Shared by the msocket servers and front end.  Every link is opened by
+   connecting to the first port of ports that answers the handshake with
+   our session id, so servers of other jobs in the same range are skipped. */
 
-int ldcs_audit_server_md_msocket_serialize_hostlist(char **hostlist, int numhosts, char **rdata, int *rsize);
-char* ldcs_audit_server_md_msocket_expand_hostname(char *rdata, int rsize, int rank);
-
-
-ldcs_msocket_bootstrap_t *ldcs_audit_server_md_msocket_new_bootstrap(int max_connections);
-int ldcs_audit_server_md_msocket_free_bootstrap(ldcs_msocket_bootstrap_t *bootstrap);
-int ldcs_audit_server_md_msocket_dump_bootstrap(ldcs_msocket_bootstrap_t *bootstrap);
-int ldcs_audit_server_md_msocket_serialize_bootstrap(ldcs_msocket_bootstrap_t *bootstrap, char **rdata, int *rsize);
-int ldcs_audit_server_md_msocket_deserialize_bootstrap(char *data, int datasize, ldcs_msocket_bootstrap_t **rbootstrap);
+int ldcs_audit_server_md_msocket_create_server(unsigned int *ports, int num_ports, unsigned int *portused);
+int ldcs_audit_server_md_msocket_accept(int listen_fd, handshake_protocol_t *handshake, uint64_t session_id);
+int ldcs_audit_server_md_msocket_connect(char *hostname, unsigned int *ports, int num_ports,
+                                         handshake_protocol_t *handshake, uint64_t session_id);
 
-int ldcs_audit_server_md_msocket_get_free_connection_table_entry (ldcs_msocket_data_t *ldcs_msocket_data);
-
-int ldcs_audit_server_md_msocket_connect(char *hostname, int *portlist, int num_ports);
+int ldcs_audit_server_md_msocket_serialize_hostlist(char **hostlist, int numhosts, char **rdata, int *rsize);
+char **ldcs_audit_server_md_msocket_expand_hostlist(char *rdata, int rsize, int numhosts);
 
+int ldcs_audit_server_md_msocket_send_hostinfo(int fd, ldcs_msocket_hostinfo_t *hostinfo, char *hostlist_data);
+int ldcs_audit_server_md_msocket_recv_hostinfo(int fd, ldcs_msocket_hostinfo_t *hostinfo, char **hostlist_data);
 
 #endif
@@ -44,6 +44,51 @@ int ldcs_audit_server_md_unregister_fd ( ldcs_process_data_t *data ) {
   return(rc);
 }
 
+int ldcs_audit_server_md_open_streams ( ldcs_process_data_t *data ) {
+  return 0;
+}
+
+int ldcs_audit_server_md_open_peers ( ldcs_process_data_t *data ) {
+  return 0;
+}
+
+int ldcs_audit_server_md_open_bypass ( ldcs_process_data_t *data ) {
+  return 0;
+}
+
+int ldcs_audit_server_md_bypass_slow ( ldcs_process_data_t *data, ldcs_message_t *msg,
+                                       int file_fd, void *secondary_data, size_t secondary_size ) {
+  return 0;
+}
+
+int ldcs_audit_server_md_set_background ( ldcs_process_data_t *data ) {
+  return 0;
+}
+
+int ldcs_audit_server_md_set_bandwidth ( ldcs_process_data_t *data ) {
+  return 0;
+}
+
+int ldcs_audit_server_md_print_links ( ldcs_process_data_t *data ) {
+  return 0;
+}
+
+int ldcs_audit_server_md_get_child_index ( ldcs_process_data_t *data, node_peer_t child ) {
+  return -1;
+}
+
+int ldcs_audit_server_md_children_linked ( ldcs_process_data_t *data, node_peer_t a, node_peer_t b ) {
+  return 0;
+}
+
+node_peer_t ldcs_audit_server_md_get_sibling ( ldcs_process_data_t *data, int sibling ) {
+  return NODE_PEER_NULL;
+}
+
+size_t ldcs_audit_server_md_get_queued ( ldcs_process_data_t *data, node_peer_t peer ) {
+  return 0;
+}
+
 int ldcs_audit_server_md_destroy ( ldcs_process_data_t *data ) {
   int rc=0;
 
@@ -56,6 +101,29 @@ int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *data, char *msg )
   return(rc);
 }
 
+int ldcs_audit_server_md_is_reader ( ldcs_process_data_t *data, char *dir ) {
+  return ldcs_audit_server_md_is_responsible(data, dir);
+}
+
+int ldcs_audit_server_md_is_rack_leader ( ldcs_process_data_t *data ) {
+  return ldcs_audit_server_md_is_responsible(data, "");
+}
+
+int ldcs_audit_server_md_get_num_readers ( ldcs_process_data_t *data ) {
+  return 1;
+}
+
+node_peer_t ldcs_audit_server_md_get_reader ( ldcs_process_data_t *data, int i ) {
+  return NODE_PEER_NULL;
+}
+
+int ldcs_audit_server_md_gather_children ( ldcs_process_data_t *data, node_peer_t from, long usecs ) {
+  return 0;
+}
+
+void ldcs_audit_server_md_release_buffer ( void *mem, size_t size ) {
+}
+
 int ldcs_audit_server_md_forward_query(ldcs_process_data_t *ldcs_process_data, ldcs_message_t* msg) {
   int rc=0;
 
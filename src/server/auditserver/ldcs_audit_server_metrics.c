@@ -0,0 +1,207 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+#include "ldcs_audit_server_metrics.h"
+#include "ldcs_audit_server_md.h"
+#include "ldcs_audit_server_requestors.h"
+#include "ldcs_audit_server_latency.h"
+#include "ldcs_audit_server_steps.h"
+#include "ldcs_cache.h"
+#include "spindle_debug.h"
+
+#define METRICS_NAME "spindle_metrics"
+
+static int timer_fd = -1;
+static char *metrics_path = NULL;
+
+static long resident_bytes()
+{
+   long pages = 0, resident = 0;
+   FILE *f = fopen("/proc/self/statm", "r");
+   if (!f)
+      return 0;
+   if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+   fclose(f);
+   return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void write_entry(FILE *f, const char *name, const char *help, ldcs_server_stat_entry_t *entry)
+{
+   fprintf(f, "# HELP spindle_%s_total %s\n", name, help);
+   fprintf(f, "# TYPE spindle_%s_total counter\n", name);
+   fprintf(f, "spindle_%s_total %d\n", name, entry->cnt);
+   fprintf(f, "spindle_%s_bytes_total %ld\n", name, entry->bytes);
+}
+
+static void write_gauge(FILE *f, const char *name, const char *help, double value)
+{
+   fprintf(f, "# HELP spindle_%s %s\n", name, help);
+   fprintf(f, "# TYPE spindle_%s gauge\n", name);
+   fprintf(f, "spindle_%s %.17g\n", name, value);
+}
+
+static void write_metrics(ldcs_process_data_t *procdata, FILE *f)
+{
+   ldcs_server_stat_t *stat = &procdata->server_stat;
+   latency_summary_t summary;
+   int i, num_children;
+
+   _ldcs_server_stat_collect(procdata);
+   write_gauge(f, "updated_seconds", "Unix time of this update", ldcs_get_time());
+   write_gauge(f, "uptime_seconds", "Time since the first client connected",
+               stat->starttime < 0 ? 0.0 : ldcs_get_time() - stat->starttime);
+   write_gauge(f, "rank", "Our rank in the server tree", procdata->md_rank);
+   write_gauge(f, "resident_bytes", "Resident memory of the server", resident_bytes());
+
+   write_gauge(f, "cache_staged_bytes", "Bytes of files staged on this node", ldcs_cache_stagedBytes());
+   write_gauge(f, "cache_budget_bytes", "Limit on staged bytes, 0 for none",
+               ((double) procdata->cache_budget) * 1024 * 1024);
+   write_entry(f, "files_staged", "Files and directories stored on this node", &stat->libstore);
+   write_entry(f, "files_read", "Files read from the shared file system", &stat->libread);
+   write_entry(f, "files_sent", "Files sent on to other servers", &stat->libdist);
+   write_entry(f, "files_evicted", "Staged files dropped for the cache budget", &stat->evict);
+
+   fprintf(f, "# HELP spindle_fs_ops_total Operations we issued against the shared file system\n");
+   fprintf(f, "# TYPE spindle_fs_ops_total counter\n");
+   fprintf(f, "spindle_fs_ops_total{op=\"open\"} %d\n", stat->fs_open.cnt);
+   fprintf(f, "spindle_fs_ops_total{op=\"stat\"} %d\n", stat->fs_stat.cnt);
+   fprintf(f, "spindle_fs_ops_total{op=\"readdir\"} %d\n", stat->fs_readdir.cnt);
+   fprintf(f, "spindle_fs_ops_total{op=\"read\"} %d\n", stat->fs_read.cnt);
+   fprintf(f, "# HELP spindle_fs_read_bytes_total Bytes we read from the shared file system\n");
+   fprintf(f, "# TYPE spindle_fs_read_bytes_total counter\n");
+   fprintf(f, "spindle_fs_read_bytes_total %ld\n", stat->fs_read.bytes);
+
+   fprintf(f, "# HELP spindle_client_queries_total Client file queries answered, by whether we had the answer\n");
+   fprintf(f, "# TYPE spindle_client_queries_total counter\n");
+   fprintf(f, "spindle_client_queries_total{result=\"hit\"} %d\n", stat->cache_hit.cnt + stat->clientpool.cnt);
+   fprintf(f, "spindle_client_queries_total{result=\"miss\"} %d\n", stat->cache_miss.cnt);
+   fprintf(f, "# HELP spindle_client_fallbacks_total Client queries given up at their deadline, from clients that exited\n");
+   fprintf(f, "# TYPE spindle_client_fallbacks_total counter\n");
+   fprintf(f, "spindle_client_fallbacks_total %d\n", stat->client_fallback.cnt);
+   latency_summary(LATENCY_CLIENT_QUERY, 0, &summary);
+   fprintf(f, "# HELP spindle_client_query_seconds Time to answer a client query\n");
+   fprintf(f, "# TYPE spindle_client_query_seconds summary\n");
+   fprintf(f, "spindle_client_query_seconds{quantile=\"0.5\"} %g\n", summary.p50);
+   fprintf(f, "spindle_client_query_seconds{quantile=\"0.99\"} %g\n", summary.p99);
+   fprintf(f, "spindle_client_query_seconds_count %lu\n", (unsigned long) summary.count);
+
+   write_gauge(f, "clients", "Clients connected", procdata->clients_live);
+   write_gauge(f, "steps", "Session steps with clients connected", steps_live());
+   write_gauge(f, "requests_in_flight", "Files and directories we're waiting on",
+               count_requested(procdata->pending_requests) +
+               count_requested(procdata->pending_metadata_requests));
+
+   fprintf(f, "# HELP spindle_peer_queued_bytes Bytes waiting to be sent to a child server\n");
+   fprintf(f, "# TYPE spindle_peer_queued_bytes gauge\n");
+   num_children = ldcs_audit_server_md_get_num_children(procdata);
+   for (i = 0; i < num_children; i++) {
+      fprintf(f, "spindle_peer_queued_bytes{child=\"%d\"} %lu\n", i,
+              (unsigned long) ldcs_audit_server_md_get_queued(procdata, ldcs_audit_server_md_get_child(procdata, i)));
+   }
+   write_gauge(f, "queued_bytes", "Bytes waiting to be sent to any server",
+               ldcs_audit_server_md_get_queued(procdata, NODE_PEER_ALL));
+   write_gauge(f, "queued_peak_bytes", "Most bytes ever waiting for one server", stat->sendq_peak);
+}
+
+int metrics_write(ldcs_process_data_t *procdata)
+{
+   char tmpname[MAX_PATH_LEN+1];
+   FILE *f;
+
+   if (!metrics_path)
+      return 0;
+   snprintf(tmpname, sizeof(tmpname), "%s.tmp", metrics_path);
+   f = fopen(tmpname, "w");
+   if (!f) {
+      err_printf("Could not create metrics file %s: %s\n", tmpname, strerror(errno));
+      return -1;
+   }
+   write_metrics(procdata, f);
+   if (fclose(f) != 0 || rename(tmpname, metrics_path) == -1) {
+      err_printf("Could not write metrics file %s: %s\n", metrics_path, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+   return 0;
+}
+
+static int metrics_CB(int fd, int id, void *data)
+{
+   uint64_t expirations;
+   if (read(fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+      debug_printf("Could not read metrics timer: %s\n", strerror(errno));
+   metrics_write((ldcs_process_data_t *) data);
+   return 0;
+}
+
+int metrics_start(ldcs_process_data_t *procdata)
+{
+   struct itimerspec spec;
+   char path[MAX_PATH_LEN+1];
+   long secs;
+
+   if (!getenv("SPINDLE_METRICS_SEC"))
+      return 0;
+   secs = atol(getenv("SPINDLE_METRICS_SEC"));
+   if (secs <= 0) {
+      err_printf("Ignoring SPINDLE_METRICS_SEC=%s\n", getenv("SPINDLE_METRICS_SEC"));
+      return 0;
+   }
+
+   timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (timer_fd == -1) {
+      err_printf("Could not create metrics timer: %s\n", strerror(errno));
+      return -1;
+   }
+   memset(&spec, 0, sizeof(spec));
+   spec.it_interval.tv_sec = secs;
+   spec.it_value.tv_sec = secs;
+   if (timerfd_settime(timer_fd, 0, &spec, NULL) == -1) {
+      err_printf("Could not start metrics timer: %s\n", strerror(errno));
+      close(timer_fd);
+      timer_fd = -1;
+      return -1;
+   }
+
+   snprintf(path, sizeof(path), "%s/%s.%d", procdata->location, METRICS_NAME, procdata->number);
+   metrics_path = strdup(path);
+   ldcs_listen_register_fd(timer_fd, timer_fd, metrics_CB, procdata);
+   debug_printf("Writing metrics to %s every %ld seconds\n", metrics_path, secs);
+   return metrics_write(procdata);
+}
+
+void metrics_stop()
+{
+   if (timer_fd == -1)
+      return;
+   ldcs_listen_unregister_fd(timer_fd);
+   close(timer_fd);
+   timer_fd = -1;
+   unlink(metrics_path);
+   free(metrics_path);
+   metrics_path = NULL;
+}
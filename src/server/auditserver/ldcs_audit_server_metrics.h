@@ -0,0 +1,44 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_METRICS_H_)
+#define LDCS_AUDIT_SERVER_METRICS_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * With SPINDLE_METRICS_SEC set, a server rewrites LOCATION/spindle_metrics.NUMBER
+ * that often while it runs, so node health checks can watch servers that
+ * stay up across jobs.  The file is in the Prometheus text format, which
+ * the node exporter's textfile collector reads as is: what we have staged,
+ * how client queries went, what's waiting on us and our peers, and our
+ * resident memory.  Counters are totals since the server started.  The
+ * file is renamed into place, so a reader never sees half of it.
+ *
+ * Writes happen on the listen loop, from a timer fd, so they see the
+ * statistics between callbacks and never in the middle of one.
+ **/
+
+/* Start the timer, if SPINDLE_METRICS_SEC asks for one */
+int metrics_start(ldcs_process_data_t *procdata);
+
+/* Write the metrics now */
+int metrics_write(ldcs_process_data_t *procdata);
+
+/* Stop the timer and remove the file */
+void metrics_stop();
+
+#endif
@@ -0,0 +1,104 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ldcs_audit_server_msgpool.h"
+
+#define MSGPOOL_MIN_SHIFT 6
+#define MSGPOOL_MAX_SHIFT 16
+#define MSGPOOL_NUM_CLASSES (MSGPOOL_MAX_SHIFT - MSGPOOL_MIN_SHIFT + 1)
+#define MSGPOOL_LARGE MSGPOOL_NUM_CLASSES
+
+/* Keep at most this many bytes idle in each size class */
+#define MSGPOOL_CLASS_LIMIT (1024*1024)
+
+/* Sits in front of each buffer, and links it into its free list while idle */
+typedef union msgpool_hdr_t {
+   struct {
+      union msgpool_hdr_t *next;
+      unsigned int size_class;
+   } h;
+   long double align;
+} msgpool_hdr_t;
+
+static msgpool_hdr_t *free_lists[MSGPOOL_NUM_CLASSES];
+static unsigned int free_counts[MSGPOOL_NUM_CLASSES];
+
+/* Client threads answer queries too, so the lists are shared under a lock */
+static pthread_mutex_t msgpool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int size_class(size_t size)
+{
+   unsigned int c = 0;
+   size_t class_size = (size_t) 1 << MSGPOOL_MIN_SHIFT;
+
+   if (size > MSGPOOL_MAX_SIZE)
+      return MSGPOOL_LARGE;
+   while (class_size < size) {
+      class_size <<= 1;
+      c++;
+   }
+   return c;
+}
+
+void *msgpool_alloc(size_t size)
+{
+   unsigned int c = size_class(size);
+   msgpool_hdr_t *hdr = NULL;
+
+   if (c != MSGPOOL_LARGE) {
+      pthread_mutex_lock(&msgpool_lock);
+      hdr = free_lists[c];
+      if (hdr) {
+         free_lists[c] = hdr->h.next;
+         free_counts[c]--;
+      }
+      pthread_mutex_unlock(&msgpool_lock);
+      size = (size_t) 1 << (c + MSGPOOL_MIN_SHIFT);
+   }
+   if (!hdr) {
+      hdr = (msgpool_hdr_t *) malloc(sizeof(*hdr) + size);
+      if (!hdr)
+         return NULL;
+   }
+   hdr->h.size_class = c;
+   return hdr + 1;
+}
+
+void msgpool_free(void *buffer)
+{
+   msgpool_hdr_t *hdr;
+   unsigned int c;
+
+   if (!buffer)
+      return;
+   hdr = ((msgpool_hdr_t *) buffer) - 1;
+   c = hdr->h.size_class;
+   if (c != MSGPOOL_LARGE) {
+      pthread_mutex_lock(&msgpool_lock);
+      if ((free_counts[c] + 1) << (c + MSGPOOL_MIN_SHIFT) <= MSGPOOL_CLASS_LIMIT) {
+         hdr->h.next = free_lists[c];
+         free_lists[c] = hdr;
+         free_counts[c]++;
+         hdr = NULL;
+      }
+      pthread_mutex_unlock(&msgpool_lock);
+   }
+   free(hdr);
+}
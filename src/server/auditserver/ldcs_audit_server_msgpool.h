@@ -0,0 +1,38 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_MSGPOOL_H_)
+#define LDCS_AUDIT_SERVER_MSGPOOL_H_
+
+#include <stddef.h>
+
+/**
+ * Buffers for messages and their send queue bookkeeping.  Every tree
+ * message used to cost a malloc and free for its data, and another two or
+ * three for queueing it, which showed up in the root server's profile
+ * under import storms.  Buffers up to MSGPOOL_MAX_SIZE come from free
+ * lists kept per power of two size, and go back to them when freed.
+ * Larger buffers are plain malloc.  Buffers must be freed with
+ * msgpool_free, never free.
+ **/
+
+#define MSGPOOL_MAX_SIZE (64*1024)
+
+void *msgpool_alloc(size_t size);
+void msgpool_free(void *buffer);
+
+#endif
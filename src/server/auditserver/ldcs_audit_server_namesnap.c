@@ -0,0 +1,208 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "ldcs_api.h"
+#include "ldcs_namesnap.h"
+#include "ldcs_audit_server_namesnap.h"
+#include "spindle_launch.h"
+#include "spindle_debug.h"
+
+static namesnap_header_t *snap = NULL;
+static uint32_t num_used = 0;
+static uint32_t strings_used = 0;
+static int full = 0;
+
+int namesnap_start(ldcs_process_data_t *procdata)
+{
+   char path[MAX_PATH_LEN+1];
+   char *env;
+   size_t size;
+   uint32_t strings_size;
+   int fd;
+   void *mem;
+
+   env = getenv("SPINDLE_NAMESNAP");
+   if (!env || !*env || strcmp(env, "0") == 0)
+      return 0;
+   if (procdata->cache_budget || (procdata->opts & (OPT_LAZYFETCH | OPT_PRELOADLEARN))) {
+      debug_printf("Answers depend on more than the path with a cache budget, lazy fetching or "
+                   "--preload-learn, not publishing a name snapshot\n");
+      return 0;
+   }
+
+   strings_size = NAMESNAP_DEFAULT_ENTRIES * NAMESNAP_STRING_BYTES_PER_ENTRY;
+   size = NAMESNAP_SIZE(NAMESNAP_DEFAULT_ENTRIES, strings_size);
+   snprintf(path, sizeof(path), "%s/%s.%d", procdata->location, NAMESNAP_NAME, procdata->number);
+   path[MAX_PATH_LEN] = '\0';
+
+   fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1) {
+      err_printf("Could not create name snapshot %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+   if (ftruncate(fd, size) == -1) {
+      err_printf("Could not size name snapshot %s to %lu: %s\n", path, (unsigned long) size, strerror(errno));
+      close(fd);
+      unlink(path);
+      return -1;
+   }
+   mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (mem == MAP_FAILED) {
+      err_printf("Could not map name snapshot %s: %s\n", path, strerror(errno));
+      unlink(path);
+      return -1;
+   }
+
+   snap = (namesnap_header_t *) mem;
+   snap->version = NAMESNAP_VERSION;
+   snap->entry_size = sizeof(namesnap_entry_t);
+   snap->max_entries = NAMESNAP_DEFAULT_ENTRIES;
+   snap->strings_size = strings_size;
+   snap->generation = 0;
+   __sync_synchronize();
+   snap->magic = NAMESNAP_MAGIC;
+
+   debug_printf("Publishing answers in name snapshot %s with %u entries\n", path, snap->max_entries);
+   return 0;
+}
+
+/* The entry for pathname, or the empty one it would go in */
+static namesnap_entry_t *find_slot(const char *pathname, uint32_t hash, size_t len)
+{
+   namesnap_entry_t *e;
+   char *strings = NAMESNAP_STRINGS(snap);
+   uint32_t mask = snap->max_entries - 1, i;
+
+   for (i = hash & mask; ; i = (i + 1) & mask) {
+      e = NAMESNAP_ENTRY(snap, i);
+      if (!e->key_len)
+         return e;
+      if (e->hash == hash && e->key_len == len && memcmp(strings + e->key_off, pathname, len) == 0)
+         return e;
+   }
+}
+
+static char *add_string(const char *str, size_t len)
+{
+   char *dest = NAMESNAP_STRINGS(snap) + strings_used;
+   memcpy(dest, str, len + 1);
+   strings_used += len + 1;
+   return dest;
+}
+
+void namesnap_publish(ldcs_process_data_t *procdata, const char *pathname, const char *localpath, int errcode)
+{
+   namesnap_entry_t *e;
+   char *strings;
+   uint32_t hash;
+   size_t len, value_len = 0, needed;
+
+   if (!snap || !pathname)
+      return;
+   hash = namesnap_hash(pathname, &len);
+   if (!len || len > MAX_PATH_LEN)
+      return;
+   if (localpath)
+      value_len = strlen(localpath);
+
+   strings = NAMESNAP_STRINGS(snap);
+   e = find_slot(pathname, hash, len);
+   if (e->key_len) {
+      if (e->errcode == errcode && e->value_len == value_len &&
+          (!value_len || memcmp(strings + e->value_off, localpath, value_len) == 0))
+         return;
+   }
+   else if (num_used >= snap->max_entries / 4 * 3) {
+      if (!full)
+         debug_printf("Name snapshot is full, later answers go through the server\n");
+      full = 1;
+      return;
+   }
+
+   needed = (e->key_len ? 0 : len + 1) + (value_len ? value_len + 1 : 0);
+   if (strings_used + needed > snap->strings_size) {
+      if (!full)
+         debug_printf("Name snapshot is out of room for names, later answers go through the server\n");
+      full = 1;
+      return;
+   }
+
+   e->seq++;
+   __sync_synchronize();
+   if (!e->key_len) {
+      e->hash = hash;
+      e->key_off = add_string(pathname, len) - strings;
+      e->key_len = len;
+      num_used++;
+   }
+   e->errcode = errcode;
+   e->value_off = value_len ? add_string(localpath, value_len) - strings : 0;
+   e->value_len = value_len;
+   __sync_synchronize();
+   e->seq++;
+
+   procdata->server_stat.namesnap.cnt++;
+   procdata->server_stat.namesnap.bytes += needed;
+}
+
+int namesnap_missing(const char *pathname)
+{
+   uint32_t hash;
+   size_t len;
+
+   if (!snap || full)
+      return 0;
+   hash = namesnap_hash(pathname, &len);
+   return find_slot(pathname, hash, len)->key_len == 0;
+}
+
+void namesnap_clear()
+{
+   namesnap_entry_t *e;
+   uint32_t i;
+
+   if (!snap || !num_used)
+      return;
+   for (i = 0; i < snap->max_entries; i++) {
+      e = NAMESNAP_ENTRY(snap, i);
+      if (!e->key_len)
+         continue;
+      e->seq++;
+      __sync_synchronize();
+      e->key_len = 0;
+      e->value_len = 0;
+      __sync_synchronize();
+      e->seq++;
+   }
+   /* Every entry that pointed into the strings has moved on, so they can be reused */
+   __sync_synchronize();
+   strings_used = 0;
+   num_used = 0;
+   full = 0;
+   snap->generation++;
+   debug_printf2("Cleared the name snapshot, now at generation %u\n", snap->generation);
+}
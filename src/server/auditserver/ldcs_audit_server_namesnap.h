@@ -0,0 +1,46 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_NAMESNAP_H_)
+#define LDCS_AUDIT_SERVER_NAMESNAP_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * With SPINDLE_NAMESNAP set, the server publishes its answers to file
+ * queries in a name snapshot (see ldcs_namesnap.h), so a client finds a
+ * file the server already answered for without a round trip.  Only
+ * answers that don't depend on the client or on anything we do when
+ * answering are published, so the snapshot isn't used with a cache
+ * budget, which pins what's handed out, lazy fetching, whose answers
+ * change as a file fills in, or --preload-learn, which records what's
+ * asked for.  Only the main thread writes it.
+ **/
+
+/* Create the snapshot, if SPINDLE_NAMESNAP asks for one */
+int namesnap_start(ldcs_process_data_t *procdata);
+
+/* Publish the answer for pathname: its staged copy, or errcode if localpath is NULL */
+void namesnap_publish(ldcs_process_data_t *procdata, const char *pathname, const char *localpath, int errcode);
+
+/* Whether there's a snapshot and pathname hasn't been published in it.  Safe
+   from the client threads, since they only run while the main thread holds off */
+int namesnap_missing(const char *pathname);
+
+/* Drop every answer, after files changed underneath them */
+void namesnap_clear();
+
+#endif
@@ -0,0 +1,262 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_numa.h"
+#include "ldcs_audit_server_placement.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * Copies are made when a file is first handed to a process rather than when
+ * it's staged, so only files that get loaded are copied.  Each copy is
+ * written with our memory policy preferring its node, which places its
+ * pages there whether the location is tmpfs or a disk's page cache.
+ * What we decided for each staged file is kept by its interned name, so a
+ * bucket is searched by comparing pointers.
+ **/
+
+#define NUMA_TABLE_SIZE 1024
+#define NUMA_MAX_NODES 64
+#define DEFAULT_NUMA_MIN_MB 1
+
+typedef struct numa_file_t {
+   const char *localname;
+   int replicated;
+   struct numa_file_t *next;
+} numa_file_t;
+
+static numa_file_t *numa_table[NUMA_TABLE_SIZE];
+static int nodes[NUMA_MAX_NODES];
+static int num_nodes = 0;
+static size_t min_size;
+
+int numa_init()
+{
+   char buffer[256], *s, *end;
+   long first, last, i;
+   FILE *f;
+
+   f = fopen("/sys/devices/system/node/online", "r");
+   if (!f) {
+      err_printf("Could not read the NUMA nodes from /sys/devices/system/node/online: %s\n", strerror(errno));
+      return -1;
+   }
+   if (!fgets(buffer, sizeof(buffer), f))
+      buffer[0] = '\0';
+   fclose(f);
+
+   /* A list of ranges, like 0-3,8-11 */
+   num_nodes = 0;
+   for (s = buffer; *s; s = end + 1) {
+      first = last = strtol(s, &end, 10);
+      if (end == s)
+         break;
+      if (*end == '-')
+         last = strtol(end + 1, &end, 10);
+      for (i = first; i <= last; i++) {
+         if (i >= NUMA_MAX_NODES || num_nodes == NUMA_MAX_NODES) {
+            err_printf("NUMA node %ld is past the %d we can place files on\n", i, NUMA_MAX_NODES);
+            num_nodes = 0;
+            return -1;
+         }
+         nodes[num_nodes++] = (int) i;
+      }
+      if (*end != ',')
+         break;
+   }
+   if (num_nodes < 2) {
+      debug_printf("Node has %d NUMA node, not making copies of files for each\n", num_nodes);
+      num_nodes = 0;
+      return -1;
+   }
+
+   min_size = (size_t) (getenv("SPINDLE_NUMA_MIN_MB") ? atol(getenv("SPINDLE_NUMA_MIN_MB")) : DEFAULT_NUMA_MIN_MB);
+   min_size *= 1024 * 1024;
+   debug_printf("Copying files of %lu bytes or more to each of %d NUMA nodes\n", (unsigned long) min_size, num_nodes);
+   return 0;
+}
+
+static numa_file_t *numa_find(const char *name)
+{
+   numa_file_t *nf;
+
+   for (nf = numa_table[intern_name_hash(name) % NUMA_TABLE_SIZE]; nf; nf = nf->next) {
+      if (nf->localname == name)
+         return nf;
+   }
+   return NULL;
+}
+
+/* Only ELF files have text for processes to run */
+static int numa_is_candidate(const char *localname, struct stat *buf)
+{
+   unsigned char ident[SELFMAG];
+   ssize_t result;
+   int fd;
+
+   if (stat(localname, buf) == -1 || !S_ISREG(buf->st_mode) || (size_t) buf->st_size < min_size)
+      return 0;
+   fd = open(localname, O_RDONLY);
+   if (fd == -1)
+      return 0;
+   result = read(fd, ident, SELFMAG);
+   close(fd);
+   return result == SELFMAG && memcmp(ident, ELFMAG, SELFMAG) == 0;
+}
+
+static void numa_replica_name(const char *localname, int node, char *replica, size_t size)
+{
+   snprintf(replica, size, "%s%s%d", localname, NUMA_REPLICA_SUFFIX, node);
+}
+
+static int numa_copy_to_node(const char *localname, const char *contents, size_t size, mode_t mode, int node)
+{
+   char replica[MAX_PATH_LEN+1];
+   unsigned long mask = 1UL << node;
+   size_t pos = 0;
+   ssize_t result;
+   int fd, error;
+
+   numa_replica_name(localname, node, replica, sizeof(replica));
+   fd = open(replica, O_WRONLY | O_CREAT | O_TRUNC, mode & 0777);
+   if (fd == -1) {
+      err_printf("Could not create %s: %s\n", replica, strerror(errno));
+      return -1;
+   }
+   if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1) == -1) {
+      err_printf("Could not place memory on NUMA node %d: %s\n", node, strerror(errno));
+      close(fd);
+      unlink(replica);
+      return -1;
+   }
+
+   while (pos < size) {
+      result = write(fd, contents + pos, size - pos);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         break;
+      pos += result;
+   }
+   error = errno;
+   placement_reset_mempolicy();
+   close(fd);
+
+   if (pos != size) {
+      err_printf("Could not write %s: %s\n", replica, strerror(error));
+      unlink(replica);
+      return -1;
+   }
+   return 0;
+}
+
+int numa_replicate(ldcs_process_data_t *procdata, const char *localname)
+{
+   numa_file_t *nf;
+   const char *name;
+   char *contents;
+   struct stat buf;
+   unsigned int bucket;
+   double starttime;
+   int fd, i, j;
+
+   if (!num_nodes)
+      return 0;
+   name = intern_name(localname);
+   nf = numa_find(name);
+   if (nf)
+      return nf->replicated;
+
+   nf = (numa_file_t *) malloc(sizeof(numa_file_t));
+   if (!nf) {
+      err_printf("Could not allocate NUMA record for %s\n", localname);
+      return 0;
+   }
+   nf->localname = name;
+   nf->replicated = 0;
+   bucket = intern_name_hash(name) % NUMA_TABLE_SIZE;
+   nf->next = numa_table[bucket];
+   numa_table[bucket] = nf;
+
+   if (!numa_is_candidate(localname, &buf))
+      return 0;
+
+   starttime = ldcs_get_time();
+   fd = open(localname, O_RDONLY);
+   if (fd == -1) {
+      err_printf("Could not open %s to copy to each NUMA node: %s\n", localname, strerror(errno));
+      return 0;
+   }
+   contents = (char *) mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (contents == MAP_FAILED) {
+      err_printf("Could not map %s to copy to each NUMA node: %s\n", localname, strerror(errno));
+      return 0;
+   }
+
+   for (i = 0; i < num_nodes; i++) {
+      if (numa_copy_to_node(localname, contents, buf.st_size, buf.st_mode, nodes[i]) == -1)
+         break;
+   }
+   munmap(contents, buf.st_size);
+
+   if (i < num_nodes) {
+      char replica[MAX_PATH_LEN+1];
+      for (j = 0; j < i; j++) {
+         numa_replica_name(localname, nodes[j], replica, sizeof(replica));
+         unlink(replica);
+      }
+      return 0;
+   }
+
+   debug_printf2("Copied %s to each of %d NUMA nodes\n", localname, num_nodes);
+   nf->replicated = 1;
+   procdata->server_stat.numa.cnt++;
+   procdata->server_stat.numa.bytes += buf.st_size * num_nodes;
+   procdata->server_stat.numa.time += ldcs_get_time() - starttime;
+   return 1;
+}
+
+void numa_evict(const char *localname)
+{
+   char replica[MAX_PATH_LEN+1];
+   numa_file_t *nf;
+   const char *name;
+   int i;
+
+   name = lookup_intern_name(localname);
+   nf = name ? numa_find(name) : NULL;
+   if (!nf || !nf->replicated)
+      return;
+   for (i = 0; i < num_nodes; i++) {
+      numa_replica_name(localname, nodes[i], replica, sizeof(replica));
+      unlink(replica);
+   }
+   nf->replicated = 0;
+}
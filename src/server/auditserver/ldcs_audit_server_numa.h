@@ -0,0 +1,42 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_NUMA_H_)
+#define LDCS_AUDIT_SERVER_NUMA_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * With --numa-replicas, each large shared library or executable that a
+ * process is handed is also copied once into the memory of every NUMA
+ * node, as the staged file's name plus NUMA_REPLICA_SUFFIX and the node's
+ * number.  The process is handed the name with the suffix but no number,
+ * and adds the number of the node it's running on.
+ *
+ * Files of SPINDLE_NUMA_MIN_MB megabytes or more are copied, 1 by default.
+ **/
+
+/* Find the node's NUMA nodes.  Returns -1 if there's only one */
+int numa_init();
+
+/* Copy localname to every NUMA node if it's worth it and we haven't.
+   Returns true if the copies are there */
+int numa_replicate(ldcs_process_data_t *procdata, const char *localname);
+
+/* Remove the copies of localname, which is being evicted */
+void numa_evict(const char *localname);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ldcs_audit_server_pfsmeta.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "ldcs_audit_server_readpool.h"
+#include "localfs.h"
+#include "spindle_debug.h"
+
+#define PFSMETA_TABLE_SIZE 1024
+
+typedef struct pfsmeta_entry_t {
+   char *pathname;
+   struct stat buf;
+   int result;
+   int errcode;
+   struct pfsmeta_entry_t *next;
+} pfsmeta_entry_t;
+
+static pfsmeta_entry_t *table[PFSMETA_TABLE_SIZE];
+static pfsmeta_entry_t **entries;
+static int num_entries;
+
+static unsigned int path_bucket(const char *pathname)
+{
+   unsigned int hash = 2166136261U;
+   for (; *pathname; pathname++)
+      hash = (hash ^ (unsigned char) *pathname) * 16777619U;
+   return hash % PFSMETA_TABLE_SIZE;
+}
+
+static pfsmeta_entry_t *find_entry(const char *pathname)
+{
+   pfsmeta_entry_t *e;
+   for (e = table[path_bucket(pathname)]; e; e = e->next) {
+      if (strcmp(e->pathname, pathname) == 0)
+         return e;
+   }
+   return NULL;
+}
+
+/* Runs on a reader thread */
+static void stat_entry(void *arg)
+{
+   pfsmeta_entry_t *e = (pfsmeta_entry_t *) arg;
+
+   e->result = stat(e->pathname, &e->buf);
+   e->errcode = (e->result == -1) ? errno : 0;
+   filemngt_count_fsop(FSOP_STAT, 0);
+}
+
+int pfsmeta_statahead(char **pathnames, int num)
+{
+   pfsmeta_entry_t **grown, *e;
+   unsigned int bucket;
+   int i, first = num_entries;
+
+   if (num < PFSMETA_MIN_BATCH)
+      return 0;
+   grown = (pfsmeta_entry_t **) realloc(entries, (num_entries + num) * sizeof(pfsmeta_entry_t *));
+   if (!grown) {
+      err_printf("Could not allocate %d entries to stat ahead\n", num);
+      return 0;
+   }
+   entries = grown;
+
+   for (i = 0; i < num; i++) {
+      if (!localfs_is_parallel(pathnames[i]) || find_entry(pathnames[i]))
+         continue;
+      e = (pfsmeta_entry_t *) calloc(1, sizeof(pfsmeta_entry_t));
+      if (e)
+         e->pathname = strdup(pathnames[i]);
+      if (!e || !e->pathname) {
+         free(e);
+         break;
+      }
+      bucket = path_bucket(e->pathname);
+      e->next = table[bucket];
+      table[bucket] = e;
+      entries[num_entries++] = e;
+   }
+   readpool_run(stat_entry, (void **) (entries + first), num_entries - first);
+
+   debug_printf2("Stat'd %d files on parallel file systems ahead of reading them\n", num_entries - first);
+   return num_entries - first;
+}
+
+int pfsmeta_lookup(const char *pathname, struct stat *buf, int *result)
+{
+   pfsmeta_entry_t *e;
+
+   if (!num_entries || !(e = find_entry(pathname)))
+      return 0;
+   *result = e->result;
+   if (e->result == 0)
+      *buf = e->buf;
+   errno = e->errcode;
+   return 1;
+}
+
+void pfsmeta_clear()
+{
+   int i;
+
+   for (i = 0; i < num_entries; i++) {
+      table[path_bucket(entries[i]->pathname)] = NULL;
+      free(entries[i]->pathname);
+      free(entries[i]);
+   }
+   num_entries = 0;
+}
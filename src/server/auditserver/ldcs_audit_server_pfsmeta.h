@@ -0,0 +1,48 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_PFSMETA_H_)
+#define LDCS_AUDIT_SERVER_PFSMETA_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * With --pfs-metadata, a server about to read a batch of files off Lustre
+ * or GPFS stats them all at once on the reader threads, rather than one
+ * at a time as each is read.  Every stat there is a metadata server round
+ * trip, and a Lustre stat also glimpses the file's size from its OSTs, so
+ * a batch pays for about one round trip rather than one per file.  The
+ * results are kept until pfsmeta_clear, and filemngt's stats of those
+ * paths are answered from them.
+ *
+ * Only the main thread stats ahead, looks results up and clears them.
+ **/
+
+#define PFSMETA_MIN_BATCH 4   /* fewer files are stat'd as they're read */
+
+/* Stat those of the num pathnames that are on a Lustre or GPFS mount, in
+   parallel.  Returns the number stat'd */
+int pfsmeta_statahead(char **pathnames, int num);
+
+/* If pathname was stat'd ahead, set *buf and *result to what stat gave,
+   set errno as stat left it, and return 1.  Otherwise return 0 */
+int pfsmeta_lookup(const char *pathname, struct stat *buf, int *result);
+
+/* Forget what was stat'd ahead, once the batch is handled */
+void pfsmeta_clear();
+
+#endif
@@ -0,0 +1,150 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_placement.h"
+#include "spindle_debug.h"
+
+static int numa_node = -1;
+
+/* Add a list of ranges, like 0-3,8-11, to set.  Returns -1 if it's malformed. */
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+   const char *s;
+   char *end = (char *) list;
+   long first, last, i;
+
+   for (s = list; *s; s = end + 1) {
+      first = last = strtol(s, &end, 10);
+      if (end == s || first < 0)
+         return -1;
+      if (*end == '-')
+         last = strtol(end + 1, &end, 10);
+      if (last < first || last >= CPU_SETSIZE)
+         return -1;
+      for (i = first; i <= last; i++)
+         CPU_SET(i, set);
+      if (*end != ',')
+         break;
+   }
+   return *end == '\0' || *end == '\n' ? 0 : -1;
+}
+
+/**
+ * The reserved CPUs are the online ones we aren't allowed to run on, such
+ * as the cores Slurm's core specialization keeps from the job.  Where a
+ * cgroup holds the job off them, pinning to them fails and is reported.
+ **/
+static int reserved_cpus(cpu_set_t *set)
+{
+   char buffer[1024];
+   cpu_set_t allowed;
+   FILE *f;
+   int i;
+
+   f = fopen("/sys/devices/system/cpu/online", "r");
+   if (!f) {
+      err_printf("Could not read the online CPUs from /sys/devices/system/cpu/online: %s\n", strerror(errno));
+      return -1;
+   }
+   if (!fgets(buffer, sizeof(buffer), f))
+      buffer[0] = '\0';
+   fclose(f);
+   if (parse_cpu_list(buffer, set) == -1 || sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+      err_printf("Could not find the CPUs reserved from the job\n");
+      return -1;
+   }
+   for (i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &allowed))
+         CPU_CLR(i, set);
+   }
+   if (CPU_COUNT(set) == 0) {
+      debug_printf("No CPUs on this node are reserved from the job\n");
+      return -1;
+   }
+   return 0;
+}
+
+static void place_cpus(const char *cpus)
+{
+   cpu_set_t set;
+
+   CPU_ZERO(&set);
+   if (strcmp(cpus, "reserved") == 0) {
+      if (reserved_cpus(&set) == -1)
+         return;
+   }
+   else if (parse_cpu_list(cpus, &set) == -1) {
+      err_printf("Could not parse CPU list %s, leaving the server unpinned\n", cpus);
+      return;
+   }
+   if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+      err_printf("Could not pin the server to CPUs %s: %s\n", cpus, strerror(errno));
+      return;
+   }
+   debug_printf("Pinned the server to %d CPUs from %s\n", CPU_COUNT(&set), cpus);
+}
+
+void placement_init(ldcs_process_data_t *procdata)
+{
+   if (procdata->server_cpus)
+      place_cpus(procdata->server_cpus);
+
+   if (procdata->server_nice) {
+      if (setpriority(PRIO_PROCESS, 0, procdata->server_nice) == -1)
+         err_printf("Could not set the server's nice value to %d: %s\n", procdata->server_nice, strerror(errno));
+      else
+         debug_printf("Running the server at nice value %d\n", procdata->server_nice);
+   }
+
+   if (procdata->server_numa >= 0) {
+      if (procdata->server_numa >= (int) (sizeof(unsigned long) * 8)) {
+         err_printf("NUMA node %d is past the ones we can place memory on\n", procdata->server_numa);
+         return;
+      }
+      numa_node = procdata->server_numa;
+      placement_reset_mempolicy();
+   }
+}
+
+void placement_reset_mempolicy()
+{
+   unsigned long mask;
+
+   if (numa_node < 0) {
+      syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+      return;
+   }
+   mask = 1UL << numa_node;
+   if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1) == -1) {
+      err_printf("Could not place the server's memory on NUMA node %d: %s\n", numa_node, strerror(errno));
+      numa_node = -1;
+      return;
+   }
+   debug_printf3("Placing the server's memory on NUMA node %d\n", numa_node);
+}
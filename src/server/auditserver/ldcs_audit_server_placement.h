@@ -0,0 +1,37 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_PLACEMENT_H_)
+#define LDCS_AUDIT_SERVER_PLACEMENT_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * With --server-cpus, --server-nice and --server-numa, the server pins
+ * itself, sets its priority and places its memory before it starts any
+ * threads, so every thread it starts takes them on.  Files staged at a
+ * tmpfs location are in memory placed by the same policy.
+ **/
+
+/* Apply procdata's placement.  A setting that can't be applied is
+   reported and left as it was. */
+void placement_init(ldcs_process_data_t *procdata);
+
+/* Put back our memory policy, after it was changed to place something
+   on another NUMA node */
+void placement_reset_mempolicy();
+
+#endif
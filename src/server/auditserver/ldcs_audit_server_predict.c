@@ -0,0 +1,229 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_predict.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * Each file keeps its few most frequent successors.  When a new successor
+ * turns up and there's no room, every count drops by one and the ones that
+ * reach zero make room (Misra-Gries), so a successor that keeps following
+ * the file always wins a slot back.  Nodes are kept by their interned
+ * pathnames, so a bucket is searched by comparing pointers.
+ **/
+
+#define PREDICT_TABLE_SIZE 4096
+#define PREDICT_MAX_NEXT 4
+
+/* Stop following the chain once it's less likely than this to be right */
+#define PREDICT_MIN_CHANCE 0.5
+
+#define STR2(X) #X
+#define STR(X) STR2(X)
+
+typedef struct predict_node_t {
+   const char *pathname;
+   const char *next[PREDICT_MAX_NEXT];
+   unsigned int count[PREDICT_MAX_NEXT];
+   unsigned int total;
+   struct predict_node_t *hash_next;
+} predict_node_t;
+
+typedef struct {
+   long id;
+   const char *last;
+} predict_stream_t;
+
+static double min_chance = PREDICT_MIN_CHANCE;
+static predict_node_t *predict_table[PREDICT_TABLE_SIZE];
+static predict_stream_t *streams = NULL;
+static int num_streams = 0, streams_size = 0;
+
+static predict_node_t *predict_find(const char *name, int create)
+{
+   predict_node_t *n;
+   unsigned int bucket;
+
+   bucket = intern_name_hash(name) % PREDICT_TABLE_SIZE;
+   for (n = predict_table[bucket]; n; n = n->hash_next) {
+      if (n->pathname == name)
+         return n;
+   }
+   if (!create)
+      return NULL;
+
+   n = (predict_node_t *) calloc(1, sizeof(predict_node_t));
+   if (!n) {
+      err_printf("Could not allocate prediction for %s\n", name);
+      return NULL;
+   }
+   n->pathname = name;
+   n->hash_next = predict_table[bucket];
+   predict_table[bucket] = n;
+   return n;
+}
+
+static void predict_link(const char *from, const char *to)
+{
+   predict_node_t *n;
+   int i, empty = -1;
+
+   if (from == to)
+      return;
+   n = predict_find(from, 1);
+   if (!n)
+      return;
+
+   for (i = 0; i < PREDICT_MAX_NEXT; i++) {
+      if (n->next[i] == to) {
+         n->count[i]++;
+         n->total++;
+         return;
+      }
+      if (!n->next[i] && empty == -1)
+         empty = i;
+   }
+   if (empty != -1) {
+      n->next[empty] = to;
+      n->count[empty] = 1;
+      n->total++;
+      return;
+   }
+
+   for (i = 0; i < PREDICT_MAX_NEXT; i++) {
+      n->count[i]--;
+      n->total--;
+      if (!n->count[i])
+         n->next[i] = NULL;
+   }
+}
+
+void predict_record(long stream, const char *pathname)
+{
+   const char *name;
+   int i;
+
+   name = intern_name(pathname);
+   for (i = 0; i < num_streams; i++) {
+      if (streams[i].id == stream)
+         break;
+   }
+   if (i == num_streams) {
+      if (num_streams == streams_size) {
+         predict_stream_t *newstreams;
+         int newsize = streams_size ? streams_size * 2 : 64;
+         newstreams = (predict_stream_t *) realloc(streams, newsize * sizeof(predict_stream_t));
+         if (!newstreams) {
+            err_printf("Could not allocate prediction streams\n");
+            return;
+         }
+         streams = newstreams;
+         streams_size = newsize;
+      }
+      streams[i].id = stream;
+      streams[i].last = NULL;
+      num_streams++;
+   }
+
+   if (streams[i].last)
+      predict_link(streams[i].last, name);
+   streams[i].last = name;
+}
+
+int predict_next(const char *pathname, const char **paths, int max)
+{
+   predict_node_t *n;
+   const char *cur;
+   double chance = 1.0;
+   int i, j, best, count = 0;
+
+   cur = lookup_intern_name(pathname);
+   while (cur && count < max) {
+      n = predict_find(cur, 0);
+      if (!n || !n->total)
+         break;
+      best = -1;
+      for (i = 0; i < PREDICT_MAX_NEXT; i++) {
+         if (n->next[i] && (best == -1 || n->count[i] > n->count[best]))
+            best = i;
+      }
+      if (best == -1)
+         break;
+      chance *= (double) n->count[best] / n->total;
+      if (chance < min_chance)
+         break;
+      cur = n->next[best];
+      if (strcmp(cur, pathname) == 0)
+         break;
+      for (j = 0; j < count; j++) {
+         if (paths[j] == cur)
+            break;
+      }
+      if (j < count)
+         break;
+      paths[count++] = cur;
+   }
+   return count;
+}
+
+void predict_set_min_chance(double chance)
+{
+   min_chance = chance;
+}
+
+/**
+ * A preload file lists files roughly in the order a run first used them,
+ * which is what a --preload-learn file records.  Directories, globs and
+ * '**' trees don't name one file, so they're skipped rather than linked.
+ **/
+int predict_seed(const char *filename)
+{
+   char pathname[MAX_PATH_LEN+1];
+   const char *name, *last = NULL;
+   size_t len;
+   int num_links = 0;
+   FILE *f;
+
+   f = fopen(filename, "r");
+   if (!f) {
+      err_printf("Error opening prediction trace %s: %s\n", filename, strerror(errno));
+      return -1;
+   }
+
+   while (fscanf(f, "%" STR(MAX_PATH_LEN) "s", pathname) == 1) {
+      pathname[MAX_PATH_LEN] = '\0';
+      len = strlen(pathname);
+      if (pathname[0] != '/' || pathname[len-1] == '/' || strpbrk(pathname, "*?["))
+         continue;
+      name = intern_name(pathname);
+      if (last && last != name) {
+         predict_link(last, name);
+         num_links++;
+      }
+      last = name;
+   }
+   fclose(f);
+
+   debug_printf("Seeded prediction with %d transitions from %s\n", num_links, filename);
+   return 0;
+}
@@ -0,0 +1,44 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_PREDICT_H_)
+#define LDCS_AUDIT_SERVER_PREDICT_H_
+
+/**
+ * With --predict, the root server keeps a first-order Markov model of the
+ * files it's asked for: for each file, the files that were asked for right
+ * after it, and how often.  Requests are followed per stream, one for each
+ * child server and one for each of our own clients, since requests from
+ * different streams interleave arbitrarily.
+ *
+ * Only the main thread uses the model, so it has no lock.
+ **/
+
+/* Note that stream asked for pathname, following whatever it asked for last */
+void predict_record(long stream, const char *pathname);
+
+/* Fill paths with up to max files likely to be asked for after pathname, in
+   the order they'd be asked for.  Returns how many */
+int predict_next(const char *pathname, const char **paths, int max);
+
+/* Stop predict_next's chain once it's less likely than chance to be right */
+void predict_set_min_chance(double chance);
+
+/* Start the model off with each file in a preload file following the one
+   before it */
+int predict_seed(const char *filename);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <assert.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+#include "ldcs_audit_server_process.h"
+#include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_prefetch.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "ldcs_cache.h"
+#include "spindle_debug.h"
+
+/**
+ * The prefetch stage runs on the root server.  A few helper threads walk
+ * the python prefixes, the server's LD_LIBRARY_PATH, and any directories
+ * in SPINDLE_PREFETCH_PATH.  The helpers read and encode directories
+ * without touching the cache, and hand each packet back over a pipe.
+ * The server loop stores the packets as they arrive, so the helpers
+ * never block the loop.  Once the walk finishes, every new directory is
+ * broadcast as one LDCS_MSG_CACHE_ENTRIES_BATCH message.
+ *
+ * Each prefix is walked PREFETCH_DEFAULT_DEPTH levels deep (settable
+ * with SPINDLE_PREFETCH_DEPTH).  At most PREFETCH_MAX_DIRS directories
+ * are read in total.
+ **/
+
+#define PREFETCH_THREADS 4
+#define PREFETCH_DEFAULT_DEPTH 1
+#define PREFETCH_MAX_DIRS 4096
+
+typedef struct prefetch_dir_t {
+   char *path;
+   int depth;
+   char *packet;
+   int packet_len;
+   size_t bytes_read;
+   struct prefetch_dir_t *next;
+} prefetch_dir_t;
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static prefetch_dir_t *todo_list = NULL;
+static prefetch_dir_t *done_list = NULL;
+static int active_workers = 0;
+static int exited_workers = 0;
+static int max_depth = PREFETCH_DEFAULT_DEPTH;
+static int num_queued = 0;
+static char **visited = NULL;
+static unsigned int visited_size = 0;
+
+static pthread_t workers[PREFETCH_THREADS];
+static int num_workers = 0;
+static int pipe_fds[2] = { -1, -1 };
+
+static char *batch = NULL;
+static size_t batch_size = 0, batch_used = 0;
+static unsigned int batch_dirs = 0;
+static double prefetch_starttime;
+
+static unsigned int visited_hash(const char *str)
+{
+   unsigned int hash = 5381;
+   int c;
+   while ((c = (unsigned char) *str++))
+      hash = ((hash << 5) + hash) + c;
+   return hash;
+}
+
+/* Must hold prefetch_lock.  Returns 1 if path is newly marked. */
+static int mark_visited(const char *path)
+{
+   unsigned int i = visited_hash(path) & (visited_size - 1);
+   while (visited[i]) {
+      if (strcmp(visited[i], path) == 0)
+         return 0;
+      i = (i + 1) & (visited_size - 1);
+   }
+   visited[i] = strdup(path);
+   return 1;
+}
+
+/* Must hold prefetch_lock */
+static void queue_dir(const char *path, int depth)
+{
+   prefetch_dir_t *dir;
+
+   if (num_queued >= PREFETCH_MAX_DIRS || !mark_visited(path))
+      return;
+   dir = (prefetch_dir_t *) calloc(1, sizeof(prefetch_dir_t));
+   dir->path = strdup(path);
+   dir->depth = depth;
+   dir->next = todo_list;
+   todo_list = dir;
+   num_queued++;
+}
+
+static void notify_loop()
+{
+   char c = 0;
+   ssize_t result;
+   do {
+      result = write(pipe_fds[1], &c, 1);
+   } while (result == -1 && errno == EINTR);
+}
+
+static void read_prefetch_dir(prefetch_dir_t *dir)
+{
+   dir_listing_t listing;
+   char subdir[MAX_PATH_LEN+1];
+   size_t i;
+
+   if (ldcs_cache_scanDirectory(dir->path, &listing) == -1) {
+      ldcs_cache_freeListing(&listing);
+      return;
+   }
+   filemngt_count_fsop(FSOP_READDIR, listing.bytes_read);
+   dir->bytes_read = listing.bytes_read;
+   if (ldcs_cache_encodeListing(dir->path, &listing, &dir->packet, &dir->packet_len) == -1)
+      dir->packet = NULL;
+
+   if (listing.exists && dir->depth < max_depth) {
+      pthread_mutex_lock(&prefetch_lock);
+      for (i = 0; i < listing.count; i++) {
+         char *name = listing.names + listing.offsets[i];
+         if (listing.types[i] != DT_DIR || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+         if (snprintf(subdir, sizeof(subdir), "%s/%s", dir->path, name) >= (int) sizeof(subdir))
+            continue;
+         queue_dir(subdir, dir->depth + 1);
+      }
+      pthread_mutex_unlock(&prefetch_lock);
+   }
+   ldcs_cache_freeListing(&listing);
+}
+
+static void *prefetch_worker(void *arg)
+{
+   prefetch_dir_t *dir;
+
+   pthread_mutex_lock(&prefetch_lock);
+   for (;;) {
+      while (!todo_list && active_workers)
+         pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+      if (!todo_list)
+         break;
+
+      dir = todo_list;
+      todo_list = dir->next;
+      active_workers++;
+      pthread_mutex_unlock(&prefetch_lock);
+
+      read_prefetch_dir(dir);
+
+      pthread_mutex_lock(&prefetch_lock);
+      dir->next = done_list;
+      done_list = dir;
+      active_workers--;
+      pthread_cond_broadcast(&prefetch_cond);
+      notify_loop();
+   }
+   exited_workers++;
+   pthread_cond_broadcast(&prefetch_cond);
+   pthread_mutex_unlock(&prefetch_lock);
+   notify_loop();
+   return NULL;
+}
+
+static void add_to_batch(prefetch_dir_t *dir)
+{
+   if (batch_used + sizeof(int) + dir->packet_len > batch_size) {
+      while (batch_used + sizeof(int) + dir->packet_len > batch_size)
+         batch_size = batch_size ? batch_size * 2 : 64*1024;
+      batch = (char *) realloc(batch, batch_size);
+      assert(batch);
+   }
+   memcpy(batch + batch_used, &dir->packet_len, sizeof(int));
+   batch_used += sizeof(int);
+   memcpy(batch + batch_used, dir->packet, dir->packet_len);
+   batch_used += dir->packet_len;
+   batch_dirs++;
+}
+
+static int prefetch_finish(ldcs_process_data_t *procdata)
+{
+   ldcs_message_t msg;
+   unsigned int i;
+   int j, result = 0;
+
+   for (j = 0; j < num_workers; j++)
+      pthread_join(workers[j], NULL);
+   ldcs_listen_unregister_fd(pipe_fds[0]);
+   close(pipe_fds[0]);
+   close(pipe_fds[1]);
+
+   for (i = 0; i < visited_size; i++)
+      free(visited[i]);
+   free(visited);
+   visited = NULL;
+
+   procdata->server_stat.prefetch.time += ldcs_get_time() - prefetch_starttime;
+   debug_printf("Prefetch finished with %u new directories in %lu bytes\n",
+                batch_dirs, (unsigned long) batch_used);
+
+   if (batch_dirs) {
+      msg.header.type = LDCS_MSG_CACHE_ENTRIES_BATCH;
+      msg.header.len = batch_used;
+      msg.data = batch;
+      result = handle_directory_batch(procdata, &msg);
+   }
+   free(batch);
+   batch = NULL;
+   batch_used = batch_size = 0;
+   return result;
+}
+
+static int prefetch_cb(int fd, int id, void *data)
+{
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
+   prefetch_dir_t *results, *dir, *next;
+   char buf[256];
+   int already_cached, finished;
+
+   while (read(fd, buf, sizeof(buf)) == sizeof(buf));
+
+   pthread_mutex_lock(&prefetch_lock);
+   results = done_list;
+   done_list = NULL;
+   finished = (exited_workers == num_workers);
+   pthread_mutex_unlock(&prefetch_lock);
+
+   for (dir = results; dir; dir = next) {
+      next = dir->next;
+      if (dir->packet) {
+         ldcs_cache_storeDirPacket(dir->packet, dir->packet_len, &already_cached);
+         if (!already_cached)
+            add_to_batch(dir);
+         procdata->server_stat.prefetch.cnt++;
+         procdata->server_stat.prefetch.bytes += dir->bytes_read;
+      }
+      free(dir->packet);
+      free(dir->path);
+      free(dir);
+   }
+
+   if (finished)
+      return prefetch_finish(procdata);
+   return 0;
+}
+
+static void queue_path_list(const char *pathlist)
+{
+   char *paths, *cur, *saveptr = NULL;
+   if (!pathlist || !*pathlist)
+      return;
+   paths = strdup(pathlist);
+   for (cur = strtok_r(paths, ":", &saveptr); cur; cur = strtok_r(NULL, ":", &saveptr)) {
+      if (*cur == '/')
+         queue_dir(cur, 0);
+   }
+   free(paths);
+}
+
+int prefetch_start(ldcs_process_data_t *procdata)
+{
+   char *depth_str;
+   int i, result;
+
+   depth_str = getenv("SPINDLE_PREFETCH_DEPTH");
+   if (depth_str)
+      max_depth = atoi(depth_str);
+
+   visited_size = 2;
+   while (visited_size < PREFETCH_MAX_DIRS * 2)
+      visited_size *= 2;
+   visited = (char **) calloc(visited_size, sizeof(char *));
+
+   queue_path_list(procdata->pythonprefix);
+   queue_path_list(getenv("LD_LIBRARY_PATH"));
+   queue_path_list(getenv("SPINDLE_PREFETCH_PATH"));
+   if (!todo_list) {
+      debug_printf("No directories to prefetch\n");
+      free(visited);
+      visited = NULL;
+      return 0;
+   }
+
+   if (pipe(pipe_fds) == -1) {
+      err_printf("Could not create prefetch pipe: %s\n", strerror(errno));
+      return -1;
+   }
+   fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+   fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+   fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+   ldcs_listen_register_fd(pipe_fds[0], pipe_fds[0], prefetch_cb, procdata);
+
+   prefetch_starttime = ldcs_get_time();
+   debug_printf("Starting directory prefetch with %d threads, depth %d\n", PREFETCH_THREADS, max_depth);
+   for (i = 0; i < PREFETCH_THREADS; i++) {
+      result = pthread_create(workers + num_workers, NULL, prefetch_worker, NULL);
+      if (result != 0) {
+         err_printf("Could not create prefetch thread: %s\n", strerror(result));
+         break;
+      }
+      num_workers++;
+   }
+   if (!num_workers) {
+      ldcs_listen_unregister_fd(pipe_fds[0]);
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+      return -1;
+   }
+   return 0;
+}
@@ -21,6 +21,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sys/inotify.h>
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
 
 #include "ldcs_api.h"
 #include "ldcs_api_listen.h"
@@ -30,10 +31,34 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_cache.h"
 #include "spindle_launch.h"
 #include "ldcs_audit_server_requestors.h"
+#include "ldcs_audit_server_prefetch.h"
+#include "ldcs_audit_server_statseg.h"
+#include "ldcs_audit_server_index.h"
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_clientpool.h"
+#include "ldcs_audit_server_fairq.h"
+#include "ldcs_audit_server_ldcache.h"
+#include "ldcs_audit_server_latency.h"
+#include "ldcs_audit_server_capture.h"
+#include "ldcs_audit_server_metrics.h"
+#include "ldcs_audit_server_footprint.h"
+#include "ldcs_audit_server_namesnap.h"
+#include "ldcs_audit_server_predict.h"
+#include "ldcs_audit_server_numa.h"
+#include "ldcs_audit_server_placement.h"
+#include "ldcs_elf_read.h"
+#include "shmutil.h"
+#include "relocrules.h"
+#include "localfs.h"
 
 ldcs_process_data_t ldcs_process_data;
 unsigned int opts;
 
+#define DEFAULT_AGGREGATE_USEC 200
+
+static char attach_record[MAX_PATH_LEN+1];
+
 int _listen_exit_loop_cb_func ( int num_fds,  void * data) {
   int rc=0;
   ldcs_process_data_t *ldcs_process_data = ( ldcs_process_data_t *) data ;
@@ -52,21 +77,93 @@ int _listen_exit_loop_cb_func ( int num_fds,  void * data) {
       /* unregister also md support (multi-daemon) */
       ldcs_audit_server_md_unregister_fd(ldcs_process_data);
 
+      /* and the queue from the client threads */
+      clientpool_stop();
+
+      /* and the metrics timer */
+      metrics_stop();
+      footprint_stop();
+
     }
   }
   return(rc);
 }
 
+/**
+ * Leave the record spindle --attach reads beside our location, written
+ * under a temporary name and renamed so it's never seen half written.
+ **/
+static void attach_record_write(spindle_args_t *args)
+{
+   char tmpname[MAX_PATH_LEN+1], *last_slash;
+   FILE *f;
+   int len, fd;
+
+   last_slash = strrchr(args->location, '/');
+   if (!last_slash || last_slash == args->location)
+      return;
+   len = snprintf(attach_record, sizeof(attach_record), "%.*s/%s%u", (int) (last_slash - args->location),
+                  args->location, ATTACH_RECORD_PREFIX, args->number);
+   if (len >= (int) sizeof(attach_record) ||
+       snprintf(tmpname, sizeof(tmpname), "%s.%d", attach_record, getpid()) >= (int) sizeof(tmpname)) {
+      attach_record[0] = '\0';
+      return;
+   }
+
+   /* The directory is usually shared with other users, so don't follow
+      anything they left at our name */
+   unlink(tmpname);
+   fd = open(tmpname, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+   f = fd == -1 ? NULL : fdopen(fd, "w");
+   if (!f) {
+      debug_printf("Could not write attach record %s: %s\n", tmpname, strerror(errno));
+      if (fd != -1) {
+         close(fd);
+         unlink(tmpname);
+      }
+      attach_record[0] = '\0';
+      return;
+   }
+   fprintf(f, "%d\n%u\n%lu\n%u\n%s\n", getpid(), args->number, (unsigned long) args->opts,
+           args->shm_cache_size, args->location);
+   fclose(f);
+   if (rename(tmpname, attach_record) == -1) {
+      debug_printf("Could not rename attach record to %s: %s\n", attach_record, strerror(errno));
+      unlink(tmpname);
+      attach_record[0] = '\0';
+      return;
+   }
+   debug_printf2("Wrote attach record %s\n", attach_record);
+}
+
+static void attach_record_remove()
+{
+   if (attach_record[0] && unlink(attach_record) == -1)
+      debug_printf("Could not remove attach record %s: %s\n", attach_record, strerror(errno));
+}
+
+static int _listen_send_batch_cb_func ( void *data ) {
+  return handle_send_batch(( ldcs_process_data_t *) data);
+}
+
 int ldcs_audit_server_network_setup(unsigned int port, unsigned int num_ports, unique_id_t unique_id, 
-                                    void **packed_setup_data, int *data_size)
+                                    char *join_hosts, void **packed_setup_data, int *data_size)
 {
    int result;
    debug_printf2("Setting up server data structure\n");
 
    memset(&ldcs_process_data, 0, sizeof(ldcs_process_data));
 
-   /* Initialize server->server network */
-   ldcs_audit_server_md_init(port, num_ports, unique_id, &ldcs_process_data);
+   /* Initialize server->server network, or join a running one */
+   if (join_hosts) {
+      result = ldcs_audit_server_md_join(port, num_ports, unique_id, join_hosts, &ldcs_process_data);
+      if (result == -1) {
+         err_printf("Could not join the servers on %s\n", join_hosts);
+         return -1;
+      }
+   }
+   else
+      ldcs_audit_server_md_init(port, num_ports, unique_id, &ldcs_process_data);
 
    /* Use network to broadcast configuration parameters */
    ldcs_message_t msg;
@@ -80,6 +177,7 @@ int ldcs_audit_server_network_setup(unsigned int port, unsigned int num_ports, u
       return -1;
    }
    assert(msg.header.type == LDCS_MSG_SETTINGS);
+   handle_keep_settings(&msg);
    result = ldcs_audit_server_md_broadcast(&ldcs_process_data, &msg);
    if (result == -1) {
       err_printf("Error broadcast setup message to children\n");
@@ -100,12 +198,40 @@ int ldcs_audit_server_process(spindle_args_t *args)
    ldcs_process_data.location = args->location;
    ldcs_process_data.number = args->number;
    ldcs_process_data.pythonprefix = args->pythonprefix;
+   ldcs_process_data.preloadfile = args->preloadfile;
+   ldcs_process_data.stats_report = args->stats_report;
+   ldcs_process_data.predict_trace = args->predict_trace;
+   ldcs_process_data.reloc_rules = args->reloc_rules;
+   ldcs_process_data.disk_location = args->disk_location;
+   ldcs_process_data.disk_threshold = args->disk_threshold;
+   ldcs_process_data.shared_cache = args->shared_cache;
+   ldcs_process_data.cluster_cache = args->cluster_cache;
+   ldcs_process_data.rack_cache = args->rack_cache;
    ldcs_process_data.md_port = args->port;
    ldcs_process_data.opts = args->opts;
+   ldcs_process_data.cache_budget = args->cache_budget;
+   ldcs_process_data.num_readers = args->num_readers;
+   ldcs_process_data.num_streams = args->num_streams;
+   ldcs_process_data.promote_children = args->promote_children;
+   ldcs_process_data.lateral_peers = args->lateral_peers;
+   ldcs_process_data.bandwidth = args->bandwidth;
+   ldcs_process_data.background_bandwidth = args->background_bandwidth;
+   ldcs_process_data.dscp = args->dscp;
+   ldcs_process_data.server_cpus = args->server_cpus;
+   ldcs_process_data.server_nice = args->server_nice;
+   ldcs_process_data.server_numa = args->server_numa;
+   ldcs_process_data.aggregate_usec = getenv("SPINDLE_AGGREGATE_USEC") ?
+      atol(getenv("SPINDLE_AGGREGATE_USEC")) : DEFAULT_AGGREGATE_USEC;
+   ldcs_process_data.client_threads = getenv("SPINDLE_CLIENT_THREADS") ?
+      atoi(getenv("SPINDLE_CLIENT_THREADS")) : 0;
+   ldcs_process_data.expected_clients = getenv("SPINDLE_RANKS_PER_NODE") ?
+      atoi(getenv("SPINDLE_RANKS_PER_NODE")) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+   placement_init(&ldcs_process_data);
    ldcs_process_data.pending_requests = new_requestor_list();
    ldcs_process_data.completed_requests = new_requestor_list();
    ldcs_process_data.pending_metadata_requests = new_requestor_list();
    ldcs_process_data.completed_metadata_requests = new_requestor_list();
+   ldcs_process_data.unaliased_requests = new_requestor_list();
 
    if (ldcs_process_data.opts & OPT_PULL) {
       debug_printf("Using PULL model\n");
@@ -120,6 +246,35 @@ int ldcs_audit_server_process(spindle_args_t *args)
       assert(0);
    }
 
+   /* Every server makes the same choices here, so they agree on the sibling links */
+   if (ldcs_process_data.lateral_peers && ldcs_process_data.dist_model == LDCS_PUSH) {
+      debug_printf("Sibling links are only used with the pull model, not opening them\n");
+      ldcs_process_data.lateral_peers = 0;
+   }
+   if (ldcs_process_data.lateral_peers && ldcs_process_data.cache_budget) {
+      /* The sibling we'd ask may have evicted the file */
+      err_printf("Sibling links can't be used with the cache budget, not opening them\n");
+      ldcs_process_data.lateral_peers = 0;
+   }
+   if (ldcs_process_data.lateral_peers && (ldcs_process_data.opts & OPT_LAZYFETCH)) {
+      /* The sibling we'd ask may not have filled the file in yet */
+      err_printf("Sibling links can't be used with lazy fetching, not opening them\n");
+      ldcs_process_data.lateral_peers = 0;
+   }
+
+   if ((ldcs_process_data.opts & OPT_RELOCRULES) && ldcs_process_data.reloc_rules) {
+      /* The front end already checked these, so a failure here would be a bad message */
+      int errline;
+      ldcs_process_data.rules = (reloc_rule_t *) malloc(MAX_RELOC_RULES * sizeof(reloc_rule_t));
+      ldcs_process_data.num_rules = reloc_rules_parse(strdup(ldcs_process_data.reloc_rules),
+                                                      ldcs_process_data.rules, MAX_RELOC_RULES,
+                                                      &errline);
+      if (ldcs_process_data.num_rules == -1) {
+         err_printf("Could not parse line %d of the relocation rules, not using them\n", errline);
+         ldcs_process_data.num_rules = 0;
+      }
+   }
+
    _ldcs_server_stat_init(&ldcs_process_data.server_stat);
 
    {
@@ -129,8 +284,55 @@ int ldcs_audit_server_process(spindle_args_t *args)
    }
    ldcs_process_data.server_stat.hostname=ldcs_process_data.hostname;
 
+   /* Have a slot ready for each local rank, so their connections don't regrow the table */
+   if (ldcs_process_data.expected_clients > 0)
+      _ldcs_server_init_client_table(&ldcs_process_data, ldcs_process_data.expected_clients);
+
    debug_printf3("Initializing file cache location %s\n", ldcs_process_data.location);
    ldcs_audit_server_filemngt_init(ldcs_process_data.location);
+   if (ldcs_process_data.disk_location) {
+      debug_printf("Staging files of %u MB or more at %s\n", ldcs_process_data.disk_threshold,
+                   ldcs_process_data.disk_location);
+      filemngt_set_disk_location(ldcs_process_data.disk_location,
+                                 (size_t) ldcs_process_data.disk_threshold * 1024 * 1024);
+   }
+   if (ldcs_process_data.opts & OPT_HUGEPAGES)
+      filemngt_set_huge_pages(1);
+   if (ldcs_process_data.opts & OPT_SPARSE)
+      elf_read_skip_holes(1);
+   if ((ldcs_process_data.opts & OPT_MEMFD) &&
+       (ldcs_process_data.shared_cache || ldcs_process_data.cluster_cache || ldcs_process_data.rack_cache)) {
+      /* Their entries are links to, or copies of, staged files by name */
+      err_printf("The shared, cluster and rack caches can't be used with --memfd, not using them\n");
+      ldcs_process_data.shared_cache = NULL;
+      ldcs_process_data.cluster_cache = NULL;
+      ldcs_process_data.rack_cache = NULL;
+   }
+   if (ldcs_process_data.opts & OPT_MEMFD) {
+      debug_printf("Staging files in sealed memfds\n");
+      filemngt_set_memfd(ldcs_process_data.number);
+   }
+   if (ldcs_process_data.shared_cache) {
+      debug_printf("Sharing files with other jobs through %s\n", ldcs_process_data.shared_cache);
+      filemngt_set_shared_cache(ldcs_process_data.shared_cache);
+   }
+   if (ldcs_process_data.cluster_cache) {
+      debug_printf("Keeping copies of files for later jobs in %s\n", ldcs_process_data.cluster_cache);
+      filemngt_set_cluster_cache(ldcs_process_data.cluster_cache);
+   }
+   if (ldcs_process_data.rack_cache && !ldcs_audit_server_md_is_rack_leader(&ldcs_process_data))
+      ldcs_process_data.rack_cache = NULL;
+   if (ldcs_process_data.rack_cache) {
+      debug_printf("Keeping copies of files for our rack in %s\n", ldcs_process_data.rack_cache);
+      filemngt_set_rack_cache(ldcs_process_data.rack_cache);
+   }
+   if (statseg_init(ldcs_process_data.location, ldcs_process_data.number) == -1)
+      err_printf("Could not create stat segment, stat results will be stored in local files\n");
+   if (ldcs_process_data.opts & OPT_SEARCHPATH) {
+      /* Our node's cache is the one our clients' loaders would read */
+      if (ldcache_init(LDCACHE_PATH) == -1)
+         debug_printf("Searches will be left to the loader once they reach ld.so.cache\n");
+   }
 
    debug_printf3("Initializing connections for clients at %s and %u\n",
                  ldcs_process_data.location, ldcs_process_data.number);
@@ -142,7 +344,31 @@ int ldcs_audit_server_process(spindle_args_t *args)
    ldcs_process_data.serverid = serverid;
    fd = ldcs_get_fd(serverid);
    ldcs_process_data.serverfd = fd;
+   attach_record_write(args);
   
+   if (ldcs_audit_server_md_open_streams(&ldcs_process_data) == -1) {
+      err_printf("Unable to open streams to neighboring servers\n");
+      return -1;
+   }
+   if (ldcs_audit_server_md_open_peers(&ldcs_process_data) == -1) {
+      err_printf("Unable to link to sibling servers\n");
+      return -1;
+   }
+   if (ldcs_audit_server_md_open_bypass(&ldcs_process_data) == -1) {
+      err_printf("Unable to link to our children's children\n");
+      return -1;
+   }
+
+   if ((ldcs_process_data.opts & OPT_IOURING) && ldcs_listen_use_io_uring() == -1)
+      err_printf("Could not use io_uring, waiting for events with epoll\n");
+
+   /* First, so whatever the queued messages send goes out in the same pass */
+   if ((ldcs_process_data.opts & OPT_FAIRCLIENTS) && fairq_init(&ldcs_process_data) == -1)
+      err_printf("Could not queue client messages, handling them as they arrive\n");
+
+   /* Before the network's flush, so a batch goes out in the same pass */
+   if (ldcs_process_data.opts & OPT_BATCHSMALL)
+      ldcs_listen_register_flush_cb(_listen_send_batch_cb_func, &ldcs_process_data);
    ldcs_audit_server_md_register_fd(&ldcs_process_data);
   
    /* register server listen fd to listener */
@@ -152,14 +378,199 @@ int ldcs_audit_server_process(spindle_args_t *args)
    debug_printf3("Initializing cache\n");
    ldcs_cache_init();
 
+   if (ldcs_process_data.cache_budget && (ldcs_process_data.opts & OPT_SHMCACHE)) {
+      /* The client shared cache would keep handing out the names of evicted files */
+      err_printf("The cache budget can't be used with the client shared memory cache, ignoring it\n");
+      ldcs_process_data.cache_budget = 0;
+   }
+   if (ldcs_process_data.cache_budget && (ldcs_process_data.opts & OPT_DEDUP)) {
+      /* A child may have evicted the file an alias links to */
+      err_printf("Deduplication can't be used with the cache budget, turning it off\n");
+      ldcs_process_data.opts &= ~OPT_DEDUP;
+   }
+   if (ldcs_process_data.cache_budget && (ldcs_process_data.opts & OPT_LAZYFETCH)) {
+      /* Lazily staged files are filled in after they're handed out, and can't be evicted */
+      err_printf("Lazy fetching can't be used with the cache budget, turning it off\n");
+      ldcs_process_data.opts &= ~OPT_LAZYFETCH;
+   }
+   if ((ldcs_process_data.opts & OPT_VERIFY) && (ldcs_process_data.opts & OPT_LAZYFETCH)) {
+      /* A lazily staged file isn't all there when it's received, so there's nothing to check */
+      err_printf("Lazy fetching can't be used with --verify, turning it off\n");
+      ldcs_process_data.opts &= ~OPT_LAZYFETCH;
+   }
+   if ((ldcs_process_data.opts & OPT_REVALIDATE) && !(ldcs_process_data.opts & OPT_SESSION)) {
+      debug_printf("Revalidation is only done between session steps, ignoring it\n");
+      ldcs_process_data.opts &= ~OPT_REVALIDATE;
+   }
+   if ((ldcs_process_data.opts & OPT_REVALIDATE) && (ldcs_process_data.opts & (OPT_DEDUP | OPT_LAZYFETCH))) {
+      /* Deduplicated files share staged copies, and lazily staged ones are filled in later */
+      err_printf("Deduplication and lazy fetching can't be used with --revalidate, turning them off\n");
+      ldcs_process_data.opts &= ~(OPT_DEDUP | OPT_LAZYFETCH);
+   }
+   if ((ldcs_process_data.opts & OPT_DELTA) && !(ldcs_process_data.opts & OPT_REVALIDATE)) {
+      debug_printf("Files are only sent as changes after --revalidate finds them changed, ignoring --delta-updates\n");
+      ldcs_process_data.opts &= ~OPT_DELTA;
+   }
+   if ((ldcs_process_data.opts & OPT_DELTA) && ldcs_process_data.cache_budget) {
+      /* A child may have evicted the last version the changes apply to */
+      err_printf("Delta updates can't be used with the cache budget, turning them off\n");
+      ldcs_process_data.opts &= ~OPT_DELTA;
+   }
+   if ((ldcs_process_data.opts & OPT_MEMFD) &&
+       (ldcs_process_data.opts & (OPT_DEDUP | OPT_LAZYFETCH | OPT_NUMA | OPT_CACHEINDEX))) {
+      /* These link, fill in, replicate or keep staged files by their names in a directory */
+      err_printf("Deduplication, lazy fetching, NUMA replicas and the cache index can't be used with --memfd, turning them off\n");
+      ldcs_process_data.opts &= ~(OPT_DEDUP | OPT_LAZYFETCH | OPT_NUMA | OPT_CACHEINDEX);
+   }
+   if ((ldcs_process_data.opts & OPT_HOTEXTENTS) &&
+       (ldcs_process_data.opts & (OPT_LAZYFETCH | OPT_PRELOADLEARN)) != (OPT_LAZYFETCH | OPT_PRELOADLEARN)) {
+      /* The extents are learned, and pushed, for lazily staged files */
+      debug_printf("Hot extents are only learned with --lazy-fetch and --preload-learn, ignoring --hot-extents\n");
+      ldcs_process_data.opts &= ~OPT_HOTEXTENTS;
+   }
+   if (ldcs_process_data.promote_children && ldcs_process_data.dist_model == LDCS_PUSH) {
+      debug_printf("Promotion is only used with the pull model, ignoring it\n");
+      ldcs_process_data.promote_children = 0;
+   }
+   if ((ldcs_process_data.opts & OPT_FOREST) && ldcs_process_data.num_readers <= 1) {
+      debug_printf("A forest needs more than one reader, ignoring it\n");
+      ldcs_process_data.opts &= ~OPT_FOREST;
+   }
+   if ((ldcs_process_data.opts & OPT_STRIPEDREAD) && ldcs_process_data.num_readers <= 1) {
+      debug_printf("Striped reads need more than one reader, ignoring them\n");
+      ldcs_process_data.opts &= ~OPT_STRIPEDREAD;
+   }
+   if (ldcs_process_data.num_readers > 1 && ldcs_process_data.dist_model == LDCS_PUSH) {
+      /* Pushed files go down from the root, so only it may read them */
+      err_printf("Multiple readers can't be used with the push model, using one reader\n");
+      ldcs_process_data.num_readers = 1;
+   }
+   if (ldcs_process_data.num_readers > 1 && (ldcs_process_data.opts & OPT_DEDUP)) {
+      /* An alias from one reader may name a copy another reader never saw */
+      err_printf("Deduplication can't be used with multiple readers, turning it off\n");
+      ldcs_process_data.opts &= ~OPT_DEDUP;
+   }
+   if (ldcs_process_data.num_readers > 1 && (ldcs_process_data.opts & OPT_LAZYFETCH)) {
+      /* Range requests are only answered by the root */
+      err_printf("Lazy fetching can't be used with multiple readers, turning it off\n");
+      ldcs_process_data.opts &= ~OPT_LAZYFETCH;
+   }
+   if (ldcs_process_data.cache_budget) {
+      debug_printf("Limiting staged files to %u MB\n", ldcs_process_data.cache_budget);
+      ldcs_cache_setBudget(((size_t) ldcs_process_data.cache_budget) * 1024 * 1024);
+   }
+   ldcs_cache_setRemap(filemngt_map_staged_file);
+   if (ldcs_process_data.opts & OPT_RESOLVELINKS)
+      ldcs_cache_setReadLinks(1);
+   if ((ldcs_process_data.opts & OPT_LOCALBYPASS) && localfs_init() == -1) {
+      err_printf("Could not read the mount table, relocating files on local file systems too\n");
+      ldcs_process_data.opts &= ~OPT_LOCALBYPASS;
+   }
+   if ((ldcs_process_data.opts & OPT_PFSMETA) && localfs_init() == -1) {
+      err_printf("Could not read the mount table, stating files one at a time\n");
+      ldcs_process_data.opts &= ~OPT_PFSMETA;
+   }
+   if ((ldcs_process_data.opts & OPT_NUMA) && numa_init() == -1)
+      ldcs_process_data.opts &= ~OPT_NUMA;
+
+   /* Before there are threads to take the signal */
+   if (footprint_start(&ldcs_process_data) == -1)
+      err_printf("Could not start taking footprint report requests, continuing without them\n");
+   if (namesnap_start(&ldcs_process_data) == -1)
+      err_printf("Could not publish a name snapshot, clients will ask for every file\n");
+
+   if (ldcs_process_data.opts & OPT_CACHEINDEX) {
+      debug_printf2("Loading cache index\n");
+      if (cacheindex_load(&ldcs_process_data) == -1)
+         err_printf("Could not use the cache index, starting with an empty cache\n");
+   }
+
+   if ((ldcs_process_data.opts & OPT_PREFETCH) && ldcs_process_data.md_rank == 0) {
+      debug_printf2("Starting directory prefetch\n");
+      if (prefetch_start(&ldcs_process_data) == -1)
+         err_printf("Could not start directory prefetch, continuing without it\n");
+   }
+
+   if ((ldcs_process_data.opts & OPT_PREDICT) && ldcs_process_data.md_rank == 0 &&
+       ldcs_process_data.predict_trace && *ldcs_process_data.predict_trace) {
+      debug_printf2("Seeding predictions from %s\n", ldcs_process_data.predict_trace);
+      if (predict_seed(ldcs_process_data.predict_trace) == -1)
+         err_printf("Could not seed predictions, learning them from this run alone\n");
+   }
+
+   if (clientpool_start(&ldcs_process_data, ldcs_process_data.client_threads) == -1) {
+      err_printf("Could not start client threads\n");
+      return -1;
+   }
+
+   if (metrics_start(&ldcs_process_data) == -1)
+      err_printf("Could not start writing metrics, continuing without them\n");
+
    return 0;
 }  
 
+static void shmcache_path(ldcs_process_data_t *data, char *path, size_t size)
+{
+   snprintf(path, size, "/dev/shm/biter_shm.%d", data->number);
+}
+
+/**
+ * Collect the hit counts our clients left in the node's shared memory
+ * cache.  See biter/shmutil.c for its name.
+ **/
+static void shmcache_read_stats(ldcs_process_data_t *data)
+{
+   char path[MAX_PATH_LEN];
+   header_t header;
+   ssize_t result;
+   int fd;
+
+   shmcache_path(data, path, sizeof(path));
+   fd = open(path, O_RDONLY);
+   if (fd == -1) {
+      debug_printf2("No client shared memory cache at %s: %s\n", path, strerror(errno));
+      return;
+   }
+   result = pread(fd, &header, sizeof(header), 0);
+   close(fd);
+   if (result == sizeof(header)) {
+      data->server_stat.shmcache_hit.cnt = header.shmcache.hits;
+      data->server_stat.shmcache_miss.cnt = header.shmcache.misses;
+      data->server_stat.shmcache_wait.cnt = header.shmcache.waits;
+   }
+}
+
+/**
+ * Bring in the statistics kept outside of server_stat: the client shared
+ * memory cache's and the shared file system operations.
+ **/
+void _ldcs_server_stat_collect(ldcs_process_data_t *data)
+{
+   if (data->opts & OPT_SHMCACHE)
+      shmcache_read_stats(data);
+   filemngt_fsops_stats(&data->server_stat);
+}
+
+static void shmcache_remove(ldcs_process_data_t *data)
+{
+   char path[MAX_PATH_LEN];
+
+   shmcache_path(data, path, sizeof(path));
+   if (!(data->opts & OPT_NOCLEAN) && unlink(path) == -1)
+      debug_printf("Could not remove client shared memory cache %s: %s\n", path, strerror(errno));
+}
+
 int ldcs_audit_server_run()
 {
+   latency_init(ldcs_process_data.md_rank, ldcs_process_data.hostname);
+   capture_init(ldcs_process_data.md_rank);
+
    /* start loop */
    debug_printf2("Entering server loop\n");
    ldcs_listen();
+   metrics_stop();
+   footprint_stop();
+   footprint_write(&ldcs_process_data);
   
    ldcs_process_data.server_stat.listen_time= ldcs_get_time() - ldcs_process_data.server_stat.starttime;
    ldcs_process_data.server_stat.select_time=
@@ -169,14 +580,30 @@ int ldcs_audit_server_run()
       - ldcs_process_data.server_stat.md_cb.time;
 
 
+   _ldcs_server_stat_collect(&ldcs_process_data);
+   if (ldcs_process_data.opts & OPT_SHMCACHE)
+      shmcache_remove(&ldcs_process_data);
+
    _ldcs_server_stat_print(&ldcs_process_data.server_stat);
+   ldcs_audit_server_md_print_links(&ldcs_process_data);
+   latency_print(ldcs_process_data.md_rank);
   
    debug_printf("destroy server (%s,%d)\n", ldcs_process_data.location, ldcs_process_data.number);
+   attach_record_remove();
    ldcs_destroy_server(ldcs_process_data.serverid);
   
    /* destroy md support (multi-daemon) */
    ldcs_audit_server_md_destroy(&ldcs_process_data);
+   readpool_shutdown();
+   latency_finish();
+   capture_finish();
   
+   /* keep the cache for the next server on this node */
+   if ((ldcs_process_data.opts & OPT_CACHEINDEX) && handle_reads_in_flight())
+      debug_printf("Not saving cache index, file reads were still in flight at exit\n");
+   else if (ldcs_process_data.opts & OPT_CACHEINDEX)
+      cacheindex_save(&ldcs_process_data);
+
    /* destroy file cache */
    if (!(ldcs_process_data.opts & OPT_NOCLEAN)) {
       ldcs_audit_server_filemngt_clean();
@@ -203,6 +630,7 @@ int ldcs_audit_server_run()
    _ldcs_server_stat_init_entry(&server_stat->libread);
    _ldcs_server_stat_init_entry(&server_stat->libstore);
    _ldcs_server_stat_init_entry(&server_stat->libdist);
+   _ldcs_server_stat_init_entry(&server_stat->libdist_raw);
    _ldcs_server_stat_init_entry(&server_stat->procdir);
    _ldcs_server_stat_init_entry(&server_stat->distdir);
    _ldcs_server_stat_init_entry(&server_stat->client_cb);
@@ -211,6 +639,65 @@ int ldcs_audit_server_run()
    _ldcs_server_stat_init_entry(&server_stat->clientmsg);
    _ldcs_server_stat_init_entry(&server_stat->bcast);
    _ldcs_server_stat_init_entry(&server_stat->preload);
+   _ldcs_server_stat_init_entry(&server_stat->prefetch);
+   _ldcs_server_stat_init_entry(&server_stat->cacheindex);
+   _ldcs_server_stat_init_entry(&server_stat->evict);
+   _ldcs_server_stat_init_entry(&server_stat->unmap);
+   _ldcs_server_stat_init_entry(&server_stat->dedup);
+   _ldcs_server_stat_init_entry(&server_stat->lazy);
+   _ldcs_server_stat_init_entry(&server_stat->pushdeps);
+   _ldcs_server_stat_init_entry(&server_stat->predict);
+   _ldcs_server_stat_init_entry(&server_stat->pycompile);
+   _ldcs_server_stat_init_entry(&server_stat->dirlist);
+   _ldcs_server_stat_init_entry(&server_stat->resolve);
+   _ldcs_server_stat_init_entry(&server_stat->localfs);
+   _ldcs_server_stat_init_entry(&server_stat->numa);
+   _ldcs_server_stat_init_entry(&server_stat->stripe);
+   _ldcs_server_stat_init_entry(&server_stat->verify);
+   _ldcs_server_stat_init_entry(&server_stat->verify_bad);
+   _ldcs_server_stat_init_entry(&server_stat->revalidate);
+   _ldcs_server_stat_init_entry(&server_stat->invalidate);
+   _ldcs_server_stat_init_entry(&server_stat->dirfilter_hit);
+   _ldcs_server_stat_init_entry(&server_stat->execsearch);
+   _ldcs_server_stat_init_entry(&server_stat->execsearch_hit);
+   _ldcs_server_stat_init_entry(&server_stat->jit_publish);
+   _ldcs_server_stat_init_entry(&server_stat->jit_wait);
+   _ldcs_server_stat_init_entry(&server_stat->jit_timeout);
+   _ldcs_server_stat_init_entry(&server_stat->dirfilter_miss);
+   _ldcs_server_stat_init_entry(&server_stat->sendq);
+   server_stat->sendq_peak = 0;
+   _ldcs_server_stat_init_entry(&server_stat->sendq_jump);
+   _ldcs_server_stat_init_entry(&server_stat->throttle);
+   _ldcs_server_stat_init_entry(&server_stat->promote);
+   _ldcs_server_stat_init_entry(&server_stat->lateral);
+   _ldcs_server_stat_init_entry(&server_stat->delegated);
+   _ldcs_server_stat_init_entry(&server_stat->bypass);
+   _ldcs_server_stat_init_entry(&server_stat->aggregate);
+   _ldcs_server_stat_init_entry(&server_stat->coalesce);
+   _ldcs_server_stat_init_entry(&server_stat->clientpool);
+   _ldcs_server_stat_init_entry(&server_stat->fairq);
+   _ldcs_server_stat_init_entry(&server_stat->delta);
+   _ldcs_server_stat_init_entry(&server_stat->rackcache);
+   _ldcs_server_stat_init_entry(&server_stat->join);
+   _ldcs_server_stat_init_entry(&server_stat->sparse);
+   _ldcs_server_stat_init_entry(&server_stat->lazypush);
+   _ldcs_server_stat_init_entry(&server_stat->statahead);
+   _ldcs_server_stat_init_entry(&server_stat->namesnap);
+   _ldcs_server_stat_init_entry(&server_stat->linktune);
+   _ldcs_server_stat_init_entry(&server_stat->shmcache_hit);
+   _ldcs_server_stat_init_entry(&server_stat->shmcache_miss);
+   _ldcs_server_stat_init_entry(&server_stat->shmcache_wait);
+   _ldcs_server_stat_init_entry(&server_stat->cache_hit);
+   _ldcs_server_stat_init_entry(&server_stat->cache_miss);
+   _ldcs_server_stat_init_entry(&server_stat->fs_open);
+   _ldcs_server_stat_init_entry(&server_stat->fs_stat);
+   _ldcs_server_stat_init_entry(&server_stat->fs_readdir);
+   _ldcs_server_stat_init_entry(&server_stat->fs_read);
+   _ldcs_server_stat_init_entry(&server_stat->client_open);
+   _ldcs_server_stat_init_entry(&server_stat->client_stat);
+   _ldcs_server_stat_init_entry(&server_stat->client_objsearch);
+   _ldcs_server_stat_init_entry(&server_stat->client_wait);
+   _ldcs_server_stat_init_entry(&server_stat->client_fallback);
 
    return(rc);
  }
@@ -248,6 +735,12 @@ int ldcs_audit_server_run()
 	  server_stat->libdist.bytes/1024.0/1024.0,
 	  server_stat->libdist.time );
 
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"libdist_raw",
+	  server_stat->libdist_raw.cnt,
+	  server_stat->libdist_raw.bytes/1024.0/1024.0,
+	  server_stat->libdist_raw.time );
+
   debug_printf(MYFORMAT,
 	  server_stat->md_rank,"procdir",
 	  server_stat->procdir.cnt,
@@ -296,6 +789,287 @@ int ldcs_audit_server_run()
 	  server_stat->preload.bytes/1024.0/1024.0,
 	  server_stat->preload.time );
 
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"prefetch",
+	  server_stat->prefetch.cnt,
+	  server_stat->prefetch.bytes/1024.0/1024.0,
+	  server_stat->prefetch.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"cacheindex",
+	  server_stat->cacheindex.cnt,
+	  server_stat->cacheindex.bytes/1024.0/1024.0,
+	  server_stat->cacheindex.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"evict",
+	  server_stat->evict.cnt,
+	  server_stat->evict.bytes/1024.0/1024.0,
+	  server_stat->evict.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"unmap",
+	  server_stat->unmap.cnt,
+	  server_stat->unmap.bytes/1024.0/1024.0,
+	  server_stat->unmap.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"dedup",
+	  server_stat->dedup.cnt,
+	  server_stat->dedup.bytes/1024.0/1024.0,
+	  server_stat->dedup.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"lazy",
+	  server_stat->lazy.cnt,
+	  server_stat->lazy.bytes/1024.0/1024.0,
+	  server_stat->lazy.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"pushdeps",
+	  server_stat->pushdeps.cnt,
+	  server_stat->pushdeps.bytes/1024.0/1024.0,
+	  server_stat->pushdeps.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"predict",
+	  server_stat->predict.cnt,
+	  server_stat->predict.bytes/1024.0/1024.0,
+	  server_stat->predict.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"pycompile",
+	  server_stat->pycompile.cnt,
+	  server_stat->pycompile.bytes/1024.0/1024.0,
+	  server_stat->pycompile.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"dirlist",
+	  server_stat->dirlist.cnt,
+	  server_stat->dirlist.bytes/1024.0/1024.0,
+	  server_stat->dirlist.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"resolve",
+	  server_stat->resolve.cnt,
+	  server_stat->resolve.bytes/1024.0/1024.0,
+	  server_stat->resolve.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"localfs",
+	  server_stat->localfs.cnt,
+	  server_stat->localfs.bytes/1024.0/1024.0,
+	  server_stat->localfs.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"numa",
+	  server_stat->numa.cnt,
+	  server_stat->numa.bytes/1024.0/1024.0,
+	  server_stat->numa.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"stripe",
+	  server_stat->stripe.cnt,
+	  server_stat->stripe.bytes/1024.0/1024.0,
+	  server_stat->stripe.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"verify",
+	  server_stat->verify.cnt,
+	  server_stat->verify.bytes/1024.0/1024.0,
+	  server_stat->verify.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"verify_bad",
+	  server_stat->verify_bad.cnt,
+	  server_stat->verify_bad.bytes/1024.0/1024.0,
+	  server_stat->verify_bad.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"revalidate",
+	  server_stat->revalidate.cnt,
+	  server_stat->revalidate.bytes/1024.0/1024.0,
+	  server_stat->revalidate.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"invalidate",
+	  server_stat->invalidate.cnt,
+	  server_stat->invalidate.bytes/1024.0/1024.0,
+	  server_stat->invalidate.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"sendq",
+	  server_stat->sendq.cnt,
+	  server_stat->sendq.bytes/1024.0/1024.0,
+	  server_stat->sendq.time );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, peak=%8.2f MB\n",
+	  server_stat->md_rank,"sendq",
+	  server_stat->sendq_peak/1024.0/1024.0 );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"sendq_jump",
+	  server_stat->sendq_jump.cnt,
+	  server_stat->sendq_jump.bytes/1024.0/1024.0,
+	  server_stat->sendq_jump.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"throttle",
+	  server_stat->throttle.cnt,
+	  server_stat->throttle.bytes/1024.0/1024.0,
+	  server_stat->throttle.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"promote",
+	  server_stat->promote.cnt,
+	  server_stat->promote.bytes/1024.0/1024.0,
+	  server_stat->promote.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"lateral",
+	  server_stat->lateral.cnt,
+	  server_stat->lateral.bytes/1024.0/1024.0,
+	  server_stat->lateral.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"delegated",
+	  server_stat->delegated.cnt,
+	  server_stat->delegated.bytes/1024.0/1024.0,
+	  server_stat->delegated.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"bypass",
+	  server_stat->bypass.cnt,
+	  server_stat->bypass.bytes/1024.0/1024.0,
+	  server_stat->bypass.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"aggregate",
+	  server_stat->aggregate.cnt,
+	  server_stat->aggregate.bytes/1024.0/1024.0,
+	  server_stat->aggregate.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"coalesce",
+	  server_stat->coalesce.cnt,
+	  server_stat->coalesce.bytes/1024.0/1024.0,
+	  server_stat->coalesce.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"clientpool",
+	  server_stat->clientpool.cnt,
+	  server_stat->clientpool.bytes/1024.0/1024.0,
+	  server_stat->clientpool.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"fairq",
+	  server_stat->fairq.cnt,
+	  server_stat->fairq.bytes/1024.0/1024.0,
+	  server_stat->fairq.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"delta",
+	  server_stat->delta.cnt,
+	  server_stat->delta.bytes/1024.0/1024.0,
+	  server_stat->delta.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"rackcache",
+	  server_stat->rackcache.cnt,
+	  server_stat->rackcache.bytes/1024.0/1024.0,
+	  server_stat->rackcache.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"join",
+	  server_stat->join.cnt,
+	  server_stat->join.bytes/1024.0/1024.0,
+	  server_stat->join.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"sparse",
+	  server_stat->sparse.cnt,
+	  server_stat->sparse.bytes/1024.0/1024.0,
+	  server_stat->sparse.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"lazypush",
+	  server_stat->lazypush.cnt,
+	  server_stat->lazypush.bytes/1024.0/1024.0,
+	  server_stat->lazypush.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"statahead",
+	  server_stat->statahead.cnt,
+	  server_stat->statahead.bytes/1024.0/1024.0,
+	  server_stat->statahead.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"namesnap",
+	  server_stat->namesnap.cnt,
+	  server_stat->namesnap.bytes/1024.0/1024.0,
+	  server_stat->namesnap.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"linktune",
+	  server_stat->linktune.cnt,
+	  server_stat->linktune.bytes/1024.0/1024.0,
+	  server_stat->linktune.time );
+
+  if (server_stat->linktune.time > 0.0)
+    debug_printf("SERVER[%02d] STAT:  %-10s, rate=%8.2f MB/s\n",
+	    server_stat->md_rank,"linktune",
+	    server_stat->linktune.bytes/1024.0/1024.0/server_stat->linktune.time );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, #hit=%5d, #miss=%5d\n",
+	  server_stat->md_rank,"dirfilter",
+	  server_stat->dirfilter_hit.cnt,
+	  server_stat->dirfilter_miss.cnt );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, #cnt=%5d, #hit=%5d\n",
+	  server_stat->md_rank,"execsearch",
+	  server_stat->execsearch.cnt,
+	  server_stat->execsearch_hit.cnt );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, #pub=%5d, #wait=%5d, #timeout=%5d, wait time=%8.4f\n",
+	  server_stat->md_rank,"jit",
+	  server_stat->jit_publish.cnt,
+	  server_stat->jit_wait.cnt,
+	  server_stat->jit_timeout.cnt,
+	  server_stat->jit_wait.time );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, #hit=%5d, #miss=%5d\n",
+	  server_stat->md_rank,"cache",
+	  server_stat->cache_hit.cnt,
+	  server_stat->cache_miss.cnt );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, #hit=%5d, #miss=%5d, #wait=%5d, hit rate=%5.1f%%\n",
+	  server_stat->md_rank,"shmcache",
+	  server_stat->shmcache_hit.cnt,
+	  server_stat->shmcache_miss.cnt,
+	  server_stat->shmcache_wait.cnt,
+	  100.0 * (server_stat->shmcache_hit.cnt + server_stat->shmcache_wait.cnt) /
+	  ((server_stat->shmcache_hit.cnt + server_stat->shmcache_wait.cnt + server_stat->shmcache_miss.cnt) ?
+	   (server_stat->shmcache_hit.cnt + server_stat->shmcache_wait.cnt + server_stat->shmcache_miss.cnt) : 1) );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, #open=%5d, #stat=%5d, #readdir=%5d, #read=%5d, read=%8.2f MB\n",
+	  server_stat->md_rank,"sharedfs",
+	  server_stat->fs_open.cnt,
+	  server_stat->fs_stat.cnt,
+	  server_stat->fs_readdir.cnt,
+	  server_stat->fs_read.cnt,
+	  server_stat->fs_read.bytes/1024.0/1024.0 );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, #open=%5d in %10.4fs, #stat=%5d in %10.4fs, #objsearch=%5d in %10.4fs, #wait=%5d in %10.4fs\n",
+	  server_stat->md_rank,"clienttime",
+	  server_stat->client_open.cnt, server_stat->client_open.time,
+	  server_stat->client_stat.cnt, server_stat->client_stat.time,
+	  server_stat->client_objsearch.cnt, server_stat->client_objsearch.time,
+	  server_stat->client_wait.cnt, server_stat->client_wait.time );
+
+  debug_printf("SERVER[%02d] STAT:  %-10s, #cnt=%5d, waited=%10.4fs\n",
+	  server_stat->md_rank,"fallback",
+	  server_stat->client_fallback.cnt, server_stat->client_fallback.time );
+
   return(rc);
 }
 
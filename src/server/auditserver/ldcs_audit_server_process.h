@@ -61,6 +61,7 @@ struct ldcs_server_stat_struct
   ldcs_server_stat_entry_t libread;
   ldcs_server_stat_entry_t libstore;
   ldcs_server_stat_entry_t libdist;
+  ldcs_server_stat_entry_t libdist_raw;   /* cnt sent compressed, bytes before compression, time compressing */
   ldcs_server_stat_entry_t procdir;
   ldcs_server_stat_entry_t distdir;
   ldcs_server_stat_entry_t client_cb;
@@ -69,6 +70,65 @@ struct ldcs_server_stat_struct
   ldcs_server_stat_entry_t clientmsg;
   ldcs_server_stat_entry_t bcast;
   ldcs_server_stat_entry_t preload;
+  ldcs_server_stat_entry_t prefetch;
+  ldcs_server_stat_entry_t cacheindex;
+  ldcs_server_stat_entry_t evict;
+  ldcs_server_stat_entry_t unmap;           /* staged files we stopped mapping once every child had them */
+  ldcs_server_stat_entry_t dedup;           /* files staged as links to a duplicate */
+  ldcs_server_stat_entry_t lazy;            /* extents of lazily staged files, read or received */
+  ldcs_server_stat_entry_t pushdeps;        /* dependencies pushed before being asked for */
+  ldcs_server_stat_entry_t predict;         /* files read and pushed because a request predicted them */
+  ldcs_server_stat_entry_t pycompile;       /* .pyc files we compiled for a __pycache__ directory, time compiling */
+  ldcs_server_stat_entry_t dirlist;         /* directory listings served to clients, time building them */
+  ldcs_server_stat_entry_t resolve;         /* readlink and realpath queries answered from the cache */
+  ldcs_server_stat_entry_t localfs;         /* queries left to the client since the file is on a node-local file system */
+  ldcs_server_stat_entry_t numa;            /* files copied to each NUMA node, time copying */
+  ldcs_server_stat_entry_t stripe;          /* pieces of striped reads read by, or received from, a reader */
+  ldcs_server_stat_entry_t verify;          /* files checksummed with --verify, time checksumming */
+  ldcs_server_stat_entry_t verify_bad;      /* staged copies that failed their checksum and were dropped */
+  ldcs_server_stat_entry_t revalidate;      /* files and directories checked before a session step, time checking */
+  ldcs_server_stat_entry_t invalidate;      /* changes dropped from the cache, staged bytes dropped */
+  ldcs_server_stat_entry_t dirfilter_hit;   /* misses answered by a directory filter */
+  ldcs_server_stat_entry_t dirfilter_miss;  /* misses the filter let through */
+  ldcs_server_stat_entry_t execsearch;      /* PATH searches for an exec */
+  ldcs_server_stat_entry_t execsearch_hit;  /* of those, ones that started from how the same search went before */
+  ldcs_server_stat_entry_t jit_publish;     /* jit files our clients wrote and published */
+  ldcs_server_stat_entry_t jit_wait;        /* jit queries that waited on another client's file, time waiting */
+  ldcs_server_stat_entry_t jit_timeout;     /* of those, ones that gave up and generated the file themselves */
+  ldcs_server_stat_entry_t sendq;           /* sends that waited on a full child socket: bytes queued, time until sent */
+  long                 sendq_peak;          /* most bytes queued for one child at once */
+  ldcs_server_stat_entry_t sendq_jump;      /* messages sent ahead of lower priority file contents */
+  ldcs_server_stat_entry_t throttle;        /* times a peer's sends waited on the --bandwidth limit, time waiting */
+  ldcs_server_stat_entry_t promote;         /* pull mode files and directories sent to all children */
+  ldcs_server_stat_entry_t lateral;         /* files we sent to a sibling for our parent */
+  ldcs_server_stat_entry_t delegated;       /* files we had a child send to its sibling */
+  ldcs_server_stat_entry_t bypass;          /* files we sent to the children of a lagging child */
+  ldcs_server_stat_entry_t aggregate;       /* child messages folded into a request batch, time waiting for them */
+  ldcs_server_stat_entry_t coalesce;        /* small messages held back to share a writev with others */
+  ldcs_server_stat_entry_t clientpool;      /* client queries answered on a client thread */
+  ldcs_server_stat_entry_t fairq;           /* client messages queued for their turn, time waiting */
+  ldcs_server_stat_entry_t delta;           /* files sent as changes to their last version, bytes saved */
+  ldcs_server_stat_entry_t rackcache;       /* files a rack leader staged from its rack cache rather than requesting */
+  ldcs_server_stat_entry_t join;            /* servers that joined below us with --elastic, bytes of listings sent them */
+  ldcs_server_stat_entry_t sparse;          /* files sent as their data extents, bytes of holes not sent */
+  ldcs_server_stat_entry_t lazypush;        /* extents of lazy files pushed with --hot-extents, bytes */
+  ldcs_server_stat_entry_t statahead;       /* files stat'd ahead on Lustre or GPFS with --pfs-metadata */
+  ldcs_server_stat_entry_t namesnap;        /* answers published in the name snapshot with SPINDLE_NAMESNAP */
+  ldcs_server_stat_entry_t linktune;        /* large transfers timed to tune each tree edge, and edges retuned */
+  ldcs_server_stat_entry_t shmcache_hit;    /* node's lookups answered by the client shared memory cache */
+  ldcs_server_stat_entry_t shmcache_miss;   /* lookups that had to ask us */
+  ldcs_server_stat_entry_t shmcache_wait;   /* lookups that waited for another client's answer */
+  ldcs_server_stat_entry_t cache_hit;       /* client file queries answered from what we had */
+  ldcs_server_stat_entry_t cache_miss;      /* client file queries that waited on a read or a request */
+  ldcs_server_stat_entry_t fs_open;         /* opens we issued against the shared file system */
+  ldcs_server_stat_entry_t fs_stat;         /* stats we issued against it */
+  ldcs_server_stat_entry_t fs_readdir;      /* directories we listed from it, bytes of entries */
+  ldcs_server_stat_entry_t fs_read;         /* files or extents we read from it, bytes read */
+  ldcs_server_stat_entry_t client_open;     /* opens our clients intercepted, time in them (OPT_CLIENTTIMING) */
+  ldcs_server_stat_entry_t client_stat;     /* stats our clients intercepted, time in them */
+  ldcs_server_stat_entry_t client_objsearch;/* library searches our clients intercepted, time in them */
+  ldcs_server_stat_entry_t client_wait;     /* client queries to us, time the clients waited for answers */
+  ldcs_server_stat_entry_t client_fallback; /* client queries given up at their deadline, time they waited */
 
   char *hostname;
 
@@ -76,24 +136,61 @@ struct ldcs_server_stat_struct
 typedef struct ldcs_server_stat_struct ldcs_server_stat_t;
 
 
+/* The table holds an entry per client, so path buffers are allocated
+   apart from it.  remote_* are NULL until the client sends them, and the
+   query_* buffers are allocated together at the client's first query.
+   Queries a client tags with a request id get an entry of their own,
+   which shares the connection of the client's entry. */
 struct ldcs_client_struct
 {
   int                  connid;
+  int                  parent;                           /* entry of the connection a request is on, or -1 */
+  int                  req;                              /* request id our answers go back with, or 0 */
+  int                  *requests;                        /* on a connection, the entry of each request id, or -1 */
   int                  lrank;
   int                  null_msg_cnt;
   ldcs_client_status_t state;
-  char                 remote_location[MAX_PATH_LEN];
+  char                 *remote_location;
   int                  remote_pid;
-  char                 remote_cwd[MAX_PATH_LEN];
+  char                 *remote_cwd;
   int                  query_open;
   int                  existance_query;
+  int                  dir_query;                        /* query is for a directory's listing */
+  int                  link_query;                       /* query is a readlink or realpath */
+  int                  link_last;                        /* link query is a readlink, of the last name only */
   int                  is_stat;
   int                  is_loader;
-  char                 query_filename[MAX_PATH_LEN];    /* hash 1st key */
-  char                 query_dirname[MAX_PATH_LEN];     /* hast 2nd key */
-  char                 query_globalpath[MAX_PATH_LEN];  /* path to file in global fs (dirname+filename) */
+  int                  is_lazy;                          /* query can be answered with a lazily staged file */
+  int                  want_fd;                          /* query asks for an open descriptor with the answer */
+  int                  is_search;                        /* query is for the first of search_list that exists */
+  char                 *search_list;                     /* NUL separated candidate paths, in search order */
+  int                  search_len;
+  int                  search_pos;                       /* offset of the candidate being looked at */
+  int                  search_index;                     /* and its index */
+  int                  search_cached;                    /* looking at the file ld.so.cache names */
+  int                  search_ldso;                      /* search follows ld.so's rules, not just list order */
+  const char           *search_key;                      /* interned name/PATH of an exec search we can remember */
+  int                  search_exec;                      /* search is for an exec through PATH */
+  int                  search_denied;                    /* an exec search passed over a candidate it couldn't read */
+  int                  jit_query;                        /* query is for a file under a jit rule */
+  int                  jit_waiting;                      /* and waits on another client to publish it */
+  int                  kvs_waiting;                      /* fenced, and waits for the key-value table */
+  int                  range_open;                       /* waiting on a range of a lazy file */
+  int                  query_missed;                     /* the open query had to be read or requested */
+  const char           *wait_path;                       /* interned path the client waits to arrive, or NULL */
+  unsigned int         step;                             /* session step the client belongs to, or 0 */
+  unsigned int         settings_seen;                    /* settings version when the client connected */
+  void                 *range_file;
+  size_t               range_first;                      /* extents the range covers */
+  size_t               range_last;
+  char                 *query_filename;                 /* hash 1st key, MAX_PATH_LEN bytes */
+  char                 *query_dirname;                  /* hast 2nd key, MAX_PATH_LEN bytes */
+  char                 *query_globalpath;               /* path to file in global fs (dirname+filename), MAX_PATH_LEN bytes */
   char                 *query_localpath;                /* path to file in local temporary fs (dirname+filename) */
   double               query_arrival_time;
+  void                 **pinned;                        /* staged files handed to this client */
+  int                  pinned_count;
+  int                  pinned_size;
 };
 typedef struct ldcs_client_struct ldcs_client_t;
 
@@ -113,13 +210,42 @@ struct ldcs_process_data_struct
   char *location;
   char *hostname;
   char *pythonprefix;
+  char *preloadfile;            /* with OPT_PRELOADLEARN, where the root writes what was used */
+  char *stats_report;           /* with OPT_STATSREPORT, where the root writes the tree's statistics */
+  char *predict_trace;          /* with OPT_PREDICT, a preload file the root seeds its predictions from */
+  char *reloc_rules;            /* with OPT_RELOCRULES, the rules' text as handed to clients */
+  struct reloc_rule *rules;     /* parsed from a copy of reloc_rules */
+  int num_rules;
+  char *disk_location;          /* where files of disk_threshold MB or more are staged, NULL for location */
+  unsigned int disk_threshold;
+  char *shared_cache;           /* node directory of files shared with this user's other jobs, or NULL */
+  char *cluster_cache;          /* directory all nodes see, with copies of files for later jobs, or NULL */
+  char *rack_cache;             /* on a rack leader, local directory of files kept for its rack, or NULL */
   int number;
   int preload_done;
+  unsigned int settings_version; /* last LDCS_MSG_SETTINGS_UPDATE taken on, 0 for none */
+  unsigned int preload_version;  /* settings version whose preload we're waiting on */
   opt_t opts;
+  unsigned int cache_budget;    /* megabytes of staged files to keep, 0 for no limit */
+  unsigned int num_readers;     /* servers that read the shared file system */
+  unsigned int num_streams;     /* TCP connections to each neighboring server */
+  unsigned int lateral_peers;   /* siblings on either side we link to, 0 for none */
+  unsigned int bandwidth;       /* MB/s we send each neighboring server, 0 for no limit */
+  unsigned int background_bandwidth; /* the limit once the job's startup is done, 0 to keep bandwidth */
+  unsigned int dscp;            /* DSCP value our network traffic is marked with, 0 for unmarked */
+  char *server_cpus;            /* CPU list or "reserved" we pin ourselves to, NULL for unpinned */
+  int server_nice;              /* nice value we run at */
+  int server_numa;              /* NUMA node our memory is placed on, -1 for the default */
+  int startup_done;             /* 0, 1 once we told our parent the job's startup is done, 2 once the root said so */
+  unsigned int promote_children; /* in pull mode, send a file to all children once this many asked, 0 for never */
+  long aggregate_usec;          /* how long to gather child requests before forwarding, 0 for no wait */
+  int client_threads;           /* threads answering cached client queries, 0 for none */
+  int expected_clients;         /* client table entries to allocate up front */
   requestor_list_t pending_requests;
   requestor_list_t completed_requests;
   requestor_list_t pending_metadata_requests;
   requestor_list_t completed_metadata_requests;
+  requestor_list_t unaliased_requests; /* peers that couldn't stage a file as an alias */
 
   /* multi daemon support */
   int md_rank;
@@ -134,18 +260,22 @@ struct ldcs_process_data_struct
 typedef struct ldcs_process_data_struct ldcs_process_data_t;
 
 int ldcs_audit_server_network_setup(unsigned int port, unsigned int num_ports, unique_id_t unique_id,
-                                    void **packed_setup_data, int *data_size);
+                                    char *join_hosts, void **packed_setup_data, int *data_size);
 int ldcs_audit_server_process (spindle_args_t *args);
 int ldcs_audit_server_run();
 
 #define CLIENT_CB_AUX_FD INT32_MAX
 int _ldcs_client_CB ( int fd, int nc, void *data );
 int _ldcs_server_CB ( int infd, int serverid, void *data );
+int _ldcs_server_init_client_table ( ldcs_process_data_t *ldcs_process_data, int size );
+int _ldcs_server_alloc_client ( ldcs_process_data_t *ldcs_process_data );
+void _ldcs_server_free_client ( ldcs_client_t *client );
 
 int _ldcs_client_process_clients_requests_after_end ( ldcs_process_data_t *ldcs_process_data );
 
 int _ldcs_server_stat_init ( ldcs_server_stat_t *server_stat );
 int _ldcs_server_stat_print ( ldcs_server_stat_t *server_stat );
+void _ldcs_server_stat_collect ( ldcs_process_data_t *ldcs_process_data );
 
 #if defined(__cplusplus)
 }
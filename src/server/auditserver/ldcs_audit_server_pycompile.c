@@ -0,0 +1,311 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_pycompile.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "name_intern.h"
+#include "spindle_launch.h"
+#include "spindle_debug.h"
+
+/**
+ * Every missing .pyc of a directory is compiled by one run of the
+ * interpreter, which reads source and destination pairs, each NUL
+ * terminated, on stdin.  Compiled files are kept by their interned
+ * pathnames, so a bucket is searched by comparing pointers.
+ **/
+
+#define PYCOMPILE_TABLE_SIZE 1024
+#define PYCOMPILE_MAX_TAG 64
+
+#define PYCOMPILE_TAG_SCRIPT \
+   "import sys; sys.stdout.write(sys.implementation.cache_tag or '')"
+#define PYCOMPILE_SCRIPT \
+   "import sys, py_compile; l = sys.stdin.buffer.read().split(b'\\0'); " \
+   "[py_compile.compile(s.decode(), cfile=c.decode()) for s, c in zip(l[0::2], l[1::2])]"
+
+typedef struct pycompiled_t {
+   const char *pathname;
+   char *compiled;
+   size_t size;
+   struct pycompiled_t *next;
+} pycompiled_t;
+
+typedef struct {
+   char *name;
+   char *compiled;
+} pycompile_pending_t;
+
+static pycompiled_t *pycompiled_table[PYCOMPILE_TABLE_SIZE];
+static int pycompile_state = 0;       /* 0 until set up, 1 if usable, -1 if not */
+static char python[MAX_PATH_LEN+1];
+static char cache_tag[PYCOMPILE_MAX_TAG];
+static char compile_dir[MAX_PATH_LEN+1];
+static unsigned long num_compiled = 0;
+
+static int find_python(ldcs_process_data_t *procdata)
+{
+   const char *prefix, *end, *names[2] = { "python3", "python" };
+   size_t len;
+   int i;
+
+   if (getenv("SPINDLE_PYTHON")) {
+      snprintf(python, sizeof(python), "%s", getenv("SPINDLE_PYTHON"));
+      return 0;
+   }
+   for (prefix = procdata->pythonprefix; prefix && *prefix; prefix = *end ? end + 1 : end) {
+      end = strchr(prefix, ':');
+      if (!end)
+         end = prefix + strlen(prefix);
+      len = end - prefix;
+      if (!len)
+         continue;
+      for (i = 0; i < 2; i++) {
+         snprintf(python, sizeof(python), "%.*s/bin/%s", (int) len, prefix, names[i]);
+         if (access(python, X_OK) == 0)
+            return 0;
+      }
+   }
+   return -1;
+}
+
+static int query_cache_tag()
+{
+   char cmdline[MAX_PATH_LEN + sizeof(PYCOMPILE_TAG_SCRIPT) + 16];
+   FILE *f;
+   size_t len;
+
+   snprintf(cmdline, sizeof(cmdline), "'%s' -c \"%s\"", python, PYCOMPILE_TAG_SCRIPT);
+   f = popen(cmdline, "r");
+   if (!f) {
+      err_printf("Failed to run %s to get its bytecode tag: %s\n", python, strerror(errno));
+      return -1;
+   }
+   if (!fgets(cache_tag, sizeof(cache_tag), f))
+      cache_tag[0] = '\0';
+   pclose(f);
+
+   len = strlen(cache_tag);
+   while (len && (cache_tag[len-1] == '\n' || cache_tag[len-1] == '\r'))
+      cache_tag[--len] = '\0';
+   return len ? 0 : -1;
+}
+
+static int pycompile_setup(ldcs_process_data_t *procdata)
+{
+   if (pycompile_state)
+      return pycompile_state == 1 ? 0 : -1;
+   pycompile_state = -1;
+
+   if (find_python(procdata) == -1) {
+      err_printf("No python interpreter under the python prefix %s, not compiling .pyc files\n",
+                 procdata->pythonprefix ? procdata->pythonprefix : "");
+      return -1;
+   }
+   if (query_cache_tag() == -1) {
+      err_printf("Could not get the bytecode tag of %s, not compiling .pyc files\n", python);
+      return -1;
+   }
+   snprintf(compile_dir, sizeof(compile_dir), "%s/pyc", procdata->location);
+   if (mkdir(compile_dir, 0700) == -1 && errno != EEXIST) {
+      err_printf("Could not create %s, not compiling .pyc files: %s\n", compile_dir, strerror(errno));
+      return -1;
+   }
+
+   debug_printf("Compiling missing .pyc files with %s, tag %s\n", python, cache_tag);
+   pycompile_state = 1;
+   return 0;
+}
+
+int pycompile_is_candidate(ldcs_process_data_t *procdata, const char *dir)
+{
+   const char *last_slash;
+
+   if (!(procdata->opts & OPT_COMPILEPYC) || pycompile_state == -1)
+      return 0;
+   last_slash = strrchr(dir, '/');
+   return last_slash && strcmp(last_slash + 1, "__pycache__") == 0;
+}
+
+static int listing_has(dir_listing_t *listing, const char *name)
+{
+   size_t i;
+
+   for (i = 0; i < listing->count; i++) {
+      if (strcmp(listing->names + listing->offsets[i], name) == 0)
+         return 1;
+   }
+   return 0;
+}
+
+static void add_compiled(const char *pathname, char *compiled, size_t size)
+{
+   pycompiled_t *pc;
+   unsigned int bucket;
+
+   pc = (pycompiled_t *) malloc(sizeof(pycompiled_t));
+   if (!pc) {
+      err_printf("Could not allocate compiled file record for %s\n", pathname);
+      free(compiled);
+      return;
+   }
+   pc->pathname = intern_name(pathname);
+   pc->compiled = compiled;
+   pc->size = size;
+   bucket = intern_name_hash(pc->pathname) % PYCOMPILE_TABLE_SIZE;
+   pc->next = pycompiled_table[bucket];
+   pycompiled_table[bucket] = pc;
+}
+
+/**
+ * Queue a compile of every .py file in parent without a .pyc for our tag
+ * in listing.  The pipe to the interpreter is opened on the first one.
+ **/
+static int queue_compiles(char *parent, dir_listing_t *listing, dir_listing_t *sources, FILE **f,
+                          pycompile_pending_t **pending, int *num_pending)
+{
+   char pycname[MAX_PATH_LEN+1], srcpath[MAX_PATH_LEN+1], compiled[MAX_PATH_LEN+1];
+   char cmdline[MAX_PATH_LEN + sizeof(PYCOMPILE_SCRIPT) + 16];
+   const char *name;
+   size_t i, len;
+
+   for (i = 0; i < sources->count; i++) {
+      name = sources->names + sources->offsets[i];
+      len = strlen(name);
+      if (sources->types[i] == DT_DIR || len <= 3 || strcmp(name + len - 3, ".py") != 0)
+         continue;
+      snprintf(pycname, sizeof(pycname), "%.*s.%s.pyc", (int) (len - 3), name, cache_tag);
+      if (listing_has(listing, pycname))
+         continue;
+
+      if (!*f) {
+         snprintf(cmdline, sizeof(cmdline), "'%s' -c \"%s\"", python, PYCOMPILE_SCRIPT);
+         *f = popen(cmdline, "w");
+         if (!*f) {
+            err_printf("Failed to run %s to compile .pyc files: %s\n", python, strerror(errno));
+            return -1;
+         }
+         *pending = (pycompile_pending_t *) malloc(sources->count * sizeof(pycompile_pending_t));
+         if (!*pending) {
+            err_printf("Could not allocate the list of .pyc files to compile\n");
+            return -1;
+         }
+      }
+
+      snprintf(srcpath, sizeof(srcpath), "%s/%s", parent, name);
+      snprintf(compiled, sizeof(compiled), "%s/%lu.pyc", compile_dir, num_compiled++);
+      fwrite(srcpath, 1, strlen(srcpath) + 1, *f);
+      fwrite(compiled, 1, strlen(compiled) + 1, *f);
+      (*pending)[*num_pending].name = strdup(pycname);
+      (*pending)[*num_pending].compiled = strdup(compiled);
+      (*num_pending)++;
+   }
+   return 0;
+}
+
+ldcs_cache_result_t pycompile_process_directory(ldcs_process_data_t *procdata, char *dir, size_t *bytesread)
+{
+   dir_listing_t listing, sources;
+   pycompile_pending_t *pending = NULL;
+   char parent[MAX_PATH_LEN+1], pathname[MAX_PATH_LEN+1], *last_slash;
+   int i, num_pending = 0, num_added = 0;
+   struct stat buf;
+   struct sigaction act, oldact;
+   double starttime;
+   FILE *f = NULL;
+
+   if (pycompile_setup(procdata) == -1)
+      return ldcs_cache_processDirectory(dir, bytesread);
+
+   starttime = ldcs_get_time();
+   if (bytesread) *bytesread = 0;
+   debug_printf2("Reading directory %s and compiling what's missing from it\n", dir);
+   ldcs_cache_scanDirectory(dir, &listing);
+   if (bytesread) *bytesread += listing.bytes_read;
+
+   snprintf(parent, sizeof(parent), "%s", dir);
+   last_slash = strrchr(parent, '/');
+   if (last_slash == parent)
+      last_slash++;
+   *last_slash = '\0';
+   ldcs_cache_scanDirectory(parent, &sources);
+   filemngt_count_fsop(FSOP_READDIR, sources.bytes_read);
+
+   /* An interpreter that dies early shouldn't take us with it */
+   memset(&act, 0, sizeof(act));
+   act.sa_handler = SIG_IGN;
+   sigaction(SIGPIPE, &act, &oldact);
+   if (queue_compiles(parent, &listing, &sources, &f, &pending, &num_pending) == -1)
+      num_pending = 0;
+   if (f && pclose(f) == -1)
+      err_printf("Failed to wait for %s compiling .pyc files: %s\n", python, strerror(errno));
+   sigaction(SIGPIPE, &oldact, NULL);
+
+   for (i = 0; i < num_pending; i++) {
+      if (stat(pending[i].compiled, &buf) == 0 && S_ISREG(buf.st_mode) &&
+          ldcs_cache_addToListing(&listing, pending[i].name, DT_REG) == 0) {
+         snprintf(pathname, sizeof(pathname), "%s/%s", dir, pending[i].name);
+         debug_printf3("Compiled %s to %s\n", pathname, pending[i].compiled);
+         add_compiled(pathname, pending[i].compiled, buf.st_size);
+         num_added++;
+      }
+      else {
+         debug_printf2("Could not compile %s in %s\n", pending[i].name, dir);
+         unlink(pending[i].compiled);
+         free(pending[i].compiled);
+      }
+      free(pending[i].name);
+   }
+   free(pending);
+
+   if (num_added)
+      listing.exists = 1;
+   ldcs_cache_storeListing(dir, &listing);
+   ldcs_cache_freeListing(&listing);
+   ldcs_cache_freeListing(&sources);
+
+   procdata->server_stat.pycompile.cnt += num_added;
+   procdata->server_stat.pycompile.time += (ldcs_get_time() - starttime);
+   return ldcs_cache_findDirInCache(dir);
+}
+
+const char *pycompile_find(const char *pathname, size_t *size)
+{
+   const char *name;
+   pycompiled_t *pc;
+
+   if (pycompile_state != 1)
+      return NULL;
+   name = lookup_intern_name(pathname);
+   if (!name)
+      return NULL;
+   for (pc = pycompiled_table[intern_name_hash(name) % PYCOMPILE_TABLE_SIZE]; pc; pc = pc->next) {
+      if (pc->pathname == name) {
+         *size = pc->size;
+         return pc->compiled;
+      }
+   }
+   return NULL;
+}
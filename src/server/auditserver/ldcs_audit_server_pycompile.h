@@ -0,0 +1,46 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_PYCOMPILE_H_)
+#define LDCS_AUDIT_SERVER_PYCOMPILE_H_
+
+#include <sys/types.h>
+
+#include "ldcs_audit_server_process.h"
+#include "ldcs_cache.h"
+
+/**
+ * With --compile-pyc, the server that reads a __pycache__ directory
+ * compiles the .py files next to it that have no bytecode there for the
+ * job's interpreter, and lists what it compiled as if it were on disk.
+ * The bytecode is staged and sent like any other file when it's asked
+ * for, so processes load it rather than each compiling the source.
+ *
+ * The interpreter is $SPINDLE_PYTHON, or else the first python3 or python
+ * under a bin directory of the python prefix.
+ **/
+
+/* Return true if dir is a __pycache__ directory we should compile into */
+int pycompile_is_candidate(ldcs_process_data_t *procdata, const char *dir);
+
+/* Compile what's missing from dir and add its listing to the cache, as
+   ldcs_cache_processDirectory does */
+ldcs_cache_result_t pycompile_process_directory(ldcs_process_data_t *procdata, char *dir, size_t *bytesread);
+
+/* Return where we compiled pathname and set *size, or NULL if we didn't */
+const char *pycompile_find(const char *pathname, size_t *size);
+
+#endif
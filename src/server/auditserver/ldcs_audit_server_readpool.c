@@ -0,0 +1,424 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "ldcs_audit_server_readpool.h"
+#include "spindle_debug.h"
+
+/**
+ * The read pool is a few helper threads that the root server uses to
+ * read from the shared file system, where each request has a high
+ * latency.  Big reads are split into READPOOL_CHUNK_SIZE preads that
+ * are all in flight at once, and batches of files (such as the preload
+ * list) are read concurrently, one job per file.
+ *
+ * Jobs can also be submitted without waiting for them (readpool_submit).
+ * Each one's arg is written to a pipe when it finishes, which the server
+ * loop listens on.  A thread waiting in readpool_run helps with the
+ * queued jobs it can wait on, so a submitted job that splits its reads
+ * into chunks can't starve for threads.  readpool_start sits between
+ * the two: the caller doesn't wait for the job at once, but later waits
+ * for it with readpool_wait, which lets it work through a stream of
+ * files with the next reads in flight.
+ *
+ * When SPINDLE_DIRECT_IO is set to a non-zero value the aligned part of
+ * each read uses an O_DIRECT fd, which skips the page cache on the
+ * server node.  If the file system rejects O_DIRECT reads we quietly
+ * go back to buffered reads.
+ **/
+
+#define READPOOL_THREADS 8
+#define READPOOL_CHUNK_SIZE (4*1024*1024)
+#define READPOOL_DIRECT_ALIGN 4096
+
+typedef struct readpool_job_t {
+   readpool_fn_t fn;
+   void *arg;
+   int *remaining;              /* NULL for a submitted job */
+   int allocated;               /* freed by run_job once done */
+   struct readpool_job_t *next;
+} readpool_job_t;
+
+typedef struct {
+   int fd;
+   int direct_fd;
+   char *buffer;
+   size_t offset;
+   size_t len;
+   ssize_t result;
+} read_chunk_t;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static readpool_job_t *job_head = NULL, *job_tail = NULL;
+static pthread_t workers[READPOOL_THREADS];
+static int num_workers = 0;
+static int shutting_down = 0;
+
+static int completion_fds[2] = { -1, -1 };
+
+/* -1 until SPINDLE_DIRECT_IO is looked at.  The reader threads turn it
+   off if O_DIRECT reads fail, so it's only touched with __atomic builtins. */
+static int direct_io = -1;
+
+static int get_direct_io()
+{
+   char *env;
+   int value, expected = -1;
+
+   value = __atomic_load_n(&direct_io, __ATOMIC_RELAXED);
+   if (value != -1)
+      return value;
+   env = getenv("SPINDLE_DIRECT_IO");
+   value = (env && atoi(env)) ? 1 : 0;
+   if (!__atomic_compare_exchange_n(&direct_io, &expected, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      value = expected;
+   return value;
+}
+
+/* Take job off the queue, which it must be on.  Called with pool_lock held. */
+static void unlink_job(readpool_job_t *job, readpool_job_t *prev)
+{
+   if (prev)
+      prev->next = job->next;
+   else
+      job_head = job->next;
+   if (job_tail == job)
+      job_tail = prev;
+}
+
+/* Run a job taken off the queue.  Called and returns with pool_lock held. */
+static void run_job(readpool_job_t *job)
+{
+   ssize_t result;
+
+   pthread_mutex_unlock(&pool_lock);
+   job->fn(job->arg);
+
+   if (!job->remaining) {
+      do {
+         result = write(completion_fds[1], &job->arg, sizeof(job->arg));
+      } while (result == -1 && errno == EINTR);
+      if (result != sizeof(job->arg))
+         err_printf("Could not report finished read job: %s\n", strerror(errno));
+      free(job);
+      pthread_mutex_lock(&pool_lock);
+      return;
+   }
+
+   pthread_mutex_lock(&pool_lock);
+   if (--*job->remaining == 0)
+      pthread_cond_broadcast(&done_cond);
+   if (job->allocated)
+      free(job);
+}
+
+/* Wait for *remaining to reach zero.  Called and returns with pool_lock held. */
+static void wait_for_jobs(int *remaining)
+{
+   readpool_job_t *job, *prev;
+
+   while (*remaining) {
+      /* Run queued jobs that someone is waiting on rather than sit idle.
+         Submitted jobs are left to the workers, since they may take long. */
+      for (prev = NULL, job = job_head; job && !job->remaining; prev = job, job = job->next);
+      if (job) {
+         unlink_job(job, prev);
+         run_job(job);
+         continue;
+      }
+      pthread_cond_wait(&done_cond, &pool_lock);
+   }
+}
+
+static void *readpool_worker(void *unused)
+{
+   readpool_job_t *job;
+
+   pthread_mutex_lock(&pool_lock);
+   for (;;) {
+      while (!job_head && !shutting_down)
+         pthread_cond_wait(&work_cond, &pool_lock);
+      if (!job_head)
+         break;
+      job = job_head;
+      unlink_job(job, NULL);
+      run_job(job);
+   }
+   pthread_mutex_unlock(&pool_lock);
+   return NULL;
+}
+
+/* Returns the number of reader threads running */
+static int start_workers()
+{
+   int result;
+
+   if (num_workers || shutting_down)
+      return num_workers;
+
+   while (num_workers < READPOOL_THREADS) {
+      result = pthread_create(workers + num_workers, NULL, readpool_worker, NULL);
+      if (result != 0) {
+         err_printf("Could not start reader thread: %s\n", strerror(result));
+         break;
+      }
+      num_workers++;
+   }
+   debug_printf2("Started %d reader threads\n", num_workers);
+   return num_workers;
+}
+
+void readpool_run(readpool_fn_t fn, void **args, int num_args)
+{
+   readpool_job_t *jobs;
+   int remaining = num_args, i;
+
+   if (num_args <= 1 || !start_workers()) {
+      for (i = 0; i < num_args; i++)
+         fn(args[i]);
+      return;
+   }
+
+   jobs = (readpool_job_t *) malloc(sizeof(readpool_job_t) * num_args);
+   assert(jobs);
+   for (i = 0; i < num_args; i++) {
+      jobs[i].fn = fn;
+      jobs[i].arg = args[i];
+      jobs[i].remaining = &remaining;
+      jobs[i].allocated = 0;
+      jobs[i].next = (i + 1 < num_args) ? jobs + i + 1 : NULL;
+   }
+
+   pthread_mutex_lock(&pool_lock);
+   if (job_tail)
+      job_tail->next = jobs;
+   else
+      job_head = jobs;
+   job_tail = jobs + num_args - 1;
+   pthread_cond_broadcast(&work_cond);
+   wait_for_jobs(&remaining);
+   pthread_mutex_unlock(&pool_lock);
+
+   free(jobs);
+}
+
+void readpool_start(readpool_fn_t fn, void *arg, int *pending)
+{
+   readpool_job_t *job;
+
+   job = start_workers() ? (readpool_job_t *) malloc(sizeof(readpool_job_t)) : NULL;
+   if (!job) {
+      fn(arg);
+      return;
+   }
+   job->fn = fn;
+   job->arg = arg;
+   job->remaining = pending;
+   job->allocated = 1;
+   job->next = NULL;
+
+   pthread_mutex_lock(&pool_lock);
+   (*pending)++;
+   if (job_tail)
+      job_tail->next = job;
+   else
+      job_head = job;
+   job_tail = job;
+   pthread_cond_signal(&work_cond);
+   pthread_mutex_unlock(&pool_lock);
+}
+
+void readpool_wait(int *pending)
+{
+   pthread_mutex_lock(&pool_lock);
+   wait_for_jobs(pending);
+   pthread_mutex_unlock(&pool_lock);
+}
+
+int readpool_completion_fd()
+{
+   if (completion_fds[0] != -1)
+      return completion_fds[0];
+   if (pipe(completion_fds) == -1) {
+      err_printf("Could not create read completion pipe: %s\n", strerror(errno));
+      completion_fds[0] = completion_fds[1] = -1;
+      return -1;
+   }
+   fcntl(completion_fds[0], F_SETFL, O_NONBLOCK);
+   fcntl(completion_fds[0], F_SETFD, FD_CLOEXEC);
+   fcntl(completion_fds[1], F_SETFD, FD_CLOEXEC);
+   return completion_fds[0];
+}
+
+int readpool_submit(readpool_fn_t fn, void *arg)
+{
+   readpool_job_t *job;
+
+   if (readpool_completion_fd() == -1 || !start_workers())
+      return -1;
+
+   job = (readpool_job_t *) malloc(sizeof(readpool_job_t));
+   if (!job) {
+      err_printf("Could not allocate read job\n");
+      return -1;
+   }
+   job->fn = fn;
+   job->arg = arg;
+   job->remaining = NULL;
+   job->allocated = 0;
+   job->next = NULL;
+
+   pthread_mutex_lock(&pool_lock);
+   if (job_tail)
+      job_tail->next = job;
+   else
+      job_head = job;
+   job_tail = job;
+   pthread_cond_signal(&work_cond);
+   pthread_mutex_unlock(&pool_lock);
+   return 0;
+}
+
+static void read_chunk(void *arg)
+{
+   read_chunk_t *chunk = (read_chunk_t *) arg;
+   size_t pos = 0, count;
+   ssize_t result;
+   int fd;
+
+   while (pos < chunk->len) {
+      fd = chunk->fd;
+      count = chunk->len - pos;
+      if (chunk->direct_fd != -1 && get_direct_io() &&
+          (((uintptr_t) (chunk->buffer + pos) | (chunk->offset + pos)) & (READPOOL_DIRECT_ALIGN-1)) == 0 &&
+          count >= READPOOL_DIRECT_ALIGN) {
+         fd = chunk->direct_fd;
+         count &= ~((size_t) READPOOL_DIRECT_ALIGN-1);
+      }
+
+      result = pread(fd, chunk->buffer + pos, count, chunk->offset + pos);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result == -1 && fd == chunk->direct_fd && errno == EINVAL) {
+         debug_printf("O_DIRECT read rejected, using buffered reads\n");
+         __atomic_store_n(&direct_io, 0, __ATOMIC_RELAXED);
+         continue;
+      }
+      if (result == -1) {
+         err_printf("Error reading %lu bytes at offset %lu: %s\n", (unsigned long) count,
+                    (unsigned long) (chunk->offset + pos), strerror(errno));
+         chunk->result = -1;
+         return;
+      }
+      if (result == 0)
+         break;
+      pos += result;
+   }
+   chunk->result = pos;
+}
+
+ssize_t readpool_read(int fd, int direct_fd, void *buffer, size_t offset, size_t len)
+{
+   read_chunk_t *chunks;
+   void **args;
+   int num_chunks, i;
+   ssize_t total = 0;
+   read_chunk_t single;
+
+   if (len <= READPOOL_CHUNK_SIZE) {
+      single.fd = fd;
+      single.direct_fd = direct_fd;
+      single.buffer = ((char *) buffer) + offset;
+      single.offset = offset;
+      single.len = len;
+      read_chunk(&single);
+      return single.result;
+   }
+
+   num_chunks = (len + READPOOL_CHUNK_SIZE - 1) / READPOOL_CHUNK_SIZE;
+   chunks = (read_chunk_t *) malloc(sizeof(read_chunk_t) * num_chunks);
+   args = (void **) malloc(sizeof(void *) * num_chunks);
+   assert(chunks && args);
+   for (i = 0; i < num_chunks; i++) {
+      chunks[i].fd = fd;
+      chunks[i].direct_fd = direct_fd;
+      chunks[i].offset = offset + (size_t) i * READPOOL_CHUNK_SIZE;
+      chunks[i].buffer = ((char *) buffer) + chunks[i].offset;
+      chunks[i].len = (i == num_chunks - 1) ? len - (size_t) i * READPOOL_CHUNK_SIZE : READPOOL_CHUNK_SIZE;
+      args[i] = chunks + i;
+   }
+
+   readpool_run(read_chunk, args, num_chunks);
+
+   /* The file ends at the first short chunk */
+   for (i = 0; i < num_chunks; i++) {
+      if (chunks[i].result == -1) {
+         total = -1;
+         break;
+      }
+      total += chunks[i].result;
+      if ((size_t) chunks[i].result < chunks[i].len)
+         break;
+   }
+
+   free(chunks);
+   free(args);
+   return total;
+}
+
+int readpool_open_direct(char *filename)
+{
+   if (!get_direct_io())
+      return -1;
+   return open(filename, O_RDONLY | O_DIRECT);
+}
+
+void readpool_shutdown()
+{
+   int i;
+   readpool_job_t *job, *prev, *next;
+
+   pthread_mutex_lock(&pool_lock);
+   shutting_down = 1;
+   /* Nobody will collect submitted jobs any more, so don't start them */
+   for (prev = NULL, job = job_head; job; job = next) {
+      next = job->next;
+      if (job->remaining) {
+         prev = job;
+         continue;
+      }
+      unlink_job(job, prev);
+      free(job);
+   }
+   pthread_cond_broadcast(&work_cond);
+   pthread_mutex_unlock(&pool_lock);
+
+   for (i = 0; i < num_workers; i++)
+      pthread_join(workers[i], NULL);
+   num_workers = 0;
+}
@@ -0,0 +1,73 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_READPOOL_H_)
+#define LDCS_AUDIT_SERVER_READPOOL_H_
+
+#include <sys/types.h>
+
+typedef void (*readpool_fn_t)(void *arg);
+
+/**
+ * Call fn on each of the num_args args on the reader threads, and return
+ * once every call has finished.  The caller runs queued calls while it
+ * waits, so a job may itself use the pool.
+ **/
+void readpool_run(readpool_fn_t fn, void **args, int num_args);
+
+/**
+ * Queue fn(arg) to run on a reader thread and return at once, adding one
+ * to *pending.  The thread subtracts one when the call finishes, and
+ * readpool_wait(pending) returns once *pending is back to zero.  Runs
+ * fn(arg) before returning if there are no reader threads.
+ **/
+void readpool_start(readpool_fn_t fn, void *arg, int *pending);
+void readpool_wait(int *pending);
+
+/**
+ * Queue fn(arg) to run on a reader thread and return at once.  When the
+ * call finishes, arg is written as a pointer to the pipe returned by
+ * readpool_completion_fd.  Returns -1 if the job couldn't be queued.
+ **/
+int readpool_submit(readpool_fn_t fn, void *arg);
+
+/**
+ * The read end of the pipe that finished readpool_submit jobs are
+ * reported on, or -1 if it can't be created.  It's non-blocking.
+ **/
+int readpool_completion_fd();
+
+/**
+ * Read len bytes of the file at offset into buffer + offset, with several
+ * large reads in flight.  direct_fd is an O_DIRECT fd for the same file
+ * from readpool_open_direct, or -1.  Returns the number of bytes read,
+ * which is short at end of file, or -1 on error.
+ **/
+ssize_t readpool_read(int fd, int direct_fd, void *buffer, size_t offset, size_t len);
+
+/**
+ * Open filename with O_DIRECT if SPINDLE_DIRECT_IO is set and the file
+ * system allows it.  Returns -1 otherwise.
+ **/
+int readpool_open_direct(char *filename);
+
+/**
+ * Stop the reader threads.
+ **/
+void readpool_shutdown();
+
+#endif
@@ -0,0 +1,475 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_report.h"
+#include "ldcs_audit_server_latency.h"
+#include "spindle_debug.h"
+
+#define REPORT_HOSTNAME_LEN 64
+#define REPORT_SLOWEST 10
+
+typedef struct {
+   const char *name;
+   size_t offset;
+} report_counter_t;
+
+#define COUNTER(NAME) { #NAME, offsetof(ldcs_server_stat_t, NAME) }
+static const report_counter_t counters[] = {
+   COUNTER(libread), COUNTER(libstore), COUNTER(libdist), COUNTER(libdist_raw),
+   COUNTER(procdir), COUNTER(distdir), COUNTER(client_cb), COUNTER(server_cb),
+   COUNTER(md_cb), COUNTER(clientmsg), COUNTER(bcast), COUNTER(preload),
+   COUNTER(prefetch), COUNTER(cacheindex), COUNTER(evict), COUNTER(dedup),
+   COUNTER(lazy), COUNTER(pushdeps), COUNTER(predict), COUNTER(pycompile),
+   COUNTER(dirlist), COUNTER(resolve), COUNTER(localfs), COUNTER(numa),
+   COUNTER(stripe), COUNTER(verify), COUNTER(verify_bad), COUNTER(revalidate),
+   COUNTER(invalidate), COUNTER(dirfilter_hit), COUNTER(dirfilter_miss), COUNTER(sendq),
+   COUNTER(sendq_jump), COUNTER(throttle), COUNTER(promote), COUNTER(lateral),
+   COUNTER(delegated), COUNTER(bypass), COUNTER(aggregate), COUNTER(coalesce),
+   COUNTER(clientpool), COUNTER(fairq), COUNTER(delta), COUNTER(rackcache), COUNTER(sparse), COUNTER(lazypush), COUNTER(statahead), COUNTER(namesnap), COUNTER(linktune), COUNTER(cache_hit), COUNTER(cache_miss), COUNTER(shmcache_hit),
+   COUNTER(shmcache_wait), COUNTER(fs_open), COUNTER(fs_stat), COUNTER(fs_readdir),
+   COUNTER(fs_read), COUNTER(client_open), COUNTER(client_stat), COUNTER(client_objsearch),
+   COUNTER(client_wait), COUNTER(execsearch), COUNTER(execsearch_hit), COUNTER(jit_publish),
+   COUNTER(jit_wait), COUNTER(jit_timeout), COUNTER(unmap), COUNTER(client_fallback)
+};
+#define NUM_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+/**
+ * Records are sent as they are, as the servers in a job all run the
+ * same build.
+ **/
+typedef struct {
+   int rank;
+   int depth;
+   double uptime;     /* from the first connection until the record was packed */
+   double busy;       /* time spent in client, server and md callbacks */
+   ldcs_server_stat_entry_t entries[NUM_COUNTERS];
+   char hostname[REPORT_HOSTNAME_LEN];
+} report_record_t;
+
+/* Our subtree's records, indexed by rank */
+static report_record_t **records = NULL;
+static int num_ranks = 0;
+
+static void report_fill(ldcs_server_stat_t *stat, report_record_t *rec)
+{
+   unsigned int i;
+
+   memset(rec, 0, sizeof(*rec));
+   rec->rank = stat->md_rank;
+   rec->depth = 0;
+   rec->uptime = stat->starttime < 0 ? 0.0 : ldcs_get_time() - stat->starttime;
+   rec->busy = stat->client_cb.time + stat->server_cb.time + stat->md_cb.time;
+   for (i = 0; i < NUM_COUNTERS; i++)
+      rec->entries[i] = *(ldcs_server_stat_entry_t *) (((char *) stat) + counters[i].offset);
+   if (stat->hostname)
+      strncpy(rec->hostname, stat->hostname, REPORT_HOSTNAME_LEN-1);
+}
+
+static int report_count()
+{
+   int i, n = 0;
+   for (i = 0; i < num_ranks; i++) {
+      if (records[i])
+         n++;
+   }
+   return n;
+}
+
+int report_pack(ldcs_server_stat_t *stat, char **data, size_t *size)
+{
+   report_record_t *recs;
+   char *buffer;
+   int i, n;
+
+   n = report_count() + 1;
+   *size = sizeof(int) + n * sizeof(report_record_t) + latency_pack_size();
+   buffer = (char *) malloc(*size);
+   if (!buffer) {
+      err_printf("Could not allocate %d statistics records\n", n);
+      return -1;
+   }
+   memcpy(buffer, &n, sizeof(int));
+   recs = (report_record_t *) (buffer + sizeof(int));
+   report_fill(stat, recs);
+   for (i = 0, n = 1; i < num_ranks; i++) {
+      if (records[i])
+         recs[n++] = *records[i];
+   }
+   latency_pack(buffer + sizeof(int) + n * sizeof(report_record_t));
+
+   *data = buffer;
+   debug_printf2("Packed %d statistics records\n", n);
+   return 0;
+}
+
+int report_merge(ldcs_server_stat_t *stat, int child, char *data, size_t size)
+{
+   report_record_t rec;
+   size_t pos, records_end;
+   int n;
+
+   if (size < sizeof(int))
+      goto malformed;
+   memcpy(&n, data, sizeof(int));
+   records_end = sizeof(int) + n * sizeof(report_record_t);
+   if (n < 0 || records_end > size)
+      goto malformed;
+   if (!records) {
+      num_ranks = stat->md_size;
+      records = (report_record_t **) calloc(num_ranks ? num_ranks : 1, sizeof(report_record_t *));
+   }
+
+   for (pos = sizeof(int); pos < records_end; pos += sizeof(report_record_t)) {
+      memcpy(&rec, data + pos, sizeof(rec));
+      if (rec.rank < 0 || rec.rank >= num_ranks || rec.rank == stat->md_rank) {
+         err_printf("Statistics report from child has a record for bad rank %d\n", rec.rank);
+         continue;
+      }
+      rec.depth++;
+      rec.hostname[REPORT_HOSTNAME_LEN-1] = '\0';
+      if (!records[rec.rank])
+         records[rec.rank] = (report_record_t *) malloc(sizeof(report_record_t));
+      *records[rec.rank] = rec;
+   }
+   return latency_merge(child, stat->md_fan_out, data + records_end, size - records_end);
+
+  malformed:
+   err_printf("Malformed statistics report of %lu bytes from child\n", (unsigned long) size);
+   return -1;
+}
+
+static int by_time(const void *a, const void *b)
+{
+   double x = *(const double *) a, y = *(const double *) b;
+   return (x > y) - (x < y);
+}
+
+static int by_busy(const void *a, const void *b)
+{
+   double x = (*(report_record_t * const *) a)->busy;
+   double y = (*(report_record_t * const *) b)->busy;
+   return (x < y) - (x > y);
+}
+
+static double percentile(double *sorted, int n, double p)
+{
+   return sorted[(int) (p * (n - 1) + 0.5)];
+}
+
+/**
+ * Spread of one counter's time across the servers, and its totals
+ **/
+typedef struct {
+   long cnt;
+   double mbytes;
+   double min, mean, p50, p90, p99, max;
+   report_record_t *slowest;
+} report_spread_t;
+
+static void report_spread(report_record_t **all, int n, unsigned int c, double *times,
+                          report_spread_t *s)
+{
+   int i;
+   double sum = 0.0;
+
+   memset(s, 0, sizeof(*s));
+   s->slowest = all[0];
+   for (i = 0; i < n; i++) {
+      ldcs_server_stat_entry_t *e = all[i]->entries + c;
+      s->cnt += e->cnt;
+      s->mbytes += e->bytes / 1024.0 / 1024.0;
+      times[i] = e->time;
+      sum += e->time;
+      if (e->time > s->slowest->entries[c].time)
+         s->slowest = all[i];
+   }
+   qsort(times, n, sizeof(double), by_time);
+   s->min = times[0];
+   s->mean = sum / n;
+   s->p50 = percentile(times, n, 0.50);
+   s->p90 = percentile(times, n, 0.90);
+   s->p99 = percentile(times, n, 0.99);
+   s->max = times[n-1];
+}
+
+/**
+ * Broadcast and distribution costs of the servers at one level
+ **/
+typedef struct {
+   int servers;
+   long bcast_cnt;
+   double bcast_sum, bcast_max;
+   double libdist_mbytes, libdist_max;
+   double busy_max;
+} report_level_t;
+
+static unsigned int counter_index(const char *name)
+{
+   unsigned int i;
+   for (i = 0; i < NUM_COUNTERS; i++) {
+      if (strcmp(counters[i].name, name) == 0)
+         break;
+   }
+   return i;
+}
+
+static report_level_t *report_levels(report_record_t **all, int n, int *num_levels)
+{
+   unsigned int bcast = counter_index("bcast"), libdist = counter_index("libdist");
+   report_level_t *levels, *l;
+   int i;
+
+   *num_levels = 0;
+   for (i = 0; i < n; i++) {
+      if (all[i]->depth + 1 > *num_levels)
+         *num_levels = all[i]->depth + 1;
+   }
+   levels = (report_level_t *) calloc(*num_levels, sizeof(report_level_t));
+   for (i = 0; i < n; i++) {
+      l = levels + all[i]->depth;
+      l->servers++;
+      l->bcast_cnt += all[i]->entries[bcast].cnt;
+      l->bcast_sum += all[i]->entries[bcast].time;
+      if (all[i]->entries[bcast].time > l->bcast_max)
+         l->bcast_max = all[i]->entries[bcast].time;
+      l->libdist_mbytes += all[i]->entries[libdist].bytes / 1024.0 / 1024.0;
+      if (all[i]->entries[libdist].time > l->libdist_max)
+         l->libdist_max = all[i]->entries[libdist].time;
+      if (all[i]->busy > l->busy_max)
+         l->busy_max = all[i]->busy;
+   }
+   return levels;
+}
+
+/**
+ * The load we put on the shared file system, against the load the client
+ * queries we and the client cache answered would have put on it without
+ * us: at least one operation each, and every node reading what was staged
+ * on it.
+ **/
+typedef struct {
+   long meta_ops;       /* opens, stats and directory listings */
+   long data_reads;
+   double read_mbytes;
+   long queries;
+   double staged_mbytes;
+   int readers;         /* servers that touched the file system */
+} report_fsload_t;
+
+static void report_fsload(report_record_t **all, int n, report_fsload_t *load)
+{
+   unsigned int fs_open = counter_index("fs_open"), fs_stat = counter_index("fs_stat");
+   unsigned int fs_readdir = counter_index("fs_readdir"), fs_read = counter_index("fs_read");
+   unsigned int clientmsg = counter_index("clientmsg"), libstore = counter_index("libstore");
+   unsigned int shmcache_hit = counter_index("shmcache_hit"), shmcache_wait = counter_index("shmcache_wait");
+   ldcs_server_stat_entry_t *e;
+   long ops;
+   int i;
+
+   memset(load, 0, sizeof(*load));
+   for (i = 0; i < n; i++) {
+      e = all[i]->entries;
+      ops = e[fs_open].cnt + e[fs_stat].cnt + e[fs_readdir].cnt;
+      load->meta_ops += ops;
+      load->data_reads += e[fs_read].cnt;
+      load->read_mbytes += e[fs_read].bytes / 1024.0 / 1024.0;
+      load->queries += e[clientmsg].cnt + e[shmcache_hit].cnt + e[shmcache_wait].cnt;
+      load->staged_mbytes += e[libstore].bytes / 1024.0 / 1024.0;
+      if (ops + e[fs_read].cnt)
+         load->readers++;
+   }
+}
+
+static double fsload_amplification(report_fsload_t *load)
+{
+   long ops = load->meta_ops + load->data_reads;
+   return ops ? (double) load->queries / ops : 0.0;
+}
+
+static void report_write_text(FILE *f, report_record_t **all, int n, report_level_t *levels,
+                              int num_levels, double *times)
+{
+   report_spread_t s;
+   latency_summary_t l;
+   report_fsload_t load;
+   unsigned int c;
+   int i;
+
+   fprintf(f, "Spindle server statistics: %d servers, %d tree levels\n\n", n, num_levels);
+
+   report_fsload(all, n, &load);
+   fprintf(f, "Shared file system load, from %d of the servers\n", load.readers);
+   fprintf(f, "  %-28s %12ld\n", "metadata operations", load.meta_ops);
+   fprintf(f, "  %-28s %12ld %10.2f MB\n", "data reads", load.data_reads, load.read_mbytes);
+   fprintf(f, "  %-28s %12ld\n", "client queries satisfied", load.queries);
+   fprintf(f, "  %-28s %12.2f\n", "queries per operation", fsload_amplification(&load));
+   fprintf(f, "  %-28s %12ld\n", "operations avoided",
+           load.queries > load.meta_ops + load.data_reads ? load.queries - load.meta_ops - load.data_reads : 0);
+   fprintf(f, "  %-28s %12.2f MB\n\n", "reads avoided",
+           load.staged_mbytes > load.read_mbytes ? load.staged_mbytes - load.read_mbytes : 0.0);
+
+   fprintf(f, "%-14s %10s %10s %9s %9s %9s %9s %9s %9s  %s\n", "counter", "count", "MB",
+           "min s", "mean s", "p50 s", "p90 s", "p99 s", "max s", "slowest");
+   for (c = 0; c < NUM_COUNTERS; c++) {
+      report_spread(all, n, c, times, &s);
+      if (!s.cnt && s.max == 0.0)
+         continue;
+      fprintf(f, "%-14s %10ld %10.2f %9.4f %9.4f %9.4f %9.4f %9.4f %9.4f  %s[%d]\n",
+              counters[c].name, s.cnt, s.mbytes, s.min, s.mean, s.p50, s.p90, s.p99, s.max,
+              s.slowest->hostname, s.slowest->rank);
+   }
+
+   fprintf(f, "\nBroadcasts by tree level\n");
+   fprintf(f, "%-6s %8s %10s %12s %12s %12s %14s %10s\n", "level", "servers", "bcasts",
+           "bcast mean s", "bcast max s", "libdist MB", "libdist max s", "busy max s");
+   for (i = 0; i < num_levels; i++) {
+      if (!levels[i].servers)
+         continue;
+      fprintf(f, "%-6d %8d %10ld %12.4f %12.4f %12.2f %14.4f %10.4f\n", i, levels[i].servers,
+              levels[i].bcast_cnt, levels[i].bcast_sum / levels[i].servers, levels[i].bcast_max,
+              levels[i].libdist_mbytes, levels[i].libdist_max, levels[i].busy_max);
+   }
+
+   fprintf(f, "\nLatencies across the tree\n");
+   fprintf(f, "%-14s %10s %9s %9s %9s %9s %9s\n", "latency", "count", "mean s", "p50 s",
+           "p90 s", "p99 s", "max s");
+   for (i = 0; i < LATENCY_NUM; i++) {
+      latency_summary((latency_id_t) i, 1, &l);
+      if (!l.count)
+         continue;
+      fprintf(f, "%-14s %10lu %9.4f %9.4f %9.4f %9.4f %9.4f\n", latency_name((latency_id_t) i),
+              (unsigned long) l.count, l.mean, l.p50, l.p90, l.p99, l.max);
+   }
+
+   fprintf(f, "\nSlowest servers, by time spent handling messages\n");
+   fprintf(f, "%-8s %-24s %6s %10s %10s %10s %10s\n", "rank", "host", "level", "busy s",
+           "uptime s", "libread s", "bcast s");
+   for (i = 0; i < n && i < REPORT_SLOWEST; i++) {
+      fprintf(f, "%-8d %-24s %6d %10.4f %10.4f %10.4f %10.4f\n", all[i]->rank, all[i]->hostname,
+              all[i]->depth, all[i]->busy, all[i]->uptime,
+              all[i]->entries[counter_index("libread")].time,
+              all[i]->entries[counter_index("bcast")].time);
+   }
+}
+
+static void report_write_json(FILE *f, report_record_t **all, int n, report_level_t *levels,
+                              int num_levels, double *times)
+{
+   report_spread_t s;
+   latency_summary_t l;
+   report_fsload_t load;
+   unsigned int c;
+   int i;
+   const char *sep;
+
+   report_fsload(all, n, &load);
+   fprintf(f, "{\n  \"servers\": %d,\n  \"levels\": %d,\n", n, num_levels);
+   fprintf(f, "  \"fs_load\": {\"readers\": %d, \"meta_ops\": %ld, \"data_reads\": %ld, "
+           "\"read_mbytes\": %.2f, \"queries\": %ld, \"staged_mbytes\": %.2f, "
+           "\"queries_per_op\": %.2f},\n",
+           load.readers, load.meta_ops, load.data_reads, load.read_mbytes, load.queries,
+           load.staged_mbytes, fsload_amplification(&load));
+   fprintf(f, "  \"counters\": {");
+   for (c = 0, sep = "\n"; c < NUM_COUNTERS; c++, sep = ",\n") {
+      report_spread(all, n, c, times, &s);
+      fprintf(f, "%s    \"%s\": {\"count\": %ld, \"mbytes\": %.2f, \"min\": %.6f, \"mean\": %.6f, "
+              "\"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f, "
+              "\"slowest\": {\"rank\": %d, \"host\": \"%s\"}}",
+              sep, counters[c].name, s.cnt, s.mbytes, s.min, s.mean, s.p50, s.p90, s.p99, s.max,
+              s.slowest->rank, s.slowest->hostname);
+   }
+
+   fprintf(f, "\n  },\n  \"tree_levels\": [");
+   for (i = 0, sep = "\n"; i < num_levels; i++, sep = ",\n") {
+      fprintf(f, "%s    {\"level\": %d, \"servers\": %d, \"bcasts\": %ld, \"bcast_mean\": %.6f, "
+              "\"bcast_max\": %.6f, \"libdist_mbytes\": %.2f, \"libdist_max\": %.6f, \"busy_max\": %.6f}",
+              sep, i, levels[i].servers, levels[i].bcast_cnt,
+              levels[i].servers ? levels[i].bcast_sum / levels[i].servers : 0.0, levels[i].bcast_max,
+              levels[i].libdist_mbytes, levels[i].libdist_max, levels[i].busy_max);
+   }
+
+   fprintf(f, "\n  ],\n  \"latencies\": {");
+   for (i = 0, sep = "\n"; i < LATENCY_NUM; i++, sep = ",\n") {
+      latency_summary((latency_id_t) i, 1, &l);
+      fprintf(f, "%s    \"%s\": {\"count\": %lu, \"mean\": %.6f, \"p50\": %.6f, \"p90\": %.6f, "
+              "\"p99\": %.6f, \"max\": %.6f}", sep, latency_name((latency_id_t) i),
+              (unsigned long) l.count, l.mean, l.p50, l.p90, l.p99, l.max);
+   }
+
+   fprintf(f, "\n  },\n  \"slowest\": [");
+   for (i = 0, sep = "\n"; i < n && i < REPORT_SLOWEST; i++, sep = ",\n") {
+      fprintf(f, "%s    {\"rank\": %d, \"host\": \"%s\", \"level\": %d, \"busy\": %.6f, \"uptime\": %.6f}",
+              sep, all[i]->rank, all[i]->hostname, all[i]->depth, all[i]->busy, all[i]->uptime);
+   }
+   fprintf(f, "\n  ]\n}\n");
+}
+
+int report_write(ldcs_server_stat_t *stat, const char *filename)
+{
+   char tmpname[MAX_PATH_LEN+1];
+   report_record_t self, **all;
+   report_level_t *levels;
+   double *times;
+   size_t len;
+   int i, n, num_levels, result;
+   FILE *f;
+
+   snprintf(tmpname, sizeof(tmpname), "%s.%d", filename, getpid());
+   f = fopen(tmpname, "w");
+   if (!f) {
+      err_printf("Could not create statistics report %s: %s\n", tmpname, strerror(errno));
+      return -1;
+   }
+
+   report_fill(stat, &self);
+   all = (report_record_t **) malloc((report_count() + 1) * sizeof(report_record_t *));
+   times = (double *) malloc((report_count() + 1) * sizeof(double));
+   all[0] = &self;
+   for (i = 0, n = 1; i < num_ranks; i++) {
+      if (records[i])
+         all[n++] = records[i];
+   }
+   qsort(all, n, sizeof(report_record_t *), by_busy);
+   levels = report_levels(all, n, &num_levels);
+
+   len = strlen(filename);
+   if (len > 5 && strcmp(filename + len - 5, ".json") == 0)
+      report_write_json(f, all, n, levels, num_levels, times);
+   else
+      report_write_text(f, all, n, levels, num_levels, times);
+   free(levels);
+   free(times);
+   free(all);
+
+   result = fclose(f);
+   if (result == 0)
+      result = rename(tmpname, filename);
+   if (result == -1) {
+      err_printf("Could not write statistics report %s: %s\n", filename, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+   debug_printf("Wrote statistics of %d servers to %s\n", n, filename);
+   return 0;
+}
@@ -0,0 +1,50 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_REPORT_H_)
+#define LDCS_AUDIT_SERVER_REPORT_H_
+
+#include <stddef.h>
+#include "ldcs_audit_server_process.h"
+
+/**
+ * With --stats-report, each server packs its statistics into a record once
+ * it's ready to exit, and sends its parent that record and the ones its
+ * children sent in a LDCS_MSG_STATS_REPORT, ahead of its exit ready.  The
+ * root writes everyone's out as a report: how each counter spread across
+ * the servers, what broadcasts cost at each level of the tree, and which
+ * servers were slowest.  Each server's latency histograms go up with its
+ * records, summed over its subtree, and the report gives their
+ * percentiles across the whole tree.
+ *
+ * A record's depth counts the levels below the server that packed it, so
+ * a parent adds one to the depth of each record it merges.  A child that
+ * cancels its exit ready and sends again replaces its earlier records.
+ *
+ * A packed report is [int num records][records][latency histograms]
+ **/
+
+/* Pack our record and our subtree's into *data, which the caller frees */
+int report_pack(ldcs_server_stat_t *stat, char **data, size_t *size);
+
+/* Merge in records our child'th child server packed */
+int report_merge(ldcs_server_stat_t *stat, int child, char *data, size_t size);
+
+/* Write the report to filename, as JSON if its name ends in .json */
+int report_write(ldcs_server_stat_t *stat, const char *filename);
+
+#endif
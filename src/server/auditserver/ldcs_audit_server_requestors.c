@@ -17,68 +17,116 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdlib.h>
 #include <string.h>
 #include "ldcs_audit_server_requestors.h"
+#include "name_intern.h"
+
+/**
+ * Tracks which peers have asked for, or been sent, each file.  Entries are
+ * keyed by interned path in a table that doubles as it fills, so lookups
+ * stay a pointer compare on a short chain however many files a session
+ * stages.  The local client and the all-children broadcast are the most
+ * common requestors and are kept as flag bits, so checking or adding them
+ * never scans.  Other peers are opaque connection handles, which may be the
+ * parent or a sibling as well as a child, and go in a small array.
+ **/
+
+#define REQ_CLIENT (1 << 0)
+#define REQ_ALL    (1 << 1)
 
 struct requested_file_struct
 {
-   char *path;
-   int hash_val;
+   const char *path;
+   unsigned int flags;
    int requestors_num;
    int requestors_size;
    node_peer_t *requestors;
    struct requested_file_struct *next;
-   struct requested_file_struct *prev;
 };
 typedef struct requested_file_struct requested_file_t;
 
+typedef struct {
+   requested_file_t **table;
+   size_t table_size;
+   size_t count;
+} requestor_table_t;
 
-
-#define INITIAL_PEER_SIZE 8
-#define REQUESTORS_TABLE_SIZE 1024
+#define INITIAL_PEER_SIZE 4
+#define INITIAL_REQUESTORS_TABLE_SIZE 1024
 
 requestor_list_t new_requestor_list()
 {
-   return (requestor_list_t) calloc(REQUESTORS_TABLE_SIZE, sizeof(requested_file_t *));
+   requestor_table_t *list = (requestor_table_t *) malloc(sizeof(requestor_table_t));
+   list->table_size = INITIAL_REQUESTORS_TABLE_SIZE;
+   list->count = 0;
+   list->table = (requested_file_t **) calloc(list->table_size, sizeof(requested_file_t *));
+   return (requestor_list_t) list;
+}
+
+static size_t bucket(requestor_table_t *list, const char *interned)
+{
+   return intern_name_hash(interned) & (list->table_size - 1);
 }
 
-static unsigned int hashval(char *str) 
+static void grow_requestor_list(requestor_table_t *list)
 {
-   unsigned int hash = 5381;
-   unsigned int c;
-   while ((c = *str++))
-      hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-   return hash % REQUESTORS_TABLE_SIZE;
+   requested_file_t **old_table = list->table, *cur, *next;
+   size_t i, old_size = list->table_size;
+
+   list->table_size *= 2;
+   list->table = (requested_file_t **) calloc(list->table_size, sizeof(requested_file_t *));
+   for (i = 0; i < old_size; i++) {
+      for (cur = old_table[i]; cur != NULL; cur = next) {
+         next = cur->next;
+         cur->next = list->table[bucket(list, cur->path)];
+         list->table[bucket(list, cur->path)] = cur;
+      }
+   }
+   free(old_table);
 }
 
-static requested_file_t *get_requestor(requestor_list_t list, char *file, int add)
+static requested_file_t *get_requestor(requestor_list_t l, char *file, int add)
 {
-   unsigned int val;
+   requestor_table_t *list = (requestor_table_t *) l;
    requested_file_t *cur;
-   requested_file_t **table = (requested_file_t **) list;
-   
-   val = hashval(file);
-   for (cur = table[val]; cur != NULL; cur = cur->next) {
-      if (cur->hash_val != val || strcmp(cur->path, file) != 0) 
-         continue;
-      return cur;
+   const char *ifile;
+   size_t val;
+
+   ifile = add ? intern_name(file) : lookup_intern_name(file);
+   if (!ifile)
+      return NULL;
+   val = bucket(list, ifile);
+   for (cur = list->table[val]; cur != NULL; cur = cur->next) {
+      if (cur->path == ifile)
+         return cur;
    }
    if (!add)
       return NULL;
 
+   if (list->count >= list->table_size * 2) {
+      grow_requestor_list(list);
+      val = bucket(list, ifile);
+   }
+
    cur = (requested_file_t *) malloc(sizeof(requested_file_t));
-   cur->path = strdup(file);
-   cur->hash_val = val;
+   cur->path = ifile;
+   cur->flags = 0;
    cur->requestors_num = 0;
-   cur->requestors_size = INITIAL_PEER_SIZE;
-   cur->requestors = (node_peer_t *) malloc(sizeof(node_peer_t) * INITIAL_PEER_SIZE);
-   if (table[val])
-      table[val]->prev = cur;
-   cur->next = table[val];
-   cur->prev = NULL;
-   
-   table[val] = cur;
+   cur->requestors_size = 0;
+   cur->requestors = NULL;
+   cur->next = list->table[val];
+   list->table[val] = cur;
+   list->count++;
    return cur;
 }
 
+static unsigned int peer_flag(node_peer_t peer)
+{
+   if (peer == NODE_PEER_CLIENT)
+      return REQ_CLIENT;
+   if (peer == NODE_PEER_ALL)
+      return REQ_ALL;
+   return 0;
+}
+
 int been_requested(requestor_list_t list, char *file)
 {
    return (get_requestor(list, file, 0) != NULL);
@@ -87,21 +135,28 @@ int been_requested(requestor_list_t list, char *file)
 void add_requestor(requestor_list_t list, char *file, node_peer_t peer)
 {
    requested_file_t *cur = get_requestor(list, file, 1);
+   unsigned int flag = peer_flag(peer);
    int i;
 
+   if (flag) {
+      cur->flags |= flag;
+      return;
+   }
+
    for (i = 0; i < cur->requestors_num; i++) {
       if (cur->requestors[i] == peer)
          return;
    }
 
    if (cur->requestors_num == cur->requestors_size) {
-      cur->requestors_size *= 2;
+      cur->requestors_size = cur->requestors_size ? cur->requestors_size * 2 : INITIAL_PEER_SIZE;
       cur->requestors = realloc(cur->requestors, sizeof(node_peer_t) * cur->requestors_size);
    }
    cur->requestors[cur->requestors_num] = peer;
    cur->requestors_num++;
 }
 
+/* Only peers other than NODE_PEER_CLIENT and NODE_PEER_ALL are listed */
 int get_requestors(requestor_list_t list, char *file, node_peer_t **requestor_list, int *requestor_list_size)
 {
    requested_file_t *req;
@@ -113,33 +168,45 @@ int get_requestors(requestor_list_t list, char *file, node_peer_t **requestor_li
    return 0;
 }
 
-void clear_requestor(requestor_list_t list, char *file)
+void clear_requestor(requestor_list_t l, char *file)
 {
-   requested_file_t **table = (requested_file_t **) list;
-   requested_file_t *cur = get_requestor(list, file, 0);
-   if (!cur) return;
-
-   if (cur->prev)
-      cur->prev->next = cur->next;
-   if (cur->next)
-      cur->next->prev = cur->prev;
-   if (table[cur->hash_val] == cur)
-      table[cur->hash_val] = cur->next;
-
-   free(cur->path);
-   free(cur->requestors);
-   free(cur);
+   requestor_table_t *list = (requestor_table_t *) l;
+   requested_file_t **prev, *cur;
+   const char *ifile;
+
+   ifile = lookup_intern_name(file);
+   if (!ifile)
+      return;
+   for (prev = list->table + bucket(list, ifile); *prev != NULL; prev = &(*prev)->next) {
+      cur = *prev;
+      if (cur->path != ifile)
+         continue;
+      *prev = cur->next;
+      list->count--;
+      free(cur->requestors);
+      free(cur);
+      return;
+   }
 }
 
 int peer_requested(requestor_list_t list, char *file, node_peer_t peer)
 {
    int i;
+   unsigned int flag;
    requested_file_t *cur = get_requestor(list, file, 0);
    if (!cur)
       return 0;
+   flag = peer_flag(peer);
+   if (flag)
+      return (cur->flags & flag) != 0;
    for (i = 0; i < cur->requestors_num; i++) {
       if (cur->requestors[i] == peer)
          return 1;
    }
    return 0;
 }
+
+int count_requested(requestor_list_t list)
+{
+   return (int) ((requestor_table_t *) list)->count;
+}
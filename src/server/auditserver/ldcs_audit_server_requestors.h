@@ -26,5 +26,6 @@ void add_requestor(requestor_list_t list, char *file, node_peer_t peer);
 void clear_requestor(requestor_list_t list, char *file);
 int get_requestors(requestor_list_t list, char *file, node_peer_t **requestor_list, int *requestor_list_size);
 int peer_requested(requestor_list_t list, char *file, node_peer_t peer);
+int count_requested(requestor_list_t list);
 
 #endif
@@ -0,0 +1,353 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "ldcs_api.h"
+#include "ldcs_cache.h"
+#include "ldcs_audit_server_revalidate.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "ldcs_audit_server_readpool.h"
+#include "name_intern.h"
+#include "spindle_debug.h"
+
+/**
+ * Entries are kept by their interned pathnames, so a bucket is searched
+ * by comparing pointers.  A check splits the entries into batches for the
+ * reader threads, which only stat them and fill in each entry's result.
+ * Everything else, including rescanning a directory that changed, is done
+ * back on the server loop.
+ **/
+
+#define REVALIDATE_TABLE_SIZE 4096
+#define REVALIDATE_BATCH 256
+
+typedef struct {
+   uint64_t dev;
+   uint64_t ino;
+   int64_t size;
+   int64_t mtime_sec;
+   int64_t mtime_nsec;
+   int64_t ctime_sec;
+   int64_t ctime_nsec;
+} file_identity_t;
+
+typedef enum {
+   ident_same,
+   ident_changed,
+   ident_gone
+} ident_result_t;
+
+typedef struct revalidate_entry_t {
+   const char *pathname;
+   int is_dir;
+   file_identity_t id;
+   file_identity_t newid;
+   ident_result_t result;
+   struct revalidate_entry_t *next;
+} revalidate_entry_t;
+
+typedef struct {
+   revalidate_entry_t **entries;
+   int count;
+} revalidate_batch_t;
+
+typedef struct {
+   char *buffer;
+   size_t size;
+   size_t used;
+   int num_records;
+} record_writer_t;
+
+typedef struct {
+   const char *dir;
+   const char **names;
+   size_t count;
+   record_writer_t *w;
+} removed_names_t;
+
+static revalidate_entry_t *revalidate_table[REVALIDATE_TABLE_SIZE];
+static int num_entries = 0;
+
+/**
+ * statx lets us ask for just the fields we compare, which some network
+ * file systems can answer without fetching the rest.
+ **/
+static int get_identity(const char *pathname, file_identity_t *id)
+{
+#if defined(STATX_BASIC_STATS)
+   struct statx stx;
+
+   filemngt_count_fsop(FSOP_STAT, 0);
+   if (statx(AT_FDCWD, pathname, 0, STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME, &stx) == -1)
+      return -1;
+   id->dev = ((uint64_t) stx.stx_dev_major << 32) | stx.stx_dev_minor;
+   id->ino = stx.stx_ino;
+   id->size = stx.stx_size;
+   id->mtime_sec = stx.stx_mtime.tv_sec;
+   id->mtime_nsec = stx.stx_mtime.tv_nsec;
+   id->ctime_sec = stx.stx_ctime.tv_sec;
+   id->ctime_nsec = stx.stx_ctime.tv_nsec;
+#else
+   struct stat st;
+
+   filemngt_count_fsop(FSOP_STAT, 0);
+   if (stat(pathname, &st) == -1)
+      return -1;
+   id->dev = st.st_dev;
+   id->ino = st.st_ino;
+   id->size = st.st_size;
+   id->mtime_sec = st.st_mtim.tv_sec;
+   id->mtime_nsec = st.st_mtim.tv_nsec;
+   id->ctime_sec = st.st_ctim.tv_sec;
+   id->ctime_nsec = st.st_ctim.tv_nsec;
+#endif
+   return 0;
+}
+
+/* A directory's size isn't meaningful on every file system, so it's left out */
+static int same_identity(file_identity_t *a, file_identity_t *b, int is_dir)
+{
+   return a->dev == b->dev && a->ino == b->ino &&
+      a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+      a->ctime_sec == b->ctime_sec && a->ctime_nsec == b->ctime_nsec &&
+      (is_dir || a->size == b->size);
+}
+
+void revalidate_track(const char *pathname, int is_dir)
+{
+   revalidate_entry_t *e;
+   file_identity_t id;
+   const char *name;
+   unsigned int bucket;
+
+   if (get_identity(pathname, &id) == -1)
+      return;
+
+   name = intern_name(pathname);
+   bucket = intern_name_hash(name) % REVALIDATE_TABLE_SIZE;
+   for (e = revalidate_table[bucket]; e; e = e->next) {
+      if (e->pathname == name)
+         break;
+   }
+   if (!e) {
+      e = (revalidate_entry_t *) calloc(1, sizeof(revalidate_entry_t));
+      if (!e) {
+         err_printf("Could not allocate revalidation entry for %s\n", pathname);
+         return;
+      }
+      e->pathname = name;
+      e->next = revalidate_table[bucket];
+      revalidate_table[bucket] = e;
+      num_entries++;
+   }
+   e->is_dir = is_dir;
+   e->id = id;
+}
+
+static void check_batch(void *arg)
+{
+   revalidate_batch_t *batch = (revalidate_batch_t *) arg;
+   revalidate_entry_t *e;
+   int i;
+
+   for (i = 0; i < batch->count; i++) {
+      e = batch->entries[i];
+      if (get_identity(e->pathname, &e->newid) == -1)
+         e->result = (errno == ENOENT || errno == ENOTDIR) ? ident_gone : ident_same;
+      else
+         e->result = same_identity(&e->id, &e->newid, e->is_dir) ? ident_same : ident_changed;
+   }
+}
+
+static void add_record(record_writer_t *w, char type, unsigned char d_type, const char *path)
+{
+   size_t needed = 2 + strlen(path) + 1;
+
+   if (w->used + needed > w->size) {
+      while (w->used + needed > w->size)
+         w->size = w->size ? w->size * 2 : 4096;
+      w->buffer = (char *) realloc(w->buffer, w->size);
+      assert(w->buffer);
+   }
+   w->buffer[w->used++] = type;
+   w->buffer[w->used++] = (char) d_type;
+   strcpy(w->buffer + w->used, path);
+   w->used += strlen(path) + 1;
+   w->num_records++;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+   return strcmp(*(const char **) a, *(const char **) b);
+}
+
+static void removed_name_cb(char *filename, unsigned char d_type, char *localpath, size_t size, void *arg)
+{
+   removed_names_t *r = (removed_names_t *) arg;
+   char path[MAX_PATH_LEN+1], *cached;
+   int errcode;
+
+   if (bsearch(&filename, r->names, r->count, sizeof(char *), name_cmp))
+      return;
+   /* Already known to be gone */
+   if (ldcs_cache_findFileDirInCache(filename, (char *) r->dir, &cached, &errcode) == LDCS_CACHE_FILE_FOUND &&
+       errcode == ENOENT)
+      return;
+   snprintf(path, sizeof(path), "%s/%s", r->dir, filename);
+   add_record(r->w, INVALIDATE_GONE, d_type, path);
+}
+
+/**
+ * Compare a changed directory with its listing in our cache.  Names that
+ * appeared are added, and names that went away are gone.
+ **/
+static void rescan_directory(const char *dir, record_writer_t *w)
+{
+   dir_listing_t listing;
+   removed_names_t removed;
+   char path[MAX_PATH_LEN+1], *name, *cached;
+   size_t i;
+   int errcode;
+
+   if (ldcs_cache_findDirInCache((char *) dir) != LDCS_CACHE_DIR_PARSED_AND_EXISTS)
+      return;
+   if (ldcs_cache_isSparseDir((char *) dir)) {
+      /* There's no listing to compare with, so rescanning won't say what changed */
+      return;
+   }
+   if (ldcs_cache_scanDirectory(dir, &listing) == -1) {
+      ldcs_cache_freeListing(&listing);
+      return;
+   }
+   filemngt_count_fsop(FSOP_READDIR, listing.bytes_read);
+
+   removed.dir = dir;
+   removed.count = listing.count;
+   removed.w = w;
+   removed.names = (const char **) malloc((listing.count + 1) * sizeof(char *));
+   assert(removed.names);
+   for (i = 0; i < listing.count; i++) {
+      name = listing.names + listing.offsets[i];
+      removed.names[i] = name;
+      if (ldcs_cache_findFileDirInCache(name, (char *) dir, &cached, &errcode) == LDCS_CACHE_FILE_FOUND &&
+          errcode != ENOENT)
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", dir, name);
+      add_record(w, INVALIDATE_ADDED, listing.types[i], path);
+   }
+   qsort(removed.names, removed.count, sizeof(char *), name_cmp);
+   ldcs_cache_foreachEntryInDir((char *) dir, removed_name_cb, &removed);
+
+   free(removed.names);
+   ldcs_cache_freeListing(&listing);
+}
+
+int revalidate_check(ldcs_process_data_t *procdata, char **data, size_t *len)
+{
+   revalidate_entry_t **entries, **e, *cur;
+   revalidate_batch_t *batches;
+   void **args;
+   record_writer_t w;
+   int i, n, num_batches;
+   double starttime;
+
+   *data = NULL;
+   *len = 0;
+   if (!num_entries)
+      return 0;
+
+   starttime = ldcs_get_time();
+   entries = (revalidate_entry_t **) malloc(num_entries * sizeof(revalidate_entry_t *));
+   num_batches = (num_entries + REVALIDATE_BATCH - 1) / REVALIDATE_BATCH;
+   batches = (revalidate_batch_t *) malloc(num_batches * sizeof(revalidate_batch_t));
+   args = (void **) malloc(num_batches * sizeof(void *));
+   if (!entries || !batches || !args) {
+      err_printf("Could not allocate %d revalidation entries\n", num_entries);
+      free(entries);
+      free(batches);
+      free(args);
+      return -1;
+   }
+
+   n = 0;
+   for (i = 0; i < REVALIDATE_TABLE_SIZE; i++) {
+      for (cur = revalidate_table[i]; cur; cur = cur->next)
+         entries[n++] = cur;
+   }
+   for (i = 0; i < num_batches; i++) {
+      batches[i].entries = entries + i * REVALIDATE_BATCH;
+      batches[i].count = (i == num_batches - 1) ? n - i * REVALIDATE_BATCH : REVALIDATE_BATCH;
+      args[i] = batches + i;
+   }
+   debug_printf("Revalidating %d files and directories in %d batches\n", n, num_batches);
+   readpool_run(check_batch, args, num_batches);
+   free(entries);
+   free(batches);
+   free(args);
+
+   /* A leading byte is left for the direction */
+   memset(&w, 0, sizeof(w));
+   w.size = 4096;
+   w.buffer = (char *) malloc(w.size);
+   assert(w.buffer);
+   w.used = 1;
+
+   for (i = 0; i < REVALIDATE_TABLE_SIZE; i++) {
+      for (e = revalidate_table + i; *e; ) {
+         cur = *e;
+         if (cur->result == ident_same) {
+            e = &cur->next;
+            continue;
+         }
+         if (cur->is_dir && cur->result == ident_changed) {
+            debug_printf2("Directory %s changed, rescanning it\n", cur->pathname);
+            rescan_directory(cur->pathname, &w);
+            cur->id = cur->newid;
+            e = &cur->next;
+            continue;
+         }
+
+         /* A file that's read again is tracked again */
+         debug_printf2("%s %s\n", cur->pathname, cur->result == ident_gone ? "is gone" : "changed");
+         add_record(&w, cur->result == ident_gone ? INVALIDATE_GONE : INVALIDATE_CHANGED,
+                    cur->is_dir ? DT_DIR : DT_REG, cur->pathname);
+         *e = cur->next;
+         free(cur);
+         num_entries--;
+      }
+   }
+
+   procdata->server_stat.revalidate.cnt += n;
+   procdata->server_stat.revalidate.time += ldcs_get_time() - starttime;
+   if (!w.num_records) {
+      free(w.buffer);
+      return 0;
+   }
+   *data = w.buffer;
+   *len = w.used;
+   return w.num_records;
+}
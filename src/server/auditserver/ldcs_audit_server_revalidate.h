@@ -0,0 +1,52 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_REVALIDATE_H_)
+#define LDCS_AUDIT_SERVER_REVALIDATE_H_
+
+#include <sys/types.h>
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * With --revalidate, each server remembers the device, inode, size, mtime
+ * and ctime of the files and directories it read off the shared file
+ * system.  Before each step of a session, it checks them all again, a
+ * batch at a time on the reader threads, and makes a LDCS_MSG_INVALIDATE
+ * of what changed.  That goes up to the root, which sends it down the
+ * tree, so every server drops just the changed files and fetches them
+ * again when they're next asked for.
+ *
+ * A LDCS_MSG_INVALIDATE is a direction byte followed by records, each a
+ * type byte, a d_type byte, and a NUL terminated path.
+ **/
+
+#define INVALIDATE_UP 'u'          /* on its way to the root */
+#define INVALIDATE_DOWN 'd'        /* on its way from the root */
+
+#define INVALIDATE_CHANGED 'c'     /* file's contents or metadata changed */
+#define INVALIDATE_GONE 'g'        /* file or directory was removed */
+#define INVALIDATE_ADDED 'a'       /* name was added to its directory */
+
+/* Remember the identity of a file or directory we just read */
+void revalidate_track(const char *pathname, int is_dir);
+
+/* Check everything we remember, and set *data and *len to a message
+   body with a record for each change.  Returns the number of records, or
+   -1 on error.  *data is malloced if any records are returned */
+int revalidate_check(ldcs_process_data_t *procdata, char **data, size_t *len);
+
+#endif
@@ -25,6 +25,68 @@
 #include "ldcs_api_listen.h"
 #include "ldcs_audit_server_process.h"
 #include "ldcs_audit_server_handlers.h"
+#include "ldcs_audit_server_clientpool.h"
+
+/**
+ * Grow the client table to hold at least size clients
+ **/
+int _ldcs_server_init_client_table ( ldcs_process_data_t *ldcs_process_data, int size ) {
+   ldcs_client_t *table;
+   int nc;
+
+   if (size <= ldcs_process_data->client_table_size)
+      return 0;
+   table = realloc(ldcs_process_data->client_table, size * sizeof(ldcs_client_t));
+   if (!table) {
+      err_printf("Could not allocate client table of %d entries\n", size);
+      return -1;
+   }
+   for (nc = ldcs_process_data->client_table_size; nc < size; nc++) {
+      memset(table + nc, 0, sizeof(ldcs_client_t));
+      table[nc].state = LDCS_CLIENT_STATUS_FREE;
+   }
+   ldcs_process_data->client_table = table;
+   ldcs_process_data->client_table_size = size;
+   return 0;
+}
+
+/**
+ * Return a free entry in the client table, which it grows if full
+ **/
+int _ldcs_server_alloc_client ( ldcs_process_data_t *ldcs_process_data ) {
+   int nc, newsize;
+
+   if (ldcs_process_data->client_table_used >= ldcs_process_data->client_table_size) {
+      newsize = ldcs_process_data->client_table_size ? ldcs_process_data->client_table_size * 2 : 16;
+      if (_ldcs_server_init_client_table(ldcs_process_data, newsize) == -1)
+         return -1;
+   }
+   for(nc=0;(nc<ldcs_process_data->client_table_size);nc++) {
+      if (ldcs_process_data->client_table[nc].state==LDCS_CLIENT_STATUS_FREE) break;
+   }
+   if(nc==ldcs_process_data->client_table_size) {
+      err_printf("internal error with client table (table full)\n");
+      return -1;
+   }
+   return nc;
+}
+
+/**
+ * Release the path buffers of a client that has gone away
+ **/
+void _ldcs_server_free_client ( ldcs_client_t *client ) {
+   free(client->remote_location);
+   client->remote_location = NULL;
+   free(client->remote_cwd);
+   client->remote_cwd = NULL;
+   free(client->search_list);
+   client->search_list = NULL;
+   free(client->requests);
+   client->requests = NULL;
+   /* query_dirname and query_globalpath share query_filename's allocation */
+   free(client->query_filename);
+   client->query_filename = client->query_dirname = client->query_globalpath = NULL;
+}
 
 int _ldcs_server_CB ( int infd, int serverid, void *data ) {
    int rc=0;
@@ -34,32 +96,48 @@ int _ldcs_server_CB ( int infd, int serverid, void *data ) {
 
    cb_starttime=ldcs_get_time();
 
+   /* take every waiting client before going back to the listen loop */
    more_avail=1;
    while(more_avail) {
     
       /* add new client */
-      if (ldcs_process_data->client_table_used >= ldcs_process_data->client_table_size) {
-         ldcs_process_data->client_table_size = ldcs_process_data->client_table_used + 16;
-         ldcs_process_data->client_table = realloc(ldcs_process_data->client_table, 
-                                                   ldcs_process_data->client_table_size * sizeof(ldcs_client_t));
-         for(nc=ldcs_process_data->client_table_used;(nc<ldcs_process_data->client_table_used + 16);nc++) {
-            ldcs_process_data->client_table[nc].state=LDCS_CLIENT_STATUS_FREE;
-         }
-      }
-      for(nc=0;(nc<ldcs_process_data->client_table_size);nc++) {
-         if (ldcs_process_data->client_table[nc].state==LDCS_CLIENT_STATUS_FREE) break;
-      }
-      if(nc==ldcs_process_data->client_table_size) _error("internal error with client table (table full)");
+      nc = _ldcs_server_alloc_client(ldcs_process_data);
+      if (nc == -1)
+         _error("could not grow client table");
     
       ldcs_process_data->client_table[nc].connid       = ldcs_open_server_connections(serverid, nc, &more_avail);
+      if (ldcs_process_data->client_table[nc].connid < 0) {
+         /* Woken without a connection to take, or it was dropped */
+         debug_printf3("No new client connection to add\n");
+         break;
+      }
       ldcs_process_data->client_table[nc].state        = LDCS_CLIENT_STATUS_ACTIVE;
+      ldcs_process_data->client_table[nc].parent       = -1;
+      ldcs_process_data->client_table[nc].req          = 0;
+      ldcs_process_data->client_table[nc].requests     = NULL;
       ldcs_process_data->client_table[nc].null_msg_cnt = 0;    
       ldcs_process_data->client_table[nc].query_open   = 0;
       ldcs_process_data->client_table[nc].existance_query = 0;
+      ldcs_process_data->client_table[nc].dir_query    = 0;
+      ldcs_process_data->client_table[nc].link_query   = 0;
       ldcs_process_data->client_table[nc].is_stat      = 0;
       ldcs_process_data->client_table[nc].is_loader    = 0;      
+      ldcs_process_data->client_table[nc].is_lazy      = 0;
+      ldcs_process_data->client_table[nc].want_fd      = 0;
+      ldcs_process_data->client_table[nc].is_search    = 0;
+      ldcs_process_data->client_table[nc].jit_query    = 0;
+      ldcs_process_data->client_table[nc].jit_waiting  = 0;
+      ldcs_process_data->client_table[nc].kvs_waiting  = 0;
+      ldcs_process_data->client_table[nc].range_open   = 0;
+      ldcs_process_data->client_table[nc].query_missed = 0;
+      ldcs_process_data->client_table[nc].wait_path    = NULL;
+      ldcs_process_data->client_table[nc].step         = 0;
+      ldcs_process_data->client_table[nc].settings_seen = ldcs_process_data->settings_version;
       ldcs_process_data->client_table[nc].lrank        = ldcs_process_data->client_counter;
       ldcs_process_data->client_table[nc].query_localpath = NULL;
+      ldcs_process_data->client_table[nc].pinned = NULL;
+      ldcs_process_data->client_table[nc].pinned_count = 0;
+      ldcs_process_data->client_table[nc].pinned_size = 0;
       ldcs_process_data->client_table_used++;
       ldcs_process_data->client_counter++;
       ldcs_process_data->clients_live++;
@@ -67,7 +145,7 @@ int _ldcs_server_CB ( int infd, int serverid, void *data ) {
     
       /* register client fd to listener */
       fd=ldcs_get_fd(ldcs_process_data->client_table[nc].connid);
-      if (fd != -1)
+      if (fd != -1 && clientpool_register_fd(nc, fd) == -1)
          ldcs_listen_register_fd(fd, nc, &_ldcs_client_CB, (void *) ldcs_process_data);
       ldcs_process_data->server_stat.num_connections++;
 
@@ -0,0 +1,124 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "ldcs_api.h"
+#include "ldcs_statseg.h"
+#include "ldcs_audit_server_statseg.h"
+
+static statseg_header_t *segment = NULL;
+static size_t segment_size = 0;
+
+int statseg_init(char *location, int number)
+{
+   char path[MAX_PATH_LEN+1];
+   int fd, result;
+   void *mem;
+
+   segment_size = STATSEG_SIZE(STATSEG_DEFAULT_ENTRIES);
+   snprintf(path, sizeof(path), "%s/%s.%d", location, STATSEG_NAME, number);
+   path[MAX_PATH_LEN] = '\0';
+
+   fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1) {
+      err_printf("Could not create stat segment %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+
+   result = ftruncate(fd, segment_size);
+   if (result == -1) {
+      err_printf("Could not size stat segment %s to %lu: %s\n", path,
+                 (unsigned long) segment_size, strerror(errno));
+      close(fd);
+      unlink(path);
+      return -1;
+   }
+
+   mem = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (mem == MAP_FAILED) {
+      err_printf("Could not map stat segment %s: %s\n", path, strerror(errno));
+      unlink(path);
+      return -1;
+   }
+
+   segment = (statseg_header_t *) mem;
+   segment->version = STATSEG_VERSION;
+   segment->entry_size = sizeof(statseg_entry_t);
+   segment->max_entries = STATSEG_DEFAULT_ENTRIES;
+   segment->num_entries = 0;
+   __sync_synchronize();
+   segment->magic = STATSEG_MAGIC;
+
+   debug_printf2("Created stat segment %s with %u entries\n", path, segment->max_entries);
+   return 0;
+}
+
+char *statseg_add(struct stat *buf)
+{
+   char ref[64];
+   statseg_entry_t *entry;
+   uint32_t index;
+
+   if (!segment)
+      return NULL;
+   if (segment->num_entries >= segment->max_entries) {
+      debug_printf3("Stat segment is full, falling back to local files\n");
+      return NULL;
+   }
+
+   index = segment->num_entries;
+   entry = STATSEG_ENTRY(segment, index);
+   memcpy(&entry->buf, buf, sizeof(*buf));
+   __sync_synchronize();
+   entry->valid = 1;
+   segment->num_entries = index + 1;
+
+   snprintf(ref, sizeof(ref), "%s%u", STATSEG_REF_PREFIX, index);
+   return strdup(ref);
+}
+
+int statseg_read(char *ref, struct stat *buf)
+{
+   unsigned long index;
+   char *end;
+   statseg_entry_t *entry;
+
+   if (!segment || !STATSEG_IS_REF(ref)) {
+      err_printf("%s is not a reference into the stat segment\n", ref);
+      return -1;
+   }
+
+   index = strtoul(ref + STATSEG_REF_PREFIX_LEN, &end, 10);
+   if (*end != '\0' || index >= segment->num_entries) {
+      err_printf("Stat segment reference %s is out of range\n", ref);
+      return -1;
+   }
+
+   entry = STATSEG_ENTRY(segment, index);
+   memcpy(buf, &entry->buf, sizeof(*buf));
+   return 0;
+}
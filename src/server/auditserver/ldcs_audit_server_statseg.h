@@ -0,0 +1,40 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_STATSEG_H_)
+#define LDCS_AUDIT_SERVER_STATSEG_H_
+
+#include <sys/stat.h>
+
+/**
+ * Create the shared stat segment under location.  Returns -1 if it
+ * could not be created, in which case stat results go to local files.
+ **/
+int statseg_init(char *location, int number);
+
+/**
+ * Copy buf into the next free slot and return a malloc'd reference
+ * string for it, or NULL if the segment is missing or full.
+ **/
+char *statseg_add(struct stat *buf);
+
+/**
+ * Copy the stat stored under a reference from statseg_add into buf.
+ **/
+int statseg_read(char *ref, struct stat *buf);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_steps.h"
+
+typedef struct step_t {
+   unsigned int id;
+   int live;                  /* clients connected now */
+   unsigned long clients;     /* clients connected since the step's first */
+   unsigned long queries;
+   unsigned long hits;
+   double start;
+   struct step_t *next;
+} step_t;
+
+/* Few steps run at once, so a list does */
+static step_t *steps = NULL;
+static int num_steps = 0;
+
+static step_t *find_step(unsigned int id)
+{
+   step_t *s;
+
+   for (s = steps; s; s = s->next) {
+      if (s->id == id)
+         return s;
+   }
+   return NULL;
+}
+
+void steps_client_start(unsigned int step)
+{
+   step_t *s;
+
+   if (!step)
+      return;
+   s = find_step(step);
+   if (!s) {
+      s = (step_t *) calloc(1, sizeof(step_t));
+      if (!s) {
+         err_printf("Could not allocate accounting for session step %u\n", step);
+         return;
+      }
+      s->id = step;
+      s->start = ldcs_get_time();
+      s->next = steps;
+      steps = s;
+      num_steps++;
+      debug_printf("Session step %u has its first client here, %d steps running\n", step, num_steps);
+   }
+   s->live++;
+   s->clients++;
+}
+
+void steps_client_end(unsigned int step)
+{
+   step_t *s, **prev;
+
+   if (!step)
+      return;
+   for (prev = &steps; (s = *prev); prev = &s->next) {
+      if (s->id == step)
+         break;
+   }
+   if (!s || --s->live > 0)
+      return;
+
+   debug_printf("Session step %u is done here: %lu clients over %.3fs, %lu of %lu queries answered from the cache\n",
+                step, s->clients, ldcs_get_time() - s->start, s->hits, s->queries);
+   *prev = s->next;
+   free(s);
+   num_steps--;
+}
+
+void steps_count_query(unsigned int step, int hit)
+{
+   step_t *s;
+
+   if (!step || !(s = find_step(step)))
+      return;
+   s->queries++;
+   if (hit)
+      s->hits++;
+}
+
+int steps_live()
+{
+   return num_steps;
+}
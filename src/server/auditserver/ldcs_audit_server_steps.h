@@ -0,0 +1,43 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_STEPS_H_)
+#define LDCS_AUDIT_SERVER_STEPS_H_
+
+/**
+ * Client accounting by session step.  A session's run-in-session steps
+ * can run at once, each on some of the session's nodes, and share the
+ * servers and their cache.  The front end gives each step's bootstrap
+ * its app id, which the clients send in their hello.  A server counts
+ * the clients each step has connected to it, and the queries they had
+ * answered on the main thread and how many of those were cache hits.
+ * Once a step's last client here is gone, that's logged and the step
+ * forgotten.  Step 0 is a client outside any step, and isn't counted.
+ **/
+
+/* A client of step connected */
+void steps_client_start(unsigned int step);
+
+/* A client of step is gone */
+void steps_client_end(unsigned int step);
+
+/* A client of step had a query answered, from the cache if hit */
+void steps_count_query(unsigned int step, int hit);
+
+/* Steps with clients connected to us now */
+int steps_live();
+
+#endif
@@ -0,0 +1,106 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_transform.h"
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_audit_server_compress.h"
+#include "ldcs_audit_server_crc.h"
+
+typedef void (*stage_fn_t)(transform_t *t, const void *buffer, size_t size);
+
+typedef struct {
+   stage_fn_t fn;
+   transform_t *t;
+   const void *buffer;
+   size_t size;
+} stage_arg_t;
+
+static void crc_stage(transform_t *t, const void *buffer, size_t size)
+{
+   double starttime = ldcs_get_time();
+
+   t->crc = crc32c(buffer, size);
+   t->crc_time = ldcs_get_time() - starttime;
+}
+
+static void compress_stage(transform_t *t, const void *buffer, size_t size)
+{
+   double starttime = ldcs_get_time();
+   size_t max_size = (size / 8) * t->zeighths;
+
+   t->zsize = 0;
+   t->zbuffer = malloc(max_size);
+   if (t->zbuffer) {
+      t->zsize = compress_buffer(buffer, size, t->zbuffer, max_size);
+      if (!t->zsize) {
+         free(t->zbuffer);
+         t->zbuffer = NULL;
+      }
+   }
+   t->compress_time = ldcs_get_time() - starttime;
+}
+
+/* New stages go here.  The slowest goes first, so it starts first */
+static struct {
+   int stage;
+   stage_fn_t fn;
+} stages[] = {
+   { TRANSFORM_COMPRESS, compress_stage },
+   { TRANSFORM_CRC, crc_stage }
+};
+#define NUM_STAGES ((int) (sizeof(stages) / sizeof(stages[0])))
+
+static void stage_job(void *arg)
+{
+   stage_arg_t *sa = (stage_arg_t *) arg;
+   sa->fn(sa->t, sa->buffer, sa->size);
+}
+
+void transform_run(transform_t *t, const void *buffer, size_t size)
+{
+   stage_arg_t args[NUM_STAGES];
+   void *argps[NUM_STAGES];
+   int i, n = 0;
+
+   for (i = 0; i < NUM_STAGES; i++) {
+      if (!(t->stages & stages[i].stage))
+         continue;
+      args[n].fn = stages[i].fn;
+      args[n].t = t;
+      args[n].buffer = buffer;
+      args[n].size = size;
+      argps[n] = args + n;
+      n++;
+   }
+
+   /* Stages only read the contents and each fills in its own fields */
+   if (n == 1)
+      stage_job(argps[0]);
+   else if (n > 1)
+      readpool_run(stage_job, argps, n);
+   t->done = t->stages;
+}
+
+void transform_release(transform_t *t)
+{
+   if (t->zbuffer)
+      free(t->zbuffer);
+   t->zbuffer = NULL;
+   t->done = 0;
+}
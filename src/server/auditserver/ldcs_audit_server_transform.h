@@ -0,0 +1,54 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_TRANSFORM_H_)
+#define LDCS_AUDIT_SERVER_TRANSFORM_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * The work done on a file's contents after a reader thread reads them off
+ * the shared file system, and before the server loop stores and sends
+ * them.  Each stage is a pass over the contents that leaves its result
+ * here, and the stages a file needs run at once on the reader threads as
+ * part of its read, so the loop only picks up their results and none of
+ * the passes hold up its reads and sends.  Stripping changes the
+ * contents, so the read does that, ahead of the stages.
+ **/
+
+#define TRANSFORM_CRC      (1 << 0)   /* the CRC32C sent with the file, with OPT_VERIFY */
+#define TRANSFORM_COMPRESS (1 << 1)   /* the compressed copy sent instead, with OPT_COMPRESS */
+
+typedef struct {
+   int stages;           /* TRANSFORM_* stages to run */
+   int done;             /* stages that have run */
+   int zeighths;         /* most a compressed copy may be, in eighths of the contents */
+   uint32_t crc;
+   void *zbuffer;        /* malloc'd compressed copy, NULL if it didn't compress */
+   size_t zsize;
+   double crc_time;
+   double compress_time;
+} transform_t;
+
+/* Run t's stages over the size bytes at buffer, at once if there's more
+   than one.  Called on a reader thread */
+void transform_run(transform_t *t, const void *buffer, size_t size);
+
+/* Free whatever of t's results the caller didn't take */
+void transform_release(transform_t *t);
+
+#endif
@@ -18,48 +18,368 @@ Place, Suite 330, Boston, MA 02111-1307 USA
  * The following code reads a stripped version of an ELF file, rather
  * than the full executable with all debug info and symbols.
  **/
+#define _GNU_SOURCE
 #include <elf.h>
 #include <errno.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "ldcs_elf_read.h"
 #include "ldcs_api.h"
+#include "ldcs_audit_server_readpool.h"
 
-static int readUpTo(FILE *f, unsigned char *buffer, size_t *cur_pos, size_t new_size)
+static int skip_holes = 0;
+
+void elf_read_skip_holes(int on)
+{
+   skip_holes = on;
+}
+
+/**
+ * readUpTo for a file that may have holes.  Only its data extents are
+ * read, since the buffer is a new staged file that's already zero, and
+ * leaving the holes untouched keeps them holes there.  Returns 1 to read
+ * the rest as usual if the file system can't find them.
+ **/
+static int readDataUpTo(int fd, int direct_fd, unsigned char *buffer, size_t *cur_pos, size_t new_size)
+{
+   off_t data, hole;
+   ssize_t result;
+   struct stat buf;
+
+   while (*cur_pos < new_size) {
+      data = lseek(fd, *cur_pos, SEEK_DATA);
+      if (data == (off_t) -1 && errno == ENXIO) {
+         /* Nothing but holes to the end of the file */
+         if (fstat(fd, &buf) == -1)
+            return -1;
+         if ((size_t) buf.st_size < new_size)
+            new_size = (size_t) buf.st_size;
+         if (*cur_pos < new_size)
+            *cur_pos = new_size;
+         return 0;
+      }
+      hole = (data == (off_t) -1) ? (off_t) -1 : lseek(fd, data, SEEK_HOLE);
+      if (hole == (off_t) -1)
+         return 1;
+      if ((size_t) data >= new_size) {
+         *cur_pos = new_size;
+         return 0;
+      }
+      if ((size_t) hole > new_size)
+         hole = new_size;
+
+      result = readpool_read(fd, direct_fd, buffer, data, hole - data);
+      if (result == -1)
+         return -1;
+      *cur_pos = data + result;
+      if (result < hole - data)
+         return 0;
+   }
+   return 0;
+}
+
+static int readUpTo(int fd, int direct_fd, unsigned char *buffer, size_t *cur_pos, size_t new_size)
 {
-   size_t result;
+   ssize_t result;
    if (*cur_pos >= new_size)
       return 0;
 
-   do {
-      result = fread(buffer + *cur_pos, 1, new_size - *cur_pos, f);
-   } while (result == -1 && errno == EINTR);
+   if (skip_holes) {
+      result = readDataUpTo(fd, direct_fd, buffer, cur_pos, new_size);
+      if (result != 1)
+         return (int) result;
+   }
+
+   result = readpool_read(fd, direct_fd, buffer, *cur_pos, new_size - *cur_pos);
    if (result == -1)
       return -1;
    *cur_pos += result;
    return 0;
 }
 
+/**
+ * Read len bytes at file offset into dest, which need not be at the same
+ * offset in the buffer.  Used for the few small pieces we move.
+ **/
+static int readAt(int fd, unsigned char *dest, size_t offset, size_t len)
+{
+   ssize_t result;
+   while (len) {
+      result = pread(fd, dest, len, offset);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         return -1;
+      dest += result;
+      offset += result;
+      len -= result;
+   }
+   return 0;
+}
+
+/**
+ * Accessors for the headers of 32 and 64-bit ELF files.  The headers are
+ * widened to their 64-bit forms, and are copied rather than cast since the
+ * program and section headers may not be aligned in the buffer.
+ **/
+static void getEhdr(unsigned char *buffer, int is64, Elf64_Ehdr *ehdr)
+{
+   Elf32_Ehdr e32;
+   if (is64) {
+      memcpy(ehdr, buffer, sizeof(*ehdr));
+      return;
+   }
+   memcpy(&e32, buffer, sizeof(e32));
+   memcpy(ehdr->e_ident, e32.e_ident, EI_NIDENT);
+   ehdr->e_type = e32.e_type;
+   ehdr->e_machine = e32.e_machine;
+   ehdr->e_version = e32.e_version;
+   ehdr->e_entry = e32.e_entry;
+   ehdr->e_phoff = e32.e_phoff;
+   ehdr->e_shoff = e32.e_shoff;
+   ehdr->e_flags = e32.e_flags;
+   ehdr->e_ehsize = e32.e_ehsize;
+   ehdr->e_phentsize = e32.e_phentsize;
+   ehdr->e_phnum = e32.e_phnum;
+   ehdr->e_shentsize = e32.e_shentsize;
+   ehdr->e_shnum = e32.e_shnum;
+   ehdr->e_shstrndx = e32.e_shstrndx;
+}
+
+static void setShoff(unsigned char *buffer, int is64, size_t shoff)
+{
+   Elf64_Off off64 = shoff;
+   Elf32_Off off32 = (Elf32_Off) shoff;
+   if (is64)
+      memcpy(buffer + offsetof(Elf64_Ehdr, e_shoff), &off64, sizeof(off64));
+   else
+      memcpy(buffer + offsetof(Elf32_Ehdr, e_shoff), &off32, sizeof(off32));
+}
+
+static void getPhdr(unsigned char *p, int is64, Elf64_Phdr *phdr)
+{
+   Elf32_Phdr p32;
+   if (is64) {
+      memcpy(phdr, p, sizeof(*phdr));
+      return;
+   }
+   memcpy(&p32, p, sizeof(p32));
+   phdr->p_type = p32.p_type;
+   phdr->p_flags = p32.p_flags;
+   phdr->p_offset = p32.p_offset;
+   phdr->p_vaddr = p32.p_vaddr;
+   phdr->p_paddr = p32.p_paddr;
+   phdr->p_filesz = p32.p_filesz;
+   phdr->p_memsz = p32.p_memsz;
+   phdr->p_align = p32.p_align;
+}
+
+/* p_type is the first word of both classes of program header */
+static void setPhdrType(unsigned char *p, Elf64_Word type)
+{
+   memcpy(p, &type, sizeof(type));
+}
+
+static void getShdr(unsigned char *p, int is64, Elf64_Shdr *shdr)
+{
+   Elf32_Shdr s32;
+   if (is64) {
+      memcpy(shdr, p, sizeof(*shdr));
+      return;
+   }
+   memcpy(&s32, p, sizeof(s32));
+   shdr->sh_name = s32.sh_name;
+   shdr->sh_type = s32.sh_type;
+   shdr->sh_flags = s32.sh_flags;
+   shdr->sh_addr = s32.sh_addr;
+   shdr->sh_offset = s32.sh_offset;
+   shdr->sh_size = s32.sh_size;
+   shdr->sh_link = s32.sh_link;
+   shdr->sh_info = s32.sh_info;
+   shdr->sh_addralign = s32.sh_addralign;
+   shdr->sh_entsize = s32.sh_entsize;
+}
+
+/* Stripping only changes a section's type and offset */
+static void setShdrTypeOffset(unsigned char *p, int is64, Elf64_Word type, size_t offset)
+{
+   Elf64_Off off64 = offset;
+   Elf32_Off off32 = (Elf32_Off) offset;
+   if (is64) {
+      memcpy(p + offsetof(Elf64_Shdr, sh_type), &type, sizeof(type));
+      memcpy(p + offsetof(Elf64_Shdr, sh_offset), &off64, sizeof(off64));
+   }
+   else {
+      memcpy(p + offsetof(Elf32_Shdr, sh_type), &type, sizeof(type));
+      memcpy(p + offsetof(Elf32_Shdr, sh_offset), &off32, sizeof(off32));
+   }
+}
+
 #if !defined PT_GNU_RELRO
 #define PT_GNU_RELRO 0x6474e552
 #endif
 
 #define ERR -1
 #define NOT_ELF -2
-static int readLoadableFileSections(FILE *f, unsigned char *buffer, size_t *size, int strip)
+#define NO_SECTIONS -3
+
+/**
+ * Debug info and the symbol table are stripped.  Anything loaded is kept,
+ * as are other unloaded sections like .gnu_debuglink, so debuggers can
+ * still find the separate debug info.
+ **/
+static int isStrippedSection(const char *name, Elf64_Shdr *shdr)
+{
+   if (shdr->sh_flags & SHF_ALLOC)
+      return 0;
+   if (shdr->sh_type == SHT_SYMTAB)
+      return 1;
+   return strncmp(name, ".debug", 6) == 0 || strncmp(name, ".zdebug", 7) == 0 ||
+      strcmp(name, ".strtab") == 0;
+}
+
+/**
+ * Strip an ELF file by sections.  The file is kept up to the end of its
+ * loadable segments, then the unloaded sections we keep are moved down to
+ * follow the segments, then a rewritten section header table.  Stripped
+ * sections keep their headers as SHT_NOBITS, so section indexes and links
+ * stay valid.  Returns NO_SECTIONS, having changed nothing past load_end,
+ * if the section headers can't be used.
+ **/
+static int stripSections(int fd, int direct_fd, unsigned char *buffer, size_t *cur_pos, Elf64_Ehdr *ehdr,
+                         int is64, size_t load_end, size_t filesize, size_t *size)
 {
-   int result;
+   size_t shentsize = is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+   size_t table_size, names_size, pos, align, stripped = 0;
+   size_t *src_offsets = NULL;
+   unsigned char *shdrs = NULL;
+   char *names = NULL;
+   const char *name;
+   Elf64_Shdr shdr;
+   unsigned int i;
+   int result = NO_SECTIONS;
+
+   if (!ehdr->e_shoff || !ehdr->e_shnum || ehdr->e_shentsize != shentsize ||
+       ehdr->e_shstrndx == SHN_UNDEF || ehdr->e_shstrndx >= ehdr->e_shnum)
+      return NO_SECTIONS;
+   table_size = ehdr->e_shnum * shentsize;
+   if (ehdr->e_shoff > filesize || table_size > filesize - ehdr->e_shoff)
+      return NO_SECTIONS;
+
+   shdrs = (unsigned char *) malloc(table_size);
+   src_offsets = (size_t *) calloc(ehdr->e_shnum, sizeof(size_t));
+   if (!shdrs || !src_offsets) {
+      result = ERR;
+      goto done;
+   }
+   if (readAt(fd, shdrs, ehdr->e_shoff, table_size) == -1) {
+      result = ERR;
+      goto done;
+   }
+
+   getShdr(shdrs + ehdr->e_shstrndx * shentsize, is64, &shdr);
+   if (shdr.sh_type != SHT_STRTAB || shdr.sh_offset > filesize || shdr.sh_size > filesize - shdr.sh_offset)
+      goto done;
+   names_size = shdr.sh_size;
+   names = (char *) malloc(names_size + 1);
+   if (!names || readAt(fd, (unsigned char *) names, shdr.sh_offset, names_size) == -1) {
+      result = ERR;
+      goto done;
+   }
+   names[names_size] = '\0';
+
+   //Kept sections that start among the segments but run past them stay where they are.
+   for (i = 1; i < ehdr->e_shnum; i++) {
+      getShdr(shdrs + i * shentsize, is64, &shdr);
+      if (shdr.sh_type == SHT_NOBITS || shdr.sh_offset > filesize || shdr.sh_size > filesize - shdr.sh_offset)
+         continue;
+      name = shdr.sh_name < names_size ? names + shdr.sh_name : "";
+      if (shdr.sh_offset < load_end && shdr.sh_offset + shdr.sh_size > load_end &&
+          !isStrippedSection(name, &shdr))
+         load_end = shdr.sh_offset + shdr.sh_size;
+   }
+
+   //Lay out the new file before touching the buffer, so we can still give up.
+   pos = load_end;
+   for (i = 1; i < ehdr->e_shnum; i++) {
+      unsigned char *p = shdrs + i * shentsize;
+      getShdr(p, is64, &shdr);
+      if (shdr.sh_offset < load_end && shdr.sh_type != SHT_NOBITS)
+         continue;
+      name = shdr.sh_name < names_size ? names + shdr.sh_name : "";
+      if (shdr.sh_type == SHT_NOBITS || isStrippedSection(name, &shdr)) {
+         if (shdr.sh_type != SHT_NOBITS)
+            stripped += shdr.sh_size;
+         if (shdr.sh_offset >= load_end)
+            setShdrTypeOffset(p, is64, SHT_NOBITS, pos);
+         continue;
+      }
+      if (shdr.sh_offset > filesize || shdr.sh_size > filesize - shdr.sh_offset)
+         goto done;
+      align = shdr.sh_addralign > 1 ? shdr.sh_addralign : 1;
+      pos = ((pos + align - 1) / align) * align;
+      if (pos > filesize || shdr.sh_size > filesize - pos)
+         goto done;
+      src_offsets[i] = shdr.sh_offset;
+      setShdrTypeOffset(p, is64, shdr.sh_type, pos);
+      pos += shdr.sh_size;
+   }
+   align = is64 ? 8 : 4;
+   pos = ((pos + align - 1) / align) * align;
+   if (pos > filesize || table_size > filesize - pos)
+      goto done;
+
+   //Read the segments, then the sections we moved.
+   if (readUpTo(fd, direct_fd, buffer, cur_pos, load_end) == -1 || *cur_pos < load_end) {
+      result = ERR;
+      goto done;
+   }
+   for (i = 1; i < ehdr->e_shnum; i++) {
+      if (!src_offsets[i])
+         continue;
+      getShdr(shdrs + i * shentsize, is64, &shdr);
+      if (readAt(fd, buffer + shdr.sh_offset, src_offsets[i], shdr.sh_size) == -1) {
+         result = ERR;
+         goto done;
+      }
+   }
+   memcpy(buffer + pos, shdrs, table_size);
+   setShoff(buffer, is64, pos);
+   *size = pos + table_size;
+
+   debug_printf3("Stripped %lu bytes of debug and symbol sections, %lu of %lu bytes left\n",
+                 (unsigned long) stripped, (unsigned long) *size, (unsigned long) filesize);
+   result = 0;
+
+  done:
+   if (shdrs)
+      free(shdrs);
+   if (src_offsets)
+      free(src_offsets);
+   if (names)
+      free(names);
+   return result;
+}
+
+static int readLoadableFileSections(int fd, int direct_fd, unsigned char *buffer, size_t *size, int strip)
+{
+   int result, is64;
    size_t filesize = *size;
    size_t cur_pos = 0;
-   size_t ph_start, ph_end;
+   size_t ph_start, ph_end, phentsize;
    unsigned long num_phdrs, i, pagesize, pagediff;
    unsigned long highest_file_addr = 0, cur_file_addr;
-   Elf64_Ehdr *ehdr;
-   Elf64_Phdr *phdr;
+   Elf64_Ehdr ehdr;
+   Elf64_Phdr phdr;
 
    //Read the first page, which will contain the ELF header
    // (and likely the program headers)
-   result = readUpTo(f, buffer, &cur_pos, 0x1000);
+   result = readUpTo(fd, direct_fd, buffer, &cur_pos, 0x1000);
    if (result == -1) {
       return ERR;
    }
@@ -68,31 +388,43 @@ static int readLoadableFileSections(FILE *f, unsigned char *buffer, size_t *size
    if (EI_NIDENT > cur_pos) {
       return NOT_ELF;
    }
-   ehdr = (Elf64_Ehdr *) buffer;
-   if (ehdr->e_ident[EI_MAG0] != ELFMAG0 ||
-       ehdr->e_ident[EI_MAG1] != ELFMAG1 ||
-       ehdr->e_ident[EI_MAG2] != ELFMAG2 ||
-       ehdr->e_ident[EI_MAG3] != ELFMAG3) {
-      readUpTo(f, buffer, &cur_pos, filesize);
+   if (buffer[EI_MAG0] != ELFMAG0 ||
+       buffer[EI_MAG1] != ELFMAG1 ||
+       buffer[EI_MAG2] != ELFMAG2 ||
+       buffer[EI_MAG3] != ELFMAG3) {
+      readUpTo(fd, direct_fd, buffer, &cur_pos, filesize);
       return NOT_ELF;
    }
-   if (ehdr->e_ident[EI_CLASS] != ELFCLASS64) {
-      readUpTo(f, buffer, &cur_pos, filesize);
+   if (buffer[EI_CLASS] == ELFCLASS64)
+      is64 = 1;
+   else if (buffer[EI_CLASS] == ELFCLASS32)
+      is64 = 0;
+   else {
+      readUpTo(fd, direct_fd, buffer, &cur_pos, filesize);
       return NOT_ELF;
    }
-   if (ehdr->e_type != ET_EXEC && ehdr->e_type != ET_DYN) {
-      readUpTo(f, buffer, &cur_pos, filesize);
+   if (cur_pos < (is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr))) {
+      readUpTo(fd, direct_fd, buffer, &cur_pos, filesize);
+      return NOT_ELF;
+   }
+   getEhdr(buffer, is64, &ehdr);
+   if (ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN) {
+      readUpTo(fd, direct_fd, buffer, &cur_pos, filesize);
+      return NOT_ELF;
+   }
+   phentsize = is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+   if (ehdr.e_phnum && ehdr.e_phentsize < phentsize) {
+      readUpTo(fd, direct_fd, buffer, &cur_pos, filesize);
       return NOT_ELF;
    }
-
 
    //Collect info on program headers and read them into memory
    // (if they weren't read in the last read).
-   num_phdrs = ehdr->e_phnum;
-   ph_start = ehdr->e_phoff;
-   ph_end = ph_start + ehdr->e_phentsize * num_phdrs;
+   num_phdrs = ehdr.e_phnum;
+   ph_start = ehdr.e_phoff;
+   ph_end = ph_start + ehdr.e_phentsize * num_phdrs;
    
-   result = readUpTo(f, buffer, &cur_pos, ph_end);
+   result = readUpTo(fd, direct_fd, buffer, &cur_pos, ph_end);
    if (result == -1) {
       return ERR;
    }
@@ -102,29 +434,38 @@ static int readLoadableFileSections(FILE *f, unsigned char *buffer, size_t *size
 
    //Spindle isn't compatible with PT_GNU_RELRO sections. Delete them
    // by changing the type to an unused type.
-   phdr = (Elf64_Phdr *) (buffer + ph_start);
-   for (i = 0; i < num_phdrs; i++, phdr++) {
-      if (phdr->p_type == PT_GNU_RELRO) {
-         phdr->p_type = 0x7a5843cc;
+   for (i = 0; i < num_phdrs; i++) {
+      getPhdr(buffer + ph_start + i * ehdr.e_phentsize, is64, &phdr);
+      if (phdr.p_type == PT_GNU_RELRO) {
+         setPhdrType(buffer + ph_start + i * ehdr.e_phentsize, 0x7a5843cc);
       }
    }
 
    if (!strip) {
-      readUpTo(f, buffer, &cur_pos, filesize);
+      readUpTo(fd, direct_fd, buffer, &cur_pos, filesize);
       return 0;
    }
 
    //Find the end of the last program header
-   phdr = (Elf64_Phdr *) (buffer + ph_start);
-   for (i = 0; i < num_phdrs; i++, phdr++) {
-      if (phdr->p_type != PT_LOAD)
+   for (i = 0; i < num_phdrs; i++) {
+      getPhdr(buffer + ph_start + i * ehdr.e_phentsize, is64, &phdr);
+      if (phdr.p_type != PT_LOAD)
          continue;
-      cur_file_addr = phdr->p_offset + phdr->p_filesz;
+      cur_file_addr = phdr.p_offset + phdr.p_filesz;
       if (cur_file_addr > highest_file_addr)
          highest_file_addr = cur_file_addr;
    }
+   if (highest_file_addr > filesize)
+      highest_file_addr = filesize;
+   if (highest_file_addr < ph_end)
+      highest_file_addr = ph_end;
 
-   //Round up to a page.
+   result = stripSections(fd, direct_fd, buffer, &cur_pos, &ehdr, is64, highest_file_addr, filesize, size);
+   if (result != NO_SECTIONS)
+      return result;
+
+   //Without usable section headers, just drop everything past the segments.
+   // Round up to a page.
    pagesize = getpagesize();
    pagediff = highest_file_addr % pagesize;
    if (pagediff) 
@@ -133,7 +474,7 @@ static int readLoadableFileSections(FILE *f, unsigned char *buffer, size_t *size
       highest_file_addr = filesize;
 
    //Read the main contents of the file
-   result = readUpTo(f, buffer, &cur_pos, highest_file_addr);
+   result = readUpTo(fd, direct_fd, buffer, &cur_pos, highest_file_addr);
    if (result == -1) {
       return ERR;
    }
@@ -144,8 +485,8 @@ static int readLoadableFileSections(FILE *f, unsigned char *buffer, size_t *size
    return 0;
 }
 
-int read_file_and_strip(FILE *f, void *data, size_t *size, int strip) {
-   int result = readLoadableFileSections(f, (unsigned char *) data, size, strip);
+int read_file_and_strip(int fd, int direct_fd, void *data, size_t *size, int strip) {
+   int result = readLoadableFileSections(fd, direct_fd, (unsigned char *) data, size, strip);
    if (result == ERR) {
       debug_printf3("Error reading from file\n");
       return -1;
@@ -153,3 +494,287 @@ int read_file_and_strip(FILE *f, void *data, size_t *size, int strip) {
    return 0;
 }
 
+
+/**
+ * Map a virtual address in the image to its file offset, using the
+ * PT_LOAD segment that contains it.  Returns -1 if no segment does.
+ **/
+static int vaddrToOffset(unsigned char *buffer, int is64, Elf64_Ehdr *ehdr, Elf64_Addr addr, size_t *offset)
+{
+   Elf64_Phdr phdr;
+   int i;
+
+   for (i = 0; i < ehdr->e_phnum; i++) {
+      getPhdr(buffer + ehdr->e_phoff + i * ehdr->e_phentsize, is64, &phdr);
+      if (phdr.p_type != PT_LOAD)
+         continue;
+      if (addr >= phdr.p_vaddr && addr < phdr.p_vaddr + phdr.p_filesz) {
+         *offset = addr - phdr.p_vaddr + phdr.p_offset;
+         return 0;
+      }
+   }
+   return -1;
+}
+
+/**
+ * Return the string at offset in the dynamic string table, or NULL if it
+ * isn't terminated inside the table.
+ **/
+static const char *getDynString(unsigned char *buffer, size_t strtab, size_t strsz, Elf64_Xword offset)
+{
+   if (offset >= strsz)
+      return NULL;
+   if (!memchr(buffer + strtab + offset, '\0', strsz - offset))
+      return NULL;
+   return (const char *) (buffer + strtab + offset);
+}
+
+/**
+ * Find the DT_NEEDED, DT_RPATH and DT_RUNPATH entries of an ELF image that
+ * has been read into memory.  An image that isn't dynamically linked ELF
+ * returns 0 with no entries.  Works on stripped images, since the dynamic
+ * section and its strings are part of the loadable segments.
+ **/
+int elf_read_dependencies(void *data, size_t size, elf_deps_t *deps)
+{
+   unsigned char *buffer = (unsigned char *) data;
+   Elf64_Ehdr ehdr;
+   Elf64_Phdr phdr;
+   Elf64_Dyn dyn;
+   Elf32_Dyn dyn32;
+   Elf64_Addr strtab_addr = 0;
+   Elf64_Xword strsz = 0, rpath_off = 0, runpath_off = 0;
+   size_t dyn_offset = 0, dyn_size = 0, dyn_entsize, strtab, pos;
+   int is64, i, have_rpath = 0, have_runpath = 0, num_needed = 0;
+   const char *name;
+
+   memset(deps, 0, sizeof(*deps));
+   if (size < EI_NIDENT || memcmp(buffer, ELFMAG, SELFMAG) != 0)
+      return 0;
+   if (buffer[EI_CLASS] != ELFCLASS32 && buffer[EI_CLASS] != ELFCLASS64)
+      return 0;
+   is64 = (buffer[EI_CLASS] == ELFCLASS64);
+   if (size < (is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr)))
+      return 0;
+   getEhdr(buffer, is64, &ehdr);
+   if (ehdr.e_phentsize < (is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)) ||
+       ehdr.e_phoff + (size_t) ehdr.e_phnum * ehdr.e_phentsize > size)
+      return 0;
+
+   for (i = 0; i < ehdr.e_phnum; i++) {
+      getPhdr(buffer + ehdr.e_phoff + i * ehdr.e_phentsize, is64, &phdr);
+      if (phdr.p_type == PT_DYNAMIC) {
+         dyn_offset = phdr.p_offset;
+         dyn_size = phdr.p_filesz;
+         break;
+      }
+   }
+   if (!dyn_size || dyn_offset + dyn_size > size)
+      return 0;
+
+   /* First pass finds the string table and counts the needed entries */
+   dyn_entsize = is64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+   for (pos = dyn_offset; pos + dyn_entsize <= dyn_offset + dyn_size; pos += dyn_entsize) {
+      if (is64)
+         memcpy(&dyn, buffer + pos, sizeof(dyn));
+      else {
+         memcpy(&dyn32, buffer + pos, sizeof(dyn32));
+         dyn.d_tag = dyn32.d_tag;
+         dyn.d_un.d_val = dyn32.d_un.d_val;
+      }
+      if (dyn.d_tag == DT_NULL)
+         break;
+      switch (dyn.d_tag) {
+         case DT_NEEDED: num_needed++; break;
+         case DT_STRTAB: strtab_addr = dyn.d_un.d_ptr; break;
+         case DT_STRSZ: strsz = dyn.d_un.d_val; break;
+         case DT_RPATH: rpath_off = dyn.d_un.d_val; have_rpath = 1; break;
+         case DT_RUNPATH: runpath_off = dyn.d_un.d_val; have_runpath = 1; break;
+      }
+   }
+   if (!strtab_addr || !strsz)
+      return 0;
+   if (vaddrToOffset(buffer, is64, &ehdr, strtab_addr, &strtab) == -1 || strtab + strsz > size) {
+      debug_printf3("Dynamic string table is not in the image\n");
+      return 0;
+   }
+
+   if (have_rpath)
+      deps->rpath = getDynString(buffer, strtab, strsz, rpath_off);
+   if (have_runpath)
+      deps->runpath = getDynString(buffer, strtab, strsz, runpath_off);
+   if (!num_needed)
+      return 0;
+
+   deps->needed = (const char **) malloc(num_needed * sizeof(char *));
+   if (!deps->needed) {
+      err_printf("Could not allocate space for %d needed entries\n", num_needed);
+      return -1;
+   }
+   for (pos = dyn_offset; pos + dyn_entsize <= dyn_offset + dyn_size; pos += dyn_entsize) {
+      if (is64)
+         memcpy(&dyn, buffer + pos, sizeof(dyn));
+      else {
+         memcpy(&dyn32, buffer + pos, sizeof(dyn32));
+         dyn.d_tag = dyn32.d_tag;
+         dyn.d_un.d_val = dyn32.d_un.d_val;
+      }
+      if (dyn.d_tag == DT_NULL)
+         break;
+      if (dyn.d_tag != DT_NEEDED)
+         continue;
+      name = getDynString(buffer, strtab, strsz, dyn.d_un.d_val);
+      if (name)
+         deps->needed[deps->num_needed++] = name;
+   }
+   return 0;
+}
+
+void elf_free_dependencies(elf_deps_t *deps)
+{
+   if (deps->needed)
+      free(deps->needed);
+   memset(deps, 0, sizeof(*deps));
+}
+
+/**
+ * Find the PLT relocations of an ELF image in memory that bind to one of
+ * names, for a PLT map.  Each match gives an entry with the relocation's
+ * offset and the index of its name.  *entries is malloced, and left NULL
+ * if there are no matches.  Returns 1 if the map is complete, which it is
+ * with no entries for an image without PLT relocations, or 0 if the image
+ * isn't ELF or its relocations can't be read.
+ **/
+int elf_read_pltmap(void *data, size_t size, const char **names, int num_names,
+                    pltmap_entry_t **entries, int *num_entries)
+{
+   unsigned char *buffer = (unsigned char *) data;
+   Elf64_Ehdr ehdr;
+   Elf64_Phdr phdr;
+   Elf64_Dyn dyn;
+   Elf32_Dyn dyn32;
+   Elf64_Addr strtab_addr = 0, symtab_addr = 0, jmprel_addr = 0;
+   Elf64_Xword strsz = 0, relsz = 0, symidx, offset;
+   uint32_t st_name;
+   size_t dyn_offset = 0, dyn_size = 0, dyn_entsize, rel_entsize, sym_entsize;
+   size_t strtab, symtab, jmprel, pos;
+   int is64, is_rela = 0, i, num = 0, max = 0;
+   const char *symname;
+   pltmap_entry_t *result = NULL, *newresult;
+
+   *entries = NULL;
+   *num_entries = 0;
+   if (size < EI_NIDENT || memcmp(buffer, ELFMAG, SELFMAG) != 0)
+      return 0;
+   if (buffer[EI_CLASS] != ELFCLASS32 && buffer[EI_CLASS] != ELFCLASS64)
+      return 0;
+   is64 = (buffer[EI_CLASS] == ELFCLASS64);
+   if (size < (is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr)))
+      return 0;
+   getEhdr(buffer, is64, &ehdr);
+   if (ehdr.e_phentsize < (is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)) ||
+       ehdr.e_phoff + (size_t) ehdr.e_phnum * ehdr.e_phentsize > size)
+      return 0;
+
+   for (i = 0; i < ehdr.e_phnum; i++) {
+      getPhdr(buffer + ehdr.e_phoff + i * ehdr.e_phentsize, is64, &phdr);
+      if (phdr.p_type == PT_DYNAMIC) {
+         dyn_offset = phdr.p_offset;
+         dyn_size = phdr.p_filesz;
+         break;
+      }
+   }
+   if (!dyn_size || dyn_offset + dyn_size > size)
+      return 0;
+
+   dyn_entsize = is64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+   for (pos = dyn_offset; pos + dyn_entsize <= dyn_offset + dyn_size; pos += dyn_entsize) {
+      if (is64)
+         memcpy(&dyn, buffer + pos, sizeof(dyn));
+      else {
+         memcpy(&dyn32, buffer + pos, sizeof(dyn32));
+         dyn.d_tag = dyn32.d_tag;
+         dyn.d_un.d_val = dyn32.d_un.d_val;
+      }
+      if (dyn.d_tag == DT_NULL)
+         break;
+      switch (dyn.d_tag) {
+         case DT_STRTAB: strtab_addr = dyn.d_un.d_ptr; break;
+         case DT_STRSZ: strsz = dyn.d_un.d_val; break;
+         case DT_SYMTAB: symtab_addr = dyn.d_un.d_ptr; break;
+         case DT_JMPREL: jmprel_addr = dyn.d_un.d_ptr; break;
+         case DT_PLTRELSZ: relsz = dyn.d_un.d_val; break;
+         case DT_PLTREL: is_rela = (dyn.d_un.d_val == DT_RELA); break;
+      }
+   }
+   if (!jmprel_addr || !relsz)
+      return 1;
+   if (!strtab_addr || !strsz || !symtab_addr)
+      return 0;
+   if (vaddrToOffset(buffer, is64, &ehdr, strtab_addr, &strtab) == -1 || strtab + strsz > size ||
+       vaddrToOffset(buffer, is64, &ehdr, symtab_addr, &symtab) == -1 ||
+       vaddrToOffset(buffer, is64, &ehdr, jmprel_addr, &jmprel) == -1 || jmprel + relsz > size) {
+      debug_printf3("PLT relocations are not in the image\n");
+      return 0;
+   }
+
+   if (is64)
+      rel_entsize = is_rela ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel);
+   else
+      rel_entsize = is_rela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+   sym_entsize = is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+
+   /* r_offset and r_info lead both Rel and Rela, and st_name leads Sym */
+   for (pos = jmprel; pos + rel_entsize <= jmprel + relsz; pos += rel_entsize) {
+      if (is64) {
+         Elf64_Rel rel;
+         memcpy(&rel, buffer + pos, sizeof(rel));
+         offset = rel.r_offset;
+         symidx = ELF64_R_SYM(rel.r_info);
+      }
+      else {
+         Elf32_Rel rel;
+         memcpy(&rel, buffer + pos, sizeof(rel));
+         offset = rel.r_offset;
+         symidx = ELF32_R_SYM(rel.r_info);
+      }
+      if (symtab + (symidx + 1) * sym_entsize > size)
+         break;
+      memcpy(&st_name, buffer + symtab + symidx * sym_entsize, sizeof(st_name));
+      symname = getDynString(buffer, strtab, strsz, st_name);
+      if (!symname)
+         break;
+
+      for (i = 0; i < num_names; i++) {
+         if (symname[0] == names[i][0] && strcmp(symname, names[i]) == 0)
+            break;
+      }
+      if (i == num_names)
+         continue;
+
+      if (num == max) {
+         max = max ? max * 2 : 16;
+         newresult = (pltmap_entry_t *) realloc(result, max * sizeof(pltmap_entry_t));
+         if (!newresult) {
+            err_printf("Could not allocate space for %d PLT map entries\n", max);
+            free(result);
+            return -1;
+         }
+         result = newresult;
+      }
+      result[num].offset = offset;
+      result[num].name = (uint32_t) i;
+      result[num].pad = 0;
+      num++;
+   }
+
+   if (pos + rel_entsize <= jmprel + relsz) {
+      debug_printf3("PLT relocation refers to a symbol that is not in the image\n");
+      free(result);
+      return 0;
+   }
+
+   *entries = result;
+   *num_entries = num;
+   return 1;
+}
@@ -18,6 +18,27 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #define LDCS_ELF_READ_H_
 
 #include <stdio.h>
-int read_file_and_strip(FILE *f, void *data, size_t *size, int strip);
+#include "ldcs_pltmap.h"
+int read_file_and_strip(int fd, int direct_fd, void *data, size_t *size, int strip);
+
+/* With --sparse-files, read only the data extents of files with holes */
+void elf_read_skip_holes(int on);
+
+/**
+ * The dynamic linking entries of an ELF image in memory.  The strings
+ * point into the image; rpath and runpath are NULL if not present.
+ **/
+typedef struct {
+   const char **needed;
+   int num_needed;
+   const char *rpath;
+   const char *runpath;
+} elf_deps_t;
+
+int elf_read_dependencies(void *data, size_t size, elf_deps_t *deps);
+void elf_free_dependencies(elf_deps_t *deps);
+
+int elf_read_pltmap(void *data, size_t size, const char **names, int num_names,
+                    pltmap_entry_t **entries, int *num_entries);
 
 #endif
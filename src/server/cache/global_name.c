@@ -15,99 +15,156 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include "ldcs_audit_server_filemngt.h"
 #include "spindle_debug.h"
 #include "global_name.h"
+#include "name_intern.h"
+
+/**
+ * Bidirectional map between the local names of staged files and the
+ * global paths they were copied from.  Every mapping sits on two hash
+ * chains, one keyed by the interned local file name (the part after the
+ * tmpdir) and one keyed by the interned global name.  Names are never
+ * parsed for the counter filemngt_calc_localname puts in them, so the
+ * map keeps working no matter how large that counter grows across a
+ * session.
+ **/
+
+#define INITIAL_GLOBAL_NAME_TABLE_SIZE 1024
 
-#define INITIAL_GLOBAL_NAME_ARRAY_SIZE (10*1024)
 typedef struct global_name_entry_t
 {
-   char *global_name;
+   const char *local_name;    /* local file name, without the tmpdir */
+   const char *global_name;   /* global path with a leading '*' */
+   struct global_name_entry_t *next_local;
+   struct global_name_entry_t *next_global;
 } global_name_entry_t;
 
-static global_name_entry_t *global_name_array;
-static size_t current_global_name_array_size = INITIAL_GLOBAL_NAME_ARRAY_SIZE;
-static size_t hiwat_global_name_array_size;
-static size_t global_name_array_index;
+static global_name_entry_t **local_table;
+static global_name_entry_t **global_table;
+static size_t global_name_table_size;
+static size_t global_name_count;
+
+static size_t bucket(const char *interned)
+{
+   return intern_name_hash(interned) & (global_name_table_size - 1);
+}
+
+static const char *starred_name(const char *pathname)
+{
+  char path[MAX_PATH_LEN+1];
+  if (*pathname == '*')
+    return intern_name(pathname);
+  snprintf(path, sizeof(path), "*%s", pathname);
+  return intern_name(path);
+}
+
+static const char *lookup_starred_name(const char *pathname)
+{
+  char path[MAX_PATH_LEN+1];
+  if (*pathname == '*')
+    return lookup_intern_name(pathname);
+  snprintf(path, sizeof(path), "*%s", pathname);
+  return lookup_intern_name(path);
+}
 
 int init_global_name_list()
 {
-  global_name_array_index = 0;
-  current_global_name_array_size = INITIAL_GLOBAL_NAME_ARRAY_SIZE;
-  hiwat_global_name_array_size = (current_global_name_array_size * 8) / 10;
-  global_name_array = (global_name_entry_t *)malloc(sizeof(global_name_entry_t) * current_global_name_array_size);
-  assert(global_name_array);
+  global_name_count = 0;
+  global_name_table_size = INITIAL_GLOBAL_NAME_TABLE_SIZE;
+  local_table = (global_name_entry_t **) calloc(global_name_table_size, sizeof(global_name_entry_t *));
+  global_table = (global_name_entry_t **) calloc(global_name_table_size, sizeof(global_name_entry_t *));
+  assert(local_table && global_table);
 
   return 0;
 }
 
 void grow_global_name_list()
 {
-  current_global_name_array_size *= 2;
-  hiwat_global_name_array_size = (current_global_name_array_size * 8) / 10;
-  global_name_array = (global_name_entry_t *)realloc(global_name_array, sizeof(global_name_entry_t) * current_global_name_array_size);
-  assert(global_name_array);
+  global_name_entry_t **old_local = local_table;
+  global_name_entry_t *entry, *next;
+  size_t i, old_size = global_name_table_size;
+
+  global_name_table_size *= 2;
+  free(global_table);
+  local_table = (global_name_entry_t **) calloc(global_name_table_size, sizeof(global_name_entry_t *));
+  global_table = (global_name_entry_t **) calloc(global_name_table_size, sizeof(global_name_entry_t *));
+  assert(local_table && global_table);
+
+  for (i = 0; i < old_size; i++) {
+    for (entry = old_local[i]; entry != NULL; entry = next) {
+      next = entry->next_local;
+      entry->next_local = local_table[bucket(entry->local_name)];
+      local_table[bucket(entry->local_name)] = entry;
+      entry->next_global = global_table[bucket(entry->global_name)];
+      global_table[bucket(entry->global_name)] = entry;
+    }
+  }
+  free(old_local);
 }
 
-void add_global_name(char* pathname, char* localpath) 
+static global_name_entry_t *find_by_local(const char *local_name)
 {
-  if (lookup_global_name(localpath) != NULL) {
-    debug_printf3("%s already present in global name cache\n", localpath);
-    return;
+  global_name_entry_t *entry;
+  for (entry = local_table[bucket(local_name)]; entry != NULL; entry = entry->next_local) {
+    if (entry->local_name == local_name)
+      return entry;
   }
+  return NULL;
+}
 
-  char path[MAX_PATH_LEN+1];
-
-  sprintf(path, "%s%s", (*pathname == '*') ? "" : "*", pathname);
-
-  debug_printf3("Adding %s, %s, index=%lx\n", localpath, path, global_name_array_index);
-
-  if (global_name_array_index > hiwat_global_name_array_size)
-    grow_global_name_list();
-
-  global_name_array[global_name_array_index++].global_name = strdup(path);
+static global_name_entry_t *find_by_global(const char *global_name)
+{
+  global_name_entry_t *entry;
+  for (entry = global_table[bucket(global_name)]; entry != NULL; entry = entry->next_global) {
+    if (entry->global_name == global_name)
+      return entry;
+  }
+  return NULL;
 }
 
-static int get_global_file_index(char* file)
+void add_global_name(char* pathname, char* localpath) 
 {
-  char buf[MAX_PATH_LEN];
-  int len = strlen(file);
-  int cnt;
-  int rval;
-  int val;
-
-  assert("Filename length too large" && len < MAX_PATH_LEN);
-  
-  for (cnt = 0; cnt < len; ++cnt) {
-    if (file[cnt] == '-' && cnt > 0)
-      break;
-
-    if ( ! isxdigit(file[cnt]) ) {
-      return -1;
-    }
+  global_name_entry_t *entry;
+  const char *local_name, *global_name;
+  char *fname = ldcs_is_a_localfile(localpath);
 
-    buf[cnt] = file[cnt];
+  if (fname == NULL) {
+    err_printf("Asked to map %s to %s, which is not a local name\n", pathname, localpath);
+    return;
   }
-  if (cnt == 0)
-    return -1;
+  local_name = intern_name(fname);
+  if (find_by_local(local_name) != NULL) {
+    debug_printf3("%s already present in global name cache\n", localpath);
+    return;
+  }
+  global_name = starred_name(pathname);
 
-  buf[cnt] = '\0';
+  debug_printf3("Adding %s, %s\n", localpath, global_name);
 
-  rval = sscanf(buf, "%x", &val);
-  assert(rval == 1);
+  if (global_name_count * 4 > global_name_table_size * 3)
+    grow_global_name_list();
 
-  return val;
+  entry = (global_name_entry_t *) malloc(sizeof(global_name_entry_t));
+  assert(entry);
+  entry->local_name = local_name;
+  entry->global_name = global_name;
+  entry->next_local = local_table[bucket(local_name)];
+  local_table[bucket(local_name)] = entry;
+  entry->next_global = global_table[bucket(global_name)];
+  global_table[bucket(global_name)] = entry;
+  global_name_count++;
 }
 
 char* lookup_global_name(char* localpath)
 {
   char *fname = ldcs_is_a_localfile(localpath);
+  const char *local_name;
+  global_name_entry_t *entry;
   char *rval;
-  int index;
 
   debug_printf3("localpath=%s\n", localpath);
   if (fname == NULL) {
@@ -115,15 +172,44 @@ char* lookup_global_name(char* localpath)
     return NULL;      /* Not a local name */
   }
 
-  index = get_global_file_index(fname);
-
-  if (index >= global_name_array_index) {
+  local_name = lookup_intern_name(fname);
+  entry = local_name ? find_by_local(local_name) : NULL;
+  if (!entry) {
     debug_printf3("%s is not yet in global_name_cache\n", fname);
     return NULL;
   }
 
-  rval = (*localpath == '*') ? global_name_array[index].global_name : global_name_array[index].global_name+1;
+  rval = (char *) ((*localpath == '*') ? entry->global_name : entry->global_name+1);
 
-  debug_printf3("global name %s for local name %s found at index %x\n", rval, localpath, index);
+  debug_printf3("global name %s for local name %s\n", rval, localpath);
   return rval;
 }
+
+const char *lookup_local_name(char *pathname)
+{
+  const char *global_name = lookup_starred_name(pathname);
+  global_name_entry_t *entry = global_name ? find_by_global(global_name) : NULL;
+  return entry ? entry->local_name : NULL;
+}
+
+int remove_global_name(char *localpath)
+{
+  global_name_entry_t **cur, *entry;
+  const char *local_name;
+  char *fname = ldcs_is_a_localfile(localpath);
+
+  if (!fname || !(local_name = lookup_intern_name(fname)))
+    return -1;
+  if (!(entry = find_by_local(local_name)))
+    return -1;
+
+  for (cur = local_table + bucket(local_name); *cur != entry; cur = &(*cur)->next_local);
+  *cur = entry->next_local;
+  for (cur = global_table + bucket(entry->global_name); *cur != entry; cur = &(*cur)->next_global);
+  *cur = entry->next_global;
+
+  debug_printf3("Removed global name mapping for %s\n", localpath);
+  free(entry);
+  global_name_count--;
+  return 0;
+}
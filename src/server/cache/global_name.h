@@ -23,4 +23,8 @@ int init_global_name_list(void);
 void grow_global_name_list(void);
 void add_global_name(char* pathname, char* localpath);
 char* lookup_global_name(char* localpath);
+
+/* Returns the local file name (relative to the tmpdir) for a global path */
+const char *lookup_local_name(char *pathname);
+int remove_global_name(char *localpath);
 #endif
@@ -19,7 +19,11 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
 #include <dirent.h>
 
 #include <stddef.h>
@@ -27,6 +31,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_api.h"
 #include "ldcs_cache.h"
 #include "ldcs_hash.h"
+#include "name_intern.h"
 
 ldcs_cache_result_t ldcs_cache_findDirInCache(char *dirname) {
    struct ldcs_hash_entry_t *e = ldcs_hash_Lookup(dirname);
@@ -70,18 +75,213 @@ ldcs_cache_result_t ldcs_cache_processDirectory(char *dirname, size_t *bytesread
   return(ldcs_cache_findDirInCache(dirname));
 }
 
+/**
+ * Called once a directory's full listing is in the cache, either from
+ * disk or from the network.  Builds the directory's negative-lookup
+ * filter.
+ **/
+void ldcs_cache_finishDirectory(char *dirname)
+{
+   ldcs_hash_buildDirFilter(dirname);
+}
+
+/**
+ * Returns 0 if the directory filter proves filename is absent, 1 if
+ * it may be present, and -1 if dirname has no filter yet.
+ **/
+int ldcs_cache_dirFilterCheck(char *filename, char *dirname)
+{
+   return ldcs_hash_dirFilterCheck(dirname, filename);
+}
+
+/**
+ * Directories with more names than this are kept sparse: the cache and
+ * the packets we send hold a filter of the names rather than the names,
+ * and each name is looked up on its own when it's asked for.  Set from
+ * SPINDLE_SPARSE_DIR in ldcs_cache_init, where 0 turns it off.
+ **/
+#define SPARSE_DIR_DEFAULT_LIMIT 65536
+static size_t sparse_dir_limit = SPARSE_DIR_DEFAULT_LIMIT;
+
+static int is_sparse_listing(size_t count)
+{
+   return sparse_dir_limit && count > sparse_dir_limit;
+}
+
+/**
+ * Returns true if dirname is in the cache as a sparse directory.  Names
+ * it has that aren't in the cache haven't been looked up yet, so its
+ * listing can't be taken as complete.
+ **/
+int ldcs_cache_isSparseDir(char *dirname)
+{
+   return ldcs_hash_isSparseDir(dirname);
+}
+
+/**
+ * Staged files sit on an LRU list so they can be dropped when the
+ * staging area goes over its byte budget.  An entry is on the list
+ * exactly when it has a local copy, and staged_bytes is the sum of
+ * their buffer sizes.
+ **/
+static struct ldcs_hash_entry_t *lru_head = NULL;
+static struct ldcs_hash_entry_t *lru_tail = NULL;
+static size_t staged_bytes = 0;
+static size_t staged_budget = 0;
+static int read_links = 0;
+static ldcs_cache_remap_cb_t remap_cb = NULL;
+
+static int lru_linked(struct ldcs_hash_entry_t *e)
+{
+   return e->lru_prev || lru_head == e;
+}
+
+static void lru_unlink(struct ldcs_hash_entry_t *e)
+{
+   if (!lru_linked(e))
+      return;
+   if (e->lru_prev)
+      e->lru_prev->lru_next = e->lru_next;
+   else
+      lru_head = e->lru_next;
+   if (e->lru_next)
+      e->lru_next->lru_prev = e->lru_prev;
+   else
+      lru_tail = e->lru_prev;
+   e->lru_prev = e->lru_next = NULL;
+   staged_bytes -= e->buffer_size;
+}
+
+static void lru_push(struct ldcs_hash_entry_t *e)
+{
+   e->lru_prev = NULL;
+   e->lru_next = lru_head;
+   if (lru_head)
+      lru_head->lru_prev = e;
+   lru_head = e;
+   if (!lru_tail)
+      lru_tail = e;
+   staged_bytes += e->buffer_size;
+}
+
+static void drop_compressed(struct ldcs_hash_entry_t *e)
+{
+   if (e->zbuffer)
+      free(e->zbuffer);
+   e->zbuffer = NULL;
+   e->zsize = 0;
+   e->ztried = 0;
+}
+
+static void lru_touch(struct ldcs_hash_entry_t *e)
+{
+   if (!lru_linked(e) || lru_head == e)
+      return;
+   lru_unlink(e);
+   lru_push(e);
+}
+
 ldcs_cache_result_t ldcs_cache_updateEntry(char *filename, char *dirname, 
                                            char *localname, void *buffer, size_t buffer_size, int errcode)
 {
-   struct ldcs_hash_entry_t *e = ldcs_hash_updateEntry(filename, dirname, localname, buffer, buffer_size, errcode);
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (e) {
+      lru_unlink(e);
+      drop_compressed(e);
+   }
+   else if (ldcs_hash_isSparseDir(dirname)) {
+      /* The first lookup of this name in a sparse directory */
+      ldcs_hash_addEntryType(dirname, filename, DT_UNKNOWN);
+   }
+   e = ldcs_hash_updateEntry(filename, dirname, localname, buffer, buffer_size, errcode);
    if(e) { 
       e->ostate = LDCS_CACHE_OBJECT_STATUS_LOCAL_PATH;
+      if (localname && buffer && !errcode)
+         lru_push(e);
       return(LDCS_CACHE_FILE_FOUND);
    }
    else
       return(LDCS_CACHE_FILE_NOT_FOUND);
 }
 
+void ldcs_cache_setBudget(size_t bytes)
+{
+   staged_budget = bytes;
+}
+
+void ldcs_cache_setReadLinks(int enable)
+{
+   read_links = enable;
+}
+
+void ldcs_cache_setLinkTarget(char *filename, char *dirname, const char *target)
+{
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (e && e->d_type == DT_LNK)
+      e->link_target = intern_name(target);
+}
+
+size_t ldcs_cache_stagedBytes()
+{
+   return staged_bytes;
+}
+
+/**
+ * Pin a staged file while a client may still have it open.  Returns a
+ * handle for ldcs_cache_unpinEntry, or NULL if the file isn't staged.
+ **/
+void *ldcs_cache_pinEntry(char *filename, char *dirname)
+{
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (!e || !lru_linked(e))
+      return NULL;
+   e->pins++;
+   lru_touch(e);
+   return (void *) e;
+}
+
+void ldcs_cache_unpinEntry(void *handle)
+{
+   struct ldcs_hash_entry_t *e = (struct ldcs_hash_entry_t *) handle;
+   assert(e->pins > 0);
+   e->pins--;
+}
+
+/**
+ * Evict unpinned staged files, least recently used first, until needed
+ * more bytes fit in the budget.  cb releases each file's local copy; the
+ * cache entry stays, so a later request fetches the file again.
+ * Returns the number of bytes freed.
+ **/
+size_t ldcs_cache_makeRoom(size_t needed, ldcs_cache_evict_cb_t cb, void *arg)
+{
+   struct ldcs_hash_entry_t *e, *prev;
+   size_t freed = 0;
+
+   if (!staged_budget)
+      return 0;
+
+   for (e = lru_tail; e && staged_bytes + needed > staged_budget; e = prev) {
+      prev = e->lru_prev;
+      if (e->pins)
+         continue;
+      debug_printf2("Evicting %s/%s (%lu bytes) from the staging area\n", e->dirname, e->filename,
+                    (unsigned long) e->buffer_size);
+      lru_unlink(e);
+      freed += e->buffer_size;
+      cb(e->localpath, e->buffer, e->buffer_size, arg);
+      drop_compressed(e);
+      e->localpath = NULL;
+      e->buffer = NULL;
+      e->buffer_size = 0;
+      e->ostate = LDCS_CACHE_OBJECT_STATUS_NOT_SET;
+   }
+   if (staged_bytes + needed > staged_budget)
+      debug_printf("Staging area is over budget (%lu + %lu > %lu bytes), remaining files are pinned\n",
+                   (unsigned long) staged_bytes, (unsigned long) needed, (unsigned long) staged_budget);
+   return freed;
+}
+
 ldcs_cache_result_t ldcs_cache_updateStatus(char *filename, char *dirname, ldcs_hash_object_status_t ostate) {
   struct ldcs_hash_entry_t *e = ldcs_hash_updateEntryOState(filename, dirname, (int) ostate);
   if(e) {     return(LDCS_CACHE_FILE_FOUND);   } 
@@ -94,6 +294,31 @@ ldcs_hash_object_status_t ldcs_cache_getStatus(char *filename) {
   else  {    return(LDCS_CACHE_OBJECT_STATUS_UNKNOWN); }
 }
 
+void ldcs_cache_setRemap(ldcs_cache_remap_cb_t cb)
+{
+   remap_cb = cb;
+}
+
+/**
+ * Stop keeping a staged file mapped.  It stays staged, and its size still
+ * counts against the budget.  Returns the buffer for the caller to unmap
+ * and sets *size, or returns NULL if the file isn't staged and mapped.
+ * The compressed copy kept for the tree goes too.
+ **/
+void *ldcs_cache_releaseBuffer(char *filename, char *dirname, size_t *size)
+{
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   void *buffer;
+
+   if (!e || !e->buffer || !lru_linked(e))
+      return NULL;
+   buffer = e->buffer;
+   *size = e->buffer_size;
+   e->buffer = NULL;
+   drop_compressed(e);
+   return buffer;
+}
+
 int ldcs_cache_get_buffer(char *dirname, char *filename, void **buffer, size_t *size)
 {
    struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
@@ -101,85 +326,435 @@ int ldcs_cache_get_buffer(char *dirname, char *filename, void **buffer, size_t *
       return -1;
    }
 
+   /* A staged file without a buffer had its mapping released */
+   if (!e->buffer && e->localpath && lru_linked(e) && remap_cb) {
+      debug_printf2("Mapping released file %s/%s again\n", dirname, filename);
+      e->buffer = remap_cb(e->localpath, e->buffer_size);
+   }
    *buffer = e->buffer;
    *size = e->buffer_size;
+   lru_touch(e);
    return 0;
 }
 
-#define INITIAL_BUFFER_SIZE 4096
-int ldcs_cache_getNewEntriesForDir(char *dir, char **data, int *len)
+/**
+ * Look up the compressed copy of a staged file that we kept for sending
+ * to other servers.  Returns 1 if compression was already tried, with
+ * zbuffer set to NULL if the file didn't compress, or 0 if not yet tried.
+ **/
+int ldcs_cache_getCompressed(char *filename, char *dirname, void **zbuffer, size_t *zsize)
 {
-   char *buffer = NULL;
-   size_t buffer_size = 0;
-   size_t cur_pos = 0;
-   int first_pass = 1;
-   int num_entries = 0;
-   struct ldcs_hash_entry_t *i;
-   
-   for (i = ldcs_hash_getFirstEntryForDir(dir); i != NULL; i = ldcs_hash_getNextEntryForDir(i)) {
-      int length_fn = i->filename ? strlen(i->filename)+1 : 0;
-      int length_dir = first_pass ? strlen(dir)+1 : 0;
-      unsigned int space_needed = length_fn + length_dir + sizeof(int)*2;
-      if (cur_pos + space_needed >= buffer_size) {
-         while (cur_pos + space_needed >= buffer_size)
-            buffer_size = !buffer_size ? INITIAL_BUFFER_SIZE : (buffer_size*2);
-         buffer = realloc(buffer, buffer_size);
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (!e || !e->ztried)
+      return 0;
+   *zbuffer = e->zbuffer;
+   *zsize = e->zsize;
+   return 1;
+}
+
+/**
+ * Keep a compressed copy of a file, or record with a NULL zbuffer that it
+ * didn't compress.  The cache takes ownership of zbuffer, which must be
+ * malloc'd.  Returns -1 if the file has no cache entry.
+ **/
+int ldcs_cache_setCompressed(char *filename, char *dirname, void *zbuffer, size_t zsize)
+{
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (!e)
+      return -1;
+   drop_compressed(e);
+   e->zbuffer = zbuffer;
+   e->zsize = zbuffer ? zsize : 0;
+   e->ztried = 1;
+   return 0;
+}
+
+/**
+ * Directory packets come in two formats.  The legacy format is a list
+ * of [int len][filename][int len][dirname] pairs, where the dirname is
+ * only spelled out in the first pair.
+ *
+ * The compact format, which is what we send, starts with a negative
+ * marker that can't begin a legacy packet:
+ *   [int DIRPACKET_COMPACT_V1][unsigned char flags]
+ *   [varint dirname_len][dirname\0][varint num_entries]
+ * followed by each entry, with filenames sorted and front-coded
+ * against the previous name:
+ *   [varint shared_prefix_len][varint suffix_len][suffix][d_type]
+ * The d_type byte is only present if DIRPACKET_HAS_DTYPE is set.  If
+ * DIRPACKET_HAS_LINKS is set, each DT_LNK entry is followed by
+ *   [varint target_len][target]
+ * where a target_len of 0 means the target wasn't read.  An entry
+ * count of 0 means the directory is empty or doesn't exist, unless
+ * DIRPACKET_SPARSE is set.  Then it's a sparse directory, and the count
+ * is followed by its filter instead of entries:
+ *   [varint filter_bits][filter_bits / 8 bytes of filter]
+ **/
+#define DIRPACKET_COMPACT_V1 -2
+#define DIRPACKET_HAS_DTYPE 0x1
+#define DIRPACKET_HAS_LINKS 0x2
+#define DIRPACKET_SPARSE 0x4
+
+static size_t put_varint(unsigned char *buffer, size_t val)
+{
+   size_t len = 0;
+   while (val >= 0x80) {
+      buffer[len++] = (unsigned char) (val | 0x80);
+      val >>= 7;
+   }
+   buffer[len++] = (unsigned char) val;
+   return len;
+}
+
+static size_t get_varint(dirbuffer_iterator_t *dpos)
+{
+   size_t val = 0;
+   int shift = 0;
+   unsigned char c;
+   do {
+      assert(dpos->pos < dpos->buffer_size);
+      c = (unsigned char) dpos->buffer[dpos->pos++];
+      val |= ((size_t) (c & 0x7f)) << shift;
+      shift += 7;
+   } while (c & 0x80);
+   return val;
+}
+
+typedef struct {
+   const char *name;
+   unsigned char d_type;
+   const char *target;
+} dir_name_t;
+
+static int dir_name_cmp(const void *a, const void *b)
+{
+   return strcmp(((const dir_name_t *) a)->name, ((const dir_name_t *) b)->name);
+}
+
+/* Encode names, which must already be sorted, into a compact packet */
+static void encode_dir_packet(const char *dir, dir_name_t *names, size_t num_entries, char **data, int *len)
+{
+   unsigned char *buffer, flags = 0;
+   size_t dir_len = strlen(dir), buffer_size, cur_pos = 0;
+   size_t j, k, name_len, prev_len = 0, shared;
+   int marker = DIRPACKET_COMPACT_V1;
+   const char *prev = "";
+
+   buffer_size = sizeof(int) + 1 + 10 + dir_len + 1 + 10;
+   for (j = 0; j < num_entries; j++) {
+      buffer_size += 10 + 10 + strlen(names[j].name) + 1;
+      if (names[j].d_type)
+         flags |= DIRPACKET_HAS_DTYPE;
+      if (names[j].target) {
+         buffer_size += 10 + strlen(names[j].target);
+         flags |= DIRPACKET_HAS_LINKS;
       }
+   }
+
+   buffer = (unsigned char *) malloc(buffer_size);
+   memcpy(buffer + cur_pos, &marker, sizeof(marker));
+   cur_pos += sizeof(marker);
+   buffer[cur_pos++] = flags;
+   cur_pos += put_varint(buffer + cur_pos, dir_len);
+   memcpy(buffer + cur_pos, dir, dir_len + 1);
+   cur_pos += dir_len + 1;
+   cur_pos += put_varint(buffer + cur_pos, num_entries);
+
+   for (j = 0; j < num_entries; j++) {
+      const char *name = names[j].name;
+      name_len = strlen(name);
+      assert(name_len <= LDCS_CACHE_MAX_NAME_LEN);
+      for (shared = 0; shared < prev_len && shared < name_len && prev[shared] == name[shared]; shared++);
+      cur_pos += put_varint(buffer + cur_pos, shared);
+      cur_pos += put_varint(buffer + cur_pos, name_len - shared);
+      for (k = shared; k < name_len; k++)
+         buffer[cur_pos++] = name[k];
+      if (flags & DIRPACKET_HAS_DTYPE)
+         buffer[cur_pos++] = names[j].d_type;
+      if ((flags & DIRPACKET_HAS_LINKS) && names[j].d_type == DT_LNK) {
+         k = names[j].target ? strlen(names[j].target) : 0;
+         cur_pos += put_varint(buffer + cur_pos, k);
+         if (k)
+            memcpy(buffer + cur_pos, names[j].target, k);
+         cur_pos += k;
+      }
+      prev = name;
+      prev_len = name_len;
+   }
+   assert(cur_pos <= buffer_size);
 
-      memcpy(buffer + cur_pos, &length_fn, sizeof(int));
-      cur_pos += sizeof(int);
-      if (length_fn)
-         strncpy(buffer + cur_pos, i->filename, length_fn);
-      cur_pos += length_fn;
+   debug_printf3("Encoded packet for directory with %lu entries in %lu bytes: %s\n",
+                 (unsigned long) num_entries, (unsigned long) cur_pos, dir);
 
-      memcpy(buffer + cur_pos, &length_dir, sizeof(int));
-      cur_pos += sizeof(int);
-      if (length_dir)
-         strncpy(buffer + cur_pos, dir, length_dir);
-      cur_pos += length_dir;
+   *data = (char *) buffer;
+   *len = cur_pos;
+}
+
+/* Encode a sparse directory's filter into a compact packet */
+static void encode_sparse_packet(const char *dir, unsigned char *filter, unsigned int mask, char **data, int *len)
+{
+   unsigned char *buffer;
+   size_t dir_len = strlen(dir), filter_len = (mask + 1) / 8, cur_pos = 0;
+   int marker = DIRPACKET_COMPACT_V1;
 
-      first_pass = 0;
+   buffer = (unsigned char *) malloc(sizeof(int) + 1 + 10 + dir_len + 1 + 10 + 10 + filter_len);
+   memcpy(buffer + cur_pos, &marker, sizeof(marker));
+   cur_pos += sizeof(marker);
+   buffer[cur_pos++] = DIRPACKET_SPARSE;
+   cur_pos += put_varint(buffer + cur_pos, dir_len);
+   memcpy(buffer + cur_pos, dir, dir_len + 1);
+   cur_pos += dir_len + 1;
+   cur_pos += put_varint(buffer + cur_pos, 0);
+   cur_pos += put_varint(buffer + cur_pos, (size_t) mask + 1);
+   memcpy(buffer + cur_pos, filter, filter_len);
+   cur_pos += filter_len;
+
+   debug_printf3("Encoded packet for sparse directory with a %lu byte filter: %s\n",
+                 (unsigned long) filter_len, dir);
+
+   *data = (char *) buffer;
+   *len = cur_pos;
+}
+
+/* Build the filter of a sparse directory from its listing */
+static unsigned char *listing_filter(dir_listing_t *listing, unsigned int *mask)
+{
+   unsigned int nbits = ldcs_hash_dirFilterBits(listing->count);
+   unsigned char *filter;
+   size_t i;
+
+   filter = (unsigned char *) calloc(nbits / 8, 1);
+   if (!filter)
+      return NULL;
+   *mask = nbits - 1;
+   for (i = 0; i < listing->count; i++)
+      ldcs_hash_dirFilterAdd(filter, *mask, listing->names + listing->offsets[i]);
+   return filter;
+}
+
+int ldcs_cache_getNewEntriesForDir(char *dir, char **data, int *len)
+{
+   struct ldcs_hash_entry_t *i;
+   dir_name_t *names = NULL;
+   size_t num_entries = 0;
+   unsigned char *filter;
+   unsigned int mask;
+
+   if (ldcs_hash_isSparseDir(dir)) {
+      /* Names we've looked up go out as files, not as part of the listing */
+      filter = ldcs_hash_getDirFilter(dir, &mask);
+      assert(filter);
+      encode_sparse_packet(dir, filter, mask, data, len);
+      return 0;
+   }
+
+   for (i = ldcs_hash_getFirstEntryForDir(dir); i != NULL; i = ldcs_hash_getNextEntryForDir(i))
       num_entries++;
+
+   if (num_entries) {
+      names = (dir_name_t *) malloc(sizeof(*names) * num_entries);
+      num_entries = 0;
+      for (i = ldcs_hash_getFirstEntryForDir(dir); i != NULL; i = ldcs_hash_getNextEntryForDir(i)) {
+         names[num_entries].name = i->filename;
+         names[num_entries].d_type = i->d_type;
+         names[num_entries].target = i->link_target;
+         num_entries++;
+      }
+      qsort(names, num_entries, sizeof(*names), dir_name_cmp);
    }
 
-   if (!buffer) {
-      debug_printf3("Encoded packet for non-existant directory: %s\n", dir);
-      /* Directory does not exist, or contains 0 files */
-      int len = strlen(dir) + 1;
-      int neg_one = -1;
-      buffer = (char *) malloc(sizeof(len) + len + sizeof(neg_one));
+   encode_dir_packet(dir, names, num_entries, data, len);
+
+   if (names)
+      free(names);
+   return 0;
+}
 
-      memcpy(buffer + cur_pos, &len, sizeof(len));
-      cur_pos += sizeof(len);
-      
-      memcpy(buffer + cur_pos, dir, len);
-      cur_pos += len;
+/**
+ * Encode a listing read by ldcs_cache_scanDirectory.  Like the scanner,
+ * this does not touch the cache.
+ **/
+int ldcs_cache_encodeListing(const char *dir, dir_listing_t *listing, char **data, int *len)
+{
+   dir_name_t *names = NULL;
+   unsigned char *filter;
+   unsigned int mask;
+   size_t j;
 
-      memcpy(buffer + cur_pos, &neg_one, sizeof(neg_one));
-      cur_pos += sizeof(neg_one);
+   if (is_sparse_listing(listing->count)) {
+      filter = listing_filter(listing, &mask);
+      if (!filter)
+         return -1;
+      encode_sparse_packet(dir, filter, mask, data, len);
+      free(filter);
+      return 0;
    }
-   else {
-      debug_printf3("Encoded packet for directory with %d entries: %s\n", num_entries, dir);
+
+   if (listing->count) {
+      names = (dir_name_t *) malloc(sizeof(*names) * listing->count);
+      if (!names)
+         return -1;
+      for (j = 0; j < listing->count; j++) {
+         names[j].name = listing->names + listing->offsets[j];
+         names[j].d_type = listing->types[j];
+         names[j].target = listing->targets[j] != LISTING_NO_TARGET ? listing->names + listing->targets[j] : NULL;
+      }
+      qsort(names, listing->count, sizeof(*names), dir_name_cmp);
    }
 
-   *data = buffer;
-   *len = cur_pos;
+   encode_dir_packet(dir, names, listing->count, data, len);
 
+   if (names)
+      free(names);
    return 0;
 }
 
+/**
+ * Add every entry of a directory packet to the cache, unless the
+ * directory is already there.  Returns the directory name, which
+ * points into data.
+ **/
+char *ldcs_cache_storeDirPacket(char *data, int len, int *already_cached)
+{
+   dirbuffer_iterator_t pos;
+   char *filename, *dirname, *dir = NULL;
+   unsigned char *filter;
+
+   *already_cached = 0;
+   foreach_filedir(data, len, pos, filename, dirname) {
+      assert(dir == NULL || dir == dirname); /* One directory per packet for now */
+      if (!dir) {
+         dir = dirname;
+         if (ldcs_cache_findDirInCache(dir) != LDCS_CACHE_DIR_NOT_PARSED) {
+            debug_printf3("Directory %s already in cache, dropping packet\n", dir);
+            *already_cached = 1;
+            return dir;
+         }
+      }
+      if (dirname && !filename && pos.filter) {
+         filter = (unsigned char *) malloc(pos.filter_mask / 8 + 1);
+         assert(filter);
+         memcpy(filter, pos.filter, pos.filter_mask / 8 + 1);
+         ldcs_hash_setSparseDir(dirname, filter, pos.filter_mask);
+         continue;
+      }
+      if (dirname && !filename) {
+         addEmptyDirectory(dirname);
+         continue;
+      }
+      ldcs_cache_addFileDirType(dirname, filename, pos.d_type);
+      if (pos.link_target)
+         ldcs_cache_setLinkTarget(filename, dirname, pos.link_target);
+   }
+   if (dir)
+      ldcs_cache_finishDirectory(dir);
+   return dir;
+}
+
+static void ldcs_cache_parseCompactEntry(dirbuffer_iterator_t *dpos, char **fname, char **dname)
+{
+   size_t shared, suffix;
+
+   if (!dpos->entries_left) {
+      *fname = NULL;
+      *dname = NULL;
+      dpos->done = 1;
+      return;
+   }
+   dpos->entries_left--;
+
+   shared = get_varint(dpos);
+   suffix = get_varint(dpos);
+   assert(shared + suffix <= LDCS_CACHE_MAX_NAME_LEN);
+   assert(dpos->pos + suffix <= dpos->buffer_size);
+   memcpy(dpos->cur_name + shared, dpos->buffer + dpos->pos, suffix);
+   dpos->cur_name[shared + suffix] = '\0';
+   dpos->pos += suffix;
+   if (dpos->has_dtype) {
+      assert(dpos->pos < dpos->buffer_size);
+      dpos->d_type = (unsigned char) dpos->buffer[dpos->pos++];
+   }
+   dpos->link_target = NULL;
+   if (dpos->has_links && dpos->d_type == DT_LNK) {
+      suffix = get_varint(dpos);
+      assert(suffix <= LDCS_CACHE_MAX_LINK_LEN);
+      assert(dpos->pos + suffix <= dpos->buffer_size);
+      if (suffix) {
+         memcpy(dpos->cur_target, dpos->buffer + dpos->pos, suffix);
+         dpos->cur_target[suffix] = '\0';
+         dpos->link_target = dpos->cur_target;
+      }
+      dpos->pos += suffix;
+   }
+
+   *fname = dpos->cur_name;
+   *dname = dpos->last_dirname;
+}
+
+static void ldcs_cache_parseCompactHeader(dirbuffer_iterator_t *dpos, char **fname, char **dname)
+{
+   size_t dir_len, filter_bits;
+   unsigned char flags;
+
+   dpos->compact = 1;
+   dpos->pos = sizeof(int);
+   assert(dpos->pos < dpos->buffer_size);
+   flags = (unsigned char) dpos->buffer[dpos->pos++];
+   dpos->has_dtype = (flags & DIRPACKET_HAS_DTYPE) ? 1 : 0;
+   dpos->has_links = (flags & DIRPACKET_HAS_LINKS) ? 1 : 0;
+
+   dir_len = get_varint(dpos);
+   assert(dpos->pos + dir_len < dpos->buffer_size);
+   dpos->last_dirname = dpos->buffer + dpos->pos;
+   dpos->pos += dir_len + 1;
+   dpos->entries_left = (unsigned int) get_varint(dpos);
+
+   if (!dpos->entries_left && (flags & DIRPACKET_SPARSE)) {
+      filter_bits = get_varint(dpos);
+      assert(filter_bits >= 64 && (filter_bits & (filter_bits - 1)) == 0);
+      assert(dpos->pos + filter_bits / 8 <= (size_t) dpos->buffer_size);
+      dpos->filter = (unsigned char *) dpos->buffer + dpos->pos;
+      dpos->filter_mask = (unsigned int) (filter_bits - 1);
+      dpos->pos += filter_bits / 8;
+   }
+   if (!dpos->entries_left) {
+      /* Empty or non-existant directory */
+      *fname = NULL;
+      *dname = dpos->last_dirname;
+      return;
+   }
+   ldcs_cache_parseCompactEntry(dpos, fname, dname);
+}
+
 void ldcs_cache_getFirstDir(char *buffer, int size, dirbuffer_iterator_t *dpos, char **fname, char **dname)
 {
+   int marker;
+
    dpos->buffer = buffer;
    dpos->buffer_size = size;
    dpos->last_dirname = NULL;
    dpos->pos = 0;
    dpos->done = 0;
+   dpos->compact = 0;
+   dpos->has_dtype = 0;
+   dpos->has_links = 0;
+   dpos->entries_left = 0;
+   dpos->d_type = 0;
+   dpos->link_target = NULL;
+   dpos->filter = NULL;
+   dpos->filter_mask = 0;
    if (!dpos->buffer_size) {
       *fname = NULL;
       *dname = NULL;
       return;
    }
+   if (dpos->buffer_size >= (int) sizeof(int)) {
+      memcpy(&marker, buffer, sizeof(int));
+      if (marker == DIRPACKET_COMPACT_V1) {
+         ldcs_cache_parseCompactHeader(dpos, fname, dname);
+         return;
+      }
+   }
    ldcs_cache_parseDir(dpos, fname, dname);
 }
 
@@ -187,6 +762,11 @@ void ldcs_cache_getNextDir(dirbuffer_iterator_t *dpos, char **fname, char **dnam
 {
    int length;
 
+   if (dpos->compact) {
+      ldcs_cache_parseCompactEntry(dpos, fname, dname);
+      return;
+   }
+
    if (dpos->pos == dpos->buffer_size) {
       dpos->done = 1;
       return;
@@ -257,8 +837,51 @@ void ldcs_cache_addFileDir(char *dname, char *fname)
    ldcs_hash_addEntry(dname, fname);
 }
 
+void ldcs_cache_addFileDirType(char *dname, char *fname, unsigned char d_type)
+{
+   debug_printf3("Adding directory %s, file %s (type %d) to cache\n", dname, fname, (int) d_type);
+   ldcs_hash_addEntryType(dname, fname, d_type);
+}
+
+/**
+ * Call cb for every directory record in the cache.  cb must not add
+ * entries to the cache.
+ **/
+void ldcs_cache_foreachDir(ldcs_cache_dir_cb_t cb, void *arg)
+{
+   struct ldcs_hash_entry_t *e;
+   unsigned int pos = 0;
+
+   while ((e = ldcs_hash_getNextDirRecord(&pos)) != NULL) {
+      int exists = (e->dirname == e->filename);
+      cb(e->filename, exists, arg);
+   }
+}
+
+/**
+ * Call cb for every name listed under dirname.  cb must not add
+ * entries to the cache.
+ **/
+void ldcs_cache_foreachEntryInDir(char *dirname, ldcs_cache_entry_cb_t cb, void *arg)
+{
+   struct ldcs_hash_entry_t *e;
+   int staged;
+
+   for (e = ldcs_hash_getFirstEntryForDir(dirname); e; e = ldcs_hash_getNextEntryForDir(e)) {
+      staged = (e->ostate == LDCS_CACHE_OBJECT_STATUS_LOCAL_PATH && e->localpath && !e->errcode);
+      cb(e->filename, e->d_type, staged ? e->localpath : NULL, staged ? e->buffer_size : 0, arg);
+   }
+}
+
 int ldcs_cache_init() {
   int rc=0;
+  char *limit = getenv("SPINDLE_SPARSE_DIR");
+  if (limit) {
+     if (limit[0] >= '0' && limit[0] <= '9')
+        sparse_dir_limit = (size_t) strtoul(limit, NULL, 10);
+     else
+        err_printf("Ignoring SPINDLE_SPARSE_DIR=%s\n", limit);
+  }
   ldcs_hash_init();
   return(rc);
 }
@@ -279,42 +902,323 @@ void addEmptyDirectory(char *dirname) {
    ldcs_hash_addEntry("-", dirname);
 }
 
+/**
+ * Read a directory with raw getdents64 calls into a large buffer, which
+ * pulls many entries per system call on parallel filesystems.  This
+ * only fills in listing and never touches the cache, so it is safe to
+ * call from helper threads.
+ **/
+struct linux_dirent64 {
+   uint64_t       d_ino;
+   int64_t        d_off;
+   unsigned short d_reclen;
+   unsigned char  d_type;
+   char           d_name[];
+};
+
+#define DIRENT_BUFFER_SIZE (256*1024)
+
+int ldcs_cache_addToListing(dir_listing_t *listing, const char *name, unsigned char d_type)
+{
+   size_t name_len = strlen(name) + 1;
+
+   if (listing->count == listing->size) {
+      listing->size = listing->size ? listing->size * 2 : 256;
+      listing->offsets = (size_t *) realloc(listing->offsets, listing->size * sizeof(size_t));
+      listing->types = (unsigned char *) realloc(listing->types, listing->size);
+      listing->targets = (size_t *) realloc(listing->targets, listing->size * sizeof(size_t));
+      if (!listing->offsets || !listing->types || !listing->targets)
+         return -1;
+   }
+   if (listing->names_used + name_len > listing->names_size) {
+      while (listing->names_used + name_len > listing->names_size)
+         listing->names_size = listing->names_size ? listing->names_size * 2 : 4096;
+      listing->names = (char *) realloc(listing->names, listing->names_size);
+      if (!listing->names)
+         return -1;
+   }
+   memcpy(listing->names + listing->names_used, name, name_len);
+   listing->offsets[listing->count] = listing->names_used;
+   listing->types[listing->count] = d_type;
+   listing->targets[listing->count] = LISTING_NO_TARGET;
+   listing->names_used += name_len;
+   listing->count++;
+   return 0;
+}
+
+/**
+ * Read the target of the link that was just added to listing.  The
+ * target goes in the names buffer after the link's own name.
+ **/
+static int listing_read_target(dir_listing_t *listing, int dirfd)
+{
+   char target[LDCS_CACHE_MAX_LINK_LEN+1];
+   const char *name = listing->names + listing->offsets[listing->count-1];
+   ssize_t len;
+
+   len = readlinkat(dirfd, name, target, LDCS_CACHE_MAX_LINK_LEN);
+   if (len <= 0)
+      return 0;
+   if (listing->names_used + len + 1 > listing->names_size) {
+      while (listing->names_used + len + 1 > listing->names_size)
+         listing->names_size *= 2;
+      listing->names = (char *) realloc(listing->names, listing->names_size);
+      if (!listing->names)
+         return -1;
+   }
+   memcpy(listing->names + listing->names_used, target, len);
+   listing->names[listing->names_used + len] = '\0';
+   listing->targets[listing->count-1] = listing->names_used;
+   listing->names_used += len + 1;
+   return 0;
+}
+
+int ldcs_cache_scanDirectory(const char *dirname, dir_listing_t *listing)
+{
+   char *buffer;
+   long nread, bpos;
+   struct linux_dirent64 *dent;
+   int fd, result = 0;
+
+   memset(listing, 0, sizeof(*listing));
+
+   fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd == -1)
+      return 0;
+   listing->exists = 1;
+
+   buffer = (char *) malloc(DIRENT_BUFFER_SIZE);
+   if (!buffer) {
+      err_printf("Could not allocate directory buffer for %s\n", dirname);
+      close(fd);
+      return -1;
+   }
+
+   for (;;) {
+      nread = syscall(SYS_getdents64, fd, buffer, DIRENT_BUFFER_SIZE);
+      if (nread == -1) {
+         err_printf("getdents64 failed on %s: %s\n", dirname, strerror(errno));
+         break;
+      }
+      if (nread == 0)
+         break;
+      listing->bytes_read += nread;
+
+      for (bpos = 0; bpos < nread; bpos += dent->d_reclen) {
+         dent = (struct linux_dirent64 *) (buffer + bpos);
+         if (dent->d_type != DT_LNK && dent->d_type != DT_REG && dent->d_type != DT_UNKNOWN && dent->d_type != DT_DIR)
+            continue;
+         if (ldcs_cache_addToListing(listing, dent->d_name, dent->d_type) == -1 ||
+             (read_links && dent->d_type == DT_LNK && listing_read_target(listing, fd) == -1)) {
+            err_printf("Out of memory reading directory %s\n", dirname);
+            result = -1;
+            break;
+         }
+      }
+      if (result == -1)
+         break;
+   }
+
+   close(fd);
+   free(buffer);
+   return result;
+}
+
+void ldcs_cache_freeListing(dir_listing_t *listing)
+{
+   free(listing->names);
+   free(listing->offsets);
+   free(listing->types);
+   free(listing->targets);
+   memset(listing, 0, sizeof(*listing));
+}
+
+/**
+ * Read a directory off disk and add all its entries to the cache in one
+ * batch.  bytesread gets the number of dirent bytes the kernel handed back.
+ **/
 void cacheLibraries(char *dirname, size_t *bytesread) {
-   size_t len;
+   dir_listing_t listing;
+
    debug_printf3("cacheLibraries for directory %s\n", dirname);
-   
-   DIR *d = opendir(dirname);
-   struct dirent *dent = NULL, *entry;
 
-   if (!d) {
-     addEmptyDirectory(dirname);
+   ldcs_cache_scanDirectory(dirname, &listing);
+   if (bytesread) *bytesread += listing.bytes_read;
+   ldcs_cache_storeListing(dirname, &listing);
+   ldcs_cache_freeListing(&listing);
+}
+
+/**
+ * Add a listing built by ldcs_cache_scanDirectory, and perhaps added to,
+ * to the cache as dirname's contents.
+ **/
+void ldcs_cache_storeListing(char *dirname, dir_listing_t *listing)
+{
+   unsigned char *filter;
+   unsigned int mask;
+   size_t i;
+
+   if (!listing->exists) {
      debug_printf3("Could not open directory %s, empty entry added\n", dirname);
      addEmptyDirectory(dirname);
      return;
-   } else {
-     ldcs_cache_addFileDir(dirname, dirname);
    }
 
+   if (is_sparse_listing(listing->count)) {
+      filter = listing_filter(listing, &mask);
+      if (filter) {
+         debug_printf2("Keeping %s, with %lu entries, as a sparse directory\n", dirname,
+                       (unsigned long) listing->count);
+         ldcs_hash_setSparseDir(dirname, filter, mask);
+         return;
+      }
+      err_printf("Could not allocate directory filter for %s\n", dirname);
+   }
+
+   ldcs_cache_addFileDir(dirname, dirname);
+   ldcs_hash_reserve(listing->count);
+   for (i = 0; i < listing->count; i++) {
+      ldcs_cache_addFileDirType(dirname, listing->names + listing->offsets[i], listing->types[i]);
+      if (listing->targets[i] != LISTING_NO_TARGET)
+         ldcs_cache_setLinkTarget(listing->names + listing->offsets[i], dirname,
+                                  listing->names + listing->targets[i]);
+   }
+
+   ldcs_cache_finishDirectory(dirname);
+}
+
+#define MAX_LINKS_FOLLOWED 40
+
+/**
+ * Walk path a name at a time from the root, looking each name up in its
+ * directory's cached listing.  rest holds what's left to walk, so a link
+ * is followed by putting its target in front of rest.
+ **/
+ldcs_cache_result_t ldcs_cache_resolvePath(const char *path, int last_link, char *result, int *errcode)
+{
+   char cur[MAX_PATH_LEN+1], rest[MAX_PATH_LEN+1], newrest[MAX_PATH_LEN+1];
+   char name[LDCS_CACHE_MAX_NAME_LEN+1], *p, *end, *slash;
+   const char *dir;
+   struct ldcs_hash_entry_t *e;
+   ldcs_cache_result_t dirresult;
+   size_t len, curlen = 0;
+   int num_links = 0, is_last;
 
-   len = offsetof(struct dirent, d_name) + pathconf(dirname, _PC_NAME_MAX) + 1;
-   entry = (struct dirent *) malloc(len);
+   *errcode = 0;
+   if (path[0] != '/') {
+      *errcode = EINVAL;
+      return LDCS_CACHE_FILE_NOT_FOUND;
+   }
+   if (snprintf(rest, sizeof(rest), "%s", path) >= (int) sizeof(rest)) {
+      *errcode = ENAMETOOLONG;
+      return LDCS_CACHE_FILE_NOT_FOUND;
+   }
+   cur[0] = '\0';
+   p = rest;
 
    for (;;) {
-      if (readdir_r(d, entry, &dent) != 0)
+      while (*p == '/')
+         p++;
+      if (!*p)
          break;
-      if (dent == NULL)
-         break;
-      if (bytesread) *bytesread += sizeof(dent);
-      if (dent->d_type != DT_LNK && dent->d_type != DT_REG && dent->d_type != DT_UNKNOWN && dent->d_type != DT_DIR) {
+      end = strchr(p, '/');
+      if (!end)
+         end = p + strlen(p);
+      len = end - p;
+      if (len > LDCS_CACHE_MAX_NAME_LEN) {
+         *errcode = ENAMETOOLONG;
+         return LDCS_CACHE_FILE_NOT_FOUND;
+      }
+      memcpy(name, p, len);
+      name[len] = '\0';
+      for (p = end; *p == '/'; p++);
+      is_last = (*p == '\0');
+
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+         if (last_link && is_last) {
+            *errcode = EINVAL;
+            return LDCS_CACHE_FILE_NOT_FOUND;
+         }
+         if (name[1] == '.' && (slash = strrchr(cur, '/')) != NULL) {
+            *slash = '\0';
+            curlen = slash - cur;
+         }
          continue;
       }
-      
-      ldcs_cache_addFileDir(dirname, dent->d_name);
-   }
 
-   closedir(d);
+      dir = curlen ? cur : "/";
+      dirresult = ldcs_cache_findDirInCache((char *) dir);
+      if (dirresult == LDCS_CACHE_DIR_NOT_PARSED) {
+         snprintf(result, LDCS_CACHE_MAX_LINK_LEN+1, "%s", dir);
+         return LDCS_CACHE_DIR_NOT_PARSED;
+      }
+      if (dirresult == LDCS_CACHE_DIR_PARSED_AND_NOT_EXISTS) {
+         /* We couldn't read it, which doesn't say why */
+         *errcode = EAGAIN;
+         return LDCS_CACHE_FILE_NOT_FOUND;
+      }
+      e = ldcs_hash_Lookup_FN_and_DIR(name, dir);
+      if (!e) {
+         /* A sparse directory's names aren't all in the cache */
+         *errcode = ldcs_hash_isSparseDir(dir) ? EAGAIN : ENOENT;
+         return LDCS_CACHE_FILE_NOT_FOUND;
+      }
+
+      if (last_link && is_last && end[0] == '\0') {
+         if (e->d_type == DT_LNK && e->link_target) {
+            snprintf(result, LDCS_CACHE_MAX_LINK_LEN+1, "%s", e->link_target);
+            return LDCS_CACHE_FILE_FOUND;
+         }
+         *errcode = (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) ? EAGAIN : EINVAL;
+         return LDCS_CACHE_FILE_NOT_FOUND;
+      }
+
+      if (e->d_type == DT_LNK) {
+         if (!e->link_target) {
+            *errcode = EAGAIN;
+            return LDCS_CACHE_FILE_NOT_FOUND;
+         }
+         if (++num_links > MAX_LINKS_FOLLOWED) {
+            *errcode = ELOOP;
+            return LDCS_CACHE_FILE_NOT_FOUND;
+         }
+         if (snprintf(newrest, sizeof(newrest), "%s/%s", e->link_target, p) >= (int) sizeof(newrest)) {
+            *errcode = ENAMETOOLONG;
+            return LDCS_CACHE_FILE_NOT_FOUND;
+         }
+         strcpy(rest, newrest);
+         p = rest;
+         if (e->link_target[0] == '/') {
+            cur[0] = '\0';
+            curlen = 0;
+         }
+         continue;
+      }
+
+      if (e->d_type == DT_UNKNOWN) {
+         *errcode = EAGAIN;
+         return LDCS_CACHE_FILE_NOT_FOUND;
+      }
+      if (e->d_type != DT_DIR && (!is_last || end[0] == '/')) {
+         *errcode = ENOTDIR;
+         return LDCS_CACHE_FILE_NOT_FOUND;
+      }
+      if (curlen + 1 + len > MAX_PATH_LEN) {
+         *errcode = ENAMETOOLONG;
+         return LDCS_CACHE_FILE_NOT_FOUND;
+      }
+      cur[curlen++] = '/';
+      memcpy(cur + curlen, name, len + 1);
+      curlen += len;
+   }
 
-   free(entry);
+   if (last_link) {
+      /* Only slashes, dots and links to directories were left */
+      *errcode = EINVAL;
+      return LDCS_CACHE_FILE_NOT_FOUND;
+   }
+   snprintf(result, LDCS_CACHE_MAX_LINK_LEN+1, "%s", curlen ? cur : "/");
+   return LDCS_CACHE_FILE_FOUND;
 }
 
 char *ldcs_cache_result_to_str(ldcs_cache_result_t res)
@@ -17,6 +17,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef LDCS_CACHE_H
 #define LDCS_CACHE_H
 
+#include <stddef.h>
+
 typedef enum {
   LDCS_CACHE_DIR_PARSED_AND_EXISTS,
   LDCS_CACHE_DIR_PARSED_AND_NOT_EXISTS,
@@ -37,6 +39,9 @@ ldcs_cache_result_t ldcs_cache_findDirInCache(char *dirname);
 ldcs_cache_result_t ldcs_cache_findFileDirInCache(char *filename, char *dirname, char **localpath, int *errcode);
 
 ldcs_cache_result_t ldcs_cache_processDirectory(char *dirname, size_t *bytesread);
+void ldcs_cache_finishDirectory(char *dirname);
+int ldcs_cache_dirFilterCheck(char *filename, char *dirname);
+int ldcs_cache_isSparseDir(char *dirname);
 
 ldcs_cache_result_t ldcs_cache_updateEntry(char *filename, char *dirname, 
                                            char *localname, void *buffer, size_t buffer_size, int errcode);
@@ -45,26 +50,103 @@ ldcs_cache_result_t ldcs_cache_updateStatus(char *filename, char *dirname, ldcs_
 ldcs_hash_object_status_t ldcs_cache_getStatus(char *filename);
 
 int ldcs_cache_getNewEntriesForDir(char *dir, char **data, int *len);
+char *ldcs_cache_storeDirPacket(char *data, int len, int *already_cached);
+
+/* A directory listing read straight off disk, outside the cache.
+   Building and encoding a listing is safe from helper threads. */
+typedef struct {
+   char *names;               /* NUL-terminated names, back to back */
+   size_t names_used;
+   size_t names_size;
+   size_t *offsets;           /* offset of each name in names */
+   unsigned char *types;      /* d_type of each name */
+   size_t *targets;           /* offset in names of each link's target, or LISTING_NO_TARGET */
+   size_t count;
+   size_t size;
+   size_t bytes_read;
+   int exists;
+} dir_listing_t;
+int ldcs_cache_scanDirectory(const char *dirname, dir_listing_t *listing);
+#define LISTING_NO_TARGET ((size_t) -1)
+int ldcs_cache_addToListing(dir_listing_t *listing, const char *name, unsigned char d_type);
+void ldcs_cache_storeListing(char *dirname, dir_listing_t *listing);
+int ldcs_cache_encodeListing(const char *dir, dir_listing_t *listing, char **data, int *len);
+void ldcs_cache_freeListing(dir_listing_t *listing);
+
+/* Walk the cache.  foreachDir reports missing directories with exists == 0.
+   foreachEntryInDir reports localpath and size only for files staged locally. */
+typedef void (*ldcs_cache_dir_cb_t)(char *dirname, int exists, void *arg);
+typedef void (*ldcs_cache_entry_cb_t)(char *filename, unsigned char d_type, char *localpath,
+                                      size_t size, void *arg);
+void ldcs_cache_foreachDir(ldcs_cache_dir_cb_t cb, void *arg);
+void ldcs_cache_foreachEntryInDir(char *dirname, ldcs_cache_entry_cb_t cb, void *arg);
 
 int ldcs_cache_init();
 int ldcs_cache_dump(char *filename);
 
 int ldcs_cache_get_buffer(char *dirname, char *filename, void **buffer, size_t *size);
 
+/* With links on, listings read off disk carry the target of each symlink,
+   and paths can be resolved from the cache. */
+void ldcs_cache_setReadLinks(int enable);
+void ldcs_cache_setLinkTarget(char *filename, char *dirname, const char *target);
+
+/* Resolve the symlinks in the absolute path from the cached listings.
+   With last_link, only the directories leading to the last name are
+   resolved, and result gets that name's link target.  Returns
+   LDCS_CACHE_FILE_FOUND with result set, LDCS_CACHE_DIR_NOT_PARSED with
+   result set to the directory whose listing is needed first, or
+   LDCS_CACHE_FILE_NOT_FOUND with *errcode set.  An errcode of EAGAIN
+   means the cache can't tell.  result must hold LDCS_CACHE_MAX_LINK_LEN+1
+   bytes. */
+ldcs_cache_result_t ldcs_cache_resolvePath(const char *path, int last_link, char *result, int *errcode);
+
+/* Byte budget for staged files.  A budget of 0 means no limit. */
+typedef void (*ldcs_cache_evict_cb_t)(char *localpath, void *buffer, size_t size, void *arg);
+void ldcs_cache_setBudget(size_t bytes);
+size_t ldcs_cache_stagedBytes();
+size_t ldcs_cache_makeRoom(size_t needed, ldcs_cache_evict_cb_t cb, void *arg);
+void *ldcs_cache_pinEntry(char *filename, char *dirname);
+void ldcs_cache_unpinEntry(void *handle);
+
+/* Staged files whose mappings were released are mapped again with cb
+   when ldcs_cache_get_buffer next asks for them */
+typedef void *(*ldcs_cache_remap_cb_t)(char *localpath, size_t size);
+void ldcs_cache_setRemap(ldcs_cache_remap_cb_t cb);
+void *ldcs_cache_releaseBuffer(char *filename, char *dirname, size_t *size);
+
+/* Compressed copies of staged files, kept for resending to other servers */
+int ldcs_cache_getCompressed(char *filename, char *dirname, void **zbuffer, size_t *zsize);
+int ldcs_cache_setCompressed(char *filename, char *dirname, void *zbuffer, size_t zsize);
+
 char *ldcs_cache_result_to_str(ldcs_cache_result_t res);
 /* Parse directory content packets */
+#define LDCS_CACHE_MAX_NAME_LEN 255
+#define LDCS_CACHE_MAX_LINK_LEN 4096
 typedef struct {
    char *buffer;
    int buffer_size;
    char *last_dirname;
    int pos;
    int done;
+   /* State for compact packets */
+   int compact;
+   int has_dtype;
+   unsigned int entries_left;
+   int has_links;
+   unsigned char d_type;
+   char *link_target;         /* target of the current entry if it's a link we know, else NULL */
+   unsigned char *filter;     /* filter of a sparse directory, else NULL */
+   unsigned int filter_mask;
+   char cur_name[LDCS_CACHE_MAX_NAME_LEN+1];
+   char cur_target[LDCS_CACHE_MAX_LINK_LEN+1];
 } dirbuffer_iterator_t;
 void ldcs_cache_getFirstDir(char *buffer, int size, dirbuffer_iterator_t *dpos, char **fname, char **dname);
 void ldcs_cache_getNextDir(dirbuffer_iterator_t *dpos, char **fname, char **dname);
 int ldcs_cache_lastDir(dirbuffer_iterator_t *dpos);
 void ldcs_cache_parseDir(dirbuffer_iterator_t *dpos, char **fname, char **dname);
 void ldcs_cache_addFileDir(char *dname, char *fname);
+void ldcs_cache_addFileDirType(char *dname, char *fname, unsigned char d_type);
 void addEmptyDirectory(char *dirname);
 #define foreach_filedir(BUFFER, SIZE, POS, FNAME, DNAME)                \
    for (ldcs_cache_getFirstDir(BUFFER, SIZE, &POS, &FNAME, &DNAME);     \
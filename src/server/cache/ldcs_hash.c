@@ -23,55 +23,226 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_api.h"
 #include "ldcs_hash.h"
 #include "global_name.h"
+#include "name_intern.h"
 
-struct ldcs_hash_entry_t  ldcs_hash_table[HASH_SIZE];
-int                       ldcs_hash_last_new_entry_index=-1;
-struct ldcs_hash_entry_t *ldcs_hash_last_new_entry_ptr=NULL;
+/**
+ * The table is open-addressed with linear probing over a power-of-two
+ * slot array that doubles once it is 3/4 full.  Entries themselves are
+ * carved out of fixed-size chunks that are never moved, so pointers
+ * handed out by lookups and the dir_next chains survive a resize.
+ *
+ * Directory records (dirname == filename, or the "-" marker used for
+ * empty directories) are keyed by the hash of their name, which is what
+ * ldcs_hash_Lookup searches for.  File records are keyed by a mix of the
+ * dirname and filename hashes, so common names like __init__.py that
+ * appear in many directories do not pile up on one probe sequence.
+ *
+ * All names are interned (see name_intern.h), so the table compares
+ * names by pointer and reuses the hash stored with each string.
+ **/
+static struct ldcs_hash_slot_t *ldcs_hash_table = NULL;
+static unsigned int ldcs_hash_mask = 0;
+static unsigned int ldcs_hash_used = 0;
 
+static struct ldcs_hash_entry_t *ldcs_hash_chunk = NULL;
+static unsigned int ldcs_hash_chunk_used = HASH_ENTRIES_PER_CHUNK;
+
+/* Must match the hash name_intern.c stores with each string */
 ldcs_hash_key_t ldcs_hash_Val(const char *str) {
    ldcs_hash_key_t hash = 5381;
    int c;
-   while ((c = *str++))
+   while ((c = (unsigned char) *str++))
       hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
    return hash;
 }
 
+/* filename and dirname must be interned */
+static int is_dir_record(const char *filename, const char *dirname) {
+   return dirname == filename || (dirname[0] == '-' && dirname[1] == '\0');
+}
+
+static ldcs_hash_key_t entry_key(const char *filename, const char *dirname) {
+   ldcs_hash_key_t dkey;
+   if (is_dir_record(filename, dirname))
+      return intern_name_hash(filename);
+   dkey = intern_name_hash(dirname);
+   return dkey ^ (intern_name_hash(filename) + 0x9e3779b9U + (dkey << 6) + (dkey >> 2));
+}
+
+/* Mix the djb2 value before masking, since its low bits are mostly
+   determined by the last few characters of the name. */
+static unsigned int slot_index(ldcs_hash_key_t key) {
+   key ^= key >> 16;
+   key *= 0x45d9f3bU;
+   key ^= key >> 16;
+   return (unsigned int) key & ldcs_hash_mask;
+}
+
+static void insert_slot(struct ldcs_hash_slot_t *table, unsigned int mask, 
+                        ldcs_hash_key_t key, const char *filename, struct ldcs_hash_entry_t *entry)
+{
+   unsigned int i = slot_index(key) & mask;
+   while (table[i].entry != NULL)
+      i = (i + 1) & mask;
+   table[i].hash_val = key;
+   table[i].filename = filename;
+   table[i].entry = entry;
+}
+
+static int grow_table(unsigned int newsize)
+{
+   struct ldcs_hash_slot_t *newtable, *oldtable = ldcs_hash_table;
+   unsigned int i, oldsize = oldtable ? ldcs_hash_mask + 1 : 0;
+
+   newtable = (struct ldcs_hash_slot_t *) calloc(newsize, sizeof(struct ldcs_hash_slot_t));
+   if (!newtable) {
+      err_printf("Could not allocate hash table of %u slots\n", newsize);
+      return -1;
+   }
+   debug_printf3("Resizing cache hash table from %u to %u slots (%u used)\n", oldsize, newsize, ldcs_hash_used);
+
+   ldcs_hash_mask = newsize - 1;
+   for (i = 0; i < oldsize; i++) {
+      if (oldtable[i].entry)
+         insert_slot(newtable, ldcs_hash_mask, oldtable[i].hash_val, oldtable[i].filename, oldtable[i].entry);
+   }
+   ldcs_hash_table = newtable;
+   if (oldtable)
+      free(oldtable);
+   return 0;
+}
+
+/**
+ * Grow the table ahead of a batch of count inserts, so a large
+ * directory doesn't trigger a chain of doublings mid-batch.
+ **/
+void ldcs_hash_reserve(unsigned int count)
+{
+   unsigned int newsize = ldcs_hash_table ? ldcs_hash_mask + 1 : HASH_INITIAL_SIZE;
+   while ((ldcs_hash_used + count + 1) * 4 > newsize * 3)
+      newsize *= 2;
+   if (!ldcs_hash_table || newsize != ldcs_hash_mask + 1)
+      grow_table(newsize);
+}
+
+static struct ldcs_hash_entry_t *new_entry()
+{
+   if (ldcs_hash_chunk_used == HASH_ENTRIES_PER_CHUNK) {
+      ldcs_hash_chunk = (struct ldcs_hash_entry_t *) malloc(sizeof(struct ldcs_hash_entry_t) * HASH_ENTRIES_PER_CHUNK);
+      if (!ldcs_hash_chunk) {
+         err_printf("Could not allocate hash entries\n");
+         assert(0);
+      }
+      ldcs_hash_chunk_used = 0;
+   }
+   return ldcs_hash_chunk + ldcs_hash_chunk_used++;
+}
+
+static struct ldcs_hash_entry_t *find_entry(ldcs_hash_key_t key, const char *filename, const char *dirname)
+{
+   struct ldcs_hash_slot_t *slot;
+   unsigned int i;
+
+   if (!ldcs_hash_table)
+      return NULL;
+
+   i = slot_index(key);
+   for (;;) {
+      slot = ldcs_hash_table + i;
+      if (slot->entry == NULL)
+         return NULL;
+      if (slot->filename == filename && (!dirname || slot->entry->dirname == dirname))
+         return slot->entry;
+      i = (i + 1) & ldcs_hash_mask;
+   }
+}
+
+/**
+ * Directory bloom filters.  Both probe positions are derived from the
+ * filename's djb2 hash, which for interned names is already stored.
+ **/
+static unsigned int filter_mix(ldcs_hash_key_t key)
+{
+   key ^= key >> 16;
+   key *= 0x85ebca6bU;
+   key ^= key >> 13;
+   key *= 0xc2b2ae35U;
+   key ^= key >> 16;
+   return key;
+}
+
+static void filter_set(unsigned char *filter, unsigned int mask, ldcs_hash_key_t key)
+{
+   unsigned int i, bit = filter_mix(key), step = ((bit >> 17) | (bit << 15)) | 1;
+   for (i = 0; i < HASH_DIR_FILTER_PROBES; i++, bit += step)
+      filter[(bit & mask) >> 3] |= 1 << (bit & 7);
+}
+
+static int filter_test(unsigned char *filter, unsigned int mask, ldcs_hash_key_t key)
+{
+   unsigned int i, bit = filter_mix(key), step = ((bit >> 17) | (bit << 15)) | 1;
+   for (i = 0; i < HASH_DIR_FILTER_PROBES; i++, bit += step) {
+      if (!(filter[(bit & mask) >> 3] & (1 << (bit & 7))))
+         return 0;
+   }
+   return 1;
+}
+
 void ldcs_hash_addEntry(char *dirname, char *filename) {
+   ldcs_hash_addEntryType(dirname, filename, 0);
+}
+
+void ldcs_hash_addEntryType(char *dirname, char *filename, unsigned char d_type) {
    struct ldcs_hash_entry_t *newentry;
-   ldcs_hash_key_t key = ldcs_hash_Val(filename);
-   unsigned int index = (unsigned int) key % HASH_SIZE;
-   int is_dir = (dirname == filename || strcmp(dirname, filename) == 0);
-
-   /* debug_printf3("Adding dir='%s' fn='%s' to cache at index %u\n", dirname, filename, index); */
-   newentry = ldcs_hash_table + index;
-   if (newentry->dirname != NULL) {
-      while (newentry->next != NULL)
-         newentry = newentry->next;
-      newentry->next = (struct ldcs_hash_entry_t *) malloc(sizeof(struct ldcs_hash_entry_t));
-      newentry = newentry->next;
+   const char *iname = intern_name(filename);
+   const char *idir = intern_name(dirname);
+   int is_dir = is_dir_record(iname, idir);
+   ldcs_hash_key_t key = entry_key(iname, idir);
+
+   /* debug_printf3("Adding dir='%s' fn='%s' to cache\n", dirname, filename); */
+   if (!ldcs_hash_table || (ldcs_hash_used + 1) * 4 > (ldcs_hash_mask + 1) * 3) {
+      if (grow_table(ldcs_hash_table ? (ldcs_hash_mask + 1) * 2 : HASH_INITIAL_SIZE) == -1)
+         assert(0);
    }
-   newentry->filename = (filename)?strdup(filename):NULL;
-   newentry->dirname = (dirname)?strdup(dirname):NULL;
+
+   newentry = new_entry();
+   newentry->filename = (char *) iname;
+   newentry->dirname = (char *) idir;
    newentry->hash_val = key;
    newentry->state = HASH_ENTRY_STATUS_NEW;
    newentry->ostate = 0;
    newentry->localpath = NULL;
    newentry->buffer = NULL;
    newentry->buffer_size = 0;
-   newentry->next = NULL;
+   newentry->errcode = 0;
+   newentry->dir_next = NULL;
+   newentry->d_type = d_type;
+   newentry->link_target = NULL;
+   newentry->dir_filter = NULL;
+   newentry->dir_filter_mask = 0;
+   newentry->sparse = 0;
+   newentry->pins = 0;
+   newentry->lru_prev = NULL;
+   newentry->lru_next = NULL;
+   newentry->zbuffer = NULL;
+   newentry->zsize = 0;
+   newentry->ztried = 0;
 
-   if (is_dir) {
-      newentry->dir_next = NULL;
+   insert_slot(ldcs_hash_table, ldcs_hash_mask, key, newentry->filename, newentry);
+   ldcs_hash_used++;
+
+   if (is_dir)
       return;
-   }
 
-   struct ldcs_hash_entry_t *dent = ldcs_hash_Lookup(dirname);
+   struct ldcs_hash_entry_t *dent = find_entry(intern_name_hash(idir), idir, NULL);
    if (!dent) {
       ldcs_hash_addEntry(dirname, dirname);
-      dent = ldcs_hash_Lookup(dirname);
+      dent = find_entry(intern_name_hash(idir), idir, NULL);
    }
    newentry->dir_next = dent->dir_next;
    dent->dir_next = newentry;
+   if (dent->dir_filter)
+      filter_set(dent->dir_filter, dent->dir_filter_mask, intern_name_hash(iname));
 
    return;
 }
@@ -109,86 +280,59 @@ struct ldcs_hash_entry_t *ldcs_hash_updateEntryOState(char *filename, char *dirn
 }
 
 struct ldcs_hash_entry_t *ldcs_hash_Lookup(const char *filename) {
-   struct ldcs_hash_entry_t *entry;
-   ldcs_hash_key_t key = ldcs_hash_Val(filename);
-   unsigned int index = (unsigned int) key % HASH_SIZE;
-   
-   if (ldcs_hash_table[index].dirname == NULL) {
-      debug_printf3("No key for %s at index %u\n", filename, index);
-      return NULL;
-   }
+   struct ldcs_hash_entry_t *entry = NULL;
+   const char *iname = lookup_intern_name(filename);
 
-   entry = ldcs_hash_table+index;
-   while (entry != NULL) {
-      if (entry->hash_val == key && strcmp(filename, entry->filename) == 0) {
-         /* debug_printf3("Found entry for %s\n", filename); */
-         return entry;
-      }
-      entry = entry->next;
-   } 
-   debug_printf3("No key for %s at index %u\n", filename, index);
-   return NULL;
+   if (iname)
+      entry = find_entry(intern_name_hash(iname), iname, NULL);
+   if (!entry)
+      debug_printf3("No key for %s\n", filename);
+   return entry;
 }
 
 struct ldcs_hash_entry_t *ldcs_hash_Lookup_FN_and_DIR(const char *filename, const char *dirname) {
-   struct ldcs_hash_entry_t *entry;
-   ldcs_hash_key_t key = ldcs_hash_Val(filename);
-   unsigned int index = (unsigned int) key % HASH_SIZE;
-   
-   if (ldcs_hash_table[index].dirname == NULL) {
-      debug_printf3("No key for %s at index %u\n", filename, index);
-      return NULL;
-   }
+   struct ldcs_hash_entry_t *entry = NULL;
+   const char *iname = lookup_intern_name(filename);
+   const char *idir = iname ? lookup_intern_name(dirname) : NULL;
 
-   entry = ldcs_hash_table+index;
-   while (entry != NULL) {
-     if (entry->hash_val == key && strcmp(filename, entry->filename) == 0 &&
-	 strcmp(dirname, entry->dirname) == 0 ) {
-	    /* debug_printf3("Found entry for %s in dir %s\n", filename, dirname); */
-       return entry;
-     }
-     entry = entry->next;
-   } 
-     debug_printf3("No key for %s in dir %s at index %u\n", filename, dirname,index);
-   return NULL;
+   if (iname && idir)
+      entry = find_entry(entry_key(iname, idir), iname, idir);
+   if (!entry)
+      debug_printf3("No key for %s in dir %s\n", filename, dirname);
+   return entry;
 }
 
 void ldcs_hash_dump(char *tofile) {
   FILE *dumpfile;
   struct ldcs_hash_entry_t *entry;
-  int index;
+  unsigned int index;
  
   dumpfile=fopen(tofile, "w");
-  
-  for(index=0;index<HASH_SIZE;index++) {
-    entry = ldcs_hash_table+index;
-    while (entry != NULL) {
-      if(entry->hash_val != 0) {
-	fprintf(dumpfile,"%4d: %16u %s %s %s\n",
-		index,entry->hash_val,entry->filename,entry->dirname,
-		(entry->state == HASH_ENTRY_STATUS_USED)        ? "HASH_ENTRY_STATUS_USED" :
-		(entry->state == HASH_ENTRY_STATUS_NEW)         ? "HASH_ENTRY_STATUS_NEW" :
-		(entry->state == HASH_ENTRY_STATUS_FREE)        ? "HASH_ENTRY_STATUS_FREE" :
-		(entry->state == HASH_ENTRY_STATUS_UNKNOWN)     ? "HASH_ENTRY_STATUS_UNKNOWN" : "???"
-		);
-      }
-      entry = entry->next;
-    } 
+  if (!dumpfile) {
+    err_printf("Could not open hash dump file %s\n", tofile);
+    return;
+  }
+
+  for(index=0; ldcs_hash_table && index<=ldcs_hash_mask; index++) {
+    entry = ldcs_hash_table[index].entry;
+    if (entry == NULL)
+      continue;
+    fprintf(dumpfile,"%4u: %16u %s %s %s\n",
+            index,entry->hash_val,entry->filename,entry->dirname,
+            (entry->state == HASH_ENTRY_STATUS_USED)        ? "HASH_ENTRY_STATUS_USED" :
+            (entry->state == HASH_ENTRY_STATUS_NEW)         ? "HASH_ENTRY_STATUS_NEW" :
+            (entry->state == HASH_ENTRY_STATUS_FREE)        ? "HASH_ENTRY_STATUS_FREE" :
+            (entry->state == HASH_ENTRY_STATUS_UNKNOWN)     ? "HASH_ENTRY_STATUS_UNKNOWN" : "???"
+            );
   }
   fclose(dumpfile);
 }
 
 int ldcs_hash_init() {
   int rc=0;
-  int index;
-
-  for(index=0;index<HASH_SIZE;index++) {
-    ldcs_hash_table[index].hash_val = 0;
-    ldcs_hash_table[index].state    = HASH_ENTRY_STATUS_FREE;
-    ldcs_hash_table[index].next     = NULL;
-    ldcs_hash_table[index].filename = NULL;
-    ldcs_hash_table[index].dirname  = NULL;
-  }
+
+  if (!ldcs_hash_table)
+    rc = grow_table(HASH_INITIAL_SIZE);
   init_global_name_list();
   return(rc);
 }
@@ -205,3 +349,117 @@ struct ldcs_hash_entry_t *ldcs_hash_getNextEntryForDir(struct ldcs_hash_entry_t
 {
    return prev_entry->dir_next;
 }
+
+/**
+ * Return the next directory record at or after slot *pos, advancing
+ * *pos past it, or NULL once the table is exhausted.  Records for
+ * directories that don't exist come back with dirname "-".
+ **/
+struct ldcs_hash_entry_t *ldcs_hash_getNextDirRecord(unsigned int *pos)
+{
+   struct ldcs_hash_entry_t *entry;
+
+   for (; ldcs_hash_table && *pos <= ldcs_hash_mask; (*pos)++) {
+      entry = ldcs_hash_table[*pos].entry;
+      if (entry && is_dir_record(entry->filename, entry->dirname)) {
+         (*pos)++;
+         return entry;
+      }
+   }
+   return NULL;
+}
+
+/**
+ * Build the bloom filter for a directory once its listing is complete.
+ * Names added to the directory afterwards are added to the filter too,
+ * so it never gives a false negative.
+ **/
+void ldcs_hash_buildDirFilter(char *dirname)
+{
+   struct ldcs_hash_entry_t *dent = ldcs_hash_Lookup(dirname), *i;
+   unsigned int count = 0, nbits;
+
+   if (!dent || dent->dirname != dent->filename || dent->dir_filter)
+      return;
+
+   for (i = dent->dir_next; i != NULL; i = i->dir_next)
+      count++;
+   nbits = ldcs_hash_dirFilterBits(count);
+
+   dent->dir_filter = (unsigned char *) calloc(nbits / 8, 1);
+   if (!dent->dir_filter) {
+      err_printf("Could not allocate directory filter for %s\n", dirname);
+      return;
+   }
+   dent->dir_filter_mask = nbits - 1;
+   for (i = dent->dir_next; i != NULL; i = i->dir_next)
+      filter_set(dent->dir_filter, dent->dir_filter_mask, intern_name_hash(i->filename));
+   debug_printf3("Built %u bit filter for %u entries in directory %s\n", nbits, count, dirname);
+}
+
+/**
+ * Returns 0 if filename is definitely not in dirname, 1 if it may be,
+ * or -1 if the directory has no filter.
+ **/
+int ldcs_hash_dirFilterCheck(const char *dirname, const char *filename)
+{
+   struct ldcs_hash_entry_t *dent = ldcs_hash_Lookup(dirname);
+   if (!dent || !dent->dir_filter)
+      return -1;
+   return filter_test(dent->dir_filter, dent->dir_filter_mask, ldcs_hash_Val(filename));
+}
+
+/**
+ * Size, in bits, of the filter for a directory of count names.  Always
+ * a power of two, so the mask is one less.
+ **/
+unsigned int ldcs_hash_dirFilterBits(size_t count)
+{
+   unsigned int nbits = 64;
+   while (nbits < count * HASH_DIR_FILTER_BITS_PER_ENTRY)
+      nbits *= 2;
+   return nbits;
+}
+
+/* Add a name to a filter that isn't attached to a directory yet */
+void ldcs_hash_dirFilterAdd(unsigned char *filter, unsigned int mask, const char *filename)
+{
+   filter_set(filter, mask, ldcs_hash_Val(filename));
+}
+
+/**
+ * Record dirname as a sparse directory, whose names are only known
+ * through filter.  Its entries are added one at a time as they're looked
+ * up.  The directory takes over filter.
+ **/
+void ldcs_hash_setSparseDir(char *dirname, unsigned char *filter, unsigned int mask)
+{
+   struct ldcs_hash_entry_t *dent = ldcs_hash_Lookup(dirname);
+
+   if (!dent) {
+      ldcs_hash_addEntry(dirname, dirname);
+      dent = ldcs_hash_Lookup(dirname);
+   }
+   assert(dent && dent->dirname == dent->filename);
+   if (dent->dir_filter)
+      free(dent->dir_filter);
+   dent->dir_filter = filter;
+   dent->dir_filter_mask = mask;
+   dent->sparse = 1;
+   debug_printf3("Stored %u bit filter for sparse directory %s\n", mask + 1, dirname);
+}
+
+int ldcs_hash_isSparseDir(const char *dirname)
+{
+   struct ldcs_hash_entry_t *dent = ldcs_hash_Lookup(dirname);
+   return dent && dent->sparse;
+}
+
+unsigned char *ldcs_hash_getDirFilter(const char *dirname, unsigned int *mask)
+{
+   struct ldcs_hash_entry_t *dent = ldcs_hash_Lookup(dirname);
+   if (!dent || !dent->dir_filter)
+      return NULL;
+   *mask = dent->dir_filter_mask;
+   return dent->dir_filter;
+}
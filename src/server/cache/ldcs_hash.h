@@ -17,7 +17,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef LDCS_HASH_H
 #define LDCS_HASH_H
 
-#define HASH_SIZE (10*1024)
+#define HASH_INITIAL_SIZE (16*1024)
+#define HASH_ENTRIES_PER_CHUNK 1024
+#define HASH_DIR_FILTER_BITS_PER_ENTRY 10
+#define HASH_DIR_FILTER_PROBES 4
 typedef unsigned ldcs_hash_key_t;
 
 typedef enum {
@@ -38,13 +41,34 @@ struct ldcs_hash_entry_t
   size_t buffer_size;
   ldcs_hash_key_t hash_val;
   int errcode;
-  struct ldcs_hash_entry_t *next;
   struct ldcs_hash_entry_t *dir_next;
+  unsigned char d_type;              /* DT_* from the directory listing, DT_UNKNOWN if not known */
+  const char *link_target;           /* interned target of a DT_LNK entry, NULL if not read */
+  unsigned char *dir_filter;         /* bloom filter of names, directory records only */
+  unsigned int dir_filter_mask;
+  unsigned char sparse;              /* directory whose names are only in dir_filter */
+  unsigned int pins;                 /* connected clients that were handed the staged file */
+  struct ldcs_hash_entry_t *lru_prev; /* staged files, most recently used first */
+  struct ldcs_hash_entry_t *lru_next;
+  void *zbuffer;                     /* compressed copy of buffer for the tree, if kept */
+  size_t zsize;
+  int ztried;                        /* compression was tried, zbuffer NULL if it didn't help */
+};
+
+/* One slot of the open-addressing table.  The key and name are kept
+   inline so a probe sequence only touches the slot array until a
+   full hash match is found. */
+struct ldcs_hash_slot_t
+{
+  ldcs_hash_key_t hash_val;
+  const char *filename;
+  struct ldcs_hash_entry_t *entry;
 };
 
 int ldcs_hash_init();
 ldcs_hash_key_t ldcs_hash_Val(const char *str);
 void ldcs_hash_addEntry(char *dirname, char *filename);
+void ldcs_hash_addEntryType(char *dirname, char *filename, unsigned char d_type);
 
 struct ldcs_hash_entry_t *ldcs_hash_updateEntryOState(char *filename, char *dirname, int ostate);
 struct ldcs_hash_entry_t *ldcs_hash_updateEntry(char *filename, char *dirname, char *localname, 
@@ -57,4 +81,14 @@ void ldcs_hash_dump(char *tofile);
 
 struct ldcs_hash_entry_t *ldcs_hash_getFirstEntryForDir(char *dirname);
 struct ldcs_hash_entry_t *ldcs_hash_getNextEntryForDir(struct ldcs_hash_entry_t *prev_entry);
+struct ldcs_hash_entry_t *ldcs_hash_getNextDirRecord(unsigned int *pos);
+
+void ldcs_hash_reserve(unsigned int count);
+void ldcs_hash_buildDirFilter(char *dirname);
+unsigned int ldcs_hash_dirFilterBits(size_t count);
+void ldcs_hash_dirFilterAdd(unsigned char *filter, unsigned int mask, const char *filename);
+void ldcs_hash_setSparseDir(char *dirname, unsigned char *filter, unsigned int mask);
+int ldcs_hash_isSparseDir(const char *dirname);
+unsigned char *ldcs_hash_getDirFilter(const char *dirname, unsigned int *mask);
+int ldcs_hash_dirFilterCheck(const char *dirname, const char *filename);
 #endif
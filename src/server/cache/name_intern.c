@@ -0,0 +1,176 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "spindle_debug.h"
+#include "name_intern.h"
+
+#define INTERN_ARENA_BLOCK_SIZE (256*1024)
+#define INTERN_INITIAL_TABLE_SIZE (32*1024)
+
+/* Every string in the arena is preceded by this header */
+typedef struct {
+   unsigned int hash_val;
+   unsigned int len;
+} intern_header_t;
+
+typedef struct {
+   unsigned int hash_val;
+   const char *str;
+} intern_slot_t;
+
+static char *arena_cur = NULL;
+static size_t arena_left = 0;
+
+static intern_slot_t *intern_table = NULL;
+static unsigned int intern_mask = 0;
+static unsigned int intern_used = 0;
+
+static unsigned int hash_str(const char *str, size_t len)
+{
+   unsigned int hash = 5381;
+   size_t i;
+   for (i = 0; i < len; i++)
+      hash = ((hash << 5) + hash) + (unsigned char) str[i]; /* hash * 33 + c */
+   return hash;
+}
+
+static unsigned int slot_index(unsigned int hash)
+{
+   hash ^= hash >> 16;
+   hash *= 0x45d9f3bU;
+   hash ^= hash >> 16;
+   return hash & intern_mask;
+}
+
+static intern_header_t *header_of(const char *interned)
+{
+   return ((intern_header_t *) interned) - 1;
+}
+
+static void insert_slot(intern_slot_t *table, unsigned int hash, const char *str)
+{
+   unsigned int i = slot_index(hash);
+   while (table[i].str != NULL)
+      i = (i + 1) & intern_mask;
+   table[i].hash_val = hash;
+   table[i].str = str;
+}
+
+static void grow_table()
+{
+   intern_slot_t *oldtable = intern_table;
+   unsigned int i, oldsize = oldtable ? intern_mask + 1 : 0;
+   unsigned int newsize = oldtable ? oldsize * 2 : INTERN_INITIAL_TABLE_SIZE;
+
+   intern_table = (intern_slot_t *) calloc(newsize, sizeof(intern_slot_t));
+   assert(intern_table);
+   intern_mask = newsize - 1;
+   for (i = 0; i < oldsize; i++) {
+      if (oldtable[i].str)
+         insert_slot(intern_table, oldtable[i].hash_val, oldtable[i].str);
+   }
+   if (oldtable)
+      free(oldtable);
+}
+
+static char *arena_alloc(size_t size)
+{
+   char *result;
+   size = (size + sizeof(intern_header_t) - 1) & ~(sizeof(intern_header_t) - 1);
+   if (size > INTERN_ARENA_BLOCK_SIZE / 4) {
+      /* Don't waste the rest of the current block on a huge string */
+      result = (char *) malloc(size);
+      assert(result);
+      return result;
+   }
+   if (size > arena_left) {
+      arena_cur = (char *) malloc(INTERN_ARENA_BLOCK_SIZE);
+      assert(arena_cur);
+      arena_left = INTERN_ARENA_BLOCK_SIZE;
+   }
+   result = arena_cur;
+   arena_cur += size;
+   arena_left -= size;
+   return result;
+}
+
+static const char *find_name(const char *str, size_t len, unsigned int hash)
+{
+   unsigned int i;
+   intern_slot_t *slot;
+
+   if (!intern_table)
+      return NULL;
+   for (i = slot_index(hash); ; i = (i + 1) & intern_mask) {
+      slot = intern_table + i;
+      if (!slot->str)
+         return NULL;
+      if (slot->hash_val == hash && header_of(slot->str)->len == len &&
+          memcmp(slot->str, str, len) == 0)
+         return slot->str;
+   }
+}
+
+const char *intern_name_len(const char *str, size_t len)
+{
+   unsigned int hash = hash_str(str, len);
+   const char *result;
+   intern_header_t *header;
+   char *newstr;
+
+   result = find_name(str, len, hash);
+   if (result)
+      return result;
+
+   if (!intern_table || (intern_used + 1) * 4 > (intern_mask + 1) * 3)
+      grow_table();
+
+   header = (intern_header_t *) arena_alloc(sizeof(intern_header_t) + len + 1);
+   header->hash_val = hash;
+   header->len = (unsigned int) len;
+   newstr = (char *) (header + 1);
+   memcpy(newstr, str, len);
+   newstr[len] = '\0';
+
+   insert_slot(intern_table, hash, newstr);
+   intern_used++;
+   return newstr;
+}
+
+const char *intern_name(const char *str)
+{
+   return intern_name_len(str, strlen(str));
+}
+
+const char *lookup_intern_name(const char *str)
+{
+   size_t len = strlen(str);
+   return find_name(str, len, hash_str(str, len));
+}
+
+unsigned int intern_name_hash(const char *interned)
+{
+   return header_of(interned)->hash_val;
+}
+
+size_t intern_name_strlen(const char *interned)
+{
+   return header_of(interned)->len;
+}
@@ -0,0 +1,41 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(NAME_INTERN_H_)
+#define NAME_INTERN_H_
+
+#include <stddef.h>
+
+/**
+ * Path and file names handed to the server caches are interned into a
+ * bump-pointer arena.  Each distinct string is stored exactly once and
+ * never freed, so interned pointers can be compared directly and
+ * remain valid for the life of the server.  The djb2 hash of each
+ * string is stored alongside it.
+ **/
+
+/* Returns the canonical copy of str, adding it if needed */
+const char *intern_name(const char *str);
+const char *intern_name_len(const char *str, size_t len);
+
+/* Returns the canonical copy of str, or NULL if it was never interned */
+const char *lookup_intern_name(const char *str);
+
+/* Hash and length of an interned string, without rescanning it */
+unsigned int intern_name_hash(const char *interned);
+size_t intern_name_strlen(const char *interned);
+
+#endif
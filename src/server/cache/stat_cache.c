@@ -18,25 +18,19 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <string.h>
 #include <unistd.h>
 #include "spindle_debug.h"
+#include "name_intern.h"
+#include "stat_cache.h"
 
 #define STAT_TABLE_SIZE 1024
 
 typedef struct stat_entry_t
 {
-   char *pathname;
+   const char *pathname;
    char *data;
    unsigned int hash_value;
    struct stat_entry_t *next;
 } stat_entry_t;
 
-static unsigned int hashkey(char *str) {
-   unsigned int hash = 5381;
-   int c;
-   while ((c = *str++))
-      hash = ((hash << 5) + hash) + c;
-   return hash;
-}
-
 stat_entry_t *stat_table[STAT_TABLE_SIZE];
 
 int init_stat_cache()
@@ -48,13 +42,14 @@ void add_stat_cache(char *pathname, char *data)
 {
    unsigned int key;
    stat_entry_t *newentry;
+   const char *ipath = intern_name(pathname);
 
    debug_printf3("Adding stat cache entry %s = %s\n", pathname, data ? : "NULL");
 
-   key = hashkey(pathname) % STAT_TABLE_SIZE;
+   key = intern_name_hash(ipath) % STAT_TABLE_SIZE;
 
    newentry = (stat_entry_t *) malloc(sizeof(stat_entry_t));
-   newentry->pathname = strdup(pathname);
+   newentry->pathname = ipath;
    newentry->data = data;
    newentry->hash_value = key;
    newentry->next = stat_table[key];
@@ -66,8 +61,14 @@ int lookup_stat_cache(char *pathname, char **data)
 {
    unsigned int key;
    stat_entry_t *entry;
+   const char *ipath = lookup_intern_name(pathname);
 
-   key = hashkey(pathname) % STAT_TABLE_SIZE;
+   if (!ipath) {
+      *data = NULL;
+      debug_printf3("Looked up stat cache entry %s, not cached\n", pathname);
+      return -1;
+   }
+   key = intern_name_hash(ipath) % STAT_TABLE_SIZE;
    entry = stat_table[key];
 
    for (;;) {      
@@ -76,7 +77,7 @@ int lookup_stat_cache(char *pathname, char **data)
          debug_printf3("Looked up stat cache entry %s, not cached\n", pathname);
          return -1;
       }
-      if (entry->hash_value != key || strcmp(entry->pathname, pathname) != 0) {
+      if (entry->pathname != ipath) {
          entry = entry->next;
          continue;
       }
@@ -85,3 +86,34 @@ int lookup_stat_cache(char *pathname, char **data)
       return 0;
    }
 }
+
+void remove_stat_cache(char *pathname)
+{
+   unsigned int key;
+   stat_entry_t **entry, *found;
+   const char *ipath = lookup_intern_name(pathname);
+
+   if (!ipath)
+      return;
+   key = intern_name_hash(ipath) % STAT_TABLE_SIZE;
+   for (entry = stat_table + key; *entry; entry = &(*entry)->next) {
+      if ((*entry)->pathname != ipath)
+         continue;
+      found = *entry;
+      *entry = found->next;
+      free(found);
+      debug_printf3("Removed stat cache entry %s\n", pathname);
+      return;
+   }
+}
+
+void foreach_stat_cache(stat_cache_cb_t cb, void *arg)
+{
+   unsigned int i;
+   stat_entry_t *entry;
+
+   for (i = 0; i < STAT_TABLE_SIZE; i++) {
+      for (entry = stat_table[i]; entry; entry = entry->next)
+         cb(entry->pathname, entry->data, arg);
+   }
+}
@@ -23,4 +23,11 @@ int init_stat_cache();
 void add_stat_cache(char *pathname, char *data);
 int lookup_stat_cache(char *pathname, char **data);
 
+/* Drop pathname's entry, so the next lookup misses.  The data isn't freed */
+void remove_stat_cache(char *pathname);
+
+/* Call cb for every entry; cb must not add entries */
+typedef void (*stat_cache_cb_t)(const char *pathname, char *data, void *arg);
+void foreach_stat_cache(stat_cache_cb_t cb, void *arg);
+
 #endif
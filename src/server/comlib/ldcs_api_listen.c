@@ -19,9 +19,37 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <unistd.h>
 #include <string.h>
 #include <sys/inotify.h>
+#include <sys/epoll.h>
 #include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_SINGLE_MMAP)
+#define LISTEN_HAVE_URING
+#endif
+#endif
+#endif
 
 #include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+
+/* Events handled per epoll_wait */
+#define LISTEN_MAX_EVENTS 64
+
+/* Callbacks run at the end of each pass */
+#define LISTEN_MAX_FLUSH_CBS 4
+
+/* Submission and completion queue sizes of the io_uring engine */
+#define LISTEN_URING_ENTRIES 256
+#define LISTEN_URING_CQ_ENTRIES 4096
+
+/* user_data of the poll removes, whose completions are dropped */
+#define LISTEN_URING_REMOVE ((uint64_t) -1)
 
 /* client description structure */
 typedef enum {
@@ -37,7 +65,11 @@ struct ldcs_listen_data_item_struct
    int                            id;
    int                            (*cb_func) ( int fd, int id, void *data );
    void*                          data;
+   int                            (*wr_cb_func) ( int fd, int id, void *data );
+   void*                          wr_data;
    ldcs_listen_data_item_status_t state;
+   unsigned int                   gen;   /* bumped on reuse, so stale events are ignored */
+   int                            armed; /* io_uring engine: a poll for the item is in the ring */
 };
 typedef struct ldcs_listen_data_item_struct ldcs_listen_data_item_t;
 
@@ -48,17 +80,286 @@ struct ldcs_listen_data_struct
    int item_table_used;
    ldcs_listen_data_item_t* item_table;
    int signal_end;
+   int epoll_fd;
+   int *fd_slot;       /* fd -> index in item_table, or -1 */
+   int fd_slot_size;
 };
 
 typedef struct ldcs_listen_data_struct ldcs_listen_data_t;
 
-static ldcs_listen_data_t ldcs_listen_data = {0, 0, 0, NULL, 0};
+/* What one wait returned for an item, from either engine */
+typedef struct {
+   int c;
+   unsigned int gen;
+   int readable;
+   int writable;
+} ldcs_listen_event_t;
+
+static ldcs_listen_data_t ldcs_listen_data = {0, 0, 0, NULL, 0, -1, NULL, 0};
 
 static int (*loop_exit_cb) ( int num_fds, void *data ) = NULL;
 static void *loop_exit_cb_data = NULL;
 
+static int (*flush_cb[LISTEN_MAX_FLUSH_CBS]) ( void *data );
+static void *flush_cb_data[LISTEN_MAX_FLUSH_CBS];
+static int num_flush_cbs = 0;
+
+static int (*wait_cb) ( int waiting, void *data ) = NULL;
+static void *wait_cb_data = NULL;
+
 static int do_exit = 0;
 
+#if defined(LISTEN_HAVE_URING)
+/**
+ * With ldcs_listen_use_io_uring, the loop waits on an io_uring rather than
+ * on epoll.  Each item has a one-shot poll in the ring, which is armed
+ * again after its callbacks run, so like epoll it's level-triggered: a
+ * poll checks for data already waiting as it's armed.  The polls a pass
+ * arms, the removes of those whose events changed, and the wait for the
+ * next completions all go in one io_uring_enter, where epoll needs an
+ * epoll_ctl for each change besides its epoll_wait.
+ **/
+static struct {
+   int fd;
+   unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+   unsigned *cq_head, *cq_tail, *cq_mask;
+   struct io_uring_sqe *sqes;
+   struct io_uring_cqe *cqes;
+   unsigned sq_entries;
+   unsigned to_submit;
+} uring = { -1 };
+
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+   return (int) syscall(__NR_io_uring_enter, uring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Submit what's queued without waiting, to make room in the ring */
+static int uring_submit() {
+   int r;
+   while (uring.to_submit) {
+      r = uring_enter(uring.to_submit, 0, 0);
+      if (r == -1 && errno == EINTR) continue;
+      if (r == -1) {
+         err_printf("Could not submit to io_uring: %s\n", strerror(errno));
+         return(-1);
+      }
+      uring.to_submit -= r;
+   }
+   return(0);
+}
+
+static struct io_uring_sqe *uring_get_sqe() {
+   unsigned head, tail = *uring.sq_tail;
+   struct io_uring_sqe *sqe;
+
+   head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+   if (tail - head >= uring.sq_entries) {
+      if (uring_submit() == -1) return(NULL);
+      head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+      if (tail - head >= uring.sq_entries) return(NULL);
+   }
+   sqe = uring.sqes + (tail & *uring.sq_mask);
+   memset(sqe, 0, sizeof(*sqe));
+   return(sqe);
+}
+
+static void uring_queue_sqe(struct io_uring_sqe *sqe) {
+   unsigned tail = *uring.sq_tail;
+   uring.sq_array[tail & *uring.sq_mask] = (unsigned) (sqe - uring.sqes);
+   __atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+   uring.to_submit++;
+}
+
+static uint64_t item_user_data( int c ) {
+   return ((uint64_t) ldcs_listen_data.item_table[c].gen << 32) | (uint32_t) c;
+}
+
+/* queue a poll for item c, for reading, and writing if it has a write callback */
+static int uring_arm( int c ) {
+   struct io_uring_sqe *sqe = uring_get_sqe();
+   if (!sqe) return(-1);
+   sqe->opcode = IORING_OP_POLL_ADD;
+   sqe->fd = ldcs_listen_data.item_table[c].fd;
+   sqe->poll32_events = POLLIN;
+   if (ldcs_listen_data.item_table[c].wr_cb_func)
+      sqe->poll32_events |= POLLOUT;
+   sqe->user_data = item_user_data(c);
+   uring_queue_sqe(sqe);
+   ldcs_listen_data.item_table[c].armed = 1;
+   return(0);
+}
+
+/* queue the removal of item c's poll.  Its completion comes back
+   canceled, and the item is armed again if it's still registered */
+static void uring_disarm( int c ) {
+   struct io_uring_sqe *sqe;
+   if (!ldcs_listen_data.item_table[c].armed) return;
+   sqe = uring_get_sqe();
+   if (!sqe) return;
+   sqe->opcode = IORING_OP_POLL_REMOVE;
+   sqe->fd = -1;
+   sqe->addr = item_user_data(c);
+   sqe->user_data = LISTEN_URING_REMOVE;
+   uring_queue_sqe(sqe);
+}
+
+static int uring_init() {
+   struct io_uring_params p;
+   void *sq_ring, *cq_ring;
+   size_t sq_size, cq_size;
+
+   memset(&p, 0, sizeof(p));
+   p.flags = IORING_SETUP_CQSIZE;
+   p.cq_entries = LISTEN_URING_CQ_ENTRIES;
+   uring.fd = (int) syscall(__NR_io_uring_setup, LISTEN_URING_ENTRIES, &p);
+   if (uring.fd == -1) {
+      debug_printf("Could not create io_uring, listening with epoll: %s\n", strerror(errno));
+      return(-1);
+   }
+   if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+      debug_printf("Kernel's io_uring is too old, listening with epoll\n");
+      close(uring.fd);
+      uring.fd = -1;
+      return(-1);
+   }
+
+   sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+   if (cq_size > sq_size) sq_size = cq_size;
+   sq_ring = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd,
+                  IORING_OFF_SQ_RING);
+   if (sq_ring == MAP_FAILED) {
+      err_printf("Could not map io_uring: %s\n", strerror(errno));
+      close(uring.fd);
+      uring.fd = -1;
+      return(-1);
+   }
+   cq_ring = sq_ring;
+   uring.sqes = (struct io_uring_sqe *) mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                             uring.fd, IORING_OFF_SQES);
+   if (uring.sqes == MAP_FAILED) {
+      err_printf("Could not map io_uring entries: %s\n", strerror(errno));
+      munmap(sq_ring, sq_size);
+      close(uring.fd);
+      uring.fd = -1;
+      return(-1);
+   }
+
+   uring.sq_head = (unsigned *) ((char *) sq_ring + p.sq_off.head);
+   uring.sq_tail = (unsigned *) ((char *) sq_ring + p.sq_off.tail);
+   uring.sq_mask = (unsigned *) ((char *) sq_ring + p.sq_off.ring_mask);
+   uring.sq_array = (unsigned *) ((char *) sq_ring + p.sq_off.array);
+   uring.cq_head = (unsigned *) ((char *) cq_ring + p.cq_off.head);
+   uring.cq_tail = (unsigned *) ((char *) cq_ring + p.cq_off.tail);
+   uring.cq_mask = (unsigned *) ((char *) cq_ring + p.cq_off.ring_mask);
+   uring.cqes = (struct io_uring_cqe *) ((char *) cq_ring + p.cq_off.cqes);
+   uring.sq_entries = p.sq_entries;
+   uring.to_submit = 0;
+   return(0);
+}
+
+/* arm every item that's waiting for a poll, submit, and wait for
+   completions.  Returns how many events were put in events */
+static int uring_wait( ldcs_listen_event_t *events, int max ) {
+   struct io_uring_cqe *cqe;
+   unsigned head, tail;
+   int c, r, n = 0;
+
+   for(c=0;c<ldcs_listen_data.item_table_size;c++) {
+      if (ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE &&
+          !ldcs_listen_data.item_table[c].armed && uring_arm(c) == -1)
+         return(-1);
+   }
+
+   head = *uring.cq_head;
+   if (head == __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)) {
+      r = uring_enter(uring.to_submit, 1, IORING_ENTER_GETEVENTS);
+      if (r == -1) return(-1);
+      uring.to_submit -= r;
+   }
+   else if (uring_submit() == -1)
+      return(-1);
+
+   tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+   for (; head != tail && n < max; head++) {
+      cqe = uring.cqes + (head & *uring.cq_mask);
+      if (cqe->user_data == LISTEN_URING_REMOVE) continue;
+      c = (int) (uint32_t) cqe->user_data;
+      if (c >= ldcs_listen_data.item_table_size ||
+          ldcs_listen_data.item_table[c].gen != (unsigned int) (cqe->user_data >> 32))
+         continue;
+      ldcs_listen_data.item_table[c].armed = 0;
+      if (cqe->res == -ECANCELED) continue;
+      events[n].c = c;
+      events[n].gen = (unsigned int) (cqe->user_data >> 32);
+      /* a failed poll shows up as readable, so the callback sees the error */
+      events[n].readable = (cqe->res < 0) || (cqe->res & (POLLIN | POLLHUP | POLLERR));
+      events[n].writable = (cqe->res > 0) && (cqe->res & POLLOUT);
+      n++;
+   }
+   __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+   return(n);
+}
+
+int ldcs_listen_use_io_uring() {
+   if (uring.fd != -1) return(0);
+   if (uring_init() == -1) return(-1);
+   debug_printf("Listening with io_uring\n");
+   /* Items registered so far are armed on the loop's first pass */
+   if (ldcs_listen_data.epoll_fd != -1) {
+      close(ldcs_listen_data.epoll_fd);
+      ldcs_listen_data.epoll_fd = -1;
+   }
+   return(0);
+}
+
+#define USING_URING (uring.fd != -1)
+#else
+int ldcs_listen_use_io_uring() {
+   debug_printf("Built without io_uring, listening with epoll\n");
+   return(-1);
+}
+
+#define USING_URING 0
+#define uring_arm(c) (-1)
+#define uring_disarm(c)
+#define uring_wait(events, max) (-1)
+#endif
+
+/* index of the active item for fd, or -1 */
+static int find_slot( int fd ) {
+   int c;
+   if (fd < 0 || fd >= ldcs_listen_data.fd_slot_size) return(-1);
+   c = ldcs_listen_data.fd_slot[fd];
+   if (c == -1 || ldcs_listen_data.item_table[c].state != LDCS_LISTEN_STATUS_ACTIVE) return(-1);
+   return(c);
+}
+
+/* (re)arm the epoll entry of item c for reading, and writing if it has a write callback */
+static int update_epoll( int c, int op ) {
+   struct epoll_event ev;
+   memset(&ev, 0, sizeof(ev));
+   ev.events = EPOLLIN;
+   if (ldcs_listen_data.item_table[c].wr_cb_func)
+      ev.events |= EPOLLOUT;
+   ev.data.u64 = ((uint64_t) ldcs_listen_data.item_table[c].gen << 32) | (uint32_t) c;
+   return epoll_ctl(ldcs_listen_data.epoll_fd, op, ldcs_listen_data.item_table[c].fd, &ev);
+}
+
+/* stop watching item c, which is still in the table */
+static void forget_item( int c ) {
+   int fd = ldcs_listen_data.item_table[c].fd;
+   if (USING_URING)
+      uring_disarm(c);
+   else
+      /* fails harmlessly if the fd was already closed */
+      epoll_ctl(ldcs_listen_data.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+   if (fd >= 0 && fd < ldcs_listen_data.fd_slot_size && ldcs_listen_data.fd_slot[fd] == c)
+      ldcs_listen_data.fd_slot[fd] = -1;
+}
+
 int ldcs_listen_register_exit_loop_cb( int cb_func ( int num_fds, void *data ), 
                                        void * data) {
    int rc=0;
@@ -67,6 +368,25 @@ int ldcs_listen_register_exit_loop_cb( int cb_func ( int num_fds, void *data ),
    return(rc);
 }
 
+int ldcs_listen_register_flush_cb( int cb_func ( void *data ),
+                                  void * data) {
+   if (num_flush_cbs == LISTEN_MAX_FLUSH_CBS) {
+      err_printf("Too many listen flush callbacks\n");
+      return(-1);
+   }
+   flush_cb[num_flush_cbs]=cb_func;
+   flush_cb_data[num_flush_cbs]=data;
+   num_flush_cbs++;
+   return(0);
+}
+
+int ldcs_listen_register_wait_cb( int cb_func ( int waiting, void *data ),
+                                 void * data) {
+   wait_cb=cb_func;
+   wait_cb_data=data;
+   return(0);
+}
+
 int ldcs_listen_register_fd( int fd, 
                              int id, 
                              int cb_func ( int fd, int id, void *data ), 
@@ -74,6 +394,11 @@ int ldcs_listen_register_fd( int fd,
    int rc=0;
    int c;
 
+   if (ldcs_listen_data.epoll_fd == -1 && !USING_URING) {
+      ldcs_listen_data.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (ldcs_listen_data.epoll_fd == -1) _error("creating epoll fd");
+   }
+
    /* icrease size of list if needed */
    if (ldcs_listen_data.item_table_used >= ldcs_listen_data.item_table_size) {
       ldcs_listen_data.item_table = realloc(ldcs_listen_data.item_table, 
@@ -82,6 +407,8 @@ int ldcs_listen_register_fd( int fd,
       ldcs_listen_data.item_table_size = ldcs_listen_data.item_table_used + 16;
       for(c=ldcs_listen_data.item_table_used;(c<ldcs_listen_data.item_table_used + 16);c++) {
          ldcs_listen_data.item_table[c].state=LDCS_LISTEN_STATUS_FREE;
+         ldcs_listen_data.item_table[c].gen=0;
+         ldcs_listen_data.item_table[c].armed=0;
       }
    }
    for(c=0;(c<ldcs_listen_data.item_table_size);c++) {
@@ -89,6 +416,14 @@ int ldcs_listen_register_fd( int fd,
    }
    if(c==ldcs_listen_data.item_table_size) _error("internal error with item table (table full)");
 
+   /* grow the fd lookup table if needed */
+   if (fd >= ldcs_listen_data.fd_slot_size) {
+      int i, newsize = fd + 64;
+      ldcs_listen_data.fd_slot = realloc(ldcs_listen_data.fd_slot, newsize * sizeof(int));
+      for(i=ldcs_listen_data.fd_slot_size;i<newsize;i++) ldcs_listen_data.fd_slot[i] = -1;
+      ldcs_listen_data.fd_slot_size = newsize;
+   }
+
    /* store information of new item */
    ldcs_listen_data.item_table_used++;
    ldcs_listen_data.item_table[c].state = LDCS_LISTEN_STATUS_ACTIVE;
@@ -96,22 +431,56 @@ int ldcs_listen_register_fd( int fd,
    ldcs_listen_data.item_table[c].id    = id;
    ldcs_listen_data.item_table[c].data  = data;
    ldcs_listen_data.item_table[c].cb_func = cb_func;
+   ldcs_listen_data.item_table[c].wr_cb_func = NULL;
+   ldcs_listen_data.item_table[c].wr_data = NULL;
+   ldcs_listen_data.item_table[c].gen++;
+   ldcs_listen_data.item_table[c].armed = 0;
+   ldcs_listen_data.fd_slot[fd] = c;
+
+   /* the io_uring engine arms it on the loop's next pass */
+   if (!USING_URING && update_epoll(c, EPOLL_CTL_ADD) == -1) {
+      err_printf("Could not add fd %d to epoll: %s\n", fd, strerror(errno));
+      rc=-1;
+   }
 
    debug_printf3("registered fd %d id=%d  c=%d\n",fd,id,c);
 
    return(rc);
 }
 
+int ldcs_listen_register_write_cb( int fd,
+                                   int cb_func ( int fd, int id, void *data ),
+                                   void * data) {
+   int c = find_slot(fd), changed;
+   if(c == -1) {
+      debug_printf3("write callback for unregistered fd %d\n",fd);
+      return(-1);
+   }
+
+   debug_printf3("%s write callback for fd %d\n", cb_func ? "registered" : "cleared", fd);
+   changed = (!ldcs_listen_data.item_table[c].wr_cb_func != !cb_func);
+   ldcs_listen_data.item_table[c].wr_cb_func = cb_func;
+   ldcs_listen_data.item_table[c].wr_data = data;
+   if (changed && USING_URING) {
+      /* rearmed with the new events once the remove completes */
+      uring_disarm(c);
+      return(0);
+   }
+   if (changed && update_epoll(c, EPOLL_CTL_MOD) == -1) {
+      err_printf("Could not change epoll events for fd %d: %s\n", fd, strerror(errno));
+      return(-1);
+   }
+   return(0);
+}
+
 int ldcs_listen_unregister_fd( int fd ) {
    int rc=0;
    int c;
    debug_printf3("unregister fd %d ..\n",fd);
-   for(c=0;(c<ldcs_listen_data.item_table_size);c++) {
-      if ( ( ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE ) &&
-           ( ldcs_listen_data.item_table[c].fd==fd) ) break;
-   }
-   if(c<ldcs_listen_data.item_table_size) {
+   c = find_slot(fd);
+   if(c != -1) {
       debug_printf3("unregister fd %d c=%d\n",fd,c);
+      forget_item(c);
       ldcs_listen_data.item_table[c].state = LDCS_LISTEN_STATUS_FREE;
       ldcs_listen_data.item_table_used--;
    } else {
@@ -122,68 +491,109 @@ int ldcs_listen_unregister_fd( int fd ) {
    return(rc);
 }
 
+int ldcs_listen_disable_fd( int fd ) {
+   int c = find_slot(fd);
+   if (c == -1)
+      return(-1);
+   debug_printf("Marking fd %d in error\n", fd);
+   forget_item(c);
+   ldcs_listen_data.item_table[c].state = LDCS_LISTEN_STATUS_ERROR;
+   return(0);
+}
+
 int ldcs_listen_signal_end_listen_loop( ) {
    int rc=0;
    ldcs_listen_data.signal_end=1;
    return(rc);
 }
 
-#undef max
-#define max(x,y) ((x) > (y) ? (x) : (y))
+/* wait for events with epoll, and put them in events */
+static int epoll_wait_events( ldcs_listen_event_t *events, int max ) {
+   struct epoll_event epoll_events[LISTEN_MAX_EVENTS];
+   int i, r;
+
+   r = epoll_wait(ldcs_listen_data.epoll_fd, epoll_events, max < LISTEN_MAX_EVENTS ? max : LISTEN_MAX_EVENTS, -1);
+   for(i=0;i<r;i++) {
+      events[i].c   = (int) (uint32_t) epoll_events[i].data.u64;
+      events[i].gen = (unsigned int) (epoll_events[i].data.u64 >> 32);
+      /* as with select, a hangup or error shows up as readable */
+      events[i].readable = (epoll_events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+      events[i].writable = (epoll_events[i].events & EPOLLOUT) != 0;
+   }
+   return(r);
+}
 
 int ldcs_listen() {
    int rc=-1;
-   int r, nfds, fd, c;
-   fd_set rd, wr, er;
+   int r, i, c, fd, result;
+   unsigned int gen;
+   ldcs_listen_event_t events[LISTEN_MAX_EVENTS];
    int do_listen=0;
 
    debug_printf2("Listening for data\n");
    do_listen=(ldcs_listen_data.item_table_used>0);
    while(do_listen && !do_exit) {
-      nfds = 0;
-      FD_ZERO(&rd);
-      FD_ZERO(&wr);
-      FD_ZERO(&er);
-    
-      /* collect all fds */
-      for(c=0;c<ldcs_listen_data.item_table_size;c++) {
-         if ( ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE ) {
-            fd = ldcs_listen_data.item_table[c].fd;
-            FD_SET(fd, &rd);
-            nfds = max(nfds, fd);  
-         }
+      /* Level-triggered: the callbacks read one message per call, and
+         whatever is left must wake us again. */
+      if(wait_cb) wait_cb(1, wait_cb_data);
+      if (USING_URING)
+         r = uring_wait(events, LISTEN_MAX_EVENTS);
+      else
+         r = epoll_wait_events(events, LISTEN_MAX_EVENTS);
+      if(wait_cb) wait_cb(0, wait_cb_data);
+
+      /* signal caught, do nothing */
+      if (r == -1 && errno == EINTR) {
+         continue;
       }
-    
-      /* do select if sckets avail */
-      if(nfds>0) {
-         r = select(nfds + 1, &rd, &wr, &er, NULL);
       
-         /* signal caught, do nothing */
-         if (r == -1 && errno == EINTR) {
-            continue;
-         }
+      /* error happened */
+      if (r == -1)  _error("in listen");
       
-         /* error happened */
-         if (r == -1)  _error("in listen");
-      
-         /* call callback function for all active fds */
-         for(c=0;c<ldcs_listen_data.item_table_size;c++) {
-            if ( ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE ) {
-               fd     = ldcs_listen_data.item_table[c].fd;
-               if(FD_ISSET(fd, &rd)) {
-                  debug_printf3("Select returned data.  Calling callback for fd %d id=%d\n",fd, ldcs_listen_data.item_table[c].id);
-                  int result = ldcs_listen_data.item_table[c].cb_func(ldcs_listen_data.item_table[c].fd,
-                                                                      ldcs_listen_data.item_table[c].id,
-                                                                      ldcs_listen_data.item_table[c].data);
-                  if (result == -1) {
-                     debug_printf("Marking fd %d in error\n", ldcs_listen_data.item_table[c].fd);
-                     ldcs_listen_data.item_table[c].state = LDCS_LISTEN_STATUS_ERROR;
-                  }
-               }
+      /* call callback functions for the fds with events */
+      for(i=0;i<r;i++) {
+         c   = events[i].c;
+         gen = events[i].gen;
+         /* an earlier callback in this batch may have dropped (or replaced) the item */
+         if ( c >= ldcs_listen_data.item_table_size ||
+              ldcs_listen_data.item_table[c].gen != gen ||
+              ldcs_listen_data.item_table[c].state != LDCS_LISTEN_STATUS_ACTIVE ) continue;
+         fd = ldcs_listen_data.item_table[c].fd;
+
+         if (events[i].readable) {
+            debug_printf3("listen returned data.  Calling callback for fd %d id=%d\n",fd, ldcs_listen_data.item_table[c].id);
+            result = ldcs_listen_data.item_table[c].cb_func(fd,
+                                                            ldcs_listen_data.item_table[c].id,
+                                                            ldcs_listen_data.item_table[c].data);
+            if (result == -1 && ldcs_listen_data.item_table[c].gen == gen &&
+                ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE) {
+               debug_printf("Marking fd %d in error\n", fd);
+               forget_item(c);
+               ldcs_listen_data.item_table[c].state = LDCS_LISTEN_STATUS_ERROR;
+            }
+         }
+         /* the read callback may have drained (and cleared) the write side */
+         if ( events[i].writable &&
+              ldcs_listen_data.item_table[c].gen == gen &&
+              ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE &&
+              ldcs_listen_data.item_table[c].wr_cb_func ) {
+            debug_printf3("listen returned writable.  Calling write callback for fd %d\n",fd);
+            result = ldcs_listen_data.item_table[c].wr_cb_func(fd,
+                                                               ldcs_listen_data.item_table[c].id,
+                                                               ldcs_listen_data.item_table[c].wr_data);
+            if (result == -1 && ldcs_listen_data.item_table[c].gen == gen &&
+                ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE) {
+               debug_printf("Marking fd %d in error\n", fd);
+               forget_item(c);
+               ldcs_listen_data.item_table[c].state = LDCS_LISTEN_STATUS_ERROR;
             }
          }
       }
 
+      /* send whatever the callbacks held back during this pass */
+      for(i=0;i<num_flush_cbs;i++)
+         flush_cb[i](flush_cb_data[i]);
+
       do_listen=(ldcs_listen_data.item_table_used>0);
     
       /* callback will unregister fd is not needed */
@@ -22,11 +22,37 @@ int ldcs_listen_register_fd( int fd,
 			     int _ldcs_server_CB ( int fd, int id, void *data ), 
 			     void * data);
 
+/* Call cb_func whenever the already registered fd is writable, until
+   it's cleared by passing NULL.  Returns -1 if fd isn't registered. */
+int ldcs_listen_register_write_cb( int fd,
+                                   int cb_func ( int fd, int id, void *data ),
+                                   void * data);
+
+/* cb_func is called once per pass of the listen loop, after the fd
+   callbacks, so they can hold small writes back and send them together.
+   Several can be registered, and they run in the order they were, so one
+   that sends messages goes before the network's own. */
+int ldcs_listen_register_flush_cb( int cb_func ( void *data ),
+                                  void * data);
+
+/* cb_func is called with waiting=1 right before the listen loop blocks
+   for events, and with waiting=0 once it wakes up. */
+int ldcs_listen_register_wait_cb( int cb_func ( int waiting, void *data ),
+                                 void * data);
+
 int ldcs_listen_register_exit_loop_cb( int cb_func ( int num_fds, void *data ), 
 				       void * data);
 
 int ldcs_listen_unregister_fd( int fd );
 
+/* Stop listening to fd as if its callback had returned -1, for a
+   callback whose message is handled after it returned. */
+int ldcs_listen_disable_fd( int fd );
+
+/* Wait on an io_uring rather than on epoll.  Returns -1, and the loop
+   keeps using epoll, if the kernel or the build doesn't support it. */
+int ldcs_listen_use_io_uring( );
+
 int ldcs_listen_signal_end_listen_loop( );
 
 int ldcs_listen();
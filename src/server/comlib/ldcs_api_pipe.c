@@ -95,6 +95,12 @@ int ldcs_get_fd_pipe (int fd) {
   }
   return(realfd);
 }
+
+char *ldcs_get_in_fn_pipe (int fd) {
+  if ((fd<0) || (fd>fdlist_pipe_size) )  _error("wrong fd");
+  if(!fdlist_pipe[fd].inuse || fdlist_pipe[fd].type!=LDCS_PIPE_FD_TYPE_CONN) return(NULL);
+  return(fdlist_pipe[fd].in_fn);
+}
 /* end of fd list */
 
 extern int spindle_mkdir(char *orig_path);
@@ -269,13 +275,13 @@ int ldcs_destroy_server_pipe(int fd) {
 /* ************************************************************** */
 int ldcs_send_msg_pipe(int fd, ldcs_message_t * msg) {
 
-  int n;
+  ssize_t n;
 
   if ((fd<0) || (fd>fdlist_pipe_size) )  _error("wrong fd");
   
-  debug_printf3("sending message of type: %s len=%d data=%s ...\n",
+  debug_printf3("sending message of type: %s len=%ld data=%s ...\n",
 	       _message_type_to_str(msg->header.type),
-	       msg->header.len,msg->data );  
+	       (long) msg->header.len,msg->data );  
 
   n = _ldcs_write_pipe(fdlist_pipe[fd].out_fd,&msg->header,sizeof(msg->header));
   if (n < 0) _error("ERROR writing header to pipe");
@@ -291,7 +297,7 @@ int ldcs_send_msg_pipe(int fd, ldcs_message_t * msg) {
 
 ldcs_message_t * ldcs_recv_msg_pipe(int fd, ldcs_read_block_t block ) {
   ldcs_message_t *msg;
-  int n;
+  ssize_t n;
 
   if ((fd<0) || (fd>fdlist_pipe_size) )  _error("wrong fd");
 
@@ -318,15 +324,15 @@ ldcs_message_t * ldcs_recv_msg_pipe(int fd, ldcs_read_block_t block ) {
     msg->data = NULL;
   }
 
-  debug_printf3("received message of type: %s len=%d data=%s ...\n",
+  debug_printf3("received message of type: %s len=%ld data=%s ...\n",
 	       _message_type_to_str(msg->header.type),
-	       msg->header.len, msg->data );
+	       (long) msg->header.len, msg->data );
 
   return(msg);
 }
 
 int ldcs_recv_msg_static_pipe(int fd, ldcs_message_t *msg, ldcs_read_block_t block) {
-  int n;
+  ssize_t n;
   int rc=0;
   msg->header.type=LDCS_MSG_UNKNOWN;
   msg->header.len=0;
@@ -354,8 +360,8 @@ int ldcs_recv_msg_static_pipe(int fd, ldcs_message_t *msg, ldcs_read_block_t blo
     }
     if (n != msg->header.len) {
        int error = errno;
-       err_printf("Partial read on pipe.  Got %u / %u: %s (%d)\n",
-                  (unsigned) n, (unsigned) msg->header.len,
+       err_printf("Partial read on pipe.  Got %ld / %ld: %s (%d)\n",
+                  (long) n, (long) msg->header.len,
                   strerror(error), error);
        return -1;
     }
@@ -364,17 +370,17 @@ int ldcs_recv_msg_static_pipe(int fd, ldcs_message_t *msg, ldcs_read_block_t blo
     *msg->data = '\0';
   }
 
-  debug_printf3("received message of type: %s len=%d data=%s ...\n",
+  debug_printf3("received message of type: %s len=%ld data=%s ...\n",
 	       _message_type_to_str(msg->header.type),
-	       msg->header.len, msg->data );
+	       (long) msg->header.len, msg->data );
 
   return(rc);
 }
 
 
-int _ldcs_read_pipe(int fd, void *data, int bytes, ldcs_read_block_t block ) {
+ssize_t _ldcs_read_pipe(int fd, void *data, size_t bytes, ldcs_read_block_t block ) {
 
-  int         left,bsumread;
+  size_t      left,bsumread;
   ssize_t     btoread, bread;
   char       *dataptr;
   
@@ -411,8 +417,8 @@ int _ldcs_read_pipe(int fd, void *data, int bytes, ldcs_read_block_t block ) {
 
 
 
-int _ldcs_write_pipe(int fd, const void *data, int bytes ) {
-  int         left,bsumwrote;
+ssize_t _ldcs_write_pipe(int fd, const void *data, size_t bytes ) {
+  size_t      left,bsumwrote;
   ssize_t     bwrite, bwrote;
   char       *dataptr;
   
@@ -423,6 +429,10 @@ int _ldcs_write_pipe(int fd, const void *data, int bytes ) {
   while (left > 0) {
     bwrite     = left;
     bwrote     = write(fd, dataptr, bwrite);
+    if (bwrote < 0) {
+      if (errno == EINTR) continue;
+      return(bwrote);
+    }
     left      -= bwrote;
     dataptr   += bwrote;
     bsumwrote += bwrote;
@@ -0,0 +1,281 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_pipe.h"
+#include "ldcs_audit_server_process.h"
+#include "shmring.h"
+
+/**
+ * The shmem transport moves messages through a pair of shared memory
+ * rings per client (see utils/shmring.c), and uses the pipe transport to
+ * find new clients and to wake the server.
+ *
+ * The client->server fifo carries one byte, the doorbell, for as long
+ * as the client's ring has unread messages.  The client writes it when
+ * a message lands in an empty ring, and the server reads it back when
+ * it empties the ring.  So the fifo is readable, and the listen loop
+ * wakes us, exactly while there are messages or the client has hung up.
+ * The client waits on a futex for answers, so nothing is written to
+ * the server->client fifo.
+ **/
+
+typedef struct {
+   shmring_conn_t *conn;
+   char *path;
+} shmem_conn_t;
+
+static shmem_conn_t *shmem_conns = NULL;
+static int shmem_conns_size = 0;
+
+static shmem_conn_t *get_shmem_conn(int connid)
+{
+   int i, newsize;
+   if (connid >= shmem_conns_size) {
+      newsize = connid + 32;
+      shmem_conns = (shmem_conn_t *) realloc(shmem_conns, newsize * sizeof(shmem_conn_t));
+      if (!shmem_conns)
+         _error("could not allocate shared memory connection table");
+      for (i = shmem_conns_size; i < newsize; i++) {
+         shmem_conns[i].conn = NULL;
+         shmem_conns[i].path = NULL;
+      }
+      shmem_conns_size = newsize;
+   }
+   return shmem_conns + connid;
+}
+
+/**
+ * Map the rings of connid.  The client creates them beside its fifos once
+ * it has connected, and before it sends anything.
+ **/
+static shmring_conn_t *get_rings(int connid)
+{
+   shmem_conn_t *sconn = get_shmem_conn(connid);
+   char *in_fn, *slash;
+   char path[MAX_PATH_LEN];
+   int pid = 0;
+
+   if (sconn->conn)
+      return sconn->conn;
+
+   in_fn = ldcs_get_in_fn_pipe(connid);
+   if (!in_fn)
+      return NULL;
+   slash = strrchr(in_fn, '/');
+   if (!slash || sscanf(slash + 1, "fifo-%d-", &pid) != 1) {
+      err_printf("Could not find client pid in fifo name %s\n", in_fn);
+      return NULL;
+   }
+   snprintf(path, sizeof(path), "%.*s/shm-%d", (int) (slash - in_fn), in_fn, pid);
+
+   sconn->conn = shmring_attach(path);
+   if (!sconn->conn)
+      return NULL;
+   sconn->path = strdup(path);
+   debug_printf3("Mapped shared memory rings %s for connection %d\n", path, connid);
+   return sconn->conn;
+}
+
+/**
+ * Wait for the client's fifo to become readable
+ **/
+static int wait_doorbell(int in_fd, ldcs_read_block_t block)
+{
+   struct pollfd pfd;
+   int result;
+
+   pfd.fd = in_fd;
+   pfd.events = POLLIN;
+   do {
+      pfd.revents = 0;
+      result = poll(&pfd, 1, block == LDCS_READ_BLOCK ? -1 : 0);
+   } while (result == -1 && errno == EINTR);
+   return result;
+}
+
+/**
+ * Take back the doorbell once the ring is empty.  The client writes it
+ * right after its message, so it may not have landed yet.
+ **/
+static void clear_doorbell(int in_fd)
+{
+   char doorbell;
+   ssize_t result;
+
+   for (;;) {
+      result = read(in_fd, &doorbell, 1);
+      if (result >= 0)
+         return;
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+         wait_doorbell(in_fd, LDCS_READ_BLOCK);
+         continue;
+      }
+      err_printf("Error reading doorbell from client fifo: %s\n", strerror(errno));
+      return;
+   }
+}
+
+int ldcs_create_server_shmem(char* location, int number)
+{
+   return ldcs_create_server_pipe(location, number);
+}
+
+int ldcs_open_server_connection_shmem(int fd)
+{
+   return ldcs_open_server_connection_pipe(fd);
+}
+
+int ldcs_open_server_connections_shmem(int fd, int nc, int *more_avail)
+{
+   int connid = ldcs_open_server_connections_pipe(fd, nc, more_avail);
+   if (connid >= 0) {
+      shmem_conn_t *sconn = get_shmem_conn(connid);
+      sconn->conn = NULL;
+      sconn->path = NULL;
+   }
+   return connid;
+}
+
+int ldcs_close_server_connection_shmem(int connid)
+{
+   shmem_conn_t *sconn = get_shmem_conn(connid);
+
+   if (sconn->conn) {
+      shmring_detach(sconn->conn);
+      sconn->conn = NULL;
+   }
+   if (sconn->path) {
+      if (unlink(sconn->path) == -1)
+         debug_printf3("error while unlinking shared memory rings %s: %s\n", sconn->path, strerror(errno));
+      free(sconn->path);
+      sconn->path = NULL;
+   }
+   return ldcs_close_server_connection_pipe(connid);
+}
+
+int ldcs_destroy_server_shmem(int cid)
+{
+   return ldcs_destroy_server_pipe(cid);
+}
+
+int ldcs_get_fd_shmem(int fd)
+{
+   return ldcs_get_fd_pipe(fd);
+}
+
+int ldcs_get_aux_fd_shmem()
+{
+   return -1;
+}
+
+int ldcs_socket_id_to_nc_shmem(int id, int fd, ldcs_process_data_t *process_data)
+{
+   return id;
+}
+
+int ldcs_send_msg_shmem(int connid, ldcs_message_t *msg)
+{
+   shmring_conn_t *conn = get_rings(connid);
+   int was_empty;
+
+   debug_printf3("sending message of type: %s len=%ld\n",
+                 _message_type_to_str(msg->header.type), (long) msg->header.len);
+   if (!conn) {
+      err_printf("No shared memory rings to send message to connection %d\n", connid);
+      return -1;
+   }
+
+   if (shmring_write(&conn->to_client, &msg->header, sizeof(msg->header),
+                     msg->data, msg->header.len, ldcs_get_fd_pipe(connid), &was_empty) == -1) {
+      err_printf("Could not send message on connection %d\n", connid);
+      return -1;
+   }
+   return 0;
+}
+
+int ldcs_recv_msg_static_shmem(int connid, ldcs_message_t *msg, ldcs_read_block_t block)
+{
+   shmring_conn_t *conn;
+   int in_fd = ldcs_get_fd_pipe(connid);
+   ssize_t result;
+   char doorbell;
+
+   msg->header.type = LDCS_MSG_UNKNOWN;
+   msg->header.len = 0;
+
+   for (;;) {
+      conn = get_rings(connid);
+      if (conn && !shmring_empty(&conn->to_server))
+         break;
+
+      if (wait_doorbell(in_fd, block) == 0)
+         return 0;
+      conn = get_rings(connid);
+      if (conn && !shmring_empty(&conn->to_server))
+         break;
+
+      /* A doorbell with an empty ring is left over from messages we already
+         took, since back to back messages may ring twice.  Drain them and
+         look again.  Only the end of the fifo means the client hung up. */
+      do {
+         result = read(in_fd, &doorbell, 1);
+      } while (result == 1 || (result == -1 && errno == EINTR));
+      if (result == 0)
+         goto client_end;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+         err_printf("Error reading doorbell from client fifo: %s\n", strerror(errno));
+         goto client_end;
+      }
+   }
+
+   if (shmring_read(&conn->to_server, &msg->header, sizeof(msg->header), in_fd) == -1)
+      goto client_end;
+   if (msg->header.len > 0) {
+      if (shmring_read(&conn->to_server, msg->data, msg->header.len, in_fd) == -1)
+         goto client_end;
+   }
+   else {
+      *msg->data = '\0';
+   }
+
+   if (shmring_empty(&conn->to_server))
+      clear_doorbell(in_fd);
+
+   debug_printf3("received message of type: %s len=%ld data=%s ...\n",
+                 _message_type_to_str(msg->header.type),
+                 (long) msg->header.len, msg->data);
+   return 0;
+
+  client_end:
+   /* Disconnect.  Return an artificial client end message */
+   debug_printf2("Client disconnected.  Returning END message\n");
+   msg->header.type = LDCS_MSG_END;
+   msg->header.len = 0;
+   msg->data = NULL;
+   return 0;
+}
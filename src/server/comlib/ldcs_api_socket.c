@@ -14,50 +14,82 @@ program; if not, write to the Free Software Foundation, Inc., 59 Temple
 Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h> 
+#include <sys/un.h>
 
 #include "ldcs_api.h"
 #include "ldcs_api_socket.h"
 #include "ldcs_audit_server_process.h"
 
+/**
+ * The socket transport connects clients to their server over a unix
+ * domain SOCK_SEQPACKET socket.  Each message is one record, header and
+ * data together, so it's sent and received with a single call, and the
+ * server can attach open file descriptors to answers (see
+ * ldcs_send_msg_fd).
+ *
+ * On Linux the socket is bound to the abstract name "spindle-<number>",
+ * which goes away with the server and leaves nothing in the file system.
+ * Abstract names have no permissions, so the server only keeps clients
+ * running as its own user.  Elsewhere the socket lives at
+ * $location/spindle_comm/sock-<number>.
+ **/
+
+/* How many connections to take from the listen queue at a time */
+#define ACCEPT_BATCH 64
+
 /* ************************************************************** */
 /* FD list                                                        */
 /* ************************************************************** */
 
-#define MAX_FD 100
+static struct fdlist_entry_t *ldcs_socket_fdlist = NULL;
+static int ldcs_socket_fdlist_size = 0;
+
+static int pending_fds[ACCEPT_BATCH];
+static int pending_cur = 0, pending_count = 0;
 
-struct fdlist_entry_t ldcs_socket_fdlist[MAX_FD];
-int ldcs_fdlist_socket_cnt=-1;
+static int get_new_fd_socket () {
+  int fd, i, newsize;
 
-int get_new_fd_socket () {
-  int fd;
-  if(ldcs_fdlist_socket_cnt==-1) {
-    /* init fd list */
-    for(fd=0;fd<MAX_FD;fd++) ldcs_socket_fdlist[fd].inuse=0;
+  for (fd = 0; fd < ldcs_socket_fdlist_size; fd++) {
+    if (!ldcs_socket_fdlist[fd].inuse)
+      break;
   }
-  if(ldcs_fdlist_socket_cnt+1<MAX_FD) {
-
-    fd=0;
-    while ( (fd<MAX_FD) && (ldcs_socket_fdlist[fd].inuse==1) ) fd++;
-    ldcs_socket_fdlist[fd].inuse=1;
-    ldcs_fdlist_socket_cnt++;
-    return(fd);
-  } else {
-    return(-1);
+  if (fd == ldcs_socket_fdlist_size) {
+    newsize = ldcs_socket_fdlist_size ? ldcs_socket_fdlist_size * 2 : 64;
+    ldcs_socket_fdlist = (struct fdlist_entry_t *) realloc(ldcs_socket_fdlist, newsize * sizeof(struct fdlist_entry_t));
+    if (!ldcs_socket_fdlist)
+      _error("could not allocate socket table");
+    for (i = ldcs_socket_fdlist_size; i < newsize; i++)
+      ldcs_socket_fdlist[i].inuse = 0;
+    ldcs_socket_fdlist_size = newsize;
   }
+
+  memset(ldcs_socket_fdlist + fd, 0, sizeof(struct fdlist_entry_t));
+  ldcs_socket_fdlist[fd].inuse = 1;
+  ldcs_socket_fdlist[fd].fd = -1;
+  ldcs_socket_fdlist[fd].server_fd = -1;
+  return fd;
 }
 
-void free_fd_socket (int fd) {
-    ldcs_socket_fdlist[fd].inuse=0;
-    ldcs_fdlist_socket_cnt--;
+static void free_fd_socket (int fd) {
+  ldcs_socket_fdlist[fd].inuse=0;
+}
+
+static void check_fd_socket (int fd) {
+  if ((fd<0) || (fd>=ldcs_socket_fdlist_size) || !ldcs_socket_fdlist[fd].inuse)  _error("wrong fd");
 }
 
 /* end of fd list */
@@ -65,14 +97,12 @@ void free_fd_socket (int fd) {
 
 int ldcs_get_fd_socket (int fd) {
   int realfd=-1;
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
-  if(ldcs_socket_fdlist[fd].inuse) {
-    if(ldcs_socket_fdlist[fd].type==LDCS_SOCKET_FD_TYPE_SERVER) {
-      realfd=ldcs_socket_fdlist[fd].server_fd;
-    }
-    if(ldcs_socket_fdlist[fd].type==LDCS_SOCKET_FD_TYPE_CONN) {
-      realfd=ldcs_socket_fdlist[fd].fd;
-    }
+  check_fd_socket(fd);
+  if(ldcs_socket_fdlist[fd].type==LDCS_SOCKET_FD_TYPE_SERVER) {
+    realfd=ldcs_socket_fdlist[fd].server_fd;
+  }
+  if(ldcs_socket_fdlist[fd].type==LDCS_SOCKET_FD_TYPE_CONN) {
+    realfd=ldcs_socket_fdlist[fd].fd;
   }
   return(realfd);
 }
@@ -81,67 +111,150 @@ int ldcs_get_fd_socket (int fd) {
 /* SERVER functions                                               */
 /* ************************************************************** */
 
+extern int spindle_mkdir(char *orig_path);
+
+/**
+ * Fill in the address clients use to reach server number.  Must match
+ * socket_address in client/client_comlib/client_api_socket.c
+ **/
+static int socket_address(char *location, int number, struct sockaddr_un *addr, socklen_t *addr_len)
+{
+  int len;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+#if defined(__linux__)
+  len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "spindle-%d", number) + 1;
+#else
+  len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/spindle_comm/sock-%d", location, number);
+#endif
+  if (len >= (int) sizeof(addr->sun_path)) {
+    err_printf("Location %s is too long for a unix socket path\n", location);
+    return -1;
+  }
+  *addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+  return 0;
+}
 
 int ldcs_create_server_socket(char* location, int number) {
   int fd, sockfd;
-  struct sockaddr_in serv_addr;
+  struct sockaddr_un serv_addr;
+  socklen_t serv_addr_len;
+
+#if !defined(__linux__)
+  char staging_dir[MAX_PATH_LEN];
+  snprintf(staging_dir, sizeof(staging_dir), "%s/spindle_comm", location);
+  if (-1 == spindle_mkdir(staging_dir)) {
+     err_printf("mkdir: ERROR during mkdir %s\n", staging_dir);
+     _error("mkdir failed");
+  }
+#endif
 
-  fd=get_new_fd_socket();
-  if(fd<0) return(-1);
+  if (socket_address(location, number, &serv_addr, &serv_addr_len) == -1)
+    return(-1);
 
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
   if (sockfd < 0)  _error("ERROR opening socket");
-  
   debug_printf3("after socket: -> sockfd=%d\n",sockfd);
   
-  bzero((char *) &serv_addr, sizeof(serv_addr));
-  serv_addr.sin_family      = AF_INET;
-  serv_addr.sin_addr.s_addr = INADDR_ANY;
-  serv_addr.sin_port        = htons(number);
-  if (bind(sockfd, (struct sockaddr *) &serv_addr,
-	   sizeof(serv_addr)) < 0)  {
-    debug_printf3("after bind: -> could not bind %d \n",number);
+  if (serv_addr.sun_path[0]) {
+    /* Left behind by a server that died */
+    unlink(serv_addr.sun_path);
+  }
+  if (bind(sockfd, (struct sockaddr *) &serv_addr, serv_addr_len) < 0)  {
+    err_printf("Could not bind socket %s%s: %s\n", serv_addr.sun_path[0] ? "" : "@",
+               serv_addr.sun_path[0] ? serv_addr.sun_path : serv_addr.sun_path + 1, strerror(errno));
+    close(sockfd);
     return(-1);
   }
-  
   debug_printf3("after bind: -> sockfd=%d\n",sockfd);
 
-  listen(sockfd,5);
-  
+  if (listen(sockfd, SOMAXCONN) < 0) {
+    err_printf("Could not listen on socket: %s\n", strerror(errno));
+    close(sockfd);
+    return(-1);
+  }
   debug_printf3("after listen: -> sockfd=%d\n",sockfd);
 
+  fd=get_new_fd_socket();
   ldcs_socket_fdlist[fd].type=LDCS_SOCKET_FD_TYPE_SERVER;
   ldcs_socket_fdlist[fd].server_fd=sockfd;
   ldcs_socket_fdlist[fd].conn_list=NULL;
   ldcs_socket_fdlist[fd].conn_list_size=0;
   ldcs_socket_fdlist[fd].conn_list_used=0;
+  ldcs_socket_fdlist[fd].path=serv_addr.sun_path[0] ? strdup(serv_addr.sun_path) : NULL;
 
   return(fd);
 }
 
-int ldcs_open_server_connection_socket(int fd) {
-  struct sockaddr_in cli_addr;
-  socklen_t clilen;
+/**
+ * Returns true if the client on sockfd runs as our user
+ **/
+static int check_peer(int sockfd)
+{
+  struct ucred cred;
+  socklen_t cred_len = sizeof(cred);
+
+  if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1) {
+    err_printf("Could not get credentials of client: %s\n", strerror(errno));
+    return 0;
+  }
+  if (cred.uid != geteuid()) {
+    err_printf("Dropping connection from pid %d, which runs as uid %d rather than %d\n",
+               (int) cred.pid, (int) cred.uid, (int) geteuid());
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Take every connection waiting on serverfd, up to ACCEPT_BATCH, so a
+ * burst of clients is registered in one wakeup
+ **/
+static void accept_batch(int serverfd)
+{
+  int newsockfd;
+
+  pending_cur = pending_count = 0;
+  while (pending_count < ACCEPT_BATCH) {
+    newsockfd = accept4(serverfd, NULL, NULL, SOCK_CLOEXEC);
+    if (newsockfd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        err_printf("Error accepting client connection: %s\n", strerror(errno));
+      break;
+    }
+    if (!check_peer(newsockfd)) {
+      close(newsockfd);
+      continue;
+    }
+    pending_fds[pending_count++] = newsockfd;
+  }
+  debug_printf3("accepted %d connections on serverfd=%d\n", pending_count, serverfd);
+}
+
+int ldcs_open_server_connections_socket(int fd, int nc, int *more_avail) {
   int connfd, serverfd, newsockfd;
 
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
+  *more_avail = 0;
+  check_fd_socket(fd);
   serverfd=ldcs_socket_fdlist[fd].server_fd;
   if(serverfd<0) return(-1);
 
-  clilen    = sizeof(cli_addr);
-  newsockfd = accept(serverfd, 
-		     (struct sockaddr *) &cli_addr, 
-		     &clilen);
-  if (newsockfd < 0) _error("ERROR on accept");
-  debug_printf3("after accept: -> serverfd=%d newsockfd=%d\n",serverfd,newsockfd);
-  
+  if (pending_cur == pending_count)
+    accept_batch(serverfd);
+  if (pending_cur == pending_count)
+    return(-1);
+  newsockfd = pending_fds[pending_cur++];
+  /* A full batch may have left more in the listen queue */
+  *more_avail = (pending_cur < pending_count) || (pending_count == ACCEPT_BATCH);
+
   /* add info to server fd data structure */
   connfd=get_new_fd_socket();
-  if(connfd<0) return(-1);
-
   ldcs_socket_fdlist[connfd].type=LDCS_SOCKET_FD_TYPE_CONN;
   ldcs_socket_fdlist[connfd].fd=newsockfd;
-  ldcs_socket_fdlist[connfd].server_fd=fd;
+  ldcs_socket_fdlist[connfd].serverid=fd;
 
   ldcs_socket_fdlist[fd].conn_list_used++;
   if (ldcs_socket_fdlist[fd].conn_list_used > ldcs_socket_fdlist[fd].conn_list_size) {
@@ -152,29 +265,54 @@ int ldcs_open_server_connection_socket(int fd) {
   }
   ldcs_socket_fdlist[fd].conn_list[ldcs_socket_fdlist[fd].conn_list_used-1]=connfd;
 
+  debug_printf3("new connection %d on socket %d\n", connfd, newsockfd);
   return(connfd);
 };
 
-int ldcs_open_server_connections_socket(int fd, int nc, int *more_avail) {
-  *more_avail=0;
-  return(ldcs_open_server_connection_socket(fd));
+int ldcs_open_server_connection_socket(int fd) {
+  int more_avail;
+  struct pollfd pfd;
+  int connfd;
+
+  check_fd_socket(fd);
+  for (;;) {
+    connfd = ldcs_open_server_connections_socket(fd, 0, &more_avail);
+    if (connfd >= 0)
+      return(connfd);
+    pfd.fd = ldcs_socket_fdlist[fd].server_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+      return(-1);
+  }
 };
 
 int ldcs_close_server_connection_socket(int fd) {
   int sockfd;
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
+  check_fd_socket(fd);
   sockfd=ldcs_socket_fdlist[fd].fd;
   if(sockfd<0) return(-1);
   close(sockfd);
+  ldcs_socket_fdlist[fd].fd=-1;
+  free_fd_socket(fd);
   return(0);
 };
 
 int ldcs_destroy_server_socket(int fd) {
   int serverfd;
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
+  check_fd_socket(fd);
   serverfd=ldcs_socket_fdlist[fd].server_fd;
   if(serverfd<0) return(-1);
   close(serverfd);
+  ldcs_socket_fdlist[fd].server_fd=-1;
+  while (pending_cur < pending_count)
+    close(pending_fds[pending_cur++]);
+  if (ldcs_socket_fdlist[fd].path) {
+    unlink(ldcs_socket_fdlist[fd].path);
+    free(ldcs_socket_fdlist[fd].path);
+    ldcs_socket_fdlist[fd].path=NULL;
+  }
+  free(ldcs_socket_fdlist[fd].conn_list);
+  free_fd_socket(fd);
   return(0);
 };
 
@@ -182,157 +320,159 @@ int ldcs_destroy_server_socket(int fd) {
 /* ************************************************************** */
 /* message transfer functions                                     */
 /* ************************************************************** */
-static int _ldcs_read_socket(int fd, void *data, int bytes, ldcs_read_block_t block) {
 
-  int         left,bsumread;
-  ssize_t      btoread, bread;
-  char       *dataptr;
-  
-  left      = bytes;
-  bsumread  = 0;
-  dataptr   = (char*) data;
-
-  while (left > 0)  {
-    btoread    = left;
-    bread      = read(fd, dataptr, btoread);
-    if(bread<0) {
-      if( (errno==EAGAIN) || (errno==EWOULDBLOCK) ) {
-	debug_printf3("read from socket: got EAGAIN or EWOULDBLOCK\n");
-	if(block==LDCS_READ_NO_BLOCK) return(0);
-	else continue;
-      } else { 
-         debug_printf3("read from socket: %ld bytes ... errno=%d (%s)\n",bread,errno,strerror(errno));
-      }
-    } else {
-      debug_printf3("read from socket: %ld bytes ...\n",bread);
-    }
+/**
+ * Send msg as one record, with passfd attached if it isn't -1.
+ **/
+static int send_record(int fd, ldcs_message_t *msg, int passfd) {
+  struct msghdr mh;
+  struct iovec iov[2];
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } ctrl;
+  ssize_t n;
+  int connfd;
+
+  check_fd_socket(fd);
+  connfd=ldcs_socket_fdlist[fd].fd;
 
-    if(bread>0) {
-      left      -= bread;
-      dataptr   += bread;
-      bsumread  += bread;
-    } else {
-      if(bread==0) return(bsumread);
-      else         return(bread);
-    }
+  debug_printf3("sending message of type: %s len=%ld%s\n",
+                _message_type_to_str(msg->header.type), (long) msg->header.len,
+                passfd != -1 ? " with descriptor" : "");
+
+  iov[0].iov_base = &msg->header;
+  iov[0].iov_len = sizeof(msg->header);
+  iov[1].iov_base = msg->data;
+  iov[1].iov_len = msg->header.len;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = iov;
+  mh.msg_iovlen = msg->header.len > 0 ? 2 : 1;
+  if (passfd != -1) {
+    mh.msg_control = ctrl.buf;
+    mh.msg_controllen = sizeof(ctrl.buf);
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &passfd, sizeof(int));
   }
-  return (bsumread);
-}
 
-static int _ldcs_write_socket(int fd, const void *data, int bytes ) {
-  int         left,bsumwrote;
-  size_t      bwrite, bwrote;
-  char       *dataptr;
-  
-  left      = bytes;
-  bsumwrote = 0;
-  dataptr   = (char*) data;
-
-  while (left > 0) {
-    bwrite     = left;
-    bwrote     = write(fd, dataptr, bwrite);
-    left      -= bwrote;
-    dataptr   += bwrote;
-    bsumwrote += bwrote;
+  do {
+    n = sendmsg(connfd, &mh, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    err_printf("Could not send message to client on connection %d: %s\n", fd, strerror(errno));
+    return(-1);
   }
-  return (bsumwrote);
+  return(0);
 }
 
 int ldcs_send_msg_socket(int fd, ldcs_message_t * msg) {
+  return send_record(fd, msg, -1);
+}
 
-  char help[41];
-  int n, connfd;
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
-  connfd=ldcs_socket_fdlist[fd].fd;
-
-  bzero(help,41);if(msg->data) strncpy(help,msg->data,40);
-  debug_printf3("sending message of type: %s len=%d data=%s ...\n",
-	       _message_type_to_str(msg->header.type),
-	       msg->header.len,help );
+/**
+ * Send msg with a copy of passfd attached.  The caller still owns passfd.
+ **/
+int ldcs_send_msg_fd_socket(int fd, ldcs_message_t *msg, int passfd) {
+  return send_record(fd, msg, passfd);
+}
 
-  n = _ldcs_write_socket(connfd,&msg->header,sizeof(msg->header));
-  if (n < 0) _error("ERROR writing header to socket");
+/**
+ * Receive one record into msg, whose data can hold up to size bytes.
+ * Returns the record's length, 0 at end of connection, -1 on error, or
+ * -2 if block is LDCS_READ_NO_BLOCK and no record is waiting.
+ **/
+static ssize_t recv_record(int fd, ldcs_message_t *msg, size_t size, ldcs_read_block_t block) {
+  struct msghdr mh;
+  struct iovec iov[2];
+  ssize_t n;
+  int connfd;
+
+  check_fd_socket(fd);
+  connfd=ldcs_socket_fdlist[fd].fd;
 
-  if(msg->header.len>0) {
-    n = _ldcs_write_socket(connfd,(void *) msg->data,msg->header.len);
-    if (n < 0) _error("ERROR writing data to socket");
-  }
-  
+  iov[0].iov_base = &msg->header;
+  iov[0].iov_len = sizeof(msg->header);
+  iov[1].iov_base = msg->data;
+  iov[1].iov_len = size;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = iov;
+  mh.msg_iovlen = size ? 2 : 1;
   
-  return(0);
+  do {
+    n = recvmsg(connfd, &mh, block == LDCS_READ_NO_BLOCK ? MSG_DONTWAIT : 0);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return(-2);
+    debug_printf3("read from socket failed: %s\n", strerror(errno));
+    return(0);
+  }
+  if (n == 0)
+    return(0);
+  if ((mh.msg_flags & MSG_TRUNC) || n < (ssize_t) sizeof(msg->header) ||
+      n - sizeof(msg->header) != (size_t) msg->header.len) {
+    err_printf("Received malformed message of %ld bytes on connection %d\n", (long) n, fd);
+    return(-1);
+  }
+  return(n);
 }
 
 ldcs_message_t * ldcs_recv_msg_socket(int fd,  ldcs_read_block_t block) {
   ldcs_message_t *msg;
-  char help[41];
-  int n, connfd;
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
-  connfd=ldcs_socket_fdlist[fd].fd;
+  ssize_t n;
 
   msg = (ldcs_message_t *) malloc(sizeof(ldcs_message_t));
   if (!msg)  _error("could not allocate memory for message");
-  
+  msg->data = (char *) malloc(LDCS_MAX_MSG_LEN);
+  if (!msg->data)  _error("could not allocate memory for message data");
 
-  n = _ldcs_read_socket(connfd,&msg->header,sizeof(msg->header), block);
-  if (n == 0) {
+  n = recv_record(fd, msg, LDCS_MAX_MSG_LEN, block);
+  if (n <= 0) {
+    free(msg->data);
     free(msg);
     return(NULL);
   }
-  if (n < 0) _error("ERROR reading header from socket");
-
-  if(msg->header.len>0) {
-
-    msg->data = (char *) malloc(msg->header.len);
-    if (!msg)  _error("could not allocate memory for message data");
-    
-    n = _ldcs_read_socket(connfd,msg->data,msg->header.len, LDCS_READ_BLOCK);
-    if (n < 0) _error("ERROR reading message data from socket");
-    if (n != msg->header.len) _error("received different number of bytes for message data");
-
-  } else {
+  if (!msg->header.len) {
+    free(msg->data);
     msg->data = NULL;
   }
 
-  bzero(help,41);if(msg->data) strncpy(help,msg->data,40);
-  debug_printf3("received message of type: %s len=%d data=%s ...\n",
-	       _message_type_to_str(msg->header.type),
-	       msg->header.len,help );
-  
+  debug_printf3("received message of type: %s len=%ld\n",
+                _message_type_to_str(msg->header.type), (long) msg->header.len);
   return(msg);
 }
 
-
+/**
+ * msg->data must hold LDCS_MAX_MSG_LEN bytes
+ **/
 int ldcs_recv_msg_static_socket(int fd, ldcs_message_t *msg,  ldcs_read_block_t block) {
-  char help[41];
-  int rc=0;
-  int n, connfd;
-  if ((fd<0) || (fd>MAX_FD) )  _error("wrong fd");
-  connfd=ldcs_socket_fdlist[fd].fd;
-
-
-  n = _ldcs_read_socket(connfd,&msg->header,sizeof(msg->header), block);
-  if (n == 0) return(rc);
-  if (n < 0) _error("ERROR reading header from socket");
-
-  if(msg->header.len>0) {
-
-    msg->data = (char *) malloc(msg->header.len);
-    if (!msg)  _error("could not allocate memory for message data");
-    
-    n = _ldcs_read_socket(connfd,msg->data,msg->header.len, LDCS_READ_BLOCK);
-    if (n == 0) return(rc);
-    if (n < 0) _error("ERROR reading message data from socket");
-    if (n != msg->header.len) _error("received different number of bytes for message data");
-
-  } else {
-    msg->data = NULL;
+  ssize_t n;
+
+  msg->header.type=LDCS_MSG_UNKNOWN;
+  msg->header.len=0;
+
+  n = recv_record(fd, msg, LDCS_MAX_MSG_LEN, block);
+  if (n == -2)
+    return(0);
+  if (n <= 0) {
+     /* Disconnect.  Return an artificial client end message */
+     debug_printf2("Client disconnected.  Returning END message\n");
+     msg->header.type = LDCS_MSG_END;
+     msg->header.len = 0;
+     msg->data = NULL;
+     return(0);
   }
 
-  bzero(help,41);if(msg->data) strncpy(help,msg->data,40);
-  debug_printf3("received message of type: %s len=%d data=%s ...\n",
-	       _message_type_to_str(msg->header.type),
-	       msg->header.len,help );
-  
+  if (!msg->header.len)
+    *msg->data = '\0';
+
+  debug_printf3("received message of type: %s len=%ld data=%.40s ...\n",
+                _message_type_to_str(msg->header.type), (long) msg->header.len,
+                msg->header.len ? msg->data : "");
   return(0);
 }
 
@@ -73,7 +73,49 @@ char* _message_type_to_str (ldcs_message_ids_t type) {
       STR_CASE(LDCS_MSG_SETTINGS);
       STR_CASE(LDCS_MSG_EXIT);
       STR_CASE(LDCS_MSG_EXIT_READY);
+      STR_CASE(LDCS_MSG_CACHE_ENTRIES_BATCH);
+      STR_CASE(LDCS_MSG_FILE_ALIAS);
+      STR_CASE(LDCS_MSG_PRELOAD_ALIAS);
+      STR_CASE(LDCS_MSG_FILE_QUERY_LAZY);
+      STR_CASE(LDCS_MSG_FILE_RANGE_QUERY);
+      STR_CASE(LDCS_MSG_FILE_RANGE_ANSWER);
+      STR_CASE(LDCS_MSG_LAZY_FILE);
+      STR_CASE(LDCS_MSG_FILE_RANGE_REQUEST);
+      STR_CASE(LDCS_MSG_FILE_RANGE_DATA);
+      STR_CASE(LDCS_MSG_FILE_QUERY_BATCH);
+      STR_CASE(LDCS_MSG_PEER_SEND);
+      STR_CASE(LDCS_MSG_FILE_QUERY_FD);
+      STR_CASE(LDCS_MSG_FILE_QUERY_SEARCH);
+      STR_CASE(LDCS_MSG_FILE_QUERY_FIRST);
+      STR_CASE(LDCS_MSG_FILE_BUNDLE);
+      STR_CASE(LDCS_MSG_PREFETCH_DIR);
+      STR_CASE(LDCS_MSG_SETTINGS_UPDATE);
+      STR_CASE(LDCS_MSG_STATS_REPORT);
       STR_CASE(LDCS_MSG_EXIT_CANCEL);
+      STR_CASE(LDCS_MSG_CLIENT_TIMING);
+      STR_CASE(LDCS_MSG_RELOCRULES_REQ);
+      STR_CASE(LDCS_MSG_RELOCRULES_RESP);
+      STR_CASE(LDCS_MSG_STARTUP_DONE);
+      STR_CASE(LDCS_MSG_DIR_QUERY);
+      STR_CASE(LDCS_MSG_READLINK_QUERY);
+      STR_CASE(LDCS_MSG_REALPATH_QUERY);
+      STR_CASE(LDCS_MSG_STRIPE_REQUEST);
+      STR_CASE(LDCS_MSG_STRIPE_DATA);
+      STR_CASE(LDCS_MSG_INVALIDATE);
+      STR_CASE(LDCS_MSG_HELLO);
+      STR_CASE(LDCS_MSG_HELLO_ANSWER);
+      STR_CASE(LDCS_MSG_FILE_QUERY_EXEC);
+      STR_CASE(LDCS_MSG_JIT_QUERY);
+      STR_CASE(LDCS_MSG_JIT_PUBLISH);
+      STR_CASE(LDCS_MSG_KVS_PUT);
+      STR_CASE(LDCS_MSG_KVS_FENCE);
+      STR_CASE(LDCS_MSG_KVS_GET);
+      STR_CASE(LDCS_MSG_KVS_ANSWER);
+      STR_CASE(LDCS_MSG_KVS_GATHER);
+      STR_CASE(LDCS_MSG_KVS_TABLE);
+      STR_CASE(LDCS_MSG_FILE_RANGE_PUSH);
+      STR_CASE(LDCS_MSG_JOIN_RANK);
+      STR_CASE(LDCS_MSG_JIT_CLAIM);
       STR_CASE(LDCS_MSG_UNKNOWN);
    }
    return "unknown";
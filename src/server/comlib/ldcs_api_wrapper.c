@@ -21,7 +21,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #if !defined(COMM)
 #if defined(COMM_PIPES)
 #define COMM pipe
-#elif defined(COMM_SOCKETS)
+#elif defined(COMM_SOCKET)
 #define COMM socket
 #elif defined(COMM_BITER)
 #define COMM biter
@@ -46,6 +46,9 @@ extern int RENAME(ldcs_get_fd)(int fd);
 extern int RENAME(ldcs_get_aux_fd)();
 extern int RENAME(ldcs_recv_msg_static)(int connid, ldcs_message_t *msg, ldcs_read_block_t block);
 extern int RENAME(ldcs_socket_id_to_nc)(int id, int fd, ldcs_process_data_t *process_data);
+#if defined(COMM_SOCKET)
+extern int ldcs_send_msg_fd_socket(int fd, ldcs_message_t *msg, int passfd);
+#endif
 
 int ldcs_create_server(char* location, int number)
 {
@@ -96,3 +99,21 @@ int ldcs_socket_id_to_nc(int id, int fd, ldcs_process_data_t *process_data)
 {
    return RENAME(ldcs_socket_id_to_nc)(id, fd, process_data);
 }
+
+int ldcs_can_send_fd()
+{
+#if defined(COMM_SOCKET)
+   return 1;
+#else
+   return 0;
+#endif
+}
+
+int ldcs_send_msg_fd(int fd, ldcs_message_t *msg, int passfd)
+{
+#if defined(COMM_SOCKET)
+   return ldcs_send_msg_fd_socket(fd, msg, passfd);
+#else
+   return ldcs_send_msg(fd, msg);
+#endif
+}
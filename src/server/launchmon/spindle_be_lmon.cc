@@ -27,6 +27,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <cstdlib>
 
 static bool push_env;
+static bool release_early;
 static char *environ_str = NULL;
 
 static int unpackfebe_cb(void* udatabuf, 
@@ -42,7 +43,7 @@ static int unpackfebe_cb(void* udatabuf,
    
    char *buffer = (char *) udatabuf;
    int pos = 0;
-   unsigned int send_env;
+   unsigned int send_env, release;
 
    memcpy(&args->port, buffer + pos, sizeof(args->port));
    pos += sizeof(args->port);
@@ -52,6 +53,9 @@ static int unpackfebe_cb(void* udatabuf,
 
    memcpy(&send_env, buffer + pos, sizeof(send_env));
    pos += sizeof(send_env);
+
+   memcpy(&release, buffer + pos, sizeof(release));
+   pos += sizeof(release);
    
    memcpy(&args->unique_id, buffer + pos, sizeof(args->unique_id));
    pos += sizeof(args->unique_id);
@@ -59,6 +63,7 @@ static int unpackfebe_cb(void* udatabuf,
    assert(pos == udatabuflen);
 
    push_env = (send_env != 0);
+   release_early = (release != 0);
 
    return 0;    
 }
@@ -140,6 +145,7 @@ int startLaunchmonBE(int argc, char *argv[], int security_type)
       unsigned int port;
       unsigned int num_ports;
       unsigned int send_env;
+      unsigned int release_early;
       unique_id_t unique_id;
    } conn_info;
    lmon_rc_e rc;
@@ -194,6 +200,7 @@ int startLaunchmonBE(int argc, char *argv[], int security_type)
          conn_info.num_ports = args.num_ports;
          conn_info.unique_id = args.unique_id;
          conn_info.send_env = push_env ? 1 : 0;
+         conn_info.release_early = release_early ? 1 : 0;
       }
    }
 
@@ -204,6 +211,7 @@ int startLaunchmonBE(int argc, char *argv[], int security_type)
       return -1;
    }
    push_env = (conn_info.send_env != 0);
+   release_early = (conn_info.release_early != 0);
 
    /* Broadcast environment to all nodes if necessary (currently done
       on BGQ). */
@@ -236,8 +244,14 @@ int startLaunchmonBE(int argc, char *argv[], int security_type)
    }
    
    
+   if (release_early) {
+      /* Let the job run while the servers connect.  Its processes wait
+         in spindle_bootstrap until our client socket is up. */
+      releaseApplication(NULL);
+   }
+
    result = spindleRunBE(conn_info.port, conn_info.num_ports, conn_info.unique_id, security_type,
-                         releaseApplication);
+                         release_early ? NULL : releaseApplication);
    if (result == -1) {
       err_printf("Failed in call to spindleInitBE\n");
       return -1;
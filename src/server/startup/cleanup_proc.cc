@@ -26,6 +26,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <string>
 #include <cstring>
 #include <cassert>
+#include <cstdio>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -127,11 +128,11 @@ bool CleanupProc::hadError()
 void CleanupProc::rmRecursive(string path)
 {
    struct stat buf;
-   int result = stat(path.c_str(), &buf);
+   int result = lstat(path.c_str(), &buf);
 
    if (result == -1)
       return;
-   else if ((buf.st_mode & S_IFLNK) || (!(buf.st_mode & S_IFDIR))) {
+   else if (!S_ISDIR(buf.st_mode)) {
       result = unlink(path.c_str());
       if (result == -1) {
          //Something's wrong, we shouldn't fail to unlink.  Stop deleting.
@@ -155,10 +156,20 @@ void CleanupProc::rmRecursive(string path)
    }
 }
 
+/**
+ * Each directory is renamed aside before it's emptied, which frees its
+ * name at once for the next job's server on this node.
+ **/
 void CleanupProc::rmDirs()
 {
+   char suffix[32];
+   snprintf(suffix, sizeof(suffix), ".trash.%d", getpid());
    for (set<string>::iterator i = dirs.begin(); i != dirs.end(); i++) {
-      rmRecursive(*i);
+      string trash = *i + string(suffix);
+      if (rename(i->c_str(), trash.c_str()) == 0)
+         rmRecursive(trash);
+      else
+         rmRecursive(*i);
    }
 }
 
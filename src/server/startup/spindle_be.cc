@@ -57,9 +57,30 @@ static int unpack_data(spindle_args_t *args, void *buffer, int buffer_size)
    unpack_param(args->use_launcher, buf, pos);
    unpack_param(args->startup_type, buf, pos);
    unpack_param(args->shm_cache_size, buf, pos);
+   unpack_param(args->cache_budget, buf, pos);
+   unpack_param(args->num_readers, buf, pos);
+   unpack_param(args->num_streams, buf, pos);
+   unpack_param(args->promote_children, buf, pos);
+   unpack_param(args->lateral_peers, buf, pos);
+   unpack_param(args->bandwidth, buf, pos);
+   unpack_param(args->background_bandwidth, buf, pos);
+   unpack_param(args->dscp, buf, pos);
+   unpack_param(args->server_nice, buf, pos);
+   unpack_param(args->server_numa, buf, pos);
+   unpack_param(args->disk_threshold, buf, pos);
    unpack_param(args->location, buf, pos);
    unpack_param(args->pythonprefix, buf, pos);
    unpack_param(args->preloadfile, buf, pos);
+   unpack_param(args->stats_report, buf, pos);
+   unpack_param(args->predict_trace, buf, pos);
+   unpack_param(args->reloc_rules, buf, pos);
+   unpack_param(args->disk_location, buf, pos);
+   unpack_param(args->shared_cache, buf, pos);
+   unpack_param(args->cluster_cache, buf, pos);
+   unpack_param(args->rack_cache, buf, pos);
+   unpack_param(args->server_cpus, buf, pos);
+   args->container_image = NULL; /* only the bootstrap uses it */
+   args->bcast_files = NULL;     /* only the front end uses it */
    assert(pos == buffer_size);
 
    return 0;    
@@ -97,6 +118,10 @@ static void initSecurity(int security_type, uint64_t unique_id)
          handshake.mechanism = hs_none;
          debug_printf("Initializing BE with NULL security\n");
          break;
+      case OPT_SEC_MUNGETICKET:
+         debug_printf("Initializing BE with munge ticket security\n");
+         handshake.mechanism = hs_munge_ticket;
+         break;
    }
 
    result = initialize_handshake_security(&handshake);
@@ -106,8 +131,8 @@ static void initSecurity(int security_type, uint64_t unique_id)
    }
 }
 
-int spindleRunBE(unsigned int port, unsigned int num_ports, unique_id_t unique_id, int security_type,
-                 int (*post_setup)(spindle_args_t *))
+static int runBE(unsigned int port, unsigned int num_ports, unique_id_t unique_id, int security_type,
+                 char *join_hosts, int (*post_setup)(spindle_args_t *))
 {
    int result;
    spindle_args_t args;
@@ -120,7 +145,7 @@ int spindleRunBE(unsigned int port, unsigned int num_ports, unique_id_t unique_i
    debug_printf3("spindleRunBE setting up network and receiving setup data\n");
    void *setup_data;
    int setup_data_size;
-   result = ldcs_audit_server_network_setup(port, num_ports, unique_id, &setup_data, &setup_data_size);
+   result = ldcs_audit_server_network_setup(port, num_ports, unique_id, join_hosts, &setup_data, &setup_data_size);
    if (result == -1) {
       err_printf("Error setting up network in spindleRunBE\n");
       return -1;
@@ -141,6 +166,63 @@ int spindleRunBE(unsigned int port, unsigned int num_ports, unique_id_t unique_i
    free(args.location);
    args.location = new_location;
 
+   if (args.disk_location[0] != '\0') {
+      new_location = parse_location(args.disk_location);
+      if (!new_location) {
+         err_printf("Failed to convert disk location %s\n", args.disk_location);
+         return -1;
+      }
+      debug_printf("Translated disk location from %s to %s\n", args.disk_location, new_location);
+   }
+   else
+      new_location = NULL;
+   free(args.disk_location);
+   args.disk_location = new_location;
+
+   if (args.shared_cache[0] != '\0') {
+      new_location = parse_location(args.shared_cache);
+      if (!new_location) {
+         err_printf("Failed to convert shared cache %s\n", args.shared_cache);
+         return -1;
+      }
+      debug_printf("Translated shared cache from %s to %s\n", args.shared_cache, new_location);
+   }
+   else
+      new_location = NULL;
+   free(args.shared_cache);
+   args.shared_cache = new_location;
+
+   if (args.cluster_cache[0] != '\0') {
+      new_location = parse_location(args.cluster_cache);
+      if (!new_location) {
+         err_printf("Failed to convert cluster cache %s\n", args.cluster_cache);
+         return -1;
+      }
+      debug_printf("Translated cluster cache from %s to %s\n", args.cluster_cache, new_location);
+   }
+   else
+      new_location = NULL;
+   free(args.cluster_cache);
+   args.cluster_cache = new_location;
+
+   if (args.rack_cache[0] != '\0') {
+      new_location = parse_location(args.rack_cache);
+      if (!new_location) {
+         err_printf("Failed to convert rack cache %s\n", args.rack_cache);
+         return -1;
+      }
+      debug_printf("Translated rack cache from %s to %s\n", args.rack_cache, new_location);
+   }
+   else
+      new_location = NULL;
+   free(args.rack_cache);
+   args.rack_cache = new_location;
+
+   if (args.server_cpus[0] == '\0') {
+      free(args.server_cpus);
+      args.server_cpus = NULL;
+   }
+
    result = ldcs_audit_server_process(&args);
    if (result == -1) {
       err_printf("Error in ldcs_audit_server_process\n");
@@ -168,3 +250,15 @@ int spindleRunBE(unsigned int port, unsigned int num_ports, unique_id_t unique_i
 
    return 0;
 }
+
+int spindleRunBE(unsigned int port, unsigned int num_ports, unique_id_t unique_id, int security_type,
+                 int (*post_setup)(spindle_args_t *))
+{
+   return runBE(port, num_ports, unique_id, security_type, NULL, post_setup);
+}
+
+int spindleJoinBE(unsigned int port, unsigned int num_ports, unique_id_t unique_id, int security_type,
+                  char *hosts)
+{
+   return runBE(port, num_ports, unique_id, security_type, hosts, NULL);
+}
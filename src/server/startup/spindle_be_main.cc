@@ -37,7 +37,8 @@ enum startup_type_t {
    lmon,
    serial,
    hostbin,
-   mpilaunch
+   mpilaunch,
+   join
 };
 startup_type_t startup_type;
 static int security_type;
@@ -45,6 +46,7 @@ static int number;
 static int port;
 static int num_ports;
 static unique_id_t unique_id;
+static char *join_hosts;
 
 int main(int argc, char *argv[])
 {
@@ -83,6 +85,9 @@ int main(int argc, char *argv[])
       case mpilaunch:
          result = startMPILaunchBE(port, num_ports, unique_id, security_type);
          break;
+      case join:
+         result = spindleJoinBE(port, num_ports, unique_id, security_type, join_hosts);
+         break;
       default:
          err_printf("Unknown startup mode\n");
          result = -1;
@@ -129,6 +134,10 @@ static int parseCommandLine(int argc, char *argv[])
          startup_type = mpilaunch;
          break;
       }
+      else if (strcmp(argv[i], "--spindle_join") == 0) {
+         startup_type = join;
+         break;
+      }
    }
 
    if (++i >= argc) return -1;   
@@ -137,7 +146,7 @@ static int parseCommandLine(int argc, char *argv[])
    if (++i >= argc) return -1;   
    number = atoi(argv[i]);
 
-   if (startup_type == hostbin || startup_type == mpilaunch) {
+   if (startup_type == hostbin || startup_type == mpilaunch || startup_type == join) {
       if (++i >= argc) return -1;
       port = atoi(argv[i]);
       if (++i >= argc) return -1;
@@ -146,5 +155,10 @@ static int parseCommandLine(int argc, char *argv[])
       unique_id = strtoul(argv[i], NULL, 10);
    }
 
+   if (startup_type == join) {
+      if (++i >= argc) return -1;
+      join_hosts = argv[i];
+   }
+
    return 0;
 }
@@ -0,0 +1,211 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <sys/types.h>
+#include <sys/vfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "localfs.h"
+
+#define LOCALFS_MAX_MOUNTS 512
+#define LOCALFS_NAMES_SIZE (64*1024)
+#define LOCALFS_LINE_SIZE 4096
+
+/* statfs f_type values, from linux/magic.h */
+#define EXT4_MAGIC     0xef53        /* also ext2 and ext3 */
+#define XFS_MAGIC      0x58465342
+#define BTRFS_MAGIC    0x9123683e
+#define TMPFS_MAGIC    0x01021994
+#define RAMFS_MAGIC    0x858458f6
+#define SQUASHFS_MAGIC 0x73717368
+#define OVERLAYFS_MAGIC 0x794c7630
+
+static const unsigned long local_magics[] = {
+   EXT4_MAGIC, XFS_MAGIC, BTRFS_MAGIC, TMPFS_MAGIC, RAMFS_MAGIC, SQUASHFS_MAGIC, OVERLAYFS_MAGIC
+};
+
+/* Mount types that are never local, and that statfs would go over the
+   network for, or trigger a mount on */
+static const char *remote_types[] = {
+   "nfs", "nfs4", "lustre", "gpfs", "cifs", "smb3", "beegfs", "panfs", "ceph", "autofs", NULL
+};
+
+/* Mount types whose metadata is served by separate metadata servers */
+static const char *parallel_types[] = {
+   "lustre", "gpfs", NULL
+};
+
+typedef struct {
+   const char *path;
+   int len;
+   int local;                 /* 1 if local, 0 if not, -1 if not yet checked */
+   int parallel;              /* 1 if a parallel file system */
+} localfs_mount_t;
+
+static localfs_mount_t mounts[LOCALFS_MAX_MOUNTS];
+static int num_mounts;
+static char names[LOCALFS_NAMES_SIZE];
+static int names_used;
+
+static int is_type_in(const char **types, const char *type)
+{
+   int i;
+   for (i = 0; types[i]; i++) {
+      if (strcmp(types[i], type) == 0)
+         return 1;
+   }
+   return 0;
+}
+
+/* Copy the mount table's field at *pos to out, undoing its octal escapes */
+static int next_field(char **pos, char *out, int out_size)
+{
+   char *c = *pos;
+   int len = 0;
+
+   while (*c == ' ' || *c == '\t')
+      c++;
+   if (!*c)
+      return -1;
+   while (*c && *c != ' ' && *c != '\t') {
+      if (len + 1 >= out_size)
+         return -1;
+      if (c[0] == '\\' && c[1] >= '0' && c[1] <= '3' && c[2] >= '0' && c[2] <= '7' && c[3] >= '0' && c[3] <= '7') {
+         out[len++] = (char) (((c[1] - '0') << 6) | ((c[2] - '0') << 3) | (c[3] - '0'));
+         c += 4;
+      }
+      else
+         out[len++] = *c++;
+   }
+   out[len] = '\0';
+   *pos = c;
+   return len;
+}
+
+static void add_mount(char *line)
+{
+   char field[LOCALFS_LINE_SIZE], path[LOCALFS_LINE_SIZE];
+   int len;
+
+   if (next_field(&line, field, sizeof(field)) == -1)
+      return;
+   len = next_field(&line, path, sizeof(path));
+   if (len <= 0 || path[0] != '/' || next_field(&line, field, sizeof(field)) == -1)
+      return;
+   if (num_mounts == LOCALFS_MAX_MOUNTS || names_used + len + 1 > LOCALFS_NAMES_SIZE)
+      return;
+
+   /* Take the trailing slash off everything but the root */
+   if (len > 1 && path[len-1] == '/')
+      path[--len] = '\0';
+   memcpy(names + names_used, path, len + 1);
+   mounts[num_mounts].path = names + names_used;
+   mounts[num_mounts].len = len;
+   mounts[num_mounts].local = is_type_in(remote_types, field) ? 0 : -1;
+   mounts[num_mounts].parallel = is_type_in(parallel_types, field);
+   names_used += len + 1;
+   num_mounts++;
+}
+
+int localfs_init()
+{
+   char buffer[LOCALFS_LINE_SIZE];
+   char *line, *newline;
+   int fd, used = 0;
+   ssize_t result;
+
+   num_mounts = 0;
+   names_used = 0;
+   fd = open("/proc/self/mounts", O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return -1;
+   for (;;) {
+      result = read(fd, buffer + used, sizeof(buffer) - used - 1);
+      if (result <= 0)
+         break;
+      used += result;
+      buffer[used] = '\0';
+      line = buffer;
+      while ((newline = strchr(line, '\n')) != NULL) {
+         *newline = '\0';
+         add_mount(line);
+         line = newline + 1;
+      }
+      used -= line - buffer;
+      if (used == sizeof(buffer) - 1)
+         used = 0;           /* A line longer than any path, drop it */
+      memmove(buffer, line, used);
+   }
+   close(fd);
+   return num_mounts ? 0 : -1;
+}
+
+/* Threads that race to check a mount get the same answer, so the answer
+   is only stored once it's known */
+static int check_mount(localfs_mount_t *m)
+{
+   struct statfs buf;
+   unsigned int i;
+   int local = 0;
+
+   if (statfs(m->path, &buf) == 0) {
+      for (i = 0; i < sizeof(local_magics) / sizeof(local_magics[0]); i++) {
+         if ((unsigned long) buf.f_type == local_magics[i])
+            local = 1;
+      }
+   }
+   m->local = local;
+   return local;
+}
+
+/* The mount path is on, or NULL */
+static localfs_mount_t *find_mount(const char *path)
+{
+   localfs_mount_t *best = NULL;
+   int i, len;
+
+   if (!path || path[0] != '/')
+      return NULL;
+
+   /* The last of the longest mount points over path is the one it's on */
+   for (i = 0; i < num_mounts; i++) {
+      len = mounts[i].len;
+      if (best && len < best->len)
+         continue;
+      if (len == 1 || (strncmp(mounts[i].path, path, len) == 0 && (path[len] == '/' || path[len] == '\0')))
+         best = mounts + i;
+   }
+   return best;
+}
+
+int localfs_is_local(const char *path)
+{
+   localfs_mount_t *m = find_mount(path);
+
+   if (!m)
+      return 0;
+   if (m->local == -1)
+      return check_mount(m);
+   return m->local;
+}
+
+int localfs_is_parallel(const char *path)
+{
+   localfs_mount_t *m = find_mount(path);
+   return m ? m->parallel : 0;
+}
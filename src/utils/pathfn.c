@@ -14,6 +14,7 @@ program; if not, write to the Free Software Foundation, Inc., 59 Temple
 Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -111,6 +112,94 @@ int reducePath(char *dir)
    return 0;
 }
 
+/* Appends the components of path[0, len) to dir[0, *dir_len), resolving
+   '.', '..' and '//' as they're copied.  Components are found with memchr,
+   which libc vectorizes, so each byte is looked at about once. */
+static int appendComponents(char *dir, int *dir_len, const char *path, int len, int absolute,
+                            int result_size)
+{
+   const char *pos = path, *end = path + len, *slash;
+   int comp_len, cur = *dir_len;
+
+   while (pos < end) {
+      slash = (const char *) memchr(pos, '/', end - pos);
+      if (!slash)
+         slash = end;
+      comp_len = slash - pos;
+      if (comp_len == 0 || (comp_len == 1 && pos[0] == '.')) {
+         /* '//' or '/./' */
+      }
+      else if (comp_len == 2 && pos[0] == '.' && pos[1] == '.') {
+         if (cur == 0)
+            return -1;
+         do {
+            cur--;
+         } while (cur > 0 && dir[cur] != '/');
+      }
+      else {
+         if (cur + comp_len + 1 >= result_size)
+            return -1;
+         if (cur || absolute)
+            dir[cur++] = '/';
+         memcpy(dir + cur, pos, comp_len);
+         cur += comp_len;
+      }
+      pos = slash + 1;
+   }
+   *dir_len = cur;
+   return 0;
+}
+
+/* Like strncpy'ing path to dir then addCWDToDir and reducePath, but in
+   one pass.  Returns the length of dir, or -1 if it's too long or
+   backs out of the root, in which case dir is left as the three calls
+   would have left it. */
+int canonicalizeDir(const char *cwd, const char *path, int path_len, char *dir, int result_size)
+{
+   int dir_len = 0, result = 0, absolute = (path[0] == '/');
+
+   if (!absolute && cwd && cwd[0] != '\0') {
+      absolute = (cwd[0] == '/');
+      result = appendComponents(dir, &dir_len, cwd, strlen(cwd), absolute, result_size);
+   }
+   if (result == 0)
+      result = appendComponents(dir, &dir_len, path, path_len, absolute, result_size);
+   if (result == 0) {
+      dir[dir_len] = '\0';
+      return dir_len;
+   }
+
+   if (path_len >= result_size)
+      path_len = result_size - 1;
+   memcpy(dir, path, path_len);
+   dir[path_len] = '\0';
+   addCWDToDir(cwd, dir, result_size);
+   reducePath(dir);
+   return -1;
+}
+
+/* parseFilenameNoAlloc, addCWDToDir and reducePath on dir, in one pass
+   over name and cwd.  Returns the length of dir, or -1 as canonicalizeDir. */
+int canonicalizePath(const char *cwd, const char *name, char *file, char *dir, int result_size)
+{
+   int name_len = strlen(name), file_len;
+   const char *last_slash = (const char *) memrchr(name, '/', name_len);
+
+   if (!last_slash) {
+      parseFilenameNoAlloc(name, file, dir, result_size);
+      return canonicalizeDir(cwd, name, 0, dir, result_size);
+   }
+   file_len = name_len - (last_slash + 1 - name);
+   if (file_len >= result_size) {
+      parseFilenameNoAlloc(name, file, dir, result_size);
+      addCWDToDir(cwd, dir, result_size);
+      reducePath(dir);
+      return -1;
+   }
+   memcpy(file, last_slash + 1, file_len + 1);
+   return canonicalizeDir(cwd, name, last_slash - name, dir, result_size);
+}
+
 char *concatStrings(const char *str1, int str1_len, const char *str2, int str2_len) {
    char *buffer = NULL;
    unsigned cur_size = str1_len + str2_len + 1;
@@ -24,6 +24,8 @@ extern "C" {
 int parseFilenameNoAlloc(const char *name, char *file, char *dir, int result_size);
 int addCWDToDir(const char *cwd, char *dir, int result_size);
 int reducePath(char *dir);
+int canonicalizeDir(const char *cwd, const char *path, int path_len, char *dir, int result_size);
+int canonicalizePath(const char *cwd, const char *name, char *file, char *dir, int result_size);
 char *concatStrings(const char *str1, int str1_len, const char *str2, int str2_len);
 
 #if defined(__cplusplus)
@@ -0,0 +1,187 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <string.h>
+
+#include "relocrules.h"
+
+static int is_space(char c)
+{
+   return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Cut the next whitespace-separated word off *pos, or return NULL at the end of the line */
+static char *next_word(char **pos)
+{
+   char *c = *pos, *word;
+
+   while (is_space(*c))
+      c++;
+   if (*c == '\0' || *c == '#') {
+      *pos = c;
+      return NULL;
+   }
+   word = c;
+   while (*c != '\0' && *c != '#' && !is_space(*c))
+      c++;
+   if (*c == '#')
+      *c = '\0';
+   else if (*c != '\0')
+      *c++ = '\0';
+   *pos = c;
+   return word;
+}
+
+static int parse_size(const char *str, unsigned long long *size)
+{
+   unsigned long long val = 0;
+   const char *c;
+
+   if (*str < '0' || *str > '9')
+      return -1;
+   for (c = str; *c >= '0' && *c <= '9'; c++)
+      val = val * 10 + (*c - '0');
+   switch (*c) {
+      case 't': case 'T': val *= 1024; /* fall through */
+      case 'g': case 'G': val *= 1024; /* fall through */
+      case 'm': case 'M': val *= 1024; /* fall through */
+      case 'k': case 'K': val *= 1024;
+         c++;
+         /* fall through */
+      case '\0':
+         break;
+      default:
+         return -1;
+   }
+   if (*c != '\0')
+      return -1;
+   *size = val;
+   return 0;
+}
+
+static int parse_rule(char *line, reloc_rule_t *rule)
+{
+   char *pos = line, *action, *glob, *size, *extra;
+
+   action = next_word(&pos);
+   if (!action)
+      return 0;
+   glob = next_word(&pos);
+   size = glob ? next_word(&pos) : NULL;
+   extra = size ? next_word(&pos) : NULL;
+   if (!glob || extra)
+      return -1;
+
+   if (strcmp(action, "relocate") == 0)
+      rule->action = reloc_relocate;
+   else if (strcmp(action, "push") == 0)
+      rule->action = reloc_push;
+   else if (strcmp(action, "pass") == 0)
+      rule->action = reloc_pass;
+   else if (strcmp(action, "jit") == 0)
+      rule->action = reloc_jit;
+   else
+      return -1;
+   rule->glob = glob;
+
+   rule->size_cmp = 0;
+   rule->size = 0;
+   if (size) {
+      if (rule->action == reloc_jit || (*size != '>' && *size != '<'))
+         return -1;
+      rule->size_cmp = (*size == '>') ? 1 : -1;
+      if (parse_size(size + 1, &rule->size) == -1)
+         return -1;
+   }
+   return 1;
+}
+
+int reloc_rules_parse(char *text, reloc_rule_t *rules, int max_rules, int *errline)
+{
+   char *line, *eol;
+   int num_rules = 0, lineno = 0, result;
+
+   for (line = text; line && *line; line = eol) {
+      lineno++;
+      eol = strchr(line, '\n');
+      if (eol)
+         *eol++ = '\0';
+      if (num_rules == max_rules) {
+         *errline = lineno;
+         return -1;
+      }
+      result = parse_rule(line, rules + num_rules);
+      if (result == -1) {
+         *errline = lineno;
+         return -1;
+      }
+      num_rules += result;
+   }
+   return num_rules;
+}
+
+/**
+ * Match str against glob, going back to the last '*' on a mismatch, so
+ * it never takes more than length of str times length of glob steps
+ **/
+static int glob_match(const char *glob, const char *str)
+{
+   const char *star = NULL, *star_str = NULL;
+
+   while (*str) {
+      if (*glob == '*') {
+         while (*glob == '*')
+            glob++;
+         if (!*glob)
+            return 1;
+         star = glob;
+         star_str = str;
+      }
+      else if (*glob == '?' || *glob == *str) {
+         glob++;
+         str++;
+      }
+      else if (star) {
+         glob = star;
+         str = ++star_str;
+      }
+      else {
+         return 0;
+      }
+   }
+   while (*glob == '*')
+      glob++;
+   return *glob == '\0';
+}
+
+reloc_action_t reloc_rules_match(const reloc_rule_t *rules, int num_rules, const char *path,
+                                 long long size)
+{
+   int i;
+
+   for (i = 0; i < num_rules; i++) {
+      if (!glob_match(rules[i].glob, path))
+         continue;
+      if (!rules[i].size_cmp)
+         return rules[i].action;
+      if (size < 0)
+         return reloc_need_size;
+      if (rules[i].size_cmp > 0 ? (unsigned long long) size > rules[i].size :
+                                  (unsigned long long) size < rules[i].size)
+         return rules[i].action;
+   }
+   return reloc_none;
+}
@@ -0,0 +1,275 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "spindle_debug.h"
+#include "shmring.h"
+
+/* How many times to look for the other side before sleeping on the futex */
+#define SHMRING_SPIN 4096
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX __asm__ __volatile__("pause" ::: "memory")
+#else
+#define CPU_RELAX __sync_synchronize()
+#endif
+
+static int peer_gone(int peer_fd)
+{
+   struct pollfd pfd;
+
+   if (peer_fd == -1)
+      return 0;
+   pfd.fd = peer_fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   if (poll(&pfd, 1, 0) == -1)
+      return 0;
+   return (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+}
+
+/**
+ * Wait until *word is no longer old.  The other side checks *waiting after
+ * it changes *word, and only makes the futex call if we're asleep.
+ **/
+static int wait_for_change(volatile uint32_t *word, uint32_t old, volatile int *waiting, int peer_fd)
+{
+   struct timespec timeout;
+   long result;
+   int i;
+
+   for (i = 0; i < SHMRING_SPIN; i++) {
+      if (*word != old)
+         return 0;
+      CPU_RELAX;
+   }
+
+   for (;;) {
+      *waiting = 1;
+      __sync_synchronize();
+      if (*word != old)
+         break;
+
+      /* Wake up now and then to check the other side is still there */
+      timeout.tv_sec = 1;
+      timeout.tv_nsec = 0;
+      result = syscall(SYS_futex, word, FUTEX_WAIT, old, &timeout, NULL, 0);
+      if (*word != old)
+         break;
+      if (result == -1 && errno != ETIMEDOUT && errno != EINTR && errno != EAGAIN) {
+         err_printf("Error waiting on shared memory ring: %s\n", strerror(errno));
+         *waiting = 0;
+         return -1;
+      }
+      if (peer_gone(peer_fd)) {
+         debug_printf2("Other end of shared memory ring went away\n");
+         *waiting = 0;
+         return -1;
+      }
+   }
+   *waiting = 0;
+   return 0;
+}
+
+static void wake_waiter(volatile uint32_t *word, volatile int *waiting)
+{
+   __sync_synchronize();
+   if (!*waiting)
+      return;
+   *waiting = 0;
+   syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static void copy_in(shmring_t *ring, uint32_t pos, const char *src, size_t size)
+{
+   size_t offset = pos & (SHMRING_SIZE - 1);
+   size_t first = SHMRING_SIZE - offset;
+   if (first > size)
+      first = size;
+   memcpy(ring->data + offset, src, first);
+   if (first < size)
+      memcpy(ring->data, src + first, size - first);
+}
+
+static void copy_out(shmring_t *ring, uint32_t pos, char *dest, size_t size)
+{
+   size_t offset = pos & (SHMRING_SIZE - 1);
+   size_t first = SHMRING_SIZE - offset;
+   if (first > size)
+      first = size;
+   memcpy(dest, ring->data + offset, first);
+   if (first < size)
+      memcpy(dest + first, ring->data, size - first);
+}
+
+int shmring_write(shmring_t *ring, const void *data1, size_t size1, const void *data2, size_t size2,
+                  int peer_fd, int *was_empty)
+{
+   const char *bufs[2];
+   size_t sizes[2];
+   size_t left = size1 + size2, want, space, n, chunk;
+   uint32_t start = ring->head, head = start, tail;
+   int cur = 0, first = 1;
+
+   bufs[0] = (const char *) data1;
+   sizes[0] = size1;
+   bufs[1] = (const char *) data2;
+   sizes[1] = size2;
+   *was_empty = 0;
+
+   while (left) {
+      tail = ring->tail;
+      space = SHMRING_SIZE - (uint32_t) (head - tail);
+      /* Publish messages that fit as a whole, so the reader never sees half of one */
+      want = left <= SHMRING_SIZE ? left : 1;
+      if (space < want) {
+         if (wait_for_change(&ring->tail, tail, &ring->writer_waiting, peer_fd) == -1)
+            return -1;
+         continue;
+      }
+
+      n = left < space ? left : space;
+      left -= n;
+      while (n) {
+         while (!sizes[cur])
+            cur++;
+         chunk = n < sizes[cur] ? n : sizes[cur];
+         copy_in(ring, head, bufs[cur], chunk);
+         bufs[cur] += chunk;
+         sizes[cur] -= chunk;
+         head += chunk;
+         n -= chunk;
+      }
+
+      __sync_synchronize();
+      ring->head = head;
+      __sync_synchronize();
+      if (first) {
+         *was_empty = (ring->tail == start);
+         first = 0;
+      }
+      wake_waiter(&ring->head, &ring->reader_waiting);
+   }
+   return 0;
+}
+
+int shmring_read(shmring_t *ring, void *data, size_t size, int peer_fd)
+{
+   char *dest = (char *) data;
+   uint32_t tail = ring->tail, head;
+   size_t avail, n;
+
+   while (size) {
+      head = ring->head;
+      avail = (uint32_t) (head - tail);
+      if (!avail) {
+         if (wait_for_change(&ring->head, head, &ring->reader_waiting, peer_fd) == -1)
+            return -1;
+         continue;
+      }
+      __sync_synchronize();
+
+      n = size < avail ? size : avail;
+      copy_out(ring, tail, dest, n);
+      dest += n;
+      size -= n;
+      tail += n;
+
+      __sync_synchronize();
+      ring->tail = tail;
+      wake_waiter(&ring->tail, &ring->writer_waiting);
+   }
+   return 0;
+}
+
+int shmring_empty(shmring_t *ring)
+{
+   __sync_synchronize();
+   return ring->head == ring->tail;
+}
+
+static shmring_conn_t *map_rings(int fd, const char *path)
+{
+   void *mem;
+
+   mem = mmap(NULL, sizeof(shmring_conn_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (mem == MAP_FAILED) {
+      err_printf("Could not map shared memory rings %s: %s\n", path, strerror(errno));
+      return NULL;
+   }
+   return (shmring_conn_t *) mem;
+}
+
+shmring_conn_t *shmring_create(const char *path)
+{
+   int fd;
+
+   fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+   if (fd == -1 && errno == EEXIST) {
+      debug_printf2("Likely inheriting existing shared memory rings %s after exec\n", path);
+      return shmring_attach(path);
+   }
+   if (fd == -1) {
+      err_printf("Could not create shared memory rings %s: %s\n", path, strerror(errno));
+      return NULL;
+   }
+   if (ftruncate(fd, sizeof(shmring_conn_t)) == -1) {
+      err_printf("Could not size shared memory rings %s: %s\n", path, strerror(errno));
+      close(fd);
+      unlink(path);
+      return NULL;
+   }
+   return map_rings(fd, path);
+}
+
+shmring_conn_t *shmring_attach(const char *path)
+{
+   struct stat st;
+   int fd;
+
+   fd = open(path, O_RDWR);
+   if (fd == -1) {
+      err_printf("Could not open shared memory rings %s: %s\n", path, strerror(errno));
+      return NULL;
+   }
+   if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(shmring_conn_t)) {
+      err_printf("Shared memory rings %s are not set up\n", path);
+      close(fd);
+      return NULL;
+   }
+   return map_rings(fd, path);
+}
+
+void shmring_detach(shmring_conn_t *conn)
+{
+   if (conn)
+      munmap(conn, sizeof(shmring_conn_t));
+}
@@ -0,0 +1,91 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(SHMRING_H_)
+#define SHMRING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Must be a power of two */
+#define SHMRING_SIZE (64*1024)
+#define SHMRING_CACHELINE 64
+
+/**
+ * A single-producer, single-consumer byte ring in shared memory.  head
+ * and tail count every byte ever written and read, and wrap around.
+ **/
+typedef struct {
+   volatile uint32_t head;
+   volatile int reader_waiting;
+   char pad0[SHMRING_CACHELINE - sizeof(uint32_t) - sizeof(int)];
+   volatile uint32_t tail;
+   volatile int writer_waiting;
+   char pad1[SHMRING_CACHELINE - sizeof(uint32_t) - sizeof(int)];
+   char data[SHMRING_SIZE];
+} shmring_t;
+
+/**
+ * The two rings of one client connection
+ **/
+typedef struct {
+   shmring_t to_server;
+   shmring_t to_client;
+} shmring_conn_t;
+
+/**
+ * Map the rings at path, creating and clearing them if the file doesn't exist yet.
+ * Returns NULL on error.
+ **/
+shmring_conn_t *shmring_create(const char *path);
+
+/**
+ * Map the rings at path, which another process created.  Returns NULL on error.
+ **/
+shmring_conn_t *shmring_attach(const char *path);
+
+void shmring_detach(shmring_conn_t *conn);
+
+/**
+ * Write the two buffers to the ring as one message, blocking while the ring is full.
+ * Sets *was_empty if the reader had consumed everything before this message.
+ * peer_fd is polled while waiting, and a hangup on it fails the write.
+ * Returns 0 on success, -1 on error.
+ **/
+int shmring_write(shmring_t *ring, const void *data1, size_t size1, const void *data2, size_t size2,
+                  int peer_fd, int *was_empty);
+
+/**
+ * Read size bytes from the ring, blocking until they arrive.  peer_fd is
+ * polled while waiting, and a hangup on it fails the read.  Returns 0 on
+ * success, -1 on error.
+ **/
+int shmring_read(shmring_t *ring, void *data, size_t size, int peer_fd);
+
+/**
+ * Returns true if the reader has consumed everything in the ring
+ **/
+int shmring_empty(shmring_t *ring);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
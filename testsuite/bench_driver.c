@@ -0,0 +1,81 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mpi.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+
+/**
+ * The benchmark's application, see runBench_template.  It's linked
+ * against the top level of the generated libraries, so the loader has
+ * brought in the whole dependency DAG by main.  Each rank then dlopens
+ * BENCH_DLOPEN_COUNT more libraries at once, and rank 0 prints the
+ * slowest rank's times.  Time to main is measured from BENCH_LAUNCH_TIME,
+ * which the script takes just before launching, so it includes the
+ * launcher and assumes the nodes' clocks agree.
+ **/
+
+static double now()
+{
+   struct timeval t;
+   gettimeofday(&t, NULL);
+   return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+   double at_main = now(), launch, start, times[2], max_times[2];
+   char path[4096], func[64];
+   int (*calc)();
+   void *handle;
+   int i, count, rank, errors = 0, all_errors = 0;
+
+   launch = getenv("BENCH_LAUNCH_TIME") ? atof(getenv("BENCH_LAUNCH_TIME")) : at_main;
+   count = getenv("BENCH_DLOPEN_COUNT") ? atoi(getenv("BENCH_DLOPEN_COUNT")) : 0;
+
+   MPI_Init(&argc, &argv);
+   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+   MPI_Barrier(MPI_COMM_WORLD);
+   start = now();
+   for (i = 0; i < count; i++) {
+      snprintf(path, sizeof(path), "%s/libbenchd%d.so", getenv("BENCH_DIR"), i);
+      snprintf(func, sizeof(func), "bd%d_calc", i);
+      handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+      if (!handle) {
+         fprintf(stderr, "Could not dlopen %s: %s\n", path, dlerror());
+         errors++;
+         continue;
+      }
+      calc = (int (*)()) dlsym(handle, func);
+      if (calc)
+         calc();
+      else
+         errors++;
+   }
+   times[0] = at_main - launch;
+   times[1] = now() - start;
+
+   MPI_Reduce(times, max_times, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+   MPI_Reduce(&errors, &all_errors, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+   if (rank == 0)
+      printf("BENCH time_to_main=%f dlopen_time=%f errors=%d\n", max_times[0], max_times[1], all_errors);
+
+   MPI_Finalize();
+   return all_errors ? -1 : 0;
+}
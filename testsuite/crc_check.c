@@ -0,0 +1,158 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Built in, rather than linked, so each of its code paths can be picked */
+#include "ldcs_audit_server_crc.c"
+
+/**
+ * Checks crc32c, which --verify and --delta-updates trust to catch
+ * corrupt files, against the standard CRC32C known answers: those of
+ * RFC 3720's appendix B.4 and the usual "123456789" check value.  Each
+ * code path built for this machine is checked, the table-driven one and
+ * the SSE 4.2 or ARMv8 one, along with their agreement at every alignment
+ * the hardware path's word loop sees.  Prints what failed and exits
+ * nonzero if anything did.
+ **/
+
+/* crc.c logs through spindle_debug.h, which stays quiet here */
+int spindle_debug_prints = 0;
+char *spindle_debug_name = "crc_check";
+FILE *spindle_debug_output_f = NULL;
+FILE *spindle_test_output_f = NULL;
+int spindle_test_mode = 0;
+int run_tests = 0;
+int spindle_debug_ring = 0;
+void spindle_dump_on_error() { }
+void spindle_ring_printf(const char *format, ...) { }
+void spindle_sock_printf(const char *format, ...) { }
+
+static int failures = 0;
+
+#define CHECK(COND, ...)                        \
+   do {                                         \
+      if (!(COND)) {                            \
+         fprintf(stderr, "FAIL: " __VA_ARGS__); \
+         fprintf(stderr, "\n");                 \
+         failures++;                            \
+      }                                         \
+   } while (0)
+
+typedef struct {
+   const char *name;
+   unsigned char data[48];
+   size_t len;
+   uint32_t crc;
+} known_answer_t;
+
+static known_answer_t answers[] = {
+   { "the empty string", { 0 }, 0, 0x00000000 },
+   { "\"123456789\"", { '1', '2', '3', '4', '5', '6', '7', '8', '9' }, 9, 0xe3069283 },
+   { "32 bytes of zeros", { 0 }, 32, 0x8a9136aa },
+   { "32 bytes of ones", { 0 }, 32, 0x62a8ab43 },
+   { "32 incrementing bytes", { 0 }, 32, 0x46dd794e },
+   { "32 decrementing bytes", { 0 }, 32, 0x113fdb5c },
+   { "an iSCSI read command", { 0x01, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00,
+                                0x00, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00, 0x18,
+                                0x28, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, 48, 0xd9963a56 }
+};
+#define NUM_ANSWERS (sizeof(answers) / sizeof(*answers))
+
+static void fill_answers()
+{
+   int i;
+   for (i = 0; i < 32; i++) {
+      answers[3].data[i] = 0xff;
+      answers[4].data[i] = i;
+      answers[5].data[i] = 31 - i;
+   }
+}
+
+static void check_answers(const char *path)
+{
+   unsigned char buffer[64];
+   size_t i, offset;
+   uint32_t crc;
+
+   for (i = 0; i < NUM_ANSWERS; i++) {
+      /* At each alignment, so the hardware path takes each mix of byte and word steps */
+      for (offset = 0; offset < 8; offset++) {
+         memcpy(buffer + offset, answers[i].data, answers[i].len);
+         crc = crc32c(buffer + offset, answers[i].len);
+         CHECK(crc == answers[i].crc, "%s CRC32C of %s at offset %lu is %08x rather than %08x", path,
+               answers[i].name, (unsigned long) offset, crc, answers[i].crc);
+      }
+   }
+}
+
+#if defined(HAVE_CRC32C_HW)
+/* The hardware path against the table on every length and alignment it splits differently */
+static void check_hw_against_table()
+{
+   unsigned char buffer[256];
+   size_t offset, len, i;
+   uint32_t hw, sw;
+
+   for (i = 0; i < sizeof(buffer); i++)
+      buffer[i] = (unsigned char) (i * 131 + 17);
+   for (offset = 0; offset < 8; offset++) {
+      for (len = 0; len + offset <= sizeof(buffer); len++) {
+         hw = ~crc32c_hw_run(~0u, buffer + offset, len);
+         sw = ~crc32c_sw(~0u, buffer + offset, len);
+         CHECK(hw == sw, "hardware CRC32C of %lu bytes at offset %lu is %08x, but the table gives %08x",
+               (unsigned long) len, (unsigned long) offset, hw, sw);
+      }
+   }
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+   int hw;
+
+   fill_answers();
+   crc32c_init();
+   hw = crc32c_hw;
+
+   crc32c_hw = 0;
+   check_answers("table-driven");
+
+#if defined(HAVE_CRC32C_HW)
+   if (hw) {
+      crc32c_hw = 1;
+      check_answers("hardware");
+      check_hw_against_table();
+   }
+   else
+      printf("This CPU has no CRC32C instructions, only the table-driven path was checked\n");
+#else
+   printf("No hardware CRC32C path is built here, only the table-driven path was checked\n");
+#endif
+
+   if (failures) {
+      fprintf(stderr, "%d crc checks failed\n", failures);
+      return 1;
+   }
+   printf("crc checks passed\n");
+   return 0;
+}
@@ -0,0 +1,215 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_delta.h"
+
+/**
+ * Checks the --delta-updates encoding: that a new version encoded by
+ * delta_get_encoded against its last one is rebuilt byte for byte by
+ * delta_apply on a server holding the same last version, and that
+ * delta_apply turns down changes made against another last version or
+ * whose checksum doesn't match what they rebuild.  Prints what failed and
+ * exits nonzero if anything did.
+ **/
+
+/* delta.c logs through spindle_debug.h, which stays quiet here */
+int spindle_debug_prints = 0;
+char *spindle_debug_name = "delta_check";
+FILE *spindle_debug_output_f = NULL;
+FILE *spindle_test_output_f = NULL;
+int spindle_test_mode = 0;
+int run_tests = 0;
+int spindle_debug_ring = 0;
+void spindle_dump_on_error() { }
+void spindle_ring_printf(const char *format, ...) { }
+void spindle_sock_printf(const char *format, ...) { }
+
+/* Bases here come from malloc rather than a staged file's mapping */
+int filemngt_unmap_staged_file(void *buffer, size_t size)
+{
+   free(buffer);
+   return 0;
+}
+
+static int failures = 0;
+
+#define CHECK(COND, ...)                        \
+   do {                                         \
+      if (!(COND)) {                            \
+         fprintf(stderr, "FAIL: " __VA_ARGS__); \
+         fprintf(stderr, "\n");                 \
+         failures++;                            \
+      }                                         \
+   } while (0)
+
+#define BASE_SIZE (2*1024*1024)
+#define PATH "/lib/libdelta.so"
+
+/* Offset of the rebuilt file's CRC in an encoding, after the base's size and CRC */
+#define CRC_POS (sizeof(size_t) + sizeof(uint32_t))
+
+static char *base;
+
+static char *copy_of(const char *data, size_t size)
+{
+   char *copy = (char *) malloc(size ? size : 1);
+   if (copy)
+      memcpy(copy, data, size);
+   return copy;
+}
+
+/* Encodes size bytes of version against base as the sending server, and
+   returns a malloced copy of the encoding, or NULL if there wasn't one */
+static char *encode(const char *version, size_t size, size_t *dsize)
+{
+   node_peer_t holder = NODE_PEER_ALL;
+   char *delta, *result;
+
+   delta_keep_base(PATH, copy_of(base, BASE_SIZE), BASE_SIZE, &holder, 1);
+   CHECK(delta_peer_has_base(PATH, holder), "a holder of the base doesn't have it");
+   delta = (char *) delta_get_encoded(PATH, version, size, dsize);
+   result = delta ? copy_of(delta, *dsize) : NULL;
+   delta_drop(PATH);
+   return result;
+}
+
+/* Rebuilds a file of size bytes from delta against receiver_base, as a
+   receiving server, into out.  Takes the encoding */
+static int apply(const char *receiver_base, char *delta, size_t dsize, char *out, size_t size)
+{
+   int result;
+
+   delta_keep_base(PATH, copy_of(receiver_base, BASE_SIZE), BASE_SIZE, NULL, 0);
+   result = delta_apply(PATH, delta, dsize, out, size);
+   if (result == -1)
+      free(delta);
+   delta_drop(PATH);
+   return result;
+}
+
+static void check_round_trip(const char *what, const char *version, size_t size)
+{
+   char *delta, *out;
+   size_t dsize = 0;
+
+   delta = encode(version, size, &dsize);
+   CHECK(delta != NULL, "%s file wasn't encoded", what);
+   if (!delta)
+      return;
+   CHECK(dsize < size / 2, "%s file of %lu bytes took %lu bytes of changes", what,
+         (unsigned long) size, (unsigned long) dsize);
+
+   out = (char *) malloc(size);
+   CHECK(apply(base, delta, dsize, out, size) == 0, "applying changes to %s file", what);
+   CHECK(memcmp(out, version, size) == 0, "%s file was rebuilt wrong", what);
+   free(out);
+}
+
+static void check_round_trips()
+{
+   char *version;
+   size_t i;
+
+   version = (char *) malloc(BASE_SIZE + 3 * DELTA_MIN_SIZE);
+
+   check_round_trip("an identical", base, BASE_SIZE);
+
+   memcpy(version, base, BASE_SIZE);
+   for (i = 0; i < 100000; i++)
+      version[BASE_SIZE + i] = (char) (i * 7);
+   check_round_trip("an appended", version, BASE_SIZE + 100000);
+
+   /* Everything after the insert moves by an amount that isn't a block */
+   memcpy(version, base, 300000);
+   memset(version + 300000, 'S', 1234);
+   memcpy(version + 301234, base + 300000, BASE_SIZE - 300000);
+   check_round_trip("a shifted", version, BASE_SIZE + 1234);
+
+   memcpy(version, base, BASE_SIZE);
+   version[5] ^= 1;
+   version[BASE_SIZE / 2] ^= 1;
+   version[BASE_SIZE - 1] ^= 1;
+   check_round_trip("a patched", version, BASE_SIZE);
+
+   check_round_trip("a truncated", base, BASE_SIZE - 400001);
+
+   free(version);
+}
+
+static void check_mismatches()
+{
+   char *version, *delta, *other_base, *out;
+   size_t dsize = 0, i;
+
+   version = copy_of(base, BASE_SIZE);
+   memset(version + 1000000, 'M', 5000);
+   out = (char *) malloc(BASE_SIZE);
+
+   /* Another last version than the one the changes were made against */
+   delta = encode(version, BASE_SIZE, &dsize);
+   other_base = copy_of(base, BASE_SIZE);
+   other_base[123456] ^= 0x40;
+   CHECK(delta && apply(other_base, delta, dsize, out, BASE_SIZE) == -1,
+         "applied changes to another last version");
+   free(other_base);
+
+   /* Changes whose CRC doesn't match the file they rebuild */
+   delta = encode(version, BASE_SIZE, &dsize);
+   if (delta)
+      delta[CRC_POS] ^= 1;
+   CHECK(delta && apply(base, delta, dsize, out, BASE_SIZE) == -1, "applied changes with a bad CRC");
+
+   /* Changes cut short */
+   delta = encode(version, BASE_SIZE, &dsize);
+   CHECK(delta && apply(base, delta, dsize - 1, out, BASE_SIZE) == -1, "applied truncated changes");
+
+   /* A file with nothing in common isn't sent as changes */
+   for (i = 0; i < BASE_SIZE; i++)
+      version[i] = (char) (rand() >> 3);
+   delta = encode(version, BASE_SIZE, &dsize);
+   CHECK(delta == NULL, "encoded a file with nothing in common as %lu bytes of changes", (unsigned long) dsize);
+   free(delta);
+
+   free(version);
+   free(out);
+}
+
+int main(int argc, char *argv[])
+{
+   size_t i;
+
+   srand(42);
+   base = (char *) malloc(BASE_SIZE);
+   for (i = 0; i < BASE_SIZE; i++)
+      base[i] = (char) (rand() >> 3);
+
+   check_round_trips();
+   check_mismatches();
+   free(base);
+
+   if (failures) {
+      fprintf(stderr, "%d delta checks failed\n", failures);
+      return 1;
+   }
+   printf("delta checks passed\n");
+   return 0;
+}
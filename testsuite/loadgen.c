@@ -0,0 +1,203 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/**
+ * Synthetic client load for spindle --emulate, which runs a copy of it
+ * against each emulated server, e.g.
+ *   spindle --emulate=64 --port=21940-22003 loadgen -p 8 -k torch.keys
+ * Each copy forks -p processes, as the ranks on a node, that each look up
+ * every key -r times: a stat, then a dlopen for a .so or an open and read
+ * for anything else, all of which go to the server.  Keys are absolute
+ * paths, one per line, as for microbench; without -k the testsuite's
+ * generated libraries are used.  Each copy prints one line with its
+ * instance number and the slowest process's time.
+ **/
+
+#define MAX_KEY_LEN 4096
+
+static char **keys = NULL;
+static int num_keys = 0;
+static int num_procs = 1;
+static int rounds = 1;
+
+static double now()
+{
+   struct timeval t;
+   gettimeofday(&t, NULL);
+   return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+static void add_key(const char *path)
+{
+   if (num_keys % 1024 == 0)
+      keys = (char **) realloc(keys, sizeof(char *) * (num_keys + 1024));
+   keys[num_keys++] = strdup(path);
+}
+
+static int read_keys(const char *filename)
+{
+   char line[MAX_KEY_LEN];
+   FILE *f = fopen(filename, "r");
+   if (!f) {
+      fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+      return -1;
+   }
+   while (fgets(line, sizeof(line), f)) {
+      line[strcspn(line, "\n")] = '\0';
+      if (line[0] == '/')
+         add_key(line);
+   }
+   fclose(f);
+   return 0;
+}
+
+static void default_keys(const char *argv0)
+{
+   static const int sizes[] = { 10, 50, 100, 500, 1000, 2000, 4000, 6000, 8000, 10000 };
+   char dir[MAX_KEY_LEN], path[MAX_KEY_LEN + 32], *last_slash;
+   unsigned int i;
+
+   if (!realpath(argv0, dir))
+      snprintf(dir, sizeof(dir), ".");
+   last_slash = strrchr(dir, '/');
+   if (last_slash)
+      *last_slash = '\0';
+   for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      snprintf(path, sizeof(path), "%s/libtest%d.so", dir, sizes[i]);
+      add_key(path);
+   }
+}
+
+static int is_library(const char *path)
+{
+   size_t len = strlen(path);
+   return (len > 3 && strcmp(path + len - 3, ".so") == 0) || strstr(path, ".so.");
+}
+
+static int lookup(const char *path)
+{
+   char buffer[4096];
+   struct stat buf;
+   void *handle;
+   int fd;
+
+   if (stat(path, &buf) == -1)
+      return -1;
+   if (S_ISDIR(buf.st_mode))
+      return 0;
+   if (is_library(path)) {
+      handle = dlopen(path, RTLD_LAZY | RTLD_LOCAL);
+      if (!handle)
+         return -1;
+      dlclose(handle);
+      return 0;
+   }
+   fd = open(path, O_RDONLY);
+   if (fd == -1)
+      return -1;
+   if (read(fd, buffer, sizeof(buffer)) == -1) {
+      close(fd);
+      return -1;
+   }
+   close(fd);
+   return 0;
+}
+
+/* Returns the number of keys that couldn't be looked up */
+static int run_proc(int proc)
+{
+   int r, i, errors = 0;
+
+   for (r = 0; r < rounds; r++) {
+      for (i = 0; i < num_keys; i++) {
+         /* Start each process at a different key, as ranks don't run in step */
+         if (lookup(keys[(i + proc) % num_keys]) == -1)
+            errors++;
+      }
+   }
+   return errors;
+}
+
+static void usage()
+{
+   fprintf(stderr, "Usage: loadgen [-k keyfile] [-p processes] [-r rounds]\n");
+   exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+   const char *keyfile = NULL, *instance;
+   double start, elapsed;
+   int opt, i, status, errors = 0, failed = 0;
+   pid_t pid;
+
+   while ((opt = getopt(argc, argv, "k:p:r:h")) != -1) {
+      switch (opt) {
+         case 'k': keyfile = optarg; break;
+         case 'p': num_procs = atoi(optarg); break;
+         case 'r': rounds = atoi(optarg); break;
+         default: usage();
+      }
+   }
+   if (num_procs < 1 || rounds < 1)
+      usage();
+
+   if (keyfile) {
+      if (read_keys(keyfile) == -1)
+         return -1;
+   }
+   else
+      default_keys(argv[0]);
+   if (!num_keys) {
+      fprintf(stderr, "No keys\n");
+      return -1;
+   }
+
+   start = now();
+   for (i = 0; i < num_procs; i++) {
+      pid = fork();
+      if (pid == -1) {
+         fprintf(stderr, "Could not fork: %s\n", strerror(errno));
+         failed++;
+         break;
+      }
+      if (pid == 0)
+         exit(run_proc(i) ? 1 : 0);
+   }
+   while ((pid = wait(&status)) != -1 || errno == EINTR) {
+      if (pid != -1 && (!WIFEXITED(status) || WEXITSTATUS(status)))
+         errors++;
+   }
+   elapsed = now() - start;
+
+   instance = getenv("SPINDLE_EMULATE_INSTANCE");
+   printf("LOAD instance=%s procs=%d keys=%d lookups=%ld time=%f lookups_per_sec=%f failed_procs=%d\n",
+          instance ? instance : "0", num_procs, num_keys, (long) num_procs * rounds * num_keys,
+          elapsed, (num_procs * rounds * num_keys) / elapsed, errors + failed);
+   return errors + failed ? -1 : 0;
+}
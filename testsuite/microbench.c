@@ -0,0 +1,538 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "ldcs_hash.h"
+#include "stat_cache.h"
+#include "name_intern.h"
+#include "ldcs_audit_server_requestors.h"
+#include "sheep.h"
+#include "shmcache.h"
+
+/**
+ * Microbenchmarks for the server's and client's lookup structures.  Each
+ * benchmark drives one structure with a key set, one absolute path per
+ * line, and reports nanoseconds, allocations and bytes allocated per
+ * operation, and the structure's footprint once filled.  Record a key
+ * set from a real import with something like
+ *   strace -f -e trace=%file -o trace python -c 'import torch'
+ *   grep -o '"/[^"]*"' trace | tr -d '"' > torch.keys
+ * Without -k, a key set shaped like a Python package import is made up:
+ * every module is looked for in each sys.path directory before the one
+ * it's in, so most lookups miss.
+ *
+ * The sheep and shmcache benchmarks also run with -t threads.  Sheep
+ * threads serialize on a lock around the shared heap, as its users do.
+ * shmcache's state is per-process, so its workers are forked processes
+ * sharing one segment, as ranks on a node do.
+ **/
+
+#define MAX_KEY_LEN 4096
+#define MAX_SHEEP_SIZE (1 << 25)   /* init_sheep's limit */
+
+/* Every malloc in the process is counted, including the structures' */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static volatile unsigned long num_allocs = 0;
+static volatile long live_bytes = 0;
+
+void *malloc(size_t size)
+{
+   void *p = __libc_malloc(size);
+   __sync_fetch_and_add(&num_allocs, 1);
+   if (p)
+      __sync_fetch_and_add(&live_bytes, malloc_usable_size(p));
+   return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+   void *p = __libc_calloc(nmemb, size);
+   __sync_fetch_and_add(&num_allocs, 1);
+   if (p)
+      __sync_fetch_and_add(&live_bytes, malloc_usable_size(p));
+   return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+   long old = ptr ? (long) malloc_usable_size(ptr) : 0;
+   void *p = __libc_realloc(ptr, size);
+   __sync_fetch_and_add(&num_allocs, 1);
+   if (p)
+      __sync_fetch_and_add(&live_bytes, (long) malloc_usable_size(p) - old);
+   return p;
+}
+
+void free(void *ptr)
+{
+   if (!ptr)
+      return;
+   __sync_fetch_and_sub(&live_bytes, malloc_usable_size(ptr));
+   __libc_free(ptr);
+}
+
+/* The structures log through spindle_debug.h, which stays quiet here */
+int spindle_debug_prints = 0;
+char *spindle_debug_name = "microbench";
+FILE *spindle_debug_output_f = NULL;
+FILE *spindle_test_output_f = NULL;
+int spindle_test_mode = 0;
+int run_tests = 0;
+int spindle_debug_ring = 0;
+void spindle_dump_on_error() { }
+void spindle_ring_printf(const char *format, ...) { }
+void spindle_sock_printf(const char *format, ...) { }
+
+/* Nothing is staged, so no key names a local file */
+char *ldcs_is_a_localfile(char *filename) { return NULL; }
+
+extern char *in_progress;
+
+typedef struct {
+   char *path;
+   char *dir;      /* path split at its last slash */
+   char *file;
+} key_t_;
+
+static key_t_ *keys = NULL;
+static int num_keys = 0;
+static key_t_ *misses = NULL;   /* the same names in directories no key is in */
+static int num_misses = 0;
+static int reps = 5;
+static int num_workers = 4;
+static int json = 0;
+
+typedef struct {
+   double start;
+   unsigned long allocs;
+   long bytes;
+} mark_t;
+
+static double now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static void mark(mark_t *m)
+{
+   m->allocs = num_allocs;
+   m->bytes = live_bytes;
+   m->start = now();
+}
+
+static void report(const char *bench, const char *op, int workers, mark_t *m, long ops, long footprint)
+{
+   double secs = now() - m->start;
+   double ns = ops ? secs * 1e9 / ops : 0.0;
+   double allocs = ops ? (double) (num_allocs - m->allocs) / ops : 0.0;
+   double bytes = ops ? (double) (live_bytes - m->bytes) / ops : 0.0;
+
+   if (json)
+      printf("{\"bench\": \"%s\", \"op\": \"%s\", \"workers\": %d, \"keys\": %d, \"ops\": %ld, "
+             "\"ns_per_op\": %.1f, \"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f, \"footprint\": %ld}\n",
+             bench, op, workers, num_keys, ops, ns, allocs, bytes, footprint);
+   else
+      printf("%-12s %-10s %3d %10ld %10.1f %10.3f %10.1f %12ld\n",
+             bench, op, workers, ops, ns, allocs, bytes, footprint);
+   fflush(stdout);
+}
+
+static void split_key(key_t_ *k, const char *path)
+{
+   char *slash;
+   k->path = strdup(path);
+   k->dir = strdup(path);
+   slash = strrchr(k->dir, '/');
+   if (slash && slash != k->dir) {
+      *slash = '\0';
+      k->file = slash + 1;
+   }
+   else {
+      k->dir[0] = '/';
+      k->dir[1] = '\0';
+      k->file = k->path + 1;
+   }
+}
+
+static void add_key(const char *path)
+{
+   if (num_keys % 1024 == 0)
+      keys = (key_t_ *) realloc(keys, sizeof(key_t_) * (num_keys + 1024));
+   split_key(keys + num_keys++, path);
+}
+
+static int read_keys(const char *filename)
+{
+   char line[MAX_KEY_LEN];
+   FILE *f = fopen(filename, "r");
+   if (!f) {
+      fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+      return -1;
+   }
+   while (fgets(line, sizeof(line), f)) {
+      line[strcspn(line, "\n")] = '\0';
+      if (line[0] == '/')
+         add_key(line);
+   }
+   fclose(f);
+   return 0;
+}
+
+/**
+ * A made-up import of npkgs packages of nmods modules each, with each
+ * module looked up as .so, .py and .pyc along nsyspath directories
+ **/
+static void make_keys(int npkgs, int nmods, int nsyspath)
+{
+   static const char *exts[] = { ".cpython-39-x86_64-linux-gnu.so", ".py", ".pyc" };
+   char path[MAX_KEY_LEN];
+   int p, m, s, e;
+
+   for (p = 0; p < npkgs; p++) {
+      for (m = 0; m < nmods; m++) {
+         for (s = 0; s <= (p % nsyspath); s++) {
+            for (e = 0; e < 3; e++) {
+               snprintf(path, sizeof(path), "/usr/workspace/env/lib/python3.9/site-packages/path%d/pkg%d/sub%d/module_%d%s",
+                        s, p, m % 4, m, exts[e]);
+               add_key(path);
+            }
+         }
+      }
+   }
+}
+
+static void make_misses()
+{
+   char path[MAX_KEY_LEN];
+   int i;
+   misses = (key_t_ *) malloc(sizeof(key_t_) * num_keys);
+   for (i = 0; i < num_keys; i++) {
+      snprintf(path, sizeof(path), "/nonexistent/%d%s", i % 64, keys[i].path);
+      split_key(misses + i, path);
+   }
+   num_misses = num_keys;
+}
+
+static void bench_hash()
+{
+   mark_t m;
+   long before;
+   int i, r;
+
+   before = live_bytes;
+   ldcs_hash_init();
+   mark(&m);
+   for (i = 0; i < num_keys; i++)
+      ldcs_hash_addEntry(keys[i].dir, keys[i].file);
+   report("hash", "insert", 1, &m, num_keys, live_bytes - before);
+
+   mark(&m);
+   for (r = 0; r < reps; r++)
+      for (i = 0; i < num_keys; i++)
+         ldcs_hash_Lookup_FN_and_DIR(keys[i].file, keys[i].dir);
+   report("hash", "hit", 1, &m, (long) reps * num_keys, live_bytes - before);
+
+   mark(&m);
+   for (r = 0; r < reps; r++)
+      for (i = 0; i < num_misses; i++)
+         ldcs_hash_Lookup_FN_and_DIR(misses[i].file, misses[i].dir);
+   report("hash", "miss", 1, &m, (long) reps * num_misses, live_bytes - before);
+}
+
+static void bench_statcache()
+{
+   char *data;
+   mark_t m;
+   long before;
+   int i, r;
+
+   before = live_bytes;
+   init_stat_cache();
+   mark(&m);
+   for (i = 0; i < num_keys; i++)
+      add_stat_cache(keys[i].path, (i % 3) ? keys[i].file : NULL);
+   report("statcache", "insert", 1, &m, num_keys, live_bytes - before);
+
+   mark(&m);
+   for (r = 0; r < reps; r++)
+      for (i = 0; i < num_keys; i++)
+         lookup_stat_cache(keys[i].path, &data);
+   report("statcache", "hit", 1, &m, (long) reps * num_keys, live_bytes - before);
+
+   mark(&m);
+   for (r = 0; r < reps; r++)
+      for (i = 0; i < num_misses; i++)
+         lookup_stat_cache(misses[i].path, &data);
+   report("statcache", "miss", 1, &m, (long) reps * num_misses, live_bytes - before);
+}
+
+static void bench_requestors()
+{
+   requestor_list_t list;
+   mark_t m;
+   long before;
+   int i, r;
+
+   before = live_bytes;
+   list = new_requestor_list();
+   for (r = 0; r < reps; r++) {
+      mark(&m);
+      for (i = 0; i < num_keys; i++) {
+         add_requestor(list, keys[i].path, (node_peer_t) (long) (i % 8 + 3));
+         add_requestor(list, keys[i].path, NODE_PEER_CLIENT);
+      }
+      report("requestors", "add", 1, &m, 2L * num_keys, live_bytes - before);
+
+      mark(&m);
+      for (i = 0; i < num_keys; i++)
+         been_requested(list, keys[i].path);
+      report("requestors", "hit", 1, &m, num_keys, live_bytes - before);
+
+      mark(&m);
+      for (i = 0; i < num_keys; i++)
+         clear_requestor(list, keys[i].path);
+      report("requestors", "clear", 1, &m, num_keys, live_bytes - before);
+   }
+}
+
+static void *sheep_mem = NULL;
+static size_t sheep_size;
+static pthread_mutex_t sheep_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile long sheep_used = 0;
+
+static void sheep_setup()
+{
+   sheep_size = 0;
+   for (int i = 0; i < num_keys; i++)
+      sheep_size += 2 * (strlen(keys[i].path) + 64);
+   sheep_size = (sheep_size * num_workers + (1 << 20)) & ~((size_t) 4095);
+   if (sheep_size >= MAX_SHEEP_SIZE)
+      sheep_size = MAX_SHEEP_SIZE - 4096;
+   if (sheep_mem)
+      munmap(sheep_mem, sheep_size);
+   sheep_mem = mmap(NULL, sheep_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   init_sheep(sheep_mem, sheep_size, 0);
+   sheep_used = 0;
+}
+
+/* Allocate a copy of each key, then free every other one and allocate them again */
+static void *sheep_worker(void *arg)
+{
+   long id = (long) arg;
+   char **copies = (char **) malloc(sizeof(char *) * num_keys);
+   size_t len;
+   int i, pass;
+
+   for (pass = 0; pass < 2; pass++) {
+      for (i = pass; i < num_keys; i += pass + 1) {
+         len = strlen(keys[i].path) + 1;
+         pthread_mutex_lock(&sheep_lock);
+         copies[i] = (char *) malloc_sheep(len);
+         pthread_mutex_unlock(&sheep_lock);
+         if (copies[i]) {
+            memcpy(copies[i], keys[i].path, len);
+            __sync_fetch_and_add(&sheep_used, sheep_alloc_size(len));
+         }
+      }
+      if (pass)
+         break;
+      for (i = 1; i < num_keys; i += 2) {
+         if (!copies[i])
+            continue;
+         __sync_fetch_and_sub(&sheep_used, sheep_alloc_size(strlen(copies[i]) + 1));
+         pthread_mutex_lock(&sheep_lock);
+         free_sheep(copies[i]);
+         pthread_mutex_unlock(&sheep_lock);
+      }
+   }
+   (void) id;
+   free(copies);
+   return NULL;
+}
+
+static void bench_sheep(int workers)
+{
+   pthread_t *threads = (pthread_t *) malloc(sizeof(pthread_t) * workers);
+   long ops = 0;
+   mark_t m;
+   int i;
+
+   sheep_setup();
+   for (i = 0; i < num_keys; i++)
+      ops += 1 + (i % 2) * 2;
+   mark(&m);
+   for (i = 0; i < workers; i++)
+      pthread_create(threads + i, NULL, sheep_worker, (void *) (long) i);
+   for (i = 0; i < workers; i++)
+      pthread_join(threads[i], NULL);
+   report(workers > 1 ? "sheep_mt" : "sheep", "alloc/free", workers, &m, ops * workers, sheep_used);
+   free(threads);
+}
+
+/**
+ * Each worker looks up every key, and fills in the ones it was first to ask
+ * for, as a rank's client does.  Prints the worker's time on fd.
+ **/
+static void shmcache_worker(int number, size_t size, int fd)
+{
+   char buffer[MAX_KEY_LEN+1], *result, out[64];
+   double start;
+   int i, r, len;
+
+   if (shmcache_init("/tmp", number, size, size / 2) == -1) {
+      fprintf(stderr, "Could not set up shmcache\n");
+      _exit(-1);
+   }
+   start = now();
+   for (r = 0; r < reps; r++) {
+      for (i = 0; i < num_keys; i++) {
+         if (shmcache_lookup_or_add(keys[i].path, &result, buffer) == -1)
+            shmcache_update(keys[i].path, (i % 3) ? keys[i].file : NULL);
+         else if (result == in_progress)
+            shmcache_waitfor_update(keys[i].path, &result, buffer);
+      }
+   }
+   shmcache_done();
+   len = snprintf(out, sizeof(out), "%f\n", now() - start);
+   if (write(fd, out, len) != len)
+      _exit(-1);
+}
+
+static void bench_shmcache(int workers)
+{
+   char shm_path[64], line[64];
+   size_t size = 0;
+   double secs, max_secs = 0.0;
+   mark_t m;
+   FILE *f;
+   int i, number = getpid(), pipes[2], finished = 0;
+
+   for (i = 0; i < num_keys; i++)
+      size += 2 * (strlen(keys[i].path) + 128);
+   size = (size + (4 << 20)) & ~((size_t) 4095);
+   if (size >= MAX_SHEEP_SIZE)
+      size = MAX_SHEEP_SIZE - 4096;
+
+   if (pipe(pipes) == -1)
+      return;
+   fflush(stdout);
+   mark(&m);
+   for (i = 0; i < workers; i++) {
+      if (fork() == 0) {
+         close(pipes[0]);
+         shmcache_worker(number, size, pipes[1]);
+         _exit(0);
+      }
+   }
+   close(pipes[1]);
+   f = fdopen(pipes[0], "r");
+   while (fgets(line, sizeof(line), f)) {
+      secs = atof(line);
+      finished++;
+      if (secs > max_secs)
+         max_secs = secs;
+   }
+   fclose(f);
+   while (wait(NULL) > 0);
+   m.start = now() - max_secs;
+   snprintf(shm_path, sizeof(shm_path), "/biter_shm.%d", number);
+   shm_unlink(shm_path);
+   if (finished != workers) {
+      fprintf(stderr, "%d of %d shmcache workers failed\n", workers - finished, workers);
+      return;
+   }
+   report(workers > 1 ? "shmcache_mt" : "shmcache", "lookup", workers, &m,
+          (long) reps * num_keys * workers, (long) size);
+}
+
+static void usage()
+{
+   fprintf(stderr, "Usage: microbench [-k keyfile] [-r reps] [-t workers] [-j] [benchmark ...]\n"
+           "Benchmarks: hash statcache requestors sheep sheep_mt shmcache shmcache_mt, all by default\n");
+   exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+   static const char *all[] = { "hash", "statcache", "requestors", "sheep", "sheep_mt",
+                                "shmcache", "shmcache_mt", NULL };
+   const char **benches = all, *keyfile = NULL;
+   int opt, i;
+
+   while ((opt = getopt(argc, argv, "k:r:t:jh")) != -1) {
+      switch (opt) {
+         case 'k': keyfile = optarg; break;
+         case 'r': reps = atoi(optarg); break;
+         case 't': num_workers = atoi(optarg); break;
+         case 'j': json = 1; break;
+         default: usage();
+      }
+   }
+   if (optind < argc)
+      benches = (const char **) argv + optind;
+
+   if (keyfile) {
+      if (read_keys(keyfile) == -1)
+         return -1;
+   }
+   else
+      make_keys(200, 40, 6);
+   if (!num_keys) {
+      fprintf(stderr, "No keys\n");
+      return -1;
+   }
+   make_misses();
+
+   if (!json)
+      printf("%-12s %-10s %3s %10s %10s %10s %10s %12s\n",
+             "bench", "op", "wrk", "ops", "ns/op", "allocs/op", "bytes/op", "footprint");
+   for (i = 0; benches[i]; i++) {
+      if (strcmp(benches[i], "hash") == 0)
+         bench_hash();
+      else if (strcmp(benches[i], "statcache") == 0)
+         bench_statcache();
+      else if (strcmp(benches[i], "requestors") == 0)
+         bench_requestors();
+      else if (strcmp(benches[i], "sheep") == 0)
+         bench_sheep(1);
+      else if (strcmp(benches[i], "sheep_mt") == 0)
+         bench_sheep(num_workers);
+      else if (strcmp(benches[i], "shmcache") == 0)
+         bench_shmcache(1);
+      else if (strcmp(benches[i], "shmcache_mt") == 0)
+         bench_shmcache(num_workers);
+      else
+         usage();
+   }
+   return 0;
+}
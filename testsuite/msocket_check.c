@@ -0,0 +1,315 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "handshake.h"
+#include "ldcs_audit_server_md_msocket.h"
+#include "ldcs_audit_server_md_msocket_util.h"
+#include "ldcs_audit_server_md_msocket_topo.h"
+
+/**
+ * Checks the msocket server network away from a running server: the tree
+ * shapes servers connect in, the hostlist and hostinfo framing sent down
+ * each tree link, and a parent accepting its child over loopback while a
+ * server of another session knocks on the same port.  Prints what failed
+ * and exits nonzero if anything did.
+ **/
+
+#define MAX_RANKS 130
+#define FIRST_PORT 23000
+#define NUM_PORTS 64
+
+/* The msocket code logs through spindle_debug.h, which stays quiet here */
+int spindle_debug_prints = 0;
+char *spindle_debug_name = "msocket_check";
+FILE *spindle_debug_output_f = NULL;
+FILE *spindle_test_output_f = NULL;
+int spindle_test_mode = 0;
+int run_tests = 0;
+int spindle_debug_ring = 0;
+void spindle_dump_on_error() { }
+void spindle_ring_printf(const char *format, ...) { }
+void spindle_sock_printf(const char *format, ...) { }
+
+void _error(const char *msg)
+{
+   fprintf(stderr, "Error: %s\n", msg);
+   exit(1);
+}
+
+void handle_security_error(const char *msg)
+{
+   fprintf(stderr, "Security error: %s\n", msg);
+}
+
+/* The real handshake needs whichever of munge or gcrypt was configured, so
+   every peer passes it here.  Telling sessions apart is left to the msocket
+   code under test. */
+int spindle_handshake_server(int sockfd, handshake_protocol_t *hdata, uint64_t session_id)
+{
+   return HSHAKE_SUCCESS;
+}
+
+int spindle_handshake_client(int sockfd, handshake_protocol_t *hdata, uint64_t session_id)
+{
+   return HSHAKE_SUCCESS;
+}
+
+char *spindle_handshake_last_error_str()
+{
+   return "";
+}
+
+static int failures = 0;
+
+#define CHECK(COND, ...)                        \
+   do {                                         \
+      if (!(COND)) {                            \
+         fprintf(stderr, "FAIL: " __VA_ARGS__); \
+         fprintf(stderr, "\n");                 \
+         failures++;                            \
+      }                                         \
+   } while (0)
+
+/* Walk the subtree under rank, returning how many ranks it holds and
+   their lowest and highest */
+static int walk_subtree(ldcs_msocket_topo_t *topo, int rank, int *seen, int *lo, int *hi)
+{
+   int children[MAX_RANKS], num_children, i, count = 1;
+
+   seen[rank]++;
+   if (rank < *lo)
+      *lo = rank;
+   if (rank > *hi)
+      *hi = rank;
+   num_children = ldcs_audit_server_md_msocket_topo_children(topo, rank, children);
+   CHECK(num_children <= ldcs_audit_server_md_msocket_topo_max_children(topo),
+         "rank %d of %d has %d children, more than the %d allowed", rank, topo->size,
+         num_children, ldcs_audit_server_md_msocket_topo_max_children(topo));
+   for (i = 0; i < num_children; i++) {
+      CHECK(children[i] > rank && children[i] < topo->size,
+            "rank %d of %d has child %d", rank, topo->size, children[i]);
+      if (children[i] <= rank || children[i] >= topo->size || seen[children[i]])
+         continue;
+      count += walk_subtree(topo, children[i], seen, lo, hi);
+   }
+   return count;
+}
+
+/* Every rank is reached once from the root, and each subtree is a
+   contiguous range starting at its root */
+static void check_topo(ldcs_topo_type_t type, int fanout, int size, char **hostlist, const char *name)
+{
+   ldcs_msocket_topo_t topo;
+   int seen[MAX_RANKS], subtree[MAX_RANKS];
+   int rank, lo, hi;
+
+   ldcs_audit_server_md_msocket_topo_init(&topo, type, fanout, size, hostlist);
+   memset(seen, 0, sizeof(seen));
+   lo = hi = 0;
+   CHECK(walk_subtree(&topo, 0, seen, &lo, &hi) == size, "%s tree of %d doesn't reach every rank", name, size);
+   for (rank = 0; rank < size; rank++)
+      CHECK(seen[rank] == 1, "%s tree of %d reaches rank %d %d times", name, size, rank, seen[rank]);
+
+   for (rank = 0; rank < size; rank++) {
+      memset(subtree, 0, sizeof(subtree));
+      lo = hi = rank;
+      int count = walk_subtree(&topo, rank, subtree, &lo, &hi);
+      CHECK(lo == rank && hi == rank + count - 1,
+            "%s tree of %d has rank %d's subtree of %d over %d-%d", name, size, rank, count, lo, hi);
+   }
+   ldcs_audit_server_md_msocket_topo_free(&topo);
+}
+
+static void check_topos()
+{
+   char *hostlist[MAX_RANKS], names[MAX_RANKS][32];
+   int size, fanout, i;
+
+   /* Racks of three to five nodes, and a host whose prefix comes back */
+   for (i = 0; i < MAX_RANKS; i++) {
+      snprintf(names[i], sizeof(names[i]), "rack%dn%03d.site", (i * 7 / 30) % 5, i);
+      hostlist[i] = names[i];
+   }
+
+   for (size = 1; size < MAX_RANKS; size++) {
+      check_topo(LDCS_TOPO_TYPE_BINOM_TREE, 0, size, NULL, "binomial");
+      for (fanout = 2; fanout <= 5; fanout++)
+         check_topo(LDCS_TOPO_TYPE_KARY_TREE, fanout, size, NULL, "k-ary");
+      check_topo(LDCS_TOPO_TYPE_HOST_TREE, 3, size, hostlist, "host");
+      check_topo(LDCS_TOPO_TYPE_HOST_TREE, 3, size, NULL, "hostless host");
+   }
+}
+
+static void check_hostlist()
+{
+   char *hosts[] = { "node1", "n", "a-much-longer-node-name.example.com", "node4" };
+   char *data, **expanded;
+   int size, i, offset;
+
+   CHECK(ldcs_audit_server_md_msocket_serialize_hostlist(hosts, 4, &data, &size) == 0, "serializing hostlist");
+   expanded = ldcs_audit_server_md_msocket_expand_hostlist(data, size, 4);
+   CHECK(expanded != NULL, "expanding hostlist");
+   for (i = 0; expanded && i < 4; i++)
+      CHECK(strcmp(expanded[i], hosts[i]) == 0, "host %d came back as %s", i, expanded[i]);
+   free(expanded);
+
+   CHECK(ldcs_audit_server_md_msocket_expand_hostlist(data, size - 1, 4) == NULL,
+         "expanding a hostlist without its last NUL");
+   CHECK(ldcs_audit_server_md_msocket_expand_hostlist(data, 3 * sizeof(int), 4) == NULL,
+         "expanding a hostlist shorter than its offsets");
+   memcpy(&offset, data + sizeof(int), sizeof(int));
+   i = size;
+   memcpy(data + sizeof(int), &i, sizeof(int));
+   CHECK(ldcs_audit_server_md_msocket_expand_hostlist(data, size, 4) == NULL,
+         "expanding a hostlist with an offset past its end");
+   memcpy(data + sizeof(int), &offset, sizeof(int));
+   free(data);
+
+   CHECK(ldcs_audit_server_md_msocket_serialize_hostlist(hosts, 0, &data, &size) == -1,
+         "serializing an empty hostlist");
+}
+
+static void check_hostinfo()
+{
+   ldcs_msocket_hostinfo_t sent, recvd;
+   char hostdata[] = "hostlist bytes", *recvd_data = NULL;
+   int fds[2];
+
+   sent.rank = 3;
+   sent.size = 8;
+   sent.topo = LDCS_TOPO_TYPE_KARY_TREE;
+   sent.fanout = 4;
+   sent.hostlist_size = sizeof(hostdata);
+
+   socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+   CHECK(ldcs_audit_server_md_msocket_send_hostinfo(fds[0], &sent, hostdata) == 0, "sending hostinfo");
+   CHECK(ldcs_audit_server_md_msocket_recv_hostinfo(fds[1], &recvd, &recvd_data) == 0, "receiving hostinfo");
+   CHECK(memcmp(&sent, &recvd, sizeof(sent)) == 0, "hostinfo changed on the way");
+   CHECK(recvd_data && memcmp(recvd_data, hostdata, sizeof(hostdata)) == 0, "hostlist changed on the way");
+   free(recvd_data);
+
+   /* A link that closes part way through the hostlist */
+   CHECK(write(fds[0], &sent, sizeof(sent)) == sizeof(sent), "writing hostinfo");
+   CHECK(write(fds[0], hostdata, 4) == 4, "writing part of the hostlist");
+   close(fds[0]);
+   recvd_data = NULL;
+   CHECK(ldcs_audit_server_md_msocket_recv_hostinfo(fds[1], &recvd, &recvd_data) == -1,
+         "receiving a hostlist cut short");
+   close(fds[1]);
+
+   /* A rank outside the tree */
+   socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+   sent.rank = sent.size;
+   CHECK(write(fds[0], &sent, sizeof(sent)) == sizeof(sent), "writing hostinfo");
+   CHECK(ldcs_audit_server_md_msocket_recv_hostinfo(fds[1], &recvd, &recvd_data) == -1,
+         "receiving hostinfo with rank %d of %d", sent.rank, sent.size);
+   close(fds[0]);
+   close(fds[1]);
+}
+
+/* Connect to the parent's port and send it hostinfo naming rank */
+static void run_child(unsigned int *ports, uint64_t session, int rank)
+{
+   handshake_protocol_t handshake;
+   ldcs_msocket_hostinfo_t info;
+   char hostdata[] = "x";
+   int fd;
+
+   handshake.mechanism = hs_none;
+   fd = ldcs_audit_server_md_msocket_connect("localhost", ports, 1, &handshake, session);
+   if (fd == -1)
+      exit(1);
+   memset(&info, 0, sizeof(info));
+   info.rank = rank;
+   info.size = rank + 1;
+   info.hostlist_size = sizeof(hostdata);
+   exit(ldcs_audit_server_md_msocket_send_hostinfo(fd, &info, hostdata) == -1 ? 1 : 0);
+}
+
+static void check_accept()
+{
+   handshake_protocol_t handshake;
+   ldcs_msocket_hostinfo_t info;
+   unsigned int ports[NUM_PORTS], port;
+   uint64_t session = 0x5350494e444c45ull;
+   char *hostdata = NULL;
+   pid_t stranger, child;
+   int listen_fd, fd, i, status;
+
+   for (i = 0; i < NUM_PORTS; i++)
+      ports[i] = FIRST_PORT + i;
+   listen_fd = ldcs_audit_server_md_msocket_create_server(ports, NUM_PORTS, &port);
+   CHECK(listen_fd != -1, "listening on ports %u-%u", ports[0], ports[NUM_PORTS-1]);
+   if (listen_fd == -1)
+      return;
+
+   /* A server of another session scans the same ports, and must be dropped */
+   stranger = fork();
+   if (stranger == 0)
+      run_child(&port, session + 1, 1);
+   sleep(1);
+   child = fork();
+   if (child == 0)
+      run_child(&port, session, 2);
+
+   handshake.mechanism = hs_none;
+   alarm(30);
+   fd = ldcs_audit_server_md_msocket_accept(listen_fd, &handshake, session);
+   CHECK(fd != -1, "accepting a child");
+   info.rank = -1;
+   if (fd != -1) {
+      CHECK(ldcs_audit_server_md_msocket_recv_hostinfo(fd, &info, &hostdata) == 0, "receiving the child's hostinfo");
+      CHECK(info.rank == 2, "accepted rank %d rather than the child of our session", info.rank);
+      free(hostdata);
+      close(fd);
+   }
+   alarm(0);
+
+   /* A child left unaccepted would keep rescanning the port */
+   if (info.rank != 2)
+      kill(child, SIGKILL);
+   else
+      CHECK(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+            "child of our session failed");
+   kill(stranger, SIGKILL);
+   waitpid(child, &status, 0);
+   waitpid(stranger, &status, 0);
+   close(listen_fd);
+}
+
+int main(int argc, char *argv[])
+{
+   check_topos();
+   check_hostlist();
+   check_hostinfo();
+   check_accept();
+
+   if (failures) {
+      fprintf(stderr, "%d msocket checks failed\n", failures);
+      return 1;
+   }
+   printf("msocket checks passed\n");
+   return 0;
+}
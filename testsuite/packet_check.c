@@ -0,0 +1,222 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldcs_api.h"
+#include "ldcs_audit_server_md.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "ldcs_audit_server_msgpool.h"
+
+/**
+ * Checks the file packet header that servers send ahead of each file's
+ * contents: that filemngt_decode_packet reads back what
+ * filemngt_encode_packet wrote, and that it fails rather than aborts on
+ * headers that are cut short or out of range, as a peer of another
+ * version might send.  Prints what failed and exits nonzero if anything did.
+ **/
+
+/* filemngt.c logs through spindle_debug.h, which stays quiet here */
+int spindle_debug_prints = 0;
+char *spindle_debug_name = "packet_check";
+FILE *spindle_debug_output_f = NULL;
+FILE *spindle_test_output_f = NULL;
+int spindle_test_mode = 0;
+int run_tests = 0;
+int spindle_debug_ring = 0;
+void spindle_dump_on_error() { }
+void spindle_ring_printf(const char *format, ...) { }
+void spindle_sock_printf(const char *format, ...) { }
+
+/* The network a packet is decoded from, passed as the peer */
+typedef struct {
+   char *data;
+   size_t size;
+   size_t pos;
+} wire_t;
+
+int ldcs_audit_server_md_complete_msg_read(node_peer_t peer, ldcs_message_t *msg, void *mem, size_t size)
+{
+   wire_t *wire = (wire_t *) peer;
+   if (size > wire->size - wire->pos)
+      return -1;
+   memcpy(mem, wire->data + wire->pos, size);
+   wire->pos += size;
+   return 0;
+}
+
+static int failures = 0;
+
+#define CHECK(COND, ...)                        \
+   do {                                         \
+      if (!(COND)) {                            \
+         fprintf(stderr, "FAIL: " __VA_ARGS__); \
+         fprintf(stderr, "\n");                 \
+         failures++;                            \
+      }                                         \
+   } while (0)
+
+/* Offsets of the fields tests corrupt, from the layout in filemngt.c */
+#define FILENAME_LEN_POS 0
+#define FILESIZE_POS sizeof(int)
+#define ENCODING_POS (sizeof(int) + 2 * sizeof(size_t))
+#define KEY_LEN_POS (ENCODING_POS + sizeof(int) + sizeof(uint32_t))
+#define FILENAME_POS (KEY_LEN_POS + sizeof(int))
+
+static char filename[MAX_PATH_LEN+1];
+static char sharedkey[MAX_NAME_LEN+1];
+static size_t filesize, raw_size;
+static int encoding;
+static uint32_t crc;
+
+/* Decodes the size bytes at data from a message of msg_len bytes */
+static int decode(char *data, size_t size, size_t msg_len)
+{
+   ldcs_message_t msg;
+   wire_t wire;
+
+   memset(&msg, 0, sizeof(msg));
+   msg.header.len = msg_len;
+   wire.data = data;
+   wire.size = size;
+   wire.pos = 0;
+   memset(filename, 'x', sizeof(filename));
+   memset(sharedkey, 'x', sizeof(sharedkey));
+   return filemngt_decode_packet(&wire, &msg, filename, &filesize, &raw_size, &encoding, &crc, sharedkey);
+}
+
+static void check_round_trip(char *name, size_t size, size_t raw, int enc, uint32_t sum, char *key)
+{
+   char *buffer = NULL;
+   size_t buffer_size, header_size;
+
+   CHECK(filemngt_encode_packet(name, NULL, size, raw, enc, sum, key, &buffer, &buffer_size) == 0,
+         "encoding %s", name);
+   if (!buffer)
+      return;
+   header_size = buffer_size - size;
+   CHECK(decode(buffer, header_size, buffer_size) == 0, "decoding %s", name);
+   CHECK(strcmp(filename, name) == 0, "%s came back as %s", name, filename);
+   CHECK(filesize == size && raw_size == raw, "%s came back with sizes %lu and %lu rather than %lu and %lu",
+         name, (unsigned long) filesize, (unsigned long) raw_size, (unsigned long) size, (unsigned long) raw);
+   CHECK(encoding == enc, "%s came back with encoding %d rather than %d", name, encoding, enc);
+   CHECK(crc == sum, "%s came back with crc %x rather than %x", name, crc, sum);
+   CHECK(strcmp(sharedkey, key ? key : "") == 0, "%s came back with key '%s'", name, sharedkey);
+   msgpool_free(buffer);
+}
+
+static void check_round_trips()
+{
+   char longname[MAX_PATH_LEN+1], longkey[MAX_NAME_LEN+1];
+
+   memset(longname, 'a', MAX_PATH_LEN);
+   longname[0] = '/';
+   longname[MAX_PATH_LEN] = '\0';
+   memset(longkey, 'k', MAX_NAME_LEN);
+   longkey[MAX_NAME_LEN] = '\0';
+
+   check_round_trip("/usr/lib64/libc.so.6", 2000000, 2000000, FILE_ENCODING_RAW, 0, NULL);
+   check_round_trip("/usr/lib64/libm.so.6", 300000, 900000, FILE_ENCODING_LZ, 0xdeadbeef, "0123abcd");
+   check_round_trip("/lib/libdelta.so", 12, 40000, FILE_ENCODING_DELTA, 0, "");
+   check_round_trip("/lib/libsparse.so", 4096, 1 << 30, FILE_ENCODING_SPARSE, 1, NULL);
+   check_round_trip("/", 0, 0, FILE_ENCODING_RAW, 0, NULL);
+   check_round_trip(longname, 1, 1, FILE_ENCODING_RAW, 0, longkey);
+}
+
+static void set_int(char *buffer, size_t pos, int value)
+{
+   memcpy(buffer + pos, &value, sizeof(value));
+}
+
+static void check_malformed()
+{
+   char *buffer = NULL, *copy;
+   size_t buffer_size, header_size, cut, big = 101;
+   char *name = "/usr/lib64/libz.so.1";
+   int name_len = strlen(name) + 1;
+
+   if (filemngt_encode_packet(name, NULL, 100, 100, FILE_ENCODING_RAW, 0, "key", &buffer, &buffer_size) == -1) {
+      CHECK(0, "encoding %s", name);
+      return;
+   }
+   header_size = buffer_size - 100;
+   copy = malloc(header_size);
+
+   for (cut = 0; cut < header_size; cut++) {
+      memcpy(copy, buffer, header_size);
+      CHECK(decode(copy, cut, buffer_size) == -1, "decoding a header cut to %lu of %lu bytes", (unsigned long) cut,
+            (unsigned long) header_size);
+   }
+
+   memcpy(copy, buffer, header_size);
+   set_int(copy, FILENAME_LEN_POS, 0);
+   CHECK(decode(copy, header_size, buffer_size) == -1, "decoding an empty filename");
+   set_int(copy, FILENAME_LEN_POS, -5);
+   CHECK(decode(copy, header_size, buffer_size) == -1, "decoding a filename of negative length");
+   set_int(copy, FILENAME_LEN_POS, MAX_PATH_LEN+2);
+   CHECK(decode(copy, header_size, buffer_size) == -1, "decoding a filename longer than MAX_PATH_LEN");
+
+   memcpy(copy, buffer, header_size);
+   set_int(copy, ENCODING_POS, FILE_ENCODING_SPARSE + 1);
+   CHECK(decode(copy, header_size, buffer_size) == -1, "decoding an unknown encoding");
+   set_int(copy, ENCODING_POS, -1);
+   CHECK(decode(copy, header_size, buffer_size) == -1, "decoding a negative encoding");
+
+   memcpy(copy, buffer, header_size);
+   set_int(copy, KEY_LEN_POS, -1);
+   CHECK(decode(copy, header_size, buffer_size) == -1, "decoding a key of negative length");
+   set_int(copy, KEY_LEN_POS, MAX_NAME_LEN+2);
+   CHECK(decode(copy, header_size, buffer_size) == -1, "decoding a key longer than MAX_NAME_LEN");
+
+   /* Whole contents of a size other than the file's would overrun its buffer */
+   memcpy(copy, buffer, header_size);
+   memcpy(copy + FILESIZE_POS, &big, sizeof(big));
+   CHECK(decode(copy, header_size, buffer_size + 1) == -1, "decoding whole contents larger than the file");
+
+   /* Contents that aren't the rest of the message */
+   memcpy(copy, buffer, header_size);
+   CHECK(decode(copy, header_size, buffer_size + 1) == -1, "decoding contents shorter than the message");
+   CHECK(decode(copy, header_size, buffer_size - 1) == -1, "decoding contents longer than the message");
+   CHECK(decode(copy, header_size, header_size - 1) == -1, "decoding a message shorter than its header");
+   CHECK(decode(copy, header_size, 3) == -1, "decoding a message shorter than its fixed fields");
+
+   /* Names without their NUL come back terminated */
+   memcpy(copy, buffer, header_size);
+   copy[FILENAME_POS + name_len - 1] = 'X';
+   copy[header_size - 1] = 'X';
+   CHECK(decode(copy, header_size, buffer_size) == 0, "decoding unterminated names");
+   CHECK(strlen(filename) == name_len - 1, "unterminated filename came back as %s", filename);
+   CHECK(strcmp(sharedkey, "key") == 0, "unterminated key came back as %s", sharedkey);
+
+   free(copy);
+   msgpool_free(buffer);
+}
+
+int main(int argc, char *argv[])
+{
+   check_round_trips();
+   check_malformed();
+
+   if (failures) {
+      fprintf(stderr, "%d packet checks failed\n", failures);
+      return 1;
+   }
+   printf("packet checks passed\n");
+   return 0;
+}
@@ -0,0 +1,158 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldcs_api.h"
+#include "pathfn.h"
+
+/**
+ * Checks that canonicalizePath and canonicalizeDir, which the server runs
+ * on every query's path, give what parseFilenameNoAlloc, addCWDToDir and
+ * reducePath did before them.  Paths whose directory reduces to the root
+ * are checked against what the one-pass code is documented to give
+ * instead, since reducePath left those unterminated.  Prints what failed
+ * and exits nonzero if anything did.
+ **/
+
+static int failures = 0;
+
+#define CHECK(COND, ...)                        \
+   do {                                         \
+      if (!(COND)) {                            \
+         fprintf(stderr, "FAIL: " __VA_ARGS__); \
+         fprintf(stderr, "\n");                 \
+         failures++;                            \
+      }                                         \
+   } while (0)
+
+static const char *cwds[] = { "/", "/home/user", "/home/user/", "/usr/./lib//", "/a/b/c/d" };
+static const char *parts[] = { "lib", "a", "..", ".", "", "x.so" };
+#define NUM_CWDS (sizeof(cwds) / sizeof(*cwds))
+#define NUM_PARTS (sizeof(parts) / sizeof(*parts))
+
+static int old_canonicalize(const char *cwd, const char *name, char *file, char *dir, int size)
+{
+   parseFilenameNoAlloc(name, file, dir, size);
+   addCWDToDir(cwd, dir, size);
+   return reducePath(dir);
+}
+
+static void check_path(const char *cwd, const char *name, int size)
+{
+   char old_file[MAX_PATH_LEN+1], old_dir[MAX_PATH_LEN+1];
+   char new_file[MAX_PATH_LEN+1], new_dir[MAX_PATH_LEN+1];
+   int old_result, new_result;
+
+   new_result = canonicalizePath(cwd, name, new_file, new_dir, size);
+   if (new_result == 0) {
+      /* The directory is the root, which reducePath can't give */
+      return;
+   }
+   old_result = old_canonicalize(cwd, name, old_file, old_dir, size);
+
+   CHECK(strcmp(old_file, new_file) == 0, "file of %s in %s is %s rather than %s", name, cwd, new_file, old_file);
+   CHECK(strcmp(old_dir, new_dir) == 0, "dir of %s in %s is %s rather than %s", name, cwd, new_dir, old_dir);
+   if (old_result == -1)
+      CHECK(new_result == -1, "%s in %s backs out of the root, but gave %d", name, cwd, new_result);
+   if (new_result != -1)
+      CHECK(new_result == (int) strlen(new_dir), "%s in %s gave length %d for %s", name, cwd, new_result, new_dir);
+}
+
+/* Every name of up to four parts, absolute and relative, in each cwd */
+static void check_against_old()
+{
+   char name[MAX_PATH_LEN+1];
+   size_t c, i, j, k, l, n;
+   int absolute;
+
+   for (c = 0; c < NUM_CWDS; c++) {
+      for (absolute = 0; absolute <= 1; absolute++) {
+         for (n = 1; n <= 4; n++) {
+            for (i = 0; i < NUM_PARTS; i++) {
+               for (j = 0; j < (n > 1 ? NUM_PARTS : 1); j++) {
+                  for (k = 0; k < (n > 2 ? NUM_PARTS : 1); k++) {
+                     for (l = 0; l < (n > 3 ? NUM_PARTS : 1); l++) {
+                        snprintf(name, sizeof(name), "%s%s%s%s%s%s%s%s/libz.so", absolute ? "/" : "",
+                                 parts[i], n > 1 ? "/" : "", n > 1 ? parts[j] : "",
+                                 n > 2 ? "/" : "", n > 2 ? parts[k] : "",
+                                 n > 3 ? "/" : "", n > 3 ? parts[l] : "");
+                        check_path(cwds[c], name, MAX_PATH_LEN);
+                     }
+                  }
+               }
+            }
+         }
+         check_path(cwds[c], "libz.so", MAX_PATH_LEN);
+      }
+   }
+}
+
+static void check_one(const char *cwd, const char *name, int size, int result, const char *file, const char *dir)
+{
+   char new_file[MAX_PATH_LEN+1], new_dir[MAX_PATH_LEN+1];
+   int new_result;
+
+   new_result = canonicalizePath(cwd, name, new_file, new_dir, size);
+   CHECK(new_result == result, "%s in %s gave %d rather than %d", name, cwd, new_result, result);
+   CHECK(strcmp(new_file, file) == 0, "file of %s in %s is %s rather than %s", name, cwd, new_file, file);
+   CHECK(strcmp(new_dir, dir) == 0, "dir of %s in %s is %s rather than %s", name, cwd, new_dir, dir);
+}
+
+static void check_edges()
+{
+   char dir[MAX_PATH_LEN+1];
+
+   /* A directory that is the root comes back empty, whatever the cwd */
+   check_one("/home/user", "/lib.so", MAX_PATH_LEN, 0, "lib.so", "");
+   check_one("/home/user", "/a/../lib.so", MAX_PATH_LEN, 0, "lib.so", "");
+   check_one("/home/user", "//lib.so", MAX_PATH_LEN, 0, "lib.so", "");
+   check_one("/home/user", "../../lib.so", MAX_PATH_LEN, 0, "lib.so", "");
+   check_one("/", "./lib.so", MAX_PATH_LEN, 0, "lib.so", "");
+
+   /* Backing out past the root fails, and leaves dir as the old calls did */
+   check_one("/home/user", "/../lib.so", MAX_PATH_LEN, -1, "lib.so", "/..");
+   check_one("/home/user", "../../../lib.so", MAX_PATH_LEN, -1, "lib.so", "/home/user/../../..");
+   check_one("/", "../lib.so", MAX_PATH_LEN, -1, "lib.so", "/..");
+   check_path("/home/user", "/a/../../lib.so", MAX_PATH_LEN);
+   check_path("/", "../lib.so", MAX_PATH_LEN);
+
+   /* Paths that don't fit */
+   check_path("/home/user", "/0123456789/0123456789/lib.so", 16);
+   check_path("/home/user", "0123456789/lib.so", 16);
+   check_path("/home/user", "/a/0123456789abcdefghij.so", 16);
+
+   CHECK(canonicalizeDir("/home/user", "../lib/./x", 10, dir, MAX_PATH_LEN) == 11 &&
+         strcmp(dir, "/home/lib/x") == 0, "canonicalizeDir of ../lib/./x gave %s", dir);
+   CHECK(canonicalizeDir("/home/user", "/..", 3, dir, MAX_PATH_LEN) == -1 &&
+         strcmp(dir, "/..") == 0, "canonicalizeDir of /.. gave %s", dir);
+}
+
+int main(int argc, char *argv[])
+{
+   check_against_old();
+   check_edges();
+
+   if (failures) {
+      fprintf(stderr, "%d pathfn checks failed\n", failures);
+      return 1;
+   }
+   printf("pathfn checks passed\n");
+   return 0;
+}